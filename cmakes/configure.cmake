@@ -16,4 +16,24 @@ if ("${BUILD_TYPE}" STREQUAL "debug")
 endif ()
 
 
-option(ENABLE_REDIS_TARGET "Enables redis target in event notifier" OFF)
\ No newline at end of file
+option(ENABLE_REDIS_TARGET "Enables redis target in event notifier and redis undelivered store" OFF)
+option(ENABLE_KAFKA_TARGET "Enables kafka target in event notifier" OFF)
+
+add_definitions(-DWSS_MIN_LOG_LEVEL=${WSS_MIN_LOG_LEVEL})
+if (ENABLE_ASYNC_LOG OR "${BUILD_TYPE}" STREQUAL "release" OR "${BUILD_TYPE}" STREQUAL "relwithprofiling")
+	add_definitions(-DWSS_ASYNC_LOG=1)
+endif ()
+
+if (ENABLE_PROFILER OR "${BUILD_TYPE}" STREQUAL "relwithprofiling")
+	check_include_file_cxx("execinfo.h" HAVE_PROFILER_EXECINFO_H)
+	check_include_file_cxx("cxxabi.h" HAVE_PROFILER_CXXABI_H)
+	if (HAVE_PROFILER_EXECINFO_H AND HAVE_PROFILER_CXXABI_H)
+		add_definitions(-DWSS_PROFILER=1)
+	else ()
+		message(WARNING "execinfo.h or cxxabi.h not found, SIGUSR2 profiler is disabled")
+	endif ()
+endif ()
+
+if (WITH_HOTPATH_PROFILING)
+	add_definitions(-DWSS_HOTPATH_PROFILING=1)
+endif ()
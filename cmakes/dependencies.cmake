@@ -9,6 +9,11 @@ find_package(Boost 1.54.0 COMPONENTS system thread random REQUIRED)
 if ("${CMAKE_CXX_COMPILER_ID}" STREQUAL "GNU" AND CMAKE_CXX_COMPILER_VERSION VERSION_LESS 4.9)
 	find_package(Boost 1.54.0 COMPONENTS regex REQUIRED)
 endif ()
+if (ENABLE_COROUTINES)
+	# boost::asio::spawn: stackful coroutines, C++20 ones are not available for C++14 server
+	find_package(Boost 1.54.0 COMPONENTS system thread random coroutine context REQUIRED)
+	add_definitions(-DWSS_ENABLE_COROUTINES -DBOOST_COROUTINES_NO_DEPRECATION_WARNING)
+endif ()
 
 
 # fmt
@@ -22,6 +27,10 @@ set(OPENSSL_USE_STATIC_LIBS ON)
 find_package(OpenSSL 1.1.0 REQUIRED)
 
 
+# zlib (websocket permessage-deflate)
+find_package(ZLIB REQUIRED)
+
+
 # ToolBox++
 add_subdirectory(${PROJECT_LIBS_DIR}/toolboxpp)
 set_target_properties(
@@ -82,6 +91,60 @@ if (ENABLE_REDIS_TARGET)
 	)
 endif ()
 
+if (ENABLE_IO_URING)
+	if (NOT CMAKE_SYSTEM_NAME STREQUAL "Linux")
+		message(FATAL_ERROR "io_uring is available only on Linux")
+	endif ()
+	if (Boost_MAJOR_VERSION EQUAL 1 AND Boost_MINOR_VERSION LESS 78)
+		message(FATAL_ERROR "io_uring backend requires Boost 1.78+")
+	endif ()
+	find_path(URING_INCLUDE_DIR liburing.h)
+	find_library(URING_LIBRARIES uring)
+	if (NOT URING_INCLUDE_DIR OR NOT URING_LIBRARIES)
+		message(FATAL_ERROR "liburing not found")
+	endif ()
+	# all asio sockets and timers go through io_uring, not only files
+	add_definitions(-DBOOST_ASIO_HAS_IO_URING -DBOOST_ASIO_DISABLE_EPOLL)
+endif ()
+
+if (ENABLE_JEMALLOC)
+	if (WITH_ASAN OR WITH_TSAN)
+		message(FATAL_ERROR "ENABLE_JEMALLOC can't be used with sanitizers: they replace malloc")
+	endif ()
+	find_library(JEMALLOC_LIBRARIES jemalloc)
+	if (NOT JEMALLOC_LIBRARIES)
+		message(FATAL_ERROR "libjemalloc not found")
+	endif ()
+endif ()
+
+if (ENABLE_ZSTD)
+	find_path(ZSTD_INCLUDE_DIR zdict.h)
+	find_library(ZSTD_LIBRARIES zstd)
+	if (NOT ZSTD_INCLUDE_DIR OR NOT ZSTD_LIBRARIES)
+		message(FATAL_ERROR "libzstd not found")
+	endif ()
+	add_definitions(-DWSS_ENABLE_ZSTD)
+endif ()
+
+if (ENABLE_HTTP2)
+	find_path(NGHTTP2_INCLUDE_DIR nghttp2/nghttp2.h)
+	find_library(NGHTTP2_LIBRARIES nghttp2)
+	if (NOT NGHTTP2_INCLUDE_DIR OR NOT NGHTTP2_LIBRARIES)
+		message(FATAL_ERROR "libnghttp2 not found")
+	endif ()
+	add_definitions(-DWSS_ENABLE_HTTP2)
+endif ()
+
+if (ENABLE_KAFKA_TARGET)
+	add_definitions(-DENABLE_KAFKA_TARGET)
+	# Kafka producer (librdkafka C api)
+	find_path(RDKAFKA_INCLUDE_DIR librdkafka/rdkafka.h)
+	find_library(RDKAFKA_LIBRARIES rdkafka)
+	if (NOT RDKAFKA_INCLUDE_DIR OR NOT RDKAFKA_LIBRARIES)
+		message(FATAL_ERROR "librdkafka not found")
+	endif ()
+endif ()
+
 function (linkdeps DEPS_PROJECT)
 	message(STATUS "Link libraries to target \"${DEPS_PROJECT}\":")
 
@@ -105,6 +168,11 @@ function (linkdeps DEPS_PROJECT)
 	target_include_directories(${DEPS_PROJECT} PUBLIC ${OPENSSL_INCLUDE_DIR})
 	message(STATUS "\t- openssl ${OPENSSL_VERSION} (${OPENSSL_LIBRARIES})")
 
+	# zlib
+	target_link_libraries(${DEPS_PROJECT} ${ZLIB_LIBRARIES})
+	target_include_directories(${DEPS_PROJECT} PUBLIC ${ZLIB_INCLUDE_DIRS})
+	message(STATUS "\t- zlib ${ZLIB_VERSION_STRING}")
+
 	# Toolbox++
 	target_link_libraries(${DEPS_PROJECT} toolboxpp)
 	target_include_directories(${DEPS_PROJECT} PUBLIC ${PROJECT_LIBS_DIR}/toolboxpp/include)
@@ -141,4 +209,34 @@ function (linkdeps DEPS_PROJECT)
 		target_include_directories(${DEPS_PROJECT} PUBLIC ${CMAKE_CURRENT_SOURCE_DIR}/libs/cpp_redis/includes)
 		message(STATUS "\t- cpp_redis")
 	endif ()
+
+	if (ENABLE_IO_URING)
+		target_link_libraries(${DEPS_PROJECT} ${URING_LIBRARIES})
+		target_include_directories(${DEPS_PROJECT} PUBLIC ${URING_INCLUDE_DIR})
+		message(STATUS "\t- liburing (${URING_LIBRARIES})")
+	endif ()
+
+	if (ENABLE_JEMALLOC)
+		# malloc and operator new of whole binary are resolved to jemalloc
+		target_link_libraries(${DEPS_PROJECT} ${JEMALLOC_LIBRARIES})
+		message(STATUS "\t- jemalloc (${JEMALLOC_LIBRARIES})")
+	endif ()
+
+	if (ENABLE_ZSTD)
+		target_link_libraries(${DEPS_PROJECT} ${ZSTD_LIBRARIES})
+		target_include_directories(${DEPS_PROJECT} PUBLIC ${ZSTD_INCLUDE_DIR})
+		message(STATUS "\t- zstd (${ZSTD_LIBRARIES})")
+	endif ()
+
+	if (ENABLE_HTTP2)
+		target_link_libraries(${DEPS_PROJECT} ${NGHTTP2_LIBRARIES})
+		target_include_directories(${DEPS_PROJECT} PUBLIC ${NGHTTP2_INCLUDE_DIR})
+		message(STATUS "\t- nghttp2 (${NGHTTP2_LIBRARIES})")
+	endif ()
+
+	if (ENABLE_KAFKA_TARGET)
+		target_link_libraries(${DEPS_PROJECT} ${RDKAFKA_LIBRARIES})
+		target_include_directories(${DEPS_PROJECT} PUBLIC ${RDKAFKA_INCLUDE_DIR})
+		message(STATUS "\t- librdkafka (${RDKAFKA_LIBRARIES})")
+	endif ()
 endfunction ()
\ No newline at end of file
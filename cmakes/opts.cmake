@@ -1,10 +1,25 @@
 
 # Project options
 option(ENABLE_SSL "Certifacates required" OFF)
-option(ENABLE_REDIS_TARGET "Enables event notifier Redis target (queue or pub/sub channel)" ON)
+option(ENABLE_REDIS_TARGET "Enables Redis: event notifier target (queue or pub/sub channel) and undelivered store" ON)
+option(ENABLE_KAFKA_TARGET "Enables Kafka event notifier target (system librdkafka required)" OFF)
+option(ENABLE_ASYNC_LOG "Write logs from background thread through ring buffer (always on for Release and RelWithProfiling)" OFF)
+set(WSS_MIN_LOG_LEVEL "0" CACHE STRING "Log records below level are not compiled: 0 - debug, 1 - info, 2 - warning, 3 - error")
+option(ENABLE_LTO "Link time optimization (always on for RelWithProfiling)" OFF)
+option(ENABLE_PROFILER "SIGUSR2 in-process sampling profiler (always on for RelWithProfiling)" OFF)
+option(ENABLE_IO_URING "Run asio reactor on io_uring instead of epoll (Linux 5.10+, Boost 1.78+, liburing required)" OFF)
+option(ENABLE_COROUTINES "Coroutine api for extensions: sequential async code on io service (Boost.Coroutine and Boost.Context required)" OFF)
+option(ENABLE_JEMALLOC "Link jemalloc instead of system malloc: per-thread arenas (system libjemalloc required)" OFF)
+option(ENABLE_ZSTD "zstd compression of undelivered store, event outbox and history log segments (libzstd required)" OFF)
+option(ENABLE_HTTP2 "Websockets over HTTP/2, RFC 8441 (system libnghttp2 required)" OFF)
+set(WSS_PGO "" CACHE STRING "Profile guided optimization: generate - instrumented build, use - build with collected profile")
+set(WSS_PGO_DIR "${CMAKE_BINARY_DIR}/pgo" CACHE PATH "Directory of PGO profile data")
 
 option(WITH_ARCH "Define target compile architecture" OFF)
 option(WITH_BENCHMARK "Compile benchmark (dev only)" OFF)
 option(WITH_TEST "Compile tests (dev only)" OFF)
+option(WITH_ASAN "AddressSanitizer and LeakSanitizer build, for tests and soak runs (dev only)" OFF)
+option(WITH_TSAN "ThreadSanitizer build, for concurrency stress tests (dev only)" OFF)
+option(WITH_HOTPATH_PROFILING "Wait and hold time of hot mutexes and counts of per-message allocations, GET /hotpath (dev only)" OFF)
 
 option(CMAKE_INSTALL_PREFIX "Install prefix" "/usr")
@@ -5,6 +5,44 @@ set(SERVER_SRC
     src/wsserver_core.h
     src/chat/Message.h
     src/chat/Message.cpp
+    src/chat/PayloadCodec.h
+    src/chat/PayloadCodec.cpp
+    src/chat/MessageType.h
+    src/chat/MessageType.cpp
+    src/chat/UndeliveredStore.h
+    src/chat/UndeliveredStore.cpp
+    src/chat/AckWindow.h
+    src/chat/AckWindow.cpp
+    src/chat/HistoryLog.h
+    src/chat/HistoryLog.cpp
+    src/chat/AttachmentStore.h
+    src/chat/AttachmentStore.cpp
+    src/chat/Snapshot.h
+    src/chat/Snapshot.cpp
+    src/chat/WriteBehindUndeliveredStore.h
+    src/chat/WriteBehindUndeliveredStore.cpp
+    src/chat/ClusterBus.h
+    src/chat/ClusterBridge.cpp
+    src/chat/ClusterBridge.h
+    src/chat/Handoff.cpp
+    src/chat/Handoff.h
+    src/chat/HashRing.cpp
+    src/chat/HashRing.h
+    src/chat/DeliveryScheduler.cpp
+    src/chat/DeliveryScheduler.h
+    src/chat/RecipientCache.cpp
+    src/chat/RecipientCache.h
+    src/chat/OutboundBatcher.cpp
+    src/chat/OutboundBatcher.h
+    src/chat/IngestServer.cpp
+    src/chat/IngestServer.h
+    src/chat/Http2Gateway.cpp
+    src/chat/Http2Gateway.h
+    src/chat/LocalIngest.cpp
+    src/chat/LocalIngest.h
+    src/chat/ClusterBus.cpp
+    src/chat/ClusterDirectory.h
+    src/chat/ClusterDirectory.cpp
     src/restapi/RestServer.cpp
     src/restapi/RestServer.h
     src/restapi/ChatRestServer.cpp
@@ -14,23 +52,66 @@ set(SERVER_SRC
     src/web/HttpClient.cpp
     src/web/HttpClient.h
     src/event/EventNotifier.h
+    src/event/EventOutbox.h
+    src/event/EventFilter.h
+    src/event/StreamTarget.h
     src/event/PostbackTarget.cpp
     src/event/PostbackTarget.h
     src/event/Target.hpp
     src/helpers/base64.cpp
     src/helpers/base64.h
+    src/helpers/logging.h
+    src/helpers/logging.cpp
     src/base/StandaloneService.h
     src/base/BaseServer.h
     src/base/StatusCode.hpp
     src/helpers/crypto.hpp
     src/helpers/utility.hpp
+    src/helpers/unmask.hpp
+    src/helpers/ring_queue.hpp
+    src/helpers/slab_pool.hpp
+    src/helpers/timer_wheel.hpp
+    src/helpers/token_bucket.hpp
+    src/helpers/rate_window.hpp
+    src/helpers/space_saving.hpp
+    src/helpers/flat_map.hpp
+    src/helpers/inline_vector.hpp
+    src/helpers/small_vector.hpp
     src/base/SocketLayerWrapper.hpp
+    src/base/UnixSocket.hpp
     src/base/ws/WebsocketServer.hpp
+    src/base/ws/PerMessageDeflate.hpp
+    src/base/ws/ProxyProtocol.hpp
+    src/base/ws/TlsSessionTickets.hpp
     src/base/http/HttpServer.h
     src/event/EventNotifier.cpp
+    src/event/EventOutbox.cpp
+    src/event/EventFilter.cpp
+    src/event/StreamTarget.cpp
     src/base/ServerStarter.cpp
     src/base/ServerStarter.h
     src/base/Settings.hpp
+    src/base/Async.hpp
+    src/base/Metrics.h
+    src/base/Metrics.cpp
+    src/base/Hotpath.h
+    src/base/Hotpath.cpp
+    src/base/TopK.h
+    src/base/TopK.cpp
+    src/base/Overload.h
+    src/base/Overload.cpp
+    src/base/Affinity.h
+    src/base/Affinity.cpp
+    src/base/SegmentCodec.h
+    src/base/SegmentCodec.cpp
+    src/base/WorkerPool.h
+    src/base/WorkerPool.cpp
+    src/base/Profiler.h
+    src/base/Profiler.cpp
+    src/base/TrafficCapture.h
+    src/base/TrafficCapture.cpp
+    src/base/Tracing.h
+    src/base/Tracing.cpp
     src/base/auth/Auth.h
     src/base/auth/Auth.cpp
     src/base/auth/OneOfAuth.cpp
@@ -47,10 +128,24 @@ set(SERVER_SRC
     src/base/auth/CookieAuth.h
     src/base/auth/RemoteAuth.cpp
     src/base/auth/RemoteAuth.h
+    src/base/auth/AuthCache.cpp
+    src/base/auth/AuthCache.h
+    src/base/auth/JwtAuth.cpp
+    src/base/auth/JwtAuth.h
     src/chat/ConnectionStorage.cpp
     src/chat/ConnectionStorage.h
+    src/chat/PresenceFeed.cpp
+    src/chat/PresenceFeed.h
+    src/chat/RoomStorage.cpp
+    src/chat/RoomStorage.h
+    src/chat/TopicStorage.cpp
+    src/chat/TopicStorage.h
+    src/chat/RateLimiter.cpp
+    src/chat/RateLimiter.h
     src/chat/Statistics.cpp
     src/chat/Statistics.h
+    src/chat/StatisticsStorage.cpp
+    src/chat/StatisticsStorage.h
     src/base/unid.cpp
     src/base/unid.h
     )
@@ -59,7 +154,18 @@ if (ENABLE_REDIS_TARGET)
 	set(SERVER_SRC
 	    ${SERVER_SRC}
 	    src/event/RedisTarget.cpp
-	    src/event/RedisTarget.h)
+	    src/event/RedisTarget.h
+	    src/chat/RedisUndeliveredStore.cpp
+	    src/chat/RedisUndeliveredStore.h
+	    src/chat/RedisClusterBridge.cpp
+	    src/chat/RedisClusterBridge.h)
+endif ()
+
+if (ENABLE_KAFKA_TARGET)
+	set(SERVER_SRC
+	    ${SERVER_SRC}
+	    src/event/KafkaTarget.cpp
+	    src/event/KafkaTarget.h)
 endif ()
 
 
@@ -77,9 +183,10 @@ set(WS_SERVER_SRC
     ${PROJECT_LIBS_DIR}/ws/server_wss.hpp
     )
 
+# header-only client of wssbench and backend services
 set(WS_CLIENT_SRC
-    ${PROJECT_LIBS_DIR}/ws/client_ws.hpp
-    ${PROJECT_LIBS_DIR}/ws/client_wss.hpp
+    src/client/Connection.hpp
+    src/client/Frame.hpp
     )
 
 set(HTTP_COMMON_SRC
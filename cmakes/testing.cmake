@@ -12,15 +12,40 @@ endif ()
 
 add_executable(${PROJECT_NAME_TEST} ${SERVER_EXEC_SRCS}
                tests/base/TestAuth.cpp
+               tests/base/TestClientFrame.cpp
+               tests/base/TestConnectionAdmission.cpp
+               tests/base/TestConnectionTable.cpp
+               tests/base/TestJwtAuth.cpp
+               tests/base/TestPerMessageDeflate.cpp
+               tests/base/TestProxyProtocol.cpp
+               tests/base/TestServerFrame.cpp
+               tests/chat/TestAckWindow.cpp
+               tests/chat/TestAttachments.cpp
+               tests/chat/TestClusterDirectory.cpp
+               tests/chat/TestHandoff.cpp
+               tests/chat/TestHashRing.cpp
+               tests/chat/TestMessagePayloadCodec.cpp
                )
 
 linkdeps(${PROJECT_NAME_TEST})
 
 include_directories(../src/server)
-target_include_directories(${PROJECT_NAME_TEST} PUBLIC ../src/server)
+target_include_directories(${PROJECT_NAME_TEST} PUBLIC ../src/server ${CMAKE_CURRENT_SOURCE_DIR})
 
 target_link_libraries(${PROJECT_NAME_TEST} gtest gtest_main)
 
+# multithreaded stress of shared structures, meant to be run in -DWITH_TSAN=On build
+add_executable(${PROJECT_NAME_TEST}-concurrency ${SERVER_EXEC_SRCS}
+               tests/base/TestUnid.cpp
+               tests/chat/TestConnectionStorage.cpp
+               tests/chat/TestMessagePayload.cpp
+               tests/chat/TestStatisticsStorage.cpp
+               )
+
+linkdeps(${PROJECT_NAME_TEST}-concurrency)
+target_include_directories(${PROJECT_NAME_TEST}-concurrency PUBLIC ${CMAKE_CURRENT_SOURCE_DIR})
+target_link_libraries(${PROJECT_NAME_TEST}-concurrency gtest gtest_main)
+
 include(cmakes/CodeCoverage.cmake)
 append_coverage_compiler_flags()
 
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+# Compares benchmark results with baseline, exit code 1 if any metric is out of its tolerance band.
+# Usage: compare.py baseline.json prefix=results.json [prefix=results.json...] [--update]
+# Results: flat wssbench JSON (-o), or Google Benchmark JSON (--benchmark_out): median real time, ns
+import json
+import sys
+
+TIME_UNITS = {"ns": 1.0, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def flatten(prefix, data):
+    out = {}
+    if "benchmarks" in data:
+        for item in data["benchmarks"]:
+            if item.get("run_type") == "aggregate" and item.get("aggregate_name") != "median":
+                continue
+            name = item.get("run_name", item["name"])
+            out[prefix + "." + name] = item["real_time"] * TIME_UNITS[item.get("time_unit", "ns")]
+        return out
+    for key, value in data.items():
+        if isinstance(value, (int, float)) and not isinstance(value, bool):
+            out[prefix + "." + key] = value
+    return out
+
+
+def main(argv):
+    update = "--update" in argv
+    args = [arg for arg in argv if arg != "--update"]
+    if len(args) < 2:
+        print("Usage: compare.py baseline.json prefix=results.json [prefix=results.json...] [--update]")
+        return 2
+
+    with open(args[0]) as f:
+        baseline = json.load(f)
+    current = {}
+    for arg in args[1:]:
+        prefix, path = arg.split("=", 1)
+        with open(path) as f:
+            current.update(flatten(prefix, json.load(f)))
+
+    defaults = baseline.get("tolerance", {})
+    failed = []
+    print("%-45s %14s %14s %9s  %s" % ("metric", "baseline", "current", "change", "status"))
+    for name, metric in sorted(baseline["metrics"].items()):
+        value = metric.get("value")
+        better = metric.get("better", "lower")
+        tolerance = metric.get("tolerance", defaults.get(better, 0.1))
+        if name not in current:
+            print("%-45s %14s %14s %9s  %s" % (name, "-" if value is None else value, "-", "", "not measured"))
+            continue
+        now = current[name]
+        if update:
+            metric["value"] = now
+        if value is None:
+            print("%-45s %14s %14.3f %9s  %s" % (name, "-", now, "", "no baseline"))
+            continue
+        change = (now - value) / value if value else (0.0 if now == value else float("inf"))
+        if better == "higher":
+            regressed = now < value * (1 - tolerance)
+        else:
+            regressed = now > value * (1 + tolerance)
+        status = "REGRESSION (tolerance %.0f%%)" % (tolerance * 100) if regressed else "ok"
+        print("%-45s %14.3f %14.3f %+8.1f%%  %s" % (name, value, now, change * 100, status))
+        if regressed:
+            failed.append(name)
+
+    if update:
+        with open(args[0], "w") as f:
+            json.dump(baseline, f, indent=2)
+            f.write("\n")
+        print("Baseline updated: " + args[0])
+        return 0
+    if failed:
+        print("%d metric(s) regressed: %s" % (len(failed), ", ".join(failed)))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv[1:]))
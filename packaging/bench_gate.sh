@@ -0,0 +1,45 @@
+#!/usr/bin/env bash
+# Benchmark regression gate: runs fixed benchmark profile against built server and compares results
+# with packaging/bench/baseline.json, fails if throughput or latency is out of tolerance.
+# Baseline must be recorded on the same (reference) host: packaging/bench_gate.sh /path/to/build --update
+# Usage: packaging/bench_gate.sh /path/to/build [--update]
+set -e
+
+BUILD=$(realpath ${1:?build dir required})
+shift
+ROOT=$(cd $(dirname $0)/.. && pwd)
+BENCH=${ROOT}/packaging/bench
+OUT=${BUILD}/bench-gate
+ENDPOINT=127.0.0.1:18085
+
+rm -rf ${OUT} && mkdir -p ${OUT}
+
+echo " -- Starting server"
+${BUILD}/wsserver -C ${BENCH}/config.json > ${OUT}/server.log 2>&1 &
+serverPid=$!
+trap "kill -INT ${serverPid} 2> /dev/null || true" EXIT
+sleep 2
+
+echo " -- Direct messages"
+${BUILD}/wssbench -e ${ENDPOINT} -c 2000 --ramp 2000 -r 20000 -d 20 --fanout 2 \
+	--payload-min 64 --payload-max 1024 --payload-dist exponential -T 2 \
+	--server-pid ${serverPid} -o ${OUT}/macro.json > ${OUT}/macro.log
+tail -n 20 ${OUT}/macro.log
+
+echo " -- Group messages"
+${BUILD}/wssbench -e ${ENDPOINT} -i 100000 -c 2050 --ramp 2000 -s 50 -f 100 -r 500 -d 20 -T 2 \
+	--server-pid ${serverPid} -o ${OUT}/group.json > ${OUT}/group.log
+tail -n 8 ${OUT}/group.log
+
+RESULTS="macro=${OUT}/macro.json group=${OUT}/group.json"
+if [ -x ${BUILD}/wssmicrobench ]
+then
+	echo " -- Micro-benchmarks"
+	${BUILD}/wssmicrobench --benchmark_repetitions=5 --benchmark_report_aggregates_only=true \
+		--benchmark_filter='BM_PayloadParse|BM_Unmask|BM_FrameCreate|BM_StorageForEach|BM_UnidNext|BM_Statistics|BM_Auth' \
+		--benchmark_out=${OUT}/micro.json --benchmark_out_format=json > ${OUT}/micro.log
+	RESULTS="${RESULTS} micro=${OUT}/micro.json"
+fi
+
+echo " -- Comparing with baseline"
+python3 ${BENCH}/compare.py ${BENCH}/baseline.json ${RESULTS} "$@"
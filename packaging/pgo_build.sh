@@ -0,0 +1,40 @@
+#!/usr/bin/env bash
+# Profile guided release build: instrumented server is trained by wssbench, then rebuilt with collected profile
+# Usage: packaging/pgo_build.sh /path/to/config.json [cmake args...]
+set -e
+
+CONFIG=$(realpath ${1:?config path required})
+shift
+ROOT=${PWD}
+GEN_DIR=${ROOT}/_build/pgo-generate
+USE_DIR=${ROOT}/_build/pgo-use
+PGO_DIR=${ROOT}/_build/pgo
+
+rm -rf ${PGO_DIR} && mkdir -p ${PGO_DIR}
+
+echo " -- Instrumented build"
+mkdir -p ${GEN_DIR} && cd ${GEN_DIR}
+cmake ${ROOT} -DCMAKE_BUILD_TYPE=RelWithProfiling -DWITH_BENCHMARK=On \
+	-DWSS_PGO=generate -DWSS_PGO_DIR=${PGO_DIR} "$@"
+make -j"$(nproc)"
+
+echo " -- Training"
+${GEN_DIR}/wsserver -C ${CONFIG} &
+serverPid=$!
+sleep 2
+${GEN_DIR}/wssbench -c 5000 --ramp 2000 -r 20000 -d 30 --fanout 2 \
+	--payload-min 64 --payload-max 4096 --payload-dist exponential || true
+# profile is written on normal exit only
+kill -INT ${serverPid}
+wait ${serverPid} || true
+
+if command -v llvm-profdata > /dev/null && ls ${PGO_DIR}/*.profraw > /dev/null 2>&1
+then
+	llvm-profdata merge -output=${PGO_DIR}/default.profdata ${PGO_DIR}/*.profraw
+fi
+
+echo " -- Optimized build"
+mkdir -p ${USE_DIR} && cd ${USE_DIR}
+cmake ${ROOT} -DCMAKE_BUILD_TYPE=RelWithProfiling \
+	-DWSS_PGO=use -DWSS_PGO_DIR=${PGO_DIR} "$@"
+make -j"$(nproc)"
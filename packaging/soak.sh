@@ -0,0 +1,59 @@
+#!/usr/bin/env bash
+# Soak test: mixed traffic against built server for hours, server process and structures are sampled
+# by packaging/soak/watch.py, which fails if any of them only grows. Build with -DWITH_ASAN=On to get
+# AddressSanitizer errors and LeakSanitizer report at server exit too.
+# Every cycle: direct messages with connection churn, group messages, reconnect storm. Each wssbench run
+# closes its connections, so state must come back to the same level between runs.
+# Usage: packaging/soak.sh /path/to/build [hours]
+set -e
+
+BUILD=$(realpath ${1:?build dir required})
+HOURS=${2:-4}
+ROOT=$(cd $(dirname $0)/.. && pwd)
+SOAK=${ROOT}/packaging/soak
+OUT=${BUILD}/soak
+ENDPOINT=127.0.0.1:18085
+
+rm -rf ${OUT} && mkdir -p ${OUT}
+deadline=$(( $(date +%s) + $(awk "BEGIN { print int(${HOURS} * 3600) }") ))
+
+echo " -- Starting server"
+ASAN_OPTIONS=detect_leaks=1:log_path=${OUT}/asan ${BUILD}/wsserver -C ${SOAK}/config.json > ${OUT}/server.log 2>&1 &
+serverPid=$!
+trap "kill -INT ${serverPid} 2> /dev/null || true" EXIT
+sleep 2
+
+python3 ${SOAK}/watch.py ${serverPid} http://127.0.0.1:18087/metrics ${OUT}/samples.csv > ${OUT}/watch.log &
+watchPid=$!
+
+cycle=0
+while [ $(date +%s) -lt ${deadline} ]
+do
+	cycle=$((cycle + 1))
+	echo " -- Cycle ${cycle}"
+	${BUILD}/wssbench -e ${ENDPOINT} -c 2000 --ramp 2000 -r 5000 -d 300 --fanout 2 --churn 50 \
+		--payload-min 64 --payload-max 4096 --payload-dist exponential -T 2 > ${OUT}/direct-${cycle}.log
+	grep -h "Received:" ${OUT}/direct-${cycle}.log || true
+	${BUILD}/wssbench -e ${ENDPOINT} -i 100000 -c 1050 --ramp 2000 -s 50 -f 100 -r 200 -d 120 -T 2 \
+		> ${OUT}/group-${cycle}.log
+	${BUILD}/wssbench -e ${ENDPOINT} -i 200000 -c 2000 --ramp 2000 -r 1000 -d 60 --storm -T 2 \
+		> ${OUT}/storm-${cycle}.log
+	# idle gap: window minima are taken from here
+	sleep 30
+done
+
+kill -TERM ${watchPid}
+status=0
+wait ${watchPid} || status=1
+cat ${OUT}/watch.log
+
+echo " -- Stopping server"
+kill -INT ${serverPid}
+wait ${serverPid} || true
+if ls ${OUT}/asan.* > /dev/null 2>&1
+then
+	echo "Sanitizer reports:"
+	cat ${OUT}/asan.*
+	status=1
+fi
+exit ${status}
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+# Samples server process and its structures while soak runs, then reports series which only grow.
+# Every interval: RSS, open descriptors and threads from /proc, wss_state_entries and wss_memory_bytes from
+# rest api GET /metrics. Samples are written to CSV until server exits or SIGTERM/SIGINT is received.
+# Growth: run without first (warm-up) window is split into windows, minimum of each window is taken (load peaks
+# are not leaks), series is flagged if minima grow window after window and last one is over first by tolerance.
+# Usage: watch.py pid http://127.0.0.1:18087/metrics samples.csv [--interval 10] [--windows 6] [--tolerance 0.1]
+# Exit code 1 if any series is flagged
+import argparse
+import csv
+import os
+import re
+import signal
+import sys
+import time
+import urllib.request
+
+METRIC = re.compile(r'^(wss_state_entries|wss_memory_bytes)\{[a-z]+="([a-z_]+)"\} (\S+)$')
+# connection counts follow load, not leaks: they are sampled, but not judged
+IGNORED = {"state.connections", "state.users", "memory.send_queues"}
+
+stopped = False
+metrics_failed = False
+
+
+def stop(signum, frame):
+    global stopped
+    stopped = True
+
+
+def sample_process(pid):
+    out = {}
+    with open("/proc/%d/statm" % pid) as f:
+        out["process.rss_bytes"] = int(f.read().split()[1]) * os.sysconf("SC_PAGE_SIZE")
+    out["process.fds"] = len(os.listdir("/proc/%d/fd" % pid))
+    with open("/proc/%d/status" % pid) as f:
+        for line in f:
+            if line.startswith("Threads:"):
+                out["process.threads"] = int(line.split()[1])
+    return out
+
+
+def sample_metrics(url):
+    out = {}
+    try:
+        with urllib.request.urlopen(url, timeout=5) as response:
+            for line in response.read().decode().splitlines():
+                match = METRIC.match(line)
+                if match:
+                    group = "state" if match.group(1) == "wss_state_entries" else "memory"
+                    out[group + "." + match.group(2)] = float(match.group(3))
+    except OSError as e:
+        global metrics_failed
+        if not metrics_failed:
+            print("metrics are not available: %s" % e, file=sys.stderr)
+        metrics_failed = True
+    return out
+
+
+def growing(values, windows, tolerance):
+    """Minima of windows after warm-up grow every time, and last is over first by tolerance"""
+    if len(values) < windows * 3:
+        return False, []
+    size = len(values) // (windows + 1)
+    minima = [min(values[(i + 1) * size:(i + 2) * size]) for i in range(windows)]
+    rising = all(later >= earlier for earlier, later in zip(minima, minima[1:]))
+    grown = minima[-1] > minima[0] * (1 + tolerance) + 1
+    return rising and grown, minima
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("pid", type=int)
+    parser.add_argument("metrics")
+    parser.add_argument("csv")
+    parser.add_argument("--interval", type=float, default=10)
+    parser.add_argument("--windows", type=int, default=6)
+    parser.add_argument("--tolerance", type=float, default=0.1)
+    args = parser.parse_args()
+
+    signal.signal(signal.SIGTERM, stop)
+    signal.signal(signal.SIGINT, stop)
+    series = {}
+    rows = []
+    started = time.time()
+    while not stopped:
+        try:
+            row = sample_process(args.pid)
+        except OSError:
+            # server exited
+            break
+        row.update(sample_metrics(args.metrics))
+        row["seconds"] = round(time.time() - started, 1)
+        rows.append(row)
+        for key, value in row.items():
+            series.setdefault(key, []).append(value)
+        time.sleep(args.interval)
+
+    columns = ["seconds"] + sorted(key for key in series if key != "seconds")
+    with open(args.csv, "w", newline="") as f:
+        writer = csv.DictWriter(f, fieldnames=columns)
+        writer.writeheader()
+        writer.writerows(rows)
+
+    flagged = 0
+    print("%-32s %14s %14s %s" % ("series", "first", "last", "window minima"))
+    for key in columns[1:]:
+        values = series[key]
+        grows, minima = growing(values, args.windows, args.tolerance)
+        judged = key not in IGNORED
+        flagged += grows and judged
+        mark = "GROWS" if grows and judged else ""
+        print("%-32s %14.0f %14.0f %s %s" % (key, values[0], values[-1],
+                                            " ".join("%.0f" % m for m in minima), mark))
+    print("%d samples written to %s" % (len(rows), args.csv))
+    if flagged:
+        print("%d series grow without going back" % flagged)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,117 @@
+/**
+ * wsserver
+ * Affinity.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "Affinity.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include "../helpers/logging.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+// written once by starter before threads are created, then only read
+std::array<std::vector<unsigned>, wss::affinity::GROUPS> groupCpus;
+
+const char *getGroupName(wss::affinity::Group group) {
+    switch (group) {
+        case wss::affinity::Group::Io:
+            return "io";
+        case wss::affinity::Group::Events:
+            return "events";
+        case wss::affinity::Group::Auth:
+            return "auth";
+        default:
+            return "background";
+    }
+}
+
+unsigned parseCpu(const std::string &value) {
+    if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos) {
+        throw std::invalid_argument("Invalid cpu: '" + value + "'");
+    }
+    const unsigned long cpu = std::stoul(value);
+#ifdef __linux__
+    if (cpu >= CPU_SETSIZE) {
+        throw std::invalid_argument("Cpu " + value + " is out of cpu set size");
+    }
+#endif
+    return static_cast<unsigned>(cpu);
+}
+
+void pinThread(wss::affinity::Group group, const unsigned *cpus, std::size_t count) noexcept {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (std::size_t i = 0; i < count; i++) {
+        CPU_SET(cpus[i], &set);
+    }
+    const int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (result != 0) {
+        WSS_LOG_F(wss::logging::LevelWarning, "Affinity", "Can't pin %s thread: %s",
+                  getGroupName(group), std::strerror(result));
+    }
+#else
+    (void) group;
+    (void) cpus;
+    (void) count;
+#endif
+}
+}
+
+std::vector<unsigned> wss::affinity::parse(const std::string &list) {
+    std::vector<unsigned> cpus;
+    std::size_t pos = 0;
+    while (pos < list.size()) {
+        const std::size_t end = std::min(list.find(',', pos), list.size());
+        const std::string item = list.substr(pos, end - pos);
+        const std::size_t dash = item.find('-');
+        if (dash == std::string::npos) {
+            cpus.push_back(parseCpu(item));
+        } else {
+            const unsigned first = parseCpu(item.substr(0, dash));
+            const unsigned last = parseCpu(item.substr(dash + 1));
+            if (last < first) {
+                throw std::invalid_argument("Invalid cpu range: '" + item + "'");
+            }
+            for (unsigned cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        }
+        pos = end + 1;
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+void wss::affinity::setCpus(Group group, std::vector<unsigned> cpus) {
+    groupCpus[static_cast<std::size_t>(group)] = std::move(cpus);
+}
+
+const std::vector<unsigned> &wss::affinity::getCpus(Group group) {
+    return groupCpus[static_cast<std::size_t>(group)];
+}
+
+void wss::affinity::pin(Group group) noexcept {
+    const std::vector<unsigned> &cpus = getCpus(group);
+    if (!cpus.empty()) {
+        pinThread(group, cpus.data(), cpus.size());
+    }
+}
+
+void wss::affinity::pinOne(Group group, std::size_t index) noexcept {
+    const std::vector<unsigned> &cpus = getCpus(group);
+    if (!cpus.empty()) {
+        pinThread(group, &cpus[index % cpus.size()], 1);
+    }
+}
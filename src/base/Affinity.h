@@ -0,0 +1,57 @@
+/**
+ * wsserver
+ * Affinity.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_AFFINITY_H
+#define WSSERVER_AFFINITY_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace wss {
+namespace affinity {
+
+/// \brief Thread groups, each one can be pinned to its own cores
+enum class Group : int {
+  /// \brief Websocket event loops: delivery
+  Io = 0,
+  /// \brief Event notifier workers, outbox and kafka poller
+  Events,
+  /// \brief Http client driver: remote authorization and webhooks
+  Auth,
+  /// \brief Throttle, snapshot, delivery statuses and undelivered store writers
+  Background
+};
+constexpr std::size_t GROUPS = 4;
+
+/// \brief Parses cpu list like "0-3,8,10-11"
+/// \param list
+/// \return sorted unique cpus, empty if list is empty
+/// \throws std::invalid_argument if list is malformed or cpu is out of cpu set size
+std::vector<unsigned> parse(const std::string &list);
+
+/// \brief Sets cores of group. Must be called before threads are started, empty - threads are not pinned
+/// \param group
+/// \param cpus
+void setCpus(Group group, std::vector<unsigned> cpus);
+const std::vector<unsigned> &getCpus(Group group);
+
+/// \brief Pins calling thread to all cores of group. Memory, that thread touches first, is allocated
+/// by kernel (default local policy) on numa node of these cores
+/// \param group
+void pin(Group group) noexcept;
+
+/// \brief Pins calling thread to single core of group: index % cores. Used by event loops, one loop per core
+/// \param group
+/// \param index thread index in pool
+void pinOne(Group group, std::size_t index) noexcept;
+
+}
+}
+
+#endif //WSSERVER_AFFINITY_H
@@ -0,0 +1,101 @@
+/**
+ * wsserver
+ * Async.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_ASYNC_HPP
+#define WSSERVER_ASYNC_HPP
+
+/// \brief Optional coroutine layer (-DENABLE_COROUTINES=On): extension code (auth, targets, actions) is written
+/// as sequential code on io service, every async step suspends coroutine instead of nesting callbacks
+/// or blocking thread. Stackful boost coroutines are used, because server is C++14
+#ifdef WSS_ENABLE_COROUTINES
+
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/spawn.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include "../helpers/logging.h"
+
+namespace wss {
+namespace async {
+
+using Strand = boost::asio::io_service::strand;
+
+/// \brief Running coroutine: strand it runs on and its yield. Valid only inside coroutine
+struct Context {
+  Strand &strand;
+  boost::asio::yield_context yield;
+};
+
+/// \brief Starts coroutine on strand. Exception of coroutine is logged, not thrown to io service
+/// \param strand must live while coroutine runs
+/// \param fn void(wss::async::Context &)
+template<typename Fn>
+void spawn(Strand &strand, Fn &&fn) {
+    boost::asio::spawn(strand, [&strand, fn = std::forward<Fn>(fn)](boost::asio::yield_context yield) mutable {
+      Context context{strand, yield};
+      try {
+          fn(context);
+      } catch (const std::exception &e) {
+          WSS_LOG_F(wss::logging::LevelError, "Async", "Coroutine failed: %s", e.what());
+      }
+    });
+}
+
+/// \brief Suspends coroutine for duration, io thread is not blocked
+template<typename Rep, typename Period>
+void sleepFor(Context &context, const std::chrono::duration<Rep, Period> &duration) {
+    boost::asio::steady_timer timer(context.strand.get_io_service(), duration);
+    boost::system::error_code ec;
+    timer.async_wait(context.yield[ec]);
+}
+
+/// \brief Suspends coroutine until callback-style operation completes: adapts existing async api
+/// (validateAuthAsync, executeAsync etc) to sequential code. Completion may be called from any thread,
+/// coroutine is resumed on its strand
+/// \tparam T result type, must be default constructible
+/// \param context
+/// \param start void(std::function<void(T)> done): starts operation, done must be called once
+/// \return value passed to done
+template<typename T, typename Start>
+T await(Context &context, Start &&start) {
+    struct State {
+      explicit State(boost::asio::io_service &service) :
+          timer(service, boost::asio::steady_timer::time_point::max()) { }
+      boost::asio::steady_timer timer;
+      bool done = false;
+      T value{};
+    };
+    auto state = std::make_shared<State>(context.strand.get_io_service());
+    Strand &strand = context.strand;
+    start(std::function<void(T)>([state, &strand](T value) {
+      // state is changed on coroutine strand only: coroutine is suspended or hasn't checked it yet
+      auto shared = std::make_shared<T>(std::move(value));
+      strand.post([state, shared] {
+        state->value = std::move(*shared);
+        state->done = true;
+        state->timer.cancel();
+      });
+    }));
+    while (!state->done) {
+        boost::system::error_code ec;
+        state->timer.async_wait(context.yield[ec]);
+    }
+    return std::move(state->value);
+}
+
+}
+}
+
+#endif // WSS_ENABLE_COROUTINES
+
+#endif //WSSERVER_ASYNC_HPP
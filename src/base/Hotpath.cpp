@@ -0,0 +1,211 @@
+/**
+ * wsserver
+ * Hotpath.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "Hotpath.h"
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+const char *wss::hotpath::nameOf(LockSite site) noexcept {
+    switch (site) {
+        case LockSite::Connections:
+            return "connections";
+        case LockSite::Statistics:
+            return "statistics";
+        case LockSite::Undelivered:
+            return "undelivered";
+        case LockSite::EndpointConnections:
+            return "endpoint_connections";
+        case LockSite::TimeoutWheel:
+            return "timeout_wheel";
+        default:
+            return "unknown";
+    }
+}
+
+const char *wss::hotpath::nameOf(AllocSite site) noexcept {
+    switch (site) {
+        case AllocSite::SendStream:
+            return "send_stream";
+        case AllocSite::Message:
+            return "message";
+        case AllocSite::MessagePayload:
+            return "message_payload";
+        default:
+            return "unknown";
+    }
+}
+
+#ifdef WSS_HOTPATH_PROFILING
+
+namespace {
+
+using namespace wss::hotpath;
+
+/// \brief Stats of one thread. Written only by owner thread (maximums are also reset by collect)
+struct Slot {
+  struct Lock {
+    std::atomic<uint64_t> acquisitions{0};
+    std::atomic<uint64_t> contended{0};
+    std::atomic<uint64_t> waitNanos{0};
+    std::atomic<uint64_t> holdNanos{0};
+    std::atomic<uint64_t> maxWaitNanos{0};
+    std::atomic<uint64_t> maxHoldNanos{0};
+  };
+  struct Alloc {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> frees{0};
+    std::atomic<uint64_t> bytes{0};
+  };
+
+  std::array<Lock, LOCK_SITES> locks;
+  std::array<Alloc, ALLOC_SITES> allocations;
+
+  void addTo(Snapshot &out) const noexcept {
+      for (std::size_t i = 0; i < LOCK_SITES; i++) {
+          LockStats &target = out.locks[i];
+          target.acquisitions += locks[i].acquisitions.load(std::memory_order_relaxed);
+          target.contended += locks[i].contended.load(std::memory_order_relaxed);
+          target.waitNanos += locks[i].waitNanos.load(std::memory_order_relaxed);
+          target.holdNanos += locks[i].holdNanos.load(std::memory_order_relaxed);
+      }
+      for (std::size_t i = 0; i < ALLOC_SITES; i++) {
+          AllocStats &target = out.allocations[i];
+          target.allocations += allocations[i].allocations.load(std::memory_order_relaxed);
+          target.frees += allocations[i].frees.load(std::memory_order_relaxed);
+          target.bytes += allocations[i].bytes.load(std::memory_order_relaxed);
+      }
+  }
+
+  void takeMaximums(Snapshot &out) noexcept {
+      for (std::size_t i = 0; i < LOCK_SITES; i++) {
+          LockStats &target = out.locks[i];
+          target.maxWaitNanos = std::max(target.maxWaitNanos, locks[i].maxWaitNanos.exchange(0));
+          target.maxHoldNanos = std::max(target.maxHoldNanos, locks[i].maxHoldNanos.exchange(0));
+      }
+  }
+};
+
+inline void increment(std::atomic<uint64_t> &value, uint64_t delta) noexcept {
+    // single writer: plain load and store instead of locked fetch_add
+    value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+inline void raiseMax(std::atomic<uint64_t> &value, uint64_t candidate) noexcept {
+    if (candidate > value.load(std::memory_order_relaxed)) {
+        value.store(candidate, std::memory_order_relaxed);
+    }
+}
+
+inline uint64_t nanosOf(std::chrono::steady_clock::duration duration) noexcept {
+    const auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    return nanos > 0 ? static_cast<uint64_t>(nanos) : 0;
+}
+
+/// \brief Slots of running threads and sum of finished ones
+class Registry {
+ public:
+    static Registry &get() {
+        // never destroyed: threads could finish after static destructors
+        static Registry *registry = new Registry();
+        return *registry;
+    }
+
+    void attach(Slot *slot) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_slots.push_back(slot);
+    }
+
+    void detach(Slot *slot) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        slot->addTo(m_finished);
+        slot->takeMaximums(m_finished);
+        m_slots.erase(std::remove(m_slots.begin(), m_slots.end(), slot), m_slots.end());
+    }
+
+    Snapshot collect() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Snapshot out = m_finished;
+        for (Slot *slot: m_slots) {
+            slot->addTo(out);
+            slot->takeMaximums(out);
+        }
+        for (auto &site: m_finished.locks) {
+            site.maxWaitNanos = 0;
+            site.maxHoldNanos = 0;
+        }
+        return out;
+    }
+
+ private:
+    std::mutex m_mutex;
+    std::vector<Slot *> m_slots;
+    Snapshot m_finished;
+};
+
+struct ThreadSlot {
+  Slot slot;
+
+  ThreadSlot() {
+      Registry::get().attach(&slot);
+  }
+  ~ThreadSlot() {
+      Registry::get().detach(&slot);
+  }
+};
+
+Slot &local() {
+    thread_local ThreadSlot threadSlot;
+    return threadSlot.slot;
+}
+
+}
+
+void wss::hotpath::recordLock(LockSite site, bool contended, std::chrono::steady_clock::duration wait,
+                              std::chrono::steady_clock::duration hold) noexcept {
+    Slot::Lock &target = local().locks[static_cast<std::size_t>(site)];
+    const uint64_t waitNanos = nanosOf(wait);
+    const uint64_t holdNanos = nanosOf(hold);
+    increment(target.acquisitions, 1);
+    if (contended) {
+        increment(target.contended, 1);
+    }
+    increment(target.waitNanos, waitNanos);
+    increment(target.holdNanos, holdNanos);
+    raiseMax(target.maxWaitNanos, waitNanos);
+    raiseMax(target.maxHoldNanos, holdNanos);
+}
+
+void wss::hotpath::recordAllocation(AllocSite site, std::size_t bytes) noexcept {
+    Slot::Alloc &target = local().allocations[static_cast<std::size_t>(site)];
+    increment(target.allocations, 1);
+    increment(target.bytes, bytes);
+}
+
+void wss::hotpath::recordFree(AllocSite site) noexcept {
+    increment(local().allocations[static_cast<std::size_t>(site)].frees, 1);
+}
+
+wss::hotpath::Snapshot wss::hotpath::collect() {
+    return Registry::get().collect();
+}
+
+#else
+
+void wss::hotpath::recordLock(LockSite, bool, std::chrono::steady_clock::duration,
+                              std::chrono::steady_clock::duration) noexcept { }
+
+void wss::hotpath::recordAllocation(AllocSite, std::size_t) noexcept { }
+
+void wss::hotpath::recordFree(AllocSite) noexcept { }
+
+wss::hotpath::Snapshot wss::hotpath::collect() {
+    return Snapshot();
+}
+
+#endif
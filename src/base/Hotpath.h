@@ -0,0 +1,180 @@
+/**
+ * wsserver
+ * Hotpath.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_HOTPATH_H
+#define WSSERVER_HOTPATH_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace wss {
+namespace hotpath {
+
+/// \brief Whether build records hot path sites (-DWITH_HOTPATH_PROFILING=On). Without it wrappers below are
+/// plain locks and empty bases, nothing is recorded
+#ifdef WSS_HOTPATH_PROFILING
+constexpr bool ENABLED = true;
+#else
+constexpr bool ENABLED = false;
+#endif
+
+/// \brief Mutexes shared by connections threads
+enum class LockSite : std::size_t {
+  /// \brief Connection storage shard: user -> connections
+  Connections = 0,
+  /// \brief Statistics storage shard
+  Statistics,
+  /// \brief Memory undelivered store shard
+  Undelivered,
+  /// \brief Endpoint connections list shard, taken on open and close
+  EndpointConnections,
+  /// \brief Idle timeouts and keepalive pings wheel of event loop
+  TimeoutWheel,
+  Count
+};
+
+/// \brief Objects created per message
+enum class AllocSite : std::size_t {
+  /// \brief Outgoing frame payload bigger than inline one
+  SendStream = 0,
+  /// \brief Incoming websocket message
+  Message,
+  MessagePayload,
+  Count
+};
+
+constexpr std::size_t LOCK_SITES = static_cast<std::size_t>(LockSite::Count);
+constexpr std::size_t ALLOC_SITES = static_cast<std::size_t>(AllocSite::Count);
+
+struct LockStats {
+  uint64_t acquisitions = 0;
+  /// \brief Acquisitions which had to wait: try_lock failed
+  uint64_t contended = 0;
+  uint64_t waitNanos = 0;
+  uint64_t holdNanos = 0;
+  /// \brief Since previous collect()
+  uint64_t maxWaitNanos = 0;
+  uint64_t maxHoldNanos = 0;
+};
+
+struct AllocStats {
+  uint64_t allocations = 0;
+  uint64_t frees = 0;
+  /// \brief Object bytes of allocations, buffers owned by objects are not included
+  uint64_t bytes = 0;
+
+  uint64_t live() const noexcept {
+      return allocations > frees ? allocations - frees : 0;
+  }
+};
+
+struct Snapshot {
+  std::array<LockStats, LOCK_SITES> locks{};
+  std::array<AllocStats, ALLOC_SITES> allocations{};
+
+  const LockStats &get(LockSite site) const noexcept {
+      return locks[static_cast<std::size_t>(site)];
+  }
+  const AllocStats &get(AllocSite site) const noexcept {
+      return allocations[static_cast<std::size_t>(site)];
+  }
+};
+
+/// \brief Site name for reports: "connections", "send_stream", ...
+const char *nameOf(LockSite site) noexcept;
+const char *nameOf(AllocSite site) noexcept;
+
+/// \brief Records one lock of site to slot of calling thread (as wss::metrics counters: no shared writes)
+/// \param site
+/// \param contended
+/// \param wait
+/// \param hold
+void recordLock(LockSite site, bool contended, std::chrono::steady_clock::duration wait,
+                std::chrono::steady_clock::duration hold) noexcept;
+
+void recordAllocation(AllocSite site, std::size_t bytes) noexcept;
+void recordFree(AllocSite site) noexcept;
+
+/// \brief Sums slots of all threads, including finished ones. Maximums are reset: next snapshot has maximums
+/// since this call (update racing with reset could be lost)
+/// \return empty snapshot if build has no profiling
+Snapshot collect();
+
+/// \brief Lock (std::unique_lock or std::shared_lock), taken by constructor, that records wait and hold time of site
+/// in profiling build, and is just Lock otherwise. Lock can be unlocked and locked again by its own methods,
+/// every hold is recorded
+template<typename Lock, LockSite Site>
+class ProfiledLock : public Lock {
+ public:
+    using mutex_type = typename Lock::mutex_type;
+
+#ifdef WSS_HOTPATH_PROFILING
+    explicit ProfiledLock(mutex_type &mutex) :
+        Lock(mutex, std::defer_lock) {
+        lock();
+    }
+
+    ~ProfiledLock() {
+        if (this->owns_lock()) {
+            unlock();
+        }
+    }
+
+    void lock() {
+        const auto started = std::chrono::steady_clock::now();
+        m_contended = !Lock::try_lock();
+        if (m_contended) {
+            Lock::lock();
+        }
+        m_acquired = std::chrono::steady_clock::now();
+        m_wait = m_acquired - started;
+    }
+
+    void unlock() {
+        Lock::unlock();
+        recordLock(Site, m_contended, m_wait, std::chrono::steady_clock::now() - m_acquired);
+    }
+
+ private:
+    bool m_contended = false;
+    std::chrono::steady_clock::time_point m_acquired;
+    std::chrono::steady_clock::duration m_wait{};
+#else
+    explicit ProfiledLock(mutex_type &mutex) :
+        Lock(mutex) { }
+#endif
+};
+
+/// \brief Base of Owner, that counts its constructions (copies and moves too) and destructions in profiling build,
+/// and is empty otherwise
+template<AllocSite Site, typename Owner>
+class Tracked {
+#ifdef WSS_HOTPATH_PROFILING
+ protected:
+    Tracked() noexcept {
+        recordAllocation(Site, sizeof(Owner));
+    }
+    Tracked(const Tracked &) noexcept :
+        Tracked() { }
+    Tracked(Tracked &&) noexcept :
+        Tracked() { }
+    Tracked &operator=(const Tracked &) noexcept = default;
+    Tracked &operator=(Tracked &&) noexcept = default;
+    ~Tracked() {
+        recordFree(Site);
+    }
+#endif
+};
+
+}
+}
+
+#endif //WSSERVER_HOTPATH_H
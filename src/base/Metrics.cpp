@@ -0,0 +1,182 @@
+/**
+ * wsserver
+ * Metrics.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "Metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+const std::array<double, wss::metrics::BUCKETS> wss::metrics::BUCKET_BOUNDS = {{
+    0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005,
+    0.001, 0.0025, 0.005, 0.01, 0.025, 0.05,
+    0.1, 0.25, 0.5, 1, 2.5, 5
+}};
+
+namespace {
+
+using namespace wss::metrics;
+
+/// \brief Memory gauge on its own cache line: different subsystems are updated by different threads at once
+struct MemoryGauge {
+  std::atomic<int64_t> bytes{0};
+  char padding[64 - sizeof(std::atomic<int64_t>)];
+};
+
+std::array<MemoryGauge, MEMORY_GAUGES> memoryGauges;
+std::atomic<uint64_t> memorySoftLimit(0);
+
+/// \brief Counters of one thread. Written only by owner thread, atomics are used just to read them safely on collect
+struct Slot {
+  struct Histogram {
+    std::array<std::atomic<uint64_t>, BUCKETS + 1> buckets;
+    std::atomic<uint64_t> sumNanos;
+  };
+
+  std::array<std::atomic<uint64_t>, COUNTERS> counters;
+  std::array<Histogram, HISTOGRAMS> histograms;
+
+  Slot() noexcept {
+      for (auto &counter: counters) {
+          counter.store(0, std::memory_order_relaxed);
+      }
+      for (auto &histogram: histograms) {
+          for (auto &bucket: histogram.buckets) {
+              bucket.store(0, std::memory_order_relaxed);
+          }
+          histogram.sumNanos.store(0, std::memory_order_relaxed);
+      }
+  }
+
+  void addTo(Snapshot &out) const noexcept {
+      for (std::size_t i = 0; i < COUNTERS; i++) {
+          out.counters[i] += counters[i].load(std::memory_order_relaxed);
+      }
+      for (std::size_t i = 0; i < HISTOGRAMS; i++) {
+          HistogramSnapshot &target = out.histograms[i];
+          for (std::size_t b = 0; b <= BUCKETS; b++) {
+              const uint64_t value = histograms[i].buckets[b].load(std::memory_order_relaxed);
+              target.buckets[b] += value;
+              target.count += value;
+          }
+          target.sum += histograms[i].sumNanos.load(std::memory_order_relaxed) / 1e9;
+      }
+  }
+};
+
+inline void increment(std::atomic<uint64_t> &value, uint64_t delta) noexcept {
+    // single writer: plain load and store instead of locked fetch_add
+    value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+/// \brief Slots of running threads and sum of finished ones
+class Registry {
+ public:
+    static Registry &get() {
+        // never destroyed: threads could finish after static destructors
+        static Registry *registry = new Registry();
+        return *registry;
+    }
+
+    void attach(const Slot *slot) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_slots.push_back(slot);
+    }
+
+    void detach(const Slot *slot) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        slot->addTo(m_finished);
+        m_slots.erase(std::remove(m_slots.begin(), m_slots.end(), slot), m_slots.end());
+    }
+
+    Snapshot collect() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Snapshot out = m_finished;
+        for (const Slot *slot: m_slots) {
+            slot->addTo(out);
+        }
+        return out;
+    }
+
+ private:
+    std::mutex m_mutex;
+    std::vector<const Slot *> m_slots;
+    Snapshot m_finished;
+};
+
+struct ThreadSlot {
+  Slot slot;
+
+  ThreadSlot() {
+      Registry::get().attach(&slot);
+  }
+  ~ThreadSlot() {
+      Registry::get().detach(&slot);
+  }
+};
+
+Slot &local() {
+    thread_local ThreadSlot threadSlot;
+    return threadSlot.slot;
+}
+
+}
+
+void wss::metrics::add(Counter counter, uint64_t value) noexcept {
+    increment(local().counters[static_cast<std::size_t>(counter)], value);
+}
+
+void wss::metrics::observe(Histogram histogram, std::chrono::steady_clock::duration duration) noexcept {
+    const double seconds = std::chrono::duration<double>(duration).count();
+    const std::size_t bucket = std::lower_bound(BUCKET_BOUNDS.begin(), BUCKET_BOUNDS.end(), seconds)
+        - BUCKET_BOUNDS.begin();
+
+    Slot::Histogram &target = local().histograms[static_cast<std::size_t>(histogram)];
+    increment(target.buckets[bucket], 1);
+    const auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    increment(target.sumNanos, static_cast<uint64_t>(std::max<decltype(nanos)>(nanos, 0)));
+}
+
+wss::metrics::Snapshot wss::metrics::collect() {
+    return Registry::get().collect();
+}
+
+void wss::metrics::acquire(Memory memory, std::size_t bytes) noexcept {
+    memoryGauges[static_cast<std::size_t>(memory)].bytes.fetch_add(static_cast<int64_t>(bytes),
+                                                                   std::memory_order_relaxed);
+}
+
+void wss::metrics::release(Memory memory, std::size_t bytes) noexcept {
+    memoryGauges[static_cast<std::size_t>(memory)].bytes.fetch_sub(static_cast<int64_t>(bytes),
+                                                                   std::memory_order_relaxed);
+}
+
+int64_t wss::metrics::getMemory(Memory memory) noexcept {
+    return memoryGauges[static_cast<std::size_t>(memory)].bytes.load(std::memory_order_relaxed);
+}
+
+int64_t wss::metrics::getMemoryTotal() noexcept {
+    int64_t out = 0;
+    for (const auto &gauge: memoryGauges) {
+        out += gauge.bytes.load(std::memory_order_relaxed);
+    }
+    return out;
+}
+
+void wss::metrics::setMemorySoftLimit(uint64_t bytes) noexcept {
+    memorySoftLimit.store(bytes, std::memory_order_relaxed);
+}
+
+uint64_t wss::metrics::getMemorySoftLimit() noexcept {
+    return memorySoftLimit.load(std::memory_order_relaxed);
+}
+
+bool wss::metrics::isOverMemorySoftLimit() noexcept {
+    const uint64_t limit = memorySoftLimit.load(std::memory_order_relaxed);
+    return limit > 0 && getMemoryTotal() > static_cast<int64_t>(limit);
+}
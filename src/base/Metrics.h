@@ -0,0 +1,172 @@
+/**
+ * wsserver
+ * Metrics.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_METRICS_H
+#define WSSERVER_METRICS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace wss {
+namespace metrics {
+
+/// \brief Server-wide monotonic counters
+enum class Counter : std::size_t {
+  ConnectionsAccepted = 0,
+  ConnectionsClosed,
+  FramesIn,
+  FramesOut,
+  BytesIn,
+  BytesOut,
+  /// \brief Connections, events and undelivered messages rejected because memory soft limit is reached
+  MemoryShed,
+  /// \brief Connections rejected because event loop lag is over limit
+  LagShed,
+  /// \brief Connections closed with redirect, because user belongs to other node of shard ring
+  ShardRedirects,
+  /// \brief Statistics and undelivered messages sent to other node by drain handoff
+  HandoffSent,
+  /// \brief Statistics and undelivered messages received from draining nodes
+  HandoffReceived,
+  /// \brief Connections closed because of missing or invalid PROXY protocol header
+  ProxyHeaderRejected,
+  /// \brief Connections closed right after accept: source address has too many open connections or opens them too often
+  AdmissionRejectedConnections,
+  AdmissionRejectedRate,
+  /// \brief Connections closed because upgrade request is not a GET or its head is over limit
+  HandshakeRejected,
+  /// \brief Overload controller: upgrades answered with 503, bulk messages dropped, rest requests answered with 429
+  OverloadRejectedConnections,
+  OverloadShedMessages,
+  OverloadRejectedRequests,
+  /// \brief Statistics of long offline users removed from storage
+  StatisticsExpired,
+  /// \brief Socket writes sent with MSG_ZEROCOPY, and those of them, that kernel has copied anyway
+  ZeroCopyWrites,
+  ZeroCopyCopied,
+  Count
+};
+
+/// \brief Server-wide latency histograms
+enum class Histogram : std::size_t {
+  AuthLatency = 0,
+  /// \brief Message read from socket -> payload decoded
+  MessageParse,
+  /// \brief Payload routing: recipients lookup and frames queued to their connections
+  MessageRoute,
+  /// \brief Frame waiting in connection send queue before write
+  MessageQueueWait,
+  /// \brief Socket write of frames
+  MessageWrite,
+  /// \brief Message read from socket -> its frame written to recipient socket
+  MessageEndToEnd,
+  /// \brief Posted no-op waiting behind ready handlers of event loop
+  EventLoopLag,
+  Count
+};
+
+/// \brief Subsystems, which bytes are accounted
+enum class Memory : std::size_t {
+  /// \brief Frames waiting in connections send queues
+  SendQueues = 0,
+  /// \brief Connections read buffers, by their largest use: streambuf never gives memory back
+  ReadBuffers,
+  /// \brief Fragmented messages being reassembled
+  FragmentBuffers,
+  /// \brief Memory undelivered store bodies
+  Undelivered,
+  /// \brief Events waiting for notifier worker
+  EventQueue,
+  /// \brief Users statistics entries
+  Statistics,
+  /// \brief Open connections objects, held by endpoint connections list
+  Connections,
+  Count
+};
+
+constexpr std::size_t COUNTERS = static_cast<std::size_t>(Counter::Count);
+constexpr std::size_t MEMORY_GAUGES = static_cast<std::size_t>(Memory::Count);
+constexpr std::size_t HISTOGRAMS = static_cast<std::size_t>(Histogram::Count);
+constexpr std::size_t BUCKETS = 18;
+
+/// \brief Upper bounds of histogram buckets in seconds, log-scaled from 10us to 5s.
+/// Last bucket (+Inf) is not included
+extern const std::array<double, BUCKETS> BUCKET_BOUNDS;
+
+struct HistogramSnapshot {
+  /// \brief Not cumulative: buckets[i] is count of values in (BUCKET_BOUNDS[i-1], BUCKET_BOUNDS[i]],
+  /// buckets[BUCKETS] - greater than last bound
+  std::array<uint64_t, BUCKETS + 1> buckets{};
+  uint64_t count = 0;
+  /// \brief Seconds
+  double sum = 0;
+};
+
+struct Snapshot {
+  std::array<uint64_t, COUNTERS> counters{};
+  std::array<HistogramSnapshot, HISTOGRAMS> histograms{};
+
+  uint64_t get(Counter counter) const noexcept {
+      return counters[static_cast<std::size_t>(counter)];
+  }
+  const HistogramSnapshot &get(Histogram histogram) const noexcept {
+      return histograms[static_cast<std::size_t>(histogram)];
+  }
+};
+
+/// \brief Adds value to counter of calling thread. Every thread writes only own counters, without locked
+/// read-modify-write, so hot paths don't contend. Counters are summed only by collect()
+/// \param counter
+/// \param value
+void add(Counter counter, uint64_t value = 1) noexcept;
+
+/// \brief Puts duration to histogram of calling thread
+/// \param histogram
+/// \param duration
+void observe(Histogram histogram, std::chrono::steady_clock::duration duration) noexcept;
+
+/// \brief Sums counters of all threads, including finished ones
+/// \return
+Snapshot collect();
+
+/// \brief Accounts bytes taken by subsystem. Memory is often released by other thread than taken it,
+/// so these gauges are shared relaxed atomics (one cache line each), not thread slots
+/// \param memory
+/// \param bytes
+void acquire(Memory memory, std::size_t bytes) noexcept;
+
+/// \brief Accounts bytes given back by subsystem
+/// \param memory
+/// \param bytes
+void release(Memory memory, std::size_t bytes) noexcept;
+
+/// \brief Bytes held by subsystem now
+/// \param memory
+/// \return
+int64_t getMemory(Memory memory) noexcept;
+
+/// \brief Bytes held by all subsystems
+/// \return
+int64_t getMemoryTotal() noexcept;
+
+/// \brief Sets soft memory limit: when accounted bytes are over it, new connections, events and undelivered
+/// messages are shed before process is killed by OOM
+/// \param bytes 0 - no limit
+void setMemorySoftLimit(uint64_t bytes) noexcept;
+
+uint64_t getMemorySoftLimit() noexcept;
+
+/// \brief Whether accounted bytes are over soft limit. Costs MEMORY_GAUGES relaxed loads
+/// \return false if limit is not set
+bool isOverMemorySoftLimit() noexcept;
+
+}
+}
+
+#endif //WSSERVER_METRICS_H
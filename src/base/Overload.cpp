@@ -0,0 +1,92 @@
+/**
+ * wsserver
+ * Overload.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "Overload.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+const int LEVEL_MAX = static_cast<int>(wss::OverloadLevel::RejectApi);
+}
+
+wss::OverloadController::OverloadController(const Options &options) :
+    m_options(options) {
+    if (options.lagMillis == 0 && options.memoryBytes == 0 && options.sendQueueBytes == 0) {
+        throw std::invalid_argument("At least one of lag, memory or send queue limits must be set");
+    }
+    if (options.rejectConnections <= 0
+        || options.shedBulk < options.rejectConnections
+        || options.rejectApi < options.shedBulk) {
+        throw std::invalid_argument("Level thresholds must be positive and ascending");
+    }
+    if (options.recovery <= 0 || options.recovery > 1.0) {
+        throw std::invalid_argument("Recovery ratio must be in range (0, 1]");
+    }
+}
+
+wss::OverloadLevel wss::OverloadController::update(const Sample &sample) {
+    double pressure = 0;
+    if (m_options.lagMillis > 0) {
+        pressure = std::max(pressure, sample.lagMicros / (m_options.lagMillis * 1000.0));
+    }
+    if (m_options.memoryBytes > 0) {
+        pressure = std::max(pressure, static_cast<double>(sample.memoryBytes) / m_options.memoryBytes);
+    }
+    if (m_options.sendQueueBytes > 0) {
+        pressure = std::max(pressure, static_cast<double>(sample.sendQueueBytes) / m_options.sendQueueBytes);
+    }
+    m_pressure.store(pressure, std::memory_order_relaxed);
+
+    const int current = m_level.load(std::memory_order_relaxed);
+    int level = current;
+    while (level < LEVEL_MAX && pressure >= getThreshold(level + 1)) {
+        level++;
+    }
+    // going down passes one level per sample: shed traffic comes back gradually
+    if (level == current && level > 0 && pressure < getThreshold(level) * m_options.recovery) {
+        level--;
+    }
+    if (level != current) {
+        m_level.store(level, std::memory_order_relaxed);
+        m_transitions.fetch_add(1, std::memory_order_relaxed);
+    }
+    return static_cast<OverloadLevel>(level);
+}
+
+wss::OverloadLevel wss::OverloadController::getLevel() const noexcept {
+    return static_cast<OverloadLevel>(m_level.load(std::memory_order_relaxed));
+}
+
+bool wss::OverloadController::isAtLeast(OverloadLevel level) const noexcept {
+    return m_level.load(std::memory_order_relaxed) >= static_cast<int>(level);
+}
+
+double wss::OverloadController::getPressure() const noexcept {
+    return m_pressure.load(std::memory_order_relaxed);
+}
+
+uint64_t wss::OverloadController::getTransitions() const noexcept {
+    return m_transitions.load(std::memory_order_relaxed);
+}
+
+const wss::OverloadController::Options &wss::OverloadController::getOptions() const noexcept {
+    return m_options;
+}
+
+double wss::OverloadController::getThreshold(int level) const noexcept {
+    switch (static_cast<OverloadLevel>(level)) {
+        case OverloadLevel::RejectConnections:
+            return m_options.rejectConnections;
+        case OverloadLevel::ShedBulk:
+            return m_options.shedBulk;
+        case OverloadLevel::RejectApi:
+            return m_options.rejectApi;
+        default:
+            return 0;
+    }
+}
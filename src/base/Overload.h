@@ -0,0 +1,80 @@
+/**
+ * wsserver
+ * Overload.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_OVERLOAD_H
+#define WSSERVER_OVERLOAD_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace wss {
+
+/// \brief Degradation steps, each one includes previous
+enum class OverloadLevel : int {
+  Normal = 0,
+  /// \brief New websocket upgrades are answered with 503
+  RejectConnections,
+  /// \brief Messages of bulk priority types are dropped
+  ShedBulk,
+  /// \brief Rest api answers 429, except metrics and status
+  RejectApi
+};
+
+/// \brief Global overload controller: load signals are turned to pressure (largest signal / its limit),
+/// pressure to level. Level is updated by one thread (see update()), read by any thread with one relaxed load
+class OverloadController {
+ public:
+    struct Options {
+      /// \brief Event loop lag at pressure 1, 0 - not used
+      uint32_t lagMillis = 0;
+      /// \brief Accounted memory at pressure 1, 0 - not used
+      uint64_t memoryBytes = 0;
+      /// \brief Bytes in all send queues at pressure 1, 0 - not used
+      uint64_t sendQueueBytes = 0;
+      /// \brief Pressure of each level
+      double rejectConnections = 1.0;
+      double shedBulk = 1.25;
+      double rejectApi = 1.5;
+      /// \brief Level goes down when pressure is below its threshold multiplied by this, so it doesn't flap
+      double recovery = 0.9;
+    };
+
+    struct Sample {
+      int64_t lagMicros = 0;
+      uint64_t memoryBytes = 0;
+      uint64_t sendQueueBytes = 0;
+    };
+
+    /// \throws std::invalid_argument if no signal is set, thresholds are not ascending or recovery is not in (0, 1]
+    explicit OverloadController(const Options &options);
+
+    /// \brief Computes level of sample. Single writer
+    /// \param sample
+    /// \return new level
+    OverloadLevel update(const Sample &sample);
+
+    OverloadLevel getLevel() const noexcept;
+    bool isAtLeast(OverloadLevel level) const noexcept;
+    /// \brief Pressure of last sample
+    double getPressure() const noexcept;
+    /// \brief Level changes since start
+    uint64_t getTransitions() const noexcept;
+    const Options &getOptions() const noexcept;
+
+ private:
+    const Options m_options;
+    std::atomic<int> m_level{0};
+    std::atomic<double> m_pressure{0};
+    std::atomic<uint64_t> m_transitions{0};
+
+    double getThreshold(int level) const noexcept;
+};
+
+}
+
+#endif //WSSERVER_OVERLOAD_H
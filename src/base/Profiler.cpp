@@ -0,0 +1,202 @@
+/**
+ * wsserver
+ * Profiler.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "Profiler.h"
+
+#ifdef WSS_PROFILER
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <semaphore.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "../helpers/logging.h"
+
+namespace {
+
+constexpr int MAX_DEPTH = 64;
+/// \brief Profiler handler and signal trampoline frames on top of every sample
+constexpr int SKIP_FRAMES = 2;
+
+struct Sample {
+  /// \brief Written last by signal handler, 0 - sample is not complete
+  std::atomic<int> depth;
+  void *frames[MAX_DEPTH];
+};
+
+wss::profiler::Config config;
+std::unique_ptr<Sample[]> samples;
+std::atomic<std::size_t> nextSample(0);
+std::atomic<bool> sampling(false);
+/// \brief Posted by SIGUSR2 handler: sem_post is async-signal-safe, so work is done by profiler thread
+sem_t toggle;
+
+void onProf(int) {
+    if (!sampling.load(std::memory_order_acquire)) {
+        return;
+    }
+    const int savedErrno = errno;
+    const std::size_t index = nextSample.fetch_add(1, std::memory_order_relaxed);
+    if (index < config.maxSamples) {
+        Sample &sample = samples[index];
+        sample.depth.store(backtrace(sample.frames, MAX_DEPTH), std::memory_order_release);
+    }
+    errno = savedErrno;
+}
+
+void onToggle(int) {
+    sem_post(&toggle);
+}
+
+void setTimer(uint32_t frequencyHz) {
+    struct itimerval timer{};
+    if (frequencyHz > 0) {
+        timer.it_interval.tv_usec = static_cast<suseconds_t>(1000000 / std::min<uint32_t>(frequencyHz, 1000000));
+        timer.it_value = timer.it_interval;
+    }
+    setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+std::string symbolOf(void *address) {
+    Dl_info info;
+    if (dladdr(address, &info) == 0 || info.dli_sname == nullptr) {
+        char buffer[32];
+        std::snprintf(buffer, sizeof(buffer), "%p", address);
+        return buffer;
+    }
+
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string out = status == 0 && demangled != nullptr ? demangled : info.dli_sname;
+    std::free(demangled);
+    // frame separator of collapsed format
+    std::replace(out.begin(), out.end(), ';', ':');
+    return out;
+}
+
+void start() {
+    // value-initialized: depth of every sample is 0
+    samples.reset(new Sample[config.maxSamples]());
+    nextSample.store(0);
+    sampling.store(true, std::memory_order_release);
+    setTimer(config.frequencyHz);
+    WSS_LOG_F(wss::logging::LevelInfo, "Profiler", "Sampling started, %u Hz", config.frequencyHz);
+}
+
+void stopAndWrite() {
+    setTimer(0);
+    sampling.store(false, std::memory_order_release);
+    // handlers running on other threads finish their samples
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    const std::size_t count = std::min(nextSample.load(), config.maxSamples);
+    std::map<std::vector<void *>, uint64_t> stacks;
+    for (std::size_t i = 0; i < count; i++) {
+        const Sample &sample = samples[i];
+        const int depth = sample.depth.load(std::memory_order_acquire);
+        if (depth <= SKIP_FRAMES) {
+            continue;
+        }
+        // collapsed stack goes from root to leaf
+        std::vector<void *> stack(sample.frames + SKIP_FRAMES, sample.frames + depth);
+        std::reverse(stack.begin(), stack.end());
+        stacks[std::move(stack)]++;
+    }
+    samples.reset();
+
+    const std::string path = config.outputDir + "/wsserver-" + std::to_string(getpid()) + "-"
+        + std::to_string(std::time(nullptr)) + ".folded";
+    // different return addresses of the same functions are one line of output
+    std::map<void *, std::string> symbols;
+    std::map<std::string, uint64_t> lines;
+    for (const auto &stack: stacks) {
+        std::string line;
+        for (void *address: stack.first) {
+            auto it = symbols.find(address);
+            if (it == symbols.end()) {
+                it = symbols.emplace(address, symbolOf(address)).first;
+            }
+            if (!line.empty()) {
+                line += ';';
+            }
+            line += it->second;
+        }
+        lines[line] += stack.second;
+    }
+
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        WSS_LOG_F(wss::logging::LevelError, "Profiler", "Can't write profile to %s", path.c_str());
+        return;
+    }
+    for (const auto &line: lines) {
+        out << line.first << ' ' << line.second << '\n';
+    }
+    WSS_LOG_F(wss::logging::LevelInfo, "Profiler", "Sampling stopped, %zu samples written to %s",
+              count, path.c_str());
+}
+
+void run() {
+    while (true) {
+        if (sem_wait(&toggle) != 0) {
+            continue;
+        }
+        if (sampling.load()) {
+            stopAndWrite();
+        } else {
+            start();
+        }
+    }
+}
+
+}
+
+bool wss::profiler::install(const Config &value) {
+    static std::atomic<bool> installed(false);
+    if (installed.exchange(true)) {
+        return true;
+    }
+    config = value;
+    config.maxSamples = std::max<std::size_t>(config.maxSamples, 1);
+    sem_init(&toggle, 0, 0);
+    // first call loads unwinder and allocates: it must not happen in signal handler
+    void *warmup[1];
+    backtrace(warmup, 1);
+
+    struct sigaction action{};
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    action.sa_handler = &onProf;
+    sigaction(SIGPROF, &action, nullptr);
+    action.sa_handler = &onToggle;
+    sigaction(SIGUSR2, &action, nullptr);
+
+    std::thread(run).detach();
+    return true;
+}
+
+#else
+
+bool wss::profiler::install(const Config &) {
+    return false;
+}
+
+#endif
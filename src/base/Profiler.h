@@ -0,0 +1,38 @@
+/**
+ * wsserver
+ * Profiler.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_PROFILER_H
+#define WSSERVER_PROFILER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace wss {
+namespace profiler {
+
+struct Config {
+  /// \brief Where collapsed stacks are written: {dir}/wsserver-{pid}-{unix time}.folded
+  std::string outputDir = "/tmp";
+  /// \brief CPU time samples per second of process
+  uint32_t frequencyHz = 99;
+  /// \brief Samples kept by one session, later samples are dropped
+  std::size_t maxSamples = 100000;
+};
+
+/// \brief Installs SIGUSR2 handler: first signal starts CPU sampling (SIGPROF timer, stack is taken by backtrace()),
+/// next one stops it and writes stacks in collapsed format (flamegraph.pl, speedscope), one line per unique stack.
+/// Requires frame pointers (RelWithProfiling build) for complete stacks. Does nothing where execinfo is not available
+/// \param config
+/// \return false if profiler is not supported by build
+bool install(const Config &config);
+
+}
+}
+
+#endif //WSSERVER_PROFILER_H
@@ -0,0 +1,304 @@
+/**
+ * wsserver
+ * SegmentCodec.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "SegmentCodec.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fmt/format.h>
+#include "../helpers/logging.h"
+
+#ifdef WSS_ENABLE_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
+constexpr uint32_t wss::SegmentCodec::COMPRESSED;
+
+namespace {
+std::runtime_error systemError(const std::string &what, const std::string &path) {
+    return std::runtime_error(fmt::format("{0} {1}: {2}", what, path, std::strerror(errno)));
+}
+
+#ifdef WSS_ENABLE_ZSTD
+/// \brief Larger records are not used as samples, they would take whole sample budget
+const std::size_t MAX_SAMPLE_BYTES = 64 * 1024;
+/// \brief Decompressed record can't be larger than record length field allows
+const unsigned long long MAX_RECORD_BYTES = wss::SegmentCodec::COMPRESSED - 1;
+
+/// \brief Contexts are reused by all codecs of thread: they keep no state between frames
+struct Contexts {
+  Contexts() :
+      compress(ZSTD_createCCtx()),
+      decompress(ZSTD_createDCtx()) {
+  }
+  ~Contexts() {
+      ZSTD_freeCCtx(compress);
+      ZSTD_freeDCtx(decompress);
+  }
+  ZSTD_CCtx *const compress;
+  ZSTD_DCtx *const decompress;
+};
+
+Contexts &contexts() {
+    thread_local Contexts value;
+    return value;
+}
+#endif
+}
+
+struct wss::SegmentCodec::Dictionary {
+  uint32_t id = 0;
+#ifdef WSS_ENABLE_ZSTD
+  ~Dictionary() {
+      ZSTD_freeCDict(cdict);
+      ZSTD_freeDDict(ddict);
+  }
+  ZSTD_CDict *cdict = nullptr;
+  ZSTD_DDict *ddict = nullptr;
+#endif
+};
+
+wss::SegmentCodec::SegmentCodec(const std::string &directory, const Options &options) :
+    m_directory(directory),
+    m_options(options) {
+    load();
+}
+
+wss::SegmentCodec::~SegmentCodec() = default;
+
+bool wss::SegmentCodec::isAvailable() noexcept {
+#ifdef WSS_ENABLE_ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::string wss::SegmentCodec::dictionaryPath(uint64_t file) const {
+    return fmt::format("{0}/{1:020d}.zdict", m_directory, file);
+}
+
+void wss::SegmentCodec::load() {
+#ifdef WSS_ENABLE_ZSTD
+    std::vector<uint64_t> files;
+    DIR *dir = ::opendir(m_directory.c_str());
+    if (dir == nullptr) {
+        throw systemError("Unable to read dictionaries directory", m_directory);
+    }
+    while (const dirent *item = ::readdir(dir)) {
+        const std::string name(item->d_name);
+        if (name.size() == 26 && name.compare(20, 6, ".zdict") == 0
+            && std::all_of(name.begin(), name.begin() + 20, ::isdigit)) {
+            files.push_back(std::stoull(name.substr(0, 20)));
+        }
+    }
+    ::closedir(dir);
+    std::sort(files.begin(), files.end());
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (uint64_t file: files) {
+        const std::string path = dictionaryPath(file);
+        FILE *in = std::fopen(path.c_str(), "rb");
+        if (in == nullptr) {
+            throw systemError("Unable to open dictionary", path);
+        }
+        std::string content;
+        char buffer[4096];
+        std::size_t read;
+        while ((read = std::fread(buffer, 1, sizeof(buffer), in)) > 0) {
+            content.append(buffer, read);
+        }
+        std::fclose(in);
+
+        DictionaryPtr dictionary = installLocked(std::move(content));
+        if (!dictionary) {
+            throw std::runtime_error("Invalid dictionary " + path);
+        }
+        // the newest one is used for new records
+        m_current = dictionary;
+        m_nextFile = file + 1;
+    }
+#endif
+}
+
+wss::SegmentCodec::DictionaryPtr wss::SegmentCodec::installLocked(std::string &&content) {
+#ifdef WSS_ENABLE_ZSTD
+    const auto id = static_cast<uint32_t>(ZDICT_getDictID(content.data(), content.size()));
+    if (id == 0 || m_dictionaries.find(id) != m_dictionaries.end()) {
+        return nullptr;
+    }
+    auto dictionary = std::make_shared<Dictionary>();
+    dictionary->id = id;
+    dictionary->cdict = ZSTD_createCDict(content.data(), content.size(), m_options.level);
+    dictionary->ddict = ZSTD_createDDict(content.data(), content.size());
+    if (dictionary->cdict == nullptr || dictionary->ddict == nullptr) {
+        return nullptr;
+    }
+    m_dictionaries[id] = dictionary;
+    return dictionary;
+#else
+    (void) content;
+    return nullptr;
+#endif
+}
+
+void wss::SegmentCodec::train(const std::string &samples, const std::vector<std::size_t> &sizes) {
+#ifdef WSS_ENABLE_ZSTD
+    std::string content(m_options.dictionaryBytes, '\0');
+    const std::size_t size = ZDICT_trainFromBuffer(&content[0], content.size(), samples.data(), sizes.data(),
+                                                   static_cast<unsigned>(sizes.size()));
+    if (ZDICT_isError(size)) {
+        WSS_LOG_F(wss::logging::LevelWarning, "SegmentCodec", "Unable to train dictionary for %s: %s",
+                  m_directory.c_str(), ZDICT_getErrorName(size));
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_training = false;
+        m_sinceTrained = 0;
+        return;
+    }
+    content.resize(size);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_training = false;
+    m_sinceTrained = 0;
+    // dictionary must be on disk before any record refers to it
+    const std::string path = dictionaryPath(m_nextFile);
+    const std::string tmpPath = path + ".tmp";
+    const int fd = ::open(tmpPath.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+    bool written = fd >= 0;
+    for (std::size_t offset = 0; written && offset < content.size();) {
+        const ssize_t n = ::write(fd, content.data() + offset, content.size() - offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        written = n > 0;
+        offset += written ? static_cast<std::size_t>(n) : 0;
+    }
+    written = written && ::fdatasync(fd) == 0;
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    if (!written || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        WSS_LOG_F(wss::logging::LevelError, "SegmentCodec", "Unable to write dictionary %s: %s",
+                  path.c_str(), std::strerror(errno));
+        ::unlink(tmpPath.c_str());
+        return;
+    }
+
+    DictionaryPtr dictionary = installLocked(std::move(content));
+    if (!dictionary) {
+        // id collision with older dictionary: keep using current one
+        ::unlink(path.c_str());
+        return;
+    }
+    m_nextFile++;
+    m_current = dictionary;
+    WSS_LOG_F(wss::logging::LevelInfo, "SegmentCodec", "Dictionary %u (%lu bytes, %lu samples) is trained for %s",
+              dictionary->id, size, sizes.size(), m_directory.c_str());
+#else
+    (void) samples;
+    (void) sizes;
+#endif
+}
+
+bool wss::SegmentCodec::compress(const char *data, std::size_t length, std::string &out) {
+#ifdef WSS_ENABLE_ZSTD
+    if (!m_options.enabled) {
+        return false;
+    }
+
+    DictionaryPtr dictionary;
+    std::string samples;
+    std::vector<std::size_t> sizes;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        dictionary = m_current;
+        if (dictionary) {
+            m_sinceTrained++;
+        }
+        const bool sampling = !m_training
+            && (!dictionary || (m_options.retrainRecords > 0 && m_sinceTrained >= m_options.retrainRecords));
+        if (sampling && length <= MAX_SAMPLE_BYTES) {
+            m_samples.append(data, length);
+            m_sampleSizes.push_back(length);
+            if (m_sampleSizes.size() >= m_options.trainSamples) {
+                m_training = true;
+                samples.swap(m_samples);
+                sizes.swap(m_sampleSizes);
+            }
+        }
+    }
+    if (!sizes.empty()) {
+        // once per dictionary, this record is still compressed by previous one
+        train(samples, sizes);
+    }
+    if (!dictionary || length < m_options.minBytes) {
+        return false;
+    }
+
+    out.resize(ZSTD_compressBound(length));
+    const std::size_t size = ZSTD_compress_usingCDict(contexts().compress, &out[0], out.size(), data, length,
+                                                      dictionary->cdict);
+    if (ZSTD_isError(size) || size >= length) {
+        return false;
+    }
+    out.resize(size);
+    m_rawBytes += length;
+    m_compressedBytes += size;
+    return true;
+#else
+    (void) data;
+    (void) length;
+    (void) out;
+    return false;
+#endif
+}
+
+bool wss::SegmentCodec::decompress(const char *data, std::size_t length, std::string &out) const {
+#ifdef WSS_ENABLE_ZSTD
+    const auto id = static_cast<uint32_t>(ZSTD_getDictID_fromFrame(data, length));
+    DictionaryPtr dictionary;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        const auto it = m_dictionaries.find(id);
+        if (it != m_dictionaries.end()) {
+            dictionary = it->second;
+        }
+    }
+    if (!dictionary) {
+        return false;
+    }
+
+    const unsigned long long size = ZSTD_getFrameContentSize(data, length);
+    if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN || size > MAX_RECORD_BYTES) {
+        return false;
+    }
+    out.resize(static_cast<std::size_t>(size));
+    const std::size_t written = ZSTD_decompress_usingDDict(contexts().decompress, &out[0], out.size(), data, length,
+                                                           dictionary->ddict);
+    return !ZSTD_isError(written) && written == size;
+#else
+    (void) data;
+    (void) length;
+    (void) out;
+    return false;
+#endif
+}
+
+uint64_t wss::SegmentCodec::getRawBytes() const noexcept {
+    return m_rawBytes;
+}
+uint64_t wss::SegmentCodec::getCompressedBytes() const noexcept {
+    return m_compressedBytes;
+}
@@ -0,0 +1,114 @@
+/**
+ * wsserver
+ * SegmentCodec.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_SEGMENTCODEC_H
+#define WSSERVER_SEGMENTCODEC_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace wss {
+
+/// \brief zstd compression of records of segmented logs (undelivered store, event outbox, history log).
+/// Envelopes are small documents with the same keys: one by one they hardly shrink, so they are compressed
+/// with dictionary trained on first records of the same log (and again on fresh ones every retrainRecords).
+/// Every record stays a separate zstd frame: readers decompress only records they need, record offsets,
+/// checksums and torn tail recovery work as before. Dictionaries are written next to segments as NNN.zdict
+/// before first record uses them and are never deleted (kilobytes each): frame keeps id of its dictionary,
+/// so segments written before retraining stay readable.
+/// Without zstd (-DENABLE_ZSTD=Off) records are written plain and compressed ones can't be read
+class SegmentCodec {
+ public:
+    /// \brief Flag of record length field: record body is compressed (records are smaller than 2 GiB)
+    static constexpr uint32_t COMPRESSED = 0x80000000u;
+
+    struct Options {
+      /// \brief Compress new records, existing compressed records are readable anyway
+      bool enabled = false;
+      /// \brief zstd level, 1 (fastest) to 19
+      int level = 3;
+      /// \brief Max dictionary size
+      std::size_t dictionaryBytes = 16 * 1024;
+      /// \brief Records collected to train dictionary
+      std::size_t trainSamples = 2000;
+      /// \brief Dictionary is trained again on fresh records after this number of records, 0 - never
+      std::size_t retrainRecords = 1000000;
+      /// \brief Smaller records are written plain
+      std::size_t minBytes = 32;
+    };
+
+    /// \brief Loads stored dictionaries of log
+    /// \param directory log directory, must exist
+    /// \param options
+    /// \throws std::runtime_error if dictionary can't be read
+    SegmentCodec(const std::string &directory, const Options &options);
+    ~SegmentCodec();
+    SegmentCodec(const SegmentCodec &other) = delete;
+    SegmentCodec &operator=(const SegmentCodec &other) = delete;
+
+    /// \brief Compresses record. Until dictionary is trained, records are collected as samples:
+    /// caller that collects the last one trains dictionary
+    /// \param data
+    /// \param length
+    /// \param out zstd frame
+    /// \return false if record must be written plain: compression is disabled, there is no dictionary yet,
+    /// record is too small or doesn't shrink
+    bool compress(const char *data, std::size_t length, std::string &out);
+
+    /// \brief Decompresses frame of compress() by its dictionary
+    /// \param data
+    /// \param length
+    /// \param out
+    /// \return false if frame is broken or its dictionary is missing
+    bool decompress(const char *data, std::size_t length, std::string &out) const;
+
+    /// \brief Server is built with zstd
+    static bool isAvailable() noexcept;
+
+    /// \brief Size of records before and after compression, only compressed ones are counted
+    uint64_t getRawBytes() const noexcept;
+    uint64_t getCompressedBytes() const noexcept;
+
+ private:
+    struct Dictionary;
+    using DictionaryPtr = std::shared_ptr<const Dictionary>;
+
+    const std::string m_directory;
+    const Options m_options;
+
+    mutable std::mutex m_lock;
+    /// \brief By zstd dictionary id
+    std::map<uint32_t, DictionaryPtr> m_dictionaries;
+    DictionaryPtr m_current;
+    uint64_t m_nextFile = 1;
+    /// \brief Samples of next dictionary, concatenated
+    std::string m_samples;
+    std::vector<std::size_t> m_sampleSizes;
+    bool m_training = false;
+    std::size_t m_sinceTrained = 0;
+
+    std::atomic<uint64_t> m_rawBytes{0};
+    std::atomic<uint64_t> m_compressedBytes{0};
+
+    std::string dictionaryPath(uint64_t file) const;
+    void load();
+    /// \brief Trains, writes and installs dictionary, lock must not be held
+    void train(const std::string &samples, const std::vector<std::size_t> &sizes);
+    /// \brief Lock must be held
+    /// \return nullptr if content is not a dictionary or its id is taken
+    DictionaryPtr installLocked(std::string &&content);
+};
+
+}
+
+#endif //WSSERVER_SEGMENTCODEC_H
@@ -7,10 +7,109 @@
  */
 
 #include "ServerStarter.h"
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <thread>
+#include <semaphore.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../helpers/logging.h"
+#include "Affinity.h"
+#include "Tracing.h"
+#include "Metrics.h"
+#include "Profiler.h"
+#include "SegmentCodec.h"
+#include "TrafficCapture.h"
 
 static wss::ServerStarter *self; // for signal instance
 
-wss::ServerStarter::ServerStarter(int argc, const char **argv) : m_args() {
+namespace {
+/// \brief Posted by SIGHUP handler: sem_post is async-signal-safe, config is reloaded by reload thread
+sem_t reloadSignal;
+
+void onReload(int) {
+    sem_post(&reloadSignal);
+}
+
+/// \brief Parses size like 10M (megabytes) or 1000K (kilobytes)
+/// \throws std::invalid_argument
+std::size_t parseMessageSize(const std::string &value) {
+    auto res = toolboxpp::strings::matchRegexp(R"(^(\d+)(M|K)$)", value);
+    if (res.size() != 3) {
+        throw std::invalid_argument(
+            "Invalid message.maxSize value format. Must be: 10M or 1000K which means 10 megabytes or 1000 kilobytes");
+    }
+
+    unsigned long sz;
+    try {
+        sz = std::stoul(res[1]);
+    } catch (const std::exception &e) {
+        throw std::invalid_argument(std::string("Invalid value message.maxSize. ") + e.what());
+    }
+    return res[2] == "M" ? sz * 1024 * 1024 : sz * 1024;
+}
+
+wss::SocketOptions toSocketOptions(const wss::SocketSettings &settings) {
+    wss::SocketOptions options;
+    options.noDelay = settings.noDelay;
+    options.sendBufferBytes = settings.sendBufferBytes;
+    options.receiveBufferBytes = settings.receiveBufferBytes;
+    options.notSentLowatBytes = settings.notSentLowatBytes;
+    options.userTimeoutMillis = settings.userTimeoutMillis;
+    options.listenBacklog = settings.listenBacklog;
+    options.zeroCopyMinBytes = settings.zeroCopyMinBytes;
+    return options;
+}
+
+/// \throws std::runtime_error if compression is enabled, but server is built without zstd or level is invalid
+wss::SegmentCodec::Options toSegmentCodecOptions(const wss::Server::SegmentCompression &settings) {
+    wss::SegmentCodec::Options options;
+    options.enabled = settings.enabled;
+    options.level = settings.level;
+    options.dictionaryBytes = static_cast<std::size_t>(settings.dictionaryKB) * 1024;
+    options.trainSamples = settings.trainSamples;
+    options.retrainRecords = settings.retrainRecords;
+    options.minBytes = settings.minBytes;
+    if (!options.enabled) {
+        return options;
+    }
+    if (!wss::SegmentCodec::isAvailable()) {
+        throw std::runtime_error("server.segmentCompression requires build with -DENABLE_ZSTD=On");
+    }
+    if (options.level < 1 || options.level > 19) {
+        throw std::runtime_error("server.segmentCompression.level must be in range 1-19");
+    }
+    if (options.dictionaryBytes < 1024 || options.trainSamples < 10) {
+        throw std::runtime_error("server.segmentCompression requires dictionaryKB >= 1 and trainSamples >= 10");
+    }
+    return options;
+}
+
+/// \brief Logs how long startup phase took, when scope is left
+class StartupPhase {
+ public:
+    explicit StartupPhase(const char *name) :
+        m_name(name),
+        m_start(std::chrono::steady_clock::now()) {
+    }
+    ~StartupPhase() {
+        const auto took = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - m_start);
+        WSS_LOG_F(wss::logging::LevelInfo, "Startup", "%s: %lld ms", m_name, static_cast<long long>(took.count()));
+    }
+
+ private:
+    const char *m_name;
+    const std::chrono::steady_clock::time_point m_start;
+};
+}
+
+wss::ServerStarter::ServerStarter(int argc, const char **argv) :
+    m_startedAt(std::chrono::steady_clock::now()),
+    m_args() {
     m_args.add<std::string>("config", 'C', "Config file path /path/to/config.json", true);
     m_args.add<bool>("test", 'T', "Test config", false, false);
     m_args.add<uint16_t>("verbosity", 'l', "Log level: 0 (error,critical), 1(0 + info), 2(all)", false, 2);
@@ -30,26 +129,55 @@ wss::ServerStarter::ServerStarter(int argc, const char **argv) : m_args() {
         return;
     }
 
-    toolboxpp::Logger::get().setVerbosity(m_args.get<uint16_t>("verbosity"));
+    wss::logging::setVerbosity(m_args.get<uint16_t>("verbosity"));
+#ifdef WSS_ASYNC_LOG
+    wss::logging::startAsync();
+#endif
 
     m_args.parse_check(argc, const_cast<char **>(argv));
-    const std::string configPath = m_args.get<std::string>("config");
+    m_configPath = m_args.get<std::string>("config");
     m_isConfigTest = m_args.get<bool>("test");
 
     // Getting config file
-    std::ifstream configFileStream(configPath);
+    std::ifstream configFileStream(m_configPath);
     if (configFileStream.fail()) {
         perror("Can't open file");
         m_valid = false;
         return;
     }
 
-    nlohmann::json config;
-    configFileStream >> config;
     wss::Settings &settings = wss::Settings::get();
-    settings = config;
+    {
+        const StartupPhase phase("config");
+        nlohmann::json config;
+        configFileStream >> config;
+        settings = config;
+    }
+
+    if (settings.tracing.sampleRate > 0 && settings.tracing.endpoint.empty()) {
+        cerr << "tracing.endpoint - required if tracing.sampleRate is set" << endl;
+        m_valid = false;
+        return;
+    }
+
+    // MULTI-PROCESS
+    if (settings.server.processes.count > 0) {
+        if (!configureProcesses(settings, argc, argv)) {
+            m_valid = false;
+            return;
+        }
+        if (m_workerPool) {
+            // master doesn't start any service or thread
+            self = this;
+            signal(SIGINT, &ServerStarter::signalHandler);
+            signal(SIGTERM, &ServerStarter::signalHandler);
+            signal(SIGHUP, &ServerStarter::signalHandler);
+            return;
+        }
+    }
 
     // CHAT
+    std::unique_ptr<StartupPhase> chatPhase = std::make_unique<StartupPhase>("chat server");
     if (settings.server.secure.enabled) {
         const std::string crtPath = settings.server.secure.crtPath;
         const std::string keyPath = settings.server.secure.keyPath;
@@ -75,13 +203,24 @@ wss::ServerStarter::ServerStarter(int argc, const char **argv) : m_args() {
         endpointStream << "^" << settings.server.endpoint << "?$";
         const std::string res = endpointStream.str();
 
-        m_webSocket = std::make_shared<wss::ChatServer>(
-            crtPath,
-            keyPath,
-            settings.server.address,
-            settings.server.port,
-            res
-        );
+        if (settings.server.secure.port != 0) {
+            if (settings.server.secure.port == settings.server.port) {
+                cerr << "server.secure.port must differ from server.port" << endl;
+                m_valid = false;
+                return;
+            }
+            // dual listeners: ws on server.port, wss on server.secure.port
+            m_webSocket = std::make_shared<wss::ChatServer>(settings.server.address, settings.server.port, res);
+            m_webSocket->addSecureListener(crtPath, keyPath, settings.server.secure.port);
+        } else {
+            m_webSocket = std::make_shared<wss::ChatServer>(
+                crtPath,
+                keyPath,
+                settings.server.address,
+                settings.server.port,
+                res
+            );
+        }
     } else {
         // creating ws service
         std::stringstream endpointStream;
@@ -90,6 +229,8 @@ wss::ServerStarter::ServerStarter(int argc, const char **argv) : m_args() {
         m_webSocket = std::make_shared<wss::ChatServer>(settings.server.address, settings.server.port, res);
     }
 
+    chatPhase.reset();
+
     // REST API
     if(settings.restApi.enabled) {
         if(settings.restApi.secure.enabled) {
@@ -121,30 +262,61 @@ wss::ServerStarter::ServerStarter(int argc, const char **argv) : m_args() {
         // configuring rest api service
         m_restServer->setAddress(settings.restApi.address);
         m_restServer->setPort(settings.restApi.port);
+        m_restServer->setKeepAlive(settings.restApi.idleTimeoutSeconds, settings.restApi.maxRequestsPerConnection);
         m_restServer->setAuth(settings.restApi.auth.data);
+        m_restServer->setSocketOptions(toSocketOptions(settings.restApi.socket));
     }
 
-    // configuring ws service
-    configureServer(settings);
-    // configuring ws service chat
-    configureChat(settings);
+    {
+        const StartupPhase phase("chat configuration");
+        // configuring ws service
+        configureServer(settings);
+        // configuring ws service chat
+        configureChat(settings);
+        configureCluster(settings);
+    }
+    if (m_workerIndex >= 0) {
+        m_webSocket->setExternalAccept(true);
+    }
 
     // creating event notifier service
     m_eventNotifier = std::make_shared<wss::event::EventNotifier>(m_webSocket);
 
+    // event targets and outbox don't depend on chat state: they are built while snapshot is restored.
+    // Both are done before start, so notifier is subscribed before listener accepts first message
+    std::future<bool> eventNotifierReady;
+    if (settings.event.enabled) {
+        eventNotifierReady = std::async(std::launch::async, [this, &settings] {
+          const StartupPhase phase("event notifier");
+          return configureEventNotifier(settings);
+        });
+    }
 
     // adding commands to run websocket and to join it threads
     enqueueService(m_webSocket);
 
+    // warm start: listener is not opened yet
+    if (!m_isConfigTest) {
+        const StartupPhase phase("snapshot");
+        try {
+            m_webSocket->restoreSnapshot();
+        } catch (const std::runtime_error &e) {
+            cerr << "chat.snapshot: " << e.what() << ", starting without restored state" << endl;
+        }
+    }
+
     // configuring event notifier
     if (settings.event.enabled) {
-        bool validConfig = configureEventNotifier(settings);
+        bool validConfig = eventNotifierReady.get();
         if (!validConfig) {
             m_valid = false;
             return;
         } else {
             // adding commands to run event notifier and to join it threads
             enqueueService(m_eventNotifier);
+            if (m_restServer) {
+                m_restServer->setEventNotifier(m_eventNotifier);
+            }
         }
     }
 
@@ -157,10 +329,32 @@ wss::ServerStarter::ServerStarter(int argc, const char **argv) : m_args() {
         return;
     }
 
+    wss::tracing::Config tracing;
+    tracing.sampleRate = settings.tracing.sampleRate;
+    tracing.endpoint = settings.tracing.endpoint;
+    tracing.serviceName = settings.tracing.serviceName;
+    tracing.queueSize = settings.tracing.queueSize;
+    tracing.flushIntervalMillis = settings.tracing.flushIntervalMillis;
+    wss::tracing::configure(tracing);
+
+    wss::profiler::Config profiler;
+    profiler.outputDir = settings.server.tmpDir;
+    if (wss::profiler::install(profiler)) {
+        WSS_LOG_F(wss::logging::LevelInfo, "Profiler",
+                  "Send SIGUSR2 to start and stop CPU sampling, profiles are written to %s",
+                  profiler.outputDir.c_str());
+    }
+
+    if (m_restServer) {
+        m_restServer->setReloadHandler(std::bind(&ServerStarter::reload, this));
+    }
+
     self = this;
 
     signal(SIGINT, &ServerStarter::signalHandler);
     signal(SIGTERM, &ServerStarter::signalHandler);
+    sem_init(&reloadSignal, 0, 0);
+    signal(SIGHUP, onReload);
 }
 wss::ServerStarter::~ServerStarter() {
 }
@@ -168,17 +362,82 @@ void wss::ServerStarter::stop() {
     for (auto &service: m_services) {
         service->stopService();
     }
+    m_webSocket->saveSnapshot();
+    wss::capture::stop();
+    wss::tracing::shutdown();
 }
 void wss::ServerStarter::run() {
+    if (m_workerPool) {
+        try {
+            m_workerPool->run();
+        } catch (const std::exception &e) {
+            cerr << "server.processes: " << e.what() << endl;
+        }
+        return;
+    }
+
     for (auto &service: m_services) {
         service->runService();
     }
+    std::thread([this] {
+      while (true) {
+          if (sem_wait(&reloadSignal) != 0) {
+              if (errno == EINTR) {
+                  continue;
+              }
+              break;
+          }
+          try {
+              reload();
+          } catch (const std::runtime_error &e) {
+              WSS_LOG_F(wss::logging::LevelError, "Reload", "%s", e.what());
+          }
+      }
+    }).detach();
+    WSS_LOG_F(wss::logging::LevelInfo, "Startup", "Services are started in %lld ms",
+              static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - m_startedAt).count()));
+
+    if (m_workerIndex >= 0) {
+        std::thread([this] {
+          // sockets wait in channel, until server is started
+          while (!m_webSocket->isAccepting()) {
+              std::this_thread::sleep_for(std::chrono::milliseconds(10));
+          }
+          wss::WorkerPool::receive([this](int fd) {
+            m_webSocket->adoptConnection(fd);
+          });
+          // master is gone: connections are not passed anymore
+          kill(getpid(), SIGTERM);
+        }).detach();
+    }
 
     std::for_each(m_services.rbegin(), m_services.rend(), [](const std::shared_ptr<wss::StandaloneService> &s) {
       s->joinThreads();
     });
 }
 void wss::ServerStarter::signalHandler(int signum) {
+    if (signum == SIGHUP) {
+        // master has no services: every worker reloads its own
+        self->m_workerPool->signalWorkers(SIGHUP);
+        return;
+    }
+    if (self->m_workerPool) {
+        // workers are stopped by pool
+        self->m_workerPool->stop();
+        return;
+    }
+    // second SIGTERM while draining stops immediately
+    if (signum == SIGTERM && self->m_drainOnTerm && !self->m_webSocket->isDraining()) {
+        std::cout << "[" << signum << "] Draining connections..." << std::endl;
+        self->m_webSocket->drain(self->m_drainOptions, [signum] {
+          self->stop();
+          std::cout << "Stopped!" << std::endl;
+          exit(signum);
+        });
+        return;
+    }
+
     std::cout << "[" << signum << "] Stopping server..." << std::endl;
     self->stop();
     std::cout << "Stopped!" << std::endl;
@@ -190,43 +449,558 @@ bool wss::ServerStarter::hasKey(nlohmann::json &obj, const std::string &key) {
     return obj.find(key) != obj.end();
 }
 void wss::ServerStarter::configureChat(wss::Settings &settings) {
-    using toolboxpp::strings::matchRegexp;
+    std::size_t maxBytes;
+    try {
+        maxBytes = parseMessageSize(settings.chat.message.maxSize);
+    } catch (const std::invalid_argument &e) {
+        cerr << e.what() << endl;
+        return;
+    }
+    m_webSocket->setMessageSizeLimit(maxBytes);
+    m_webSocket->setMessageFragmentsLimit(settings.chat.message.maxFragments);
+    m_webSocket->setEnabledMessageDeliveryStatus(settings.chat.message.enableDeliveryStatus);
+    m_webSocket->setUndeliveredTtl(settings.chat.undeliveredTtlSeconds);
+    try {
+        m_webSocket->setRedeliveryBatchSize(settings.chat.redeliveryBatchSize);
+    } catch (const std::invalid_argument &e) {
+        cerr << "chat.redeliveryBatchSize: " << e.what() << endl;
+        m_valid = false;
+    }
+    m_webSocket->setAckWindow(settings.chat.ackWindow);
+    try {
+        const auto &store = settings.chat.undeliveredStore;
+        wss::undelivered::StoreConfig config;
+        config.directory = settings.server.tmpDir + "/undelivered";
+        config.spillDirectory = settings.server.tmpDir + "/undelivered-spill";
+        config.file.segmentBytes = static_cast<std::size_t>(store.segmentSizeMB) * 1024 * 1024;
+        config.file.syncIntervalMillis = store.syncIntervalMillis;
+        config.file.compression = toSegmentCodecOptions(settings.server.segmentCompression);
+        config.memory.maxPerUser = store.maxPerUser;
+        config.memory.maxBytes = static_cast<std::size_t>(store.maxMemoryMB) * 1024 * 1024;
+        config.overflowPolicy = store.overflowPolicy;
+        config.redis = store.redis;
+        config.writeBehindBytes = static_cast<std::size_t>(store.writeBehindQueueMB) * 1024 * 1024;
+        m_webSocket->setUndeliveredStore(wss::undelivered::registry::create(store.type, config));
+    } catch (const std::runtime_error &e) {
+        cerr << "chat.undeliveredStore: " << e.what() << endl;
+        m_valid = false;
+    }
+    m_webSocket->setEnabledClientTopicPublish(settings.chat.enableClientTopicPublish);
+    m_webSocket->setMaxBatchSize(settings.chat.message.maxBatchSize);
+
+    try {
+        const auto toLimits = [](const wss::Chat::RateLimit::Bucket &bucket) {
+          wss::RateLimiter::Limits limits;
+          limits.messagesRate = bucket.messagesPerSec;
+          limits.messagesBurst = bucket.messagesBurst;
+          limits.bytesRate = bucket.bytesPerSec;
+          limits.bytesBurst = bucket.bytesBurst;
+          return limits;
+        };
+        m_webSocket->setRateLimits(toLimits(settings.chat.rateLimit.connection),
+                                   toLimits(settings.chat.rateLimit.user),
+                                   settings.chat.rateLimit.policy,
+                                   settings.chat.rateLimit.maxDelayMillis);
+    } catch (const std::runtime_error &e) {
+        cerr << "chat.rateLimit.policy: " << e.what() << endl;
+        m_valid = false;
+    }
 
-    std::string messageMaxSize = settings.chat.message.maxSize;
+    if (settings.chat.presence.enabled) {
+        try {
+            m_webSocket->setPresence(settings.chat.presence.historySize,
+                                     settings.chat.presence.topic,
+                                     settings.chat.presence.notifyEvents);
+        } catch (const std::runtime_error &e) {
+            cerr << "chat.presence.topic: " << e.what() << endl;
+            m_valid = false;
+        }
+    }
 
-    auto res = matchRegexp(R"(^(\d+)(M|K)$)", messageMaxSize);
-    if (res.size() != 3) {
-        cerr
-            << "Invalid message.maxSize value format. Must be: 10M or 1000K which means 10 megabytes or 1000 kilobytes"
-            << endl;
-        return;
+    if (settings.chat.history.enabled) {
+        try {
+            const auto &history = settings.chat.history;
+            wss::HistoryLog::Options options;
+            options.segmentBytes = static_cast<std::size_t>(history.segmentSizeMB) * 1024 * 1024;
+            options.maxBytes = static_cast<std::size_t>(history.maxSizeMB) * 1024 * 1024;
+            options.retentionSeconds = history.retentionSeconds;
+            options.compression = toSegmentCodecOptions(settings.server.segmentCompression);
+            m_webSocket->setHistoryLog(
+                std::make_unique<wss::HistoryLog>(settings.server.tmpDir + "/history", options));
+            m_webSocket->setHistoryPageSize(history.maxPageSize);
+        } catch (const std::exception &e) {
+            cerr << "chat.history: " << e.what() << endl;
+            m_valid = false;
+        }
+    }
+
+    m_webSocket->setStatisticsLimits(settings.chat.statistics.offlineSeconds, settings.chat.statistics.maxUsers);
+
+    if (settings.chat.scheduler.enabled) {
+        try {
+            wss::DeliveryScheduler::Options options;
+            options.tickMillis = settings.chat.scheduler.tickMillis;
+            options.maxMessages = settings.chat.scheduler.maxMessages;
+            options.maxDelaySeconds = settings.chat.scheduler.maxDelaySeconds;
+            m_webSocket->setScheduler(std::make_unique<wss::DeliveryScheduler>(options));
+        } catch (const std::exception &e) {
+            cerr << "chat.scheduler: " << e.what() << endl;
+            m_valid = false;
+        }
+    }
+
+    m_webSocket->setBroadcastRate(settings.chat.broadcast.connectionsPerSecond);
+    if (settings.chat.recipientCache.enabled) {
+        wss::RecipientCache::Options options;
+        options.maxEntries = settings.chat.recipientCache.maxEntries;
+        options.minRecipients = settings.chat.recipientCache.minRecipients;
+        m_webSocket->setRecipientCache(std::make_unique<wss::RecipientCache>(options));
+    }
+    if (settings.chat.outboundBatch.enabled) {
+        if (settings.chat.outboundBatch.lingerMillis == 0 || settings.chat.outboundBatch.maxItems < 2) {
+            cerr << "chat.outboundBatch: lingerMillis must be positive and maxItems at least 2" << endl;
+            m_valid = false;
+        } else {
+            wss::OutboundBatcher::Options options;
+            options.lingerMillis = settings.chat.outboundBatch.lingerMillis;
+            options.maxItems = settings.chat.outboundBatch.maxItems;
+            options.maxBytes = settings.chat.outboundBatch.maxBytes;
+            m_webSocket->setOutboundBatching(options);
+        }
+    }
+
+    if (settings.chat.attachments.enabled) {
+        try {
+            wss::AttachmentStore::Options options;
+            options.thresholdBytes = settings.chat.attachments.thresholdBytes;
+            options.ttlSeconds = settings.chat.attachments.ttlSeconds;
+            if (options.thresholdBytes == 0) {
+                throw std::invalid_argument("thresholdBytes must be greater than 0");
+            }
+            m_webSocket->setAttachmentStore(
+                std::make_unique<wss::AttachmentStore>(settings.server.tmpDir + "/attachments", options));
+        } catch (const std::exception &e) {
+            cerr << "chat.attachments: " << e.what() << endl;
+            m_valid = false;
+        }
+    }
+
+    if (settings.chat.localIngest.enabled && !m_isConfigTest) {
+        try {
+            const auto &ingest = settings.chat.localIngest;
+            wss::LocalIngest::Options options;
+            options.path = ingest.path;
+            options.slots = ingest.slots;
+            options.slotBytes = ingest.slotBytes;
+            options.idleSleepMicros = ingest.idleSleepMicros;
+            m_webSocket->setLocalIngest(std::make_unique<wss::LocalIngest>(options));
+        } catch (const std::exception &e) {
+            cerr << "chat.localIngest: " << e.what() << endl;
+            m_valid = false;
+        }
+    }
+    if (settings.server.http2.enabled) {
+        const auto &http2 = settings.server.http2;
+        const auto &secure = settings.server.secure;
+        if (secure.enabled && secure.port == 0) {
+            cerr << "server.http2: streams are bridged to plain ws listener, "
+                    "it's not available when server.secure is enabled without server.secure.port" << endl;
+            m_valid = false;
+        } else if (wss::unixsocket::isAddress(settings.server.address)) {
+            cerr << "server.http2: ws listener on unix socket is not supported" << endl;
+            m_valid = false;
+        } else if (http2.secure && (secure.crtPath.empty() || secure.keyPath.empty())) {
+            cerr << "server.http2: secure requires server.secure.crtPath and server.secure.keyPath" << endl;
+            m_valid = false;
+        } else if (http2.maxStreams == 0 || http2.streamBufferBytes < 16384) {
+            cerr << "server.http2: maxStreams must be greater than 0 and streamBufferBytes at least 16384" << endl;
+            m_valid = false;
+        } else if (!wss::Http2Gateway::isAvailable()) {
+            cerr << "server.http2 requires build with -DENABLE_HTTP2=On" << endl;
+            m_valid = false;
+        } else if (!m_isConfigTest) {
+            try {
+                wss::Http2Gateway::Options options;
+                options.address = http2.address;
+                options.port = http2.port;
+                if (http2.secure) {
+                    options.crtPath = secure.crtPath;
+                    options.keyPath = secure.keyPath;
+                }
+                options.path = settings.server.endpoint;
+                const std::string &address = settings.server.address;
+                if (address == "::") {
+                    options.upstreamAddress = "::1";
+                } else if (!address.empty() && address != "*" && address != "0.0.0.0") {
+                    options.upstreamAddress = address;
+                }
+                options.upstreamPort = settings.server.port;
+                options.maxStreams = http2.maxStreams;
+                options.streamBufferBytes = http2.streamBufferBytes;
+                options.idleSeconds = http2.idleSeconds;
+                options.threads = http2.threads;
+                m_webSocket->setHttp2Gateway(std::make_unique<wss::Http2Gateway>(options));
+            } catch (const std::exception &e) {
+                cerr << "server.http2: " << e.what() << endl;
+                m_valid = false;
+            }
+        }
+    }
+    if (settings.chat.ingest.enabled && !m_isConfigTest) {
+        try {
+            const auto &ingest = settings.chat.ingest;
+            wss::IngestServer::Options options;
+            options.address = ingest.address;
+            options.port = ingest.port;
+            options.token = ingest.token;
+            options.maxFrameBytes = ingest.maxFrameBytes;
+            options.threads = ingest.threads;
+            m_webSocket->setIngestServer(std::make_unique<wss::IngestServer>(options));
+        } catch (const std::exception &e) {
+            cerr << "chat.ingest: " << e.what() << endl;
+            m_valid = false;
+        }
+    }
+
+    if (settings.chat.snapshot.enabled) {
+        m_webSocket->setSnapshot(settings.server.tmpDir + "/state.snapshot", settings.chat.snapshot.intervalSeconds);
+    }
+
+    if (settings.chat.capture.enabled) {
+        wss::capture::Config capture;
+        capture.path = settings.server.tmpDir + "/traffic-" + std::to_string(std::time(nullptr)) + ".trace";
+        capture.maxSeconds = settings.chat.capture.maxSeconds;
+        capture.maxSizeMB = settings.chat.capture.maxSizeMB;
+        try {
+            wss::capture::start(capture);
+        } catch (const std::runtime_error &e) {
+            cerr << "chat.capture: " << e.what() << endl;
+            m_valid = false;
+        }
     }
 
-    unsigned long sz;
     try {
-        sz = std::stoul(res[1]);
-    } catch (const std::exception &e) {
-        cerr << "Invalid value message.maxSize. " << e.what() << endl;
-        return;
+        m_webSocket->setSendPriorities(settings.chat.message.priorities,
+                                       settings.server.send.normalWeight,
+                                       settings.server.send.bulkWeight);
+    } catch (const std::runtime_error &e) {
+        cerr << "chat.message.priorities: " << e.what() << endl;
+        m_valid = false;
     }
 
-    std::size_t maxBytes = 0;
+    try {
+        m_webSocket->setCoalescedTypes(settings.chat.message.coalescedTypes);
+    } catch (const std::length_error &e) {
+        cerr << "chat.message.coalescedTypes: " << e.what() << endl;
+        m_valid = false;
+    }
 
-    if (res[2] == "M") {
-        // megabytes
-        maxBytes = sz * 1024 * 1024;
-    } else {
-        // kilobytes
-        maxBytes = sz * 1024;
+    try {
+        m_webSocket->setEphemeralTypes(settings.chat.message.ephemeralTypes);
+    } catch (const std::length_error &e) {
+        cerr << "chat.message.ephemeralTypes: " << e.what() << endl;
+        m_valid = false;
+    }
+
+    try {
+        m_webSocket->setDeliveryStatusCoalescing(settings.chat.message.deliveryStatusMode,
+                                                 settings.chat.message.deliveryStatusFlushMillis,
+                                                 settings.chat.message.deliveryStatusFlushItems);
+    } catch (const std::runtime_error &e) {
+        cerr << "chat.message.deliveryStatusMode: " << e.what() << endl;
+        m_valid = false;
+    }
+
+    try {
+        m_webSocket->setCodecs(settings.chat.codecs);
+    } catch (const std::runtime_error &e) {
+        cerr << "chat.codecs: " << e.what() << endl;
+        m_valid = false;
     }
-    m_webSocket->setMessageSizeLimit(maxBytes);
-    m_webSocket->setEnabledMessageDeliveryStatus(settings.chat.message.enableDeliveryStatus);
 }
 void wss::ServerStarter::configureServer(wss::Settings &settings) {
 
     // setting num of workers (threads in thread pool)
     m_webSocket->setThreadPoolSize(settings.server.workers);
+    m_webSocket->setReusePort(settings.server.reusePort);
+    m_webSocket->setIoServicePerThread(settings.server.ioServicePerThread);
+    m_webSocket->setProxyProtocol(settings.server.proxyProtocol);
+    if (!settings.server.ioBackend.empty() && settings.server.ioBackend != wss::IO_BACKEND) {
+        cerr << "server.ioBackend: server is built with " << wss::IO_BACKEND << " reactor, "
+             << settings.server.ioBackend << " requires rebuild";
+        if (settings.server.ioBackend == "io_uring") {
+            cerr << " with -DENABLE_IO_URING=On";
+        }
+        cerr << endl;
+        m_valid = false;
+    }
+
+    // threads pin themselves on start, so cores are set before any of them is created
+    const auto &affinity = settings.server.affinity;
+    const std::array<std::pair<wss::affinity::Group, const std::string *>, wss::affinity::GROUPS> groups = {{
+        {wss::affinity::Group::Io, &affinity.io},
+        {wss::affinity::Group::Events, &affinity.events},
+        {wss::affinity::Group::Auth, &affinity.auth},
+        {wss::affinity::Group::Background, &affinity.background}
+    }};
+    for (const auto &group: groups) {
+        try {
+            wss::affinity::setCpus(group.first, wss::affinity::parse(*group.second));
+        } catch (const std::invalid_argument &e) {
+            cerr << "server.affinity: " << e.what() << endl;
+            m_valid = false;
+        }
+    }
+
+    m_webSocket->setSocketOptions(toSocketOptions(settings.server.socket));
+
+    const auto &watchdog = settings.server.watchdog;
+    if (watchdog.enabled && watchdog.pingIntervalSeconds <= 0) {
+        cerr << "server.watchdog.pingIntervalSeconds must be greater than 0" << endl;
+        m_valid = false;
+    }
+    m_webSocket->setKeepalive(watchdog.enabled ? watchdog.pingIntervalSeconds : 0, watchdog.maxMissedPongs);
     m_webSocket->setAuth(settings.server.auth.data);
+    m_webSocket->setAuthMaxQueue(settings.server.authMaxQueue);
+
+    const auto &secure = settings.server.secure;
+    if (secure.sessionCacheSize < 0 || secure.sessionTimeoutSeconds <= 0 || secure.ticketKeyRotationSeconds < 0) {
+        cerr << "server.secure: session cache size and ticket key rotation can't be negative, session timeout must be greater than 0" << endl;
+        m_valid = false;
+    }
+    wss::server::websocket::SocketServerSecure::SessionConfig sessionConfig;
+    sessionConfig.cacheSize = secure.sessionCacheSize;
+    sessionConfig.timeout = secure.sessionTimeoutSeconds;
+    sessionConfig.tickets = secure.sessionTickets;
+    sessionConfig.ticketKeyRotation = secure.ticketKeyRotationSeconds;
+    m_webSocket->setTlsSessionConfig(sessionConfig);
+    m_webSocket->setMaxConcurrentHandshakes(secure.maxConcurrentHandshakes);
+
+    const auto &deflateSettings = settings.server.permessageDeflate;
+    if (deflateSettings.serverMaxWindowBits < 9 || deflateSettings.serverMaxWindowBits > 15
+        || deflateSettings.clientMaxWindowBits < 8 || deflateSettings.clientMaxWindowBits > 15) {
+        cerr << "server.permessageDeflate: window bits must be in range 9-15 (server) and 8-15 (client)" << endl;
+        m_valid = false;
+    } else {
+        wss::server::websocket::PerMessageDeflate::Options deflateOptions;
+        deflateOptions.enabled = deflateSettings.enabled;
+        deflateOptions.minSize = deflateSettings.minSize;
+        deflateOptions.level = deflateSettings.level;
+        deflateOptions.serverMaxWindowBits = deflateSettings.serverMaxWindowBits;
+        deflateOptions.clientMaxWindowBits = deflateSettings.clientMaxWindowBits;
+        deflateOptions.serverNoContextTakeover = deflateSettings.serverNoContextTakeover;
+        deflateOptions.clientNoContextTakeover = deflateSettings.clientNoContextTakeover;
+        m_webSocket->setPerMessageDeflate(deflateOptions);
+    }
+
+    m_webSocket->setSendCoalescing(settings.server.send.coalesceFrames, settings.server.send.coalesceBytes);
+    m_webSocket->setReadBufferRetainSize(settings.server.readBufferRetainBytes);
+    if (settings.server.readChunkBytes == 0) {
+        cerr << "server.readChunkBytes: must be greater than 0" << endl;
+        m_valid = false;
+    }
+    m_webSocket->setReadChunkSize(settings.server.readChunkBytes);
+    wss::metrics::setMemorySoftLimit(settings.server.memorySoftLimitBytes);
+    if (settings.server.loopLagLimitMillis > 0 && settings.server.loopLagProbeMillis == 0) {
+        cerr << "server.loopLagLimitMillis requires server.loopLagProbeMillis" << endl;
+        m_valid = false;
+    }
+    m_webSocket->setLoopLagMonitor(settings.server.loopLagProbeMillis, settings.server.loopLagLimitMillis);
+    if (settings.server.admission.connectRatePerIp < 0 || settings.server.admission.connectBurstPerIp < 0) {
+        cerr << "server.admission: connectRatePerIp and connectBurstPerIp can't be negative" << endl;
+        m_valid = false;
+    } else {
+        wss::server::websocket::ConnectionAdmission::Options admission;
+        admission.maxConnectionsPerIp = settings.server.admission.maxConnectionsPerIp;
+        admission.connectRatePerIp = settings.server.admission.connectRatePerIp;
+        admission.connectBurstPerIp = settings.server.admission.connectBurstPerIp;
+        m_webSocket->setAdmission(admission,
+                                  settings.server.admission.maxHandshakeBytes,
+                                  settings.server.admission.handshakeDeadlineMillis);
+    }
+    if (settings.server.overload.enabled) {
+        const auto &overload = settings.server.overload;
+        if (overload.lagMillis > 0 && settings.server.loopLagProbeMillis == 0) {
+            cerr << "server.overload.lagMillis requires server.loopLagProbeMillis" << endl;
+            m_valid = false;
+        }
+        if (overload.checkMillis == 0) {
+            cerr << "server.overload.checkMillis must be greater than 0" << endl;
+            m_valid = false;
+        }
+        try {
+            wss::OverloadController::Options options;
+            options.lagMillis = overload.lagMillis;
+            options.memoryBytes = overload.memoryBytes;
+            options.sendQueueBytes = overload.sendQueueBytes;
+            options.rejectConnections = overload.rejectConnections;
+            options.shedBulk = overload.shedBulk;
+            options.rejectApi = overload.rejectApi;
+            options.recovery = overload.recovery;
+            m_webSocket->setOverload(std::make_unique<wss::OverloadController>(options), overload.checkMillis);
+        } catch (const std::exception &e) {
+            cerr << "server.overload: " << e.what() << endl;
+            m_valid = false;
+        }
+    }
+    m_drainOnTerm = settings.server.drain.enabled;
+    m_drainOptions.batchSize = settings.server.drain.batchSize;
+    m_drainOptions.intervalMillis = settings.server.drain.intervalMillis;
+    m_drainOptions.reconnectJitterMillis = settings.server.drain.reconnectJitterMillis;
+    m_drainOptions.flushTimeoutMillis = settings.server.drain.flushTimeoutMillis;
+    try {
+        m_webSocket->setSendQueueLimits(settings.server.send.highWaterFrames,
+                                        settings.server.send.highWaterBytes,
+                                        settings.server.send.slowConsumerPolicy);
+    } catch (const std::runtime_error &e) {
+        cerr << "server.send.slowConsumerPolicy: " << e.what() << endl;
+        m_valid = false;
+    }
+}
+void wss::ServerStarter::configureCluster(wss::Settings &settings) {
+    const auto &cluster = settings.cluster;
+    if (cluster.sharding.enabled) {
+        try {
+            if (!cluster.sharding.ring.is_array()) {
+                throw std::invalid_argument("sharding.ring must be an array");
+            }
+            std::vector<wss::HashRing::Node> nodes;
+            for (const auto &node: cluster.sharding.ring) {
+                wss::HashRing::Node item{node.at("id").get<wss::node_id_t>(), node.at("url").get<std::string>()};
+                // url is sent as close reason: control frame payload is up to 125 bytes, 2 of them are status
+                if (item.url.empty() || item.url.size() > 123) {
+                    throw std::invalid_argument("sharding.ring url of node " + std::to_string(item.id)
+                                                    + " must be 1..123 characters");
+                }
+                nodes.push_back(std::move(item));
+            }
+            m_webSocket->setShardRing(
+                std::make_unique<wss::HashRing>(std::move(nodes), cluster.sharding.virtualNodes), cluster.nodeId);
+        } catch (const std::exception &e) {
+            cerr << "cluster: " << e.what() << endl;
+            m_valid = false;
+            return;
+        }
+    }
+    if (!cluster.enabled) {
+        return;
+    }
+
+    wss::ClusterBus::Options options;
+    options.nodeId = cluster.nodeId;
+    options.address = cluster.address;
+    options.port = cluster.port;
+    options.secret = cluster.secret;
+    options.maxPendingBytes = static_cast<std::size_t>(cluster.maxPendingMB) * 1024 * 1024;
+    options.reconnectMillis = cluster.reconnectIntervalMillis;
+    options.digestMillis = cluster.digestIntervalMillis;
+    try {
+        if (cluster.transport != "links") {
+            // broker does routing: nodes and links options are not used
+            if (cluster.nodeId == 0) {
+                throw std::invalid_argument("Node id must be in range 1..65535");
+            }
+            if (cluster.handoff.enabled) {
+                throw std::invalid_argument("handoff works only with links transport");
+            }
+            m_webSocket->setClusterBridge(wss::bridge::registry::create(cluster.transport, cluster.nodeId,
+                                                                        cluster.redis));
+        } else {
+            if (!cluster.nodes.is_array()) {
+                throw std::invalid_argument("nodes must be an array");
+            }
+            for (const auto &node: cluster.nodes) {
+                wss::ClusterBus::Node item{node.at("id").get<wss::node_id_t>(),
+                                           node.at("address").get<std::string>(),
+                                           node.at("port").get<unsigned short>(),
+                                           node.value("url", "")};
+                // url goes to close reason after reconnect delay: control frame payload is up to 125 bytes
+                if (item.url.size() > 79) {
+                    throw std::invalid_argument("nodes url of node " + std::to_string(item.id)
+                                                    + " must be up to 79 characters");
+                }
+                options.nodes.push_back(std::move(item));
+            }
+            m_webSocket->setCluster(std::make_unique<wss::ClusterBus>(options));
+            if (cluster.handoff.enabled) {
+                wss::ChatServer::HandoffOptions handoff;
+                handoff.node = cluster.handoff.node;
+                handoff.timeoutMillis = cluster.handoff.timeoutMillis;
+                m_webSocket->setHandoff(handoff);
+            }
+        }
+    } catch (const std::exception &e) {
+        cerr << "cluster: " << e.what() << endl;
+        m_valid = false;
+        return;
+    }
+    if (settings.chat.enableUndeliveredQueue && settings.chat.undeliveredStore.type != "redis") {
+        WSS_LOG_F(wss::logging::LevelWarning, "Cluster",
+                  "Undelivered messages are kept by node: use redis store to redeliver them on any node");
+    }
+}
+bool wss::ServerStarter::configureProcesses(wss::Settings &settings, int argc, const char **argv) {
+    const auto &processes = settings.server.processes;
+    if (settings.server.secure.enabled) {
+        cerr << "server.processes: workers can serve only plain (ws) connections, terminate TLS before them" << endl;
+        return false;
+    }
+    if (settings.cluster.enabled || settings.cluster.sharding.enabled) {
+        cerr << "server.processes: workers are cluster themselves, cluster options can't be used" << endl;
+        return false;
+    }
+    if (static_cast<uint32_t>(processes.clusterPort) + processes.count > 65536) {
+        cerr << "server.processes: clusterPort + count must be up to 65536" << endl;
+        return false;
+    }
+
+    m_workerIndex = wss::WorkerPool::getWorkerIndex();
+    if (m_workerIndex < 0) {
+        if (m_isConfigTest) {
+            return true;
+        }
+        wss::WorkerPool::Options options;
+        options.workers = processes.count;
+        options.pinCores = processes.pinCores;
+        options.address = settings.server.address;
+        options.port = settings.server.port;
+        options.restartDelayMillis = processes.restartDelayMillis;
+        options.args.assign(argv, argv + argc);
+        m_workerPool = std::make_unique<wss::WorkerPool>(options);
+        return true;
+    }
+
+    wss::WorkerPool::pinWorker();
+    const auto index = static_cast<uint32_t>(m_workerIndex);
+
+    // own state files of worker
+    settings.server.tmpDir += "/worker-" + std::to_string(index);
+    if (::mkdir(settings.server.tmpDir.c_str(), 0755) != 0 && errno != EEXIST) {
+        cerr << "server.processes: can't create " << settings.server.tmpDir << ": " << strerror(errno) << endl;
+        return false;
+    }
+    // REST port can't be shared: messages of rest api reach users of other workers through cluster
+    settings.restApi.enabled = settings.restApi.enabled && index == 0;
+    settings.chat.localIngest.enabled = settings.chat.localIngest.enabled && index == 0;
+    settings.chat.ingest.enabled = settings.chat.ingest.enabled && index == 0;
+    settings.server.http2.enabled = settings.server.http2.enabled && index == 0;
+
+    settings.cluster.enabled = true;
+    settings.cluster.transport = "links";
+    settings.cluster.nodeId = static_cast<uint16_t>(index + 1);
+    settings.cluster.address = "127.0.0.1";
+    settings.cluster.port = static_cast<unsigned short>(processes.clusterPort + index);
+    settings.cluster.nodes = nlohmann::json::array();
+    for (uint32_t other = 0; other < processes.count; other++) {
+        if (other != index) {
+            settings.cluster.nodes.push_back({
+                                                 {"id", other + 1},
+                                                 {"address", "127.0.0.1"},
+                                                 {"port", processes.clusterPort + other}
+                                             });
+        }
+    }
+    return true;
 }
 bool wss::ServerStarter::configureEventNotifier(wss::Settings &settings) {
     if (!settings.event.enabled) {
@@ -248,6 +1022,20 @@ bool wss::ServerStarter::configureEventNotifier(wss::Settings &settings) {
     m_eventNotifier->setMaxTries(settings.event.retryCount);
     m_eventNotifier->setRetryIntervalSeconds(settings.event.retryIntervalSeconds);
 
+    if (settings.event.outbox.enabled) {
+        try {
+            EventOutbox::Options options;
+            options.segmentBytes = static_cast<std::size_t>(settings.event.outbox.segmentSizeMB) * 1024 * 1024;
+            options.syncIntervalMillis = settings.event.outbox.syncIntervalMillis;
+            options.compression = toSegmentCodecOptions(settings.server.segmentCompression);
+            m_eventNotifier->setOutbox(
+                std::make_unique<EventOutbox>(settings.server.tmpDir + "/event-outbox", options));
+        } catch (const std::exception &e) {
+            cerr << "event.outbox: " << e.what() << endl;
+            return false;
+        }
+    }
+
     int i = 0;
     for (auto &target: settings.event.targets) {
         if (!hasKey(target, "type")) {
@@ -270,3 +1058,101 @@ bool wss::ServerStarter::configureEventNotifier(wss::Settings &settings) {
 bool wss::ServerStarter::isValid() {
     return m_valid;
 }
+nlohmann::json wss::ServerStarter::reload() {
+    std::lock_guard<std::mutex> locker(m_reloadMutex);
+    std::ifstream stream(m_configPath);
+    if (stream.fail()) {
+        throw std::runtime_error("Can't open config file " + m_configPath);
+    }
+    wss::Settings fresh;
+    try {
+        nlohmann::json config;
+        stream >> config;
+        fresh = config;
+    } catch (const std::exception &e) {
+        throw std::runtime_error(std::string("Invalid config: ") + e.what());
+    }
+
+    // everything is validated before first change
+    std::size_t maxBytes;
+    try {
+        maxBytes = parseMessageSize(fresh.chat.message.maxSize);
+    } catch (const std::invalid_argument &e) {
+        throw std::runtime_error(e.what());
+    }
+    const auto &watchdog = fresh.server.watchdog;
+    if (watchdog.enabled && watchdog.pingIntervalSeconds <= 0) {
+        throw std::runtime_error("server.watchdog.pingIntervalSeconds must be greater than 0");
+    }
+    const auto &send = fresh.server.send;
+    try {
+        // the only setter that can fail, it fails before applying
+        m_webSocket->setSendQueueLimits(send.highWaterFrames, send.highWaterBytes, send.slowConsumerPolicy);
+    } catch (const std::runtime_error &e) {
+        throw std::runtime_error(std::string("server.send.slowConsumerPolicy: ") + e.what());
+    }
+
+    nlohmann::json applied;
+    applied["server.send.highWaterFrames"] = send.highWaterFrames;
+    applied["server.send.highWaterBytes"] = send.highWaterBytes;
+    applied["server.send.slowConsumerPolicy"] = send.slowConsumerPolicy;
+
+    m_webSocket->setSendCoalescing(send.coalesceFrames, send.coalesceBytes);
+    applied["server.send.coalesceFrames"] = send.coalesceFrames;
+    applied["server.send.coalesceBytes"] = send.coalesceBytes;
+
+    m_webSocket->setMessageSizeLimit(maxBytes);
+    applied["chat.message.maxSize"] = fresh.chat.message.maxSize;
+
+    m_webSocket->setKeepalive(watchdog.enabled ? watchdog.pingIntervalSeconds : 0, watchdog.maxMissedPongs);
+    applied["server.watchdog.pingIntervalSeconds"] = watchdog.enabled ? watchdog.pingIntervalSeconds : 0;
+    applied["server.watchdog.maxMissedPongs"] = watchdog.maxMissedPongs;
+
+    m_webSocket->setAuthMaxQueue(fresh.server.authMaxQueue);
+    applied["server.authMaxQueue"] = fresh.server.authMaxQueue;
+
+    m_webSocket->setBroadcastRate(fresh.chat.broadcast.connectionsPerSecond);
+    applied["chat.broadcast.connectionsPerSecond"] = fresh.chat.broadcast.connectionsPerSecond;
+
+    if (m_eventNotifier) {
+        const auto &event = fresh.event;
+        wss::event::RetryPolicy policy;
+        policy.interval = std::chrono::seconds(event.retryIntervalSeconds);
+        policy.maxInterval = std::chrono::seconds(event.retryMaxIntervalSeconds);
+        policy.multiplier = event.retryBackoffMultiplier;
+        policy.jitter = event.retryJitter;
+        m_eventNotifier->setRetryPolicy(policy);
+        m_eventNotifier->setMaxTries(event.retryCount);
+        m_eventNotifier->setMaxParallelWorkers(event.maxParallelWorkers);
+        applied["event.retryIntervalSeconds"] = event.retryIntervalSeconds;
+        applied["event.retryMaxIntervalSeconds"] = event.retryMaxIntervalSeconds;
+        applied["event.retryBackoffMultiplier"] = event.retryBackoffMultiplier;
+        applied["event.retryJitter"] = event.retryJitter;
+        applied["event.retryCount"] = event.retryCount;
+        applied["event.maxParallelWorkers"] = event.maxParallelWorkers;
+    }
+
+    // settings that are read once: listeners, io threads, enabled services
+    const wss::Settings &current = wss::Settings::get();
+    nlohmann::json restartRequired = nlohmann::json::array();
+    const std::array<std::pair<const char *, bool>, 8> fixed = {{
+        {"server.workers", fresh.server.workers != current.server.workers},
+        {"server.address", fresh.server.address != current.server.address},
+        {"server.port", fresh.server.port != current.server.port},
+        {"server.secure.enabled", fresh.server.secure.enabled != current.server.secure.enabled},
+        {"restApi.enabled", fresh.restApi.enabled != current.restApi.enabled},
+        {"restApi.port", fresh.restApi.port != current.restApi.port},
+        {"event.enabled", fresh.event.enabled != current.event.enabled},
+        {"cluster.enabled", fresh.cluster.enabled != current.cluster.enabled},
+    }};
+    for (const auto &setting: fixed) {
+        if (setting.second) {
+            restartRequired.push_back(setting.first);
+            WSS_LOG_F(wss::logging::LevelWarning, "Reload", "%s is changed, it's applied on restart", setting.first);
+        }
+    }
+
+    WSS_LOG_F(wss::logging::LevelInfo, "Reload", "Config %s is reloaded, %lu settings applied",
+              m_configPath.c_str(), applied.size());
+    return {{"applied", applied}, {"restartRequired", restartRequired}};
+}
@@ -16,7 +16,9 @@
 #include <fstream>
 #include <memory>
 #include <algorithm>
+#include <chrono>
 #include <functional>
+#include <mutex>
 #include "json.hpp"
 
 #include "cmdline.hpp"
@@ -25,6 +27,7 @@
 #include "..//chat/ChatServer.h"
 #include "StandaloneService.h"
 #include "Settings.hpp"
+#include "WorkerPool.h"
 
 namespace wss {
 
@@ -34,7 +37,19 @@ class ServerStarter {
  private:
     bool m_valid = true;
     bool m_isConfigTest = false;
+    /// \brief Start of configuration, for startup timings
+    std::chrono::steady_clock::time_point m_startedAt;
+    /// \brief Drain connections on SIGTERM instead of dropping them
+    bool m_drainOnTerm = false;
+    wss::ChatServer::DrainOptions m_drainOptions;
     cmdline::parser m_args;
+    std::string m_configPath;
+    /// \brief POST /reload and SIGHUP may come at once
+    std::mutex m_reloadMutex;
+    /// \brief Multi-process mode master: it runs only pool, without services
+    std::unique_ptr<wss::WorkerPool> m_workerPool;
+    /// \brief Multi-process mode worker index, -1 - not a worker
+    int m_workerIndex = -1;
 
     std::vector<std::shared_ptr<wss::StandaloneService>> m_services;
 
@@ -54,6 +69,12 @@ class ServerStarter {
     /// \brief valid state
     /// \return false if not configured
     bool isValid();
+    /// \brief Re-reads config file and applies tunable settings to running services (SIGHUP, POST /reload):
+    /// event workers pool, retry policy, message size, keepalive, send coalescing and queue caps, auth queue,
+    /// broadcast rate. Listeners, io threads and services enabled on start require restart
+    /// \throws std::runtime_error if config can't be read or is invalid, nothing is applied then
+    /// \return {"applied": {setting: value}, "restartRequired": [changed settings that are not applied]}
+    nlohmann::json reload();
 
  private:
     /// \brief POSIX singal handler
@@ -87,6 +108,15 @@ class ServerStarter {
     /// \param settings
     /// \return false if not valid config
     bool configureEventNotifier(wss::Settings &settings);
+    /// \brief Setup cluster links
+    /// \param settings
+    void configureCluster(wss::Settings &settings);
+    /// \brief Multi-process mode: creates pool in master, or turns worker settings into cluster of loopback links
+    /// \param settings
+    /// \param argc
+    /// \param argv
+    /// \return false if not valid config
+    bool configureProcesses(wss::Settings &settings, int argc, const char **argv);
 };
 
 }
@@ -10,8 +10,10 @@
 #define WSSERVER_SETTINGS_HPP
 
 #include "json.hpp"
+#include "../chat/MessageType.h"
 #include <iostream>
 #include <thread>
+#include <unordered_map>
 
 #ifdef setConfig
 #undef setConfig
@@ -31,16 +33,116 @@ struct AuthSettings {
   nlohmann::json data;
 };
 
+struct SocketSettings {
+  bool noDelay = true;
+  int sendBufferBytes = 0;
+  int receiveBufferBytes = 0;
+  int notSentLowatBytes = 16384;
+  uint32_t userTimeoutMillis = 0;
+  int listenBacklog = 0;
+  uint32_t zeroCopyMinBytes = 0;
+};
+
 struct Secure {
   bool enabled = false;
   std::string crtPath;
   std::string keyPath;
+  uint16_t port = 0;
+  long sessionCacheSize = 20480;
+  long sessionTimeoutSeconds = 300;
+  bool sessionTickets = true;
+  long ticketKeyRotationSeconds = 3600;
+  uint32_t maxConcurrentHandshakes = 0;
 };
 
 struct Server {
   /// @todo create simple field
   struct Watchdog {
     bool enabled = false;
+    long pingIntervalSeconds = 60;
+    uint32_t maxMissedPongs = 1;
+  };
+  struct PerMessageDeflate {
+    bool enabled = false;
+    uint32_t minSize = 256;
+    int level = -1;
+    int serverMaxWindowBits = 15;
+    int clientMaxWindowBits = 15;
+    bool serverNoContextTakeover = false;
+    bool clientNoContextTakeover = false;
+  };
+  struct Send {
+    uint32_t coalesceFrames = 1;
+    uint64_t coalesceBytes = 0;
+    uint32_t highWaterFrames = 0;
+    uint64_t highWaterBytes = 0;
+    std::string slowConsumerPolicy = "undelivered";
+    uint32_t normalWeight = 4;
+    uint32_t bulkWeight = 1;
+  };
+  struct Drain {
+    bool enabled = false;
+    uint32_t batchSize = 1000;
+    uint32_t intervalMillis = 100;
+    uint32_t reconnectJitterMillis = 5000;
+    uint32_t flushTimeoutMillis = 2000;
+  };
+  /// \brief Multi-process mode, see wss::WorkerPool
+  struct Processes {
+    /// \brief 0 - single process
+    uint32_t count = 0;
+    bool pinCores = true;
+    /// \brief Worker i listens cluster links on clusterPort + i, loopback only
+    uint16_t clusterPort = 8190;
+    uint32_t restartDelayMillis = 1000;
+  };
+  /// \brief Pre-auth limits of new connections, see wss::server::websocket::ConnectionAdmission
+  struct Admission {
+    uint32_t maxConnectionsPerIp = 0;
+    double connectRatePerIp = 0;
+    double connectBurstPerIp = 0;
+    uint32_t maxHandshakeBytes = 16384;
+    uint32_t handshakeDeadlineMillis = 0;
+  };
+  /// \brief Websockets over HTTP/2, see wss::Http2Gateway
+  struct Http2 {
+    bool enabled = false;
+    std::string address = "0.0.0.0";
+    uint16_t port = 8443;
+    /// \brief TLS with certificate of server.secure, false - cleartext HTTP/2 (behind TLS terminating proxy)
+    bool secure = true;
+    uint32_t maxStreams = 100;
+    uint32_t streamBufferBytes = 262144;
+    uint32_t idleSeconds = 60;
+    uint32_t threads = 1;
+  };
+  /// \brief Global overload controller, see wss::OverloadController
+  struct Overload {
+    bool enabled = false;
+    uint32_t checkMillis = 100;
+    uint32_t lagMillis = 0;
+    uint64_t memoryBytes = 0;
+    uint64_t sendQueueBytes = 0;
+    double rejectConnections = 1.0;
+    double shedBulk = 1.25;
+    double rejectApi = 1.5;
+    double recovery = 0.9;
+  };
+  /// \brief Cpu lists ("0-3,8") of thread groups, empty - not pinned
+  struct Affinity {
+    std::string io;
+    std::string events;
+    std::string auth;
+    std::string background;
+  };
+  /// \brief zstd compression of undelivered store, event outbox and history log records
+  struct SegmentCompression {
+    bool enabled = false;
+    int level = 3;
+    uint32_t dictionaryKB = 16;
+    uint32_t trainSamples = 2000;
+    uint32_t retrainRecords = 1000000;
+    uint32_t minBytes = 32;
   };
 
   Secure secure;
@@ -48,39 +150,236 @@ struct Server {
   std::string address = "*";
   uint16_t port = 8085;
   uint32_t workers = 8;
+  bool reusePort = false;
+  bool ioServicePerThread = false;
+  bool proxyProtocol = false;
+  /// \brief Required reactor: epoll, io_uring. Empty - any. Reactor is chosen at build time, so value is checked
+  std::string ioBackend;
   std::string tmpDir = "/tmp";
+  uint64_t readBufferRetainBytes = 65536;
+  uint64_t readChunkBytes = 4096;
+  /// \brief Accounted memory (see GET /metrics wss_memory_bytes), over which load is shed, 0 - unlimited
+  uint64_t memorySoftLimitBytes = 0;
+  /// \brief Event loop lag probe interval, 0 - disabled
+  uint32_t loopLagProbeMillis = 0;
+  /// \brief Event loop lag over which new connections are rejected, 0 - never
+  uint32_t loopLagLimitMillis = 0;
   Watchdog watchdog;
+  Send send;
+  Drain drain;
+  Processes processes;
+  Admission admission;
+  Http2 http2;
+  Overload overload;
+  Affinity affinity;
+  SegmentCompression segmentCompression;
+  SocketSettings socket;
+  PerMessageDeflate permessageDeflate;
   AuthSettings auth;
+  uint32_t authMaxQueue = 0;
   std::string timezone;
 };
 struct RestApi {
   bool enabled = false;
   std::string address = "*";
   uint16_t port = 8082;
+  /// \brief How long keep-alive connection waits for next request
+  uint32_t idleTimeoutSeconds = 60;
+  /// \brief Connection is closed after this number of requests, 0 - unlimited
+  uint32_t maxRequestsPerConnection = 0;
   AuthSettings auth;
   Secure secure;
+  SocketSettings socket;
 };
 struct Chat {
   struct Message {
     std::string maxSize = "10M";
+    uint32_t maxFragments = 1024;
     bool enableDeliveryStatus = false;
+    std::string deliveryStatusMode = "delivery";
+    uint32_t deliveryStatusFlushMillis = 100;
+    uint32_t deliveryStatusFlushItems = 50;
     bool enableSendBack = false;
     std::vector<std::string> ignoreTypesSendBack;
+    /// \brief ignoreTypesSendBack compiled on load
+    wss::types::TypeSet ignoreTypesSendBackSet;
+    uint32_t maxBatchSize = 100;
+    std::unordered_map<std::string, std::string> priorities;
+    std::vector<std::string> coalescedTypes;
+    std::vector<std::string> ephemeralTypes;
+  };
+  struct RateLimit {
+    struct Bucket {
+      double messagesPerSec = 0;
+      double messagesBurst = 0;
+      double bytesPerSec = 0;
+      double bytesBurst = 0;
+    };
+    Bucket connection;
+    Bucket user;
+    std::string policy = "drop";
+    uint32_t maxDelayMillis = 1000;
+  };
+  struct Presence {
+    bool enabled = false;
+    uint32_t historySize = 1024;
+    std::string topic;
+    bool notifyEvents = false;
   };
   Message message = Message();
+  RateLimit rateLimit = RateLimit();
+  Presence presence = Presence();
+  struct History {
+    bool enabled = false;
+    uint32_t segmentSizeMB = 64;
+    uint32_t maxSizeMB = 1024;
+    uint32_t retentionSeconds = 86400;
+    uint32_t maxPageSize = 500;
+  };
+  History history = History();
+  struct Attachments {
+    bool enabled = false;
+    uint32_t thresholdBytes = 256 * 1024;
+    uint32_t ttlSeconds = 86400;
+  };
+  Attachments attachments = Attachments();
+  struct StatisticsLimits {
+    uint32_t offlineSeconds = 0;
+    uint32_t maxUsers = 0;
+  };
+  StatisticsLimits statistics = StatisticsLimits();
+  struct Scheduler {
+    bool enabled = false;
+    uint32_t tickMillis = 100;
+    uint32_t maxMessages = 1000000;
+    uint32_t maxDelaySeconds = 30 * 86400;
+  };
+  Scheduler scheduler = Scheduler();
+  struct Broadcast {
+    uint32_t connectionsPerSecond = 50000;
+  };
+  Broadcast broadcast = Broadcast();
+  struct RecipientCache {
+    bool enabled = false;
+    uint32_t maxEntries = 4096;
+    uint32_t minRecipients = 8;
+  };
+  RecipientCache recipientCache = RecipientCache();
+  struct OutboundBatch {
+    bool enabled = false;
+    uint32_t lingerMillis = 5;
+    uint32_t maxItems = 64;
+    uint32_t maxBytes = 65536;
+  };
+  OutboundBatch outboundBatch = OutboundBatch();
+  struct Snapshot {
+    bool enabled = false;
+    uint32_t intervalSeconds = 300;
+  };
+  Snapshot snapshot = Snapshot();
+  struct Capture {
+    bool enabled = false;
+    uint32_t maxSeconds = 3600;
+    uint32_t maxSizeMB = 256;
+  };
+  Capture capture = Capture();
+  struct LocalIngest {
+    bool enabled = false;
+    std::string path = "/dev/shm/wsserver-ingest";
+    uint32_t slots = 4096;
+    uint32_t slotBytes = 65536;
+    uint32_t idleSleepMicros = 200;
+  };
+  LocalIngest localIngest = LocalIngest();
+  struct Ingest {
+    bool enabled = false;
+    std::string address = "127.0.0.1";
+    uint16_t port = 8087;
+    std::string token;
+    uint32_t maxFrameBytes = 16 * 1024 * 1024;
+    uint32_t threads = 1;
+  };
+  Ingest ingest = Ingest();
+  struct UndeliveredStorage {
+    std::string type = "memory";
+    uint32_t segmentSizeMB = 64;
+    uint32_t syncIntervalMillis = 100;
+    uint32_t maxPerUser = 0;
+    uint32_t maxMemoryMB = 0;
+    std::string overflowPolicy = "dropOldest";
+    nlohmann::json redis = nlohmann::json::object();
+    uint32_t writeBehindQueueMB = 64;
+  };
   bool enableUndeliveredQueue = false;
+  uint32_t undeliveredTtlSeconds = 0;
+  uint32_t redeliveryBatchSize = 100;
+  uint32_t ackWindow = 0;
+  UndeliveredStorage undeliveredStore = UndeliveredStorage();
+  bool enableClientTopicPublish = false;
+  std::vector<std::string> codecs = {"wss.json.v1", "wss.binary.v1", "wss.msgpack.v1", "wss.cbor.v1"};
 };
 struct Event {
   bool enabled = false;
   bool enableRetry = false;
   bool sendBotMessages = false;
   int retryIntervalSeconds = 10;
+  int retryMaxIntervalSeconds = 300;
+  double retryBackoffMultiplier = 2.0;
+  double retryJitter = 0.2;
   int retryCount = 3;
   uint32_t maxParallelWorkers = 8;
+  struct Outbox {
+    bool enabled = false;
+    uint32_t segmentSizeMB = 64;
+    uint32_t syncIntervalMillis = 100;
+  };
+  Outbox outbox = Outbox();
   std::vector<std::string> ignoreTypes;
+  /// \brief ignoreTypes compiled on load
+  wss::types::TypeSet ignoreTypesSet;
   nlohmann::json targets;
 };
 
+struct Cluster {
+  bool enabled = false;
+  /// \brief links - own node links (ClusterBus), redis - redis pub/sub bridge
+  std::string transport = "links";
+  uint16_t nodeId = 0;
+  std::string address = "0.0.0.0";
+  unsigned short port = 8090;
+  std::string secret;
+  /// \brief Other nodes: array of {id, address, port, url (optional, reconnect hint of handoff)}
+  nlohmann::json nodes = nlohmann::json::array();
+  uint32_t maxPendingMB = 64;
+  uint32_t reconnectIntervalMillis = 1000;
+  uint32_t digestIntervalMillis = 30000;
+  /// \brief Redis bridge connection, same keys as redis event target, and channelPrefix
+  nlohmann::json redis = nlohmann::json::object();
+  /// \brief Users are pinned to nodes of ring, works without cluster.enabled too
+  struct Sharding {
+    bool enabled = false;
+    uint32_t virtualNodes = 128;
+    /// \brief All nodes, including this one: array of {id, url}
+    nlohmann::json ring = nlohmann::json::array();
+  } sharding;
+  /// \brief Draining node sends users state to other node before exit
+  struct Handoff {
+    bool enabled = false;
+    /// \brief 0 - first connected node
+    uint16_t node = 0;
+    /// \brief Max wait for link buffer space and ack of receiver, per batch
+    uint32_t timeoutMillis = 10000;
+  } handoff;
+};
+
+struct Tracing {
+  uint32_t sampleRate = 0;
+  std::string endpoint;
+  std::string serviceName = "wsserver";
+  uint32_t queueSize = 8192;
+  uint32_t flushIntervalMillis = 1000;
+};
+
 struct Settings {
   static Settings &get() {
       static Settings s;
@@ -90,8 +389,20 @@ struct Settings {
   RestApi restApi;
   Chat chat;
   Event event;
+  Cluster cluster;
+  Tracing tracing;
 };
 
+inline void from_json(const nlohmann::json &j, wss::SocketSettings &in) {
+    setConfigDef(in.noDelay, j, "noDelay", true);
+    setConfigDef(in.sendBufferBytes, j, "sendBufferBytes", 0);
+    setConfigDef(in.receiveBufferBytes, j, "receiveBufferBytes", 0);
+    setConfigDef(in.notSentLowatBytes, j, "notSentLowatBytes", 16384);
+    setConfigDef(in.userTimeoutMillis, j, "userTimeoutMillis", (uint32_t) 0);
+    setConfigDef(in.listenBacklog, j, "listenBacklog", 0);
+    setConfigDef(in.zeroCopyMinBytes, j, "zeroCopyMinBytes", (uint32_t) 0);
+}
+
 inline void from_json(const nlohmann::json &j, wss::Settings &in) {
     nlohmann::json server = j.at("server");
     setConfigDef(in.server.address, server, "address", "*");
@@ -104,6 +415,12 @@ inline void from_json(const nlohmann::json &j, wss::Settings &in) {
         setConfig(in.server.secure.crtPath, server["secure"], "crtPath");
         setConfig(in.server.secure.keyPath, server["secure"], "keyPath");
         setConfig(in.server.secure.enabled, server["secure"], "enabled");
+        setConfig(in.server.secure.port, server["secure"], "port");
+        setConfig(in.server.secure.sessionCacheSize, server["secure"], "sessionCacheSize");
+        setConfig(in.server.secure.sessionTimeoutSeconds, server["secure"], "sessionTimeoutSeconds");
+        setConfig(in.server.secure.sessionTickets, server["secure"], "sessionTickets");
+        setConfig(in.server.secure.ticketKeyRotationSeconds, server["secure"], "ticketKeyRotationSeconds");
+        setConfig(in.server.secure.maxConcurrentHandshakes, server["secure"], "maxConcurrentHandshakes");
     }
 
     if (server.find("auth") != server.end()) {
@@ -111,13 +428,108 @@ inline void from_json(const nlohmann::json &j, wss::Settings &in) {
         setConfigDef(in.server.auth.type, server["auth"], "type", "noauth");
         in.server.auth.data = server.at("auth");
     }
+    setConfigDef(in.server.authMaxQueue, server, "authMaxQueue", (uint32_t) 0);
 
     uint32_t nativeThreadsMax =
         (uint32_t) (std::thread::hardware_concurrency() == 0 ? 2 : std::thread::hardware_concurrency());
     setConfigDef(in.server.workers, server, "workers", (uint32_t) nativeThreadsMax);
+    setConfigDef(in.server.reusePort, server, "reusePort", false);
+    setConfigDef(in.server.ioServicePerThread, server, "ioServicePerThread", false);
+    setConfigDef(in.server.proxyProtocol, server, "proxyProtocol", false);
+    setConfigDef(in.server.ioBackend, server, "ioBackend", "");
     setConfigDef(in.server.tmpDir, server, "tmpDir", "/tmp");
+    setConfigDef(in.server.readBufferRetainBytes, server, "readBufferRetainBytes", (uint64_t) 65536);
+    setConfigDef(in.server.readChunkBytes, server, "readChunkBytes", (uint64_t) 4096);
+    setConfigDef(in.server.memorySoftLimitBytes, server, "memorySoftLimitBytes", (uint64_t) 0);
+    setConfigDef(in.server.loopLagProbeMillis, server, "loopLagProbeMillis", (uint32_t) 0);
+    setConfigDef(in.server.loopLagLimitMillis, server, "loopLagLimitMillis", (uint32_t) 0);
     if (server.find("watchdog") != server.end()) {
         setConfig(in.server.watchdog.enabled, server["watchdog"], "enabled");
+        setConfigDef(in.server.watchdog.pingIntervalSeconds, server["watchdog"], "pingIntervalSeconds", 60L);
+        setConfigDef(in.server.watchdog.maxMissedPongs, server["watchdog"], "maxMissedPongs", (uint32_t) 1);
+    }
+    if (server.find("drain") != server.end()) {
+        setConfigDef(in.server.drain.enabled, server["drain"], "enabled", false);
+        setConfigDef(in.server.drain.batchSize, server["drain"], "batchSize", (uint32_t) 1000);
+        setConfigDef(in.server.drain.intervalMillis, server["drain"], "intervalMillis", (uint32_t) 100);
+        setConfigDef(in.server.drain.reconnectJitterMillis, server["drain"], "reconnectJitterMillis", (uint32_t) 5000);
+        setConfigDef(in.server.drain.flushTimeoutMillis, server["drain"], "flushTimeoutMillis", (uint32_t) 2000);
+    }
+    if (server.find("processes") != server.end()) {
+        setConfigDef(in.server.processes.count, server["processes"], "count", (uint32_t) 0);
+        setConfigDef(in.server.processes.pinCores, server["processes"], "pinCores", true);
+        setConfigDef(in.server.processes.clusterPort, server["processes"], "clusterPort", (uint16_t) 8190);
+        setConfigDef(in.server.processes.restartDelayMillis, server["processes"], "restartDelayMillis",
+                     (uint32_t) 1000);
+    }
+    if (server.find("socket") != server.end()) {
+        in.server.socket = server.at("socket").get<wss::SocketSettings>();
+    }
+    if (server.find("affinity") != server.end()) {
+        nlohmann::json affinity = server.at("affinity");
+        setConfigDef(in.server.affinity.io, affinity, "io", "");
+        setConfigDef(in.server.affinity.events, affinity, "events", "");
+        setConfigDef(in.server.affinity.auth, affinity, "auth", "");
+        setConfigDef(in.server.affinity.background, affinity, "background", "");
+    }
+    if (server.find("segmentCompression") != server.end()) {
+        nlohmann::json compression = server.at("segmentCompression");
+        setConfigDef(in.server.segmentCompression.enabled, compression, "enabled", false);
+        setConfigDef(in.server.segmentCompression.level, compression, "level", 3);
+        setConfigDef(in.server.segmentCompression.dictionaryKB, compression, "dictionaryKB", (uint32_t) 16);
+        setConfigDef(in.server.segmentCompression.trainSamples, compression, "trainSamples", (uint32_t) 2000);
+        setConfigDef(in.server.segmentCompression.retrainRecords, compression, "retrainRecords", (uint32_t) 1000000);
+        setConfigDef(in.server.segmentCompression.minBytes, compression, "minBytes", (uint32_t) 32);
+    }
+    if (server.find("admission") != server.end()) {
+        nlohmann::json admission = server.at("admission");
+        setConfigDef(in.server.admission.maxConnectionsPerIp, admission, "maxConnectionsPerIp", (uint32_t) 0);
+        setConfigDef(in.server.admission.connectRatePerIp, admission, "connectRatePerIp", 0.0);
+        setConfigDef(in.server.admission.connectBurstPerIp, admission, "connectBurstPerIp", 0.0);
+        setConfigDef(in.server.admission.maxHandshakeBytes, admission, "maxHandshakeBytes", (uint32_t) 16384);
+        setConfigDef(in.server.admission.handshakeDeadlineMillis, admission, "handshakeDeadlineMillis", (uint32_t) 0);
+    }
+    if (server.find("http2") != server.end()) {
+        nlohmann::json http2 = server.at("http2");
+        setConfigDef(in.server.http2.enabled, http2, "enabled", false);
+        setConfigDef(in.server.http2.address, http2, "address", "0.0.0.0");
+        setConfigDef(in.server.http2.port, http2, "port", (uint16_t) 8443);
+        setConfigDef(in.server.http2.secure, http2, "secure", true);
+        setConfigDef(in.server.http2.maxStreams, http2, "maxStreams", (uint32_t) 100);
+        setConfigDef(in.server.http2.streamBufferBytes, http2, "streamBufferBytes", (uint32_t) 262144);
+        setConfigDef(in.server.http2.idleSeconds, http2, "idleSeconds", (uint32_t) 60);
+        setConfigDef(in.server.http2.threads, http2, "threads", (uint32_t) 1);
+    }
+    if (server.find("overload") != server.end()) {
+        nlohmann::json overload = server.at("overload");
+        setConfigDef(in.server.overload.enabled, overload, "enabled", false);
+        setConfigDef(in.server.overload.checkMillis, overload, "checkMillis", (uint32_t) 100);
+        setConfigDef(in.server.overload.lagMillis, overload, "lagMillis", (uint32_t) 0);
+        setConfigDef(in.server.overload.memoryBytes, overload, "memoryBytes", (uint64_t) 0);
+        setConfigDef(in.server.overload.sendQueueBytes, overload, "sendQueueBytes", (uint64_t) 0);
+        setConfigDef(in.server.overload.rejectConnections, overload, "rejectConnections", 1.0);
+        setConfigDef(in.server.overload.shedBulk, overload, "shedBulk", 1.25);
+        setConfigDef(in.server.overload.rejectApi, overload, "rejectApi", 1.5);
+        setConfigDef(in.server.overload.recovery, overload, "recovery", 0.9);
+    }
+    if (server.find("permessageDeflate") != server.end()) {
+        nlohmann::json deflate = server.at("permessageDeflate");
+        setConfigDef(in.server.permessageDeflate.enabled, deflate, "enabled", false);
+        setConfigDef(in.server.permessageDeflate.minSize, deflate, "minSize", (uint32_t) 256);
+        setConfigDef(in.server.permessageDeflate.level, deflate, "level", -1);
+        setConfigDef(in.server.permessageDeflate.serverMaxWindowBits, deflate, "serverMaxWindowBits", 15);
+        setConfigDef(in.server.permessageDeflate.clientMaxWindowBits, deflate, "clientMaxWindowBits", 15);
+        setConfigDef(in.server.permessageDeflate.serverNoContextTakeover, deflate, "serverNoContextTakeover", false);
+        setConfigDef(in.server.permessageDeflate.clientNoContextTakeover, deflate, "clientNoContextTakeover", false);
+    }
+    if (server.find("send") != server.end()) {
+        setConfigDef(in.server.send.coalesceFrames, server["send"], "coalesceFrames", (uint32_t) 1);
+        setConfigDef(in.server.send.coalesceBytes, server["send"], "coalesceBytes", (uint64_t) 0);
+        setConfigDef(in.server.send.highWaterFrames, server["send"], "highWaterFrames", (uint32_t) 0);
+        setConfigDef(in.server.send.highWaterBytes, server["send"], "highWaterBytes", (uint64_t) 0);
+        setConfigDef(in.server.send.slowConsumerPolicy, server["send"], "slowConsumerPolicy", "undelivered");
+        setConfigDef(in.server.send.normalWeight, server["send"], "normalWeight", (uint32_t) 4);
+        setConfigDef(in.server.send.bulkWeight, server["send"], "bulkWeight", (uint32_t) 1);
     }
 
     if (j.find("restApi") != j.end() && j["restApi"].value("enabled", in.restApi.enabled)) {
@@ -126,11 +538,16 @@ inline void from_json(const nlohmann::json &j, wss::Settings &in) {
         setConfigDef(in.restApi.enabled, restApi, "enabled", false);
         setConfigDef(in.restApi.port, restApi, "port", (uint16_t) 8082);
         setConfigDef(in.restApi.address, restApi, "address", "*");
+        setConfigDef(in.restApi.idleTimeoutSeconds, restApi, "idleTimeoutSeconds", (uint32_t) 60);
+        setConfigDef(in.restApi.maxRequestsPerConnection, restApi, "maxRequestsPerConnection", (uint32_t) 0);
         if (restApi.find("auth") != restApi.end()) {
             in.restApi.auth = wss::AuthSettings();
             setConfigDef(in.restApi.auth.type, restApi["auth"], "type", "noauth");
             in.restApi.auth.data = restApi["auth"];
         }
+        if (restApi.find("socket") != restApi.end()) {
+            in.restApi.socket = restApi.at("socket").get<wss::SocketSettings>();
+        }
 
         if (restApi.find("secure") != restApi.end()) {
             setConfig(in.restApi.secure.crtPath, restApi["secure"], "crtPath");
@@ -142,13 +559,55 @@ inline void from_json(const nlohmann::json &j, wss::Settings &in) {
     if (j.find("chat") != j.end()) {
         nlohmann::json chat = j.at("chat");
         setConfigDef(in.chat.message.enableDeliveryStatus, chat, "enableDeliveryStatus", false);
+        setConfigDef(in.chat.enableClientTopicPublish, chat, "enableClientTopicPublish", false);
+        setConfigDef(in.chat.undeliveredTtlSeconds, chat, "undeliveredTtlSeconds", (uint32_t) 0);
+        setConfigDef(in.chat.redeliveryBatchSize, chat, "redeliveryBatchSize", (uint32_t) 100);
+        setConfigDef(in.chat.ackWindow, chat, "ackWindow", (uint32_t) 0);
+        if (chat.find("undeliveredStore") != chat.end()) {
+            nlohmann::json store = chat.at("undeliveredStore");
+            setConfigDef(in.chat.undeliveredStore.type, store, "type", "memory");
+            setConfigDef(in.chat.undeliveredStore.segmentSizeMB, store, "segmentSizeMB", (uint32_t) 64);
+            setConfigDef(in.chat.undeliveredStore.syncIntervalMillis, store, "syncIntervalMillis", (uint32_t) 100);
+            setConfigDef(in.chat.undeliveredStore.maxPerUser, store, "maxPerUser", (uint32_t) 0);
+            setConfigDef(in.chat.undeliveredStore.maxMemoryMB, store, "maxMemoryMB", (uint32_t) 0);
+            setConfigDef(in.chat.undeliveredStore.overflowPolicy, store, "overflowPolicy", "dropOldest");
+            setConfigDef(in.chat.undeliveredStore.writeBehindQueueMB, store, "writeBehindQueueMB", (uint32_t) 64);
+            if (store.find("redis") != store.end()) {
+                in.chat.undeliveredStore.redis = store.at("redis");
+            }
+        }
+        if (chat.find("codecs") != chat.end()) {
+            in.chat.codecs = chat.at("codecs").get<std::vector<std::string>>();
+        }
 
         if (chat.find("message") != chat.end()) {
             nlohmann::json chatMessage = chat.at("message");
 
             setConfigDef(in.chat.message.maxSize, chatMessage, "maxSize", "10M");
+            setConfigDef(in.chat.message.maxFragments, chatMessage, "maxFragments", (uint32_t) 1024);
             setConfigDef(in.chat.enableUndeliveredQueue, chatMessage, "enableUndeliveredQueue", false);
             setConfigDef(in.chat.message.enableSendBack, chatMessage, "enableSendBack", false);
+            setConfigDef(in.chat.message.maxBatchSize, chatMessage, "maxBatchSize", (uint32_t) 100);
+            setConfigDef(in.chat.message.deliveryStatusMode, chatMessage, "deliveryStatusMode", "delivery");
+            setConfigDef(in.chat.message.deliveryStatusFlushMillis,
+                         chatMessage,
+                         "deliveryStatusFlushMillis",
+                         (uint32_t) 100);
+            setConfigDef(in.chat.message.deliveryStatusFlushItems,
+                         chatMessage,
+                         "deliveryStatusFlushItems",
+                         (uint32_t) 50);
+
+            if (chatMessage.find("priorities") != chatMessage.end()) {
+                in.chat.message.priorities =
+                    chatMessage.at("priorities").get<std::unordered_map<std::string, std::string>>();
+            }
+            if (chatMessage.find("coalescedTypes") != chatMessage.end()) {
+                in.chat.message.coalescedTypes = chatMessage.at("coalescedTypes").get<std::vector<std::string>>();
+            }
+            if (chatMessage.find("ephemeralTypes") != chatMessage.end()) {
+                in.chat.message.ephemeralTypes = chatMessage.at("ephemeralTypes").get<std::vector<std::string>>();
+            }
 
             if (chatMessage.find("ignoredTypesSendBack") != chatMessage.end()) {
                 in.chat.message.ignoreTypesSendBack =
@@ -156,9 +615,150 @@ inline void from_json(const nlohmann::json &j, wss::Settings &in) {
             } else {
                 in.chat.message.ignoreTypesSendBack.resize(0);
             }
+            in.chat.message.ignoreTypesSendBackSet = wss::types::compile(in.chat.message.ignoreTypesSendBack);
+        }
+
+        if (chat.find("rateLimit") != chat.end()) {
+            nlohmann::json rateLimit = chat.at("rateLimit");
+            setConfigDef(in.chat.rateLimit.policy, rateLimit, "policy", "drop");
+            setConfigDef(in.chat.rateLimit.maxDelayMillis, rateLimit, "maxDelayMillis", (uint32_t) 1000);
+
+            const auto readBucket = [&rateLimit](const char *name, Chat::RateLimit::Bucket &bucket) {
+              if (rateLimit.find(name) == rateLimit.end()) {
+                  return;
+              }
+              nlohmann::json src = rateLimit.at(name);
+              setConfigDef(bucket.messagesPerSec, src, "messagesPerSec", 0.0);
+              setConfigDef(bucket.messagesBurst, src, "messagesBurst", 0.0);
+              setConfigDef(bucket.bytesPerSec, src, "bytesPerSec", 0.0);
+              setConfigDef(bucket.bytesBurst, src, "bytesBurst", 0.0);
+            };
+            readBucket("connection", in.chat.rateLimit.connection);
+            readBucket("user", in.chat.rateLimit.user);
+        }
+
+        if (chat.find("presence") != chat.end()) {
+            nlohmann::json presence = chat.at("presence");
+            setConfigDef(in.chat.presence.enabled, presence, "enabled", false);
+            setConfigDef(in.chat.presence.historySize, presence, "historySize", (uint32_t) 1024);
+            setConfigDef(in.chat.presence.topic, presence, "topic", "");
+            setConfigDef(in.chat.presence.notifyEvents, presence, "notifyEvents", false);
+        }
+        if (chat.find("history") != chat.end()) {
+            nlohmann::json history = chat.at("history");
+            setConfigDef(in.chat.history.enabled, history, "enabled", false);
+            setConfigDef(in.chat.history.segmentSizeMB, history, "segmentSizeMB", (uint32_t) 64);
+            setConfigDef(in.chat.history.maxSizeMB, history, "maxSizeMB", (uint32_t) 1024);
+            setConfigDef(in.chat.history.retentionSeconds, history, "retentionSeconds", (uint32_t) 86400);
+            setConfigDef(in.chat.history.maxPageSize, history, "maxPageSize", (uint32_t) 500);
+        }
+        if (chat.find("statistics") != chat.end()) {
+            nlohmann::json statistics = chat.at("statistics");
+            setConfigDef(in.chat.statistics.offlineSeconds, statistics, "offlineSeconds", (uint32_t) 0);
+            setConfigDef(in.chat.statistics.maxUsers, statistics, "maxUsers", (uint32_t) 0);
+        }
+        if (chat.find("scheduler") != chat.end()) {
+            nlohmann::json scheduler = chat.at("scheduler");
+            setConfigDef(in.chat.scheduler.enabled, scheduler, "enabled", false);
+            setConfigDef(in.chat.scheduler.tickMillis, scheduler, "tickMillis", (uint32_t) 100);
+            setConfigDef(in.chat.scheduler.maxMessages, scheduler, "maxMessages", (uint32_t) 1000000);
+            setConfigDef(in.chat.scheduler.maxDelaySeconds, scheduler, "maxDelaySeconds", (uint32_t) 30 * 86400);
+        }
+        if (chat.find("broadcast") != chat.end()) {
+            nlohmann::json broadcast = chat.at("broadcast");
+            setConfigDef(in.chat.broadcast.connectionsPerSecond, broadcast, "connectionsPerSecond", (uint32_t) 50000);
+        }
+        if (chat.find("recipientCache") != chat.end()) {
+            nlohmann::json recipientCache = chat.at("recipientCache");
+            setConfigDef(in.chat.recipientCache.enabled, recipientCache, "enabled", false);
+            setConfigDef(in.chat.recipientCache.maxEntries, recipientCache, "maxEntries", (uint32_t) 4096);
+            setConfigDef(in.chat.recipientCache.minRecipients, recipientCache, "minRecipients", (uint32_t) 8);
+        }
+        if (chat.find("outboundBatch") != chat.end()) {
+            nlohmann::json outboundBatch = chat.at("outboundBatch");
+            setConfigDef(in.chat.outboundBatch.enabled, outboundBatch, "enabled", false);
+            setConfigDef(in.chat.outboundBatch.lingerMillis, outboundBatch, "lingerMillis", (uint32_t) 5);
+            setConfigDef(in.chat.outboundBatch.maxItems, outboundBatch, "maxItems", (uint32_t) 64);
+            setConfigDef(in.chat.outboundBatch.maxBytes, outboundBatch, "maxBytes", (uint32_t) 65536);
+        }
+        if (chat.find("attachments") != chat.end()) {
+            nlohmann::json attachments = chat.at("attachments");
+            setConfigDef(in.chat.attachments.enabled, attachments, "enabled", false);
+            setConfigDef(in.chat.attachments.thresholdBytes, attachments, "thresholdBytes", (uint32_t) 262144);
+            setConfigDef(in.chat.attachments.ttlSeconds, attachments, "ttlSeconds", (uint32_t) 86400);
+        }
+        if (chat.find("snapshot") != chat.end()) {
+            nlohmann::json snapshot = chat.at("snapshot");
+            setConfigDef(in.chat.snapshot.enabled, snapshot, "enabled", false);
+            setConfigDef(in.chat.snapshot.intervalSeconds, snapshot, "intervalSeconds", (uint32_t) 300);
+        }
+        if (chat.find("capture") != chat.end()) {
+            nlohmann::json capture = chat.at("capture");
+            setConfigDef(in.chat.capture.enabled, capture, "enabled", false);
+            setConfigDef(in.chat.capture.maxSeconds, capture, "maxSeconds", (uint32_t) 3600);
+            setConfigDef(in.chat.capture.maxSizeMB, capture, "maxSizeMB", (uint32_t) 256);
+        }
+        if (chat.find("localIngest") != chat.end()) {
+            nlohmann::json ingest = chat.at("localIngest");
+            setConfigDef(in.chat.localIngest.enabled, ingest, "enabled", false);
+            setConfigDef(in.chat.localIngest.path, ingest, "path", "/dev/shm/wsserver-ingest");
+            setConfigDef(in.chat.localIngest.slots, ingest, "slots", (uint32_t) 4096);
+            setConfigDef(in.chat.localIngest.slotBytes, ingest, "slotBytes", (uint32_t) 65536);
+            setConfigDef(in.chat.localIngest.idleSleepMicros, ingest, "idleSleepMicros", (uint32_t) 200);
+        }
+        if (chat.find("ingest") != chat.end()) {
+            nlohmann::json ingest = chat.at("ingest");
+            setConfigDef(in.chat.ingest.enabled, ingest, "enabled", false);
+            setConfigDef(in.chat.ingest.address, ingest, "address", "127.0.0.1");
+            setConfigDef(in.chat.ingest.port, ingest, "port", (uint16_t) 8087);
+            setConfigDef(in.chat.ingest.token, ingest, "token", "");
+            setConfigDef(in.chat.ingest.maxFrameBytes, ingest, "maxFrameBytes", (uint32_t) 16 * 1024 * 1024);
+            setConfigDef(in.chat.ingest.threads, ingest, "threads", (uint32_t) 1);
         }
     }
 
+    if (j.find("cluster") != j.end()) {
+        nlohmann::json cluster = j.at("cluster");
+        setConfigDef(in.cluster.enabled, cluster, "enabled", false);
+        setConfigDef(in.cluster.transport, cluster, "transport", "links");
+        setConfigDef(in.cluster.nodeId, cluster, "nodeId", (uint16_t) 0);
+        setConfigDef(in.cluster.address, cluster, "address", "0.0.0.0");
+        setConfigDef(in.cluster.port, cluster, "port", (unsigned short) 8090);
+        setConfigDef(in.cluster.secret, cluster, "secret", "");
+        setConfigDef(in.cluster.maxPendingMB, cluster, "maxPendingMB", (uint32_t) 64);
+        setConfigDef(in.cluster.reconnectIntervalMillis, cluster, "reconnectIntervalMillis", (uint32_t) 1000);
+        setConfigDef(in.cluster.digestIntervalMillis, cluster, "digestIntervalMillis", (uint32_t) 30000);
+        if (cluster.find("nodes") != cluster.end()) {
+            in.cluster.nodes = cluster.at("nodes");
+        }
+        if (cluster.find("redis") != cluster.end()) {
+            in.cluster.redis = cluster.at("redis");
+        }
+        if (cluster.find("sharding") != cluster.end()) {
+            nlohmann::json sharding = cluster.at("sharding");
+            setConfigDef(in.cluster.sharding.enabled, sharding, "enabled", false);
+            setConfigDef(in.cluster.sharding.virtualNodes, sharding, "virtualNodes", (uint32_t) 128);
+            if (sharding.find("ring") != sharding.end()) {
+                in.cluster.sharding.ring = sharding.at("ring");
+            }
+        }
+        if (cluster.find("handoff") != cluster.end()) {
+            nlohmann::json handoff = cluster.at("handoff");
+            setConfigDef(in.cluster.handoff.enabled, handoff, "enabled", false);
+            setConfigDef(in.cluster.handoff.node, handoff, "node", (uint16_t) 0);
+            setConfigDef(in.cluster.handoff.timeoutMillis, handoff, "timeoutMillis", (uint32_t) 10000);
+        }
+    }
+
+    if (j.find("tracing") != j.end()) {
+        nlohmann::json tracing = j.at("tracing");
+        setConfigDef(in.tracing.sampleRate, tracing, "sampleRate", (uint32_t) 0);
+        setConfigDef(in.tracing.endpoint, tracing, "endpoint", "");
+        setConfigDef(in.tracing.serviceName, tracing, "serviceName", "wsserver");
+        setConfigDef(in.tracing.queueSize, tracing, "queueSize", (uint32_t) 8192);
+        setConfigDef(in.tracing.flushIntervalMillis, tracing, "flushIntervalMillis", (uint32_t) 1000);
+    }
+
     if (j.find("event") != j.end()) {
         nlohmann::json event = j.at("event");
         setConfig(in.event.enabled, event, "enabled");
@@ -175,14 +775,24 @@ inline void from_json(const nlohmann::json &j, wss::Settings &in) {
             setConfigDef(in.event.enableRetry, event, "enableRetry", true);
             setConfigDef(in.event.sendBotMessages, event, "sendBotMessages", false);
             setConfigDef(in.event.retryIntervalSeconds, event, "retryIntervalSeconds", 10);
+            setConfigDef(in.event.retryMaxIntervalSeconds, event, "retryMaxIntervalSeconds", 300);
+            setConfigDef(in.event.retryBackoffMultiplier, event, "retryBackoffMultiplier", 2.0);
+            setConfigDef(in.event.retryJitter, event, "retryJitter", 0.2);
             setConfigDef(in.event.retryCount, event, "retryCount", 3);
             setConfigDef(in.event.maxParallelWorkers, event, "maxParallelWorkers", (uint32_t) (nativeThreadsMax * 2));
+            if (event.find("outbox") != event.end()) {
+                nlohmann::json outbox = event.at("outbox");
+                setConfigDef(in.event.outbox.enabled, outbox, "enabled", false);
+                setConfigDef(in.event.outbox.segmentSizeMB, outbox, "segmentSizeMB", (uint32_t) 64);
+                setConfigDef(in.event.outbox.syncIntervalMillis, outbox, "syncIntervalMillis", (uint32_t) 100);
+            }
 
             if (event.find("ignoreTypes") != event.end() && event.at("ignoreTypes").is_array()) {
                 in.event.ignoreTypes = event.at("ignoreTypes").get<std::vector<std::string>>();
             } else {
                 in.event.ignoreTypes.resize(0);
             }
+            in.event.ignoreTypesSet = wss::types::compile(in.event.ignoreTypes);
         }
     }
 }
@@ -16,6 +16,9 @@
 #include <boost/asio/ssl/context.hpp>
 #include <functional>
 #include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 using namespace boost;
@@ -36,140 +39,164 @@ using io_context_service = asio::io_service;
 }
 #endif
 
-class SocketLayerWrapper {
- private:
-    asio::ip::tcp::socket *m_insecure;
-    asio::ssl::stream<asio::ip::tcp::socket> *m_secure;
+namespace wss {
+/// \brief Reactor of all asio sockets and timers, selected at build time (see -DENABLE_IO_URING)
+#if defined(BOOST_ASIO_HAS_IO_URING) && defined(BOOST_ASIO_DISABLE_EPOLL)
+constexpr const char *IO_BACKEND = "io_uring";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+constexpr const char *IO_BACKEND = "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+constexpr const char *IO_BACKEND = "kqueue";
+#else
+constexpr const char *IO_BACKEND = "select";
+#endif
+}
 
+/// \brief Plain tcp socket or TLS stream over it, kept inline: connection has one allocation for both.
+/// Operations call one branch, that passes concrete stream to asio, so composed operations are instantiated
+/// for each stream type and handlers are moved to them as is (not copied, not type-erased)
+class SocketLayerWrapper {
  public:
-    template<typename ...Args>
-    SocketLayerWrapper(Args &&...args) {
-        asio::io_service srv;
-        if (sizeof...(args) == 1) {
-            m_insecure = new asio::ip::tcp::socket(std::forward<Args>(args)...);
-            m_secure = nullptr;
+    using PlainStream = asio::ip::tcp::socket;
+    using SecureStream = asio::ssl::stream<asio::ip::tcp::socket>;
+
+    explicit SocketLayerWrapper(wss::io_context_service &ioContext) :
+        m_isSecure(false) {
+        new(&m_storage) PlainStream(ioContext);
+    }
+
+    SocketLayerWrapper(wss::io_context_service &ioContext, asio::ssl::context &sslContext) :
+        m_isSecure(true) {
+        new(&m_storage) SecureStream(ioContext, sslContext);
+    }
+
+    SocketLayerWrapper(const SocketLayerWrapper &other) = delete;
+    SocketLayerWrapper &operator=(const SocketLayerWrapper &other) = delete;
+
+    ~SocketLayerWrapper() {
+        if (m_isSecure) {
+            secure().~SecureStream();
         } else {
-            m_secure = new asio::ssl::stream<asio::ip::tcp::socket>(std::forward<Args>(args)...);
-            m_insecure = nullptr;
+            plain().~PlainStream();
         }
+    }
 
+    /// \return nullptr for TLS connection
+    PlainStream *rawInsecure() {
+        return m_isSecure ? nullptr : &plain();
     }
-    SocketLayerWrapper(wss::io_context_service &ioContext) {
-        m_insecure = new asio::ip::tcp::socket(ioContext);
-        m_secure = nullptr;
+
+    /// \return nullptr for plain connection
+    SecureStream *rawSecure() {
+        return m_isSecure ? &secure() : nullptr;
     }
 
-    SocketLayerWrapper(wss::io_context_service &ioContext, asio::ssl::context &sslContext) {
-        m_secure = new asio::ssl::stream<asio::ip::tcp::socket>(ioContext, sslContext);
-        m_insecure = nullptr;
+    /// \brief Calls fn with concrete stream, PlainStream& or SecureStream&
+    /// \param fn generic callable, returns the same type for both streams
+    template<typename Fn>
+    auto visit(Fn &&fn) -> decltype(fn(std::declval<PlainStream &>())) {
+        if (m_isSecure) {
+            return fn(secure());
+        }
+        return fn(plain());
     }
 
-    asio::ip::tcp::socket *rawInsecure() {
-        return m_insecure;
+    template<typename ReadHandler>
+    void async_read_until(asio::streambuf &streambuf, const std::string &match_condition, ReadHandler &&handler) {
+        visit([&](auto &stream) {
+          asio::async_read_until(stream, streambuf, match_condition, std::forward<ReadHandler>(handler));
+        });
     }
 
-    asio::ssl::stream<asio::ip::tcp::socket> *rawSecure() {
-        return m_secure;
+    /// \brief async_read_until with match condition (see asio::is_match_condition)
+    template<typename MatchCondition, typename ReadHandler>
+    void async_read_until_match(asio::streambuf &streambuf, MatchCondition cond, ReadHandler &&handler) {
+        visit([&](auto &stream) {
+          asio::async_read_until(stream, streambuf, cond, std::forward<ReadHandler>(handler));
+        });
     }
 
-    template<typename ReadHandler = std::function<void(system::error_code, std::size_t)>>
-    void async_read_until(asio::streambuf &streambuf, const std::string &match_condition, const ReadHandler &handler) {
-        if (isSecure()) {
-            asio::async_read_until(*rawSecure(), streambuf, match_condition, handler);
-        } else {
-            asio::async_read_until(*rawInsecure(), streambuf, match_condition, handler);
-        }
+    template<typename CompleteCondition, typename ReadHandler>
+    void async_read(asio::streambuf &streambuf, CompleteCondition cond, ReadHandler &&handler) {
+        visit([&](auto &stream) {
+          asio::async_read(stream, streambuf, cond, std::forward<ReadHandler>(handler));
+        });
     }
 
-    template<typename CompleteCondition, typename ReadHandler = std::function<void(system::error_code, std::size_t)>>
-    void async_read(asio::streambuf &streambuf, CompleteCondition cond, const ReadHandler &handler) {
-        if (isSecure()) {
-            asio::async_read(*rawSecure(), streambuf, cond, handler);
-        } else {
-            asio::async_read(*rawInsecure(), streambuf, cond, handler);
-        }
+    template<typename ReadHandler>
+    void async_read_some(const asio::mutable_buffer &buffer, ReadHandler &&handler) {
+        visit([&](auto &stream) {
+          stream.async_read_some(asio::mutable_buffers_1(buffer), std::forward<ReadHandler>(handler));
+        });
     }
 
     template<typename... Args>
     void set_option(Args &&... args) {
-        if (isSecure()) {
-            m_secure->lowest_layer().set_option(std::forward<Args>(args)...);
-        } else {
-            m_insecure->set_option(std::forward<Args>(args)...);
-        }
+        lowest_layer().set_option(std::forward<Args>(args)...);
     }
 
-    template<typename WriteHandler = std::function<void(system::error_code, std::size_t)>>
-    void async_write(asio::streambuf &streambuf, const WriteHandler &handler) {
-        if (isSecure()) {
-            asio::async_write(*rawSecure(), streambuf, handler);
-        } else {
-            asio::async_write(*rawInsecure(), streambuf, handler);
-        }
+    template<typename WriteHandler>
+    void async_write(asio::streambuf &streambuf, WriteHandler &&handler) {
+        visit([&](auto &stream) {
+          asio::async_write(stream, streambuf, std::forward<WriteHandler>(handler));
+        });
     }
 
-    template<typename WriteHandler = std::function<void(system::error_code, std::size_t)>>
-    void async_write(const std::vector<asio::const_buffer> &streambuf, const WriteHandler &handler) {
-        if (isSecure()) {
-            asio::async_write(*rawSecure(), streambuf, handler);
-        } else {
-            asio::async_write(*rawInsecure(), streambuf, handler);
-        }
+    template<typename WriteHandler>
+    void async_write(const std::vector<asio::const_buffer> &streambuf, WriteHandler &&handler) {
+        visit([&](auto &stream) {
+          asio::async_write(stream, streambuf, std::forward<WriteHandler>(handler));
+        });
     }
 
-    template<typename HandshakeHandler = std::function<void(boost::system::error_code)>>
-    void async_handshake(const HandshakeHandler &handler) {
-        if (isSecure()) {
-            m_secure->async_handshake(asio::ssl::stream_base::server, handler);
+    template<typename HandshakeHandler>
+    void async_handshake(HandshakeHandler &&handler) {
+        if (m_isSecure) {
+            secure().async_handshake(asio::ssl::stream_base::server, std::forward<HandshakeHandler>(handler));
         }
     }
 
-    const wss::basic_socket_name &lowest_layer() const {
-        if (isSecure()) {
-            return m_secure->lowest_layer();
-        }
+    /// \brief Tcp stream: socket itself, or stream under TLS layer. Reads from it bypass TLS
+    asio::ip::tcp::socket &stream_layer() {
+        return m_isSecure ? secure().next_layer() : plain();
+    }
 
-        return m_insecure->lowest_layer();
+    const wss::basic_socket_name &lowest_layer() const {
+        return m_isSecure ? secure().lowest_layer() : plain().lowest_layer();
     }
 
     wss::basic_socket_name &lowest_layer() {
-        if (isSecure()) {
-            return m_secure->lowest_layer();
-        }
-
-        return m_insecure->lowest_layer();
+        return m_isSecure ? secure().lowest_layer() : plain().lowest_layer();
     }
 
     const wss::io_context_service &get_io_service() const {
-        if (isSecure()) {
-            return m_secure->get_io_service();
-        }
-
-        return m_insecure->get_io_service();
+        return const_cast<SocketLayerWrapper *>(this)->get_io_service();
     }
 
     wss::io_context_service &get_io_service() {
-        if (isSecure()) {
-            return m_secure->get_io_service();
-        }
+        return m_isSecure ? secure().get_io_service() : plain().get_io_service();
+    }
 
-        return m_insecure->get_io_service();
+    bool isSecure() const {
+        return m_isSecure;
     }
 
-    ~SocketLayerWrapper() {
-        if (m_secure != nullptr) {
-            delete m_secure;
-        }
+ private:
+    std::aligned_union<0, PlainStream, SecureStream>::type m_storage;
+    const bool m_isSecure;
 
-        if (m_insecure != nullptr) {
-            delete m_insecure;
-        }
+    PlainStream &plain() {
+        return *reinterpret_cast<PlainStream *>(&m_storage);
     }
-
-    bool isSecure() const {
-        return m_secure != nullptr;
+    const PlainStream &plain() const {
+        return *reinterpret_cast<const PlainStream *>(&m_storage);
+    }
+    SecureStream &secure() {
+        return *reinterpret_cast<SecureStream *>(&m_storage);
+    }
+    const SecureStream &secure() const {
+        return *reinterpret_cast<const SecureStream *>(&m_storage);
     }
-
 };
 
 #endif //WSSERVER_SOCKETLAYERWRAPPER_HPP
@@ -0,0 +1,90 @@
+/**
+ * wsserver
+ * SocketOptions.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_SOCKETOPTIONS_HPP
+#define WSSERVER_SOCKETOPTIONS_HPP
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/socket_base.hpp>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace wss {
+
+/// \brief Tcp options of listener and accepted sockets. Defaults are for latency of small messages:
+/// no Nagle delay, small unsent kernel buffer (queued frames wait in user space, where priority lanes
+/// and coalescing apply), full accept backlog
+struct SocketOptions {
+  /// \brief TCP_NODELAY
+  bool noDelay = true;
+  /// \brief SO_SNDBUF, 0 - kernel default (autotuning)
+  int sendBufferBytes = 0;
+  /// \brief SO_RCVBUF, 0 - kernel default (autotuning). Set on listener, so window scale is negotiated by it
+  int receiveBufferBytes = 0;
+  /// \brief TCP_NOTSENT_LOWAT: socket is writable only while unsent data is below it, 0 - kernel default
+  int notSentLowatBytes = 16 * 1024;
+  /// \brief TCP_USER_TIMEOUT: connection is dropped when sent data is not acked for this time, 0 - kernel default
+  unsigned userTimeoutMillis = 0;
+  /// \brief listen() backlog, 0 - SOMAXCONN
+  int listenBacklog = 0;
+  /// \brief Plain connections: writes of at least this size are sent with MSG_ZEROCOPY (Linux), 0 - disabled
+  std::size_t zeroCopyMinBytes = 0;
+};
+
+namespace socketopts {
+
+template<typename Socket, typename Option>
+void set(Socket &socket, const Option &option) noexcept {
+    boost::system::error_code ec;
+    socket.set_option(option, ec);
+}
+
+/// \brief Buffer sizes of listener are inherited by accepted sockets
+/// \param listener opened tcp acceptor
+/// \param options
+inline void applyListener(boost::asio::ip::tcp::acceptor &listener, const SocketOptions &options) noexcept {
+    if (options.sendBufferBytes > 0) {
+        set(listener, boost::asio::socket_base::send_buffer_size(options.sendBufferBytes));
+    }
+    if (options.receiveBufferBytes > 0) {
+        set(listener, boost::asio::socket_base::receive_buffer_size(options.receiveBufferBytes));
+    }
+}
+
+inline int getBacklog(const SocketOptions &options) noexcept {
+    return options.listenBacklog > 0 ? options.listenBacklog : SOMAXCONN;
+}
+
+/// \brief Sets options of accepted socket. Errors are ignored: unix sockets have no tcp options
+/// \param socket
+/// \param options
+template<typename Socket>
+void apply(Socket &socket, const SocketOptions &options) noexcept {
+    set(socket, boost::asio::ip::tcp::no_delay(options.noDelay));
+    if (options.sendBufferBytes > 0) {
+        set(socket, boost::asio::socket_base::send_buffer_size(options.sendBufferBytes));
+    }
+#ifdef TCP_NOTSENT_LOWAT
+    if (options.notSentLowatBytes > 0) {
+        set(socket, boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_NOTSENT_LOWAT>(
+            options.notSentLowatBytes));
+    }
+#endif
+#ifdef TCP_USER_TIMEOUT
+    if (options.userTimeoutMillis > 0) {
+        set(socket, boost::asio::detail::socket_option::integer<IPPROTO_TCP, TCP_USER_TIMEOUT>(
+            static_cast<int>(options.userTimeoutMillis)));
+    }
+#endif
+}
+
+}
+}
+
+#endif //WSSERVER_SOCKETOPTIONS_HPP
@@ -0,0 +1,153 @@
+/**
+ * wsserver
+ * TopK.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "TopK.h"
+#include <algorithm>
+#include <mutex>
+
+namespace {
+
+using namespace wss::topk;
+using wss::utils::SpaceSaving;
+
+constexpr std::size_t MAX_LABEL_LENGTH = 64;
+
+/// \brief Summaries of one thread or merged ones
+struct Summaries {
+  std::array<SpaceSaving, DIMENSIONS> dimensions{{
+      SpaceSaving(CAPACITY), SpaceSaving(CAPACITY), SpaceSaving(CAPACITY)
+  }};
+
+  void mergeTo(Summaries &out) const {
+      for (std::size_t i = 0; i < DIMENSIONS; i++) {
+          out.dimensions[i].merge(dimensions[i]);
+      }
+  }
+
+  void clear() {
+      for (auto &dimension: dimensions) {
+          dimension.clear();
+      }
+  }
+};
+
+struct Slot {
+  std::mutex mutex;
+  Summaries summaries;
+};
+
+/// \brief FNV-1a: type names are keyed by hash, name itself is stored only by summary item
+uint64_t hashOf(const std::string &value) noexcept {
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c: value) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/// \brief Slots of running threads and merged summaries of finished ones
+class Registry {
+ public:
+    static Registry &get() {
+        // never destroyed: threads could finish after static destructors
+        static Registry *registry = new Registry();
+        return *registry;
+    }
+
+    void attach(Slot *slot) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_slots.push_back(slot);
+    }
+
+    void detach(Slot *slot) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        {
+            std::lock_guard<std::mutex> slotLock(slot->mutex);
+            slot->summaries.mergeTo(m_finished);
+        }
+        m_slots.erase(std::remove(m_slots.begin(), m_slots.end(), slot), m_slots.end());
+    }
+
+    Snapshot collect(std::size_t limit) {
+        Summaries merged;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished.mergeTo(merged);
+            for (Slot *slot: m_slots) {
+                std::lock_guard<std::mutex> slotLock(slot->mutex);
+                slot->summaries.mergeTo(merged);
+            }
+        }
+
+        Snapshot out;
+        for (std::size_t i = 0; i < DIMENSIONS; i++) {
+            out.items[i] = merged.dimensions[i].top(limit);
+            out.totals[i] = merged.dimensions[i].getTotal();
+        }
+        return out;
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished.clear();
+        for (Slot *slot: m_slots) {
+            std::lock_guard<std::mutex> slotLock(slot->mutex);
+            slot->summaries.clear();
+        }
+    }
+
+ private:
+    std::mutex m_mutex;
+    std::vector<Slot *> m_slots;
+    Summaries m_finished;
+};
+
+struct ThreadSlot {
+  Slot slot;
+
+  ThreadSlot() {
+      Registry::get().attach(&slot);
+  }
+  ~ThreadSlot() {
+      Registry::get().detach(&slot);
+  }
+};
+
+Slot &local() {
+    thread_local ThreadSlot threadSlot;
+    return threadSlot.slot;
+}
+
+}
+
+void wss::topk::add(Dimension dimension, uint64_t key, uint64_t weight) {
+    Slot &slot = local();
+    std::lock_guard<std::mutex> lock(slot.mutex);
+    slot.summaries.dimensions[static_cast<std::size_t>(dimension)].add(key, weight);
+}
+
+void wss::topk::addType(const std::string &type, uint64_t weight) {
+    const uint64_t key = hashOf(type);
+    Slot &slot = local();
+    std::lock_guard<std::mutex> lock(slot.mutex);
+    SpaceSaving &types = slot.summaries.dimensions[static_cast<std::size_t>(Dimension::Types)];
+    if (type.size() > MAX_LABEL_LENGTH) {
+        types.add(key, weight, type.substr(0, MAX_LABEL_LENGTH));
+    } else {
+        types.add(key, weight, type);
+    }
+}
+
+wss::topk::Snapshot wss::topk::collect(std::size_t limit) {
+    return Registry::get().collect(limit);
+}
+
+void wss::topk::reset() {
+    Registry::get().reset();
+}
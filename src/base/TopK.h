@@ -0,0 +1,74 @@
+/**
+ * wsserver
+ * TopK.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_TOPK_H
+#define WSSERVER_TOPK_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../helpers/space_saving.hpp"
+
+namespace wss {
+namespace topk {
+
+/// \brief Tracked traffic keys
+enum class Dimension : std::size_t {
+  /// \brief Users by sent messages
+  Senders = 0,
+  /// \brief Users by delivered messages
+  Recipients,
+  /// \brief Message types by sent messages
+  Types,
+  Count
+};
+
+constexpr std::size_t DIMENSIONS = static_cast<std::size_t>(Dimension::Count);
+/// \brief Counters per dimension of each thread and of merged summary: about 12 KB per thread for all dimensions
+constexpr std::size_t CAPACITY = 128;
+
+using Item = wss::utils::SpaceSaving::Item;
+
+struct Snapshot {
+  std::array<std::vector<Item>, DIMENSIONS> items;
+  /// \brief Sum of all counted messages of dimension, to compare items with
+  std::array<uint64_t, DIMENSIONS> totals{};
+
+  const std::vector<Item> &get(Dimension dimension) const noexcept {
+      return items[static_cast<std::size_t>(dimension)];
+  }
+  uint64_t getTotal(Dimension dimension) const noexcept {
+      return totals[static_cast<std::size_t>(dimension)];
+  }
+};
+
+/// \brief Counts key in summary of calling thread. Summary lock is taken only by owner thread and by collect(),
+/// so it's never contended on hot path
+/// \param dimension Senders or Recipients
+/// \param key user id
+/// \param weight
+void add(Dimension dimension, uint64_t key, uint64_t weight = 1);
+
+/// \brief Counts message type, names longer than 64 chars are truncated in output
+/// \param type
+/// \param weight
+void addType(const std::string &type, uint64_t weight = 1);
+
+/// \brief Merges summaries of all threads, including finished ones
+/// \param limit number of items per dimension
+/// \return items ordered by count descending
+Snapshot collect(std::size_t limit);
+
+/// \brief Drops all counters, to start tracking from now
+void reset();
+
+}
+}
+
+#endif //WSSERVER_TOPK_H
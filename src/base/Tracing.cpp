@@ -0,0 +1,354 @@
+/**
+ * wsserver
+ * Tracing.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "Tracing.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <thread>
+#include "json.hpp"
+#include "../web/HttpClient.h"
+
+namespace {
+
+using namespace wss::tracing;
+
+struct SpanRecord {
+  std::string name;
+  SpanContext span;
+  int64_t startNanos;
+  int64_t endNanos;
+  Attributes attributes;
+  bool error;
+};
+
+std::atomic<uint32_t> sampleRate(0);
+std::atomic<uint64_t> recorded(0);
+std::atomic<uint64_t> exported(0);
+std::atomic<uint64_t> dropped(0);
+std::atomic<uint64_t> failed(0);
+
+const SpanContext *&currentSpan() noexcept {
+    static thread_local const SpanContext *span = nullptr;
+    return span;
+}
+
+uint64_t randomId() {
+    static thread_local std::mt19937_64 generator(std::random_device{}());
+    uint64_t out;
+    do {
+        out = generator();
+    } while (out == 0);
+    return out;
+}
+
+void appendHex(std::string &out, uint64_t value) {
+    char buffer[17];
+    std::snprintf(buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+    out.append(buffer, 16);
+}
+
+std::string hex(uint64_t value) {
+    std::string out;
+    appendHex(out, value);
+    return out;
+}
+
+bool parseHex(const std::string &value, std::size_t offset, std::size_t length, uint64_t &out) {
+    out = 0;
+    for (std::size_t i = offset; i < offset + length; i++) {
+        const char c = value[i];
+        uint64_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = static_cast<uint64_t>(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = static_cast<uint64_t>(c - 'a' + 10);
+        } else {
+            return false;
+        }
+        out = (out << 4u) | digit;
+    }
+    return true;
+}
+
+int64_t toUnixNanos(std::chrono::steady_clock::time_point point) {
+    const auto fromNow = point - std::chrono::steady_clock::now();
+    const auto wall = std::chrono::system_clock::now()
+        + std::chrono::duration_cast<std::chrono::system_clock::duration>(fromNow);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(wall.time_since_epoch()).count();
+}
+
+/// \brief Finished spans queue and thread, that sends them to OTLP/HTTP receiver
+class Exporter {
+ public:
+    explicit Exporter(const Config &config) :
+        m_config(config),
+        m_stop(false),
+        m_thread(&Exporter::run, this) {
+    }
+
+    void push(SpanRecord &&record) {
+        bool flush;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stop || m_queue.size() >= m_config.queueSize) {
+                dropped++;
+                return;
+            }
+            m_queue.push_back(std::move(record));
+            flush = m_queue.size() >= m_config.maxBatch;
+        }
+        if (flush) {
+            m_cv.notify_one();
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stop) {
+                return;
+            }
+            m_stop = true;
+        }
+        m_cv.notify_one();
+        m_thread.join();
+    }
+
+ private:
+    const Config m_config;
+    std::deque<SpanRecord> m_queue;
+    bool m_stop;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::thread m_thread;
+
+    void run() {
+        wss::web::HttpClient client;
+        std::vector<SpanRecord> batch;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_cv.wait_for(lock, std::chrono::milliseconds(m_config.flushIntervalMillis), [this] {
+              return m_stop || m_queue.size() >= m_config.maxBatch;
+            });
+            const bool stopping = m_stop;
+            while (!m_queue.empty()) {
+                batch.clear();
+                while (!m_queue.empty() && batch.size() < m_config.maxBatch) {
+                    batch.push_back(std::move(m_queue.front()));
+                    m_queue.pop_front();
+                }
+                lock.unlock();
+                send(client, batch);
+                lock.lock();
+            }
+            if (stopping) {
+                return;
+            }
+        }
+    }
+
+    void send(wss::web::HttpClient &client, const std::vector<SpanRecord> &batch) {
+        wss::web::Request request(m_config.endpoint, wss::web::Request::Method::POST);
+        request.setHeader({"Content-Type", "application/json"});
+        request.setBody(encode(batch));
+        const wss::web::Response response = client.execute(request);
+        if (response.isSuccess()) {
+            exported += batch.size();
+        } else {
+            failed += batch.size();
+        }
+    }
+
+    /// \brief OTLP/HTTP json: ExportTraceServiceRequest
+    std::string encode(const std::vector<SpanRecord> &batch) const {
+        using json = nlohmann::json;
+        json spans = json::array();
+        for (const auto &record: batch) {
+            std::string traceId;
+            appendHex(traceId, record.span.traceHigh);
+            appendHex(traceId, record.span.traceLow);
+
+            json attributes = json::array();
+            for (const auto &attribute: record.attributes) {
+                attributes.push_back({{"key", attribute.first}, {"value", {{"stringValue", attribute.second}}}});
+            }
+
+            json span = {
+                {"traceId", traceId},
+                {"spanId", hex(record.span.spanId)},
+                {"name", record.name},
+                // SPAN_KIND_INTERNAL
+                {"kind", 1},
+                {"startTimeUnixNano", std::to_string(record.startNanos)},
+                {"endTimeUnixNano", std::to_string(record.endNanos)},
+                {"attributes", attributes},
+                // STATUS_CODE_ERROR : STATUS_CODE_UNSET
+                {"status", {{"code", record.error ? 2 : 0}}}
+            };
+            if (record.span.parentId != 0) {
+                span["parentSpanId"] = hex(record.span.parentId);
+            }
+            spans.push_back(std::move(span));
+        }
+
+        json scope = {{"scope", {{"name", "wsserver"}}}, {"spans", std::move(spans)}};
+        json serviceName = {{"key", "service.name"}, {"value", {{"stringValue", m_config.serviceName}}}};
+        json resource = {
+            {"resource", {{"attributes", json::array({std::move(serviceName)})}}},
+            {"scopeSpans", json::array({std::move(scope)})}
+        };
+        const json out = {{"resourceSpans", json::array({std::move(resource)})}};
+        return out.dump();
+    }
+};
+
+std::mutex exporterMutex;
+/// \brief Never destroyed: workers could record spans after shutdown
+std::atomic<Exporter *> exporter(nullptr);
+
+}
+
+std::string wss::tracing::SpanContext::toTraceparent() const {
+    std::string out;
+    out.reserve(55);
+    out += "00-";
+    appendHex(out, traceHigh);
+    appendHex(out, traceLow);
+    out += '-';
+    appendHex(out, spanId);
+    out += sampled ? "-01" : "-00";
+    return out;
+}
+
+bool wss::tracing::SpanContext::fromTraceparent(const std::string &value, SpanContext &out) {
+    // version(2)-trace-id(32)-parent-id(16)-flags(2), later versions can append fields
+    if (value.size() < 55 || value[2] != '-' || value[35] != '-' || value[52] != '-') {
+        return false;
+    }
+    if ((value.size() > 55 && value[55] != '-') || value.compare(0, 2, "ff") == 0) {
+        return false;
+    }
+    uint64_t version, flags;
+    SpanContext parsed;
+    if (!parseHex(value, 0, 2, version)
+        || !parseHex(value, 3, 16, parsed.traceHigh)
+        || !parseHex(value, 19, 16, parsed.traceLow)
+        || !parseHex(value, 36, 16, parsed.spanId)
+        || !parseHex(value, 53, 2, flags)) {
+        return false;
+    }
+    if ((parsed.traceHigh == 0 && parsed.traceLow == 0) || parsed.spanId == 0) {
+        return false;
+    }
+    parsed.sampled = (flags & 0x01u) != 0;
+    out = parsed;
+    return true;
+}
+
+void wss::tracing::configure(const Config &config) {
+    std::lock_guard<std::mutex> lock(exporterMutex);
+    const bool enabled = config.sampleRate > 0 && !config.endpoint.empty();
+    if (enabled && exporter.load() == nullptr) {
+        exporter.store(new Exporter(config));
+    }
+    sampleRate.store(enabled ? config.sampleRate : 0);
+}
+
+void wss::tracing::shutdown() {
+    std::lock_guard<std::mutex> lock(exporterMutex);
+    sampleRate.store(0);
+    Exporter *current = exporter.load();
+    if (current != nullptr) {
+        current->stop();
+    }
+}
+
+bool wss::tracing::isEnabled() noexcept {
+    return sampleRate.load(std::memory_order_relaxed) > 0;
+}
+
+wss::tracing::Stats wss::tracing::getStats() noexcept {
+    return Stats{recorded.load(), exported.load(), dropped.load(), failed.load()};
+}
+
+wss::tracing::SpanContext wss::tracing::detail::sampleSlow() {
+    const uint32_t rate = sampleRate.load(std::memory_order_relaxed);
+    if (rate == 0) {
+        // configure() is called before workers start, so disabled thread never comes here again
+        countdown() = std::numeric_limits<uint64_t>::max();
+        return SpanContext();
+    }
+    countdown() = rate;
+
+    SpanContext out;
+    out.traceHigh = randomId();
+    out.traceLow = randomId();
+    out.spanId = randomId();
+    out.sampled = true;
+    return out;
+}
+
+wss::tracing::SpanContext wss::tracing::sampleRemote(const std::string &traceparent) {
+    SpanContext remote;
+    if (!isEnabled() || traceparent.empty() || !SpanContext::fromTraceparent(traceparent, remote)) {
+        return sample();
+    }
+    if (!remote.sampled) {
+        return SpanContext();
+    }
+    return child(remote);
+}
+
+wss::tracing::SpanContext wss::tracing::child(const SpanContext &parent) {
+    SpanContext out = parent;
+    out.spanId = randomId();
+    out.parentId = parent.spanId;
+    return out;
+}
+
+void wss::tracing::record(const char *name,
+                          const SpanContext &span,
+                          std::chrono::steady_clock::time_point start,
+                          std::chrono::steady_clock::time_point end,
+                          Attributes attributes,
+                          bool error) {
+    Exporter *current = exporter.load(std::memory_order_acquire);
+    if (current == nullptr || !span.sampled) {
+        return;
+    }
+    recorded++;
+    const int64_t endNanos = toUnixNanos(end);
+    current->push(SpanRecord{
+        name,
+        span,
+        endNanos - std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(),
+        endNanos,
+        std::move(attributes),
+        error
+    });
+}
+
+const wss::tracing::SpanContext &wss::tracing::current() noexcept {
+    static const SpanContext empty;
+    const SpanContext *span = currentSpan();
+    return span == nullptr ? empty : *span;
+}
+
+wss::tracing::ScopedSpan::ScopedSpan(const SpanContext &span) noexcept :
+    m_previous(currentSpan()) {
+    currentSpan() = &span;
+}
+
+wss::tracing::ScopedSpan::~ScopedSpan() {
+    currentSpan() = m_previous;
+}
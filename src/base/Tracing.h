@@ -0,0 +1,136 @@
+/**
+ * wsserver
+ * Tracing.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_TRACING_H
+#define WSSERVER_TRACING_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace wss {
+namespace tracing {
+
+/// \brief W3C trace context of one span
+struct SpanContext {
+  uint64_t traceHigh = 0;
+  uint64_t traceLow = 0;
+  uint64_t spanId = 0;
+  /// \brief Parent span id, 0 - root span
+  uint64_t parentId = 0;
+  /// \brief Unsampled context is empty: nothing is recorded for it
+  bool sampled = false;
+
+  /// \brief traceparent header value: 00-{trace-id}-{span-id}-{flags}
+  std::string toTraceparent() const;
+
+  /// \brief Parses traceparent header
+  /// \param value
+  /// \param out
+  /// \return false if value is invalid
+  static bool fromTraceparent(const std::string &value, SpanContext &out);
+};
+
+using Attributes = std::vector<std::pair<std::string, std::string>>;
+
+struct Config {
+  /// \brief Every N-th message is traced (per worker thread), 0 - tracing is disabled
+  uint32_t sampleRate = 0;
+  /// \brief OTLP/HTTP json receiver, for example: http://collector:4318/v1/traces
+  std::string endpoint;
+  std::string serviceName = "wsserver";
+  /// \brief Finished spans waiting for export, spans over it are dropped
+  std::size_t queueSize = 8192;
+  uint32_t flushIntervalMillis = 1000;
+  /// \brief Max spans sent by one request
+  std::size_t maxBatch = 512;
+};
+
+struct Stats {
+  uint64_t recorded;
+  uint64_t exported;
+  /// \brief Dropped by full queue
+  uint64_t dropped;
+  /// \brief Not accepted by receiver
+  uint64_t failed;
+};
+
+/// \brief Applies config and starts exporter thread if tracing is enabled. Call before workers start
+/// \param config
+void configure(const Config &config);
+/// \brief Exports queued spans and stops exporter thread
+void shutdown();
+bool isEnabled() noexcept;
+Stats getStats() noexcept;
+
+namespace detail {
+/// \brief Messages left until next sampled one on this thread
+inline uint64_t &countdown() noexcept {
+    static thread_local uint64_t value = 1;
+    return value;
+}
+SpanContext sampleSlow();
+}
+
+/// \brief Root context for new message. Every sampleRate-th call on thread is sampled,
+/// for other calls it costs one decrement and one branch
+/// \return empty context if message is not sampled
+inline SpanContext sample() {
+    if (--detail::countdown() != 0) {
+        return SpanContext();
+    }
+    return detail::sampleSlow();
+}
+
+/// \brief Root context for message came from outside with traceparent header.
+/// Valid header continues remote trace with its sampled flag, otherwise message is sampled as usual
+/// \param traceparent header value, can be empty
+/// \return
+SpanContext sampleRemote(const std::string &traceparent);
+
+/// \brief New span in trace of parent
+/// \param parent must be sampled
+/// \return
+SpanContext child(const SpanContext &parent);
+
+/// \brief Queues finished span for export
+/// \param name
+/// \param span must be sampled
+/// \param start
+/// \param end
+/// \param attributes
+/// \param error
+void record(const char *name,
+            const SpanContext &span,
+            std::chrono::steady_clock::time_point start,
+            std::chrono::steady_clock::time_point end,
+            Attributes attributes = Attributes(),
+            bool error = false);
+
+/// \brief Span of calling thread, that outgoing requests are made for (passed to their headers)
+/// \return empty context if there is no one
+const SpanContext &current() noexcept;
+
+/// \brief Sets current span of thread while in scope
+class ScopedSpan {
+ public:
+    explicit ScopedSpan(const SpanContext &span) noexcept;
+    ~ScopedSpan();
+    ScopedSpan(const ScopedSpan &) = delete;
+    ScopedSpan &operator=(const ScopedSpan &) = delete;
+
+ private:
+    const SpanContext *m_previous;
+};
+
+}
+}
+
+#endif //WSSERVER_TRACING_H
@@ -0,0 +1,206 @@
+/**
+ * wsserver
+ * TrafficCapture.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "TrafficCapture.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <unordered_map>
+#include "../helpers/logging.h"
+
+namespace {
+
+using namespace wss::capture;
+using steady_clock = std::chrono::steady_clock;
+
+/// \brief Records are written to file by chunks of this size
+constexpr std::size_t FLUSH_BYTES = 64 * 1024;
+
+class Writer {
+ public:
+    void start(const Config &config) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        closeLocked();
+        m_file = std::fopen(config.path.c_str(), "wb");
+        if (m_file == nullptr) {
+            throw std::runtime_error("can't open " + config.path);
+        }
+        m_path = config.path;
+        m_maxBytes = static_cast<uint64_t>(config.maxSizeMB) * 1024 * 1024;
+        m_started = steady_clock::now();
+        m_last = m_started;
+        m_deadline = config.maxSeconds == 0
+                     ? steady_clock::time_point::max()
+                     : m_started + std::chrono::seconds(config.maxSeconds);
+        m_users.clear();
+        m_written = 0;
+
+        m_buffer.assign(MAGIC, MAGIC + MAGIC_SIZE);
+        m_buffer.push_back(static_cast<char>(VERSION));
+        const uint64_t startedAt = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+        for (int i = 0; i < 8; i++) {
+            m_buffer.push_back(static_cast<char>((startedAt >> (8 * i)) & 0xFF));
+        }
+        m_running.store(true, std::memory_order_release);
+        WSS_LOG_F(wss::logging::LevelInfo, "Capture", "Traffic capture started, writing to %s", m_path.c_str());
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        closeLocked();
+    }
+
+    bool isRunning() const noexcept {
+        return m_running.load(std::memory_order_relaxed);
+    }
+
+    void user(RecordType type, uint64_t user) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!beginLocked(type)) {
+            return;
+        }
+        putVarint(indexOf(user));
+        commitLocked();
+    }
+
+    void message(RecordType type, uint64_t sender, std::size_t size, const uint64_t *recipients, std::size_t count) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!beginLocked(type)) {
+            return;
+        }
+        putVarint(indexOf(sender));
+        putVarint(size);
+        putVarint(count);
+        if (recipients != nullptr) {
+            for (std::size_t i = 0; i < count; i++) {
+                putVarint(indexOf(recipients[i]));
+            }
+        }
+        commitLocked();
+    }
+
+ private:
+    std::mutex m_mutex;
+    std::atomic<bool> m_running{false};
+    std::FILE *m_file = nullptr;
+    std::string m_path;
+    uint64_t m_maxBytes = 0;
+    uint64_t m_written = 0;
+    steady_clock::time_point m_started;
+    steady_clock::time_point m_last;
+    steady_clock::time_point m_deadline;
+    std::unordered_map<uint64_t, uint64_t> m_users;
+    std::vector<char> m_buffer;
+
+    uint64_t indexOf(uint64_t user) {
+        if (user == 0) {
+            return 0;
+        }
+        return m_users.emplace(user, m_users.size() + 1).first->second;
+    }
+
+    void putVarint(uint64_t value) {
+        while (value >= 0x80) {
+            m_buffer.push_back(static_cast<char>((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        m_buffer.push_back(static_cast<char>(value));
+    }
+
+    /// \brief Puts record type and time, time is taken under lock, so deltas are never negative
+    bool beginLocked(RecordType type) {
+        if (m_file == nullptr) {
+            return false;
+        }
+        const auto now = steady_clock::now();
+        if (now >= m_deadline || (m_maxBytes > 0 && m_written + m_buffer.size() >= m_maxBytes)) {
+            WSS_LOG_F(wss::logging::LevelInfo, "Capture", "Traffic capture limit is reached");
+            closeLocked();
+            return false;
+        }
+        m_buffer.push_back(static_cast<char>(type));
+        putVarint(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - m_last).count()));
+        m_last = now;
+        return true;
+    }
+
+    void commitLocked() {
+        if (m_buffer.size() >= FLUSH_BYTES) {
+            flushLocked();
+        }
+    }
+
+    void flushLocked() {
+        if (m_buffer.empty()) {
+            return;
+        }
+        if (std::fwrite(m_buffer.data(), 1, m_buffer.size(), m_file) != m_buffer.size()) {
+            WSS_LOG_F(wss::logging::LevelError, "Capture", "Can't write trace to %s", m_path.c_str());
+        }
+        m_written += m_buffer.size();
+        m_buffer.clear();
+    }
+
+    void closeLocked() {
+        if (m_file == nullptr) {
+            return;
+        }
+        m_running.store(false, std::memory_order_release);
+        flushLocked();
+        std::fclose(m_file);
+        m_file = nullptr;
+        WSS_LOG_F(wss::logging::LevelInfo, "Capture", "Traffic capture stopped: %lu users, %lu bytes written to %s",
+                  static_cast<unsigned long>(m_users.size()), static_cast<unsigned long>(m_written), m_path.c_str());
+    }
+};
+
+Writer &writer() {
+    // never destroyed: hooks could be called by io threads after static destructors
+    static Writer *instance = new Writer();
+    return *instance;
+}
+
+}
+
+void wss::capture::start(const Config &config) {
+    writer().start(config);
+}
+
+void wss::capture::stop() {
+    writer().stop();
+}
+
+bool wss::capture::isRunning() noexcept {
+    return writer().isRunning();
+}
+
+void wss::capture::connected(uint64_t user) {
+    if (isRunning()) {
+        writer().user(RecordType::Connect, user);
+    }
+}
+
+void wss::capture::disconnected(uint64_t user) {
+    if (isRunning()) {
+        writer().user(RecordType::Disconnect, user);
+    }
+}
+
+void wss::capture::direct(uint64_t sender, std::size_t size, const uint64_t *recipients, std::size_t count) {
+    if (isRunning()) {
+        writer().message(RecordType::Direct, sender, size, recipients, count);
+    }
+}
+
+void wss::capture::fanout(uint64_t sender, std::size_t size, std::size_t recipients) {
+    if (isRunning()) {
+        writer().message(RecordType::Fanout, sender, size, nullptr, recipients);
+    }
+}
@@ -0,0 +1,176 @@
+/**
+ * wsserver
+ * TrafficCapture.h
+ *
+ * Traffic shape capture: connection lifetimes, message sizes, fan-out and inter-arrival times, without payloads.
+ * Trace is replayed by wssbench --replay
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_TRAFFICCAPTURE_H
+#define WSSERVER_TRAFFICCAPTURE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace wss {
+namespace capture {
+
+/// \brief File starts with magic, version byte and start time (unix micros, 8 bytes little endian).
+/// Every record is type byte, varint micros since previous record and type fields as varints.
+/// Users are numbered in order of appearance from 1, 0 is bot, so trace has no real ids
+constexpr const char MAGIC[] = "WSSTRACE";
+constexpr std::size_t MAGIC_SIZE = 8;
+constexpr uint8_t VERSION = 1;
+
+enum class RecordType : uint8_t {
+  /// \brief user
+  Connect = 1,
+  /// \brief user
+  Disconnect = 2,
+  /// \brief sender, size, recipients count, recipients. No recipients - message to bot
+  Direct = 3,
+  /// \brief sender, size, recipients count: room and topic messages, recipients are resolved by server
+  Fanout = 4,
+};
+
+struct Config {
+  /// \brief Trace file, replaced if exists
+  std::string path;
+  /// \brief Capture is stopped after this time, 0 - until server stop
+  uint32_t maxSeconds = 3600;
+  /// \brief Capture is stopped when file reaches this size, 0 - unlimited
+  uint32_t maxSizeMB = 256;
+};
+
+/// \brief Opens trace file and starts capture. Hooks below do nothing (one relaxed load) until it's called
+/// \throws std::runtime_error if file can't be opened
+void start(const Config &config);
+/// \brief Writes buffered records and closes file
+void stop();
+bool isRunning() noexcept;
+
+void connected(uint64_t user);
+void disconnected(uint64_t user);
+void direct(uint64_t sender, std::size_t size, const uint64_t *recipients, std::size_t count);
+void fanout(uint64_t sender, std::size_t size, std::size_t recipients);
+
+struct Record {
+  RecordType type;
+  /// \brief Micros since capture start
+  uint64_t at = 0;
+  /// \brief Connected or disconnected user, message sender
+  uint32_t user = 0;
+  uint32_t size = 0;
+  uint32_t count = 0;
+  /// \brief Direct message recipients
+  std::vector<uint32_t> recipients;
+};
+
+/// \brief Sequential trace reader, header only: load generator doesn't link server
+class Reader {
+ public:
+    /// \throws std::runtime_error if stream is not a trace or has unsupported version
+    explicit Reader(std::istream &in) : m_in(in) {
+        char magic[MAGIC_SIZE];
+        if (!m_in.read(magic, MAGIC_SIZE) || std::memcmp(magic, MAGIC, MAGIC_SIZE) != 0) {
+            throw std::runtime_error("not a traffic trace");
+        }
+        const int version = m_in.get();
+        if (version != VERSION) {
+            throw std::runtime_error("unsupported trace version " + std::to_string(version));
+        }
+        for (int i = 0; i < 8; i++) {
+            const int c = m_in.get();
+            if (c == EOF) {
+                throw std::runtime_error("truncated trace header");
+            }
+            m_startedAt |= static_cast<uint64_t>(c) << (8 * i);
+        }
+    }
+
+    /// \return capture start, unix micros
+    uint64_t getStartedAt() const {
+        return m_startedAt;
+    }
+
+    /// \return false at end of trace, truncated last record is skipped
+    /// \throws std::runtime_error on unknown record type
+    bool next(Record &out) {
+        const int type = m_in.get();
+        if (type == EOF) {
+            return false;
+        }
+        uint64_t delta, user;
+        if (!readVarint(delta) || !readVarint(user)) {
+            return false;
+        }
+        m_at += delta;
+        out.type = static_cast<RecordType>(type);
+        out.at = m_at;
+        out.user = static_cast<uint32_t>(user);
+        out.size = 0;
+        out.count = 0;
+        out.recipients.clear();
+        switch (out.type) {
+            case RecordType::Connect:
+            case RecordType::Disconnect:
+                return true;
+            case RecordType::Direct:
+            case RecordType::Fanout:
+                break;
+            default:
+                throw std::runtime_error("unknown trace record type " + std::to_string(type));
+        }
+
+        uint64_t size, count;
+        if (!readVarint(size) || !readVarint(count)) {
+            return false;
+        }
+        out.size = static_cast<uint32_t>(size);
+        out.count = static_cast<uint32_t>(count);
+        if (out.type == RecordType::Direct) {
+            out.recipients.reserve(out.count);
+            for (uint32_t i = 0; i < out.count; i++) {
+                uint64_t recipient;
+                if (!readVarint(recipient)) {
+                    return false;
+                }
+                out.recipients.push_back(static_cast<uint32_t>(recipient));
+            }
+        }
+        return true;
+    }
+
+ private:
+    std::istream &m_in;
+    uint64_t m_startedAt = 0;
+    uint64_t m_at = 0;
+
+    bool readVarint(uint64_t &out) {
+        out = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            const int c = m_in.get();
+            if (c == EOF) {
+                return false;
+            }
+            out |= static_cast<uint64_t>(c & 0x7F) << shift;
+            if ((c & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+}
+}
+
+#endif //WSSERVER_TRAFFICCAPTURE_H
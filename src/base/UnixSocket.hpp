@@ -0,0 +1,76 @@
+/**
+ * wsserver
+ * UnixSocket.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_UNIXSOCKET_HPP
+#define WSSERVER_UNIXSOCKET_HPP
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace wss {
+namespace unixsocket {
+
+/// \brief Listen address `unix:/path/to.sock` means AF_UNIX socket instead of tcp address and port
+static const std::string ADDRESS_PREFIX = "unix:";
+
+inline bool isAddress(const std::string &address) noexcept {
+    return address.compare(0, ADDRESS_PREFIX.size(), ADDRESS_PREFIX) == 0;
+}
+
+/// \param address unix:/path
+/// \return /path
+inline std::string getPath(const std::string &address) {
+    return address.substr(ADDRESS_PREFIX.size());
+}
+
+/// \brief Removes socket file left by previous run. Other files are never removed
+/// \param path
+inline void remove(const std::string &path) noexcept {
+    struct stat info{};
+    if (::lstat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode)) {
+        ::unlink(path.c_str());
+    }
+}
+
+/// \brief Opens listening AF_UNIX stream socket. File mode is defined by umask
+/// \param path socket file, stale one is replaced
+/// \param flags additional socket type flags (SOCK_NONBLOCK, SOCK_CLOEXEC)
+/// \return listening socket
+/// \throws std::system_error if unable to bind or listen
+inline int listen(const std::string &path, int flags = SOCK_CLOEXEC) {
+    sockaddr_un address{};
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw std::system_error(ENAMETOOLONG, std::generic_category(), "Invalid unix socket path: " + path);
+    }
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.data(), path.size());
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | flags, 0);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Can't create unix socket");
+    }
+    remove(path);
+    if (::bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+        || ::listen(fd, SOMAXCONN) != 0) {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "Can't listen unix socket " + path);
+    }
+    return fd;
+}
+
+}
+}
+
+#endif //WSSERVER_UNIXSOCKET_HPP
@@ -0,0 +1,361 @@
+/**
+ * wsserver
+ * WorkerPool.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "WorkerPool.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "UnixSocket.hpp"
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include "../helpers/logging.h"
+
+extern char **environ;
+
+namespace {
+/// \brief Worker environment, set by master before exec
+const char *ENV_INDEX = "WSS_WORKER_INDEX";
+const char *ENV_CHANNEL = "WSS_WORKER_CHANNEL";
+const char *ENV_PIN = "WSS_WORKER_PIN";
+/// \brief Master loop wakes up at least this often to reap and restart workers
+const int POLL_MILLIS = 200;
+
+int64_t nowMillis() {
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+std::system_error systemError(const std::string &what) {
+    return std::system_error(errno, std::generic_category(), what);
+}
+
+/// \brief Sends descriptor with one byte of data
+/// \return false if worker is gone or its channel buffer is full
+bool sendDescriptor(int channel, int fd) {
+    char data = 'c';
+    iovec io{&data, 1};
+    char control[CMSG_SPACE(sizeof(int))];
+    std::memset(control, 0, sizeof(control));
+
+    msghdr message{};
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+    ssize_t sent;
+    do {
+        sent = ::sendmsg(channel, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while (sent < 0 && errno == EINTR);
+    return sent == 1;
+}
+}
+
+int wss::WorkerPool::getWorkerIndex() {
+    const char *index = std::getenv(ENV_INDEX);
+    return index == nullptr ? -1 : std::atoi(index);
+}
+
+void wss::WorkerPool::pinWorker() {
+#ifdef __linux__
+    const char *pin = std::getenv(ENV_PIN);
+    const int index = getWorkerIndex();
+    const unsigned cores = std::thread::hardware_concurrency();
+    if (index < 0 || pin == nullptr || std::strcmp(pin, "1") != 0 || cores == 0) {
+        return;
+    }
+    // threads, created later, inherit affinity
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(static_cast<unsigned>(index) % cores, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        WSS_LOG_F(wss::logging::LevelWarning, "Workers", "Can't pin worker %d to core: %s",
+                  index, std::strerror(errno));
+    }
+#endif
+}
+
+void wss::WorkerPool::receive(const std::function<void(int fd)> &onConnection) {
+    const char *channelEnv = std::getenv(ENV_CHANNEL);
+    if (channelEnv == nullptr) {
+        return;
+    }
+    const int channel = std::atoi(channelEnv);
+    while (true) {
+        char data;
+        iovec io{&data, 1};
+        char control[CMSG_SPACE(sizeof(int))];
+        msghdr message{};
+        message.msg_iov = &io;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        const ssize_t received = ::recvmsg(channel, &message, MSG_CMSG_CLOEXEC);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            // master is gone
+            break;
+        }
+        for (cmsghdr *header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header)) {
+            if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+                int fd;
+                std::memcpy(&fd, CMSG_DATA(header), sizeof(int));
+                onConnection(fd);
+            }
+        }
+    }
+    ::close(channel);
+}
+
+wss::WorkerPool::WorkerPool(const Options &options) :
+    m_options(options),
+    m_workers(options.workers) {
+    if (m_options.workers == 0) {
+        throw std::invalid_argument("Workers count must be greater than 0");
+    }
+}
+
+wss::WorkerPool::~WorkerPool() {
+    for (auto &worker: m_workers) {
+        if (worker.channel >= 0) {
+            ::close(worker.channel);
+        }
+    }
+    if (m_listener >= 0) {
+        ::close(m_listener);
+    }
+}
+
+void wss::WorkerPool::run() {
+    listen();
+    for (std::size_t i = 0; i < m_workers.size(); i++) {
+        spawn(i);
+    }
+    WSS_LOG_F(wss::logging::LevelInfo, "Workers", "Master %d passes connections of port %u to %lu workers",
+              static_cast<int>(::getpid()), m_options.port, static_cast<unsigned long>(m_workers.size()));
+
+    while (!m_stopping) {
+        pollfd listener{m_listener, POLLIN, 0};
+        if (::poll(&listener, 1, POLL_MILLIS) > 0 && (listener.revents & POLLIN) != 0) {
+            while (true) {
+                const int fd = ::accept4(m_listener, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd < 0) {
+                    // EAGAIN: backlog is empty; other errors (EMFILE, aborted connection) are retried by next poll
+                    break;
+                }
+                dispatch(fd);
+            }
+        }
+        supervise();
+    }
+    shutdown();
+}
+
+void wss::WorkerPool::stop() noexcept {
+    m_stopping = m_stopping + 1;
+}
+void wss::WorkerPool::signalWorkers(int signum) noexcept {
+    for (const auto &worker: m_workers) {
+        if (worker.pid > 0) {
+            ::kill(worker.pid, signum);
+        }
+    }
+}
+
+void wss::WorkerPool::listen() {
+    if (wss::unixsocket::isAddress(m_options.address)) {
+        m_listener = wss::unixsocket::listen(wss::unixsocket::getPath(m_options.address), SOCK_NONBLOCK | SOCK_CLOEXEC);
+        return;
+    }
+
+    sockaddr_storage address{};
+    socklen_t length;
+    const bool any = m_options.address.empty() || m_options.address == "*";
+    auto *v4 = reinterpret_cast<sockaddr_in *>(&address);
+    auto *v6 = reinterpret_cast<sockaddr_in6 *>(&address);
+    if (any || ::inet_pton(AF_INET, m_options.address.c_str(), &v4->sin_addr) == 1) {
+        v4->sin_family = AF_INET;
+        v4->sin_port = htons(m_options.port);
+        if (any) {
+            v4->sin_addr.s_addr = htonl(INADDR_ANY);
+        }
+        length = sizeof(sockaddr_in);
+    } else if (::inet_pton(AF_INET6, m_options.address.c_str(), &v6->sin6_addr) == 1) {
+        v6->sin6_family = AF_INET6;
+        v6->sin6_port = htons(m_options.port);
+        length = sizeof(sockaddr_in6);
+    } else {
+        throw std::invalid_argument("Invalid listen address: " + m_options.address);
+    }
+
+    m_listener = ::socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listener < 0) {
+        throw systemError("Can't create listener");
+    }
+    const int enable = 1;
+    ::setsockopt(m_listener, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    if (::bind(m_listener, reinterpret_cast<sockaddr *>(&address), length) != 0) {
+        throw systemError("Can't bind port " + std::to_string(m_options.port));
+    }
+    if (::listen(m_listener, SOMAXCONN) != 0) {
+        throw systemError("Can't listen port " + std::to_string(m_options.port));
+    }
+}
+
+void wss::WorkerPool::spawn(std::size_t index) {
+    Worker &worker = m_workers[index];
+    int channels[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, channels) != 0) {
+        WSS_LOG_F(wss::logging::LevelWarning, "Workers", "Can't create channel of worker %lu: %s",
+                  static_cast<unsigned long>(index), std::strerror(errno));
+        worker.restartAt = nowMillis() + m_options.restartDelayMillis;
+        return;
+    }
+
+    // worker end survives exec, master ends don't. Child of process with threads (async log) may only exec:
+    // arguments and environment are prepared before fork
+    ::fcntl(channels[1], F_SETFD, 0);
+    std::vector<std::string> env{
+        std::string(ENV_INDEX) + "=" + std::to_string(index),
+        std::string(ENV_CHANNEL) + "=" + std::to_string(channels[1]),
+        std::string(ENV_PIN) + "=" + (m_options.pinCores ? "1" : "0"),
+    };
+    for (char **item = environ; *item != nullptr; item++) {
+        if (std::strncmp(*item, "WSS_WORKER_", 11) != 0) {
+            env.emplace_back(*item);
+        }
+    }
+    std::vector<char *> envp;
+    for (auto &item: env) {
+        envp.push_back(&item[0]);
+    }
+    envp.push_back(nullptr);
+    std::vector<char *> argv;
+    for (const auto &arg: m_options.args) {
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    const pid_t pid = ::fork();
+    if (pid == 0) {
+        ::execve("/proc/self/exe", argv.data(), envp.data());
+        ::execve(argv[0], argv.data(), envp.data());
+        ::_exit(127);
+    }
+
+    ::close(channels[1]);
+    if (pid < 0) {
+        ::close(channels[0]);
+        WSS_LOG_F(wss::logging::LevelWarning, "Workers", "Can't start worker %lu: %s",
+                  static_cast<unsigned long>(index), std::strerror(errno));
+        worker.restartAt = nowMillis() + m_options.restartDelayMillis;
+        return;
+    }
+    ::fcntl(channels[0], F_SETFL, ::fcntl(channels[0], F_GETFL) | O_NONBLOCK);
+    worker.pid = pid;
+    worker.channel = channels[0];
+}
+
+void wss::WorkerPool::supervise() {
+    int status;
+    pid_t pid;
+    while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0) {
+        for (std::size_t i = 0; i < m_workers.size(); i++) {
+            Worker &worker = m_workers[i];
+            if (worker.pid != pid) {
+                continue;
+            }
+            WSS_LOG_F(wss::logging::LevelWarning, "Workers", "Worker %lu (%d) exited with %s %d, starting it again",
+                      static_cast<unsigned long>(i), static_cast<int>(pid),
+                      WIFSIGNALED(status) ? "signal" : "status",
+                      WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status));
+            ::close(worker.channel);
+            worker.channel = -1;
+            worker.pid = -1;
+            worker.restartAt = nowMillis() + m_options.restartDelayMillis;
+        }
+    }
+
+    const int64_t now = nowMillis();
+    for (std::size_t i = 0; i < m_workers.size(); i++) {
+        if (m_workers[i].pid < 0 && now >= m_workers[i].restartAt && !m_stopping) {
+            spawn(i);
+        }
+    }
+}
+
+void wss::WorkerPool::dispatch(int fd) {
+    for (std::size_t attempt = 0; attempt < m_workers.size(); attempt++) {
+        const Worker &worker = m_workers[m_next++ % m_workers.size()];
+        if (worker.pid >= 0 && sendDescriptor(worker.channel, fd)) {
+            break;
+        }
+    }
+    // worker has own copy, or connection is dropped: all workers are down or busy
+    ::close(fd);
+}
+
+void wss::WorkerPool::shutdown() {
+    ::close(m_listener);
+    m_listener = -1;
+    if (wss::unixsocket::isAddress(m_options.address)) {
+        wss::unixsocket::remove(wss::unixsocket::getPath(m_options.address));
+    }
+
+    sig_atomic_t signalled = 0;
+    while (true) {
+        // second stop() while workers drain stops them immediately
+        if (signalled != m_stopping && signalled < 2) {
+            signalled = m_stopping;
+            for (const auto &worker: m_workers) {
+                if (worker.pid >= 0) {
+                    ::kill(worker.pid, SIGTERM);
+                }
+            }
+        }
+
+        int status;
+        pid_t pid;
+        while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0) {
+            for (auto &worker: m_workers) {
+                if (worker.pid == pid) {
+                    worker.pid = -1;
+                }
+            }
+        }
+        const bool alive = std::any_of(m_workers.begin(), m_workers.end(), [](const Worker &worker) {
+          return worker.pid >= 0;
+        });
+        if (!alive) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MILLIS / 2));
+    }
+    WSS_LOG(wss::logging::LevelInfo, "Workers", "All workers are stopped");
+}
@@ -0,0 +1,93 @@
+/**
+ * wsserver
+ * WorkerPool.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_WORKERPOOL_H
+#define WSSERVER_WORKERPOOL_H
+
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+namespace wss {
+
+/// \brief Multi-process mode: master accepts connections and passes their sockets (SCM_RIGHTS) round-robin
+/// to worker processes. Every worker is the same binary, started again with the same arguments, and runs its
+/// own chat server. Master has no threads and no chat state: crashed worker loses only its connections
+/// and is started again. Workers exchange messages through cluster links (see ServerStarter)
+class WorkerPool {
+ public:
+    struct Options {
+      std::size_t workers = 2;
+      /// \brief Worker i runs on core i % cores
+      bool pinCores = true;
+      /// \brief Chat listen address, empty or "*" - any, `unix:/path` - unix socket
+      std::string address;
+      unsigned short port = 8085;
+      /// \brief Arguments of master process, workers are started with them
+      std::vector<std::string> args;
+      /// \brief Delay before crashed worker is started again
+      long restartDelayMillis = 1000;
+    };
+
+    /// \brief Index of this worker process
+    /// \return -1 if this process is not a worker
+    static int getWorkerIndex();
+
+    /// \brief Worker: pins this process to core of worker, if master was asked to
+    static void pinWorker();
+
+    /// \brief Worker: receives sockets from master until master exits. Blocks caller
+    /// \param onConnection takes ownership of socket descriptor
+    static void receive(const std::function<void(int fd)> &onConnection);
+
+    explicit WorkerPool(const Options &options);
+    ~WorkerPool();
+
+    /// \brief Master: opens listener, starts workers and passes them accepted connections until stop().
+    /// Then stops workers by SIGTERM (they drain, if configured) and waits for them
+    /// \throws std::system_error if listener can't be opened
+    void run();
+
+    /// \brief Master: async-signal-safe, run() returns after workers are stopped
+    void stop() noexcept;
+
+    /// \brief Master: async-signal-safe, sends signal to every alive worker (SIGHUP - config reload)
+    /// \param signum
+    void signalWorkers(int signum) noexcept;
+
+ private:
+    struct Worker {
+      pid_t pid = -1;
+      /// \brief Master end of socket pair
+      int channel = -1;
+      /// \brief When crashed worker can be started again, steady clock milliseconds
+      int64_t restartAt = 0;
+    };
+
+    const Options m_options;
+    std::vector<Worker> m_workers;
+    int m_listener = -1;
+    std::size_t m_next = 0;
+    volatile sig_atomic_t m_stopping = 0;
+
+    void listen();
+    void spawn(std::size_t index);
+    /// \brief Reaps exited workers and starts them again after restart delay
+    void supervise();
+    /// \brief Passes socket to next alive worker, closes it in master
+    void dispatch(int fd);
+    void shutdown();
+};
+
+}
+
+#endif //WSSERVER_WORKERPOOL_H
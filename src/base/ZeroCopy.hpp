@@ -0,0 +1,132 @@
+/**
+ * wsserver
+ * ZeroCopy.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_ZEROCOPY_HPP
+#define WSSERVER_ZEROCOPY_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#endif
+
+/// \brief MSG_ZEROCOPY (Linux 4.14+): kernel sends pages of user buffers instead of copying them to socket buffer.
+/// Buffers must not be freed or changed until kernel reports completion of send by socket error queue
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define WSS_HAS_ZEROCOPY 1
+#endif
+
+namespace wss {
+namespace zerocopy {
+
+/// \brief Max iovecs passed to one sendmsg
+constexpr std::size_t MAX_IOV = 64;
+
+/// \brief Sets SO_ZEROCOPY
+/// \param fd connected tcp socket
+/// \return false if not supported by kernel or build
+inline bool enable(int fd) noexcept {
+#ifdef WSS_HAS_ZEROCOPY
+    const int one = 1;
+    return ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+#else
+    (void) fd;
+    return false;
+#endif
+}
+
+/// \brief Single non-blocking sendmsg(MSG_ZEROCOPY) of buffers, starting from offset.
+/// Every successful call gets next completion id of socket (starting from 0)
+/// \param fd
+/// \param buffers
+/// \param offset bytes of buffers already sent
+/// \return sent bytes, -1 and errno on error
+inline ssize_t send(int fd, const std::vector<boost::asio::const_buffer> &buffers, std::size_t offset) noexcept {
+#ifdef WSS_HAS_ZEROCOPY
+    iovec iov[MAX_IOV];
+    std::size_t count = 0;
+    for (const auto &buffer: buffers) {
+        const std::size_t size = boost::asio::buffer_size(buffer);
+        if (offset >= size) {
+            offset -= size;
+            continue;
+        }
+        if (count == MAX_IOV) {
+            break;
+        }
+        iov[count].iov_base = const_cast<char *>(boost::asio::buffer_cast<const char *>(buffer)) + offset;
+        iov[count].iov_len = size - offset;
+        offset = 0;
+        count++;
+    }
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    return ::sendmsg(fd, &msg, MSG_ZEROCOPY | MSG_DONTWAIT | MSG_NOSIGNAL);
+#else
+    (void) fd;
+    (void) buffers;
+    (void) offset;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/// \brief Reads completion notifications from socket error queue, without blocking
+/// \param fd
+/// \param completed set to last completed id, if any notification is read
+/// \param copied incremented by notifications of sends, that kernel has copied anyway (device doesn't support
+/// scatter-gather or loopback)
+/// \return true if any notification is read
+inline bool reap(int fd, uint32_t &completed, std::size_t &copied) noexcept {
+    bool found = false;
+#ifdef WSS_HAS_ZEROCOPY
+    char control[128];
+    while (true) {
+        msghdr msg{};
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (::recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR(&msg, cm)) {
+            const bool recvErr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                || (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+            if (!recvErr) {
+                continue;
+            }
+            const auto *err = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(cm));
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // range [ee_info, ee_data] is completed, tcp completes sends in order
+            completed = err->ee_data;
+            found = true;
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                copied++;
+            }
+        }
+    }
+#else
+    (void) fd;
+    (void) completed;
+    (void) copied;
+#endif
+    return found;
+}
+
+}
+}
+
+#endif //WSSERVER_ZEROCOPY_HPP
@@ -23,3 +23,6 @@ bool wss::AllOfAuth::validateAuth(const wss::web::Request &request) const {
 
     return true;
 }
+void wss::AllOfAuth::validateAuthAsync(const wss::web::Request &request, AuthCallback callback) const {
+    validateAllAsync(request, false, std::move(callback));
+}
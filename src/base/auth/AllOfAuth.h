@@ -20,6 +20,8 @@ class AllOfAuth : public OneOfAuth {
     AllOfAuth(std::vector<std::unique_ptr<Auth>> &&types);
     std::string getType() override;
     bool validateAuth(const wss::web::Request &request) const override;
+    /// \brief Runs all auths in parallel, completes with first failure
+    void validateAuthAsync(const wss::web::Request &request, AuthCallback callback) const override;
 };
 
 }
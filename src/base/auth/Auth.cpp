@@ -16,6 +16,7 @@
 #include "OneOfAuth.h"
 #include "AllOfAuth.h"
 #include "RemoteAuth.h"
+#include "JwtAuth.h"
 
 // NO-AUTH
 std::string wss::Auth::getType() {
@@ -27,6 +28,22 @@ void wss::Auth::performAuth(wss::web::Request &) const {
 bool wss::Auth::validateAuth(const wss::web::Request &) const {
     return true;
 }
+void wss::Auth::validateAuthAsync(const wss::web::Request &request, AuthCallback callback) const {
+    bool authorized = false;
+    try {
+        authorized = validateAuth(request);
+    } catch (const std::exception &e) {
+        L_WARN_F("Auth", "Auth error: %s", e.what());
+    }
+    callback(authorized);
+}
+#ifdef WSS_ENABLE_COROUTINES
+bool wss::Auth::awaitAuth(const wss::web::Request &request, wss::async::Context &context) const {
+    return wss::async::await<bool>(context, [this, &request](std::function<void(bool)> done) {
+      validateAuthAsync(request, done);
+    });
+}
+#endif
 std::string wss::Auth::getLocalValue() const {
     return std::string();
 }
@@ -76,8 +93,8 @@ std::unique_ptr<wss::Auth> wss::auth::registry::createFromConfig(const nlohmann:
         );
     } else if (eq(authType, "oneOf") || eq(authType, "allOf")) {
         bool isOneOf = eq(authType, "oneOf");
-        std::vector<std::unique_ptr<wss::Auth>> types(data.size());
         std::vector<nlohmann::json> items = data.at("types").get<std::vector<nlohmann::json>>();
+        std::vector<std::unique_ptr<wss::Auth>> types(items.size());
 
         for (size_t i = 0; i < items.size(); i++) {
             types[i] = createFromConfig(items.at(i));
@@ -92,6 +109,12 @@ std::unique_ptr<wss::Auth> wss::auth::registry::createFromConfig(const nlohmann:
     } else if (eq(authType, "remote")) {
         std::unique_ptr<wss::Auth> source = createFromConfig(data.at("source").get<nlohmann::json>());
         out = std::make_unique<wss::RemoteAuth>(data, std::move(source));
+    } else if (eq(authType, "jwt")) {
+        std::unique_ptr<wss::Auth> source;
+        if (data.find("source") != data.end()) {
+            source = createFromConfig(data.at("source").get<nlohmann::json>());
+        }
+        out = std::make_unique<wss::JwtAuth>(data, std::move(source));
     } else {
         out = std::make_unique<wss::Auth>();
     }
@@ -11,6 +11,7 @@
 
 #include <string>
 #include <sstream>
+#include <functional>
 #include <memory>
 #include "json.hpp"
 #include "../../web/HttpClient.h"
@@ -42,8 +43,16 @@ namespace wss {
 /// type: allOf
 ///   types: [...list of auth objects...]
 ///
+/// type: remote (see RemoteAuth)
+///
+/// type: jwt (see JwtAuth)
+///
 class Auth {
  public:
+    using AuthCallback = std::function<void(bool authorized)>;
+
+    virtual ~Auth() = default;
+
     /// \brief Auth type
     /// \return string type used by json config
     virtual std::string getType();
@@ -55,6 +64,21 @@ class Auth {
     /// \return true if validated
     virtual bool validateAuth(const wss::web::Request &) const;
 
+    /// \brief Validate without blocking caller. By default validates in place: local checks are cheap,
+    /// remote auth sends request asynchronously, composites run their auths in parallel.
+    /// Never throws: error is reported as not authorized
+    /// \param request is not used after return
+    /// \param callback called once, in place or from http client thread: must not block
+    virtual void validateAuthAsync(const wss::web::Request &request, AuthCallback callback) const;
+
+#ifdef WSS_ENABLE_COROUTINES
+    /// \brief validateAuthAsync() for coroutine: suspends it until auth is done
+    /// \param request must live while coroutine is suspended
+    /// \param context running coroutine
+    /// \return true if validated
+    bool awaitAuth(const wss::web::Request &request, wss::async::Context &context) const;
+#endif
+
     /// \brief Value setled in config
     /// \return
     virtual std::string getLocalValue() const;
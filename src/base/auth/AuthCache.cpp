@@ -0,0 +1,116 @@
+/**
+ * wsserver
+ * AuthCache.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "AuthCache.h"
+#include <algorithm>
+#include <future>
+#include "../../helpers/crypto.hpp"
+
+wss::AuthCache::AuthCache(const Options &options) :
+    m_options(options),
+    m_shardEntries(std::max(options.maxEntries / SHARDS, (std::size_t) 1)) {
+}
+
+bool wss::AuthCache::get(const std::string &value, const Lookup &lookup) {
+    std::promise<bool> result;
+    getAsync(value, [&lookup](DecisionCallback done) {
+      Decision decision{false, false};
+      try {
+          decision = lookup();
+      } catch (...) {
+          // waiters are denied too, nothing is cached
+      }
+      done(decision);
+    }, [&result](bool allowed) {
+      result.set_value(allowed);
+    });
+    return result.get_future().get();
+}
+
+void wss::AuthCache::getAsync(const std::string &value, const AsyncLookup &lookup, ResultCallback callback) {
+    const std::string key = wss::utils::Crypto::sha256(value);
+    Shard &shard = getShard(key);
+    {
+        std::unique_lock<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end()) {
+            if (it->second->expiresAt > Clock::now()) {
+                m_metrics.hits++;
+                shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+                const bool allowed = it->second->allowed;
+                lock.unlock();
+                callback(allowed);
+                return;
+            }
+            shard.lru.erase(it->second);
+            shard.entries.erase(it);
+        }
+
+        auto flight = shard.inFlight.find(key);
+        if (flight != shard.inFlight.end()) {
+            m_metrics.coalesced++;
+            flight->second.push_back(std::move(callback));
+            return;
+        }
+        shard.inFlight[key].push_back(std::move(callback));
+    }
+
+    m_metrics.misses++;
+    try {
+        lookup([this, &shard, key](const Decision &decision) {
+          complete(shard, key, decision);
+        });
+    } catch (...) {
+        complete(shard, key, {false, false});
+    }
+}
+
+void wss::AuthCache::complete(Shard &shard, const std::string &key, const Decision &decision) {
+    std::vector<ResultCallback> waiters;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto flight = shard.inFlight.find(key);
+        if (flight == shard.inFlight.end()) {
+            return;
+        }
+        waiters = std::move(flight->second);
+        shard.inFlight.erase(flight);
+        putLocked(shard, key, decision);
+    }
+    for (const auto &waiter: waiters) {
+        waiter(decision.allowed);
+    }
+}
+
+void wss::AuthCache::putLocked(Shard &shard, const std::string &key, const Decision &decision) {
+    const std::chrono::milliseconds ttl = decision.allowed ? m_options.ttl : m_options.negativeTtl;
+    if (!decision.cacheable || ttl.count() <= 0) {
+        return;
+    }
+
+    shard.lru.push_front({key, decision.allowed, Clock::now() + ttl});
+    shard.entries[key] = shard.lru.begin();
+    while (shard.entries.size() > m_shardEntries) {
+        shard.entries.erase(shard.lru.back().key);
+        shard.lru.pop_back();
+        m_metrics.evicted++;
+    }
+}
+
+std::size_t wss::AuthCache::size() const {
+    std::size_t out = 0;
+    for (const auto &shard: m_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        out += shard.entries.size();
+    }
+    return out;
+}
+
+const wss::AuthCacheMetrics &wss::AuthCache::getMetrics() const noexcept {
+    return m_metrics;
+}
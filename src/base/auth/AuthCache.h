@@ -0,0 +1,112 @@
+/**
+ * wsserver
+ * AuthCache.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_AUTHCACHE_H
+#define WSSERVER_AUTHCACHE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace wss {
+
+struct AuthCacheMetrics {
+  std::atomic<uint64_t> hits{0};
+  std::atomic<uint64_t> misses{0};
+  /// \brief Lookups, that waited for the same value lookup of other thread
+  std::atomic<uint64_t> coalesced{0};
+  std::atomic<uint64_t> evicted{0};
+};
+
+/// \brief Cache of auth decisions. Entries are keyed by sha256 of value (raw tokens are not kept in memory),
+/// split into shards by key, each shard is LRU list with own lock. Allowed and denied decisions have own TTL.
+/// Concurrent lookups of the same value are coalesced: one thread asks backend, others wait for its decision
+class AuthCache {
+ public:
+    /// \brief Number of shards (power of two)
+    static constexpr std::size_t SHARDS = 16;
+
+    struct Options {
+      /// \brief TTL of allowed, 0 - not cached
+      std::chrono::milliseconds ttl{30000};
+      /// \brief TTL of denied, 0 - not cached
+      std::chrono::milliseconds negativeTtl{5000};
+      /// \brief All shards limit, least recently used entries are evicted
+      std::size_t maxEntries = 10000;
+    };
+
+    /// \brief Backend decision
+    struct Decision {
+      bool allowed;
+      /// \brief false if backend failed to decide (transport error, server error): not cached
+      bool cacheable;
+    };
+    using Lookup = std::function<Decision()>;
+    using DecisionCallback = std::function<void(const Decision &decision)>;
+    /// \brief Asynchronous backend request, must call done exactly once
+    using AsyncLookup = std::function<void(DecisionCallback done)>;
+    using ResultCallback = std::function<void(bool allowed)>;
+
+    explicit AuthCache(const Options &options);
+    AuthCache(const AuthCache &other) = delete;
+    AuthCache &operator=(const AuthCache &other) = delete;
+
+    /// \brief Cached decision for value, or lookup result
+    /// \param value remote auth value
+    /// \param lookup called if there is no fresh decision and no lookup of the same value in progress
+    /// \return true if allowed
+    bool get(const std::string &value, const Lookup &lookup);
+
+    /// \brief Non-blocking get
+    /// \param value remote auth value
+    /// \param lookup called if there is no fresh decision and no lookup of the same value in progress
+    /// \param callback called once: right away on hit, otherwise from thread that completes lookup
+    void getAsync(const std::string &value, const AsyncLookup &lookup, ResultCallback callback);
+
+    std::size_t size() const;
+    const AuthCacheMetrics &getMetrics() const noexcept;
+
+ private:
+    using Clock = std::chrono::steady_clock;
+    struct Entry {
+      std::string key;
+      bool allowed;
+      Clock::time_point expiresAt;
+    };
+    struct Shard {
+      mutable std::mutex mutex;
+      /// \brief Most recently used first
+      std::list<Entry> lru;
+      std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+      /// \brief Callbacks waiting for lookup in progress
+      std::unordered_map<std::string, std::vector<ResultCallback>> inFlight;
+    };
+
+    const Options m_options;
+    const std::size_t m_shardEntries;
+    std::array<Shard, SHARDS> m_shards;
+    AuthCacheMetrics m_metrics;
+
+    Shard &getShard(const std::string &key) noexcept {
+        return m_shards[static_cast<unsigned char>(key[0]) & (SHARDS - 1)];
+    }
+    /// \brief Stores decision and completes waiters of key
+    void complete(Shard &shard, const std::string &key, const Decision &decision);
+    /// \brief Stores decision, shard must be locked
+    void putLocked(Shard &shard, const std::string &key, const Decision &decision);
+};
+
+}
+
+#endif //WSSERVER_AUTHCACHE_H
@@ -11,11 +11,13 @@
 // BASIC
 wss::BasicAuth::BasicAuth(std::string &&username, std::string &&password) :
     m_username(std::move(username)),
-    password(std::move(password)) {
+    password(std::move(password)),
+    m_value(buildValue(m_username, this->password)) {
 }
 wss::BasicAuth::BasicAuth(const std::string &username, const std::string &password) :
     m_username(username),
-    password(password) {
+    password(password),
+    m_value(buildValue(username, password)) {
 }
 std::string wss::BasicAuth::getType() {
     return "basic";
@@ -24,12 +26,23 @@ void wss::BasicAuth::performAuth(wss::web::Request &request) const {
     request.setHeader({"Authorization", getLocalValue()});
 }
 bool wss::BasicAuth::validateAuth(const wss::web::Request &request) const {
-    return request.compareHeaderValue("Authorization", getLocalValue());
+    const std::string *header = request.findHeader("Authorization");
+    if (header == nullptr || header->size() != m_value.size()) {
+        return false;
+    }
+
+    // every byte is compared, so time doesn't depend on position of first mismatch
+    unsigned char diff = 0;
+    for (std::size_t i = 0; i < m_value.size(); i++) {
+        diff |= static_cast<unsigned char>((*header)[i] ^ m_value[i]);
+    }
+    return diff == 0;
 }
 std::string wss::BasicAuth::getLocalValue() const {
-    std::stringstream ss;
-    ss << m_username << ":" << password;
-    const std::string glued = ss.str();
+    return m_value;
+}
+std::string wss::BasicAuth::buildValue(const std::string &username, const std::string &password) {
+    const std::string glued = username + ":" + password;
     const std::string encoded = wss::utils::base64_encode(
         reinterpret_cast<const unsigned char *>(glued.c_str()),
         static_cast<unsigned int>(glued.length())
@@ -12,7 +12,8 @@
 
 namespace wss {
 
-/// \brief Basic web authorization with base64(username:password) value
+/// \brief Basic web authorization with base64(username:password) value.
+/// Header value is built once, and compared with request header in place, in constant time
 /// Example config.json
 /// "auth": {
 ///      "type": "basic",
@@ -41,6 +42,10 @@ class BasicAuth : public Auth {
     std::string getRemoteValue(const wss::web::Request &request) const override;
  private:
     std::string m_username, password;
+    /// \brief "Basic base64(username:password)"
+    std::string m_value;
+
+    static std::string buildValue(const std::string &username, const std::string &password);
 };
 
 }
@@ -6,6 +6,7 @@
  */
 
 #include "CookieAuth.h"
+#include <algorithm>
 #include "fmt/format.h"
 
 /// COOKIE
@@ -24,57 +25,69 @@ std::string wss::CookieAuth::getType() {
 void wss::CookieAuth::performAuth(wss::web::Request &request) const {
     request.setHeader({"Cookie", fmt::format("{0}={1}", m_name, m_value)});
 }
-bool wss::CookieAuth::validateAuth(const wss::web::Request &request) const {
-    if (!request.hasHeader("cookie")) {
-        return false;
-    }
-    std::string cookieHeader = request.getHeader("cookie");
-    std::vector<std::string> cookies = toolboxpp::strings::split(cookieHeader, ";");
-
-    const std::string pattern = "([a-zA-Z0-9-_]+)=([a-zA-Z0-9-_]+)";
-    for (auto &cookie: cookies) {
-        if (toolboxpp::strings::hasRegex(pattern, cookie)) {
-            const auto &match = toolboxpp::strings::matchRegexp(pattern, cookie);
-            if (match.size() != 3) {
-                continue;
-            }
+bool wss::CookieAuth::findCookie(const std::string &header, const char *&value, std::size_t &length) const noexcept {
+    const auto isSpace = [](char c) {
+      return c == ' ' || c == '\t';
+    };
+    const auto lower = [](char c) {
+      return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+    };
 
-            const std::string n = match[1];
-            const std::string v = match[2];
+    const char *cursor = header.data();
+    const char *const end = cursor + header.size();
+    while (cursor < end) {
+        const char *next = std::find(cursor, end, ';');
+        const char *eq = std::find(cursor, next, '=');
+        if (eq != next) {
+            const char *nameBegin = cursor, *nameEnd = eq;
+            while (nameBegin < nameEnd && isSpace(*nameBegin)) nameBegin++;
+            while (nameEnd > nameBegin && isSpace(*(nameEnd - 1))) nameEnd--;
 
-            if (toolboxpp::strings::equalsIgnoreCase(m_name, n) && v.compare(m_value) == 0) {
+            const auto nameLength = static_cast<std::size_t>(nameEnd - nameBegin);
+            if (nameLength == m_name.size()
+                && std::equal(nameBegin, nameEnd, m_name.begin(), [&lower](char a, char b) {
+                  return lower(a) == lower(b);
+                })) {
+                const char *valueBegin = eq + 1, *valueEnd = next;
+                while (valueBegin < valueEnd && isSpace(*valueBegin)) valueBegin++;
+                while (valueEnd > valueBegin && isSpace(*(valueEnd - 1))) valueEnd--;
+                if (valueEnd - valueBegin >= 2 && *valueBegin == '"' && *(valueEnd - 1) == '"') {
+                    valueBegin++;
+                    valueEnd--;
+                }
+                value = valueBegin;
+                length = static_cast<std::size_t>(valueEnd - valueBegin);
                 return true;
             }
         }
+        if (next == end) {
+            break;
+        }
+        cursor = next + 1;
     }
 
     return false;
 }
+bool wss::CookieAuth::validateAuth(const wss::web::Request &request) const {
+    const std::string *header = request.findHeader("cookie");
+    const char *value;
+    std::size_t length;
+    if (header == nullptr || !findCookie(*header, value, length)) {
+        return false;
+    }
+
+    return m_value.compare(0, std::string::npos, value, length) == 0;
+}
 std::string wss::CookieAuth::getLocalValue() const {
     return m_value;
 }
 std::string wss::CookieAuth::getRemoteValue(const wss::web::Request &request) const {
-    if (!request.hasHeader("cookie")) {
+    const std::string *header = request.findHeader("cookie");
+    const char *value;
+    std::size_t length;
+    if (header == nullptr || !findCookie(*header, value, length)) {
         return "";
     }
-    std::string cookieHeader = request.getHeader("cookie");
-    std::vector<std::string> cookies = toolboxpp::strings::split(cookieHeader, ";");
-
-    const std::string pattern = "([a-zA-Z0-9-_]+)=([a-zA-Z0-9-_]+)";
-    for (auto &cookie: cookies) {
-        if (toolboxpp::strings::hasRegex(pattern, cookie)) {
-            const auto &match = toolboxpp::strings::matchRegexp(pattern, cookie);
-            if (match.size() != 3) {
-                continue;
-            }
-
-            const std::string n = match[1];
-            const std::string v = match[2];
-            if (toolboxpp::strings::equalsIgnoreCase(n, m_name)) {
-                return v;
-            }
-        }
-    }
 
-    return "";
+    return std::string(value, length);
 }
@@ -12,7 +12,8 @@
 
 namespace wss {
 
-/// \brief
+/// \brief Cookie header is scanned in place: name=value pairs separated by ';', spaces around them and
+/// quotes of value are skipped, name is case insensitive, value must be equal
 /// Example config.json
 /// "auth": {
 ///      "type": "cookie",
@@ -33,6 +34,13 @@ class CookieAuth : public Auth {
     std::string getRemoteValue(const wss::web::Request &request) const override;
  private:
     std::string m_name, m_value;
+
+    /// \brief Finds cookie with configured name
+    /// \param header cookie header value
+    /// \param value begin of cookie value in header
+    /// \param length value length
+    /// \return false if not found
+    bool findCookie(const std::string &header, const char *&value, std::size_t &length) const noexcept;
 };
 
 }
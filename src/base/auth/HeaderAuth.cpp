@@ -23,7 +23,8 @@ void wss::HeaderAuth::performAuth(wss::web::Request &request) const {
     request.setHeader({m_name, getLocalValue()});
 }
 bool wss::HeaderAuth::validateAuth(const wss::web::Request &response) const {
-    return response.compareHeaderValue(m_name, getLocalValue());
+    // value is compared in place, not copied
+    return response.compareHeaderValue(m_name, m_value);
 }
 std::string wss::HeaderAuth::getLocalValue() const {
     return m_value;
@@ -0,0 +1,473 @@
+/**
+ * wsserver
+ * JwtAuth.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "JwtAuth.h"
+#include <algorithm>
+#include <ctime>
+#include <stdexcept>
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/hmac.h>
+#include <openssl/obj_mac.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#include <toolboxpp.h>
+#include "../../helpers/logging.h"
+
+namespace {
+
+/// \brief Strict base64url (RFC 7515), padding is allowed. Only canonical encoding is accepted:
+/// nothing after padding, padding completes last quantum, unused bits of last character are zero
+bool base64UrlDecode(const char *in, std::size_t length, std::string &out) {
+    out.clear();
+    out.reserve(length * 3 / 4);
+    uint32_t buffer = 0;
+    int bits = 0;
+    std::size_t chars = 0;
+    for (; chars < length; chars++) {
+        const char c = in[chars];
+        int value;
+        if (c >= 'A' && c <= 'Z') {
+            value = c - 'A';
+        } else if (c >= 'a' && c <= 'z') {
+            value = c - 'a' + 26;
+        } else if (c >= '0' && c <= '9') {
+            value = c - '0' + 52;
+        } else if (c == '-') {
+            value = 62;
+        } else if (c == '_') {
+            value = 63;
+        } else if (c == '=') {
+            break;
+        } else {
+            return false;
+        }
+        buffer = (buffer << 6) | static_cast<uint32_t>(value);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back(static_cast<char>((buffer >> bits) & 0xFF));
+        }
+    }
+
+    const std::size_t padding = length - chars;
+    if (chars % 4 == 1 || (padding > 0 && (chars % 4 == 0 || padding != 4 - chars % 4))
+        || (buffer & ((1u << bits) - 1)) != 0) {
+        return false;
+    }
+    for (std::size_t i = chars; i < length; i++) {
+        if (in[i] != '=') {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool base64UrlDecode(const std::string &in, std::string &out) {
+    return base64UrlDecode(in.data(), in.size(), out);
+}
+
+BIGNUM *toBignum(const std::string &bytes) {
+    return BN_bin2bn(reinterpret_cast<const unsigned char *>(bytes.data()), static_cast<int>(bytes.size()), nullptr);
+}
+
+std::string claimToString(const nlohmann::json &claim) {
+    if (claim.is_string()) {
+        return claim.get<std::string>();
+    } else if (claim.is_number_unsigned()) {
+        return std::to_string(claim.get<uint64_t>());
+    } else if (claim.is_number_integer()) {
+        return std::to_string(claim.get<int64_t>());
+    }
+    return std::string();
+}
+
+}
+
+wss::JwtAuth::JwtAuth(const nlohmann::json &data, std::unique_ptr<Auth> &&source) :
+    m_source(std::move(source)),
+    m_keys(std::make_shared<const KeySet>()) {
+    m_secret = data.value("secret", "");
+    if (data.find("publicKey") != data.end()) {
+        m_publicKey = parsePem(data.at("publicKey").get<std::string>());
+        if (!m_publicKey) {
+            throw std::invalid_argument("JWT auth: invalid publicKey");
+        }
+    }
+    m_jwksUrl = data.value("jwksUrl", "");
+    m_jwksRefresh = std::chrono::seconds(data.value("jwksRefreshSeconds", (uint32_t) 300));
+    m_issuer = data.value("issuer", "");
+    m_audience = data.value("audience", "");
+    m_userClaim = data.value("userClaim", "sub");
+    m_idParam = data.value("idParam", "id");
+    m_leeway = data.value("leewaySeconds", 30L);
+
+    if (data.find("algorithms") != data.end()) {
+        for (const auto &item: data.at("algorithms")) {
+            const std::string alg = item.get<std::string>();
+            if (alg == "HS256") {
+                m_algorithms |= HS256;
+            } else if (alg == "RS256") {
+                m_algorithms |= RS256;
+            } else if (alg == "ES256") {
+                m_algorithms |= ES256;
+            } else {
+                throw std::invalid_argument("JWT auth: unsupported algorithm " + alg);
+            }
+        }
+    } else {
+        if (!m_secret.empty()) {
+            m_algorithms |= HS256;
+        }
+        if (m_publicKey || !m_jwksUrl.empty()) {
+            m_algorithms |= RS256 | ES256;
+        }
+    }
+    if ((m_algorithms & HS256) && m_secret.empty()) {
+        throw std::invalid_argument("JWT auth: HS256 requires secret");
+    }
+    if ((m_algorithms & (RS256 | ES256)) && !m_publicKey && m_jwksUrl.empty()) {
+        throw std::invalid_argument("JWT auth: RS256 and ES256 require publicKey or jwksUrl");
+    }
+    if (m_algorithms == 0) {
+        throw std::invalid_argument("JWT auth: secret, publicKey or jwksUrl required");
+    }
+
+    if (!m_jwksUrl.empty()) {
+        // first load is synchronous: tokens are verifiable right after start
+        const bool loaded = refreshKeys();
+        m_refresher = std::thread(&JwtAuth::refreshLoop, this, loaded);
+    }
+}
+
+wss::JwtAuth::~JwtAuth() {
+    {
+        std::lock_guard<std::mutex> lock(m_refreshLock);
+        m_stop = true;
+    }
+    m_refreshCondition.notify_all();
+    if (m_refresher.joinable()) {
+        m_refresher.join();
+    }
+}
+
+std::string wss::JwtAuth::getType() {
+    return "jwt";
+}
+void wss::JwtAuth::performAuth(wss::web::Request &) const {
+    // do nothing
+}
+bool wss::JwtAuth::validateAuth(const wss::web::Request &request) const {
+    const std::string token = getRemoteValue(request);
+    if (token.empty()) {
+        return false;
+    }
+
+    std::string user;
+    if (!verify(token, user)) {
+        return false;
+    }
+    if (!m_userClaim.empty() && !m_idParam.empty() && request.hasParam(m_idParam)) {
+        return !user.empty() && request.getParam(m_idParam) == user;
+    }
+    return true;
+}
+std::string wss::JwtAuth::getLocalValue() const {
+    return Auth::getLocalValue();
+}
+std::string wss::JwtAuth::getRemoteValue(const wss::web::Request &request) const {
+    std::string value;
+    if (m_source) {
+        value = m_source->getRemoteValue(request);
+    } else {
+        const std::string *header = request.findHeader("authorization");
+        if (header != nullptr) {
+            value = *header;
+        }
+    }
+
+    const std::string prefix = "bearer ";
+    if (value.size() > prefix.size() && toolboxpp::strings::equalsIgnoreCase(value.substr(0, prefix.size()), prefix)) {
+        value.erase(0, prefix.size());
+    }
+    return value;
+}
+
+bool wss::JwtAuth::verify(const std::string &token, std::string &user) const {
+    const std::size_t first = token.find('.');
+    const std::size_t second = first == std::string::npos ? first : token.find('.', first + 1);
+    if (second == std::string::npos || token.find('.', second + 1) != std::string::npos) {
+        return false;
+    }
+
+    std::string headerData, payloadData, signature;
+    if (!base64UrlDecode(token.data(), first, headerData)
+        || !base64UrlDecode(token.data() + first + 1, second - first - 1, payloadData)
+        || !base64UrlDecode(token.data() + second + 1, token.size() - second - 1, signature)) {
+        return false;
+    }
+    const auto *signingInput = reinterpret_cast<const unsigned char *>(token.data());
+    const std::size_t signingLength = second;
+
+    nlohmann::json header, payload;
+    try {
+        header = nlohmann::json::parse(headerData);
+        payload = nlohmann::json::parse(payloadData);
+    } catch (const std::exception &) {
+        return false;
+    }
+    if (!header.is_object() || !payload.is_object()) {
+        return false;
+    }
+
+    // algorithm of token is accepted only if it's allowed: "none" or HS256 with public key are rejected
+    const std::string alg = header.value("alg", "");
+    const std::string kid = header.value("kid", "");
+    bool verified = false;
+    if (alg == "HS256" && (m_algorithms & HS256)) {
+        unsigned char mac[EVP_MAX_MD_SIZE];
+        unsigned int macLength = 0;
+        HMAC(EVP_sha256(), m_secret.data(), static_cast<int>(m_secret.size()),
+             signingInput, signingLength, mac, &macLength);
+        verified = signature.size() == macLength && CRYPTO_memcmp(mac, signature.data(), macLength) == 0;
+    } else if ((alg == "RS256" && (m_algorithms & RS256)) || (alg == "ES256" && (m_algorithms & ES256))) {
+        const bool isEc = alg == "ES256";
+        KeyPtr key = findKey(kid, isEc ? EVP_PKEY_EC : EVP_PKEY_RSA);
+        if (!key) {
+            return false;
+        }
+
+        std::string der;
+        if (isEc) {
+            // JWS signature is r || s, openssl verifies DER
+            if (signature.size() != 64) {
+                return false;
+            }
+            ECDSA_SIG *sig = ECDSA_SIG_new();
+            ECDSA_SIG_set0(sig, toBignum(signature.substr(0, 32)), toBignum(signature.substr(32)));
+            unsigned char *out = nullptr;
+            const int length = i2d_ECDSA_SIG(sig, &out);
+            if (length > 0) {
+                der.assign(reinterpret_cast<const char *>(out), static_cast<std::size_t>(length));
+            }
+            OPENSSL_free(out);
+            ECDSA_SIG_free(sig);
+            signature = std::move(der);
+        }
+
+        EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+        verified = EVP_DigestVerifyInit(ctx, nullptr, EVP_sha256(), nullptr, key.get()) == 1
+            && EVP_DigestVerifyUpdate(ctx, signingInput, signingLength) == 1
+            && EVP_DigestVerifyFinal(ctx,
+                                     reinterpret_cast<const unsigned char *>(signature.data()),
+                                     signature.size()) == 1;
+        EVP_MD_CTX_free(ctx);
+    }
+    if (!verified) {
+        return false;
+    }
+
+    const long now = static_cast<long>(std::time(nullptr));
+    if (payload.find("exp") != payload.end()) {
+        if (!payload.at("exp").is_number() || payload.at("exp").get<long>() + m_leeway <= now) {
+            return false;
+        }
+    }
+    if (payload.find("nbf") != payload.end()) {
+        if (!payload.at("nbf").is_number() || payload.at("nbf").get<long>() - m_leeway > now) {
+            return false;
+        }
+    }
+    if (!m_issuer.empty() && payload.value("iss", "") != m_issuer) {
+        return false;
+    }
+    if (!m_audience.empty()) {
+        bool found = false;
+        if (payload.find("aud") != payload.end()) {
+            const auto &aud = payload.at("aud");
+            if (aud.is_string()) {
+                found = aud.get<std::string>() == m_audience;
+            } else if (aud.is_array()) {
+                for (const auto &item: aud) {
+                    found = found || (item.is_string() && item.get<std::string>() == m_audience);
+                }
+            }
+        }
+        if (!found) {
+            return false;
+        }
+    }
+
+    user.clear();
+    if (!m_userClaim.empty() && payload.find(m_userClaim) != payload.end()) {
+        user = claimToString(payload.at(m_userClaim));
+    }
+    return true;
+}
+
+std::size_t wss::JwtAuth::getKeysCount() const {
+    std::lock_guard<std::mutex> lock(m_keysLock);
+    return m_keys->size() + (m_publicKey ? 1 : 0);
+}
+
+wss::JwtAuth::KeyPtr wss::JwtAuth::findKey(const std::string &kid, int type) const {
+    std::shared_ptr<const KeySet> keys;
+    {
+        std::lock_guard<std::mutex> lock(m_keysLock);
+        keys = m_keys;
+    }
+
+    if (!kid.empty()) {
+        auto it = keys->find(kid);
+        if (it != keys->end()) {
+            return EVP_PKEY_base_id(it->second.get()) == type ? it->second : nullptr;
+        }
+        if (!m_jwksUrl.empty()) {
+            // key could be rotated after last refresh
+            requestRefresh();
+        }
+    } else {
+        // without kid, single key of type is unambiguous
+        KeyPtr found;
+        for (const auto &item: *keys) {
+            if (EVP_PKEY_base_id(item.second.get()) == type) {
+                if (found) {
+                    found = nullptr;
+                    break;
+                }
+                found = item.second;
+            }
+        }
+        if (found) {
+            return found;
+        }
+    }
+
+    if (m_publicKey && EVP_PKEY_base_id(m_publicKey.get()) == type) {
+        return m_publicKey;
+    }
+    return nullptr;
+}
+
+wss::JwtAuth::KeyPtr wss::JwtAuth::parsePem(const std::string &pem) {
+    BIO *bio = BIO_new_mem_buf(pem.data(), static_cast<int>(pem.size()));
+    EVP_PKEY *key = PEM_read_bio_PUBKEY(bio, nullptr, nullptr, nullptr);
+    BIO_free(bio);
+    if (key == nullptr) {
+        return nullptr;
+    }
+    return KeyPtr(key, EVP_PKEY_free);
+}
+
+wss::JwtAuth::KeyPtr wss::JwtAuth::parseJwk(const nlohmann::json &jwk) {
+    if (jwk.value("use", "sig") != "sig") {
+        return nullptr;
+    }
+
+    const std::string kty = jwk.value("kty", "");
+    EVP_PKEY *key = EVP_PKEY_new();
+    bool assigned = false;
+    if (kty == "RSA") {
+        std::string n, e;
+        if (base64UrlDecode(jwk.value("n", ""), n) && base64UrlDecode(jwk.value("e", ""), e)
+            && !n.empty() && !e.empty()) {
+            RSA *rsa = RSA_new();
+            RSA_set0_key(rsa, toBignum(n), toBignum(e), nullptr);
+            assigned = EVP_PKEY_assign_RSA(key, rsa) == 1;
+            if (!assigned) {
+                RSA_free(rsa);
+            }
+        }
+    } else if (kty == "EC" && jwk.value("crv", "") == "P-256") {
+        std::string x, y;
+        if (base64UrlDecode(jwk.value("x", ""), x) && base64UrlDecode(jwk.value("y", ""), y)) {
+            EC_KEY *ec = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+            BIGNUM *bx = toBignum(x), *by = toBignum(y);
+            assigned = EC_KEY_set_public_key_affine_coordinates(ec, bx, by) == 1
+                && EVP_PKEY_assign_EC_KEY(key, ec) == 1;
+            BN_free(bx);
+            BN_free(by);
+            if (!assigned) {
+                EC_KEY_free(ec);
+            }
+        }
+    }
+
+    if (!assigned) {
+        EVP_PKEY_free(key);
+        return nullptr;
+    }
+    return KeyPtr(key, EVP_PKEY_free);
+}
+
+bool wss::JwtAuth::refreshKeys() {
+    {
+        std::lock_guard<std::mutex> lock(m_refreshLock);
+        m_lastRefresh = std::chrono::steady_clock::now();
+        m_refreshRequested = false;
+    }
+
+    wss::web::Request request(m_jwksUrl, wss::web::Request::Method::GET);
+    wss::web::HttpClient client;
+    client.enableVerbose(false);
+    auto response = client.execute(request);
+    if (!response.isSuccess()) {
+        L_WARN_F("Auth::Jwt", "Unable to load JWKS from %s: %d %s",
+                 m_jwksUrl.c_str(), response.status, response.statusMessage.c_str());
+        return false;
+    }
+
+    auto keys = std::make_shared<KeySet>();
+    try {
+        const nlohmann::json jwks = nlohmann::json::parse(response.data);
+        for (const auto &jwk: jwks.at("keys")) {
+            KeyPtr key = parseJwk(jwk);
+            if (key) {
+                (*keys)[jwk.value("kid", "")] = key;
+            }
+        }
+    } catch (const std::exception &e) {
+        L_WARN_F("Auth::Jwt", "Invalid JWKS from %s: %s", m_jwksUrl.c_str(), e.what());
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_keysLock);
+        m_keys = keys;
+    }
+    WSS_DEBUG_F("Auth::Jwt", "Loaded %lu key(s) from %s", keys->size(), m_jwksUrl.c_str());
+    return true;
+}
+
+void wss::JwtAuth::refreshLoop(bool loaded) {
+    while (true) {
+        {
+            // failed load is retried sooner, previous keys are kept meanwhile
+            const auto interval = loaded ? m_jwksRefresh : std::min(m_jwksRefresh, std::chrono::seconds(10));
+            std::unique_lock<std::mutex> lock(m_refreshLock);
+            m_refreshCondition.wait_until(lock, m_lastRefresh + interval, [this] {
+              return m_stop || m_refreshRequested;
+            });
+            if (m_stop) {
+                return;
+            }
+        }
+        loaded = refreshKeys();
+    }
+}
+
+void wss::JwtAuth::requestRefresh() const {
+    std::lock_guard<std::mutex> lock(m_refreshLock);
+    if (m_refreshRequested || std::chrono::steady_clock::now() - m_lastRefresh < std::chrono::seconds(10)) {
+        return;
+    }
+    m_refreshRequested = true;
+    m_refreshCondition.notify_one();
+}
@@ -0,0 +1,123 @@
+/**
+ * wsserver
+ * JwtAuth.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_JWTAUTH_H
+#define WSSERVER_JWTAUTH_H
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <openssl/evp.h>
+#include "Auth.h"
+
+namespace wss {
+
+/// \brief Verifies signed JWT locally (HS256, RS256, ES256), without request to auth backend.
+/// If request has id parameter (?id= of websocket connection), user claim of token must be equal to it,
+/// so client can't connect as other user with own valid token.
+/// Public keys are taken from "publicKey" (PEM) and/or JWKS, that is loaded on start and refreshed by background
+/// thread (also earlier, if token has unknown kid).
+///
+/// Config example:
+/// {
+///          "type": "jwt",
+///          "source": {
+///            "type": "header",
+///            "name": "Authorization"
+///          }, - where token is taken from, "Bearer " prefix is skipped. Default: Authorization header
+///          "algorithms": ["RS256", "ES256"], - default: HS256 if secret is set, RS256 and ES256 if public keys are set
+///          "secret": "hmac secret", - HS256
+///          "publicKey": "-----BEGIN PUBLIC KEY-----...", - RS256 or ES256
+///          "jwksUrl": "https://auth.mywebapp/.well-known/jwks.json",
+///          "jwksRefreshSeconds": 300,
+///          "issuer": "https://auth.mywebapp/", - optional, "iss" must be equal
+///          "audience": "wsserver", - optional, "aud" must be equal or contain it
+///          "userClaim": "sub", - claim with user id, empty - not checked
+///          "idParam": "id", - request parameter compared with user claim
+///          "leewaySeconds": 30 - allowed clock skew for "exp" and "nbf"
+///        }
+///
+class JwtAuth : public Auth {
+ public:
+    JwtAuth(const nlohmann::json &data, std::unique_ptr<Auth> &&source);
+    ~JwtAuth();
+
+    std::string getType() override;
+    void performAuth(wss::web::Request &request) const override;
+    bool validateAuth(const wss::web::Request &request) const override;
+
+    std::string getLocalValue() const override;
+    /// \brief Token from source, without "Bearer " prefix
+    std::string getRemoteValue(const wss::web::Request &request) const override;
+
+    /// \brief Checks token signature and claims
+    /// \param token compact JWS: header.payload.signature
+    /// \param user value of user claim
+    /// \return true if token is valid
+    bool verify(const std::string &token, std::string &user) const;
+
+    /// \brief Count of public keys (configured and loaded from JWKS)
+    std::size_t getKeysCount() const;
+
+ private:
+    using KeyPtr = std::shared_ptr<EVP_PKEY>;
+    using KeySet = std::unordered_map<std::string, KeyPtr>;
+    enum Algorithm {
+      HS256 = 1 << 0,
+      RS256 = 1 << 1,
+      ES256 = 1 << 2
+    };
+
+    std::unique_ptr<wss::Auth> m_source;
+    int m_algorithms = 0;
+    std::string m_secret;
+    /// \brief Key from config, used for tokens without known kid
+    KeyPtr m_publicKey;
+    std::string m_issuer;
+    std::string m_audience;
+    std::string m_userClaim;
+    std::string m_idParam;
+    long m_leeway;
+
+    std::string m_jwksUrl;
+    std::chrono::seconds m_jwksRefresh;
+    mutable std::mutex m_keysLock;
+    std::shared_ptr<const KeySet> m_keys;
+
+    mutable std::mutex m_refreshLock;
+    mutable std::condition_variable m_refreshCondition;
+    mutable bool m_refreshRequested = false;
+    bool m_stop = false;
+    mutable std::chrono::steady_clock::time_point m_lastRefresh;
+    std::thread m_refresher;
+
+    static KeyPtr parsePem(const std::string &pem);
+    static KeyPtr parseJwk(const nlohmann::json &jwk);
+    /// \brief Loads JWKS
+    /// \return false on error
+    bool refreshKeys();
+    /// \param loaded previous load result
+    void refreshLoop(bool loaded);
+    /// \brief Wakes refresher if token has unknown kid, not often than once per few seconds
+    void requestRefresh() const;
+
+    /// \brief Key for token
+    /// \param kid key id from token header, may be empty
+    /// \param type EVP_PKEY_RSA or EVP_PKEY_EC
+    /// \return nullptr if not found
+    KeyPtr findKey(const std::string &kid, int type) const;
+};
+
+}
+
+#endif //WSSERVER_JWTAUTH_H
@@ -6,6 +6,8 @@
  */
 
 #include "OneOfAuth.h"
+#include <atomic>
+#include <memory>
 
 // OneOfAuth
 wss::OneOfAuth::OneOfAuth(std::vector<std::unique_ptr<wss::Auth>> &&data) : types(std::move(data)) {
@@ -27,6 +29,38 @@ bool wss::OneOfAuth::validateAuth(const wss::web::Request &request) const {
     }
     return false;
 }
+void wss::OneOfAuth::validateAuthAsync(const wss::web::Request &request, AuthCallback callback) const {
+    validateAllAsync(request, true, std::move(callback));
+}
+void wss::OneOfAuth::validateAllAsync(const wss::web::Request &request, bool decisive, AuthCallback callback) const {
+    if (types.empty()) {
+        callback(false);
+        return;
+    }
+
+    struct State {
+      std::atomic<std::size_t> remaining;
+      std::atomic<bool> done{false};
+      AuthCallback callback;
+    };
+    auto state = std::make_shared<State>();
+    state->remaining = types.size();
+    state->callback = std::move(callback);
+
+    for (auto &auth: types) {
+        if (state->done) {
+            // decided by auth, that completed in place
+            break;
+        }
+        auth->validateAuthAsync(request, [state, decisive](bool authorized) {
+          if (authorized == decisive || --state->remaining == 0) {
+              if (!state->done.exchange(true)) {
+                  state->callback(authorized);
+              }
+          }
+        });
+    }
+}
 std::string wss::OneOfAuth::getLocalValue() const {
     return Auth::getLocalValue();
 }
@@ -43,6 +43,8 @@ class OneOfAuth : public Auth {
     /// \brief Validate responsed auth data
     /// \return true if validated
     bool validateAuth(const wss::web::Request &request) const override;
+    /// \brief Runs all auths in parallel, completes with first success
+    void validateAuthAsync(const wss::web::Request &request, AuthCallback callback) const override;
 
     /// \brief Dummy value
     /// \return for this auth type, values is not required
@@ -50,6 +52,13 @@ class OneOfAuth : public Auth {
 
  protected:
     std::vector<std::unique_ptr<wss::Auth>> types;
+
+    /// \brief Runs all auths in parallel. First result equal to decisive completes callback with it,
+    /// otherwise callback gets !decisive when all auths are done
+    /// \param request
+    /// \param decisive
+    /// \param callback
+    void validateAllAsync(const wss::web::Request &request, bool decisive, AuthCallback callback) const;
 };
 
 }
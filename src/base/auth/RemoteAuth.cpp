@@ -14,16 +14,28 @@
 // REMOTE AUTH
 wss::RemoteAuth::RemoteAuth(const nlohmann::json &data, std::unique_ptr<Auth> &&source) :
     m_source(std::move(source)) {
+    std::string body;
     if (data.find("data") != data.end()) {
         if (data.at("data").is_string()) {
-            m_data = data.at("data").get<std::string>();
+            body = data.at("data").get<std::string>();
         } else if (data.at("data").is_object()) {
-            m_data = data.at("data").get<nlohmann::json>().dump();
+            body = data.at("data").get<nlohmann::json>().dump();
         }
     }
+    // placeholder is replaced by value on every auth: template is split once
+    const std::string placeholder = "{0}";
+    std::size_t from = 0, found;
+    while (!body.empty() && (found = body.find(placeholder, from)) != std::string::npos) {
+        m_dataParts.push_back(body.substr(from, found - from));
+        from = found + placeholder.size();
+    }
+    if (!body.empty()) {
+        m_dataParts.push_back(body.substr(from));
+    }
 
     m_url = data.value("url", "");
     m_method = wss::web::Request::methodFromString(data.value("method", "POST"));
+    m_http2 = data.value("http2", false);
 
     std::vector<nlohmann::json> headers = data.value("headers", std::vector<nlohmann::json>(0));
     for (auto &obj: headers) {
@@ -33,6 +45,17 @@ wss::RemoteAuth::RemoteAuth(const nlohmann::json &data, std::unique_ptr<Auth> &&
             m_headers[k] = v;
         }
     }
+
+    AuthCache::Options cacheOptions;
+    if (data.find("cache") != data.end()) {
+        const nlohmann::json &cache = data.at("cache");
+        cacheOptions.ttl = std::chrono::seconds(cache.value("ttlSeconds", (uint32_t) 30));
+        cacheOptions.negativeTtl = std::chrono::seconds(cache.value("negativeTtlSeconds", (uint32_t) 5));
+        cacheOptions.maxEntries = cache.value("maxEntries", (std::size_t) 10000);
+    }
+    if (cacheOptions.ttl.count() > 0 || cacheOptions.negativeTtl.count() > 0) {
+        m_cache = std::make_unique<AuthCache>(cacheOptions);
+    }
 }
 
 std::string wss::RemoteAuth::getType() {
@@ -47,27 +70,66 @@ bool wss::RemoteAuth::validateAuth(const wss::web::Request &request) const {
         // is this make sense to try auth with empty value?
         return false;
     }
+    if (m_cache) {
+        return m_cache->get(value, [this, &value] { return lookup(value); });
+    }
+    return lookup(value).allowed;
+}
+void wss::RemoteAuth::validateAuthAsync(const wss::web::Request &request, AuthCallback callback) const {
+    const std::string value = m_source->getRemoteValue(request);
+    if (value.empty()) {
+        callback(false);
+        return;
+    }
+    if (m_cache) {
+        m_cache->getAsync(value, [this, &value](AuthCache::DecisionCallback done) {
+          lookupAsync(value, std::move(done));
+        }, std::move(callback));
+        return;
+    }
+    lookupAsync(value, [callback](const AuthCache::Decision &decision) {
+      callback(decision.allowed);
+    });
+}
+
+wss::AuthCache::Decision wss::RemoteAuth::decide(const wss::web::Response &response) {
+    // status is -1 on transport error
+    return {response.isSuccess(), response.status > 0 && response.status < 500};
+}
 
+wss::AuthCache::Decision wss::RemoteAuth::lookup(const std::string &value) const {
+    wss::web::HttpClient client;
+    client.enableVerbose(false);
+    client.setHttp2(m_http2);
+    return decide(client.execute(buildRequest(value)));
+}
+
+void wss::RemoteAuth::lookupAsync(const std::string &value, AuthCache::DecisionCallback done) const {
+    wss::web::HttpClient client;
+    client.enableVerbose(false);
+    client.setHttp2(m_http2);
+    client.executeAsync(buildRequest(value), [done](wss::web::Response &&response) {
+      done(decide(response));
+    });
+}
+
+wss::web::Request wss::RemoteAuth::buildRequest(const std::string &value) const {
     wss::web::Request r(m_url, m_method);
     r.setHeaders(m_headers);
 
-    std::string outData;
-    if (!m_data.empty()) {
-        std::vector<std::string> outputs{value};
-        std::vector<std::string> inputs(outputs.size());
-        for (size_t i = 0; i < outputs.size(); i++) {
-            inputs[i] = fmt::format("{{0}}", i);
+    if (!m_dataParts.empty()) {
+        std::string outData = m_dataParts[0];
+        for (std::size_t i = 1; i < m_dataParts.size(); i++) {
+            outData.append(value);
+            outData.append(m_dataParts[i]);
         }
-
-        outData = toolboxpp::strings::substringReplaceAll(inputs, outputs, m_data);
-        r.setBody(outData);
+        r.setBody(std::move(outData));
     }
+    return r;
+}
 
-    wss::web::HttpClient client;
-    client.enableVerbose(false);
-    auto resp = client.execute(r);
-
-    return resp.isSuccess();
+const wss::AuthCache *wss::RemoteAuth::getCache() const noexcept {
+    return m_cache.get();
 }
 std::string wss::RemoteAuth::getLocalValue() const {
     return Auth::getLocalValue();
@@ -8,8 +8,11 @@
 #ifndef WSSERVER_EXECAUTH_H
 #define WSSERVER_EXECAUTH_H
 
+#include <memory>
 #include <unordered_map>
+#include <vector>
 #include "Auth.h"
+#include "AuthCache.h"
 
 namespace wss {
 
@@ -36,6 +39,15 @@ namespace wss {
 ///          }
 /// or if it will be x-www-form-urlencode, set:
 ///          "data": "param1=value1&param2=value2" et cetera
+/// negotiate HTTP/2 (https only): concurrent authorizations are streams of one connection
+///          "http2": false,
+/// decisions cache (see AuthCache), reconnecting clients are not authorized by remote on every connect.
+/// Transport errors and 5xx responses are not cached. 0 ttl - decision is not cached
+///          "cache": {
+///            "ttlSeconds": 30,
+///            "negativeTtlSeconds": 5,
+///            "maxEntries": 10000
+///          }
 ///        }
 ///
 class RemoteAuth : public Auth {
@@ -44,15 +56,30 @@ class RemoteAuth : public Auth {
     std::string getType() override;
     void performAuth(wss::web::Request &request) const override;
     bool validateAuth(const wss::web::Request &request) const override;
+    /// \brief Sends request by async http client, no thread waits for response
+    void validateAuthAsync(const wss::web::Request &request, AuthCallback callback) const override;
+
+    /// \brief Decisions cache
+    /// \return nullptr if cache is disabled
+    const AuthCache *getCache() const noexcept;
 
     std::string getLocalValue() const override;
     std::string getRemoteValue(const wss::web::Request &request) const override;
  private:
     std::unique_ptr<wss::Auth> m_source;
-    std::string m_data;
+    /// \brief Body template split by value placeholders
+    std::vector<std::string> m_dataParts;
     std::unordered_map<std::string, std::string> m_headers;
     std::string m_url;
     wss::web::Request::Method m_method;
+    std::unique_ptr<AuthCache> m_cache;
+    bool m_http2 = false;
+
+    wss::web::Request buildRequest(const std::string &value) const;
+    static AuthCache::Decision decide(const wss::web::Response &response);
+    /// \brief Asks remote
+    AuthCache::Decision lookup(const std::string &value) const;
+    void lookupAsync(const std::string &value, AuthCache::DecisionCallback done) const;
 };
 
 }
@@ -14,6 +14,9 @@
 #include "crypto.hpp"
 #include "../BaseServer.h"
 #include "../SocketLayerWrapper.hpp"
+#include "../SocketOptions.hpp"
+#include "../UnixSocket.hpp"
+#include <cstdio>
 #include <functional>
 #include <iostream>
 #include <limits>
@@ -21,6 +24,7 @@
 #include <mutex>
 #include <sstream>
 #include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <memory>
 #include <boost/asio.hpp>
@@ -105,6 +109,22 @@ class ServerBase : public BaseServer {
             std::ostream::write(ptr, n);
         }
 
+        /// Writes chunk of "Transfer-Encoding: chunked" body. Empty chunk is skipped, it would end the body
+        void write_chunk(const char_type *ptr, std::size_t n) {
+            if (n == 0)
+                return;
+            char size[20];
+            const int length = std::snprintf(size, sizeof(size), "%zx\r\n", n);
+            streambuf.sputn(size, length);
+            streambuf.sputn(ptr, static_cast<std::streamsize>(n));
+            streambuf.sputn("\r\n", 2);
+        }
+
+        /// Ends "Transfer-Encoding: chunked" body
+        void write_last_chunk() {
+            streambuf.sputn("0\r\n\r\n", 5);
+        }
+
         /// Convenience function for writing status line, potential header fields, and empty content
         void write(StatusCode status_code = StatusCode::success_ok,
                    const CaseInsensitiveMultimap &header = CaseInsensitiveMultimap()) {
@@ -175,6 +195,10 @@ class ServerBase : public BaseServer {
                 return std::string();
             }
         }
+        /// Content bytes without copying, size() bytes long. Valid until the stream buffer is consumed.
+        const char *data() noexcept {
+            return asio::buffer_cast<const char *>(streambuf.data());
+        }
 
      private:
         asio::streambuf &streambuf;
@@ -240,6 +264,9 @@ class ServerBase : public BaseServer {
 
         std::shared_ptr<asio::ip::tcp::endpoint> remote_endpoint;
 
+        /// Number of requests handled by this connection.
+        std::size_t requests = 0;
+
         void close() noexcept {
             error_code ec;
             std::unique_lock<std::mutex>
@@ -287,6 +314,8 @@ class ServerBase : public BaseServer {
 
         std::shared_ptr<Connection> connection;
         std::shared_ptr<Request> request;
+        /// Bytes of next pipelined request(s), read together with this request.
+        std::string pipelined;
     };
 
  public:
@@ -305,14 +334,22 @@ class ServerBase : public BaseServer {
         long timeout_request = 5;
         /// Timeout on content handling. Defaults to 300 seconds.
         long timeout_content = 300;
+        /// Timeout of waiting next request on keep-alive connection. Defaults to 60 seconds.
+        long timeout_idle = 60;
+        /// Connection is closed after this number of requests. Defaults to 0 (unlimited).
+        std::size_t max_requests_per_connection = 0;
         /// Maximum size of request stream buffer. Defaults to architecture maximum.
         /// Reaching this limit will result in a message_size error code.
         std::size_t max_request_streambuf_size = std::numeric_limits<std::size_t>::max();
         /// IPv4 address in dotted decimal form or IPv6 address in hexadecimal notation.
         /// If empty, the address will be any address.
+        /// `unix:/path` - listen AF_UNIX socket instead, port is not used. Socket file is replaced on start
+        /// and removed on stop.
         std::string address;
         /// Set to false to avoid binding the socket to an address that is already in use. Defaults to true.
         bool reuse_address = true;
+        /// Tcp options of listener and accepted connections.
+        wss::SocketOptions socket;
     };
     /// Set before calling start().
     Config config;
@@ -326,6 +363,13 @@ class ServerBase : public BaseServer {
     >;
     /// Warning: do not add or remove resources after start() is called
     ResourceEndpoint resource;
+    /// Resources matched by whole path with hash lookup, before regex resources. path_match is left empty.
+    /// Warning: do not add or remove resources after start() is called
+    std::unordered_map<std::string,
+                       std::map<std::string,
+                                std::function<void(std::shared_ptr<typename ServerBase::Response>,
+                                                   std::shared_ptr<typename ServerBase::Request>)>>>
+        exact_resource;
 
     std::map<std::string,
              std::function<void(std::shared_ptr<typename ServerBase::Response>,
@@ -347,20 +391,32 @@ class ServerBase : public BaseServer {
             io_service->reset();
         }
 
-        asio::ip::tcp::endpoint endpoint;
-        if (config.address.size() > 0)
-            endpoint = asio::ip::tcp::endpoint(asio::ip::address::from_string(config.address), config.port);
-        else
-            endpoint = asio::ip::tcp::endpoint(asio::ip::tcp::v4(), config.port);
-
         if (!acceptor) {
             acceptor = std::make_unique<asio::ip::tcp::acceptor>(*io_service);
         }
 
-        acceptor->open(endpoint.protocol());
-        acceptor->set_option(asio::socket_base::reuse_address(config.reuse_address));
-        acceptor->bind(endpoint);
-        acceptor->listen();
+        if (wss::unixsocket::isAddress(config.address)) {
+            // AF_UNIX listener is driven by tcp acceptor: accepted sockets are read and written as any stream socket
+            const int fd = wss::unixsocket::listen(wss::unixsocket::getPath(config.address));
+            error_code ec;
+            acceptor->assign(asio::ip::tcp::v4(), fd, ec);
+            if (ec) {
+                ::close(fd);
+                throw boost::system::system_error(ec);
+            }
+        } else {
+            asio::ip::tcp::endpoint endpoint;
+            if (config.address.size() > 0)
+                endpoint = asio::ip::tcp::endpoint(asio::ip::address::from_string(config.address), config.port);
+            else
+                endpoint = asio::ip::tcp::endpoint(asio::ip::tcp::v4(), config.port);
+
+            acceptor->open(endpoint.protocol());
+            acceptor->set_option(asio::socket_base::reuse_address(config.reuse_address));
+            wss::socketopts::applyListener(*acceptor, config.socket);
+            acceptor->bind(endpoint);
+            acceptor->listen(wss::socketopts::getBacklog(config.socket));
+        }
 
         accept();
 
@@ -388,6 +444,9 @@ class ServerBase : public BaseServer {
         if (acceptor) {
             error_code ec;
             acceptor->close(ec);
+            if (wss::unixsocket::isAddress(config.address)) {
+                wss::unixsocket::remove(wss::unixsocket::getPath(config.address));
+            }
 
             {
                 std::unique_lock<std::mutex> lock(*connections_mutex);
@@ -449,8 +508,35 @@ class ServerBase : public BaseServer {
         return connection;
     }
 
+    /// Moves bytes beyond request content (next pipelined requests) from request streambuf to session.
+    void keep_pipelined(const std::shared_ptr<Session> &session, std::size_t content_length) {
+        auto &streambuf = session->request->streambuf;
+        if (streambuf.size() <= content_length)
+            return;
+
+        const char *data = asio::buffer_cast<const char *>(streambuf.data());
+        const std::string content(data, content_length);
+        session->pipelined.assign(data + content_length, streambuf.size() - content_length);
+        streambuf.consume(streambuf.size());
+        streambuf.sputn(content.data(), content.size());
+    }
+
+    /// Returns true if client allows to reuse connection after response.
+    static bool keep_alive(const Request &request) noexcept {
+        auto range = request.header.equal_range("Connection");
+        for (auto it = range.first; it != range.second; it++) {
+            if (case_insensitive_equal(it->second, "close"))
+                return false;
+            else if (case_insensitive_equal(it->second, "keep-alive"))
+                return true;
+        }
+        return request.http_version >= "1.1";
+    }
+
     void read(const std::shared_ptr<Session> &session) {
-        session->connection->set_timeout(config.timeout_request);
+        // Waiting for next request on keep-alive connection is limited by idle timeout
+        session->connection->set_timeout(session->connection->requests > 0 ? config.timeout_idle
+                                                                            : config.timeout_request);
 
         session->connection->socket->async_read_until(
             session->request->streambuf,
@@ -474,16 +560,21 @@ class ServerBase : public BaseServer {
               if (!ec) {
                   // request->streambuf.size() is not necessarily the same as bytes_transferred, from Boost-docs:
                   // "After a successful async_read_until operation, the streambuf may contain additional data beyond the delimiter"
-                  // The chosen solution is to extract lines from the stream directly when parsing the header. What is left of the
-                  // streambuf (maybe some bytes of the content) is appended to in the async_read-function below (for retrieving content).
+                  // Header is parsed right from read buffer and consumed, what is left of the streambuf
+                  // (maybe some bytes of the content) is appended to in the async_read-function below (for retrieving content),
+                  // so actions get contiguous content without copies.
                   std::size_t num_additional_bytes = session->request->streambuf.size() - bytes_transferred;
 
-                  if (!RequestMessage::parse(session->request->content,
-                                             session->request->method,
-                                             session->request->path,
-                                             session->request->query_string,
-                                             session->request->http_version,
-                                             session->request->header)) {
+                  const bool parsed = RequestMessage::parse(
+                      asio::buffer_cast<const char *>(session->request->streambuf.data()),
+                      bytes_transferred,
+                      session->request->method,
+                      session->request->path,
+                      session->request->query_string,
+                      session->request->http_version,
+                      session->request->header);
+                  session->request->streambuf.consume(bytes_transferred);
+                  if (!parsed) {
                       if (this->on_error)
                           this->on_error(session->request, make_error_code::make_error_code(errc::protocol_error));
                       return;
@@ -531,6 +622,7 @@ class ServerBase : public BaseServer {
                                     this->on_error(session->request, ec);
                               });
                       } else {
+                          this->keep_pipelined(session, content_length);
                           this->find_resource(session);
                       }
                   } else if (
@@ -539,8 +631,10 @@ class ServerBase : public BaseServer {
                       auto
                           chunks_streambuf = std::make_shared<asio::streambuf>(this->config.max_request_streambuf_size);
                       this->read_chunked_transfer_encoded(session, chunks_streambuf);
-                  } else
+                  } else {
+                      this->keep_pipelined(session, 0);
                       this->find_resource(session);
+                  }
               } else if (this->on_error)
                   this->on_error(session->request, ec);
             });
@@ -630,11 +724,12 @@ class ServerBase : public BaseServer {
     void read_chunked_transfer_encoded_chunk(const std::shared_ptr<Session> &session,
                                              const std::shared_ptr<asio::streambuf> &chunks_streambuf,
                                              unsigned long length) {
-        std::ostream tmp_stream(chunks_streambuf.get());
         if (length > 0) {
-            std::unique_ptr<char[]> buffer(new char[length]);
-            session->request->content.read(buffer.get(), static_cast<std::streamsize>(length));
-            tmp_stream.write(buffer.get(), static_cast<std::streamsize>(length));
+            // chunk is copied once, from read buffer to contiguous content
+            auto &streambuf = session->request->streambuf;
+            chunks_streambuf->sputn(asio::buffer_cast<const char *>(streambuf.data()),
+                                    static_cast<std::streamsize>(length));
+            streambuf.consume(length);
             if (chunks_streambuf->size() == chunks_streambuf->max_size()) {
                 auto response = std::shared_ptr<Response>(new Response(session, this->config.timeout_content));
                 response->write(StatusCode::client_error_payload_too_large);
@@ -653,8 +748,8 @@ class ServerBase : public BaseServer {
             read_chunked_transfer_encoded(session, chunks_streambuf);
         else {
             if (chunks_streambuf->size() > 0) {
-                std::ostream ostream(&session->request->streambuf);
-                ostream << chunks_streambuf.get();
+                session->request->streambuf.sputn(asio::buffer_cast<const char *>(chunks_streambuf->data()),
+                                                  static_cast<std::streamsize>(chunks_streambuf->size()));
             }
             this->find_resource(session);
         }
@@ -677,6 +772,15 @@ class ServerBase : public BaseServer {
                 return;
             }
         }
+        // Exact path is found in constant time, regex resources are fallback
+        auto exact = exact_resource.find(session->request->path);
+        if (exact != exact_resource.end()) {
+            auto it = exact->second.find(session->request->method);
+            if (it != exact->second.end()) {
+                write(session, it->second);
+                return;
+            }
+        }
         // Find path- and method-match, and call write
         for (auto &regex_method : resource) {
             auto it = regex_method.second.find(session->request->method);
@@ -706,28 +810,24 @@ class ServerBase : public BaseServer {
                     if (response->close_connection_after_response)
                         return;
 
-                    auto range = response->session->request->header.equal_range("Connection");
-                    for (auto it = range.first; it != range.second; it++) {
-                        if (case_insensitive_equal(it->second, "close"))
-                            return;
-                        else if (case_insensitive_equal(it->second, "keep-alive")) {
-                            auto new_session = std::make_shared<Session>(this->config.max_request_streambuf_size,
-                                                                         response->session->connection);
-                            this->read(new_session);
-                            return;
-                        }
-                    }
-                    if (response->session->request->http_version >= "1.1") {
-                        auto new_session = std::make_shared<Session>(this->config.max_request_streambuf_size,
-                                                                     response->session->connection);
-                        this->read(new_session);
-                        return;
-                    }
+                    auto new_session = std::make_shared<Session>(this->config.max_request_streambuf_size,
+                                                                 response->session->connection);
+                    // Pipelined requests are handled one by one, so responses are sent in order of requests
+                    const std::string &pipelined = response->session->pipelined;
+                    if (!pipelined.empty())
+                        new_session->request->streambuf.sputn(pipelined.data(), pipelined.size());
+                    this->read(new_session);
                 } else if (this->on_error)
                     this->on_error(response->session->request, ec);
               });
             });
 
+        // Handler may check close_connection_after_response to write proper Connection header
+        const std::size_t requests = ++session->connection->requests;
+        if (!keep_alive(*session->request)
+            || (config.max_requests_per_connection > 0 && requests >= config.max_requests_per_connection))
+            response->close_connection_after_response = true;
+
         try {
             resource_function(response, session->request);
         }
@@ -759,9 +859,7 @@ class Server : public ServerBase {
           auto session = std::make_shared<Session>(config.max_request_streambuf_size, connection);
 
           if (!ec) {
-              asio::ip::tcp::no_delay option(true);
-              error_code ec;
-              session->connection->socket->set_option(option, ec);
+              wss::socketopts::apply(session->connection->socket->lowest_layer(), config.socket);
 
               this->read(session);
           } else if (this->on_error)
@@ -823,9 +921,7 @@ class ServerSecure : public ServerBase {
           auto session = std::make_shared<Session>(config.max_request_streambuf_size, connection);
 
           if (!ec) {
-              asio::ip::tcp::no_delay option(true);
-              error_code ec;
-              session->connection->socket->lowest_layer().set_option(option, ec);
+              wss::socketopts::apply(session->connection->socket->lowest_layer(), config.socket);
 
               session->connection->set_timeout(config.timeout_request);
               session->connection->socket
@@ -23,7 +23,7 @@ void wss::unid::generateUUID() {
     boost::uuids::uuid id = boost::uuids::random_generator()();
 
     boost::random::random_device randDevice;
-    boost::random::uniform_int_distribution<> indexDist(0, id.size());
+    boost::random::uniform_int_distribution<> indexDist(0, static_cast<int>(id.size()) - 1);
     const int
         b1 = indexDist(randDevice),
         b2 = indexDist(randDevice),
@@ -46,30 +46,58 @@ void wss::unid::generateUUID() {
     );
 }
 wss::unid::id wss::unid::next() {
-
-    uint32_t cnt = m_counter.load(std::memory_order_acquire);// force acquire latest inc
-
-    // every N counter we need new uuid, just in case
-    if (cnt % m_maxCounterUUID == 0 || cnt == m_maxCounter) {
-        generateUUID();
-    }
-
-    // prevent overflow
-    if (cnt == m_maxCounter) {
-        cnt = 0;
+    // one shared atomic add per COUNTER_BLOCK ids, blocks of threads never overlap
+    struct Block {
+      uint32_t next = 0;
+      uint32_t end = 0;
+    };
+    static thread_local Block block;
+    if (block.next == block.end) {
+        block.next = m_counter.fetch_add(COUNTER_BLOCK, std::memory_order_relaxed);
+        block.end = block.next + COUNTER_BLOCK;
     }
 
-    cnt++;
-
-    m_counter.store(cnt, std::memory_order_relaxed); // no matter, what thread will increment last value, relax sync
     return {
         (uint32_t) time(nullptr),
-        m_uuidBytes.load(std::memory_order_acquire),
+        m_uuidBytes.load(std::memory_order_relaxed),
         pid,
-        cnt
+        block.next++
     };
 }
 
 wss::unid::id wss::unid::operator()() noexcept {
     return next();
 }
+bool wss::unid::id::parse(const std::string &value, unid::id &out) noexcept {
+    // XXXXXXXX-XXXXXXXX-XXXX-XXXXXXXX
+    static const std::size_t groups[] = {8, 8, 4, 8};
+    if (value.size() != 31) {
+        return false;
+    }
+    uint32_t parts[4] = {0, 0, 0, 0};
+    std::size_t pos = 0;
+    for (std::size_t g = 0; g < 4; g++) {
+        if (g > 0 && value[pos++] != '-') {
+            return false;
+        }
+        for (std::size_t i = 0; i < groups[g]; i++, pos++) {
+            const char c = value[pos];
+            uint32_t digit;
+            if (c >= '0' && c <= '9') {
+                digit = static_cast<uint32_t>(c - '0');
+            } else if (c >= 'A' && c <= 'F') {
+                digit = static_cast<uint32_t>(c - 'A' + 10);
+            } else if (c >= 'a' && c <= 'f') {
+                digit = static_cast<uint32_t>(c - 'a' + 10);
+            } else {
+                return false;
+            }
+            parts[g] = (parts[g] << 4) | digit;
+        }
+    }
+    out.tm = parts[0];
+    out.uuid = parts[1];
+    out.pid = static_cast<uint16_t>(parts[2]);
+    out.inc = parts[3];
+    return true;
+}
@@ -22,7 +22,8 @@ namespace wss {
 /// 4 bytes - current unix timestamp (seconds since 1970)
 /// 4 bytes - 4 random bytes (of 16) from uuid
 /// 2 bytes - current process PID. If pid is 32 bit, it will cutted to 16 bits by: pid & 0xFFFF
-/// 4 bytes - incremental integer
+/// 4 bytes - incremental integer, unique for all threads (wraps after 2^32 ids)
+/// Thread safe: every thread takes counter values by blocks, so generation is a thread local increment
 class unid {
  public:
     struct id {
@@ -49,6 +50,12 @@ class unid {
       friend void to_json(nlohmann::json &obj, const unid::id &id) {
           obj = id.str();
       }
+
+      /// \brief Parses string made by str()
+      /// \param value
+      /// \param out
+      /// \return false if value is not valid id
+      static bool parse(const std::string &value, unid::id &out) noexcept;
     };
 
     static unid &generator() {
@@ -73,16 +80,14 @@ class unid {
     /// \brief Generates new uuid and set new value to uuidBytes
     void generateUUID();
 
-    /// \brief Maximum auto increment value
-    const uint32_t m_maxCounter = 0xFFFFFFFF - 1;
-    /// \brief Number of when we'll generate new UUID
-    const uint32_t m_maxCounterUUID = 1000;
+    /// \brief Counter values taken by thread at once
+    static const uint32_t COUNTER_BLOCK = 1024;
 
     /// \brief PID 2 bytes usual (max 65535)
     uint16_t pid;
-    /// \brief First 4 random bytes from uuid
+    /// \brief 4 random bytes from uuid, generated once per process
     std::atomic<uint32_t> m_uuidBytes;
-    /// \brief Incremental counter
+    /// \brief Start of next counter block
     std::atomic<uint32_t> m_counter;
 
 };
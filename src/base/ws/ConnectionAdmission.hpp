@@ -0,0 +1,272 @@
+/*!
+ * wsserver.
+ * ConnectionAdmission.hpp
+ *
+ * \date 2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_CONNECTIONADMISSION_HPP
+#define WSSERVER_CONNECTIONADMISSION_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <boost/asio/ip/address.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/type_traits/integral_constant.hpp>
+#include "token_bucket.hpp"
+
+namespace wss {
+namespace server {
+namespace websocket {
+
+/// \brief Per source address limits, checked right after accept (after PROXY header, if it's used), before
+/// TLS and websocket handshakes: connections over limits are closed without reading anything.
+/// IPv4 sources are counted by address, IPv6 ones by /64 prefix (one host usually owns whole prefix).
+/// Shared by listeners of one server, must be owned by shared_ptr: tickets keep it
+class ConnectionAdmission : public std::enable_shared_from_this<ConnectionAdmission> {
+ public:
+    struct Options {
+      /// \brief Max open connections of source, including ones in handshake, 0 - unlimited
+      std::size_t maxConnectionsPerIp = 0;
+      /// \brief New connections per second of source, 0 - unlimited
+      double connectRatePerIp = 0;
+      /// \brief Connections opened at once before rate applies
+      double connectBurstPerIp = 0;
+    };
+
+    enum class Result {
+      Accepted,
+      TooManyConnections,
+      TooFrequent
+    };
+
+    /// \brief Open connection slot of source, released by destructor
+    class Ticket {
+     public:
+        Ticket() noexcept = default;
+        Ticket(const Ticket &other) = delete;
+        Ticket &operator=(const Ticket &other) = delete;
+        ~Ticket() {
+            release();
+        }
+
+        void release() noexcept {
+            if (m_owner) {
+                m_owner->release(m_key);
+                m_owner.reset();
+            }
+        }
+
+     private:
+        friend class ConnectionAdmission;
+        std::shared_ptr<ConnectionAdmission> m_owner;
+        uint64_t m_key = 0;
+    };
+
+    /// \brief Not thread safe: call before listeners are started
+    /// \param options
+    void configure(const Options &options) noexcept {
+        m_options = options;
+        m_cost = 0;
+        m_window = 0;
+        if (options.connectRatePerIp > 0) {
+            m_cost = std::max<int64_t>(1, static_cast<int64_t>(1e9 / options.connectRatePerIp));
+            m_window = static_cast<int64_t>(std::max(1.0, options.connectBurstPerIp) * m_cost);
+        }
+    }
+
+    bool isEnabled() const noexcept {
+        return m_options.maxConnectionsPerIp > 0 || m_cost > 0;
+    }
+
+    /// \brief Checks limits of source and takes connection slot
+    /// \param address unspecified one (unix socket) is always accepted. Local gateways pass address of their
+    /// clients in PROXY header instead (see Http2Gateway)
+    /// \param ticket connection slot, released when ticket is destroyed
+    /// \return
+    Result admit(const boost::asio::ip::address &address, Ticket &ticket) {
+        if (!isEnabled() || address.is_unspecified()) {
+            return Result::Accepted;
+        }
+        const uint64_t key = toKey(address);
+        const int64_t now = wss::utils::TokenBucket::nowNanos();
+        Stripe &stripe = m_stripes[key % STRIPES];
+
+        std::lock_guard<std::mutex> lock(stripe.lock);
+        if (stripe.sources.size() >= PRUNE_SOURCES) {
+            pruneLocked(stripe, now);
+        }
+        Source &source = stripe.sources[key];
+        if (m_options.maxConnectionsPerIp > 0 && source.connections >= m_options.maxConnectionsPerIp) {
+            return Result::TooManyConnections;
+        }
+        if (m_cost > 0) {
+            // GCRA, like wss::utils::TokenBucket
+            const int64_t next = std::max(source.tat, now) + m_cost;
+            if (next - now > m_window) {
+                if (source.connections == 0) {
+                    // nothing to release: entry stays only for its bucket
+                    source.tat = std::max(source.tat, now);
+                }
+                return Result::TooFrequent;
+            }
+            source.tat = next;
+        }
+        source.connections++;
+        ticket.release();
+        ticket.m_owner = shared_from_this();
+        ticket.m_key = key;
+        return Result::Accepted;
+    }
+
+    /// \brief Sources with open connections or not refilled buckets
+    std::size_t size() const {
+        std::size_t out = 0;
+        for (auto &stripe: m_stripes) {
+            std::lock_guard<std::mutex> lock(stripe.lock);
+            out += stripe.sources.size();
+        }
+        return out;
+    }
+
+ private:
+    static constexpr std::size_t STRIPES = 16;
+    /// \brief Stripe is swept for idle sources when it grows to this size
+    static constexpr std::size_t PRUNE_SOURCES = 4096;
+
+    struct Source {
+      std::size_t connections = 0;
+      /// \brief Theoretical arrival time of next connection, steady nanoseconds
+      int64_t tat = 0;
+    };
+    struct Stripe {
+      mutable std::mutex lock;
+      std::unordered_map<uint64_t, Source> sources;
+    };
+
+    Options m_options;
+    /// \brief Nanoseconds per connection and burst in nanoseconds, 0 - no rate limit
+    int64_t m_cost = 0;
+    int64_t m_window = 0;
+    std::array<Stripe, STRIPES> m_stripes;
+
+    /// \brief IPv4 address (or IPv4-mapped IPv6) as is, upper half of IPv6 otherwise:
+    /// global IPv6 prefixes never fit 32 bits, so they don't collide with IPv4 keys
+    static uint64_t toKey(const boost::asio::ip::address &address) noexcept {
+        if (address.is_v4()) {
+            return address.to_v4().to_ulong();
+        }
+        const boost::asio::ip::address_v6 v6 = address.to_v6();
+        const auto bytes = v6.to_bytes();
+        if (v6.is_v4_mapped()) {
+            return (uint64_t(bytes[12]) << 24) | (uint64_t(bytes[13]) << 16) | (uint64_t(bytes[14]) << 8) | bytes[15];
+        }
+        uint64_t key = 0;
+        for (std::size_t i = 0; i < 8; i++) {
+            key = (key << 8) | bytes[i];
+        }
+        return key;
+    }
+
+    static void pruneLocked(Stripe &stripe, int64_t now) {
+        for (auto it = stripe.sources.begin(); it != stripe.sources.end();) {
+            if (it->second.connections == 0 && it->second.tat <= now) {
+                it = stripe.sources.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void release(uint64_t key) noexcept {
+        Stripe &stripe = m_stripes[key % STRIPES];
+        std::lock_guard<std::mutex> lock(stripe.lock);
+        auto it = stripe.sources.find(key);
+        if (it == stripe.sources.end()) {
+            return;
+        }
+        if (it->second.connections > 0) {
+            it->second.connections--;
+        }
+        if (it->second.connections == 0 && it->second.tat <= wss::utils::TokenBucket::nowNanos()) {
+            stripe.sources.erase(it);
+        }
+    }
+};
+
+/// \brief async_read_until() condition of websocket upgrade request head: stops at \r\n\r\n,
+/// or early, if connection doesn't start with "GET " or head grows over limit.
+/// Read size is then checked by isComplete()
+class HandshakeHeadCondition {
+ public:
+    /// \param maxBytes 0 - unlimited
+    explicit HandshakeHeadCondition(std::size_t maxBytes) noexcept :
+        m_maxBytes(maxBytes) { }
+
+    template<typename Iterator>
+    std::pair<Iterator, bool> operator()(Iterator begin, Iterator end) const {
+        static const char method[] = "GET ";
+        static const char delimiter[] = "\r\n\r\n";
+        const auto available = static_cast<std::size_t>(std::distance(begin, end));
+
+        Iterator it = begin;
+        // request line is checked before waiting for headers: scanners and non-http clients are dropped at once
+        for (; m_checked < 4 && it != end; ++it, m_checked++) {
+            if (*it != method[m_checked]) {
+                return std::make_pair(it, true);
+            }
+        }
+
+        const Iterator found = std::search(it, end, delimiter, delimiter + 4);
+        if (found != end) {
+            return std::make_pair(std::next(found, 4), true);
+        }
+        if (m_maxBytes > 0 && m_scanned + available > m_maxBytes) {
+            return std::make_pair(end, true);
+        }
+        // delimiter may be split between reads
+        const std::size_t keep = std::min<std::size_t>(3, static_cast<std::size_t>(std::distance(it, end)));
+        using Difference = typename std::iterator_traits<Iterator>::difference_type;
+        const Iterator resume = std::prev(end, static_cast<Difference>(keep));
+        m_scanned += static_cast<std::size_t>(std::distance(begin, resume));
+        return std::make_pair(resume, false);
+    }
+
+    /// \brief Whether read of this condition has ended with \r\n\r\n
+    /// \param data read buffer
+    /// \param length bytes transferred by read
+    /// \return false if connection must be rejected
+    static bool isComplete(const char *data, std::size_t length) noexcept {
+        return length >= 8 && std::memcmp(data, "GET ", 4) == 0 && std::memcmp(data + length - 4, "\r\n\r\n", 4) == 0;
+    }
+
+ private:
+    const std::size_t m_maxBytes;
+    /// \brief Bytes of request method checked, bytes scanned before current read. Condition is owned by read
+    /// operation and called only by it
+    mutable std::size_t m_checked = 0;
+    mutable std::size_t m_scanned = 0;
+};
+
+}
+}
+}
+
+namespace boost {
+namespace asio {
+template<>
+struct is_match_condition<wss::server::websocket::HandshakeHeadCondition> : public boost::true_type {
+};
+}
+}
+
+#endif //WSSERVER_CONNECTIONADMISSION_HPP
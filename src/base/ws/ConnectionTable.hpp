@@ -0,0 +1,248 @@
+/*!
+ * wsserver.
+ * ConnectionTable.hpp
+ *
+ * \date 2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_CONNECTIONTABLE_HPP
+#define WSSERVER_CONNECTIONTABLE_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "../Metrics.h"
+
+namespace wss {
+namespace server {
+namespace websocket {
+
+/// \brief Hot metadata of all connections of process, structure of arrays: sweeps over all connections
+/// (keepalive state, queues, owners) stream through few contiguous columns instead of chasing connection objects.
+/// Connection holds its slot and keeps these fields right in table cells, so they are written once.
+/// Split into shards by creating thread, each one has columns in chunks of CHUNK_SLOTS: chunks are allocated on
+/// demand and kept for process lifetime, so cells never move. Freed slots are reused by next connections of shard
+class ConnectionTable {
+ public:
+    static constexpr std::size_t SHARDS = 16;
+    static constexpr std::size_t CHUNK_SLOTS = 4096;
+    /// \brief Chunks per shard: table holds up to 64M connections
+    static constexpr std::size_t MAX_CHUNKS = 1024;
+
+    /// \brief Columns of CHUNK_SLOTS connections. Free slot has uniqueId 0
+    struct Chunk {
+      std::array<std::atomic<uint64_t>, CHUNK_SLOTS> uniqueId;
+      /// \brief Owner (user) id, 0 - not authorized yet
+      std::array<std::atomic<uint64_t>, CHUNK_SLOTS> userId;
+      /// \brief Last incoming frame time: steady clock milliseconds
+      std::array<std::atomic<int64_t>, CHUNK_SLOTS> lastActivity;
+      /// \brief Last outgoing data frame time: steady clock milliseconds
+      std::array<std::atomic<int64_t>, CHUNK_SLOTS> lastSend;
+      /// \brief Pings sent after last incoming frame
+      std::array<std::atomic<std::size_t>, CHUNK_SLOTS> unansweredPings;
+      /// \brief Send queue depth
+      std::array<std::atomic<std::size_t>, CHUNK_SLOTS> queuedFrames;
+      std::array<std::atomic<std::size_t>, CHUNK_SLOTS> queuedBytes;
+    };
+
+    /// \brief Cells of one connection in global() table, released by destructor
+    class Slot {
+     public:
+        Slot() {
+            global().allocate(*this);
+        }
+
+        Slot(const Slot &other) = delete;
+        Slot &operator=(const Slot &other) = delete;
+
+        ~Slot() {
+            global().release(*this);
+        }
+
+        /// \brief Makes slot visible to sweeps. Other cells must be set before
+        /// \param uniqueId not 0
+        void publish(uint64_t uniqueId) noexcept {
+            m_chunk->uniqueId[index()].store(uniqueId, std::memory_order_release);
+        }
+
+        std::atomic<uint64_t> &userId() const noexcept {
+            return m_chunk->userId[index()];
+        }
+        std::atomic<int64_t> &lastActivity() const noexcept {
+            return m_chunk->lastActivity[index()];
+        }
+        std::atomic<int64_t> &lastSend() const noexcept {
+            return m_chunk->lastSend[index()];
+        }
+        std::atomic<std::size_t> &unansweredPings() const noexcept {
+            return m_chunk->unansweredPings[index()];
+        }
+        std::atomic<std::size_t> &queuedFrames() const noexcept {
+            return m_chunk->queuedFrames[index()];
+        }
+        std::atomic<std::size_t> &queuedBytes() const noexcept {
+            return m_chunk->queuedBytes[index()];
+        }
+
+     private:
+        friend class ConnectionTable;
+        Chunk *m_chunk = nullptr;
+        uint32_t m_shard = 0;
+        /// \brief Index in shard
+        uint32_t m_slot = 0;
+
+        std::size_t index() const noexcept {
+            return m_slot % CHUNK_SLOTS;
+        }
+    };
+
+    /// \brief Connections state, computed by one sweep over columns
+    struct Summary {
+      std::size_t connections = 0;
+      /// \brief Connections with owner id
+      std::size_t authorized = 0;
+      /// \brief Connections with unanswered keepalive pings
+      std::size_t awaitingPong = 0;
+      /// \brief Connections without incoming frames for idle time and longer
+      std::size_t idle = 0;
+      std::size_t maxQueueFrames = 0;
+      std::size_t maxQueueBytes = 0;
+    };
+
+    /// \brief Table of all connections of process
+    static ConnectionTable &global() {
+        static ConnectionTable table;
+        return table;
+    }
+
+    ConnectionTable() = default;
+    ConnectionTable(const ConnectionTable &other) = delete;
+    ConnectionTable &operator=(const ConnectionTable &other) = delete;
+
+    ~ConnectionTable() {
+        for (auto &shard: m_shards) {
+            for (auto &chunk: shard.chunks) {
+                delete chunk.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// \brief Calls fn(const Chunk &, std::size_t count) for every chunk in use: slots from count are not
+    /// allocated yet, free slots below it have uniqueId 0. Runs concurrently with opens and closes
+    template<typename Fn>
+    void forEachChunk(Fn &&fn) const {
+        for (const auto &shard: m_shards) {
+            const std::size_t used = shard.used.load(std::memory_order_acquire);
+            for (std::size_t i = 0; i * CHUNK_SLOTS < used; i++) {
+                const Chunk &chunk = *shard.chunks[i].load(std::memory_order_acquire);
+                fn(chunk, std::min(CHUNK_SLOTS, used - i * CHUNK_SLOTS));
+            }
+        }
+    }
+
+    /// \brief Sweeps columns: each one is read sequentially, connection objects are not touched
+    /// \param nowMillis steady clock milliseconds
+    /// \param idleMillis connections without incoming frames for this time are idle
+    /// \return
+    Summary summarize(int64_t nowMillis, int64_t idleMillis) const {
+        Summary out;
+        forEachChunk([&out, nowMillis, idleMillis](const Chunk &chunk, std::size_t count) {
+          for (std::size_t i = 0; i < count; i++) {
+              if (chunk.uniqueId[i].load(std::memory_order_acquire) == 0) {
+                  continue;
+              }
+              out.connections++;
+              out.authorized += chunk.userId[i].load(std::memory_order_relaxed) != 0;
+              out.awaitingPong += chunk.unansweredPings[i].load(std::memory_order_relaxed) != 0;
+              out.idle += nowMillis - chunk.lastActivity[i].load(std::memory_order_relaxed) >= idleMillis;
+              out.maxQueueFrames = std::max(out.maxQueueFrames, chunk.queuedFrames[i].load(std::memory_order_relaxed));
+              out.maxQueueBytes = std::max(out.maxQueueBytes, chunk.queuedBytes[i].load(std::memory_order_relaxed));
+          }
+        });
+        return out;
+    }
+
+ private:
+    struct Shard {
+      std::mutex mutex;
+      /// \brief Released slots, reused first
+      std::vector<uint32_t> free;
+      /// \brief Slots ever allocated, all of them are below this index
+      std::atomic<std::size_t> used{0};
+      std::array<std::atomic<Chunk *>, MAX_CHUNKS> chunks{};
+    };
+    std::array<Shard, SHARDS> m_shards;
+    std::atomic<std::size_t> m_nextShard{0};
+
+    /// \brief Connections of one thread mostly share shard and its chunks
+    std::size_t threadShard() noexcept {
+        thread_local std::size_t shard = m_nextShard.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+        return shard;
+    }
+
+    void allocate(Slot &slot) {
+        const std::size_t first = threadShard();
+        for (std::size_t n = 0; n < SHARDS; n++) {
+            const std::size_t index = (first + n) % SHARDS;
+            Shard &shard = m_shards[index];
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            uint32_t position;
+            if (!shard.free.empty()) {
+                position = shard.free.back();
+                shard.free.pop_back();
+            } else {
+                const std::size_t used = shard.used.load(std::memory_order_relaxed);
+                if (used == MAX_CHUNKS * CHUNK_SLOTS) {
+                    continue;
+                }
+                if (used % CHUNK_SLOTS == 0) {
+                    // cells are zeroed: free slot, connection without state
+                    shard.chunks[used / CHUNK_SLOTS].store(new Chunk(), std::memory_order_release);
+                    wss::metrics::acquire(wss::metrics::Memory::Connections, sizeof(Chunk));
+                }
+                position = static_cast<uint32_t>(used);
+                // published after chunk pointer
+                shard.used.store(used + 1, std::memory_order_release);
+            }
+            slot.m_shard = static_cast<uint32_t>(index);
+            slot.m_slot = position;
+            slot.m_chunk = shard.chunks[position / CHUNK_SLOTS].load(std::memory_order_relaxed);
+            return;
+        }
+        throw std::bad_alloc();
+    }
+
+    void release(Slot &slot) noexcept {
+        Chunk &chunk = *slot.m_chunk;
+        const std::size_t i = slot.index();
+        chunk.uniqueId[i].store(0, std::memory_order_release);
+        chunk.userId[i].store(0, std::memory_order_relaxed);
+        chunk.lastActivity[i].store(0, std::memory_order_relaxed);
+        chunk.lastSend[i].store(0, std::memory_order_relaxed);
+        chunk.unansweredPings[i].store(0, std::memory_order_relaxed);
+        chunk.queuedFrames[i].store(0, std::memory_order_relaxed);
+        chunk.queuedBytes[i].store(0, std::memory_order_relaxed);
+
+        Shard &shard = m_shards[slot.m_shard];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        try {
+            shard.free.push_back(slot.m_slot);
+        } catch (...) {
+            // slot is lost, table stays consistent
+        }
+    }
+};
+
+}
+}
+}
+
+#endif //WSSERVER_CONNECTIONTABLE_HPP
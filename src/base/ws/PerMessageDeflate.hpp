@@ -0,0 +1,357 @@
+/*!
+ * wsserver.
+ * PerMessageDeflate.hpp
+ *
+ * \date 2018
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_PERMESSAGEDEFLATE_HPP
+#define WSSERVER_PERMESSAGEDEFLATE_HPP
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+#include <cctype>
+#include <zlib.h>
+
+namespace wss {
+namespace server {
+namespace websocket {
+
+/// \brief permessage-deflate extension (RFC 7692)
+/// Instance keeps compression and decompression contexts of single connection, so it's not thread safe:
+/// use it only inside connection strand.
+class PerMessageDeflate {
+ public:
+    /// \brief Server side extension settings
+    struct Options {
+      /// \brief Enable extension negotiation
+      bool enabled = false;
+      /// \brief Outgoing frames with payload smaller than this value will be sent uncompressed
+      std::size_t minSize = 256;
+      /// \brief zlib compression level: -1 (default), 0-9
+      int level = Z_DEFAULT_COMPRESSION;
+      /// \brief Max LZ77 window bits used by server compressor: 8-15
+      int serverMaxWindowBits = 15;
+      /// \brief Max LZ77 window bits that client is allowed to use: 8-15
+      int clientMaxWindowBits = 15;
+      /// \brief Reset server compressor after each message
+      bool serverNoContextTakeover = false;
+      /// \brief Ask client to reset its compressor after each message
+      bool clientNoContextTakeover = false;
+    };
+
+    /// \brief Negotiated parameters
+    struct Params {
+      int serverMaxWindowBits = 15;
+      int clientMaxWindowBits = 15;
+      bool serverNoContextTakeover = false;
+      bool clientNoContextTakeover = false;
+    };
+
+    /// \brief Chooses first acceptable permessage-deflate offer from client Sec-WebSocket-Extensions header value
+    /// \param offers header value (multiple headers must be joined with comma)
+    /// \param options server settings
+    /// \param params negotiated parameters
+    /// \param response Sec-WebSocket-Extensions response header value
+    /// \return false if there is no acceptable offer
+    static bool negotiate(const std::string &offers, const Options &options, Params &params, std::string &response) {
+        for (const auto &offer: split(offers, ',')) {
+            std::vector<std::string> items = split(offer, ';');
+            if (items.empty() || items[0] != "permessage-deflate") {
+                continue;
+            }
+
+            Params p;
+            p.serverMaxWindowBits = options.serverMaxWindowBits;
+            p.clientMaxWindowBits = options.clientMaxWindowBits;
+            p.serverNoContextTakeover = options.serverNoContextTakeover;
+            p.clientNoContextTakeover = options.clientNoContextTakeover;
+
+            bool valid = true;
+            bool hasClientBits = false;
+            std::vector<std::string> seen;
+            for (std::size_t i = 1; i < items.size() && valid; i++) {
+                std::string name, value;
+                const auto eq = items[i].find('=');
+                if (eq == std::string::npos) {
+                    name = items[i];
+                } else {
+                    name = trim(items[i].substr(0, eq));
+                    value = trim(items[i].substr(eq + 1));
+                    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+                        value = value.substr(1, value.size() - 2);
+                    }
+                }
+
+                // duplicated parameters are not allowed
+                if (std::find(seen.begin(), seen.end(), name) != seen.end()) {
+                    valid = false;
+                    break;
+                }
+                seen.push_back(name);
+
+                if (name == "server_no_context_takeover" && value.empty()) {
+                    p.serverNoContextTakeover = true;
+                } else if (name == "client_no_context_takeover" && value.empty()) {
+                    p.clientNoContextTakeover = true;
+                } else if (name == "server_max_window_bits") {
+                    int bits = parseWindowBits(value);
+                    if (bits == 0) {
+                        valid = false;
+                    } else {
+                        p.serverMaxWindowBits = std::min(bits, options.serverMaxWindowBits);
+                    }
+                } else if (name == "client_max_window_bits") {
+                    hasClientBits = true;
+                    if (!value.empty()) {
+                        int bits = parseWindowBits(value);
+                        if (bits == 0) {
+                            valid = false;
+                        } else {
+                            p.clientMaxWindowBits = std::min(bits, options.clientMaxWindowBits);
+                        }
+                    }
+                } else {
+                    valid = false;
+                }
+            }
+
+            // zlib can't compress raw deflate with 8 bits window, so declining such offer
+            if (!valid || p.serverMaxWindowBits < 9) {
+                continue;
+            }
+
+            // client must support client_max_window_bits if we want limit its window
+            if (!hasClientBits) {
+                p.clientMaxWindowBits = 15;
+            }
+
+            response = "permessage-deflate";
+            if (p.serverNoContextTakeover) response += "; server_no_context_takeover";
+            if (p.clientNoContextTakeover) response += "; client_no_context_takeover";
+            if (p.serverMaxWindowBits < 15) response += "; server_max_window_bits=" + std::to_string(p.serverMaxWindowBits);
+            if (hasClientBits && p.clientMaxWindowBits < 15) {
+                response += "; client_max_window_bits=" + std::to_string(p.clientMaxWindowBits);
+            }
+
+            params = p;
+            return true;
+        }
+
+        return false;
+    }
+
+    PerMessageDeflate(const Params &params, const Options &options) :
+        m_params(params),
+        m_minSize(options.minSize) {
+        std::memset(&m_deflate, 0, sizeof(m_deflate));
+        std::memset(&m_inflate, 0, sizeof(m_inflate));
+
+        // zlib does not support raw deflate with 8 bits window, 9 is compatible with 8
+        if (deflateInit2(&m_deflate, options.level, Z_DEFLATED, -std::max(9, params.serverMaxWindowBits),
+                         8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("Unable to initialize deflate stream");
+        }
+        if (inflateInit2(&m_inflate, -std::max(9, params.clientMaxWindowBits)) != Z_OK) {
+            deflateEnd(&m_deflate);
+            throw std::runtime_error("Unable to initialize inflate stream");
+        }
+    }
+
+    PerMessageDeflate(const PerMessageDeflate &) = delete;
+    PerMessageDeflate &operator=(const PerMessageDeflate &) = delete;
+
+    ~PerMessageDeflate() {
+        deflateEnd(&m_deflate);
+        inflateEnd(&m_inflate);
+    }
+
+    /// \brief Minimum payload size to compress
+    std::size_t getMinSize() const noexcept {
+        return m_minSize;
+    }
+
+    const Params &getParams() const noexcept {
+        return m_params;
+    }
+
+    /// \brief Compresses whole message payload
+    /// \param data
+    /// \param length
+    /// \param out compressed payload, without trailing 0x00 0x00 0xff 0xff
+    /// \return false on zlib error
+    bool compress(const uint8_t *data, std::size_t length, std::string &out) {
+        out.clear();
+        m_deflate.next_in = const_cast<Bytef *>(data);
+        m_deflate.avail_in = static_cast<uInt>(length);
+
+        uint8_t chunk[CHUNK_SIZE];
+        do {
+            m_deflate.next_out = chunk;
+            m_deflate.avail_out = CHUNK_SIZE;
+            int ret = ::deflate(&m_deflate, Z_SYNC_FLUSH);
+            if (ret == Z_STREAM_ERROR) {
+                deflateReset(&m_deflate);
+                return false;
+            }
+            out.append(reinterpret_cast<const char *>(chunk), CHUNK_SIZE - m_deflate.avail_out);
+        } while (m_deflate.avail_out == 0);
+
+        if (out.size() >= 4 && std::memcmp(out.data() + out.size() - 4, tail(), 4) == 0) {
+            out.resize(out.size() - 4);
+        }
+        if (out.empty()) {
+            // RFC 7692 7.2.3.6: empty block
+            out.push_back('\0');
+        }
+
+        if (m_params.serverNoContextTakeover) {
+            deflateReset(&m_deflate);
+        }
+
+        return true;
+    }
+
+    /// \brief Decompresses message frame payload. Fragments must be passed in order they've come.
+    /// \param data
+    /// \param length
+    /// \param fin last message frame
+    /// \param out decompressed data will be appended here
+    /// \param maxSize max size of out, to protect from compression bombs
+    /// \return false on zlib error or if maxSize is exceeded
+    bool decompress(const uint8_t *data, std::size_t length, bool fin, std::string &out, std::size_t maxSize) {
+        if (!inflateChunk(data, length, out, maxSize)) {
+            resetInflate();
+            return false;
+        }
+        if (fin) {
+            // tail is not needed by stream ended with BFINAL block
+            if (!m_inflateEnded && !inflateChunk(tail(), 4, out, maxSize)) {
+                resetInflate();
+                return false;
+            }
+            if (m_params.clientNoContextTakeover) {
+                resetInflate();
+            } else if (m_inflateEnded) {
+                restartInflate();
+            }
+        }
+
+        return true;
+    }
+
+ private:
+    static const std::size_t CHUNK_SIZE = 16384;
+
+    /// \brief Deflate block tail, removed from outgoing message and appended to incoming
+    static const uint8_t *tail() noexcept {
+        static const uint8_t bytes[4] = {0x00, 0x00, 0xff, 0xff};
+        return bytes;
+    }
+
+    Params m_params;
+    std::size_t m_minSize;
+    z_stream m_deflate;
+    z_stream m_inflate;
+    /// \brief Client has sent block with BFINAL set in current message (RFC 7692 7.2.3.3)
+    bool m_inflateEnded = false;
+
+    bool inflateChunk(const uint8_t *data, std::size_t length, std::string &out, std::size_t maxSize) {
+        if (m_inflateEnded) {
+            // nothing may follow the end of deflate stream in the same message
+            return length == 0;
+        }
+        m_inflate.next_in = const_cast<Bytef *>(data);
+        m_inflate.avail_in = static_cast<uInt>(length);
+
+        uint8_t chunk[CHUNK_SIZE];
+        do {
+            m_inflate.next_out = chunk;
+            m_inflate.avail_out = CHUNK_SIZE;
+            int ret = ::inflate(&m_inflate, Z_SYNC_FLUSH);
+            if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END) {
+                return false;
+            }
+            const std::size_t produced = CHUNK_SIZE - m_inflate.avail_out;
+            if (out.size() + produced > maxSize) {
+                return false;
+            }
+            out.append(reinterpret_cast<const char *>(chunk), produced);
+            if (ret == Z_STREAM_END) {
+                // inflate doesn't read input after stream end anymore
+                m_inflateEnded = true;
+                return m_inflate.avail_in == 0;
+            }
+            if (ret == Z_BUF_ERROR) {
+                break;
+            }
+        } while (m_inflate.avail_out == 0 || m_inflate.avail_in > 0);
+
+        return true;
+    }
+
+    void resetInflate() {
+        inflateReset(&m_inflate);
+        m_inflateEnded = false;
+    }
+
+    /// \brief Starts new stream after BFINAL block, keeping window: next messages may still refer to this one
+    void restartInflate() {
+        uint8_t window[32768];
+        uInt windowSize = 0;
+        const bool keep = inflateGetDictionary(&m_inflate, window, &windowSize) == Z_OK;
+        resetInflate();
+        if (keep && windowSize > 0) {
+            inflateSetDictionary(&m_inflate, window, windowSize);
+        }
+    }
+
+    static int parseWindowBits(const std::string &value) {
+        if (value.empty() || value.size() > 2 || !std::all_of(value.begin(), value.end(), ::isdigit)) {
+            return 0;
+        }
+        int bits = std::stoi(value);
+        if (bits < 8 || bits > 15) {
+            return 0;
+        }
+        return bits;
+    }
+
+    static std::string trim(const std::string &in) {
+        const auto begin = in.find_first_not_of(" \t");
+        if (begin == std::string::npos) {
+            return std::string();
+        }
+        const auto end = in.find_last_not_of(" \t");
+        return in.substr(begin, end - begin + 1);
+    }
+
+    static std::vector<std::string> split(const std::string &in, char delimiter) {
+        std::vector<std::string> out;
+        std::size_t start = 0;
+        while (start <= in.size()) {
+            auto pos = in.find(delimiter, start);
+            if (pos == std::string::npos) {
+                pos = in.size();
+            }
+            std::string item = trim(in.substr(start, pos - start));
+            if (!item.empty()) {
+                out.push_back(std::move(item));
+            }
+            start = pos + 1;
+        }
+        return out;
+    }
+};
+
+}
+}
+}
+
+#endif //WSSERVER_PERMESSAGEDEFLATE_HPP
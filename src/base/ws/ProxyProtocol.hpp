@@ -0,0 +1,155 @@
+/*!
+ * wsserver.
+ * ProxyProtocol.hpp
+ *
+ * \date 2018
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_PROXYPROTOCOL_HPP
+#define WSSERVER_PROXYPROTOCOL_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <boost/asio/ip/tcp.hpp>
+
+namespace wss {
+namespace server {
+namespace websocket {
+
+/// \brief PROXY protocol v2 header (haproxy proxy-protocol.txt, section 2.2), sent by L4 balancer
+/// before any connection data: original client address of connection.
+/// Header is binary and self-delimited, so it's read with first bytes of connection, without extra round trip
+class ProxyProtocol {
+ public:
+    /// \brief Signature, version/command, family, u16 length of addresses and TLVs
+    static constexpr std::size_t HEADER_BYTES = 16;
+    /// \brief Limit of addresses and TLVs length: balancers send 12..36 bytes of addresses and a few small TLVs
+    static constexpr std::size_t MAX_BODY_BYTES = 2048;
+
+    enum class Status {
+      /// \brief Original client address is read
+      Proxied,
+      /// \brief LOCAL command (balancer health check) or unsupported family: socket peer address is kept
+      Local,
+      Invalid
+    };
+
+    /// \brief Checks fixed part of header
+    /// \param data HEADER_BYTES
+    /// \param bodyBytes length of addresses and TLVs, that follow fixed part
+    /// \return false if it's not PROXY v2 header or body is too long
+    static bool parseHeader(const uint8_t *data, std::size_t &bodyBytes) noexcept {
+        static const std::array<uint8_t, 12> signature = {{
+            0x0D, 0x0A, 0x0D, 0x0A, 0x00, 0x0D, 0x0A, 0x51, 0x55, 0x49, 0x54, 0x0A
+        }};
+        if (std::memcmp(data, signature.data(), signature.size()) != 0 || (data[12] & 0xF0u) != 0x20u) {
+            return false;
+        }
+        bodyBytes = (static_cast<std::size_t>(data[14]) << 8u) | data[15];
+        return bodyBytes <= MAX_BODY_BYTES;
+    }
+
+    /// \brief Reads source address of connection
+    /// \param header HEADER_BYTES, checked by parseHeader()
+    /// \param body addresses and TLVs
+    /// \param bodyBytes
+    /// \param source written only if status is Proxied
+    /// \return
+    static Status parseBody(const uint8_t *header,
+                            const uint8_t *body,
+                            std::size_t bodyBytes,
+                            boost::asio::ip::tcp::endpoint &source) noexcept {
+        const uint8_t command = header[12] & 0x0Fu;
+        if (command == 0x00u) {
+            return Status::Local;
+        }
+        if (command != 0x01u) {
+            return Status::Invalid;
+        }
+
+        // high nibble - address family, low - transport. Only TCP over IPv4 and IPv6 is translated
+        const uint8_t family = header[13];
+        if (family == 0x11u) {
+            if (bodyBytes < 12) {
+                return Status::Invalid;
+            }
+            boost::asio::ip::address_v4::bytes_type address;
+            std::memcpy(address.data(), body, address.size());
+            source = boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v4(address), readPort(body + 8));
+            return Status::Proxied;
+        }
+        if (family == 0x21u) {
+            if (bodyBytes < 36) {
+                return Status::Invalid;
+            }
+            boost::asio::ip::address_v6::bytes_type address;
+            std::memcpy(address.data(), body, address.size());
+            source = boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v6(address), readPort(body + 32));
+            return Status::Proxied;
+        }
+        return Status::Local;
+    }
+
+    /// \brief Builds PROXY command header, for connections that local gateways open on behalf of clients
+    /// \param source client address
+    /// \param destination address client connected to
+    /// \return header and addresses, IPv4 addresses are written as IPv4-mapped if other one is IPv6
+    static std::string writeHeader(const boost::asio::ip::tcp::endpoint &source,
+                                   const boost::asio::ip::tcp::endpoint &destination) {
+        static const char signature[] = "\x0D\x0A\x0D\x0A\x00\x0D\x0A\x51\x55\x49\x54\x0A";
+        const bool v4 = source.address().is_v4() && destination.address().is_v4();
+        std::string out(signature, 12);
+        out.push_back('\x21');
+        out.push_back(v4 ? '\x11' : '\x21');
+        const std::size_t bodyBytes = v4 ? 12 : 36;
+        out.push_back(static_cast<char>(bodyBytes >> 8u));
+        out.push_back(static_cast<char>(bodyBytes & 0xFFu));
+        if (v4) {
+            appendBytes(out, source.address().to_v4().to_bytes());
+            appendBytes(out, destination.address().to_v4().to_bytes());
+        } else {
+            appendBytes(out, toV6(source.address()).to_bytes());
+            appendBytes(out, toV6(destination.address()).to_bytes());
+        }
+        writePort(out, source.port());
+        writePort(out, destination.port());
+        return out;
+    }
+
+ private:
+    template<typename Bytes>
+    static void appendBytes(std::string &out, const Bytes &bytes) {
+        out.append(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    }
+
+    static boost::asio::ip::address_v6 toV6(const boost::asio::ip::address &address) {
+        if (address.is_v6()) {
+            return address.to_v6();
+        }
+        boost::asio::ip::address_v6::bytes_type bytes{};
+        const auto v4 = address.to_v4().to_bytes();
+        bytes[10] = 0xFF;
+        bytes[11] = 0xFF;
+        std::memcpy(bytes.data() + 12, v4.data(), v4.size());
+        return boost::asio::ip::address_v6(bytes);
+    }
+
+    static void writePort(std::string &out, unsigned short port) {
+        out.push_back(static_cast<char>(port >> 8u));
+        out.push_back(static_cast<char>(port & 0xFFu));
+    }
+
+    static unsigned short readPort(const uint8_t *data) noexcept {
+        return static_cast<unsigned short>((data[0] << 8u) | data[1]);
+    }
+};
+
+}
+}
+}
+
+#endif //WSSERVER_PROXYPROTOCOL_HPP
@@ -0,0 +1,179 @@
+/*!
+ * wsserver.
+ * TlsSessionTickets.hpp
+ *
+ * \date 2018
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_TLSSESSIONTICKETS_HPP
+#define WSSERVER_TLSSESSIONTICKETS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <openssl/ssl.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+namespace wss {
+namespace server {
+namespace websocket {
+
+/// \brief TLS session resumption counters
+struct TlsSessionMetrics {
+  /// \brief Completed handshakes
+  std::atomic<uint64_t> handshakes{0};
+  /// \brief Handshakes resumed from session cache or ticket
+  std::atomic<uint64_t> resumed{0};
+  /// \brief Tickets encrypted with previous key, that were accepted and renewed
+  std::atomic<uint64_t> ticketsRenewed{0};
+  /// \brief Tickets with unknown (expired) key, full handshake was made
+  std::atomic<uint64_t> ticketsRejected{0};
+};
+
+/// \brief RFC 5077 session ticket keys with rotation.
+/// Keeps current key, used to issue tickets, and previous key, that is still accepted,
+/// so clients with tickets issued before rotation are resumed (and get fresh ticket).
+/// Keys are rotated lazily by handshake that came after rotation interval, so no timers needed.
+class TlsSessionTickets {
+ public:
+    using Clock = std::chrono::steady_clock;
+
+    /// \param rotation key lifetime, 0 - never rotate
+    explicit TlsSessionTickets(Clock::duration rotation = Clock::duration::zero()) :
+        m_rotation(rotation),
+        m_rotatedAt(Clock::now()) {
+        generate(m_current);
+        generate(m_previous);
+    }
+
+    TlsSessionTickets(const TlsSessionTickets &) = delete;
+    TlsSessionTickets &operator=(const TlsSessionTickets &) = delete;
+
+    /// \brief Installs ticket key callback to context. Instance must outlive context
+    /// \param ctx
+    /// \param metrics counters, can be nullptr
+    void install(SSL_CTX *ctx, TlsSessionMetrics *metrics) {
+        m_metrics = metrics;
+        SSL_CTX_set_ex_data(ctx, exIndex(), this);
+        SSL_CTX_set_tlsext_ticket_key_cb(ctx, &TlsSessionTickets::callback);
+    }
+
+    /// \brief New key for issuing tickets, current becomes previous, previous is forgotten
+    void rotate() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        rotateLocked();
+    }
+
+ private:
+    struct Key {
+      std::array<unsigned char, 16> name;
+      std::array<unsigned char, 32> aesKey;
+      std::array<unsigned char, 32> hmacKey;
+    };
+
+    std::mutex m_mutex;
+    Clock::duration m_rotation;
+    Clock::time_point m_rotatedAt;
+    Key m_current;
+    Key m_previous;
+    TlsSessionMetrics *m_metrics = nullptr;
+
+    static int exIndex() {
+        static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+    }
+
+    void rotateLocked() {
+        Key key;
+        generate(key);
+        m_previous = m_current;
+        m_current = key;
+        m_rotatedAt = Clock::now();
+    }
+
+    static void generate(Key &key) {
+        if (RAND_bytes(key.name.data(), static_cast<int>(key.name.size())) != 1
+            || RAND_bytes(key.aesKey.data(), static_cast<int>(key.aesKey.size())) != 1
+            || RAND_bytes(key.hmacKey.data(), static_cast<int>(key.hmacKey.size())) != 1) {
+            throw std::runtime_error("Unable to generate TLS session ticket key");
+        }
+    }
+
+    /// \brief OpenSSL ticket key callback
+    /// \return encrypt: 1 - ok, -1 - error; decrypt: 0 - unknown key, 1 - ok, 2 - ok, ticket should be renewed
+    static int callback(SSL *ssl, unsigned char *keyName, unsigned char *iv, EVP_CIPHER_CTX *cipherCtx,
+                        HMAC_CTX *hmacCtx, int encrypt) {
+        auto *self = static_cast<TlsSessionTickets *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), exIndex()));
+        if (self == nullptr) {
+            return -1;
+        }
+
+        Key key;
+        int result = 1;
+        {
+            std::unique_lock<std::mutex> lock(self->m_mutex);
+            if (self->m_rotation > Clock::duration::zero() && Clock::now() - self->m_rotatedAt >= self->m_rotation) {
+                try {
+                    self->rotateLocked();
+                } catch (const std::exception &) {
+                    // keeping old keys, will try next time
+                }
+            }
+
+            if (encrypt) {
+                key = self->m_current;
+            } else if (std::memcmp(keyName, self->m_current.name.data(), key.name.size()) == 0) {
+                key = self->m_current;
+            } else if (std::memcmp(keyName, self->m_previous.name.data(), key.name.size()) == 0) {
+                key = self->m_previous;
+                result = 2;
+            } else {
+                result = 0;
+            }
+        }
+
+        if (result == 0) {
+            if (self->m_metrics) {
+                self->m_metrics->ticketsRejected++;
+            }
+            return 0;
+        }
+
+        if (encrypt) {
+            if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1) {
+                return -1;
+            }
+            std::memcpy(keyName, key.name.data(), key.name.size());
+            if (EVP_EncryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key.aesKey.data(), iv) != 1) {
+                return -1;
+            }
+        } else {
+            if (EVP_DecryptInit_ex(cipherCtx, EVP_aes_256_cbc(), nullptr, key.aesKey.data(), iv) != 1) {
+                return -1;
+            }
+        }
+
+        if (HMAC_Init_ex(hmacCtx, key.hmacKey.data(), static_cast<int>(key.hmacKey.size()), EVP_sha256(), nullptr)
+            != 1) {
+            return -1;
+        }
+
+        if (result == 2 && self->m_metrics) {
+            self->m_metrics->ticketsRenewed++;
+        }
+        return result;
+    }
+};
+
+}
+}
+}
+
+#endif //WSSERVER_TLSSESSIONTICKETS_HPP
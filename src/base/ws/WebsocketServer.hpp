@@ -10,29 +10,52 @@
 #ifndef WSSERVER_WEBSOCKETSERVER_H
 #define WSSERVER_WEBSOCKETSERVER_H
 
+#include "../Affinity.h"
 #include "../BaseServer.h"
+#include "../Hotpath.h"
+#include "../Metrics.h"
 #include "../SocketLayerWrapper.hpp"
+#include "../SocketOptions.hpp"
+#include "../UnixSocket.hpp"
+#include "../ZeroCopy.hpp"
 
 #include "crypto.hpp"
 #include "utility.hpp"
+#include "unmask.hpp"
+#include "ring_queue.hpp"
+#include "slab_pool.hpp"
+#include "timer_wheel.hpp"
+#include "token_bucket.hpp"
+#include "ConnectionAdmission.hpp"
+#include "ConnectionTable.hpp"
+#include "PerMessageDeflate.hpp"
+#include "ProxyProtocol.hpp"
+#include "TlsSessionTickets.hpp"
+#include "concurrentqueue.h"
 
 #include <atomic>
+#include <deque>
 #include <iostream>
 #include <limits>
-#include <list>
 #include <memory>
 #include <mutex>
 #include <functional>
 #include <thread>
 #include <unordered_set>
+#include <vector>
+#include <array>
 #include <toolboxpp.h>
 #include <string>
+#include <cstring>
 #include <algorithm>
 #include <openssl/ssl.h>
 #include <boost/asio/ssl.hpp>
 #include <boost/thread.hpp>
 #include <boost/asio.hpp>
 #include <boost/asio/steady_timer.hpp>
+#include <boost/utility/string_view.hpp>
+#include <sys/socket.h>
+#include <unistd.h>
 
 namespace wss {
 namespace server {
@@ -45,15 +68,119 @@ namespace make_error_code = boost::system::errc;
 using WS = asio::ip::tcp::socket;
 using SendCallback = std::function<void(const ErrorCode, std::size_t)>;
 using namespace wss::utils;
+using EndpointConnectionsLock = wss::hotpath::ProfiledLock<std::unique_lock<std::mutex>,
+                                                           wss::hotpath::LockSite::EndpointConnections>;
+using TimeoutWheelLock = wss::hotpath::ProfiledLock<std::unique_lock<std::mutex>, wss::hotpath::LockSite::TimeoutWheel>;
 
 class SocketServer;
 class SocketServerSecure;
 
+/// \brief What to do when connection send queue reaches high-water mark (slow consumer)
+enum class SlowConsumerPolicy {
+  /// \brief Drop oldest queued (not being written) frames, callbacks receive frameDroppedError()
+  DropOldest,
+  /// \brief Drop new frame, callback receives frameDroppedError()
+  DropNewest,
+  /// \brief Reject new frame, callback receives errc::no_buffer_space, so caller can store it somewhere else
+  Reject,
+  /// \brief Close connection with 1013 (try again later), new frame callback receives errc::no_buffer_space
+  Close
+};
+
+/// \brief Connection send lane. Frames of higher priority lane never wait behind lower priority backlog
+enum class SendPriority {
+  /// \brief Control frames (close, ping, pong) and latency-critical messages. Always written first
+  High = 0,
+  /// \brief Regular messages
+  Normal = 1,
+  /// \brief Bulk traffic, like redelivered history
+  Bulk = 2
+};
+/// \brief Number of SendPriority lanes
+constexpr std::size_t SEND_PRIORITIES = 3;
+/// \brief TLS writes up to this size are copied into one buffer (see Connection::tlsWriteBuffer)
+constexpr std::size_t TLS_LINEARIZE_MAX_BYTES = 64 * 1024;
+/// \brief Zero-copy writes of connection, which frames wait for kernel completion: next writes are copied
+constexpr std::size_t ZEROCOPY_MAX_HELD = 64;
+/// \brief Max read of large frame payload at once: buffer grows with received bytes, not with declared length
+constexpr std::size_t READ_STEP_MAX_BYTES = 64 * 1024;
+
+/// \brief Identity of superseding frames (last write wins): new frame replaces not written frame
+/// of the same key in connection send lane, keeping its position. Kind 0 - frame is never replaced
+struct CoalesceKey {
+  uint32_t kind = 0;
+  uint64_t source = 0;
+  uint64_t scope = 0;
+
+  explicit operator bool() const noexcept {
+      return kind != 0;
+  }
+  bool operator==(const CoalesceKey &other) const noexcept {
+      return kind == other.kind && source == other.source && scope == other.scope;
+  }
+};
+
+/// \brief Error passed to send callback when frame was dropped by slow consumer policy.
+/// Not an operation_aborted (ECANCELED), to distinguish it from real socket cancellation.
+inline ErrorCode frameDroppedError() noexcept {
+    return make_error_code::make_error_code(errc::resource_unavailable_try_again);
+}
+
+/// \brief Send queues gauges, summary for all server connections
+struct SendQueueMetrics {
+  std::atomic<uint64_t> frames{0};
+  std::atomic<uint64_t> bytes{0};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> slowConsumerCloses{0};
+  /// \brief Frames replaced by newer frame of the same CoalesceKey
+  std::atomic<uint64_t> coalesced{0};
+};
+
+/// \brief Results of event loop probes (see SocketServerBase::Config::loopLagProbeMillis)
+struct EventLoopMetrics {
+  /// \brief Last measured lag of each event loop, microseconds. Index is shard index (0 - main loop)
+  std::vector<int64_t> lagMicros;
+  /// \brief Connections, which executor backlog was sampled by last probe
+  std::size_t backlogSampled = 0;
+  /// \brief Largest and summary tasks waiting in executors of sampled connections
+  std::size_t backlogMax = 0;
+  std::size_t backlogTotal = 0;
+};
+
+/// \brief Point-in-time state of one connection, read from its atomics while it keeps working
+struct ConnectionDiagnostics {
+  uint64_t uniqueId;
+  std::string remoteAddress;
+  unsigned short remotePort;
+  std::size_t sendQueueFrames;
+  std::size_t sendQueueBytes;
+  /// \brief Tasks posted to connection executor (strand or shard loop) and not started yet
+  std::size_t executorBacklog;
+  /// \brief Steady clock milliseconds, 0 - never
+  int64_t lastReadMillis;
+  int64_t lastWriteMillis;
+  /// \brief Last keepalive ping round trip, microseconds. -1 - not measured yet
+  int64_t rttMicros;
+  std::size_t unansweredPings;
+  bool secure;
+  /// \brief Empty for plain connection
+  std::string tlsVersion;
+  std::string tlsCipher;
+  bool tlsResumed;
+  /// \brief Payload bytes of fragmented message being reassembled
+  std::size_t fragmentBufferBytes;
+  std::string subprotocol;
+  bool permessageDeflate;
+};
+
 class SocketServerBase : public BaseServer {
  public:
+    class Message;
+
     /// The buffer is not consumed during send operations.
     /// Do not alter while sending.
-    class SendStream : public std::ostream {
+    class SendStream : public std::ostream,
+                       private wss::hotpath::Tracked<wss::hotpath::AllocSite::SendStream, SendStream> {
         friend class SocketServerBase;
         friend class SocketServer;
         friend class SocketServerSecure;
@@ -69,6 +196,187 @@ class SocketServerBase : public BaseServer {
         }
     };
 
+    /// \brief Immutable pre-framed message: frame header + payload.
+    /// Encoded once, then can be queued by any number of connections without copying (fan-out).
+    /// Do not alter payload stream after frame was created.
+    class Frame {
+        friend class SocketServerBase;
+        friend class SocketServer;
+        friend class SocketServerSecure;
+
+     public:
+        /// \brief Payloads up to this size are copied into frame itself (see InlineFrame), without SendStream
+        static constexpr std::size_t INLINE_PAYLOAD_SIZE = 512;
+
+        /// fin_rsv_opcode: 129=one fragment, text, 130=one fragment, binary, 136=close connection.
+        /// See http://tools.ietf.org/html/rfc6455#section-5.2 for more information
+        Frame(std::shared_ptr<SendStream> messageStream, uint8_t fin_rsv_opcode = 129) noexcept
+            : Frame(fin_rsv_opcode, messageStream->size()) {
+            this->messageStream = std::move(messageStream);
+            payload = asio::buffer_cast<const uint8_t *>(this->messageStream->streambuf.data());
+        }
+
+        Frame(const Frame &) = delete;
+        Frame &operator=(const Frame &) = delete;
+
+        /// \brief Creates frame using thread local pool (no heap allocation for frame itself in steady state)
+        /// \param messageStream
+        /// \param fin_rsv_opcode
+        /// \return
+        static std::shared_ptr<const Frame> make(std::shared_ptr<SendStream> messageStream,
+                                                 uint8_t fin_rsv_opcode = 129) {
+            return std::allocate_shared<const Frame>(wss::utils::PoolAllocator<Frame>(),
+                                                     std::move(messageStream),
+                                                     fin_rsv_opcode);
+        }
+
+        /// \brief Creates shared frame from raw payload. Small payloads are stored inline,
+        /// so frame costs no heap allocations in steady state
+        /// \param data
+        /// \param length
+        /// \param fin_rsv_opcode
+        /// \return
+        static std::shared_ptr<const Frame> create(const char *data, std::size_t length, uint8_t fin_rsv_opcode = 129);
+
+        /// \brief Creates shared frame from string payload
+        /// \param payload
+        /// \param fin_rsv_opcode
+        /// \return
+        static std::shared_ptr<const Frame> create(const std::string &payload, uint8_t fin_rsv_opcode = 129) {
+            return create(payload.data(), payload.size(), fin_rsv_opcode);
+        }
+
+        /// \brief Whole frame size: header + payload
+        std::size_t size() const noexcept {
+            return headerLength + payloadLength;
+        }
+
+        /// \brief Payload size without header
+        std::size_t payloadSize() const noexcept {
+            return payloadLength;
+        }
+
+        /// \brief Payload bytes (unmasked), payloadSize() long
+        const uint8_t *payloadData() const noexcept {
+            return payload;
+        }
+
+        uint8_t getFinRsvOpcode() const noexcept {
+            return finRsvOpcode;
+        }
+
+     protected:
+        Frame(uint8_t fin_rsv_opcode, std::size_t length) noexcept
+            : finRsvOpcode(fin_rsv_opcode),
+              headerLength(0),
+              payloadLength(length) {
+            header[headerLength++] = fin_rsv_opcode;
+            // Unmasked (first length byte<128)
+            if (length >= 126) {
+                std::size_t numBytes;
+                if (length > 0xffff) {
+                    numBytes = 8;
+                    header[headerLength++] = 127;
+                } else {
+                    numBytes = 2;
+                    header[headerLength++] = 126;
+                }
+
+                for (std::size_t c = numBytes - 1; c != static_cast<std::size_t>(-1); c--)
+                    header[headerLength++] = static_cast<uint8_t>((length >> (8 * c)) % 256);
+            } else {
+                header[headerLength++] = static_cast<uint8_t>(length);
+            }
+        }
+
+        /// \brief Payload bytes: messageStream data or inline storage
+        const uint8_t *payload = nullptr;
+
+     private:
+        /// \brief nullptr for inline frames
+        std::shared_ptr<SendStream> messageStream;
+        uint8_t finRsvOpcode;
+        /// \brief max header size for unmasked frame: 1 + 1 + 8
+        uint8_t header[10];
+        uint8_t headerLength;
+        std::size_t payloadLength;
+
+        asio::const_buffer headerBuffer() const noexcept {
+            return asio::const_buffer(header, headerLength);
+        }
+
+        asio::const_buffer payloadBuffer() const noexcept {
+            return asio::const_buffer(payload, payloadLength);
+        }
+    };
+
+    /// \brief Frame with small payload copied into it. Allocated from slab pool, as Frame
+    class InlineFrame : public Frame {
+     public:
+        InlineFrame(const char *data, std::size_t length, uint8_t fin_rsv_opcode) noexcept
+            : Frame(fin_rsv_opcode, length) {
+            if (length > 0) {
+                std::memcpy(storage, data, length);
+            }
+            payload = storage;
+        }
+
+     private:
+        uint8_t storage[INLINE_PAYLOAD_SIZE];
+    };
+
+    /// \brief Event loop owned by single worker thread (see Config::ioServicePerThread).
+    /// Connections are pinned to shard they were accepted on,
+    /// other threads pass work to them through lock-free mailbox, drained by one io_service handler.
+    class Shard {
+     public:
+        Shard(std::size_t index, std::shared_ptr<asio::io_service> service) :
+            index(index),
+            service(std::move(service)) { }
+
+        /// \brief Worker thread number
+        const std::size_t index;
+        std::shared_ptr<asio::io_service> service;
+
+        /// \brief Queue task from any thread. Tasks from one thread are executed in the order they were posted.
+        /// \param task
+        void post(std::function<void()> &&task) {
+            mailbox.enqueue(std::move(task));
+            if (!drainScheduled.exchange(true)) {
+                service->post([this] { drain(); });
+            }
+        }
+
+     private:
+        /// \brief Max tasks executed by single drain, to not starve socket handlers
+        static const std::size_t DRAIN_BATCH = 256;
+
+        moodycamel::ConcurrentQueue<std::function<void()>> mailbox;
+        std::atomic<bool> drainScheduled{false};
+
+        void drain() {
+            // reset before dequeue, so producer that enqueued after this point will schedule new drain
+            drainScheduled = false;
+
+            std::function<void()> tasks[DRAIN_BATCH];
+            const std::size_t count = mailbox.try_dequeue_bulk(tasks, DRAIN_BATCH);
+            for (std::size_t i = 0; i < count; i++) {
+                tasks[i]();
+            }
+
+            if (count == DRAIN_BATCH && !drainScheduled.exchange(true)) {
+                service->post([this] { drain(); });
+            }
+        }
+    };
+
+    /// \brief Parsed header of incoming frame, kept until its mask and payload are read
+    struct FrameHeader {
+      bool parsed = false;
+      unsigned char fin_rsv_opcode = 0;
+      std::size_t length = 0;
+    };
+
     class Connection : public std::enable_shared_from_this<Connection> {
         friend class SocketServerBase;
         friend class SocketServer;
@@ -79,12 +387,34 @@ class SocketServerBase : public BaseServer {
             : socket(std::move(socket)),
               closed(false),
               id(0),
+              uniqueId(nextUniqueId()),
               timeoutIdle(0),
-              strand(this->socket->get_io_service()) { }
+              strand(this->socket->get_io_service()) {
+            hotSlot.publish(uniqueId);
+        }
 
-        std::string method, path, queryString, httpVersion;
-        wss::utils::CaseInsensitiveMultimap header;
-        regexns::smatch pathMatch;
+        ~Connection() {
+            // drain was not run: io service is stopped
+            PendingSend *pending = pendingSends.exchange(nullptr, std::memory_order_acquire);
+            while (pending != nullptr) {
+                PendingSend *next = pending->next;
+                delete pending;
+                pending = next;
+            }
+            releaseReadBuffer();
+            setFragmentBufferBytes(0);
+            wss::metrics::release(wss::metrics::Memory::SendQueues, queuedBytes());
+        }
+
+        /// \brief Upgrade request fields, needed only while handshaking
+        struct Handshake {
+          std::string method, path, queryString, httpVersion;
+          wss::utils::CaseInsensitiveMultimap header;
+          /// \brief Set only for endpoints with real regex, literal endpoints are matched without regex engine
+          regexns::smatch pathMatch;
+        };
+        /// \brief Upgrade request. Released right after Endpoint::onOpen returns: handler must copy what it needs
+        std::unique_ptr<Handshake> handshake{new Handshake()};
         asio::ip::tcp::endpoint remoteEndpoint;
 
         std::string remoteEndpointAddress() const noexcept {
@@ -100,47 +430,91 @@ class SocketServerBase : public BaseServer {
             return remoteEndpoint.port();
         }
 
+        /// \brief Set owner (user) id
+        /// \param _id
         void setId(unsigned long _id) {
             id = _id;
-
-            using toolboxpp::strings::substringReplaceAll;
-            std::stringstream ss;
-            ss << substringReplaceAll(".", "", remoteEndpointAddress()) << remoteEndpointPort();
-            uniqueId = std::stoul(ss.str());
+            hotSlot.userId().store(_id, std::memory_order_relaxed);
         }
 
         unsigned long getId() const {
             return id;
         }
 
-        unsigned long getUniqueId() const {
+        /// \brief Connection id, unique for process lifetime. Assigned on accept, never 0
+        /// \return
+        uint64_t getUniqueId() const noexcept {
             return uniqueId;
         }
 
+        /// \brief Negotiated Sec-WebSocket-Protocol
+        /// \return empty string if client didn't offer any of endpoint subprotocols
+        const std::string &getSubprotocol() const noexcept {
+            return subprotocol;
+        }
+
+        /// \brief Index of negotiated subprotocol in Endpoint::subprotocols
+        /// \return npos if none
+        std::size_t getSubprotocolIndex() const noexcept {
+            return subprotocolIndex;
+        }
+
+        /// \brief Incoming messages per second limit, configured by Config::inboundMessagesRate
+        wss::utils::TokenBucket &getInboundMessagesBucket() noexcept {
+            return inboundMessages;
+        }
+
+        /// \brief Incoming bytes per second limit, configured by Config::inboundBytesRate
+        wss::utils::TokenBucket &getInboundBytesBucket() noexcept {
+            return inboundBytes;
+        }
+
      private:
         class SendData {
          public:
-            SendData(std::shared_ptr<SendStream> headerStream,
-                     std::shared_ptr<SendStream> messageStream,
-                     wss::server::websocket::SendCallback callback) noexcept
-                : headerStream(std::move(headerStream)),
-                  messageStream(std::move(messageStream)),
-                  callback(std::move(callback)) { }
-
-            std::shared_ptr<SendStream> headerStream;
-            std::shared_ptr<SendStream> messageStream;
+            SendData() noexcept = default;
+            SendData(std::shared_ptr<const Frame> frame,
+                     wss::server::websocket::SendCallback callback,
+                     std::chrono::steady_clock::time_point receivedAt,
+                     std::chrono::steady_clock::time_point queuedAt,
+                     const CoalesceKey &coalesceKey = CoalesceKey()) noexcept
+                : frame(std::move(frame)),
+                  callback(std::move(callback)),
+                  receivedAt(receivedAt),
+                  queuedAt(queuedAt),
+                  coalesceKey(coalesceKey) { }
+
+            std::shared_ptr<const Frame> frame;
             wss::server::websocket::SendCallback callback;
+            /// \brief Ingress time of message, which is sent by this frame. Epoch - unknown
+            std::chrono::steady_clock::time_point receivedAt;
+            std::chrono::steady_clock::time_point queuedAt;
+            CoalesceKey coalesceKey;
+        };
+
+        /// \brief Frame passed to send() from any thread, waiting for executor
+        struct PendingSend {
+          PendingSend *next;
+          std::shared_ptr<const Frame> frame;
+          wss::server::websocket::SendCallback callback;
+          SendPriority priority;
+          std::chrono::steady_clock::time_point receivedAt;
+          CoalesceKey coalesceKey;
         };
 
+     public:
+        /// \brief Public for std::allocate_shared only: connections are created by server accept
         Connection(std::shared_ptr<ScopeRunner> handler_runner,
                    long timeout_idle,
                    wss::io_context_service &ioContext) noexcept
             : handlerRunner(std::move(handler_runner)),
               socket(std::make_unique<SocketLayerWrapper>(ioContext)),
                      closed(false),
-                     uniqueId(0),
+                     uniqueId(nextUniqueId()),
                      timeoutIdle(timeout_idle),
-                     strand(socket->get_io_service()) { }
+                     strand(socket->get_io_service()) {
+            hotSlot.publish(uniqueId);
+        }
 
         Connection(std::shared_ptr<ScopeRunner> handler_runner,
                    long timeout_idle,
@@ -149,77 +523,250 @@ class SocketServerBase : public BaseServer {
             handlerRunner(std::move(handler_runner)),
             socket(std::make_unique<SocketLayerWrapper>(ioContext, sslContext)),
             closed(false),
-            uniqueId(0),
+            uniqueId(nextUniqueId()),
             timeoutIdle(timeout_idle),
-            strand(socket->get_io_service()) { }
+            strand(socket->get_io_service()) {
+            hotSlot.publish(uniqueId);
+        }
+
+     private:
+        /// \brief Each thread takes ids by blocks from global counter, so ids are unique without contention
+        /// \return
+        static uint64_t nextUniqueId() noexcept {
+            static constexpr uint64_t ID_BLOCK = 1024;
+            static std::atomic<uint64_t> nextBlock{0};
+            thread_local uint64_t next = 0;
+            thread_local uint64_t blockEnd = 0;
+            if (next == blockEnd) {
+                next = nextBlock.fetch_add(ID_BLOCK, std::memory_order_relaxed) + 1;
+                blockEnd = next + ID_BLOCK;
+            }
+            return next++;
+        }
 
         std::shared_ptr<ScopeRunner> handlerRunner;
 
         /// \brief Socket must be unique_ptr since asio::ssl::stream<asio::ip::tcp::socket> is not movable
         std::unique_ptr<SocketLayerWrapper> socket;
-        std::mutex socketCloseMutex;
-        std::mutex readIdMutex;
-        std::list<SendData> sendQueue;
-        asio::streambuf readBuffer;
+        /// \brief Guards socket shutdown and request timer
+        std::mutex stateMutex;
+        /// \brief Rings of send descriptors by SendPriority, slots are reused. Strand only
+        std::array<wss::utils::RingQueue<SendData>, SEND_PRIORITIES> sendLanes;
+        /// \brief Frames taken from lanes, that are being written now. Strand only
+        std::vector<SendData> inFlight;
+        /// \brief TLS only: in-flight frames copied into one buffer. Strand only
+        std::vector<char> tlsWriteBuffer;
+        /// \brief Plain tcp only: writes of at least this size are sent with MSG_ZEROCOPY, 0 - disabled
+        std::size_t zeroCopyMinBytes = 0;
+        /// \brief Completion id of next zero-copy send. Strand only
+        uint32_t zeroCopyNext = 0;
+        /// \brief Frames of zero-copy writes, kept until kernel completes last send of write: id, frames. Strand only
+        std::deque<std::pair<uint32_t, std::vector<std::shared_ptr<const Frame>>>> zeroCopyHeld;
+        /// \brief Weighted round-robin: Normal and Bulk lanes frames written in turn, High lane is always first
+        std::array<std::size_t, SEND_PRIORITIES> laneWeights{{1, 4, 1}};
+        /// \brief Frames left in current round of weighted round-robin. Strand only
+        std::array<std::size_t, SEND_PRIORITIES> laneCredits{{0, 0, 0}};
+        /// \brief Frame headers and payloads are read here. Replaced by small one after frame larger than
+        /// Config::readBufferRetainBytes, as streambuf never gives grown memory back. Read chain only
+        std::unique_ptr<asio::streambuf> readBuffer{new asio::streambuf()};
         std::atomic<bool> closed;
 
+        /// \brief Cells of hot fields (owner id, activity, keepalive and queue state) in process ConnectionTable,
+        /// accessed by methods below. Released after destructor body
+        ConnectionTable::Slot hotSlot;
         uint64_t id;
         uint64_t uniqueId;
         long timeoutIdle;
+        /// \brief Max frames written by single write operation
+        std::size_t coalesceFrames = 1;
+        /// \brief Max bytes written by single write operation, 0 - unlimited
+        std::size_t coalesceBytes = 0;
+        /// \brief Send queue high-water mark in frames, 0 - unlimited
+        std::size_t highWaterFrames = 0;
+        /// \brief Send queue high-water mark in bytes, 0 - unlimited
+        std::size_t highWaterBytes = 0;
+        SlowConsumerPolicy slowConsumerPolicy = SlowConsumerPolicy::Reject;
+        std::shared_ptr<SendQueueMetrics> queueMetrics;
+        std::atomic<std::size_t> &queuedFrames() const noexcept {
+            return hotSlot.queuedFrames();
+        }
+        std::atomic<std::size_t> &queuedBytes() const noexcept {
+            return hotSlot.queuedBytes();
+        }
+        /// \brief Whether write operation is running. Strand only
+        bool sendInProgress = false;
+        /// \brief Lock-free stack of frames from send(), newest first. Sender that finds it empty posts
+        /// drainPending(), others only push: burst of sends to connection costs one executor dispatch
+        std::atomic<PendingSend *> pendingSends{nullptr};
+        /// \brief Negotiated permessage-deflate contexts, nullptr if extension is not used
+        std::unique_ptr<PerMessageDeflate> permessageDeflate;
+        /// \brief Negotiated Sec-WebSocket-Protocol, empty if client didn't offer any of endpoint subprotocols
+        std::string subprotocol;
+        /// \brief Index of negotiated subprotocol in Endpoint::subprotocols, npos if none
+        std::size_t subprotocolIndex = std::string::npos;
+        wss::utils::TokenBucket inboundMessages;
+        wss::utils::TokenBucket inboundBytes;
+        /// \brief Slot of source address in ConnectionAdmission, released with connection
+        ConnectionAdmission::Ticket admissionTicket;
+        /// \brief Config::handshakeDeadlineMillis from accept: request timeouts don't expire later. Epoch - none
+        std::chrono::steady_clock::time_point handshakeDeadline;
+        /// \brief Whether currently reading fragmented message is compressed. Read chain only
+        bool inflatingMessage = false;
+        /// \brief Frames of currently reading fragmented message, including current frame. Read chain only
+        uint32_t fragmentCount = 0;
+        /// \brief Payload bytes of currently reading fragmented message, without current frame. Read chain only
+        std::size_t fragmentedSize = 0;
+        /// \brief Fragmented message being reassembled, fragments are unmasked right into its buffer. Read chain only
+        std::shared_ptr<Message> fragmentedMessage;
+        /// \brief Header of frame, which payload is not read completely yet. Read chain only
+        FrameHeader frameHeader;
         std::unique_ptr<asio::steady_timer> timer;
-        std::mutex timerMutex;
         asio::io_service::strand strand;
+        /// \brief Owner event loop, nullptr if server does not use shards
+        Shard *shard = nullptr;
+        /// \brief Last incoming frame time: steady clock milliseconds
+        std::atomic<int64_t> &lastActivity() const noexcept {
+            return hotSlot.lastActivity();
+        }
+        /// \brief Last outgoing data frame time: steady clock milliseconds
+        std::atomic<int64_t> &lastSend() const noexcept {
+            return hotSlot.lastSend();
+        }
+        /// \brief Pings sent after last incoming frame
+        std::atomic<std::size_t> &unansweredPings() const noexcept {
+            return hotSlot.unansweredPings();
+        }
+        /// \brief Last keepalive ping time: steady clock microseconds, 0 - no ping waits for pong
+        std::atomic<int64_t> pingSentAt{0};
+        /// \brief Last ping-pong round trip in microseconds, -1 - not measured
+        std::atomic<int64_t> rttMicros{-1};
+        /// \brief send() and post() tasks waiting in executor
+        std::atomic<std::size_t> executorBacklog{0};
+        /// \brief Mirror of fragmented message size for diagnostics, written by read chain
+        std::atomic<std::size_t> fragmentBufferBytes{0};
+        /// \brief Accounted read buffer bytes: largest size of current buffer. Read chain only
+        std::size_t readBufferBytes = 0;
+        /// \brief Negotiated TLS version and cipher (static OpenSSL strings), nullptr for plain connection.
+        /// Written once after TLS handshake, before connection is opened
+        const char *tlsVersion = nullptr;
+        const char *tlsCipher = nullptr;
+        bool tlsResumed = false;
+
+        static int64_t nowMillis() noexcept {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        static int64_t nowMicros() noexcept {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        /// \brief Sets fragmented message size and accounts its difference
+        /// \param bytes
+        void setFragmentBufferBytes(std::size_t bytes) noexcept {
+            const std::size_t previous = fragmentBufferBytes.exchange(bytes, std::memory_order_relaxed);
+            if (bytes > previous) {
+                wss::metrics::acquire(wss::metrics::Memory::FragmentBuffers, bytes - previous);
+            } else if (previous > bytes) {
+                wss::metrics::release(wss::metrics::Memory::FragmentBuffers, previous - bytes);
+            }
+        }
+
+        /// \brief Accounts read buffer growth: buffer keeps memory of the largest frame it has held
+        /// \param used bytes held by buffer for current frame
+        void accountReadBuffer(std::size_t used) noexcept {
+            if (used > readBufferBytes) {
+                wss::metrics::acquire(wss::metrics::Memory::ReadBuffers, used - readBufferBytes);
+                readBufferBytes = used;
+            }
+        }
+
+        void releaseReadBuffer() noexcept {
+            wss::metrics::release(wss::metrics::Memory::ReadBuffers, readBufferBytes);
+            readBufferBytes = 0;
+        }
+
+        /// \brief Measures round trip of keepalive ping, if pong is its answer
+        void pongReceived() noexcept {
+            const int64_t sentAt = pingSentAt.exchange(0);
+            if (sentAt != 0) {
+                rttMicros = nowMicros() - sentAt;
+            }
+        }
+
+        static std::chrono::steady_clock::time_point toTimePoint(int64_t millis) noexcept {
+            return std::chrono::steady_clock::time_point(std::chrono::milliseconds(millis));
+        }
+
+        void touch() noexcept {
+            lastActivity() = nowMillis();
+            unansweredPings() = 0;
+        }
+
+        std::chrono::steady_clock::time_point getLastActivity() const noexcept {
+            return toTimePoint(lastActivity().load());
+        }
+
+        /// \brief Last incoming or outgoing data frame time, idle timeout counts from it
+        std::chrono::steady_clock::time_point getLastIo() const noexcept {
+            return toTimePoint(std::max(lastActivity().load(), lastSend().load()));
+        }
 
         void close() noexcept {
             ErrorCode ec;
             /// The following operations seems to be needed to run sequentially
-            std::unique_lock<std::mutex> lock(socketCloseMutex);
+            std::unique_lock<std::mutex> lock(stateMutex);
             socket->lowest_layer().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
             socket->lowest_layer().close(ec);
         }
 
-        void timeoutSet(long seconds = -1L) noexcept {
-            bool useTimeoutIdle = false;
-            if (seconds == -1L) {
-                useTimeoutIdle = true;
-                seconds = timeoutIdle;
-            }
+        /// \brief Arms request (handshake) timeout: connection is closed if timeoutCancel() is not called in time.
+        /// Timeout doesn't expire later than handshake deadline, if it's set.
+        /// Idle timeout is handled by server timeout wheel, not by this timer.
+        /// \param seconds 0 - no timeout (except handshake deadline)
+        void timeoutSet(long seconds) noexcept {
+            std::unique_lock<std::mutex> lock(stateMutex);
 
-            std::unique_lock<std::mutex> lock(timerMutex);
-
-            if (seconds == 0) {
+            const bool hasDeadline = handshakeDeadline != std::chrono::steady_clock::time_point();
+            if (seconds == 0 && !hasDeadline) {
                 timer = nullptr;
                 return;
             }
 
+            auto expiry = seconds == 0
+                          ? handshakeDeadline
+                          : std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+            if (hasDeadline && handshakeDeadline < expiry) {
+                expiry = handshakeDeadline;
+            }
             timer = std::unique_ptr<asio::steady_timer>(new asio::steady_timer(socket->get_io_service()));
-            timer->expires_from_now(std::chrono::seconds(seconds));
+            timer->expires_at(expiry);
             std::weak_ptr<Connection> connectionWeak
                 (this->shared_from_this()); // To avoid keeping Connection instance alive longer than needed
-            timer->async_wait([connectionWeak, useTimeoutIdle](const ErrorCode &ec) {
+            timer->async_wait([connectionWeak](const ErrorCode &ec) {
               if (!ec) {
                   if (auto connection = connectionWeak.lock()) {
-                      if (useTimeoutIdle) {
-                          connection->sendClose(1000, "idle timeout"); // 1000=normal closure
-                      } else {
-                          connection->close();
-                      }
+                      connection->close();
                   }
               }
             });
         }
 
         void timeoutCancel() noexcept {
-            std::unique_lock<std::mutex> lock(timerMutex);
+            std::unique_lock<std::mutex> lock(stateMutex);
             if (timer) {
                 ErrorCode ec;
                 timer->cancel(ec);
             }
         }
 
-        bool handshakeGenerate(const std::shared_ptr<asio::streambuf> &writeBuffer) {
+        bool handshakeGenerate(const std::shared_ptr<asio::streambuf> &writeBuffer,
+                               const PerMessageDeflate::Options &deflateOptions,
+                               const std::vector<std::string> &subprotocols) {
             std::ostream handshake(writeBuffer.get());
 
+            const auto &header = this->handshake->header;
             auto headerIterator = header.find("Sec-WebSocket-Key");
             if (headerIterator == header.end())
                 return false;
@@ -231,52 +778,487 @@ class SocketServerBase : public BaseServer {
             handshake << "Upgrade: websocket\r\n";
             handshake << "Connection: Upgrade\r\n";
             handshake << "Sec-WebSocket-Accept: " << Crypto::Base64::encode(sha1) << "\r\n";
+
+            subprotocolIndex = negotiateSubprotocol(subprotocols);
+            if (subprotocolIndex != std::string::npos) {
+                subprotocol = subprotocols[subprotocolIndex];
+                handshake << "Sec-WebSocket-Protocol: " << subprotocol << "\r\n";
+            }
+
+            if (deflateOptions.enabled) {
+                // client may send extensions in multiple headers
+                std::string offers;
+                auto range = header.equal_range("Sec-WebSocket-Extensions");
+                for (auto it = range.first; it != range.second; ++it) {
+                    if (!offers.empty()) offers += ", ";
+                    offers += it->second;
+                }
+
+                PerMessageDeflate::Params params;
+                std::string extensionResponse;
+                if (!offers.empty() && PerMessageDeflate::negotiate(offers, deflateOptions, params, extensionResponse)) {
+                    try {
+                        permessageDeflate = std::make_unique<PerMessageDeflate>(params, deflateOptions);
+                        handshake << "Sec-WebSocket-Extensions: " << extensionResponse << "\r\n";
+                    } catch (const std::runtime_error &) {
+                        permessageDeflate = nullptr;
+                    }
+                }
+            }
+
             handshake << "\r\n";
 
             return true;
         }
 
-        void sendFromQueue() {
-            const std::shared_ptr<Connection> self = this->shared_from_this();
+        /// \brief Selects first of client offered subprotocols (in client preference order), that endpoint supports
+        /// \param subprotocols endpoint subprotocols
+        /// \return index in subprotocols, npos if nothing matches
+        std::size_t negotiateSubprotocol(const std::vector<std::string> &subprotocols) const {
+            if (subprotocols.empty()) {
+                return std::string::npos;
+            }
 
-            strand.post([self]() {
+            // client may send offers in multiple headers, each is comma separated list of tokens
+            auto range = handshake->header.equal_range("Sec-WebSocket-Protocol");
+            for (auto it = range.first; it != range.second; ++it) {
+                const std::string &offers = it->second;
+                std::size_t start = 0;
+                while (start < offers.size()) {
+                    std::size_t end = offers.find(',', start);
+                    if (end == std::string::npos) {
+                        end = offers.size();
+                    }
+                    const std::size_t tokenStart = offers.find_first_not_of(" \t", start);
+                    if (tokenStart < end) {
+                        const std::size_t tokenEnd = offers.find_last_not_of(" \t", end - 1) + 1;
+                        for (std::size_t i = 0; i < subprotocols.size(); i++) {
+                            if (subprotocols[i].size() == tokenEnd - tokenStart
+                                && offers.compare(tokenStart, tokenEnd - tokenStart, subprotocols[i]) == 0) {
+                                return i;
+                            }
+                        }
+                    }
+                    start = end + 1;
+                }
+            }
 
-              std::vector<asio::const_buffer> bufs(2);
-              const SendData data = ((SendData) *self->sendQueue.begin());
-              // headers
-              bufs.push_back(data.headerStream->streambuf.data());
-              // body
-              bufs.push_back(data.messageStream->streambuf.data());
+            return std::string::npos;
+        }
 
-              self->socket->async_write(bufs, self->strand.wrap([self](const ErrorCode &ec, std::size_t ts) {
-                std::unique_ptr<ScopeRunner::SharedLock> lock = self->handlerRunner->continueLock();
-                if (!lock) {
-                    return;
+        bool isOverHighWater(std::size_t frameSize) const noexcept {
+            return (highWaterFrames > 0 && queuedFrames() + 1 > highWaterFrames)
+                || (highWaterBytes > 0 && queuedBytes() + frameSize > highWaterBytes);
+        }
+
+        void queueAccountAdd(const SendData &data) noexcept {
+            const std::size_t sz = data.frame->size();
+            queuedFrames()++;
+            queuedBytes() += sz;
+            wss::metrics::acquire(wss::metrics::Memory::SendQueues, sz);
+            if (queueMetrics) {
+                queueMetrics->frames++;
+                queueMetrics->bytes += sz;
+            }
+        }
+
+        void queueAccountRemove(const SendData &data) noexcept {
+            const std::size_t sz = data.frame->size();
+            queuedFrames()--;
+            queuedBytes() -= sz;
+            wss::metrics::release(wss::metrics::Memory::SendQueues, sz);
+            if (queueMetrics) {
+                queueMetrics->frames--;
+                queueMetrics->bytes -= sz;
+            }
+        }
+
+        void queueClear() noexcept {
+            wss::metrics::release(wss::metrics::Memory::SendQueues, queuedBytes());
+            if (queueMetrics) {
+                queueMetrics->frames -= queuedFrames();
+                queueMetrics->bytes -= queuedBytes();
+            }
+            queuedFrames() = 0;
+            queuedBytes() = 0;
+            for (auto &lane: sendLanes) {
+                lane.clear();
+            }
+            inFlight.clear();
+            sendInProgress = false;
+        }
+
+        bool lanesEmpty() const noexcept {
+            for (const auto &lane: sendLanes) {
+                if (!lane.empty()) {
+                    return false;
                 }
+            }
+            return true;
+        }
 
-                const SendData sendDataQueued = ((SendData) *self->sendQueue.begin());
-                // if error occured, cleanup queue
-                if (ec) {
-                    if (sendDataQueued.callback) {
-                        sendDataQueued.callback(ec, ts);
+        /// \brief Next lane to take frame from: High lane while it's not empty,
+        /// then other lanes by credits, which are refilled from laneWeights when round is over.
+        /// \return SEND_PRIORITIES if all lanes are empty
+        std::size_t nextLane() noexcept {
+            if (!sendLanes[0].empty()) {
+                return 0;
+            }
+            for (int round = 0; round < 2; round++) {
+                for (std::size_t i = 1; i < SEND_PRIORITIES; i++) {
+                    if (!sendLanes[i].empty() && laneCredits[i] > 0) {
+                        laneCredits[i]--;
+                        return i;
                     }
+                }
+                for (std::size_t i = 1; i < SEND_PRIORITIES; i++) {
+                    laneCredits[i] = std::max<std::size_t>(1, laneWeights[i]);
+                }
+            }
+            return SEND_PRIORITIES;
+        }
 
-                    self->sendQueue.clear();
+        /// \brief Compresses unfragmented data frame if permessage-deflate negotiated and payload is big enough.
+        /// Must be called inside strand, for frames in order they are written: with context takeover client
+        /// inflates every compressed frame by history of previous ones, so dropped or reordered frame breaks it
+        std::shared_ptr<const Frame> deflateFrame(std::shared_ptr<const Frame> frame) {
+            const uint8_t fin_rsv_opcode = frame->getFinRsvOpcode();
+            const uint8_t opcode = fin_rsv_opcode & 0x0fu;
+            if (!permessageDeflate
+                || (fin_rsv_opcode & 0xf0u) != 0x80u // only finished frames with clear rsv bits
+                || (opcode != 1 && opcode != 2)
+                || frame->payloadSize() < permessageDeflate->getMinSize()) {
+                return frame;
+            }
 
-                    return;
+            std::string compressed;
+            if (!permessageDeflate->compress(frame->payload, frame->payloadSize(), compressed)) {
+                return frame;
+            }
+
+            // RSV1 = compressed message
+            return Frame::create(compressed, static_cast<uint8_t>(fin_rsv_opcode | 0x40u));
+        }
+
+        /// \brief Replaces not written frame of the same key in lane of new frame, in place.
+        /// Callback of replaced frame receives frameDroppedError(). Must be called inside strand
+        /// \return false if lane has no such frame
+        bool coalesce(std::shared_ptr<const Frame> &frame,
+                      const SendCallback &callback,
+                      SendPriority priority,
+                      std::chrono::steady_clock::time_point receivedAt,
+                      const CoalesceKey &key) {
+            // queued frames are compressed only when written, so new frame takes slot of older one
+            // without changing order of compressed frames
+            auto &queue = sendLanes[static_cast<std::size_t>(priority)];
+            for (std::size_t i = 0; i < queue.size(); i++) {
+                SendData &queued = queue.at(i);
+                if (!(queued.coalesceKey == key)) {
+                    continue;
                 }
+                const SendData superseded = std::move(queued);
+                queueAccountRemove(superseded);
+                queued = SendData(std::move(frame), callback, receivedAt, superseded.queuedAt, key);
+                queueAccountAdd(queued);
+                if (queueMetrics) queueMetrics->coalesced++;
+                if (superseded.callback) {
+                    superseded.callback(frameDroppedError(), 0);
+                }
+                return true;
+            }
+            return false;
+        }
 
-                if (sendDataQueued.callback) {
-                    sendDataQueued.callback(ec, ts);
+        /// \brief Must be called inside strand
+        void enqueue(std::shared_ptr<const Frame> frame,
+                     const SendCallback &callback,
+                     SendPriority priority,
+                     std::chrono::steady_clock::time_point receivedAt,
+                     const CoalesceKey &coalesceKey) {
+            // control frames (close, ping, pong) are never limited
+            const bool isControl = (frame->getFinRsvOpcode() & 0x08) != 0;
+            if (isControl) {
+                priority = SendPriority::High;
+            }
+            // replacing frame doesn't grow queue, so it is not limited by high-water mark
+            if (!isControl && coalesceKey && coalesce(frame, callback, priority, receivedAt, coalesceKey)) {
+                return;
+            }
+            if (!isControl && isOverHighWater(frame->size())) {
+                switch (slowConsumerPolicy) {
+                    case SlowConsumerPolicy::DropOldest: {
+                        // frames which are being written are already out of lanes, lowest priority are dropped first.
+                        // Queued frames are not compressed yet, so dropping doesn't break client inflate context
+                        for (std::size_t lane = SEND_PRIORITIES; lane-- > 0 && isOverHighWater(frame->size());) {
+                            auto &queue = sendLanes[lane];
+                            std::size_t i = 0;
+                            while (i < queue.size() && isOverHighWater(frame->size())) {
+                                if ((queue.at(i).frame->getFinRsvOpcode() & 0x08) != 0) {
+                                    i++;
+                                    continue;
+                                }
+                                const SendData dropped = std::move(queue.at(i));
+                                queue.erase(i);
+                                queueAccountRemove(dropped);
+                                if (queueMetrics) queueMetrics->dropped++;
+                                if (dropped.callback) {
+                                    dropped.callback(frameDroppedError(), 0);
+                                }
+                            }
+                        }
+                    }
+                        break;
+
+                    case SlowConsumerPolicy::DropNewest:
+                        if (queueMetrics) queueMetrics->dropped++;
+                        if (callback) {
+                            callback(frameDroppedError(), 0);
+                        }
+                        return;
+
+                    case SlowConsumerPolicy::Reject:
+                        if (queueMetrics) queueMetrics->dropped++;
+                        if (callback) {
+                            callback(make_error_code::make_error_code(errc::no_buffer_space), 0);
+                        }
+                        return;
+
+                    case SlowConsumerPolicy::Close:
+                        if (queueMetrics && !closed) queueMetrics->slowConsumerCloses++;
+                        if (callback) {
+                            callback(make_error_code::make_error_code(errc::no_buffer_space), 0);
+                        }
+                        sendClose(1013, "try again later"); // 1013=try again later
+                        return;
                 }
+            }
 
-                self->sendQueue.erase(self->sendQueue.begin());
-                if (self->sendQueue.size() > 0) {
-                    self->sendFromQueue();
+            auto &lane = sendLanes[static_cast<std::size_t>(priority)];
+            lane.emplace_back(std::move(frame), callback, receivedAt, std::chrono::steady_clock::now(), coalesceKey);
+            queueAccountAdd(lane.back());
+        }
+
+        /// \brief Moves frames of send() to lanes in send order and starts write, if it's not running.
+        /// Must be called inside strand
+        void drainPending() {
+            PendingSend *pending = pendingSends.exchange(nullptr, std::memory_order_acquire);
+            // stack is newest first
+            PendingSend *ordered = nullptr;
+            std::size_t count = 0;
+            while (pending != nullptr) {
+                PendingSend *next = pending->next;
+                pending->next = ordered;
+                ordered = pending;
+                pending = next;
+                count++;
+            }
+            executorBacklog -= count;
+            while (ordered != nullptr) {
+                std::unique_ptr<PendingSend> item(ordered);
+                ordered = item->next;
+                enqueue(std::move(item->frame), item->callback, item->priority, item->receivedAt, item->coalesceKey);
+            }
+            if (!sendInProgress && !lanesEmpty()) {
+                sendInProgress = true;
+                writeQueued();
+            }
+        }
+
+        /// \brief Writes queued frames, lanes must not be empty. Must be called inside strand:
+        /// enqueue and write completion are there already, so write starts without another dispatch
+        void writeQueued() {
+            // gathering queued frames by lanes priority into one scatter-gather write, at least one frame will be taken
+            std::vector<asio::const_buffer> bufs;
+            std::size_t numBytes = 0;
+            const std::size_t maxFrames = std::max<std::size_t>(1, coalesceFrames);
+            inFlight.clear();
+            while (inFlight.size() < maxFrames) {
+                const std::size_t lane = nextLane();
+                if (lane == SEND_PRIORITIES) {
+                    break;
+                }
+                auto &queue = sendLanes[lane];
+                const std::size_t frameSize = queue.front().frame->size();
+                if (!inFlight.empty() && coalesceBytes > 0 && numBytes + frameSize > coalesceBytes) {
+                    // frame stays first in its lane
+                    laneCredits[lane]++;
+                    break;
+                }
+                inFlight.push_back(std::move(queue.front()));
+                queue.pop_front();
+                if (permessageDeflate) {
+                    // queued frames are plain, lanes may drop or reorder them
+                    SendData &data = inFlight.back();
+                    std::shared_ptr<const Frame> compressed = deflateFrame(data.frame);
+                    if (compressed != data.frame) {
+                        queueAccountRemove(data);
+                        data.frame = std::move(compressed);
+                        queueAccountAdd(data);
+                    }
                 }
-              }));
+                numBytes += inFlight.back().frame->size();
+            }
+            const std::size_t numFrames = inFlight.size();
+            const auto writeStart = std::chrono::steady_clock::now();
+            bufs.reserve(numFrames * 2);
+            for (const auto &data: inFlight) {
+                wss::metrics::observe(wss::metrics::Histogram::MessageQueueWait, writeStart - data.queuedAt);
+                // headers
+                bufs.push_back(data.frame->headerBuffer());
+                // body
+                bufs.push_back(data.frame->payloadBuffer());
+            }
+            const std::size_t writeBytes = asio::buffer_size(bufs);
+            // frames are shared by many connections and immutable, so kernel can send their pages directly
+            const bool zeroCopy = zeroCopyMinBytes > 0 && writeBytes >= zeroCopyMinBytes
+                && reapZeroCopy() < ZEROCOPY_MAX_HELD;
+            if (socket->isSecure() && bufs.size() > 1 && writeBytes <= TLS_LINEARIZE_MAX_BYTES) {
+                // ssl stream encrypts one contiguous buffer per SSL_write (at most 8 KiB of gathered ones):
+                // single buffer is split to full 16 KiB records, so batch of small frames costs fewer records
+                // and socket writes. Larger batches are mostly big bodies, written without copy
+                tlsWriteBuffer.resize(writeBytes);
+                asio::buffer_copy(asio::buffer(tlsWriteBuffer), bufs);
+                bufs.assign(1, asio::buffer(tlsWriteBuffer));
+            }
 
+            const std::shared_ptr<Connection> self = this->shared_from_this();
+            auto completion = strand.wrap([self, numFrames, writeStart, zeroCopy](const ErrorCode &ec, std::size_t ts) {
+              ScopeRunner::SharedLock lock = self->handlerRunner->continueLock();
+              if (!lock) {
+                  return;
+              }
+              if (zeroCopy) {
+                  // kernel may still read pages of sent frames
+                  std::vector<std::shared_ptr<const Frame>> frames;
+                  frames.reserve(self->inFlight.size());
+                  for (const auto &data: self->inFlight) {
+                      frames.push_back(data.frame);
+                  }
+                  self->zeroCopyHeld.emplace_back(self->zeroCopyNext - 1, std::move(frames));
+              }
+
+              // if error occured, cleanup queue
+              if (ec) {
+                  const std::vector<SendData> written = std::move(self->inFlight);
+                  self->queueClear();
+                  for (const auto &data: written) {
+                      if (data.callback) {
+                          data.callback(ec, ts);
+                      }
+                  }
+
+                  return;
+              }
+
+              const auto writeEnd = std::chrono::steady_clock::now();
+              wss::metrics::observe(wss::metrics::Histogram::MessageWrite, writeEnd - writeStart);
+
+              // every frame callback receives only its own size
+              const std::vector<SendData> written = std::move(self->inFlight);
+              self->inFlight.clear();
+              for (const auto &sendDataQueued: written) {
+                  if (sendDataQueued.receivedAt != std::chrono::steady_clock::time_point()) {
+                      wss::metrics::observe(wss::metrics::Histogram::MessageEndToEnd,
+                                            writeEnd - sendDataQueued.receivedAt);
+                  }
+                  self->queueAccountRemove(sendDataQueued);
+                  if (sendDataQueued.callback) {
+                      sendDataQueued.callback(ec, numFrames == 1 ? ts : sendDataQueued.frame->size());
+                  }
+              }
+
+              if (!self->lanesEmpty()) {
+                  self->writeQueued();
+              } else {
+                  self->sendInProgress = false;
+              }
             });
+            if (zeroCopy) {
+                wss::metrics::add(wss::metrics::Counter::ZeroCopyWrites);
+                writeZeroCopy(std::make_shared<std::vector<asio::const_buffer>>(std::move(bufs)), 0, writeBytes,
+                              std::move(completion));
+                return;
+            }
+            socket->async_write(bufs, std::move(completion));
+        }
+
+        /// \brief Sends buffers by sendmsg(MSG_ZEROCOPY), waits for writable socket when kernel buffer is full.
+        /// Rest is written as usual if kernel refuses zero-copy. Plain tcp only, must be called inside strand
+        /// \param handler strand wrapped write completion
+        template<typename Handler>
+        void writeZeroCopy(const std::shared_ptr<std::vector<asio::const_buffer>> &bufs,
+                           std::size_t written,
+                           std::size_t total,
+                           Handler handler) {
+            const int fd = socket->lowest_layer().native_handle();
+            while (written < total) {
+                const ssize_t sent = wss::zerocopy::send(fd, *bufs, written);
+                if (sent >= 0) {
+                    zeroCopyNext++;
+                    written += static_cast<std::size_t>(sent);
+                    continue;
+                }
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    const std::shared_ptr<Connection> self = this->shared_from_this();
+                    auto resume = strand.wrap([self, bufs, written, total, handler](const ErrorCode &ec, auto...) mutable {
+                      if (ec) {
+                          handler(ec, written);
+                          return;
+                      }
+                      self->writeZeroCopy(bufs, written, total, handler);
+                    });
+#if (BOOST_VERSION >= 106600)
+                    socket->rawInsecure()->async_wait(asio::ip::tcp::socket::wait_write, resume);
+#else
+                    socket->rawInsecure()->async_write_some(asio::null_buffers(), resume);
+#endif
+                    return;
+                }
+                if (errno == ENOBUFS) {
+                    // notifications are over optmem limit
+                    std::vector<asio::const_buffer> rest;
+                    std::size_t offset = written;
+                    for (const auto &buffer: *bufs) {
+                        const std::size_t size = asio::buffer_size(buffer);
+                        if (offset >= size) {
+                            offset -= size;
+                            continue;
+                        }
+                        rest.push_back(buffer + offset);
+                        offset = 0;
+                    }
+                    asio::async_write(*socket->rawInsecure(), rest,
+                                      [written, handler](const ErrorCode &ec, std::size_t ts) mutable {
+                                        handler(ec, written + ts);
+                                      });
+                    return;
+                }
+                handler(ErrorCode(errno, boost::system::system_category()), written);
+                return;
+            }
+            socket->get_io_service().post(std::bind(handler, ErrorCode(), total));
+        }
+
+        /// \brief Releases frames of completed zero-copy writes. Must be called inside strand
+        /// \return writes still waiting for completion
+        std::size_t reapZeroCopy() {
+            if (zeroCopyHeld.empty()) {
+                return 0;
+            }
+            uint32_t completed = 0;
+            std::size_t copied = 0;
+            if (wss::zerocopy::reap(socket->lowest_layer().native_handle(), completed, copied)) {
+                while (!zeroCopyHeld.empty() && static_cast<int32_t>(completed - zeroCopyHeld.front().first) >= 0) {
+                    zeroCopyHeld.pop_front();
+                }
+                if (copied > 0) {
+                    wss::metrics::add(wss::metrics::Counter::ZeroCopyCopied, copied);
+                }
+            }
+            return zeroCopyHeld.size();
         }
 
         void readRemoteEndpoint() noexcept {
@@ -293,38 +1275,102 @@ class SocketServerBase : public BaseServer {
         void send(std::shared_ptr<SendStream> messageStream,
                   const SendCallback &callback = nullptr,
                   uint8_t fin_rsv_opcode = 129) {
-            timeoutCancel();
-            timeoutSet();
-
-            std::shared_ptr<SendStream> headerStream = std::make_shared<SendStream>();
-            std::size_t length = messageStream->size();
+            send(Frame::make(std::move(messageStream), fin_rsv_opcode), callback);
+        }
 
-            headerStream->put(static_cast<char>(fin_rsv_opcode));
-            // Unmasked (first length byte<128)
-            if (length >= 126) {
-                std::size_t numBytes;
-                if (length > 0xffff) {
-                    numBytes = 8;
-                    headerStream->put(127);
-                } else {
-                    numBytes = 2;
-                    headerStream->put(126);
-                }
+        /// \brief Queues already encoded frame. The same frame instance can be sent to many connections,
+        /// payload and header are not copied.
+        /// \param frame shared immutable frame
+        /// \param callback
+        /// \param priority send lane, control frames always go to SendPriority::High
+        /// \param receivedAt ingress time of message that is sent, for end-to-end latency metric. Epoch - unknown
+        /// \param coalesceKey frame replaces queued frame of the same key, see CoalesceKey
+        void send(std::shared_ptr<const Frame> frame,
+                  const SendCallback &callback = nullptr,
+                  SendPriority priority = SendPriority::Normal,
+                  std::chrono::steady_clock::time_point receivedAt = std::chrono::steady_clock::time_point(),
+                  const CoalesceKey &coalesceKey = CoalesceKey()) {
+            // idle deadline bump, control frames (keepalive pings, pongs) do not make connection active
+            if ((frame->getFinRsvOpcode() & 0x0fu) < 8) {
+                lastSend() = nowMillis();
+            }
 
-                for (std::size_t c = numBytes - 1; c != static_cast<std::size_t>(-1); c--)
-                    headerStream->put(static_cast<char>((length >> (8 * c)) % 256));
-            } else {
-                headerStream->put(static_cast<char>(length));
+            executorBacklog++;
+            auto *item = new PendingSend{nullptr, std::move(frame), callback, priority, receivedAt, coalesceKey};
+            PendingSend *head = pendingSends.load(std::memory_order_relaxed);
+            do {
+                item->next = head;
+            } while (!pendingSends.compare_exchange_weak(head, item,
+                                                         std::memory_order_release,
+                                                         std::memory_order_relaxed));
+            if (head != nullptr) {
+                // drain is already posted and hasn't taken stack yet
+                return;
             }
 
             const std::shared_ptr<Connection> self = this->shared_from_this();
-            strand.post([self, headerStream, messageStream, callback]() {
-              self->sendQueue.emplace_back(std::move(headerStream), std::move(messageStream), std::move(callback));
-              if (self->sendQueue.size() == 1)
-                  self->sendFromQueue();
+            if (shard != nullptr) {
+                // shard io_service is run by one thread, so its handlers are already serialized
+                shard->post([self]() {
+                  self->drainPending();
+                });
+                return;
+            }
+
+            strand.post([self]() {
+              self->drainPending();
             });
         }
 
+        /// \brief Runs task on connection executor: owner shard loop, or connection strand
+        /// \param task
+        void post(std::function<void()> &&task) {
+            executorBacklog++;
+            const std::shared_ptr<Connection> self = this->shared_from_this();
+            auto counted = [self, task = std::move(task)]() {
+              self->executorBacklog--;
+              task();
+            };
+            if (shard != nullptr) {
+                shard->post(std::move(counted));
+                return;
+            }
+            strand.post(std::move(counted));
+        }
+
+        /// \brief Snapshot of connection state. Safe to call from any thread
+        ConnectionDiagnostics getDiagnostics() const {
+            ConnectionDiagnostics out;
+            out.uniqueId = uniqueId;
+            out.remoteAddress = remoteEndpointAddress();
+            out.remotePort = remoteEndpointPort();
+            out.sendQueueFrames = queuedFrames().load(std::memory_order_relaxed);
+            out.sendQueueBytes = queuedBytes().load(std::memory_order_relaxed);
+            out.executorBacklog = executorBacklog.load(std::memory_order_relaxed);
+            out.lastReadMillis = lastActivity().load(std::memory_order_relaxed);
+            out.lastWriteMillis = lastSend().load(std::memory_order_relaxed);
+            out.rttMicros = rttMicros.load(std::memory_order_relaxed);
+            out.unansweredPings = unansweredPings().load(std::memory_order_relaxed);
+            out.secure = tlsVersion != nullptr;
+            out.tlsVersion = tlsVersion == nullptr ? "" : tlsVersion;
+            out.tlsCipher = tlsCipher == nullptr ? "" : tlsCipher;
+            out.tlsResumed = tlsResumed;
+            out.fragmentBufferBytes = fragmentBufferBytes.load(std::memory_order_relaxed);
+            out.subprotocol = subprotocol;
+            out.permessageDeflate = permessageDeflate != nullptr;
+            return out;
+        }
+
+        /// \brief Send queue size gauge (including frame being written)
+        std::size_t getSendQueueFrames() const noexcept {
+            return queuedFrames();
+        }
+
+        /// \brief Send queue bytes gauge (including frame being written)
+        std::size_t getSendQueueBytes() const noexcept {
+            return queuedBytes();
+        }
+
         void sendClose(int status, const std::string &reason = "", const SendCallback &callback = nullptr) {
             // Send close only once (in case close is initiated by server)
             if (closed) {
@@ -333,29 +1379,42 @@ class SocketServerBase : public BaseServer {
 
             closed = true;
 
-            auto sendStream = std::make_shared<SendStream>();
-
-            sendStream->put(static_cast<char>(status >> 8));
-            sendStream->put(static_cast<char>(status % 256));
-
-            *sendStream << reason;
+            std::string payload;
+            payload.reserve(2 + reason.size());
+            payload.push_back(static_cast<char>(status >> 8));
+            payload.push_back(static_cast<char>(status % 256));
+            payload += reason;
 
             // fin_rsv_opcode=136: message close
-            send(std::move(sendStream), callback, 136);
+            send(Frame::create(payload, 136), callback);
         }
     };
 
-    class Message : public std::istream {
+    class Message : public std::istream, private wss::hotpath::Tracked<wss::hotpath::AllocSite::Message, Message> {
         friend class SocketServerBase;
         friend class SocketServer;
         friend class SocketServerSecure;
 
      public:
         unsigned char fin_rsv_opcode;
+        /// \brief When last frame of message was read
+        std::chrono::steady_clock::time_point receivedAt;
         std::size_t size() noexcept {
             return length;
         }
 
+        /// \brief Unmasked payload bytes, contiguous. Pointer is valid while message is alive and not consumed.
+        /// \return pointer to the first not consumed byte
+        const char *data() const noexcept {
+            return asio::buffer_cast<const char *>(streambuf.data());
+        }
+
+        /// \brief Non-owning view of not consumed payload. No copy made, buffer is not consumed.
+        /// \return
+        boost::string_view view() const noexcept {
+            return boost::string_view(data(), streambuf.size());
+        }
+
         /// Convenience function to return std::string. The stream buffer is consumed.
         std::string string() noexcept {
             try {
@@ -367,30 +1426,165 @@ class SocketServerBase : public BaseServer {
             }
         }
 
-     private:
+        /// \brief Public for std::allocate_shared only: messages are created by server read chain
         Message() noexcept : std::istream(&streambuf) { }
+
+     private:
         std::size_t length;
         asio::streambuf streambuf;
     };
 
+    /// \brief Number of Endpoint connections shards (power of two)
+    static constexpr std::size_t CONNECTION_SHARDS = 64;
+    using ConnectionList = std::vector<std::shared_ptr<Connection>>;
+    using ConnectionListPtr = std::shared_ptr<const ConnectionList>;
+    class Endpoint;
+
+    /// \brief Immutable view of all endpoint connections: one list per shard.
+    /// Taking it costs CONNECTION_SHARDS atomic loads instead of copying connections,
+    /// and it is not affected by following opens and closes.
+    class ConnectionsSnapshot {
+        friend class Endpoint;
+     public:
+        /// \brief Calls handler(const std::shared_ptr<Connection>&) for each connection
+        template<typename Handler>
+        void forEach(Handler &&handler) const {
+            for (const auto &shard: shards) {
+                for (const auto &connection: *shard) {
+                    handler(connection);
+                }
+            }
+        }
+
+        std::size_t size() const noexcept {
+            std::size_t out = 0;
+            for (const auto &shard: shards) {
+                out += shard->size();
+            }
+            return out;
+        }
+
+        /// \brief Calls handler(const std::shared_ptr<Connection>&) for up to count connections,
+        /// evenly spread over snapshot. Different offsets select different connections
+        template<typename Handler>
+        void forEachSampled(std::size_t count, std::size_t offset, Handler &&handler) const {
+            const std::size_t total = size();
+            if (total == 0 || count == 0) {
+                return;
+            }
+            const std::size_t step = std::max<std::size_t>(1, total / count);
+            const std::size_t sampled = std::min(count, total);
+            for (std::size_t i = 0; i < sampled; i++) {
+                std::size_t index = (offset % step + i * step) % total;
+                for (const auto &shard: shards) {
+                    if (index < shard->size()) {
+                        handler((*shard)[index]);
+                        break;
+                    }
+                    index -= shard->size();
+                }
+            }
+        }
+
+     private:
+        std::array<ConnectionListPtr, CONNECTION_SHARDS> shards;
+    };
+
     class Endpoint {
         friend class SocketServerBase;
         friend class SocketServer;
         friend class SocketServerSecure;
 
      private:
-        std::unordered_set<std::shared_ptr<Connection>> connections;
-        std::mutex connectionsMutex;
+        /// \brief Read-copy-update: writers replace shard list under shard mutex, readers atomically load it
+        struct ConnectionsShard {
+          std::mutex mutex;
+          ConnectionListPtr items = std::make_shared<const ConnectionList>();
+        };
+        std::array<ConnectionsShard, CONNECTION_SHARDS> connectionShards;
+
+        /// \brief Accounted bytes of one open connection: its object, socket and list entry.
+        /// Buffers and queues are accounted separately
+        static constexpr std::size_t CONNECTION_BYTES =
+            sizeof(Connection) + sizeof(SocketLayerWrapper) + sizeof(std::shared_ptr<Connection>);
+
+        ConnectionsShard &getConnectionsShard(const Connection *connection) noexcept {
+            // low bits of heap addresses are the same
+            return connectionShards[(reinterpret_cast<std::uintptr_t>(connection) >> 6) & (CONNECTION_SHARDS - 1)];
+        }
+
+        void addConnection(const std::shared_ptr<Connection> &connection) {
+            ConnectionsShard &shard = getConnectionsShard(connection.get());
+            EndpointConnectionsLock lock(shard.mutex);
+            auto updated = std::make_shared<ConnectionList>(*std::atomic_load(&shard.items));
+            updated->push_back(connection);
+            std::atomic_store(&shard.items, ConnectionListPtr(std::move(updated)));
+            wss::metrics::acquire(wss::metrics::Memory::Connections, CONNECTION_BYTES);
+        }
+
+        void removeConnection(const std::shared_ptr<Connection> &connection) {
+            ConnectionsShard &shard = getConnectionsShard(connection.get());
+            EndpointConnectionsLock lock(shard.mutex);
+            const ConnectionListPtr current = std::atomic_load(&shard.items);
+            const auto it = std::find(current->begin(), current->end(), connection);
+            if (it == current->end()) {
+                return;
+            }
+            auto updated = std::make_shared<ConnectionList>();
+            updated->reserve(current->size() - 1);
+            updated->insert(updated->end(), current->begin(), it);
+            updated->insert(updated->end(), it + 1, current->end());
+            std::atomic_store(&shard.items, ConnectionListPtr(std::move(updated)));
+            wss::metrics::release(wss::metrics::Memory::Connections, CONNECTION_BYTES);
+        }
+
+        /// \brief Removes all connections
+        /// \return removed connections
+        ConnectionsSnapshot clearConnections() {
+            ConnectionsSnapshot out;
+            for (std::size_t i = 0; i < CONNECTION_SHARDS; i++) {
+                EndpointConnectionsLock lock(connectionShards[i].mutex);
+                out.shards[i] = std::atomic_load(&connectionShards[i].items);
+                std::atomic_store(&connectionShards[i].items, std::make_shared<const ConnectionList>());
+            }
+            wss::metrics::release(wss::metrics::Memory::Connections, out.size() * CONNECTION_BYTES);
+            return out;
+        }
 
      public:
+        /// \brief permessage-deflate settings for this endpoint. Set before start()
+        PerMessageDeflate::Options deflateOptions;
+        /// \brief Supported Sec-WebSocket-Protocol values. Negotiated one is stored in Connection::subprotocol.
+        /// Set before start()
+        std::vector<std::string> subprotocols;
+
+        /// \brief Admission control: called before upgrade response, false - request is answered with 503
+        /// and connection is closed. Handshake fields are available
+        std::function<bool(const std::shared_ptr<Connection> &)> onUpgrade;
         std::function<void(std::shared_ptr<Connection>)> onOpen;
+        /// \brief Called for every data message. Fragmented messages are reassembled by server
+        /// and delivered once, as single frame (FIN bit is set, opcode of first fragment)
         std::function<void(std::shared_ptr<Connection>, std::shared_ptr<Message>)> onMessage;
         std::function<void(std::shared_ptr<Connection>, int, const std::string &)> onClose;
         std::function<void(std::shared_ptr<Connection>, const ErrorCode &)> onError;
 
-        std::unordered_set<std::shared_ptr<Connection>> getConnections() noexcept {
-            std::unique_lock<std::mutex> lock(connectionsMutex);
-            auto copy = connections;
+        /// \brief All connections, without blocking opens and closes. Prefer it to getConnections()
+        /// \return
+        ConnectionsSnapshot getConnectionsSnapshot() const noexcept {
+            ConnectionsSnapshot out;
+            for (std::size_t i = 0; i < CONNECTION_SHARDS; i++) {
+                out.shards[i] = std::atomic_load(&connectionShards[i].items);
+            }
+            return out;
+        }
+
+        /// \brief Copy of all connections
+        /// \return
+        std::unordered_set<std::shared_ptr<Connection>> getConnections() {
+            std::unordered_set<std::shared_ptr<Connection>> copy;
+            getConnectionsSnapshot().forEach([&copy](const std::shared_ptr<Connection> &connection) {
+              copy.insert(connection);
+            });
             return copy;
         }
     };
@@ -406,18 +1600,136 @@ class SocketServerBase : public BaseServer {
         std::size_t threadPoolSize = 1;
         /// Timeout on request handling. Defaults to 5 seconds.
         long timeoutRequest = 5;
-        /// Idle timeout. Defaults to no timeout.
+        /// Idle timeout in seconds: connection without incoming and outgoing data frames will be closed.
+        /// Checked by timeout wheel with 1 second resolution. Defaults to no timeout.
         long timeoutIdle = 0;
         /// Maximum size of incoming messages. Defaults to architecture maximum.
         /// Exceeding this limit will result in a message_size error code and the connection will be closed.
-        std::size_t maxMessageSize = std::numeric_limits<std::size_t>::max();
+        /// Can be changed while server is running.
+        wss::utils::Tunable<std::size_t> maxMessageSize = std::numeric_limits<std::size_t>::max();
+        /// Maximum frames of one fragmented message, 0 - unlimited. Defaults to unlimited.
+        /// Exceeding this limit closes connection with 1008 (policy violation), before fragment payload is read.
+        std::size_t maxMessageFragments = 0;
         /// IPv4 address in dotted decimal form or IPv6 address in hexadecimal notation.
         /// If empty, the address will be any address.
+        /// `unix:/path` - listen AF_UNIX socket instead, port is not used. Socket file is replaced on start
+        /// and removed on stop. Unix socket connections have no tcp options and remote address.
         std::string address;
         /// Set to false to avoid binding the socket to an address that is already in use. Defaults to true.
         bool reuseAddress = true;
+        /// Tcp options of listeners and accepted connections (TCP_NODELAY, buffers, TCP_NOTSENT_LOWAT, backlog).
+        wss::SocketOptions socket;
+        /// Open one SO_REUSEPORT listening socket per thread, each with own io_service,
+        /// so kernel spreads incoming connections across threads. Connection stays on thread that accepted it.
+        /// Works only with internal io_service, threadPoolSize > 1 and tcp address, otherwise ignored.
+        /// Defaults to false.
+        bool reusePort = false;
+        /// Give every thread its own io_service (shard) instead of running one io_service by all threads.
+        /// Accepted connections are distributed round-robin and stay on their shard,
+        /// sends from other threads go through shard mailbox. Always on in reusePort mode.
+        /// Works only with internal io_service and threadPoolSize > 1, otherwise ignored. Defaults to false.
+        bool ioServicePerThread = false;
+        /// Every connection starts with PROXY protocol v2 header of L4 balancer: remote endpoint is client address
+        /// from header. Connections without valid header are closed. Defaults to false.
+        bool proxyProtocol = false;
+        /// Connections from this host (loopback or own address) may start with PROXY protocol v2 header, that is
+        /// detected by its first byte: local gateway (wss::Http2Gateway) sends address of its client in it.
+        /// Without header, socket peer address is kept. Ignored with proxyProtocol. Defaults to false.
+        bool localProxyProtocol = false;
+        /// Don't open listener: connections are accepted by other process and given by adopt()
+        /// (multi-process mode, see wss::WorkerPool). Plain server only. Defaults to false.
+        bool externalAccept = false;
+        /// Maximum number of queued frames sent by single write (scatter-gather). Defaults to 1 (no coalescing).
+        /// Send options below can be changed while server is running, connection takes them when it's opened.
+        wss::utils::Tunable<std::size_t> sendCoalesceFrames = 1;
+        /// Maximum bytes of queued frames sent by single write. 0 - no limit, only sendCoalesceFrames is used.
+        wss::utils::Tunable<std::size_t> sendCoalesceBytes = 0;
+        /// Connection send queue high-water mark in frames. Defaults to 0 (unlimited).
+        wss::utils::Tunable<std::size_t> sendHighWaterFrames = 0;
+        /// Connection send queue high-water mark in bytes. Defaults to 0 (unlimited).
+        wss::utils::Tunable<std::size_t> sendHighWaterBytes = 0;
+        /// Weighted round-robin of Normal and Bulk send lanes: frames written from each lane in turn.
+        /// High lane is always written first. Defaults to 4 normal frames per 1 bulk frame.
+        std::size_t sendNormalWeight = 4;
+        std::size_t sendBulkWeight = 1;
+        /// Connection read buffer grown by larger frame is released after frame is handled.
+        /// Defaults to 64 KiB. 0 - never release.
+        std::size_t readBufferRetainBytes = 64 * 1024;
+        /// Size of single socket read: all frames of received chunk are handled without another read.
+        /// Each connection read buffer holds at least this size. Defaults to 4 KiB.
+        std::size_t readChunkBytes = 4 * 1024;
+        /// Per-connection token buckets of incoming messages, used by message handler. Rate 0 - unlimited.
+        double inboundMessagesRate = 0;
+        double inboundMessagesBurst = 0;
+        /// Per-connection token buckets of incoming bytes, used by message handler. Rate 0 - unlimited.
+        double inboundBytesRate = 0;
+        double inboundBytesBurst = 0;
+        /// What to do with slow consumer, when its send queue reached high-water mark. Defaults to reject new frames.
+        wss::utils::Tunable<SlowConsumerPolicy> slowConsumerPolicy = SlowConsumerPolicy::Reject;
+        /// Max size of upgrade request head (request line and headers). Larger requests are answered with 431,
+        /// connections that don't start with "GET " are closed before headers are read.
+        /// Defaults to 16 KiB, 0 - unlimited.
+        std::size_t maxHandshakeBytes = 16 * 1024;
+        /// Deadline of whole handshake in milliseconds from accept: PROXY header, TLS, upgrade request and response.
+        /// Each step is also limited by timeoutRequest. Defaults to 0 (only timeoutRequest of each step).
+        long handshakeDeadlineMillis = 0;
+        /// TLS only: max handshakes running at the same time. When limit is reached, server stops accepting
+        /// (clients wait in listen backlog) until some handshake is finished,
+        /// so reconnect storm can't take all workers time from established connections. Defaults to 0 (unlimited).
+        std::size_t maxConcurrentHandshakes = 0;
+        /// Keepalive: send ping to connection without incoming frames for this number of seconds.
+        /// Every connection pings up to a quarter of interval earlier, by its own stable offset, so connections
+        /// opened at once (reconnect wave) don't ping at the same wheel tick. Defaults to 0 (keepalive is disabled).
+        /// Interval and missed pings can be changed while server is running, if it was started with keepalive
+        /// or idle timeout (timeout wheel is armed on start only).
+        wss::utils::Tunable<long> pingInterval = 0;
+        /// Keepalive: close connection after this number of unanswered pings. Defaults to 2.
+        wss::utils::Tunable<std::size_t> pingMaxMissed = 2;
+        /// Event loop lag probe: every interval each event loop runs posted no-op, time it waited behind queued
+        /// handlers is loop lag. Main loop probe also samples executor backlog of up to LOOP_BACKLOG_SAMPLES
+        /// connections. Defaults to 0 (probes are disabled).
+        long loopLagProbeMillis = 0;
+        /// Admission control: while lag of any event loop is over this number of milliseconds, server
+        /// is reported overloaded (see isOverLoopLagLimit). Requires probes. Defaults to 0 (never overloaded).
+        long loopLagLimitMillis = 0;
     };
 
+    /// \brief Idle timeout and keepalive checks of connections that belong to one event loop
+    class TimeoutWheel {
+        friend class SocketServerBase;
+     public:
+        using Entry = std::pair<std::weak_ptr<Connection>, Endpoint *>;
+
+        explicit TimeoutWheel(asio::io_service &service) :
+            timer(service),
+            wheel(std::chrono::seconds(1)) { }
+
+     private:
+        asio::steady_timer timer;
+        /// \brief Guards wheel: connections are added from their threads, checked by timer thread
+        std::mutex mutex;
+        wss::utils::TimerWheel<Entry> wheel;
+        /// \brief Timer handler scratch
+        std::vector<Entry> expired;
+    };
+
+    /// \brief Lag probe of one event loop
+    class LoopMonitor {
+        friend class SocketServerBase;
+     public:
+        explicit LoopMonitor(asio::io_service &service) :
+            service(service),
+            timer(service) { }
+
+     private:
+        asio::io_service &service;
+        asio::steady_timer timer;
+        std::atomic<int64_t> lagMicros{0};
+    };
+
+    /// \brief Connections, which executor backlog is sampled by one probe
+    static constexpr std::size_t LOOP_BACKLOG_SAMPLES = 64;
+
     void start() override {
         if (!ioService) {
             ioService = std::make_shared<asio::io_service>();
@@ -428,33 +1740,90 @@ class SocketServerBase : public BaseServer {
             ioService->reset();
         }
 
+        const bool unixListener = wss::unixsocket::isAddress(config.address);
         asio::ip::tcp::endpoint endpoint;
-        if (config.address.size() > 0) {
+        if (unixListener) {
+            // endpoint is not used: unix socket is opened by listen()
+        } else if (config.address.size() > 0) {
             endpoint = asio::ip::tcp::endpoint(asio::ip::address::from_string(config.address), config.port);
         } else {
             endpoint = asio::ip::tcp::endpoint(asio::ip::tcp::v4(), config.port);
         }
 
+        const bool multiThreaded = internalIoService && config.threadPoolSize > 1;
+        // one unix socket path can't be bound twice
+        const bool multiAcceptor = multiThreaded && config.reusePort && !unixListener && reusePortSupported();
+
+        activeShards = 0;
+        if (multiThreaded && (multiAcceptor || config.ioServicePerThread)) {
+            // first shard uses main ioService, other threads have their own
+            if (shards.empty()) {
+                shards.push_back(std::make_unique<Shard>(0, ioService));
+            }
+            for (std::size_t c = 1; c < config.threadPoolSize; c++) {
+                if (shards.size() <= c) {
+                    shards.push_back(std::make_unique<Shard>(c, std::make_shared<asio::io_service>()));
+                } else if (shards[c]->service->stopped()) {
+                    shards[c]->service->reset();
+                }
+            }
+            activeShards = config.threadPoolSize;
+        }
+
         if (!acceptor) {
             acceptor = std::make_unique<asio::ip::tcp::acceptor>(*ioService);
         }
 
-        acceptor->open(endpoint.protocol());
-        acceptor->set_option(asio::socket_base::reuse_address(config.reuseAddress));
-        acceptor->bind(endpoint);
-        acceptor->listen();
+        accepting = true;
+        if (!config.externalAccept) {
+            listen(*acceptor, endpoint, multiAcceptor);
+            accept();
+        }
+
+        if (timeoutWheelEnabled()) {
+            // one wheel per event loop
+            const std::size_t numWheels = std::max<std::size_t>(1, activeShards);
+            for (std::size_t c = timeoutWheels.size(); c < numWheels; c++) {
+                timeoutWheels.push_back(std::make_unique<TimeoutWheel>(c == 0 ? *ioService : *shards[c]->service));
+            }
+            for (std::size_t c = 0; c < numWheels; c++) {
+                timeoutWheelArm(*timeoutWheels[c]);
+            }
+        }
+
+        if (config.loopLagProbeMillis > 0) {
+            const std::size_t numMonitors = std::max<std::size_t>(1, activeShards);
+            for (std::size_t c = loopMonitors.size(); c < numMonitors; c++) {
+                loopMonitors.push_back(std::make_unique<LoopMonitor>(c == 0 ? *ioService : *shards[c]->service));
+            }
+            for (std::size_t c = 0; c < numMonitors; c++) {
+                loopMonitorArm(*loopMonitors[c]);
+            }
+        }
 
-        accept();
+        workerAcceptors.clear();
+        if (multiAcceptor) {
+            for (std::size_t c = 1; c < activeShards; c++) {
+                auto &service = *shards[c]->service;
+                workerAcceptors.push_back(std::make_unique<asio::ip::tcp::acceptor>(service));
+                listen(*workerAcceptors.back(), endpoint, true);
+                accept(*workerAcceptors.back(), service);
+            }
+        }
 
         if (internalIoService) {
             // If thread_pool_size>1, start m_io_service.run() in (thread_pool_size-1) threads for thread-pooling
             for (std::size_t c = 1; c < config.threadPoolSize; c++) {
-                threadGroup.create_thread(
-                    boost::bind(&boost::asio::io_service::run, ioService)
-                );
+                std::shared_ptr<asio::io_service> service = activeShards > 0 ? shards[c]->service : ioService;
+                threadGroup.create_thread([service, c] {
+                  // one event loop per core: connections of shard are allocated on core's numa node
+                  wss::affinity::pinOne(wss::affinity::Group::Io, c);
+                  service->run();
+                });
             }
             // Main thread
             if (config.threadPoolSize > 0) {
+                wss::affinity::pinOne(wss::affinity::Group::Io, 0);
                 ioService->run();
             }
 
@@ -463,21 +1832,61 @@ class SocketServerBase : public BaseServer {
         }
     }
 
+    /// \brief Stops accepting new connections, opened connections are kept (see ChatServer::drain)
+    void stopAccept() {
+        accepting = false;
+        if (!acceptor) {
+            return;
+        }
+        // listeners are used only by their own io_service threads
+        asio::ip::tcp::acceptor *listener = acceptor.get();
+        ioService->post([listener] {
+          ErrorCode ec;
+          listener->close(ec);
+        });
+        for (std::size_t i = 0; i < workerAcceptors.size(); i++) {
+            asio::ip::tcp::acceptor *workerListener = workerAcceptors[i].get();
+            shards[i + 1]->service->post([workerListener] {
+              ErrorCode ec;
+              workerListener->close(ec);
+            });
+        }
+    }
+
+    /// \brief Whether server accepts new connections
+    bool isAccepting() const noexcept {
+        return accepting;
+    }
+
     void stop() override {
         if (acceptor) {
+            accepting = false;
             ErrorCode ec;
             acceptor->close(ec);
+            for (auto &workerAcceptor: workerAcceptors) {
+                workerAcceptor->close(ec);
+            }
+            if (wss::unixsocket::isAddress(config.address) && !config.externalAccept) {
+                wss::unixsocket::remove(wss::unixsocket::getPath(config.address));
+            }
+            for (auto &wheel: timeoutWheels) {
+                wheel->timer.cancel(ec);
+            }
+            for (auto &monitor: loopMonitors) {
+                monitor->timer.cancel(ec);
+            }
 
             for (auto &pair : endpoint) {
-                std::unique_lock<std::mutex> lock(pair.second.connectionsMutex);
-                for (auto &connection : pair.second.connections) {
-                    connection->close();
-                }
-                pair.second.connections.clear();
+                pair.second.clearConnections().forEach([](const std::shared_ptr<Connection> &connection) {
+                  connection->close();
+                });
             }
 
             if (internalIoService) {
                 ioService->stop();
+                for (auto &shard: shards) {
+                    shard->service->stop();
+                }
             }
 
             threadGroup.interrupt_all();
@@ -493,11 +1902,11 @@ class SocketServerBase : public BaseServer {
      * Example use:
      * server.on_upgrade=[&socket_server] (auto socket, auto request) {
      *   auto connection=std::make_shared<wss::server::websocket::SocketServer<wss::server::websocket::WS>::Connection>(std::move(socket));
-     *   connection->method=std::move(request->method);
-     *   connection->path=std::move(request->path);
-     *   connection->query_string=std::move(request->query_string);
-     *   connection->http_version=std::move(request->http_version);
-     *   connection->header=std::move(request->header);
+     *   connection->handshake->method=std::move(request->method);
+     *   connection->handshake->path=std::move(request->path);
+     *   connection->handshake->queryString=std::move(request->query_string);
+     *   connection->handshake->httpVersion=std::move(request->http_version);
+     *   connection->handshake->header=std::move(request->header);
      *   connection->remote_endpoint=std::move(*request->remote_endpoint);
      *   socket_server.upgrade(connection);
      * }
@@ -505,57 +1914,520 @@ class SocketServerBase : public BaseServer {
     void upgrade(const std::shared_ptr<Connection> &connection) {
         connection->handlerRunner = handlerRunner;
         connection->timeoutIdle = config.timeoutIdle;
+        configureConnection(connection);
         handshakeWrite(connection);
     }
 
     /// If you have your own asio::io_service, store its pointer here before running start().
     std::shared_ptr<asio::io_service> ioService;
 
-    Config &getConfig() {
-        return config;
+    Config &getConfig() {
+        return config;
+    }
+
+    std::map<RegexOrderable, Endpoint> &getEndpoint() {
+        return endpoint;
+    }
+
+    /// \brief All connections send queues gauges
+    const SendQueueMetrics &getSendQueueMetrics() const {
+        return *sendQueueMetrics;
+    }
+
+    /// \brief Event loops lag and sampled executors backlog, measured by last probes
+    EventLoopMetrics getEventLoopMetrics() const {
+        EventLoopMetrics out;
+        for (const auto &monitor: loopMonitors) {
+            out.lagMicros.push_back(monitor->lagMicros.load(std::memory_order_relaxed));
+        }
+        out.backlogSampled = backlogSampled.load(std::memory_order_relaxed);
+        out.backlogMax = backlogMax.load(std::memory_order_relaxed);
+        out.backlogTotal = backlogTotal.load(std::memory_order_relaxed);
+        return out;
+    }
+
+    /// \brief Whether lag of any event loop is over Config::loopLagLimitMillis. Costs one relaxed load per loop
+    bool isOverLoopLagLimit() const noexcept {
+        if (config.loopLagLimitMillis <= 0) {
+            return false;
+        }
+        const int64_t limitMicros = static_cast<int64_t>(config.loopLagLimitMillis) * 1000;
+        for (const auto &monitor: loopMonitors) {
+            if (monitor->lagMicros.load(std::memory_order_relaxed) > limitMicros) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// \brief Use send queues gauges of other server, to get summary for both. Call before start()
+    /// \param other
+    void shareSendQueueMetrics(const SocketServerBase &other) {
+        sendQueueMetrics = other.sendQueueMetrics;
+    }
+
+    /// \brief Per source address limits of new connections. Configure before start()
+    ConnectionAdmission &getAdmission() noexcept {
+        return *admission;
+    }
+
+    /// \brief Count connections of both servers by the same per source limits. Call before start()
+    /// \param other
+    void shareAdmission(const SocketServerBase &other) {
+        admission = other.admission;
+    }
+
+ protected:
+    /// Set before calling start().
+    Config config;
+    /// Warning: do not add or remove endpoints after start() is called
+    std::map<RegexOrderable, Endpoint> endpoint;
+
+    bool internalIoService = false;
+
+    std::unique_ptr<asio::ip::tcp::acceptor> acceptor;
+    /// \brief Cleared by stopAccept(): accept handlers don't re-arm closed listeners
+    std::atomic<bool> accepting{false};
+    /// \brief Per-thread event loops, first one wraps ioService. Kept between restarts, connections refer to them
+    std::vector<std::unique_ptr<Shard>> shards;
+    /// \brief Number of shards used by current start(), 0 - sharding is off
+    std::size_t activeShards = 0;
+    std::atomic<std::size_t> nextShard{0};
+    /// \brief SO_REUSEPORT mode: listeners of shards, except first, that uses acceptor
+    std::vector<std::unique_ptr<asio::ip::tcp::acceptor>> workerAcceptors;
+    /// \brief Timeout wheel per event loop, index is shard index. Kept between restarts
+    std::vector<std::unique_ptr<TimeoutWheel>> timeoutWheels;
+    /// \brief Lag probe per event loop, index is shard index. Kept between restarts
+    std::vector<std::unique_ptr<LoopMonitor>> loopMonitors;
+    /// \brief Executor backlog sample of last probe, written by main loop probe only
+    std::atomic<std::size_t> backlogSampled{0};
+    std::atomic<std::size_t> backlogMax{0};
+    std::atomic<std::size_t> backlogTotal{0};
+    /// \brief Offset of next sample in connections snapshot, so probes go over all connections in turn
+    std::size_t backlogCursor = 0;
+    boost::thread_group threadGroup;
+
+    std::shared_ptr<ScopeRunner> handlerRunner;
+
+    std::shared_ptr<SendQueueMetrics> sendQueueMetrics;
+    std::shared_ptr<ConnectionAdmission> admission;
+
+    SocketServerBase(unsigned short port) noexcept:
+        config(port),
+        handlerRunner(new ScopeRunner()),
+        sendQueueMetrics(std::make_shared<SendQueueMetrics>()),
+        admission(std::make_shared<ConnectionAdmission>()) { }
+
+    void accept() override {
+        accept(*acceptor, *ioService);
+    }
+
+    /// \brief Accept next connection on given listener
+    /// \param listener
+    /// \param service io_service of listener, accepted connection will be handled by it
+    virtual void accept(asio::ip::tcp::acceptor &listener, wss::io_context_service &service) = 0;
+
+    /// \brief Shard for connection accepted by listener that runs on given io_service
+    /// \param service listener io_service
+    /// \return nullptr if sharding is off
+    Shard *acceptShard(wss::io_context_service &service) noexcept {
+        if (activeShards == 0) {
+            return nullptr;
+        }
+        if (workerAcceptors.empty()) {
+            // single listener, spreading connections
+            return shards[nextShard++ % activeShards].get();
+        }
+        for (std::size_t c = 0; c < activeShards; c++) {
+            if (shards[c]->service.get() == &service) {
+                return shards[c].get();
+            }
+        }
+        return nullptr;
+    }
+
+    static bool reusePortSupported() noexcept {
+#ifdef SO_REUSEPORT
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void listen(asio::ip::tcp::acceptor &listener, const asio::ip::tcp::endpoint &endpoint, bool reusePort) {
+        if (wss::unixsocket::isAddress(config.address)) {
+            // AF_UNIX listener is driven by tcp acceptor: it only accepts descriptors, accepted sockets
+            // are read and written as any stream socket
+            const int fd = wss::unixsocket::listen(wss::unixsocket::getPath(config.address));
+            ErrorCode ec;
+            listener.assign(asio::ip::tcp::v4(), fd, ec);
+            if (ec) {
+                ::close(fd);
+                throw boost::system::system_error(ec);
+            }
+            return;
+        }
+        listener.open(endpoint.protocol());
+        listener.set_option(asio::socket_base::reuse_address(config.reuseAddress));
+#ifdef SO_REUSEPORT
+        if (reusePort) {
+            listener.set_option(asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+        }
+#endif
+        wss::socketopts::applyListener(listener, config.socket);
+        listener.bind(endpoint);
+        listener.listen(wss::socketopts::getBacklog(config.socket));
+    }
+
+    bool timeoutWheelEnabled() const noexcept {
+        return config.pingInterval > 0 || config.timeoutIdle > 0;
+    }
+
+    void timeoutWheelArm(TimeoutWheel &timeoutWheel) {
+        timeoutWheel.timer.expires_from_now(timeoutWheel.wheel.getTick());
+        timeoutWheel.timer.async_wait([this, &timeoutWheel](const ErrorCode &ec) {
+          if (ec) {
+              return;
+          }
+          timeoutWheelCheck(timeoutWheel);
+          timeoutWheelArm(timeoutWheel);
+        });
+    }
+
+    void loopMonitorArm(LoopMonitor &monitor) {
+        monitor.timer.expires_from_now(std::chrono::milliseconds(config.loopLagProbeMillis));
+        monitor.timer.async_wait([this, &monitor](const ErrorCode &ec) {
+          if (ec) {
+              return;
+          }
+          const auto postedAt = std::chrono::steady_clock::now();
+          // no-op is queued behind all ready handlers: its wait is how late any handler posted now would run
+          monitor.service.post([this, &monitor, postedAt] {
+            const auto lag = std::chrono::steady_clock::now() - postedAt;
+            monitor.lagMicros.store(std::chrono::duration_cast<std::chrono::microseconds>(lag).count(),
+                                    std::memory_order_relaxed);
+            wss::metrics::observe(wss::metrics::Histogram::EventLoopLag, lag);
+            if (&monitor == loopMonitors.front().get()) {
+                sampleExecutorBacklog();
+            }
+            // next probe is armed only now, so probes of overloaded loop don't pile up
+            loopMonitorArm(monitor);
+          });
+        });
+    }
+
+    /// \brief Reads executor backlog of up to LOOP_BACKLOG_SAMPLES connections, spread over all endpoints
+    void sampleExecutorBacklog() {
+        std::size_t sampled = 0;
+        std::size_t maxBacklog = 0;
+        std::size_t total = 0;
+        for (auto &pair: endpoint) {
+            pair.second.getConnectionsSnapshot().forEachSampled(
+                LOOP_BACKLOG_SAMPLES, backlogCursor, [&](const std::shared_ptr<Connection> &connection) {
+                  const std::size_t backlog = connection->executorBacklog.load(std::memory_order_relaxed);
+                  maxBacklog = std::max(maxBacklog, backlog);
+                  total += backlog;
+                  sampled++;
+                });
+        }
+        backlogCursor++;
+        backlogSampled.store(sampled, std::memory_order_relaxed);
+        backlogMax.store(maxBacklog, std::memory_order_relaxed);
+        backlogTotal.store(total, std::memory_order_relaxed);
+    }
+
+    /// \brief Adds connection to timeout wheel of its event loop
+    void timeoutWheelAdd(const std::shared_ptr<Connection> &connection, Endpoint &endpoint,
+                         std::chrono::steady_clock::time_point deadline) const {
+        if (timeoutWheels.empty() || !timeoutWheelEnabled()) {
+            return;
+        }
+
+        const std::size_t index = connection->shard ? connection->shard->index : 0;
+        if (index >= timeoutWheels.size()) {
+            return;
+        }
+        auto &timeoutWheel = *timeoutWheels[index];
+        TimeoutWheelLock lock(timeoutWheel.mutex);
+        timeoutWheel.wheel.schedule(TimeoutWheel::Entry(connection, &endpoint), deadline);
+    }
+
+    /// \brief Next wheel deadline of connection: idle timeout or keepalive ping, whichever is earlier
+    std::chrono::steady_clock::time_point timeoutWheelDeadline(const std::shared_ptr<Connection> &connection) const {
+        auto deadline = std::chrono::steady_clock::time_point::max();
+        if (connection->timeoutIdle > 0) {
+            deadline = connection->getLastIo() + std::chrono::seconds(connection->timeoutIdle);
+        }
+        const long pingInterval = config.pingInterval;
+        if (pingInterval > 0) {
+            // every unanswered ping moves deadline by one more interval
+            const auto pingDeadline = connection->getLastActivity()
+                + std::chrono::seconds(pingInterval * static_cast<long>(connection->unansweredPings() + 1))
+                - keepalivePhase(*connection);
+            deadline = std::min(deadline, pingDeadline);
+        }
+        return deadline;
+    }
+
+    /// \brief Per-connection keepalive offset in [0, pingInterval / 4): connection period differs by offset,
+    /// so pings of connections with the same last activity drift apart instead of hitting one tick every interval
+    std::chrono::milliseconds keepalivePhase(const Connection &connection) const noexcept {
+        const uint64_t window = static_cast<uint64_t>(config.pingInterval) * 1000 / 4;
+        if (window == 0) {
+            return std::chrono::milliseconds(0);
+        }
+        // sequential unique ids are spread by splitmix64 finalizer
+        uint64_t key = connection.getUniqueId();
+        key ^= key >> 30;
+        key *= 0xbf58476d1ce4e5b9ULL;
+        key ^= key >> 27;
+        key *= 0x94d049bb133111ebULL;
+        key ^= key >> 31;
+        return std::chrono::milliseconds(static_cast<int64_t>(key % window));
+    }
+
+    /// \brief Checks expired wheel entries, connection timestamps are bumped without touching wheel,
+    /// so active connections are just rescheduled by their next deadline.
+    /// Idle connections are closed, connections without incoming frames are pinged
+    /// and closed after pingMaxMissed unanswered pings.
+    void timeoutWheelCheck(TimeoutWheel &timeoutWheel) {
+        const auto now = std::chrono::steady_clock::now();
+        {
+            TimeoutWheelLock lock(timeoutWheel.mutex);
+            timeoutWheel.wheel.advance(now, [&timeoutWheel](TimeoutWheel::Entry &&entry) {
+              timeoutWheel.expired.push_back(std::move(entry));
+            });
+        }
+
+        for (auto &entry: timeoutWheel.expired) {
+            auto connection = entry.first.lock();
+            if (!connection || connection->closed) {
+                continue;
+            }
+
+            if (connection->timeoutIdle > 0
+                && now >= connection->getLastIo() + std::chrono::seconds(connection->timeoutIdle)) {
+                connection->sendClose(1000, "idle timeout"); // 1000=normal closure
+                continue;
+            }
+
+            const auto deadline = timeoutWheelDeadline(connection);
+            if (now < deadline) {
+                timeoutWheelAdd(connection, *entry.second, deadline);
+                continue;
+            }
+
+            // keepalive deadline
+            if (connection->unansweredPings() >= config.pingMaxMissed) {
+                const int status = 1000;
+                const std::string reason = "ping timeout";
+                connection->sendClose(status, reason);
+                connectionClose(connection, *entry.second, status, reason);
+                connection->close();
+                continue;
+            }
+
+            connection->unansweredPings()++;
+            // round trip is measured from first unanswered ping
+            int64_t noPing = 0;
+            connection->pingSentAt.compare_exchange_strong(noPing, Connection::nowMicros());
+            // fin_rsv_opcode=137: ping
+            connection->send(Frame::create(nullptr, 0, 137));
+            timeoutWheelAdd(connection, *entry.second, timeoutWheelDeadline(connection));
+        }
+        timeoutWheel.expired.clear();
+    }
+
+    /// \brief MSG_ZEROCOPY writes of large frames, if configured and supported. Plain connections only:
+    /// tls encrypts frames into own buffer anyway
+    void enableZeroCopy(const std::shared_ptr<Connection> &connection) const noexcept {
+        if (config.socket.zeroCopyMinBytes > 0 && !connection->socket->isSecure()
+            && wss::zerocopy::enable(connection->socket->lowest_layer().native_handle())) {
+            connection->zeroCopyMinBytes = config.socket.zeroCopyMinBytes;
+        }
     }
 
-    std::map<RegexOrderable, Endpoint> &getEndpoint() {
-        return endpoint;
+    /// \brief Applies send settings from config to new connection
+    void configureConnection(const std::shared_ptr<Connection> &connection) const noexcept {
+        connection->coalesceFrames = config.sendCoalesceFrames;
+        connection->coalesceBytes = config.sendCoalesceBytes;
+        connection->highWaterFrames = config.sendHighWaterFrames;
+        connection->highWaterBytes = config.sendHighWaterBytes;
+        connection->slowConsumerPolicy = config.slowConsumerPolicy;
+        connection->laneWeights[static_cast<std::size_t>(SendPriority::Normal)] = config.sendNormalWeight;
+        connection->laneWeights[static_cast<std::size_t>(SendPriority::Bulk)] = config.sendBulkWeight;
+        connection->inboundMessages.configure(config.inboundMessagesRate, config.inboundMessagesBurst);
+        connection->inboundBytes.configure(config.inboundBytesRate, config.inboundBytesBurst);
+        connection->queueMetrics = sendQueueMetrics;
     }
 
- protected:
-    /// Set before calling start().
-    Config config;
-    /// Warning: do not add or remove endpoints after start() is called
-    std::map<RegexOrderable, Endpoint> endpoint;
+    /// \brief Reads remote endpoint, with Config::proxyProtocol - from PROXY header. Header is read from tcp stream,
+    /// before TLS and websocket handshakes, exactly by its length: no bytes of next layer are taken.
+    /// Then source address is checked by admission limits
+    /// \param connection
+    /// \param next called with false if connection is closed because of invalid header or admission limits
+    void proxyHeaderRead(const std::shared_ptr<Connection> &connection, std::function<void(bool)> next) {
+        if (config.handshakeDeadlineMillis > 0) {
+            connection->handshakeDeadline =
+                std::chrono::steady_clock::now() + std::chrono::milliseconds(config.handshakeDeadlineMillis);
+        }
+        connection->readRemoteEndpoint();
+        if (config.proxyProtocol) {
+            proxyHeaderReadExact(connection, std::move(next));
+            return;
+        }
+        if (!config.localProxyProtocol || !isLocalPeer(connection)) {
+            next(admit(connection));
+            return;
+        }
 
-    bool internalIoService = false;
+        // optional header: first byte of PROXY signature is \r, websocket request starts with "GET"
+        connection->timeoutSet(config.timeoutRequest);
+        auto first = std::make_shared<uint8_t>(0);
+        connection->socket->stream_layer().async_receive(
+            asio::buffer(first.get(), 1),
+            asio::ip::tcp::socket::message_peek,
+            [this, connection, next, first](const ErrorCode &ec, std::size_t) {
+              auto lock = connection->handlerRunner->continueLock();
+              if (!lock) {
+                  return;
+              }
+              if (ec) {
+                  connection->timeoutCancel();
+                  connection->close();
+                  next(false);
+                  return;
+              }
+              if (*first == 0x0D) {
+                  proxyHeaderReadExact(connection, next);
+                  return;
+              }
+              connection->timeoutCancel();
+              next(admit(connection));
+            });
+    }
 
-    std::unique_ptr<asio::ip::tcp::acceptor> acceptor;
-    boost::thread_group threadGroup;
+    /// \brief Whether connection is opened from this host: loopback or own address of listener
+    static bool isLocalPeer(const std::shared_ptr<Connection> &connection) {
+        const asio::ip::address &address = connection->remoteEndpoint.address();
+        if (address.is_unspecified()) {
+            return false;
+        }
+        if (address.is_loopback()) {
+            return true;
+        }
+        ErrorCode ec;
+        const asio::ip::tcp::endpoint local = connection->socket->stream_layer().local_endpoint(ec);
+        return !ec && local.address() == address;
+    }
 
-    std::shared_ptr<ScopeRunner> handlerRunner;
+    void proxyHeaderReadExact(const std::shared_ptr<Connection> &connection, std::function<void(bool)> next) {
+        connection->timeoutSet(config.timeoutRequest);
+        asio::async_read(
+            connection->socket->stream_layer(),
+            *connection->readBuffer,
+            asio::transfer_exactly(ProxyProtocol::HEADER_BYTES),
+            [this, connection, next](const ErrorCode &ec, std::size_t) {
+              auto lock = connection->handlerRunner->continueLock();
+              if (!lock) {
+                  return;
+              }
+              std::size_t bodyBytes = 0;
+              if (ec || !ProxyProtocol::parseHeader(
+                  asio::buffer_cast<const uint8_t *>(connection->readBuffer->data()), bodyBytes)) {
+                  proxyHeaderReject(connection, next);
+                  return;
+              }
+              asio::async_read(
+                  connection->socket->stream_layer(),
+                  *connection->readBuffer,
+                  asio::transfer_exactly(bodyBytes),
+                  [this, connection, next, bodyBytes](const ErrorCode &ec, std::size_t) {
+                    auto lock = connection->handlerRunner->continueLock();
+                    if (!lock) {
+                        return;
+                    }
+                    const auto *header = asio::buffer_cast<const uint8_t *>(connection->readBuffer->data());
+                    asio::ip::tcp::endpoint source;
+                    const ProxyProtocol::Status status = ec
+                                                         ? ProxyProtocol::Status::Invalid
+                                                         : ProxyProtocol::parseBody(
+                            header, header + ProxyProtocol::HEADER_BYTES, bodyBytes, source);
+                    if (status == ProxyProtocol::Status::Invalid) {
+                        proxyHeaderReject(connection, next);
+                        return;
+                    }
+                    connection->timeoutCancel();
+                    connection->readBuffer->consume(ProxyProtocol::HEADER_BYTES + bodyBytes);
+                    if (status == ProxyProtocol::Status::Proxied) {
+                        connection->remoteEndpoint = source;
+                    }
+                    next(admit(connection));
+                  });
+            });
+    }
 
-    SocketServerBase(unsigned short port) noexcept: config(port), handlerRunner(new ScopeRunner()) { }
+    /// \brief Takes slot of connection source address
+    /// \param connection
+    /// \return false if source is over limits: connection is closed
+    bool admit(const std::shared_ptr<Connection> &connection) {
+        if (!admission->isEnabled()) {
+            return true;
+        }
+        const ConnectionAdmission::Result result =
+            admission->admit(connection->remoteEndpoint.address(), connection->admissionTicket);
+        if (result == ConnectionAdmission::Result::Accepted) {
+            return true;
+        }
+        wss::metrics::add(result == ConnectionAdmission::Result::TooManyConnections
+                          ? wss::metrics::Counter::AdmissionRejectedConnections
+                          : wss::metrics::Counter::AdmissionRejectedRate);
+        connection->close();
+        return false;
+    }
 
-    void handshakeRead(const std::shared_ptr<Connection> &connection) {
-        connection->readRemoteEndpoint();
+    void proxyHeaderReject(const std::shared_ptr<Connection> &connection, const std::function<void(bool)> &next) {
+        connection->timeoutCancel();
+        wss::metrics::add(wss::metrics::Counter::ProxyHeaderRejected);
+        connection->close();
+        next(false);
+    }
 
+    void handshakeRead(const std::shared_ptr<Connection> &connection) {
         connection->timeoutSet(config.timeoutRequest);
-        // reading handshake headers until \r\n\r\n
-        connection->socket->async_read_until(
-            connection->readBuffer,
-            "\r\n\r\n",
-            [this, connection](const ErrorCode &ec, std::size_t /*bytes_transferred*/) {
+        // reading handshake headers until \r\n\r\n, not a websocket upgrade or too large request stops read early
+        connection->socket->async_read_until_match(
+            *connection->readBuffer,
+            HandshakeHeadCondition(config.maxHandshakeBytes),
+            [this, connection](const ErrorCode &ec, std::size_t bytesTransferred) {
               connection->timeoutCancel();
               auto lock = connection->handlerRunner->continueLock();
               if (!lock)
                   return;
+              if (!ec && !HandshakeHeadCondition::isComplete(
+                  asio::buffer_cast<const char *>(connection->readBuffer->data()), bytesTransferred)) {
+                  wss::metrics::add(wss::metrics::Counter::HandshakeRejected);
+                  if (bytesTransferred >= 4
+                      && std::memcmp(asio::buffer_cast<const char *>(connection->readBuffer->data()), "GET ", 4) == 0) {
+                      handshakeReject(connection, "431 Request Header Fields Too Large");
+                  } else {
+                      connection->close();
+                  }
+                  return;
+              }
               if (!ec) {
-                  std::istream stream(&connection->readBuffer);
-                  if (RequestMessage::parse(stream,
-                                            connection->method,
-                                            connection->path,
-                                            connection->queryString,
-                                            connection->httpVersion,
-                                            connection->header))
-
+                  // headers are parsed right from read buffer, bytes after \r\n\r\n (if any) stay there
+                  const bool parsed = RequestMessage::parse(
+                      asio::buffer_cast<const char *>(connection->readBuffer->data()),
+                      bytesTransferred,
+                      connection->handshake->method,
+                      connection->handshake->path,
+                      connection->handshake->queryString,
+                      connection->handshake->httpVersion,
+                      connection->handshake->header);
+                  connection->readBuffer->consume(bytesTransferred);
+
+                  if (parsed)
                       // after success incoming handshake, sending server handshake
                       handshakeWrite(connection);
               }
@@ -565,11 +2437,17 @@ class SocketServerBase : public BaseServer {
     void handshakeWrite(const std::shared_ptr<Connection> &connection) {
         for (auto &regexEndpoint : endpoint) {
             regexns::smatch pathMatch;
-            if (regexns::regex_match(connection->path, pathMatch, regexEndpoint.first)) {
+            if (regexEndpoint.first.match(connection->handshake->path, pathMatch)) {
+                if (regexEndpoint.second.onUpgrade && !regexEndpoint.second.onUpgrade(connection)) {
+                    handshakeReject(connection, "503 Service Unavailable");
+                    return;
+                }
                 auto writeBuffer = std::make_shared<asio::streambuf>();
 
-                if (connection->handshakeGenerate(writeBuffer)) {
-                    connection->pathMatch = std::move(pathMatch);
+                if (connection->handshakeGenerate(writeBuffer,
+                                                 regexEndpoint.second.deflateOptions,
+                                                 regexEndpoint.second.subprotocols)) {
+                    connection->handshake->pathMatch = std::move(pathMatch);
                     connection->timeoutSet(config.timeoutRequest);
                     connection->socket->async_write(
                         *writeBuffer,
@@ -581,7 +2459,10 @@ class SocketServerBase : public BaseServer {
                           }
 
                           if (!ec) {
+                              connection->handshakeDeadline = std::chrono::steady_clock::time_point();
                               onConnectionOpen(connection, regexEndpoint.second);
+                              // headers, path and query are not needed for the rest of connection life
+                              connection->handshake.reset();
                               readMessage(connection, regexEndpoint.second);
                           } else
                               onConnectionError(connection, regexEndpoint.second, ec);
@@ -592,205 +2473,331 @@ class SocketServerBase : public BaseServer {
         }
     }
 
+    /// \brief Answers upgrade request with http status, without body, and closes connection
+    void handshakeReject(const std::shared_ptr<Connection> &connection, const char *status) {
+        auto writeBuffer = std::make_shared<asio::streambuf>();
+        std::ostream response(writeBuffer.get());
+        response << "HTTP/1.1 " << status << "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        connection->timeoutSet(config.timeoutRequest);
+        connection->socket->async_write(*writeBuffer, [connection, writeBuffer](const ErrorCode &, std::size_t) {
+          connection->timeoutCancel();
+          auto lock = connection->handlerRunner->continueLock();
+          if (!lock) {
+              return;
+          }
+          connection->close();
+        });
+    }
+
+    /// \brief Handles frames already buffered, then reads more. Frames pipelined by client are taken from one read
     void readMessage(const std::shared_ptr<Connection> &connection, Endpoint &endpoint) const {
         connection->strand.post([this, connection, &endpoint] {
-          // first read - detecting size
-          connection->socket->async_read(
-              connection->readBuffer,
-              asio::transfer_exactly(2),
-              connection->strand.wrap([this, connection, &endpoint](const ErrorCode &ec,
-                                                                    std::size_t bytesTransferred) {
-                auto lock = connection->handlerRunner->continueLock();
-                if (!lock) {
-                    return;
-                }
-
-                if (ec) {
-                    onConnectionError(connection, endpoint, ec);
-                    return;
-                }
-
-                if (bytesTransferred == 0) { // TODO: why does this happen sometimes?
-                    readMessage(connection, endpoint);
-                    return;
-                }
-
-                std::istream stream(&connection->readBuffer);
-
-                std::vector<unsigned char> firstBytes(2);
-                stream.read((char *) &firstBytes[0], 2);
+          readFrames(connection, endpoint);
+        });
+    }
 
-                unsigned char fin_rsv_opcode = firstBytes[0];
+    enum class FrameRead {
+      Handled,
+      /// \brief Frame is not complete yet, more bytes must be read
+      Incomplete,
+      /// \brief Connection is closed (close frame or protocol error), reading stops
+      Closed
+    };
 
-                // Close connection if unmasked message from client (protocol error)
-                if (firstBytes[1] < 128) {
-                    const std::string reason("message from client not masked");
-                    connection->sendClose(1002, reason);
-                    connectionClose(connection, endpoint, 1002, reason);
-                    return;
-                }
+    void readFrames(const std::shared_ptr<Connection> &connection, Endpoint &endpoint) const {
+        std::size_t missing = 0;
+        FrameRead result;
+        while ((result = readFrame(connection, endpoint, missing)) == FrameRead::Handled) { }
+        if (result == FrameRead::Closed) {
+            return;
+        }
 
-                std::size_t length = (firstBytes[1] & 127u);
-
-                if (length == 126) {
-                    // if length == 126 means
-                    // 2 next bytes is the size of content
-                    connection->socket->async_read(
-                        connection->readBuffer,
-                        asio::transfer_exactly(2),
-                        [this, connection, &endpoint, fin_rsv_opcode](const ErrorCode &ec, std::size_t) {
-                          auto sublock = connection->handlerRunner->continueLock();
-                          if (!sublock) {
-                              return;
-                          }
+        auto &readBuffer = connection->readBuffer;
+        if (readBuffer->size() == 0 && config.readBufferRetainBytes > 0
+            && connection->readBufferBytes > std::max(config.readBufferRetainBytes, config.readChunkBytes)) {
+            // one big upload must not keep its memory for the rest of session
+            readBuffer.reset(new asio::streambuf());
+            connection->releaseReadBuffer();
+        }
 
-                          if (ec) {
-                              onConnectionError(connection, endpoint, ec);
-                              return;
-                          }
+        // single read takes all received bytes up to chunk size, rest of large frame is read by steps:
+        // declared length doesn't allocate memory before payload comes
+        const std::size_t readSize = std::max(config.readChunkBytes, std::min(missing, READ_STEP_MAX_BYTES));
+        auto buffer = readBuffer->prepare(readSize);
+        connection->accountReadBuffer(readBuffer->size() + readSize);
+        connection->socket->async_read_some(
+            buffer,
+            connection->strand.wrap([this, connection, &endpoint](const ErrorCode &ec, std::size_t bytesTransferred) {
+              auto lock = connection->handlerRunner->continueLock();
+              if (!lock) {
+                  return;
+              }
 
-                          std::istream readStream(&connection->readBuffer);
+              if (ec) {
+                  onConnectionError(connection, endpoint, ec);
+                  return;
+              }
 
-                          std::vector<unsigned char> lengthBytes(2);
-                          readStream.read((char *) &lengthBytes[0], 2);
+              connection->readBuffer->commit(bytesTransferred);
+              readFrames(connection, endpoint);
+            }));
+    }
 
-                          std::size_t toReadLength = 0;
-                          std::size_t numBytes = 2;
-                          for (std::size_t c = 0; c < numBytes; c++) {
-                              toReadLength +=
-                                  static_cast<std::size_t>(lengthBytes[c]) << (8 * (numBytes - 1 - c));
-                          }
+    /// \brief Handles first frame of read buffer. Frame header is parsed and checked once,
+    /// its payload may be completed by next reads
+    /// \param connection
+    /// \param endpoint
+    /// \param missing bytes lacking to complete header, mask or payload, if frame is Incomplete
+    /// \return
+    FrameRead readFrame(const std::shared_ptr<Connection> &connection, Endpoint &endpoint,
+                        std::size_t &missing) const {
+        asio::streambuf &buffer = *connection->readBuffer;
+        FrameHeader &header = connection->frameHeader;
+
+        if (!header.parsed) {
+            const std::size_t available = buffer.size();
+            if (available < 2) {
+                missing = 2 - available;
+                return FrameRead::Incomplete;
+            }
 
-                          // now we know real content length, reading whole message
-                          readMessageContent(connection, toReadLength, endpoint, fin_rsv_opcode);
-                        });
+            const auto *data = asio::buffer_cast<const uint8_t *>(buffer.data());
+            const unsigned char fin_rsv_opcode = data[0];
 
-                } else if (length == 127) {
-                    // 8 next bytes is the size of content
-                    connection->socket->async_read(
-                        connection->readBuffer,
-                        asio::transfer_exactly(8),
-                        [this, connection, &endpoint, fin_rsv_opcode](const ErrorCode &ec, std::size_t) {
-                          auto lock = connection->handlerRunner->continueLock();
-                          if (!lock) {
-                              return;
-                          }
+            // Close connection if unmasked message from client (protocol error)
+            if (data[1] < 128) {
+                const std::string reason("message from client not masked");
+                connection->sendClose(1002, reason);
+                connectionClose(connection, endpoint, 1002, reason);
+                return FrameRead::Closed;
+            }
 
-                          if (ec) {
-                              onConnectionError(connection, endpoint, ec);
-                              return;
-                          }
+            // RSV1 is allowed only for permessage-deflate compressed data messages (first frame)
+            const uint8_t opcode = fin_rsv_opcode & 0x0fu;
+            if ((fin_rsv_opcode & 0x40u) && (!connection->permessageDeflate || opcode == 0 || opcode >= 8)) {
+                protocolError(connection, endpoint, "invalid rsv1 bit");
+                return FrameRead::Closed;
+            }
 
-                          std::istream readStream(&connection->readBuffer);
+            // RFC 6455 5.5: control frames are not fragmented and carry at most 125 bytes (no extended length)
+            if (opcode >= 8 && (!(fin_rsv_opcode & 0x80u) || (data[1] & 127u) > 125)) {
+                protocolError(connection, endpoint, "invalid control frame");
+                return FrameRead::Closed;
+            }
 
-                          std::vector<unsigned char> lengthBytes(8);
-                          readStream.read((char *) &lengthBytes[0], 8);
+            // 126: 2 next bytes is the size of content, 127: 8 next bytes
+            std::size_t length = (data[1] & 127u);
+            const std::size_t lengthBytes = length == 126 ? 2 : (length == 127 ? 8 : 0);
+            if (available < 2 + lengthBytes) {
+                missing = 2 + lengthBytes - available;
+                return FrameRead::Incomplete;
+            }
+            if (lengthBytes > 0) {
+                length = 0;
+                for (std::size_t c = 0; c < lengthBytes; c++) {
+                    length = (length << 8u) | data[2 + c];
+                }
+            }
+            buffer.consume(2 + lengthBytes);
 
-                          std::size_t toReadLength = 0;
-                          std::size_t num_bytes = 8;
-                          for (std::size_t c = 0; c < num_bytes; c++) {
-                              toReadLength +=
-                                  static_cast<std::size_t>(lengthBytes[c]) << (8 * (num_bytes - 1 - c));
-                          }
+            if (!checkFrameLimits(connection, endpoint, length, fin_rsv_opcode)) {
+                return FrameRead::Closed;
+            }
+            header.parsed = true;
+            header.fin_rsv_opcode = fin_rsv_opcode;
+            header.length = length;
+        }
 
-                          // now we know real content length, reading whole message
-                          readMessageContent(connection, toReadLength, endpoint, fin_rsv_opcode);
-                        });
-                } else {
-                    // real message content length is that length that we have now
-                    readMessageContent(connection, length, endpoint, fin_rsv_opcode);
-                }
-              }));
-        });
+        // mask and payload, declared length can be up to size_t max
+        if (buffer.size() < 4 || buffer.size() - 4 < header.length) {
+            missing = buffer.size() < 4 ? 4 - buffer.size() : header.length - (buffer.size() - 4);
+            return FrameRead::Incomplete;
+        }
+        header.parsed = false;
+        return readMessageContent(connection, header.length, endpoint, header.fin_rsv_opcode)
+               ? FrameRead::Handled
+               : FrameRead::Closed;
     }
 
-    void readMessageContent(
+    /// \brief Checks fragmented message limits on every fragment header, before payload is read
+    /// \return false if connection is closed
+    bool checkFrameLimits(
         const std::shared_ptr<Connection> &connection,
-        std::size_t length,
         Endpoint &endpoint,
+        std::size_t length,
         unsigned char fin_rsv_opcode) const {
-        if (length > config.maxMessageSize) {
+        const uint8_t frameOpcode = fin_rsv_opcode & 0x0fu;
+        std::size_t messageSize = length;
+        std::size_t fragments = 1;
+        if (frameOpcode == 0) {
+            messageSize += connection->fragmentedSize;
+            fragments += connection->fragmentCount;
+        }
+        if (frameOpcode < 8) {
+            const bool fin = (fin_rsv_opcode & 0x80u) != 0;
+            connection->fragmentedSize = fin ? 0 : messageSize;
+            connection->fragmentCount = fin ? 0 : static_cast<uint32_t>(fragments);
+        }
+
+        if (frameOpcode < 8 && config.maxMessageFragments > 0 && fragments > config.maxMessageFragments) {
+            onConnectionError(connection, endpoint, make_error_code::make_error_code(errc::message_size));
+            const int status = 1008;
+            const std::string reason = "too many message fragments";
+            connection->sendClose(status, reason);
+            connectionClose(connection, endpoint, status, reason);
+            return false;
+        }
+
+        if (messageSize > config.maxMessageSize) {
             onConnectionError(connection, endpoint, make_error_code::make_error_code(errc::message_size));
             const int status = 1009;
             const std::string reason = "message too big";
             connection->sendClose(status, reason);
             connectionClose(connection, endpoint, status, reason);
-            return;
+            return false;
         }
+        return true;
+    }
 
-        connection->strand.post([this, connection, &endpoint, length, fin_rsv_opcode] {
-          connection->socket->async_read(
-              connection->readBuffer,
-              asio::transfer_exactly(4 + length),
-              [this, connection, length, &endpoint, fin_rsv_opcode](const ErrorCode &ec, std::size_t) {
-                auto lock = connection->handlerRunner->continueLock();
-                if (!lock) {
-                    return;
-                }
+    /// \brief Unmasks complete frame (mask and payload are in read buffer) and dispatches it
+    /// \return false if connection is closed
+    bool readMessageContent(
+        const std::shared_ptr<Connection> &connection,
+        std::size_t length,
+        Endpoint &endpoint,
+        unsigned char fin_rsv_opcode) const {
+        // streambuf input sequence is contiguous, so unmasking directly from it
+        const auto *rawMessageData = asio::buffer_cast<const uint8_t *>(connection->readBuffer->data());
 
-                if (ec) {
-                    onConnectionError(connection, endpoint, ec);
-                    return;
-                }
+        // Read mask
+        uint8_t mask[4];
+        std::memcpy(mask, rawMessageData, 4);
 
-                std::istream rawMessageData(&connection->readBuffer);
+        const uint8_t opcode = fin_rsv_opcode & 0x0fu;
+        const bool fin = (fin_rsv_opcode & 0x80u) != 0;
 
-                // Read mask
-                std::vector<uint8_t> mask(4);
-                rawMessageData.read((char *) &mask[0], 4);
+        std::shared_ptr<Message> message;
+        if (opcode == 0) {
+            if (!connection->fragmentedMessage) {
+                protocolError(connection, endpoint, "unexpected continuation frame");
+                return false;
+            }
+            message = connection->fragmentedMessage;
+        } else {
+            if (opcode < 8 && connection->fragmentedMessage) {
+                protocolError(connection, endpoint, "expected continuation frame");
+                return false;
+            }
 
-                std::shared_ptr<Message> message(new Message());
-                message->length = length;
+            message = std::allocate_shared<Message>(wss::utils::PoolAllocator<Message>());
+            message->length = 0;
+            if (opcode < 8) {
+                // consumers see whole plain message as single frame
+                message->fin_rsv_opcode = static_cast<unsigned char>((fin_rsv_opcode | 0x80u) & ~0x40u);
+                if (!fin) {
+                    connection->fragmentedMessage = message;
+                }
+            } else {
                 message->fin_rsv_opcode = fin_rsv_opcode;
+            }
+        }
 
-                std::ostream messageDataOutStream(&message->streambuf);
-                for (std::size_t c = 0; c < length; c++) {
-                    messageDataOutStream.put(rawMessageData.get() ^ mask[c % 4]);
-                }
+        // permessage-deflate: RSV1 on first frame marks whole message (all its fragments) as compressed
+        if (connection->permessageDeflate && opcode != 0 && opcode < 8) {
+            connection->inflatingMessage = (fin_rsv_opcode & 0x40u) != 0;
+        }
 
-                // If connection close
-                if ((fin_rsv_opcode & 0x0f) == 8) {
-                    int status = 0;
-                    if (length >= 2) {
-                        unsigned char byte1 = static_cast<unsigned char>(message->get());
-                        unsigned char byte2 = static_cast<unsigned char>(message->get());
-                        status = (byte1 << 8) + byte2;
-                    }
+        if (connection->permessageDeflate && opcode < 8 && connection->inflatingMessage) {
+            std::vector<uint8_t> deflated(length);
+            wss::utils::unmask(deflated.data(), rawMessageData + 4, length, mask);
+            connection->readBuffer->consume(4 + length);
+
+            std::string inflated;
+            if (!connection->permessageDeflate->decompress(deflated.data(), length, fin, inflated,
+                                                           config.maxMessageSize - message->length)) {
+                onConnectionError(connection, endpoint, make_error_code::make_error_code(errc::message_size));
+                const int status = 1009;
+                const std::string reason = "unable to decompress message or message too big";
+                connection->sendClose(status, reason);
+                connectionClose(connection, endpoint, status, reason);
+                return false;
+            }
+            if (fin) {
+                connection->inflatingMessage = false;
+            }
 
-                    auto reason = message->string();
-                    connection->sendClose(status, reason);
-                    connectionClose(connection, endpoint, status, reason);
-                    return;
-                } else {
-                    // If ping
-                    if ((fin_rsv_opcode & 0x0f) == 9) {
-                        // Send pong
-                        auto empty_send_stream = std::make_shared<SendStream>();
-                        connection->send(std::move(empty_send_stream),
-                                         nullptr,
-                                         static_cast<unsigned char>(fin_rsv_opcode + 1));
-                    } else if (endpoint.onMessage) {
-                        connection->timeoutCancel();
-                        connection->timeoutSet();
-                        endpoint.onMessage(connection, message);
-                    }
+            auto messageData = message->streambuf.prepare(inflated.size());
+            std::memcpy(asio::buffer_cast<uint8_t *>(messageData), inflated.data(), inflated.size());
+            message->streambuf.commit(inflated.size());
+            message->length += inflated.size();
+        } else {
+            // fragments are appended to the same buffer, it grows geometrically
+            auto messageData = message->streambuf.prepare(length);
+            wss::utils::unmask(asio::buffer_cast<uint8_t *>(messageData), rawMessageData + 4, length, mask);
+            message->streambuf.commit(length);
+            message->length += length;
+            connection->readBuffer->consume(4 + length);
+        }
 
-                    // Next message
-                    readMessage(connection, endpoint);
-                }
+        if (opcode < 8 && !fin) {
+            // waiting for next fragment
+            connection->setFragmentBufferBytes(message->length);
+            connection->touch();
+            return true;
+        }
+        if (opcode == 0) {
+            connection->fragmentedMessage.reset();
+            connection->setFragmentBufferBytes(0);
+        }
 
-              });
-        });
+        connection->touch();
+
+        // If connection close
+        if ((fin_rsv_opcode & 0x0f) == 8) {
+            int status = 0;
+            if (length >= 2) {
+                unsigned char byte1 = static_cast<unsigned char>(message->get());
+                unsigned char byte2 = static_cast<unsigned char>(message->get());
+                status = (byte1 << 8) + byte2;
+            }
+
+            auto reason = message->string();
+            connection->sendClose(status, reason);
+            connectionClose(connection, endpoint, status, reason);
+            return false;
+        }
+
+        // If ping
+        if ((fin_rsv_opcode & 0x0f) == 9) {
+            // Send pong with the same application data
+            // control frame payload is at most 125 bytes, so pong is always inline
+            connection->send(Frame::create(message->data(),
+                                           message->view().size(),
+                                           static_cast<unsigned char>(fin_rsv_opcode + 1)));
+        } else if ((fin_rsv_opcode & 0x0f) == 10) {
+            // Pong: keepalive is handled by touch() above
+            connection->pongReceived();
+        } else if (endpoint.onMessage) {
+            // message is complete: latency stages of its payload are measured from here
+            message->receivedAt = std::chrono::steady_clock::now();
+            endpoint.onMessage(connection, message);
+        }
+        return true;
+    }
+
+    void protocolError(const std::shared_ptr<Connection> &connection, Endpoint &endpoint,
+                       const std::string &reason) const {
+        connection->fragmentedMessage.reset();
+        connection->setFragmentBufferBytes(0);
+        connection->sendClose(1002, reason);
+        connectionClose(connection, endpoint, 1002, reason);
     }
 
     void onConnectionOpen(const std::shared_ptr<Connection> &connection, Endpoint &endpoint) const {
-        connection->timeoutCancel();
-        connection->timeoutSet();
+        connection->touch();
+        timeoutWheelAdd(connection, endpoint, timeoutWheelDeadline(connection));
 
-        {
-            std::unique_lock<std::mutex> lock(endpoint.connectionsMutex);
-            endpoint.connections.insert(connection);
-        }
+        endpoint.addConnection(connection);
 
         if (endpoint.onOpen)
             endpoint.onOpen(connection);
@@ -802,12 +2809,8 @@ class SocketServerBase : public BaseServer {
         int status,
         const std::string &reason) const {
         connection->timeoutCancel();
-        connection->timeoutSet();
 
-        {
-            std::unique_lock<std::mutex> lock(endpoint.connectionsMutex);
-            endpoint.connections.erase(connection);
-        }
+        endpoint.removeConnection(connection);
 
         if (endpoint.onClose)
             endpoint.onClose(connection, status, reason);
@@ -818,12 +2821,8 @@ class SocketServerBase : public BaseServer {
         Endpoint &endpoint,
         const ErrorCode &ec) const {
         connection->timeoutCancel();
-        connection->timeoutSet();
 
-        {
-            std::unique_lock<std::mutex> lock(endpoint.connectionsMutex);
-            endpoint.connections.erase(connection);
-        }
+        endpoint.removeConnection(connection);
 
         if (endpoint.onError) {
             endpoint.onError(connection, ec);
@@ -831,28 +2830,96 @@ class SocketServerBase : public BaseServer {
     }
 };
 
+inline std::shared_ptr<const SocketServerBase::Frame> SocketServerBase::Frame::create(const char *data,
+                                                                                     std::size_t length,
+                                                                                     uint8_t fin_rsv_opcode) {
+    if (length <= INLINE_PAYLOAD_SIZE) {
+        return std::allocate_shared<const InlineFrame>(wss::utils::PoolAllocator<InlineFrame>(),
+                                                       data,
+                                                       length,
+                                                       fin_rsv_opcode);
+    }
+
+    auto messageStream = std::allocate_shared<SendStream>(wss::utils::PoolAllocator<SendStream>());
+    messageStream->write(data, length);
+    return make(std::move(messageStream), fin_rsv_opcode);
+}
+
 /// @TODO socket wrapper instead of templates
 class SocketServer : public SocketServerBase {
  public:
     SocketServer() noexcept : SocketServerBase((uint16_t) 80) { }
 
- protected:
-    void accept() override {
-        std::shared_ptr<Connection> connection(new Connection(handlerRunner, config.timeoutIdle, *ioService));
+    /// \brief Takes socket of connection accepted by other process (see Config::externalAccept).
+    /// Socket is closed if server doesn't accept connections. Thread safe
+    /// \param fd connected socket, owned by server after call
+    void adopt(int fd) {
+        sockaddr_storage local{};
+        socklen_t length = sizeof(local);
+        if (!accepting || ::getsockname(fd, reinterpret_cast<sockaddr *>(&local), &length) != 0) {
+            ::close(fd);
+            return;
+        }
+
+        Shard *shard = acceptShard(*ioService);
+        wss::io_context_service &service = shard ? *shard->service : *ioService;
+        auto connection = std::allocate_shared<Connection>(wss::utils::PoolAllocator<Connection>(),
+                                                           handlerRunner, config.timeoutIdle, service);
+        connection->shard = shard;
+        configureConnection(connection);
+
+        ErrorCode ec;
+        connection->socket->lowest_layer().assign(local.ss_family == AF_INET6 ? asio::ip::tcp::v6() : asio::ip::tcp::v4(),
+                                                  fd, ec);
+        if (ec) {
+            ::close(fd);
+            return;
+        }
+        // socket is used only by its event loop
+        service.post([this, connection] {
+          auto lock = connection->handlerRunner->continueLock();
+          if (!lock)
+              return;
+          wss::socketopts::apply(connection->socket->lowest_layer(), config.socket);
+          enableZeroCopy(connection);
+          proxyHeaderRead(connection, [this, connection](bool valid) {
+            if (valid) {
+                handshakeRead(connection);
+            }
+          });
+        });
+    }
 
-        acceptor->async_accept(connection->socket->lowest_layer(), [this, connection](const ErrorCode &ec) {
+ protected:
+    using SocketServerBase::accept;
+
+    void accept(asio::ip::tcp::acceptor &listener, wss::io_context_service &service) override {
+        Shard *shard = acceptShard(service);
+        // connection and its control block come from thread local pool: no malloc on reconnect storms
+        auto connection = std::allocate_shared<Connection>(wss::utils::PoolAllocator<Connection>(),
+                                                           handlerRunner,
+                                                           config.timeoutIdle,
+                                                           shard ? *shard->service : service);
+        connection->shard = shard;
+        configureConnection(connection);
+
+        listener.async_accept(connection->socket->lowest_layer(), [this, connection, &listener, &service](const ErrorCode &ec) {
           auto lock = connection->handlerRunner->continueLock();
           if (!lock)
               return;
           // Immediately start accepting a new connection (if ioService hasn't been stopped)
-          if (ec != asio::error::operation_aborted)
-              accept();
+          if (ec != asio::error::operation_aborted && accepting)
+              accept(listener, service);
 
           if (!ec) {
-              asio::ip::tcp::no_delay option(true);
-              connection->socket->set_option(option);
+              wss::socketopts::apply(connection->socket->lowest_layer(), config.socket);
+              enableZeroCopy(connection);
 
-              handshakeRead(connection);
+              proxyHeaderRead(connection, [this, connection](bool valid) {
+                if (valid) {
+                    handshakeRead(connection);
+                }
+              });
           }
         });
     }
@@ -861,6 +2928,18 @@ class SocketServer : public SocketServerBase {
 class SocketServerSecure : public SocketServerBase {
 
  public:
+    /// \brief TLS session resumption settings. Set before start()
+    struct SessionConfig {
+      /// \brief Server side session cache size (shared by all threads), 0 - disable session cache
+      long cacheSize = SSL_SESSION_CACHE_MAX_SIZE_DEFAULT;
+      /// \brief Session and ticket lifetime in seconds
+      long timeout = 300;
+      /// \brief Enable RFC 5077 session tickets
+      bool tickets = true;
+      /// \brief Ticket key rotation interval in seconds, 0 - key is generated once on start
+      long ticketKeyRotation = 3600;
+    };
+
     SocketServerSecure(const std::string &certFile,
                        const std::string &privateKeyFile,
                        const std::string &verifyFile = std::string())
@@ -890,45 +2969,163 @@ class SocketServerSecure : public SocketServerBase {
                 (unsigned int) std::min<std::size_t>(sessionIdContext.size(), SSL_MAX_SSL_SESSION_ID_LENGTH)
             );
         }
+        configureSessions();
+        {
+            std::unique_lock<std::mutex> lock(handshakeMutex);
+            handshakesInFlight = 0;
+            pausedListeners.clear();
+        }
         SocketServerBase::start();
     }
 
+    SessionConfig &getSessionConfig() {
+        return sessionConfig;
+    }
+
+    /// \brief TLS handshakes and resumption counters
+    const TlsSessionMetrics &getTlsSessionMetrics() const {
+        return tlsSessionMetrics;
+    }
+
  protected:
     std::string sessionIdContext;
     bool setSessionIdContext = false;
     asio::ssl::context context;
+    SessionConfig sessionConfig;
+    TlsSessionMetrics tlsSessionMetrics;
+    std::unique_ptr<TlsSessionTickets> sessionTickets;
+
+    /// \brief Guards handshakesInFlight and pausedListeners
+    std::mutex handshakeMutex;
+    std::size_t handshakesInFlight = 0;
+    /// \brief Listeners that stopped accepting because of maxConcurrentHandshakes
+    std::vector<std::pair<asio::ip::tcp::acceptor *, wss::io_context_service *>> pausedListeners;
+
+    /// \brief Takes handshake slot for just accepted connection
+    /// \return false if limit is reached and listener is paused, it will be resumed by handshakeEnd()
+    bool handshakeBegin(asio::ip::tcp::acceptor &listener, wss::io_context_service &service) {
+        if (config.maxConcurrentHandshakes == 0) {
+            return true;
+        }
 
-    void accept() override {
-        std::shared_ptr<Connection>
-            connection(new Connection(handlerRunner, config.timeoutIdle, *ioService, context));
+        std::unique_lock<std::mutex> lock(handshakeMutex);
+        handshakesInFlight++;
+        if (handshakesInFlight < config.maxConcurrentHandshakes) {
+            return true;
+        }
+        pausedListeners.emplace_back(&listener, &service);
+        return false;
+    }
+
+    /// \brief Releases handshake slot and resumes one paused listener
+    void handshakeEnd() {
+        if (config.maxConcurrentHandshakes == 0) {
+            return;
+        }
+
+        std::pair<asio::ip::tcp::acceptor *, wss::io_context_service *> resume(nullptr, nullptr);
+        {
+            std::unique_lock<std::mutex> lock(handshakeMutex);
+            if (handshakesInFlight > 0) {
+                handshakesInFlight--;
+            }
+            if (!pausedListeners.empty() && handshakesInFlight < config.maxConcurrentHandshakes) {
+                resume = pausedListeners.back();
+                pausedListeners.pop_back();
+            }
+        }
+
+        if (resume.first != nullptr) {
+            // listener is used only by its own io_service threads
+            resume.second->post([this, resume] {
+              if (accepting) {
+                  accept(*resume.first, *resume.second);
+              }
+            });
+        }
+    }
+
+    void configureSessions() {
+        SSL_CTX *ctx = context.native_handle();
+
+        if (sessionConfig.cacheSize > 0) {
+            // OpenSSL internal cache is locked by itself, so it is shared by all io threads
+            SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+            SSL_CTX_sess_set_cache_size(ctx, sessionConfig.cacheSize);
+        } else {
+            SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+        }
+        SSL_CTX_set_timeout(ctx, sessionConfig.timeout);
+
+        if (sessionConfig.tickets) {
+            SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
+            sessionTickets = std::make_unique<TlsSessionTickets>(std::chrono::seconds(sessionConfig.ticketKeyRotation));
+            sessionTickets->install(ctx, &tlsSessionMetrics);
+        } else {
+            SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+        }
+    }
 
-        acceptor->async_accept(connection->socket->lowest_layer(), [this, connection](const ErrorCode &ec) {
+    /// \brief Handshake slot is taken by accept, released here
+    void tlsHandshake(const std::shared_ptr<Connection> &connection) {
+        connection->timeoutSet(config.timeoutRequest);
+        connection->socket
+                  ->async_handshake([this, connection](const ErrorCode &ec) {
+                    auto sublock = connection->handlerRunner->continueLock();
+                    if (!sublock) {
+                        return;
+                    }
+
+                    connection->timeoutCancel();
+                    handshakeEnd();
+                    if (!ec) {
+                        tlsSessionMetrics.handshakes++;
+                        SSL *ssl = connection->socket->rawSecure()->native_handle();
+                        connection->tlsVersion = SSL_get_version(ssl);
+                        connection->tlsCipher = SSL_get_cipher_name(ssl);
+                        connection->tlsResumed = SSL_session_reused(ssl) != 0;
+                        if (connection->tlsResumed) {
+                            tlsSessionMetrics.resumed++;
+                        }
+                        handshakeRead(connection);
+                    }
+                  });
+    }
+
+    using SocketServerBase::accept;
+
+    void accept(asio::ip::tcp::acceptor &listener, wss::io_context_service &service) override {
+        Shard *shard = acceptShard(service);
+        auto connection = std::allocate_shared<Connection>(wss::utils::PoolAllocator<Connection>(),
+                                                           handlerRunner,
+                                                           config.timeoutIdle,
+                                                           shard ? *shard->service : service,
+                                                           context);
+        connection->shard = shard;
+        configureConnection(connection);
+
+        listener.async_accept(connection->socket->lowest_layer(), [this, connection, &listener, &service](const ErrorCode &ec) {
           auto lock = connection->handlerRunner->continueLock();
           if (!lock) {
               return;
           }
 
-          // Immediately start accepting a new connection (if ioService hasn't been stopped)
-          if (ec != asio::error::operation_aborted) {
-              accept();
+          // Immediately start accepting a new connection (if ioService hasn't been stopped),
+          // unless handshakes limit is reached: then accepting is resumed by finished handshake
+          if (ec != asio::error::operation_aborted && accepting && (ec || handshakeBegin(listener, service))) {
+              accept(listener, service);
           }
 
           if (!ec) {
-              asio::ip::tcp::no_delay option(true);
-              connection->socket->lowest_layer().set_option(option);
-
-              connection->timeoutSet(config.timeoutRequest);
-              connection->socket
-                        ->async_handshake([this, connection](const ErrorCode &ec) {
-                          auto sublock = connection->handlerRunner->continueLock();
-                          if (!sublock) {
-                              return;
-                          }
+              wss::socketopts::apply(connection->socket->lowest_layer(), config.socket);
 
-                          connection->timeoutCancel();
-                          if (!ec)
-                              handshakeRead(connection);
-                        });
+              proxyHeaderRead(connection, [this, connection](bool valid) {
+                if (valid) {
+                    tlsHandshake(connection);
+                } else {
+                    handshakeEnd();
+                }
+              });
           }
         });
     }
@@ -0,0 +1,87 @@
+/**
+ * wsserver
+ * connection_footprint.cpp
+ *
+ * Memory benchmark: resident bytes per idle websocket connection object (without kernel socket buffers).
+ * Run without arguments - handshake released after upgrade (as server does), with "keep" - handshake kept
+ * for the whole connection life (previous layout). Each mode must run in own process: freed memory is not
+ * returned to system, so second measurement in the same process would be wrong.
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <iostream>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "../base/ws/WebsocketServer.hpp"
+
+using std::cout;
+using std::endl;
+using Connection = wss::server::websocket::SocketServerBase::Connection;
+
+const std::size_t CONNECTIONS = 100000;
+
+/// \brief Connection object size, reported at compile time. Measured on x86_64 libstdc++: grow it consciously
+const std::size_t CONNECTION_SIZE_TARGET = 768;
+#if defined(__x86_64__) && defined(__GLIBCXX__)
+static_assert(sizeof(Connection) <= CONNECTION_SIZE_TARGET, "Connection object exceeds size target");
+#endif
+
+/// \brief Typical browser upgrade request
+const std::string REQUEST =
+    "GET /chat?id=123456 HTTP/1.1\r\n"
+    "Host: chat.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: */*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Sec-WebSocket-Version: 13\r\n"
+    "Origin: https://chat.example.com\r\n"
+    "Sec-WebSocket-Protocol: wss.json.v1, wss.binary.v1\r\n"
+    "Sec-WebSocket-Extensions: permessage-deflate\r\n"
+    "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+    "Connection: keep-alive, Upgrade\r\n"
+    "Cookie: session=0123456789abcdef0123456789abcdef\r\n"
+    "X-Auth-Token: aOel0Pnx9Fi-h2EeknsHuAyDknV5rbSR\r\n"
+    "Pragma: no-cache\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Upgrade: websocket\r\n"
+    "\r\n";
+
+static std::size_t residentBytes() {
+    std::ifstream statm("/proc/self/statm");
+    std::size_t total = 0, resident = 0;
+    statm >> total >> resident;
+    return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+}
+
+int main(int argc, char **argv) {
+    const bool keepHandshake = argc > 1 && std::string(argv[1]) == "keep";
+
+    boost::asio::io_service ioService;
+    std::vector<std::shared_ptr<Connection>> connections;
+    connections.reserve(CONNECTIONS);
+
+    const std::size_t before = residentBytes();
+    for (std::size_t i = 0; i < CONNECTIONS; i++) {
+        auto connection = std::make_shared<Connection>(std::make_unique<SocketLayerWrapper>(ioService));
+        auto &handshake = *connection->handshake;
+        wss::utils::RequestMessage::parse(REQUEST.c_str(), REQUEST.size(), handshake.method, handshake.path,
+                                          handshake.queryString, handshake.httpVersion, handshake.header);
+        if (!keepHandshake) {
+            connection->handshake.reset();
+        }
+        connections.push_back(std::move(connection));
+    }
+    const std::size_t after = residentBytes();
+
+    cout << "sizeof(Connection): " << sizeof(Connection) << " (target " << CONNECTION_SIZE_TARGET << ")" << endl;
+    cout << "Handshake: " << (keepHandshake ? "kept" : "released") << endl;
+    cout << "Resident bytes per idle connection: " << (after - before) / CONNECTIONS << endl;
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+/**
+ * wsserver
+ * connection_index.cpp
+ *
+ * Micro-benchmark: user -> connections index at 1M users,
+ * nested std::unordered_map (previous ConnectionStorage layout) vs FlatMap of InlineVector
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <iostream>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "flat_map.hpp"
+#include "inline_vector.hpp"
+
+using std::cout;
+using std::endl;
+using hr_clock = std::chrono::high_resolution_clock;
+
+const std::size_t USERS = 1000000;
+const std::size_t LOOKUPS = 10000000;
+
+// connection stand-in: index stores only shared pointers
+using ConnPtr = std::shared_ptr<int>;
+using Nested = std::unordered_map<uint64_t, std::unordered_map<uint64_t, ConnPtr>>;
+using Flat = wss::utils::FlatMap<wss::utils::InlineVector<std::pair<uint64_t, ConnPtr>, 3>>;
+
+/// \brief Most users have one device, some have two or three, few - more
+static std::size_t devicesOf(uint64_t user) {
+    const uint64_t r = user % 100;
+    return r < 70 ? 1 : r < 90 ? 2 : r < 98 ? 3 : 5;
+}
+
+template<typename Fn>
+static double millis(Fn &&fn) {
+    const auto start = hr_clock::now();
+    fn();
+    return std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(hr_clock::now() - start).count();
+}
+
+int main(int, char **) {
+    const ConnPtr conn = std::make_shared<int>(0);
+    std::vector<uint64_t> lookups(LOOKUPS);
+    std::mt19937_64 rnd(42);
+    for (auto &id: lookups) {
+        id = rnd() % USERS;
+    }
+
+    Nested nested;
+    Flat flat;
+    const double nestedFill = millis([&] {
+      for (uint64_t u = 0; u < USERS; u++) {
+          for (std::size_t d = 0; d < devicesOf(u); d++) {
+              nested[u][u * 8 + d] = conn;
+          }
+      }
+    });
+    const double flatFill = millis([&] {
+      for (uint64_t u = 0; u < USERS; u++) {
+          auto &connections = flat[u];
+          for (std::size_t d = 0; d < devicesOf(u); d++) {
+              connections.push_back({u * 8 + d, conn});
+          }
+      }
+    });
+
+    std::size_t sink = 0;
+    const double nestedLookup = millis([&] {
+      for (uint64_t id: lookups) {
+          const auto it = nested.find(id);
+          if (it == nested.end()) continue;
+          for (const auto &c: it->second) {
+              sink += c.first + (c.second ? 1 : 0);
+          }
+      }
+    });
+    const double flatLookup = millis([&] {
+      for (uint64_t id: lookups) {
+          const auto *connections = flat.find(id);
+          if (connections == nullptr) continue;
+          for (std::size_t i = 0; i < connections->size(); i++) {
+              sink += (*connections)[i].first + ((*connections)[i].second ? 1 : 0);
+          }
+      }
+    });
+
+    cout << "users: " << USERS << ", lookups: " << LOOKUPS << " (sink " << sink << ")" << endl;
+    cout << "fill:" << endl;
+    cout << "\tnested unordered_map: " << nestedFill << " ms" << endl;
+    cout << "\tflat map:             " << flatFill << " ms" << endl;
+    cout << "lookup + iterate connections:" << endl;
+    cout << "\tnested unordered_map: " << nestedLookup << " ms" << endl;
+    cout << "\tflat map:             " << flatLookup << " ms" << endl;
+
+    return 0;
+}
@@ -0,0 +1,289 @@
+/**
+ * wsserver
+ * event_notifier.cpp
+ *
+ * Benchmark: event notifier throughput with in-process mock targets of configurable latency and failure rate.
+ * Events are injected at fixed rate (open-loop) by ChatServer::send() to bot, which only calls message listeners,
+ * so the path is the same as in server: listener -> EventNotifier::onMessage -> target queues -> workers.
+ * Reports events/s, queue depth over time, retry amplification (sends per event) and process threads.
+ *
+ * Example: wssbench-event-notifier -r 20000 -d 20 --targets 2 --latency-ms 5 --failure-rate 0.01 -w 16
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cmdline.hpp"
+#include "../chat/ChatServer.h"
+#include "../event/EventNotifier.h"
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using steady_clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Options {
+  double rate;
+  double duration;
+  double drain;
+  std::size_t producers;
+  std::size_t targets;
+  double latencyMs;
+  double failureRate;
+  uint32_t workers;
+  int retries;
+  int retryIntervalSeconds;
+  std::size_t queueCapacity;
+  std::size_t batchSize;
+  std::size_t payloadSize;
+};
+
+/// \brief Blocks worker for latency, as real targets do by synchronous request, and fails with given probability
+class MockTarget : public wss::event::Target {
+ public:
+    MockTarget(const nlohmann::json &config, const std::string &name, double latencyMs, double failureRate) :
+        Target(config),
+        m_name(name),
+        m_latency(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::duration<double, std::milli>(latencyMs))),
+        m_failureRate(failureRate) { }
+
+    bool send(const wss::MessagePayload &payload, std::string &error) override {
+        wait();
+        return attempt(payload, error);
+    }
+
+    void sendBatch(const std::vector<const wss::MessagePayload *> &payloads,
+                   std::vector<bool> &sent,
+                   std::vector<std::string> &errors) override {
+        // one request for whole batch: latency is paid once
+        batches++;
+        sent.assign(payloads.size(), false);
+        errors.assign(payloads.size(), std::string());
+        wait();
+        for (std::size_t i = 0; i < payloads.size(); i++) {
+            sent[i] = attempt(*payloads[i], errors[i]);
+        }
+    }
+
+    std::string getType() override {
+        return m_name;
+    }
+
+    std::atomic<uint64_t> attempts{0};
+    std::atomic<uint64_t> failures{0};
+    std::atomic<uint64_t> batches{0};
+    std::atomic<uint64_t> bytes{0};
+
+ private:
+    const std::string m_name;
+    const std::chrono::microseconds m_latency;
+    const double m_failureRate;
+
+    void wait() const {
+        if (m_latency.count() > 0) {
+            std::this_thread::sleep_for(m_latency);
+        }
+    }
+
+    bool attempt(const wss::MessagePayload &payload, std::string &error) {
+        attempts++;
+        // real targets encode payload before request
+        bytes += getCodec().encode(payload).size();
+        thread_local std::mt19937 random(std::random_device{}());
+        if (m_failureRate > 0 && std::uniform_real_distribution<double>(0.0, 1.0)(random) < m_failureRate) {
+            failures++;
+            error = "mock failure";
+            return false;
+        }
+        return true;
+    }
+};
+
+/// \return threads of this process, 0 if /proc is not available
+uint64_t threadsCount() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 8, "Threads:") == 0) {
+            return std::stoull(line.substr(8));
+        }
+    }
+    return 0;
+}
+
+bool parseOptions(int argc, char **argv, Options &out) {
+    cmdline::parser args;
+    args.add<double>("rate", 'r', "Injected events per second (open-loop)", false, 10000);
+    args.add<double>("duration", 'd', "Seconds of injection", false, 10);
+    args.add<double>("drain", 0, "Seconds to wait for queues after injection is finished", false, 5);
+    args.add<std::size_t>("producers", 'p', "Injecting threads, as server worker threads", false, 4);
+    args.add<std::size_t>("targets", 0, "Mock targets, every event is sent to each one", false, 1);
+    args.add<double>("latency-ms", 'l', "Send latency of mock target", false, 1);
+    args.add<double>("failure-rate", 'f', "Probability of failed send, 0..1", false, 0);
+    args.add<uint32_t>("workers", 'w', "event.maxParallelWorkers", false, 8);
+    args.add<int>("retries", 0, "event.retryCount, 0 - retry is disabled", false, 3);
+    args.add<int>("retry-interval", 0, "event.retryIntervalSeconds", false, 1);
+    args.add<std::size_t>("queue-capacity", 0, "Target queueCapacity, 0 - unlimited", false, 100000);
+    args.add<std::size_t>("batch-size", 0, "Target batchSize", false, 1);
+    args.add<std::size_t>("payload", 0, "Text size of event, bytes", false, 128);
+    args.parse_check(argc, argv);
+
+    out.rate = args.get<double>("rate");
+    out.duration = args.get<double>("duration");
+    out.drain = args.get<double>("drain");
+    out.producers = std::max<std::size_t>(1, args.get<std::size_t>("producers"));
+    out.targets = std::max<std::size_t>(1, args.get<std::size_t>("targets"));
+    out.latencyMs = args.get<double>("latency-ms");
+    out.failureRate = args.get<double>("failure-rate");
+    out.workers = std::max<uint32_t>(1, args.get<uint32_t>("workers"));
+    out.retries = args.get<int>("retries");
+    out.retryIntervalSeconds = args.get<int>("retry-interval");
+    out.queueCapacity = args.get<std::size_t>("queue-capacity");
+    out.batchSize = std::max<std::size_t>(1, args.get<std::size_t>("batch-size"));
+    out.payloadSize = args.get<std::size_t>("payload");
+
+    if (out.rate <= 0 || out.duration <= 0 || out.latencyMs < 0 || out.failureRate < 0 || out.failureRate > 1) {
+        cerr << "Rate and duration must be greater than 0, failure rate must be in 0..1" << endl;
+        return false;
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 1;
+    }
+
+    auto &settings = wss::Settings::get().event;
+    settings.enabled = true;
+    settings.enableRetry = options.retries > 0;
+    settings.retryCount = std::max(options.retries, 1);
+    settings.retryIntervalSeconds = options.retryIntervalSeconds;
+    settings.maxParallelWorkers = options.workers;
+
+    // server is not started: send() to bot only calls message listeners
+    auto ws = std::make_shared<wss::ChatServer>("127.0.0.1", 0, "^/chat/?$");
+    wss::event::EventNotifier notifier(ws);
+    std::vector<std::shared_ptr<MockTarget>> targets;
+    for (std::size_t i = 0; i < options.targets; i++) {
+        const nlohmann::json config = {
+            {"type", "mock"},
+            {"batchSize", options.batchSize},
+            {"queueCapacity", options.queueCapacity},
+            // breaker would hide failures from retries
+            {"breakerFailures", 0}
+        };
+        targets.push_back(std::make_shared<MockTarget>(config, "mock-" + std::to_string(i), options.latencyMs,
+                                                       options.failureRate));
+        notifier.addTarget(targets.back());
+    }
+    const uint64_t threadsBefore = threadsCount();
+    notifier.runService();
+    const uint64_t threadsStarted = threadsCount();
+
+    cout << "Injecting " << options.rate << " events/s for " << options.duration << " s by " << options.producers
+         << " threads, " << options.targets << " target(s) " << options.latencyMs << " ms latency, "
+         << options.failureRate * 100 << "% failures, " << options.workers << " workers" << endl;
+
+    std::atomic<uint64_t> injected(0);
+    std::atomic<uint64_t> late(0);
+    const auto start = steady_clock::now() + std::chrono::milliseconds(100);
+    const auto end = start + std::chrono::duration_cast<steady_clock::duration>(
+        std::chrono::duration<double>(options.duration));
+    std::vector<std::thread> producers;
+    for (std::size_t p = 0; p < options.producers; p++) {
+        producers.emplace_back([&, p] {
+          const double rate = options.rate / options.producers;
+          const std::string text(options.payloadSize, 'x');
+          for (uint64_t n = 0;; n++) {
+              const auto at = start + std::chrono::duration_cast<steady_clock::duration>(
+                  std::chrono::duration<double>(n / rate));
+              if (at >= end) {
+                  break;
+              }
+              const auto now = steady_clock::now();
+              if (at > now) {
+                  std::this_thread::sleep_until(at);
+              } else if (now - at > std::chrono::milliseconds(1)) {
+                  late++;
+              }
+              // sender is not a bot: messages from bot are skipped by notifier
+              ws->send(wss::MessagePayload(1 + (n * options.producers + p) % 10000, 0, text));
+              injected++;
+          }
+        });
+    }
+
+    const wss::event::EventMetrics &metrics = notifier.getMetrics();
+    uint64_t lastInjected = 0, lastSent = 0, queuedMax = 0, threadsMax = threadsStarted;
+    const auto drainEnd = end + std::chrono::duration_cast<steady_clock::duration>(
+        std::chrono::duration<double>(options.drain));
+    cout << "  time  injected/s  sent/s  queued  delayed  busy  threads" << endl;
+    for (int second = 1; steady_clock::now() < drainEnd; second++) {
+        std::this_thread::sleep_until(start + std::chrono::seconds(second));
+        const uint64_t currentInjected = injected;
+        const uint64_t currentSent = metrics.sent;
+        const uint64_t threads = threadsCount();
+        queuedMax = std::max<uint64_t>(queuedMax, metrics.queued);
+        threadsMax = std::max(threadsMax, threads);
+        cout << std::setw(6) << second << std::setw(12) << currentInjected - lastInjected
+             << std::setw(8) << currentSent - lastSent << std::setw(8) << metrics.queued
+             << std::setw(9) << metrics.delayed << std::setw(6) << metrics.busyWorkers
+             << std::setw(9) << threads << endl;
+        lastInjected = currentInjected;
+        lastSent = currentSent;
+        if (steady_clock::now() >= end && metrics.queued == 0 && metrics.delayed == 0 && metrics.batching == 0
+            && metrics.busyWorkers == 0) {
+            break;
+        }
+    }
+    for (auto &producer: producers) {
+        producer.join();
+    }
+    const double seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+
+    uint64_t attempts = 0, failures = 0, batches = 0;
+    for (const auto &target: targets) {
+        attempts += target->attempts;
+        failures += target->failures;
+        batches += target->batches;
+    }
+    const uint64_t deliveries = injected * options.targets;
+    const uint64_t sent = metrics.sent;
+    cout << endl << std::fixed << std::setprecision(0)
+         << "Injected:           " << injected << " events (" << injected / options.duration << "/s of "
+         << options.rate << "/s target), late " << late << endl
+         << "Sent:               " << sent << " of " << deliveries << " target deliveries, "
+         << sent / seconds << "/s" << endl
+         << "Failed:             " << metrics.failed << " after all tries, dropped " << metrics.dropped
+         << ", still queued " << metrics.queued << ", delayed " << metrics.delayed << endl
+         << "Target sends:       " << attempts << " (" << failures << " failed, " << batches << " batches), retried "
+         << metrics.retried << endl
+         << std::setprecision(3)
+         << "Retry amplification: " << (deliveries > 0 ? static_cast<double>(attempts) / deliveries : 0)
+         << " sends per delivery" << endl
+         << "Max queued:         " << queuedMax << endl
+         << "Threads:            " << threadsBefore << " before start, " << threadsStarted << " started, "
+         << threadsMax << " max" << endl;
+
+    notifier.stopService();
+    notifier.joinThreads();
+    return 0;
+}
@@ -1,305 +1,1554 @@
+/**
+ * wsserver
+ * main.cpp
+ *
+ * Load generator: opens many plain websocket connections from a few event loop threads and sends messages
+ * open-loop - at fixed target rate, by schedule that does not wait for server. Latency is measured from
+ * scheduled send time to delivery to recipient, so slow server is not hidden by slow sender (coordinated omission).
+ * Every message carries its scheduled time and sequence number of each sender -> recipient pair in "text",
+ * recipients are also connections of this benchmark: they verify arrival, order and loss of every pair.
+ * Group mode (--senders M --fanout K): M connections send to groups of K of the other ones, delivery spread
+ * (first to last recipient of the same message) and server egress are reported, server CPU and RSS are sampled
+ * from /proc if it runs on the same host (--server-pid).
+ * Churn mode (--churn R): R random connections per second are closed and opened again, optionally over TLS (--tls),
+ * --storm closes all connections after run and reconnects them at once; connect latency is reported by phase.
+ * Replay mode (--replay trace --speed N): connections, message sizes, recipients and timing are taken from traffic
+ * trace captured by server (chat.capture), N times faster than recorded.
+ *
+ * Example: wssbench -e 10.0.0.5:8085 -c 100000 --ramp 5000 -r 50000 -d 60 --fanout 2 --source-ips 10.0.0.2,10.0.0.3
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
 #include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
-#include <sstream>
-#include <boost/thread/thread.hpp>
-#include <boost/asio/io_service.hpp>
-#include <unordered_set>
-#include <csignal>
-#include <toolboxpp.h>
-#include <client_wss.hpp>
-
-#include "client_ws.hpp"
-#include "json.hpp"
-
-using namespace std::placeholders;
-using namespace boost;
-using WsClient = SimpleWeb::SocketClient<SimpleWeb::WSS>;
-using WsConnectionPtr = std::shared_ptr<WsClient::Connection>;
-using logger = toolboxpp::Logger;
+#include <sys/resource.h>
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include "cmdline.hpp"
+#include "../base/TrafficCapture.h"
+#include "../client/Connection.hpp"
+
+namespace asio = boost::asio;
+using asio::ip::tcp;
+using ErrorCode = boost::system::error_code;
+using steady_clock = std::chrono::steady_clock;
 using std::cout;
 using std::cerr;
 using std::endl;
 
-int lastSender;
-int lastRecipient;
-std::atomic_int connected;
-std::recursive_mutex lock;
-
-// CONFIG
-// TODO cli arguments
-const int RUN_TIMES = 20;
-const int CONCURRENCY = 50;
-const int MESSAGES = 2;
-const boost::int_least64_t SLEEP_MS = 0;
-//std::string endpoint = "localhost:8085";
-std::string endpoint = "localhost:8085";
-
-std::mutex connMutex;
-std::unordered_map<int, WsConnectionPtr> conns(CONCURRENCY);
-
-const static std::string DUMMY_TEXT =
-    "Lorem ipsum dolor sit amet, consectetur adipiscing elit. Phasellus egestas, dui euismod aliquet ultrices, magna ex tincidunt ante, non tincidunt enim quam at ipsum. Etiam vel ligula pulvinar, pharetra magna at, finibus eros. Vestibulum ante ipsum primis in faucibus orci luctus et ultrices posuere cubilia Curae; Nullam nibh nibh, tincidunt sit amet posuere eget, lobortis eu quam. Sed tincidunt, nulla ac fringilla cursus, velit nibh condimentum nisl, eget suscipit orci ex at nibh. Nam malesuada, purus nec cursus feugiat, elit erat porta quam, in maximus dui nisi ut tortor. Duis felis magna, maximus quis tristique ac, pellentesque at elit. Pellentesque augue felis, vehicula ut egestas luctus, aliquet ut justo. Quisque iaculis ligula sit amet sollicitudin facilisis. Vivamus congue suscipit metus, vitae eleifend neque ornare nec. Nulla facilisi. Phasellus augue leo, laoreet non dapibus malesuada, auctor et purus. Etiam tempor tempus sagittis. Duis porta iaculis velit quis pretium. Donec at arcu luctus, vulputate magna id, tincidunt arcu.\n"
-    "\n"
-    "Integer fermentum vulputate lorem, eget aliquam lectus interdum at. In lobortis, lectus id pellentesque porttitor, magna nunc vestibulum urna, eu auctor nisl eros eget nibh. Fusce augue diam, tempus nec nisi ac, pharetra tempor erat. Aliquam ullamcorper urna vitae elit sagittis ornare. Quisque aliquam diam lorem, eget suscipit tellus venenatis ultrices. Proin at elit quis lectus accumsan mattis. Ut vel commodo justo. Vivamus gravida euismod lacus eu mattis. Duis vitae porttitor ligula, non pellentesque turpis. Donec sollicitudin lectus a sem egestas, eget lacinia libero blandit. Ut consequat nisl felis, id sodales tortor ultrices sed.\n"
-    "\n"
-    "Donec dictum gravida est. In hac habitasse platea dictumst. Sed in tristique est, in volutpat odio. Sed finibus felis mi, eget scelerisque orci interdum et. Proin ac orci non libero facilisis fringilla. Duis eget eleifend elit. Praesent consequat diam elit, lobortis porta tellus blandit at. Proin a felis nisl. Cras fermentum sollicitudin urna, non blandit erat scelerisque quis. Pellentesque habitant morbi tristique senectus et netus et malesuada fames ac turpis egestas.\n"
-    "\n"
-    "Maecenas elementum placerat pulvinar. Praesent porttitor maximus lorem, quis convallis magna laoreet maximus. Proin iaculis dapibus bibendum. Pellentesque ac velit feugiat, varius nulla nec, lobortis nibh. Nunc condimentum nisi ac malesuada tempor. Nunc et magna sed lectus viverra mollis id nec orci. Nunc aliquam euismod dui, eu scelerisque purus ornare quis. Suspendisse magna ipsum, porttitor ornare risus ac, aliquam lacinia quam. Donec venenatis faucibus consectetur. Integer ultrices, libero et imperdiet ullamcorper, magna elit laoreet velit, a auctor sem justo eu massa. Morbi ornare accumsan orci, a blandit massa vestibulum vitae. Vestibulum tortor velit, convallis eu tortor et, maximus rhoncus urna. Suspendisse vitae pulvinar sapien.\n"
-    "\n"
-    "Duis condimentum justo vitae malesuada laoreet. Pellentesque vitae lorem risus. Fusce at nulla vitae ex vestibulum viverra id ac risus. Ut non leo lectus. Phasellus venenatis erat non odio maximus sagittis. Duis id laoreet nulla. Cras lacinia eros sit amet sodales rhoncus. Fusce convallis convallis facilisis. Phasellus cursus tincidunt libero, sed placerat quam tempus quis. Nullam pellentesque, quam ut auctor tristique, diam justo tristique felis, a bibendum urna ipsum eget odio. Etiam congue euismod convallis.";
-
-struct stats_t {
-  std::vector<double> sendTimes;
-  std::atomic_int sentMessages;
-  std::atomic_int errorMessages;
-  std::atomic_int totalConnections;
-  std::atomic_long payloadTransferredBytes;
-  double timeTaken = 0;
-
-  std::vector<int> calcTime(long ms) {
-      int seconds = (int) (ms / 1000) % 60;
-      auto minutes = (int) ((ms / (1000 * 60)) % 60);
-      auto hours = (int) ((ms / (1000 * 60 * 60)) % 24);
-
-      return {
-          hours, minutes, seconds
-      };
+struct Options {
+  std::string host;
+  std::string port;
+  std::string path;
+  std::string token;
+  uint64_t firstId;
+  std::size_t connections;
+  /// \brief New connections per second
+  double ramp;
+  /// \brief Messages per second, summary for all loops
+  double rate;
+  double duration;
+  double drain;
+  std::size_t fanout;
+  /// \brief First connections which send, others only receive. 0 - every connection sends and receives
+  std::size_t senders;
+  std::size_t payloadMin;
+  std::size_t payloadMax;
+  bool payloadExponential;
+  std::size_t threads;
+  std::vector<asio::ip::address> sourceAddresses;
+  /// \brief Results file for regression tracking, empty - not written
+  std::string jsonPath;
+  /// \brief Server process on this host to sample CPU and memory of, 0 - not sampled
+  int serverPid;
+  /// \brief Connections closed and opened again per second while running, summary for all loops
+  double churn;
+  /// \brief Close all connections after run and reconnect them
+  bool storm;
+  /// \brief Reconnects per second of storm, 0 - all at once
+  double stormRamp;
+  bool tls;
+  /// \brief Client context of wss connections, set if tls is on
+  asio::ssl::context *tlsContext = nullptr;
+  /// \brief Traffic trace to replay instead of generated load, empty - not replayed
+  std::string replayPath;
+  /// \brief Replay time scale: 2 - twice faster than recorded
+  double speed;
+
+  bool isReplay() const noexcept {
+      return !replayPath.empty();
   }
 
-  void calculate() {
-      double minMax[3];
-      calcMinMaxTime(minMax);
-      double totalSendTimes = 0.0;
-      for (auto t: sendTimes) {
-          totalSendTimes += t;
-      }
-      double transferSpeedKbps = ((payloadTransferredBytes * 8) / totalSendTimes) / 1000;
-
-      const std::vector<int> times = calcTime(static_cast<long>(totalSendTimes));
-      cout
-          << endl
-          << "         MIN send time:      " << (minMax[0]) << "ms" << endl
-          << "         MAX send time:      " << (minMax[1]) << "ms" << endl
-          << "         AVG send time:      " << (minMax[2]) << "ms" << endl
-          << "            Total sent:      " << sendTimes.size() << endl
-          << "         Sent messages:      " << sentMessages << endl
-          << "        Error messages:      " << errorMessages << endl
-          << "     Total connections:      " << totalConnections << endl
-          << "   Transferred payload:      " << payloadTransferredBytes << " bytes ("
-          << (payloadTransferredBytes / 1000)
-          << " Kb)" << endl
-          << "Average transfer throughput: " << transferSpeedKbps << " Kb/s (" << (transferSpeedKbps / 1000) << " Mb/s)"
-          << endl
-          << "Benchmark time (total):      " << totalSendTimes << "ms (" << times[1] << " minutes" << " " << times[2]
-          << " seconds)" << endl
-          << endl;
+  /// \brief Ids recipients are picked from: receivers in group mode, all connections otherwise
+  uint64_t firstReceiver() const noexcept {
+      return firstId + senders;
+  }
+  std::size_t receivers() const noexcept {
+      return connections - senders;
+  }
+  bool isSender(uint64_t id) const noexcept {
+      return senders == 0 || id - firstId < senders;
+  }
+  /// \brief Recipients per message: distinct ones, except sender
+  std::size_t effectiveFanout() const noexcept {
+      return std::min(fanout, senders == 0 ? connections - 1 : receivers());
   }
+};
 
-  void calcMinMaxTime(double *result) {
-      double min = 0, max = 0;
-      double sum = 0.0;
-      for (auto t: sendTimes) {
-          sum += t;
-          if (t > max) {
-              max = t;
-          }
-      }
-      min = max;
-      for (auto t: sendTimes) {
-          if (t < min) {
-              min = t;
-          }
-      }
+/// \brief Log-linear histogram of microseconds: 16 buckets per power of two, relative error is under 7%.
+/// Owned by one loop, merged after loops are stopped
+class LatencyHistogram {
+ public:
+    void record(uint64_t micros) {
+        counts[indexOf(micros)]++;
+        total++;
+        maxValue = std::max(maxValue, micros);
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (std::size_t i = 0; i < BUCKETS; i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        maxValue = std::max(maxValue, other.maxValue);
+    }
+
+    /// \param quantile 0..1
+    /// \return upper bound of bucket, microseconds
+    uint64_t percentile(double quantile) const {
+        const uint64_t rank = static_cast<uint64_t>(std::ceil(quantile * total));
+        uint64_t seen = 0;
+        for (std::size_t i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank && seen > 0) {
+                return std::min(upperBoundOf(i), maxValue);
+            }
+        }
+        return maxValue;
+    }
+
+    uint64_t getCount() const noexcept {
+        return total;
+    }
+    uint64_t getMax() const noexcept {
+        return maxValue;
+    }
+
+ private:
+    static constexpr std::size_t SUB_BITS = 4;
+    static constexpr std::size_t SUB_BUCKETS = 1u << SUB_BITS;
+    /// \brief Up to 2^40 us
+    static constexpr std::size_t BUCKETS = (40 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    std::array<uint64_t, BUCKETS> counts{};
+    uint64_t total = 0;
+    uint64_t maxValue = 0;
+
+    static std::size_t indexOf(uint64_t value) {
+        if (value < SUB_BUCKETS) {
+            return value;
+        }
+        std::size_t magnitude = 63 - __builtin_clzll(value);
+        const std::size_t sub = (value >> (magnitude - SUB_BITS)) & (SUB_BUCKETS - 1);
+        const std::size_t index = (magnitude - SUB_BITS + 1) * SUB_BUCKETS + sub;
+        return std::min(index, BUCKETS - 1);
+    }
+
+    static uint64_t upperBoundOf(std::size_t index) {
+        if (index < SUB_BUCKETS) {
+            return index;
+        }
+        const std::size_t magnitude = index / SUB_BUCKETS + SUB_BITS - 1;
+        const uint64_t sub = index % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (magnitude - SUB_BITS)) - 1;
+    }
+};
+
+/// \brief Progress counters of loop, read by main thread while loop works
+struct LoopStats {
+  std::atomic<uint64_t> connected{0};
+  std::atomic<uint64_t> failed{0};
+  std::atomic<uint64_t> closed{0};
+  std::atomic<uint64_t> sent{0};
+  std::atomic<uint64_t> sentBytes{0};
+  /// \brief Deliveries to recipients of sent messages, bot is not counted
+  std::atomic<uint64_t> expected{0};
+  std::atomic<uint64_t> received{0};
+  /// \brief Frames bytes of received messages: server egress to this benchmark
+  std::atomic<uint64_t> receivedBytes{0};
+  /// \brief Scheduled messages without open sender connection
+  std::atomic<uint64_t> skipped{0};
+  /// \brief Messages sent later than 1 ms after schedule: generator itself was saturated
+  std::atomic<uint64_t> late{0};
+  /// \brief Pair messages received after later ones of the same pair
+  std::atomic<uint64_t> reordered{0};
+  /// \brief Sequence numbers skipped at arrival, some of them could be reordered later
+  std::atomic<uint64_t> gaps{0};
+  /// \brief Open connections closed and opened again by churn
+  std::atomic<uint64_t> churned{0};
+  /// \brief Connections closed by disconnects of replayed trace
+  std::atomic<uint64_t> disconnected{0};
+};
+
+/// \brief Connect latency is reported separately for connections started in each phase
+enum ConnectPhase : std::size_t {
+  PhaseRamp = 0,
+  PhaseChurn,
+  PhaseStorm,
+  PhaseCount
+};
 
-      result[0] = min;
-      result[1] = max;
-      result[2] = sum / static_cast<double>(sendTimes.size());
+/// \brief Arrivals of one group message at recipients of one loop, nanoseconds
+struct Spread {
+  uint64_t first = UINT64_MAX;
+  uint64_t last = 0;
+  uint32_t recipients = 0;
 
+  void add(uint64_t arrival) {
+      first = std::min(first, arrival);
+      last = std::max(last, arrival);
+      recipients++;
   }
-}; // stats
 
-stats_t _statistics;
-std::mutex statLock;
+  void merge(const Spread &other) {
+      first = std::min(first, other.first);
+      last = std::max(last, other.last);
+      recipients += other.recipients;
+  }
+};
 
-void handleOne(int sen, int rec, WsConnectionPtr &conn) {
-    std::lock_guard<std::mutex> locker(connMutex);
-    if (conn == nullptr) {
-        L_ERR_F("HandleOne", "Connection is NULL sen=%d, rec=%d", sen, rec);
-        return;
+/// \brief Sender id and scheduled nanos: sender is owned by one loop, which never schedules two messages at once
+using SpreadKey = std::pair<uint64_t, uint64_t>;
+struct SpreadKeyHash {
+  std::size_t operator()(const SpreadKey &key) const noexcept {
+      return std::hash<uint64_t>()(key.first * 0x9E3779B97F4A7C15ULL ^ key.second);
+  }
+};
+using Spreads = std::unordered_map<SpreadKey, Spread, SpreadKeyHash>;
+
+class Loop;
+
+class Client : public wss::client::Connection<Client> {
+ public:
+    Client(Loop &loop, uint64_t id);
+
+    void start(const tcp::endpoint &endpoint, const asio::ip::address *source);
+
+    const uint64_t id;
+    /// \brief Position in loop open clients, to remove it in O(1)
+    std::size_t openIndex = 0;
+
+    /// \brief Connection hooks: stats and latencies of loop
+    void onSecured(steady_clock::duration tlsHandshake);
+    void onOpen();
+    void onMessage(uint8_t opcode, const char *data, std::size_t length);
+    void onClose(const ErrorCode &ec, bool wasOpen);
+
+ private:
+    Loop &loop;
+    steady_clock::time_point startedAt;
+    ConnectPhase phase = PhaseRamp;
+
+    static asio::io_service &ioServiceOf(Loop &loop);
+};
+
+class Loop {
+ public:
+    Loop(std::size_t index, const Options &options, const tcp::endpoint &endpoint) :
+        index(index),
+        options(options),
+        endpoint(endpoint),
+        work(service),
+        sendTimer(service),
+        churnTimer(service),
+        replayTimer(service),
+        random(std::random_device()() + index) { }
+
+    void run() {
+        thread = std::thread([this] { service.run(); });
+    }
+
+    void stop() {
+        service.stop();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+    void connect(uint64_t id) {
+        service.post([this, id] {
+          // replay closes connections of user by its trace
+          std::vector<std::shared_ptr<Client>> &owner = options.isReplay() ? userClients[id] : clients;
+          owner.push_back(std::make_shared<Client>(*this, id));
+          owner.back()->start(endpoint, sourceOf(id));
+        });
     }
 
-    std::string msg;
-    nlohmann::json obj;
-    std::vector<int> recps = {rec};
-    obj["sender"] = sen;
-    obj["recipients"] = recps;
-    obj["type"] = "text";
-    obj["text"] = DUMMY_TEXT;
-    msg = obj.dump();
-
-    for (int i = 0; i < MESSAGES; i++) {
-        std::stringstream ss;
-        ss << "client_" << sen << "_" << i;
-        const std::string tag = ss.str();
-
-        // DO NOT reuse stream, it will die after first sending
-        const std::shared_ptr<WsClient::SendStream> send_stream = std::make_shared<WsClient::SendStream>();
-        *send_stream << msg;
-
-        toolboxpp::Profiler::get().begin(tag);
-        try {
-            // See http://www.boost.org/doc/libs/1_55_0/doc/html/boost_asio/reference.html, Error Codes for error code meanings
-            conn->send(send_stream, [conn, tag](const SimpleWeb::error_code &errorCode) {
-              conn->send_close(1000, "OK");
-              if (errorCode) {
-                  std::stringstream ss;
-                  ss << "Server: Error sending message. " << errorCode.category().name()
-                     << " error message: " << errorCode.message() << endl;
-
-                  toolboxpp::Logger::get().debug("Send Message", ss.str());
-
-                  _statistics.errorMessages++;
-                  toolboxpp::Profiler::get().end(tag);
-                  return;
+    /// \brief Closes and forgets all clients, they could be connected again
+    void closeAll() {
+        service.post([this] {
+          sending = false;
+          churnEnd = churnStart;
+          churnTimer.cancel();
+          replayNext = replayEvents.size();
+          replayTimer.cancel();
+          for (auto &client: clients) {
+              client->close();
+          }
+          clients.clear();
+          for (auto &user: userClients) {
+              for (auto &client: user.second) {
+                  client->close();
               }
-              double sendTime;
-              toolboxpp::Profiler::get().end(tag, &sendTime);
-              statLock.lock();
-              _statistics.sendTimes.push_back(sendTime);
-              statLock.unlock();
-              _statistics.sentMessages++;
+          }
+          userClients.clear();
+        });
+    }
+
+    /// \brief Phase of connections started from now
+    void setPhase(ConnectPhase value) {
+        service.post([this, value] {
+          phase = value;
+        });
+    }
+
+    ConnectPhase getPhase() const noexcept {
+        return phase;
+    }
 
+    /// \brief Starts closing and opening again this loop share of churn rate
+    void startChurn(steady_clock::time_point start, steady_clock::time_point end) {
+        service.post([this, start, end] {
+          churnStart = start;
+          churnEnd = end;
+          churned = 0;
+          phase = PhaseChurn;
+          churnTick();
+        });
+    }
+
+    /// \brief Starts sending this loop share of rate
+    /// \param start first message schedule
+    /// \param end
+    void startSending(steady_clock::time_point start, steady_clock::time_point end) {
+        service.post([this, start, end] {
+          sendStart = start;
+          sendEnd = end;
+          scheduled = 0;
+          sending = true;
+          tick();
+        });
+    }
+
+    /// \brief Starts replay of trace records of users of this loop
+    /// \param start schedule of trace start
+    /// \param events ordered by time
+    void startReplay(steady_clock::time_point start, std::vector<wss::capture::Record> &&events) {
+        auto shared = std::make_shared<std::vector<wss::capture::Record>>(std::move(events));
+        service.post([this, start, shared] {
+          replayStart = start;
+          replayEvents = std::move(*shared);
+          replayNext = 0;
+          replayTick();
+        });
+    }
 
-            });
-        } catch (const std::exception &e) {
-            cerr << e.what() << endl;
+    /// \param client
+    /// \param connectMicros from connect start to upgrade response
+    void onOpen(Client *client, ConnectPhase startedIn, uint64_t connectMicros) {
+        connectLatency[startedIn].record(connectMicros);
+        if (options.isSender(client->id)) {
+            client->openIndex = openClients.size();
+            openClients.push_back(client);
         }
+        stats.connected++;
+    }
 
-        _statistics.payloadTransferredBytes += msg.length();
+    void onClosed(Client *client, bool wasOpen) {
+        if (wasOpen && !options.isSender(client->id)) {
+            stats.closed++;
+        } else if (wasOpen) {
+            Client *last = openClients.back();
+            last->openIndex = client->openIndex;
+            openClients[client->openIndex] = last;
+            openClients.pop_back();
+            stats.closed++;
+        } else {
+            stats.failed++;
+        }
+    }
 
-        if (SLEEP_MS > 0) {
-            boost::this_thread::sleep_for(boost::chrono::milliseconds(SLEEP_MS));
+    /// \brief Records delivery latency and checks sequence number of sender -> receiver pair
+    /// \param receiver
+    /// \param data text "{scheduled nanos}:{sequence of 1st recipient},{of 2nd}...:{padding}"
+    /// \param length
+    void onMessage(const Client &receiver, const char *data, std::size_t length) {
+        const char *end = data + length;
+        const char *text = findAfter(data, end, "\"text\":\"");
+        if (text == nullptr) {
+            return;
+        }
+        const uint64_t scheduledNanos = readUnsigned(text, end);
+        const uint64_t now = nowNanos();
+        histogram.record(now > scheduledNanos ? (now - scheduledNanos) / 1000 : 0);
+        stats.received++;
+
+        const char *senderField = findAfter(data, end, "\"sender\":");
+        const char *recipientsField = findAfter(data, end, "\"recipients\":[");
+        if (text == end || *text != ':' || senderField == nullptr || recipientsField == nullptr) {
+            return;
         }
+        const uint64_t sender = readUnsigned(senderField, end);
+        if (options.effectiveFanout() > 1) {
+            spreads[SpreadKey(sender, scheduledNanos)].add(now);
+        }
+        // sequence numbers follow recipients order
+        const char *sequence = text + 1;
+        for (const char *recipient = recipientsField; recipient < end;) {
+            if (readUnsigned(recipient, end) == receiver.id) {
+                checkSequence(sender, receiver.id, readUnsigned(sequence, end));
+                return;
+            }
+            if (recipient == end || *recipient != ',' || sequence == end) {
+                return;
+            }
+            recipient++;
+            readUnsigned(sequence, end);
+            if (sequence == end || *sequence != ',') {
+                return;
+            }
+            sequence++;
+        }
+    }
 
+    const Options &getOptions() const noexcept {
+        return options;
     }
 
-    L_DEBUG_F("Client", "[%d] sent message to client [%d]", sen, rec);
-}
+    static uint64_t nowNanos() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            steady_clock::now().time_since_epoch()).count());
+    }
+
+    asio::io_service service;
+    LoopStats stats;
+    LatencyHistogram histogram;
+    /// \brief Group messages received by this loop, merged with other loops after stop
+    Spreads spreads;
+    std::array<LatencyHistogram, PhaseCount> connectLatency;
+    LatencyHistogram tlsHandshakeLatency;
+
+ private:
+    const std::size_t index;
+    const Options &options;
+    const tcp::endpoint endpoint;
+    asio::io_service::work work;
+    asio::steady_timer sendTimer;
+    asio::steady_timer churnTimer;
+    asio::steady_timer replayTimer;
+    std::mt19937_64 random;
+    std::thread thread;
+    std::vector<std::shared_ptr<Client>> clients;
+    /// \brief Open connections which send
+    std::vector<Client *> openClients;
+    /// \brief Last sent sequence number of pair, for senders of this loop
+    std::unordered_map<uint64_t, uint32_t> sentSequences;
+    /// \brief Last received sequence number of pair, for recipients of this loop
+    std::unordered_map<uint64_t, uint32_t> receivedSequences;
+
+    bool sending = false;
+    steady_clock::time_point sendStart;
+    steady_clock::time_point sendEnd;
+    uint64_t scheduled = 0;
+    /// \brief Scratch of sendOne
+    std::vector<uint64_t> recipients;
 
-void connect(int sen, int) {
+    ConnectPhase phase = PhaseRamp;
+    steady_clock::time_point churnStart;
+    steady_clock::time_point churnEnd;
+    uint64_t churned = 0;
 
+    steady_clock::time_point replayStart;
+    std::vector<wss::capture::Record> replayEvents;
+    std::size_t replayNext = 0;
+    /// \brief Connections opened by replay: user could have a few, disconnect closes one of them
+    std::unordered_map<uint64_t, std::vector<std::shared_ptr<Client>>> userClients;
 
-        if (conns.count(sen)) {
+    /// \brief Source addresses are assigned round-robin by id, so reconnect goes from the same one
+    const asio::ip::address *sourceOf(uint64_t id) const {
+        if (options.sourceAddresses.empty()) {
+            return nullptr;
+        }
+        return &options.sourceAddresses[(id - options.firstId) % options.sourceAddresses.size()];
+    }
+
+    void churnTick() {
+        if (churnEnd <= churnStart) {
+            // stopped by closeAll()
+            return;
+        }
+        const auto now = steady_clock::now();
+        if (now >= churnStart) {
+            const double elapsed = std::chrono::duration<double>(std::min(now, churnEnd) - churnStart).count();
+            const auto due = static_cast<uint64_t>(elapsed * options.churn / options.threads);
+            for (; churned < due; churned++) {
+                reconnectRandom();
+            }
+        }
+        if (now >= churnEnd) {
             return;
         }
+        churnTimer.expires_at(std::max(churnStart, now + std::chrono::milliseconds(10)));
+        churnTimer.async_wait([this](const ErrorCode &ec) {
+          if (!ec) {
+              churnTick();
+          }
+        });
+    }
 
+    /// \brief Trace users are numbered from 1, 0 is bot
+    uint64_t idOfTraceUser(uint32_t user) const {
+        return user == 0 ? 0 : options.firstId + user - 1;
+    }
 
+    steady_clock::time_point replayScheduleOf(const wss::capture::Record &record) const {
+        return replayStart + std::chrono::duration_cast<steady_clock::duration>(
+            std::chrono::duration<double, std::micro>(record.at / options.speed));
+    }
 
-    L_DEBUG_F("Client", "[%d] Connecting...", sen);
+    void replayTick() {
+        const auto now = steady_clock::now();
+        for (; replayNext < replayEvents.size(); replayNext++) {
+            const wss::capture::Record &record = replayEvents[replayNext];
+            const auto at = replayScheduleOf(record);
+            if (at > now) {
+                break;
+            }
+            if (now - at > std::chrono::milliseconds(1)) {
+                stats.late++;
+            }
+            replay(record, at);
+        }
+        if (replayNext >= replayEvents.size()) {
+            return;
+        }
+        replayTimer.expires_at(std::max(replayScheduleOf(replayEvents[replayNext]),
+                                        now + std::chrono::milliseconds(1)));
+        replayTimer.async_wait([this](const ErrorCode &ec) {
+          if (!ec) {
+              replayTick();
+          }
+        });
+    }
 
-    WsClient client(
-        std::string(endpoint + "/chat?id=" + std::to_string(sen)),
-        false
-    );
-    client.config.header.emplace("X-Auth-Token", "aOel0Pnx9Fi-h2EeknsHuAyDknV5rbSR");
+    void replay(const wss::capture::Record &record, steady_clock::time_point at) {
+        const uint64_t id = idOfTraceUser(record.user);
+        std::vector<std::shared_ptr<Client>> &connections = userClients[id];
+        switch (record.type) {
+            case wss::capture::RecordType::Connect:
+                connections.push_back(std::make_shared<Client>(*this, id));
+                connections.back()->start(endpoint, sourceOf(id));
+                return;
+            case wss::capture::RecordType::Disconnect:
+                if (!connections.empty()) {
+                    if (connections.back()->isOpen()) {
+                        stats.disconnected++;
+                    }
+                    connections.back()->close();
+                    connections.pop_back();
+                }
+                return;
+            default:
+                break;
+        }
 
-    client.on_message = [](WsConnectionPtr, std::shared_ptr<WsClient::Message>) {
-//        cout << "Client: [" << sen << "] Message received: "<< endl;
-    };
+        const auto sender = std::find_if(connections.begin(), connections.end(),
+                                         [](const std::shared_ptr<Client> &client) {
+                                           return client->isOpen();
+                                         });
+        if (sender == connections.end()) {
+            stats.skipped++;
+            return;
+        }
+        recipients.clear();
+        if (record.type == wss::capture::RecordType::Direct) {
+            for (uint32_t user: record.recipients) {
+                recipients.push_back(idOfTraceUser(user));
+            }
+        } else {
+            // rooms and topics are not replayed, the same number of random users gets message directly
+            const std::size_t count = std::min<std::size_t>(record.count, options.connections - 1);
+            while (recipients.size() < count) {
+                const uint64_t recipient = options.firstId + random() % options.connections;
+                if (recipient != id && std::find(recipients.begin(), recipients.end(), recipient) == recipients.end()) {
+                    recipients.push_back(recipient);
+                }
+            }
+        }
+        if (recipients.empty()) {
+            recipients.push_back(0);
+        }
+        sendTo(sender->get(), at, record.size);
+    }
 
-    client.on_open = [sen](WsConnectionPtr connection) {
-      L_DEBUG_F("Client", "[%d] Connected!", sen);
-      std::lock_guard<std::mutex> locker(connMutex);
-      conns[sen] = connection;
-      connected++;
-    };
+    /// \brief Closes random open connection and opens it again with the same id
+    void reconnectRandom() {
+        // connections which are still connecting are not churned: a few tries to find open one
+        for (int attempt = 0; attempt < 8 && !clients.empty(); attempt++) {
+            std::shared_ptr<Client> &client = clients[random() % clients.size()];
+            if (!client->isOpen()) {
+                continue;
+            }
+            const uint64_t id = client->id;
+            client->close();
+            client = std::make_shared<Client>(*this, id);
+            client->start(endpoint, sourceOf(id));
+            stats.churned++;
+            return;
+        }
+    }
 
-    client.on_close = [sen](WsConnectionPtr /*connection*/, int status, const std::string &reason) {
-      const char *s = reason.c_str();
-      L_DEBUG_F("Client", "[%d] Disconnected with status code %d: %s", sen, status, s);
-      std::lock_guard<std::mutex> locker(connMutex);
-      conns.erase(sen);
-      connected--;
-    };
+    static const char *findAfter(const char *begin, const char *end, const char *marker) {
+        const char *markerEnd = marker + std::strlen(marker);
+        const char *found = std::search(begin, end, marker, markerEnd);
+        return found == end ? nullptr : found + (markerEnd - marker);
+    }
 
-    // See http://www.boost.org/doc/libs/1_55_0/doc/html/boost_asio/reference.html, Error Codes for error code meanings
-    client.on_error = [sen](WsConnectionPtr /*connection*/, const SimpleWeb::error_code &ec) {
-      L_ERR_F("Client", "[%d] Error: %s, error message: %s", sen, ec.category().name(), ec.message().c_str());
-      std::lock_guard<std::mutex> locker(connMutex);
-      conns.erase(sen);
-      connected--;
-    };
+    static uint64_t readUnsigned(const char *&position, const char *end) {
+        uint64_t out = 0;
+        for (; position < end && *position >= '0' && *position <= '9'; position++) {
+            out = out * 10 + static_cast<uint64_t>(*position - '0');
+        }
+        return out;
+    }
+
+    /// \return false if id is not a connection of this benchmark (admin or server messages)
+    bool pairKey(uint64_t sender, uint64_t recipient, uint64_t &out) const {
+        if (sender < options.firstId || sender - options.firstId >= options.connections
+            || recipient < options.firstId || recipient - options.firstId >= options.connections) {
+            return false;
+        }
+        out = (sender - options.firstId) * options.connections + (recipient - options.firstId);
+        return true;
+    }
+
+    void checkSequence(uint64_t sender, uint64_t recipient, uint64_t sequence) {
+        uint64_t key;
+        if (!pairKey(sender, recipient, key)) {
+            return;
+        }
+        uint32_t &last = receivedSequences[key];
+        if (sequence > last + 1u) {
+            stats.gaps += sequence - last - 1;
+        } else if (sequence <= last) {
+            stats.reordered++;
+            return;
+        }
+        last = static_cast<uint32_t>(sequence);
+    }
+
+    double loopRate() const {
+        return options.rate / options.threads;
+    }
+
+    steady_clock::time_point scheduleOf(uint64_t number) const {
+        return sendStart + std::chrono::duration_cast<steady_clock::duration>(
+            std::chrono::duration<double>(number / loopRate()));
+    }
 
-    client.start();
+    /// \brief Sends every message which schedule has come, whether previous ones are delivered or not
+    void tick() {
+        if (!sending) {
+            return;
+        }
+        const auto now = steady_clock::now();
+        const auto until = std::min(now, sendEnd);
+        while (scheduleOf(scheduled) <= until) {
+            const auto at = scheduleOf(scheduled);
+            if (now - at > std::chrono::milliseconds(1)) {
+                stats.late++;
+            }
+            sendOne(at);
+            scheduled++;
+        }
+        if (now >= sendEnd) {
+            sending = false;
+            return;
+        }
+
+        // no more often than once per millisecond: messages due within it are sent by one tick
+        sendTimer.expires_at(std::max(scheduleOf(scheduled), now + std::chrono::milliseconds(1)));
+        sendTimer.async_wait([this](const ErrorCode &ec) {
+          if (!ec) {
+              tick();
+          }
+        });
+    }
+
+    void sendOne(steady_clock::time_point at) {
+        if (openClients.empty()) {
+            stats.skipped++;
+            return;
+        }
+        Client *sender = openClients[random() % openClients.size()];
+
+        // distinct recipients, except sender: duplicates would be delivered once
+        const std::size_t fanout = options.effectiveFanout();
+        recipients.clear();
+        while (recipients.size() < fanout) {
+            const uint64_t recipient = options.firstReceiver() + random() % options.receivers();
+            if (recipient != sender->id
+                && std::find(recipients.begin(), recipients.end(), recipient) == recipients.end()) {
+                recipients.push_back(recipient);
+            }
+        }
+        sendTo(sender, at, payloadSize());
+    }
+
+    /// \brief Sends message to scratch recipients, 0 - bot
+    /// \param sender
+    /// \param at schedule
+    /// \param size of payload, bytes
+    void sendTo(Client *sender, steady_clock::time_point at, std::size_t size) {
+        std::string payload = "{\"type\":\"text\",\"sender\":" + std::to_string(sender->id) + ",\"recipients\":[";
+        std::string sequences;
+        for (std::size_t i = 0; i < recipients.size(); i++) {
+            if (i > 0) {
+                payload += ',';
+                sequences += ',';
+            }
+            payload += std::to_string(recipients[i]);
+            uint64_t key;
+            if (pairKey(sender->id, recipients[i], key)) {
+                sequences += std::to_string(++sentSequences[key]);
+                stats.expected++;
+            } else {
+                sequences += '0';
+            }
+        }
+        payload += "],\"text\":\"";
+        payload += std::to_string(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            at.time_since_epoch()).count());
+        payload += ':';
+        payload += sequences;
+        payload += ':';
+        if (size > payload.size() + 2) {
+            payload.append(size - payload.size() - 2, 'x');
+        }
+        payload += "\"}";
+
+        stats.sent++;
+        stats.sentBytes += wss::client::frameHeaderSize(payload.size(), true) + payload.size();
+        sender->send(wss::client::Text, payload);
+    }
+
+    std::size_t payloadSize() {
+        if (options.payloadMax <= options.payloadMin) {
+            return options.payloadMin;
+        }
+        const std::size_t span = options.payloadMax - options.payloadMin;
+        if (options.payloadExponential) {
+            // most messages are small, mean is a quarter of range, tail is cut at max
+            std::exponential_distribution<double> distribution(4.0 / span);
+            return options.payloadMin + std::min<std::size_t>(static_cast<std::size_t>(distribution(random)), span);
+        }
+        return options.payloadMin + random() % (span + 1);
+    }
+};
+
+asio::io_service &Client::ioServiceOf(Loop &loop) {
+    return loop.service;
 }
 
-void connectAll(asio::io_service *service) {
-    for (int i = 1; i < CONCURRENCY + 1; i += 2) {
-        service->post(boost::bind(&connect, i, i + 1));
-        service->post(boost::bind(&connect, i + 1, i));
-        _statistics.totalConnections += 2;
+Client::Client(Loop &loop, uint64_t id) :
+    wss::client::Connection<Client>(ioServiceOf(loop), loop.getOptions().tlsContext),
+    id(id),
+    loop(loop) { }
+
+void Client::start(const tcp::endpoint &endpoint, const asio::ip::address *source) {
+    startedAt = steady_clock::now();
+    phase = loop.getPhase();
+    const Options &options = loop.getOptions();
+    wss::client::Handshake handshake;
+    handshake.host = options.host;
+    handshake.port = options.port;
+    handshake.target = options.path + "?id=" + std::to_string(id);
+    handshake.headers.emplace_back("X-Auth-Token", options.token);
+    connect(endpoint, std::move(handshake), source);
+}
+
+void Client::onSecured(steady_clock::duration tlsHandshake) {
+    loop.tlsHandshakeLatency.record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(tlsHandshake).count()));
+}
+
+void Client::onOpen() {
+    loop.onOpen(this, phase, static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() - startedAt).count()));
+}
+
+void Client::onMessage(uint8_t, const char *data, std::size_t length) {
+    loop.stats.receivedBytes += wss::client::frameHeaderSize(length, false) + length;
+    loop.onMessage(*this, data, length);
+}
+
+void Client::onClose(const ErrorCode &, bool wasOpen) {
+    // wss connection is dropped without TLS shutdown: closing side is not measured
+    loop.onClosed(this, wasOpen);
+}
+
+struct Summary {
+  uint64_t connected = 0;
+  uint64_t failed = 0;
+  uint64_t closed = 0;
+  uint64_t sent = 0;
+  uint64_t sentBytes = 0;
+  uint64_t expected = 0;
+  uint64_t received = 0;
+  uint64_t receivedBytes = 0;
+  uint64_t skipped = 0;
+  uint64_t late = 0;
+  uint64_t reordered = 0;
+  uint64_t gaps = 0;
+  uint64_t churned = 0;
+  uint64_t disconnected = 0;
+};
+
+static Summary summarize(const std::vector<std::unique_ptr<Loop>> &loops) {
+    Summary out;
+    for (const auto &loop: loops) {
+        out.connected += loop->stats.connected;
+        out.failed += loop->stats.failed;
+        out.closed += loop->stats.closed;
+        out.sent += loop->stats.sent;
+        out.sentBytes += loop->stats.sentBytes;
+        out.expected += loop->stats.expected;
+        out.received += loop->stats.received;
+        out.receivedBytes += loop->stats.receivedBytes;
+        out.skipped += loop->stats.skipped;
+        out.late += loop->stats.late;
+        out.reordered += loop->stats.reordered;
+        out.gaps += loop->stats.gaps;
+        out.churned += loop->stats.churned;
+        out.disconnected += loop->stats.disconnected;
     }
+    return out;
 }
 
-void watchdog(asio::io_service &service) {
-    while (connected > 0) {
-        boost::this_thread::sleep_for(boost::chrono::seconds(1));
-        L_DEBUG_F("Watchdog", "Still have %d connections", connected.load())
+/// \brief CPU time and resident memory of server process, read from /proc: server must run on this host
+class ProcessSampler {
+ public:
+    explicit ProcessSampler(int pid) :
+        pid(pid) { }
+
+    /// \return false if process is not found
+    bool sample() {
+        std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+        std::string line;
+        if (!std::getline(stat, line)) {
+            return false;
+        }
+        // command name could contain spaces, fields are counted after it: utime and stime are 14th and 15th,
+        // threads number is 20th
+        const std::size_t nameEnd = line.rfind(')');
+        if (nameEnd == std::string::npos) {
+            return false;
+        }
+        std::istringstream fields(line.substr(nameEnd + 2));
+        std::string field;
+        uint64_t ticks = 0;
+        for (int i = 3; i <= 20 && fields >> field; i++) {
+            if (i == 14 || i == 15) {
+                ticks += std::stoull(field);
+            } else if (i == 20) {
+                threads = std::stoull(field);
+            }
+        }
+        cpuSeconds = static_cast<double>(ticks) / sysconf(_SC_CLK_TCK);
+
+        std::ifstream statm("/proc/" + std::to_string(pid) + "/statm");
+        uint64_t pages = 0, residentPages = 0;
+        if (!(statm >> pages >> residentPages)) {
+            return false;
+        }
+        rssBytes = residentPages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        return true;
     }
 
-    boost::this_thread::sleep_for(boost::chrono::seconds(2));
-    service.stop();
-}
+    double cpuSeconds = 0;
+    uint64_t rssBytes = 0;
+    uint64_t threads = 0;
+
+ private:
+    const int pid;
+};
+
+/// \brief Server side of run, sampled once per second while connecting, running and draining
+struct ServerUsage {
+  bool sampled = false;
+  /// \brief 100 - one core, average of run
+  double cpuPercent = 0;
+  double cpuPercentMax = 0;
+  uint64_t rssIdle = 0;
+  /// \brief After ramp, before run
+  uint64_t rssStart = 0;
+  /// \brief After run, before storm
+  uint64_t rssEnd = 0;
+  uint64_t rssStorm = 0;
+  uint64_t rssMax = 0;
+  uint64_t threadsStart = 0;
+  uint64_t threadsEnd = 0;
+  uint64_t threadsMax = 0;
+
+  void update(const ProcessSampler &server) {
+      rssMax = std::max(rssMax, server.rssBytes);
+      threadsMax = std::max(threadsMax, server.threads);
+  }
+};
+
+struct Results {
+  Summary connected;
+  Summary summary;
+  /// \brief Connected and failed by reconnect wave only
+  Summary storm;
+  double rampSeconds = 0;
+  double stormSeconds = 0;
+  LatencyHistogram latency;
+  LatencyHistogram spread;
+  uint64_t partialGroups = 0;
+  std::array<LatencyHistogram, PhaseCount> connectLatency;
+  LatencyHistogram tlsHandshakeLatency;
+  ServerUsage usage;
+};
 
-void run() {
-    asio::io_service ioService;
-    boost::thread_group threadGroup;
-    asio::io_service::work work(ioService);
+static void writePercentiles(std::ostream &out, const std::string &prefix, const LatencyHistogram &histogram) {
+    out << ",\n"
+        << "  \"" << prefix << "P50Ms\": " << histogram.percentile(0.50) / 1000.0 << ",\n"
+        << "  \"" << prefix << "P99Ms\": " << histogram.percentile(0.99) / 1000.0 << ",\n"
+        << "  \"" << prefix << "MaxMs\": " << histogram.getMax() / 1000.0;
+}
 
-    // run threads
-    for (int i = 0; i < CONCURRENCY * 2; i++) {
-        threadGroup.create_thread(
-            boost::bind(&asio::io_service::run, &ioService)
-        );
+/// \brief Report for regression tracking: one flat object, latencies in milliseconds
+static bool writeJson(const std::string &path, const Options &options, const Results &results) {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+        return false;
+    }
+    const Summary &summary = results.summary;
+    const LatencyHistogram &latency = results.latency;
+    const ServerUsage &usage = results.usage;
+    const uint64_t expected = summary.expected;
+    const double egressSeconds = options.duration + options.drain;
+    out << std::fixed << std::setprecision(3)
+        << "{\n"
+        << "  \"connections\": " << options.connections << ",\n"
+        << "  \"connected\": " << results.connected.connected << ",\n"
+        << "  \"connectFailed\": " << results.connected.failed << ",\n"
+        << "  \"rampSeconds\": " << results.rampSeconds << ",\n"
+        << "  \"tls\": " << (options.tlsContext != nullptr ? "true" : "false") << ",\n"
+        << "  \"replay\": " << (options.isReplay() ? "true" : "false") << ",\n"
+        << "  \"replaySpeed\": " << options.speed << ",\n"
+        << "  \"targetRate\": " << options.rate << ",\n"
+        << "  \"durationSeconds\": " << options.duration << ",\n"
+        << "  \"fanout\": " << options.fanout << ",\n"
+        << "  \"senders\": " << options.senders << ",\n"
+        << "  \"payloadMin\": " << options.payloadMin << ",\n"
+        << "  \"payloadMax\": " << options.payloadMax << ",\n"
+        << "  \"sent\": " << summary.sent << ",\n"
+        << "  \"sentPerSecond\": " << summary.sent / options.duration << ",\n"
+        << "  \"sentBytes\": " << summary.sentBytes << ",\n"
+        << "  \"expected\": " << expected << ",\n"
+        << "  \"received\": " << summary.received << ",\n"
+        << "  \"receivedPerSecond\": " << summary.received / options.duration << ",\n"
+        << "  \"receivedBytes\": " << summary.receivedBytes << ",\n"
+        << "  \"egressBytesPerSecond\": " << summary.receivedBytes / egressSeconds << ",\n"
+        << "  \"lost\": " << (expected > summary.received ? expected - summary.received : 0) << ",\n"
+        << "  \"gaps\": " << summary.gaps << ",\n"
+        << "  \"reordered\": " << summary.reordered << ",\n"
+        << "  \"skipped\": " << summary.skipped << ",\n"
+        << "  \"late\": " << summary.late << ",\n"
+        << "  \"latencyP50Ms\": " << latency.percentile(0.50) / 1000.0 << ",\n"
+        << "  \"latencyP90Ms\": " << latency.percentile(0.90) / 1000.0 << ",\n"
+        << "  \"latencyP99Ms\": " << latency.percentile(0.99) / 1000.0 << ",\n"
+        << "  \"latencyP999Ms\": " << latency.percentile(0.999) / 1000.0 << ",\n"
+        << "  \"latencyMaxMs\": " << latency.getMax() / 1000.0;
+    writePercentiles(out, "connect", results.connectLatency[PhaseRamp]);
+    if (options.tlsContext != nullptr) {
+        writePercentiles(out, "tlsHandshake", results.tlsHandshakeLatency);
+    }
+    if (options.effectiveFanout() > 1) {
+        out << ",\n"
+            << "  \"groupsComplete\": " << results.spread.getCount() << ",\n"
+            << "  \"groupsPartial\": " << results.partialGroups;
+        writePercentiles(out, "spread", results.spread);
+    }
+    if (options.churn > 0) {
+        out << ",\n"
+            << "  \"churnRate\": " << options.churn << ",\n"
+            << "  \"churned\": " << summary.churned << ",\n"
+            << "  \"churnConnected\": " << results.connectLatency[PhaseChurn].getCount();
+        writePercentiles(out, "churnConnect", results.connectLatency[PhaseChurn]);
     }
+    if (options.storm) {
+        out << ",\n"
+            << "  \"stormConnected\": " << results.storm.connected << ",\n"
+            << "  \"stormFailed\": " << results.storm.failed << ",\n"
+            << "  \"stormSeconds\": " << results.stormSeconds;
+        writePercentiles(out, "stormConnect", results.connectLatency[PhaseStorm]);
+    }
+    if (usage.sampled) {
+        out << ",\n"
+            << "  \"serverCpuPercent\": " << usage.cpuPercent << ",\n"
+            << "  \"serverCpuPercentMax\": " << usage.cpuPercentMax << ",\n"
+            << "  \"serverRssIdleBytes\": " << usage.rssIdle << ",\n"
+            << "  \"serverRssStartBytes\": " << usage.rssStart << ",\n"
+            << "  \"serverRssEndBytes\": " << usage.rssEnd << ",\n"
+            << "  \"serverRssMaxBytes\": " << usage.rssMax << ",\n"
+            << "  \"serverThreadsStart\": " << usage.threadsStart << ",\n"
+            << "  \"serverThreadsEnd\": " << usage.threadsEnd << ",\n"
+            << "  \"serverThreadsMax\": " << usage.threadsMax;
+        if (options.storm) {
+            out << ",\n"
+                << "  \"serverRssStormBytes\": " << usage.rssStorm;
+        }
+    }
+    out << "\n}\n";
+    return out.good();
+}
 
-    // connect
-    connectAll(&ioService);
+static void printPercentiles(const std::string &title, const LatencyHistogram &histogram) {
+    cout << std::fixed << std::setprecision(3) << title << ", ms: " << histogram.getCount() << endl
+         << "  p50   " << histogram.percentile(0.50) / 1000.0 << endl
+         << "  p90   " << histogram.percentile(0.90) / 1000.0 << endl
+         << "  p99   " << histogram.percentile(0.99) / 1000.0 << endl
+         << "  max   " << histogram.getMax() / 1000.0 << endl;
+}
 
+/// \brief Starts connections of ids in 10 ms batches and waits until every one is open or failed
+/// \param loops
+/// \param options
+/// \param ids user of every connection, connection is started by loop of its user
+/// \param ramp connections per second, 0 - all at once
+/// \param onSecond called once per second of waiting
+/// \return connected and failed by this call
+static Summary connectAll(const std::vector<std::unique_ptr<Loop>> &loops, const Options &options,
+                          const std::vector<uint64_t> &ids, double ramp, const std::function<void()> &onSecond) {
+    const Summary before = summarize(loops);
+    const auto start = steady_clock::now();
+    auto nextReport = start + std::chrono::seconds(1);
+    std::size_t started = 0;
+    Summary out;
+    while (true) {
+        const auto now = steady_clock::now();
+        const double elapsed = std::chrono::duration<double>(now - start).count();
+        const std::size_t due = ramp > 0
+                                ? std::min(ids.size(), static_cast<std::size_t>(elapsed * ramp) + 1)
+                                : ids.size();
+        for (; started < due; started++) {
+            loops[(ids[started] - options.firstId) % loops.size()]->connect(ids[started]);
+        }
 
-    // wait for all connected
-    while (connected < CONCURRENCY) {
-        cout << "Waiting for connecting all connections..." << endl;
-        boost::this_thread::sleep_for(boost::chrono::seconds(1));
+        const Summary summary = summarize(loops);
+        out.connected = summary.connected - before.connected;
+        out.failed = summary.failed - before.failed;
+        if (now >= nextReport) {
+            cout << "  connected " << out.connected << ", failed " << out.failed << endl;
+            onSecond();
+            nextReport += std::chrono::seconds(1);
+        }
+        if (out.connected + out.failed >= ids.size()) {
+            break;
+        }
+        // connects that never complete: give up 10 seconds after the last one is started
+        if (started == ids.size() && elapsed > (ramp > 0 ? ids.size() / ramp : 0) + 10) {
+            cerr << "  timed out waiting for connections" << endl;
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
     }
+    return out;
+}
 
-    // run message exchanges
-    for (int i = 1; i < CONCURRENCY + 1; i += 2) {
-        ioService.post(boost::bind(&handleOne, i, i + 1, conns[i]));
-        ioService.post(boost::bind(&handleOne, i + 1, i, conns[i + 1]));
+/// \brief Reads trace and splits it by loops of users. Sets connections to users of trace and duration to its time
+/// \param options
+/// \param out records of each loop
+/// \param online users which were online when capture started: they are connected before replay
+/// \return false if trace can't be read
+static bool loadTrace(Options &options,
+                      std::vector<std::vector<wss::capture::Record>> &out,
+                      std::vector<uint64_t> &online) {
+    std::ifstream in(options.replayPath, std::ios::binary);
+    if (!in.is_open()) {
+        cerr << "Can't open trace " << options.replayPath << endl;
+        return false;
     }
+    enum class Seen : uint8_t {
+      No,
+      Connected,
+      Online
+    };
+    std::vector<Seen> users(1, Seen::No);
+    const auto see = [&users](uint32_t user, Seen state) {
+      if (user >= users.size()) {
+          users.resize(user + 1, Seen::No);
+      }
+      if (users[user] == Seen::No) {
+          users[user] = state;
+      }
+    };
 
-    ioService.post(boost::bind(watchdog, boost::ref(ioService)));
+    out.assign(options.threads, std::vector<wss::capture::Record>());
+    uint64_t first = 0, last = 0, records = 0, messages = 0;
+    try {
+        wss::capture::Reader reader(in);
+        wss::capture::Record record;
+        while (reader.next(record)) {
+            // not authorized connections
+            if (record.user == 0) {
+                continue;
+            }
+            if (records++ == 0) {
+                first = record.at;
+            }
+            record.at -= first;
+            last = record.at;
+            // user seen before own connect was connected before capture. Users known only as recipients could be
+            // offline, but most messages are delivered to online ones
+            see(record.user, record.type == wss::capture::RecordType::Connect ? Seen::Connected : Seen::Online);
+            for (uint32_t recipient: record.recipients) {
+                see(recipient, Seen::Online);
+            }
+            if (record.type == wss::capture::RecordType::Direct || record.type == wss::capture::RecordType::Fanout) {
+                messages++;
+            }
+            out[(record.user - 1) % options.threads].push_back(std::move(record));
+        }
+    } catch (const std::runtime_error &e) {
+        cerr << "Can't read trace " << options.replayPath << ": " << e.what() << endl;
+        return false;
+    }
+    for (uint32_t user = 1; user < users.size(); user++) {
+        if (users[user] == Seen::Online) {
+            online.push_back(options.firstId + user - 1);
+        }
+    }
+    if (users.size() < 2) {
+        cerr << "Trace " << options.replayPath << " is empty" << endl;
+        return false;
+    }
 
-    threadGroup.join_all();
+    options.connections = users.size() - 1;
+    options.duration = std::max(last / 1e6 / options.speed, 0.001);
+    cout << "Trace: " << records << " records, " << messages << " messages, " << options.connections << " users ("
+         << online.size() << " online at start), " << std::fixed << std::setprecision(1) << last / 1e6
+         << " s recorded" << endl;
+    return true;
+}
 
-    conns.clear();
+/// \brief Each connection takes descriptor, default soft limit (1024) is far too low
+static void raiseDescriptorsLimit(std::size_t connections) {
+    struct rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        return;
+    }
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < connections + 64) {
+        cerr << "Open files limit " << limit.rlim_cur << " is less than connections number, raise it by ulimit -n"
+             << endl;
+    }
 }
 
-int main() {
-    L_LEVEL(logger::LEVEL_INFO | logger::LEVEL_ERROR | logger::LEVEL_WARNING);
+static bool parseOptions(int argc, char **argv, Options &out) {
+    cmdline::parser args;
+    args.add<std::string>("endpoint", 'e', "Server host:port", false, "localhost:8085");
+    args.add<std::string>("path", 'p', "Chat endpoint path", false, "/chat");
+    args.add<std::string>("token", 't', "X-Auth-Token header value", false, "aOel0Pnx9Fi-h2EeknsHuAyDknV5rbSR");
+    args.add<uint64_t>("first-id", 'i', "User id of first connection, others are following ones", false, 1);
+    args.add<std::size_t>("connections", 'c', "Connections number", false, 1000);
+    args.add<double>("ramp", 0, "New connections per second", false, 1000);
+    args.add<double>("rate", 'r', "Target messages per second (open-loop), 0 - connect only", false, 1000);
+    args.add<double>("duration", 'd', "Seconds of sending", false, 30);
+    args.add<double>("drain", 0, "Seconds to wait for deliveries after sending is finished", false, 2);
+    args.add<std::size_t>("fanout", 'f', "Recipients per message", false, 1);
+    args.add<std::size_t>("senders", 's',
+                          "Group mode: first N connections send to --fanout of the other ones, "
+                          "which only receive. 0 - every connection sends", false, 0);
+    args.add<std::size_t>("payload-min", 0, "Min message size, bytes", false, 128);
+    args.add<std::size_t>("payload-max", 0, "Max message size, bytes", false, 128);
+    args.add<std::string>("payload-dist", 0, "Message size distribution between min and max", false, "uniform",
+                          cmdline::oneof<std::string>("uniform", "exponential"));
+    args.add<std::size_t>("threads", 'T', "Event loop threads", false, 4);
+    args.add<std::string>("source-ips", 0,
+                          "Comma separated local addresses to bind connections to, round-robin: "
+                          "one address gives at most ~28k connections to one server port", false, "");
+    args.add<std::string>("json", 'o', "Write results to JSON file", false, "");
+    args.add<int>("server-pid", 0, "Sample CPU, memory and threads of server process running on this host", false, 0);
+    args.add<double>("churn", 0, "Open connections closed and opened again per second while running", false, 0);
+    args.add("storm", 0, "After run close all connections and reconnect them (see --storm-ramp)");
+    args.add<double>("storm-ramp", 0, "Reconnects per second of storm, 0 - all at once", false, 0);
+    args.add("tls", 0, "Connect over wss, server certificate is not verified");
+    args.add<std::string>("replay", 0,
+                          "Replay traffic trace captured by server (chat.capture) instead of generated messages: "
+                          "--connections, --rate, --duration and payload options are taken from trace", false, "");
+    args.add<double>("speed", 0, "Replay speed, 2 - twice faster than recorded", false, 1);
+    args.parse_check(argc, argv);
+
+    const std::string endpoint = args.get<std::string>("endpoint");
+    const std::size_t colon = endpoint.rfind(':');
+    if (colon == std::string::npos) {
+        cerr << "Endpoint must be host:port" << endl;
+        return false;
+    }
+    out.host = endpoint.substr(0, colon);
+    out.port = endpoint.substr(colon + 1);
+    out.path = args.get<std::string>("path");
+    out.token = args.get<std::string>("token");
+    out.firstId = args.get<uint64_t>("first-id");
+    out.connections = args.get<std::size_t>("connections");
+    out.ramp = args.get<double>("ramp");
+    out.rate = args.get<double>("rate");
+    out.duration = args.get<double>("duration");
+    out.drain = args.get<double>("drain");
+    out.fanout = args.get<std::size_t>("fanout");
+    out.senders = args.get<std::size_t>("senders");
+    out.payloadMin = args.get<std::size_t>("payload-min");
+    out.payloadMax = args.get<std::size_t>("payload-max");
+    out.payloadExponential = args.get<std::string>("payload-dist") == "exponential";
+    out.threads = std::max<std::size_t>(1, args.get<std::size_t>("threads"));
+    out.jsonPath = args.get<std::string>("json");
+    out.serverPid = args.get<int>("server-pid");
+    out.churn = args.get<double>("churn");
+    out.storm = args.exist("storm");
+    out.stormRamp = args.get<double>("storm-ramp");
+    out.tls = args.exist("tls");
+    out.replayPath = args.get<std::string>("replay");
+    out.speed = args.get<double>("speed");
+    if (out.isReplay()) {
+        out.rate = 0;
+    }
+
+    std::string sources = args.get<std::string>("source-ips");
+    std::size_t begin = 0;
+    while (begin < sources.size()) {
+        std::size_t end = sources.find(',', begin);
+        if (end == std::string::npos) {
+            end = sources.size();
+        }
+        ErrorCode ec;
+        out.sourceAddresses.push_back(asio::ip::address::from_string(sources.substr(begin, end - begin), ec));
+        if (ec) {
+            cerr << "Invalid source address: " << sources.substr(begin, end - begin) << endl;
+            return false;
+        }
+        begin = end + 1;
+    }
+
+    if (out.connections == 0 || out.ramp <= 0 || out.rate < 0 || out.duration <= 0 || out.churn < 0
+        || out.stormRamp < 0 || out.speed <= 0) {
+        cerr << "Connections, ramp and duration must be greater than 0, rates can't be negative" << endl;
+        return false;
+    }
+    if (out.senders >= out.connections || (out.isReplay() && out.senders > 0)) {
+        cerr << "Senders must be less than connections: others are receivers. Replay has no group mode" << endl;
+        return false;
+    }
+    return true;
+}
 
-    if (CONCURRENCY % 2 != 0) {
-        cerr << "Concurrent connections number must be even" << endl;
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
         return 1;
     }
+    std::vector<std::vector<wss::capture::Record>> replayEvents;
+    std::vector<uint64_t> ids;
+    if (options.isReplay()) {
+        if (!loadTrace(options, replayEvents, ids)) {
+            return 1;
+        }
+    } else {
+        for (std::size_t i = 0; i < options.connections; i++) {
+            ids.push_back(options.firstId + i);
+        }
+    }
+    raiseDescriptorsLimit(options.connections);
+
+    asio::ssl::context tlsContext(asio::ssl::context::sslv23_client);
+    if (options.tls) {
+        // handshake cost is measured, not certificate of test server
+        tlsContext.set_verify_mode(asio::ssl::verify_none);
+        options.tlsContext = &tlsContext;
+    }
+
+    tcp::endpoint endpoint;
+    {
+        asio::io_service resolverService;
+        tcp::resolver resolver(resolverService);
+        ErrorCode ec;
+        auto it = resolver.resolve(tcp::resolver::query(options.host, options.port), ec);
+        if (ec || it == tcp::resolver::iterator()) {
+            cerr << "Can't resolve " << options.host << ": " << ec.message() << endl;
+            return 1;
+        }
+        endpoint = *it;
+    }
+
+    std::vector<std::unique_ptr<Loop>> loops;
+    for (std::size_t i = 0; i < options.threads; i++) {
+        loops.push_back(std::make_unique<Loop>(i, options, endpoint));
+        loops.back()->run();
+    }
+
+    Results results;
+    ServerUsage &usage = results.usage;
+    ProcessSampler server(options.serverPid);
+    if (options.serverPid > 0) {
+        usage.sampled = server.sample();
+        usage.rssIdle = server.rssBytes;
+        usage.update(server);
+        if (!usage.sampled) {
+            cerr << "Can't read /proc of server process " << options.serverPid << ", it's not sampled" << endl;
+        }
+    }
+    const auto sampleServer = [&usage, &server] {
+      if (usage.sampled && server.sample()) {
+          usage.update(server);
+      }
+    };
+
+    cout << "Connecting " << ids.size() << (options.tlsContext != nullptr ? " wss" : "")
+         << " connections, " << options.ramp << "/s" << endl;
+    const auto rampStart = steady_clock::now();
+    connectAll(loops, options, ids, options.ramp, sampleServer);
+    results.rampSeconds = std::chrono::duration<double>(steady_clock::now() - rampStart).count();
+    results.connected = summarize(loops);
+    sampleServer();
+    usage.rssStart = server.rssBytes;
+    usage.threadsStart = server.threads;
+
+    steady_clock::time_point runStart = steady_clock::now();
+    if (options.rate > 0 || options.churn > 0 || options.isReplay()) {
+        if (options.isReplay()) {
+            cout << "Replaying " << options.replayPath << " at " << options.speed << "x for " << std::fixed
+                 << std::setprecision(1) << options.duration << " s" << endl;
+        }
+        if (options.rate > 0) {
+            cout << "Sending " << options.rate << " messages/s for " << options.duration << " s, fan-out "
+                 << options.effectiveFanout();
+            if (options.senders > 0) {
+                cout << ", " << options.senders << " senders to " << options.receivers() << " receivers";
+            }
+            cout << endl;
+        }
+        if (options.churn > 0) {
+            cout << "Reconnecting " << options.churn << " connections/s for " << options.duration << " s" << endl;
+        }
+        runStart += std::chrono::milliseconds(100);
+        const auto runEnd = runStart + std::chrono::duration_cast<steady_clock::duration>(
+            std::chrono::duration<double>(options.duration));
+        for (auto &loop: loops) {
+            if (options.rate > 0) {
+                loop->startSending(runStart, runEnd);
+            }
+            if (options.churn > 0) {
+                loop->startChurn(runStart, runEnd);
+            }
+        }
+        for (std::size_t i = 0; i < replayEvents.size(); i++) {
+            loops[i]->startReplay(runStart, std::move(replayEvents[i]));
+        }
+
+        Summary last = summarize(loops);
+        const double cpuStart = server.cpuSeconds;
+        double lastCpu = cpuStart;
+        auto lastSample = steady_clock::now();
+        const auto drainEnd = runEnd + std::chrono::duration_cast<steady_clock::duration>(
+            std::chrono::duration<double>(options.drain));
+        while (steady_clock::now() < drainEnd) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            const Summary current = summarize(loops);
+            cout << "  sent " << (current.sent - last.sent) << "/s, received " << (current.received - last.received)
+                 << "/s, " << std::fixed << std::setprecision(1)
+                 << (current.receivedBytes - last.receivedBytes) / (1024.0 * 1024.0) << " MiB/s, open "
+                 << (current.connected - current.closed);
+            if (options.churn > 0) {
+                cout << ", reconnected " << (current.churned - last.churned) << "/s, failed "
+                     << (current.failed - last.failed);
+            }
+            if (usage.sampled && server.sample()) {
+                const auto now = steady_clock::now();
+                const double cpuPercent = 100.0 * (server.cpuSeconds - lastCpu)
+                    / std::chrono::duration<double>(now - lastSample).count();
+                usage.cpuPercentMax = std::max(usage.cpuPercentMax, cpuPercent);
+                usage.update(server);
+                cout << ", server cpu " << cpuPercent << "%, rss " << server.rssBytes / (1024 * 1024) << " MiB, "
+                     << server.threads << " threads";
+                lastCpu = server.cpuSeconds;
+                lastSample = now;
+            }
+            cout << endl;
+            last = current;
+        }
+        if (usage.sampled) {
+            usage.cpuPercent = 100.0 * (lastCpu - cpuStart)
+                / std::chrono::duration<double>(lastSample - runStart).count();
+        }
+    }
+    sampleServer();
+    usage.rssEnd = server.rssBytes;
+    usage.threadsEnd = server.threads;
+
+    const Summary beforeClose = summarize(loops);
+    if (options.storm) {
+        cout << "Closing all connections and reconnecting "
+             << (options.stormRamp > 0 ? std::to_string(static_cast<uint64_t>(options.stormRamp)) + "/s"
+                                       : std::string("at once")) << endl;
+        for (auto &loop: loops) {
+            loop->closeAll();
+            loop->setPhase(PhaseStorm);
+        }
+        // closeAll() is done by loops asynchronously
+        for (int i = 0; i < 500; i++) {
+            const Summary current = summarize(loops);
+            if (current.connected == current.closed) {
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        const auto stormStart = steady_clock::now();
+        std::vector<uint64_t> all;
+        for (std::size_t i = 0; i < options.connections; i++) {
+            all.push_back(options.firstId + i);
+        }
+        results.storm = connectAll(loops, options, all, options.stormRamp, sampleServer);
+        results.stormSeconds = std::chrono::duration<double>(steady_clock::now() - stormStart).count();
+        // redelivery and auth of reconnected users settle
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        sampleServer();
+        usage.rssStorm = server.rssBytes;
+    }
+
+    for (auto &loop: loops) {
+        loop->closeAll();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    for (auto &loop: loops) {
+        loop->stop();
+        results.latency.merge(loop->histogram);
+        for (std::size_t phase = 0; phase < PhaseCount; phase++) {
+            results.connectLatency[phase].merge(loop->connectLatency[phase]);
+        }
+        results.tlsHandshakeLatency.merge(loop->tlsHandshakeLatency);
+    }
+
+    // recipients of one group message are spread over loops
+    Spreads &spreads = loops[0]->spreads;
+    for (std::size_t i = 1; i < loops.size(); i++) {
+        for (const auto &item: loops[i]->spreads) {
+            spreads[item.first].merge(item.second);
+        }
+        Spreads().swap(loops[i]->spreads);
+    }
+    for (const auto &item: spreads) {
+        if (item.second.recipients >= options.effectiveFanout()) {
+            results.spread.record((item.second.last - item.second.first) / 1000);
+        } else {
+            results.partialGroups++;
+        }
+    }
+
+    const Summary &summary = results.summary = summarize(loops);
+    const Summary &connectedSummary = results.connected;
+    const LatencyHistogram &latency = results.latency;
+    const double sendSeconds = options.duration;
+    // churn and replay closes are counted as closed too
+    cout << endl
+         << "Connections:        " << connectedSummary.connected << " of " << ids.size() << " in "
+         << std::fixed << std::setprecision(1) << results.rampSeconds << " s, failed " << connectedSummary.failed
+         << ", closed by server " << beforeClose.closed - beforeClose.churned - beforeClose.disconnected << endl;
+    printPercentiles("Connect latency", results.connectLatency[PhaseRamp]);
+    if (options.tlsContext != nullptr) {
+        printPercentiles("TLS handshake", results.tlsHandshakeLatency);
+    }
+    if (options.churn > 0) {
+        cout << "Churn:              " << beforeClose.churned << " reconnected, failed "
+             << beforeClose.failed - connectedSummary.failed << endl;
+        printPercentiles("Churn connect latency", results.connectLatency[PhaseChurn]);
+    }
+    if (options.storm) {
+        cout << "Reconnect storm:    " << results.storm.connected << " of " << options.connections << " in "
+             << std::setprecision(2) << results.stormSeconds << " s, failed " << results.storm.failed << endl;
+        printPercentiles("Storm connect latency", results.connectLatency[PhaseStorm]);
+    }
+    if (options.rate > 0 || options.isReplay()) {
+        const uint64_t expected = summary.expected;
+        cout << "Sent:               " << summary.sent << " messages (" << std::setprecision(0)
+             << summary.sent / sendSeconds << "/s";
+        if (!options.isReplay()) {
+            cout << " of " << options.rate << "/s target";
+        }
+        cout << "), "
+             << summary.sentBytes / (1024 * 1024) << " MiB" << endl
+             << "Received:           " << summary.received << " of " << expected << " expected ("
+             << std::setprecision(2) << (expected > 0 ? 100.0 * summary.received / expected : 0) << "%), "
+             << std::setprecision(0) << summary.received / sendSeconds << "/s, "
+             << std::setprecision(1) << summary.receivedBytes / (sendSeconds + options.drain) / (1024 * 1024)
+             << " MiB/s server egress" << endl
+             << "Lost:               " << (expected > summary.received ? expected - summary.received : 0)
+             << ", sequence gaps " << summary.gaps << ", out of order " << summary.reordered << endl
+             << "Skipped (no sender): " << summary.skipped << ", sent late by generator: " << summary.late << endl
+             << "Latency from schedule, ms:" << endl
+             << std::setprecision(3)
+             << "  p50   " << latency.percentile(0.50) / 1000.0 << endl
+             << "  p90   " << latency.percentile(0.90) / 1000.0 << endl
+             << "  p99   " << latency.percentile(0.99) / 1000.0 << endl
+             << "  p99.9 " << latency.percentile(0.999) / 1000.0 << endl
+             << "  max   " << latency.getMax() / 1000.0 << endl;
+    }
+    if (options.rate > 0 && options.effectiveFanout() > 1) {
+        cout << "Groups:             " << results.spread.getCount() << " complete, " << results.partialGroups
+             << " partial" << endl;
+        printPercentiles("Group delivery spread (first to last recipient)", results.spread);
+    }
+    if (usage.sampled) {
+        const uint64_t mib = 1024 * 1024;
+        cout << "Server:             cpu " << std::setprecision(1) << usage.cpuPercent << "% average, "
+             << usage.cpuPercentMax << "% max (100% - one core)" << endl
+             << "  rss " << usage.rssIdle / mib << " MiB idle, " << usage.rssStart / mib << " connected, "
+             << usage.rssEnd / mib << " after run";
+        if (options.storm) {
+            cout << ", " << usage.rssStorm / mib << " after storm";
+        }
+        cout << ", " << usage.rssMax / mib << " max" << endl
+             << "  threads " << usage.threadsStart << " connected, " << usage.threadsEnd << " after run, "
+             << usage.threadsMax << " max" << endl;
+    }
 
-    for (int i = 0; i < RUN_TIMES; i++) {
-        L_INFO_F("main", "Run benchmark %d time", i + 1);
-        run();
+    if (!options.jsonPath.empty() && !writeJson(options.jsonPath, options, results)) {
+        cerr << "Can't write results to " << options.jsonPath << endl;
+        return 1;
     }
-    _statistics.calculate();
 
     return 0;
 }
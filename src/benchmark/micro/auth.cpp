@@ -0,0 +1,51 @@
+/**
+ * wsserver
+ * auth.cpp
+ *
+ * Micro-benchmarks: local auth validators on request with valid credentials, as every handshake is checked
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <memory>
+#include <benchmark/benchmark.h>
+#include "../../base/auth/BasicAuth.h"
+#include "../../base/auth/BearerAuth.h"
+#include "../../base/auth/CookieAuth.h"
+#include "../../base/auth/HeaderAuth.h"
+
+namespace {
+
+/// \brief Request is made by auth itself, so it is always valid
+template<typename AuthType>
+void validate(benchmark::State &state, const AuthType &auth) {
+    wss::web::Request request;
+    auth.performAuth(request);
+    for (auto _: state) {
+        benchmark::DoNotOptimize(auth.validateAuth(request));
+    }
+}
+
+void BM_AuthBasic(benchmark::State &state) {
+    validate(state, wss::BasicAuth("username", "password"));
+}
+
+void BM_AuthHeader(benchmark::State &state) {
+    validate(state, wss::HeaderAuth("X-Auth-Token", "aOel0Pnx9Fi-h2EeknsHuAyDknV5rbSR"));
+}
+
+void BM_AuthBearer(benchmark::State &state) {
+    validate(state, wss::BearerAuth("aOel0Pnx9Fi-h2EeknsHuAyDknV5rbSR"));
+}
+
+void BM_AuthCookie(benchmark::State &state) {
+    validate(state, wss::CookieAuth("session", "0123456789abcdef0123456789abcdef"));
+}
+
+}
+
+BENCHMARK(BM_AuthBasic);
+BENCHMARK(BM_AuthHeader);
+BENCHMARK(BM_AuthBearer);
+BENCHMARK(BM_AuthCookie);
@@ -0,0 +1,83 @@
+/**
+ * wsserver
+ * base64.cpp
+ *
+ * Micro-benchmark: base64 of handshake accept key (20 bytes), credentials and binary data,
+ * OpenSSL BIO chain (previous Crypto::Base64) vs wss::utils::base64_encode
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <cmath>
+#include <random>
+#include <string>
+#include <benchmark/benchmark.h>
+#include <openssl/buffer.h>
+#include <openssl/evp.h>
+#include "../../helpers/base64.h"
+
+namespace {
+
+std::string makeInput(std::size_t size) {
+    std::mt19937 rng(0xBA5E64);
+    std::string input(size, '\0');
+    for (auto &c: input) {
+        c = static_cast<char>(rng());
+    }
+    return input;
+}
+
+/// \brief Previous Crypto::Base64::encode
+std::string encodeBio(const std::string &ascii) {
+    std::string base64;
+    BUF_MEM *bptr = BUF_MEM_new();
+    BIO *b64 = BIO_new(BIO_f_base64());
+    BIO_set_flags(b64, BIO_FLAGS_BASE64_NO_NL);
+    BIO *bio = BIO_new(BIO_s_mem());
+    BIO_push(b64, bio);
+    BIO_set_mem_buf(b64, bptr, BIO_CLOSE);
+
+    base64.resize(static_cast<std::size_t>(std::round(4 * std::ceil(ascii.size() / 3.0))));
+    bptr->length = 0;
+    bptr->max = base64.size() + 1;
+    bptr->data = &base64[0];
+    if (BIO_write(b64, &ascii[0], static_cast<int>(ascii.size())) <= 0 || BIO_flush(b64) <= 0) {
+        base64.clear();
+    }
+    bptr->length = 0;
+    bptr->max = 0;
+    bptr->data = nullptr;
+    BIO_free_all(b64);
+    return base64;
+}
+
+void BM_Base64EncodeBio(benchmark::State &state) {
+    const std::string input = makeInput(static_cast<std::size_t>(state.range(0)));
+    for (auto _: state) {
+        benchmark::DoNotOptimize(encodeBio(input));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+
+void BM_Base64Encode(benchmark::State &state) {
+    const std::string input = makeInput(static_cast<std::size_t>(state.range(0)));
+    for (auto _: state) {
+        benchmark::DoNotOptimize(wss::utils::base64_encode(input));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+
+void BM_Base64Decode(benchmark::State &state) {
+    const std::string input = wss::utils::base64_encode(makeInput(static_cast<std::size_t>(state.range(0))));
+    for (auto _: state) {
+        benchmark::DoNotOptimize(wss::utils::base64_decode(input));
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * input.size()));
+}
+
+}
+
+BENCHMARK(BM_Base64EncodeBio)->Arg(20)->Arg(64)->Arg(4096)->Arg(65536);
+BENCHMARK(BM_Base64Encode)->Arg(20)->Arg(64)->Arg(4096)->Arg(65536);
+BENCHMARK(BM_Base64Decode)->Arg(20)->Arg(64)->Arg(4096)->Arg(65536);
@@ -0,0 +1,117 @@
+/**
+ * wsserver
+ * connection_storage.cpp
+ *
+ * Micro-benchmarks: ConnectionStorage add, lookup and forEach (delivery path) with 1k, 100k and 1M users,
+ * one connection per user, and full sweep of hot connection metadata. Connection objects are real,
+ * so 1M users take about 1 GB
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "../../chat/ConnectionStorage.h"
+#include "../../base/ws/WebsocketServer.hpp"
+
+namespace {
+
+using Connection = wss::server::websocket::SocketServerBase::Connection;
+
+boost::asio::io_service &ioService() {
+    static boost::asio::io_service service;
+    return service;
+}
+
+/// \brief Connections are made once per size and shared by benchmarks
+const std::vector<wss::WsConnectionPtr> &connections(std::size_t count) {
+    static std::vector<wss::WsConnectionPtr> out;
+    while (out.size() < count) {
+        out.push_back(std::make_shared<Connection>(std::make_unique<SocketLayerWrapper>(ioService())));
+    }
+    return out;
+}
+
+/// \brief Filled storage per size
+wss::ConnectionStorage &storage(std::size_t users) {
+    static std::map<std::size_t, std::unique_ptr<wss::ConnectionStorage>> storages;
+    auto &out = storages[users];
+    if (!out) {
+        out = std::make_unique<wss::ConnectionStorage>();
+        const auto &items = connections(users);
+        for (std::size_t i = 0; i < users; i++) {
+            out->add(i, items[i]);
+        }
+    }
+    return *out;
+}
+
+std::vector<wss::user_id_t> randomUsers(std::size_t users) {
+    std::vector<wss::user_id_t> out(4096);
+    std::mt19937_64 random(42);
+    for (auto &id: out) {
+        id = random() % users;
+    }
+    return out;
+}
+
+void BM_StorageAdd(benchmark::State &state) {
+    const auto users = static_cast<std::size_t>(state.range(0));
+    const auto &items = connections(users);
+    for (auto _: state) {
+        wss::ConnectionStorage fresh;
+        for (std::size_t i = 0; i < users; i++) {
+            fresh.add(i, items[i]);
+        }
+        benchmark::DoNotOptimize(fresh.size());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * users));
+}
+
+void BM_StorageExists(benchmark::State &state) {
+    const auto users = static_cast<std::size_t>(state.range(0));
+    wss::ConnectionStorage &filled = storage(users);
+    const auto ids = randomUsers(users);
+    std::size_t i = 0;
+    for (auto _: state) {
+        benchmark::DoNotOptimize(filled.exists(ids[i++ % ids.size()]));
+    }
+}
+
+void BM_StorageForEach(benchmark::State &state) {
+    const auto users = static_cast<std::size_t>(state.range(0));
+    wss::ConnectionStorage &filled = storage(users);
+    const auto ids = randomUsers(users);
+    std::size_t i = 0;
+    std::size_t found = 0;
+    const wss::ConnectionStorage::ItemHandler handler = [&found](size_t, const wss::WsConnectionPtr &,
+                                                                 wss::conn_id_t, wss::user_id_t) {
+      found++;
+    };
+    for (auto _: state) {
+        filled.forEach(ids[i++ % ids.size()], handler);
+    }
+    benchmark::DoNotOptimize(found);
+}
+
+/// \brief Sweep over process connections table: watchdog, metrics and stats summaries
+void BM_ConnectionTableSummary(benchmark::State &state) {
+    const auto users = static_cast<std::size_t>(state.range(0));
+    storage(users);
+    const auto &table = wss::server::websocket::ConnectionTable::global();
+    for (auto _: state) {
+        benchmark::DoNotOptimize(table.summarize(0, 60000));
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * users));
+}
+
+}
+
+BENCHMARK(BM_StorageAdd)->Arg(1000)->Arg(100000)->Arg(1000000)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_StorageExists)->Arg(1000)->Arg(100000)->Arg(1000000)->ThreadRange(1, 8);
+BENCHMARK(BM_StorageForEach)->Arg(1000)->Arg(100000)->Arg(1000000)->ThreadRange(1, 8);
+BENCHMARK(BM_ConnectionTableSummary)->Arg(1000)->Arg(100000)->Arg(1000000)->Unit(benchmark::kMillisecond);
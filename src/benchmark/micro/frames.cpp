@@ -0,0 +1,66 @@
+/**
+ * wsserver
+ * frames.cpp
+ *
+ * Micro-benchmarks: incoming payload unmasking (as readMessageContent does it) and outgoing frame encoding
+ * (header + inline or stream payload, as Connection::send gets it), by payload size; client side: masked frames
+ * encoded into batch buffer by wss::client::FrameWriter, as wssbench sends them
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "../../base/ws/WebsocketServer.hpp"
+#include "../../client/Frame.hpp"
+#include "../../helpers/unmask.hpp"
+
+namespace {
+
+using Frame = wss::server::websocket::SocketServerBase::Frame;
+
+void BM_Unmask(benchmark::State &state) {
+    const auto length = static_cast<std::size_t>(state.range(0));
+    std::vector<uint8_t> src(length, 0x5a);
+    std::vector<uint8_t> dst(length);
+    const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+    for (auto _: state) {
+        wss::utils::unmask(dst.data(), src.data(), length, mask);
+        benchmark::DoNotOptimize(dst.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * length));
+}
+
+/// \brief Payload up to Frame::INLINE_PAYLOAD_SIZE is copied into frame, larger goes to SendStream
+void BM_FrameCreate(benchmark::State &state) {
+    const std::string payload(static_cast<std::size_t>(state.range(0)), 'x');
+    for (auto _: state) {
+        auto frame = Frame::create(payload);
+        benchmark::DoNotOptimize(frame->size());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * payload.size()));
+}
+
+/// \brief Batch is reused: its capacity stays after clear(), as in client write loop
+void BM_ClientFrameWrite(benchmark::State &state) {
+    const std::string payload(static_cast<std::size_t>(state.range(0)), 'x');
+    wss::client::FrameWriter writer;
+    std::string batch;
+    for (auto _: state) {
+        batch.clear();
+        writer.append(batch, 0x80u | wss::client::Text, payload.data(), payload.size());
+        benchmark::DoNotOptimize(batch.data());
+        benchmark::ClobberMemory();
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * payload.size()));
+}
+
+}
+
+BENCHMARK(BM_Unmask)->Arg(16)->Arg(128)->Arg(1024)->Arg(16 * 1024)->Arg(256 * 1024);
+BENCHMARK(BM_FrameCreate)->Arg(16)->Arg(125)->Arg(512)->Arg(4096)->Arg(70000);
+BENCHMARK(BM_ClientFrameWrite)->Arg(16)->Arg(125)->Arg(512)->Arg(4096)->Arg(70000);
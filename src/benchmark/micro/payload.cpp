@@ -0,0 +1,75 @@
+/**
+ * wsserver
+ * payload.cpp
+ *
+ * Micro-benchmarks: MessagePayload parse (schema-specific parser) and parse + serialize (forwarding),
+ * by number of "data" items in payload (0, 1, 20: about 150 bytes to 1.5 KB)
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <string>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include "../../chat/Message.h"
+
+namespace {
+
+std::string makeMessage(std::size_t n, std::size_t dataItems) {
+    std::string data = "[";
+    for (std::size_t i = 0; i < dataItems; i++) {
+        data += (i ? "," : "") + std::string(R"({"id":)") + std::to_string(n + i)
+            + R"(,"name":"item name","price":12.5,"tags":["a","b"],"active":true})";
+    }
+    data += "]";
+
+    return R"({"type":"text","sender":)" + std::to_string(n % 10000)
+        + R"(,"recipients":[)" + std::to_string((n + 1) % 10000) + "," + std::to_string((n + 7) % 10000)
+        + R"(],"text":"hello, benchmark","timestamp":"2018-01-01T00:00:00.000Z","data":)" + data + "}";
+}
+
+std::vector<std::string> makeMessages(std::size_t dataItems) {
+    std::vector<std::string> out;
+    for (std::size_t i = 0; i < 256; i++) {
+        out.push_back(makeMessage(i, dataItems));
+    }
+    return out;
+}
+
+void BM_PayloadParse(benchmark::State &state) {
+    const auto messages = makeMessages(static_cast<std::size_t>(state.range(0)));
+    std::size_t i = 0;
+    for (auto _: state) {
+        const std::string &message = messages[i++ % messages.size()];
+        wss::MessagePayload payload(message.c_str(), message.length());
+        benchmark::DoNotOptimize(payload.isValid());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * messages[0].size()));
+}
+
+void BM_PayloadParseSerialize(benchmark::State &state) {
+    const auto messages = makeMessages(static_cast<std::size_t>(state.range(0)));
+    std::size_t i = 0;
+    for (auto _: state) {
+        const std::string &message = messages[i++ % messages.size()];
+        wss::MessagePayload payload(message.c_str(), message.length());
+        benchmark::DoNotOptimize(payload.toJson().size());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * messages[0].size()));
+}
+
+/// \brief Server built payload (admin and system messages), serialized from fields
+void BM_PayloadSerialize(benchmark::State &state) {
+    const std::string text(static_cast<std::size_t>(state.range(0)), 'x');
+    for (auto _: state) {
+        wss::MessagePayload payload(1, std::vector<wss::user_id_t>{2, 3}, std::string(text));
+        benchmark::DoNotOptimize(payload.toJson().size());
+    }
+}
+
+}
+
+BENCHMARK(BM_PayloadParse)->Arg(0)->Arg(1)->Arg(20);
+BENCHMARK(BM_PayloadParseSerialize)->Arg(0)->Arg(1)->Arg(20);
+BENCHMARK(BM_PayloadSerialize)->Arg(16)->Arg(1024)->Arg(16 * 1024);
@@ -0,0 +1,40 @@
+/**
+ * wsserver
+ * statistics.cpp
+ *
+ * Micro-benchmarks: user statistics updates made for every sent and received message,
+ * by one thread and by several threads updating the same user (group sender)
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <benchmark/benchmark.h>
+#include "../../chat/Statistics.h"
+
+namespace {
+
+wss::Statistics &shared() {
+    static wss::Statistics statistics(1);
+    return statistics;
+}
+
+void BM_StatisticsMessage(benchmark::State &state) {
+    wss::Statistics &statistics = shared();
+    for (auto _: state) {
+        statistics.addSendMessage().addBytesTransferred(128);
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+void BM_StatisticsRead(benchmark::State &state) {
+    wss::Statistics &statistics = shared();
+    for (auto _: state) {
+        benchmark::DoNotOptimize(statistics.getMessagesRate());
+    }
+}
+
+}
+
+BENCHMARK(BM_StatisticsMessage)->ThreadRange(1, 8);
+BENCHMARK(BM_StatisticsRead);
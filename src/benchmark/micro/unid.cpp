@@ -0,0 +1,26 @@
+/**
+ * wsserver
+ * unid.cpp
+ *
+ * Micro-benchmark: message id generation by 1 to 8 threads sharing one generator
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <benchmark/benchmark.h>
+#include "../../base/unid.h"
+
+namespace {
+
+void BM_UnidNext(benchmark::State &state) {
+    auto &generate = wss::unid::generator();
+    for (auto _: state) {
+        benchmark::DoNotOptimize(generate());
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+}
+
+BENCHMARK(BM_UnidNext)->ThreadRange(1, 8);
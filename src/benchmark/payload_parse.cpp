@@ -0,0 +1,85 @@
+/**
+ * wsserver
+ * payload_parse.cpp
+ *
+ * Micro-benchmark: json payload parsing by DOM (nlohmann::json::parse + from_json, as MessagePayload did)
+ * vs schema-specific parser with "data" passed through as raw text. Both parse and parse + serialize
+ * (forwarding to recipient: client text with spliced server fields) are measured, for payloads with small and large data.
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <iostream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include "../chat/Message.h"
+
+using std::cout;
+using std::endl;
+using hr_clock = std::chrono::high_resolution_clock;
+
+const std::size_t MESSAGES = 200000;
+
+static std::string makeMessage(std::size_t n, std::size_t dataItems) {
+    std::string data = "[";
+    for (std::size_t i = 0; i < dataItems; i++) {
+        data += (i ? "," : "") + std::string(R"({"id":)") + std::to_string(n + i)
+            + R"(,"name":"item name","price":12.5,"tags":["a","b"],"active":true})";
+    }
+    data += "]";
+
+    return R"({"type":"text","sender":)" + std::to_string(n % 10000)
+        + R"(,"recipients":[)" + std::to_string((n + 1) % 10000) + "," + std::to_string((n + 7) % 10000)
+        + R"(],"text":"hello, benchmark","timestamp":"2018-01-01T00:00:00.000Z","data":)" + data + "}";
+}
+
+template<typename Handler>
+static double messagesPerSec(const std::vector<std::string> &messages, Handler &&handler) {
+    std::size_t sink = 0;
+    const auto start = hr_clock::now();
+    for (const auto &message: messages) {
+        sink += handler(message);
+    }
+    const std::chrono::duration<double> elapsed = hr_clock::now() - start;
+    if (sink == 0) {
+        cout << "Invalid benchmark messages" << endl;
+    }
+    return messages.size() / elapsed.count();
+}
+
+int main(int, char **) {
+    const auto dom = [](const std::string &message) -> std::size_t {
+      wss::MessagePayload payload(wss::json::parse(message));
+      return payload.isValid() ? payload.getRecipients().size() : 0;
+    };
+    const auto fast = [](const std::string &message) -> std::size_t {
+      wss::MessagePayload payload(message.c_str(), message.length());
+      return payload.isValid() ? payload.getRecipients().size() : 0;
+    };
+    const auto domForward = [](const std::string &message) -> std::size_t {
+      wss::MessagePayload payload(wss::json::parse(message));
+      return payload.toJson().size();
+    };
+    const auto fastForward = [](const std::string &message) -> std::size_t {
+      wss::MessagePayload payload(message.c_str(), message.length());
+      return payload.toJson().size();
+    };
+
+    for (std::size_t dataItems: {0, 1, 20}) {
+        std::vector<std::string> messages;
+        messages.reserve(MESSAGES);
+        for (std::size_t i = 0; i < MESSAGES; i++) {
+            messages.push_back(makeMessage(i, dataItems));
+        }
+
+        cout << "Payload " << messages[0].size() << " bytes (" << dataItems << " data items)" << endl;
+        cout << "  parse            dom: " << messagesPerSec(messages, dom) << " msg/s, fast: "
+             << messagesPerSec(messages, fast) << " msg/s" << endl;
+        cout << "  parse + toJson   dom: " << messagesPerSec(messages, domForward) << " msg/s, fast: "
+             << messagesPerSec(messages, fastForward) << " msg/s" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+/**
+ * wsserver
+ * routing.cpp
+ *
+ * Micro-benchmark: incoming message path (parse payload + recipients lookup) on N worker threads,
+ * server-wide lock around whole handler (as ChatServer::onMessage had) vs sharded ConnectionStorage locks
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include "../chat/Message.h"
+#include "../chat/ConnectionStorage.h"
+
+using std::cout;
+using std::endl;
+using hr_clock = std::chrono::high_resolution_clock;
+
+const std::size_t MESSAGES_PER_THREAD = 200000;
+const std::size_t USERS = 10000;
+
+static std::string makeMessage(std::size_t n) {
+    const wss::user_id_t sender = n % USERS;
+    return R"({"type":"text","sender":)" + std::to_string(sender)
+        + R"(,"recipients":[)" + std::to_string((sender + 1) % USERS) + "," + std::to_string((sender + 7) % USERS)
+        + R"(],"text":"hello, benchmark"})";
+}
+
+/// \brief What onMessage does before sending: parse and resolve recipients connections
+static std::size_t route(wss::ConnectionStorage &storage, const std::string &data) {
+    wss::MessagePayload payload(data.c_str(), data.length());
+    if (!payload.isValid()) {
+        return 0;
+    }
+
+    std::size_t found = 0;
+    for (auto recipient: payload.getRecipients()) {
+        found += storage.size(recipient);
+        storage.forEach(recipient, [&found](size_t, const wss::WsConnectionPtr &, wss::conn_id_t, wss::user_id_t) {
+          found++;
+        });
+    }
+    return found;
+}
+
+template<typename Handler>
+static double messagesPerSec(std::size_t threads, const std::vector<std::string> &messages, Handler &&handler) {
+    std::vector<std::thread> workers;
+    std::atomic_size_t sink(0);
+
+    const auto start = hr_clock::now();
+    for (std::size_t t = 0; t < threads; t++) {
+        workers.emplace_back([t, &messages, &handler, &sink] {
+          std::size_t local = 0;
+          for (std::size_t i = 0; i < MESSAGES_PER_THREAD; i++) {
+              local += handler(messages[(i + t) % messages.size()]);
+          }
+          sink += local;
+        });
+    }
+    for (auto &w: workers) {
+        w.join();
+    }
+
+    const double sec = std::chrono::duration_cast<std::chrono::duration<double>>(hr_clock::now() - start).count();
+    return (threads * MESSAGES_PER_THREAD) / sec;
+}
+
+int main(int, char **) {
+    std::vector<std::string> messages;
+    messages.reserve(1024);
+    for (std::size_t i = 0; i < 1024; i++) {
+        messages.push_back(makeMessage(i * 31));
+    }
+
+    wss::ConnectionStorage storage;
+    std::recursive_mutex serverMutex;
+
+    const std::size_t maxThreads = std::max<std::size_t>(1, std::thread::hardware_concurrency());
+    for (std::size_t threads = 1; threads <= maxThreads; threads *= 2) {
+        const double global = messagesPerSec(threads, messages, [&storage, &serverMutex](const std::string &data) {
+          std::lock_guard<std::recursive_mutex> lock(serverMutex);
+          return route(storage, data);
+        });
+        const double sharded = messagesPerSec(threads, messages, [&storage](const std::string &data) {
+          return route(storage, data);
+        });
+
+        cout << "workers " << threads << ":" << endl;
+        cout << "\tglobal lock: " << static_cast<std::size_t>(global) << " msg/s" << endl;
+        cout << "\tsharded:     " << static_cast<std::size_t>(sharded) << " msg/s" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+/**
+ * wsserver
+ * unid.cpp
+ *
+ * Micro-benchmark: message ids generation on N threads (as io threads do it while parsing payloads).
+ * Reports generated ids per second and number of duplicates among all generated ids.
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <tuple>
+#include "../base/unid.h"
+
+using std::cout;
+using std::endl;
+using hr_clock = std::chrono::high_resolution_clock;
+
+const std::size_t IDS_PER_THREAD = 2000000;
+
+static bool less(const wss::unid_t &lhs, const wss::unid_t &rhs) {
+    return std::tie(lhs.tm, lhs.uuid, lhs.pid, lhs.inc) < std::tie(rhs.tm, rhs.uuid, rhs.pid, rhs.inc);
+}
+
+int main(int, char **) {
+    for (std::size_t threads: {1, 2, 4, 8}) {
+        std::vector<std::vector<wss::unid_t>> ids(threads);
+        std::vector<std::thread> workers;
+
+        const auto start = hr_clock::now();
+        for (std::size_t t = 0; t < threads; t++) {
+            workers.emplace_back([&ids, t] {
+              auto &generate = wss::unid::generator();
+              auto &out = ids[t];
+              out.reserve(IDS_PER_THREAD);
+              for (std::size_t i = 0; i < IDS_PER_THREAD; i++) {
+                  out.push_back(generate());
+              }
+            });
+        }
+        for (auto &worker: workers) {
+            worker.join();
+        }
+        const std::chrono::duration<double> elapsed = hr_clock::now() - start;
+
+        std::vector<wss::unid_t> all;
+        all.reserve(threads * IDS_PER_THREAD);
+        for (const auto &items: ids) {
+            all.insert(all.end(), items.begin(), items.end());
+        }
+        std::sort(all.begin(), all.end(), less);
+        std::size_t duplicates = 0;
+        for (std::size_t i = 1; i < all.size(); i++) {
+            if (all[i] == all[i - 1]) {
+                duplicates++;
+            }
+        }
+
+        cout << "Threads " << threads << ": " << (all.size() / elapsed.count()) << " ids/s, duplicates: "
+             << duplicates << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,82 @@
+/**
+ * wsserver
+ * unmask.cpp
+ *
+ * Micro-benchmark: websocket frame unmasking, byte-by-byte stream loop vs wss::utils::unmask
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <cstdlib>
+#include "unmask.hpp"
+
+using std::cout;
+using std::endl;
+using hr_clock = std::chrono::high_resolution_clock;
+
+const std::vector<std::size_t> PAYLOAD_SIZES = {16, 128, 1024, 4096, 65536};
+const std::size_t TOTAL_BYTES = 256 * 1024 * 1024;
+
+/// \brief Old implementation from SocketServerBase::readMessageContent
+static void unmaskStream(std::istream &in, std::ostream &out, std::size_t length, const uint8_t mask[4]) {
+    for (std::size_t c = 0; c < length; c++) {
+        out.put(in.get() ^ mask[c % 4]);
+    }
+}
+
+static double mbPerSec(std::size_t bytes, hr_clock::duration d) {
+    const double sec = std::chrono::duration_cast<std::chrono::duration<double>>(d).count();
+    return (bytes / (1024.0 * 1024.0)) / sec;
+}
+
+int main(int, char **) {
+    std::mt19937 rng(0xC0FFEE);
+    const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+
+    for (std::size_t size: PAYLOAD_SIZES) {
+        std::vector<uint8_t> src(size), dst(size), check(size);
+        for (auto &b: src) {
+            b = static_cast<uint8_t>(rng());
+        }
+
+        const std::size_t iterations = std::max<std::size_t>(1, TOTAL_BYTES / size);
+
+        // reference
+        auto start = hr_clock::now();
+        for (std::size_t i = 0; i < iterations; i++) {
+            std::stringstream in(std::string(src.begin(), src.end()));
+            std::stringstream out;
+            unmaskStream(in, out, size, mask);
+            if (i == 0) {
+                const std::string res = out.str();
+                std::copy(res.begin(), res.end(), check.begin());
+            }
+        }
+        auto streamTime = hr_clock::now() - start;
+
+        // vectorized
+        start = hr_clock::now();
+        for (std::size_t i = 0; i < iterations; i++) {
+            wss::utils::unmask(dst.data(), src.data(), size, mask);
+        }
+        auto wordTime = hr_clock::now() - start;
+
+        if (dst != check) {
+            std::cerr << "Result mismatch for payload size " << size << endl;
+            return 1;
+        }
+
+        const std::size_t processed = iterations * size;
+        cout << "payload " << size << " bytes:" << endl;
+        cout << "\tstream: " << mbPerSec(processed, streamTime) << " MB/s" << endl;
+        cout << "\tunmask: " << mbPerSec(processed, wordTime) << " MB/s" << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+/**
+ * wsserver
+ * AckWindow.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "AckWindow.h"
+#include <algorithm>
+#include <stdexcept>
+
+constexpr std::size_t wss::AckWindow::SHARDS;
+
+wss::AckWindow::AckWindow(std::size_t windowSize) :
+    m_windowSize(windowSize) {
+    if (windowSize == 0) {
+        throw std::invalid_argument("Ack window size must be at least 1");
+    }
+}
+
+void wss::AckWindow::open(conn_id_t connection) {
+    Shard &shard = getShard(connection);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    shard.windows.emplace(connection, Window());
+}
+
+wss::AckWindow::TrackResult wss::AckWindow::track(conn_id_t connection, const MessagePayloadPtr &payload) {
+    Shard &shard = getShard(connection);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    const auto it = shard.windows.find(connection);
+    if (it == shard.windows.end() || !it->second.tracked) {
+        return TrackResult::Untracked;
+    }
+    Window &window = it->second;
+    if (window.inFlight.size() >= m_windowSize) {
+        window.deferred = true;
+        return TrackResult::Full;
+    }
+    window.inFlight.push_back(payload);
+    m_metrics.inFlight++;
+    return TrackResult::Tracked;
+}
+
+bool wss::AckWindow::eraseLocked(Window &window, const unid_t &id) {
+    auto &inFlight = window.inFlight;
+    // acks usually come in send order
+    if (!inFlight.empty() && inFlight.front()->getId() == id) {
+        inFlight.pop_front();
+        return true;
+    }
+    const auto it = std::find_if(inFlight.begin(), inFlight.end(), [&id](const MessagePayloadPtr &item) {
+      return item->getId() == id;
+    });
+    if (it == inFlight.end()) {
+        return false;
+    }
+    inFlight.erase(it);
+    return true;
+}
+
+bool wss::AckWindow::ack(conn_id_t connection, const std::vector<unid_t> &ids) {
+    Shard &shard = getShard(connection);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    const auto it = shard.windows.find(connection);
+    if (it == shard.windows.end()) {
+        // late ack of released connection must not create window again
+        return false;
+    }
+    Window &window = it->second;
+    window.tracked = true;
+    std::size_t acked = 0;
+    for (const auto &id: ids) {
+        if (eraseLocked(window, id)) {
+            acked++;
+        }
+    }
+    m_metrics.inFlight -= acked;
+    m_metrics.acked += acked;
+    if (window.deferred && window.inFlight.size() * 2 <= m_windowSize) {
+        window.deferred = false;
+        return true;
+    }
+    return false;
+}
+
+void wss::AckWindow::forget(conn_id_t connection, const unid_t &id) {
+    Shard &shard = getShard(connection);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    const auto it = shard.windows.find(connection);
+    if (it != shard.windows.end() && eraseLocked(it->second, id)) {
+        m_metrics.inFlight--;
+    }
+}
+
+void wss::AckWindow::defer(conn_id_t connection) {
+    Shard &shard = getShard(connection);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    const auto it = shard.windows.find(connection);
+    if (it != shard.windows.end()) {
+        it->second.deferred = true;
+    }
+}
+
+std::size_t wss::AckWindow::available(conn_id_t connection) const {
+    const Shard &shard = getShard(connection);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    const auto it = shard.windows.find(connection);
+    return it == shard.windows.end() ? m_windowSize : m_windowSize - it->second.inFlight.size();
+}
+
+void wss::AckWindow::release(conn_id_t connection, std::vector<MessagePayloadPtr> &out) {
+    Window window;
+    {
+        Shard &shard = getShard(connection);
+        std::lock_guard<std::mutex> lock(shard.lock);
+        const auto it = shard.windows.find(connection);
+        if (it == shard.windows.end()) {
+            return;
+        }
+        window = std::move(it->second);
+        shard.windows.erase(it);
+    }
+    m_metrics.inFlight -= window.inFlight.size();
+    out.insert(out.end(), window.inFlight.begin(), window.inFlight.end());
+}
+
+std::size_t wss::AckWindow::getWindowSize() const noexcept {
+    return m_windowSize;
+}
+
+const wss::AckMetrics &wss::AckWindow::getMetrics() const noexcept {
+    return m_metrics;
+}
+
+void wss::AckWindow::addRequeued(std::size_t deferred, std::size_t requeued) noexcept {
+    m_metrics.deferred += deferred;
+    m_metrics.requeued += requeued;
+}
@@ -0,0 +1,130 @@
+/**
+ * wsserver
+ * AckWindow.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_ACKWINDOW_H
+#define WSSERVER_ACKWINDOW_H
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "Message.h"
+#include "../wsserver_core.h"
+
+namespace wss {
+
+/// \brief Acknowledgement counters
+struct AckMetrics {
+  /// \brief Messages sent and not acknowledged yet
+  std::atomic<uint64_t> inFlight{0};
+  std::atomic<uint64_t> acked{0};
+  /// \brief Messages put to undelivered queue, because window was full
+  std::atomic<uint64_t> deferred{0};
+  /// \brief Not acknowledged messages put back to undelivered queue on disconnect
+  std::atomic<uint64_t> requeued{0};
+};
+
+/// \brief Messages sent to connections, that were not acknowledged by client yet (see TYPE_ACK).
+/// Connection is registered by open() and tracked after its first ack, so clients without ack support
+/// are not affected. Acks of released (closed) connections are ignored.
+/// Connections are split into shards by id, like in ConnectionStorage
+class AckWindow {
+ public:
+    /// \brief Number of shards (power of two)
+    static constexpr std::size_t SHARDS = 64;
+
+    enum class TrackResult {
+      /// \brief Connection doesn't use acks
+      Untracked,
+      /// \brief Message is added to window
+      Tracked,
+      /// \brief Window is full, message is not added
+      Full
+    };
+
+    /// \param windowSize max not acknowledged messages per connection, at least 1
+    explicit AckWindow(std::size_t windowSize);
+
+    /// \brief Registers connection, its window is used after first ack
+    /// \param connection
+    void open(conn_id_t connection);
+
+    /// \brief Adds message to connection window before it is sent
+    /// \param connection
+    /// \param payload
+    /// \return
+    TrackResult track(conn_id_t connection, const MessagePayloadPtr &payload);
+
+    /// \brief Removes acknowledged messages from window. Starts tracking of opened connection,
+    /// ack of connection that is not open (already released) is ignored
+    /// \param connection
+    /// \param ids
+    /// \return true if window was full since last resume, and now at least half of it is free:
+    /// messages deferred to undelivered queue can be sent again
+    bool ack(conn_id_t connection, const std::vector<unid_t> &ids);
+
+    /// \brief Removes message from window without ack, e.g. if send failed and message is queued again
+    /// \param connection
+    /// \param id
+    void forget(conn_id_t connection, const unid_t &id);
+
+    /// \brief Marks that connection has messages waiting in undelivered queue for free window space,
+    /// so next ack resumes them
+    /// \param connection
+    void defer(conn_id_t connection);
+
+    /// \brief Free window slots
+    /// \param connection
+    /// \return windowSize if connection is not tracked
+    std::size_t available(conn_id_t connection) const;
+
+    /// \brief Drops connection window
+    /// \param connection
+    /// \param out not acknowledged messages in send order are appended here
+    void release(conn_id_t connection, std::vector<MessagePayloadPtr> &out);
+
+    std::size_t getWindowSize() const noexcept;
+
+    const AckMetrics &getMetrics() const noexcept;
+
+    /// \brief Counts messages, that were put to undelivered queue
+    /// \param deferred because of full window
+    /// \param requeued on disconnect
+    void addRequeued(std::size_t deferred, std::size_t requeued) noexcept;
+
+ private:
+    struct Window {
+      std::deque<MessagePayloadPtr> inFlight;
+      /// \brief Message was not tracked because window was full
+      bool deferred = false;
+      /// \brief Client sent ack at least once
+      bool tracked = false;
+    };
+    struct Shard {
+      mutable std::mutex lock;
+      std::unordered_map<conn_id_t, Window> windows;
+    };
+    const std::size_t m_windowSize;
+    std::array<Shard, SHARDS> m_shards;
+    AckMetrics m_metrics;
+
+    Shard &getShard(conn_id_t connection) noexcept {
+        return m_shards[connection & (SHARDS - 1)];
+    }
+    const Shard &getShard(conn_id_t connection) const noexcept {
+        return m_shards[connection & (SHARDS - 1)];
+    }
+    /// \brief Removes message from window, shard must be locked
+    bool eraseLocked(Window &window, const unid_t &id);
+};
+
+}
+
+#endif //WSSERVER_ACKWINDOW_H
@@ -0,0 +1,127 @@
+/**
+ * wsserver
+ * AttachmentStore.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "AttachmentStore.h"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fmt/format.h>
+
+namespace {
+
+bool writeAll(int fd, const char *data, std::size_t length) {
+    while (length > 0) {
+        const ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+}
+
+wss::AttachmentStore::AttachmentStore(const std::string &directory, const Options &options) :
+    m_directory(directory),
+    m_options(options) {
+    if (::mkdir(m_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw std::runtime_error(fmt::format("Unable to create attachments directory {0}: {1}",
+                                             m_directory, std::strerror(errno)));
+    }
+}
+
+bool wss::AttachmentStore::accepts(const MessagePayload &payload) const {
+    return payload.getDataSize() > m_options.thresholdBytes;
+}
+
+bool wss::AttachmentStore::offload(MessagePayload &payload) {
+    const std::string id = payload.getId().str();
+    const std::string path = m_directory + "/" + id;
+    const std::string tmpPath = path + ".tmp";
+    const std::string data = payload.getDataText();
+
+    const int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    const bool written = writeAll(fd, data.data(), data.size());
+    ::close(fd);
+    // reference is published only for complete file
+    if (!written || ::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        ::unlink(tmpPath.c_str());
+        return false;
+    }
+
+    payload.setData({{"attachment", {{"id", id}, {"size", data.size()}}}});
+    m_offloaded++;
+    m_offloadedBytes += data.size();
+    return true;
+}
+
+std::string wss::AttachmentStore::find(const std::string &id) const {
+    // only message ids, so reference can't point outside of directory
+    unid_t parsed{};
+    if (!unid_t::parse(id, parsed)) {
+        return std::string();
+    }
+    const std::string path = m_directory + "/" + parsed.str();
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return std::string();
+    }
+    return path;
+}
+
+std::size_t wss::AttachmentStore::expire() {
+    DIR *dir = ::opendir(m_directory.c_str());
+    if (dir == nullptr) {
+        return 0;
+    }
+    const time_t deadline = std::time(nullptr) - static_cast<time_t>(m_options.ttlSeconds);
+    std::size_t removed = 0;
+    while (const dirent *item = ::readdir(dir)) {
+        if (item->d_name[0] == '.') {
+            continue;
+        }
+        const std::string path = m_directory + "/" + item->d_name;
+        struct stat st;
+        if (::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_mtime < deadline
+            && ::unlink(path.c_str()) == 0) {
+            removed++;
+        }
+    }
+    ::closedir(dir);
+    m_expired += removed;
+    return removed;
+}
+
+uint64_t wss::AttachmentStore::getOffloaded() const noexcept {
+    return m_offloaded.load(std::memory_order_relaxed);
+}
+
+uint64_t wss::AttachmentStore::getOffloadedBytes() const noexcept {
+    return m_offloadedBytes.load(std::memory_order_relaxed);
+}
+
+uint64_t wss::AttachmentStore::getExpired() const noexcept {
+    return m_expired.load(std::memory_order_relaxed);
+}
+
+const wss::AttachmentStore::Options &wss::AttachmentStore::getOptions() const noexcept {
+    return m_options;
+}
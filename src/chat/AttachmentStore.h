@@ -0,0 +1,74 @@
+/**
+ * wsserver
+ * AttachmentStore.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_ATTACHMENTSTORE_H
+#define WSSERVER_ATTACHMENTSTORE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include "Message.h"
+
+namespace wss {
+
+/// \brief Spool of large payloads data. Data above threshold is written once to file, payload carries
+/// only reference: {"attachment": {"id": "<message id>", "size": bytes}}. So send queues, undelivered store
+/// and history keep small message instead of the same large body. Recipient downloads data by reference
+/// (GET /attachment?id=), file is streamed by chunks. Files are removed after ttl
+class AttachmentStore {
+ public:
+    struct Options {
+      /// \brief Payloads which data json is larger than this are spooled
+      std::size_t thresholdBytes = 256 * 1024;
+      /// \brief File lifetime, should not be less than undelivered messages lifetime
+      uint32_t ttlSeconds = 86400;
+    };
+
+    /// \brief Opens spool directory (creates if not exists)
+    /// \param directory
+    /// \param options
+    /// \throws std::runtime_error if directory can't be created
+    AttachmentStore(const std::string &directory, const Options &options);
+
+    /// \brief Whether payload should be spooled. Cheap for parsed payloads
+    /// \param payload
+    /// \return
+    bool accepts(const MessagePayload &payload) const;
+
+    /// \brief Writes payload data to file and replaces it by reference. Blocks on disk, don't call on io thread
+    /// \param payload
+    /// \return false if file can't be written, payload is not changed then
+    bool offload(MessagePayload &payload);
+
+    /// \brief Path of attachment file
+    /// \param id message id from reference
+    /// \return empty string if id is not valid message id or attachment doesn't exist (expired)
+    std::string find(const std::string &id) const;
+
+    /// \brief Removes files older than ttl
+    /// \return removed files
+    std::size_t expire();
+
+    /// \brief Spooled payloads since start
+    uint64_t getOffloaded() const noexcept;
+    /// \brief Spooled data bytes since start
+    uint64_t getOffloadedBytes() const noexcept;
+    uint64_t getExpired() const noexcept;
+    const Options &getOptions() const noexcept;
+
+ private:
+    const std::string m_directory;
+    const Options m_options;
+    std::atomic<uint64_t> m_offloaded{0};
+    std::atomic<uint64_t> m_offloadedBytes{0};
+    std::atomic<uint64_t> m_expired{0};
+};
+
+}
+
+#endif //WSSERVER_ATTACHMENTSTORE_H
@@ -6,10 +6,63 @@
  * @link https://github.com/edwardstock
  */
 
+#include <algorithm>
+#include <random>
+#include <unordered_set>
+#include <unistd.h>
 #include <fmt/format.h>
 #include "ChatServer.h"
+#include "Handoff.h"
+#include "Snapshot.h"
 #include "../helpers/helpers.h"
+#include "../helpers/logging.h"
 #include "../base/Settings.hpp"
+#include "../base/Metrics.h"
+#include "../base/Affinity.h"
+#include "../base/TopK.h"
+#include "../base/TrafficCapture.h"
+#include "../base/Tracing.h"
+
+namespace {
+/// \brief Snapshot sections
+enum SnapshotSection : uint32_t {
+  SNAPSHOT_STATISTICS = 1,
+  SNAPSHOT_ROOMS = 2,
+  SNAPSHOT_PRESENCE = 3,
+  SNAPSHOT_UNDELIVERED = 4,
+  SNAPSHOT_SCHEDULED = 5,
+};
+
+/// \brief Handoff body is sent when it reaches this size: link buffer isn't taken by one record
+constexpr std::size_t HANDOFF_BATCH_BYTES = 1024 * 1024;
+
+/// \brief Broadcast sends part of connections each step, so pace is rate / steps per second
+constexpr long BROADCAST_STEP_MILLIS = 100;
+
+/// \brief Decides if message is traced, and records its parse span if so
+void traceParse(wss::MessagePayload &payload, std::chrono::steady_clock::time_point parsedAt) {
+    payload.setTrace(wss::tracing::sample());
+    if (payload.getTrace().sampled) {
+        wss::tracing::record("chat.parse", wss::tracing::child(payload.getTrace()), payload.getReceivedAt(), parsedAt);
+    }
+}
+
+/// \brief Records routing span and message root span. Message must be sampled
+void traceRoute(const wss::MessagePayload &payload, std::chrono::steady_clock::time_point routeStart) {
+    const auto routeEnd = std::chrono::steady_clock::now();
+    wss::tracing::record("chat.route", wss::tracing::child(payload.getTrace()), routeStart, routeEnd);
+
+    // message from rest api has no ingress time
+    const bool fromSocket = payload.getReceivedAt() != std::chrono::steady_clock::time_point();
+    const auto start = fromSocket ? payload.getReceivedAt() : routeStart;
+    wss::tracing::record("chat.message", payload.getTrace(), start, routeEnd, {
+        {"message.id", payload.getId().str()},
+        {"message.type", payload.getType()},
+        {"message.sender", std::to_string(payload.getSender())},
+        {"message.recipients", std::to_string(payload.getRecipients().size())}
+    });
+}
+}
 
 
 wss::ChatServer::ChatServer(
@@ -17,8 +70,14 @@ wss::ChatServer::ChatServer(
     const std::string &host, unsigned short port, const std::string &regexPath) :
     m_useSSL(true),
     m_maxMessageSize(10 * 1024 * 1024),
+    m_endpointPath(regexPath),
     m_server(std::make_unique<WssServer>(crtPath, privKeyPath)),
-    m_connectionStorage(std::make_unique<wss::ConnectionStorage>()) {
+    m_connectionStorage(std::make_unique<wss::ConnectionStorage>()),
+    m_rooms(std::make_unique<wss::RoomStorage>()),
+    m_topics(std::make_unique<wss::TopicStorage>()),
+    m_statistics(std::make_unique<wss::StatisticsStorage>()),
+    m_rateLimiter(std::make_unique<wss::RateLimiter>()) {
+    m_undelivered = std::make_unique<wss::MemoryUndeliveredStore>();
 
 
     m_server->getConfig().port = port;
@@ -29,516 +88,2580 @@ wss::ChatServer::ChatServer(
         m_server->getConfig().address = host;
     };
 
-    m_endpoint = &m_server->getEndpoint()[regexPath];
-    m_endpoint->onMessage = [this](WsConnectionPtr connectionPtr, WsMessagePtr messagePtr) {
-      if (messagePtr->fin_rsv_opcode == FLAG_PONG) {
-          onPong(connectionPtr, messagePtr);
-          return;
-      }
-      onMessage(connectionPtr, messagePtr);
-    };
-
-    m_endpoint->onOpen = std::bind(&wss::ChatServer::onConnected, this, std::placeholders::_1);
-    m_endpoint->onError = [](WsConnectionPtr conn, const boost::system::error_code &ec) {
-      L_DEBUG_F("Server::Connection::Info", "Connection error[%lu]: %s %s",
-               conn->getId(),
-               ec.category().name(),
-               ec.message().c_str()
-      )
-    };
-    m_endpoint->onClose = std::bind(&wss::ChatServer::onDisconnected,
-                                    this,
-                                    std::placeholders::_1,
-                                    std::placeholders::_2,
-                                    std::placeholders::_3);
-
+    m_endpoint = createEndpoint(*m_server);
+    setCodecs({SUBPROTOCOL_JSON_V1, SUBPROTOCOL_BINARY_V1, SUBPROTOCOL_MSGPACK_V1, SUBPROTOCOL_CBOR_V1});
 }
 
 wss::ChatServer::ChatServer(const std::string &host, unsigned short port, const std::string &regexPath) :
     m_useSSL(false),
     m_maxMessageSize(10 * 1024 * 1024),
+    m_endpointPath(regexPath),
     m_server(std::make_unique<WsServer>()),
-    m_connectionStorage(std::make_unique<wss::ConnectionStorage>()) {
+    m_connectionStorage(std::make_unique<wss::ConnectionStorage>()),
+    m_rooms(std::make_unique<wss::RoomStorage>()),
+    m_topics(std::make_unique<wss::TopicStorage>()),
+    m_statistics(std::make_unique<wss::StatisticsStorage>()),
+    m_rateLimiter(std::make_unique<wss::RateLimiter>()) {
+    m_undelivered = std::make_unique<wss::MemoryUndeliveredStore>();
     m_server->getConfig().port = port;
     m_server->getConfig().threadPoolSize = std::thread::hardware_concurrency();
     m_server->getConfig().maxMessageSize = m_maxMessageSize;
 
-    if (host.length() == 15) {
+    if (host.length() == 15 || wss::unixsocket::isAddress(host)) {
         m_server->getConfig().address = host;
     };
 
-    m_endpoint = &m_server->getEndpoint()[regexPath];
-    m_endpoint->onMessage = [this](WsConnectionPtr connectionPtr, WsMessagePtr messagePtr) {
-      if (messagePtr->fin_rsv_opcode == FLAG_PONG) {
-          onPong(connectionPtr, messagePtr);
-          return;
-      }
+    m_endpoint = createEndpoint(*m_server);
+    setCodecs({SUBPROTOCOL_JSON_V1, SUBPROTOCOL_BINARY_V1, SUBPROTOCOL_MSGPACK_V1, SUBPROTOCOL_CBOR_V1});
+}
+
+wss::WsBase::Endpoint *wss::ChatServer::createEndpoint(wss::server::websocket::SocketServerBase &server) {
+    WsBase::Endpoint *endpoint = &server.getEndpoint()[m_endpointPath];
+    endpoint->onMessage = [this](WsConnectionPtr connectionPtr, WsMessagePtr messagePtr) {
       onMessage(connectionPtr, messagePtr);
     };
 
-    m_endpoint->onOpen = std::bind(&wss::ChatServer::onConnected, this, std::placeholders::_1);
-    m_endpoint->onError = [](WsConnectionPtr, const boost::system::error_code &ec) {
-        L_DEBUG_F("Server::Connection::Info", "Connection error: %s %s",
-                 ec.category().name(),
-                 ec.message().c_str()
-        )
+    endpoint->onUpgrade = [this](const WsConnectionPtr &) {
+      if (m_overload && m_overload->isAtLeast(wss::OverloadLevel::RejectConnections)) {
+          wss::metrics::add(wss::metrics::Counter::OverloadRejectedConnections);
+          return false;
+      }
+      return true;
+    };
+    endpoint->onOpen = std::bind(&wss::ChatServer::onConnected, this, std::placeholders::_1);
+    endpoint->onError = [](WsConnectionPtr conn, const boost::system::error_code &ec) {
+      WSS_DEBUG_F("Server::Connection::Info", "Connection error[%lu]: %s %s",
+                   conn->getId(),
+                   ec.category().name(),
+                   ec.message().c_str()
+      );
     };
-    m_endpoint->onClose = std::bind(&wss::ChatServer::onDisconnected,
-                                    this,
-                                    std::placeholders::_1,
-                                    std::placeholders::_2,
-                                    std::placeholders::_3);
+    endpoint->onClose = std::bind(&wss::ChatServer::onDisconnected,
+                                  this,
+                                  std::placeholders::_1,
+                                  std::placeholders::_2,
+                                  std::placeholders::_3);
 
+    return endpoint;
 }
 
-wss::ChatServer::~ChatServer() {
-    stopService();
-    joinThreads();
-}
+void wss::ChatServer::addSecureListener(const std::string &crtPath,
+                                        const std::string &privKeyPath,
+                                        unsigned short port) {
+    if (m_useSSL) {
+        throw std::runtime_error("Server is already secure");
+    }
+    if (port == m_server->getConfig().port) {
+        throw std::runtime_error("Secure listener port must differ from insecure one");
+    }
 
-void wss::ChatServer::setThreadPoolSize(std::size_t size) {
-    m_server->getConfig().threadPoolSize = size;
+    m_secureServer = std::make_unique<WssServer>(crtPath, privKeyPath);
+    m_secureServer->getConfig().port = port;
+    m_secureServer->shareSendQueueMetrics(*m_server);
+    m_secureServer->shareAdmission(*m_server);
+    m_secureEndpoint = createEndpoint(*m_secureServer);
 }
-void wss::ChatServer::joinThreads() {
-    if (m_workerThread && m_workerThread->joinable()) {
-        m_workerThread->join();
-    }
 
-    if (m_watchdogThread && m_watchdogThread->joinable()) {
-        m_watchdogThread->join();
+void wss::ChatServer::setCodecs(const std::vector<std::string> &names) {
+    std::vector<std::unique_ptr<wss::PayloadCodec>> codecs;
+    codecs.reserve(names.size());
+    for (const auto &name: names) {
+        auto codec = wss::codec::registry::createByName(name);
+        if (!codec) {
+            throw std::runtime_error("Unknown codec: " + name);
+        }
+        codecs.push_back(std::move(codec));
     }
+
+    m_codecs = std::move(codecs);
+    m_endpoint->subprotocols = names;
 }
-void wss::ChatServer::detachThreads() {
-    if (m_workerThread) {
-        m_workerThread->detach();
-    }
-    if (m_watchdogThread) {
-        m_watchdogThread->detach();
+const wss::PayloadCodec &wss::ChatServer::getCodec(const WsConnectionPtr &connection) const {
+    const std::size_t index = connection->getSubprotocolIndex();
+    if (index < m_codecs.size()) {
+        return *m_codecs[index];
     }
+    return m_defaultCodec;
 }
-void wss::ChatServer::runService() {
-    std::string hostname = "0.0.0.0";
-    if (not m_server->getConfig().address.empty()) {
-        hostname = m_server->getConfig().address;
+
+const wss::PayloadCodec &wss::ChatServer::getCodec(const WsConnectionPtr &connection,
+                                                    const WsMessagePtr &message) const {
+    // frames with other opcode than negotiated codec uses (text frame from binary codec client) are json
+    const wss::PayloadCodec &codec = getCodec(connection);
+    if ((message->fin_rsv_opcode & 0x0Fu) != (codec.getFinRsvOpcode() & 0x0Fu)) {
+        return m_defaultCodec;
     }
-    const char *proto = m_useSSL ? "wss" : "ws";
-    L_INFO_F("WebSocket Server", "Started at %s://%s:%d", proto, hostname.c_str(),
-             m_server->getConfig().port);
-    m_workerThread = std::make_unique<boost::thread>([this] {
-      this->m_server->start();
-    });
+    return codec;
+}
 
-    if (wss::Settings::get().server.watchdog.enabled) {
-        L_INFO("Watchdog", "Started with interval in 1 minute");
-        m_watchdogThread =
-            std::make_unique<boost::thread>(boost::bind(&wss::ChatServer::watchdogWorker, this));
+wss::WssServer *wss::ChatServer::getSecureServer() const {
+    if (m_useSSL) {
+        return static_cast<WssServer *>(m_server.get());
     }
+    return m_secureServer.get();
 }
-void wss::ChatServer::stopService() {
-    this->m_server->stop();
-    if (m_watchdogThread) {
-        m_watchdogThread->interrupt();
+std::vector<wss::server::websocket::SocketServerBase::Config *> wss::ChatServer::getConfigs() const {
+    std::vector<wss::server::websocket::SocketServerBase::Config *> configs{&m_server->getConfig()};
+    if (m_secureServer) {
+        configs.push_back(&m_secureServer->getConfig());
     }
+    return configs;
 }
 
-void wss::ChatServer::watchdogWorker() {
-    try {
-        while (true) {
-            boost::this_thread::sleep_for(boost::chrono::minutes(1));
-
-            // remote connections without pong response
-            std::size_t disconnected = m_connectionStorage->disconnectWithoutPong(
-                wss::ChatServer::STATUS_INACTIVE_CONNECTION,
-                "Dangling connection"
-            );
-            if (disconnected > 0) {
-                L_DEBUG_F("Watchdog", "Disconnected %lu dangling connections", disconnected);
-            }
+wss::ChatServer::~ChatServer() {
+    stopService();
+    joinThreads();
+}
 
-            m_connectionStorage->verify(FLAG_PING);
-        }
-    } catch (const boost::thread_interrupted &) {
-        L_INFO("Watchdog", "Stopping...");
+void wss::ChatServer::setThreadPoolSize(std::size_t size) {
+    m_server->getConfig().threadPoolSize = size;
+}
+void wss::ChatServer::setReusePort(bool enabled) {
+    m_server->getConfig().reusePort = enabled;
+}
+void wss::ChatServer::setIoServicePerThread(bool enabled) {
+    m_server->getConfig().ioServicePerThread = enabled;
+}
+void wss::ChatServer::setProxyProtocol(bool enabled) {
+    m_server->getConfig().proxyProtocol = enabled;
+}
+void wss::ChatServer::setAdmission(const wss::server::websocket::ConnectionAdmission::Options &options,
+                                   std::size_t maxHandshakeBytes,
+                                   long handshakeDeadlineMillis) {
+    m_server->getAdmission().configure(options);
+    for (auto *config: getConfigs()) {
+        config->maxHandshakeBytes = maxHandshakeBytes;
+        config->handshakeDeadlineMillis = handshakeDeadlineMillis;
     }
 }
-
-void wss::ChatServer::onPong(wss::WsConnectionPtr &connection, wss::WsMessagePtr) {
-    m_connectionStorage->markPongReceived(connection);
+void wss::ChatServer::setExternalAccept(bool enabled) {
+    if (enabled && (m_useSSL || m_secureServer)) {
+        throw std::logic_error("Connections can be passed only to plain (ws) server");
+    }
+    m_server->getConfig().externalAccept = enabled;
 }
-
-void wss::ChatServer::onMessage(WsConnectionPtr &connection, WsMessagePtr message) {
-    std::lock_guard<std::recursive_mutex> lock(m_connectionMutex);
-    L_DEBUG_F("Chat::Incoming", "On thread: %lu", getThreadName());
-    MessagePayload payload;
-    const short opcode = message->fin_rsv_opcode;
-
-    if (opcode != FLAG_FRAME_TEXT && opcode != FLAG_FRAME_BINARY) {
-        // fragmented frame message
-        user_id_t senderId = connection->getId();
-
-        if (opcode == FLAG_FRAGMENT_BEGIN_TEXT || opcode == FLAG_FRAGMENT_BEGIN_BINARY) {
-            L_DEBUG_F("Chat::Message", "Fragmented frame begin (flag: 0x%08x)", opcode);
-            writeFrameBuffer(senderId, message->string(), true);
-            return;
-        } else if (opcode == FLAG_FRAGMENT_CONTINUE) {
-            writeFrameBuffer(senderId, message->string(), false);
-            return;
-        } else if (opcode == FLAG_FRAGMENT_END) {
-            L_DEBUG("Chat::Message", "Fragmented frame end");
-            std::stringstream final;
-            final << readFrameBuffer(senderId, true);
-            final << message->string();
-            std::string buffered = final.str();
-            final.str("");
-            final.clear();
-
-            /**
-             * @Deprecated
-             */
-            if (buffered.length() > m_maxMessageSize) {
-                connection->sendClose(STATUS_MESSAGE_TOO_BIG,
-                                      "Message to big. Maximum size: "
-                                          + wss::utils::humanReadableBytes(m_maxMessageSize));
-                return;
-            }
-
-            payload = MessagePayload(buffered);
-        }
-    } else {
-        // one frame message
-        payload = MessagePayload(message->string());
+void wss::ChatServer::adoptConnection(int fd) {
+    if (!m_server->getConfig().externalAccept) {
+        ::close(fd);
+        return;
+    }
+    // secure server can't be in external accept mode
+    static_cast<WsServer *>(m_server.get())->adopt(fd);
+}
+bool wss::ChatServer::isAccepting() const noexcept {
+    return m_server->isAccepting();
+}
+void wss::ChatServer::setKeepalive(long pingIntervalSeconds, std::size_t maxMissedPongs) {
+    for (auto *config: getConfigs()) {
+        config->pingInterval = pingIntervalSeconds;
+        config->pingMaxMissed = maxMissedPongs;
+    }
+}
+void wss::ChatServer::setSendCoalescing(std::size_t maxFrames, std::size_t maxBytes) {
+    for (auto *config: getConfigs()) {
+        config->sendCoalesceFrames = maxFrames;
+        config->sendCoalesceBytes = maxBytes;
     }
+}
+void wss::ChatServer::setReadBufferRetainSize(std::size_t bytes) {
+    m_server->getConfig().readBufferRetainBytes = bytes;
+}
+void wss::ChatServer::setReadChunkSize(std::size_t bytes) {
+    m_server->getConfig().readChunkBytes = bytes;
+}
+void wss::ChatServer::setSocketOptions(const wss::SocketOptions &options) {
+    m_server->getConfig().socket = options;
+}
+void wss::ChatServer::setLoopLagMonitor(long probeMillis, long limitMillis) {
+    m_server->getConfig().loopLagProbeMillis = probeMillis;
+    m_server->getConfig().loopLagLimitMillis = limitMillis;
+}
+void wss::ChatServer::setOverload(std::unique_ptr<wss::OverloadController> controller, long checkMillis) {
+    m_overload = std::move(controller);
+    m_overloadCheckMillis = checkMillis;
+}
+const wss::OverloadController *wss::ChatServer::getOverload() const {
+    return m_overload.get();
+}
+void wss::ChatServer::setAttachmentStore(std::unique_ptr<wss::AttachmentStore> store) {
+    m_attachments = std::move(store);
+}
+const wss::AttachmentStore *wss::ChatServer::getAttachmentStore() const {
+    return m_attachments.get();
+}
+void wss::ChatServer::setStatisticsLimits(uint32_t offlineSeconds, std::size_t maxUsers) {
+    m_statisticsOfflineSeconds = offlineSeconds;
+    m_statisticsMaxUsers = maxUsers;
+}
+void wss::ChatServer::setScheduler(std::unique_ptr<wss::DeliveryScheduler> scheduler) {
+    m_scheduler = std::move(scheduler);
+}
+const wss::DeliveryScheduler *wss::ChatServer::getScheduler() const {
+    return m_scheduler.get();
+}
+void wss::ChatServer::setRecipientCache(std::unique_ptr<wss::RecipientCache> cache) {
+    m_recipientCache = std::move(cache);
+}
+const wss::RecipientCache *wss::ChatServer::getRecipientCache() const {
+    return m_recipientCache.get();
+}
+void wss::ChatServer::setOutboundBatching(const wss::OutboundBatcher::Options &options) {
+    m_outboundBatcher = std::make_unique<wss::OutboundBatcher>(m_throttleService, options);
+}
+const wss::OutboundBatcher *wss::ChatServer::getOutboundBatcher() const {
+    return m_outboundBatcher.get();
+}
+void wss::ChatServer::setBroadcastRate(std::size_t connectionsPerSecond) {
+    m_broadcastRate = connectionsPerSecond;
+}
 
-    if (!payload.isValid()) {
-        connection->sendClose(STATUS_INVALID_MESSAGE_PAYLOAD, "Invalid payload. " + payload.getError());
+struct wss::ChatServer::BroadcastJob {
+  explicit BroadcastJob(wss::MessagePayloadPtr payload, SendPriority priority) :
+      payload(std::move(payload)),
+      frames(*this->payload, priority) { }
+
+  const wss::MessagePayloadPtr payload;
+  /// \brief Used only by throttle thread
+  wss::EncodedFrames frames;
+  /// \brief Next shard to copy connections from
+  std::size_t shard = 0;
+  std::vector<wss::ConnectionStorage::Recipients::Item> items;
+  std::size_t position = 0;
+  std::size_t sent = 0;
+  const std::chrono::steady_clock::time_point startedAt = std::chrono::steady_clock::now();
+};
+
+void wss::ChatServer::broadcast(const wss::MessagePayload &payload, const wss::BroadcastSegment &segment) {
+    if (segment.room != 0) {
+        wss::MessagePayload roomPayload = payload;
+        roomPayload.setRoom(segment.room);
+        send(roomPayload);
         return;
     }
 
-    if (wss::Settings::get().chat.message.enableSendBack) {
-        bool isIgnoredType = false;
-        for (const auto &ignore: wss::Settings::get().chat.message.ignoreTypesSendBack) {
-            if (toolboxpp::strings::equalsIgnoreCase(payload.getType(), ignore)) {
-                isIgnoredType = true;
-                break;
+    wss::MessagePayload copy = payload;
+    copy.setRecipients(std::vector<user_id_t>());
+    const wss::MessagePayloadPtr shared = std::make_shared<const wss::MessagePayload>(std::move(copy));
+    callOnMessageListeners(shared);
+    getStat(shared->getSender())->addSendMessage();
+
+    if (segment.connectedWithinSeconds > 0 && wss::Settings::get().chat.enableUndeliveredQueue) {
+        std::vector<user_id_t> offline;
+        for (const auto &stat: m_statistics->snapshot()) {
+            if (!stat->isOnline() && stat->getConnectedTimes() > 0
+                && stat->getOfflineTime() <= static_cast<time_t>(segment.connectedWithinSeconds)) {
+                offline.push_back(stat->getId());
             }
         }
-        if (!isIgnoredType && !payload.isForBot()) {
-            sendTo(payload.getSender(), payload);
+        if (!offline.empty()) {
+            enqueueUndeliveredMessage(offline.data(), offline.size(), shared);
         }
     }
 
-    send(payload);
+    auto job = std::make_shared<BroadcastJob>(shared, getSendPriority(*shared));
+    m_throttleService.post([this, job] {
+      broadcastStep(job);
+    });
 }
 
-void wss::ChatServer::onMessageSent(wss::MessagePayload &&payload, std::size_t bytesTransferred, bool hasSent) {
-    if (payload.isTypeOfSentStatus()) return;
-
-    getStat(payload.getSender())
-        ->addSendMessage()
-        .addBytesTransferred(bytesTransferred);
+void wss::ChatServer::broadcastStep(const std::shared_ptr<BroadcastJob> &job) {
+    const std::size_t budget = m_broadcastRate == 0
+                               ? std::numeric_limits<std::size_t>::max()
+                               : std::max<std::size_t>(1, m_broadcastRate * BROADCAST_STEP_MILLIS / 1000);
+    std::size_t sent = 0;
+    while (sent < budget) {
+        if (job->position == job->items.size()) {
+            if (job->shard == wss::ConnectionStorage::SHARDS) {
+                L_INFO_F("Chat::Broadcast", "Message %s is sent to %lu connection(s) in %lld ms",
+                         job->payload->getId().str().c_str(), job->sent,
+                         (long long) std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::steady_clock::now() - job->startedAt).count());
+                return;
+            }
+            job->items.clear();
+            job->position = 0;
+            m_connectionStorage->getShardConnections(job->shard++, job->items);
+            continue;
+        }
 
-    for (auto &i: payload.getRecipients()) {
-        if (hasSent) {
-            getStat(i)->addReceivedMessage().addBytesTransferred(bytesTransferred);
+        const auto &item = job->items[job->position++];
+        if (item.user == job->payload->getSender()) {
+            continue;
         }
+        const user_id_t uid = item.user;
+        item.connection->send(job->frames.get(getCodec(item.connection)),
+                              [this, uid](const wss::server::websocket::ErrorCode &errorCode, std::size_t ts) {
+                                if (!errorCode) {
+                                    getStat(uid)->addReceivedMessage().addBytesTransferred(ts);
+                                    m_statistics->addDelivered(ts);
+                                }
+                              }, job->frames.getPriority(), job->payload->getReceivedAt());
+        sent++;
     }
+    job->sent += sent;
 
-    if (m_enableMessageDeliveryStatus && hasSent) {
-        wss::MessagePayload status = MessagePayload::createSendStatus(payload);
-        send(status);
-    }
+    auto timer = std::make_shared<boost::asio::steady_timer>(m_throttleService,
+                                                             std::chrono::milliseconds(BROADCAST_STEP_MILLIS));
+    timer->async_wait([this, timer, job](const boost::system::error_code &ec) {
+      if (!ec) {
+          broadcastStep(job);
+      }
+    });
 }
-
-void wss::ChatServer::onConnected(WsConnectionPtr connection) {
-    wss::web::Request request;
-    request.parseParamsString(connection->queryString);
-    request.setHeaders(connection->header);
-
-    if (request.getParams().empty()) {
-        L_DEBUG_F("Chat::Connect::Error", "Invalid request: %s", connection->queryString.c_str());
-        connection->sendClose(STATUS_INVALID_QUERY_PARAMS, "Invalid request");
-        return;
-    } else if (!request.hasParam("id") || request.getParam("id").empty()) {
-        L_DEBUG("Chat::Connect::Error", "Id required in query parameter: ?id={id}");
-
-        connection->sendClose(STATUS_INVALID_QUERY_PARAMS, "Id required in query parameter: ?id={id}");
-        return;
+void wss::ChatServer::setSendQueueLimits(std::size_t maxFrames, std::size_t maxBytes, const std::string &policy) {
+    using toolboxpp::strings::equalsIgnoreCase;
+    using wss::server::websocket::SlowConsumerPolicy;
+
+    SlowConsumerPolicy p;
+    if (equalsIgnoreCase(policy, "dropOldest")) {
+        p = SlowConsumerPolicy::DropOldest;
+    } else if (equalsIgnoreCase(policy, "dropNewest")) {
+        p = SlowConsumerPolicy::DropNewest;
+    } else if (equalsIgnoreCase(policy, "close")) {
+        p = SlowConsumerPolicy::Close;
+    } else if (equalsIgnoreCase(policy, "undelivered")) {
+        p = SlowConsumerPolicy::Reject;
+    } else {
+        throw std::runtime_error("Unknown slow consumer policy: " + policy);
     }
 
-    user_id_t id;
-    try {
-        id = std::stoul(request.getParam("id"));
-    } catch (const std::invalid_argument &e) {
-        const std::string errReason = "Passed invalid id: id=" + request.getParam("id") + ". " + e.what();
-        L_DEBUG("Chat::Connect::Error", errReason);
-        connection->sendClose(STATUS_INVALID_QUERY_PARAMS, errReason);
-        return;
+    for (auto *config: getConfigs()) {
+        config->sendHighWaterFrames = maxFrames;
+        config->sendHighWaterBytes = maxBytes;
+        config->slowConsumerPolicy = p;
     }
-
-    boost::thread authThread([this, id, connection, request] {
-      bool authorized = m_auth->validateAuth(request);
-
-      if (!authorized) {
-          connection->sendClose(STATUS_UNAUTHORIZED, "Unauthorized");
-          return;
-      }
-
-      {
-          std::lock_guard<std::recursive_mutex> conLock(m_connectionMutex);
-          m_connectionStorage->add(id, connection);
-      }
-
-      getStat(id)->addConnection();
-
-      L_DEBUG_F("Chat::Connect", "User %lu connected (%s:%d) on thread %lu",
-                id,
-                connection->remoteEndpointAddress().c_str(),
-                connection->remoteEndpointPort(),
-                getThreadName()
-      );
-
-      redeliverMessagesTo(id);
-    });
-    authThread.detach();
 }
-void wss::ChatServer::onDisconnected(WsConnectionPtr connection, int status, const std::string &reason) {
-    if (!m_connectionStorage->exists(connection->getId())) {
-        return;
+void wss::ChatServer::setSendPriorities(const std::unordered_map<std::string, std::string> &typePriorities,
+                                        std::size_t normalWeight,
+                                        std::size_t bulkWeight) {
+    using toolboxpp::strings::equalsIgnoreCase;
+
+    std::unordered_map<std::string, SendPriority> priorities;
+    for (const auto &item: typePriorities) {
+        if (equalsIgnoreCase(item.second, "high")) {
+            priorities[item.first] = SendPriority::High;
+        } else if (equalsIgnoreCase(item.second, "normal")) {
+            priorities[item.first] = SendPriority::Normal;
+        } else if (equalsIgnoreCase(item.second, "bulk")) {
+            priorities[item.first] = SendPriority::Bulk;
+        } else {
+            throw std::runtime_error("Unknown priority of type " + item.first + ": " + item.second);
+        }
     }
 
-    L_DEBUG_F("Chat::Disconnect", "User %lu (%lu) has disconnected by reason: %s[%d]",
-              connection->getId(),
-              connection->getUniqueId(),
-              reason.c_str(),
-              status
-    );
-
-    getStat(connection->getId())->addDisconnection();
-    m_connectionStorage->remove(connection);
+    m_typePriorities = std::move(priorities);
+    m_server->getConfig().sendNormalWeight = normalWeight;
+    m_server->getConfig().sendBulkWeight = bulkWeight;
 }
-
-bool wss::ChatServer::hasFrameBuffer(wss::user_id_t senderId) {
-    return m_frameBuffer.find(senderId) != m_frameBuffer.end();
+void wss::ChatServer::setCoalescedTypes(const std::vector<std::string> &types) {
+    m_coalescedTypes = wss::types::compile(types);
 }
-
-bool wss::ChatServer::writeFrameBuffer(wss::user_id_t senderId, const std::string &input, bool clear) {
-    std::lock_guard<std::mutex> fbLock(m_frameBufferMutex);
-    if (!hasFrameBuffer(senderId)) {
-        m_frameBuffer[senderId] = std::make_shared<std::stringstream>();
-    } else if (clear) {
-        m_frameBuffer[senderId]->str("");
-        m_frameBuffer[senderId]->clear();
+void wss::ChatServer::setEphemeralTypes(const std::vector<std::string> &types) {
+    m_ephemeralTypes = wss::types::compile(types);
+}
+const wss::server::websocket::SendQueueMetrics &wss::ChatServer::getSendQueueMetrics() const {
+    return m_server->getSendQueueMetrics();
+}
+wss::server::websocket::EventLoopMetrics wss::ChatServer::getEventLoopMetrics() const {
+    wss::server::websocket::EventLoopMetrics out = m_server->getEventLoopMetrics();
+    if (m_secureServer) {
+        const auto secure = m_secureServer->getEventLoopMetrics();
+        out.lagMicros.insert(out.lagMicros.end(), secure.lagMicros.begin(), secure.lagMicros.end());
+        out.backlogSampled += secure.backlogSampled;
+        out.backlogMax = std::max(out.backlogMax, secure.backlogMax);
+        out.backlogTotal += secure.backlogTotal;
     }
-
-    (*m_frameBuffer[senderId]) << input;
-    return true;
+    return out;
 }
-const std::string wss::ChatServer::readFrameBuffer(wss::user_id_t senderId, bool clear) {
-    std::lock_guard<std::mutex> fbLock(m_frameBufferMutex);
-    if (!hasFrameBuffer(senderId)) {
-        return std::string();
+std::size_t wss::ChatServer::getConnectionsCount() const {
+    std::size_t out = m_endpoint->getConnectionsSnapshot().size();
+    if (m_secureEndpoint) {
+        out += m_secureEndpoint->getConnectionsSnapshot().size();
     }
-
-    const std::string out = m_frameBuffer[senderId]->str();
-    if (clear) {
-        m_frameBuffer.erase(senderId);
+    return out;
+}
+wss::server::websocket::ConnectionTable::Summary wss::ChatServer::getConnectionsSummary(long idleSeconds) const {
+    const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return wss::server::websocket::ConnectionTable::global().summarize(now, static_cast<int64_t>(idleSeconds) * 1000);
+}
+std::vector<wss::server::websocket::ConnectionDiagnostics> wss::ChatServer::getConnectionDiagnostics(user_id_t id) const {
+    std::vector<wss::server::websocket::ConnectionDiagnostics> out;
+    try {
+        for (const auto &connection: m_connectionStorage->get(id)) {
+            out.push_back(connection.second->getDiagnostics());
+        }
+    } catch (const ConnectionNotFound &) {
+        // offline
     }
     return out;
 }
+struct wss::ChatServer::DrainState {
+  explicit DrainState(boost::asio::io_service &service) : timer(service) {
+  }
+
+  DrainOptions options;
+  std::function<void()> onDrained;
+  boost::asio::steady_timer timer;
+  std::mt19937 random;
+  /// \brief Connections waiting for their batch
+  std::vector<WsConnectionPtr> queue;
+  std::size_t next = 0;
+  /// \brief Connections of taken batches, waiting for send queue flush until deadline
+  std::vector<std::pair<WsConnectionPtr, std::chrono::steady_clock::time_point>> flushing;
+  /// \brief Unique ids of all queued connections: closed, but not yet removed connections are not queued twice
+  std::unordered_set<uint64_t> seen;
+  /// \brief Receiver of handoff, chosen when drain is started
+  wss::node_id_t handoffNode = 0;
+  /// \brief Json fields appended to close reason: url of handoff receiver
+  std::string reasonExtra;
+};
+
+void wss::ChatServer::drain(const DrainOptions &options, const std::function<void()> &onDrained) {
+    bool expected = false;
+    if (!m_draining.compare_exchange_strong(expected, true)) {
+        return;
+    }
 
-int wss::ChatServer::redeliverMessagesTo(const wss::MessagePayload &payload) {
-    int cnt = 0;
-    for (user_id_t id: payload.getRecipients()) {
-        cnt += redeliverMessagesTo(id);
+    m_server->stopAccept();
+    if (m_secureServer) {
+        m_secureServer->stopAccept();
+    }
+
+    auto state = std::make_shared<DrainState>(m_throttleService);
+    state->options = options;
+    state->options.batchSize = std::max<std::size_t>(1, options.batchSize);
+    state->onDrained = onDrained;
+    state->random.seed(std::random_device()());
+    if (m_handoff) {
+        state->handoffNode = getHandoffNode();
+        const wss::ClusterBus::Node *node = m_cluster->getNode(state->handoffNode);
+        if (node && !node->url.empty()) {
+            state->reasonExtra = ",\"url\":" + nlohmann::json(node->url).dump();
+        }
     }
+    collectDrainConnections(*state);
+    L_INFO_F("Chat", "Draining %lu connections", state->queue.size());
 
-    return cnt;
+    m_throttleService.post([this, state] {
+      drainStep(state);
+    });
 }
-bool wss::ChatServer::hasUndeliveredMessages(user_id_t recipientId) {
-    std::lock_guard<std::mutex> locker(m_undeliveredMutex);
-    L_DEBUG_F("Chat::Underlivered",
-              "Check for undelivered messages for user %lu: %lu",
-              recipientId,
-              m_undeliveredMessagesMap[recipientId].size());
-    return !m_undeliveredMessagesMap[recipientId].empty();
+bool wss::ChatServer::isDraining() const noexcept {
+    return m_draining;
+}
+void wss::ChatServer::setHandoff(const HandoffOptions &options) {
+    if (!m_cluster) {
+        throw std::logic_error("Handoff requires cluster links: call setCluster() first");
+    }
+    m_handoff = std::make_unique<HandoffOptions>(options);
 }
-wss::MessageQueue &wss::ChatServer::getUndeliveredMessages(user_id_t recipientId) {
-    std::lock_guard<std::mutex> locker(m_undeliveredMutex);
-    return m_undeliveredMessagesMap[recipientId];
+wss::node_id_t wss::ChatServer::getHandoffNode() const {
+    const auto connected = m_cluster->getConnectedNodes();
+    if (m_handoff->node != 0) {
+        return std::binary_search(connected.begin(), connected.end(), m_handoff->node) ? m_handoff->node : 0;
+    }
+    return connected.empty() ? 0 : connected.front();
 }
+void wss::ChatServer::handoffState(wss::node_id_t node) {
+    if (node == 0) {
+        WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "No connected node to hand off users state");
+        return;
+    }
+    const auto started = std::chrono::steady_clock::now();
+    std::size_t sent = 0;
+    const auto send = [this, node, &sent](wss::handoff::Writer &writer) {
+      if (writer.count() == 0) {
+          return true;
+      }
+      if (!m_cluster->sendHandoff(node, writer.getBody(), m_handoff->timeoutMillis)) {
+          return false;
+      }
+      wss::metrics::add(wss::metrics::Counter::HandoffSent, writer.count());
+      sent += writer.count();
+      writer.clear();
+      return true;
+    };
 
-std::vector<wss::MessageQueue *>
-wss::ChatServer::getUndeliveredMessages(const MessagePayload &payload) {
-    std::vector<wss::MessageQueue *> out;
-    {
-        std::lock_guard<std::mutex> locker(m_undeliveredMutex);
-        for (user_id_t id: payload.getRecipients()) {
-            out.push_back(&m_undeliveredMessagesMap[id]);
+    // connections are closed: open connections counters are not sent
+    wss::handoff::Writer stats(wss::handoff::StatisticsKind);
+    bool ok = true;
+    for (const auto &stat: m_statistics->snapshot()) {
+        stats.add(stat->getState());
+        if (stats.size() >= HANDOFF_BATCH_BYTES && !(ok = send(stats))) {
+            break;
         }
     }
+    ok = ok && send(stats);
+
+    if (ok && !m_undelivered->isShared()) {
+        // snapshot keeps original expiry of memory messages, other ones start their lifetime again on receiver
+        std::unordered_map<const wss::MessagePayload *, uint64_t> expiry;
+        std::unordered_set<user_id_t> recipients;
+        m_undelivered->snapshot([&expiry, &recipients](const std::vector<user_id_t> &users,
+                                                       const MessagePayloadPtr &payload,
+                                                       uint64_t expiresAt) {
+          expiry[payload.get()] = expiresAt;
+          recipients.insert(users.begin(), users.end());
+        });
+        for (const auto &stat: m_statistics->snapshot()) {
+            recipients.insert(stat->getId());
+        }
 
-    return out;
-}
+        const auto expiryOf = [this, &expiry](const MessagePayloadPtr &payload) {
+          const auto it = expiry.find(payload.get());
+          return it != expiry.end() ? it->second : getUndeliveredExpiry(*payload);
+        };
+
+        // taken messages are kept until receiver acks their batch, and are put back with their expiry otherwise
+        struct Taken {
+          user_id_t recipient;
+          MessagePayloadPtr payload;
+          uint64_t expiresAt;
+        };
+        std::vector<Taken> batch;
+        std::size_t batchBytes = 0;
+        const auto flush = [this, &send, &batch, &batchBytes]() {
+          wss::handoff::Writer writer(wss::handoff::MessagesKind);
+          for (const auto &item: batch) {
+              writer.add({item.recipient}, item.payload, item.expiresAt);
+          }
+          const bool delivered = send(writer);
+          if (!delivered) {
+              for (const auto &item: batch) {
+                  m_undelivered->push(item.recipient, item.payload, item.expiresAt);
+              }
+          }
+          batch.clear();
+          batchBytes = 0;
+          return delivered;
+        };
+
+        std::vector<MessagePayloadPtr> taken;
+        for (user_id_t recipient: recipients) {
+            if (!ok) {
+                break;
+            }
+            if (!m_undelivered->has(recipient)) {
+                continue;
+            }
+            taken.clear();
+            m_undelivered->take(recipient, 0, taken);
+            for (std::size_t i = 0; i < taken.size(); i++) {
+                batch.push_back(Taken{recipient, taken[i], expiryOf(taken[i])});
+                batchBytes += taken[i]->toBinary().size();
+                if (batchBytes >= HANDOFF_BATCH_BYTES && !(ok = flush())) {
+                    for (std::size_t rest = i + 1; rest < taken.size(); rest++) {
+                        m_undelivered->push(recipient, taken[rest], expiryOf(taken[rest]));
+                    }
+                    break;
+                }
+            }
+        }
+        ok = ok && flush();
+    }
 
-void wss::ChatServer::enqueueUndeliveredMessage(const wss::MessagePayload &payload) {
-    std::unique_lock<std::mutex> uniqueLock(m_undeliveredMutex);
-    for (auto recipient: payload.getRecipients()) {
-        m_undeliveredMessagesMap[recipient].push(payload);
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started).count();
+    if (ok) {
+        WSS_LOG_F(wss::logging::LevelInfo, "Cluster", "Handed off %lu items of users state to node %u in %lldms",
+                  static_cast<unsigned long>(sent), node, static_cast<long long>(elapsed));
+    } else {
+        WSS_LOG_F(wss::logging::LevelWarning, "Cluster",
+                  "Handoff to node %u is interrupted after %lu items: link is down or buffer is full",
+                  node, static_cast<unsigned long>(sent));
     }
 }
-int wss::ChatServer::redeliverMessagesTo(user_id_t recipientId) {
-    if (not wss::Settings::get().chat.enableUndeliveredQueue) {
-        return 0;
+bool wss::ChatServer::onHandoff(wss::node_id_t from, const std::string &body) {
+    const bool queueEnabled = wss::Settings::get().chat.enableUndeliveredQueue;
+    const uint64_t now = UndeliveredStore::now();
+    std::size_t received = 0;
+    std::unordered_set<user_id_t> recipients;
+    bool valid = true;
+    try {
+        wss::handoff::read(body.data(), body.size(), [this, &received](const wss::Statistics::State &state) {
+          m_statistics->get(state.id)->merge(state);
+          received++;
+        }, [this, &received, &recipients, queueEnabled, now](std::vector<user_id_t> &&users,
+                                                            const MessagePayloadPtr &payload,
+                                                            uint64_t expiresAt) {
+          received++;
+          if (!queueEnabled || (expiresAt != 0 && expiresAt <= now)) {
+              return;
+          }
+          m_undelivered->push(users.data(), users.size(), payload, expiresAt);
+          recipients.insert(users.begin(), users.end());
+        });
+    } catch (const std::exception &e) {
+        WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Invalid handoff from node %u: %s", from, e.what());
+        valid = false;
     }
-
-    if (!hasUndeliveredMessages(recipientId)) {
-        return 0;
+    wss::metrics::add(wss::metrics::Counter::HandoffReceived, received);
+    // users, that reconnected here before their messages arrived
+    for (user_id_t recipient: recipients) {
+        redeliverMessagesTo(recipient);
     }
-
-    int cnt = 0;
-    auto &queue = getUndeliveredMessages(recipientId);
-    L_DEBUG_F("Chat::Undelivered", "Redeliver %lu message(s) to user %lu", queue.size(), recipientId);
-    while (!queue.empty()) {
-        MessagePayload payload = queue.front();
-        queue.pop();
-        send(payload);
-        cnt++;
+    return valid;
+}
+void wss::ChatServer::collectDrainConnections(DrainState &state) {
+    // all queued connections are taken already
+    state.queue.clear();
+    state.next = 0;
+
+    const auto collect = [&state](const WsConnectionPtr &connection) {
+      if (state.seen.insert(connection->getUniqueId()).second) {
+          state.queue.push_back(connection);
+      }
+    };
+    m_endpoint->getConnectionsSnapshot().forEach(collect);
+    if (m_secureEndpoint) {
+        m_secureEndpoint->getConnectionsSnapshot().forEach(collect);
     }
-
-    return cnt;
 }
-
-void wss::ChatServer::send(const wss::MessagePayload &payload) {
-    // if recipient is a BOT, than we don't need to find conneciton, just trigger event notifier ilsteners
-    if (payload.isForBot()) {
-        callOnMessageListeners(payload);
-        L_DEBUG("Chat::Send", "Sending message to bot");
-        return;
+void wss::ChatServer::drainStep(const std::shared_ptr<DrainState> &state) {
+    const auto now = std::chrono::steady_clock::now();
+
+    if (state->next == state->queue.size() && state->flushing.empty()) {
+        // connections, that were finishing handshake when accepting has been stopped
+        collectDrainConnections(*state);
+        if (state->queue.empty()) {
+            L_INFO("Chat", "All connections are drained");
+            if (m_handoff) {
+                // chosen node could be gone while draining
+                const auto connected = m_cluster->getConnectedNodes();
+                const bool alive = std::binary_search(connected.begin(), connected.end(), state->handoffNode);
+                handoffState(alive ? state->handoffNode : getHandoffNode());
+            }
+            if (state->onDrained) {
+                state->onDrained();
+            }
+            return;
+        }
     }
 
-    callOnMessageListeners(payload);
+    const auto deadline = now + std::chrono::milliseconds(state->options.flushTimeoutMillis);
+    for (std::size_t taken = 0; taken < state->options.batchSize && state->next < state->queue.size(); taken++) {
+        state->flushing.emplace_back(std::move(state->queue[state->next++]), deadline);
+    }
 
-    for (user_id_t uid: payload.getRecipients()) {
-        if (uid == 0L) {
-            // just in case, prevent sending bot-only message to nobody
+    std::uniform_int_distribution<long> jitter(0, std::max(0L, state->options.reconnectJitterMillis));
+    for (std::size_t i = 0; i < state->flushing.size();) {
+        auto &item = state->flushing[i];
+        if (item.first->getSendQueueFrames() > 0 && now < item.second) {
+            i++;
             continue;
         }
 
-        sendTo(uid, payload);
+        item.first->sendClose(STATUS_SERVICE_RESTART,
+                              fmt::format("{{\"reconnectAfterMillis\":{0}{1}}}",
+                                          jitter(state->random), state->reasonExtra));
+        item = std::move(state->flushing.back());
+        state->flushing.pop_back();
     }
-}
 
-void wss::ChatServer::sendTo(user_id_t recipient, const wss::MessagePayload &payload) {
-    using toolboxpp::Logger;
-    const std::string payloadString = payload.toJson();
-    std::size_t payloadSize = payloadString.length();
-    uint8_t fin_rsv_opcode = 129;//@TODO static_cast<uint8_t>(payload.isBinary() ? 130 : 129);
-
-//    std::lock_guard<std::recursive_mutex> locker(m_connectionMutex);
-
-    if (!m_connectionStorage->size(recipient)) {
-        handleUndeliverable(recipient, payload);
-        MessagePayload sent = payload; // copy to move, referenced payload will goes out of scope
-        sent.setRecipient(recipient);
-        onMessageSent(std::move(sent), payloadSize, false);
-        return;
-    }
-
-        m_connectionStorage->forEach(recipient, [this, fin_rsv_opcode, payload, payloadString]
-        (size_t i, const wss::WsConnectionPtr &conn, wss::conn_id_t cid, wss::user_id_t uid){
-          // DO NOT reuse stream, it will die after first sending
-          auto sendStream = std::make_shared<WsMessageStream>();
-          *sendStream << payloadString;
-
-          Logger::get().debug(__FILE__, __LINE__, "Chat::Send",
-                              fmt::format("Sending message [thread={0}] to recipient {1}, connection[{2}]",
-                                          getThreadName(), uid, i
-                              ));
-
-          // connection->send is an asynchronous function
-          conn->send(sendStream, [this, uid, payload, cid]
-              (const wss::server::websocket::ErrorCode &errorCode, std::size_t ts) {
-            if (errorCode) {
-                // See http://www.boost.org/doc/libs/1_55_0/doc/html/boost_asio/reference.html, Error Codes for error code meanings
-                Logger::get().debug(__FILE__, __LINE__, "Chat::Send::Error",
-                                    fmt::format(
-                                        "Unable to send message to {0}. Cause: {1} error: {2}",
-                                        uid, errorCode.category().name(), errorCode.message()
-                                    ));
-
-                if (errorCode.value() == boost::system::errc::broken_pipe) {
-                    Logger::get().debug(__FILE__, __LINE__, "Chat::Send::Error",
-                                        fmt::format("Disconnecting Broken connection {0} ({1})", uid, cid));
-                    m_connectionStorage->remove(uid, cid);
-                }
-                handleUndeliverable(uid, payload);
-            } else {
-                MessagePayload sent = payload;
-                sent.setRecipient(uid);
-                onMessageSent(std::move(sent), ts, true);
-            }
-          }, fin_rsv_opcode);
-        }, [this, payload] (wss::user_id_t uid, wss::conn_id_t) {
-          L_DEBUG("Chat::Send", "Connection not found exception. Adding payload to undelivered");
-          handleUndeliverable(uid, payload);
-        });
+    state->timer.expires_from_now(std::chrono::milliseconds(state->options.intervalMillis));
+    state->timer.async_wait([this, state](const boost::system::error_code &ec) {
+      if (!ec) {
+          drainStep(state);
+      }
+    });
 }
-
-void wss::ChatServer::handleUndeliverable(wss::user_id_t uid, const wss::MessagePayload &payload) {
-    if (!wss::Settings::get().chat.enableUndeliveredQueue) {
-        L_DEBUG_F("Chat::Send", "User %lu is unavailable. Skipping message.", uid);
+void wss::ChatServer::setTlsSessionConfig(const wss::server::websocket::SocketServerSecure::SessionConfig &config) {
+    WssServer *secureServer = getSecureServer();
+    if (!secureServer) {
         return;
     }
-    MessagePayload inaccessibleUserPayload = payload;
-    inaccessibleUserPayload.setRecipient(uid);
-    // as messages did not sent to exact user, we add to undelivered queue exact this user in payload recipients
-    enqueueUndeliveredMessage(inaccessibleUserPayload);
-    L_DEBUG_F("Chat::Send", "User %lu is unavailable. Adding message to queue", uid);
+    secureServer->getSessionConfig() = config;
 }
-
-std::size_t wss::ChatServer::getThreadName() {
-    const std::thread::id id = std::this_thread::get_id();
-    static std::size_t nextindex = 0;
-    static std::mutex my_mutex;
-    static std::map<std::thread::id, std::size_t> ids;
-    std::lock_guard<std::mutex> lock(my_mutex);
-    if (ids.find(id) == ids.end())
-        ids[id] = nextindex++;
-
-    return ids[id];
+void wss::ChatServer::setMaxConcurrentHandshakes(std::size_t maxHandshakes) {
+    m_server->getConfig().maxConcurrentHandshakes = maxHandshakes;
 }
-void wss::ChatServer::setMessageSizeLimit(size_t bytes) {
-    m_maxMessageSize = bytes;
-    m_server->getConfig().maxMessageSize = m_maxMessageSize;
+void wss::ChatServer::setAuthMaxQueue(std::size_t maxQueue) {
+    m_authMaxQueue = maxQueue;
 }
-void wss::ChatServer::setAuth(const nlohmann::json &config) {
-    m_auth = wss::auth::registry::createFromConfig(config);
+const wss::AuthMetrics &wss::ChatServer::getAuthMetrics() const {
+    return m_authMetrics;
+}
+wss::StateSizes wss::ChatServer::getStateSizes() const {
+    wss::StateSizes out;
+    out.connections = getConnectionsCount();
+    out.users = m_connectionStorage->size();
+    out.statistics = m_statistics->size();
+    out.rooms = m_rooms->size();
+    out.topicSubscriptions = m_topics->size();
+    out.rateLimitedUsers = m_rateLimiter->size();
+    return out;
 }
+void wss::ChatServer::setRateLimits(const wss::RateLimiter::Limits &connectionLimits,
+                                    const wss::RateLimiter::Limits &userLimits,
+                                    const std::string &policy,
+                                    long maxDelayMillis) {
+    using toolboxpp::strings::equalsIgnoreCase;
+
+    RateLimiter::Policy p;
+    if (equalsIgnoreCase(policy, "drop")) {
+        p = RateLimiter::Policy::Drop;
+    } else if (equalsIgnoreCase(policy, "delay")) {
+        p = RateLimiter::Policy::Delay;
+    } else if (equalsIgnoreCase(policy, "close")) {
+        p = RateLimiter::Policy::Close;
+    } else {
+        throw std::runtime_error("Unknown rate limit policy: " + policy);
+    }
 
-void wss::ChatServer::setEnabledMessageDeliveryStatus(bool enabled) {
-    m_enableMessageDeliveryStatus = enabled;
+    m_rateLimiter->configure(userLimits, p, std::chrono::milliseconds(maxDelayMillis));
+    m_server->getConfig().inboundMessagesRate = connectionLimits.messagesRate;
+    m_server->getConfig().inboundMessagesBurst = connectionLimits.messagesBurst;
+    m_server->getConfig().inboundBytesRate = connectionLimits.bytesRate;
+    m_server->getConfig().inboundBytesBurst = connectionLimits.bytesBurst;
 }
+void wss::ChatServer::setPresence(std::size_t historySize, const std::string &topic, bool notifyListeners) {
+    if (!topic.empty() && !wss::TopicStorage::isValidTopic(topic)) {
+        throw std::runtime_error("Invalid presence topic: " + topic);
+    }
 
-void wss::ChatServer::addMessageListener(wss::ChatServer::OnMessageSentListener callback) {
-    m_messageListeners.push_back(callback);
+    m_presence = std::make_unique<wss::PresenceFeed>(historySize);
+    m_presenceTopic = topic;
+    m_presenceNotify = notifyListeners;
+    m_connectionStorage->setPresenceHandler(std::bind(&wss::ChatServer::onPresence, this, std::placeholders::_1));
 }
-void wss::ChatServer::addStopListener(wss::ChatServer::OnServerStopListener callback) {
-    m_stopListeners.push_back(callback);
+bool wss::ChatServer::getPresenceEvents(uint64_t since,
+                                        std::vector<wss::PresenceFeed::PresenceEvent> &out,
+                                        uint64_t &last) const {
+    if (!m_presence) {
+        last = 0;
+        return false;
+    }
+    return m_presence->since(since, out, last);
 }
-std::unique_ptr<wss::Statistics> &wss::ChatServer::getStat(wss::user_id_t id) {
-    std::lock_guard<std::mutex> locker(m_statMutex);
-    if (m_statistics.find(id) == m_statistics.end()) {
-        m_statistics[id] = std::make_unique<wss::Statistics>(id);
+void wss::ChatServer::onPresence(const wss::ConnectionStorage::PresenceEvent &event) {
+    if (m_cluster) {
+        m_cluster->notifyPresence(event.user, event.online, event.sequence);
+    }
+    if (m_bridge) {
+        m_bridge->onPresence(event.user);
+    }
+    if (!m_presence) {
+        return;
+    }
+    m_presence->push(event);
+    if (m_presenceTopic.empty() && !m_presenceNotify) {
+        return;
     }
 
-    return m_statistics[id];
+    MessagePayload payload = MessagePayload::createPresence(event.user, event.online, event.sequence);
+    if (m_presenceTopic.empty()) {
+        callOnMessageListeners(std::make_shared<const wss::MessagePayload>(std::move(payload)));
+        return;
+    }
+    if (m_presenceNotify) {
+        // topic copy differs by topic
+        callOnMessageListeners(std::make_shared<const wss::MessagePayload>(payload));
+    }
+    payload.setTopic(m_presenceTopic);
+    const wss::MessagePayloadPtr shared = std::make_shared<const wss::MessagePayload>(std::move(payload));
+    wss::EncodedFrames frames(*shared, SendPriority::Normal);
+    publish(shared, frames);
+    if (m_cluster) {
+        m_cluster->publish(shared);
+    }
+    if (m_bridge) {
+        m_bridge->publish(shared);
+    }
 }
-
-const wss::UserMap<std::unique_ptr<wss::Statistics>> &wss::ChatServer::getStats() {
-    return m_statistics;
+const wss::RateLimitMetrics &wss::ChatServer::getRateLimitMetrics() const {
+    return m_rateLimiter->getMetrics();
 }
-void wss::ChatServer::callOnMessageListeners(wss::MessagePayload payload) {
+const wss::UndeliveredStore &wss::ChatServer::getUndeliveredStore() const {
+    return *m_undelivered;
+}
+const wss::server::websocket::TlsSessionMetrics *wss::ChatServer::getTlsSessionMetrics() const {
+    const WssServer *secureServer = getSecureServer();
+    if (!secureServer) {
+        return nullptr;
+    }
+    return &secureServer->getTlsSessionMetrics();
+}
+void wss::ChatServer::setPerMessageDeflate(const wss::server::websocket::PerMessageDeflate::Options &options) {
+    m_endpoint->deflateOptions = options;
+}
+void wss::ChatServer::joinThreads() {
+    if (m_throttleThread && m_throttleThread->joinable()) {
+        m_throttleThread->join();
+    }
+    if (m_deliveryStatusThread && m_deliveryStatusThread->joinable()) {
+        m_deliveryStatusThread->join();
+    }
+    if (m_snapshotThread && m_snapshotThread->joinable()) {
+        m_snapshotThread->join();
+    }
+    if (m_cluster) {
+        m_cluster->join();
+    }
+    if (m_workerThread && m_workerThread->joinable()) {
+        m_workerThread->join();
+    }
+    if (m_secureWorkerThread && m_secureWorkerThread->joinable()) {
+        m_secureWorkerThread->join();
+    }
+}
+void wss::ChatServer::detachThreads() {
+    if (m_workerThread) {
+        m_workerThread->detach();
+    }
+    if (m_secureWorkerThread) {
+        m_secureWorkerThread->detach();
+    }
+}
+void wss::ChatServer::runService() {
+    std::string hostname = "0.0.0.0";
+    if (not m_server->getConfig().address.empty()) {
+        hostname = m_server->getConfig().address;
+    }
+    const char *proto = m_useSSL ? "wss" : "ws";
+    if (wss::unixsocket::isAddress(hostname)) {
+        L_INFO_F("WebSocket Server", "Started at %s+%s (%s)", proto, hostname.c_str(), wss::IO_BACKEND);
+    } else {
+        L_INFO_F("WebSocket Server", "Started at %s://%s:%d (%s)", proto, hostname.c_str(),
+                 m_server->getConfig().port, wss::IO_BACKEND);
+    }
+
+    if (m_enableMessageDeliveryStatus && m_deliveryStatusMode == DeliveryStatusMode::Batch
+        && m_deliveryStatusFlushMillis > 0) {
+        m_deliveryStatusThread = std::make_unique<boost::thread>([this] {
+          wss::affinity::pin(wss::affinity::Group::Background);
+          const auto interval = boost::chrono::milliseconds(m_deliveryStatusFlushMillis);
+          try {
+              while (!boost::this_thread::interruption_requested()) {
+                  boost::this_thread::sleep_for(interval);
+                  flushDeliveryStatuses();
+              }
+          } catch (const boost::thread_interrupted &) {
+              // stopped
+          }
+        });
+    }
+
+    if (!m_snapshotPath.empty() && m_snapshotIntervalSeconds > 0) {
+        m_snapshotThread = std::make_unique<boost::thread>([this] {
+          wss::affinity::pin(wss::affinity::Group::Background);
+          const auto interval = boost::chrono::seconds(m_snapshotIntervalSeconds);
+          try {
+              while (!boost::this_thread::interruption_requested()) {
+                  boost::this_thread::sleep_for(interval);
+                  saveSnapshot();
+              }
+          } catch (const boost::thread_interrupted &) {
+              // stopped
+          }
+        });
+    }
+
+    if (m_cluster) {
+        // peers get snapshot of users on link start, so bus is started before clients are accepted
+        m_cluster->start();
+    }
+    if (m_bridge) {
+        m_bridge->start();
+    }
+
+    m_throttleWork = std::make_unique<boost::asio::io_service::work>(m_throttleService);
+    m_throttleThread = std::make_unique<boost::thread>([this] {
+      wss::affinity::pin(wss::affinity::Group::Background);
+      m_throttleService.run();
+    });
+    m_throttleService.post([this] {
+      expireUndeliveredMessages();
+    });
+    if (m_overload) {
+        m_throttleService.post([this] {
+          checkOverload();
+        });
+    }
+    if (m_attachments) {
+        m_throttleService.post([this] {
+          expireAttachments();
+        });
+    }
+    if (m_statisticsOfflineSeconds > 0 || m_statisticsMaxUsers > 0) {
+        m_throttleService.post([this] {
+          expireStatistics();
+        });
+    }
+    if (m_scheduler) {
+        m_throttleService.post([this] {
+          deliverScheduled();
+        });
+    }
+
+    m_workerThread = std::make_unique<boost::thread>([this] {
+      this->m_server->start();
+    });
+
+    if (m_localIngest) {
+        m_localIngest->start([this](const char *data, std::size_t length) {
+          // same checks as rest api send-message
+          MessagePayload payload = MessagePayload::fromBinary(data, length);
+          if (!payload.isValid() || payload.isForBot()) {
+              return false;
+          }
+          payload.setTrace(wss::tracing::sample());
+          send(payload);
+          return true;
+        });
+    }
+    if (m_ingestServer) {
+        m_ingestServer->start([this](MessagePayload &&payload) {
+          if (!payload.isValid() || payload.isForBot()) {
+              return false;
+          }
+          payload.setTrace(wss::tracing::sample());
+          send(payload);
+          return true;
+        });
+    }
+    if (m_http2Gateway) {
+        m_http2Gateway->start();
+    }
+
+    if (m_secureServer) {
+        // all settings were applied to main server, secure listener differs only by port and TLS settings
+        const unsigned short securePort = m_secureServer->getConfig().port;
+        m_secureServer->getConfig() = m_server->getConfig();
+        m_secureServer->getConfig().port = securePort;
+        if (wss::unixsocket::isAddress(hostname)) {
+            // unix socket is taken by main listener, secure one listens port of any address
+            m_secureServer->getConfig().address.clear();
+            hostname = "0.0.0.0";
+        }
+        m_secureEndpoint->deflateOptions = m_endpoint->deflateOptions;
+        m_secureEndpoint->subprotocols = m_endpoint->subprotocols;
+
+        L_INFO_F("WebSocket Server", "Started at wss://%s:%d", hostname.c_str(), securePort);
+        m_secureWorkerThread = std::make_unique<boost::thread>([this] {
+          this->m_secureServer->start();
+        });
+    }
+}
+void wss::ChatServer::stopService() {
+    if (m_deliveryStatusThread) {
+        m_deliveryStatusThread->interrupt();
+    }
+    if (m_snapshotThread) {
+        m_snapshotThread->interrupt();
+    }
+    if (m_localIngest) {
+        m_localIngest->stop();
+    }
+    if (m_ingestServer) {
+        m_ingestServer->stop();
+    }
+    if (m_http2Gateway) {
+        m_http2Gateway->stop();
+    }
+    if (m_outboundBatcher) {
+        m_outboundBatcher->flushAll();
+    }
+    m_throttleWork.reset();
+    m_throttleService.stop();
+    if (m_cluster) {
+        m_cluster->stop();
+    }
+    if (m_bridge) {
+        m_bridge->stop();
+    }
+    this->m_server->stop();
+    if (m_secureServer) {
+        m_secureServer->stop();
+    }
+}
+
+void wss::ChatServer::onMessage(WsConnectionPtr &connection, WsMessagePtr message) {
+    wss::metrics::add(wss::metrics::Counter::FramesIn);
+    wss::metrics::add(wss::metrics::Counter::BytesIn, message->size());
+    std::size_t batchItems;
+    try {
+        // every item of batch is charged by rate limits
+        batchItems = getCodec(connection, message).countBatch(message->data(), message->size());
+    } catch (const std::exception &e) {
+        connection->sendClose(STATUS_INVALID_MESSAGE_PAYLOAD, std::string("Invalid payload. ") + e.what());
+        return;
+    }
+    std::chrono::nanoseconds delay;
+    switch (m_rateLimiter->check(connection, message->size(), std::max<std::size_t>(1, batchItems), delay)) {
+        case RateLimiter::Action::Accept:
+            handleMessage(connection, message, batchItems);
+            break;
+
+        case RateLimiter::Action::Drop:
+            WSS_DEBUG_F("Chat::Throttle", "User %lu (%lu): message dropped by rate limit",
+                          connection->getId(), connection->getUniqueId());
+            break;
+
+        case RateLimiter::Action::Close:
+            connection->sendClose(STATUS_POLICY_VIOLATION, "Rate limit exceeded");
+            break;
+
+        case RateLimiter::Action::Delay: {
+            // later messages reserve later tokens, so delayed messages are handled in order they came
+            auto timer = std::make_shared<boost::asio::steady_timer>(m_throttleService, delay);
+            timer->async_wait([this, connection, message, batchItems, timer](const boost::system::error_code &ec) {
+              WsConnectionPtr conn = connection;
+              if (!ec) {
+                  handleMessage(conn, message, batchItems);
+              }
+            });
+        }
+            break;
+    }
+}
+
+void wss::ChatServer::handleMessage(WsConnectionPtr &connection, const WsMessagePtr &message, std::size_t batchItems) {
+    // no server-wide lock here: payload is parsed by connection strand, routing locks only recipient shard of storage
+    WSS_DEBUG_F("Chat::Incoming", "On thread: %lu", getThreadName());
+    // oversized batch is rejected by its header, before items are decoded
+    if (batchItems > 0 && (m_maxBatchSize == 0 || batchItems > m_maxBatchSize)) {
+        connection->sendClose(STATUS_INVALID_MESSAGE_PAYLOAD,
+                              "Invalid payload. Batch size limit is " + std::to_string(m_maxBatchSize));
+        return;
+    }
+    // fragmented messages come here already reassembled by server, parsing right from the frame buffer
+    const wss::PayloadCodec *codec = &getCodec(connection, message);
+    std::vector<MessagePayload> batch;
+    bool isBatch;
+    try {
+        isBatch = codec->decodeBatch(message->data(), message->size(), batch);
+    } catch (const std::exception &e) {
+        connection->sendClose(STATUS_INVALID_MESSAGE_PAYLOAD, std::string("Invalid payload. ") + e.what());
+        return;
+    }
+    if (isBatch) {
+        const auto parsedAt = std::chrono::steady_clock::now();
+        for (auto &item: batch) {
+            item.setReceivedAt(message->receivedAt);
+            traceParse(item, parsedAt);
+            if (item.isValid()) {
+                captureMessage(connection, item, message->size() / batch.size());
+            }
+        }
+        wss::metrics::observe(wss::metrics::Histogram::MessageParse, parsedAt - message->receivedAt);
+        onBatch(connection, batch);
+        return;
+    }
+
+    MessagePayload payload = codec->decode(message->data(), message->size());
+    payload.setReceivedAt(message->receivedAt);
+    const auto parsedAt = std::chrono::steady_clock::now();
+    traceParse(payload, parsedAt);
+    wss::metrics::observe(wss::metrics::Histogram::MessageParse, parsedAt - message->receivedAt);
+
+    if (!payload.isValid()) {
+        connection->sendClose(STATUS_INVALID_MESSAGE_PAYLOAD, "Invalid payload. " + payload.getError());
+        return;
+    }
+
+    captureMessage(connection, payload, message->size());
+    dispatch(connection, payload);
+}
+
+void wss::ChatServer::captureMessage(const WsConnectionPtr &connection,
+                                     const wss::MessagePayload &payload,
+                                     std::size_t size) {
+    if (!wss::capture::isRunning()) {
+        return;
+    }
+    if (payload.isForRoom()) {
+        wss::capture::fanout(connection->getId(), size, m_rooms->getMembers(payload.getRoom())->size());
+    } else if (payload.isForTopic()) {
+        // subscribers are matched by publish, walking topic trie twice is not worth it
+        wss::capture::fanout(connection->getId(), size, 0);
+    } else {
+        const wss::MessagePayload::Recipients &recipients = payload.getRecipients();
+        wss::capture::direct(connection->getId(), size, recipients.data(), recipients.size());
+    }
+}
+
+void wss::ChatServer::onBatch(WsConnectionPtr &connection, const std::vector<wss::MessagePayload> &batch) {
+    if (m_maxBatchSize == 0 || batch.size() > m_maxBatchSize) {
+        connection->sendClose(STATUS_INVALID_MESSAGE_PAYLOAD,
+                              "Invalid payload. Batch size limit is " + std::to_string(m_maxBatchSize));
+        return;
+    }
+
+    // invalid items don't break batch: they are reported in status, other items are sent
+    std::size_t accepted = 0;
+    std::vector<std::pair<std::size_t, std::string>> rejected;
+    for (std::size_t i = 0; i < batch.size(); i++) {
+        if (!batch[i].isValid()) {
+            rejected.emplace_back(i, batch[i].getError());
+            continue;
+        }
+        dispatch(connection, batch[i]);
+        accepted++;
+    }
+
+    const MessagePayload status = MessagePayload::createBatchStatus(connection->getId(), accepted, rejected);
+    const wss::PayloadCodec &codec = getCodec(connection);
+    connection->send(WsBase::Frame::create(codec.encode(status), codec.getFinRsvOpcode()));
+}
+
+void wss::ChatServer::dispatch(WsConnectionPtr &connection, const wss::MessagePayload &payload) {
+    if (payload.typeIs(types::ID_ACK)) {
+        onAck(connection, payload);
+        return;
+    }
+    if (payload.typeIs(types::ID_HISTORY)) {
+        onHistory(connection, payload);
+        return;
+    }
+    if (payload.isForTopic()) {
+        if (payload.typeIs(types::ID_TOPIC_SUBSCRIBE)) {
+            subscribe(payload.getTopic(), connection);
+            return;
+        } else if (payload.typeIs(types::ID_TOPIC_UNSUBSCRIBE)) {
+            unsubscribe(payload.getTopic(), connection);
+            return;
+        } else if (!m_enableClientTopicPublish) {
+            WSS_DEBUG_F("Chat::Send", "User %lu can't publish to topic %s. Skipping message.",
+                          connection->getId(), payload.getTopic().c_str());
+            return;
+        }
+    } else if (payload.isForRoom()) {
+        // membership is always changed for connection owner, not for payload sender
+        if (payload.typeIs(types::ID_ROOM_JOIN)) {
+            joinRoom(payload.getRoom(), connection->getId());
+            return;
+        } else if (payload.typeIs(types::ID_ROOM_LEAVE)) {
+            leaveRoom(payload.getRoom(), connection->getId());
+            return;
+        } else if (!m_rooms->isMember(payload.getRoom(), connection->getId())) {
+            WSS_DEBUG_F("Chat::Send", "User %lu is not a member of room %lu. Skipping message.",
+                          connection->getId(), payload.getRoom());
+            return;
+        }
+    }
+
+    wss::topk::add(wss::topk::Dimension::Senders, payload.getSender());
+    wss::topk::addType(payload.getType());
+
+    if (wss::Settings::get().chat.message.enableSendBack) {
+        const bool isIgnoredType = wss::Settings::get().chat.message.ignoreTypesSendBackSet[payload.getTypeId()];
+        if (!isIgnoredType && !payload.isForBot()) {
+            sendTo(payload.getSender(), payload);
+        }
+    }
+
+    send(payload);
+}
+
+void wss::ChatServer::onAck(WsConnectionPtr &connection, const wss::MessagePayload &payload) {
+    if (!m_ackWindow) {
+        return;
+    }
+    if (m_ackWindow->ack(connection->getUniqueId(), payload.getDataIds())) {
+        // messages deferred by full window are waiting in undelivered queue
+        redeliverMessagesTo(connection->getId());
+    }
+}
+
+void wss::ChatServer::onHistory(WsConnectionPtr &connection, const wss::MessagePayload &payload) {
+    if (!m_history || connection->getId() == 0) {
+        return;
+    }
+    const json data = payload.getData();
+    unid_t since{};
+    bool hasCursor = false;
+    std::size_t limit = m_historyPageSize;
+    if (data.is_object()) {
+        const auto cursor = data.find("since");
+        if (cursor != data.end() && cursor->is_string()) {
+            if (!unid_t::parse(cursor->get<std::string>(), since)) {
+                WSS_DEBUG_F("Chat::History", "User %lu sent invalid cursor. Skipping request.", connection->getId());
+                return;
+            }
+            hasCursor = true;
+        }
+        const auto requested = data.find("limit");
+        if (requested != data.end() && requested->is_number_unsigned() && requested->get<std::size_t>() > 0) {
+            limit = std::min(limit, requested->get<std::size_t>());
+        }
+    }
+
+    wss::ConnectionStorage::Recipients::Item item;
+    item.user = connection->getId();
+    item.connectionId = connection->getUniqueId();
+    item.connection = connection;
+    // disk reads must not block io threads
+    m_throttleService.post([this, item, since, hasCursor, limit] {
+      std::size_t pageLimit = limit;
+      if (m_ackWindow) {
+          pageLimit = std::max<std::size_t>(1, std::min(pageLimit, m_ackWindow->available(item.connectionId)));
+      }
+      std::vector<MessagePayloadPtr> messages;
+      readHistory(item.user, hasCursor ? &since : nullptr, pageLimit, messages);
+      WSS_DEBUG_F("Chat::History", "Send %lu history message(s) to user %lu", messages.size(), item.user);
+
+      // same lane as redelivery: backfill must not delay live messages, reply goes after page
+      for (const auto &message: messages) {
+          wss::EncodedFrames frames(*message, SendPriority::Bulk);
+          sendToConnection(item, message, frames, nullptr);
+      }
+      const MessagePayloadPtr status = std::make_shared<const wss::MessagePayload>(
+          MessagePayload::createHistoryStatus(item.user, messages.empty() ? since : messages.back()->getId(),
+                                              messages.size() == pageLimit, messages.size()));
+      wss::EncodedFrames frames(*status, SendPriority::Bulk);
+      sendToConnection(item, status, frames, nullptr);
+    });
+}
+
+void wss::ChatServer::appendHistory(const user_id_t *recipients,
+                                    std::size_t count,
+                                    const wss::MessagePayload &payload) {
+    if (!m_history || payload.isTypeOfSentStatus() || payload.typeIs(types::ID_PRESENCE)
+        || payload.typeIs(types::ID_HISTORY)) {
+        return;
+    }
+    m_history->append(recipients, count, payload);
+}
+
+bool wss::ChatServer::readHistory(user_id_t user,
+                                  const unid_t *since,
+                                  std::size_t limit,
+                                  std::vector<MessagePayloadPtr> &out) const {
+    if (!m_history) {
+        return false;
+    }
+    // only page of payloads is built, envelopes are read from mapped log
+    m_history->read(user, since, std::min(limit, m_historyPageSize),
+                    [&out](const unid_t &, const char *envelope, std::size_t length) {
+                      MessagePayload payload = MessagePayload::fromStoredBinary(envelope, length);
+                      if (payload.isValid()) {
+                          out.push_back(std::make_shared<const MessagePayload>(std::move(payload)));
+                      }
+                    });
+    return true;
+}
+
+std::size_t wss::ChatServer::getHistoryPageSize() const {
+    return m_historyPageSize;
+}
+
+void wss::ChatServer::onMessageSent(const wss::MessagePayload &payload,
+                                    user_id_t recipient,
+                                    std::size_t bytesTransferred,
+                                    bool hasSent) {
+    if (payload.isTypeOfSentStatus()) return;
+
+    getStat(payload.getSender())
+        ->addSendMessage()
+        .addBytesTransferred(bytesTransferred);
+
+    if (hasSent) {
+        getStat(recipient)->addReceivedMessage().addBytesTransferred(bytesTransferred);
+        m_statistics->addDelivered(bytesTransferred);
+        wss::topk::add(wss::topk::Dimension::Recipients, recipient);
+    }
+
+    if (m_enableMessageDeliveryStatus && hasSent && m_deliveryStatusMode == DeliveryStatusMode::Delivery) {
+        wss::MessagePayload status = MessagePayload::createSendStatus(payload);
+        send(status);
+    }
+}
+
+std::shared_ptr<wss::ChatServer::DeliveryTracker> wss::ChatServer::createTracker(const wss::MessagePayloadPtr &payload,
+                                                                                 const ReportCollectorPtr &report) {
+    const bool status = m_enableMessageDeliveryStatus && m_deliveryStatusMode != DeliveryStatusMode::Delivery
+        && !payload->isTypeOfSentStatus();
+    if (!status && !report) {
+        return nullptr;
+    }
+    return std::make_shared<DeliveryTracker>(payload, status, report);
+}
+
+void wss::ChatServer::completeDelivery(const std::shared_ptr<DeliveryTracker> &tracker, bool delivered) {
+    if (!tracker) {
+        return;
+    }
+    if (delivered) {
+        tracker->delivered++;
+    }
+    if (--tracker->pending > 0) {
+        return;
+    }
+    if (tracker->report) {
+        finishReport(tracker->report);
+    }
+    if (!tracker->status || tracker->delivered == 0) {
+        return;
+    }
+
+    // all recipients connections are handled
+    const wss::MessagePayload &payload = *tracker->payload;
+    if (m_deliveryStatusMode == DeliveryStatusMode::Message) {
+        wss::MessagePayload status = MessagePayload::createSendStatus(payload.getSender(), {payload.getId()});
+        send(status);
+        return;
+    }
+
+    std::vector<wss::unid_t> flush;
+    {
+        std::lock_guard<std::mutex> locker(m_deliveryStatusMutex);
+        auto &ids = m_pendingDeliveryStatuses[payload.getSender()];
+        ids.push_back(payload.getId());
+        if (m_deliveryStatusFlushItems > 0 && ids.size() >= m_deliveryStatusFlushItems) {
+            flush = std::move(ids);
+            m_pendingDeliveryStatuses.erase(payload.getSender());
+        }
+    }
+    if (!flush.empty()) {
+        wss::MessagePayload status = MessagePayload::createSendStatus(payload.getSender(), flush);
+        send(status);
+    }
+}
+
+void wss::ChatServer::recordOutcome(const std::shared_ptr<DeliveryTracker> &tracker,
+                                    user_id_t user,
+                                    DeliveryOutcome outcome) {
+    if (!tracker || !tracker->report) {
+        return;
+    }
+    std::lock_guard<std::mutex> locker(tracker->report->lock);
+    tracker->report->outcomes[user] = outcome;
+}
+
+void wss::ChatServer::trackRecipients(ReportCollector &report,
+                                      const user_id_t *recipients,
+                                      std::size_t count,
+                                      user_id_t exclude) {
+    std::lock_guard<std::mutex> locker(report.lock);
+    report.tracked = true;
+    report.outcomes.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        if (recipients[i] != 0 && recipients[i] != exclude) {
+            report.outcomes.emplace(recipients[i], DeliveryOutcome::Pending);
+        }
+    }
+}
+
+void wss::ChatServer::finishReport(const ReportCollectorPtr &report) {
+    if (report->done.exchange(true)) {
+        return;
+    }
+    DeliveryReport out;
+    {
+        std::lock_guard<std::mutex> locker(report->lock);
+        out.tracked = report->tracked;
+        out.recipients.assign(report->outcomes.begin(), report->outcomes.end());
+    }
+    std::sort(out.recipients.begin(), out.recipients.end(), [](const auto &lhs, const auto &rhs) {
+      return lhs.first < rhs.first;
+    });
+    if (report->timer) {
+        // not cancelled here: handler of timer may run concurrently on throttle service thread
+        const std::shared_ptr<boost::asio::steady_timer> timer = report->timer;
+        m_throttleService.post([timer] {
+          timer->cancel();
+        });
+    }
+    report->handler(std::move(out));
+}
+
+void wss::ChatServer::flushDeliveryStatuses() {
+    UserMap<std::vector<wss::unid_t>> pending;
+    {
+        std::lock_guard<std::mutex> locker(m_deliveryStatusMutex);
+        pending.swap(m_pendingDeliveryStatuses);
+    }
+    for (const auto &item: pending) {
+        wss::MessagePayload status = MessagePayload::createSendStatus(item.first, item.second);
+        send(status);
+    }
+}
+
+void wss::ChatServer::onConnected(WsConnectionPtr connection) {
+    wss::metrics::add(wss::metrics::Counter::ConnectionsAccepted);
+    wss::web::Request request;
+    // handshake is released after this handler, request keeps copies
+    request.parseParamsString(connection->handshake->queryString);
+    request.setHeaders(connection->handshake->header);
+
+    if (!request.hasParams()) {
+        WSS_DEBUG_F("Chat::Connect::Error", "Invalid request: %s", connection->handshake->queryString.c_str());
+        connection->sendClose(STATUS_INVALID_QUERY_PARAMS, "Invalid request");
+        return;
+    }
+
+    const std::string idParam = request.getParam("id");
+    if (idParam.empty()) {
+        WSS_DEBUG("Chat::Connect::Error", "Id required in query parameter: ?id={id}");
+
+        connection->sendClose(STATUS_INVALID_QUERY_PARAMS, "Id required in query parameter: ?id={id}");
+        return;
+    }
+
+    user_id_t id;
+    try {
+        id = std::stoul(idParam);
+    } catch (const std::invalid_argument &e) {
+        const std::string errReason = "Passed invalid id: id=" + idParam + ". " + e.what();
+        WSS_DEBUG("Chat::Connect::Error", errReason);
+        connection->sendClose(STATUS_INVALID_QUERY_PARAMS, errReason);
+        return;
+    }
+
+    if (m_ring) {
+        const wss::HashRing::Node &owner = m_ring->locate(id);
+        if (owner.id != m_ringNode) {
+            wss::metrics::add(wss::metrics::Counter::ShardRedirects);
+            WSS_DEBUG_F("Chat::Connect", "User %lu belongs to node %u, redirecting to %s", id, owner.id,
+                        owner.url.c_str());
+            connection->sendClose(STATUS_REDIRECT, owner.url);
+            return;
+        }
+    }
+
+    // remote auth completes later, limit connections waiting for it
+    if (m_authMaxQueue > 0 && m_authMetrics.running >= m_authMaxQueue) {
+        m_authMetrics.rejected++;
+        WSS_DEBUG_F("Chat::Connect::Error", "Auth queue is full, rejecting user %lu", id);
+        connection->sendClose(STATUS_TRY_AGAIN_LATER, "Server is busy, try again later");
+        return;
+    }
+    if (wss::metrics::isOverMemorySoftLimit()) {
+        wss::metrics::add(wss::metrics::Counter::MemoryShed);
+        WSS_DEBUG_F("Chat::Connect::Error", "Memory soft limit is reached, rejecting user %lu", id);
+        connection->sendClose(STATUS_TRY_AGAIN_LATER, "Server is busy, try again later");
+        return;
+    }
+    if (m_server->isOverLoopLagLimit() || (m_secureServer && m_secureServer->isOverLoopLagLimit())) {
+        wss::metrics::add(wss::metrics::Counter::LagShed);
+        WSS_DEBUG_F("Chat::Connect::Error", "Event loop lag is over limit, rejecting user %lu", id);
+        connection->sendClose(STATUS_TRY_AGAIN_LATER, "Server is busy, try again later");
+        return;
+    }
+
+    m_authMetrics.running++;
+    const auto authStart = std::chrono::steady_clock::now();
+    m_auth->validateAuthAsync(request, [this, id, connection, authStart](bool authorized) {
+      wss::metrics::observe(wss::metrics::Histogram::AuthLatency, std::chrono::steady_clock::now() - authStart);
+      // result could come from http client thread
+      connection->post([this, id, connection, authorized] {
+        onAuthorized(id, connection, authorized);
+      });
+    });
+}
+void wss::ChatServer::onAuthorized(wss::user_id_t id, const WsConnectionPtr &connection, bool authorized) {
+    m_authMetrics.running--;
+    m_authMetrics.total++;
+
+    if (!authorized) {
+        connection->sendClose(STATUS_UNAUTHORIZED, "Unauthorized");
+        return;
+    }
+
+    m_connectionStorage->add(id, connection);
+    if (m_ackWindow) {
+        m_ackWindow->open(connection->getUniqueId());
+    }
+    wss::capture::connected(id);
+
+    getStat(id)->addConnection();
+    m_statistics->addConnection();
+
+    WSS_DEBUG_F("Chat::Connect", "User %lu connected (%s:%d) on thread %lu",
+                  id,
+                  connection->remoteEndpointAddress().c_str(),
+                  connection->remoteEndpointPort(),
+                  getThreadName()
+    );
+
+    redeliverMessagesTo(id);
+}
+void wss::ChatServer::onDisconnected(WsConnectionPtr connection, int status, const std::string &reason) {
+    wss::metrics::add(wss::metrics::Counter::ConnectionsClosed);
+    m_topics->unsubscribeAll(connection);
+    if (m_ackWindow) {
+        // written, but not acknowledged messages could be lost in socket buffers
+        std::vector<MessagePayloadPtr> unacked;
+        m_ackWindow->release(connection->getUniqueId(), unacked);
+        const user_id_t uid = connection->getId();
+        for (const auto &payload: unacked) {
+            handleUndeliverable(&uid, 1, payload);
+        }
+        m_ackWindow->addRequeued(0, unacked.size());
+    }
+    if (!m_connectionStorage->exists(connection->getId())) {
+        return;
+    }
+    wss::capture::disconnected(connection->getId());
+
+    WSS_DEBUG_F("Chat::Disconnect", "User %lu (%lu) has disconnected by reason: %s[%d]",
+                  connection->getId(),
+                  connection->getUniqueId(),
+                  reason.c_str(),
+                  status
+    );
+
+    getStat(connection->getId())->addDisconnection();
+    m_connectionStorage->remove(connection);
+    if (!m_connectionStorage->exists(connection->getId())) {
+        m_rateLimiter->remove(connection->getId());
+    }
+}
+
+
+void wss::ChatServer::redeliverMessagesTo(const wss::MessagePayload &payload) {
+    for (user_id_t id: payload.getRecipients()) {
+        redeliverMessagesTo(id);
+    }
+}
+bool wss::ChatServer::hasUndeliveredMessages(user_id_t recipientId) {
+    return m_undelivered->has(recipientId);
+}
+
+void wss::ChatServer::enqueueUndeliveredMessage(const user_id_t *recipients,
+                                                std::size_t count,
+                                                const wss::MessagePayloadPtr &payload) {
+    m_undelivered->push(recipients, count, payload, getUndeliveredExpiry(*payload));
+}
+uint64_t wss::ChatServer::getUndeliveredExpiry(const wss::MessagePayload &payload) const {
+    const uint32_t ttl = payload.getTtl() != 0 ? payload.getTtl() : m_undeliveredTtlSeconds;
+    return ttl == 0 ? 0 : UndeliveredStore::now() + static_cast<uint64_t>(ttl) * 1000;
+}
+void wss::ChatServer::redeliverMessagesTo(user_id_t recipientId) {
+    if (not wss::Settings::get().chat.enableUndeliveredQueue) {
+        return;
+    }
+
+    // connect handler must not be blocked by big backlog or by slow store
+    m_throttleService.post([this, recipientId] {
+      if (!hasUndeliveredMessages(recipientId)) {
+          return;
+      }
+      if (m_redelivering.insert(recipientId).second) {
+          redeliverBatch(recipientId);
+      }
+    });
+}
+void wss::ChatServer::redeliverBatch(user_id_t recipientId) {
+    wss::ConnectionStorage::Recipients resolved;
+    m_connectionStorage->resolve(&recipientId, 1, resolved);
+    if (resolved.online.empty()) {
+        // rest of messages are waiting for next connect
+        m_redelivering.erase(recipientId);
+        return;
+    }
+
+    const bool busy = std::any_of(resolved.online.begin(), resolved.online.end(),
+                                  [this](const wss::ConnectionStorage::Recipients::Item &item) {
+                                    return item.connection->getSendQueueFrames() >= m_redeliveryBatchSize;
+                                  });
+    if (busy) {
+        auto timer = std::make_shared<boost::asio::steady_timer>(m_throttleService, std::chrono::milliseconds(10));
+        timer->async_wait([this, timer, recipientId](const boost::system::error_code &ec) {
+          if (!ec) {
+              redeliverBatch(recipientId);
+          }
+        });
+        return;
+    }
+
+    std::size_t limit = m_redeliveryBatchSize;
+    if (m_ackWindow) {
+        for (const auto &item: resolved.online) {
+            limit = std::min(limit, m_ackWindow->available(item.connectionId));
+        }
+        if (limit == 0) {
+            // resumed by ack
+            for (const auto &item: resolved.online) {
+                m_ackWindow->defer(item.connectionId);
+            }
+            m_redelivering.erase(recipientId);
+            return;
+        }
+    }
+
+    std::vector<MessagePayloadPtr> messages;
+    messages.reserve(limit);
+    m_undelivered->take(recipientId, limit, messages);
+    WSS_DEBUG_F("Chat::Undelivered", "Redeliver %lu message(s) to user %lu", messages.size(), recipientId);
+    for (const auto &payload: messages) {
+        // body is shared with other recipients, so message goes only to this one connections
+        // history backfill must not delay live messages
+        const SendPriority priority = getSendPriority(*payload);
+        wss::EncodedFrames frames(*payload, priority == SendPriority::High ? priority : SendPriority::Bulk);
+        const std::shared_ptr<DeliveryTracker> tracker = createTracker(payload);
+        sendToOnline(resolved.online, payload, frames, tracker);
+        completeDelivery(tracker, false);
+    }
+
+    if (messages.size() < limit || !hasUndeliveredMessages(recipientId)) {
+        m_redelivering.erase(recipientId);
+        return;
+    }
+    m_throttleService.post([this, recipientId] {
+      redeliverBatch(recipientId);
+    });
+}
+void wss::ChatServer::expireUndeliveredMessages() {
+    const std::size_t expired = m_undelivered->expire();
+    if (expired > 0) {
+        WSS_DEBUG_F("Chat::Undelivered", "Expired %lu undelivered message(s)", expired);
+    }
+
+    auto timer = std::make_shared<boost::asio::steady_timer>(m_throttleService, std::chrono::seconds(1));
+    timer->async_wait([this, timer](const boost::system::error_code &ec) {
+      if (!ec) {
+          expireUndeliveredMessages();
+      }
+    });
+}
+
+void wss::ChatServer::checkOverload() {
+    wss::OverloadController::Sample sample;
+    for (int64_t lag: getEventLoopMetrics().lagMicros) {
+        sample.lagMicros = std::max(sample.lagMicros, lag);
+    }
+    sample.memoryBytes = static_cast<uint64_t>(std::max<int64_t>(0, wss::metrics::getMemoryTotal()));
+    // gauges are shared by both listeners
+    sample.sendQueueBytes = getSendQueueMetrics().bytes.load(std::memory_order_relaxed);
+
+    const wss::OverloadLevel previous = m_overload->getLevel();
+    const wss::OverloadLevel level = m_overload->update(sample);
+    if (level != previous) {
+        WSS_LOG_F(wss::logging::LevelWarning, "Overload", "Level %d -> %d, pressure %.2f",
+                  static_cast<int>(previous), static_cast<int>(level), m_overload->getPressure());
+    }
+
+    auto timer = std::make_shared<boost::asio::steady_timer>(m_throttleService,
+                                                             std::chrono::milliseconds(m_overloadCheckMillis));
+    timer->async_wait([this, timer](const boost::system::error_code &ec) {
+      if (!ec) {
+          checkOverload();
+      }
+    });
+}
+
+void wss::ChatServer::expireAttachments() {
+    const std::size_t expired = m_attachments->expire();
+    if (expired > 0) {
+        WSS_DEBUG_F("Chat::Attachment", "Removed %lu expired attachment(s)", expired);
+    }
+
+    auto timer = std::make_shared<boost::asio::steady_timer>(m_throttleService, std::chrono::seconds(60));
+    timer->async_wait([this, timer](const boost::system::error_code &ec) {
+      if (!ec) {
+          expireAttachments();
+      }
+    });
+}
+
+void wss::ChatServer::expireStatistics() {
+    const std::size_t expired = m_statistics->expire(m_statisticsOfflineSeconds, m_statisticsMaxUsers);
+    if (expired > 0) {
+        wss::metrics::add(wss::metrics::Counter::StatisticsExpired, expired);
+        WSS_DEBUG_F("Chat::Statistics", "Removed %lu offline user(s)", expired);
+    }
+
+    auto timer = std::make_shared<boost::asio::steady_timer>(m_throttleService, std::chrono::seconds(60));
+    timer->async_wait([this, timer](const boost::system::error_code &ec) {
+      if (!ec) {
+          expireStatistics();
+      }
+    });
+}
+
+void wss::ChatServer::deliverScheduled() {
+    // message due within current tick, but a bit later than now, goes back to scheduler till next tick
+    m_scheduler->advance(UndeliveredStore::now(), [this](const wss::MessagePayloadPtr &payload) {
+      send(*payload);
+    });
+
+    auto timer = std::make_shared<boost::asio::steady_timer>(
+        m_throttleService, std::chrono::milliseconds(m_scheduler->getOptions().tickMillis));
+    timer->async_wait([this, timer](const boost::system::error_code &ec) {
+      if (!ec) {
+          deliverScheduled();
+      }
+    });
+}
+
+wss::ChatServer::SendPriority wss::ChatServer::getSendPriority(const wss::MessagePayload &payload) const {
+    const auto it = m_typePriorities.find(payload.getType());
+    if (it == m_typePriorities.end()) {
+        return SendPriority::Normal;
+    }
+    return it->second;
+}
+void wss::ChatServer::send(const wss::MessagePayload &payload) {
+    send(payload, getSendPriority(payload));
+}
+void wss::ChatServer::send(const wss::MessagePayload &payload,
+                           std::chrono::milliseconds wait,
+                           DeliveryReportHandler &&handler) {
+    const ReportCollectorPtr report = std::make_shared<ReportCollector>(std::move(handler));
+    report->timer = std::make_shared<boost::asio::steady_timer>(m_throttleService, wait);
+    report->timer->async_wait([this, report](const boost::system::error_code &ec) {
+      if (!ec) {
+          finishReport(report);
+      }
+    });
+    send(payload, getSendPriority(payload), report);
+    if (!report->deferred && !report->tracked) {
+        // set by the same thread only, before any write is started
+        finishReport(report);
+    }
+}
+void wss::ChatServer::send(const wss::MessagePayload &payload, SendPriority priority) {
+    send(payload, priority, nullptr);
+}
+void wss::ChatServer::send(const wss::MessagePayload &payload,
+                           SendPriority priority,
+                           const ReportCollectorPtr &report) {
+    if (m_scheduler && payload.getDeliverAt() > UndeliveredStore::now()) {
+        // overload, attachments and routing are applied when message is due
+        if (!m_scheduler->schedule(std::make_shared<const wss::MessagePayload>(payload))) {
+            WSS_LOG_F(wss::logging::LevelWarning, "Chat::Scheduler",
+                      "Message %s is dropped: scheduler is full or delivery time is too far",
+                      payload.getId().str().c_str());
+        }
+        return;
+    }
+    if (priority == SendPriority::Bulk && m_overload && m_overload->isAtLeast(wss::OverloadLevel::ShedBulk)) {
+        wss::metrics::add(wss::metrics::Counter::OverloadShedMessages);
+        return;
+    }
+    if (m_attachments && m_attachments->accepts(payload)) {
+        if (report) {
+            report->deferred = true;
+        }
+        // the only copy of large body: queues, undelivered store, history and events get reference message.
+        // disk writes must not block io threads
+        auto reference = std::make_shared<wss::MessagePayload>(payload);
+        m_throttleService.post([this, reference, priority, report] {
+          if (!m_attachments->offload(*reference)) {
+              WSS_LOG_F(wss::logging::LevelWarning, "Chat::Attachment",
+                        "Unable to spool data of message %s, sent as is", reference->getId().str().c_str());
+          }
+          route(*reference, priority, report);
+          if (report && !report->tracked) {
+              finishReport(report);
+          }
+        });
+        return;
+    }
+    route(payload, priority, report);
+}
+void wss::ChatServer::route(const wss::MessagePayload &payload,
+                            SendPriority priority,
+                            const ReportCollectorPtr &report) {
+    if (m_ephemeralTypes[payload.getTypeId()] && !payload.isForBot() && !payload.isForTopic()) {
+        sendEphemeral(payload, priority);
+        return;
+    }
+    // if recipient is a BOT, than we don't need to find conneciton, just trigger event notifier ilsteners
+    const auto routeStart = std::chrono::steady_clock::now();
+    // the only copy: listeners and completion callbacks share it
+    const wss::MessagePayloadPtr shared = std::make_shared<const wss::MessagePayload>(payload);
+    if (payload.isForBot()) {
+        callOnMessageListeners(shared);
+        WSS_DEBUG("Chat::Send", "Sending message to bot");
+        if (payload.getTrace().sampled) {
+            traceRoute(payload, routeStart);
+        }
+        return;
+    }
+
+    callOnMessageListeners(shared);
+
+    // payload is encoded once per codec for all recipients
+    wss::EncodedFrames frames(payload, priority);
+    if (payload.isForTopic()) {
+        publish(shared, frames);
+        if (m_cluster) {
+            m_cluster->publish(shared);
+        }
+        if (m_bridge) {
+            m_bridge->publish(shared);
+        }
+        wss::metrics::observe(wss::metrics::Histogram::MessageRoute, std::chrono::steady_clock::now() - routeStart);
+        if (payload.getTrace().sampled) {
+            traceRoute(payload, routeStart);
+        }
+        return;
+    }
+
+    // holds one pending delivery, until all recipients are iterated
+    const std::shared_ptr<DeliveryTracker> tracker = createTracker(shared, report);
+    if (payload.isForRoom()) {
+        // members snapshot stays valid while room is changing
+        const wss::RoomStorage::Members members = m_rooms->getMembers(payload.getRoom());
+        appendHistory(members->data(), members->size(), payload);
+        if (report) {
+            trackRecipients(*report, members->data(), members->size(), payload.getSender());
+        }
+        sendToAll(members->data(), members->size(), payload.getSender(), shared, frames, tracker);
+    } else {
+        // zero ids are skipped: just in case, prevent sending bot-only message to nobody
+        const wss::MessagePayload::Recipients &recipients = payload.getRecipients();
+        appendHistory(recipients.data(), recipients.size(), payload);
+        if (report) {
+            trackRecipients(*report, recipients.data(), recipients.size(), 0);
+        }
+        sendToAll(recipients.data(), recipients.size(), 0, shared, frames, tracker);
+    }
+    completeDelivery(tracker, false);
+    wss::metrics::observe(wss::metrics::Histogram::MessageRoute, std::chrono::steady_clock::now() - routeStart);
+    if (payload.getTrace().sampled) {
+        traceRoute(payload, routeStart);
+    }
+}
+
+bool wss::ChatServer::joinRoom(wss::room_id_t room, wss::user_id_t user) {
+    if (room == 0 || user == 0) {
+        return false;
+    }
+    const bool joined = m_rooms->join(room, user);
+    WSS_DEBUG_F("Chat::Room", "User %lu joined room %lu: %d", user, room, joined);
+    if (joined && m_cluster) {
+        m_cluster->notifyRoom(room, user, true);
+    }
+    return joined;
+}
+bool wss::ChatServer::leaveRoom(wss::room_id_t room, wss::user_id_t user) {
+    const bool left = m_rooms->leave(room, user);
+    WSS_DEBUG_F("Chat::Room", "User %lu left room %lu: %d", user, room, left);
+    if (left && m_cluster) {
+        m_cluster->notifyRoom(room, user, false);
+    }
+    return left;
+}
+wss::RoomStorage::Members wss::ChatServer::getRoomMembers(wss::room_id_t room) const {
+    return m_rooms->getMembers(room);
+}
+bool wss::ChatServer::subscribe(const std::string &pattern, const WsConnectionPtr &connection) {
+    if (connection->getId() == 0) {
+        // not authorized yet
+        return false;
+    }
+    const bool subscribed = m_topics->subscribe(pattern, connection);
+    WSS_DEBUG_F("Chat::Topic", "User %lu subscribed to %s: %d", connection->getId(), pattern.c_str(), subscribed);
+    return subscribed;
+}
+bool wss::ChatServer::unsubscribe(const std::string &pattern, const WsConnectionPtr &connection) {
+    const bool unsubscribed = m_topics->unsubscribe(pattern, connection);
+    WSS_DEBUG_F("Chat::Topic", "User %lu unsubscribed from %s: %d",
+                  connection->getId(), pattern.c_str(), unsubscribed);
+    return unsubscribed;
+}
+void wss::ChatServer::publish(const wss::MessagePayloadPtr &payload, wss::EncodedFrames &frames) {
+    // single trie walk, subscribers may be connections of any user
+    const std::vector<wss::WsConnectionPtr> subscribers = m_topics->getSubscribers(payload->getTopic());
+    if (!payload->isTypeOfSentStatus()) {
+        getStat(payload->getSender())->addSendMessage();
+    }
+
+    for (const auto &conn: subscribers) {
+        const user_id_t uid = conn->getId();
+        conn->send(frames.get(getCodec(conn)), [this, uid](const wss::server::websocket::ErrorCode &errorCode,
+                                                          std::size_t ts) {
+          if (!errorCode) {
+              getStat(uid)->addReceivedMessage().addBytesTransferred(ts);
+              m_statistics->addDelivered(ts);
+              wss::topk::add(wss::topk::Dimension::Recipients, uid);
+          }
+        }, frames.getPriority(), payload->getReceivedAt());
+    }
+}
+
+void wss::ChatServer::sendTo(user_id_t recipient, const wss::MessagePayload &payload) {
+    wss::EncodedFrames frames(payload, getSendPriority(payload));
+    const wss::MessagePayloadPtr shared = std::make_shared<const wss::MessagePayload>(payload);
+    const std::shared_ptr<DeliveryTracker> tracker = createTracker(shared);
+    sendTo(recipient, shared, frames, tracker);
+    completeDelivery(tracker, false);
+}
+
+void wss::ChatServer::sendTo(user_id_t recipient,
+                             const wss::MessagePayloadPtr &payload,
+                             wss::EncodedFrames &frames,
+                             const std::shared_ptr<DeliveryTracker> &tracker) {
+    sendToAll(&recipient, 1, 0, payload, frames, tracker);
+}
+
+void wss::ChatServer::sendToAll(const user_id_t *recipients,
+                                std::size_t count,
+                                user_id_t exclude,
+                                const wss::MessagePayloadPtr &payload,
+                                wss::EncodedFrames &frames,
+                                const std::shared_ptr<DeliveryTracker> &tracker) {
+    wss::ConnectionStorage::Recipients local;
+    wss::RecipientCache::RecipientsPtr cached;
+    if (m_recipientCache && count >= m_recipientCache->getOptions().minRecipients) {
+        cached = m_recipientCache->resolve(*m_connectionStorage, recipients, count, exclude);
+    } else {
+        m_connectionStorage->resolve(recipients, count, local, exclude);
+    }
+    // cached result is shared by concurrent sends: read only
+    const wss::ConnectionStorage::Recipients &resolved = cached ? *cached : local;
+
+    std::vector<user_id_t> offline;
+    const std::vector<user_id_t> *missing = &resolved.missing;
+    if (m_cluster) {
+        // every recipient is looked up: user can be connected here and to other nodes by different devices
+        std::vector<user_id_t> forwarded;
+        m_cluster->route(recipients, count, exclude, payload, forwarded);
+        if (!forwarded.empty() && !resolved.missing.empty()) {
+            for (user_id_t uid: resolved.missing) {
+                if (!std::binary_search(forwarded.begin(), forwarded.end(), uid)) {
+                    offline.push_back(uid);
+                } else {
+                    recordOutcome(tracker, uid, DeliveryOutcome::Forwarded);
+                }
+            }
+            missing = &offline;
+        }
+    } else if (m_bridge && !resolved.missing.empty()) {
+        // recipients, that no node has received, are given back to undeliverable handler by bridge
+        m_bridge->forward(resolved.missing.data(), resolved.missing.size(), payload);
+        for (user_id_t uid: resolved.missing) {
+            recordOutcome(tracker, uid, DeliveryOutcome::Forwarded);
+        }
+        missing = &offline;
+    }
+
+    if (!missing->empty()) {
+        // one stored body for all offline recipients
+        handleUndeliverable(missing->data(), missing->size(), payload);
+        const std::size_t length = frames.getPayload().toJson().length();
+        const DeliveryOutcome outcome = wss::Settings::get().chat.enableUndeliveredQueue
+                                        ? DeliveryOutcome::Queued : DeliveryOutcome::Dropped;
+        for (user_id_t uid: *missing) {
+            onMessageSent(*payload, uid, length, false);
+            recordOutcome(tracker, uid, outcome);
+        }
+    }
+
+    sendToOnline(resolved.online, payload, frames, tracker);
+}
+
+void wss::ChatServer::sendToOnline(const std::vector<wss::ConnectionStorage::Recipients::Item> &online,
+                                   const wss::MessagePayloadPtr &payload,
+                                   wss::EncodedFrames &frames,
+                                   const std::shared_ptr<DeliveryTracker> &tracker) {
+    // connections of one user are adjacent
+    for (std::size_t i = 0; i < online.size();) {
+        std::size_t end = i + 1;
+        while (end < online.size() && online[end].user == online[i].user) {
+            end++;
+        }
+        sendToUser(&online[i], end - i, payload, frames, tracker);
+        i = end;
+    }
+}
+
+void wss::ChatServer::sendToConnection(const wss::ConnectionStorage::Recipients::Item &item,
+                                       const wss::MessagePayloadPtr &payload,
+                                       wss::EncodedFrames &frames,
+                                       const std::shared_ptr<DeliveryTracker> &tracker) {
+    sendToUser(&item, 1, payload, frames, tracker);
+}
+
+void wss::ChatServer::sendToUser(const wss::ConnectionStorage::Recipients::Item *items,
+                                 std::size_t count,
+                                 const wss::MessagePayloadPtr &payload,
+                                 wss::EncodedFrames &frames,
+                                 const std::shared_ptr<DeliveryTracker> &tracker) {
+    using toolboxpp::Logger;
+
+    const user_id_t uid = items[0].user;
+    const bool acked = m_ackWindow && !payload->isTypeOfSentStatus() && !payload->typeIs(types::ID_PRESENCE)
+        && !payload->typeIs(types::ID_HISTORY);
+
+    // one completion for all devices: statistics and delivery status are per user.
+    // Extra pending is released after all sends are started
+    auto delivery = std::make_shared<UserDelivery>(uid, payload, tracker, count + 1);
+    if (payload->getTrace().sampled) {
+        // write span covers send queue wait and socket write
+        delivery->writeStart = std::chrono::steady_clock::now();
+    }
+    if (tracker) {
+        tracker->pending++;
+    }
+
+    for (std::size_t i = 0; i < count; i++) {
+        const conn_id_t cid = items[i].connectionId;
+        if (acked && m_ackWindow->track(cid, payload) == AckWindow::TrackResult::Full) {
+            delivery->requeued = true;
+            delivery->pending--;
+            continue;
+        }
+        // frame is shared between all connections using same codec
+        const wss::PayloadCodec &codec = getCodec(items[i].connection);
+        const wss::WsFramePtr frame = frames.get(codec);
+
+        WSS_DEBUG("Chat::Send", fmt::format("Sending message [thread={0}] to recipient {1}, connection[{2}]",
+                                            getThreadName(), uid, cid));
+
+        wss::server::websocket::SendCallback callback = [this, delivery, cid, acked]
+            (const wss::server::websocket::ErrorCode &errorCode, std::size_t ts) {
+          const MessagePayloadPtr &payload = delivery->payload;
+          const user_id_t uid = delivery->user;
+          if (payload->getTrace().sampled) {
+              wss::tracing::record("chat.write", wss::tracing::child(payload->getTrace()),
+                                   delivery->writeStart, std::chrono::steady_clock::now(), {
+                                       {"user.id", std::to_string(uid)},
+                                       {"connection.id", std::to_string(cid)},
+                                       {"error", errorCode ? errorCode.message() : std::string()}
+                                   }, static_cast<bool>(errorCode));
+          }
+          if (errorCode && acked) {
+              // queued again on completion, not on disconnect
+              m_ackWindow->forget(cid, payload->getId());
+          }
+          if (errorCode) {
+              // See http://www.boost.org/doc/libs/1_55_0/doc/html/boost_asio/reference.html, Error Codes for error code meanings
+              WSS_DEBUG("Chat::Send::Error", fmt::format("Unable to send message to {0}. Cause: {1} error: {2}",
+                                                         uid, errorCode.category().name(), errorCode.message()));
+
+              if (errorCode.value() == boost::system::errc::broken_pipe) {
+                  WSS_DEBUG("Chat::Send::Error", fmt::format("Disconnecting Broken connection {0} ({1})", uid, cid));
+                  m_connectionStorage->remove(uid, cid);
+              }
+              // dropped by slow consumer policy: not stored
+              if (errorCode != wss::server::websocket::frameDroppedError()) {
+                  delivery->failed = true;
+              }
+          } else {
+              wss::metrics::add(wss::metrics::Counter::FramesOut);
+              wss::metrics::add(wss::metrics::Counter::BytesOut, ts);
+              std::size_t none = 0;
+              delivery->bytes.compare_exchange_strong(none, ts);
+              delivery->delivered = true;
+          }
+          if (--delivery->pending == 0) {
+              completeUserDelivery(*delivery);
+          }
+        };
+
+        // connection->send is an asynchronous function
+        if (m_outboundBatcher && codec.isBatching()) {
+            m_outboundBatcher->send(items[i].connection, codec, frame, std::move(callback), frames.getPriority(),
+                                    payload->getReceivedAt(), getCoalesceKey(*payload));
+        } else {
+            items[i].connection->send(frame, callback, frames.getPriority(), payload->getReceivedAt(),
+                                      getCoalesceKey(*payload));
+        }
+    }
+
+    if (delivery->requeued) {
+        // sent again when client acknowledges half of window, stored once for all devices of user
+        handleUndeliverable(&uid, 1, payload);
+        m_ackWindow->addRequeued(1, 0);
+    }
+    if (--delivery->pending == 0) {
+        completeUserDelivery(*delivery);
+    }
+}
+
+void wss::ChatServer::completeUserDelivery(const UserDelivery &delivery) {
+    if (delivery.tracker && delivery.tracker->report) {
+        DeliveryOutcome outcome = DeliveryOutcome::Dropped;
+        if (delivery.delivered) {
+            outcome = DeliveryOutcome::Delivered;
+        } else if (delivery.requeued || (delivery.failed && wss::Settings::get().chat.enableUndeliveredQueue)) {
+            outcome = DeliveryOutcome::Queued;
+        }
+        // before completion: last one reports
+        recordOutcome(delivery.tracker, delivery.user, outcome);
+    }
+    completeDelivery(delivery.tracker, delivery.delivered);
+    if (delivery.delivered) {
+        // undelivered store is per user: stored copy would be sent again to devices, that have received it
+        onMessageSent(*delivery.payload, delivery.user, delivery.bytes, true);
+    } else if (delivery.failed && !delivery.requeued) {
+        handleUndeliverable(&delivery.user, 1, delivery.payload);
+    }
+}
+
+void wss::ChatServer::sendEphemeral(const wss::MessagePayload &payload, SendPriority priority) {
+    const user_id_t *recipients = payload.getRecipients().data();
+    std::size_t count = payload.getRecipients().size();
+    user_id_t exclude = 0;
+    wss::RoomStorage::Members members;
+    if (payload.isForRoom()) {
+        members = m_rooms->getMembers(payload.getRoom());
+        recipients = members->data();
+        count = members->size();
+        exclude = payload.getSender();
+    }
+
+    wss::ConnectionStorage::Recipients resolved;
+    m_connectionStorage->resolve(recipients, count, resolved, exclude);
+    if (m_cluster) {
+        // recipient can be online on other nodes too, payload is dropped there if not
+        std::vector<user_id_t> forwarded;
+        m_cluster->route(recipients, count, exclude, std::make_shared<const wss::MessagePayload>(payload), forwarded);
+    }
+
+    wss::EncodedFrames frames(payload, priority);
+    const wss::server::websocket::CoalesceKey coalesceKey = getCoalesceKey(payload);
+    for (const auto &item: resolved.online) {
+        // failed write is not retried and not reported
+        item.connection->send(frames.get(getCodec(item.connection)), nullptr, frames.getPriority(),
+                              payload.getReceivedAt(), coalesceKey);
+    }
+}
+
+wss::server::websocket::CoalesceKey wss::ChatServer::getCoalesceKey(const wss::MessagePayload &payload) const {
+    // slow connection receives only latest state of each sender, superseded one gets frameDroppedError()
+    wss::server::websocket::CoalesceKey key;
+    if (m_coalescedTypes[payload.getTypeId()]) {
+        key.kind = payload.getTypeId();
+        key.source = payload.getSender();
+        key.scope = payload.getRoom();
+    }
+    return key;
+}
+
+void wss::ChatServer::handleUndeliverable(const wss::user_id_t *uids,
+                                          std::size_t count,
+                                          const wss::MessagePayloadPtr &payload) {
+    if (!wss::Settings::get().chat.enableUndeliveredQueue) {
+        WSS_DEBUG_F("Chat::Send", "%lu user(s) are unavailable, first: %lu. Skipping message.", count, uids[0]);
+        return;
+    }
+    // payload keeps original recipients, store queues it only for unavailable ones
+    enqueueUndeliveredMessage(uids, count, payload);
+    WSS_DEBUG_F("Chat::Send", "%lu user(s) are unavailable, first: %lu. Adding message to queue", count, uids[0]);
+}
+
+std::size_t wss::ChatServer::getThreadName() {
+    // index is resolved once per thread, without locking on every log line
+    static std::atomic_size_t nextIndex(0);
+    static thread_local const std::size_t index = nextIndex++;
+    return index;
+}
+void wss::ChatServer::setMessageSizeLimit(size_t bytes) {
+    m_maxMessageSize = bytes;
+    for (auto *config: getConfigs()) {
+        config->maxMessageSize = bytes;
+    }
+}
+void wss::ChatServer::setUndeliveredStore(std::unique_ptr<wss::UndeliveredStore> store) {
+    m_undelivered = std::move(store);
+}
+void wss::ChatServer::setCluster(std::unique_ptr<wss::ClusterBus> cluster) {
+    m_cluster = std::move(cluster);
+    m_cluster->setMessageHandler(std::bind(&wss::ChatServer::onClusterMessage, this, std::placeholders::_1,
+                                           std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
+    m_cluster->setUsersProvider([this](std::vector<wss::user_id_t> &out) {
+      const uint64_t sequence = m_connectionStorage->getPresenceSequence();
+      m_connectionStorage->getUsers(out);
+      return sequence;
+    });
+    // applied to storage directly: change made on other node is not sent back
+    m_cluster->setRoomHandler([this](wss::room_id_t room, const wss::user_id_t *users, std::size_t count, bool joined) {
+      for (std::size_t i = 0; i < count; i++) {
+          if (joined) {
+              m_rooms->join(room, users[i]);
+          } else {
+              m_rooms->leave(room, users[i]);
+          }
+      }
+    });
+    m_cluster->setRoomsProvider([this](const wss::ClusterBus::RoomVisitor &visitor) {
+      m_rooms->forEach([&visitor](wss::room_id_t room, const wss::RoomStorage::Members &members) {
+        visitor(room, members->data(), members->size());
+      });
+    });
+    // store writes can block: body is applied by throttle thread, not by cluster io thread
+    m_cluster->setHandoffHandler([this](wss::node_id_t from, uint64_t id, const char *data, std::size_t length) {
+      auto body = std::make_shared<std::string>(data, length);
+      m_throttleService.post([this, from, id, body] {
+        // sender keeps taken messages until ack: body is acked only once it's in store
+        if (onHandoff(from, *body)) {
+            m_cluster->ackHandoff(from, id);
+        }
+      });
+    });
+    m_connectionStorage->setPresenceHandler(std::bind(&wss::ChatServer::onPresence, this, std::placeholders::_1));
+}
+const wss::ClusterBus *wss::ChatServer::getCluster() const {
+    return m_cluster.get();
+}
+void wss::ChatServer::setClusterBridge(std::unique_ptr<wss::ClusterBridge> bridge) {
+    m_bridge = std::move(bridge);
+    m_bridge->setMessageHandler(std::bind(&wss::ChatServer::onClusterMessage, this, std::placeholders::_1,
+                                          std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
+    m_bridge->setUndeliverableHandler([this](wss::user_id_t recipient, const wss::MessagePayloadPtr &payload) {
+      handleUndeliverable(&recipient, 1, payload);
+      onMessageSent(*payload, recipient, payload->toJson().length(), false);
+    });
+    m_bridge->setOnlineCheck([this](wss::user_id_t user) {
+      return m_connectionStorage->exists(user);
+    });
+    m_connectionStorage->setPresenceHandler(std::bind(&wss::ChatServer::onPresence, this, std::placeholders::_1));
+}
+const wss::ClusterBridge *wss::ChatServer::getClusterBridge() const {
+    return m_bridge.get();
+}
+void wss::ChatServer::setShardRing(std::unique_ptr<wss::HashRing> ring, wss::node_id_t node) {
+    if (!ring->contains(node)) {
+        throw std::invalid_argument("Node " + std::to_string(node) + " is not in shard ring");
+    }
+    m_ring = std::move(ring);
+    m_ringNode = node;
+}
+void wss::ChatServer::onClusterMessage(wss::node_id_t from,
+                                       const user_id_t *recipients,
+                                       std::size_t count,
+                                       const wss::MessagePayloadPtr &payload) {
+    wss::EncodedFrames frames(*payload, getSendPriority(*payload));
+    if (recipients == nullptr) {
+        publish(payload, frames);
+        return;
+    }
+
+    // taken before lookup: connection of missing recipient made after it has greater sequence
+    const uint64_t sequence = m_connectionStorage->getPresenceSequence();
+    wss::ConnectionStorage::Recipients resolved;
+    m_connectionStorage->resolve(recipients, count, resolved);
+    if (!resolved.missing.empty()) {
+        if (m_cluster) {
+            m_cluster->notifyMissing(from, resolved.missing.data(), resolved.missing.size(), sequence);
+        }
+        handleUndeliverable(resolved.missing.data(), resolved.missing.size(), payload);
+        const std::size_t length = payload->toJson().length();
+        for (user_id_t uid: resolved.missing) {
+            onMessageSent(*payload, uid, length, false);
+        }
+    }
+
+    // delivery status of this node recipients goes back to sender through cluster
+    const std::shared_ptr<DeliveryTracker> tracker = createTracker(payload);
+    sendToOnline(resolved.online, payload, frames, tracker);
+    completeDelivery(tracker, false);
+}
+void wss::ChatServer::setUndeliveredTtl(uint32_t seconds) {
+    m_undeliveredTtlSeconds = seconds;
+}
+void wss::ChatServer::setHistoryLog(std::unique_ptr<wss::HistoryLog> log) {
+    m_history = std::move(log);
+}
+void wss::ChatServer::setLocalIngest(std::unique_ptr<wss::LocalIngest> ingest) {
+    m_localIngest = std::move(ingest);
+}
+const wss::LocalIngest *wss::ChatServer::getLocalIngest() const {
+    return m_localIngest.get();
+}
+void wss::ChatServer::setIngestServer(std::unique_ptr<wss::IngestServer> ingest) {
+    m_ingestServer = std::move(ingest);
+}
+const wss::IngestServer *wss::ChatServer::getIngestServer() const {
+    return m_ingestServer.get();
+}
+void wss::ChatServer::setHttp2Gateway(std::unique_ptr<wss::Http2Gateway> gateway) {
+    if (gateway) {
+        // bridged streams carry client address in PROXY header, connections are limited by the same admission
+        m_server->getConfig().localProxyProtocol = true;
+        gateway->setAdmission(m_server->getAdmission().shared_from_this());
+    }
+    m_http2Gateway = std::move(gateway);
+}
+const wss::Http2Gateway *wss::ChatServer::getHttp2Gateway() const {
+    return m_http2Gateway.get();
+}
+void wss::ChatServer::setHistoryPageSize(std::size_t messages) {
+    if (messages == 0) {
+        throw std::invalid_argument("History page size must be at least 1");
+    }
+    m_historyPageSize = messages;
+}
+void wss::ChatServer::setSnapshot(const std::string &path, uint32_t intervalSeconds) {
+    m_snapshotPath = path;
+    m_snapshotIntervalSeconds = intervalSeconds;
+}
+void wss::ChatServer::setAckWindow(std::size_t windowSize) {
+    m_ackWindow = windowSize == 0 ? nullptr : std::make_unique<wss::AckWindow>(windowSize);
+}
+const wss::AckMetrics *wss::ChatServer::getAckMetrics() const {
+    return m_ackWindow ? &m_ackWindow->getMetrics() : nullptr;
+}
+void wss::ChatServer::setRedeliveryBatchSize(std::size_t messages) {
+    if (messages == 0) {
+        throw std::invalid_argument("Redelivery batch size must be at least 1");
+    }
+    m_redeliveryBatchSize = messages;
+}
+void wss::ChatServer::setMessageFragmentsLimit(size_t fragments) {
+    m_server->getConfig().maxMessageFragments = fragments;
+}
+void wss::ChatServer::setAuth(const nlohmann::json &config) {
+    m_auth = wss::auth::registry::createFromConfig(config);
+}
+
+void wss::ChatServer::setEnabledMessageDeliveryStatus(bool enabled) {
+    m_enableMessageDeliveryStatus = enabled;
+}
+void wss::ChatServer::setDeliveryStatusCoalescing(const std::string &mode, long flushMillis, std::size_t flushItems) {
+    if (mode == "delivery") {
+        m_deliveryStatusMode = DeliveryStatusMode::Delivery;
+    } else if (mode == "message") {
+        m_deliveryStatusMode = DeliveryStatusMode::Message;
+    } else if (mode == "batch") {
+        m_deliveryStatusMode = DeliveryStatusMode::Batch;
+    } else {
+        throw std::runtime_error("Unknown delivery status mode: " + mode);
+    }
+    m_deliveryStatusFlushMillis = flushMillis;
+    m_deliveryStatusFlushItems = flushItems;
+}
+void wss::ChatServer::setMaxBatchSize(std::size_t maxItems) {
+    m_maxBatchSize = maxItems;
+}
+void wss::ChatServer::setEnabledClientTopicPublish(bool enabled) {
+    m_enableClientTopicPublish = enabled;
+}
+
+void wss::ChatServer::addMessageListener(wss::ChatServer::OnMessageSentListener callback) {
+    m_messageListeners.push_back(callback);
+}
+void wss::ChatServer::addStopListener(wss::ChatServer::OnServerStopListener callback) {
+    m_stopListeners.push_back(callback);
+}
+wss::StatisticsStorage::StatisticsPtr wss::ChatServer::getStat(wss::user_id_t id) {
+    return m_statistics->get(id);
+}
+
+std::vector<wss::StatisticsStorage::StatisticsPtr> wss::ChatServer::getStats() const {
+    return m_statistics->snapshot();
+}
+std::vector<wss::StatisticsStorage::StatisticsPtr> wss::ChatServer::getStatsPage(wss::user_id_t after,
+                                                                                 std::size_t limit,
+                                                                                 const wss::StatisticsStorage::Filter &filter,
+                                                                                 bool &more) const {
+    return m_statistics->page(after, limit, filter, more);
+}
+wss::StatisticsStorage::StatisticsPtr wss::ChatServer::findStat(wss::user_id_t id) const {
+    return m_statistics->find(id);
+}
+wss::StatisticsStorage::Rates wss::ChatServer::getRates() const {
+    return m_statistics->getRates();
+}
+std::vector<bool> wss::ChatServer::checkOnline(const std::vector<user_id_t> &ids) const {
+    std::vector<bool> online;
+    m_connectionStorage->exists(ids.data(), ids.size(), online);
+    if (m_cluster) {
+        for (std::size_t i = 0; i < ids.size(); i++) {
+            online[i] = online[i] || m_cluster->getDirectory().exists(ids[i]);
+        }
+    }
+    return online;
+}
+void wss::ChatServer::callOnMessageListeners(const wss::MessagePayloadPtr &payload) {
     for (auto &listener: m_messageListeners) {
-        listener(std::move(payload));
+        listener(payload);
+    }
+}
+
+bool wss::ChatServer::saveSnapshot() {
+    if (m_snapshotPath.empty()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> locker(m_snapshotMutex);
+    const auto started = std::chrono::steady_clock::now();
+    std::size_t undelivered = 0;
+    try {
+        wss::SnapshotWriter writer(m_snapshotPath);
+
+        writer.beginSection(SNAPSHOT_STATISTICS);
+        for (const auto &stat: m_statistics->snapshot()) {
+            const wss::Statistics::State state = stat->getState();
+            writer.write<uint64_t>(state.id);
+            writer.write<int64_t>(state.lastConnectionTime);
+            writer.write<int64_t>(state.lastDisconnectionTime);
+            writer.write<uint64_t>(state.connectedTimes);
+            writer.write<uint64_t>(state.disconnectedTimes);
+            writer.write<uint64_t>(state.bytesTransferred);
+            writer.write<uint64_t>(state.sentMessages);
+            writer.write<uint64_t>(state.receivedMessages);
+            writer.write<int64_t>(state.lastMessageTime);
+        }
+        writer.endSection();
+
+        writer.beginSection(SNAPSHOT_ROOMS);
+        m_rooms->forEach([&writer](wss::room_id_t room, const wss::RoomStorage::Members &members) {
+          writer.write<uint64_t>(room);
+          writer.write<uint32_t>(static_cast<uint32_t>(members->size()));
+          for (wss::user_id_t member: *members) {
+              writer.write<uint64_t>(member);
+          }
+        });
+        writer.endSection();
+
+        writer.beginSection(SNAPSHOT_PRESENCE);
+        std::vector<wss::PresenceFeed::PresenceEvent> events;
+        uint64_t last = 0;
+        if (m_presence) {
+            m_presence->since(0, events, last);
+        }
+        writer.write<uint64_t>(m_connectionStorage->getPresenceSequence());
+        writer.write<uint64_t>(last);
+        writer.write<uint32_t>(static_cast<uint32_t>(events.size()));
+        for (const auto &event: events) {
+            writer.write<uint64_t>(event.user);
+            writer.write<uint8_t>(event.online ? 1 : 0);
+            writer.write<uint64_t>(event.sequence);
+        }
+        writer.endSection();
+
+        // persistent stores keep messages themselves
+        writer.beginSection(SNAPSHOT_UNDELIVERED);
+        m_undelivered->snapshot([&writer, &undelivered](const std::vector<user_id_t> &recipients,
+                                                        const MessagePayloadPtr &payload,
+                                                        uint64_t expiresAt) {
+          writer.write<uint64_t>(expiresAt);
+          writer.write<uint32_t>(static_cast<uint32_t>(recipients.size()));
+          for (user_id_t recipient: recipients) {
+              writer.write<uint64_t>(recipient);
+          }
+          writer.writeString(payload->toBinary());
+          undelivered += recipients.size();
+        });
+        writer.endSection();
+
+        if (m_scheduler) {
+            writer.beginSection(SNAPSHOT_SCHEDULED);
+            m_scheduler->forEach([&writer](const MessagePayloadPtr &payload) {
+              writer.writeString(payload->toBinary());
+            });
+            writer.endSection();
+        }
+
+        writer.commit();
+    } catch (const std::exception &e) {
+        L_ERR_F("Chat::Snapshot", "Unable to save snapshot: %s", e.what());
+        return false;
+    }
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started);
+    L_INFO_F("Chat::Snapshot", "Saved %lu user(s), %lu room(s), %lu undelivered message(s) to %s in %ld ms",
+             m_statistics->size(), m_rooms->size(), undelivered, m_snapshotPath.c_str(), (long) elapsed.count());
+    return true;
+}
+
+bool wss::ChatServer::restoreSnapshot() {
+    if (m_snapshotPath.empty() || ::access(m_snapshotPath.c_str(), F_OK) != 0) {
+        return false;
+    }
+    wss::SnapshotReader reader(m_snapshotPath);
+    const time_t restoredAt = time(nullptr);
+    const uint64_t restoredAtMillis = UndeliveredStore::now();
+    std::vector<user_id_t> wasOnline;
+    uint64_t presenceSequence = 0;
+    std::size_t undelivered = 0;
+    std::size_t scheduled = 0;
+
+    uint32_t tag;
+    while (reader.nextSection(tag)) {
+        switch (tag) {
+            case SNAPSHOT_STATISTICS:
+                while (!reader.atSectionEnd()) {
+                    wss::Statistics::State state;
+                    state.id = reader.read<uint64_t>();
+                    state.lastConnectionTime = reader.read<int64_t>();
+                    state.lastDisconnectionTime = reader.read<int64_t>();
+                    state.connectedTimes = reader.read<uint64_t>();
+                    state.disconnectedTimes = reader.read<uint64_t>();
+                    state.bytesTransferred = reader.read<uint64_t>();
+                    state.sentMessages = reader.read<uint64_t>();
+                    state.receivedMessages = reader.read<uint64_t>();
+                    state.lastMessageTime = reader.read<int64_t>();
+                    if (state.connectedTimes > state.disconnectedTimes) {
+                        // connections were closed by restart
+                        state.disconnectedTimes = state.connectedTimes;
+                        state.lastDisconnectionTime = restoredAt;
+                        wasOnline.push_back(state.id);
+                    }
+                    getStat(state.id)->setState(state);
+                }
+                break;
+
+            case SNAPSHOT_ROOMS:
+                while (!reader.atSectionEnd()) {
+                    const auto room = reader.read<uint64_t>();
+                    std::vector<wss::user_id_t> members(reader.read<uint32_t>());
+                    for (auto &member: members) {
+                        member = reader.read<uint64_t>();
+                    }
+                    m_rooms->assign(room, std::move(members));
+                }
+                break;
+
+            case SNAPSHOT_PRESENCE: {
+                presenceSequence = reader.read<uint64_t>();
+                const auto last = reader.read<uint64_t>();
+                std::vector<wss::PresenceFeed::PresenceEvent> events(reader.read<uint32_t>());
+                for (auto &event: events) {
+                    event.user = reader.read<uint64_t>();
+                    event.online = reader.read<uint8_t>() != 0;
+                    event.sequence = reader.read<uint64_t>();
+                }
+                if (m_presence) {
+                    m_presence->restore(events, last);
+                }
+            }
+                break;
+
+            case SNAPSHOT_UNDELIVERED:
+                while (!reader.atSectionEnd()) {
+                    const auto expiresAt = reader.read<uint64_t>();
+                    std::vector<user_id_t> recipients(reader.read<uint32_t>());
+                    for (auto &recipient: recipients) {
+                        recipient = reader.read<uint64_t>();
+                    }
+                    const std::string envelope = reader.readString();
+                    if (expiresAt != 0 && expiresAt <= restoredAtMillis) {
+                        continue;
+                    }
+                    MessagePayload payload = MessagePayload::fromStoredBinary(envelope.data(), envelope.size());
+                    if (payload.isValid()) {
+                        m_undelivered->push(recipients.data(), recipients.size(),
+                                            std::make_shared<const MessagePayload>(std::move(payload)), expiresAt);
+                        undelivered += recipients.size();
+                    }
+                }
+                break;
+
+            case SNAPSHOT_SCHEDULED:
+                while (!reader.atSectionEnd()) {
+                    const std::string envelope = reader.readString();
+                    MessagePayload payload = MessagePayload::fromStoredBinary(envelope.data(), envelope.size());
+                    // messages that became due while server was stopped are sent on start
+                    if (payload.isValid() && m_scheduler
+                        && m_scheduler->schedule(std::make_shared<const MessagePayload>(std::move(payload)))) {
+                        scheduled++;
+                    }
+                }
+                break;
+
+            default:
+                L_WARN_F("Chat::Snapshot", "Skipping unknown snapshot section %u", tag);
+                break;
+        }
+    }
+
+    if (m_presence) {
+        for (user_id_t user: wasOnline) {
+            onPresence(wss::ConnectionStorage::PresenceEvent{user, false, ++presenceSequence});
+        }
     }
+    m_connectionStorage->setPresenceSequence(presenceSequence);
+
+    L_INFO_F("Chat::Snapshot",
+             "Restored %lu user(s), %lu room(s), %lu undelivered message(s), %lu scheduled message(s) from %s",
+             m_statistics->size(), m_rooms->size(), undelivered, scheduled, m_snapshotPath.c_str());
+    return true;
 }
@@ -12,7 +12,9 @@
 #include <string>
 #include <iostream>
 #include <unordered_map>
+#include <unordered_set>
 #include <queue>
+#include <chrono>
 #include <memory>
 #include <thread>
 #include <mutex>
@@ -25,13 +27,34 @@
 #include <functional>
 #include <toolboxpp.h>
 #include <boost/thread.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include "json.hpp"
 #include "Message.h"
+#include "PayloadCodec.h"
 #include "../wsserver_core.h"
 #include "../base/StandaloneService.h"
 #include "ConnectionStorage.h"
+#include "RoomStorage.h"
+#include "TopicStorage.h"
+#include "RateLimiter.h"
 #include "../base/auth/Auth.h"
-#include "Statistics.h"
+#include "StatisticsStorage.h"
+#include "PresenceFeed.h"
+#include "UndeliveredStore.h"
+#include "AckWindow.h"
+#include "HistoryLog.h"
+#include "ClusterBus.h"
+#include "ClusterBridge.h"
+#include "HashRing.h"
+#include "Http2Gateway.h"
+#include "IngestServer.h"
+#include "LocalIngest.h"
+#include "../base/Overload.h"
+#include "AttachmentStore.h"
+#include "DeliveryScheduler.h"
+#include "RecipientCache.h"
+#include "OutboundBatcher.h"
 
 namespace wss {
 
@@ -39,13 +62,47 @@ using namespace std;
 using namespace std::placeholders;
 
 using QueryParams = std::unordered_map<std::string, std::string>;
-using MessageQueue = std::queue<MessagePayload>;
 
 namespace cal = boost::gregorian;
 namespace pt = boost::posix_time;
 
+/// \brief Connection authorization counters
+struct AuthMetrics {
+  /// \brief Authorizations running right now (waiting for remote auth response)
+  std::atomic<uint64_t> running{0};
+  /// \brief Completed authorizations
+  std::atomic<uint64_t> total{0};
+  /// \brief Connections closed with "try again later" because auth queue was full
+  std::atomic<uint64_t> rejected{0};
+};
+
+/// \brief Entries of long-living server structures, to find ones that grow without eviction
+struct StateSizes {
+  /// \brief Connections of chat endpoints
+  std::size_t connections = 0;
+  /// \brief Users of connection storage
+  std::size_t users = 0;
+  /// \brief Users statistics, they are kept for disconnected users too
+  std::size_t statistics = 0;
+  std::size_t rooms = 0;
+  std::size_t topicSubscriptions = 0;
+  /// \brief Users with rate limit buckets
+  std::size_t rateLimitedUsers = 0;
+};
+
+/// \brief Users selected by broadcast
+struct BroadcastSegment {
+  /// \brief Also users that were connected during this time: offline ones get message from undelivered queue.
+  /// 0 - connected users only
+  uint32_t connectedWithinSeconds = 0;
+  /// \brief Only members of room, 0 - all users
+  room_id_t room = 0;
+};
+
 class ChatServer : public virtual StandaloneService {
  public:
+    using SendPriority = wss::server::websocket::SendPriority;
+
     const int STATUS_OK = 1000;
     const int STATUS_GOING_AWAY = 1001;
     const int STATUS_PROTOCOL_ERROR = 1002;
@@ -66,6 +123,8 @@ class ChatServer : public virtual StandaloneService {
     const int STATUS_INVALID_QUERY_PARAMS = 4000;
     const int STATUS_INVALID_MESSAGE_PAYLOAD = 4001;
     const int STATUS_INACTIVE_CONNECTION = 4010;
+    /// \brief User belongs to other node of shard ring, close reason is url of that node
+    const int STATUS_REDIRECT = 4030;
     const int STATUS_UNAUTHORIZED = 4050;
 
     /**
@@ -126,9 +185,54 @@ class ChatServer : public virtual StandaloneService {
     const uint8_t FLAG_FRAME_BINARY = FIN1 | OPCODE_BINARY;
     //@formatter:on
 
-    typedef std::function<void(wss::MessagePayload &&)> OnMessageSentListener;
+    /// \brief Payload is shared by all listeners, so each one costs a reference, not a copy
+    typedef std::function<void(const wss::MessagePayloadPtr &)> OnMessageSentListener;
     typedef std::function<void()> OnServerStopListener;
 
+    /// \brief Connections draining settings, see drain()
+    struct DrainOptions {
+      /// \brief Connections taken for closing per step
+      std::size_t batchSize = 1000;
+      /// \brief Delay between steps
+      long intervalMillis = 100;
+      /// \brief Clients are told to reconnect after random delay from [0, reconnectJitterMillis]
+      long reconnectJitterMillis = 5000;
+      /// \brief Max time to wait while connection send queue is written, before closing it
+      long flushTimeoutMillis = 2000;
+    };
+
+    /// \brief Result of message for one recipient, see send() with report handler
+    enum class DeliveryOutcome {
+      /// \brief Not completed in time
+      Pending,
+      /// \brief Written to at least one connection of user
+      Delivered,
+      /// \brief Stored in undelivered queue (user is offline, write failed or ack window is full)
+      Queued,
+      /// \brief Sent to other node of cluster or bridge
+      Forwarded,
+      /// \brief Not written and not stored: undelivered queue is disabled or slow consumer policy dropped it
+      Dropped
+    };
+
+    struct DeliveryReport {
+      /// \brief false - message is not delivered to recipients right away (scheduled, shed by overload, ephemeral,
+      /// topic and bot messages), recipients are empty
+      bool tracked = false;
+      /// \brief Recipients of message (room members without sender), ordered by id
+      std::vector<std::pair<user_id_t, DeliveryOutcome>> recipients;
+    };
+    /// \brief Called once, on thread of last completed write or on timeout
+    typedef std::function<void(DeliveryReport &&)> DeliveryReportHandler;
+
+    /// \brief State handoff of draining node, see setHandoff()
+    struct HandoffOptions {
+      /// \brief Node, that receives users state, 0 - first connected node
+      wss::node_id_t node = 0;
+      /// \brief Max wait for cluster link buffer space, per batch
+      long timeoutMillis = 10000;
+    };
+
  public:
     /// \brief Secure message server ctr (SSL)
     /// \param crtPath
@@ -154,22 +258,354 @@ class ChatServer : public virtual StandaloneService {
     void runService() override;
     void stopService() override;
 
-    /// \brief Send payload. Payload already contains recipients and sender
+    /// \brief Send payload. Payload already contains recipients and sender. Room payload is sent to
+    /// all room members, except sender
     /// \param payload
     void send(const MessagePayload &payload);
 
+    /// \brief Send payload and report outcome of every recipient, once all writes are completed or message is
+    /// queued as undelivered. Nothing waits: handler is called by completion of last write
+    /// \param payload
+    /// \param wait recipients not completed in this time are reported as Pending
+    /// \param handler
+    void send(const MessagePayload &payload, std::chrono::milliseconds wait, DeliveryReportHandler &&handler);
+
+    /// \brief Add user to room. Clients send TYPE_ROOM_JOIN payload with room to join themselves
+    /// \param room
+    /// \param user
+    /// \return false if user is already a member or ids are 0
+    bool joinRoom(wss::room_id_t room, wss::user_id_t user);
+
+    /// \brief Remove user from room. Clients send TYPE_ROOM_LEAVE payload with room to leave
+    /// \param room
+    /// \param user
+    /// \return false if user was not a member
+    bool leaveRoom(wss::room_id_t room, wss::user_id_t user);
+
+    /// \brief Subscribe connection to topic or wildcard pattern ("prices.*"). Clients send TYPE_TOPIC_SUBSCRIBE
+    /// payload with pattern in topic field
+    /// \see wss::TopicStorage
+    /// \param pattern
+    /// \param connection
+    /// \return false if pattern is invalid or already subscribed
+    bool subscribe(const std::string &pattern, const WsConnectionPtr &connection);
+
+    /// \brief Unsubscribe connection from topic or wildcard pattern. Clients send TYPE_TOPIC_UNSUBSCRIBE payload
+    /// \param pattern
+    /// \param connection
+    /// \return false if connection was not subscribed
+    bool unsubscribe(const std::string &pattern, const WsConnectionPtr &connection);
+
+    /// \brief Room members snapshot
+    /// \param room
+    /// \return sorted members ids
+    wss::RoomStorage::Members getRoomMembers(wss::room_id_t room) const;
+
     /// \brief Send payload to specified recipient. NOT used payload recipient
     /// \param payload
     void sendTo(user_id_t recipient, const MessagePayload &payload);
 
+    /// \brief Set wire formats, that clients can request by Sec-WebSocket-Protocol (in order of client preference).
+    /// Clients without subprotocol always use json. Call before runService()
+    /// \param names codec names: wss.json.v1, wss.binary.v1, wss.msgpack.v1, wss.cbor.v1,
+    /// any of them with +batch suffix accepts outbound batches (see setOutboundBatching())
+    /// \throws std::runtime_error if codec is unknown
+    void setCodecs(const std::vector<std::string> &names);
+
+    /// \brief Run TLS listener next to insecure one. Both listeners share connections storage, routing and settings,
+    /// so internal services can connect without TLS cost, while public clients use wss.
+    /// Secure listener runs its own workers (same number as insecure one). Call before runService().
+    /// \param crtPath
+    /// \param privKeyPath
+    /// \param port secure listener port, must differ from insecure one
+    /// \throws std::runtime_error if server is already secure
+    void addSecureListener(const std::string &crtPath, const std::string &privKeyPath, unsigned short port);
+
     /// \brief Max number of workers for incoming messages
     /// \param size Recommended - core numbers
     void setThreadPoolSize(std::size_t size);
 
+    /// \brief Listen with one SO_REUSEPORT socket per worker thread, to spread accepts across cores
+    /// \param enabled
+    void setReusePort(bool enabled);
+
+    /// \brief Run every worker thread on its own event loop, connections are pinned to loop that accepted them
+    /// \param enabled
+    void setIoServicePerThread(bool enabled);
+
+    /// \brief Expect PROXY protocol v2 header of L4 balancer on every connection, including secure listener.
+    /// Remote address of connection is client address from header, connections without header are closed
+    /// \param enabled
+    void setProxyProtocol(bool enabled);
+
+    /// \brief Pre-auth admission of new connections (ws and wss listeners share source counters): sources over
+    /// connection or connect rate limits are closed right after accept, upgrade requests that are not a GET
+    /// or have head larger than maxHandshakeBytes are rejected before headers are parsed. Call before runService()
+    /// \param options per source address limits
+    /// \param maxHandshakeBytes 0 - unlimited
+    /// \param handshakeDeadlineMillis deadline of whole handshake from accept, 0 - only request timeout of each step
+    void setAdmission(const wss::server::websocket::ConnectionAdmission::Options &options,
+                      std::size_t maxHandshakeBytes,
+                      long handshakeDeadlineMillis);
+
+    /// \brief Don't listen: connections are accepted by master process and passed by adoptConnection()
+    /// (see wss::WorkerPool). Must be set before server is started
+    /// \param enabled
+    /// \throws std::logic_error if chat server is secure
+    void setExternalAccept(bool enabled);
+
+    /// \brief Takes socket of connection accepted by master process, see setExternalAccept()
+    /// \param fd owned by server after call
+    void adoptConnection(int fd);
+
+    /// \return true if server is started and accepts connections
+    bool isAccepting() const noexcept;
+
+    /// \brief Transport keepalive: ping connections idle for pingIntervalSeconds, close them after maxMissedPongs.
+    /// Tunable settings (keepalive, message size, send coalescing and queue limits, broadcast rate, auth queue)
+    /// can be changed while server is running
+    /// \param pingIntervalSeconds 0 - disable keepalive
+    /// \param maxMissedPongs
+    void setKeepalive(long pingIntervalSeconds, std::size_t maxMissedPongs);
+
     /// \brief Set maximum websocket message size (for fragmented message - sum of sizes)
     /// \param bytes
     void setMessageSizeLimit(size_t bytes);
 
+    /// \brief Set maximum frames of one fragmented websocket message
+    /// \param fragments 0 - unlimited
+    void setMessageFragmentsLimit(size_t fragments);
+
+    /// \brief Set outgoing frames coalescing: queued frames will be written by single scatter-gather write
+    /// \param maxFrames max frames per write, 1 - disabled
+    /// \param maxBytes max bytes per write, 0 - unlimited
+    void setSendCoalescing(std::size_t maxFrames, std::size_t maxBytes);
+
+    /// \brief Set size of frame, after which connection read buffer is released
+    /// \param bytes 0 - never release
+    void setReadBufferRetainSize(std::size_t bytes);
+
+    /// \brief Set size of single socket read, all frames received in it are handled at once
+    /// \param bytes
+    void setReadChunkSize(std::size_t bytes);
+
+    /// \brief Tcp options of listeners and accepted connections, secure listener gets the same
+    /// \param options
+    void setSocketOptions(const wss::SocketOptions &options);
+
+    /// \brief Set event loop lag probes and admission control: while lag is over limit,
+    /// new connections are closed with STATUS_TRY_AGAIN_LATER
+    /// \param probeMillis probe interval, 0 - disabled
+    /// \param limitMillis 0 - connections are never rejected by lag
+    void setLoopLagMonitor(long probeMillis, long limitMillis);
+
+    /// \brief Enable overload controller: lag of event loops (requires probes), accounted memory and send queues
+    /// are sampled every checkMillis. By its level, upgrades are answered with 503, messages of bulk priority
+    /// types are dropped and rest api answers 429 (see ChatRestServer)
+    /// \param controller
+    /// \param checkMillis
+    void setOverload(std::unique_ptr<wss::OverloadController> controller, long checkMillis);
+    /// \return nullptr if overload control is disabled
+    const wss::OverloadController *getOverload() const;
+
+    /// \brief Enable spooling of large payloads data: it's written to file once, message carries reference
+    /// \param store
+    void setAttachmentStore(std::unique_ptr<wss::AttachmentStore> store);
+    /// \return nullptr if large payloads are sent as is
+    const wss::AttachmentStore *getAttachmentStore() const;
+
+    /// \brief Bound users statistics: users offline longer than ttl and, above max count, longest offline ones
+    /// are removed every minute. Removed users are not written to snapshot and start from zero on next connection
+    /// \param offlineSeconds 0 - not removed by time
+    /// \param maxUsers 0 - not limited
+    void setStatisticsLimits(uint32_t offlineSeconds, std::size_t maxUsers);
+
+    /// \brief Enable scheduled delivery: messages with future "deliverAt" wait in scheduler and are sent when due.
+    /// Without scheduler such messages are sent right away
+    /// \param scheduler
+    void setScheduler(std::unique_ptr<wss::DeliveryScheduler> scheduler);
+    /// \return nullptr if scheduled delivery is disabled
+    const wss::DeliveryScheduler *getScheduler() const;
+
+    /// \brief Enable cache of resolved recipient sets for group sends
+    /// \param cache
+    void setRecipientCache(std::unique_ptr<wss::RecipientCache> cache);
+    /// \return nullptr if cache is disabled
+    const wss::RecipientCache *getRecipientCache() const;
+
+    /// \brief Enable outbound batching for clients that negotiated batching codec (e.g. wss.json.v1+batch,
+    /// see setCodecs()): messages sent to connection within linger window are joined into one frame.
+    /// Call before runService()
+    /// \param options
+    void setOutboundBatching(const wss::OutboundBatcher::Options &options);
+    /// \return nullptr if batching is disabled
+    const wss::OutboundBatcher *getOutboundBatcher() const;
+
+    /// \brief Sends payload to all connections of this server: frame is encoded once per codec and shared,
+    /// connection storage shards are walked one by one on throttle service, writes run on connections io threads.
+    /// Pace is limited by setBroadcastRate(). Recipients of payload are ignored and not sent
+    /// \param payload
+    /// \param segment room segment is sent as room message
+    void broadcast(const wss::MessagePayload &payload, const wss::BroadcastSegment &segment);
+    /// \brief Max connections broadcast sends to per second
+    /// \param connectionsPerSecond 0 - unlimited
+    void setBroadcastRate(std::size_t connectionsPerSecond);
+
+    /// \brief Set per-connection send queue high-water mark and slow consumer policy
+    /// \param maxFrames max queued frames, 0 - unlimited
+    /// \param maxBytes max queued bytes, 0 - unlimited
+    /// \param policy one of: dropOldest, dropNewest, close, undelivered
+    /// \throws std::runtime_error if policy is unknown
+    void setSendQueueLimits(std::size_t maxFrames, std::size_t maxBytes, const std::string &policy);
+
+    /// \brief Set send lanes of messages by type. Lanes are scheduled per connection:
+    /// high lane is always written first, normal and bulk lanes are written in turn by weights.
+    /// Redelivered (undelivered queue) messages go to bulk lane, unless their type is high.
+    /// \param typePriorities message type -> one of: high, normal, bulk. Not listed types are normal
+    /// \param normalWeight normal lane frames per round
+    /// \param bulkWeight bulk lane frames per round
+    /// \throws std::runtime_error if priority is unknown
+    void setSendPriorities(const std::unordered_map<std::string, std::string> &typePriorities,
+                           std::size_t normalWeight,
+                           std::size_t bulkWeight);
+
+    /// \brief Set ephemeral message types (typing, read position and alike): message of such type replaces
+    /// not yet written message of the same type, sender and room in connection send queue.
+    /// So backed up connection receives only latest state of each sender
+    /// \param types
+    void setCoalescedTypes(const std::vector<std::string> &types);
+
+    /// \brief Set ephemeral message types: they're worthless once delivery fails, so are written
+    /// to online recipients connections only, without events, history, statistics and undelivered store
+    /// \param types
+    void setEphemeralTypes(const std::vector<std::string> &types);
+
+    /// \brief Summary send queues gauges for all connections
+    /// \return
+    const wss::server::websocket::SendQueueMetrics &getSendQueueMetrics() const;
+
+    /// \brief Event loops lag and sampled executors backlog of both listeners,
+    /// secure listener loops follow main server ones in lagMicros
+    /// \return
+    wss::server::websocket::EventLoopMetrics getEventLoopMetrics() const;
+
+    /// \brief Count of open connections of chat endpoints. Uses connections snapshot, so it does not block accepting
+    /// \return
+    std::size_t getConnectionsCount() const;
+
+    /// \brief Keepalive, owner and queue state of all process connections (including ones in handshake),
+    /// by one sweep over hot metadata columns: connection objects are not touched
+    /// \param idleSeconds connections without incoming frames for this time are counted as idle
+    /// \return
+    wss::server::websocket::ConnectionTable::Summary getConnectionsSummary(long idleSeconds) const;
+
+    /// \brief Live state of user connections, read from connection atomics without stopping them
+    /// \param id user id
+    /// \return empty if user has no connections
+    std::vector<wss::server::websocket::ConnectionDiagnostics> getConnectionDiagnostics(user_id_t id) const;
+
+    /// \brief Set TLS session resumption settings. Does nothing for insecure server without secure listener
+    /// \param config
+    void setTlsSessionConfig(const wss::server::websocket::SocketServerSecure::SessionConfig &config);
+
+    /// \brief Limit TLS handshakes running at the same time, to protect established connections from reconnect storms
+    /// \param maxHandshakes 0 - unlimited
+    void setMaxConcurrentHandshakes(std::size_t maxHandshakes);
+
+    /// \brief TLS handshake counters
+    /// \return nullptr for insecure server without secure listener
+    const wss::server::websocket::TlsSessionMetrics *getTlsSessionMetrics() const;
+
+    /// \brief Limit of connections being authorized. Auth is asynchronous (remote auth doesn't hold a thread),
+    /// so the limit bounds pending auth requests
+    /// \param maxQueue max connections waiting for auth, others are closed with STATUS_TRY_AGAIN_LATER. 0 - unlimited
+    void setAuthMaxQueue(std::size_t maxQueue);
+
+    /// \brief Auth counters
+    /// \return
+    const wss::AuthMetrics &getAuthMetrics() const;
+
+    /// \brief Sizes of server structures. Every storage is locked by shards, so it's for monitoring, not hot paths
+    /// \return
+    wss::StateSizes getStateSizes() const;
+
+    /// \brief Set inbound messages rate limits (token buckets). Must be called before server is started
+    /// \param connectionLimits limits of each connection
+    /// \param userLimits limits shared by all connections of user
+    /// \param policy one of: drop - skip message, delay - handle message later (up to maxDelayMillis, then drop),
+    /// close - close connection with STATUS_POLICY_VIOLATION
+    /// \param maxDelayMillis
+    /// \throws std::runtime_error if policy is unknown
+    void setRateLimits(const wss::RateLimiter::Limits &connectionLimits,
+                       const wss::RateLimiter::Limits &userLimits,
+                       const std::string &policy,
+                       long maxDelayMillis);
+
+    /// \brief Throttling counters
+    /// \return
+    const wss::RateLimitMetrics &getRateLimitMetrics() const;
+
+    /// \brief Undelivered queue storage, to read its size and counters
+    /// \return
+    const wss::UndeliveredStore &getUndeliveredStore() const;
+
+    /// \brief Cluster links of this node
+    /// \return nullptr if cluster mode is disabled
+    const wss::ClusterBus *getCluster() const;
+
+    /// \brief Broker bridge of this node
+    /// \return nullptr if cluster mode is disabled or uses links
+    const wss::ClusterBridge *getClusterBridge() const;
+
+    /// \brief Reads page of user messages from history log (see setHistoryLog())
+    /// \param user recipient
+    /// \param since cursor: messages after this id are returned, nullptr - from oldest
+    /// \param limit max messages, cut to history page size
+    /// \param out messages in sent order are appended here
+    /// \return false if history is disabled
+    bool readHistory(user_id_t user, const unid_t *since, std::size_t limit, std::vector<MessagePayloadPtr> &out) const;
+
+    /// \brief History page size limit
+    /// \return
+    std::size_t getHistoryPageSize() const;
+
+    /// \brief Enable users online/offline transitions feed. Must be called before server is started
+    /// \param historySize max events kept for polling (rest api GET /presence)
+    /// \param topic publish transitions to this topic subscribers, empty - don't publish
+    /// \param notifyListeners pass transitions to message listeners (event notifier)
+    /// \throws std::runtime_error if topic is invalid
+    void setPresence(std::size_t historySize, const std::string &topic, bool notifyListeners);
+
+    /// \brief Zero-downtime restart: stops accepting new connections, then closes existing ones in paced batches
+    /// with STATUS_SERVICE_RESTART. Close reason is json: {"reconnectAfterMillis": N}, N is random per connection,
+    /// so clients don't reconnect to next instance all at once. Connection is closed after its send queue is flushed
+    /// or after flush timeout. Second call does nothing.
+    /// \param options
+    /// \param onDrained called from timers thread, when all connections are closed (and state is handed off)
+    void drain(const DrainOptions &options, const std::function<void()> &onDrained);
+
+    /// \brief Hands off users state to other node of cluster, when drain() has closed all connections:
+    /// statistics are merged into receiver ones, undelivered messages are moved to receiver queues and
+    /// redelivered there, if users are already connected. Rooms are replicated by cluster itself.
+    /// Close reason of drained connections gets "url" of receiver, if it's set in cluster nodes.
+    /// Messages of shared store (redis) are not moved. Works only with cluster links (setCluster())
+    /// \param options
+    void setHandoff(const HandoffOptions &options);
+
+    /// \return true if drain() was called
+    bool isDraining() const noexcept;
+
+    /// \brief Presence transitions after cursor
+    /// \param since last seen sequence
+    /// \param out
+    /// \param last sequence of last transition, next cursor
+    /// \return false if feed is disabled or some transitions after cursor are lost: consumer must reload presence
+    bool getPresenceEvents(uint64_t since, std::vector<wss::PresenceFeed::PresenceEvent> &out, uint64_t &last) const;
+
+    /// \brief Set permessage-deflate extension settings for chat endpoint
+    /// \param options
+    void setPerMessageDeflate(const wss::server::websocket::PerMessageDeflate::Options &options);
+
     /// \brief Set websocket authorization method. If planning to use browser JS clients, recommended to use Basic Auth
     /// \see wss::BasicAuth - requires basic auth
     /// \see wss::WebAuth - does not requires authorization
@@ -181,78 +617,273 @@ class ChatServer : public virtual StandaloneService {
     /// \param enabled
     void setEnabledMessageDeliveryStatus(bool enabled);
 
+    /// \brief Set storage of undelivered queue messages. By default, messages are kept in memory
+    /// \param store
+    void setUndeliveredStore(std::unique_ptr<wss::UndeliveredStore> store);
+
+    /// \brief Enables cluster mode: messages for users connected to other nodes are forwarded to them.
+    /// Bus is started with server. Must be set before server is started
+    /// \param cluster
+    void setCluster(std::unique_ptr<wss::ClusterBus> cluster);
+
+    /// \brief Enables cluster mode through message broker, instead of links (see setCluster()).
+    /// Bridge is started with server. Must be set before server is started
+    /// \param bridge
+    void setClusterBridge(std::unique_ptr<wss::ClusterBridge> bridge);
+
+    /// \brief Pins users to nodes: user, that belongs to other node of ring, is closed with STATUS_REDIRECT
+    /// and url of its node before auth. Must be set before server is started
+    /// \param ring
+    /// \param node this node id, must be in ring
+    void setShardRing(std::unique_ptr<wss::HashRing> ring, wss::node_id_t node);
+
+    /// \brief Set default lifetime of undelivered queue messages. Payload "ttl" field overrides it
+    /// \param seconds 0 - messages never expire
+    void setUndeliveredTtl(uint32_t seconds);
+
+    /// \brief Set how many undelivered messages are sent to reconnected user at once. Next batch is taken when
+    /// user connections sent queues have less than batch frames
+    /// \param messages at least 1
+    void setRedeliveryBatchSize(std::size_t messages);
+
+    /// \brief Enable history: every message to users and rooms is written to log, clients can request messages
+    /// since cursor (TYPE_HISTORY control message or rest api GET /history)
+    /// \param log nullptr - history is disabled (default)
+    void setHistoryLog(std::unique_ptr<wss::HistoryLog> log);
+
+    /// \brief Enable local ingest: co-located producers put binary envelopes to shared memory ring,
+    /// they are sent like messages of rest api. Ring is drained by own thread, started with server
+    /// \param ingest
+    void setLocalIngest(std::unique_ptr<wss::LocalIngest> ingest);
+    /// \return nullptr if local ingest is disabled
+    const wss::LocalIngest *getLocalIngest() const;
+
+    /// \brief Enable streaming ingest: backends send batches of binary envelopes over persistent tcp connections,
+    /// they are sent like messages of rest api. Listener is started with server
+    /// \param ingest
+    void setIngestServer(std::unique_ptr<wss::IngestServer> ingest);
+    /// \return nullptr if streaming ingest is disabled
+    const wss::IngestServer *getIngestServer() const;
+
+    /// \brief Enable websockets over HTTP/2: gateway bridges extended CONNECT streams to plain listener of this
+    /// server, so they are routed like any other connection. Gateway is started with server
+    /// \param gateway
+    void setHttp2Gateway(std::unique_ptr<wss::Http2Gateway> gateway);
+    /// \return nullptr if HTTP/2 is disabled
+    const wss::Http2Gateway *getHttp2Gateway() const;
+
+    /// \brief Set max messages of one history request
+    /// \param messages at least 1
+    void setHistoryPageSize(std::size_t messages);
+
+    /// \brief Enable snapshot of in-memory state: users statistics, rooms, presence feed and undelivered messages of
+    /// memory store. Snapshot is written on stop and periodically, and restored with restoreSnapshot()
+    /// \param path snapshot file
+    /// \param intervalSeconds 0 - only on stop
+    void setSnapshot(const std::string &path, uint32_t intervalSeconds);
+
+    /// \brief Writes snapshot, file is replaced atomically. Thread safe
+    /// \return false if snapshot is disabled or can't be written (error is logged)
+    bool saveSnapshot();
+
+    /// \brief Restores state from snapshot. Must be called before server is started.
+    /// Users that were online are restored as disconnected at restore time (presence feed gets offline transitions)
+    /// \return false if snapshot is disabled or file not exists
+    /// \throws std::runtime_error if snapshot is corrupted or has unsupported version
+    bool restoreSnapshot();
+
+    /// \brief Enable client acknowledgements (TYPE_ACK control message with message ids). Connection that sent ack
+    /// keeps up to windowSize not acknowledged messages, next messages wait in undelivered queue. On disconnect not
+    /// acknowledged messages are put to undelivered queue. Requires enabled undelivered queue
+    /// \param windowSize 0 - disabled, written messages are considered delivered (default)
+    void setAckWindow(std::size_t windowSize);
+
+    /// \brief Acknowledgement counters
+    /// \return nullptr if acknowledgements are disabled
+    const wss::AckMetrics *getAckMetrics() const;
+
+    /// \brief Set how delivery statuses (see setEnabledMessageDeliveryStatus) are coalesced
+    /// \param mode delivery - status for each recipient connection (default), message - one status per
+    /// message after all recipients connections are handled, batch - statuses are collected per sender and flushed
+    /// every flushMillis or after flushItems messages. Status data contains delivered messages ids: {"ids":[...]}
+    /// \param flushMillis batch flush interval, 0 - by items count only
+    /// \param flushItems max messages in one batch status, 0 - by interval only
+    /// \throws std::runtime_error if mode is unknown
+    void setDeliveryStatusCoalescing(const std::string &mode, long flushMillis, std::size_t flushItems);
+
+    /// \brief Max payloads in batch frame (array of payloads). Client receives single "notification_batch_received"
+    /// status for each batch
+    /// \param maxItems 0 - batches are not accepted
+    void setMaxBatchSize(std::size_t maxItems);
+
+    /// \brief Whether clients can publish payloads to topics. Rest api can publish always
+    /// \param enabled
+    void setEnabledClientTopicPublish(bool enabled);
+
     /// \brief Adds event listener for message send event
-    /// \param callback semantic: void(wss::MessagePayload &&, bool hasSent)
+    /// \param callback semantic: void(const wss::MessagePayloadPtr &), payload is immutable and shared with delivery
     void addMessageListener(wss::ChatServer::OnMessageSentListener callback);
 
     /// \brief Adds event listener for server stopping event
     /// \param callback semantic: void(void)
     void addStopListener(wss::ChatServer::OnServerStopListener callback);
 
-    /// \brief Returns map of user connections/sends statistics. Key - user id, value - statistics
+    /// \brief Returns snapshot of all users connections/sends statistics. Safe to iterate while server is running
     /// \return
-    const UserMap<std::unique_ptr<wss::Statistics>> &getStats();
+    std::vector<wss::StatisticsStorage::StatisticsPtr> getStats() const;
+
+    /// \brief Returns page of users statistics ordered by user id
+    /// \see wss::StatisticsStorage::page
+    std::vector<wss::StatisticsStorage::StatisticsPtr> getStatsPage(wss::user_id_t after,
+                                                                    std::size_t limit,
+                                                                    const wss::StatisticsStorage::Filter &filter,
+                                                                    bool &more) const;
+
+    /// \brief Returns user statistics if exists
+    /// \param id
+    /// \return nullptr if user has never connected
+    wss::StatisticsStorage::StatisticsPtr findStat(user_id_t id) const;
+
+    /// \brief Server-wide messages, bytes and connections rates during last minute
+    /// \return
+    wss::StatisticsStorage::Rates getRates() const;
+
+    /// \brief Checks many users have open connections
+    /// \param ids
+    /// \return online[i] for ids[i]
+    std::vector<bool> checkOnline(const std::vector<user_id_t> &ids) const;
 
  protected:
-    /// \brief Called when pong frame received from client
+    /// \brief Called when message received from client
     /// \param connection
     /// \param payload
-    void onPong(WsConnectionPtr &connection, WsMessagePtr payload);
+    void onMessage(WsConnectionPtr &connection, WsMessagePtr payload);
 
-    /// \brief Called when message received from client
+    /// \brief Decodes and handles message after rate limits check
+    /// \param connection
+    /// \param message
+    /// \param batchItems PayloadCodec::countBatch() of message
+    void handleMessage(WsConnectionPtr &connection, const WsMessagePtr &message, std::size_t batchItems);
+
+    /// \brief Called when client sent batch of payloads in single frame
+    /// \param connection
+    /// \param batch parsed, but not validated payloads
+    void onBatch(WsConnectionPtr &connection, const std::vector<wss::MessagePayload> &batch);
+
+    /// \brief Routes valid payload received from client: control messages, rooms, topics, recipients
     /// \param connection
     /// \param payload
-    void onMessage(WsConnectionPtr &connection, WsMessagePtr payload);
+    void dispatch(WsConnectionPtr &connection, const wss::MessagePayload &payload);
+    /// \brief Writes message shape to traffic capture if it's running: size, sender and recipients, no content
+    /// \param connection
+    /// \param payload
+    /// \param size frame size, batch items get equal share of batch frame
+    void captureMessage(const WsConnectionPtr &connection, const wss::MessagePayload &payload, std::size_t size);
+
+    /// \brief Handles client acknowledgement: frees window and resumes deferred messages
+    /// \param connection
+    /// \param payload ack control message
+    void onAck(WsConnectionPtr &connection, const wss::MessagePayload &payload);
+
+    /// \brief Sends requested history page to connection, on throttle service thread
+    /// \param connection
+    /// \param payload history control message
+    void onHistory(WsConnectionPtr &connection, const wss::MessagePayload &payload);
 
-    /// \brief Called when message has sent to recipient, for entire recipient. Payload contains only 1 entire recipient.
+    /// \brief Writes message to history log, if history is enabled and message is not a control or system one
+    /// \param recipients
+    /// \param count
     /// \param payload
+    void appendHistory(const user_id_t *recipients, std::size_t count, const wss::MessagePayload &payload);
+
+    /// \brief Called when message has sent to recipient, for entire recipient
+    /// \param payload shared payload with all recipients
+    /// \param recipient entire recipient
     /// \param bytesTransferred Payload message size
     /// \param hasSent Indicates that message has send or not
-    void onMessageSent(wss::MessagePayload &&payload, std::size_t bytesTransferred, bool hasSent);
+    void onMessageSent(const wss::MessagePayload &payload, user_id_t recipient, std::size_t bytesTransferred, bool hasSent);
 
     /// \brief Called when client has connected
     /// \param connection
     void onConnected(WsConnectionPtr connection);
 
+    /// \brief Auth result of connected client, called on connection executor
+    /// \param id
+    /// \param connection
+    /// \param authorized
+    void onAuthorized(wss::user_id_t id, const WsConnectionPtr &connection, bool authorized);
+
     /// \brief Called when client has disconnected
     /// \param connection
     /// \param status Disconnection status code
     /// \param reason Disconnection string reason. May be empty.
     void onDisconnected(WsConnectionPtr connection, int status, const std::string &reason);
-    void watchdogWorker();
 
     /// \brief Check for entire user has undelivered message
     /// \param recipientId recipient id
     /// \return
     inline bool hasUndeliveredMessages(user_id_t recipientId);
-    /// \brief Returns queue of undelivered messages
-    /// \param recipientId recipient id
-    /// \return
-    MessageQueue &getUndeliveredMessages(user_id_t recipientId);
 
-    /// \brief Returns list of queues of undelivered messages.
-    /// \param payload Function takes all recipients from payload
-    /// \return
-    std::vector<MessageQueue *> getUndeliveredMessages(const MessagePayload &payload);
+    /// \brief Store undelivered message for recipients: body is stored once, queues reference it
+    /// \param recipients
+    /// \param count
+    /// \param payload
+    void enqueueUndeliveredMessage(const user_id_t *recipients, std::size_t count, const MessagePayloadPtr &payload);
 
-    /// \brief Store undelivered message for payload recipients (for each recipient - single queue element)
+    /// \brief Expiry time of message stored now
     /// \param payload
-    void enqueueUndeliveredMessage(const MessagePayload &payload);
+    /// \return unix milliseconds, 0 - never expires
+    uint64_t getUndeliveredExpiry(const MessagePayload &payload) const;
 
-    /// \brief Take from undelivered queue messages for recipient, and tries to resend them
+    /// \brief Schedules redelivery of undelivered queue messages to recipient connections only.
+    /// Messages are not sent to their other recipients and message listeners are not called again.
+    /// Does nothing if redelivery to recipient is already running
     /// \param recipientId
-    /// \return Number of successfully sent messages
-    int redeliverMessagesTo(user_id_t recipientId);
+    void redeliverMessagesTo(user_id_t recipientId);
 
     /// \brief Works like wss::ChatMessageServer::redeliverMessagesTo(user_id_t recipientId) but uses multiple recipients from payload
     /// \param payload
-    /// \return Number of successfully sent messages
-    int redeliverMessagesTo(const MessagePayload &payload);
+    void redeliverMessagesTo(const MessagePayload &payload);
+
+    /// \brief Delivers message forwarded by other node to local recipients: listeners and history are handled
+    /// by origin node. Recipients, that are not connected anymore, are queued as undelivered and reported back
+    /// \param from origin node
+    /// \param recipients nullptr for topic message
+    /// \param count
+    /// \param payload
+    void onClusterMessage(wss::node_id_t from,
+                          const user_id_t *recipients,
+                          std::size_t count,
+                          const wss::MessagePayloadPtr &payload);
+
+    /// \brief Sends next batch of undelivered messages to recipient, then reschedules itself until queue is empty
+    /// or recipient is gone. Runs on throttle service
+    /// \param recipientId
+    void redeliverBatch(user_id_t recipientId);
+
+    /// \brief Drops expired undelivered messages, then reschedules itself on throttle service every second
+    void expireUndeliveredMessages();
+
+    /// \brief Feeds load sample to overload controller, then reschedules itself on throttle service
+    void checkOverload();
+
+    /// \brief Removes expired attachment files, then reschedules itself on throttle service every minute
+    void expireAttachments();
+
+    /// \brief Removes long offline users statistics, then reschedules itself on throttle service every minute
+    void expireStatistics();
+
+    /// \brief Sends due scheduled messages, then reschedules itself on throttle service every scheduler tick
+    void deliverScheduled();
+
+    struct BroadcastJob;
+    /// \brief Sends broadcast to next part of connections, then reschedules itself on throttle service
+    void broadcastStep(const std::shared_ptr<BroadcastJob> &job);
 
     /// \brief Returns statistics for entire user
     /// \param id
     /// \return
-    std::unique_ptr<wss::Statistics> &getStat(user_id_t id);
+    wss::StatisticsStorage::StatisticsPtr getStat(user_id_t id);
 
  private:
     // secure
@@ -265,57 +896,342 @@ class ChatServer : public virtual StandaloneService {
     /// \brief Number in bytes
     std::size_t m_maxMessageSize; // 10 megabytes by default
     bool m_enableMessageDeliveryStatus = false;
+    bool m_enableClientTopicPublish = false;
+    std::size_t m_maxBatchSize = 100;
+    /// \brief Message type -> send lane, not listed types are SendPriority::Normal
+    std::unordered_map<std::string, SendPriority> m_typePriorities;
+    /// \brief Last write wins types in send queues
+    wss::types::TypeSet m_coalescedTypes;
+    /// \brief Types delivered to online connections only, see sendEphemeral()
+    wss::types::TypeSet m_ephemeralTypes;
+
+    // delivery statuses
+    enum class DeliveryStatusMode {
+      Delivery,
+      Message,
+      Batch
+    };
+    /// \brief Outcomes of recipients, collected for send() with report handler
+    struct ReportCollector {
+      explicit ReportCollector(DeliveryReportHandler &&handler) : handler(std::move(handler)) { }
+      DeliveryReportHandler handler;
+      std::shared_ptr<boost::asio::steady_timer> timer;
+      std::atomic_bool done{false};
+      std::mutex lock;
+      bool tracked = false;
+      /// \brief Message is routed by other thread (attachment is spooled first), that finishes untracked report
+      bool deferred = false;
+      std::unordered_map<user_id_t, DeliveryOutcome> outcomes;
+    };
+    using ReportCollectorPtr = std::shared_ptr<ReportCollector>;
+    /// \brief Pending deliveries of single message
+    struct DeliveryTracker {
+      DeliveryTracker(wss::MessagePayloadPtr payload, bool status, ReportCollectorPtr report) :
+          payload(std::move(payload)),
+          status(status),
+          report(std::move(report)) { }
+      const wss::MessagePayloadPtr payload;
+      /// \brief Coalesced delivery status is sent
+      const bool status;
+      /// \brief Can be nullptr
+      const ReportCollectorPtr report;
+      std::atomic_size_t pending{1};
+      std::atomic_size_t delivered{0};
+    };
+    /// \brief Sends of message to all devices of one user
+    struct UserDelivery {
+      UserDelivery(user_id_t user, wss::MessagePayloadPtr payload, std::shared_ptr<DeliveryTracker> tracker,
+                   std::size_t pending) :
+          user(user),
+          payload(std::move(payload)),
+          tracker(std::move(tracker)),
+          pending(pending) { }
+      const user_id_t user;
+      const wss::MessagePayloadPtr payload;
+      const std::shared_ptr<DeliveryTracker> tracker;
+      std::chrono::steady_clock::time_point writeStart;
+      std::atomic_size_t pending;
+      /// \brief Bytes written to first device
+      std::atomic_size_t bytes{0};
+      std::atomic_bool delivered{false};
+      /// \brief Send failed, not dropped by slow consumer policy
+      std::atomic_bool failed{false};
+      /// \brief Ack window of device is full, message is stored again. Set before sends are completed
+      bool requeued = false;
+    };
+    void completeUserDelivery(const UserDelivery &delivery);
+    DeliveryStatusMode m_deliveryStatusMode = DeliveryStatusMode::Delivery;
+    long m_deliveryStatusFlushMillis = 0;
+    std::size_t m_deliveryStatusFlushItems = 0;
+    std::mutex m_deliveryStatusMutex;
+    UserMap<std::vector<wss::unid_t>> m_pendingDeliveryStatuses;
+    std::unique_ptr<boost::thread> m_deliveryStatusThread;
+
+    // snapshot
+    std::string m_snapshotPath;
+    uint32_t m_snapshotIntervalSeconds = 0;
+    /// \brief Periodic and stop snapshots are not written concurrently
+    std::mutex m_snapshotMutex;
+    std::unique_ptr<boost::thread> m_snapshotThread;
 
     // events
     std::vector<wss::ChatServer::OnMessageSentListener> m_messageListeners;
     std::vector<OnServerStopListener> m_stopListeners;
 
-    std::mutex m_frameBufferMutex;
-    std::recursive_mutex m_connectionMutex;
-    std::mutex m_undeliveredMutex;
-    std::mutex m_statMutex;
+    std::unique_ptr<wss::UndeliveredStore> m_undelivered;
+    std::unique_ptr<wss::ClusterBus> m_cluster;
+    std::unique_ptr<wss::ClusterBridge> m_bridge;
+    std::unique_ptr<wss::HashRing> m_ring;
+    wss::node_id_t m_ringNode = 0;
+    std::unique_ptr<HandoffOptions> m_handoff;
+    uint32_t m_undeliveredTtlSeconds = 0;
+    std::size_t m_redeliveryBatchSize = 100;
+    /// \brief Users with running redelivery, used only on throttle service thread
+    std::unordered_set<user_id_t> m_redelivering;
+    /// \brief nullptr if acknowledgements are disabled
+    std::unique_ptr<wss::AckWindow> m_ackWindow;
+    /// \brief nullptr if history is disabled
+    std::unique_ptr<wss::HistoryLog> m_history;
+    std::unique_ptr<wss::LocalIngest> m_localIngest;
+    std::unique_ptr<wss::IngestServer> m_ingestServer;
+    std::unique_ptr<wss::Http2Gateway> m_http2Gateway;
+    std::unique_ptr<wss::OverloadController> m_overload;
+    long m_overloadCheckMillis = 100;
+    std::unique_ptr<wss::AttachmentStore> m_attachments;
+    uint32_t m_statisticsOfflineSeconds = 0;
+    std::size_t m_statisticsMaxUsers = 0;
+    std::unique_ptr<wss::DeliveryScheduler> m_scheduler;
+    std::atomic<std::size_t> m_broadcastRate{50000};
+    std::unique_ptr<wss::RecipientCache> m_recipientCache;
+    std::size_t m_historyPageSize = 500;
 
     std::unique_ptr<boost::thread> m_workerThread;
-    std::unique_ptr<boost::thread> m_watchdogThread;
+    std::unique_ptr<boost::thread> m_secureWorkerThread;
+
+    // auth executor
+    std::atomic<std::size_t> m_authMaxQueue{0};
+    wss::AuthMetrics m_authMetrics;
 
+    // throttling: delayed messages (and drain steps) are handled by timers of single thread
+    boost::asio::io_service m_throttleService;
+    std::unique_ptr<boost::asio::io_service::work> m_throttleWork;
+    std::unique_ptr<boost::thread> m_throttleThread;
+    // linger timer runs on throttle service: destroyed before it
+    std::unique_ptr<wss::OutboundBatcher> m_outboundBatcher;
+
+    // draining
+    struct DrainState;
+    std::atomic<bool> m_draining{false};
+
+    const std::string m_endpointPath;
     WsBase::Endpoint *m_endpoint;
     std::unique_ptr<wss::server::websocket::SocketServerBase> m_server;
 
+    /// \brief Secure listener of insecure server (see addSecureListener). Takes config from m_server on start
+    std::unique_ptr<WssServer> m_secureServer;
+    WsBase::Endpoint *m_secureEndpoint = nullptr;
+
     const std::unique_ptr<wss::ConnectionStorage> m_connectionStorage;
-    UserMap<std::shared_ptr<std::stringstream>> m_frameBuffer;
-    UserMap<std::queue<wss::MessagePayload>> m_undeliveredMessagesMap;
-    UserMap<std::unique_ptr<Statistics>> m_statistics;
-    UserMap<bool> m_sentUniqueId;
+    const std::unique_ptr<wss::RoomStorage> m_rooms;
+    const std::unique_ptr<wss::TopicStorage> m_topics;
+    const std::unique_ptr<wss::StatisticsStorage> m_statistics;
+    const std::unique_ptr<wss::RateLimiter> m_rateLimiter;
+    std::unique_ptr<wss::PresenceFeed> m_presence;
+    std::string m_presenceTopic;
+    bool m_presenceNotify = false;
+
+    /// \brief Codecs in order of WsBase::Endpoint::subprotocols
+    std::vector<std::unique_ptr<wss::PayloadCodec>> m_codecs;
+    const wss::JsonCodec m_defaultCodec;
+
+    /// \brief Running thread index
+    /// \return incremental simple integer
+    std::size_t getThreadName();
+
+    /// \brief Creates chat endpoint on server
+    /// \param server
+    /// \return
+    WsBase::Endpoint *createEndpoint(wss::server::websocket::SocketServerBase &server);
 
-    /// \todo move out to server side
+    /// \brief Server that handles TLS connections
+    /// \return nullptr if there is no one
+    WssServer *getSecureServer() const;
 
-    /// \brief Check for existence of fragmented frame was written to temporary buffer
-    /// \param senderId
+    /// \brief Configs of main and secure listener: secure one copies main config on start,
+    /// so tunable settings changed later must be set to both
     /// \return
-    bool hasFrameBuffer(user_id_t senderId);
+    std::vector<wss::server::websocket::SocketServerBase::Config *> getConfigs() const;
+
+    /// \brief Calling message event listeners
+    /// \param payload
+    void callOnMessageListeners(const wss::MessagePayloadPtr &payload);
+
+    /// \brief Adds message to undelivered queue of users, that are offline or send to them failed
+    /// \param uids
+    /// \param count
+    /// \param payload
+    void handleUndeliverable(const user_id_t *uids, std::size_t count, const wss::MessagePayloadPtr &payload);
+
+    /// \brief Moves not yet seen endpoints connections to drain queue
+    /// \param state
+    void collectDrainConnections(DrainState &state);
+    /// \brief Single drain step: takes next batch, closes flushed connections and schedules next step
+    /// \param state
+    void drainStep(const std::shared_ptr<DrainState> &state);
+    /// \brief Receiver of handoff: configured node or first connected one
+    /// \return 0 if there is no connected node
+    wss::node_id_t getHandoffNode() const;
+    /// \brief Sends statistics and undelivered messages to node. Blocks caller until node acks every batch:
+    /// taken messages are pushed back with their expiry, if batch isn't acked
+    /// \param node
+    void handoffState(wss::node_id_t node);
+    /// \brief Applies handoff body of draining node
+    /// \param from
+    /// \param body
+    /// \return false if body is invalid, it's not acked then
+    bool onHandoff(wss::node_id_t from, const std::string &body);
+
+    /// \brief Connection storage presence handler
+    /// \param event
+    void onPresence(const wss::ConnectionStorage::PresenceEvent &event);
+
+    /// \brief Send payload to recipient, using frames shared with other recipients of this payload
+    /// \param recipient
+    /// \param payload copy of payload, shared by completion callbacks of all recipients
+    /// \param frames
+    /// \param tracker pending deliveries for coalesced delivery status, can be nullptr
+    void sendTo(user_id_t recipient,
+                const wss::MessagePayloadPtr &payload,
+                wss::EncodedFrames &frames,
+                const std::shared_ptr<DeliveryTracker> &tracker);
+
+    /// \brief Send payload to many recipients: connections are resolved by single bulk lookup
+    /// \param recipients pointer to first recipient id
+    /// \param count recipients count
+    /// \param exclude recipient to skip, 0 - none
+    /// \param payload copy of payload, shared by completion callbacks of all recipients
+    /// \param frames
+    /// \param tracker pending deliveries for coalesced delivery status, can be nullptr
+    void sendToAll(const user_id_t *recipients,
+                   std::size_t count,
+                   user_id_t exclude,
+                   const wss::MessagePayloadPtr &payload,
+                   wss::EncodedFrames &frames,
+                   const std::shared_ptr<DeliveryTracker> &tracker);
+
+    /// \brief Send payload to resolved connections, by users
+    /// \param online connections of one user must be adjacent (see ConnectionStorage::resolve())
+    /// \param payload
+    /// \param frames
+    /// \param tracker can be nullptr
+    void sendToOnline(const std::vector<wss::ConnectionStorage::Recipients::Item> &online,
+                      const wss::MessagePayloadPtr &payload,
+                      wss::EncodedFrames &frames,
+                      const std::shared_ptr<DeliveryTracker> &tracker);
 
-    /// \brief Write to buffer fragmented frame
-    /// \param senderId
-    /// \param input input data
-    /// \param clear if true, buffer for will be cleared for entire sender
+    /// \brief Send payload to single recipient connection
+    /// \param item resolved connection
+    /// \param payload
+    /// \param frames
+    /// \param tracker can be nullptr
+    void sendToConnection(const wss::ConnectionStorage::Recipients::Item &item,
+                          const wss::MessagePayloadPtr &payload,
+                          wss::EncodedFrames &frames,
+                          const std::shared_ptr<DeliveryTracker> &tracker);
+
+    /// \brief Send payload to connections (devices) of one user: frames are shared, completions
+    /// are aggregated, so statistics, delivery status and undelivered store see one result per user.
+    /// User has received message if any device has written it
+    /// \param items connections of same user
+    /// \param count
+    /// \param payload
+    /// \param frames
+    /// \param tracker can be nullptr
+    void sendToUser(const wss::ConnectionStorage::Recipients::Item *items,
+                    std::size_t count,
+                    const wss::MessagePayloadPtr &payload,
+                    wss::EncodedFrames &frames,
+                    const std::shared_ptr<DeliveryTracker> &tracker);
+
+    /// \brief Sends payload to its recipients using given send lane
+    /// \param payload
+    /// \param priority
+    void send(const MessagePayload &payload, SendPriority priority);
+    /// \param payload
+    /// \param priority
+    /// \param report outcomes of recipients, can be nullptr
+    void send(const MessagePayload &payload, SendPriority priority, const ReportCollectorPtr &report);
+    /// \brief Sends payload, that passed scheduling, overload and attachment steps of send()
+    /// \param payload
+    /// \param priority
+    /// \param report outcomes of recipients, can be nullptr
+    void route(const MessagePayload &payload, SendPriority priority, const ReportCollectorPtr &report);
+
+    /// \brief Fast path of ephemeral types: payload is written to online connections only.
+    /// No event listeners, history, statistics, delivery status, ack window and undelivered store
+    /// \param payload direct or room message
+    /// \param priority
+    void sendEphemeral(const MessagePayload &payload, SendPriority priority);
+
+    /// \brief Send queue key of payload: set for coalesced types only
+    /// \param payload
     /// \return
-    bool writeFrameBuffer(user_id_t senderId, const std::string &input, bool clear = false);
+    wss::server::websocket::CoalesceKey getCoalesceKey(const wss::MessagePayload &payload) const;
 
-    /// \brief Read from buffer fragmented frame
-    /// \param senderId
-    /// \param clear
+    /// \brief Send lane of payload by its type
+    /// \param payload
     /// \return
-    const std::string readFrameBuffer(user_id_t senderId, bool clear = true);
+    SendPriority getSendPriority(const wss::MessagePayload &payload) const;
 
-    /// \brief Running thread index
-    /// \return incremental simple integer
-    std::size_t getThreadName();
+    /// \brief Delivery tracker for coalesced delivery status and outcomes report
+    /// \param payload
+    /// \param report can be nullptr
+    /// \return nullptr if there is no report and statuses are disabled or sent for each delivery
+    std::shared_ptr<DeliveryTracker> createTracker(const wss::MessagePayloadPtr &payload,
+                                                   const ReportCollectorPtr &report = nullptr);
 
-    /// \brief Calling message event listeners
-    /// \param paylod
-    void callOnMessageListeners(wss::MessagePayload paylod);
+    /// \brief Completes one pending delivery. Last one sends (or enqueues to batch) delivery status
+    /// and completes report
+    /// \param tracker can be nullptr
+    /// \param delivered
+    void completeDelivery(const std::shared_ptr<DeliveryTracker> &tracker, bool delivered);
+
+    /// \brief Sets outcome of recipient, if tracker has report
+    /// \param tracker can be nullptr
+    /// \param user
+    /// \param outcome
+    static void recordOutcome(const std::shared_ptr<DeliveryTracker> &tracker, user_id_t user,
+                              DeliveryOutcome outcome);
+
+    /// \brief Marks report as tracked, with Pending outcome of every recipient. Call before sends are started
+    /// \param report
+    /// \param recipients
+    /// \param count
+    /// \param exclude recipient to skip, 0 - none
+    static void trackRecipients(ReportCollector &report, const user_id_t *recipients, std::size_t count,
+                                user_id_t exclude);
 
-    void handleUndeliverable(user_id_t uid, const wss::MessagePayload &payload);
+    /// \brief Calls report handler, if it's not called yet
+    /// \param report
+    void finishReport(const ReportCollectorPtr &report);
+
+    /// \brief Sends all batched delivery statuses
+    void flushDeliveryStatuses();
+
+    /// \brief Send topic payload to all subscribed connections. Topic messages are not queued for offline users
+    /// \param payload
+    /// \param frames
+    void publish(const wss::MessagePayloadPtr &payload, wss::EncodedFrames &frames);
+
+    /// \brief Codec negotiated by connection
+    /// \param connection
+    /// \return default json codec if client requested nothing
+    const wss::PayloadCodec &getCodec(const WsConnectionPtr &connection) const;
+    /// \brief Codec of incoming frame
+    /// \param connection
+    /// \param message
+    /// \return default json codec if frame opcode differs from one negotiated codec uses
+    const wss::PayloadCodec &getCodec(const WsConnectionPtr &connection, const WsMessagePtr &message) const;
 };
 
 }
@@ -0,0 +1,53 @@
+/**
+ * wsserver
+ * ClusterBridge.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "ClusterBridge.h"
+#include <stdexcept>
+#include <toolboxpp.h>
+#ifdef ENABLE_REDIS_TARGET
+#include "RedisClusterBridge.h"
+#endif
+
+wss::ClusterBridge::ClusterBridge(wss::node_id_t nodeId) :
+    m_nodeId(nodeId) {
+}
+
+void wss::ClusterBridge::setMessageHandler(MessageHandler handler) {
+    m_messageHandler = std::move(handler);
+}
+
+void wss::ClusterBridge::setUndeliverableHandler(UndeliverableHandler handler) {
+    m_undeliverableHandler = std::move(handler);
+}
+
+void wss::ClusterBridge::setOnlineCheck(OnlineCheck check) {
+    m_onlineCheck = std::move(check);
+}
+
+wss::node_id_t wss::ClusterBridge::getNodeId() const noexcept {
+    return m_nodeId;
+}
+
+const wss::ClusterBridgeMetrics &wss::ClusterBridge::getMetrics() const {
+    return m_metrics;
+}
+
+std::unique_ptr<wss::ClusterBridge> wss::bridge::registry::create(const std::string &type,
+                                                                  wss::node_id_t nodeId,
+                                                                  const nlohmann::json &config) {
+    #ifdef ENABLE_REDIS_TARGET
+    if (toolboxpp::strings::equalsIgnoreCase(type, "redis")) {
+        return std::make_unique<wss::RedisClusterBridge>(nodeId, config);
+    }
+    throw std::runtime_error("Unknown cluster transport: " + type + ". Available: links, redis");
+    #else
+    (void) nodeId;
+    (void) config;
+    throw std::runtime_error("Unknown cluster transport: " + type + ". Available: links");
+    #endif
+}
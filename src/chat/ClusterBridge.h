@@ -0,0 +1,114 @@
+/**
+ * wsserver
+ * ClusterBridge.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_CLUSTERBRIDGE_H
+#define WSSERVER_CLUSTERBRIDGE_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include "json.hpp"
+#include "ClusterDirectory.h"
+#include "Message.h"
+#include "../wsserver_core.h"
+
+namespace wss {
+
+struct ClusterBridgeMetrics {
+  /// \brief Recipients of messages sent to broker
+  std::atomic<uint64_t> forwarded{0};
+  /// \brief Messages received from broker
+  std::atomic<uint64_t> received{0};
+  /// \brief Forwarded recipients, that no node has received: they are put to undelivered queue by this node
+  std::atomic<uint64_t> unroutable{0};
+  /// \brief Failed broker commands
+  std::atomic<uint64_t> errors{0};
+};
+
+/// \brief Cluster mode through external message broker, simpler alternative of ClusterBus: node subscribes to
+/// channel of every user connected to it, messages for recipients that are not connected here are published to
+/// their channels, so broker does routing and nodes don't know each other.
+/// Rooms membership and user locations are not shared: room message reaches only members joined on sender node,
+/// checkOnline sees only local users. User connected to many nodes gets message only on nodes, where it isn't
+/// sent locally. Delivery is at most once
+class ClusterBridge {
+ public:
+    /// \brief Message published by other node
+    /// \param from sender node
+    /// \param recipients local recipients, nullptr and 0 for topic message
+    using MessageHandler = std::function<void(wss::node_id_t from,
+                                              const wss::user_id_t *recipients,
+                                              std::size_t count,
+                                              const wss::MessagePayloadPtr &payload)>;
+    /// \brief Forwarded recipient isn't connected to any node. Called by bridge thread
+    using UndeliverableHandler = std::function<void(wss::user_id_t recipient, const wss::MessagePayloadPtr &payload)>;
+    /// \brief Check user is connected to this node
+    using OnlineCheck = std::function<bool(wss::user_id_t user)>;
+
+    explicit ClusterBridge(wss::node_id_t nodeId);
+    virtual ~ClusterBridge() = default;
+
+    /// \brief Must be set before start()
+    void setMessageHandler(MessageHandler handler);
+    /// \brief Must be set before start()
+    void setUndeliverableHandler(UndeliverableHandler handler);
+    /// \brief Must be set before start()
+    void setOnlineCheck(OnlineCheck check);
+
+    /// \throws std::runtime_error if broker is not available
+    virtual void start() = 0;
+    virtual void stop() = 0;
+
+    /// \brief User has connected or disconnected: subscription follows OnlineCheck result,
+    /// so transitions called in other order than they happened end with right state
+    /// \param user
+    virtual void onPresence(wss::user_id_t user) = 0;
+
+    /// \brief Sends message to recipients connected to other nodes
+    /// \param recipients not connected to this node
+    /// \param count
+    /// \param payload
+    virtual void forward(const wss::user_id_t *recipients, std::size_t count, const wss::MessagePayloadPtr &payload) = 0;
+
+    /// \brief Sends topic message to all nodes
+    /// \param payload
+    virtual void publish(const wss::MessagePayloadPtr &payload) = 0;
+
+    /// \brief Count of users channels this node is subscribed to
+    /// \return
+    virtual std::size_t getSubscriptions() const = 0;
+
+    wss::node_id_t getNodeId() const noexcept;
+    const wss::ClusterBridgeMetrics &getMetrics() const;
+
+ protected:
+    const wss::node_id_t m_nodeId;
+    MessageHandler m_messageHandler;
+    UndeliverableHandler m_undeliverableHandler;
+    OnlineCheck m_onlineCheck;
+    wss::ClusterBridgeMetrics m_metrics;
+};
+
+namespace bridge {
+namespace registry {
+/// \brief Creates bridge by broker type
+/// \param type redis (if built with ENABLE_REDIS_TARGET)
+/// \param nodeId this node id, message of node is ignored by itself
+/// \param config broker connection, see implementation
+/// \throws std::runtime_error if type is unknown
+/// \return
+std::unique_ptr<wss::ClusterBridge> create(const std::string &type,
+                                           wss::node_id_t nodeId,
+                                           const nlohmann::json &config);
+}
+}
+
+}
+
+#endif //WSSERVER_CLUSTERBRIDGE_H
@@ -0,0 +1,971 @@
+/**
+ * wsserver
+ * ClusterBus.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "ClusterBus.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <openssl/crypto.h>
+#include "../helpers/logging.h"
+
+namespace {
+
+using boost::asio::ip::tcp;
+using ErrorCode = boost::system::error_code;
+
+enum RecordType : uint8_t {
+  /// \brief u16 node, u16 secret length, secret
+  Hello = 1,
+  /// \brief u64 sequence, u32 count, count of u64 user
+  Online = 2,
+  /// \brief same as Online
+  Offline = 3,
+  /// \brief u32 count, count of u64 recipient, binary envelope till the end of record
+  Message = 4,
+  /// \brief u64 room, u32 count, count of u64 user
+  RoomJoin = 5,
+  /// \brief same as RoomJoin
+  RoomLeave = 6,
+  /// \brief Empty, all users of node follow
+  SyncBegin = 7,
+  /// \brief Empty, users not sent since SyncBegin are not connected to node
+  SyncEnd = 8,
+  /// \brief u64 count, u64 hash: ClusterDirectory::Digest of node users
+  Digest = 9,
+  /// \brief Empty, receiver sends sync of its users back by its own link
+  SyncRequest = 10,
+  /// \brief u64 id, handoff body till the end of record, see ChatServer handoff
+  Handoff = 11,
+  /// \brief u64 id of applied handoff body, sent back by receiver's own link
+  HandoffAck = 12,
+};
+
+/// \brief Digests of node, that differ in a row, before sync is requested: single one can be caused by
+/// transition, that is applied by node, but isn't sent yet
+constexpr unsigned DIGEST_MISMATCHES = 2;
+
+/// \brief u32 length of record
+constexpr std::size_t HEADER_SIZE = 4;
+/// \brief Limit of records before hello: u8 type, u16 node, u16 secret length and secret
+constexpr std::size_t MAX_HELLO_BYTES = 4 * 1024;
+/// \brief Snapshot of node users is split into records of this size
+constexpr std::size_t SNAPSHOT_CHUNK = 64 * 1024;
+
+template<typename T>
+void put(std::string &out, T value) {
+    for (std::size_t c = sizeof(T); c > 0; c--) {
+        out.push_back(static_cast<char>((static_cast<uint64_t>(value) >> (8 * (c - 1))) & 0xFFu));
+    }
+}
+
+/// \brief Bounds checked reader of record body
+class RecordReader {
+ public:
+    RecordReader(const char *data, std::size_t length) :
+        m_data(reinterpret_cast<const uint8_t *>(data)),
+        m_length(length) { }
+
+    template<typename T>
+    T get() {
+        if (m_length - m_pos < sizeof(T)) {
+            throw std::runtime_error("truncated record");
+        }
+        uint64_t value = 0;
+        for (std::size_t i = 0; i < sizeof(T); i++) {
+            value = (value << 8) | m_data[m_pos++];
+        }
+        return static_cast<T>(value);
+    }
+
+    const char *rest(std::size_t &length) noexcept {
+        length = m_length - m_pos;
+        return reinterpret_cast<const char *>(m_data + m_pos);
+    }
+
+    std::size_t left() const noexcept {
+        return m_length - m_pos;
+    }
+
+ private:
+    const uint8_t *m_data;
+    std::size_t m_length;
+    std::size_t m_pos = 0;
+};
+
+/// \brief Appends record header, body is appended by caller
+/// \return position of record, for endRecord()
+std::size_t beginRecord(std::string &out, RecordType type) {
+    const std::size_t position = out.size();
+    put<uint32_t>(out, 0);
+    out.push_back(static_cast<char>(type));
+    return position;
+}
+
+void endRecord(std::string &out, std::size_t position) {
+    const auto length = static_cast<uint32_t>(out.size() - position - HEADER_SIZE);
+    for (std::size_t i = 0; i < HEADER_SIZE; i++) {
+        out[position + i] = static_cast<char>((length >> (8 * (HEADER_SIZE - 1 - i))) & 0xFFu);
+    }
+}
+
+/// \brief Presence or room record: u64 sequence or room, users
+void putUsers(std::string &out, RecordType type, uint64_t key, const wss::user_id_t *users, std::size_t count) {
+    const std::size_t position = beginRecord(out, type);
+    put<uint64_t>(out, key);
+    put<uint32_t>(out, static_cast<uint32_t>(count));
+    for (std::size_t i = 0; i < count; i++) {
+        put<uint64_t>(out, users[i]);
+    }
+    endRecord(out, position);
+}
+
+void putEmpty(std::string &out, RecordType type) {
+    endRecord(out, beginRecord(out, type));
+}
+
+void putMessage(std::string &out, const wss::user_id_t *recipients, std::size_t count, const std::string &envelope) {
+    const std::size_t position = beginRecord(out, RecordType::Message);
+    put<uint32_t>(out, static_cast<uint32_t>(count));
+    for (std::size_t i = 0; i < count; i++) {
+        put<uint64_t>(out, recipients[i]);
+    }
+    out.append(envelope);
+    endRecord(out, position);
+}
+
+}
+
+/// \brief Outgoing link to node: connects, reconnects with interval and writes buffered records
+class wss::ClusterBus::Link : public std::enable_shared_from_this<Link> {
+ public:
+    Link(wss::ClusterBus &bus, const Node &node) :
+        m_bus(bus),
+        m_node(node),
+        m_socket(bus.m_service),
+        m_timer(bus.m_service) { }
+
+    /// \brief Called by io thread
+    void connect() {
+        ErrorCode ec;
+        tcp::resolver resolver(m_bus.m_service);
+        auto it = resolver.resolve(tcp::resolver::query(m_node.address, std::to_string(m_node.port)), ec);
+        if (ec || it == tcp::resolver::iterator()) {
+            WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Can't resolve node %u address %s: %s",
+                      m_node.id, m_node.address.c_str(), ec.message().c_str());
+            scheduleReconnect();
+            return;
+        }
+
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            generation = ++m_generation;
+        }
+        auto self = shared_from_this();
+        m_socket.async_connect(*it, [self, generation](const ErrorCode &error) {
+          if (!self->isCurrent(generation)) {
+              return;
+          }
+          if (error) {
+              self->fail(error);
+              return;
+          }
+          self->onConnected(generation);
+        });
+    }
+
+    /// \brief Appends record to link buffer
+    /// \param resyncOnOverflow if record doesn't fit buffer, sync of all users is sent when buffer is written
+    /// \return false if link is not connected or buffer is full
+    bool append(const std::string &record, bool resyncOnOverflow = false) {
+        uint64_t generation = 0;
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            if (!m_connected) {
+                return false;
+            }
+            if (m_pending.size() + record.size() > m_bus.m_options.maxPendingBytes) {
+                m_resyncPending = m_resyncPending || resyncOnOverflow;
+                return false;
+            }
+            m_pending.append(record);
+            generation = startWriting();
+        }
+        post(generation);
+        return true;
+    }
+
+    bool isConnected() {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        return m_connected;
+    }
+
+    const Node &getNode() const {
+        return m_node;
+    }
+
+    /// \brief Sends all users of this node to node, after records buffered by now
+    void resync() {
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            if (!m_connected) {
+                // connect sends snapshot anyway
+                return;
+            }
+            m_resyncPending = true;
+            generation = startWriting();
+        }
+        post(generation);
+    }
+
+ private:
+    wss::ClusterBus &m_bus;
+    const Node m_node;
+    tcp::socket m_socket;
+    boost::asio::deadline_timer m_timer;
+    std::array<char, 64> m_readBuffer;
+    /// \brief Written right now, touched only by io thread
+    std::string m_sending;
+
+    std::mutex m_mutex;
+    /// \brief Incremented on every connect attempt and failure: callbacks of previous socket are ignored
+    uint64_t m_generation = 0;
+    bool m_connected = false;
+    bool m_writing = false;
+    /// \brief Sync of all users is appended by next write
+    bool m_resyncPending = false;
+    std::string m_pending;
+
+    /// \brief Link must be locked
+    /// \return generation to post write with, 0 if write is running already
+    uint64_t startWriting() {
+        if (m_writing) {
+            return 0;
+        }
+        m_writing = true;
+        return m_generation;
+    }
+
+    void post(uint64_t generation) {
+        if (generation == 0) {
+            return;
+        }
+        auto self = shared_from_this();
+        m_bus.m_service.post([self, generation] {
+          if (self->isCurrent(generation)) {
+              self->write(generation);
+          }
+        });
+    }
+
+    /// \brief Appends sync of all users and rooms of this node. Link must be locked: snapshot is taken under
+    /// link lock, so transitions appended after it are newer than snapshot
+    /// \return count of users
+    std::size_t putSnapshot(std::string &out) {
+        std::vector<wss::user_id_t> users;
+        const uint64_t sequence = m_bus.m_usersProvider ? m_bus.m_usersProvider(users) : 0;
+        putEmpty(out, RecordType::SyncBegin);
+        for (std::size_t offset = 0; offset < users.size(); offset += SNAPSHOT_CHUNK) {
+            putUsers(out, RecordType::Online, sequence, users.data() + offset,
+                     std::min(SNAPSHOT_CHUNK, users.size() - offset));
+        }
+        putEmpty(out, RecordType::SyncEnd);
+        if (m_bus.m_roomsProvider) {
+            m_bus.m_roomsProvider([&out](wss::room_id_t room, const wss::user_id_t *members, std::size_t count) {
+              for (std::size_t offset = 0; offset < count; offset += SNAPSHOT_CHUNK) {
+                  putUsers(out, RecordType::RoomJoin, room, members + offset,
+                           std::min(SNAPSHOT_CHUNK, count - offset));
+              }
+            });
+        }
+        return users.size();
+    }
+
+    bool isCurrent(uint64_t generation) {
+        std::lock_guard<std::mutex> locker(m_mutex);
+        return generation == m_generation;
+    }
+
+    void onConnected(uint64_t generation) {
+        ErrorCode ignored;
+        m_socket.set_option(tcp::no_delay(true), ignored);
+
+        std::string start;
+        const std::size_t position = beginRecord(start, RecordType::Hello);
+        put<uint16_t>(start, m_bus.m_options.nodeId);
+        put<uint16_t>(start, static_cast<uint16_t>(m_bus.m_options.secret.size()));
+        start.append(m_bus.m_options.secret);
+        endRecord(start, position);
+
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            const std::size_t users = putSnapshot(start);
+            m_pending = std::move(start);
+            m_connected = true;
+            m_writing = true;
+            m_resyncPending = false;
+            WSS_LOG_F(wss::logging::LevelInfo, "Cluster", "Connected to node %u (%s:%u), sent %lu users",
+                      m_node.id, m_node.address.c_str(), m_node.port, static_cast<unsigned long>(users));
+        }
+        m_bus.m_metrics.linksUp++;
+        write(generation);
+        watch(generation);
+    }
+
+    void write(uint64_t generation) {
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            if (m_resyncPending) {
+                m_resyncPending = false;
+                const std::size_t users = putSnapshot(m_pending);
+                m_bus.m_metrics.resyncs++;
+                WSS_LOG_F(wss::logging::LevelInfo, "Cluster", "Sending sync of %lu users to node %u",
+                          static_cast<unsigned long>(users), m_node.id);
+            }
+            m_sending.clear();
+            m_sending.swap(m_pending);
+        }
+        auto self = shared_from_this();
+        boost::asio::async_write(m_socket, boost::asio::buffer(m_sending),
+                                 [self, generation](const ErrorCode &error, std::size_t written) {
+                                   if (!self->isCurrent(generation)) {
+                                       return;
+                                   }
+                                   if (error) {
+                                       self->fail(error);
+                                       return;
+                                   }
+                                   self->m_bus.m_metrics.bytesOut += written;
+                                   {
+                                       std::lock_guard<std::mutex> locker(self->m_mutex);
+                                       if (self->m_pending.empty() && !self->m_resyncPending) {
+                                           self->m_writing = false;
+                                           return;
+                                       }
+                                   }
+                                   self->write(generation);
+                                 });
+    }
+
+    /// \brief Node never writes to this link: read completes only when it's closed
+    void watch(uint64_t generation) {
+        auto self = shared_from_this();
+        m_socket.async_read_some(boost::asio::buffer(m_readBuffer),
+                                 [self, generation](const ErrorCode &error, std::size_t) {
+                                   if (!self->isCurrent(generation)) {
+                                       return;
+                                   }
+                                   if (error) {
+                                       self->fail(error);
+                                       return;
+                                   }
+                                   self->watch(generation);
+                                 });
+    }
+
+    void fail(const ErrorCode &error) {
+        bool wasConnected;
+        std::size_t lost;
+        {
+            std::lock_guard<std::mutex> locker(m_mutex);
+            wasConnected = m_connected;
+            lost = m_pending.size() + m_sending.size();
+            m_connected = false;
+            m_writing = false;
+            m_resyncPending = false;
+            m_pending.clear();
+            m_generation++;
+        }
+        m_sending.clear();
+        ErrorCode ignored;
+        m_socket.close(ignored);
+        if (wasConnected) {
+            m_bus.m_metrics.linksUp--;
+            m_bus.m_metrics.lostBytes += lost;
+            WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Link to node %u is broken: %s, %lu bytes lost",
+                      m_node.id, error.message().c_str(), static_cast<unsigned long>(lost));
+        }
+        scheduleReconnect();
+    }
+
+    void scheduleReconnect() {
+        auto self = shared_from_this();
+        m_timer.expires_from_now(boost::posix_time::milliseconds(m_bus.m_options.reconnectMillis));
+        m_timer.async_wait([self](const ErrorCode &error) {
+          if (error) {
+              return;
+          }
+          self->m_bus.m_metrics.reconnects++;
+          self->connect();
+        });
+    }
+};
+
+/// \brief Incoming link from node: reads records
+class wss::ClusterBus::Session : public std::enable_shared_from_this<Session> {
+ public:
+    explicit Session(wss::ClusterBus &bus) :
+        m_bus(bus),
+        m_socket(bus.m_service) { }
+
+    tcp::socket &getSocket() {
+        return m_socket;
+    }
+
+    void start() {
+        readHeader();
+    }
+
+    /// \brief Closes socket without notifying bus: session is replaced by newer one of the same node
+    void detach() {
+        m_closed = true;
+        ErrorCode ignored;
+        m_socket.close(ignored);
+    }
+
+    /// \brief Sender node, 0 until hello is received
+    wss::node_id_t node = 0;
+    /// \brief Digests of node in a row, that differed from directory
+    unsigned mismatches = 0;
+
+ private:
+    wss::ClusterBus &m_bus;
+    tcp::socket m_socket;
+    std::array<char, HEADER_SIZE> m_header;
+    std::vector<char> m_body;
+    bool m_closed = false;
+
+    void readHeader() {
+        auto self = shared_from_this();
+        boost::asio::async_read(m_socket, boost::asio::buffer(m_header), [self](const ErrorCode &error, std::size_t) {
+          if (error) {
+              self->close();
+              return;
+          }
+          uint32_t length = 0;
+          for (char c: self->m_header) {
+              length = (length << 8) | static_cast<uint8_t>(c);
+          }
+          // unauthenticated peer doesn't make node allocate big buffer
+          const std::size_t maxLength = self->node == 0 ? MAX_HELLO_BYTES : self->m_bus.m_options.maxRecordBytes;
+          if (length == 0 || length > maxLength) {
+              WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Invalid record size %u from node %u",
+                        length, self->node);
+              self->close();
+              return;
+          }
+          self->m_body.resize(length);
+          self->readBody();
+        });
+    }
+
+    void readBody() {
+        auto self = shared_from_this();
+        boost::asio::async_read(m_socket, boost::asio::buffer(m_body), [self](const ErrorCode &error,
+                                                                             std::size_t read) {
+          if (error) {
+              self->close();
+              return;
+          }
+          self->m_bus.m_metrics.bytesIn += read + HEADER_SIZE;
+          try {
+              self->m_bus.onRecord(*self, static_cast<uint8_t>(self->m_body[0]),
+                                   self->m_body.data() + 1, self->m_body.size() - 1);
+          } catch (const std::exception &e) {
+              WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Invalid record from node %u: %s",
+                        self->node, e.what());
+              self->close();
+              return;
+          }
+          if (!self->m_closed) {
+              self->readHeader();
+          }
+        });
+    }
+
+    void close() {
+        if (m_closed) {
+            return;
+        }
+        m_closed = true;
+        ErrorCode ignored;
+        m_socket.close(ignored);
+        m_bus.onSessionClosed(shared_from_this());
+    }
+};
+
+wss::ClusterBus::ClusterBus(const Options &options) :
+    m_options(options),
+    m_acceptor(m_service),
+    m_digestTimer(m_service) {
+    if (m_options.nodeId == 0) {
+        throw std::invalid_argument("Node id must be in range 1..65535");
+    }
+    // peer, that knows secret, can inject users and messages: only loopback listener may go without it
+    ErrorCode ec;
+    const auto listenAddress = boost::asio::ip::address::from_string(m_options.address, ec);
+    if (m_options.secret.empty() && (ec || !listenAddress.is_loopback())) {
+        throw std::invalid_argument("Cluster secret is required to listen on " + m_options.address);
+    }
+    for (const auto &node: m_options.nodes) {
+        if (node.id == 0 || node.id == m_options.nodeId || m_links.count(node.id) != 0) {
+            throw std::invalid_argument("Node id " + std::to_string(node.id) + " is invalid or duplicated");
+        }
+        m_links.emplace(node.id, std::make_shared<Link>(*this, node));
+    }
+}
+
+wss::ClusterBus::~ClusterBus() {
+    stop();
+    join();
+}
+
+void wss::ClusterBus::setMessageHandler(MessageHandler handler) {
+    m_messageHandler = std::move(handler);
+}
+
+void wss::ClusterBus::setUsersProvider(UsersProvider provider) {
+    m_usersProvider = std::move(provider);
+}
+
+void wss::ClusterBus::setRoomHandler(RoomHandler handler) {
+    m_roomHandler = std::move(handler);
+}
+
+void wss::ClusterBus::setRoomsProvider(RoomsProvider provider) {
+    m_roomsProvider = std::move(provider);
+}
+
+void wss::ClusterBus::setHandoffHandler(HandoffHandler handler) {
+    m_handoffHandler = std::move(handler);
+}
+
+void wss::ClusterBus::start() {
+    try {
+        const tcp::endpoint endpoint(boost::asio::ip::address::from_string(m_options.address), m_options.port);
+        m_acceptor.open(endpoint.protocol());
+        m_acceptor.set_option(tcp::acceptor::reuse_address(true));
+        m_acceptor.bind(endpoint);
+        m_acceptor.listen();
+    } catch (const boost::system::system_error &e) {
+        throw std::runtime_error(
+            "can't listen " + m_options.address + ":" + std::to_string(m_options.port) + ": " + e.what());
+    }
+    accept();
+    scheduleDigest();
+    for (const auto &link: m_links) {
+        std::shared_ptr<Link> target = link.second;
+        m_service.post([target] {
+          target->connect();
+        });
+    }
+
+    m_work = std::make_unique<boost::asio::io_service::work>(m_service);
+    m_thread = std::make_unique<boost::thread>([this] {
+      m_service.run();
+    });
+    WSS_LOG_F(wss::logging::LevelInfo, "Cluster", "Node %u is listening for %lu node(s) at %s:%u",
+              m_options.nodeId, static_cast<unsigned long>(m_links.size()), m_options.address.c_str(),
+              m_options.port);
+}
+
+void wss::ClusterBus::stop() {
+    m_work.reset();
+    m_service.stop();
+}
+
+void wss::ClusterBus::join() {
+    if (m_thread && m_thread->joinable()) {
+        m_thread->join();
+    }
+}
+
+void wss::ClusterBus::accept() {
+    auto session = std::make_shared<Session>(*this);
+    m_acceptor.async_accept(session->getSocket(), [this, session](const ErrorCode &error) {
+      if (!m_acceptor.is_open() || error == boost::asio::error::operation_aborted) {
+          return;
+      }
+      if (!error) {
+          ErrorCode ignored;
+          session->getSocket().set_option(tcp::no_delay(true), ignored);
+          session->start();
+      }
+      accept();
+    });
+}
+
+void wss::ClusterBus::scheduleDigest() {
+    if (m_options.digestMillis <= 0 || m_links.empty()) {
+        return;
+    }
+    m_digestTimer.expires_from_now(boost::posix_time::milliseconds(m_options.digestMillis));
+    m_digestTimer.async_wait([this](const ErrorCode &error) {
+      if (error) {
+          return;
+      }
+      {
+          std::lock_guard<std::mutex> locker(m_presenceMutex);
+          std::string record;
+          const std::size_t position = beginRecord(record, RecordType::Digest);
+          put<uint64_t>(record, m_localDigest.count);
+          put<uint64_t>(record, m_localDigest.hash);
+          endRecord(record, position);
+          broadcast(record);
+      }
+      scheduleDigest();
+    });
+}
+
+void wss::ClusterBus::onSessionStarted(const std::shared_ptr<Session> &session) {
+    auto it = m_sessions.find(session->node);
+    if (it != m_sessions.end()) {
+        // node has reconnected before previous link was found broken
+        it->second->detach();
+    }
+    // snapshot of node follows hello
+    m_directory.removeNode(session->node);
+    m_sessions[session->node] = session;
+    WSS_LOG_F(wss::logging::LevelInfo, "Cluster", "Node %u has connected", session->node);
+}
+
+void wss::ClusterBus::onSessionClosed(const std::shared_ptr<Session> &session) {
+    if (session->node == 0) {
+        return;
+    }
+    auto it = m_sessions.find(session->node);
+    if (it == m_sessions.end() || it->second != session) {
+        return;
+    }
+    m_sessions.erase(it);
+    const std::size_t removed = m_directory.removeNode(session->node);
+    WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Node %u has disconnected, %lu users are unavailable",
+              session->node, static_cast<unsigned long>(removed));
+}
+
+void wss::ClusterBus::onRecord(Session &session, uint8_t type, const char *data, std::size_t length) {
+    RecordReader reader(data, length);
+    if (type == RecordType::Hello) {
+        const auto node = reader.get<wss::node_id_t>();
+        const auto secretLength = reader.get<uint16_t>();
+        std::size_t left;
+        const char *secret = reader.rest(left);
+        if (session.node != 0 || m_links.count(node) == 0) {
+            throw std::runtime_error("unexpected hello of node " + std::to_string(node));
+        }
+        // constant time, like jwt signature check
+        if (left != secretLength || left != m_options.secret.size()
+            || CRYPTO_memcmp(secret, m_options.secret.data(), left) != 0) {
+            throw std::runtime_error("invalid secret of node " + std::to_string(node));
+        }
+        session.node = node;
+        onSessionStarted(session.shared_from_this());
+        return;
+    }
+    if (session.node == 0) {
+        throw std::runtime_error("hello expected");
+    }
+
+    switch (type) {
+        case RecordType::Online:
+        case RecordType::Offline:
+        case RecordType::RoomJoin:
+        case RecordType::RoomLeave: {
+            const auto key = reader.get<uint64_t>();
+            const auto count = reader.get<uint32_t>();
+            if (reader.left() != static_cast<std::size_t>(count) * sizeof(uint64_t)) {
+                throw std::runtime_error("invalid users record");
+            }
+            std::vector<wss::user_id_t> users(count);
+            for (uint32_t i = 0; i < count; i++) {
+                users[i] = reader.get<uint64_t>();
+            }
+            if (type == RecordType::RoomJoin || type == RecordType::RoomLeave) {
+                if (m_roomHandler) {
+                    m_roomHandler(key, users.data(), users.size(), type == RecordType::RoomJoin);
+                }
+                break;
+            }
+            for (wss::user_id_t user: users) {
+                if (type == RecordType::Online) {
+                    m_directory.online(session.node, user, key);
+                } else {
+                    m_directory.offline(session.node, user, key);
+                }
+            }
+            break;
+        }
+        case RecordType::Message: {
+            const auto count = reader.get<uint32_t>();
+            if (reader.left() < static_cast<std::size_t>(count) * sizeof(uint64_t)) {
+                throw std::runtime_error("invalid message record");
+            }
+            std::vector<wss::user_id_t> recipients(count);
+            for (uint32_t i = 0; i < count; i++) {
+                recipients[i] = reader.get<uint64_t>();
+            }
+            std::size_t envelopeLength;
+            const char *envelope = reader.rest(envelopeLength);
+            // origin id is kept: delivery statuses and acks refer to it
+            auto payload = std::make_shared<const wss::MessagePayload>(
+                wss::MessagePayload::fromStoredBinary(envelope, envelopeLength));
+            if (!payload->isValid()) {
+                WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Invalid payload from node %u: %s",
+                          session.node, payload->getError().c_str());
+                break;
+            }
+            m_metrics.received++;
+            if (m_messageHandler) {
+                m_messageHandler(session.node, recipients.empty() ? nullptr : recipients.data(), count, payload);
+            }
+            break;
+        }
+        case RecordType::SyncBegin:
+            m_directory.beginSync(session.node);
+            session.mismatches = 0;
+            break;
+        case RecordType::SyncEnd: {
+            const std::size_t removed = m_directory.endSync(session.node);
+            if (removed != 0) {
+                WSS_LOG_F(wss::logging::LevelInfo, "Cluster", "Sync of node %u has removed %lu stale users",
+                          session.node, static_cast<unsigned long>(removed));
+            }
+            break;
+        }
+        case RecordType::Digest: {
+            wss::ClusterDirectory::Digest digest;
+            digest.count = reader.get<uint64_t>();
+            digest.hash = reader.get<uint64_t>();
+            if (digest == m_directory.getDigest(session.node)) {
+                session.mismatches = 0;
+                break;
+            }
+            if (++session.mismatches < DIGEST_MISMATCHES) {
+                break;
+            }
+            session.mismatches = 0;
+            WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Users of node %u differ from its digest, requesting sync",
+                      session.node);
+            std::string record;
+            putEmpty(record, RecordType::SyncRequest);
+            // sessions are started only by configured nodes
+            m_links.at(session.node)->append(record);
+            break;
+        }
+        case RecordType::SyncRequest:
+            m_links.at(session.node)->resync();
+            break;
+        case RecordType::Handoff: {
+            const auto id = reader.get<uint64_t>();
+            std::size_t bodyLength;
+            const char *body = reader.rest(bodyLength);
+            if (m_handoffHandler) {
+                m_handoffHandler(session.node, id, body, bodyLength);
+            }
+            break;
+        }
+        case RecordType::HandoffAck: {
+            const auto id = reader.get<uint64_t>();
+            {
+                std::lock_guard<std::mutex> locker(m_handoffMutex);
+                // sender could stop waiting already
+                const auto pending = m_handoffPending.find(id);
+                if (pending == m_handoffPending.end()) {
+                    break;
+                }
+                pending->second = true;
+            }
+            m_handoffAcked.notify_all();
+            break;
+        }
+        default:
+            throw std::runtime_error("unknown record type " + std::to_string(type));
+    }
+}
+
+void wss::ClusterBus::broadcast(const std::string &record, bool resyncOnOverflow) {
+    for (const auto &link: m_links) {
+        link.second->append(record, resyncOnOverflow);
+    }
+}
+
+void wss::ClusterBus::notifyPresence(wss::user_id_t user, bool online, uint64_t sequence) {
+    std::string record;
+    putUsers(record, online ? RecordType::Online : RecordType::Offline, sequence, &user, 1);
+    // digest and records are changed together: digest sent after them describes all of them
+    std::lock_guard<std::mutex> locker(m_presenceMutex);
+    if (online) {
+        m_localDigest.add(user);
+    } else {
+        m_localDigest.remove(user);
+    }
+    broadcast(record, true);
+}
+
+void wss::ClusterBus::notifyRoom(wss::room_id_t room, wss::user_id_t user, bool joined) {
+    std::string record;
+    putUsers(record, joined ? RecordType::RoomJoin : RecordType::RoomLeave, room, &user, 1);
+    // sync repeats rooms joins, but not leaves
+    broadcast(record, true);
+}
+
+void wss::ClusterBus::notifyMissing(wss::node_id_t node,
+                                    const wss::user_id_t *users,
+                                    std::size_t count,
+                                    uint64_t sequence) {
+    const auto link = m_links.find(node);
+    if (link == m_links.end() || count == 0) {
+        return;
+    }
+    std::string record;
+    putUsers(record, RecordType::Offline, sequence, users, count);
+    link->second->append(record);
+}
+
+void wss::ClusterBus::route(const wss::user_id_t *recipients,
+                            std::size_t count,
+                            wss::user_id_t exclude,
+                            const wss::MessagePayloadPtr &payload,
+                            std::vector<wss::user_id_t> &forwarded) {
+    forwarded.clear();
+    std::vector<wss::ClusterDirectory::Route> routes;
+    std::vector<wss::user_id_t> missing;
+    m_directory.locate(recipients, count, routes, missing);
+    if (routes.empty()) {
+        return;
+    }
+
+    std::string record;
+    for (auto &route: routes) {
+        if (exclude != 0) {
+            route.users.erase(std::remove(route.users.begin(), route.users.end(), exclude), route.users.end());
+        }
+        if (route.users.empty()) {
+            continue;
+        }
+        const auto link = m_links.find(route.node);
+        record.clear();
+        try {
+            // envelope is serialized once and cached by payload for all nodes
+            putMessage(record, route.users.data(), route.users.size(), payload->toBinary());
+        } catch (const std::exception &e) {
+            WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Can't forward message: %s", e.what());
+            m_metrics.unroutable += route.users.size();
+            continue;
+        }
+        if (link == m_links.end() || !link->second->append(record)) {
+            m_metrics.unroutable += route.users.size();
+            continue;
+        }
+        m_metrics.forwarded++;
+        m_metrics.forwardedRecipients += route.users.size();
+        forwarded.insert(forwarded.end(), route.users.begin(), route.users.end());
+    }
+    std::sort(forwarded.begin(), forwarded.end());
+    forwarded.erase(std::unique(forwarded.begin(), forwarded.end()), forwarded.end());
+}
+
+void wss::ClusterBus::publish(const wss::MessagePayloadPtr &payload) {
+    if (m_links.empty()) {
+        return;
+    }
+    std::string record;
+    try {
+        putMessage(record, nullptr, 0, payload->toBinary());
+    } catch (const std::exception &e) {
+        WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Can't forward topic message: %s", e.what());
+        return;
+    }
+    broadcast(record);
+}
+
+bool wss::ClusterBus::sendHandoff(wss::node_id_t node, const std::string &body, long timeoutMillis) {
+    const auto link = m_links.find(node);
+    if (link == m_links.end()) {
+        return false;
+    }
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> locker(m_handoffMutex);
+        id = ++m_handoffId;
+        m_handoffPending[id] = false;
+    }
+    std::string record;
+    const std::size_t position = beginRecord(record, RecordType::Handoff);
+    put<uint64_t>(record, id);
+    record.append(body);
+    endRecord(record, position);
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMillis);
+    bool appended;
+    while (!(appended = link->second->append(record))) {
+        if (!link->second->isConnected() || std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+        // buffer is written by io thread
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+
+    std::unique_lock<std::mutex> locker(m_handoffMutex);
+    // dropped link is checked on every wake up: ack can't come by it anymore
+    while (appended && !m_handoffPending.at(id)) {
+        const auto now = std::chrono::steady_clock::now();
+        if (now >= deadline || !link->second->isConnected()) {
+            break;
+        }
+        m_handoffAcked.wait_until(locker, std::min(deadline, now + std::chrono::milliseconds(50)));
+    }
+    const bool acked = m_handoffPending.at(id);
+    m_handoffPending.erase(id);
+    return acked;
+}
+
+void wss::ClusterBus::ackHandoff(wss::node_id_t node, uint64_t id) {
+    const auto link = m_links.find(node);
+    if (link == m_links.end()) {
+        return;
+    }
+    std::string record;
+    const std::size_t position = beginRecord(record, RecordType::HandoffAck);
+    put<uint64_t>(record, id);
+    endRecord(record, position);
+    link->second->append(record);
+}
+
+std::vector<wss::node_id_t> wss::ClusterBus::getConnectedNodes() const {
+    std::vector<wss::node_id_t> out;
+    for (const auto &link: m_links) {
+        if (link.second->isConnected()) {
+            out.push_back(link.first);
+        }
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
+
+const wss::ClusterBus::Node *wss::ClusterBus::getNode(wss::node_id_t node) const {
+    const auto link = m_links.find(node);
+    return link == m_links.end() ? nullptr : &link->second->getNode();
+}
+
+wss::node_id_t wss::ClusterBus::getNodeId() const noexcept {
+    return m_options.nodeId;
+}
+
+const wss::ClusterDirectory &wss::ClusterBus::getDirectory() const {
+    return m_directory;
+}
+
+const wss::ClusterMetrics &wss::ClusterBus::getMetrics() const {
+    return m_metrics;
+}
@@ -0,0 +1,247 @@
+/**
+ * wsserver
+ * ClusterBus.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_CLUSTERBUS_H
+#define WSSERVER_CLUSTERBUS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/thread.hpp>
+#include "ClusterDirectory.h"
+#include "Message.h"
+#include "../wsserver_core.h"
+
+namespace wss {
+
+/// \brief Inter-node links counters
+struct ClusterMetrics {
+  /// \brief Outgoing links connected right now
+  std::atomic<uint64_t> linksUp{0};
+  /// \brief Outgoing link reconnects after failure
+  std::atomic<uint64_t> reconnects{0};
+  /// \brief Messages forwarded to nodes (one per node, not per recipient)
+  std::atomic<uint64_t> forwarded{0};
+  /// \brief Recipients of forwarded messages
+  std::atomic<uint64_t> forwardedRecipients{0};
+  /// \brief Messages received from nodes
+  std::atomic<uint64_t> received{0};
+  /// \brief Remote recipients that were not forwarded: link is down or its send buffer is full
+  std::atomic<uint64_t> unroutable{0};
+  /// \brief Buffered bytes lost when link was broken
+  std::atomic<uint64_t> lostBytes{0};
+  /// \brief Syncs of all users sent to nodes: requested by node after digest mismatch, or sent because
+  /// presence transition didn't fit link buffer
+  std::atomic<uint64_t> resyncs{0};
+  std::atomic<uint64_t> bytesOut{0};
+  std::atomic<uint64_t> bytesIn{0};
+};
+
+/// \brief Cluster mode: persistent links between chat nodes, that replicate users locations and carry
+/// messages for users connected to other nodes.
+/// Every node listens for peers and keeps one outgoing link to each of them: outgoing link only writes,
+/// incoming only reads. Record: u32 length (big endian, of type and body), u8 type, body.
+/// Link starts with hello (node id, secret) and snapshot of node users, then presence transitions follow.
+/// Users of node are dropped from ClusterDirectory of peer when that link is closed.
+/// Every link also carries digest of node users periodically (anti-entropy): peer, that has other digest of
+/// that node twice in a row, requests sync of all users (transitions lost on full buffer or reordered by threads
+/// are repaired). Sync is also sent without request, when presence transition didn't fit link buffer.
+/// Rooms membership is shared: joins and leaves are sent to all nodes, and every link starts with all rooms
+/// known to node, that are merged by peer (member left while node was unreachable can come back).
+/// Message carries recipients hosted by target node and binary envelope of payload (MessagePayload::toBinary()),
+/// so group message is sent only to nodes hosting room members, once per node.
+/// Records are appended to link buffer by any thread, and written by single io thread:
+/// everything appended while previous write is running goes with next write (batching without timer).
+/// Delivery between nodes is at most once: buffered records of broken link are lost (see ClusterMetrics::lostBytes)
+class ClusterBus {
+ public:
+    struct Node {
+      wss::node_id_t id;
+      std::string address;
+      unsigned short port;
+      /// \brief Where clients of node connect, optional: reconnect hint of handoff
+      std::string url;
+    };
+
+    struct Options {
+      /// \brief This node id, 1..65535, unique in cluster
+      wss::node_id_t nodeId = 0;
+      /// \brief Listen address for peers
+      std::string address = "0.0.0.0";
+      unsigned short port = 0;
+      /// \brief Other nodes of cluster, without this one
+      std::vector<Node> nodes;
+      /// \brief Shared by all nodes, connections with other secret are closed. Links are not encrypted,
+      /// cluster port must be reachable only from private network. Required, unless address is loopback one
+      std::string secret;
+      /// \brief Buffered bytes per link, when reached, messages for node are not forwarded
+      std::size_t maxPendingBytes = 64 * 1024 * 1024;
+      /// \brief Incoming records above this size close link. Records before hello are limited to 4KB
+      std::size_t maxRecordBytes = 64 * 1024 * 1024;
+      long reconnectMillis = 1000;
+      /// \brief How often digest of node users is sent to nodes, 0 - never
+      long digestMillis = 30000;
+    };
+
+    /// \brief Message received from node
+    /// \param from sender node
+    /// \param recipients local recipients, nullptr and 0 for topic message, that is published to all nodes
+    using MessageHandler = std::function<void(wss::node_id_t from,
+                                              const wss::user_id_t *recipients,
+                                              std::size_t count,
+                                              const wss::MessagePayloadPtr &payload)>;
+    /// \brief Lists users of this node, for snapshot of new link
+    /// \param out users
+    /// \return presence sequence, taken before listing
+    using UsersProvider = std::function<uint64_t(std::vector<wss::user_id_t> &out)>;
+    /// \brief Room members have joined or left on other node
+    using RoomHandler = std::function<void(wss::room_id_t room,
+                                           const wss::user_id_t *users,
+                                           std::size_t count,
+                                           bool joined)>;
+    using RoomVisitor = std::function<void(wss::room_id_t room, const wss::user_id_t *members, std::size_t count)>;
+    /// \brief Visits all rooms of this node, for snapshot of new link
+    using RoomsProvider = std::function<void(const RoomVisitor &visitor)>;
+    /// \brief State of users, that node hands off before it stops. Body is opaque for bus.
+    /// Handler calls ackHandoff() with id, once body is applied
+    using HandoffHandler = std::function<void(wss::node_id_t from,
+                                              uint64_t id,
+                                              const char *data,
+                                              std::size_t length)>;
+
+    /// \throws std::invalid_argument if node ids are invalid or duplicated, or secret is empty while
+    /// address isn't loopback one
+    explicit ClusterBus(const Options &options);
+    ClusterBus(const ClusterBus &other) = delete;
+    ClusterBus(ClusterBus &&other) = delete;
+    ~ClusterBus();
+
+    /// \brief Must be set before start()
+    void setMessageHandler(MessageHandler handler);
+    /// \brief Must be set before start()
+    void setUsersProvider(UsersProvider provider);
+    /// \brief Must be set before start()
+    void setRoomHandler(RoomHandler handler);
+    /// \brief Must be set before start()
+    void setRoomsProvider(RoomsProvider provider);
+    /// \brief Must be set before start()
+    void setHandoffHandler(HandoffHandler handler);
+
+    /// \brief Opens listener, starts io thread and connects to nodes
+    /// \throws std::runtime_error if listener can't be opened
+    void start();
+    void stop();
+    void join();
+
+    /// \brief Sends presence transition of local user to all nodes
+    void notifyPresence(wss::user_id_t user, bool online, uint64_t sequence);
+
+    /// \brief Sends room membership change to all nodes
+    void notifyRoom(wss::room_id_t room, wss::user_id_t user, bool joined);
+
+    /// \brief Tells node, that users it has sent message to are not connected here
+    /// \param node
+    /// \param users
+    /// \param count
+    /// \param sequence local presence sequence, taken before users were looked up
+    void notifyMissing(wss::node_id_t node, const wss::user_id_t *users, std::size_t count, uint64_t sequence);
+
+    /// \brief Forwards payload to nodes hosting recipients
+    /// \param recipients
+    /// \param count
+    /// \param exclude recipient to skip, 0 - none
+    /// \param payload
+    /// \param forwarded recipients forwarded to at least one node, sorted, previous content is cleared
+    void route(const wss::user_id_t *recipients,
+               std::size_t count,
+               wss::user_id_t exclude,
+               const wss::MessagePayloadPtr &payload,
+               std::vector<wss::user_id_t> &forwarded);
+
+    /// \brief Forwards topic payload to all nodes: subscriptions are not replicated
+    /// \param payload
+    void publish(const wss::MessagePayloadPtr &payload);
+
+    /// \brief Sends handoff body to node and waits until node acks it. Blocks caller
+    /// \param node
+    /// \param body
+    /// \param timeoutMillis max wait for buffer space and ack
+    /// \return false if link is down, or body isn't acked in time: node may still apply it
+    bool sendHandoff(wss::node_id_t node, const std::string &body, long timeoutMillis);
+
+    /// \brief Tells node, that its handoff body is applied
+    /// \param node sender of body
+    /// \param id passed to HandoffHandler
+    void ackHandoff(wss::node_id_t node, uint64_t id);
+
+    /// \brief Nodes with connected outgoing link
+    /// \return sorted ids
+    std::vector<wss::node_id_t> getConnectedNodes() const;
+
+    /// \brief Configured node, nullptr if it's unknown
+    /// \param node
+    /// \return
+    const Node *getNode(wss::node_id_t node) const;
+
+    wss::node_id_t getNodeId() const noexcept;
+    const wss::ClusterDirectory &getDirectory() const;
+    const wss::ClusterMetrics &getMetrics() const;
+
+ private:
+    class Link;
+    class Session;
+
+    const Options m_options;
+    boost::asio::io_service m_service;
+    std::unique_ptr<boost::asio::io_service::work> m_work;
+    std::unique_ptr<boost::thread> m_thread;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    boost::asio::deadline_timer m_digestTimer;
+    std::unordered_map<wss::node_id_t, std::shared_ptr<Link>> m_links;
+    /// \brief Current incoming session of node. Touched only by io thread
+    std::unordered_map<wss::node_id_t, std::shared_ptr<Session>> m_sessions;
+    MessageHandler m_messageHandler;
+    UsersProvider m_usersProvider;
+    RoomHandler m_roomHandler;
+    RoomsProvider m_roomsProvider;
+    HandoffHandler m_handoffHandler;
+    wss::ClusterDirectory m_directory;
+    wss::ClusterMetrics m_metrics;
+    /// \brief Orders presence records and digests on all links
+    std::mutex m_presenceMutex;
+    /// \brief Local users, as they were sent by presence transitions
+    wss::ClusterDirectory::Digest m_localDigest;
+    /// \brief Guards handoff ids and acks
+    std::mutex m_handoffMutex;
+    std::condition_variable m_handoffAcked;
+    uint64_t m_handoffId = 0;
+    /// \brief Ids of sent handoff bodies, that sender waits for, and whether they are acked
+    std::unordered_map<uint64_t, bool> m_handoffPending;
+
+    void accept();
+    void scheduleDigest();
+    /// \brief Session has sent hello: previous session of the same node is replaced
+    void onSessionStarted(const std::shared_ptr<Session> &session);
+    void onSessionClosed(const std::shared_ptr<Session> &session);
+    void onRecord(Session &session, uint8_t type, const char *data, std::size_t length);
+    /// \brief Appends record to all links, that are connected
+    /// \param resyncOnOverflow see Link::append()
+    void broadcast(const std::string &record, bool resyncOnOverflow = false);
+};
+
+}
+
+#endif //WSSERVER_CLUSTERBUS_H
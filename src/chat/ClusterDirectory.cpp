@@ -0,0 +1,163 @@
+/**
+ * wsserver
+ * ClusterDirectory.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "ClusterDirectory.h"
+#include <algorithm>
+
+void wss::ClusterDirectory::online(wss::node_id_t node, wss::user_id_t user, uint64_t sequence) {
+    Shard &shard = getShard(user);
+    std::lock_guard<std::mutex> locker(shard.mutex);
+    Locations &locations = shard.users[user];
+    const uint32_t epoch = getEpoch(node);
+    for (auto &location: locations) {
+        if (location.node == node) {
+            location.sequence = std::max(location.sequence, sequence);
+            location.epoch = epoch;
+            return;
+        }
+    }
+    locations.push_back({node, sequence, epoch});
+    std::lock_guard<std::mutex> nodesLocker(m_nodesMutex);
+    m_nodes[node].digest.add(user);
+}
+
+void wss::ClusterDirectory::offline(wss::node_id_t node, wss::user_id_t user, uint64_t sequence) {
+    Shard &shard = getShard(user);
+    std::lock_guard<std::mutex> locker(shard.mutex);
+    auto it = shard.users.find(user);
+    if (it == shard.users.end()) {
+        return;
+    }
+    for (const auto &location: it->second) {
+        if (location.node == node && location.sequence > sequence) {
+            // user has connected again: this transition was delivered out of order
+            return;
+        }
+    }
+    if (eraseNode(it->second, user, node) && it->second.empty()) {
+        shard.users.erase(it);
+    }
+}
+
+std::size_t wss::ClusterDirectory::removeNode(wss::node_id_t node) {
+    std::size_t removed = 0;
+    for (auto &shard: m_shards) {
+        std::lock_guard<std::mutex> locker(shard.mutex);
+        for (auto it = shard.users.begin(); it != shard.users.end();) {
+            if (eraseNode(it->second, it->first, node)) {
+                removed++;
+            }
+            if (it->second.empty()) {
+                it = shard.users.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    std::lock_guard<std::mutex> nodesLocker(m_nodesMutex);
+    m_nodes.erase(node);
+    return removed;
+}
+
+void wss::ClusterDirectory::beginSync(wss::node_id_t node) {
+    std::lock_guard<std::mutex> nodesLocker(m_nodesMutex);
+    m_nodes[node].epoch++;
+}
+
+std::size_t wss::ClusterDirectory::endSync(wss::node_id_t node) {
+    std::size_t removed = 0;
+    for (auto &shard: m_shards) {
+        std::lock_guard<std::mutex> locker(shard.mutex);
+        const uint32_t epoch = getEpoch(node);
+        for (auto it = shard.users.begin(); it != shard.users.end();) {
+            if (eraseNode(it->second, it->first, node, epoch)) {
+                removed++;
+            }
+            if (it->second.empty()) {
+                it = shard.users.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    return removed;
+}
+
+wss::ClusterDirectory::Digest wss::ClusterDirectory::getDigest(wss::node_id_t node) const {
+    std::lock_guard<std::mutex> nodesLocker(m_nodesMutex);
+    const auto it = m_nodes.find(node);
+    return it == m_nodes.end() ? Digest() : it->second.digest;
+}
+
+void wss::ClusterDirectory::locate(const wss::user_id_t *users,
+                                   std::size_t count,
+                                   std::vector<Route> &routes,
+                                   std::vector<wss::user_id_t> &missing) const {
+    routes.clear();
+    missing.clear();
+    for (std::size_t i = 0; i < count; i++) {
+        const Shard &shard = getShard(users[i]);
+        std::lock_guard<std::mutex> locker(shard.mutex);
+        const auto it = shard.users.find(users[i]);
+        if (it == shard.users.end()) {
+            missing.push_back(users[i]);
+            continue;
+        }
+        for (const auto &location: it->second) {
+            // few nodes per message: linear search is cheaper than map
+            auto route = std::find_if(routes.begin(), routes.end(), [&location](const Route &item) {
+              return item.node == location.node;
+            });
+            if (route == routes.end()) {
+                routes.push_back(Route{location.node, {}});
+                route = routes.end() - 1;
+            }
+            route->users.push_back(users[i]);
+        }
+    }
+}
+
+bool wss::ClusterDirectory::exists(wss::user_id_t user) const {
+    const Shard &shard = getShard(user);
+    std::lock_guard<std::mutex> locker(shard.mutex);
+    return shard.users.find(user) != shard.users.end();
+}
+
+std::size_t wss::ClusterDirectory::size() const {
+    std::size_t out = 0;
+    for (const auto &shard: m_shards) {
+        std::lock_guard<std::mutex> locker(shard.mutex);
+        out += shard.users.size();
+    }
+    return out;
+}
+
+bool wss::ClusterDirectory::eraseNode(Locations &locations,
+                                      wss::user_id_t user,
+                                      wss::node_id_t node,
+                                      uint32_t keepEpoch) {
+    Locations left;
+    for (const auto &location: locations) {
+        if (location.node != node || location.epoch == keepEpoch) {
+            left.push_back(location);
+        }
+    }
+    if (left.size() == locations.size()) {
+        return false;
+    }
+    locations = std::move(left);
+    std::lock_guard<std::mutex> nodesLocker(m_nodesMutex);
+    m_nodes[node].digest.remove(user);
+    return true;
+}
+
+uint32_t wss::ClusterDirectory::getEpoch(wss::node_id_t node) const {
+    std::lock_guard<std::mutex> nodesLocker(m_nodesMutex);
+    const auto it = m_nodes.find(node);
+    return it == m_nodes.end() ? 0 : it->second.epoch;
+}
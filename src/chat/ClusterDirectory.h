@@ -0,0 +1,164 @@
+/**
+ * wsserver
+ * ClusterDirectory.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_CLUSTERDIRECTORY_H
+#define WSSERVER_CLUSTERDIRECTORY_H
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "small_vector.hpp"
+#include "../wsserver_core.h"
+
+namespace wss {
+
+using node_id_t = uint16_t;
+
+/// \brief Locations of users connected to other cluster nodes: user -> nodes.
+/// Filled by presence transitions and snapshots received from nodes (see ClusterBus), entries of node are
+/// dropped when its link is closed. Transitions carry node presence sequence: offline that is older than
+/// known online of the same node is ignored, so reordered transitions don't hide online user.
+/// Every node entries are summarized by digest (count and xor of users hashes), updated with entries: node
+/// sends digest of its own users from time to time, and when they differ, whole node users are synced again
+/// (beginSync()/endSync() drop entries that were not repeated by sync).
+/// Users are split into shards by id, like ConnectionStorage.
+class ClusterDirectory {
+ public:
+    static constexpr std::size_t SHARDS = 64;
+
+    /// \brief Remote recipients of one node
+    struct Route {
+      wss::node_id_t node;
+      std::vector<wss::user_id_t> users;
+    };
+
+    /// \brief Order independent summary of users set
+    struct Digest {
+      uint64_t count = 0;
+      uint64_t hash = 0;
+
+      void add(wss::user_id_t user) noexcept {
+          count++;
+          hash ^= hashOf(user);
+      }
+      void remove(wss::user_id_t user) noexcept {
+          count--;
+          hash ^= hashOf(user);
+      }
+      bool operator==(const Digest &other) const noexcept {
+          return count == other.count && hash == other.hash;
+      }
+      bool operator!=(const Digest &other) const noexcept {
+          return !(*this == other);
+      }
+    };
+
+    /// \brief Mixes user id bits (splitmix64 finalizer), so xor of sequential ids doesn't collide
+    static uint64_t hashOf(wss::user_id_t user) noexcept {
+        uint64_t x = static_cast<uint64_t>(user) + 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30u)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27u)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31u);
+    }
+
+    ClusterDirectory() = default;
+    ClusterDirectory(const ClusterDirectory &other) = delete;
+    ClusterDirectory(ClusterDirectory &&other) = delete;
+
+    /// \brief User has connected to node
+    /// \param node
+    /// \param user
+    /// \param sequence node presence sequence of transition
+    void online(wss::node_id_t node, wss::user_id_t user, uint64_t sequence);
+
+    /// \brief User has disconnected from node, or node hasn't found it's connections
+    /// \param node
+    /// \param user
+    /// \param sequence ignored if online of this user on node has greater sequence
+    void offline(wss::node_id_t node, wss::user_id_t user, uint64_t sequence);
+
+    /// \brief Forget all users of node
+    /// \param node
+    /// \return removed locations
+    std::size_t removeNode(wss::node_id_t node);
+
+    /// \brief Node starts sending all its users again: entries received before are kept until endSync()
+    /// \param node
+    void beginSync(wss::node_id_t node);
+
+    /// \brief Node has sent all its users: drops entries, that were not sent after beginSync()
+    /// \param node
+    /// \return removed locations
+    std::size_t endSync(wss::node_id_t node);
+
+    /// \brief Summary of node entries, to compare with digest sent by node
+    /// \param node
+    /// \return
+    Digest getDigest(wss::node_id_t node) const;
+
+    /// \brief Groups users by nodes they are connected to. User connected to many nodes goes to every route
+    /// \param users
+    /// \param count
+    /// \param routes previous content is cleared
+    /// \param missing users without remote location, previous content is cleared
+    void locate(const wss::user_id_t *users,
+                std::size_t count,
+                std::vector<Route> &routes,
+                std::vector<wss::user_id_t> &missing) const;
+
+    /// \brief Check user is connected to any other node
+    /// \param user
+    /// \return
+    bool exists(wss::user_id_t user) const;
+
+    /// \brief Count of remote users
+    /// \return
+    std::size_t size() const;
+
+ private:
+    struct Location {
+      wss::node_id_t node;
+      uint64_t sequence;
+      /// \brief Node sync epoch, when location was received last time
+      uint32_t epoch;
+    };
+    struct NodeState {
+      Digest digest;
+      uint32_t epoch = 0;
+    };
+    using Locations = wss::utils::SmallVector<Location, 2>;
+    struct Shard {
+      mutable std::mutex mutex;
+      std::unordered_map<wss::user_id_t, Locations> users;
+    };
+    std::array<Shard, SHARDS> m_shards;
+    /// \brief Locked after shard lock
+    mutable std::mutex m_nodesMutex;
+    std::unordered_map<wss::node_id_t, NodeState> m_nodes;
+
+    Shard &getShard(wss::user_id_t id) noexcept {
+        return m_shards[id & (SHARDS - 1)];
+    }
+    const Shard &getShard(wss::user_id_t id) const noexcept {
+        return m_shards[id & (SHARDS - 1)];
+    }
+
+    static constexpr uint32_t ANY_EPOCH = UINT32_MAX;
+
+    /// \brief Removes node from locations of user and updates node digest. Shard must be locked
+    /// \param keepEpoch location received in this sync epoch is kept, ANY_EPOCH - removed anyway
+    /// \return true if node was removed
+    bool eraseNode(Locations &locations, wss::user_id_t user, wss::node_id_t node, uint32_t keepEpoch = ANY_EPOCH);
+    uint32_t getEpoch(wss::node_id_t node) const;
+};
+
+}
+
+#endif //WSSERVER_CLUSTERDIRECTORY_H
@@ -7,182 +7,425 @@
  */
 
 #include "ConnectionStorage.h"
+#include <algorithm>
 #include <fmt/format.h>
+#include "../base/Hotpath.h"
+#include "../helpers/logging.h"
+
+constexpr std::size_t wss::ConnectionStorage::SHARDS;
+
+namespace {
+using ShardWriteLock = wss::hotpath::ProfiledLock<std::unique_lock<std::shared_timed_mutex>,
+                                                  wss::hotpath::LockSite::Connections>;
+using ShardReadLock = wss::hotpath::ProfiledLock<std::shared_lock<std::shared_timed_mutex>,
+                                                 wss::hotpath::LockSite::Connections>;
+}
 
 wss::ConnectionStorage::~ConnectionStorage() {
-    for (auto &kv: m_idMap) {
-        for (const auto &c: kv.second) {
-            try {
-                c.second->sendClose(1000, "Server Gone Away");
-            } catch (...) {
+    for (auto &shard: m_shards) {
+        ShardWriteLock locker(shard.mutex);
+        shard.idMap.forEach([](wss::user_id_t, Connections &connections) {
+          for (std::size_t i = 0; i < connections.size(); i++) {
+              try {
+                  if (connections[i].second) {
+                      connections[i].second->sendClose(1000, "Server Gone Away");
+                  }
+              } catch (...) {
 
-            }
-        }
+              }
+          }
+        });
+        shard.idMap.clear();
+    }
+}
+void wss::ConnectionStorage::setPresenceHandler(wss::ConnectionStorage::PresenceHandler handler) {
+    m_presenceHandler = std::move(handler);
+}
+uint64_t wss::ConnectionStorage::getPresenceSequence() const noexcept {
+    return m_presenceSequence;
+}
+void wss::ConnectionStorage::setPresenceSequence(uint64_t sequence) noexcept {
+    m_presenceSequence = sequence;
+}
+wss::ConnectionStorage::PresenceEvent wss::ConnectionStorage::createPresenceEvent(wss::user_id_t id, bool online) {
+    return PresenceEvent{id, online, ++m_presenceSequence};
+}
+void wss::ConnectionStorage::notifyPresence(const wss::ConnectionStorage::PresenceEvent &event) {
+    if (event.user == 0 || m_presenceHandler == nullptr) {
+        return;
+    }
+    try {
+        m_presenceHandler(event);
+    } catch (const std::exception &e) {
+        Logger::get().warning(__FILE__, __LINE__, "Connection::Presence", fmt::format("Unknown error: {0}", e.what()));
     }
-    m_idMap.clear();
 }
 bool wss::ConnectionStorage::exists(wss::user_id_t id) const {
-    // мы проверяем только наличие мапы, но есть ли такое содениение с уникальным айдишником - нет, тут баг
-    std::lock_guard<std::recursive_mutex> locker(m_connectionMutex);
-    return m_idMap.find(id) != m_idMap.end();
-}
-bool wss::ConnectionStorage::verify(uint8_t pingFlag) {
-    std::lock_guard<std::recursive_mutex> locker(m_connectionMutex);
-    for (const std::pair<user_id_t, std::unordered_map<conn_id_t, WsConnectionPtr>> &t: m_idMap) {
-        for (const auto &conn: t.second) {
-            if (!conn.second) {
-
-                // haha deadlock? i hope no
-                remove(t.first, conn.first);
-                continue;
-            }
+    if (wss::utils::PresenceBitmap::covers(id)) {
+        return m_presence.test(id);
+    }
+    // user map is removed with last user connection
+    const Shard &shard = getShard(id);
+    ShardReadLock locker(shard.mutex);
+    return shard.idMap.find(id) != nullptr;
+}
+void wss::ConnectionStorage::exists(const wss::user_id_t *ids, std::size_t count, std::vector<bool> &out) const {
+    out.assign(count, false);
 
-            auto pingStream = std::make_shared<WsMessageStream>();
-            *pingStream << ".";
-            conn.second
-                ->send(std::move(pingStream), [conn, this](const wss::server::websocket::ErrorCode &err, std::size_t) {
-                  if (err) {
-                      // does not matter, what happens, anyway, this mean connection is bad, broken pipe, eof or something else
-                      remove(conn.second);
-                  } else {
-                      // lazy ping pong
-                      markPongWait(conn.second);
-                  }
-                }, pingFlag);
+    // positions of ids, that bitmap doesn't cover
+    std::vector<std::size_t> uncovered;
+    for (std::size_t i = 0; i < count; i++) {
+        if (wss::utils::PresenceBitmap::covers(ids[i])) {
+            out[i] = ids[i] != 0 && m_presence.test(ids[i]);
+        } else {
+            uncovered.push_back(i);
+        }
+    }
+    if (uncovered.empty()) {
+        return;
+    }
+
+    // counting sort of positions by shard, same as resolve()
+    std::array<std::size_t, SHARDS + 1> offsets{};
+    for (std::size_t position: uncovered) {
+        offsets[(ids[position] & (SHARDS - 1)) + 1]++;
+    }
+    for (std::size_t s = 0; s < SHARDS; s++) {
+        offsets[s + 1] += offsets[s];
+    }
+    std::vector<std::size_t> ordered(uncovered.size());
+    {
+        std::array<std::size_t, SHARDS> cursor;
+        std::copy(offsets.begin(), offsets.end() - 1, cursor.begin());
+        for (std::size_t position: uncovered) {
+            ordered[cursor[ids[position] & (SHARDS - 1)]++] = position;
+        }
+    }
+
+    for (std::size_t s = 0; s < SHARDS; s++) {
+        if (offsets[s] == offsets[s + 1]) {
+            continue;
+        }
+
+        const Shard &shard = m_shards[s];
+        ShardReadLock locker(shard.mutex);
+        for (std::size_t i = offsets[s]; i < offsets[s + 1]; i++) {
+            const std::size_t position = ordered[i];
+            out[position] = ids[position] != 0 && shard.idMap.find(ids[position]) != nullptr;
         }
     }
-    return true;
 }
 std::size_t wss::ConnectionStorage::size() const {
-    std::lock_guard<std::recursive_mutex> locker(m_connectionMutex);
-    return m_idMap.size();
+    std::size_t out = 0;
+    for (const auto &shard: m_shards) {
+        ShardReadLock locker(shard.mutex);
+        out += shard.idMap.size();
+    }
+    return out;
+}
+void wss::ConnectionStorage::getUsers(std::vector<wss::user_id_t> &out) const {
+    out.clear();
+    for (const auto &shard: m_shards) {
+        ShardReadLock locker(shard.mutex);
+        out.reserve(out.size() + shard.idMap.size());
+        shard.idMap.forEach([&out](wss::user_id_t id, const Connections &) {
+          out.push_back(id);
+        });
+    }
+}
+void wss::ConnectionStorage::getShardConnections(std::size_t shard,
+                                                 std::vector<Recipients::Item> &out) const {
+    const Shard &found = m_shards[shard & (SHARDS - 1)];
+    ShardReadLock locker(found.mutex);
+    found.idMap.forEach([&out](wss::user_id_t id, const Connections &connections) {
+      for (std::size_t i = 0; i < connections.size(); i++) {
+          if (connections[i].second) {
+              out.push_back(Recipients::Item{id, connections[i].first, connections[i].second});
+          }
+      }
+    });
 }
 std::size_t wss::ConnectionStorage::size(wss::user_id_t id) {
-    std::lock_guard<std::recursive_mutex> locker(m_connectionMutex);
+    if (isOffline(id)) {
+        return 0;
+    }
+    const Shard &shard = getShard(id);
+    ShardReadLock locker(shard.mutex);
 
-    if (m_idMap.find(id) == m_idMap.end()) {
+    const Connections *connections = shard.idMap.find(id);
+    if (connections == nullptr) {
         return 0;
     }
 
-    return m_idMap[id].size();
+    return connections->size();
+}
+uint64_t wss::ConnectionStorage::getShardEpoch(std::size_t shard) const noexcept {
+    return m_shards[shard & (SHARDS - 1)].epoch.load(std::memory_order_acquire);
 }
 void wss::ConnectionStorage::add(wss::user_id_t id, const wss::WsConnectionPtr &connection) {
-    std::lock_guard<std::recursive_mutex> locker(m_connectionMutex);
-    connection->setId(id);
-    m_idMap[id][connection->getUniqueId()] = connection;
-    L_DEBUG_F("Connection::Add", "Adding connection for %lu. Now size: %lu", connection->getId(), m_idMap[id].size());
+    PresenceEvent online{0, true, 0};
+    {
+        Shard &shard = getShard(id);
+        ShardWriteLock locker(shard.mutex);
+        connection->setId(id);
+        auto &connections = shard.idMap[id];
+        const wss::conn_id_t connId = connection->getUniqueId();
+        bool replaced = false;
+        for (std::size_t i = 0; i < connections.size() && !replaced; i++) {
+            if (connections[i].first == connId) {
+                connections[i].second = connection;
+                replaced = true;
+            }
+        }
+        if (!replaced) {
+            if (connections.empty()) {
+                online = createPresenceEvent(id, true);
+                if (wss::utils::PresenceBitmap::covers(id)) {
+                    m_presence.set(id);
+                }
+            }
+            connections.push_back({connId, connection});
+        }
+        shard.epoch++;
+        WSS_DEBUG_F("Connection::Add", "Adding connection for %lu. Now size: %lu", connection->getId(), connections.size());
+    }
+    notifyPresence(online);
 }
 void wss::ConnectionStorage::remove(wss::user_id_t id) {
-    std::lock_guard<std::recursive_mutex> locker(m_connectionMutex);
-    m_idMap.erase(id);
+    PresenceEvent offline{0, false, 0};
+    {
+        Shard &shard = getShard(id);
+        ShardWriteLock locker(shard.mutex);
+        if (shard.idMap.erase(id)) {
+            if (wss::utils::PresenceBitmap::covers(id)) {
+                m_presence.reset(id);
+            }
+            offline = createPresenceEvent(id, false);
+            shard.epoch++;
+        }
+    }
+    notifyPresence(offline);
 }
 void wss::ConnectionStorage::remove(wss::user_id_t id, wss::conn_id_t connectionId) {
-    std::lock_guard<std::recursive_mutex> locker(m_connectionMutex);
-    const auto &it = m_idMap.find(id);
-    if (it != m_idMap.end()) {
-        if (it->second.find(connectionId) != it->second.end()) {
-            it->second.erase(connectionId);
-        }
+    PresenceEvent offline{0, false, 0};
+    {
+        Shard &shard = getShard(id);
+        ShardWriteLock locker(shard.mutex);
+        eraseLocked(shard, id, connectionId, offline);
     }
+    notifyPresence(offline);
 }
 void wss::ConnectionStorage::remove(const wss::WsConnectionPtr &connection) {
-    std::lock_guard<std::recursive_mutex> locker(m_connectionMutex);
     const user_id_t id = connection->getId();
     const conn_id_t connId = connection->getUniqueId();
+    std::size_t left = 0;
+    PresenceEvent offline{0, false, 0};
 
-    const auto &userMapIt = m_idMap.find(id);
-    if (userMapIt != m_idMap.end()) {
-        if (userMapIt->second.find(connId) != userMapIt->second.end()) {
-            userMapIt->second.erase(connId);
-        }
+    {
+        Shard &shard = getShard(id);
+        ShardWriteLock locker(shard.mutex);
+        left = eraseLocked(shard, id, connId, offline);
     }
 
-    L_DEBUG_F("Connection::Remove", "User %lu (%lu). Left connections: %lu",
-              connection->getId(),
-              connection->getUniqueId(),
-              m_idMap[id].size());
+    WSS_DEBUG_F("Connection::Remove", "User %lu (%lu). Left connections: %lu", id, connId, left);
+    notifyPresence(offline);
 }
-wss::ConnectionMap<wss::WsConnectionPtr> &wss::ConnectionStorage::get(wss::user_id_t id) {
-    std::lock_guard<std::recursive_mutex> locker(m_connectionMutex);
-    if (!exists(id)) {
-        throw ConnectionNotFound();
+std::size_t wss::ConnectionStorage::eraseLocked(Shard &shard,
+                                                wss::user_id_t id,
+                                                wss::conn_id_t connectionId,
+                                                PresenceEvent &offline) {
+    Connections *connections = shard.idMap.find(id);
+    if (connections == nullptr) {
+        return 0;
+    }
+    for (std::size_t i = 0; i < connections->size(); i++) {
+        if ((*connections)[i].first == connectionId) {
+            connections->erase(i);
+            shard.epoch++;
+            break;
+        }
     }
-    return m_idMap[id];
+    const std::size_t left = connections->size();
+    if (left == 0) {
+        // user without connections is not exists()
+        shard.idMap.erase(id);
+        if (wss::utils::PresenceBitmap::covers(id)) {
+            m_presence.reset(id);
+        }
+        offline = createPresenceEvent(id, false);
+    }
+    return left;
 }
-const wss::UserMap<wss::ConnectionMap<wss::WsConnectionPtr>> &wss::ConnectionStorage::get() const {
-    return m_idMap;
+wss::ConnectionMap<wss::WsConnectionPtr> wss::ConnectionStorage::get(wss::user_id_t id) const {
+    if (isOffline(id)) {
+        throw ConnectionNotFound();
+    }
+    const Shard &shard = getShard(id);
+    ShardReadLock locker(shard.mutex);
+    const Connections *connections = shard.idMap.find(id);
+    if (connections == nullptr) {
+        throw ConnectionNotFound();
+    }
+    wss::ConnectionMap<wss::WsConnectionPtr> out;
+    for (std::size_t i = 0; i < connections->size(); i++) {
+        out.emplace((*connections)[i].first, (*connections)[i].second);
+    }
+    return out;
 }
 void wss::ConnectionStorage::handle(wss::user_id_t id, std::function<void(wss::WsConnectionPtr &)> &&handler) {
-    std::lock_guard<std::recursive_mutex> locker(m_connectionMutex);
     for (auto &conn: get(id)) {
         handler(conn.second);
     }
 }
-void wss::ConnectionStorage::markPongWait(const wss::WsConnectionPtr &connection) {
-    std::lock_guard<std::mutex> locker(m_pongMutex);
-    m_waitForPong[connection->getUniqueId()] = {connection->getId(), false};
-}
-void wss::ConnectionStorage::markPongReceived(const wss::WsConnectionPtr &connection) {
-    std::lock_guard<std::mutex> locker(m_pongMutex);
-    m_waitForPong[connection->getUniqueId()].second = true;
-}
-std::size_t wss::ConnectionStorage::disconnectWithoutPong(int statusCode, const std::string &reason) {
-    std::lock_guard<std::mutex> locker(m_pongMutex);
-    std::size_t disconnected = 0;
-    for (auto it = m_waitForPong.begin(); it != m_waitForPong.end();) {
-        if (!it->second.second) {
-            {
-                std::lock_guard<std::recursive_mutex> sublock(m_connectionMutex);
-                WsConnectionPtr &conn = m_idMap[it->second.first][it->first];
-                if (conn) {
-                    conn->sendClose(statusCode, reason);
-                } else {
-                    // by some reason, connection already nullptr
-                    m_idMap[it->second.first].erase(it->first);
-                }
-            }
-
-            disconnected++;
-        }
-
-        m_waitForPong.erase(it++);
-    }
-
-    return disconnected;
-}
-
-
 void wss::ConnectionStorage::forEach(
     wss::user_id_t recipient,
     const wss::ConnectionStorage::ItemHandler &handler,
-    const wss::ConnectionStorage::ItemNotFoundHandler& notFoundHandler) {
+    const wss::ConnectionStorage::ItemNotFoundHandler &notFoundHandler) {
 
-    if(handler == nullptr) {
+    if (handler == nullptr || isOffline(recipient)) {
         return;
     }
 
-    std::lock_guard<std::recursive_mutex> locker(m_connectionMutex);
+    // copying connections, so handlers may send, remove or add connections without deadlock
+    std::vector<std::pair<wss::conn_id_t, wss::WsConnectionPtr>> connections;
+    std::vector<wss::conn_id_t> invalid;
+    Shard &shard = getShard(recipient);
+    {
+        // delivery path is read-only, readers of the same shard don't wait for each other
+        ShardReadLock locker(shard.mutex);
+        const Connections *found = shard.idMap.find(recipient);
+        if (found == nullptr) {
+            return;
+        }
 
-    try {
-        const auto &connections = get(recipient);
-        size_t i = 0;
+        connections.reserve(found->size());
+        for (std::size_t i = 0; i < found->size(); i++) {
+            const auto &item = (*found)[i];
+            if (!item.second) {
+                invalid.push_back(item.first);
+                continue;
+            }
+            connections.emplace_back(item.first, item.second);
+        }
+    }
 
-        for (const auto &connection: connections) {
-            if (!connection.second) {
-                if(notFoundHandler != nullptr) {
-                    notFoundHandler(recipient, connection.first);
+    if (!invalid.empty()) {
+        // removing invalid recipient connections
+        PresenceEvent offline{0, false, 0};
+        {
+            ShardWriteLock locker(shard.mutex);
+            for (const auto &cid: invalid) {
+                Connections *found = shard.idMap.find(recipient);
+                if (found == nullptr) {
+                    break;
+                }
+                for (std::size_t i = 0; i < found->size(); i++) {
+                    if ((*found)[i].first == cid && !(*found)[i].second) {
+                        eraseLocked(shard, recipient, cid, offline);
+                        break;
+                    }
                 }
-                // removing invalid recipient connection
-                remove(recipient, connection.first);
-                continue;
             }
+        }
+        notifyPresence(offline);
+    }
 
-            handler(i, connection.second, connection.first, recipient);
+    try {
+        if (notFoundHandler != nullptr) {
+            for (const auto &cid: invalid) {
+                notFoundHandler(recipient, cid);
+            }
         }
 
+        size_t i = 0;
+        for (const auto &connection: connections) {
+            handler(i++, connection.second, connection.first, recipient);
+        }
     } catch (const std::exception &e) {
         Logger::get().warning(__FILE__, __LINE__, "Connection::Handle", fmt::format("Unknown error: {0}", e.what()));
     } catch (...) {
         Logger::get().warning(__FILE__, __LINE__, "Connection::Handle", "Unknown error");
     }
 }
+void wss::ConnectionStorage::resolve(const wss::user_id_t *recipients,
+                                     std::size_t count,
+                                     wss::ConnectionStorage::Recipients &out,
+                                     wss::user_id_t exclude) {
+    out.online.clear();
+    out.missing.clear();
+    if (count == 0) {
+        return;
+    }
+
+    // offline recipients are known from presence bitmap: they go to missing without shard lock,
+    // only the rest are looked up
+    std::vector<wss::user_id_t> candidates;
+    candidates.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        const wss::user_id_t uid = recipients[i];
+        if (uid == 0 || uid == exclude) {
+            continue;
+        }
+        if (isOffline(uid)) {
+            out.missing.push_back(uid);
+        } else {
+            candidates.push_back(uid);
+        }
+    }
+    if (candidates.empty()) {
+        return;
+    }
+
+    // counting sort of recipients by shard: positions of shard
+    // recipients in order are [offsets[s], offsets[s+1])
+    std::array<std::size_t, SHARDS + 1> offsets{};
+    for (const wss::user_id_t uid: candidates) {
+        offsets[(uid & (SHARDS - 1)) + 1]++;
+    }
+    for (std::size_t s = 0; s < SHARDS; s++) {
+        offsets[s + 1] += offsets[s];
+    }
+    std::vector<wss::user_id_t> ordered(candidates.size());
+    {
+        std::array<std::size_t, SHARDS> cursor;
+        std::copy(offsets.begin(), offsets.end() - 1, cursor.begin());
+        for (const wss::user_id_t uid: candidates) {
+            ordered[cursor[uid & (SHARDS - 1)]++] = uid;
+        }
+    }
+
+    out.online.reserve(candidates.size());
+    std::vector<std::pair<wss::user_id_t, wss::conn_id_t>> invalid;
+    for (std::size_t s = 0; s < SHARDS; s++) {
+        if (offsets[s] == offsets[s + 1]) {
+            continue;
+        }
+
+        const Shard &shard = m_shards[s];
+        ShardReadLock locker(shard.mutex);
+        for (std::size_t i = offsets[s]; i < offsets[s + 1]; i++) {
+            const wss::user_id_t uid = ordered[i];
+            const Connections *found = shard.idMap.find(uid);
+            if (found == nullptr) {
+                out.missing.push_back(uid);
+                continue;
+            }
+            const std::size_t before = out.online.size();
+            for (std::size_t j = 0; j < found->size(); j++) {
+                const auto &item = (*found)[j];
+                if (!item.second) {
+                    invalid.emplace_back(uid, item.first);
+                    continue;
+                }
+                out.online.push_back({uid, item.first, item.second});
+            }
+            if (out.online.size() == before) {
+                out.missing.push_back(uid);
+            }
+        }
+    }
+
+    for (const auto &item: invalid) {
+        remove(item.first, item.second);
+    }
+}
@@ -9,13 +9,18 @@
 #ifndef WSSERVER_CONNECTIONSTORAGE_H
 #define WSSERVER_CONNECTIONSTORAGE_H
 
+#include <array>
 #include <mutex>
+#include <shared_mutex>
 #include <functional>
 #include <unordered_map>
 #include <vector>
 #include <string>
 #include <atomic>
 #include <toolboxpp.h>
+#include "flat_map.hpp"
+#include "inline_vector.hpp"
+#include "presence_bitmap.hpp"
 #include "../wsserver_core.h"
 
 using toolboxpp::Logger;
@@ -28,52 +33,144 @@ struct ConnectionNotFound : std::exception {
   }
 };
 
-/// \brief Container for handling and storing client connections
+/// \brief Container for handling and storing client connections.
+/// Users are split into shards by id, each shard has own reader/writer lock, so message routing for different users
+/// doesn't contend on single mutex, and lookups of the same shard run in parallel.
+/// Handlers are called outside of shard lock and may modify storage.
+/// Users with connections are also marked in presence bitmap (ids below 2^32), updated under shard lock:
+/// online checks and lookups of offline users read it without locks, only online users are looked up in shards.
 class ConnectionStorage {
+ public:
+    /// \brief Number of shards (power of two)
+    static constexpr std::size_t SHARDS = 64;
+
+    /// \brief User presence transition: first connection added (online) or last one removed (offline)
+    struct PresenceEvent {
+      wss::user_id_t user;
+      bool online;
+      /// \brief Assigned under user shard lock: transitions of the same user are ordered by sequence,
+      /// even if handlers of them are called concurrently
+      uint64_t sequence;
+    };
+    using PresenceHandler = std::function<void(const wss::ConnectionStorage::PresenceEvent &)>;
+
  private:
-    mutable std::recursive_mutex m_connectionMutex;
-    mutable std::mutex m_pongMutex;
-    wss::UserMap<wss::ConnectionMap<WsConnectionPtr>> m_idMap;
-    wss::ConnectionMap<std::pair<user_id_t, bool>> m_waitForPong;
+    /// \brief Most users have 1-3 devices, their connections are stored right in index slot
+    using Connections = wss::utils::InlineVector<std::pair<wss::conn_id_t, WsConnectionPtr>, 3>;
+    struct Shard {
+      mutable std::shared_timed_mutex mutex;
+      /// \brief Flat open-addressing index: UserId -> connections
+      wss::utils::FlatMap<Connections> idMap;
+      /// \brief Incremented under write lock on every connection change of shard
+      std::atomic<uint64_t> epoch{0};
+    };
+    std::array<Shard, SHARDS> m_shards;
+    wss::utils::PresenceBitmap m_presence;
+    PresenceHandler m_presenceHandler;
+    std::atomic<uint64_t> m_presenceSequence{0};
+
+    /// \brief Whether user is known to have no connections, without shard lock
+    bool isOffline(wss::user_id_t id) const noexcept {
+        return wss::utils::PresenceBitmap::covers(id) && !m_presence.test(id);
+    }
+
+    Shard &getShard(wss::user_id_t id) noexcept {
+        return m_shards[id & (SHARDS - 1)];
+    }
+    const Shard &getShard(wss::user_id_t id) const noexcept {
+        return m_shards[id & (SHARDS - 1)];
+    }
+
+    /// \brief Removes user connection, and user itself if it was last one. Shard must be locked
+    /// \param offline set to offline transition of user, if this was last connection, otherwise untouched
+    /// \return left user connections
+    std::size_t eraseLocked(Shard &shard, wss::user_id_t id, wss::conn_id_t connectionId, PresenceEvent &offline);
+
+    /// \brief Creates presence transition event. User shard must be locked
+    PresenceEvent createPresenceEvent(wss::user_id_t id, bool online);
+
+    /// \brief Calls presence handler, if event is valid (has user id). Must be called without shard lock
+    void notifyPresence(const PresenceEvent &event);
 
  public:
     using ItemHandler = std::function<void(size_t, const wss::WsConnectionPtr &, wss::conn_id_t, wss::user_id_t)>;
+
+    /// \brief Last assigned presence transition sequence
+    /// \return
+    uint64_t getPresenceSequence() const noexcept;
+
+    /// \brief Continues presence sequence of previous server run. Must be called before connections are added
+    /// \param sequence next transition gets sequence + 1
+    void setPresenceSequence(uint64_t sequence) noexcept;
     using ItemNotFoundHandler = std::function<void(wss::user_id_t, wss::conn_id_t)>;
 
+    /// \brief Result of bulk recipients lookup
+    struct Recipients {
+      struct Item {
+        wss::user_id_t user;
+        wss::conn_id_t connectionId;
+        wss::WsConnectionPtr connection;
+      };
+      /// \brief Connections of online recipients, grouped by shard, not by recipients order
+      std::vector<Item> online;
+      /// \brief Recipients without connections
+      std::vector<wss::user_id_t> missing;
+    };
 
     /// \brief Default empty constructor
     ConnectionStorage() = default;
 
-    /// \brief Deleted copy ctr, cause contains mutex
+    /// \brief Deleted copy ctr, cause contains mutexes
     /// \param other
     ConnectionStorage(const ConnectionStorage &other) = delete;
 
-    /// \brief Deleted move ctr, cause contains mutex
+    /// \brief Deleted move ctr, cause contains mutexes
     /// \param other
     ConnectionStorage(ConnectionStorage &&other) = delete;
 
     /// \brief On destruction, all connections trying to disconnect, than map of connections will be cleaned up
     ~ConnectionStorage();
 
+    /// \brief Set listener of users online/offline transitions. Handler is called without storage lock.
+    /// Not thread safe: must be set before storage is used
+    /// \param handler
+    void setPresenceHandler(PresenceHandler handler);
+
     /// \brief Check for existing connection using UserId
     /// \param id UserId
     /// \return true if connection with UserId in map
     bool exists(wss::user_id_t id) const;
 
-    /// \brief Check connection is not nullptr, remove if null
-    /// \param connection
-    /// \return true if is valid connection, false othwerwise
-    bool verify(uint8_t pingFlag);
+    /// \brief Bulk check of many users: each touched shard is locked once (shared) for all its users
+    /// \param ids pointer to first user id
+    /// \param count users count
+    /// \param out out[i] is true if ids[i] has connection, previous content is cleared
+    void exists(const wss::user_id_t *ids, std::size_t count, std::vector<bool> &out) const;
 
     /// \brief Count total users in map
     /// \return Size of map user:connections
     std::size_t size() const;
 
+    /// \brief List users with connections. Shards are locked one by one: it's not an atomic snapshot
+    /// \param out previous content is cleared
+    void getUsers(std::vector<wss::user_id_t> &out) const;
+
+    /// \brief Connections of one shard, copied under shared lock: walk over all connections locks one shard at a time
+    /// \param shard index, less than SHARDS
+    /// \param out connections are appended
+    void getShardConnections(std::size_t shard, std::vector<Recipients::Item> &out) const;
+
     /// \brief Count total connections for entire user
     /// \param id UserId
     /// \return Size of vector user connections
     std::size_t size(wss::user_id_t id);
 
+    /// \brief Version of shard connections: changed by every add and remove of shard users.
+    /// Lookup result of shard users stays valid while epoch is the same
+    /// \param shard index, less than SHARDS
+    /// \return
+    uint64_t getShardEpoch(std::size_t shard) const noexcept;
+
     /// \brief Add to map new connection (non-unique)
     /// \param id UserId
     /// \param connection SimpleWeb::Connection shared_ptr
@@ -87,40 +184,36 @@ class ConnectionStorage {
     /// \param id UserId
     void remove(wss::user_id_t id, wss::conn_id_t connectionId);
 
-    /// \brief Remove from connection by unique connection id : std::stoul("ip address without dots" + "remote port num").
+    /// \brief Remove connection by its owner id and unique connection id
     /// \param connection SimpleWeb::Connection shared_ptr
     void remove(const wss::WsConnectionPtr &connection);
 
-    /// \brief Return from map connections for entire user
+    /// \brief Return copy of user connections map
     /// \param id UserId
-    /// \return  Vector of connections
-    wss::ConnectionMap<wss::WsConnectionPtr> &get(wss::user_id_t id);
-
-    /// \brief Return whole map by const reference
-    /// \return unordered_map< UserId, vector<WsConnectionPtr> >
-    const wss::UserMap<wss::ConnectionMap<wss::WsConnectionPtr>> &get() const;
+    /// \throws ConnectionNotFound if user has no connections map
+    /// \return  Map of connections
+    wss::ConnectionMap<wss::WsConnectionPtr> get(wss::user_id_t id) const;
 
     /// \brief Callback function to handle connections for entire UserId
     /// \param id UserId
     /// \param handler callback function (void<WsConnectionPtr &>)
     void handle(user_id_t id, std::function<void(WsConnectionPtr &)> &&handler);
 
-    /// \brief Mark connection as waiting for pong response from client.
-    /// \param connection
-    void markPongWait(const WsConnectionPtr &connection);
-
-    /// \brief Mark connection as received pong response from client
-    /// \param connection
-    void markPongReceived(const WsConnectionPtr &connection);
-
-    /// \brief Disconnect all queued connections, that waits for pong response but not received
-    /// \return count of disconnected connections
-    std::size_t disconnectWithoutPong(int statusCode, const std::string &reason);
-
-    /// \brief Handle connections by recipient. Uses recursive mutex to prevent data races
+    /// \brief Handle connections by recipient. Connections are copied under shard lock, handler called without lock
     /// \param recipient recipient id
     /// \param handler
     void forEach(wss::user_id_t recipient, const wss::ConnectionStorage::ItemHandler &handler, const wss::ConnectionStorage::ItemNotFoundHandler& = nullptr);
+
+    /// \brief Bulk lookup of many recipients: each touched shard is locked once for all its recipients.
+    /// Doesn't throw on missing users. Zero ids are skipped.
+    /// \param recipients pointer to first recipient id
+    /// \param count recipients count
+    /// \param out filled with connections and missing recipients, previous content is cleared
+    /// \param exclude recipient to skip (e.g. sender), 0 - none
+    void resolve(const wss::user_id_t *recipients,
+                 std::size_t count,
+                 wss::ConnectionStorage::Recipients &out,
+                 wss::user_id_t exclude = 0);
 };
 
 }
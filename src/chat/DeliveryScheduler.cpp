@@ -0,0 +1,147 @@
+/**
+ * wsserver
+ * DeliveryScheduler.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "DeliveryScheduler.h"
+#include <chrono>
+#include <stdexcept>
+
+constexpr std::size_t wss::DeliveryScheduler::LEVELS;
+constexpr std::size_t wss::DeliveryScheduler::SLOT_BITS;
+constexpr std::size_t wss::DeliveryScheduler::SLOTS;
+
+namespace {
+uint64_t nowMillis() {
+    using namespace std::chrono;
+    return static_cast<uint64_t>(duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count());
+}
+}
+
+wss::DeliveryScheduler::DeliveryScheduler(const Options &options) :
+    m_options(options) {
+    if (options.tickMillis == 0) {
+        throw std::invalid_argument("Tick must be greater than 0");
+    }
+    m_current = nowMillis() / options.tickMillis;
+}
+
+bool wss::DeliveryScheduler::schedule(const wss::MessagePayloadPtr &payload) {
+    const uint64_t deliverAt = payload->getDeliverAt();
+    if (m_options.maxDelaySeconds > 0 && deliverAt > nowMillis() + m_options.maxDelaySeconds * 1000ull) {
+        m_rejected++;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> locker(m_lock);
+    if (m_size >= m_options.maxMessages) {
+        m_rejected++;
+        return false;
+    }
+    place(Entry{deliverAt / m_options.tickMillis, payload});
+    m_size++;
+    return true;
+}
+
+std::size_t wss::DeliveryScheduler::advance(uint64_t nowMillis, const Handler &handler) {
+    Slot due;
+    {
+        std::lock_guard<std::mutex> locker(m_lock);
+        const uint64_t target = nowMillis / m_options.tickMillis;
+        while (m_current < target) {
+            m_current++;
+            // higher level slot comes when all lower levels have turned
+            for (std::size_t level = 1; level < LEVELS; level++) {
+                const std::size_t shift = SLOT_BITS * level;
+                if ((m_current & ((1ull << shift) - 1)) != 0) {
+                    break;
+                }
+                cascade(level, (m_current >> shift) & (SLOTS - 1));
+            }
+            if ((m_current & ((1ull << (SLOT_BITS * LEVELS)) - 1)) == 0 && !m_overflow.empty()) {
+                Slot overflow;
+                overflow.swap(m_overflow);
+                for (auto &entry: overflow) {
+                    place(std::move(entry));
+                }
+            }
+
+            Slot &slot = m_wheel[0][m_current & (SLOTS - 1)];
+            for (auto &entry: slot) {
+                m_due.push_back(std::move(entry));
+            }
+            slot.clear();
+        }
+        due.swap(m_due);
+        m_size -= due.size();
+    }
+
+    for (const auto &entry: due) {
+        handler(entry.payload);
+    }
+    m_delivered += due.size();
+    return due.size();
+}
+
+void wss::DeliveryScheduler::forEach(const Handler &handler) const {
+    std::vector<wss::MessagePayloadPtr> payloads;
+    {
+        std::lock_guard<std::mutex> locker(m_lock);
+        payloads.reserve(m_size);
+        const auto &collect = [&payloads](const Slot &slot) {
+          for (const auto &entry: slot) {
+              payloads.push_back(entry.payload);
+          }
+        };
+        for (const auto &level: m_wheel) {
+            for (const auto &slot: level) {
+                collect(slot);
+            }
+        }
+        collect(m_overflow);
+        collect(m_due);
+    }
+    for (const auto &payload: payloads) {
+        handler(payload);
+    }
+}
+
+std::size_t wss::DeliveryScheduler::size() const noexcept {
+    return m_size;
+}
+uint64_t wss::DeliveryScheduler::getDelivered() const noexcept {
+    return m_delivered;
+}
+uint64_t wss::DeliveryScheduler::getRejected() const noexcept {
+    return m_rejected;
+}
+const wss::DeliveryScheduler::Options &wss::DeliveryScheduler::getOptions() const noexcept {
+    return m_options;
+}
+
+void wss::DeliveryScheduler::place(Entry &&entry) {
+    if (entry.tick <= m_current) {
+        m_due.push_back(std::move(entry));
+        return;
+    }
+    const uint64_t delta = entry.tick - m_current;
+    for (std::size_t level = 0; level < LEVELS; level++) {
+        const std::size_t shift = SLOT_BITS * level;
+        if (delta < (1ull << (shift + SLOT_BITS))) {
+            m_wheel[level][(entry.tick >> shift) & (SLOTS - 1)].push_back(std::move(entry));
+            return;
+        }
+    }
+    m_overflow.push_back(std::move(entry));
+}
+
+void wss::DeliveryScheduler::cascade(std::size_t level, std::size_t slot) {
+    Slot entries;
+    entries.swap(m_wheel[level][slot]);
+    for (auto &entry: entries) {
+        place(std::move(entry));
+    }
+}
@@ -0,0 +1,96 @@
+/**
+ * wsserver
+ * DeliveryScheduler.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_DELIVERYSCHEDULER_H
+#define WSSERVER_DELIVERYSCHEDULER_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include "Message.h"
+
+namespace wss {
+
+/// \brief Messages with "deliverAt" wait here until they are due. Hierarchical timer wheel: 4 levels of 64 slots,
+/// level 0 slot is one tick, each next level slot is the whole previous level. Scheduling is O(1), slot of
+/// higher level is spread down once, when its time comes. Messages due after last level (64^4 ticks,
+/// 19 days with 100 ms tick) wait in overflow list and are placed to wheel when last level turns.
+/// Scheduled messages are written to server snapshot, so they survive restart
+class DeliveryScheduler {
+ public:
+    struct Options {
+      /// \brief Wheel resolution, messages are sent up to one tick late
+      uint32_t tickMillis = 100;
+      /// \brief Max scheduled messages, next ones are rejected
+      std::size_t maxMessages = 1000000;
+      /// \brief Max delay from now, 0 - unlimited
+      uint32_t maxDelaySeconds = 30 * 86400;
+    };
+
+    using Handler = std::function<void(const wss::MessagePayloadPtr &payload)>;
+
+    /// \throws std::invalid_argument if tick is 0
+    explicit DeliveryScheduler(const Options &options);
+
+    /// \brief Adds message by its getDeliverAt(). Message that is already due is returned by next advance()
+    /// \param payload
+    /// \return false if scheduler is full or delay is too long
+    bool schedule(const wss::MessagePayloadPtr &payload);
+
+    /// \brief Moves wheel to now, calls handler for every due message, outside of lock
+    /// \param nowMillis unix milliseconds
+    /// \param handler
+    /// \return delivered messages
+    std::size_t advance(uint64_t nowMillis, const Handler &handler);
+
+    /// \brief Iterates all scheduled messages, for snapshot
+    /// \param handler
+    void forEach(const Handler &handler) const;
+
+    std::size_t size() const noexcept;
+    uint64_t getDelivered() const noexcept;
+    uint64_t getRejected() const noexcept;
+    const Options &getOptions() const noexcept;
+
+ private:
+    static constexpr std::size_t LEVELS = 4;
+    static constexpr std::size_t SLOT_BITS = 6;
+    static constexpr std::size_t SLOTS = 1u << SLOT_BITS;
+
+    struct Entry {
+      /// \brief Absolute tick: deliverAt / tickMillis
+      uint64_t tick;
+      wss::MessagePayloadPtr payload;
+    };
+    using Slot = std::vector<Entry>;
+
+    const Options m_options;
+    mutable std::mutex m_lock;
+    std::array<std::array<Slot, SLOTS>, LEVELS> m_wheel;
+    /// \brief Later than wheel horizon
+    Slot m_overflow;
+    /// \brief Due, not yet taken by advance()
+    Slot m_due;
+    /// \brief Last processed tick
+    uint64_t m_current;
+    std::atomic<std::size_t> m_size{0};
+    std::atomic<uint64_t> m_delivered{0};
+    std::atomic<uint64_t> m_rejected{0};
+
+    /// \brief Puts entry to slot by distance from current tick. Called under lock
+    void place(Entry &&entry);
+    /// \brief Spreads slot of level down. Called under lock
+    void cascade(std::size_t level, std::size_t slot);
+};
+
+}
+
+#endif //WSSERVER_DELIVERYSCHEDULER_H
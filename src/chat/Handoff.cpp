@@ -0,0 +1,160 @@
+/**
+ * wsserver
+ * Handoff.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "Handoff.h"
+#include <memory>
+#include <stdexcept>
+
+namespace {
+/// \brief u8 kind, u32 count
+constexpr std::size_t HEADER_SIZE = 5;
+
+template<typename T>
+void put(std::string &out, T value) {
+    for (std::size_t c = sizeof(T); c > 0; c--) {
+        out.push_back(static_cast<char>((static_cast<uint64_t>(value) >> (8 * (c - 1))) & 0xFFu));
+    }
+}
+
+class Reader {
+ public:
+    Reader(const char *data, std::size_t length) :
+        m_data(reinterpret_cast<const uint8_t *>(data)),
+        m_length(length) { }
+
+    template<typename T>
+    T get() {
+        require(sizeof(T));
+        uint64_t value = 0;
+        for (std::size_t i = 0; i < sizeof(T); i++) {
+            value = (value << 8) | m_data[m_pos++];
+        }
+        return static_cast<T>(value);
+    }
+
+    const char *take(std::size_t length) {
+        require(length);
+        const char *out = reinterpret_cast<const char *>(m_data + m_pos);
+        m_pos += length;
+        return out;
+    }
+
+ private:
+    const uint8_t *m_data;
+    std::size_t m_length;
+    std::size_t m_pos = 0;
+
+    void require(std::size_t length) const {
+        if (m_length - m_pos < length) {
+            throw std::runtime_error("truncated handoff body");
+        }
+    }
+};
+}
+
+wss::handoff::Writer::Writer(Kind kind) {
+    m_body.push_back(static_cast<char>(kind));
+    put<uint32_t>(m_body, 0);
+}
+
+void wss::handoff::Writer::add(const wss::Statistics::State &state) {
+    put<uint64_t>(m_body, state.id);
+    put<int64_t>(m_body, state.lastConnectionTime);
+    put<int64_t>(m_body, state.lastDisconnectionTime);
+    put<uint64_t>(m_body, state.connectedTimes);
+    put<uint64_t>(m_body, state.disconnectedTimes);
+    put<uint64_t>(m_body, state.bytesTransferred);
+    put<uint64_t>(m_body, state.sentMessages);
+    put<uint64_t>(m_body, state.receivedMessages);
+    put<int64_t>(m_body, state.lastMessageTime);
+    setCount(m_count + 1);
+}
+
+void wss::handoff::Writer::add(const std::vector<wss::user_id_t> &recipients,
+                               const wss::MessagePayloadPtr &payload,
+                               uint64_t expiresAt) {
+    const std::string &envelope = payload->toBinary();
+    put<uint64_t>(m_body, expiresAt);
+    put<uint32_t>(m_body, static_cast<uint32_t>(recipients.size()));
+    for (wss::user_id_t recipient: recipients) {
+        put<uint64_t>(m_body, recipient);
+    }
+    put<uint32_t>(m_body, static_cast<uint32_t>(envelope.size()));
+    m_body.append(envelope);
+    setCount(m_count + 1);
+}
+
+std::size_t wss::handoff::Writer::count() const noexcept {
+    return m_count;
+}
+
+std::size_t wss::handoff::Writer::size() const noexcept {
+    return m_body.size();
+}
+
+const std::string &wss::handoff::Writer::getBody() const noexcept {
+    return m_body;
+}
+
+void wss::handoff::Writer::clear() {
+    m_body.resize(HEADER_SIZE);
+    setCount(0);
+}
+
+void wss::handoff::Writer::setCount(uint32_t count) {
+    m_count = count;
+    for (std::size_t i = 0; i < 4; i++) {
+        m_body[1 + i] = static_cast<char>((count >> (8 * (3 - i))) & 0xFFu);
+    }
+}
+
+void wss::handoff::read(const char *data,
+                        std::size_t length,
+                        const StateHandler &onState,
+                        const MessageHandler &onMessage) {
+    Reader reader(data, length);
+    const auto kind = reader.get<uint8_t>();
+    const auto count = reader.get<uint32_t>();
+    switch (kind) {
+        case StatisticsKind:
+            for (uint32_t i = 0; i < count; i++) {
+                wss::Statistics::State state;
+                state.id = reader.get<uint64_t>();
+                state.lastConnectionTime = static_cast<time_t>(reader.get<int64_t>());
+                state.lastDisconnectionTime = static_cast<time_t>(reader.get<int64_t>());
+                state.connectedTimes = reader.get<uint64_t>();
+                state.disconnectedTimes = reader.get<uint64_t>();
+                state.bytesTransferred = reader.get<uint64_t>();
+                state.sentMessages = reader.get<uint64_t>();
+                state.receivedMessages = reader.get<uint64_t>();
+                state.lastMessageTime = static_cast<time_t>(reader.get<int64_t>());
+                onState(state);
+            }
+            break;
+        case MessagesKind:
+            for (uint32_t i = 0; i < count; i++) {
+                const auto expiresAt = reader.get<uint64_t>();
+                const auto recipientsCount = reader.get<uint32_t>();
+                std::vector<wss::user_id_t> recipients;
+                for (uint32_t r = 0; r < recipientsCount; r++) {
+                    recipients.push_back(reader.get<uint64_t>());
+                }
+                const auto envelopeLength = reader.get<uint32_t>();
+                const char *envelope = reader.take(envelopeLength);
+                auto payload = std::make_shared<const wss::MessagePayload>(
+                    wss::MessagePayload::fromStoredBinary(envelope, envelopeLength));
+                if (!payload->isValid()) {
+                    throw std::runtime_error("invalid handoff message: " + payload->getError());
+                }
+                onMessage(std::move(recipients), payload, expiresAt);
+            }
+            break;
+        default:
+            throw std::runtime_error("unknown handoff kind " + std::to_string(kind));
+    }
+}
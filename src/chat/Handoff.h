@@ -0,0 +1,67 @@
+/**
+ * wsserver
+ * Handoff.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_HANDOFF_H
+#define WSSERVER_HANDOFF_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Message.h"
+#include "Statistics.h"
+#include "../wsserver_core.h"
+
+namespace wss {
+namespace handoff {
+
+/// \brief First byte of handoff body
+enum Kind : uint8_t {
+  /// \brief u32 count, count of: u64 id, i64 last connection, i64 last disconnection, u64 connected times,
+  /// u64 disconnected times, u64 bytes, u64 sent, u64 received, i64 last message (same as snapshot)
+  StatisticsKind = 1,
+  /// \brief u32 count, count of: u64 expiresAt, u32 recipients count, u64 recipients, u32 length, binary envelope
+  MessagesKind = 2,
+};
+
+/// \brief Builds body of one kind. All numbers are big endian
+class Writer {
+ public:
+    explicit Writer(Kind kind);
+
+    void add(const wss::Statistics::State &state);
+    void add(const std::vector<wss::user_id_t> &recipients, const wss::MessagePayloadPtr &payload, uint64_t expiresAt);
+
+    /// \brief Items added since clear()
+    std::size_t count() const noexcept;
+    /// \brief Body size in bytes
+    std::size_t size() const noexcept;
+    const std::string &getBody() const noexcept;
+    void clear();
+
+ private:
+    std::string m_body;
+    uint32_t m_count = 0;
+
+    /// \brief Keeps count in header up to date
+    void setCount(uint32_t count);
+};
+
+using StateHandler = std::function<void(const wss::Statistics::State &state)>;
+using MessageHandler = std::function<void(std::vector<wss::user_id_t> &&recipients,
+                                          const wss::MessagePayloadPtr &payload,
+                                          uint64_t expiresAt)>;
+
+/// \brief Parses body, calling handler of its kind for each item
+/// \throws std::runtime_error if body is truncated, of unknown kind or has invalid envelope
+void read(const char *data, std::size_t length, const StateHandler &onState, const MessageHandler &onMessage);
+
+}
+}
+
+#endif //WSSERVER_HANDOFF_H
@@ -0,0 +1,61 @@
+/**
+ * wsserver
+ * HashRing.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "HashRing.h"
+#include <algorithm>
+#include <stdexcept>
+
+wss::HashRing::HashRing(std::vector<Node> nodes, uint32_t virtualNodes) :
+    m_nodes(std::move(nodes)) {
+    if (m_nodes.empty()) {
+        throw std::invalid_argument("Ring must have at least one node");
+    }
+    if (virtualNodes == 0) {
+        throw std::invalid_argument("Virtual nodes count must be greater than 0");
+    }
+    m_points.reserve(m_nodes.size() * virtualNodes);
+    for (std::size_t i = 0; i < m_nodes.size(); i++) {
+        const wss::node_id_t id = m_nodes[i].id;
+        for (std::size_t j = 0; j < i; j++) {
+            if (m_nodes[j].id == id) {
+                throw std::invalid_argument("Node id " + std::to_string(id) + " is duplicated in ring");
+            }
+        }
+        if (id == 0) {
+            throw std::invalid_argument("Node id must be in range 1..65535");
+        }
+        // points depend only on node id: every node builds the same ring from the same list in any order
+        for (uint32_t replica = 0; replica < virtualNodes; replica++) {
+            const uint64_t point = wss::ClusterDirectory::hashOf((static_cast<uint64_t>(id) << 32u) | replica);
+            m_points.emplace_back(point, i);
+        }
+    }
+    std::sort(m_points.begin(), m_points.end());
+}
+
+const wss::HashRing::Node &wss::HashRing::locate(wss::user_id_t user) const {
+    const uint64_t hash = wss::ClusterDirectory::hashOf(user);
+    auto it = std::upper_bound(m_points.begin(), m_points.end(), hash,
+                               [](uint64_t value, const std::pair<uint64_t, std::size_t> &point) {
+                                 return value < point.first;
+                               });
+    if (it == m_points.end()) {
+        it = m_points.begin();
+    }
+    return m_nodes[it->second];
+}
+
+bool wss::HashRing::contains(wss::node_id_t node) const {
+    return std::any_of(m_nodes.begin(), m_nodes.end(), [node](const Node &item) {
+      return item.id == node;
+    });
+}
+
+const std::vector<wss::HashRing::Node> &wss::HashRing::getNodes() const {
+    return m_nodes;
+}
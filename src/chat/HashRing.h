@@ -0,0 +1,57 @@
+/**
+ * wsserver
+ * HashRing.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_HASHRING_H
+#define WSSERVER_HASHRING_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ClusterDirectory.h"
+#include "../wsserver_core.h"
+
+namespace wss {
+
+/// \brief Consistent hashing of users to nodes: every node has virtualNodes points on 64 bit ring, user belongs
+/// to node of first point after user hash. Adding or removing node moves only users of its ring segments.
+/// Built once, immutable: lookups don't lock
+class HashRing {
+ public:
+    struct Node {
+      wss::node_id_t id;
+      /// \brief Where clients of this node connect, sent with redirect
+      std::string url;
+    };
+
+    /// \param nodes all nodes of ring, including this one
+    /// \param virtualNodes points per node: more points - more even split of users
+    /// \throws std::invalid_argument if nodes are empty, ids are invalid or duplicated, or virtualNodes is 0
+    HashRing(std::vector<Node> nodes, uint32_t virtualNodes);
+
+    /// \brief Node, that user belongs to
+    /// \param user
+    /// \return
+    const Node &locate(wss::user_id_t user) const;
+
+    /// \brief Check node is in ring
+    /// \param node
+    /// \return
+    bool contains(wss::node_id_t node) const;
+
+    const std::vector<Node> &getNodes() const;
+
+ private:
+    std::vector<Node> m_nodes;
+    /// \brief Sorted points: hash, index of node
+    std::vector<std::pair<uint64_t, std::size_t>> m_points;
+};
+
+}
+
+#endif //WSSERVER_HASHRING_H
@@ -0,0 +1,357 @@
+/**
+ * wsserver
+ * HistoryLog.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "HistoryLog.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <fmt/format.h>
+#include <toolboxpp.h>
+
+namespace {
+
+/// \brief u32 body length, u32 crc32
+const std::size_t RECORD_HEADER = 8;
+/// \brief u32 id.tm, u32 id.uuid, u32 id.pid, u32 id.inc, u32 recipients count, followed by u64 recipients
+const std::size_t RECORD_META = 20;
+
+std::runtime_error systemError(const std::string &what, const std::string &path) {
+    return std::runtime_error(fmt::format("{0} {1}: {2}", what, path, std::strerror(errno)));
+}
+
+uint32_t checksum(const char *data, std::size_t length) noexcept {
+    return static_cast<uint32_t>(::crc32(0L, reinterpret_cast<const Bytef *>(data), static_cast<uInt>(length)));
+}
+
+bool writeAll(int fd, const char *data, std::size_t length) {
+    while (length > 0) {
+        const ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+wss::unid_t readId(const char *body) noexcept {
+    uint32_t fields[4];
+    std::memcpy(fields, body, 16);
+    return {fields[0], fields[1], static_cast<uint16_t>(fields[2]), fields[3]};
+}
+
+}
+
+wss::HistoryLog::FileHandle::~FileHandle() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+wss::HistoryLog::Mapping::~Mapping() {
+    ::munmap(const_cast<char *>(data), size);
+}
+
+wss::HistoryLog::HistoryLog(const std::string &directory, const Options &options) :
+    m_directory(directory),
+    m_options(options) {
+    if (::mkdir(m_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw systemError("Unable to create history directory", m_directory);
+    }
+    // created even if compression is disabled: compressed records written before stay readable
+    m_codec = std::unique_ptr<SegmentCodec>(new SegmentCodec(m_directory, m_options.compression));
+    recover();
+}
+
+std::string wss::HistoryLog::segmentPath(uint64_t segment) const {
+    return fmt::format("{0}/{1:020d}.log", m_directory, segment);
+}
+
+void wss::HistoryLog::recover() {
+    std::vector<uint64_t> segments;
+    DIR *dir = ::opendir(m_directory.c_str());
+    if (dir == nullptr) {
+        throw systemError("Unable to read history directory", m_directory);
+    }
+    while (const dirent *item = ::readdir(dir)) {
+        const std::string name(item->d_name);
+        if (name.size() == 24 && name.compare(20, 4, ".log") == 0
+            && std::all_of(name.begin(), name.begin() + 20, ::isdigit)) {
+            segments.push_back(std::stoull(name.substr(0, 20)));
+        }
+    }
+    ::closedir(dir);
+    std::sort(segments.begin(), segments.end());
+
+    for (uint64_t segment: segments) {
+        recoverSegment(segment);
+    }
+    openSegment(segments.empty() ? 1 : segments.back() + 1);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    trimLocked();
+    L_INFO_F("Chat::History", "Opened %lu history segment(s), %lu bytes in %s",
+             m_segments.size(), m_size, m_directory.c_str());
+}
+
+void wss::HistoryLog::recoverSegment(uint64_t segment) {
+    const std::string path = segmentPath(segment);
+    const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        throw systemError("Unable to open history segment", path);
+    }
+    auto file = std::make_shared<FileHandle>(fd);
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        throw systemError("Unable to stat history segment", path);
+    }
+    const auto fileSize = static_cast<uint64_t>(st.st_size);
+    if (fileSize == 0) {
+        ::unlink(path.c_str());
+        return;
+    }
+
+    void *mapped = ::mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        throw systemError("Unable to map history segment", path);
+    }
+    const char *data = static_cast<const char *>(mapped);
+
+    Segment seg;
+    seg.file = std::move(file);
+    uint64_t offset = 0;
+    while (offset + RECORD_HEADER <= fileSize) {
+        uint32_t length, crc, count;
+        std::memcpy(&length, data + offset, 4);
+        std::memcpy(&crc, data + offset + 4, 4);
+        length &= ~SegmentCodec::COMPRESSED;
+        const char *body = data + offset + RECORD_HEADER;
+        if (length < RECORD_META || offset + RECORD_HEADER + length > fileSize || checksum(body, length) != crc) {
+            break;
+        }
+        std::memcpy(&count, body + 16, 4);
+        if (RECORD_META + static_cast<uint64_t>(count) * 8 > length) {
+            break;
+        }
+        const uint32_t tm = readId(body).tm;
+        if (seg.firstTm == 0) {
+            seg.firstTm = tm;
+        }
+        seg.lastTm = std::max(seg.lastTm, tm);
+        offset += RECORD_HEADER + length;
+    }
+    ::munmap(mapped, fileSize);
+
+    if (offset != fileSize) {
+        // torn write of crashed process
+        L_WARN_F("Chat::History", "Segment %s is truncated from %lu to %lu bytes", path.c_str(), fileSize, offset);
+        if (::ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+            throw systemError("Unable to truncate history segment", path);
+        }
+    }
+    if (offset == 0) {
+        ::unlink(path.c_str());
+        return;
+    }
+    seg.size = offset;
+    m_size += offset;
+    m_segments[segment] = std::move(seg);
+}
+
+void wss::HistoryLog::openSegment(uint64_t segment) {
+    const std::string path = segmentPath(segment);
+    const int fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw systemError("Unable to create history segment", path);
+    }
+    Segment &seg = m_segments[segment];
+    seg.file = std::make_shared<FileHandle>(fd);
+    m_activeSegment = segment;
+}
+
+void wss::HistoryLog::trimLocked() {
+    const uint64_t now = static_cast<uint64_t>(time(nullptr));
+    for (auto it = m_segments.begin(); it != m_segments.end() && it->first != m_activeSegment;) {
+        const bool oversize = m_options.maxBytes > 0 && m_size > m_options.maxBytes;
+        const bool outdated = m_options.retentionSeconds > 0
+            && static_cast<uint64_t>(it->second.lastTm) + m_options.retentionSeconds < now;
+        if (!oversize && !outdated) {
+            break;
+        }
+        // readers keep their mappings
+        ::unlink(segmentPath(it->first).c_str());
+        m_size -= it->second.size;
+        it = m_segments.erase(it);
+    }
+}
+
+void wss::HistoryLog::append(const user_id_t *recipients, std::size_t count, const MessagePayload &payload) {
+    if (count == 0) {
+        return;
+    }
+    const std::string &binary = payload.toBinary();
+    std::string compressed;
+    const bool isCompressed = m_codec->compress(binary.data(), binary.size(), compressed);
+    const std::string &envelope = isCompressed ? compressed : binary;
+    const std::size_t recipientsSize = count * 8;
+    const auto length = static_cast<uint32_t>(RECORD_META + recipientsSize + envelope.size());
+    std::string record(RECORD_HEADER + length, '\0');
+
+    const unid_t &id = payload.getId();
+    const uint32_t meta[5] = {id.tm, id.uuid, id.pid, id.inc, static_cast<uint32_t>(count)};
+    char *body = &record[RECORD_HEADER];
+    std::memcpy(body, meta, RECORD_META);
+    std::memcpy(body + RECORD_META, recipients, recipientsSize);
+    std::memcpy(body + RECORD_META + recipientsSize, envelope.data(), envelope.size());
+    const uint32_t crc = checksum(body, length);
+    const uint32_t lengthField = isCompressed ? (length | SegmentCodec::COMPRESSED) : length;
+    std::memcpy(&record[0], &lengthField, 4);
+    std::memcpy(&record[4], &crc, 4);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    Segment &seg = m_segments[m_activeSegment];
+    if (!writeAll(seg.file->fd, record.data(), record.size())) {
+        L_ERR_F("Chat::History", "Unable to write message for %lu user(s): %s", count, std::strerror(errno));
+        // partial record must not be followed by next records
+        if (::ftruncate(seg.file->fd, static_cast<off_t>(seg.size)) != 0) {
+            openSegment(m_activeSegment + 1);
+        }
+        return;
+    }
+    seg.size += record.size();
+    m_size += record.size();
+    if (seg.firstTm == 0) {
+        seg.firstTm = id.tm;
+    }
+    seg.lastTm = std::max(seg.lastTm, id.tm);
+
+    if (seg.size >= m_options.segmentBytes) {
+        openSegment(m_activeSegment + 1);
+        trimLocked();
+    }
+}
+
+std::shared_ptr<const wss::HistoryLog::Mapping> wss::HistoryLog::mapLocked(const Segment &segment) const {
+    void *mapped = ::mmap(nullptr, segment.size, PROT_READ, MAP_SHARED, segment.file->fd, 0);
+    if (mapped == MAP_FAILED) {
+        L_ERR_F("Chat::History", "Unable to map history segment: %s", std::strerror(errno));
+        return nullptr;
+    }
+    return std::make_shared<const Mapping>(static_cast<const char *>(mapped), segment.size);
+}
+
+std::size_t wss::HistoryLog::read(user_id_t recipient,
+                                  const unid_t *since,
+                                  std::size_t limit,
+                                  const RecordHandler &handler) const {
+    if (limit == 0) {
+        return 0;
+    }
+
+    // written bytes of active segment are never changed, so mapping of its current size is complete
+    std::vector<std::shared_ptr<const Mapping>> mappings;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (auto &item: m_segments) {
+            Segment &seg = item.second;
+            if (seg.size == 0 || (since != nullptr && seg.lastTm < since->tm)) {
+                continue;
+            }
+            if (item.first == m_activeSegment) {
+                mappings.push_back(mapLocked(seg));
+                continue;
+            }
+            if (!seg.mapping) {
+                seg.mapping = mapLocked(seg);
+            }
+            mappings.push_back(seg.mapping);
+        }
+    }
+
+    bool started = since == nullptr;
+    std::size_t found = 0;
+    std::string decompressed;
+    for (const auto &mapping: mappings) {
+        if (!mapping) {
+            continue;
+        }
+        const char *data = mapping->data;
+        uint64_t offset = 0;
+        while (offset + RECORD_HEADER <= mapping->size) {
+            uint32_t length, count;
+            std::memcpy(&length, data + offset, 4);
+            const bool isCompressed = (length & SegmentCodec::COMPRESSED) != 0;
+            length &= ~SegmentCodec::COMPRESSED;
+            const char *body = data + offset + RECORD_HEADER;
+            offset += RECORD_HEADER + length;
+            std::memcpy(&count, body + 16, 4);
+
+            const unid_t id = readId(body);
+            if (!started) {
+                if (id == *since) {
+                    started = true;
+                    continue;
+                }
+                if (id.tm <= since->tm) {
+                    continue;
+                }
+                started = true;
+            }
+
+            const char *recipients = body + RECORD_META;
+            bool addressed = false;
+            for (uint32_t i = 0; i < count && !addressed; i++) {
+                uint64_t item;
+                std::memcpy(&item, recipients + i * 8, 8);
+                addressed = item == recipient;
+            }
+            if (!addressed) {
+                continue;
+            }
+
+            const std::size_t envelopeOffset = RECORD_META + static_cast<std::size_t>(count) * 8;
+            if (isCompressed) {
+                if (!m_codec->decompress(body + envelopeOffset, length - envelopeOffset, decompressed)) {
+                    L_ERR_F("Chat::History", "Unable to decompress message for %lu", recipient);
+                    continue;
+                }
+                handler(id, decompressed.data(), decompressed.size());
+            } else {
+                handler(id, body + envelopeOffset, length - envelopeOffset);
+            }
+            if (++found == limit) {
+                return found;
+            }
+        }
+    }
+    return found;
+}
+
+std::size_t wss::HistoryLog::size() const {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_size;
+}
+
+const wss::SegmentCodec &wss::HistoryLog::getCodec() const noexcept {
+    return *m_codec;
+}
@@ -0,0 +1,121 @@
+/**
+ * wsserver
+ * HistoryLog.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_HISTORYLOG_H
+#define WSSERVER_HISTORYLOG_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "Message.h"
+#include "../base/SegmentCodec.h"
+#include "../wsserver_core.h"
+
+namespace wss {
+
+/// \brief Segmented append-only log of all routed messages, read by recipient starting after message id (cursor).
+/// Record (host byte order): u32 body length, u32 crc32 of body, body: u32 id.tm, u32 id.uuid, u32 id.pid,
+/// u32 id.inc, u32 recipients count, u64 recipients, binary envelope of payload (see MessagePayload::toBinary()).
+/// If length has SegmentCodec::COMPRESSED flag, envelope is zstd frame: recipients are scanned as is,
+/// only envelopes of matching messages are decompressed.
+/// Reads scan memory-mapped segments: envelopes are passed to handler without copying, only one page of
+/// messages is held by reader. Oldest segments are deleted when log grows above maxBytes or segment is older
+/// than retention, checked every time new segment is started.
+/// Log is not fsync-ed: crash may lose last written messages
+class HistoryLog {
+ public:
+    struct Options {
+      /// \brief Segment is closed and new one is started when it grows above this size
+      std::size_t segmentBytes = 64 * 1024 * 1024;
+      /// \brief Max size of all segments, 0 - unlimited
+      std::size_t maxBytes = 1024 * 1024 * 1024;
+      /// \brief Segments with messages older than this are deleted, 0 - keep forever
+      uint32_t retentionSeconds = 86400;
+      /// \brief Compression of envelopes
+      SegmentCodec::Options compression;
+    };
+
+    /// \brief Receives message id and its binary envelope, valid only while handler is called
+    using RecordHandler = std::function<void(const unid_t &id, const char *envelope, std::size_t length)>;
+
+    /// \brief Opens log directory (creates if not exists), torn tail of crashed process is truncated
+    /// \param directory
+    /// \param options
+    /// \throws std::runtime_error if directory or files can't be opened
+    HistoryLog(const std::string &directory, const Options &options);
+
+    /// \brief Writes one record for all recipients. Record is built before lock is taken
+    /// \param recipients
+    /// \param count
+    /// \param payload
+    void append(const user_id_t *recipients, std::size_t count, const MessagePayload &payload);
+
+    /// \brief Reads recipient messages written after cursor, in write order.
+    /// If cursor is not in log (deleted by retention or it's not a message id of this log),
+    /// reading starts from first message with greater timestamp (second precision)
+    /// \param recipient
+    /// \param since cursor, nullptr - from oldest message
+    /// \param limit max messages
+    /// \param handler
+    /// \return number of messages passed to handler
+    std::size_t read(user_id_t recipient, const unid_t *since, std::size_t limit, const RecordHandler &handler) const;
+
+    /// \brief Size of all segments
+    /// \return bytes
+    std::size_t size() const;
+
+    /// \brief Envelopes compression
+    const SegmentCodec &getCodec() const noexcept;
+
+ private:
+    struct FileHandle {
+      explicit FileHandle(int fd) : fd(fd) { }
+      ~FileHandle();
+      const int fd;
+    };
+    /// \brief Read-only segment mapping, kept by readers after segment is deleted
+    struct Mapping {
+      Mapping(const char *data, std::size_t size) : data(data), size(size) { }
+      ~Mapping();
+      const char *const data;
+      const std::size_t size;
+    };
+    struct Segment {
+      std::shared_ptr<FileHandle> file;
+      uint64_t size = 0;
+      /// \brief Seconds timestamps of first and last message ids
+      uint32_t firstTm = 0;
+      uint32_t lastTm = 0;
+      /// \brief Mapping of closed segment, created by first reader
+      std::shared_ptr<const Mapping> mapping;
+    };
+
+    const std::string m_directory;
+    const Options m_options;
+
+    mutable std::mutex m_lock;
+    mutable std::map<uint64_t, Segment> m_segments;
+    uint64_t m_activeSegment = 0;
+    std::size_t m_size = 0;
+    std::unique_ptr<SegmentCodec> m_codec;
+
+    std::string segmentPath(uint64_t segment) const;
+    void recover();
+    void recoverSegment(uint64_t segment);
+    void openSegment(uint64_t segment);
+    /// \brief Deletes oldest closed segments over size and retention limits, lock must be held
+    void trimLocked();
+    /// \return nullptr if segment can't be mapped
+    std::shared_ptr<const Mapping> mapLocked(const Segment &segment) const;
+};
+
+}
+
+#endif //WSSERVER_HISTORYLOG_H
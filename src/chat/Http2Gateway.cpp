@@ -0,0 +1,852 @@
+/**
+ * wsserver
+ * Http2Gateway.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "Http2Gateway.h"
+#include <stdexcept>
+#include <toolboxpp.h>
+#include "../base/Affinity.h"
+#include "../base/Metrics.h"
+#include "../helpers/logging.h"
+
+#ifdef WSS_ENABLE_HTTP2
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <deque>
+#include <istream>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/write.hpp>
+#include <nghttp2/nghttp2.h>
+#include <openssl/ssl.h>
+#include "../base/SocketLayerWrapper.hpp"
+#include "../base/ws/ProxyProtocol.hpp"
+#include "../helpers/base64.h"
+#endif
+
+namespace {
+
+using boost::asio::ip::tcp;
+using ErrorCode = boost::system::error_code;
+
+#ifdef WSS_ENABLE_HTTP2
+constexpr std::size_t READ_CHUNK = 16 * 1024;
+/// \brief Output of nghttp2 is collected up to this size for one socket write
+constexpr std::size_t WRITE_CHUNK = 64 * 1024;
+/// \brief Limit of listener upgrade response head
+constexpr std::size_t MAX_RESPONSE_HEAD = 16 * 1024;
+
+/// \brief Request headers, that are set by gateway in upgrade request or have no meaning in HTTP/1.1
+bool isHopHeader(const std::string &name) {
+    static const char *const names[] = {
+        "host", "connection", "upgrade", "keep-alive", "proxy-connection", "transfer-encoding", "te",
+        "content-length", "sec-websocket-key", "sec-websocket-version"
+    };
+    for (const char *hop: names) {
+        if (name == hop) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/// \brief Header of upgrade request, that listener expects to be unpredictable
+std::string websocketKey() {
+    thread_local std::mt19937_64 random(std::random_device{}());
+    std::string bytes(16, '\0');
+    for (auto &byte: bytes) {
+        byte = static_cast<char>(random() & 0xFFu);
+    }
+    return wss::utils::base64_encode(bytes);
+}
+
+nghttp2_nv makeHeader(const std::string &name, const std::string &value) {
+    // nghttp2 copies headers when frame is submitted
+    return nghttp2_nv{
+        reinterpret_cast<uint8_t *>(const_cast<char *>(name.data())),
+        reinterpret_cast<uint8_t *>(const_cast<char *>(value.data())),
+        name.size(),
+        value.size(),
+        NGHTTP2_NV_FLAG_NONE
+    };
+}
+
+int selectAlpn(SSL *, const unsigned char **out, unsigned char *outLength,
+               const unsigned char *in, unsigned int inLength, void *) {
+    for (unsigned int i = 0; i < inLength; i += in[i] + 1u) {
+        if (in[i] == 2 && i + 3 <= inLength && std::memcmp(in + i + 1, "h2", 2) == 0) {
+            *out = in + i + 1;
+            *outLength = 2;
+            return SSL_TLSEXT_ERR_OK;
+        }
+    }
+    return SSL_TLSEXT_ERR_NOACK;
+}
+#endif
+
+}
+
+#ifdef WSS_ENABLE_HTTP2
+/// \brief Client HTTP/2 connection. nghttp2 session and all streams of it are used only by handlers of session
+/// strand, nghttp2 callbacks are called from mem_recv/mem_send, so they run in these handlers too
+class wss::Http2Gateway::Session : public std::enable_shared_from_this<Session> {
+ public:
+    explicit Session(wss::Http2Gateway &gateway) :
+        m_gateway(gateway),
+        m_options(gateway.m_options),
+        m_strand(gateway.m_service),
+        m_socket(gateway.m_tls
+                 ? std::make_unique<SocketLayerWrapper>(gateway.m_service, *gateway.m_tls)
+                 : std::make_unique<SocketLayerWrapper>(gateway.m_service)),
+        m_idle(gateway.m_service) { }
+
+    ~Session() {
+        if (m_session) {
+            nghttp2_session_del(m_session);
+        }
+    }
+
+    tcp::socket &getSocket() {
+        return m_socket->stream_layer();
+    }
+
+    wss::server::websocket::ConnectionAdmission::Ticket &getAdmissionTicket() noexcept {
+        return m_admissionTicket;
+    }
+
+    void start() {
+        ErrorCode ignored;
+        m_peer = getSocket().remote_endpoint(ignored);
+        m_local = getSocket().local_endpoint(ignored);
+        auto self = shared_from_this();
+        // first handlers may run on other thread before start() returns
+        m_strand.dispatch([self] {
+          self->armIdle();
+          if (self->m_socket->isSecure()) {
+              self->handshake();
+          } else {
+              self->open();
+          }
+        });
+    }
+
+ private:
+    void handshake() {
+        auto self = shared_from_this();
+        m_socket->async_handshake(m_strand.wrap([self](const ErrorCode &error) {
+          if (error) {
+              self->close();
+              return;
+          }
+          const unsigned char *protocol = nullptr;
+          unsigned int length = 0;
+          SSL_get0_alpn_selected(self->m_socket->rawSecure()->native_handle(), &protocol, &length);
+          if (length != 2 || std::memcmp(protocol, "h2", 2) != 0) {
+              WSS_LOG_F(wss::logging::LevelDebug, "HTTP/2", "Client %s didn't negotiate h2",
+                        self->getPeer().c_str());
+              self->close();
+              return;
+          }
+          self->open();
+        }));
+    }
+
+    /// \brief Extended CONNECT stream and its listener connection
+    struct Stream {
+      Stream(boost::asio::io_service &service, int32_t id) :
+          id(id),
+          upstream(service),
+          response(MAX_RESPONSE_HEAD) { }
+
+      const int32_t id;
+      std::string method;
+      std::string protocol;
+      std::string path;
+      std::string authority;
+      std::vector<std::pair<std::string, std::string>> headers;
+
+      tcp::socket upstream;
+      std::string request;
+      boost::asio::streambuf response;
+      std::array<char, READ_CHUNK> readBuffer;
+
+      /// \brief Request is valid, listener connection is opened
+      bool accepted = false;
+      /// \brief Listener answered 101, DATA is bridged
+      bool open = false;
+      bool closed = false;
+
+      /// \brief Client DATA not yet written to listener, front one is being written
+      std::deque<std::string> toUpstream;
+      bool writing = false;
+      bool clientEnded = false;
+      bool upstreamShutdown = false;
+
+      /// \brief Listener data not yet taken by nghttp2, from toClientOffset
+      std::string toClient;
+      std::size_t toClientOffset = 0;
+      bool reading = false;
+      bool upstreamEnded = false;
+      /// \brief Data provider returned NGHTTP2_ERR_DEFERRED, stream must be resumed on new data
+      bool deferred = false;
+
+      std::size_t toClientSize() const noexcept {
+          return toClient.size() - toClientOffset;
+      }
+    };
+    using StreamPtr = std::shared_ptr<Stream>;
+
+    wss::Http2Gateway &m_gateway;
+    const Options &m_options;
+    boost::asio::io_service::strand m_strand;
+    std::unique_ptr<SocketLayerWrapper> m_socket;
+    boost::asio::steady_timer m_idle;
+    tcp::endpoint m_peer;
+    tcp::endpoint m_local;
+    wss::server::websocket::ConnectionAdmission::Ticket m_admissionTicket;
+    nghttp2_session *m_session = nullptr;
+    std::unordered_map<int32_t, StreamPtr> m_streams;
+    std::array<char, READ_CHUNK> m_input;
+    std::string m_output;
+    bool m_writing = false;
+    bool m_active = false;
+    bool m_closed = false;
+
+    static Session &from(void *userData) {
+        return *static_cast<Session *>(userData);
+    }
+
+    StreamPtr findStream(int32_t id) const {
+        auto it = m_streams.find(id);
+        return it == m_streams.end() ? nullptr : it->second;
+    }
+
+    void open() {
+        nghttp2_session_callbacks *callbacks = nullptr;
+        nghttp2_session_callbacks_new(&callbacks);
+        nghttp2_session_callbacks_set_on_begin_headers_callback(callbacks, onBeginHeaders);
+        nghttp2_session_callbacks_set_on_header_callback(callbacks, onHeader);
+        nghttp2_session_callbacks_set_on_frame_recv_callback(callbacks, onFrameRecv);
+        nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, onDataChunk);
+        nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, onStreamClose);
+        nghttp2_option *option = nullptr;
+        nghttp2_option_new(&option);
+        // window is updated only when data is written to listener
+        nghttp2_option_set_no_auto_window_update(option, 1);
+        const int result = nghttp2_session_server_new2(&m_session, callbacks, this, option);
+        nghttp2_option_del(option);
+        nghttp2_session_callbacks_del(callbacks);
+        if (result != 0) {
+            m_session = nullptr;
+            close();
+            return;
+        }
+
+        const auto window = static_cast<uint32_t>(
+            std::min<std::size_t>(m_options.streamBufferBytes, NGHTTP2_MAX_WINDOW_SIZE));
+        const nghttp2_settings_entry settings[] = {
+            {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, m_options.maxStreams},
+            {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, window},
+            {NGHTTP2_SETTINGS_ENABLE_CONNECT_PROTOCOL, 1}
+        };
+        nghttp2_submit_settings(m_session, NGHTTP2_FLAG_NONE, settings, 3);
+        const auto connectionWindow = static_cast<int32_t>(std::min<uint64_t>(
+            uint64_t(window) * std::max<uint32_t>(1, m_options.maxStreams), NGHTTP2_MAX_WINDOW_SIZE));
+        nghttp2_session_set_local_window_size(m_session, NGHTTP2_FLAG_NONE, 0, connectionWindow);
+
+        read();
+        flush();
+    }
+
+    void read() {
+        auto self = shared_from_this();
+        m_socket->async_read_some(boost::asio::buffer(m_input), m_strand.wrap(
+            [self](const ErrorCode &error, std::size_t read) {
+              if (error || self->m_closed) {
+                  self->close();
+                  return;
+              }
+              self->m_gateway.m_metrics.bytesIn += read;
+              self->m_active = true;
+              const auto result = nghttp2_session_mem_recv(
+                  self->m_session, reinterpret_cast<const uint8_t *>(self->m_input.data()), read);
+              if (result < 0) {
+                  WSS_LOG_F(wss::logging::LevelDebug, "HTTP/2", "Protocol error from %s: %s",
+                            self->getPeer().c_str(), nghttp2_strerror(static_cast<int>(result)));
+                  self->close();
+                  return;
+              }
+              self->flush();
+              if (!self->m_closed) {
+                  self->read();
+              }
+            }));
+    }
+
+    /// \brief Writes frames queued in nghttp2 session, closes connection when session is finished
+    void flush() {
+        if (m_closed || m_writing) {
+            return;
+        }
+        m_output.clear();
+        while (m_output.size() < WRITE_CHUNK) {
+            const uint8_t *data = nullptr;
+            const auto length = nghttp2_session_mem_send(m_session, &data);
+            if (length < 0) {
+                close();
+                return;
+            }
+            if (length == 0) {
+                break;
+            }
+            m_output.append(reinterpret_cast<const char *>(data), static_cast<std::size_t>(length));
+        }
+        if (m_output.empty()) {
+            if (!nghttp2_session_want_read(m_session) && !nghttp2_session_want_write(m_session)) {
+                close();
+            }
+            return;
+        }
+
+        m_writing = true;
+        auto self = shared_from_this();
+        const std::vector<boost::asio::const_buffer> buffers = {boost::asio::buffer(m_output)};
+        m_socket->async_write(buffers, m_strand.wrap([self](const ErrorCode &error, std::size_t written) {
+          self->m_writing = false;
+          if (error) {
+              self->close();
+              return;
+          }
+          self->m_gateway.m_metrics.bytesOut += written;
+          self->flush();
+        }));
+    }
+
+    void armIdle() {
+        if (m_options.idleSeconds == 0) {
+            return;
+        }
+        auto self = shared_from_this();
+        m_idle.expires_from_now(std::chrono::seconds(m_options.idleSeconds));
+        m_idle.async_wait(m_strand.wrap([self](const ErrorCode &error) {
+          if (error || self->m_closed) {
+              return;
+          }
+          if (!self->m_active && self->m_streams.empty()) {
+              if (!self->m_session) {
+                  // TLS handshake is not finished
+                  self->close();
+                  return;
+              }
+              nghttp2_session_terminate_session(self->m_session, NGHTTP2_NO_ERROR);
+              self->flush();
+              return;
+          }
+          self->m_active = false;
+          self->armIdle();
+        }));
+    }
+
+    static int onBeginHeaders(nghttp2_session *, const nghttp2_frame *frame, void *userData) {
+        if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST) {
+            return 0;
+        }
+        Session &self = from(userData);
+        self.m_streams[frame->hd.stream_id] = std::make_shared<Stream>(self.m_gateway.m_service, frame->hd.stream_id);
+        self.m_gateway.m_metrics.streams++;
+        self.m_gateway.m_metrics.streamsTotal++;
+        return 0;
+    }
+
+    static int onHeader(nghttp2_session *, const nghttp2_frame *frame,
+                        const uint8_t *name, std::size_t nameLength,
+                        const uint8_t *value, std::size_t valueLength,
+                        uint8_t, void *userData) {
+        if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_REQUEST) {
+            return 0;
+        }
+        const StreamPtr stream = from(userData).findStream(frame->hd.stream_id);
+        if (!stream) {
+            return 0;
+        }
+        // names are lowercase and values have no CR/LF: both are validated by nghttp2
+        std::string key(reinterpret_cast<const char *>(name), nameLength);
+        std::string val(reinterpret_cast<const char *>(value), valueLength);
+        if (key == ":method") {
+            stream->method = std::move(val);
+        } else if (key == ":protocol") {
+            stream->protocol = std::move(val);
+        } else if (key == ":path") {
+            stream->path = std::move(val);
+        } else if (key == ":authority") {
+            stream->authority = std::move(val);
+        } else if (key[0] != ':' && !isHopHeader(key)) {
+            stream->headers.emplace_back(std::move(key), std::move(val));
+        }
+        return 0;
+    }
+
+    static int onFrameRecv(nghttp2_session *, const nghttp2_frame *frame, void *userData) {
+        if (frame->hd.type != NGHTTP2_HEADERS && frame->hd.type != NGHTTP2_DATA) {
+            return 0;
+        }
+        Session &self = from(userData);
+        const StreamPtr stream = self.findStream(frame->hd.stream_id);
+        if (!stream) {
+            return 0;
+        }
+        if (frame->hd.type == NGHTTP2_HEADERS && frame->headers.cat == NGHTTP2_HCAT_REQUEST) {
+            self.onRequest(stream);
+        }
+        if ((frame->hd.flags & NGHTTP2_FLAG_END_STREAM) != 0) {
+            stream->clientEnded = true;
+            self.writeUpstream(stream);
+        }
+        return 0;
+    }
+
+    static int onDataChunk(nghttp2_session *session, uint8_t, int32_t streamId,
+                           const uint8_t *data, std::size_t length, void *userData) {
+        const StreamPtr stream = from(userData).findStream(streamId);
+        if (!stream || !stream->accepted) {
+            // nobody reads it: window is given back at once
+            nghttp2_session_consume(session, streamId, length);
+            return 0;
+        }
+        stream->toUpstream.emplace_back(reinterpret_cast<const char *>(data), length);
+        from(userData).writeUpstream(stream);
+        return 0;
+    }
+
+    static int onStreamClose(nghttp2_session *session, int32_t streamId, uint32_t, void *userData) {
+        Session &self = from(userData);
+        auto it = self.m_streams.find(streamId);
+        if (it == self.m_streams.end()) {
+            return 0;
+        }
+        std::size_t pending = 0;
+        for (const auto &chunk: it->second->toUpstream) {
+            pending += chunk.size();
+        }
+        // connection window of data, that will never be written
+        nghttp2_session_consume_connection(session, pending);
+        closeUpstream(*it->second);
+        self.m_streams.erase(it);
+        self.m_gateway.m_metrics.streams--;
+        return 0;
+    }
+
+    static ssize_t onReadData(nghttp2_session *, int32_t streamId, uint8_t *buffer, std::size_t length,
+                              uint32_t *flags, nghttp2_data_source *, void *userData) {
+        Session &self = from(userData);
+        const StreamPtr stream = self.findStream(streamId);
+        if (!stream) {
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+        }
+        const std::size_t available = stream->toClientSize();
+        if (available == 0) {
+            if (stream->upstreamEnded) {
+                *flags |= NGHTTP2_DATA_FLAG_EOF;
+                return 0;
+            }
+            stream->deferred = true;
+            return NGHTTP2_ERR_DEFERRED;
+        }
+        const std::size_t size = std::min(available, length);
+        std::memcpy(buffer, stream->toClient.data() + stream->toClientOffset, size);
+        stream->toClientOffset += size;
+        if (stream->toClientOffset == stream->toClient.size()) {
+            stream->toClient.clear();
+            stream->toClientOffset = 0;
+        }
+        // paused by full buffer
+        self.readUpstream(stream);
+        return static_cast<ssize_t>(size);
+    }
+
+    void onRequest(const StreamPtr &stream) {
+        const std::string path = stream->path.substr(0, stream->path.find('?'));
+        if (path != m_options.path) {
+            reject(*stream, "404");
+            return;
+        }
+        if (stream->method != "CONNECT" || stream->protocol != "websocket") {
+            reject(*stream, "400");
+            return;
+        }
+        stream->accepted = true;
+
+        auto self = shared_from_this();
+        stream->upstream.async_connect(m_gateway.m_upstream, m_strand.wrap([self, stream](const ErrorCode &error) {
+          if (stream->closed || self->m_closed) {
+              return;
+          }
+          if (error) {
+              WSS_LOG_F(wss::logging::LevelWarning, "HTTP/2", "Unable to connect websocket listener: %s",
+                        error.message().c_str());
+              self->reject(*stream, "502");
+              self->flush();
+              return;
+          }
+          ErrorCode ignored;
+          stream->upstream.set_option(tcp::no_delay(true), ignored);
+          self->writeUpgrade(stream);
+        }));
+    }
+
+    /// \brief Answers stream without body and ends it
+    void reject(Stream &stream, const std::string &status) {
+        m_gateway.m_metrics.rejectedStreams++;
+        closeUpstream(stream);
+        const std::string name = ":status";
+        const nghttp2_nv headers[] = {makeHeader(name, status)};
+        nghttp2_submit_response(m_session, stream.id, headers, 1, nullptr);
+    }
+
+    void writeUpgrade(const StreamPtr &stream) {
+        // always: listener counts stream by client address, not by loopback one of bridge
+        std::string &request = stream->request;
+        request = wss::server::websocket::ProxyProtocol::writeHeader(m_peer, m_local);
+        request += "GET " + stream->path + " HTTP/1.1\r\n";
+        request += "Host: " + (stream->authority.empty() ? std::string("localhost") : stream->authority) + "\r\n";
+        request += "Upgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Version: 13\r\n";
+        request += "Sec-WebSocket-Key: " + websocketKey() + "\r\n";
+        for (const auto &header: stream->headers) {
+            request += header.first + ": " + header.second + "\r\n";
+        }
+        request += "\r\n";
+        stream->headers.clear();
+
+        auto self = shared_from_this();
+        boost::asio::async_write(stream->upstream, boost::asio::buffer(request), m_strand.wrap(
+            [self, stream](const ErrorCode &error, std::size_t) {
+              if (stream->closed || self->m_closed) {
+                  return;
+              }
+              if (error) {
+                  self->reject(*stream, "502");
+                  self->flush();
+                  return;
+              }
+              stream->request.clear();
+              self->readUpgrade(stream);
+            }));
+    }
+
+    void readUpgrade(const StreamPtr &stream) {
+        auto self = shared_from_this();
+        boost::asio::async_read_until(stream->upstream, stream->response, "\r\n\r\n", m_strand.wrap(
+            [self, stream](const ErrorCode &error, std::size_t) {
+              if (stream->closed || self->m_closed) {
+                  return;
+              }
+              if (error) {
+                  self->reject(*stream, "502");
+              } else {
+                  self->onUpgrade(stream);
+              }
+              self->flush();
+            }));
+    }
+
+    void onUpgrade(const StreamPtr &stream) {
+        std::istream input(&stream->response);
+        std::string line;
+        std::getline(input, line);
+        if (line.size() < 12 || line.compare(0, 5, "HTTP/") != 0) {
+            reject(*stream, "502");
+            return;
+        }
+        const std::string status = line.substr(9, 3);
+        if (status != "101") {
+            // listener answer (401, 403, 429, 503...) is returned to client as is
+            reject(*stream, status);
+            return;
+        }
+
+        std::string subprotocol;
+        std::string extensions;
+        while (std::getline(input, line) && line != "\r") {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            const std::size_t colon = line.find(':');
+            if (colon == std::string::npos) {
+                continue;
+            }
+            std::string name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) {
+              return static_cast<char>(std::tolower(c));
+            });
+            const std::size_t valueStart = line.find_first_not_of(' ', colon + 1);
+            const std::string value = valueStart == std::string::npos ? std::string() : line.substr(valueStart);
+            if (name == "sec-websocket-protocol") {
+                subprotocol = value;
+            } else if (name == "sec-websocket-extensions") {
+                extensions = value;
+            }
+        }
+
+        // frames sent by listener right after handshake
+        const std::size_t rest = stream->response.size();
+        if (rest > 0) {
+            stream->toClient.append(boost::asio::buffer_cast<const char *>(stream->response.data()), rest);
+            stream->response.consume(rest);
+        }
+
+        const std::string statusName = ":status";
+        const std::string ok = "200";
+        const std::string subprotocolName = "sec-websocket-protocol";
+        const std::string extensionsName = "sec-websocket-extensions";
+        std::vector<nghttp2_nv> headers = {makeHeader(statusName, ok)};
+        if (!subprotocol.empty()) {
+            headers.push_back(makeHeader(subprotocolName, subprotocol));
+        }
+        if (!extensions.empty()) {
+            headers.push_back(makeHeader(extensionsName, extensions));
+        }
+        nghttp2_data_provider provider;
+        provider.source.ptr = nullptr;
+        provider.read_callback = onReadData;
+        if (nghttp2_submit_response(m_session, stream->id, headers.data(), headers.size(), &provider) != 0) {
+            closeUpstream(*stream);
+            return;
+        }
+
+        stream->open = true;
+        readUpstream(stream);
+        writeUpstream(stream);
+    }
+
+    /// \brief Reads listener data, until stream buffer is full
+    void readUpstream(const StreamPtr &stream) {
+        if (!stream->open || stream->reading || stream->upstreamEnded || stream->closed
+            || stream->toClientSize() >= m_options.streamBufferBytes) {
+            return;
+        }
+        stream->reading = true;
+        auto self = shared_from_this();
+        stream->upstream.async_read_some(boost::asio::buffer(stream->readBuffer), m_strand.wrap(
+            [self, stream](const ErrorCode &error, std::size_t read) {
+              stream->reading = false;
+              if (stream->closed || self->m_closed) {
+                  return;
+              }
+              if (error) {
+                  // listener closed websocket: stream is ended after buffered data
+                  stream->upstreamEnded = true;
+              } else {
+                  stream->toClient.append(stream->readBuffer.data(), read);
+              }
+              if (stream->deferred) {
+                  stream->deferred = false;
+                  nghttp2_session_resume_data(self->m_session, stream->id);
+              }
+              self->readUpstream(stream);
+              self->flush();
+            }));
+    }
+
+    /// \brief Writes client data to listener one chunk at a time, window of chunk is given back when it's written
+    void writeUpstream(const StreamPtr &stream) {
+        if (!stream->open || stream->writing || stream->closed) {
+            return;
+        }
+        if (stream->toUpstream.empty()) {
+            if (stream->clientEnded && !stream->upstreamShutdown) {
+                stream->upstreamShutdown = true;
+                ErrorCode ignored;
+                stream->upstream.shutdown(tcp::socket::shutdown_send, ignored);
+            }
+            return;
+        }
+
+        stream->writing = true;
+        auto self = shared_from_this();
+        boost::asio::async_write(stream->upstream, boost::asio::buffer(stream->toUpstream.front()), m_strand.wrap(
+            [self, stream](const ErrorCode &error, std::size_t written) {
+              stream->writing = false;
+              if (stream->closed || self->m_closed) {
+                  return;
+              }
+              if (error) {
+                  nghttp2_submit_rst_stream(self->m_session, NGHTTP2_FLAG_NONE, stream->id, NGHTTP2_CANCEL);
+                  self->flush();
+                  return;
+              }
+              stream->toUpstream.pop_front();
+              nghttp2_session_consume(self->m_session, stream->id, written);
+              self->writeUpstream(stream);
+              self->flush();
+            }));
+    }
+
+    static void closeUpstream(Stream &stream) {
+        stream.closed = true;
+        ErrorCode ignored;
+        stream.upstream.close(ignored);
+    }
+
+    std::string getPeer() const {
+        return m_peer.address().to_string() + ":" + std::to_string(m_peer.port());
+    }
+
+    void close() {
+        if (m_closed) {
+            return;
+        }
+        m_closed = true;
+        for (auto &item: m_streams) {
+            closeUpstream(*item.second);
+        }
+        m_gateway.m_metrics.streams -= m_streams.size();
+        m_streams.clear();
+        ErrorCode ignored;
+        m_idle.cancel(ignored);
+        m_socket->lowest_layer().close(ignored);
+        m_gateway.m_metrics.connections--;
+    }
+};
+#endif
+
+bool wss::Http2Gateway::isAvailable() noexcept {
+#ifdef WSS_ENABLE_HTTP2
+    return true;
+#else
+    return false;
+#endif
+}
+
+wss::Http2Gateway::Http2Gateway(const Options &options) :
+    m_options(options),
+    m_acceptor(m_service) {
+    if (options.port == 0 || options.upstreamPort == 0) {
+        throw std::invalid_argument("HTTP/2 port and websocket listener port required");
+    }
+    if (options.threads == 0) {
+        throw std::invalid_argument("HTTP/2 threads must be at least 1");
+    }
+    if (!isAvailable()) {
+        throw std::runtime_error("HTTP/2 requires build with -DENABLE_HTTP2=On");
+    }
+
+#ifdef WSS_ENABLE_HTTP2
+    ErrorCode error;
+    const auto upstreamAddress = boost::asio::ip::address::from_string(options.upstreamAddress, error);
+    if (error) {
+        throw std::invalid_argument("Invalid websocket listener address " + options.upstreamAddress);
+    }
+    m_upstream = tcp::endpoint(upstreamAddress, options.upstreamPort);
+
+    if (!options.crtPath.empty()) {
+        m_tls = std::make_unique<boost::asio::ssl::context>(boost::asio::ssl::context::tlsv12);
+        try {
+            m_tls->use_certificate_chain_file(options.crtPath);
+            m_tls->use_private_key_file(options.keyPath, boost::asio::ssl::context::pem);
+        } catch (const boost::system::system_error &e) {
+            throw std::runtime_error("HTTP/2 certificate: " + std::string(e.what()));
+        }
+        m_tls->set_options(SSL_OP_NO_COMPRESSION);
+        SSL_CTX_set_alpn_select_cb(m_tls->native_handle(), selectAlpn, nullptr);
+    }
+#endif
+}
+
+wss::Http2Gateway::~Http2Gateway() {
+    stop();
+}
+
+void wss::Http2Gateway::start() {
+    try {
+        const tcp::endpoint endpoint(boost::asio::ip::address::from_string(m_options.address), m_options.port);
+        m_acceptor.open(endpoint.protocol());
+        m_acceptor.set_option(tcp::acceptor::reuse_address(true));
+        m_acceptor.bind(endpoint);
+        m_acceptor.listen();
+    } catch (const boost::system::system_error &e) {
+        throw std::runtime_error(
+            "can't listen " + m_options.address + ":" + std::to_string(m_options.port) + ": " + e.what());
+    }
+    accept();
+
+    m_work = std::make_unique<boost::asio::io_service::work>(m_service);
+    for (std::size_t i = 0; i < m_options.threads; i++) {
+        m_threads.create_thread([this] {
+          wss::affinity::pin(wss::affinity::Group::Io);
+          m_service.run();
+        });
+    }
+    L_INFO_F("HTTP/2", "Websockets over HTTP/2 at %s://%s:%u%s", m_tls ? "https" : "http",
+             m_options.address.c_str(), static_cast<unsigned>(m_options.port), m_options.path.c_str());
+}
+
+void wss::Http2Gateway::stop() {
+    if (!m_work) {
+        return;
+    }
+    m_work.reset();
+    m_service.stop();
+    m_threads.join_all();
+    // pending handlers own sessions, they are destroyed with service and close sockets
+    ErrorCode ignored;
+    m_acceptor.close(ignored);
+}
+
+void wss::Http2Gateway::setAdmission(std::shared_ptr<wss::server::websocket::ConnectionAdmission> admission) {
+    m_admission = std::move(admission);
+}
+
+const wss::Http2Metrics &wss::Http2Gateway::getMetrics() const noexcept {
+    return m_metrics;
+}
+
+const wss::Http2Gateway::Options &wss::Http2Gateway::getOptions() const noexcept {
+    return m_options;
+}
+
+void wss::Http2Gateway::accept() {
+#ifdef WSS_ENABLE_HTTP2
+    auto session = std::make_shared<Session>(*this);
+    m_acceptor.async_accept(session->getSocket(), [this, session](const ErrorCode &error) {
+      if (!m_acceptor.is_open() || error == boost::asio::error::operation_aborted) {
+          return;
+      }
+      if (!error && admit(*session)) {
+          ErrorCode ignored;
+          session->getSocket().set_option(tcp::no_delay(true), ignored);
+          m_metrics.connections++;
+          session->start();
+      }
+      accept();
+    });
+#endif
+}
+
+#ifdef WSS_ENABLE_HTTP2
+bool wss::Http2Gateway::admit(Session &session) {
+    using wss::server::websocket::ConnectionAdmission;
+    if (!m_admission || !m_admission->isEnabled()) {
+        return true;
+    }
+    ErrorCode ignored;
+    const tcp::endpoint peer = session.getSocket().remote_endpoint(ignored);
+    const ConnectionAdmission::Result result = m_admission->admit(peer.address(), session.getAdmissionTicket());
+    if (result == ConnectionAdmission::Result::Accepted) {
+        return true;
+    }
+    wss::metrics::add(result == ConnectionAdmission::Result::TooManyConnections
+                      ? wss::metrics::Counter::AdmissionRejectedConnections
+                      : wss::metrics::Counter::AdmissionRejectedRate);
+    session.getSocket().close(ignored);
+    return false;
+}
+#endif
@@ -0,0 +1,115 @@
+/**
+ * wsserver
+ * Http2Gateway.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_HTTP2GATEWAY_H
+#define WSSERVER_HTTP2GATEWAY_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/thread.hpp>
+#include "../base/ws/ConnectionAdmission.hpp"
+
+namespace wss {
+
+struct Http2Metrics {
+  std::atomic<uint64_t> connections{0};
+  std::atomic<uint64_t> streams{0};
+  std::atomic<uint64_t> streamsTotal{0};
+  std::atomic<uint64_t> rejectedStreams{0};
+  std::atomic<uint64_t> bytesIn{0};
+  std::atomic<uint64_t> bytesOut{0};
+};
+
+/// \brief WebSockets over HTTP/2 (RFC 8441): mobile clients open many chat streams over one TLS connection,
+/// without TCP and TLS handshake per websocket.
+/// Stream is extended CONNECT request (:method CONNECT, :protocol websocket, :path of chat endpoint), every one
+/// is bridged to plain websocket listener of this server over loopback tcp: gateway sends HTTP/1.1 upgrade
+/// request with headers of stream, and on 101 answers stream with 200. After that DATA frames carry websocket
+/// frames as is in both directions, so authentication, codecs, routing and limits of chat connections apply
+/// unchanged. Non-101 answer of listener is returned as stream status.
+/// Every bridged stream starts with PROXY v2 header of client address (listener accepts it from local peers,
+/// see Config::localProxyProtocol), so per source limits count streams of client, and HTTP/2 connections are
+/// checked by the same admission when they are accepted.
+///
+/// Both directions are flow controlled: client DATA is acknowledged (WINDOW_UPDATE) only after it's written to
+/// listener, listener reads pause while stream has more than streamBufferBytes not sent to client.
+/// Requires build with -DENABLE_HTTP2=On (libnghttp2)
+class Http2Gateway {
+ public:
+    struct Options {
+      std::string address = "0.0.0.0";
+      unsigned short port = 0;
+      /// \brief TLS certificate and key, ALPN "h2". Empty - cleartext HTTP/2 with prior knowledge (behind TLS proxy)
+      std::string crtPath;
+      std::string keyPath;
+      /// \brief Path of websocket streams, query is not compared
+      std::string path = "/chat";
+      /// \brief Plain websocket listener of server
+      std::string upstreamAddress = "127.0.0.1";
+      unsigned short upstreamPort = 0;
+      /// \brief SETTINGS_MAX_CONCURRENT_STREAMS of connection
+      uint32_t maxStreams = 100;
+      /// \brief Per stream buffer of each direction, it's also initial flow control window
+      std::size_t streamBufferBytes = 256 * 1024;
+      /// \brief Connection without streams is closed after this time, 0 - never
+      uint32_t idleSeconds = 60;
+      /// \brief Threads running connections
+      std::size_t threads = 1;
+    };
+
+    /// \brief Whether server is built with libnghttp2
+    static bool isAvailable() noexcept;
+
+    /// \param options
+    /// \throws std::invalid_argument if ports or threads are not set
+    /// \throws std::runtime_error if build has no HTTP/2 support, or certificate can't be loaded
+    explicit Http2Gateway(const Options &options);
+    ~Http2Gateway();
+    Http2Gateway(const Http2Gateway &) = delete;
+    Http2Gateway &operator=(const Http2Gateway &) = delete;
+
+    /// \brief Opens listener and starts threads
+    /// \throws std::runtime_error if unable to listen
+    void start();
+    /// \brief Closes listener and connections, joins threads
+    void stop();
+
+    /// \brief Per source limits of accepted HTTP/2 connections, shared with websocket listener. Call before start()
+    /// \param admission nullptr - no limits
+    void setAdmission(std::shared_ptr<wss::server::websocket::ConnectionAdmission> admission);
+
+    const Http2Metrics &getMetrics() const noexcept;
+    const Options &getOptions() const noexcept;
+
+ private:
+    class Session;
+
+    const Options m_options;
+    boost::asio::io_service m_service;
+    std::unique_ptr<boost::asio::io_service::work> m_work;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    boost::asio::ip::tcp::endpoint m_upstream;
+    /// \brief nullptr - cleartext
+    std::unique_ptr<boost::asio::ssl::context> m_tls;
+    boost::thread_group m_threads;
+    Http2Metrics m_metrics;
+    std::shared_ptr<wss::server::websocket::ConnectionAdmission> m_admission;
+
+    void accept();
+    /// \brief Takes admission slot of connection peer
+    /// \return false if peer is over limits: connection is closed
+    bool admit(Session &session);
+};
+
+}
+
+#endif //WSSERVER_HTTP2GATEWAY_H
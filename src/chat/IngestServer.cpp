@@ -0,0 +1,300 @@
+/**
+ * wsserver
+ * IngestServer.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "IngestServer.h"
+#include <array>
+#include <deque>
+#include <stdexcept>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+#include <openssl/crypto.h>
+#include "../base/Affinity.h"
+#include "../helpers/logging.h"
+
+namespace {
+
+using boost::asio::ip::tcp;
+using ErrorCode = boost::system::error_code;
+
+/// \brief u32 length of frame
+constexpr std::size_t HEADER_SIZE = 4;
+/// \brief u32 batch sequence of producer frame
+constexpr std::size_t SEQUENCE_SIZE = 4;
+/// \brief Unwritten acks of connection, when reached, frames are not read until producer reads acks
+constexpr std::size_t MAX_PENDING_ACKS = 1024;
+
+uint32_t readU32(const char *data) {
+    uint32_t value = 0;
+    for (std::size_t i = 0; i < 4; i++) {
+        value = (value << 8) | static_cast<uint8_t>(data[i]);
+    }
+    return value;
+}
+
+void putU32(std::string &out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>((value >> shift) & 0xFFu));
+    }
+}
+
+}
+
+/// \brief Producer connection. Frames are read one by one, acks are queued and written in order.
+/// Handlers of session run through its strand, so connection threads don't need locks
+class wss::IngestServer::Session : public std::enable_shared_from_this<Session> {
+ public:
+    explicit Session(wss::IngestServer &server) :
+        m_server(server),
+        m_strand(server.m_service),
+        m_socket(server.m_service),
+        m_authorized(server.m_options.token.empty()) { }
+
+    tcp::socket &getSocket() {
+        return m_socket;
+    }
+
+    void start() {
+        readHeader();
+    }
+
+ private:
+    wss::IngestServer &m_server;
+    boost::asio::io_service::strand m_strand;
+    tcp::socket m_socket;
+    std::array<char, HEADER_SIZE> m_header;
+    std::vector<char> m_body;
+    std::deque<std::string> m_acks;
+    bool m_authorized;
+    bool m_closed = false;
+    /// \brief Reading is stopped by full acks queue
+    bool m_paused = false;
+
+    void readHeader() {
+        auto self = shared_from_this();
+        boost::asio::async_read(m_socket, boost::asio::buffer(m_header), m_strand.wrap(
+            [self](const ErrorCode &error, std::size_t) {
+              if (error) {
+                  self->close();
+                  return;
+              }
+              const uint32_t length = readU32(self->m_header.data());
+              // unauthenticated producer doesn't make server allocate big buffer
+              const std::size_t maxLength = self->m_authorized
+                                            ? self->m_server.m_options.maxFrameBytes
+                                            : SEQUENCE_SIZE + self->m_server.m_options.token.size();
+              if (length < SEQUENCE_SIZE || length > maxLength) {
+                  WSS_LOG_F(wss::logging::LevelWarning, "Ingest", "Invalid frame size %u from %s",
+                            length, self->getPeer().c_str());
+                  self->close();
+                  return;
+              }
+              self->m_body.resize(length);
+              self->readBody();
+            }));
+    }
+
+    void readBody() {
+        auto self = shared_from_this();
+        boost::asio::async_read(m_socket, boost::asio::buffer(m_body), m_strand.wrap(
+            [self](const ErrorCode &error, std::size_t read) {
+              if (error) {
+                  self->close();
+                  return;
+              }
+              self->m_server.m_metrics.bytesIn += read + HEADER_SIZE;
+              self->onFrame();
+              if (self->m_closed) {
+                  return;
+              }
+              if (self->m_acks.size() >= MAX_PENDING_ACKS) {
+                  // producer doesn't read acks: don't queue them without limit
+                  self->m_paused = true;
+                  return;
+              }
+              self->readHeader();
+            }));
+    }
+
+    void onFrame() {
+        const uint32_t sequence = readU32(m_body.data());
+        const char *data = m_body.data() + SEQUENCE_SIZE;
+        const std::size_t length = m_body.size() - SEQUENCE_SIZE;
+        uint32_t accepted = 0;
+        uint32_t rejected = 0;
+
+        if (!m_authorized) {
+            const std::string &token = m_server.m_options.token;
+            // constant time, like jwt signature check
+            if (sequence != 0 || length != token.size() || CRYPTO_memcmp(data, token.data(), length) != 0) {
+                WSS_LOG_F(wss::logging::LevelWarning, "Ingest", "Invalid token from %s", getPeer().c_str());
+                close();
+                return;
+            }
+            m_authorized = true;
+            accepted = 1;
+        } else {
+            m_server.m_metrics.batches++;
+            m_server.dispatch(data, length, accepted, rejected);
+        }
+
+        std::string ack;
+        ack.reserve(HEADER_SIZE + 12);
+        putU32(ack, 12);
+        putU32(ack, sequence);
+        putU32(ack, accepted);
+        putU32(ack, rejected);
+        m_acks.push_back(std::move(ack));
+        if (m_acks.size() == 1) {
+            writeAck();
+        }
+    }
+
+    void writeAck() {
+        auto self = shared_from_this();
+        boost::asio::async_write(m_socket, boost::asio::buffer(m_acks.front()), m_strand.wrap(
+            [self](const ErrorCode &error, std::size_t) {
+              if (error) {
+                  self->close();
+                  return;
+              }
+              self->m_acks.pop_front();
+              if (!self->m_acks.empty()) {
+                  self->writeAck();
+              }
+              if (self->m_paused && !self->m_closed) {
+                  self->m_paused = false;
+                  self->readHeader();
+              }
+            }));
+    }
+
+    std::string getPeer() const {
+        ErrorCode error;
+        const tcp::endpoint peer = m_socket.remote_endpoint(error);
+        return error ? std::string("unknown") : peer.address().to_string() + ":" + std::to_string(peer.port());
+    }
+
+    void close() {
+        if (m_closed) {
+            return;
+        }
+        m_closed = true;
+        ErrorCode ignored;
+        m_socket.close(ignored);
+        m_server.m_metrics.connections--;
+    }
+};
+
+wss::IngestServer::IngestServer(const Options &options) :
+    m_options(options),
+    m_acceptor(m_service) {
+    if (options.port == 0) {
+        throw std::invalid_argument("Ingest port required");
+    }
+    if (options.threads == 0) {
+        throw std::invalid_argument("Ingest threads must be at least 1");
+    }
+    // producer sends messages on behalf of any sender: only loopback listener may go without token
+    ErrorCode ec;
+    const auto listenAddress = boost::asio::ip::address::from_string(options.address, ec);
+    if (options.token.empty() && (ec || !listenAddress.is_loopback())) {
+        throw std::invalid_argument("Ingest token is required to listen on " + options.address);
+    }
+}
+
+wss::IngestServer::~IngestServer() {
+    stop();
+}
+
+void wss::IngestServer::start(Handler handler) {
+    m_handler = std::move(handler);
+    try {
+        const tcp::endpoint endpoint(boost::asio::ip::address::from_string(m_options.address), m_options.port);
+        m_acceptor.open(endpoint.protocol());
+        m_acceptor.set_option(tcp::acceptor::reuse_address(true));
+        m_acceptor.bind(endpoint);
+        m_acceptor.listen();
+    } catch (const boost::system::system_error &e) {
+        throw std::runtime_error(
+            "can't listen " + m_options.address + ":" + std::to_string(m_options.port) + ": " + e.what());
+    }
+    accept();
+
+    m_work = std::make_unique<boost::asio::io_service::work>(m_service);
+    for (std::size_t i = 0; i < m_options.threads; i++) {
+        m_threads.create_thread([this] {
+          wss::affinity::pin(wss::affinity::Group::Io);
+          m_service.run();
+        });
+    }
+    L_INFO_F("Ingest", "Listening for producers at %s:%u", m_options.address.c_str(),
+             static_cast<unsigned>(m_options.port));
+}
+
+void wss::IngestServer::stop() {
+    if (!m_work) {
+        return;
+    }
+    m_work.reset();
+    m_service.stop();
+    m_threads.join_all();
+    // pending handlers own sessions, they are destroyed with service and close sockets
+    ErrorCode ignored;
+    m_acceptor.close(ignored);
+}
+
+const wss::IngestMetrics &wss::IngestServer::getMetrics() const noexcept {
+    return m_metrics;
+}
+
+const wss::IngestServer::Options &wss::IngestServer::getOptions() const noexcept {
+    return m_options;
+}
+
+void wss::IngestServer::accept() {
+    auto session = std::make_shared<Session>(*this);
+    m_acceptor.async_accept(session->getSocket(), [this, session](const ErrorCode &error) {
+      if (!m_acceptor.is_open() || error == boost::asio::error::operation_aborted) {
+          return;
+      }
+      if (!error) {
+          ErrorCode ignored;
+          session->getSocket().set_option(tcp::no_delay(true), ignored);
+          m_metrics.connections++;
+          session->start();
+      }
+      accept();
+    });
+}
+
+void wss::IngestServer::dispatch(const char *data, std::size_t length, uint32_t &accepted, uint32_t &rejected) {
+    if (!MessagePayload::isBinaryBatch(data, length)) {
+        if (m_handler(MessagePayload::fromBinary(data, length))) {
+            accepted++;
+        } else {
+            rejected++;
+        }
+    } else {
+        std::vector<MessagePayload> payloads;
+        try {
+            payloads = MessagePayload::fromBinaryBatch(data, length);
+        } catch (const std::exception &e) {
+            WSS_LOG_F(wss::logging::LevelWarning, "Ingest", "Invalid batch: %s", e.what());
+            rejected++;
+        }
+        for (auto &payload: payloads) {
+            if (m_handler(std::move(payload))) {
+                accepted++;
+            } else {
+                rejected++;
+            }
+        }
+    }
+    m_metrics.accepted += accepted;
+    m_metrics.rejected += rejected;
+}
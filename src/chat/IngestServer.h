@@ -0,0 +1,97 @@
+/**
+ * wsserver
+ * IngestServer.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_INGESTSERVER_H
+#define WSSERVER_INGESTSERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include "Message.h"
+
+namespace wss {
+
+struct IngestMetrics {
+  std::atomic<uint64_t> connections{0};
+  std::atomic<uint64_t> batches{0};
+  std::atomic<uint64_t> accepted{0};
+  std::atomic<uint64_t> rejected{0};
+  std::atomic<uint64_t> bytesIn{0};
+};
+
+/// \brief Streaming ingest for backends: persistent tcp connections, that carry batches of binary envelopes,
+/// each batch is acknowledged. Producer doesn't wait for ack to send next batch, acks come in order of batches.
+/// Connection is not read while 1024 acks are unwritten, so producer must read acks.
+///
+/// Every frame is u32 length (big endian, like cluster records) and body of this length.
+/// Producer frame: u32 batch sequence, then binary batch (MessagePayload::isBinaryBatch()) or single envelope
+/// (MessagePayload::toBinary() layout, id is generated by server).
+/// Server frame: u32 batch sequence, u32 accepted, u32 rejected.
+/// If token is set, first producer frame is sequence 0 and token, acknowledged with accepted 1,
+/// wrong token closes connection
+class IngestServer {
+ public:
+    struct Options {
+      std::string address = "127.0.0.1";
+      unsigned short port = 0;
+      /// \brief Empty - producers are not authenticated. Required, unless address is loopback one
+      std::string token;
+      /// \brief Max producer frame, larger one closes connection. Frame before token is limited to token size
+      std::size_t maxFrameBytes = 16 * 1024 * 1024;
+      /// \brief Threads running connections
+      std::size_t threads = 1;
+    };
+
+    /// \brief Dispatches payload, called by connection thread. Returns false if payload is rejected
+    using Handler = std::function<bool(MessagePayload &&payload)>;
+
+    /// \param options
+    /// \throws std::invalid_argument if port or threads are not set, or token is empty while address isn't
+    /// loopback one
+    explicit IngestServer(const Options &options);
+    ~IngestServer();
+    IngestServer(const IngestServer &) = delete;
+    IngestServer &operator=(const IngestServer &) = delete;
+
+    /// \brief Opens listener and starts threads
+    /// \param handler
+    /// \throws std::runtime_error if unable to listen
+    void start(Handler handler);
+    /// \brief Closes listener and connections, joins threads
+    void stop();
+
+    const IngestMetrics &getMetrics() const noexcept;
+    const Options &getOptions() const noexcept;
+
+ private:
+    class Session;
+
+    const Options m_options;
+    boost::asio::io_service m_service;
+    std::unique_ptr<boost::asio::io_service::work> m_work;
+    boost::asio::ip::tcp::acceptor m_acceptor;
+    boost::thread_group m_threads;
+    Handler m_handler;
+    IngestMetrics m_metrics;
+
+    void accept();
+    /// \brief Handles batch body
+    /// \param data
+    /// \param length
+    /// \param accepted
+    /// \param rejected
+    void dispatch(const char *data, std::size_t length, uint32_t &accepted, uint32_t &rejected);
+};
+
+}
+
+#endif //WSSERVER_INGESTSERVER_H
@@ -0,0 +1,253 @@
+/**
+ * wsserver
+ * LocalIngest.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "LocalIngest.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../helpers/logging.h"
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Ring of local ingest requires lock-free 64 bit atomics");
+
+namespace {
+constexpr uint64_t MAGIC = 0x31474E4952535357ULL; // "WSSRING1"
+constexpr uint32_t VERSION = 1;
+/// \brief Idle consumer spins, then yields, then sleeps
+constexpr unsigned IDLE_SPINS = 64;
+constexpr unsigned IDLE_YIELDS = 128;
+
+struct RingHeader {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t slotBytes;
+  uint64_t slots;
+  /// \brief Producers and consumer counters are on their own cache lines
+  alignas(64) std::atomic<uint64_t> tail;
+  alignas(64) std::atomic<uint64_t> rejected;
+};
+static_assert(sizeof(RingHeader) == 192, "Ring header layout is a part of producers ABI");
+
+struct SlotHeader {
+  std::atomic<uint64_t> sequence;
+  uint32_t length;
+  uint32_t reserved;
+};
+static_assert(sizeof(SlotHeader) == 16, "Slot header layout is a part of producers ABI");
+
+RingHeader *header(void *map) noexcept {
+    return static_cast<RingHeader *>(map);
+}
+
+SlotHeader *slotAt(void *map, uint64_t position) noexcept {
+    RingHeader *ring = header(map);
+    char *slots = static_cast<char *>(map) + sizeof(RingHeader);
+    return reinterpret_cast<SlotHeader *>(slots + (position & (ring->slots - 1)) * ring->slotBytes);
+}
+
+std::runtime_error systemError(const std::string &what, const std::string &path) {
+    return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+}
+
+wss::LocalIngest::Producer::Producer(const std::string &path) {
+    const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        throw systemError("Can't open ring", path);
+    }
+    struct stat info{};
+    if (::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(RingHeader)) {
+        ::close(fd);
+        throw std::runtime_error("Not a ring: " + path);
+    }
+    m_mapBytes = static_cast<std::size_t>(info.st_size);
+    m_map = ::mmap(nullptr, m_mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m_map == MAP_FAILED) {
+        m_map = nullptr;
+        throw systemError("Can't map ring", path);
+    }
+    const RingHeader *ring = header(m_map);
+    if (ring->magic != MAGIC || ring->version != VERSION
+        || sizeof(RingHeader) + ring->slots * ring->slotBytes != m_mapBytes) {
+        ::munmap(m_map, m_mapBytes);
+        m_map = nullptr;
+        throw std::runtime_error("Not a ring or unsupported version: " + path);
+    }
+}
+
+wss::LocalIngest::Producer::~Producer() {
+    if (m_map) {
+        ::munmap(m_map, m_mapBytes);
+    }
+}
+
+bool wss::LocalIngest::Producer::push(const char *data, std::size_t length) noexcept {
+    RingHeader *ring = header(m_map);
+    if (length > ring->slotBytes - sizeof(SlotHeader)) {
+        return false;
+    }
+
+    uint64_t position = ring->tail.load(std::memory_order_relaxed);
+    SlotHeader *slot;
+    while (true) {
+        slot = slotAt(m_map, position);
+        const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        const auto diff = static_cast<int64_t>(sequence - position);
+        if (diff == 0) {
+            if (ring->tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // slot of previous lap is not read yet
+            ring->rejected.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            position = ring->tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->length = static_cast<uint32_t>(length);
+    std::memcpy(reinterpret_cast<char *>(slot) + sizeof(SlotHeader), data, length);
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool wss::LocalIngest::Producer::push(const MessagePayload &payload) noexcept {
+    try {
+        const std::string &envelope = payload.toBinary();
+        return push(envelope.data(), envelope.size());
+    } catch (const std::exception &) {
+        return false;
+    }
+}
+
+wss::LocalIngest::LocalIngest(const Options &options) :
+    m_options(options) {
+    if (options.slots < 2 || (options.slots & (options.slots - 1)) != 0) {
+        throw std::invalid_argument("Ring slots must be a power of two, at least 2");
+    }
+    if (options.slotBytes < 64 || options.slotBytes % 8 != 0 || options.slotBytes > UINT32_MAX) {
+        throw std::invalid_argument("Ring slot size must be a multiple of 8, at least 64 bytes");
+    }
+
+    m_mapBytes = sizeof(RingHeader) + options.slots * options.slotBytes;
+    const int fd = ::open(options.path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0660);
+    if (fd < 0) {
+        throw systemError("Can't create ring", options.path);
+    }
+    // truncated to zero first: slots of previous run are dropped
+    if (::ftruncate(fd, 0) != 0 || ::ftruncate(fd, static_cast<off_t>(m_mapBytes)) != 0) {
+        ::close(fd);
+        throw systemError("Can't resize ring", options.path);
+    }
+    m_map = ::mmap(nullptr, m_mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (m_map == MAP_FAILED) {
+        m_map = nullptr;
+        throw systemError("Can't map ring", options.path);
+    }
+
+    RingHeader *ring = header(m_map);
+    ring->version = VERSION;
+    ring->slotBytes = static_cast<uint32_t>(options.slotBytes);
+    ring->slots = options.slots;
+    new(&ring->tail) std::atomic<uint64_t>(0);
+    new(&ring->rejected) std::atomic<uint64_t>(0);
+    for (uint64_t i = 0; i < options.slots; i++) {
+        new(&slotAt(m_map, i)->sequence) std::atomic<uint64_t>(i);
+    }
+    // producers check magic last: ring is ready when it's set
+    std::atomic_thread_fence(std::memory_order_release);
+    ring->magic = MAGIC;
+}
+
+wss::LocalIngest::~LocalIngest() {
+    stop();
+    if (m_map) {
+        ::munmap(m_map, m_mapBytes);
+    }
+}
+
+void wss::LocalIngest::start(Handler handler) {
+    if (m_running.exchange(true)) {
+        return;
+    }
+    m_handler = std::move(handler);
+    m_thread = std::thread(&LocalIngest::consume, this);
+    WSS_LOG_F(wss::logging::LevelInfo, "LocalIngest", "Reading ring %s: %lu slots of %lu bytes",
+              m_options.path.c_str(), static_cast<unsigned long>(m_options.slots),
+              static_cast<unsigned long>(m_options.slotBytes));
+}
+
+void wss::LocalIngest::stop() {
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+const wss::LocalIngestMetrics &wss::LocalIngest::getMetrics() const noexcept {
+    return m_metrics;
+}
+
+uint64_t wss::LocalIngest::getRejected() const noexcept {
+    return header(m_map)->rejected.load(std::memory_order_relaxed);
+}
+
+const wss::LocalIngest::Options &wss::LocalIngest::getOptions() const noexcept {
+    return m_options;
+}
+
+void wss::LocalIngest::consume() {
+    unsigned idle = 0;
+    while (m_running.load(std::memory_order_relaxed)) {
+        if (poll()) {
+            idle = 0;
+            continue;
+        }
+        idle++;
+        if (idle < IDLE_SPINS) {
+            continue;
+        }
+        if (idle < IDLE_YIELDS) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(m_options.idleSleepMicros));
+        }
+    }
+}
+
+bool wss::LocalIngest::poll() {
+    SlotHeader *slot = slotAt(m_map, m_head);
+    if (slot->sequence.load(std::memory_order_acquire) != m_head + 1) {
+        return false;
+    }
+
+    const std::size_t maxLength = m_options.slotBytes - sizeof(SlotHeader);
+    const std::size_t length = std::min<std::size_t>(slot->length, maxLength);
+    m_metrics.received++;
+    try {
+        if (!m_handler(reinterpret_cast<const char *>(slot) + sizeof(SlotHeader), length)) {
+            m_metrics.invalid++;
+        }
+    } catch (const std::exception &e) {
+        m_metrics.invalid++;
+        WSS_LOG_F(wss::logging::LevelWarning, "LocalIngest", "Message dropped: %s", e.what());
+    }
+    // slot is free for the next lap
+    slot->sequence.store(m_head + m_options.slots, std::memory_order_release);
+    m_head++;
+    return true;
+}
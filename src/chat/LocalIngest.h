@@ -0,0 +1,116 @@
+/**
+ * wsserver
+ * LocalIngest.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_LOCALINGEST_H
+#define WSSERVER_LOCALINGEST_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include "Message.h"
+
+namespace wss {
+
+struct LocalIngestMetrics {
+  /// \brief Messages taken from ring
+  std::atomic<uint64_t> received{0};
+  /// \brief Taken messages with invalid envelope
+  std::atomic<uint64_t> invalid{0};
+};
+
+/// \brief Local ingest channel: memory-mapped file with bounded MPSC ring, that co-located producers
+/// fill without syscalls, and server drains by one thread. Slot is binary envelope of payload
+/// (MessagePayload::toBinary() layout, id is generated by server).
+///
+/// File layout (all fields are native endian, atomics are lock-free 64 bit):
+/// header of 192 bytes: u64 magic "WSSRING1", u32 version (1), u32 slotBytes, u64 slots (power of two),
+/// at offset 64 atomic u64 tail (next position reserved by producers), at offset 128 atomic u64 rejected
+/// (pushes to full ring); then slots of slotBytes each: atomic u64 sequence, u32 length, u32 reserved, envelope.
+/// Push (Vyukov bounded queue): load tail, slot = tail & (slots - 1); if slot sequence == tail, CAS tail to tail + 1,
+/// write length and envelope, store sequence = tail + 1 (release). Sequence < tail means ring is full.
+/// Server reads slot at head when its sequence == head + 1, then stores sequence = head + slots.
+/// Producer, that died between reservation and commit, stops the ring until server is restarted
+class LocalIngest {
+ public:
+    struct Options {
+      std::string path = "/dev/shm/wsserver-ingest";
+      /// \brief Power of two
+      std::size_t slots = 4096;
+      /// \brief Slot size with its 16 bytes header: max envelope is slotBytes - 16
+      std::size_t slotBytes = 64 * 1024;
+      /// \brief Max sleep of idle consumer: it spins, then yields, then sleeps up to this time
+      long idleSleepMicros = 200;
+    };
+
+    /// \brief Receives envelope of slot, buffer is valid only during call. Returns false if envelope is invalid
+    using Handler = std::function<bool(const char *data, std::size_t length)>;
+
+    /// \brief Maps existing ring file of server, for producers in the same language
+    class Producer {
+     public:
+        /// \throws std::runtime_error if file can't be mapped or it isn't a ring
+        explicit Producer(const std::string &path);
+        ~Producer();
+        Producer(const Producer &) = delete;
+        Producer &operator=(const Producer &) = delete;
+
+        /// \brief Thread safe, lock-free
+        /// \param data envelope
+        /// \param length
+        /// \return false if ring is full or envelope doesn't fit slot
+        bool push(const char *data, std::size_t length) noexcept;
+        bool push(const MessagePayload &payload) noexcept;
+
+     private:
+        void *m_map = nullptr;
+        std::size_t m_mapBytes = 0;
+    };
+
+    /// \brief Creates (or truncates) ring file and maps it. Messages, left by previous run, are dropped
+    /// \param options
+    /// \throws std::invalid_argument if geometry is invalid
+    /// \throws std::runtime_error if file can't be created or mapped
+    explicit LocalIngest(const Options &options);
+    ~LocalIngest();
+    LocalIngest(const LocalIngest &) = delete;
+    LocalIngest &operator=(const LocalIngest &) = delete;
+
+    /// \brief Starts consumer thread
+    /// \param handler called by consumer thread
+    void start(Handler handler);
+    /// \brief Stops consumer thread, messages left in ring are dropped
+    void stop();
+
+    const LocalIngestMetrics &getMetrics() const noexcept;
+    /// \brief Pushes rejected by full ring
+    uint64_t getRejected() const noexcept;
+    const Options &getOptions() const noexcept;
+
+ private:
+    const Options m_options;
+    void *m_map = nullptr;
+    std::size_t m_mapBytes = 0;
+    uint64_t m_head = 0;
+    std::atomic<bool> m_running{false};
+    std::thread m_thread;
+    Handler m_handler;
+    LocalIngestMetrics m_metrics;
+
+    void consume();
+    /// \brief Takes ready slot
+    /// \return false if ring is empty
+    bool poll();
+};
+
+}
+
+#endif //WSSERVER_LOCALINGEST_H
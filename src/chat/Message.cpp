@@ -10,6 +10,8 @@
 
 #include <fmt/format.h>
 #include <toolboxpp.h>
+#include <limits>
+#include <cstring>
 
 using namespace wss;
 using std::cout;
@@ -19,6 +21,458 @@ using std::endl;
 const char *wss::TYPE_TEXT = "text";
 const char *wss::TYPE_BINARY = "binary";
 const char *wss::TYPE_NOTIFICATION_RECEIVED = "notification_received";
+const char *wss::TYPE_NOTIFICATION_BATCH_RECEIVED = "notification_batch_received";
+const char *wss::TYPE_ROOM_JOIN = "room_join";
+const char *wss::TYPE_ROOM_LEAVE = "room_leave";
+const char *wss::TYPE_TOPIC_SUBSCRIBE = "topic_subscribe";
+const char *wss::TYPE_TOPIC_UNSUBSCRIBE = "topic_unsubscribe";
+const char *wss::TYPE_PRESENCE = "presence";
+const char *wss::TYPE_ACK = "ack";
+const char *wss::TYPE_HISTORY = "history";
+const char *wss::SUBPROTOCOL_BINARY_V1 = "wss.binary.v1";
+
+static const uint8_t BINARY_VERSION = 1;
+static const uint8_t BINARY_VERSION_EXTENDED = 2;
+static const uint8_t BINARY_VERSION_BATCH = 3;
+static const uint8_t BINARY_VERSION_TTL = 4;
+static const uint8_t BINARY_VERSION_SCHEDULED = 5;
+
+namespace {
+
+template<typename T>
+void writeBigEndian(std::string &out, T value) {
+    for (std::size_t c = sizeof(T); c > 0; c--) {
+        out.push_back(static_cast<char>((static_cast<uint64_t>(value) >> (8 * (c - 1))) & 0xFFu));
+    }
+}
+
+template<typename Length>
+void writeString(std::string &out, const std::string &value) {
+    if (value.size() > std::numeric_limits<Length>::max()) {
+        throw InvalidPayloadException("Binary payload: field is too long");
+    }
+    writeBigEndian<Length>(out, static_cast<Length>(value.size()));
+    out.append(value);
+}
+
+/// \brief Bounds checked reader of binary envelope
+class BinaryReader {
+ public:
+    BinaryReader(const char *data, std::size_t length) :
+        m_data(reinterpret_cast<const uint8_t *>(data)),
+        m_length(length),
+        m_pos(0) { }
+
+    template<typename T>
+    T read() {
+        require(sizeof(T));
+        uint64_t value = 0;
+        for (std::size_t c = 0; c < sizeof(T); c++) {
+            value = (value << 8u) | m_data[m_pos++];
+        }
+        return static_cast<T>(value);
+    }
+
+    template<typename Length>
+    std::string readString() {
+        const auto length = static_cast<std::size_t>(read<Length>());
+        require(length);
+        std::string out(reinterpret_cast<const char *>(m_data + m_pos), length);
+        m_pos += length;
+        return out;
+    }
+
+    /// \brief Raw bytes view
+    const char *readBytes(std::size_t length) {
+        require(length);
+        const char *out = reinterpret_cast<const char *>(m_data + m_pos);
+        m_pos += length;
+        return out;
+    }
+
+    bool atEnd() const {
+        return m_pos == m_length;
+    }
+
+ private:
+    const uint8_t *m_data;
+    std::size_t m_length;
+    std::size_t m_pos;
+
+    void require(std::size_t bytes) const {
+        if (m_length - m_pos < bytes) {
+            throw InvalidPayloadException("Binary payload is truncated");
+        }
+    }
+};
+
+/// \brief Strict forward-only json reader for payload fast path. Every method returns false if input is not
+/// what was expected (or not valid json): caller falls back to DOM parser, that reports exact error
+class JsonScanner {
+ public:
+    JsonScanner(const char *data, std::size_t length) :
+        m_pos(data),
+        m_end(data + length) { }
+
+    /// \brief Skips whitespace and consumes expected char
+    bool consume(char c) {
+        skipWhitespace();
+        if (m_pos == m_end || *m_pos != c) {
+            return false;
+        }
+        m_pos++;
+        return true;
+    }
+
+    /// \brief Next not whitespace char without consuming it
+    bool peek(char &c) {
+        skipWhitespace();
+        if (m_pos == m_end) {
+            return false;
+        }
+        c = *m_pos;
+        return true;
+    }
+
+    bool atEnd() {
+        skipWhitespace();
+        return m_pos == m_end;
+    }
+
+    const char *getPosition() const {
+        return m_pos;
+    }
+
+    bool readNull() {
+        skipWhitespace();
+        return readLiteral("null");
+    }
+
+    /// \brief Reads string and decodes escapes
+    bool readString(std::string &out) {
+        if (!consume('"')) {
+            return false;
+        }
+        out.clear();
+        while (m_pos != m_end) {
+            const char *run = m_pos;
+            while (m_pos != m_end && *m_pos != '"' && *m_pos != '\\' && static_cast<unsigned char>(*m_pos) >= 0x20) {
+                if (static_cast<unsigned char>(*m_pos) >= 0x80) {
+                    if (!skipUtf8()) {
+                        return false;
+                    }
+                } else {
+                    m_pos++;
+                }
+            }
+            out.append(run, m_pos);
+            if (m_pos == m_end || static_cast<unsigned char>(*m_pos) < 0x20) {
+                return false;
+            }
+            if (*m_pos++ == '"') {
+                return true;
+            }
+            if (!readEscape(&out)) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    /// \brief Reads unsigned integer: fractions, exponents, signs and overflows are not accepted
+    bool readUnsigned(uint64_t &out) {
+        skipWhitespace();
+        if (m_pos == m_end || *m_pos < '0' || *m_pos > '9') {
+            return false;
+        }
+        if (*m_pos == '0' && m_pos + 1 != m_end && m_pos[1] >= '0' && m_pos[1] <= '9') {
+            return false;
+        }
+        out = 0;
+        while (m_pos != m_end && *m_pos >= '0' && *m_pos <= '9') {
+            const auto digit = static_cast<uint64_t>(*m_pos - '0');
+            if (out > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+                return false;
+            }
+            out = out * 10 + digit;
+            m_pos++;
+        }
+        return m_pos == m_end || (*m_pos != '.' && *m_pos != 'e' && *m_pos != 'E');
+    }
+
+    /// \brief Validates any json value without materializing it
+    /// \param begin value first byte
+    /// \param end byte after value
+    bool skipValue(const char *&begin, const char *&end) {
+        skipWhitespace();
+        begin = m_pos;
+        if (!skipValueAt(0)) {
+            return false;
+        }
+        end = m_pos;
+        return true;
+    }
+
+ private:
+    /// \brief Deeper values are left to DOM parser
+    static const std::size_t MAX_DEPTH = 128;
+
+    const char *m_pos;
+    const char *m_end;
+
+    void skipWhitespace() {
+        while (m_pos != m_end && (*m_pos == ' ' || *m_pos == '\n' || *m_pos == '\r' || *m_pos == '\t')) {
+            m_pos++;
+        }
+    }
+
+    bool readLiteral(const char *literal) {
+        const std::size_t length = strlen(literal);
+        if (static_cast<std::size_t>(m_end - m_pos) < length || memcmp(m_pos, literal, length) != 0) {
+            return false;
+        }
+        m_pos += length;
+        return true;
+    }
+
+    bool readHex(uint32_t &out) {
+        if (m_end - m_pos < 4) {
+            return false;
+        }
+        out = 0;
+        for (int i = 0; i < 4; i++) {
+            const char c = *m_pos++;
+            out <<= 4u;
+            if (c >= '0' && c <= '9') {
+                out |= static_cast<uint32_t>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                out |= static_cast<uint32_t>(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                out |= static_cast<uint32_t>(c - 'A' + 10);
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// \brief Escape sequence after backslash
+    /// \param out decoded char is appended to it, nullptr - only validate
+    bool readEscape(std::string *out) {
+        if (m_pos == m_end) {
+            return false;
+        }
+        char decoded;
+        switch (*m_pos++) {
+            case '"': decoded = '"';
+                break;
+            case '\\': decoded = '\\';
+                break;
+            case '/': decoded = '/';
+                break;
+            case 'b': decoded = '\b';
+                break;
+            case 'f': decoded = '\f';
+                break;
+            case 'n': decoded = '\n';
+                break;
+            case 'r': decoded = '\r';
+                break;
+            case 't': decoded = '\t';
+                break;
+            case 'u': return readUnicodeEscape(out);
+            default: return false;
+        }
+        if (out) {
+            out->push_back(decoded);
+        }
+        return true;
+    }
+
+    bool readUnicodeEscape(std::string *out) {
+        uint32_t codepoint;
+        if (!readHex(codepoint) || (codepoint >= 0xDC00 && codepoint <= 0xDFFF)) {
+            return false;
+        }
+        if (codepoint >= 0xD800 && codepoint <= 0xDBFF) {
+            uint32_t low;
+            if (m_end - m_pos < 2 || m_pos[0] != '\\' || m_pos[1] != 'u') {
+                return false;
+            }
+            m_pos += 2;
+            if (!readHex(low) || low < 0xDC00 || low > 0xDFFF) {
+                return false;
+            }
+            codepoint = 0x10000 + ((codepoint - 0xD800) << 10u) + (low - 0xDC00);
+        }
+        if (!out) {
+            return true;
+        }
+
+        if (codepoint < 0x80) {
+            out->push_back(static_cast<char>(codepoint));
+        } else if (codepoint < 0x800) {
+            out->push_back(static_cast<char>(0xC0 | (codepoint >> 6u)));
+            out->push_back(static_cast<char>(0x80 | (codepoint & 0x3Fu)));
+        } else if (codepoint < 0x10000) {
+            out->push_back(static_cast<char>(0xE0 | (codepoint >> 12u)));
+            out->push_back(static_cast<char>(0x80 | ((codepoint >> 6u) & 0x3Fu)));
+            out->push_back(static_cast<char>(0x80 | (codepoint & 0x3Fu)));
+        } else {
+            out->push_back(static_cast<char>(0xF0 | (codepoint >> 18u)));
+            out->push_back(static_cast<char>(0x80 | ((codepoint >> 12u) & 0x3Fu)));
+            out->push_back(static_cast<char>(0x80 | ((codepoint >> 6u) & 0x3Fu)));
+            out->push_back(static_cast<char>(0x80 | (codepoint & 0x3Fu)));
+        }
+        return true;
+    }
+
+    /// \brief Validates multibyte UTF-8 sequence: no overlongs, surrogates and codepoints above U+10FFFF
+    bool skipUtf8() {
+        const auto lead = static_cast<unsigned char>(*m_pos);
+        std::size_t length;
+        unsigned char min = 0x80, max = 0xBF;
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            length = 2;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            length = 3;
+            if (lead == 0xE0) min = 0xA0;
+            if (lead == 0xED) max = 0x9F;
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            length = 4;
+            if (lead == 0xF0) min = 0x90;
+            if (lead == 0xF4) max = 0x8F;
+        } else {
+            return false;
+        }
+        if (static_cast<std::size_t>(m_end - m_pos) < length) {
+            return false;
+        }
+        for (std::size_t i = 1; i < length; i++) {
+            const auto c = static_cast<unsigned char>(m_pos[i]);
+            if (c < (i == 1 ? min : 0x80) || c > (i == 1 ? max : 0xBF)) {
+                return false;
+            }
+        }
+        m_pos += length;
+        return true;
+    }
+
+    bool skipString() {
+        // opening quote is checked by caller
+        m_pos++;
+        while (m_pos != m_end) {
+            const auto c = static_cast<unsigned char>(*m_pos);
+            if (c == '"') {
+                m_pos++;
+                return true;
+            }
+            if (c < 0x20) {
+                return false;
+            }
+            if (c == '\\') {
+                m_pos++;
+                if (!readEscape(nullptr)) {
+                    return false;
+                }
+            } else if (c >= 0x80) {
+                if (!skipUtf8()) {
+                    return false;
+                }
+            } else {
+                m_pos++;
+            }
+        }
+        return false;
+    }
+
+    bool skipDigits() {
+        const char *start = m_pos;
+        while (m_pos != m_end && *m_pos >= '0' && *m_pos <= '9') {
+            m_pos++;
+        }
+        return m_pos != start;
+    }
+
+    bool skipNumber() {
+        if (*m_pos == '-') {
+            m_pos++;
+        }
+        if (m_pos == m_end) {
+            return false;
+        }
+        if (*m_pos == '0') {
+            m_pos++;
+        } else if (!skipDigits()) {
+            return false;
+        }
+        if (m_pos != m_end && *m_pos == '.') {
+            m_pos++;
+            if (!skipDigits()) {
+                return false;
+            }
+        }
+        if (m_pos != m_end && (*m_pos == 'e' || *m_pos == 'E')) {
+            m_pos++;
+            if (m_pos != m_end && (*m_pos == '+' || *m_pos == '-')) {
+                m_pos++;
+            }
+            if (!skipDigits()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool skipValueAt(std::size_t depth) {
+        if (depth > MAX_DEPTH || m_pos == m_end) {
+            return false;
+        }
+        switch (*m_pos) {
+            case '"': return skipString();
+            case 't': return readLiteral("true");
+            case 'f': return readLiteral("false");
+            case 'n': return readLiteral("null");
+            case '[': {
+                m_pos++;
+                if (consume(']')) {
+                    return true;
+                }
+                do {
+                    skipWhitespace();
+                    if (!skipValueAt(depth + 1)) {
+                        return false;
+                    }
+                } while (consume(','));
+                return consume(']');
+            }
+            case '{': {
+                m_pos++;
+                if (consume('}')) {
+                    return true;
+                }
+                do {
+                    skipWhitespace();
+                    if (m_pos == m_end || *m_pos != '"' || !skipString() || !consume(':')) {
+                        return false;
+                    }
+                    skipWhitespace();
+                    if (!skipValueAt(depth + 1)) {
+                        return false;
+                    }
+                } while (consume(','));
+                return consume('}');
+            }
+            default:
+                if (*m_pos == '-' || (*m_pos >= '0' && *m_pos <= '9')) {
+                    return skipNumber();
+                }
+                return false;
+        }
+    }
+};
+
+}
 
 MessagePayload::MessagePayload() :
     m_id({0, 0, 0, 0}) {
@@ -27,27 +481,30 @@ MessagePayload::MessagePayload() :
 wss::MessagePayload::MessagePayload(user_id_t from, user_id_t to, std::string &&message) :
     m_id(wss::unid::generator()()),
     m_sender(from),
-    m_recipients(std::vector<user_id_t>{to}),
+    m_recipients{to},
     m_text(std::move(message)),
     m_type(TYPE_TEXT),
+    m_typeId(types::ID_TEXT),
     m_timestamp(wss::utils::getNowISODateTimeFractionalConfigAware()) {
 
 }
 wss::MessagePayload::MessagePayload(user_id_t from, std::vector<user_id_t> &&to, std::string &&message) :
     m_id(wss::unid::generator()()),
     m_sender(from),
-    m_recipients(std::move(to)),
+    m_recipients(to),
     m_text(std::move(message)),
     m_type(TYPE_TEXT),
+    m_typeId(types::ID_TEXT),
     m_timestamp(wss::utils::getNowISODateTimeFractionalConfigAware()) {
     validate();
 }
 MessagePayload::MessagePayload(user_id_t from, user_id_t to, const std::string &message) :
     m_id(wss::unid::generator()()),
     m_sender(from),
-    m_recipients(to),
+    m_recipients{to},
     m_text(message),
     m_type(TYPE_TEXT),
+    m_typeId(types::ID_TEXT),
     m_timestamp(wss::utils::getNowISODateTimeFractionalConfigAware()) {
 }
 wss::MessagePayload::MessagePayload(user_id_t from, const std::vector<user_id_t> &to, const std::string &message) :
@@ -56,33 +513,181 @@ wss::MessagePayload::MessagePayload(user_id_t from, const std::vector<user_id_t>
     m_recipients(to),
     m_text(message),
     m_type(TYPE_TEXT),
+    m_typeId(types::ID_TEXT),
     m_timestamp(wss::utils::getNowISODateTimeFractionalConfigAware()) {
     validate();
 }
 wss::MessagePayload::MessagePayload(const std::string &json) noexcept:
+    MessagePayload(json.data(), json.length()) {
+}
+
+wss::MessagePayload::MessagePayload(const char *data, std::size_t length) noexcept:
     m_id(wss::unid::generator()()) {
-    if (json.length() == 0) {
+    if (data == nullptr || length == 0) {
         m_errorCause = "Empty message";
         m_validState = false;
         return;
     }
+    if (fromJsonFast(data, length)) {
+        return;
+    }
     try {
-        auto obj = json::parse(json);
+        auto obj = json::parse(data, data + length);
         fromJson(obj);
         validate();
     } catch (const std::exception &e) {
-        handleJsonException(e, json);
+        handleJsonException(e);
     }
 }
 
 wss::MessagePayload::MessagePayload(const wss::json &obj) noexcept:
     m_id(wss::unid::generator()()) {
-    fromJson(obj);
-    validate();
+    try {
+        fromJson(obj);
+        validate();
+    } catch (const std::exception &e) {
+        handleJsonException(e);
+    }
+}
+
+wss::MessagePayload wss::MessagePayload::fromBinary(const char *data, std::size_t length) noexcept {
+    MessagePayload payload;
+    payload.m_id = wss::unid::generator()();
+    if (data == nullptr || length == 0) {
+        payload.m_errorCause = "Empty message";
+        payload.m_validState = false;
+        return payload;
+    }
+
+    try {
+        BinaryReader reader(data, length);
+        const auto version = reader.read<uint8_t>();
+        if (version != BINARY_VERSION && version != BINARY_VERSION_EXTENDED && version != BINARY_VERSION_TTL
+            && version != BINARY_VERSION_SCHEDULED) {
+            throw InvalidPayloadException("Unsupported binary payload version");
+        }
+        // client id is ignored, as for json payload
+        reader.readBytes(4 + 4 + 2 + 4);
+
+        payload.m_sender = reader.read<uint64_t>();
+        const auto recipientsCount = reader.read<uint32_t>();
+        if (recipientsCount == 0 && version == BINARY_VERSION) {
+            throw InvalidPayloadException("recipients[] must contains at least 1 value");
+        }
+        if (recipientsCount > (length / sizeof(uint64_t))) {
+            throw InvalidPayloadException("Binary payload is truncated");
+        }
+        payload.m_recipients.reserve(recipientsCount);
+        for (uint32_t i = 0; i < recipientsCount; i++) {
+            payload.m_recipients.push_back(reader.read<uint64_t>());
+        }
+
+        payload.m_type = reader.readString<uint16_t>();
+        if (payload.m_type.empty()) {
+            throw InvalidPayloadException("type must be a string");
+        }
+        payload.m_typeId = types::find(payload.m_type);
+        payload.m_timestamp = reader.readString<uint16_t>();
+        if (payload.m_timestamp.empty()) {
+            payload.m_timestamp = wss::utils::getNowISODateTimeFractionalConfigAware();
+        }
+        payload.m_text = reader.readString<uint32_t>();
+
+        const auto dataLength = static_cast<std::size_t>(reader.read<uint32_t>());
+        if (dataLength > 0) {
+            const char *jsonData = reader.readBytes(dataLength);
+            JsonScanner scanner(jsonData, dataLength);
+            const char *dataBegin, *dataEnd;
+            if (!scanner.skipValue(dataBegin, dataEnd) || !scanner.atEnd()) {
+                // reports error
+                json::parse(jsonData, jsonData + dataLength);
+            } else if (dataEnd - dataBegin != 4 || memcmp(dataBegin, "null", 4) != 0) {
+                payload.m_rawData.assign(dataBegin, dataEnd);
+            }
+        }
+        if (version != BINARY_VERSION) {
+            payload.m_room = reader.read<uint64_t>();
+            payload.m_topic = reader.readString<uint16_t>();
+        }
+        if (version == BINARY_VERSION_TTL || version == BINARY_VERSION_SCHEDULED) {
+            payload.m_ttl = reader.read<uint32_t>();
+        }
+        if (version == BINARY_VERSION_SCHEDULED) {
+            payload.m_deliverAt = reader.read<uint64_t>();
+        }
+
+        if (!reader.atEnd()) {
+            throw InvalidPayloadException("Binary payload has trailing bytes");
+        }
+        payload.validate();
+    } catch (const std::exception &e) {
+        payload.handleJsonException(e);
+    }
+
+    return payload;
+}
+
+wss::MessagePayload wss::MessagePayload::fromStoredBinary(const char *data, std::size_t length) noexcept {
+    MessagePayload payload = fromBinary(data, length);
+    if (payload.isValid()) {
+        BinaryReader reader(data, length);
+        reader.read<uint8_t>();
+        payload.m_id.tm = reader.read<uint32_t>();
+        payload.m_id.uuid = reader.read<uint32_t>();
+        payload.m_id.pid = reader.read<uint16_t>();
+        payload.m_id.inc = reader.read<uint32_t>();
+    }
+    return payload;
+}
+
+bool wss::MessagePayload::isBinaryBatch(const char *data, std::size_t length) noexcept {
+    return data != nullptr && length > 0 && static_cast<uint8_t>(data[0]) == BINARY_VERSION_BATCH;
+}
+
+std::vector<wss::MessagePayload> wss::MessagePayload::fromBinaryBatch(const char *data, std::size_t length) {
+    if (!isBinaryBatch(data, length)) {
+        throw InvalidPayloadException("Not a binary batch");
+    }
+
+    BinaryReader reader(data, length);
+    reader.read<uint8_t>();
+    const auto count = reader.read<uint32_t>();
+    if (count > length / sizeof(uint32_t)) {
+        throw InvalidPayloadException("Binary payload is truncated");
+    }
+
+    std::vector<MessagePayload> out;
+    out.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        const auto itemLength = static_cast<std::size_t>(reader.read<uint32_t>());
+        out.push_back(fromBinary(reader.readBytes(itemLength), itemLength));
+    }
+
+    if (!reader.atEnd()) {
+        throw InvalidPayloadException("Binary payload has trailing bytes");
+    }
+    return out;
+}
+
+std::string wss::MessagePayload::toBinaryBatch(const std::vector<std::pair<const char *, std::size_t>> &items) {
+    std::size_t size = sizeof(uint8_t) + sizeof(uint32_t);
+    for (const auto &item: items) {
+        size += sizeof(uint32_t) + item.second;
+    }
+
+    std::string out;
+    out.reserve(size);
+    writeBigEndian<uint8_t>(out, BINARY_VERSION_BATCH);
+    writeBigEndian<uint32_t>(out, static_cast<uint32_t>(items.size()));
+    for (const auto &item: items) {
+        writeBigEndian<uint32_t>(out, static_cast<uint32_t>(item.second));
+        out.append(item.first, item.second);
+    }
+    return out;
 }
 
 void wss::MessagePayload::validate() {
-    if (m_recipients.empty()) {
+    if (m_recipients.empty() && m_room == 0 && m_topic.empty()) {
         m_validState = false;
         m_errorCause = "Recipients can't be empty";
     }
@@ -91,35 +696,322 @@ void wss::MessagePayload::validate() {
 void wss::MessagePayload::fromJson(const json &obj) {
     from_json(obj, *this);
 }
+
+bool wss::MessagePayload::fromJsonFast(const char *data, std::size_t length) {
+    JsonScanner scanner(data, length);
+    if (!scanner.consume('{')) {
+        return false;
+    }
+    const char *objectBegin = scanner.getPosition() - 1;
+
+    std::string key, type, text, timestamp, topic;
+    bool hasType = false, hasSender = false, textIsString = false, hasTimestamp = false;
+    // original text can be forwarded, if it has only known fields, without duplicates and values
+    // that toJson() would replace or drop
+    bool passthrough = true, hasText = false, hasData = false, hasRecipients = false;
+    uint32_t keys = 0;
+    user_id_t sender = 0;
+    room_id_t room = 0;
+    uint64_t ttl = 0;
+    uint64_t deliverAt = 0;
+    Recipients recipients;
+    const char *dataBegin = nullptr, *dataEnd = nullptr;
+    char next;
+
+    if (!scanner.consume('}')) {
+        do {
+            if (!scanner.readString(key) || !scanner.consume(':') || !scanner.peek(next)) {
+                return false;
+            }
+            const uint32_t keyBit = key == "type" ? 1u : key == "sender" ? 2u : key == "recipients" ? 4u
+                : key == "room" ? 8u : key == "topic" ? 16u : key == "text" ? 32u
+                : key == "timestamp" ? 64u : key == "data" ? 128u : key == "ttl" ? 256u
+                : key == "deliverAt" ? 512u : 0u;
+            // client id is replaced, unknown fields are dropped
+            if (keyBit == 0 || (keys & keyBit) != 0) {
+                passthrough = false;
+            }
+            keys |= keyBit;
+
+            if (key == "type") {
+                if (!scanner.readString(type)) {
+                    return false;
+                }
+                hasType = true;
+            } else if (key == "sender") {
+                if (!scanner.readUnsigned(sender)) {
+                    return false;
+                }
+                hasSender = true;
+            } else if (key == "recipients") {
+                recipients.clear();
+                hasRecipients = next != 'n';
+                if (next == 'n') {
+                    if (!scanner.readNull()) {
+                        return false;
+                    }
+                    passthrough = false;
+                    continue;
+                }
+                if (!scanner.consume('[')) {
+                    return false;
+                }
+                if (!scanner.consume(']')) {
+                    do {
+                        uint64_t recipient;
+                        if (!scanner.readUnsigned(recipient)) {
+                            return false;
+                        }
+                        recipients.push_back(recipient);
+                    } while (scanner.consume(','));
+                    if (!scanner.consume(']')) {
+                        return false;
+                    }
+                }
+            } else if (key == "room") {
+                room = 0;
+                if (next == 'n' ? !scanner.readNull() : !scanner.readUnsigned(room)) {
+                    return false;
+                }
+                passthrough = passthrough && room != 0;
+            } else if (key == "ttl") {
+                // null, 0 and values out of uint32 range go to DOM parser
+                if (!scanner.readUnsigned(ttl) || ttl == 0 || ttl > std::numeric_limits<uint32_t>::max()) {
+                    return false;
+                }
+            } else if (key == "deliverAt") {
+                // null and 0 go to DOM parser
+                if (!scanner.readUnsigned(deliverAt) || deliverAt == 0) {
+                    return false;
+                }
+            } else if (key == "topic") {
+                topic.clear();
+                if (next == 'n' ? !scanner.readNull() : !scanner.readString(topic)) {
+                    return false;
+                }
+                passthrough = passthrough && !topic.empty();
+            } else if (key == "text" || key == "timestamp") {
+                // not string values are replaced by defaults
+                const bool isText = key == "text";
+                const char *begin, *end;
+                if (next == '"' ? !scanner.readString(isText ? text : timestamp) : !scanner.skipValue(begin, end)) {
+                    return false;
+                }
+                if (isText) {
+                    textIsString = next == '"';
+                    hasText = true;
+                } else {
+                    hasTimestamp = next == '"';
+                }
+                passthrough = passthrough && next == '"';
+            } else if (key == "data") {
+                const char *begin, *end;
+                if (!scanner.skipValue(begin, end)) {
+                    return false;
+                }
+                const bool isNull = end - begin == 4 && memcmp(begin, "null", 4) == 0;
+                dataBegin = isNull ? nullptr : begin;
+                dataEnd = isNull ? nullptr : end;
+                hasData = true;
+            } else {
+                const char *begin, *end;
+                if (!scanner.skipValue(begin, end)) {
+                    return false;
+                }
+            }
+        } while (scanner.consume(','));
+
+        if (!scanner.consume('}')) {
+            return false;
+        }
+    }
+    const char *objectEnd = scanner.getPosition();
+    if (!scanner.atEnd()) {
+        return false;
+    }
+
+    // invalid payloads go to DOM parser for its error message
+    if (!hasType || !hasSender || (type == TYPE_TEXT && !textIsString)
+        || (recipients.empty() && room == 0 && topic.empty())) {
+        return false;
+    }
+
+    m_type = std::move(type);
+    m_typeId = types::find(m_type);
+    m_text = textIsString ? std::move(text) : std::string();
+    m_sender = sender;
+    m_recipients = std::move(recipients);
+    m_room = room;
+    m_ttl = static_cast<uint32_t>(ttl);
+    m_deliverAt = deliverAt;
+    m_topic = std::move(topic);
+    if (dataBegin) {
+        m_rawData.assign(dataBegin, dataEnd);
+    } else {
+        m_rawData.clear();
+    }
+    m_timestamp = hasTimestamp ? std::move(timestamp) : wss::utils::getNowISODateTimeFractionalConfigAware();
+
+    if (passthrough) {
+        // client body is copied as is, only server fields are spliced before closing brace.
+        // Any modification drops this cache, then json is built from fields
+        std::string out;
+        out.reserve(static_cast<std::size_t>(objectEnd - objectBegin) + 128);
+        out.assign(objectBegin, objectEnd - 1);
+        out.append(",\"id\":\"").append(m_id.str()).push_back('"');
+        if (!hasTimestamp) {
+            out.append(",\"timestamp\":").append(json(m_timestamp).dump());
+        }
+        if (!hasText) {
+            out.append(",\"text\":\"\"");
+        }
+        if (!hasData) {
+            out.append(",\"data\":null");
+        }
+        if (!hasRecipients) {
+            out.append(",\"recipients\":[]");
+        }
+        out.push_back('}');
+        m_cachedJson.setIfEmpty(std::make_shared<const std::string>(std::move(out)));
+    }
+    return true;
+}
 const unid_t MessagePayload::getId() const {
     return m_id;
 }
+void wss::MessagePayload::setReceivedAt(std::chrono::steady_clock::time_point receivedAt) {
+    m_receivedAt = receivedAt;
+}
+std::chrono::steady_clock::time_point wss::MessagePayload::getReceivedAt() const {
+    return m_receivedAt;
+}
+void wss::MessagePayload::setTrace(const wss::tracing::SpanContext &trace) {
+    m_trace = trace;
+}
+const wss::tracing::SpanContext &wss::MessagePayload::getTrace() const {
+    return m_trace;
+}
 user_id_t wss::MessagePayload::getSender() const {
     return m_sender;
 }
-const std::vector<user_id_t> wss::MessagePayload::getRecipients() const {
+const wss::MessagePayload::Recipients &wss::MessagePayload::getRecipients() const {
     return m_recipients;
 }
-const std::string wss::MessagePayload::toJson() const {
-    if (m_isCached) {
-        return m_cachedJson;
+wss::room_id_t wss::MessagePayload::getRoom() const {
+    return m_room;
+}
+bool wss::MessagePayload::isForRoom() const {
+    return m_room != 0;
+}
+uint32_t wss::MessagePayload::getTtl() const {
+    return m_ttl;
+}
+uint64_t wss::MessagePayload::getDeliverAt() const {
+    return m_deliverAt;
+}
+const std::string &wss::MessagePayload::getTopic() const {
+    return m_topic;
+}
+wss::json wss::MessagePayload::getData() const {
+    if (m_rawData.empty()) {
+        return json();
+    }
+    return json::parse(m_rawData, nullptr, false);
+}
+std::string wss::MessagePayload::getDataText() const {
+    return m_rawData;
+}
+std::size_t wss::MessagePayload::getDataSize() const {
+    return m_rawData.size();
+}
+std::vector<wss::unid_t> wss::MessagePayload::getDataIds() const {
+    std::vector<unid_t> out;
+    const json data = getData();
+    if (!data.is_object() || data.find("ids") == data.end() || !data.at("ids").is_array()) {
+        return out;
+    }
+    const json &ids = data.at("ids");
+    out.reserve(ids.size());
+    for (const auto &item: ids) {
+        unid_t id;
+        if (item.is_string() && unid_t::parse(item.get<std::string>(), id)) {
+            out.push_back(id);
+        }
+    }
+    return out;
+}
+bool wss::MessagePayload::isForTopic() const {
+    return !m_topic.empty();
+}
+const std::string &wss::MessagePayload::toJson() const {
+    return *getJsonBuffer();
+}
+wss::SerializedCache::Buffer wss::MessagePayload::getJsonBuffer() const {
+    SerializedCache::Buffer cached = m_cachedJson.get();
+    if (cached) {
+        return cached;
     }
 
     json obj;
-    to_json(obj, *this);
+    writeJsonFields(obj);
+    // data text is appended as is, its DOM is never built
+    std::string out = obj.dump();
+    out.pop_back();
+    out.append(",\"data\":").append(m_rawData.empty() ? "null" : m_rawData).push_back('}');
+    return m_cachedJson.setIfEmpty(std::make_shared<const std::string>(std::move(out)));
+}
+const std::string &wss::MessagePayload::toBinary() const {
+    return *getBinaryBuffer();
+}
+wss::SerializedCache::Buffer wss::MessagePayload::getBinaryBuffer() const {
+    SerializedCache::Buffer cached = m_cachedBinary.get();
+    if (cached) {
+        return cached;
+    }
+
+    const std::string &data = m_rawData;
 
-    m_cachedJson = obj.dump();
-    m_isCached = true;
-    return m_cachedJson;
+    std::string out;
+    out.reserve(1 + 14 + 8 + 4 + m_recipients.size() * 8 + 2 + m_type.size() + 2 + m_timestamp.size()
+                    + 4 + m_text.size() + 4 + data.size() + 8 + 2 + m_topic.size() + 4 + 8);
+    const bool extended = isForRoom() || isForTopic() || m_ttl != 0 || m_deliverAt != 0;
+    writeBigEndian<uint8_t>(out, m_deliverAt != 0 ? BINARY_VERSION_SCHEDULED
+                                 : m_ttl != 0 ? BINARY_VERSION_TTL
+                                 : extended ? BINARY_VERSION_EXTENDED : BINARY_VERSION);
+    writeBigEndian<uint32_t>(out, m_id.tm);
+    writeBigEndian<uint32_t>(out, m_id.uuid);
+    writeBigEndian<uint16_t>(out, m_id.pid);
+    writeBigEndian<uint32_t>(out, m_id.inc);
+    writeBigEndian<uint64_t>(out, m_sender);
+    writeBigEndian<uint32_t>(out, static_cast<uint32_t>(m_recipients.size()));
+    for (user_id_t recipient: m_recipients) {
+        writeBigEndian<uint64_t>(out, recipient);
+    }
+    writeString<uint16_t>(out, m_type);
+    writeString<uint16_t>(out, m_timestamp);
+    writeString<uint32_t>(out, m_text);
+    writeString<uint32_t>(out, data);
+    if (extended) {
+        writeBigEndian<uint64_t>(out, m_room);
+        writeString<uint16_t>(out, m_topic);
+    }
+    if (m_ttl != 0 || m_deliverAt != 0) {
+        writeBigEndian<uint32_t>(out, m_ttl);
+    }
+    if (m_deliverAt != 0) {
+        writeBigEndian<uint64_t>(out, m_deliverAt);
+    }
+
+    return m_cachedBinary.setIfEmpty(std::make_shared<const std::string>(std::move(out)));
 }
-const std::string wss::MessagePayload::getText() const {
+const std::string &wss::MessagePayload::getText() const {
     return m_text;
 }
 bool wss::MessagePayload::isMyMessage(user_id_t id) const {
     return getSender() == id;
 }
 bool wss::MessagePayload::isValid() const {
-    return m_validState && !m_recipients.empty();
+    return m_validState && (!m_recipients.empty() || m_room != 0 || !m_topic.empty());
 }
 
 bool MessagePayload::isFromBot() const {
@@ -134,46 +1026,52 @@ bool wss::MessagePayload::haveSingleRecipient() const {
     return m_recipients.size() == 1;
 }
 bool wss::MessagePayload::isBinary() const {
-    return typeIs(TYPE_BINARY);
+    return typeIs(types::ID_BINARY);
 }
 bool wss::MessagePayload::isTypeOfSentStatus() const {
-    return typeIs(TYPE_NOTIFICATION_RECEIVED);
+    return typeIs(types::ID_NOTIFICATION_RECEIVED);
 }
 bool wss::MessagePayload::typeIs(const char *t) const {
     const char *lc = m_type.c_str();
     return strcmp(lc, t) == 0;
 }
-const std::string MessagePayload::getType() const {
+bool wss::MessagePayload::typeIs(type_id_t typeId) const {
+    return m_typeId == typeId;
+}
+const std::string &MessagePayload::getType() const {
     return m_type;
 }
-const std::string wss::MessagePayload::getError() const {
+wss::type_id_t MessagePayload::getTypeId() const {
+    return m_typeId;
+}
+const std::string &wss::MessagePayload::getError() const {
     return m_errorCause;
 }
 
 MessagePayload &MessagePayload::setSender(user_id_t id) {
     m_sender = id;
-    clearCachedJson();
+    clearCache();
     return *this;
 }
 
 wss::MessagePayload &MessagePayload::setRecipient(user_id_t id) {
     m_recipients.clear();
     m_recipients.push_back(id);
-    clearCachedJson();
+    clearCache();
     return *this;
 }
 wss::MessagePayload &MessagePayload::setRecipients(const std::vector<user_id_t> &recipients) {
-    this->m_recipients = recipients;
-    clearCachedJson();
+    this->m_recipients = Recipients(recipients);
+    clearCache();
     return *this;
 }
 wss::MessagePayload &MessagePayload::setRecipients(std::vector<user_id_t> &&recipients) {
-    this->m_recipients = std::move(recipients);
-    clearCachedJson();
+    this->m_recipients = Recipients(recipients);
+    clearCache();
     return *this;
 }
 
-void wss::MessagePayload::handleJsonException(const std::exception &e, const std::string &) {
+void wss::MessagePayload::handleJsonException(const std::exception &e) {
     m_validState = false;
     std::stringstream ss;
     ss << "Invalid payload: " << e.what();
@@ -181,10 +1079,15 @@ void wss::MessagePayload::handleJsonException(const std::exception &e, const std
     L_WARN("Chat::Message::Payload", ss.str().c_str())
 }
 
-void MessagePayload::clearCachedJson() {
-    if (m_isCached) {
-        m_isCached = false;
-        m_cachedJson.clear();
+void MessagePayload::clearCache() {
+    m_cachedJson.clear();
+    m_cachedBinary.clear();
+}
+void MessagePayload::setRawData(const json &data) {
+    if (data.is_null()) {
+        m_rawData.clear();
+    } else {
+        m_rawData = data.dump();
     }
 }
 
@@ -194,20 +1097,65 @@ bool MessagePayload::operator==(wss::MessagePayload const &rhs) {
 
 wss::MessagePayload &MessagePayload::addRecipient(user_id_t to) {
     m_recipients.push_back(to);
-    clearCachedJson();
+    clearCache();
+    return *this;
+}
+wss::MessagePayload &MessagePayload::setRoom(room_id_t room) {
+    m_room = room;
+    clearCache();
+    return *this;
+}
+wss::MessagePayload &MessagePayload::setTtl(uint32_t seconds) {
+    m_ttl = seconds;
+    clearCache();
+    return *this;
+}
+wss::MessagePayload &MessagePayload::setDeliverAt(uint64_t unixMillis) {
+    m_deliverAt = unixMillis;
+    clearCache();
+    return *this;
+}
+wss::MessagePayload &MessagePayload::setTopic(const std::string &topic) {
+    m_topic = topic;
+    clearCache();
+    return *this;
+}
+wss::MessagePayload &MessagePayload::setData(const json &data) {
+    setRawData(data);
+    clearCache();
     return *this;
 }
 
-void wss::to_json(wss::json &j, const wss::MessagePayload &in) {
+void wss::MessagePayload::writeJsonFields(json &j) const {
     j = json{
-        {"id",         in.m_id},
-        {"type",       in.m_type},
-        {"text",       in.m_text},
-        {"timestamp",  in.m_timestamp},
-        {"sender",     in.m_sender},
-        {"recipients", in.m_recipients},
-        {"data",       in.m_data}
+        {"id",         m_id},
+        {"type",       m_type},
+        {"text",       m_text},
+        {"timestamp",  m_timestamp},
+        {"sender",     m_sender},
+        {"recipients", json::array()}
     };
+    json &recipients = j["recipients"];
+    for (user_id_t recipient: m_recipients) {
+        recipients.push_back(recipient);
+    }
+    if (m_room != 0) {
+        j["room"] = m_room;
+    }
+    if (!m_topic.empty()) {
+        j["topic"] = m_topic;
+    }
+    if (m_ttl != 0) {
+        j["ttl"] = m_ttl;
+    }
+    if (m_deliverAt != 0) {
+        j["deliverAt"] = m_deliverAt;
+    }
+}
+
+void wss::to_json(wss::json &j, const wss::MessagePayload &in) {
+    in.writeJsonFields(j);
+    j["data"] = in.getData();
 }
 
 void wss::from_json(const wss::json &j, wss::MessagePayload &in) {
@@ -215,11 +1163,23 @@ void wss::from_json(const wss::json &j, wss::MessagePayload &in) {
         throw InvalidPayloadException("$.type must be a string");
     } else if (j.find("sender") == j.end() || j.at("sender").is_null() || !j.at("sender").is_number()) {
         throw InvalidPayloadException("$.sender must be uint64_t");
-    } else if (j.find("recipients") == j.end() || j.at("recipients").is_null() || !j.at("recipients").is_array()) {
+    }
+
+    const bool hasRoom = j.find("room") != j.end() && !j.at("room").is_null();
+    if (hasRoom && !j.at("room").is_number_unsigned()) {
+        throw InvalidPayloadException("$.room must be uint64_t");
+    }
+    const bool hasTopic = j.find("topic") != j.end() && !j.at("topic").is_null();
+    if (hasTopic && !j.at("topic").is_string()) {
+        throw InvalidPayloadException("$.topic must be string");
+    }
+    const bool hasRecipients = j.find("recipients") != j.end() && !j.at("recipients").is_null();
+    if ((hasRecipients || (!hasRoom && !hasTopic)) && (!hasRecipients || !j.at("recipients").is_array())) {
         throw InvalidPayloadException("$.recipients[] must be uint64_t[]");
     }
 
     in.m_type = j.value("type", std::string(TYPE_TEXT));
+    in.m_typeId = types::find(in.m_type);
 
     if (strcmp(in.m_type.c_str(), TYPE_TEXT) == 0) {
         if (!j.at("text").is_string()) {
@@ -235,17 +1195,36 @@ void wss::from_json(const wss::json &j, wss::MessagePayload &in) {
     }
 
     in.m_sender = j.at("sender").get<user_id_t>();
-    in.m_recipients = j.at("recipients").get<std::vector<user_id_t>>();
-    if (in.m_recipients.empty()) {
-        throw InvalidPayloadException("$.recipients[] must contains at least 1 value");
+    in.m_room = hasRoom ? j.at("room").get<room_id_t>() : 0;
+    in.m_ttl = 0;
+    if (j.find("ttl") != j.end() && !j.at("ttl").is_null()) {
+        if (!j.at("ttl").is_number_unsigned() || j.at("ttl").get<uint64_t>() > std::numeric_limits<uint32_t>::max()) {
+            throw InvalidPayloadException("$.ttl must be uint32_t");
+        }
+        in.m_ttl = j.at("ttl").get<uint32_t>();
     }
-
-    if (j.find("data") != j.end()) {
-        in.m_data = j.value("data", json());
+    in.m_deliverAt = 0;
+    if (j.find("deliverAt") != j.end() && !j.at("deliverAt").is_null()) {
+        if (!j.at("deliverAt").is_number_unsigned()) {
+            throw InvalidPayloadException("$.deliverAt must be uint64_t");
+        }
+        in.m_deliverAt = j.at("deliverAt").get<uint64_t>();
+    }
+    in.m_topic = hasTopic ? j.at("topic").get<std::string>() : std::string();
+    if (hasRecipients) {
+        in.m_recipients = MessagePayload::Recipients(j.at("recipients").get<std::vector<user_id_t>>());
     } else {
-        in.m_data = json();
+        in.m_recipients.clear();
+    }
+    if (in.m_recipients.empty() && in.m_room == 0 && in.m_topic.empty()) {
+        throw InvalidPayloadException("$.recipients[] must contains at least 1 value");
     }
 
+    // payload DOM is already built here (codecs, scanner fallback), but only data text is kept:
+    // copies of payload must not copy its nodes
+    const auto data = j.find("data");
+    in.setRawData(data != j.end() ? *data : json());
+
     if (j.find("timestamp") != j.end() && j.at("timestamp").is_string()) {
         in.m_timestamp = j.at("timestamp").get<std::string>();
     } else {
@@ -258,12 +1237,65 @@ wss::MessagePayload MessagePayload::createSendStatus(user_id_t to) {
     payload.m_sender = 0;
     payload.addRecipient(to);
     payload.m_type = TYPE_NOTIFICATION_RECEIVED;
+    payload.m_typeId = types::ID_NOTIFICATION_RECEIVED;
 
     return payload;
 }
 wss::MessagePayload MessagePayload::createSendStatus(const MessagePayload &payload) {
     return createSendStatus(payload.getSender());
 }
+wss::MessagePayload MessagePayload::createSendStatus(user_id_t to, const std::vector<unid_t> &ids) {
+    MessagePayload payload = createSendStatus(to);
+    json items = json::array();
+    for (const auto &id: ids) {
+        items.push_back(id);
+    }
+    payload.setRawData({{"ids", items}});
+
+    return payload;
+}
+wss::MessagePayload MessagePayload::createHistoryStatus(user_id_t to, const unid_t &next, bool more, std::size_t count) {
+    MessagePayload payload;
+    payload.m_id = wss::unid::generator()();
+    payload.m_sender = 0;
+    payload.addRecipient(to);
+    payload.m_type = TYPE_HISTORY;
+    payload.m_typeId = types::ID_HISTORY;
+    payload.m_timestamp = wss::utils::getNowISODateTimeFractionalConfigAware();
+    payload.setRawData({{"next", next}, {"more", more}, {"count", count}});
+
+    return payload;
+}
+wss::MessagePayload MessagePayload::createPresence(user_id_t user, bool online, uint64_t sequence) {
+    MessagePayload payload;
+    payload.m_id = wss::unid::generator()();
+    payload.m_sender = 0;
+    payload.m_type = TYPE_PRESENCE;
+    payload.m_typeId = types::ID_PRESENCE;
+    payload.m_timestamp = wss::utils::getNowISODateTimeFractionalConfigAware();
+    payload.setRawData({{"user", user}, {"online", online}, {"seq", sequence}});
+
+    return payload;
+}
+wss::MessagePayload MessagePayload::createBatchStatus(user_id_t to,
+                                                     std::size_t accepted,
+                                                     const std::vector<std::pair<std::size_t, std::string>> &rejected) {
+    MessagePayload payload;
+    payload.m_id = wss::unid::generator()();
+    payload.m_sender = 0;
+    payload.addRecipient(to);
+    payload.m_type = TYPE_NOTIFICATION_BATCH_RECEIVED;
+    payload.m_typeId = types::ID_NOTIFICATION_BATCH_RECEIVED;
+    payload.m_timestamp = wss::utils::getNowISODateTimeFractionalConfigAware();
+
+    json errors = json::array();
+    for (const auto &item: rejected) {
+        errors.push_back({{"index", item.first}, {"error", item.second}});
+    }
+    payload.setRawData({{"accepted", accepted}, {"rejected", errors}});
+
+    return payload;
+}
 
 
 
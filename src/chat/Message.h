@@ -9,19 +9,46 @@
 #ifndef WSSERVER_MESSAGE_HPP
 #define WSSERVER_MESSAGE_HPP
 
+#include <chrono>
 #include <string>
 #include <iostream>
+#include <memory>
 #include <type_traits>
+#include <utility>
+#include <vector>
 #include <toolboxpp.h>
 #include "json.hpp"
+#include "small_vector.hpp"
+#include "MessageType.h"
 #include "../wsserver_core.h"
+#include "../base/Hotpath.h"
 #include "../base/unid.h"
+#include "../base/Tracing.h"
 
 namespace wss {
 
 extern const char *TYPE_TEXT;
 extern const char *TYPE_BINARY;
 extern const char *TYPE_NOTIFICATION_RECEIVED;
+/// \brief System message with result of received batch
+extern const char *TYPE_NOTIFICATION_BATCH_RECEIVED;
+/// \brief Control message: sender joins payload room
+extern const char *TYPE_ROOM_JOIN;
+/// \brief Control message: sender leaves payload room
+extern const char *TYPE_ROOM_LEAVE;
+/// \brief Control message: connection subscribes to payload topic (or wildcard pattern)
+extern const char *TYPE_TOPIC_SUBSCRIBE;
+/// \brief Control message: connection unsubscribes from payload topic (or wildcard pattern)
+extern const char *TYPE_TOPIC_UNSUBSCRIBE;
+/// \brief System message: user went online or offline
+extern const char *TYPE_PRESENCE;
+/// \brief Control message: client acknowledges received messages, data: {"ids": ["unid", ...]}
+extern const char *TYPE_ACK;
+/// \brief Control message: client requests messages after cursor, data: {"since": "unid", "limit": 100}.
+/// Server sends found messages and reply of the same type, data: {"next": "unid", "more": bool, "count": 10}
+extern const char *TYPE_HISTORY;
+/// \brief Subprotocol of binary payload envelope, see MessagePayload::toBinary()
+extern const char *SUBPROTOCOL_BINARY_V1;
 
 struct InvalidPayloadException : std::exception {
   std::string err;
@@ -34,27 +61,94 @@ struct InvalidPayloadException : std::exception {
   }
 };
 
+/// \brief Serialized form of payload: computed once, then shared by all payload copies.
+/// Buffer can be set concurrently from many threads: first one wins, others use it
+class SerializedCache {
+ public:
+    using Buffer = std::shared_ptr<const std::string>;
+
+    SerializedCache() = default;
+    SerializedCache(const SerializedCache &other) noexcept :
+        m_buffer(other.get()) { }
+    SerializedCache &operator=(const SerializedCache &other) noexcept {
+        std::atomic_store(&m_buffer, other.get());
+        return *this;
+    }
+
+    /// \return nullptr if not serialized yet
+    Buffer get() const noexcept {
+        return std::atomic_load(&m_buffer);
+    }
+
+    /// \brief Sets buffer, if it is not set yet
+    /// \param buffer
+    /// \return stored buffer: passed one, or one that was set before
+    Buffer setIfEmpty(Buffer buffer) const noexcept {
+        Buffer expected;
+        if (std::atomic_compare_exchange_strong(&m_buffer, &expected, buffer)) {
+            return buffer;
+        }
+        return expected;
+    }
+
+    /// \brief Drops buffer of modified payload. Must not be called concurrently with readers of this payload
+    void clear() noexcept {
+        std::atomic_store(&m_buffer, Buffer());
+    }
+
+ private:
+    mutable Buffer m_buffer;
+};
+
 /// \brief Main structured message payload
 /// \todo Protobuf support
-class MessagePayload {
+class MessagePayload : private wss::hotpath::Tracked<wss::hotpath::AllocSite::MessagePayload, MessagePayload> {
+ public:
+    /// \brief Most messages have few recipients: they are stored without heap allocation
+    using Recipients = wss::utils::SmallVector<user_id_t, 4>;
+
  private:
     unid_t m_id;
     user_id_t m_sender;
-    std::vector<user_id_t> m_recipients;
+    Recipients m_recipients;
+    room_id_t m_room = 0;
+    /// \brief Undelivered queue lifetime in seconds, 0 - server default
+    uint32_t m_ttl = 0;
+    /// \brief Scheduled delivery time, unix milliseconds, 0 - right away
+    uint64_t m_deliverAt = 0;
+    std::string m_topic;
     std::string m_text;
     std::string m_type;
+    /// \brief Interned m_type, see wss::types::find()
+    type_id_t m_typeId = types::ID_CUSTOM;
     std::string m_timestamp;
-    json m_data;
+    /// \brief Validated "data" json text: it is stored, copied and passed through as is, DOM is built only by
+    /// getData(). Empty - payload has no data (null)
+    std::string m_rawData;
     bool m_validState = true;
     std::string m_errorCause;
+    /// \brief When message was read from client socket, not serialized. Epoch - unknown (not from websocket)
+    std::chrono::steady_clock::time_point m_receivedAt;
+    /// \brief Root span of message, not serialized. Empty if message is not sampled
+    wss::tracing::SpanContext m_trace;
 
-    mutable std::string m_cachedJson;
-    mutable bool m_isCached = false;
+    SerializedCache m_cachedJson;
+    SerializedCache m_cachedBinary;
 
     void fromJson(const json &json);
+    /// \brief Schema-specific parser of known fields, without DOM
+    /// \param data
+    /// \param length
+    /// \return false if payload is not valid or has unusual shape: DOM parser must be used to get exact error
+    bool fromJsonFast(const char *data, std::size_t length);
+    /// \brief Sets all json fields except data
+    void writeJsonFields(json &obj) const;
     void validate();
-    void handleJsonException(const std::exception &e, const std::string &data);
-    void clearCachedJson();
+    void handleJsonException(const std::exception &e);
+    void clearCache();
+    /// \brief Keeps data as json text
+    /// \param data null - no data
+    void setRawData(const json &data);
 
     friend void to_json(wss::json &j, const wss::MessagePayload &in);
     friend void from_json(const wss::json &j, wss::MessagePayload &in);
@@ -69,6 +163,12 @@ class MessagePayload {
     /// \return
     static MessagePayload createSendStatus(const MessagePayload &payload);
 
+    /// \brief Creates coalesced send-status message with delivered messages ids in data: {"ids": [...]}
+    /// \param to sender UserId
+    /// \param ids delivered messages ids
+    /// \return valid payload object
+    static MessagePayload createSendStatus(user_id_t to, const std::vector<unid_t> &ids);
+
     MessagePayload();
     MessagePayload(user_id_t from, user_id_t to, const std::string &message);
     MessagePayload(user_id_t from, user_id_t to, std::string &&message);
@@ -80,8 +180,67 @@ class MessagePayload {
     MessagePayload &operator=(MessagePayload &&payload) = default;
 
     explicit MessagePayload(const std::string &json) noexcept;
+    /// \brief Parses json payload directly from raw buffer, without copying it to std::string
+    /// \param data json bytes
+    /// \param length bytes count
+    MessagePayload(const char *data, std::size_t length) noexcept;
     explicit MessagePayload(const nlohmann::json &obj) noexcept;
 
+    /// \brief Parses binary envelope (see toBinary()). Id is generated by server, like for json payload
+    /// \param data
+    /// \param length
+    /// \return payload, check isValid()
+    static MessagePayload fromBinary(const char *data, std::size_t length) noexcept;
+
+    /// \brief Parses binary envelope, that was created by server (stored payload): id is taken from envelope
+    /// \param data
+    /// \param length
+    /// \return payload, check isValid()
+    static MessagePayload fromStoredBinary(const char *data, std::size_t length) noexcept;
+
+    /// \brief Check buffer is a binary batch: u8 version (3), u32 count, then count of: u32 length, envelope
+    /// \param data
+    /// \param length
+    /// \return
+    static bool isBinaryBatch(const char *data, std::size_t length) noexcept;
+
+    /// \brief Parses binary batch (see isBinaryBatch()). Items are not validated, check isValid() for each
+    /// \param data
+    /// \param length
+    /// \throws InvalidPayloadException if batch container is truncated
+    /// \return payloads
+    static std::vector<MessagePayload> fromBinaryBatch(const char *data, std::size_t length);
+
+    /// \brief Joins binary envelopes (see toBinary()) into binary batch (see isBinaryBatch())
+    /// \param items envelope data and length
+    /// \return batch
+    static std::string toBinaryBatch(const std::vector<std::pair<const char *, std::size_t>> &items);
+
+    /// \brief Creates aggregated result of received batch, data: {"accepted": N, "rejected": [{"index": i, "error": "..."}]}
+    /// \param to batch sender
+    /// \param accepted number of dispatched payloads
+    /// \param rejected index and error of invalid payloads
+    /// \return valid payload object
+    static MessagePayload createBatchStatus(user_id_t to,
+                                            std::size_t accepted,
+                                            const std::vector<std::pair<std::size_t, std::string>> &rejected);
+
+    /// \brief Creates presence transition message, data: {"user": id, "online": bool, "seq": sequence}.
+    /// Payload has no recipients: it must be published to topic, or passed to event listeners
+    /// \param user
+    /// \param online
+    /// \param sequence transition sequence number
+    /// \return
+    static MessagePayload createPresence(user_id_t user, bool online, uint64_t sequence);
+
+    /// \brief Creates reply to history request (see TYPE_HISTORY)
+    /// \param to requesting user
+    /// \param next cursor for next page: id of last sent message
+    /// \param more page is full, next page can have messages
+    /// \param count sent messages
+    /// \return valid payload object
+    static MessagePayload createHistoryStatus(user_id_t to, const unid_t &next, bool more, std::size_t count);
+
     bool operator==(wss::MessagePayload const &);
 
     /// \brief Return sender UserId
@@ -92,22 +251,100 @@ class MessagePayload {
     /// \return string identifier
     const unid_t getId() const;
 
+    /// \brief Ingress time, used for latency metrics
+    /// \param receivedAt monotonic time message was read from socket
+    void setReceivedAt(std::chrono::steady_clock::time_point receivedAt);
+    /// \brief Ingress time
+    /// \return epoch if payload didn't come from websocket
+    std::chrono::steady_clock::time_point getReceivedAt() const;
+
+    /// \brief Trace context, that spans of this message (parse, routing, writes, event sends) belong to
+    /// \param trace root span, see wss::tracing::sample()
+    void setTrace(const wss::tracing::SpanContext &trace);
+    /// \brief Trace context
+    /// \return unsampled (empty) context if message is not traced
+    const wss::tracing::SpanContext &getTrace() const;
+
     /// \brief Recipients ids
-    /// \return std::vector<UserId>
-    const std::vector<user_id_t> getRecipients() const;
+    /// \return std::vector<UserId>, can be empty for room message
+    const Recipients &getRecipients() const;
+
+    /// \brief Room id. Room message is delivered to all room members except sender, recipients are ignored
+    /// \return 0 if payload is not addressed to room
+    room_id_t getRoom() const;
+
+    /// \brief Whether payload is addressed to room
+    /// \return
+    bool isForRoom() const;
+
+    /// \brief How long message waits in undelivered queue for offline recipient
+    /// \return seconds, 0 - server default (chat.undeliveredTtlSeconds)
+    uint32_t getTtl() const;
+
+    /// \brief When message is delivered, if server has scheduler (chat.scheduler). Due message is sent as usual
+    /// \return unix milliseconds, 0 - right away
+    uint64_t getDeliverAt() const;
+
+    /// \brief Topic name (or subscription pattern for subscribe control messages). Topic payload is delivered
+    /// to all subscribed connections, recipients are ignored
+    /// \return empty string if payload is not published to topic
+    const std::string &getTopic() const;
+
+    /// \brief Custom payload data, parsed from its json text on every call: server itself doesn't need it
+    /// \return null if payload has no data
+    json getData() const;
+
+    /// \brief Json text of payload data, as is, without DOM
+    /// \return empty string if payload has no data
+    std::string getDataText() const;
+
+    /// \brief Length of getDataText(). Data is not copied
+    /// \return bytes
+    std::size_t getDataSize() const;
+
+    /// \brief Message ids from data "ids" array, e.g. for ack control message
+    /// \return empty if data has no ids, invalid ids are skipped
+    std::vector<unid_t> getDataIds() const;
+
+    /// \brief Whether payload is published to topic
+    /// \return
+    bool isForTopic() const;
 
     /// \brief Message type
     /// \return string type. Predefined types:
     /// \see constants TYPE_TEXT, TYPE_BINARY, TYPE_B64_IMAGE, TYPE_URL_IMAGE, TYPE_NOTIFICATION_RECEIVED
-    const std::string getType() const;
+    const std::string &getType() const;
+
+    /// \brief Interned message type
+    /// \return type id (types::ID_* for predefined types) or types::ID_CUSTOM if type is not registered
+    type_id_t getTypeId() const;
 
     /// \brief Text message
     /// \return string or empty if type not a TYPE_TEXT
-    const std::string getText() const;
+    const std::string &getText() const;
 
-    /// \brief Converts this payload to json string
-    /// \return valid json string
-    const std::string toJson() const;
+    /// \brief Converts this payload to json string. Unmodified parsed payload with only known fields
+    /// is forwarded as received client text, with server fields (id, default timestamp etc) spliced in
+    /// \return valid json string, cached until payload is modified
+    const std::string &toJson() const;
+
+    /// \brief Same as toJson(), but buffer can be kept after payload is destroyed, without copying it
+    /// \return
+    SerializedCache::Buffer getJsonBuffer() const;
+
+    /// \brief Converts this payload to binary envelope (all numbers are big endian):
+    /// u8 version (1), u32 id.tm, u32 id.uuid, u16 id.pid, u32 id.inc, u64 sender,
+    /// u32 recipients count, u64 recipient[count], u16 type length, type,
+    /// u16 timestamp length, timestamp, u32 text length, text, u32 data length, data (json, 0 length - null).
+    /// Room or topic payload has version 2 with u64 room (0 - none), u16 topic length, topic after data,
+    /// recipients count can be 0. Payload with ttl has version 4: version 2 fields, then u32 ttl.
+    /// Scheduled payload has version 5: version 4 fields (ttl can be 0), then u64 deliverAt
+    /// \return binary string, cached until payload is modified
+    const std::string &toBinary() const;
+
+    /// \brief Same as toBinary(), but buffer can be kept after payload is destroyed, without copying it
+    /// \return
+    SerializedCache::Buffer getBinaryBuffer() const;
 
     /// \brief Checks by passed id, that current payload belongs to sender
     /// \param id UserId
@@ -131,6 +368,11 @@ class MessagePayload {
     /// \return
     bool typeIs(const char *type) const;
 
+    /// \brief Check message type by interned id (case-insensitive)
+    /// \param typeId types::ID_* constant
+    /// \return
+    bool typeIs(type_id_t typeId) const;
+
     /// \brief Whether message type is just send status
     /// \return
     bool isTypeOfSentStatus() const;
@@ -145,15 +387,23 @@ class MessagePayload {
 
     /// \brief Error message
     /// \return Empty string if no one error. Check @see isValid() before
-    const std::string getError() const;
+    const std::string &getError() const;
 
     MessagePayload &setSender(user_id_t id);
     MessagePayload &setRecipient(user_id_t id);
     MessagePayload &setRecipients(const std::vector<user_id_t> &recipients);
     MessagePayload &setRecipients(std::vector<user_id_t> &&recipients);
     MessagePayload &addRecipient(user_id_t to);
+    MessagePayload &setRoom(room_id_t room);
+    MessagePayload &setTtl(uint32_t seconds);
+    MessagePayload &setDeliverAt(uint64_t unixMillis);
+    MessagePayload &setTopic(const std::string &topic);
+    MessagePayload &setData(const json &data);
 };
 
+/// \brief Immutable payload shared by fan-out callbacks. It can be serialized from any thread: caches are thread safe
+using MessagePayloadPtr = std::shared_ptr<const MessagePayload>;
+
 void to_json(wss::json &j, const wss::MessagePayload &in);
 void from_json(const wss::json &j, wss::MessagePayload &in);
 
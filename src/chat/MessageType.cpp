@@ -0,0 +1,139 @@
+/**
+ * wsserver
+ * MessageType.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "MessageType.h"
+#include "Message.h"
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <mutex>
+#include <stdexcept>
+
+namespace {
+
+inline char lower(char c) noexcept {
+    return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+}
+
+/// \brief Case-insensitive FNV-1a
+uint64_t hashName(const char *name, std::size_t length) noexcept {
+    uint64_t hash = 14695981039346656037ULL;
+    for (std::size_t i = 0; i < length; i++) {
+        hash ^= static_cast<unsigned char>(lower(name[i]));
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/// \brief Insert-only open-addressing table. Writers are serialized by mutex and publish entry with
+/// release store, so readers never lock. Entries are never removed
+class TypeRegistry {
+ public:
+    static TypeRegistry &get() {
+        static TypeRegistry registry;
+        return registry;
+    }
+
+    wss::type_id_t find(const char *name, std::size_t length) const noexcept {
+        const uint64_t hash = hashName(name, length);
+        for (std::size_t i = hash & (SLOTS - 1);; i = (i + 1) & (SLOTS - 1)) {
+            const Entry *entry = m_slots[i].load(std::memory_order_acquire);
+            if (entry == nullptr) {
+                return wss::types::ID_CUSTOM;
+            }
+            if (entry->hash == hash && equals(entry->name, name, length)) {
+                return entry->id;
+            }
+        }
+    }
+
+    wss::type_id_t intern(const std::string &name) {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        const wss::type_id_t found = find(name.data(), name.length());
+        if (found != wss::types::ID_CUSTOM) {
+            return found;
+        }
+        if (m_count == wss::types::MAX_TYPES) {
+            throw std::length_error("Too many message types, max: " + std::to_string(wss::types::MAX_TYPES - 1));
+        }
+
+        Entry &entry = m_entries[m_count];
+        entry.name.reserve(name.length());
+        for (char c: name) {
+            entry.name.push_back(lower(c));
+        }
+        entry.hash = hashName(name.data(), name.length());
+        entry.id = static_cast<wss::type_id_t>(m_count++);
+
+        std::size_t i = entry.hash & (SLOTS - 1);
+        while (m_slots[i].load(std::memory_order_relaxed) != nullptr) {
+            i = (i + 1) & (SLOTS - 1);
+        }
+        m_slots[i].store(&entry, std::memory_order_release);
+        return entry.id;
+    }
+
+ private:
+    struct Entry {
+      std::string name;
+      uint64_t hash = 0;
+      wss::type_id_t id = wss::types::ID_CUSTOM;
+    };
+    // load factor is always below 1/2
+    static constexpr std::size_t SLOTS = wss::types::MAX_TYPES * 2;
+
+    std::array<std::atomic<const Entry *>, SLOTS> m_slots;
+    std::array<Entry, wss::types::MAX_TYPES> m_entries;
+    // id 0 is reserved for custom types
+    std::size_t m_count = 1;
+    std::mutex m_writeMutex;
+
+    TypeRegistry() {
+        for (auto &slot: m_slots) {
+            slot.store(nullptr, std::memory_order_relaxed);
+        }
+        // order is the same as ID_* constants
+        for (const char *type: {wss::TYPE_TEXT, wss::TYPE_BINARY, wss::TYPE_NOTIFICATION_RECEIVED,
+                                wss::TYPE_NOTIFICATION_BATCH_RECEIVED, wss::TYPE_ROOM_JOIN, wss::TYPE_ROOM_LEAVE,
+                                wss::TYPE_TOPIC_SUBSCRIBE, wss::TYPE_TOPIC_UNSUBSCRIBE, wss::TYPE_PRESENCE,
+                                wss::TYPE_ACK, wss::TYPE_HISTORY}) {
+            intern(type);
+        }
+    }
+
+    static bool equals(const std::string &lowered, const char *name, std::size_t length) noexcept {
+        if (lowered.length() != length) {
+            return false;
+        }
+        for (std::size_t i = 0; i < length; i++) {
+            if (lowered[i] != lower(name[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+}
+
+wss::type_id_t wss::types::find(const char *name, std::size_t length) noexcept {
+    return TypeRegistry::get().find(name, length);
+}
+wss::type_id_t wss::types::find(const std::string &name) noexcept {
+    return TypeRegistry::get().find(name.data(), name.length());
+}
+wss::type_id_t wss::types::intern(const std::string &name) {
+    return TypeRegistry::get().intern(name);
+}
+wss::types::TypeSet wss::types::compile(const std::vector<std::string> &names) {
+    TypeSet out;
+    for (const auto &name: names) {
+        out.set(intern(name));
+    }
+    return out;
+}
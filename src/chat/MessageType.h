@@ -0,0 +1,66 @@
+/**
+ * wsserver
+ * MessageType.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_MESSAGETYPE_H
+#define WSSERVER_MESSAGETYPE_H
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace wss {
+
+using type_id_t = uint16_t;
+
+namespace types {
+
+/// \brief Type, that is not registered: it is never a member of any TypeSet
+constexpr type_id_t ID_CUSTOM = 0;
+constexpr type_id_t ID_TEXT = 1;
+constexpr type_id_t ID_BINARY = 2;
+constexpr type_id_t ID_NOTIFICATION_RECEIVED = 3;
+constexpr type_id_t ID_NOTIFICATION_BATCH_RECEIVED = 4;
+constexpr type_id_t ID_ROOM_JOIN = 5;
+constexpr type_id_t ID_ROOM_LEAVE = 6;
+constexpr type_id_t ID_TOPIC_SUBSCRIBE = 7;
+constexpr type_id_t ID_TOPIC_UNSUBSCRIBE = 8;
+constexpr type_id_t ID_PRESENCE = 9;
+constexpr type_id_t ID_ACK = 10;
+constexpr type_id_t ID_HISTORY = 11;
+
+/// \brief Max registered types, including built-in
+constexpr std::size_t MAX_TYPES = 256;
+
+/// \brief Set of type ids, membership test is one bit test
+using TypeSet = std::bitset<MAX_TYPES>;
+
+/// \brief Type id by name, case-insensitive. Lock-free, used for every parsed message.
+/// Unknown types are not registered here: clients can't fill registry with random names
+/// \param name
+/// \param length
+/// \return ID_CUSTOM if type name is not registered
+type_id_t find(const char *name, std::size_t length) noexcept;
+type_id_t find(const std::string &name) noexcept;
+
+/// \brief Registers type name (case-insensitive) if not registered yet. Thread safe
+/// \param name
+/// \return type id
+/// \throws std::length_error if registry already has MAX_TYPES names
+type_id_t intern(const std::string &name);
+
+/// \brief Interns names and makes set of them. Called on config load for type lists
+/// \param names
+/// \return
+TypeSet compile(const std::vector<std::string> &names);
+
+}
+}
+
+#endif //WSSERVER_MESSAGETYPE_H
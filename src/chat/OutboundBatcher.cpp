@@ -0,0 +1,154 @@
+/**
+ * wsserver
+ * OutboundBatcher.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "OutboundBatcher.h"
+#include <memory>
+#include <utility>
+
+constexpr std::size_t wss::OutboundBatcher::STRIPES;
+
+wss::OutboundBatcher::OutboundBatcher(boost::asio::io_service &service, const Options &options) :
+    m_options(options),
+    m_timer(service) {
+}
+
+wss::OutboundBatcher::~OutboundBatcher() {
+    boost::system::error_code ignored;
+    m_timer.cancel(ignored);
+}
+
+void wss::OutboundBatcher::send(const wss::WsConnectionPtr &connection,
+                                const wss::PayloadCodec &codec,
+                                wss::WsFramePtr frame,
+                                SendCallback callback,
+                                SendPriority priority,
+                                std::chrono::steady_clock::time_point receivedAt,
+                                const CoalesceKey &coalesceKey) {
+    if (priority == SendPriority::High) {
+        // written before any queued frame anyway
+        connection->send(std::move(frame), callback, priority, receivedAt, coalesceKey);
+        return;
+    }
+
+    const uint64_t key = connection->getUniqueId();
+    Stripe &stripe = m_stripes[key % STRIPES];
+    // sent after lock is released, in this order
+    std::vector<Batch> ready;
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lock(stripe.lock);
+        auto it = stripe.batches.find(key);
+        if (it != stripe.batches.end() && (coalesceKey || it->second.priority != priority)) {
+            // sent before this frame, to keep order
+            ready.push_back(std::move(it->second));
+            stripe.batches.erase(it);
+            it = stripe.batches.end();
+        }
+
+        if (!coalesceKey) {
+            if (it == stripe.batches.end()) {
+                it = stripe.batches.emplace(key, Batch()).first;
+                it->second.connection = connection;
+                it->second.codec = &codec;
+                it->second.priority = priority;
+                it->second.receivedAt = receivedAt;
+            }
+            Batch &batch = it->second;
+            batch.bytes += frame->payloadSize();
+            batch.items.push_back(Item{std::move(frame), std::move(callback)});
+            queued = true;
+
+            if (batch.items.size() >= m_options.maxItems || batch.bytes >= m_options.maxBytes) {
+                ready.push_back(std::move(batch));
+                stripe.batches.erase(it);
+                queued = false;
+            }
+        }
+    }
+
+    for (auto &batch: ready) {
+        flush(std::move(batch));
+    }
+    if (coalesceKey) {
+        connection->send(std::move(frame), callback, priority, receivedAt, coalesceKey);
+    } else if (queued) {
+        arm();
+    }
+}
+
+void wss::OutboundBatcher::flushAll() {
+    for (auto &stripe: m_stripes) {
+        std::unordered_map<uint64_t, Batch> batches;
+        {
+            std::lock_guard<std::mutex> lock(stripe.lock);
+            batches.swap(stripe.batches);
+        }
+        for (auto &item: batches) {
+            flush(std::move(item.second));
+        }
+    }
+}
+
+void wss::OutboundBatcher::arm() {
+    if (m_armed.exchange(true)) {
+        return;
+    }
+    m_timer.expires_from_now(std::chrono::milliseconds(m_options.lingerMillis));
+    m_timer.async_wait([this](const boost::system::error_code &errorCode) {
+      if (errorCode == boost::asio::error::operation_aborted) {
+          return;
+      }
+      onTimer();
+    });
+}
+
+void wss::OutboundBatcher::onTimer() {
+    // frames queued from now on start timer again
+    m_armed = false;
+    flushAll();
+}
+
+void wss::OutboundBatcher::flush(Batch &&batch) {
+    if (batch.items.empty()) {
+        return;
+    }
+    if (batch.items.size() == 1) {
+        Item &item = batch.items.front();
+        batch.connection->send(std::move(item.frame), item.callback, batch.priority, batch.receivedAt);
+        return;
+    }
+
+    wss::PayloadCodec::EncodedItems encoded;
+    encoded.reserve(batch.items.size());
+    for (const auto &item: batch.items) {
+        encoded.emplace_back(reinterpret_cast<const char *>(item.frame->payloadData()), item.frame->payloadSize());
+    }
+    wss::WsFramePtr frame = WsBase::Frame::create(batch.codec->encodeBatch(encoded), batch.codec->getFinRsvOpcode());
+
+    m_batches++;
+    m_batchedItems += batch.items.size();
+    auto items = std::make_shared<std::vector<Item>>(std::move(batch.items));
+    batch.connection->send(std::move(frame), [items](const wss::server::websocket::ErrorCode &errorCode,
+                                                     std::size_t) {
+      for (const auto &item: *items) {
+          if (item.callback) {
+              item.callback(errorCode, errorCode ? 0 : item.frame->size());
+          }
+      }
+    }, batch.priority, batch.receivedAt);
+}
+
+uint64_t wss::OutboundBatcher::getBatches() const noexcept {
+    return m_batches;
+}
+uint64_t wss::OutboundBatcher::getBatchedItems() const noexcept {
+    return m_batchedItems;
+}
+const wss::OutboundBatcher::Options &wss::OutboundBatcher::getOptions() const noexcept {
+    return m_options;
+}
@@ -0,0 +1,117 @@
+/**
+ * wsserver
+ * OutboundBatcher.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_OUTBOUNDBATCHER_H
+#define WSSERVER_OUTBOUNDBATCHER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include "PayloadCodec.h"
+#include "../wsserver_core.h"
+
+namespace wss {
+
+/// \brief Joins frames sent to connection within linger window into one batch frame, for clients that negotiated
+/// batching codec (see BatchingCodec). High-rate receivers get one frame, one socket write and one write completion
+/// per batch instead of per message. Every message callback is still called with batch write result,
+/// so delivery tracking and statistics stay per message.
+/// Control frames (SendPriority::High) and coalesced frames are never batched: pending batch of connection is sent
+/// before coalesced frame to keep order. Batch is sent when it reaches maxItems or maxBytes, or by timer:
+/// pending batches are sent every lingerMillis, so message waits at most lingerMillis
+class OutboundBatcher {
+ public:
+    using SendPriority = wss::server::websocket::SendPriority;
+    using SendCallback = wss::server::websocket::SendCallback;
+    using CoalesceKey = wss::server::websocket::CoalesceKey;
+
+    struct Options {
+      /// \brief Max time message waits for next ones
+      uint32_t lingerMillis = 5;
+      /// \brief Batch is sent when it has this number of messages
+      std::size_t maxItems = 64;
+      /// \brief Batch is sent when its messages are larger than this
+      std::size_t maxBytes = 64 * 1024;
+    };
+
+    /// \param service timer runs on it, must outlive batcher
+    /// \param options
+    OutboundBatcher(boost::asio::io_service &service, const Options &options);
+    ~OutboundBatcher();
+    OutboundBatcher(const OutboundBatcher &other) = delete;
+    OutboundBatcher &operator=(const OutboundBatcher &other) = delete;
+
+    /// \brief Queues frame to batch of connection, or sends it directly if it can't be batched.
+    /// Arguments are the same as of Connection::send()
+    /// \param connection
+    /// \param codec connection codec, batch is encoded by it, must outlive batcher
+    /// \param frame encoded payload
+    /// \param callback
+    /// \param priority
+    /// \param receivedAt
+    /// \param coalesceKey
+    void send(const wss::WsConnectionPtr &connection,
+              const wss::PayloadCodec &codec,
+              wss::WsFramePtr frame,
+              SendCallback callback,
+              SendPriority priority,
+              std::chrono::steady_clock::time_point receivedAt,
+              const CoalesceKey &coalesceKey);
+
+    /// \brief Sends all pending batches now, e.g. before server stops
+    void flushAll();
+
+    /// \brief Sent batch frames and messages in them (single pending messages are sent as is and not counted)
+    uint64_t getBatches() const noexcept;
+    uint64_t getBatchedItems() const noexcept;
+    const Options &getOptions() const noexcept;
+
+ private:
+    static constexpr std::size_t STRIPES = 16;
+
+    struct Item {
+      wss::WsFramePtr frame;
+      SendCallback callback;
+    };
+    struct Batch {
+      wss::WsConnectionPtr connection;
+      const wss::PayloadCodec *codec = nullptr;
+      SendPriority priority = SendPriority::Normal;
+      /// \brief Of first message, for end-to-end latency
+      std::chrono::steady_clock::time_point receivedAt;
+      std::vector<Item> items;
+      std::size_t bytes = 0;
+    };
+    struct Stripe {
+      std::mutex lock;
+      /// \brief By connection unique id
+      std::unordered_map<uint64_t, Batch> batches;
+    };
+
+    const Options m_options;
+    boost::asio::steady_timer m_timer;
+    std::atomic_bool m_armed{false};
+    std::array<Stripe, STRIPES> m_stripes;
+    std::atomic<uint64_t> m_batches{0};
+    std::atomic<uint64_t> m_batchedItems{0};
+
+    /// \brief Starts timer, if it's not started
+    void arm();
+    void onTimer();
+    void flush(Batch &&batch);
+};
+
+}
+
+#endif //WSSERVER_OUTBOUNDBATCHER_H
@@ -0,0 +1,474 @@
+/**
+ * wsserver
+ * PayloadCodec.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "PayloadCodec.h"
+#include <cctype>
+#include <toolboxpp.h>
+#include "../helpers/logging.h"
+
+const char *wss::SUBPROTOCOL_JSON_V1 = "wss.json.v1";
+const char *wss::SUBPROTOCOL_MSGPACK_V1 = "wss.msgpack.v1";
+const char *wss::SUBPROTOCOL_CBOR_V1 = "wss.cbor.v1";
+const char *wss::SUBPROTOCOL_BATCH_SUFFIX = "+batch";
+
+bool wss::PayloadCodec::decodeBatch(const char *, std::size_t, std::vector<wss::MessagePayload> &) const {
+    return false;
+}
+std::size_t wss::PayloadCodec::countBatch(const char *, std::size_t) const {
+    return 0;
+}
+bool wss::PayloadCodec::isBatching() const {
+    return false;
+}
+const wss::PayloadCodec &wss::PayloadCodec::getItemCodec() const {
+    return *this;
+}
+
+namespace {
+
+void decodeJsonBatch(const wss::json &obj, std::vector<wss::MessagePayload> &out) {
+    if (!obj.is_array()) {
+        throw wss::InvalidPayloadException("Batch must be an array of payloads");
+    }
+    out.reserve(obj.size());
+    for (const auto &item: obj) {
+        out.emplace_back(item);
+    }
+}
+
+/// \brief Top level items of json array, strings and nested containers are skipped by single pass
+/// \param pos position of opening bracket
+std::size_t countJsonItems(const char *data, std::size_t length, std::size_t pos) {
+    std::size_t depth = 0;
+    std::size_t separators = 0;
+    bool hasItem = false;
+    bool inString = false;
+    bool escaped = false;
+    for (; pos < length; pos++) {
+        const char c = data[pos];
+        if (inString) {
+            if (escaped) {
+                escaped = false;
+            } else if (c == '\\') {
+                escaped = true;
+            } else if (c == '"') {
+                inString = false;
+            }
+            continue;
+        }
+        if (c == '[' || c == '{') {
+            hasItem = hasItem || depth == 1;
+            depth++;
+        } else if (c == ']' || c == '}') {
+            if (--depth == 0) {
+                return hasItem ? separators + 1 : 0;
+            }
+        } else if (c == ',') {
+            separators += depth == 1 ? 1 : 0;
+        } else if (!std::isspace(static_cast<unsigned char>(c))) {
+            hasItem = hasItem || depth == 1;
+            inString = c == '"';
+        }
+    }
+    throw wss::InvalidPayloadException("Invalid batch: array is not closed");
+}
+
+uint32_t readBigEndian(const char *data, std::size_t bytes) {
+    uint32_t value = 0;
+    for (std::size_t c = 0; c < bytes; c++) {
+        value = (value << 8u) | static_cast<uint8_t>(data[c]);
+    }
+    return value;
+}
+
+void writeBigEndian(std::string &out, uint32_t value, std::size_t bytes) {
+    for (std::size_t c = bytes; c > 0; c--) {
+        out.push_back(static_cast<char>((value >> (8 * (c - 1))) & 0xFFu));
+    }
+}
+
+/// \brief Array header, then items as is
+std::string joinItems(const std::string &header, const wss::PayloadCodec::EncodedItems &items) {
+    std::size_t size = header.size();
+    for (const auto &item: items) {
+        size += item.second;
+    }
+    std::string out;
+    out.reserve(size);
+    out.append(header);
+    for (const auto &item: items) {
+        out.append(item.first, item.second);
+    }
+    return out;
+}
+
+}
+
+// JSON
+const char *wss::JsonCodec::getName() const {
+    return SUBPROTOCOL_JSON_V1;
+}
+uint8_t wss::JsonCodec::getFinRsvOpcode() const {
+    return 129;
+}
+const char *wss::JsonCodec::getMediaType() const {
+    return "application/json";
+}
+wss::MessagePayload wss::JsonCodec::decode(const char *data, std::size_t length) const {
+    return MessagePayload(data, length);
+}
+bool wss::JsonCodec::decodeBatch(const char *data, std::size_t length, std::vector<wss::MessagePayload> &out) const {
+    std::size_t pos = 0;
+    while (pos < length && std::isspace(static_cast<unsigned char>(data[pos]))) {
+        pos++;
+    }
+    if (pos == length || data[pos] != '[') {
+        return false;
+    }
+
+    try {
+        decodeJsonBatch(json::parse(data + pos, data + length), out);
+    } catch (const wss::InvalidPayloadException &) {
+        throw;
+    } catch (const std::exception &e) {
+        throw InvalidPayloadException(std::string("Invalid batch: ") + e.what());
+    }
+    return true;
+}
+std::size_t wss::JsonCodec::countBatch(const char *data, std::size_t length) const {
+    std::size_t pos = 0;
+    while (pos < length && std::isspace(static_cast<unsigned char>(data[pos]))) {
+        pos++;
+    }
+    if (pos == length || data[pos] != '[') {
+        return 0;
+    }
+    return countJsonItems(data, length, pos);
+}
+std::string wss::JsonCodec::encode(const wss::MessagePayload &payload) const {
+    return payload.toJson();
+}
+std::string wss::JsonCodec::encodeBatch(const EncodedItems &items) const {
+    std::size_t size = 2 + items.size();
+    for (const auto &item: items) {
+        size += item.second;
+    }
+    std::string out;
+    out.reserve(size);
+    out.push_back('[');
+    for (std::size_t i = 0; i < items.size(); i++) {
+        if (i > 0) {
+            out.push_back(',');
+        }
+        out.append(items[i].first, items[i].second);
+    }
+    out.push_back(']');
+    return out;
+}
+
+// BINARY
+const char *wss::BinaryCodec::getName() const {
+    return SUBPROTOCOL_BINARY_V1;
+}
+uint8_t wss::BinaryCodec::getFinRsvOpcode() const {
+    return 130;
+}
+const char *wss::BinaryCodec::getMediaType() const {
+    return "application/octet-stream";
+}
+wss::MessagePayload wss::BinaryCodec::decode(const char *data, std::size_t length) const {
+    return MessagePayload::fromBinary(data, length);
+}
+bool wss::BinaryCodec::decodeBatch(const char *data, std::size_t length, std::vector<wss::MessagePayload> &out) const {
+    if (!MessagePayload::isBinaryBatch(data, length)) {
+        return false;
+    }
+    out = MessagePayload::fromBinaryBatch(data, length);
+    return true;
+}
+std::size_t wss::BinaryCodec::countBatch(const char *data, std::size_t length) const {
+    if (!MessagePayload::isBinaryBatch(data, length)) {
+        return 0;
+    }
+    // version, u32 count
+    if (length < 5) {
+        throw InvalidPayloadException("Binary payload is truncated");
+    }
+    return readBigEndian(data + 1, 4);
+}
+std::string wss::BinaryCodec::encode(const wss::MessagePayload &payload) const {
+    return payload.toBinary();
+}
+std::string wss::BinaryCodec::encodeBatch(const EncodedItems &items) const {
+    return MessagePayload::toBinaryBatch(items);
+}
+
+// MESSAGEPACK
+const char *wss::MsgpackCodec::getName() const {
+    return SUBPROTOCOL_MSGPACK_V1;
+}
+uint8_t wss::MsgpackCodec::getFinRsvOpcode() const {
+    return 130;
+}
+const char *wss::MsgpackCodec::getMediaType() const {
+    return "application/msgpack";
+}
+wss::MessagePayload wss::MsgpackCodec::decode(const char *data, std::size_t length) const {
+    if (data == nullptr || length == 0) {
+        return MessagePayload(std::string());
+    }
+
+    json obj;
+    try {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+        obj = json::from_msgpack(std::vector<uint8_t>(bytes, bytes + length));
+    } catch (const std::exception &e) {
+        WSS_DEBUG_F("Chat::Codec", "Invalid msgpack payload: %s", e.what());
+        // null object makes invalid payload
+        obj = json();
+    }
+
+    return MessagePayload(obj);
+}
+bool wss::MsgpackCodec::decodeBatch(const char *data, std::size_t length, std::vector<wss::MessagePayload> &out) const {
+    if (data == nullptr || length == 0) {
+        return false;
+    }
+    // fixarray, array16, array32
+    const auto marker = static_cast<uint8_t>(data[0]);
+    if ((marker & 0xF0u) != 0x90u && marker != 0xDCu && marker != 0xDDu) {
+        return false;
+    }
+
+    try {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+        decodeJsonBatch(json::from_msgpack(std::vector<uint8_t>(bytes, bytes + length)), out);
+    } catch (const wss::InvalidPayloadException &) {
+        throw;
+    } catch (const std::exception &e) {
+        throw InvalidPayloadException(std::string("Invalid batch: ") + e.what());
+    }
+    return true;
+}
+std::size_t wss::MsgpackCodec::countBatch(const char *data, std::size_t length) const {
+    if (data == nullptr || length == 0) {
+        return 0;
+    }
+    // fixarray, array16, array32
+    const auto marker = static_cast<uint8_t>(data[0]);
+    if ((marker & 0xF0u) == 0x90u) {
+        return marker & 0x0Fu;
+    }
+    const std::size_t countBytes = marker == 0xDCu ? 2 : (marker == 0xDDu ? 4 : 0);
+    if (countBytes == 0) {
+        return 0;
+    }
+    if (length < 1 + countBytes) {
+        throw InvalidPayloadException("Invalid batch: truncated array header");
+    }
+    return readBigEndian(data + 1, countBytes);
+}
+std::string wss::MsgpackCodec::encode(const wss::MessagePayload &payload) const {
+    json obj;
+    to_json(obj, payload);
+    const std::vector<uint8_t> bytes = json::to_msgpack(obj);
+    return std::string(bytes.begin(), bytes.end());
+}
+std::string wss::MsgpackCodec::encodeBatch(const EncodedItems &items) const {
+    // fixarray, array16, array32
+    std::string header;
+    const auto count = static_cast<uint32_t>(items.size());
+    if (count < 16) {
+        header.push_back(static_cast<char>(0x90u | count));
+    } else if (count <= 0xFFFFu) {
+        header.push_back(static_cast<char>(0xDCu));
+        writeBigEndian(header, count, 2);
+    } else {
+        header.push_back(static_cast<char>(0xDDu));
+        writeBigEndian(header, count, 4);
+    }
+    return joinItems(header, items);
+}
+
+// CBOR
+const char *wss::CborCodec::getName() const {
+    return SUBPROTOCOL_CBOR_V1;
+}
+uint8_t wss::CborCodec::getFinRsvOpcode() const {
+    return 130;
+}
+const char *wss::CborCodec::getMediaType() const {
+    return "application/cbor";
+}
+wss::MessagePayload wss::CborCodec::decode(const char *data, std::size_t length) const {
+    if (data == nullptr || length == 0) {
+        return MessagePayload(std::string());
+    }
+
+    json obj;
+    try {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+        obj = json::from_cbor(std::vector<uint8_t>(bytes, bytes + length));
+    } catch (const std::exception &e) {
+        WSS_DEBUG_F("Chat::Codec", "Invalid cbor payload: %s", e.what());
+        // null object makes invalid payload
+        obj = json();
+    }
+
+    return MessagePayload(obj);
+}
+bool wss::CborCodec::decodeBatch(const char *data, std::size_t length, std::vector<wss::MessagePayload> &out) const {
+    if (data == nullptr || length == 0) {
+        return false;
+    }
+    // major type 4: array
+    const auto marker = static_cast<uint8_t>(data[0]);
+    if ((marker & 0xE0u) != 0x80u) {
+        return false;
+    }
+
+    try {
+        const auto *bytes = reinterpret_cast<const uint8_t *>(data);
+        decodeJsonBatch(json::from_cbor(std::vector<uint8_t>(bytes, bytes + length)), out);
+    } catch (const wss::InvalidPayloadException &) {
+        throw;
+    } catch (const std::exception &e) {
+        throw InvalidPayloadException(std::string("Invalid batch: ") + e.what());
+    }
+    return true;
+}
+std::size_t wss::CborCodec::countBatch(const char *data, std::size_t length) const {
+    if (data == nullptr || length == 0) {
+        return 0;
+    }
+    // major type 4: array, count in marker or in following 1, 2 or 4 bytes
+    const auto marker = static_cast<uint8_t>(data[0]);
+    if ((marker & 0xE0u) != 0x80u) {
+        return 0;
+    }
+    const uint8_t info = marker & 0x1Fu;
+    if (info < 24) {
+        return info;
+    }
+    // 8 bytes count can't fit frame, indefinite length can't be checked without decoding
+    const std::size_t countBytes = info == 24 ? 1 : (info == 25 ? 2 : (info == 26 ? 4 : 0));
+    if (countBytes == 0) {
+        throw InvalidPayloadException("Invalid batch: array length must be definite");
+    }
+    if (length < 1 + countBytes) {
+        throw InvalidPayloadException("Invalid batch: truncated array header");
+    }
+    return readBigEndian(data + 1, countBytes);
+}
+std::string wss::CborCodec::encode(const wss::MessagePayload &payload) const {
+    json obj;
+    to_json(obj, payload);
+    const std::vector<uint8_t> bytes = json::to_cbor(obj);
+    return std::string(bytes.begin(), bytes.end());
+}
+std::string wss::CborCodec::encodeBatch(const EncodedItems &items) const {
+    // major type 4: array, count in marker or in following 1, 2 or 4 bytes
+    std::string header;
+    const auto count = static_cast<uint32_t>(items.size());
+    if (count < 24) {
+        header.push_back(static_cast<char>(0x80u | count));
+    } else if (count <= 0xFFu) {
+        header.push_back(static_cast<char>(0x98u));
+        writeBigEndian(header, count, 1);
+    } else if (count <= 0xFFFFu) {
+        header.push_back(static_cast<char>(0x99u));
+        writeBigEndian(header, count, 2);
+    } else {
+        header.push_back(static_cast<char>(0x9Au));
+        writeBigEndian(header, count, 4);
+    }
+    return joinItems(header, items);
+}
+
+// BATCHING
+wss::BatchingCodec::BatchingCodec(std::unique_ptr<wss::PayloadCodec> codec) :
+    m_codec(std::move(codec)),
+    m_name(std::string(m_codec->getName()) + SUBPROTOCOL_BATCH_SUFFIX) {
+}
+const char *wss::BatchingCodec::getName() const {
+    return m_name.c_str();
+}
+uint8_t wss::BatchingCodec::getFinRsvOpcode() const {
+    return m_codec->getFinRsvOpcode();
+}
+const char *wss::BatchingCodec::getMediaType() const {
+    return m_codec->getMediaType();
+}
+wss::MessagePayload wss::BatchingCodec::decode(const char *data, std::size_t length) const {
+    return m_codec->decode(data, length);
+}
+bool wss::BatchingCodec::decodeBatch(const char *data, std::size_t length, std::vector<wss::MessagePayload> &out) const {
+    return m_codec->decodeBatch(data, length, out);
+}
+std::size_t wss::BatchingCodec::countBatch(const char *data, std::size_t length) const {
+    return m_codec->countBatch(data, length);
+}
+std::string wss::BatchingCodec::encode(const wss::MessagePayload &payload) const {
+    return m_codec->encode(payload);
+}
+std::string wss::BatchingCodec::encodeBatch(const EncodedItems &items) const {
+    return m_codec->encodeBatch(items);
+}
+bool wss::BatchingCodec::isBatching() const {
+    return true;
+}
+const wss::PayloadCodec &wss::BatchingCodec::getItemCodec() const {
+    return *m_codec;
+}
+
+// FRAMES
+wss::EncodedFrames::EncodedFrames(const wss::MessagePayload &payload, SendPriority priority) :
+    m_payload(payload),
+    m_priority(priority) {
+}
+wss::WsFramePtr wss::EncodedFrames::get(const wss::PayloadCodec &codec) {
+    const wss::PayloadCodec &itemCodec = codec.getItemCodec();
+    for (const auto &item: m_frames) {
+        if (item.first == &itemCodec) {
+            return item.second;
+        }
+    }
+
+    m_frames.emplace_back(&itemCodec, WsBase::Frame::create(itemCodec.encode(m_payload), itemCodec.getFinRsvOpcode()));
+    return m_frames.back().second;
+}
+const wss::MessagePayload &wss::EncodedFrames::getPayload() const {
+    return m_payload;
+}
+wss::EncodedFrames::SendPriority wss::EncodedFrames::getPriority() const {
+    return m_priority;
+}
+
+std::unique_ptr<wss::PayloadCodec> wss::codec::registry::createByName(const std::string &name) {
+    const std::string suffix(SUBPROTOCOL_BATCH_SUFFIX);
+    if (name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+        auto codec = createByName(name.substr(0, name.size() - suffix.size()));
+        if (!codec || codec->isBatching()) {
+            return nullptr;
+        }
+        return std::make_unique<wss::BatchingCodec>(std::move(codec));
+    }
+
+    std::unique_ptr<wss::PayloadCodec> out;
+    if (name == SUBPROTOCOL_JSON_V1) {
+        out = std::make_unique<wss::JsonCodec>();
+    } else if (name == SUBPROTOCOL_BINARY_V1) {
+        out = std::make_unique<wss::BinaryCodec>();
+    } else if (name == SUBPROTOCOL_MSGPACK_V1) {
+        out = std::make_unique<wss::MsgpackCodec>();
+    } else if (name == SUBPROTOCOL_CBOR_V1) {
+        out = std::make_unique<wss::CborCodec>();
+    }
+
+    return out;
+}
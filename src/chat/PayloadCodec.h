@@ -0,0 +1,201 @@
+/**
+ * wsserver
+ * PayloadCodec.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_PAYLOADCODEC_H
+#define WSSERVER_PAYLOADCODEC_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+#include "Message.h"
+#include "../wsserver_core.h"
+
+namespace wss {
+
+extern const char *SUBPROTOCOL_JSON_V1;
+extern const char *SUBPROTOCOL_MSGPACK_V1;
+extern const char *SUBPROTOCOL_CBOR_V1;
+/// \brief Suffix of codec name, that client uses to accept outbound batches, e.g. wss.json.v1+batch
+extern const char *SUBPROTOCOL_BATCH_SUFFIX;
+
+/// \brief MessagePayload wire format. Client selects it on handshake by Sec-WebSocket-Protocol = codec name
+class PayloadCodec {
+ public:
+    /// \brief Already encoded payloads: data and length
+    using EncodedItems = std::vector<std::pair<const char *, std::size_t>>;
+
+    virtual ~PayloadCodec() = default;
+
+    /// \brief Subprotocol name
+    /// \return
+    virtual const char *getName() const = 0;
+
+    /// \brief Frame fin_rsv_opcode for encoded payload: 129 - text, 130 - binary
+    /// \return
+    virtual uint8_t getFinRsvOpcode() const = 0;
+
+    /// \brief Media type of encoded payload, for http bodies (event targets)
+    /// \return
+    virtual const char *getMediaType() const = 0;
+
+    /// \brief Parse payload from frame data. Never throws, check MessagePayload::isValid()
+    /// \param data
+    /// \param length
+    /// \return
+    virtual MessagePayload decode(const char *data, std::size_t length) const = 0;
+
+    /// \brief Parse batch of payloads from single frame, if frame contains batch. Items are not validated,
+    /// check MessagePayload::isValid() for each
+    /// \param data
+    /// \param length
+    /// \param out batch items
+    /// \throws InvalidPayloadException if frame is a batch but container is malformed
+    /// \return false if frame is not a batch (single payload)
+    virtual bool decodeBatch(const char *data, std::size_t length, std::vector<MessagePayload> &out) const;
+
+    /// \brief Number of batch items, read from container header (json array is scanned) without decoding items.
+    /// So oversized batch is rejected before it's decoded
+    /// \param data
+    /// \param length
+    /// \throws InvalidPayloadException if frame is a batch but its header is malformed
+    /// \return 0 if frame is not a batch or batch is empty
+    virtual std::size_t countBatch(const char *data, std::size_t length) const;
+
+    /// \brief Serialize payload
+    /// \param payload
+    /// \return
+    virtual std::string encode(const MessagePayload &payload) const = 0;
+
+    /// \brief Join encoded payloads into one batch, readable by decodeBatch(). Items are copied as is
+    /// \param items encode() results
+    /// \return
+    virtual std::string encodeBatch(const EncodedItems &items) const = 0;
+
+    /// \brief Client accepts outbound batches: frames to it may be joined by OutboundBatcher
+    /// \return
+    virtual bool isBatching() const;
+
+    /// \brief Codec of single payloads. Connections of codec and its batching variant share encoded frames
+    /// \return
+    virtual const PayloadCodec &getItemCodec() const;
+};
+
+/// \brief Default codec for clients without subprotocol: json text frames. Batch is a json array of payloads
+class JsonCodec : public PayloadCodec {
+ public:
+    const char *getName() const override;
+    uint8_t getFinRsvOpcode() const override;
+    const char *getMediaType() const override;
+    MessagePayload decode(const char *data, std::size_t length) const override;
+    bool decodeBatch(const char *data, std::size_t length, std::vector<MessagePayload> &out) const override;
+    std::size_t countBatch(const char *data, std::size_t length) const override;
+    std::string encode(const MessagePayload &payload) const override;
+    std::string encodeBatch(const EncodedItems &items) const override;
+};
+
+/// \brief Binary envelope, see MessagePayload::toBinary(). Batch: see MessagePayload::fromBinaryBatch()
+class BinaryCodec : public PayloadCodec {
+ public:
+    const char *getName() const override;
+    uint8_t getFinRsvOpcode() const override;
+    const char *getMediaType() const override;
+    MessagePayload decode(const char *data, std::size_t length) const override;
+    bool decodeBatch(const char *data, std::size_t length, std::vector<MessagePayload> &out) const override;
+    std::size_t countBatch(const char *data, std::size_t length) const override;
+    std::string encode(const MessagePayload &payload) const override;
+    std::string encodeBatch(const EncodedItems &items) const override;
+};
+
+/// \brief MessagePack map with same fields as json payload. Batch is a msgpack array of maps
+class MsgpackCodec : public PayloadCodec {
+ public:
+    const char *getName() const override;
+    uint8_t getFinRsvOpcode() const override;
+    const char *getMediaType() const override;
+    MessagePayload decode(const char *data, std::size_t length) const override;
+    bool decodeBatch(const char *data, std::size_t length, std::vector<MessagePayload> &out) const override;
+    std::size_t countBatch(const char *data, std::size_t length) const override;
+    std::string encode(const MessagePayload &payload) const override;
+    std::string encodeBatch(const EncodedItems &items) const override;
+};
+
+/// \brief CBOR (RFC 7049) map with same fields as json payload. Batch is a CBOR array of maps
+class CborCodec : public PayloadCodec {
+ public:
+    const char *getName() const override;
+    uint8_t getFinRsvOpcode() const override;
+    const char *getMediaType() const override;
+    MessagePayload decode(const char *data, std::size_t length) const override;
+    bool decodeBatch(const char *data, std::size_t length, std::vector<MessagePayload> &out) const override;
+    std::size_t countBatch(const char *data, std::size_t length) const override;
+    std::string encode(const MessagePayload &payload) const override;
+    std::string encodeBatch(const EncodedItems &items) const override;
+};
+
+/// \brief Codec variant, negotiated as name + SUBPROTOCOL_BATCH_SUFFIX: the same format, but frames sent to client
+/// within short window may be joined into one batch frame (see OutboundBatcher), in format of decodeBatch().
+/// Client must handle both single payloads and batches
+class BatchingCodec : public PayloadCodec {
+ public:
+    explicit BatchingCodec(std::unique_ptr<PayloadCodec> codec);
+
+    const char *getName() const override;
+    uint8_t getFinRsvOpcode() const override;
+    const char *getMediaType() const override;
+    MessagePayload decode(const char *data, std::size_t length) const override;
+    bool decodeBatch(const char *data, std::size_t length, std::vector<MessagePayload> &out) const override;
+    std::size_t countBatch(const char *data, std::size_t length) const override;
+    std::string encode(const MessagePayload &payload) const override;
+    std::string encodeBatch(const EncodedItems &items) const override;
+    bool isBatching() const override;
+    const PayloadCodec &getItemCodec() const override;
+
+ private:
+    const std::unique_ptr<PayloadCodec> m_codec;
+    const std::string m_name;
+};
+
+/// \brief Frames of single payload, encoded once for each codec used by recipients connections
+class EncodedFrames {
+ public:
+    using SendPriority = wss::server::websocket::SendPriority;
+
+    explicit EncodedFrames(const MessagePayload &payload, SendPriority priority = SendPriority::Normal);
+
+    /// \brief Encodes payload on first call for each codec (batching variants use frame of their item codec)
+    /// \param codec
+    /// \return shared frame
+    wss::WsFramePtr get(const PayloadCodec &codec);
+
+    /// \brief Encoded payload. Must be serialized only from thread that owns this object
+    /// \return
+    const MessagePayload &getPayload() const;
+
+    /// \brief Connections send lane for all frames
+    /// \return
+    SendPriority getPriority() const;
+
+ private:
+    const MessagePayload &m_payload;
+    const SendPriority m_priority;
+    std::vector<std::pair<const PayloadCodec *, wss::WsFramePtr>> m_frames;
+};
+
+namespace codec {
+namespace registry {
+/// \brief Creates codec by its subprotocol name
+/// \param name
+/// \return nullptr if codec is unknown
+std::unique_ptr<wss::PayloadCodec> createByName(const std::string &name);
+}
+}
+
+}
+
+#endif //WSSERVER_PAYLOADCODEC_H
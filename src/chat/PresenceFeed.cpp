@@ -0,0 +1,51 @@
+/**
+ * wsserver
+ * PresenceFeed.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "PresenceFeed.h"
+#include <algorithm>
+
+wss::PresenceFeed::PresenceFeed(std::size_t capacity) :
+    m_capacity(std::max<std::size_t>(1, capacity)) {
+}
+void wss::PresenceFeed::push(const wss::PresenceFeed::PresenceEvent &event) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (event.sequence <= m_dropped) {
+        return;
+    }
+
+    // almost always appended to the end
+    auto it = m_events.end();
+    while (it != m_events.begin() && std::prev(it)->sequence > event.sequence) {
+        --it;
+    }
+    m_events.insert(it, event);
+
+    while (m_events.size() > m_capacity) {
+        m_dropped = m_events.front().sequence;
+        m_events.pop_front();
+    }
+}
+bool wss::PresenceFeed::since(uint64_t since,
+                              std::vector<wss::PresenceFeed::PresenceEvent> &out,
+                              uint64_t &last) const {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    last = m_events.empty() ? m_dropped : m_events.back().sequence;
+    const auto it = std::upper_bound(m_events.begin(), m_events.end(), since,
+                                     [](uint64_t value, const PresenceEvent &event) {
+                                       return value < event.sequence;
+                                     });
+    out.insert(out.end(), it, m_events.end());
+    return since >= m_dropped;
+}
+void wss::PresenceFeed::restore(const std::vector<PresenceEvent> &events, uint64_t last) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_events.clear();
+    const std::size_t skip = events.size() > m_capacity ? events.size() - m_capacity : 0;
+    m_events.insert(m_events.end(), events.begin() + skip, events.end());
+    m_dropped = m_events.empty() ? last : m_events.front().sequence - 1;
+}
@@ -0,0 +1,57 @@
+/**
+ * wsserver
+ * PresenceFeed.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_PRESENCEFEED_H
+#define WSSERVER_PRESENCEFEED_H
+
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "ConnectionStorage.h"
+
+namespace wss {
+
+/// \brief Bounded history of users online/offline transitions, ordered by sequence.
+/// Consumers poll it with cursor (last seen sequence) and maintain presence incrementally, instead of listing all users.
+class PresenceFeed {
+ public:
+    using PresenceEvent = wss::ConnectionStorage::PresenceEvent;
+
+    /// \param capacity max stored events, oldest are dropped
+    explicit PresenceFeed(std::size_t capacity);
+    PresenceFeed(const PresenceFeed &other) = delete;
+    PresenceFeed(PresenceFeed &&other) = delete;
+
+    /// \brief Adds event. Events may come slightly out of order (handlers are called concurrently), so they are
+    /// inserted by sequence
+    /// \param event
+    void push(const PresenceEvent &event);
+
+    /// \brief Events with sequence greater than cursor
+    /// \param since cursor, 0 - from the oldest stored event
+    /// \param out
+    /// \param last sequence of last stored event (next cursor), 0 if there were no events
+    /// \return false if some events after cursor are already dropped: consumer must reload whole presence
+    bool since(uint64_t since, std::vector<PresenceEvent> &out, uint64_t &last) const;
+
+    /// \brief Replaces events with saved ones (see ChatServer::saveSnapshot()), so cursors of consumers stay valid
+    /// \param events sorted by sequence, as returned by since(0, ...)
+    /// \param last last sequence returned by since(0, ...): cursors older than first event are reset
+    void restore(const std::vector<PresenceEvent> &events, uint64_t last);
+
+ private:
+    mutable std::mutex m_mutex;
+    std::deque<PresenceEvent> m_events;
+    std::size_t m_capacity;
+    /// \brief Sequence of the newest dropped event
+    uint64_t m_dropped = 0;
+};
+
+}
+
+#endif //WSSERVER_PRESENCEFEED_H
@@ -0,0 +1,115 @@
+/**
+ * wsserver
+ * RateLimiter.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "RateLimiter.h"
+
+constexpr std::size_t wss::RateLimiter::SHARDS;
+
+void wss::RateLimiter::configure(const wss::RateLimiter::Limits &userLimits,
+                                 wss::RateLimiter::Policy policy,
+                                 std::chrono::milliseconds maxDelay) {
+    m_userLimits = userLimits;
+    m_userLimitsEnabled = userLimits.messagesRate > 0 || userLimits.bytesRate > 0;
+    m_policy = policy;
+    m_maxDelay = maxDelay;
+}
+
+std::shared_ptr<wss::RateLimiter::UserBuckets> wss::RateLimiter::getUserBuckets(wss::user_id_t user) {
+    Shard &shard = m_shards[user & (SHARDS - 1)];
+    std::lock_guard<std::mutex> locker(shard.mutex);
+    auto &buckets = shard.users[user];
+    if (!buckets) {
+        buckets = std::make_shared<UserBuckets>(m_userLimits);
+    }
+    return buckets;
+}
+
+wss::RateLimiter::Action wss::RateLimiter::check(const wss::WsConnectionPtr &connection,
+                                                 std::size_t bytes,
+                                                 std::size_t messages,
+                                                 std::chrono::nanoseconds &delay) {
+    delay = std::chrono::nanoseconds(0);
+    std::shared_ptr<UserBuckets> user;
+    if (m_userLimitsEnabled) {
+        user = getUserBuckets(connection->getId());
+    }
+
+    // frame counts as its payloads of messages bucket (batch is not cheaper) and as its size of bytes bucket
+    wss::utils::TokenBucket *buckets[4] = {
+        &connection->getInboundMessagesBucket(),
+        &connection->getInboundBytesBucket(),
+        user ? &user->messages : nullptr,
+        user ? &user->bytes : nullptr,
+    };
+    const std::size_t tokens[4] = {messages, bytes, messages, bytes};
+    const int64_t now = wss::utils::TokenBucket::nowNanos();
+
+    if (m_policy == Policy::Delay) {
+        int64_t wait = 0;
+        for (std::size_t i = 0; i < 4; i++) {
+            if (buckets[i]) {
+                wait = std::max(wait, buckets[i]->reserve(tokens[i], now));
+            }
+        }
+        if (wait == 0) {
+            return Action::Accept;
+        }
+        if (std::chrono::nanoseconds(wait) > m_maxDelay) {
+            for (std::size_t i = 0; i < 4; i++) {
+                if (buckets[i]) {
+                    buckets[i]->refund(tokens[i]);
+                }
+            }
+            m_metrics.dropped++;
+            return Action::Drop;
+        }
+        m_metrics.delayed++;
+        delay = std::chrono::nanoseconds(wait);
+        return Action::Delay;
+    }
+
+    for (std::size_t i = 0; i < 4; i++) {
+        if (!buckets[i] || buckets[i]->tryConsume(tokens[i], now) == 0) {
+            continue;
+        }
+
+        // message is not accepted, so it doesn't spend limits
+        for (std::size_t j = 0; j < i; j++) {
+            if (buckets[j]) {
+                buckets[j]->refund(tokens[j]);
+            }
+        }
+        if (m_policy == Policy::Close) {
+            m_metrics.closed++;
+            return Action::Close;
+        }
+        m_metrics.dropped++;
+        return Action::Drop;
+    }
+
+    return Action::Accept;
+}
+
+void wss::RateLimiter::remove(wss::user_id_t user) {
+    Shard &shard = m_shards[user & (SHARDS - 1)];
+    std::lock_guard<std::mutex> locker(shard.mutex);
+    shard.users.erase(user);
+}
+
+const wss::RateLimitMetrics &wss::RateLimiter::getMetrics() const {
+    return m_metrics;
+}
+
+std::size_t wss::RateLimiter::size() const {
+    std::size_t out = 0;
+    for (const auto &shard: m_shards) {
+        std::lock_guard<std::mutex> locker(shard.mutex);
+        out += shard.users.size();
+    }
+    return out;
+}
@@ -0,0 +1,121 @@
+/**
+ * wsserver
+ * RateLimiter.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_RATELIMITER_H
+#define WSSERVER_RATELIMITER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include "../helpers/token_bucket.hpp"
+#include "../wsserver_core.h"
+
+namespace wss {
+
+/// \brief Throttling counters
+struct RateLimitMetrics {
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<uint64_t> delayed{0};
+  std::atomic<uint64_t> closed{0};
+};
+
+/// \brief Inbound messages rate limiting: connection buckets are stored inline in connection,
+/// user buckets (shared by all user connections) are split into shards by user id, like ConnectionStorage.
+class RateLimiter {
+ public:
+    /// \brief What to do with message over limit
+    enum class Policy {
+      /// \brief Skip message
+      Drop,
+      /// \brief Handle message when tokens will be available (up to max delay, later ones are dropped)
+      Delay,
+      /// \brief Close connection with 1008 (policy violation)
+      Close
+    };
+
+    /// \brief Decision about incoming message
+    enum class Action {
+      Accept,
+      Delay,
+      Drop,
+      Close
+    };
+
+    struct Limits {
+      /// \brief Messages per second, 0 - unlimited
+      double messagesRate = 0;
+      double messagesBurst = 0;
+      /// \brief Bytes per second, 0 - unlimited
+      double bytesRate = 0;
+      double bytesBurst = 0;
+    };
+
+    /// \brief Number of shards (power of two)
+    static constexpr std::size_t SHARDS = 64;
+
+    RateLimiter() = default;
+    RateLimiter(const RateLimiter &other) = delete;
+    RateLimiter(RateLimiter &&other) = delete;
+
+    /// \brief Must be called before server is started
+    /// \param userLimits
+    /// \param policy
+    /// \param maxDelay Policy::Delay: messages that must wait longer are dropped
+    void configure(const Limits &userLimits, Policy policy, std::chrono::milliseconds maxDelay);
+
+    /// \brief Consumes tokens of connection and user buckets
+    /// \param connection
+    /// \param bytes frame size
+    /// \param messages payloads in frame: batch items count, 1 for single payload
+    /// \param delay out: time to wait for Action::Delay
+    /// \return
+    Action check(const wss::WsConnectionPtr &connection,
+                 std::size_t bytes,
+                 std::size_t messages,
+                 std::chrono::nanoseconds &delay);
+
+    /// \brief Removes user buckets, when user has no more connections
+    /// \param user
+    void remove(wss::user_id_t user);
+
+    /// \brief Throttling counters
+    /// \return
+    const RateLimitMetrics &getMetrics() const;
+
+    /// \brief Users which have buckets
+    /// \return
+    std::size_t size() const;
+
+ private:
+    struct UserBuckets {
+      explicit UserBuckets(const Limits &limits) :
+          messages(limits.messagesRate, limits.messagesBurst),
+          bytes(limits.bytesRate, limits.bytesBurst) { }
+      wss::utils::TokenBucket messages;
+      wss::utils::TokenBucket bytes;
+    };
+    struct Shard {
+      mutable std::mutex mutex;
+      UserMap<std::shared_ptr<UserBuckets>> users;
+    };
+
+    Limits m_userLimits;
+    bool m_userLimitsEnabled = false;
+    Policy m_policy = Policy::Drop;
+    std::chrono::milliseconds m_maxDelay{1000};
+    std::array<Shard, SHARDS> m_shards;
+    RateLimitMetrics m_metrics;
+
+    std::shared_ptr<UserBuckets> getUserBuckets(wss::user_id_t user);
+};
+
+}
+
+#endif //WSSERVER_RATELIMITER_H
@@ -0,0 +1,121 @@
+/**
+ * wsserver
+ * RecipientCache.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "RecipientCache.h"
+#include <algorithm>
+
+constexpr std::size_t wss::RecipientCache::STRIPES;
+
+namespace {
+uint64_t mix(uint64_t value) noexcept {
+    // splitmix64 finalizer
+    value += 0x9e3779b97f4a7c15ull;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+    return value ^ (value >> 31);
+}
+}
+
+wss::RecipientCache::RecipientCache(const Options &options) :
+    m_options(options) {
+}
+
+wss::RecipientCache::RecipientsPtr wss::RecipientCache::resolve(wss::ConnectionStorage &storage,
+                                                                const wss::user_id_t *recipients,
+                                                                std::size_t count,
+                                                                wss::user_id_t exclude) {
+    const uint64_t key = hash(recipients, count, exclude);
+    Stripe &stripe = m_stripes[key & (STRIPES - 1)];
+    EntryPtr entry;
+    {
+        std::lock_guard<std::mutex> locker(stripe.lock);
+        auto it = stripe.entries.find(key);
+        if (it != stripe.entries.end()) {
+            entry = it->second;
+        }
+    }
+
+    std::vector<wss::user_id_t> sorted(recipients, recipients + count);
+    std::sort(sorted.begin(), sorted.end());
+    if (entry && isValid(*entry, storage, sorted, exclude)) {
+        m_hits++;
+        return entry->resolved;
+    }
+    m_misses++;
+
+    auto fresh = std::make_shared<Entry>();
+    fresh->exclude = exclude;
+    // epochs are taken before lookup: connection changed meanwhile makes entry invalid, not stale
+    uint64_t shards = 0;
+    for (wss::user_id_t uid: sorted) {
+        shards |= 1ull << (uid & (wss::ConnectionStorage::SHARDS - 1));
+    }
+    for (std::size_t s = 0; s < wss::ConnectionStorage::SHARDS; s++) {
+        if (shards & (1ull << s)) {
+            fresh->epochs.emplace_back(s, storage.getShardEpoch(s));
+        }
+    }
+    auto resolved = std::make_shared<wss::ConnectionStorage::Recipients>();
+    storage.resolve(recipients, count, *resolved, exclude);
+    fresh->resolved = resolved;
+    fresh->sorted = std::move(sorted);
+
+    {
+        std::lock_guard<std::mutex> locker(stripe.lock);
+        const std::size_t limit = std::max<std::size_t>(1, m_options.maxEntries / STRIPES);
+        if (stripe.entries.size() >= limit && stripe.entries.find(key) == stripe.entries.end()) {
+            stripe.entries.erase(stripe.entries.begin());
+        }
+        stripe.entries[key] = fresh;
+    }
+    return resolved;
+}
+
+std::size_t wss::RecipientCache::size() const {
+    std::size_t total = 0;
+    for (const auto &stripe: m_stripes) {
+        std::lock_guard<std::mutex> locker(stripe.lock);
+        total += stripe.entries.size();
+    }
+    return total;
+}
+uint64_t wss::RecipientCache::getHits() const noexcept {
+    return m_hits;
+}
+uint64_t wss::RecipientCache::getMisses() const noexcept {
+    return m_misses;
+}
+const wss::RecipientCache::Options &wss::RecipientCache::getOptions() const noexcept {
+    return m_options;
+}
+
+uint64_t wss::RecipientCache::hash(const wss::user_id_t *recipients,
+                                   std::size_t count,
+                                   wss::user_id_t exclude) noexcept {
+    // sum of mixed ids doesn't depend on order
+    uint64_t sum = 0;
+    for (std::size_t i = 0; i < count; i++) {
+        sum += mix(recipients[i]);
+    }
+    return mix(sum ^ mix(exclude) ^ (static_cast<uint64_t>(count) << 32));
+}
+
+bool wss::RecipientCache::isValid(const Entry &entry,
+                                  const wss::ConnectionStorage &storage,
+                                  const std::vector<wss::user_id_t> &sorted,
+                                  wss::user_id_t exclude) {
+    if (entry.exclude != exclude || entry.sorted != sorted) {
+        return false;
+    }
+    for (const auto &epoch: entry.epochs) {
+        if (storage.getShardEpoch(epoch.first) != epoch.second) {
+            return false;
+        }
+    }
+    return true;
+}
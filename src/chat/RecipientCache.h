@@ -0,0 +1,88 @@
+/**
+ * wsserver
+ * RecipientCache.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_RECIPIENTCACHE_H
+#define WSSERVER_RECIPIENTCACHE_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ConnectionStorage.h"
+
+namespace wss {
+
+/// \brief Resolved connections of recently used recipient sets. Groups send to the same recipients again and again,
+/// cached lookup result is used while connections of its shards are not changed (see ConnectionStorage::getShardEpoch),
+/// so repeated send checks up to 64 shard epochs instead of locking shards and looking up every member.
+/// Set is keyed by order independent hash of recipients, the same recipients in other order hit the same entry
+class RecipientCache {
+ public:
+    struct Options {
+      /// \brief Max cached sets, arbitrary entry is replaced when cache is full
+      std::size_t maxEntries = 4096;
+      /// \brief Smaller sets are resolved directly, it's cheaper than hashing and comparing
+      std::size_t minRecipients = 8;
+    };
+    using RecipientsPtr = std::shared_ptr<const wss::ConnectionStorage::Recipients>;
+
+    explicit RecipientCache(const Options &options);
+
+    /// \brief Cached or fresh lookup result of recipients
+    /// \param storage
+    /// \param recipients pointer to first recipient id
+    /// \param count recipients count
+    /// \param exclude recipient to skip (e.g. sender), 0 - none
+    /// \return never nullptr, result is shared by concurrent sends and must not be changed
+    RecipientsPtr resolve(wss::ConnectionStorage &storage,
+                          const wss::user_id_t *recipients,
+                          std::size_t count,
+                          wss::user_id_t exclude);
+
+    std::size_t size() const;
+    uint64_t getHits() const noexcept;
+    uint64_t getMisses() const noexcept;
+    const Options &getOptions() const noexcept;
+
+ private:
+    static constexpr std::size_t STRIPES = 16;
+
+    struct Entry {
+      /// \brief Sorted recipients, hash collisions are checked by them
+      std::vector<wss::user_id_t> sorted;
+      wss::user_id_t exclude;
+      /// \brief Touched shard and its epoch before lookup
+      std::vector<std::pair<std::size_t, uint64_t>> epochs;
+      RecipientsPtr resolved;
+    };
+    using EntryPtr = std::shared_ptr<const Entry>;
+
+    struct Stripe {
+      mutable std::mutex lock;
+      std::unordered_map<uint64_t, EntryPtr> entries;
+    };
+
+    const Options m_options;
+    std::array<Stripe, STRIPES> m_stripes;
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+
+    static uint64_t hash(const wss::user_id_t *recipients, std::size_t count, wss::user_id_t exclude) noexcept;
+    static bool isValid(const Entry &entry,
+                        const wss::ConnectionStorage &storage,
+                        const std::vector<wss::user_id_t> &sorted,
+                        wss::user_id_t exclude);
+};
+
+}
+
+#endif //WSSERVER_RECIPIENTCACHE_H
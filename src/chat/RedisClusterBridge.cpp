@@ -0,0 +1,241 @@
+/**
+ * wsserver
+ * RedisClusterBridge.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "RedisClusterBridge.h"
+#include <stdexcept>
+#include <fmt/format.h>
+#include <toolboxpp.h>
+#include "../helpers/logging.h"
+
+namespace {
+/// \brief u16 sender node before envelope
+const std::size_t MESSAGE_META = 2;
+/// \brief Broken connections are restored forever, with this interval
+const uint32_t RECONNECT_MILLIS = 1000;
+}
+
+wss::RedisClusterBridge::RedisClusterBridge(wss::node_id_t nodeId, const nlohmann::json &config) :
+    ClusterBridge(nodeId),
+    m_config(config),
+    m_prefix(config.value("channelPrefix", "wss:cluster:")) {
+}
+
+wss::RedisClusterBridge::~RedisClusterBridge() {
+    stop();
+}
+
+void wss::RedisClusterBridge::start() {
+    const bool unixSocket = m_config.find("unixSocket") != m_config.end();
+    const std::string host = unixSocket
+                             ? m_config.at("unixSocket").get<std::string>()
+                             : m_config.value("address", "127.0.0.1");
+    const std::size_t port = unixSocket ? 0 : m_config.value("port", (std::size_t) 6379);
+
+    // clients keep connect and setup callbacks and call them again on every reconnect,
+    // so they share error with this call instead of referencing its stack
+    const auto error = std::make_shared<SetupError>();
+    try {
+        m_publisher.connect(host, port,
+                            [error](const std::string &h, std::size_t p, cpp_redis::client::connect_state status) {
+                              if (status == cpp_redis::client::connect_state::failed) {
+                                  error->set(fmt::format("Can't connect to redis: {0}:{1}", h, p));
+                              }
+                            }, 0, -1, RECONNECT_MILLIS);
+        m_subscriber.connect(host, port,
+                             [error](const std::string &h,
+                                     std::size_t p,
+                                     cpp_redis::subscriber::connect_state status) {
+                               if (status == cpp_redis::subscriber::connect_state::failed) {
+                                   error->set(fmt::format("Can't connect to redis: {0}:{1}", h, p));
+                               }
+                             }, 0, -1, RECONNECT_MILLIS);
+    } catch (const std::exception &e) {
+        throw std::runtime_error(e.what());
+    }
+    if (!error->get().empty() || !m_publisher.is_connected() || !m_subscriber.is_connected()) {
+        const std::string message = error->get();
+        throw std::runtime_error(message.empty() ? "Can't connect to redis" : message);
+    }
+
+    const auto onSetup = [error](cpp_redis::reply &reply) {
+      if (reply.is_error()) {
+          error->set(reply.error());
+      }
+    };
+    if (m_config.find("password") != m_config.end()) {
+        const std::string password = m_config.at("password").get<std::string>();
+        m_publisher.auth(password, onSetup);
+        m_subscriber.auth(password, onSetup);
+    }
+    // pub/sub doesn't depend on database, it's selected to match redis target config
+    if (m_config.find("database") != m_config.end()) {
+        m_publisher.select(m_config.at("database").get<int>(), onSetup);
+    }
+    m_publisher.sync_commit();
+    if (!error->get().empty()) {
+        throw std::runtime_error(error->get());
+    }
+
+    std::lock_guard<std::mutex> locker(m_subscribeLock);
+    m_subscriber.subscribe(getTopicsChannel(), [this](const std::string &channel, const std::string &message) {
+      onMessage(channel, message);
+    });
+    m_subscriber.commit();
+    WSS_LOG_F(wss::logging::LevelInfo, "Cluster", "Node %u is bridged through redis %s:%lu, channels %s*",
+              m_nodeId, host.c_str(), static_cast<unsigned long>(port), m_prefix.c_str());
+}
+
+void wss::RedisClusterBridge::stop() {
+    if (m_subscriber.is_connected()) {
+        m_subscriber.disconnect(true);
+    }
+    if (m_publisher.is_connected()) {
+        m_publisher.disconnect(true);
+    }
+}
+
+void wss::RedisClusterBridge::onPresence(wss::user_id_t user) {
+    std::lock_guard<std::mutex> locker(m_subscribeLock);
+    const bool online = m_onlineCheck && m_onlineCheck(user);
+    const bool subscribed = m_subscribed.count(user) != 0;
+    if (online == subscribed) {
+        return;
+    }
+    if (online) {
+        m_subscriber.subscribe(getUserChannel(user), [this](const std::string &channel, const std::string &message) {
+          onMessage(channel, message);
+        });
+        m_subscribed.insert(user);
+    } else {
+        m_subscriber.unsubscribe(getUserChannel(user));
+        m_subscribed.erase(user);
+    }
+    m_subscriber.commit();
+}
+
+void wss::RedisClusterBridge::forward(const wss::user_id_t *recipients,
+                                      std::size_t count,
+                                      const wss::MessagePayloadPtr &payload) {
+    if (count == 0) {
+        return;
+    }
+    std::string message;
+    try {
+        message = createMessage(payload);
+    } catch (const std::exception &e) {
+        WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Can't forward message: %s", e.what());
+        m_metrics.errors++;
+        return;
+    }
+
+    std::lock_guard<std::mutex> locker(m_publishLock);
+    // all recipients are sent in one pipeline, caller doesn't wait for replies
+    for (std::size_t i = 0; i < count; i++) {
+        const wss::user_id_t recipient = recipients[i];
+        m_publisher.publish(getUserChannel(recipient), message, [this, recipient, payload](cpp_redis::reply &reply) {
+          if (reply.is_error()) {
+              onReply(reply);
+              return;
+          }
+          if (reply.is_integer() && reply.as_integer() == 0) {
+              m_metrics.unroutable++;
+              if (m_undeliverableHandler) {
+                  m_undeliverableHandler(recipient, payload);
+              }
+          }
+        });
+    }
+    m_publisher.commit();
+    m_metrics.forwarded += count;
+}
+
+void wss::RedisClusterBridge::publish(const wss::MessagePayloadPtr &payload) {
+    std::string message;
+    try {
+        message = createMessage(payload);
+    } catch (const std::exception &e) {
+        WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Can't forward topic message: %s", e.what());
+        m_metrics.errors++;
+        return;
+    }
+    std::lock_guard<std::mutex> locker(m_publishLock);
+    m_publisher.publish(getTopicsChannel(), message, [this](cpp_redis::reply &reply) {
+      onReply(reply);
+    });
+    m_publisher.commit();
+}
+
+std::size_t wss::RedisClusterBridge::getSubscriptions() const {
+    std::lock_guard<std::mutex> locker(m_subscribeLock);
+    return m_subscribed.size();
+}
+
+std::string wss::RedisClusterBridge::getUserChannel(wss::user_id_t user) const {
+    return m_prefix + "user:" + std::to_string(user);
+}
+
+std::string wss::RedisClusterBridge::getTopicsChannel() const {
+    return m_prefix + "topics";
+}
+
+std::string wss::RedisClusterBridge::createMessage(const wss::MessagePayloadPtr &payload) const {
+    // envelope is serialized once and cached by payload
+    const std::string &envelope = payload->toBinary();
+    std::string out;
+    out.reserve(MESSAGE_META + envelope.size());
+    out.push_back(static_cast<char>((m_nodeId >> 8u) & 0xFFu));
+    out.push_back(static_cast<char>(m_nodeId & 0xFFu));
+    out.append(envelope);
+    return out;
+}
+
+void wss::RedisClusterBridge::onMessage(const std::string &channel, const std::string &message) {
+    if (message.size() <= MESSAGE_META) {
+        m_metrics.errors++;
+        return;
+    }
+    const auto from = static_cast<wss::node_id_t>(
+        (static_cast<uint8_t>(message[0]) << 8u) | static_cast<uint8_t>(message[1]));
+    const bool topic = channel == getTopicsChannel();
+    if (topic && from == m_nodeId) {
+        // published to local subscribers by sender
+        return;
+    }
+
+    wss::user_id_t recipient = 0;
+    if (!topic) {
+        const std::string userPrefix = m_prefix + "user:";
+        try {
+            recipient = std::stoul(channel.substr(userPrefix.size()));
+        } catch (const std::exception &) {
+            m_metrics.errors++;
+            return;
+        }
+    }
+
+    // origin id is kept: delivery statuses and acks refer to it
+    auto payload = std::make_shared<const wss::MessagePayload>(
+        wss::MessagePayload::fromStoredBinary(message.data() + MESSAGE_META, message.size() - MESSAGE_META));
+    if (!payload->isValid()) {
+        WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Invalid payload from node %u: %s",
+                  from, payload->getError().c_str());
+        m_metrics.errors++;
+        return;
+    }
+    m_metrics.received++;
+    if (m_messageHandler) {
+        m_messageHandler(from, topic ? nullptr : &recipient, topic ? 0 : 1, payload);
+    }
+}
+
+void wss::RedisClusterBridge::onReply(const cpp_redis::reply &reply) {
+    if (reply.is_error()) {
+        m_metrics.errors++;
+        WSS_LOG_F(wss::logging::LevelWarning, "Cluster", "Redis bridge command failed: %s", reply.error().c_str());
+    }
+}
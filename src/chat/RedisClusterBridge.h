@@ -0,0 +1,81 @@
+/**
+ * wsserver
+ * RedisClusterBridge.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_REDISCLUSTERBRIDGE_H
+#define WSSERVER_REDISCLUSTERBRIDGE_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <cpp_redis/core/client.hpp>
+#include <cpp_redis/core/subscriber.hpp>
+#include "ClusterBridge.h"
+
+namespace wss {
+
+/// \brief Redis pub/sub bridge: channel `<prefix>user:<id>` per connected user, `<prefix>topics` for topic messages.
+/// Channel message: u16 sender node (big endian), binary envelope of payload (MessagePayload::toBinary()).
+/// Message for many remote recipients is one pipeline of PUBLISH (one round trip), envelope is serialized once.
+/// PUBLISH reply is count of subscribers: 0 means recipient isn't connected to any node.
+/// Subscriber connection is restored with its subscriptions, when redis is back
+class RedisClusterBridge : public ClusterBridge {
+ public:
+    /// \param nodeId
+    /// \param config same keys as redis event target: address ("127.0.0.1"), port (6379) or unixSocket;
+    /// database, password; and channelPrefix ("wss:cluster:")
+    RedisClusterBridge(wss::node_id_t nodeId, const nlohmann::json &config);
+    ~RedisClusterBridge() override;
+
+    /// \brief Connects publisher and subscriber
+    /// \throws std::runtime_error if unable to connect
+    void start() override;
+    void stop() override;
+    void onPresence(wss::user_id_t user) override;
+    void forward(const wss::user_id_t *recipients, std::size_t count, const wss::MessagePayloadPtr &payload) override;
+    void publish(const wss::MessagePayloadPtr &payload) override;
+    std::size_t getSubscriptions() const override;
+
+ private:
+    /// \brief Error of connect or setup, written by callbacks of client io threads
+    class SetupError {
+     public:
+        void set(std::string error) {
+            std::lock_guard<std::mutex> locker(m_lock);
+            m_error = std::move(error);
+        }
+        std::string get() const {
+            std::lock_guard<std::mutex> locker(m_lock);
+            return m_error;
+        }
+     private:
+        mutable std::mutex m_lock;
+        std::string m_error;
+    };
+
+    const nlohmann::json m_config;
+    const std::string m_prefix;
+    /// \brief Commands of many threads are put into one pipeline and committed by lock
+    std::mutex m_publishLock;
+    cpp_redis::client m_publisher;
+    /// \brief Keeps subscriptions equal to users connected here
+    mutable std::mutex m_subscribeLock;
+    cpp_redis::subscriber m_subscriber;
+    std::unordered_set<wss::user_id_t> m_subscribed;
+
+    std::string getUserChannel(wss::user_id_t user) const;
+    std::string getTopicsChannel() const;
+    /// \return sender node and envelope
+    std::string createMessage(const wss::MessagePayloadPtr &payload) const;
+    void onMessage(const std::string &channel, const std::string &message);
+    void onReply(const cpp_redis::reply &reply);
+};
+
+}
+
+#endif //WSSERVER_REDISCLUSTERBRIDGE_H
@@ -0,0 +1,180 @@
+/**
+ * wsserver
+ * RedisUndeliveredStore.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "RedisUndeliveredStore.h"
+#include <cstring>
+#include <stdexcept>
+#include <fmt/format.h>
+#include <toolboxpp.h>
+
+namespace {
+/// \brief u64 expiresAt before envelope
+const std::size_t ITEM_META = 8;
+}
+
+wss::RedisUndeliveredStore::RedisUndeliveredStore(const nlohmann::json &config) :
+    m_keyPrefix(config.value("keyPrefix", "wss:undelivered:")),
+    m_maxPerUser(config.value("maxPerUser", (std::size_t) 10000)) {
+
+    std::string error;
+    const auto onConnect = [&error](const std::string &host, std::size_t port, cpp_redis::client::connect_state status) {
+      if (status == cpp_redis::client::connect_state::failed) {
+          error = fmt::format("Can't connect to redis: {0}:{1}", host, port);
+      }
+    };
+
+    try {
+        if (config.find("unixSocket") != config.end()) {
+            m_client.connect(config.at("unixSocket").get<std::string>(), 0, onConnect);
+        } else {
+            m_client.connect(config.value("address", "127.0.0.1"), config.value("port", (std::size_t) 6379), onConnect);
+        }
+    } catch (const std::exception &e) {
+        throw std::runtime_error(e.what());
+    }
+    if (!error.empty() || !m_client.is_connected()) {
+        throw std::runtime_error(error.empty() ? "Can't connect to redis" : error);
+    }
+
+    const auto onReply = [&error](const cpp_redis::reply &reply) {
+      if (reply.is_error()) {
+          error = reply.error();
+      }
+    };
+    if (config.find("password") != config.end()) {
+        m_client.auth(config.at("password").get<std::string>(), onReply);
+    }
+    if (config.find("database") != config.end()) {
+        m_client.select(config.at("database").get<int>(), onReply);
+    }
+    m_client.sync_commit();
+    if (!error.empty()) {
+        throw std::runtime_error(error);
+    }
+}
+
+wss::RedisUndeliveredStore::~RedisUndeliveredStore() {
+    if (m_client.is_connected()) {
+        m_client.disconnect(true);
+    }
+}
+
+std::string wss::RedisUndeliveredStore::getKey(user_id_t recipient) const {
+    return m_keyPrefix + std::to_string(recipient);
+}
+
+void wss::RedisUndeliveredStore::push(const user_id_t *recipients,
+                                      std::size_t count,
+                                      const MessagePayloadPtr &payload,
+                                      uint64_t expiresAt) {
+    const std::string &envelope = payload->toBinary();
+    std::string item(ITEM_META + envelope.size(), '\0');
+    std::memcpy(&item[0], &expiresAt, ITEM_META);
+    std::memcpy(&item[ITEM_META], envelope.data(), envelope.size());
+    const std::vector<std::string> values{item};
+
+    const auto onReply = [](const cpp_redis::reply &reply) {
+      if (reply.is_error()) {
+          L_ERR_F("Chat::Undelivered", "Unable to store message in redis: %s", reply.error().c_str());
+      }
+    };
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    // all recipients are sent in one pipeline, io thread doesn't wait for reply
+    for (std::size_t i = 0; i < count; i++) {
+        const std::string key = getKey(recipients[i]);
+        m_client.rpush(key, values, onReply);
+        if (m_maxPerUser > 0) {
+            m_client.ltrim(key, -static_cast<int>(m_maxPerUser), -1, onReply);
+        }
+    }
+    m_client.commit();
+}
+
+std::size_t wss::RedisUndeliveredStore::take(user_id_t recipient,
+                                             std::size_t limit,
+                                             std::vector<MessagePayloadPtr> &out) {
+    const std::string key = getKey(recipient);
+    const uint64_t takenAt = now();
+    std::size_t taken = 0;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    // expired items are trimmed too, so repeat until limit of live messages is reached or list is empty
+    while (limit == 0 || taken < limit) {
+        const std::size_t left = limit == 0 ? 0 : limit - taken;
+        std::vector<cpp_redis::reply> items;
+        std::string error;
+
+        m_client.multi();
+        m_client.lrange(key, 0, left == 0 ? -1 : static_cast<int>(left) - 1);
+        if (left == 0) {
+            m_client.del({key});
+        } else {
+            m_client.ltrim(key, static_cast<int>(left), -1);
+        }
+        m_client.exec([&items, &error](const cpp_redis::reply &reply) {
+          if (reply.is_error()) {
+              error = reply.error();
+          } else if (reply.is_array() && !reply.as_array().empty() && reply.as_array()[0].is_array()) {
+              items = reply.as_array()[0].as_array();
+          }
+        });
+        m_client.sync_commit();
+
+        if (!error.empty()) {
+            L_ERR_F("Chat::Undelivered", "Unable to take messages of user %lu from redis: %s",
+                    recipient, error.c_str());
+            break;
+        }
+
+        for (const auto &item: items) {
+            if (!item.is_string() || item.as_string().size() <= ITEM_META) {
+                continue;
+            }
+            const std::string &data = item.as_string();
+            uint64_t expiresAt;
+            std::memcpy(&expiresAt, data.data(), ITEM_META);
+            if (expiresAt != 0 && expiresAt <= takenAt) {
+                continue;
+            }
+            MessagePayload payload = MessagePayload::fromStoredBinary(data.data() + ITEM_META,
+                                                                      data.size() - ITEM_META);
+            if (payload.isValid()) {
+                out.push_back(std::make_shared<const MessagePayload>(std::move(payload)));
+                taken++;
+            }
+        }
+
+        if (left == 0 || items.size() < left) {
+            // list is empty now
+            break;
+        }
+    }
+    return taken;
+}
+
+bool wss::RedisUndeliveredStore::has(user_id_t recipient) const {
+    bool found = false;
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_client.exists({getKey(recipient)}, [&found](const cpp_redis::reply &reply) {
+      found = reply.is_integer() && reply.as_integer() > 0;
+    });
+    m_client.sync_commit();
+    return found;
+}
+
+std::size_t wss::RedisUndeliveredStore::expire() {
+    return 0;
+}
+
+std::size_t wss::RedisUndeliveredStore::size() const {
+    return 0;
+}
+bool wss::RedisUndeliveredStore::isShared() const noexcept {
+    return true;
+}
@@ -0,0 +1,64 @@
+/**
+ * wsserver
+ * RedisUndeliveredStore.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_REDISUNDELIVEREDSTORE_H
+#define WSSERVER_REDISUNDELIVEREDSTORE_H
+
+#include <mutex>
+#include <string>
+#include <cpp_redis/core/client.hpp>
+#include "json.hpp"
+#include "UndeliveredStore.h"
+
+namespace wss {
+
+/// \brief Keeps messages in redis list per recipient, so any server node can redeliver them on reconnect.
+/// List item: u64 expiresAt (unix ms, host byte order), binary envelope of payload (see MessagePayload::toBinary()).
+/// Pushes to all recipients are pipelined in one round trip, list is trimmed to per-user cap (oldest are dropped).
+/// Take reads and trims list in one MULTI/EXEC, so two nodes never redeliver the same message.
+/// Expired items are dropped when taken, not by expire()
+class RedisUndeliveredStore : public UndeliveredStore {
+ public:
+    /// \brief Connects to redis
+    /// \param config object: address ("127.0.0.1"), port (6379) or unixSocket; database, password,
+    /// keyPrefix ("wss:undelivered:"), maxPerUser (10000, 0 - unlimited)
+    /// \throws std::runtime_error if unable to connect
+    explicit RedisUndeliveredStore(const nlohmann::json &config);
+    ~RedisUndeliveredStore() override;
+
+    using UndeliveredStore::push;
+    void push(const user_id_t *recipients, std::size_t count,
+              const MessagePayloadPtr &payload, uint64_t expiresAt) override;
+    std::size_t take(user_id_t recipient, std::size_t limit, std::vector<MessagePayloadPtr> &out) override;
+    bool has(user_id_t recipient) const override;
+
+    /// \brief Does nothing: expired items are skipped on take
+    /// \return always 0
+    std::size_t expire() override;
+
+    /// \brief Not tracked: lists are shared between nodes
+    /// \return always 0
+    std::size_t size() const override;
+
+    /// \brief Lists are shared between nodes
+    /// \return true
+    bool isShared() const noexcept override;
+
+ private:
+    /// \brief Client is not safe for concurrent MULTI blocks, commands are serialized by lock
+    mutable std::mutex m_lock;
+    mutable cpp_redis::client m_client;
+    std::string m_keyPrefix;
+    std::size_t m_maxPerUser;
+
+    std::string getKey(user_id_t recipient) const;
+};
+
+}
+
+#endif //WSSERVER_REDISUNDELIVEREDSTORE_H
@@ -0,0 +1,113 @@
+/**
+ * wsserver
+ * RoomStorage.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "RoomStorage.h"
+#include <algorithm>
+
+constexpr std::size_t wss::RoomStorage::SHARDS;
+
+bool wss::RoomStorage::join(wss::room_id_t room, wss::user_id_t user) {
+    Shard &shard = getShard(room);
+    std::lock_guard<std::mutex> locker(shard.mutex);
+
+    auto &members = shard.rooms[room];
+    if (!members) {
+        members = std::make_shared<const std::vector<wss::user_id_t>>(1, user);
+        return true;
+    }
+
+    const auto pos = std::lower_bound(members->begin(), members->end(), user);
+    if (pos != members->end() && *pos == user) {
+        return false;
+    }
+
+    auto updated = std::make_shared<std::vector<wss::user_id_t>>();
+    updated->reserve(members->size() + 1);
+    updated->insert(updated->end(), members->begin(), pos);
+    updated->push_back(user);
+    updated->insert(updated->end(), pos, members->end());
+    members = std::move(updated);
+    return true;
+}
+bool wss::RoomStorage::leave(wss::room_id_t room, wss::user_id_t user) {
+    Shard &shard = getShard(room);
+    std::lock_guard<std::mutex> locker(shard.mutex);
+
+    const auto it = shard.rooms.find(room);
+    if (it == shard.rooms.end()) {
+        return false;
+    }
+
+    const auto &members = it->second;
+    const auto pos = std::lower_bound(members->begin(), members->end(), user);
+    if (pos == members->end() || *pos != user) {
+        return false;
+    }
+
+    if (members->size() == 1) {
+        shard.rooms.erase(it);
+        return true;
+    }
+
+    auto updated = std::make_shared<std::vector<wss::user_id_t>>();
+    updated->reserve(members->size() - 1);
+    updated->insert(updated->end(), members->begin(), pos);
+    updated->insert(updated->end(), pos + 1, members->end());
+    it->second = std::move(updated);
+    return true;
+}
+bool wss::RoomStorage::isMember(wss::room_id_t room, wss::user_id_t user) const {
+    const Members members = getMembers(room);
+    return std::binary_search(members->begin(), members->end(), user);
+}
+wss::RoomStorage::Members wss::RoomStorage::getMembers(wss::room_id_t room) const {
+    const Shard &shard = getShard(room);
+    std::lock_guard<std::mutex> locker(shard.mutex);
+
+    const auto it = shard.rooms.find(room);
+    if (it == shard.rooms.end()) {
+        return m_empty;
+    }
+    return it->second;
+}
+std::size_t wss::RoomStorage::size() const {
+    std::size_t out = 0;
+    for (const auto &shard: m_shards) {
+        std::lock_guard<std::mutex> locker(shard.mutex);
+        out += shard.rooms.size();
+    }
+    return out;
+}
+void wss::RoomStorage::forEach(const std::function<void(wss::room_id_t, const Members &)> &handler) const {
+    std::vector<std::pair<wss::room_id_t, Members>> rooms;
+    for (const auto &shard: m_shards) {
+        rooms.clear();
+        {
+            std::lock_guard<std::mutex> locker(shard.mutex);
+            rooms.reserve(shard.rooms.size());
+            for (const auto &item: shard.rooms) {
+                rooms.emplace_back(item.first, item.second);
+            }
+        }
+        for (const auto &item: rooms) {
+            handler(item.first, item.second);
+        }
+    }
+}
+void wss::RoomStorage::assign(wss::room_id_t room, std::vector<wss::user_id_t> members) {
+    std::sort(members.begin(), members.end());
+    members.erase(std::unique(members.begin(), members.end()), members.end());
+
+    Shard &shard = getShard(room);
+    std::lock_guard<std::mutex> locker(shard.mutex);
+    if (members.empty()) {
+        shard.rooms.erase(room);
+        return;
+    }
+    shard.rooms[room] = std::make_shared<const std::vector<wss::user_id_t>>(std::move(members));
+}
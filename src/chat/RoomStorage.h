@@ -0,0 +1,89 @@
+/**
+ * wsserver
+ * RoomStorage.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_ROOMSTORAGE_H
+#define WSSERVER_ROOMSTORAGE_H
+
+#include <array>
+#include <functional>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include "../wsserver_core.h"
+
+namespace wss {
+
+/// \brief Rooms membership index. Members of room are kept in sorted vector, that is replaced on join/leave
+/// (copy-on-write), so message fan-out iterates contiguous snapshot without holding any lock.
+/// Rooms are split into shards by id, like ConnectionStorage users. Room is removed when last member leaves.
+class RoomStorage {
+ public:
+    using Members = std::shared_ptr<const std::vector<wss::user_id_t>>;
+
+    /// \brief Number of shards (power of two)
+    static constexpr std::size_t SHARDS = 64;
+
+    RoomStorage() = default;
+    RoomStorage(const RoomStorage &other) = delete;
+    RoomStorage(RoomStorage &&other) = delete;
+
+    /// \brief Add user to room, creates room if not exists
+    /// \param room
+    /// \param user
+    /// \return false if user is already a member
+    bool join(wss::room_id_t room, wss::user_id_t user);
+
+    /// \brief Remove user from room
+    /// \param room
+    /// \param user
+    /// \return false if user is not a member
+    bool leave(wss::room_id_t room, wss::user_id_t user);
+
+    /// \brief Check user is a member of room
+    /// \param room
+    /// \param user
+    /// \return
+    bool isMember(wss::room_id_t room, wss::user_id_t user) const;
+
+    /// \brief Snapshot of room members, sorted by id. Not affected by following join/leave
+    /// \param room
+    /// \return never nullptr, empty for unknown room
+    Members getMembers(wss::room_id_t room) const;
+
+    /// \brief Count of rooms
+    /// \return
+    std::size_t size() const;
+
+    /// \brief Visits all rooms with their members snapshots. Handler is called outside of locks
+    /// \param handler
+    void forEach(const std::function<void(wss::room_id_t, const Members &)> &handler) const;
+
+    /// \brief Replaces room members
+    /// \param room
+    /// \param members any order, duplicates are removed; empty - room is removed
+    void assign(wss::room_id_t room, std::vector<wss::user_id_t> members);
+
+ private:
+    struct Shard {
+      mutable std::mutex mutex;
+      wss::RoomMap<Members> rooms;
+    };
+    std::array<Shard, SHARDS> m_shards;
+    const Members m_empty = std::make_shared<const std::vector<wss::user_id_t>>();
+
+    Shard &getShard(wss::room_id_t room) noexcept {
+        return m_shards[room & (SHARDS - 1)];
+    }
+    const Shard &getShard(wss::room_id_t room) const noexcept {
+        return m_shards[room & (SHARDS - 1)];
+    }
+};
+
+}
+
+#endif //WSSERVER_ROOMSTORAGE_H
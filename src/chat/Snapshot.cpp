@@ -0,0 +1,229 @@
+/**
+ * wsserver
+ * Snapshot.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "Snapshot.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <fmt/format.h>
+
+namespace {
+
+const char MAGIC[8] = {'W', 'S', 'S', 'S', 'N', 'A', 'P', '\0'};
+/// \brief Chunk is written when buffered section data reaches this size
+const std::size_t CHUNK_SIZE = 64 * 1024;
+/// \brief Bigger chunk is considered a corruption
+const uint32_t MAX_CHUNK_SIZE = 16 * 1024 * 1024;
+
+std::runtime_error systemError(const std::string &what, const std::string &path) {
+    return std::runtime_error(fmt::format("{0} {1}: {2}", what, path, std::strerror(errno)));
+}
+
+uint32_t checksum(const char *data, std::size_t length) noexcept {
+    return static_cast<uint32_t>(::crc32(0L, reinterpret_cast<const Bytef *>(data), static_cast<uInt>(length)));
+}
+
+}
+
+const uint32_t wss::SnapshotWriter::VERSION;
+
+// Writer
+wss::SnapshotWriter::SnapshotWriter(const std::string &path) :
+    m_path(path),
+    m_tmpPath(path + ".tmp") {
+    m_fd = ::open(m_tmpPath.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        throw systemError("Unable to create snapshot", m_tmpPath);
+    }
+    m_chunk.reserve(CHUNK_SIZE);
+    writeFile(MAGIC, sizeof(MAGIC));
+    const uint32_t version = VERSION;
+    writeFile(&version, 4);
+}
+wss::SnapshotWriter::~SnapshotWriter() {
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+    if (!m_committed) {
+        ::unlink(m_tmpPath.c_str());
+    }
+}
+
+void wss::SnapshotWriter::writeFile(const void *data, std::size_t length) {
+    const char *ptr = static_cast<const char *>(data);
+    while (length > 0) {
+        const ssize_t written = ::write(m_fd, ptr, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw systemError("Unable to write snapshot", m_tmpPath);
+        }
+        ptr += written;
+        length -= static_cast<std::size_t>(written);
+    }
+}
+
+void wss::SnapshotWriter::flushChunk() {
+    if (m_chunk.empty()) {
+        return;
+    }
+    const uint32_t header[2] = {static_cast<uint32_t>(m_chunk.size()), checksum(m_chunk.data(), m_chunk.size())};
+    writeFile(header, sizeof(header));
+    writeFile(m_chunk.data(), m_chunk.size());
+    m_chunk.clear();
+}
+
+void wss::SnapshotWriter::beginSection(uint32_t tag) {
+    writeFile(&tag, 4);
+}
+void wss::SnapshotWriter::endSection() {
+    flushChunk();
+    const uint32_t header[2] = {0, 0};
+    writeFile(header, sizeof(header));
+}
+
+void wss::SnapshotWriter::write(const void *data, std::size_t length) {
+    const char *ptr = static_cast<const char *>(data);
+    while (length > 0) {
+        const std::size_t part = std::min(length, CHUNK_SIZE - m_chunk.size());
+        m_chunk.append(ptr, part);
+        ptr += part;
+        length -= part;
+        if (m_chunk.size() == CHUNK_SIZE) {
+            flushChunk();
+        }
+    }
+}
+void wss::SnapshotWriter::writeString(const std::string &value) {
+    write(static_cast<uint32_t>(value.size()));
+    write(value.data(), value.size());
+}
+
+void wss::SnapshotWriter::commit() {
+    const uint32_t end = 0;
+    writeFile(&end, 4);
+    if (::fsync(m_fd) != 0) {
+        throw systemError("Unable to sync snapshot", m_tmpPath);
+    }
+    ::close(m_fd);
+    m_fd = -1;
+    if (std::rename(m_tmpPath.c_str(), m_path.c_str()) != 0) {
+        throw systemError("Unable to replace snapshot", m_path);
+    }
+    m_committed = true;
+}
+
+// Reader
+wss::SnapshotReader::SnapshotReader(const std::string &path) :
+    m_path(path) {
+    m_fd = ::open(m_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0) {
+        throw systemError("Unable to open snapshot", m_path);
+    }
+    char magic[sizeof(MAGIC)];
+    uint32_t version;
+    readFile(magic, sizeof(magic));
+    readFile(&version, 4);
+    if (std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw std::runtime_error(fmt::format("File {0} is not a snapshot", m_path));
+    }
+    if (version == 0 || version > SnapshotWriter::VERSION) {
+        throw std::runtime_error(fmt::format("Unsupported snapshot version {0} of {1}", version, m_path));
+    }
+}
+wss::SnapshotReader::~SnapshotReader() {
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+void wss::SnapshotReader::readFile(void *data, std::size_t length) {
+    char *ptr = static_cast<char *>(data);
+    while (length > 0) {
+        const ssize_t read = ::read(m_fd, ptr, length);
+        if (read <= 0) {
+            if (read < 0 && errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(fmt::format("Snapshot {0} is truncated", m_path));
+        }
+        ptr += read;
+        length -= static_cast<std::size_t>(read);
+    }
+}
+
+bool wss::SnapshotReader::loadChunk() {
+    if (!m_inSection) {
+        return false;
+    }
+    uint32_t header[2];
+    readFile(header, sizeof(header));
+    if (header[0] == 0) {
+        m_inSection = false;
+        return false;
+    }
+    if (header[0] > MAX_CHUNK_SIZE) {
+        throw std::runtime_error(fmt::format("Snapshot {0} is corrupted", m_path));
+    }
+    m_chunk.resize(header[0]);
+    readFile(m_chunk.data(), m_chunk.size());
+    if (checksum(m_chunk.data(), m_chunk.size()) != header[1]) {
+        throw std::runtime_error(fmt::format("Snapshot {0} is corrupted", m_path));
+    }
+    m_position = 0;
+    return true;
+}
+
+bool wss::SnapshotReader::nextSection(uint32_t &tag) {
+    while (loadChunk()) {
+        // rest of previous section
+    }
+    readFile(&tag, 4);
+    m_chunk.clear();
+    m_position = 0;
+    m_inSection = tag != 0;
+    return m_inSection;
+}
+
+bool wss::SnapshotReader::atSectionEnd() {
+    while (m_position == m_chunk.size()) {
+        if (!loadChunk()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void wss::SnapshotReader::read(void *data, std::size_t length) {
+    char *ptr = static_cast<char *>(data);
+    while (length > 0) {
+        if (atSectionEnd()) {
+            throw std::runtime_error(fmt::format("Snapshot {0} section is truncated", m_path));
+        }
+        const std::size_t part = std::min(length, m_chunk.size() - m_position);
+        std::memcpy(ptr, m_chunk.data() + m_position, part);
+        m_position += part;
+        ptr += part;
+        length -= part;
+    }
+}
+std::string wss::SnapshotReader::readString(std::size_t maxLength) {
+    const auto length = read<uint32_t>();
+    if (length > maxLength) {
+        throw std::runtime_error(fmt::format("Snapshot {0} is corrupted", m_path));
+    }
+    std::string value(length, '\0');
+    read(&value[0], length);
+    return value;
+}
@@ -0,0 +1,106 @@
+/**
+ * wsserver
+ * Snapshot.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_SNAPSHOT_H
+#define WSSERVER_SNAPSHOT_H
+
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "../wsserver_core.h"
+
+namespace wss {
+
+/// \brief Snapshot file: magic "WSSSNAP\0", u32 version, sections, u32 tag 0.
+/// Section: u32 tag, chunks, empty chunk. Chunk: u32 length, u32 crc32, data.
+/// Section data is written by chunks of limited size, so neither writer nor reader holds whole state in memory,
+/// and reader skips sections with unknown tags. Values are in host byte order
+class SnapshotWriter {
+ public:
+    static const uint32_t VERSION = 1;
+
+    /// \brief Starts writing to temporary file near path, it replaces path only on commit()
+    /// \param path
+    /// \throws std::runtime_error if file can't be created
+    explicit SnapshotWriter(const std::string &path);
+    ~SnapshotWriter();
+    SnapshotWriter(const SnapshotWriter &other) = delete;
+    SnapshotWriter &operator=(const SnapshotWriter &other) = delete;
+
+    void beginSection(uint32_t tag);
+    void endSection();
+
+    void write(const void *data, std::size_t length);
+    template<typename T>
+    void write(T value) {
+        static_assert(std::is_arithmetic<T>::value, "Only numbers are written as is");
+        write(&value, sizeof(T));
+    }
+    /// \brief Writes u32 length and bytes
+    void writeString(const std::string &value);
+
+    /// \brief Writes end marker, syncs file and atomically replaces previous snapshot
+    /// \throws std::runtime_error on write error
+    void commit();
+
+ private:
+    const std::string m_path;
+    const std::string m_tmpPath;
+    int m_fd;
+    std::string m_chunk;
+    bool m_committed = false;
+
+    void flushChunk();
+    void writeFile(const void *data, std::size_t length);
+};
+
+class SnapshotReader {
+ public:
+    /// \param path
+    /// \throws std::runtime_error if file can't be opened, or it's not a snapshot of supported version
+    explicit SnapshotReader(const std::string &path);
+    ~SnapshotReader();
+    SnapshotReader(const SnapshotReader &other) = delete;
+    SnapshotReader &operator=(const SnapshotReader &other) = delete;
+
+    /// \brief Moves to next section, rest of current one is skipped
+    /// \param tag
+    /// \return false at the end of snapshot
+    /// \throws std::runtime_error if file is truncated
+    bool nextSection(uint32_t &tag);
+
+    /// \brief Whether all data of current section was read
+    bool atSectionEnd();
+
+    /// \throws std::runtime_error if section has less data, or chunk is corrupted
+    void read(void *data, std::size_t length);
+    template<typename T>
+    T read() {
+        static_assert(std::is_arithmetic<T>::value, "Only numbers are read as is");
+        T value;
+        read(&value, sizeof(T));
+        return value;
+    }
+    /// \param maxLength string longer than this is considered a corruption
+    std::string readString(std::size_t maxLength = 64 * 1024 * 1024);
+
+ private:
+    const std::string m_path;
+    int m_fd;
+    std::vector<char> m_chunk;
+    std::size_t m_position = 0;
+    bool m_inSection = false;
+
+    /// \return false if section is over
+    bool loadChunk();
+    void readFile(void *data, std::size_t length);
+};
+
+}
+
+#endif //WSSERVER_SNAPSHOT_H
@@ -7,9 +7,12 @@
  */
 
 #include "Statistics.h"
+
+using wss::utils::CoarseClock;
+
 wss::Statistics::Statistics(wss::user_id_t id) :
     m_id(id),
-    m_lastConnectionTime(time(nullptr)),
+    m_lastConnectionTime(CoarseClock::now()),
     m_lastDisconnectionTime(0),
     m_connectedTimes(0),
     m_disconnectedTimes(0),
@@ -19,7 +22,7 @@ wss::Statistics::Statistics(wss::user_id_t id) :
     m_lastMessageTime(0) { }
 wss::Statistics::Statistics() :
     m_id(0),
-    m_lastConnectionTime(time(nullptr)),
+    m_lastConnectionTime(CoarseClock::now()),
     m_lastDisconnectionTime(0),
     m_connectedTimes(0),
     m_disconnectedTimes(0),
@@ -32,24 +35,32 @@ wss::Statistics &wss::Statistics::setId(wss::user_id_t _id) {
     m_id = _id;
     return *this;
 }
+wss::user_id_t wss::Statistics::getId() const {
+    return m_id;
+}
 wss::Statistics &wss::Statistics::addConnection() {
-    m_lastConnectionTime = time(nullptr);
+    const time_t now = CoarseClock::now();
+    m_lastConnectionTime = now;
     m_connectedTimes++;
+    m_connectsWindow.add(1, now);
     m_lastMessageTime = 0;
     return *this;
 }
 wss::Statistics &wss::Statistics::addDisconnection() {
-    m_lastDisconnectionTime = time(nullptr);
+    m_lastDisconnectionTime = CoarseClock::now();
     m_disconnectedTimes++;
     return *this;
 }
 wss::Statistics &wss::Statistics::addBytesTransferred(std::size_t bytes) {
     m_bytesTransferred += bytes;
+    m_bytesWindow.add(bytes, CoarseClock::now());
     return *this;
 }
 wss::Statistics &wss::Statistics::addSentMessages(std::size_t sent) {
+    const time_t now = CoarseClock::now();
     m_sentMessages += sent;
-    m_lastMessageTime = time(nullptr);
+    m_lastMessageTime = now;
+    m_messagesWindow.add(sent, now);
     return *this;
 }
 wss::Statistics &wss::Statistics::addSendMessage() {
@@ -57,30 +68,31 @@ wss::Statistics &wss::Statistics::addSendMessage() {
 }
 wss::Statistics &wss::Statistics::addReceivedMessages(std::size_t received) {
     m_receivedMessages += received;
+    m_messagesWindow.add(received, CoarseClock::now());
     return *this;
 }
 wss::Statistics &wss::Statistics::addReceivedMessage() {
     return addReceivedMessages(1);
 }
-std::size_t wss::Statistics::getConnectedTimes() {
+std::size_t wss::Statistics::getConnectedTimes() const {
     return m_connectedTimes;
 }
-std::size_t wss::Statistics::getDisconnectedTimes() {
+std::size_t wss::Statistics::getDisconnectedTimes() const {
     return m_disconnectedTimes;
 }
 time_t wss::Statistics::getOnlineTime() const {
     if (!isOnline()) {
         return 0;
     }
-    return time(nullptr) - m_lastConnectionTime;
+    return CoarseClock::now() - m_lastConnectionTime;
 }
 
 time_t wss::Statistics::getInactiveTime() const {
     if (getLastMessageTime() == 0) {
-        return std::time(nullptr) - getConnectionTime();
+        return CoarseClock::now() - getConnectionTime();
     }
 
-    return std::time(nullptr) - getLastMessageTime();
+    return CoarseClock::now() - getLastMessageTime();
 
 }
 time_t wss::Statistics::getOfflineTime() const {
@@ -88,7 +100,7 @@ time_t wss::Statistics::getOfflineTime() const {
         return 0;
     }
 
-    return time(nullptr) - m_lastDisconnectionTime;
+    return CoarseClock::now() - m_lastDisconnectionTime;
 }
 time_t wss::Statistics::getLastMessageTime() const {
     return m_lastMessageTime;
@@ -108,3 +120,50 @@ std::size_t wss::Statistics::getSentMessages() const {
 std::size_t wss::Statistics::getReceivedMessages() const {
     return m_receivedMessages;
 }
+double wss::Statistics::getMessagesRate() const {
+    return m_messagesWindow.perSecond(CoarseClock::now());
+}
+double wss::Statistics::getBytesRate() const {
+    return m_bytesWindow.perSecond(CoarseClock::now());
+}
+std::size_t wss::Statistics::getConnectsPerMinute() const {
+    return static_cast<std::size_t>(m_connectsWindow.sum(CoarseClock::now()));
+}
+wss::Statistics::State wss::Statistics::getState() const {
+    State state;
+    state.id = m_id;
+    state.lastConnectionTime = m_lastConnectionTime;
+    state.lastDisconnectionTime = m_lastDisconnectionTime;
+    state.connectedTimes = m_connectedTimes;
+    state.disconnectedTimes = m_disconnectedTimes;
+    state.bytesTransferred = m_bytesTransferred;
+    state.sentMessages = m_sentMessages;
+    state.receivedMessages = m_receivedMessages;
+    state.lastMessageTime = m_lastMessageTime;
+    return state;
+}
+void wss::Statistics::setState(const State &state) {
+    m_id = state.id;
+    m_lastConnectionTime = state.lastConnectionTime;
+    m_lastDisconnectionTime = state.lastDisconnectionTime;
+    m_connectedTimes = state.connectedTimes;
+    m_disconnectedTimes = state.disconnectedTimes;
+    m_bytesTransferred = state.bytesTransferred;
+    m_sentMessages = state.sentMessages;
+    m_receivedMessages = state.receivedMessages;
+    m_lastMessageTime = state.lastMessageTime;
+}
+void wss::Statistics::merge(const State &state) {
+    const auto latest = [](std::atomic<time_t> &target, time_t value) {
+      time_t current = target;
+      while (value > current && !target.compare_exchange_weak(current, value)) { }
+    };
+    latest(m_lastConnectionTime, state.lastConnectionTime);
+    latest(m_lastDisconnectionTime, state.lastDisconnectionTime);
+    latest(m_lastMessageTime, state.lastMessageTime);
+    m_connectedTimes += state.connectedTimes;
+    m_disconnectedTimes += state.disconnectedTimes;
+    m_bytesTransferred += state.bytesTransferred;
+    m_sentMessages += state.sentMessages;
+    m_receivedMessages += state.receivedMessages;
+}
@@ -12,11 +12,29 @@
 #include <atomic>
 #include <ctime>
 #include "../wsserver_core.h"
+#include "../helpers/rate_window.hpp"
 
 namespace wss {
 
 /// \brief User statistics storage
 class Statistics {
+ public:
+    /// \brief Last minute by 5 seconds buckets: 288 bytes per user for all rates
+    using RateWindow = wss::utils::RateWindow<12, 5>;
+
+    /// \brief All counters and timestamps, to save and restore statistics (see ChatServer::saveSnapshot())
+    struct State {
+      user_id_t id;
+      time_t lastConnectionTime;
+      time_t lastDisconnectionTime;
+      std::size_t connectedTimes;
+      std::size_t disconnectedTimes;
+      std::size_t bytesTransferred;
+      std::size_t sentMessages;
+      std::size_t receivedMessages;
+      time_t lastMessageTime;
+    };
+
  private:
     std::atomic<user_id_t> m_id;
     std::atomic<time_t> m_lastConnectionTime;
@@ -27,6 +45,9 @@ class Statistics {
     std::atomic_size_t m_sentMessages;
     std::atomic_size_t m_receivedMessages;
     std::atomic<time_t> m_lastMessageTime;
+    RateWindow m_messagesWindow;
+    RateWindow m_bytesWindow;
+    RateWindow m_connectsWindow;
 
  public:
     explicit Statistics(user_id_t id);
@@ -37,6 +58,10 @@ class Statistics {
     /// \return self
     Statistics &setId(user_id_t _id);
 
+    /// \brief Statistic user id
+    /// \return UserId
+    user_id_t getId() const;
+
     /// \brief Add 1 to connections count
     /// \return self
     Statistics &addConnection();
@@ -70,11 +95,11 @@ class Statistics {
 
     /// \brief Summary connections count
     /// \return total count
-    std::size_t getConnectedTimes();
+    std::size_t getConnectedTimes() const;
 
     /// \brief Summary disconnections count
     /// \return total count
-    std::size_t getDisconnectedTimes();
+    std::size_t getDisconnectedTimes() const;
 
     /// \brief Statistics of last online time. Counts from the last connection.
     /// \return seconds ago
@@ -111,6 +136,31 @@ class Statistics {
     /// \brief Count of received messages
     /// \return total count
     std::size_t getReceivedMessages() const;
+
+    /// \brief Sent and received messages per second during last minute
+    /// \return
+    double getMessagesRate() const;
+
+    /// \brief Bytes transferred by or to user per second during last minute
+    /// \return
+    double getBytesRate() const;
+
+    /// \brief Connections during last minute
+    /// \return
+    std::size_t getConnectsPerMinute() const;
+
+    /// \brief Copy of counters. Rates are not included: they are useless after restore Concurrent updates may be not included
+    /// \return
+    State getState() const;
+
+    /// \brief Replaces all counters
+    /// \param state
+    void setState(const State &state);
+
+    /// \brief Adds counters of user, kept by other node, and takes the latest timestamps.
+    /// Connections of state must be closed: open ones would make user online here forever
+    /// \param state
+    void merge(const State &state);
 };
 }
 
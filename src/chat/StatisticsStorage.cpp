@@ -0,0 +1,202 @@
+/**
+ * wsserver
+ * StatisticsStorage.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "StatisticsStorage.h"
+#include <algorithm>
+#include "../base/Hotpath.h"
+#include "../base/Metrics.h"
+
+constexpr std::size_t wss::StatisticsStorage::SHARDS;
+constexpr std::size_t wss::StatisticsStorage::RATE_SHARDS;
+
+namespace {
+using ShardLock = wss::hotpath::ProfiledLock<std::unique_lock<std::mutex>, wss::hotpath::LockSite::Statistics>;
+
+/// \brief Accounted memory of entry. Map node and shared_ptr control block are approximated by two pointers
+constexpr std::size_t ENTRY_BYTES =
+    sizeof(wss::Statistics) + sizeof(wss::user_id_t) + sizeof(wss::StatisticsStorage::StatisticsPtr) * 2;
+}
+
+wss::StatisticsStorage::StatisticsStorage() {
+    for (auto &shard: m_shards) {
+        shard.map = std::make_shared<const Map>();
+    }
+}
+wss::StatisticsStorage::StatisticsPtr wss::StatisticsStorage::get(wss::user_id_t id) {
+    StatisticsPtr existing = find(id);
+    if (existing) {
+        return existing;
+    }
+
+    Shard &shard = getShard(id);
+    ShardLock locker(shard.mutex);
+    const MapPtr current = std::atomic_load(&shard.map);
+    // another writer could insert it before we've locked
+    const auto it = current->find(id);
+    if (it != current->end()) {
+        return it->second;
+    }
+
+    auto updated = std::make_shared<Map>(*current);
+    StatisticsPtr stat = std::make_shared<wss::Statistics>(id);
+    updated->emplace(id, stat);
+    std::atomic_store(&shard.map, MapPtr(std::move(updated)));
+    wss::metrics::acquire(wss::metrics::Memory::Statistics, ENTRY_BYTES);
+    return stat;
+}
+wss::StatisticsStorage::StatisticsPtr wss::StatisticsStorage::find(wss::user_id_t id) const {
+    const MapPtr current = std::atomic_load(&getShard(id).map);
+    const auto it = current->find(id);
+    if (it == current->end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+std::vector<wss::StatisticsStorage::StatisticsPtr> wss::StatisticsStorage::snapshot() const {
+    std::vector<StatisticsPtr> out;
+    for (const auto &shard: m_shards) {
+        const MapPtr current = std::atomic_load(&shard.map);
+        out.reserve(out.size() + current->size());
+        for (const auto &item: *current) {
+            out.push_back(item.second);
+        }
+    }
+    return out;
+}
+std::vector<wss::StatisticsStorage::StatisticsPtr> wss::StatisticsStorage::page(wss::user_id_t after,
+                                                                                 std::size_t limit,
+                                                                                 const Filter &filter,
+                                                                                 bool &more) const {
+    const auto &byId = [](const StatisticsPtr &lhs, const StatisticsPtr &rhs) {
+      return lhs->getId() < rhs->getId();
+    };
+
+    more = false;
+    std::vector<StatisticsPtr> out;
+    for (const auto &shard: m_shards) {
+        const MapPtr current = std::atomic_load(&shard.map);
+        for (const auto &item: *current) {
+            if (item.first <= after || (filter && !filter(*item.second))) {
+                continue;
+            }
+            if (limit == 0 || out.size() < limit) {
+                out.push_back(item.second);
+                if (out.size() == limit) {
+                    std::make_heap(out.begin(), out.end(), byId);
+                }
+                continue;
+            }
+
+            // page is full: max-heap top is the greatest id on page, replaced by lesser one
+            more = true;
+            if (item.first < out.front()->getId()) {
+                std::pop_heap(out.begin(), out.end(), byId);
+                out.back() = item.second;
+                std::push_heap(out.begin(), out.end(), byId);
+            }
+        }
+    }
+    std::sort(out.begin(), out.end(), byId);
+    return out;
+}
+std::size_t wss::StatisticsStorage::size() const {
+    std::size_t out = 0;
+    for (const auto &shard: m_shards) {
+        out += std::atomic_load(&shard.map)->size();
+    }
+    return out;
+}
+std::size_t wss::StatisticsStorage::expire(time_t offlineSeconds, std::size_t maxUsers) {
+    std::size_t removed = 0;
+    // idle time and id of users that survived ttl, candidates for count limit
+    std::vector<std::pair<time_t, wss::user_id_t>> idle;
+    std::size_t kept = 0;
+    for (auto &shard: m_shards) {
+        std::vector<wss::user_id_t> ids;
+        const MapPtr current = std::atomic_load(&shard.map);
+        for (const auto &item: *current) {
+            const time_t idleTime = getIdleTime(item.second);
+            if (idleTime >= 0 && offlineSeconds > 0 && idleTime >= offlineSeconds) {
+                ids.push_back(item.first);
+            } else if (idleTime >= 0 && maxUsers > 0) {
+                idle.emplace_back(idleTime, item.first);
+            }
+        }
+        kept += current->size() - ids.size();
+        if (!ids.empty()) {
+            std::sort(ids.begin(), ids.end());
+            removed += remove(shard, ids);
+        }
+    }
+
+    if (maxUsers > 0 && kept > maxUsers && !idle.empty()) {
+        // least recently active first
+        const std::size_t excess = std::min(kept - maxUsers, idle.size());
+        std::nth_element(idle.begin(), idle.begin() + (excess - 1), idle.end(),
+                         std::greater<std::pair<time_t, wss::user_id_t>>());
+        std::array<std::vector<wss::user_id_t>, SHARDS> ids;
+        for (std::size_t i = 0; i < excess; i++) {
+            ids[idle[i].second & (SHARDS - 1)].push_back(idle[i].second);
+        }
+        for (std::size_t i = 0; i < SHARDS; i++) {
+            if (!ids[i].empty()) {
+                std::sort(ids[i].begin(), ids[i].end());
+                removed += remove(m_shards[i], ids[i]);
+            }
+        }
+    }
+    return removed;
+}
+time_t wss::StatisticsStorage::getIdleTime(const StatisticsPtr &stat) {
+    // storage holds the only reference: nobody updates it right now
+    if (stat.use_count() > 1 || stat->isOnline()) {
+        return -1;
+    }
+    return std::min(stat->getOfflineTime(), stat->getInactiveTime());
+}
+std::size_t wss::StatisticsStorage::remove(Shard &shard, const std::vector<wss::user_id_t> &ids) {
+    ShardLock locker(shard.mutex);
+    const MapPtr current = std::atomic_load(&shard.map);
+    auto updated = std::make_shared<Map>();
+    updated->reserve(current->size());
+    for (const auto &item: *current) {
+        // user could connect again since scan
+        if (std::binary_search(ids.begin(), ids.end(), item.first) && getIdleTime(item.second) >= 0) {
+            continue;
+        }
+        updated->emplace(item.first, item.second);
+    }
+    const std::size_t removed = current->size() - updated->size();
+    std::atomic_store(&shard.map, MapPtr(std::move(updated)));
+    wss::metrics::release(wss::metrics::Memory::Statistics, removed * ENTRY_BYTES);
+    return removed;
+}
+void wss::StatisticsStorage::addDelivered(std::size_t bytes) {
+    RateShard &shard = getRateShard();
+    const time_t now = wss::utils::CoarseClock::now();
+    shard.messages.add(1, now);
+    shard.bytes.add(bytes, now);
+}
+void wss::StatisticsStorage::addConnection() {
+    getRateShard().connects.add(1, wss::utils::CoarseClock::now());
+}
+wss::StatisticsStorage::Rates wss::StatisticsStorage::getRates() const {
+    const time_t now = wss::utils::CoarseClock::now();
+    Rates out{0, 0, 0};
+    for (const auto &shard: m_rates) {
+        out.messagesPerSecond += shard.messages.perSecond(now);
+        out.bytesPerSecond += shard.bytes.perSecond(now);
+        out.connectsPerMinute += static_cast<std::size_t>(shard.connects.sum(now));
+    }
+    return out;
+}
+wss::StatisticsStorage::RateShard &wss::StatisticsStorage::getRateShard() noexcept {
+    static std::atomic_size_t nextIndex(0);
+    static thread_local const std::size_t index = nextIndex++ & (RATE_SHARDS - 1);
+    return m_rates[index];
+}
@@ -0,0 +1,134 @@
+/**
+ * wsserver
+ * StatisticsStorage.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_STATISTICSSTORAGE_H
+#define WSSERVER_STATISTICSSTORAGE_H
+
+#include <array>
+#include <functional>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include "Statistics.h"
+#include "../wsserver_core.h"
+
+namespace wss {
+
+/// \brief Users statistics registry. Users are split into shards by id, each shard keeps immutable map snapshot,
+/// that is replaced (copy-on-write) only when new user appears. Lookups atomically load shard snapshot and don't
+/// take any lock, counters are atomic, so concurrent updates doesn't contend. Readers iterate snapshots safely.
+class StatisticsStorage {
+ public:
+    using StatisticsPtr = std::shared_ptr<wss::Statistics>;
+    using Filter = std::function<bool(const wss::Statistics &stat)>;
+
+    /// \brief Number of shards (power of two)
+    static constexpr std::size_t SHARDS = 64;
+    /// \brief Number of global rate windows, threads are spread over them
+    static constexpr std::size_t RATE_SHARDS = 16;
+
+    /// \brief Server-wide rates during last minute
+    struct Rates {
+      /// \brief Delivered messages per second
+      double messagesPerSecond;
+      /// \brief Delivered bytes per second
+      double bytesPerSecond;
+      std::size_t connectsPerMinute;
+    };
+
+    StatisticsStorage();
+    StatisticsStorage(const StatisticsStorage &other) = delete;
+    StatisticsStorage(StatisticsStorage &&other) = delete;
+
+    /// \brief Returns user statistics, creates it if not exists
+    /// \param id
+    /// \return never nullptr
+    StatisticsPtr get(wss::user_id_t id);
+
+    /// \brief Returns user statistics if exists
+    /// \param id
+    /// \return nullptr if user has no statistics
+    StatisticsPtr find(wss::user_id_t id) const;
+
+    /// \brief Snapshot of all users statistics. Not affected by following inserts
+    /// \return
+    std::vector<StatisticsPtr> snapshot() const;
+
+    /// \brief Page of users statistics ordered by user id. Keeps only limit items while iterating shards
+    /// \param after cursor: only users with greater id are returned, 0 - from the first user
+    /// \param limit max items, 0 - unlimited
+    /// \param filter nullptr - all users
+    /// \param more set to true if there are more matching users after page
+    /// \return
+    std::vector<StatisticsPtr> page(wss::user_id_t after, std::size_t limit, const Filter &filter, bool &more) const;
+
+    /// \brief Count of users with statistics
+    /// \return
+    std::size_t size() const;
+
+    /// \brief Removes users that are offline and idle (no connection, disconnection or message) longer than ttl,
+    /// then, if there are still more than maxUsers, longest idle offline users. Users held outside of storage
+    /// (by connection or request) are kept. Shards are replaced like on insert, readers are not blocked
+    /// \param offlineSeconds 0 - by count only
+    /// \param maxUsers 0 - by ttl only
+    /// \return removed users
+    std::size_t expire(time_t offlineSeconds, std::size_t maxUsers);
+
+    /// \brief Adds delivered message to global rates
+    /// \param bytes
+    void addDelivered(std::size_t bytes);
+
+    /// \brief Adds connection to global rates
+    void addConnection();
+
+    /// \brief Sum of global rate windows
+    /// \return
+    Rates getRates() const;
+
+ private:
+    using Map = UserMap<StatisticsPtr>;
+    using MapPtr = std::shared_ptr<const Map>;
+
+    struct Shard {
+      /// \brief Guards writers only
+      std::mutex mutex;
+      /// \brief Accessed with std::atomic_load/atomic_store
+      MapPtr map;
+    };
+    std::array<Shard, SHARDS> m_shards;
+
+    /// \brief Each thread updates own shard, so global rates are not one contended cache line
+    struct RateShard {
+      Statistics::RateWindow messages;
+      Statistics::RateWindow bytes;
+      Statistics::RateWindow connects;
+      char padding[64];
+    };
+    std::array<RateShard, RATE_SHARDS> m_rates;
+
+    RateShard &getRateShard() noexcept;
+
+    /// \brief Seconds since last activity of offline user, -1 if user can't be removed
+    static time_t getIdleTime(const StatisticsPtr &stat);
+    /// \brief Copies shard map without removed users
+    /// \param shard
+    /// \param ids sorted
+    /// \return removed users
+    std::size_t remove(Shard &shard, const std::vector<wss::user_id_t> &ids);
+
+    Shard &getShard(wss::user_id_t id) noexcept {
+        return m_shards[id & (SHARDS - 1)];
+    }
+    const Shard &getShard(wss::user_id_t id) const noexcept {
+        return m_shards[id & (SHARDS - 1)];
+    }
+};
+
+}
+
+#endif //WSSERVER_STATISTICSSTORAGE_H
@@ -0,0 +1,213 @@
+/**
+ * wsserver
+ * TopicStorage.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "TopicStorage.h"
+#include <algorithm>
+
+constexpr std::size_t wss::TopicStorage::MAX_LENGTH;
+
+namespace {
+
+/// \brief Calls handler(segment, isLast) for each dot separated segment
+template<typename Handler>
+bool forEachSegment(const std::string &topic, Handler &&handler) {
+    std::size_t start = 0;
+    while (true) {
+        const std::size_t dot = topic.find('.', start);
+        const bool last = dot == std::string::npos;
+        const std::string segment = topic.substr(start, last ? std::string::npos : dot - start);
+        if (!handler(segment, last)) {
+            return false;
+        }
+        if (last) {
+            return true;
+        }
+        start = dot + 1;
+    }
+}
+
+}
+
+bool wss::TopicStorage::isValidTopic(const std::string &topic) {
+    if (topic.empty() || topic.length() > MAX_LENGTH) {
+        return false;
+    }
+
+    return forEachSegment(topic, [](const std::string &segment, bool) {
+      return !segment.empty() && segment.find('*') == std::string::npos;
+    });
+}
+bool wss::TopicStorage::isValidPattern(const std::string &pattern) {
+    if (pattern.empty() || pattern.length() > MAX_LENGTH) {
+        return false;
+    }
+
+    return forEachSegment(pattern, [](const std::string &segment, bool last) {
+      if (segment == "*") {
+          return last;
+      }
+      return !segment.empty() && segment.find('*') == std::string::npos;
+    });
+}
+
+wss::TopicStorage::Subscribers *wss::TopicStorage::find(const std::string &pattern, bool create) {
+    Node *node = &m_root;
+    Subscribers *out = nullptr;
+    forEachSegment(pattern, [&node, &out, create](const std::string &segment, bool last) {
+      if (segment == "*") {
+          out = &node->wildcard;
+          return true;
+      }
+
+      auto it = node->children.find(segment);
+      if (it == node->children.end()) {
+          if (!create) {
+              return false;
+          }
+          it = node->children.emplace(segment, std::make_unique<Node>()).first;
+      }
+      node = it->second.get();
+      if (last) {
+          out = &node->exact;
+      }
+      return true;
+    });
+
+    return out;
+}
+
+bool wss::TopicStorage::subscribe(const std::string &pattern, const wss::WsConnectionPtr &connection) {
+    if (!connection || !isValidPattern(pattern)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> locker(m_mutex);
+    Subscribers *subscribers = find(pattern, true);
+    const ConnectionKey key = connection.get();
+    const auto existing = subscribers->find(key);
+    if (existing != subscribers->end()) {
+        if (!existing->second.expired()) {
+            return false;
+        }
+        // expired connection had same address
+        existing->second = connection;
+        m_size--;
+    } else {
+        subscribers->emplace(key, connection);
+    }
+
+    m_connectionPatterns[key].push_back(pattern);
+    m_size++;
+    return true;
+}
+bool wss::TopicStorage::unsubscribeLocked(const std::string &pattern, ConnectionKey key) {
+    Subscribers *subscribers = find(pattern, false);
+    if (subscribers == nullptr || subscribers->erase(key) == 0) {
+        return false;
+    }
+    m_size--;
+
+    // removing empty nodes from leaf to root
+    std::vector<std::pair<Node *, std::string>> path;
+    Node *node = &m_root;
+    forEachSegment(pattern, [&node, &path](const std::string &segment, bool) {
+      if (segment == "*") {
+          return true;
+      }
+      path.emplace_back(node, segment);
+      node = node->children.at(segment).get();
+      return true;
+    });
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+        const Node *child = it->first->children.at(it->second).get();
+        if (!child->children.empty() || !child->exact.empty() || !child->wildcard.empty()) {
+            break;
+        }
+        it->first->children.erase(it->second);
+    }
+
+    return true;
+}
+bool wss::TopicStorage::unsubscribe(const std::string &pattern, const wss::WsConnectionPtr &connection) {
+    if (!connection || !isValidPattern(pattern)) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> locker(m_mutex);
+    const ConnectionKey key = connection.get();
+    if (!unsubscribeLocked(pattern, key)) {
+        return false;
+    }
+
+    auto &patterns = m_connectionPatterns[key];
+    patterns.erase(std::remove(patterns.begin(), patterns.end(), pattern), patterns.end());
+    if (patterns.empty()) {
+        m_connectionPatterns.erase(key);
+    }
+    return true;
+}
+void wss::TopicStorage::unsubscribeAll(const wss::WsConnectionPtr &connection) {
+    if (!connection) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> locker(m_mutex);
+    const ConnectionKey key = connection.get();
+    const auto it = m_connectionPatterns.find(key);
+    if (it == m_connectionPatterns.end()) {
+        return;
+    }
+
+    for (const auto &pattern: it->second) {
+        unsubscribeLocked(pattern, key);
+    }
+    m_connectionPatterns.erase(it);
+}
+void wss::TopicStorage::collect(Subscribers &subscribers, std::vector<wss::WsConnectionPtr> &out) {
+    for (auto it = subscribers.begin(); it != subscribers.end();) {
+        wss::WsConnectionPtr connection = it->second.lock();
+        if (!connection) {
+            // connection has gone without close event
+            it = subscribers.erase(it);
+            m_size--;
+            continue;
+        }
+        out.push_back(std::move(connection));
+        ++it;
+    }
+}
+std::vector<wss::WsConnectionPtr> wss::TopicStorage::getSubscribers(const std::string &topic) {
+    std::vector<wss::WsConnectionPtr> out;
+    if (!isValidTopic(topic)) {
+        return out;
+    }
+
+    std::lock_guard<std::mutex> locker(m_mutex);
+    Node *node = &m_root;
+    forEachSegment(topic, [this, &node, &out](const std::string &segment, bool last) {
+      // prefix wildcards of this level match all deeper topics
+      collect(node->wildcard, out);
+      const auto it = node->children.find(segment);
+      if (it == node->children.end()) {
+          return false;
+      }
+      node = it->second.get();
+      if (last) {
+          collect(node->exact, out);
+      }
+      return true;
+    });
+
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+std::size_t wss::TopicStorage::size() const {
+    std::lock_guard<std::mutex> locker(m_mutex);
+    return m_size;
+}
@@ -0,0 +1,98 @@
+/**
+ * wsserver
+ * TopicStorage.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_TOPICSTORAGE_H
+#define WSSERVER_TOPICSTORAGE_H
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "../wsserver_core.h"
+
+namespace wss {
+
+/// \brief Topic subscriptions of connections. Topic is a dot separated name: "prices.btc.usd".
+/// Subscription pattern is a topic name, or prefix wildcard: "prices.*" matches "prices.btc" and "prices.btc.usd",
+/// single "*" matches all topics. Patterns are stored in trie by segments, so publishing costs one walk by
+/// topic segments, not depending on subscriptions count.
+/// Connections are kept weakly and are removed on disconnect (unsubscribeAll) or lazily, when expired.
+class TopicStorage {
+ public:
+    /// \brief Max topic or pattern length
+    static constexpr std::size_t MAX_LENGTH = 255;
+
+    TopicStorage() = default;
+    TopicStorage(const TopicStorage &other) = delete;
+    TopicStorage(TopicStorage &&other) = delete;
+
+    /// \brief Check topic name is valid for publishing: not empty, non-empty segments, no wildcards
+    /// \param topic
+    /// \return
+    static bool isValidTopic(const std::string &topic);
+
+    /// \brief Check subscription pattern: valid topic, or topic with last segment "*", or single "*"
+    /// \param pattern
+    /// \return
+    static bool isValidPattern(const std::string &pattern);
+
+    /// \brief Subscribe connection to topic or wildcard pattern
+    /// \param pattern
+    /// \param connection
+    /// \return false if pattern is invalid or connection is already subscribed to it
+    bool subscribe(const std::string &pattern, const wss::WsConnectionPtr &connection);
+
+    /// \brief Remove connection subscription
+    /// \param pattern
+    /// \param connection
+    /// \return false if connection was not subscribed to this pattern
+    bool unsubscribe(const std::string &pattern, const wss::WsConnectionPtr &connection);
+
+    /// \brief Remove all connection subscriptions
+    /// \param connection
+    void unsubscribeAll(const wss::WsConnectionPtr &connection);
+
+    /// \brief Connections subscribed to topic by name or by any matching wildcard. Each connection appears once
+    /// \param topic
+    /// \return
+    std::vector<wss::WsConnectionPtr> getSubscribers(const std::string &topic);
+
+    /// \brief Count of subscriptions of all connections
+    /// \return
+    std::size_t size() const;
+
+ private:
+    using ConnectionKey = const WsBase::Connection *;
+    using Subscribers = std::unordered_map<ConnectionKey, std::weak_ptr<WsBase::Connection>>;
+
+    struct Node {
+      std::unordered_map<std::string, std::unique_ptr<Node>> children;
+      /// \brief Subscribed to exactly this topic
+      Subscribers exact;
+      /// \brief Subscribed to this prefix and all sub-topics (pattern "prefix.*")
+      Subscribers wildcard;
+    };
+
+    mutable std::mutex m_mutex;
+    Node m_root;
+    std::unordered_map<ConnectionKey, std::vector<std::string>> m_connectionPatterns;
+    std::size_t m_size = 0;
+
+    /// \brief Finds pattern node and subscribers map
+    /// \param pattern valid pattern
+    /// \param create create missing nodes
+    /// \return nullptr if node not exists and create = false
+    Subscribers *find(const std::string &pattern, bool create);
+    bool unsubscribeLocked(const std::string &pattern, ConnectionKey key);
+    void collect(Subscribers &subscribers, std::vector<wss::WsConnectionPtr> &out);
+};
+
+}
+
+#endif //WSSERVER_TOPICSTORAGE_H
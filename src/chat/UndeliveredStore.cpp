@@ -0,0 +1,806 @@
+/**
+ * wsserver
+ * UndeliveredStore.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "UndeliveredStore.h"
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <fmt/format.h>
+#include <toolboxpp.h>
+#include "../base/Affinity.h"
+#include "../base/Hotpath.h"
+#include "WriteBehindUndeliveredStore.h"
+#ifdef ENABLE_REDIS_TARGET
+#include "RedisUndeliveredStore.h"
+#endif
+
+namespace {
+
+using ShardLock = wss::hotpath::ProfiledLock<std::unique_lock<std::mutex>, wss::hotpath::LockSite::Undelivered>;
+
+const char INDEX_MAGIC[8] = {'W', 'S', 'S', 'U', 'I', 'D', 'X', '1'};
+const std::size_t INDEX_MIN_CAPACITY = 4096;
+/// \brief u32 body length, u32 crc32
+const std::size_t RECORD_HEADER = 8;
+/// \brief u64 seq, u64 expiresAt, u32 recipients count, followed by u64 recipients
+const std::size_t RECORD_META = 20;
+
+std::runtime_error systemError(const std::string &what, const std::string &path) {
+    return std::runtime_error(fmt::format("{0} {1}: {2}", what, path, std::strerror(errno)));
+}
+
+uint64_t mixRecipient(uint64_t key) noexcept {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
+
+uint32_t checksum(const char *data, std::size_t length) noexcept {
+    return static_cast<uint32_t>(::crc32(0L, reinterpret_cast<const Bytef *>(data), static_cast<uInt>(length)));
+}
+
+bool writeAll(int fd, const char *data, std::size_t length) {
+    while (length > 0) {
+        const ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+bool readAll(int fd, char *data, std::size_t length, uint64_t offset) {
+    while (length > 0) {
+        const ssize_t read = ::pread(fd, data, length, static_cast<off_t>(offset));
+        if (read <= 0) {
+            if (read < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += read;
+        length -= static_cast<std::size_t>(read);
+        offset += static_cast<uint64_t>(read);
+    }
+    return true;
+}
+
+}
+
+// Memory
+constexpr std::size_t wss::MemoryUndeliveredStore::SHARDS;
+
+wss::MemoryUndeliveredStore::MemoryUndeliveredStore() :
+    MemoryUndeliveredStore(Options(), nullptr) {
+}
+wss::MemoryUndeliveredStore::MemoryUndeliveredStore(const Options &options, std::unique_ptr<UndeliveredStore> spill) :
+    m_options(options),
+    m_spill(options.policy == OverflowPolicy::Spill ? std::move(spill) : nullptr) {
+    if (options.policy == OverflowPolicy::Spill && !m_spill) {
+        throw std::invalid_argument("Spill store is required for spill overflow policy");
+    }
+}
+
+void wss::MemoryUndeliveredStore::push(const user_id_t *recipients,
+                                       std::size_t count,
+                                       const MessagePayloadPtr &payload,
+                                       uint64_t expiresAt) {
+    const uint64_t pushedAt = now();
+    // envelope is cached by payload, and the same bytes are written if message is spilled
+    const std::size_t bytes = payload->toBinary().size();
+    const bool overSoftLimit = wss::metrics::isOverMemorySoftLimit();
+    const bool overBytes = overSoftLimit || (m_options.maxBytes > 0 && m_metrics.bytes + bytes > m_options.maxBytes);
+    if (overSoftLimit) {
+        wss::metrics::add(wss::metrics::Counter::MemoryShed);
+    }
+    // created by first recipient, that fits in memory
+    BodyPtr body;
+    std::vector<user_id_t> spilled;
+
+    const auto pushShard = [&](Shard &shard, const user_id_t *ids, std::size_t n) {
+      ShardLock lock(shard.lock);
+      const uint64_t seq = ++shard.seq;
+      spilled.clear();
+      for (std::size_t i = 0; i < n; i++) {
+          const user_id_t recipient = ids[i];
+          const bool overUser = m_options.maxPerUser > 0 && shard.queues.size(recipient) >= m_options.maxPerUser;
+          if (m_spill) {
+              // spilled messages are newer than in memory ones, recipient new messages must follow them
+              if (overBytes || overUser || m_spill->has(recipient)) {
+                  spilled.push_back(recipient);
+                  continue;
+              }
+          } else if (overBytes) {
+              m_metrics.dropped++;
+              continue;
+          } else if (overUser) {
+              shard.queues.dropOldest(recipient, [](UndeliveredQueues<BodyPtr>::Entry &&) { });
+              m_metrics.dropped++;
+          }
+
+          if (!body) {
+              body = std::make_shared<const Body>(payload, bytes, m_metrics.bytes, ++m_bodies);
+          }
+          shard.queues.push(recipient, seq, body, expiresAt, pushedAt);
+      }
+      if (!spilled.empty()) {
+          // under shard lock: take of the same recipient can't see spilled part before memory part
+          m_spill->push(spilled.data(), spilled.size(), payload, expiresAt);
+          m_metrics.spilled += spilled.size();
+      }
+    };
+
+    if (count == 1) {
+        pushShard(getShard(recipients[0]), recipients, 1);
+        return;
+    }
+
+    // group recipients by shard, so each touched shard is locked once
+    std::array<std::size_t, SHARDS + 1> offsets{};
+    for (std::size_t i = 0; i < count; i++) {
+        offsets[(recipients[i] & (SHARDS - 1)) + 1]++;
+    }
+    for (std::size_t s = 0; s < SHARDS; s++) {
+        offsets[s + 1] += offsets[s];
+    }
+    std::vector<user_id_t> ordered(count);
+    {
+        std::array<std::size_t, SHARDS> cursor;
+        std::copy(offsets.begin(), offsets.end() - 1, cursor.begin());
+        for (std::size_t i = 0; i < count; i++) {
+            ordered[cursor[recipients[i] & (SHARDS - 1)]++] = recipients[i];
+        }
+    }
+
+    for (std::size_t s = 0; s < SHARDS; s++) {
+        if (offsets[s] != offsets[s + 1]) {
+            pushShard(m_shards[s], ordered.data() + offsets[s], offsets[s + 1] - offsets[s]);
+        }
+    }
+}
+std::size_t wss::MemoryUndeliveredStore::take(user_id_t recipient,
+                                              std::size_t limit,
+                                              std::vector<MessagePayloadPtr> &out) {
+    Shard &shard = getShard(recipient);
+    ShardLock lock(shard.lock);
+    std::size_t taken = shard.queues.take(recipient, limit, now(), [&out](UndeliveredQueues<BodyPtr>::Entry &&entry,
+                                                                         bool live) {
+      if (live) {
+          out.push_back(entry.item->payload);
+      }
+    });
+    // memory part is older than spilled one
+    if (m_spill && (limit == 0 || taken < limit)) {
+        taken += m_spill->take(recipient, limit == 0 ? 0 : limit - taken, out);
+    }
+    return taken;
+}
+bool wss::MemoryUndeliveredStore::has(user_id_t recipient) const {
+    const Shard &shard = getShard(recipient);
+    ShardLock lock(shard.lock);
+    return shard.queues.has(recipient) || (m_spill && m_spill->has(recipient));
+}
+std::size_t wss::MemoryUndeliveredStore::expire() {
+    std::size_t expired = 0;
+    for (auto &shard: m_shards) {
+        ShardLock lock(shard.lock);
+        expired += shard.queues.expire([](UndeliveredQueues<BodyPtr>::Entry &) { });
+    }
+    m_metrics.expired += expired;
+    if (m_spill) {
+        expired += m_spill->expire();
+    }
+    return expired;
+}
+bool wss::MemoryUndeliveredStore::snapshot(const SnapshotHandler &handler) const {
+    struct Record {
+      BodyPtr body;
+      uint64_t expiresAt = 0;
+      std::vector<user_id_t> recipients;
+    };
+    // recipients of one body are collected from all shards, body is referenced, not copied
+    std::unordered_map<const Body *, Record> records;
+    for (const auto &shard: m_shards) {
+        ShardLock lock(shard.lock);
+        shard.queues.forEach([&records](user_id_t recipient, const UndeliveredQueues<BodyPtr>::Entry &entry) {
+          Record &record = records[entry.item.get()];
+          if (!record.body) {
+              record.body = entry.item;
+              record.expiresAt = entry.expiresAt;
+          }
+          record.recipients.push_back(recipient);
+        });
+    }
+
+    // restored in creation order, so every recipient queue keeps its order
+    std::vector<const Record *> ordered;
+    ordered.reserve(records.size());
+    for (const auto &item: records) {
+        ordered.push_back(&item.second);
+    }
+    std::sort(ordered.begin(), ordered.end(), [](const Record *lhs, const Record *rhs) {
+      return lhs->body->order < rhs->body->order;
+    });
+    for (const Record *record: ordered) {
+        handler(record->recipients, record->body->payload, record->expiresAt);
+    }
+    return true;
+}
+std::size_t wss::MemoryUndeliveredStore::size() const {
+    std::size_t out = 0;
+    for (const auto &shard: m_shards) {
+        ShardLock lock(shard.lock);
+        out += shard.queues.size();
+    }
+    return out + (m_spill ? m_spill->size() : 0);
+}
+
+// File
+wss::FileUndeliveredStore::FileHandle::~FileHandle() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+wss::FileUndeliveredStore::FileUndeliveredStore(const std::string &directory, const Options &options) :
+    m_directory(directory),
+    m_options(options) {
+    if (::mkdir(m_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw systemError("Unable to create undelivered store directory", m_directory);
+    }
+    // created even if compression is disabled: compressed records written before stay readable
+    m_codec = std::unique_ptr<SegmentCodec>(new SegmentCodec(m_directory, m_options.compression));
+
+    openIndex();
+    recover();
+
+    if (m_options.syncIntervalMillis > 0) {
+        m_flusher = std::thread(&FileUndeliveredStore::flushLoop, this);
+    }
+}
+wss::FileUndeliveredStore::~FileUndeliveredStore() {
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_flushCondition.notify_all();
+    if (m_flusher.joinable()) {
+        m_flusher.join();
+    }
+    sync();
+    if (m_indexMap) {
+        ::munmap(m_indexMap, m_indexMapSize);
+    }
+}
+
+std::string wss::FileUndeliveredStore::segmentPath(uint64_t segment) const {
+    return fmt::format("{0}/{1:020d}.log", m_directory, segment);
+}
+
+void wss::FileUndeliveredStore::recover() {
+    std::vector<uint64_t> segments;
+    DIR *dir = ::opendir(m_directory.c_str());
+    if (dir == nullptr) {
+        throw systemError("Unable to read undelivered store directory", m_directory);
+    }
+    while (const dirent *item = ::readdir(dir)) {
+        const std::string name(item->d_name);
+        if (name.size() == 24 && name.compare(20, 4, ".log") == 0
+            && std::all_of(name.begin(), name.begin() + 20, ::isdigit)) {
+            segments.push_back(std::stoull(name.substr(0, 20)));
+        }
+    }
+    ::closedir(dir);
+    std::sort(segments.begin(), segments.end());
+
+    // global seq is stored in records order, so recipient queues are restored sorted
+    for (std::size_t i = 0; i < segments.size(); i++) {
+        recoverSegment(segments[i], i + 1 == segments.size());
+    }
+    for (auto it = m_segments.begin(); it != m_segments.end();) {
+        if (it->second.live == 0) {
+            ::unlink(segmentPath(it->first).c_str());
+            it = m_segments.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // consumed seq can be greater than seq of any remaining record
+    const IndexSlot *slots = indexSlots();
+    for (std::size_t i = 0; i < indexHeader().capacity; i++) {
+        if (slots[i].used) {
+            m_seq = std::max(m_seq, slots[i].consumed);
+        }
+    }
+
+    openSegment(segments.empty() ? 1 : segments.back() + 1);
+    L_INFO_F("Chat::Undelivered", "Recovered %lu message(s) from %lu segment(s) in %s",
+             m_queues.size(), segments.size(), m_directory.c_str());
+}
+
+void wss::FileUndeliveredStore::recoverSegment(uint64_t segment, bool last) {
+    const std::string path = segmentPath(segment);
+    const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        throw systemError("Unable to open undelivered store segment", path);
+    }
+    Segment &seg = m_segments[segment];
+    seg.file = std::make_shared<FileHandle>(fd);
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        throw systemError("Unable to stat undelivered store segment", path);
+    }
+    const auto fileSize = static_cast<uint64_t>(st.st_size);
+    if (fileSize == 0) {
+        return;
+    }
+
+    void *mapped = ::mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        throw systemError("Unable to map undelivered store segment", path);
+    }
+    const char *data = static_cast<const char *>(mapped);
+    const uint64_t now = UndeliveredStore::now();
+
+    uint64_t offset = 0;
+    while (offset + RECORD_HEADER <= fileSize) {
+        uint32_t length, crc;
+        std::memcpy(&length, data + offset, 4);
+        std::memcpy(&crc, data + offset + 4, 4);
+        length &= ~SegmentCodec::COMPRESSED;
+        const char *body = data + offset + RECORD_HEADER;
+        if (length < RECORD_META || offset + RECORD_HEADER + length > fileSize || checksum(body, length) != crc) {
+            break;
+        }
+
+        uint64_t seq, expiresAt;
+        uint32_t count;
+        std::memcpy(&seq, body, 8);
+        std::memcpy(&expiresAt, body + 8, 8);
+        std::memcpy(&count, body + 16, 4);
+        if (RECORD_META + static_cast<uint64_t>(count) * 8 > length) {
+            break;
+        }
+        m_seq = std::max(m_seq, seq);
+        if (seg.firstSeq == 0) {
+            seg.firstSeq = seq;
+        }
+        if (expiresAt == 0 || expiresAt > now) {
+            Location location;
+            location.segment = segment;
+            location.offset = offset;
+            location.length = static_cast<uint32_t>(RECORD_HEADER + length);
+            for (uint32_t i = 0; i < count; i++) {
+                uint64_t recipient;
+                std::memcpy(&recipient, body + RECORD_META + i * 8, 8);
+                if (seq > getConsumed(recipient)) {
+                    m_queues.push(recipient, seq, location, expiresAt, now);
+                    seg.live++;
+                }
+            }
+        }
+        offset += RECORD_HEADER + length;
+    }
+    ::munmap(mapped, fileSize);
+
+    if (offset != fileSize) {
+        // torn write of crashed process: tail after last valid record is dropped
+        L_WARN_F("Chat::Undelivered", "Segment %s is truncated from %lu to %lu bytes%s", path.c_str(), fileSize,
+                 offset, last ? "" : " (not last segment)");
+        if (::ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+            throw systemError("Unable to truncate undelivered store segment", path);
+        }
+    }
+    seg.size = offset;
+}
+
+void wss::FileUndeliveredStore::openSegment(uint64_t segment) {
+    const std::string path = segmentPath(segment);
+    const int fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw systemError("Unable to create undelivered store segment", path);
+    }
+    Segment &seg = m_segments[segment];
+    seg.file = std::make_shared<FileHandle>(fd);
+    m_activeSegment = segment;
+
+    // new file entry must survive crash too
+    const int dirFd = ::open(m_directory.c_str(), O_RDONLY | O_CLOEXEC);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+}
+
+void wss::FileUndeliveredStore::release(const Location &location) {
+    const auto it = m_segments.find(location.segment);
+    if (it == m_segments.end()) {
+        return;
+    }
+    if (--it->second.live == 0 && location.segment != m_activeSegment) {
+        m_segments.erase(it);
+        ::unlink(segmentPath(location.segment).c_str());
+    }
+}
+
+void wss::FileUndeliveredStore::push(const user_id_t *recipients,
+                                     std::size_t count,
+                                     const MessagePayloadPtr &payload,
+                                     uint64_t expiresAt) {
+    if (count == 0) {
+        return;
+    }
+    const std::string &binary = payload->toBinary();
+    std::string compressed;
+    const bool isCompressed = m_codec->compress(binary.data(), binary.size(), compressed);
+    const std::string &envelope = isCompressed ? compressed : binary;
+    const std::size_t recipientsSize = count * 8;
+    std::string record(RECORD_HEADER + RECORD_META + recipientsSize + envelope.size(), '\0');
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    const uint64_t seq = ++m_seq;
+    const auto length = static_cast<uint32_t>(RECORD_META + recipientsSize + envelope.size());
+    const auto recipientsCount = static_cast<uint32_t>(count);
+    char *body = &record[RECORD_HEADER];
+    std::memcpy(body, &seq, 8);
+    std::memcpy(body + 8, &expiresAt, 8);
+    std::memcpy(body + 16, &recipientsCount, 4);
+    std::memcpy(body + RECORD_META, recipients, recipientsSize);
+    std::memcpy(body + RECORD_META + recipientsSize, envelope.data(), envelope.size());
+    const uint32_t crc = checksum(body, length);
+    const uint32_t lengthField = isCompressed ? (length | SegmentCodec::COMPRESSED) : length;
+    std::memcpy(&record[0], &lengthField, 4);
+    std::memcpy(&record[4], &crc, 4);
+
+    Segment &seg = m_segments[m_activeSegment];
+    if (!writeAll(seg.file->fd, record.data(), record.size())) {
+        L_ERR_F("Chat::Undelivered", "Unable to write message for %lu user(s): %s", count, std::strerror(errno));
+        // partial record is cut on recovery by crc check, next records must not follow it
+        if (::ftruncate(seg.file->fd, static_cast<off_t>(seg.size)) != 0) {
+            openSegment(m_activeSegment + 1);
+        }
+        return;
+    }
+
+    Location location;
+    location.segment = m_activeSegment;
+    location.offset = seg.size;
+    location.length = static_cast<uint32_t>(record.size());
+    seg.size += record.size();
+    seg.live += count;
+    if (seg.firstSeq == 0) {
+        seg.firstSeq = seq;
+    }
+    const uint64_t pushedAt = now();
+    for (std::size_t i = 0; i < count; i++) {
+        m_queues.push(recipients[i], seq, location, expiresAt, pushedAt);
+    }
+    m_dirty = true;
+
+    if (m_options.syncIntervalMillis == 0) {
+        ::fdatasync(seg.file->fd);
+    }
+    if (seg.size >= m_options.segmentBytes) {
+        ::fdatasync(seg.file->fd);
+        const uint64_t previous = m_activeSegment;
+        openSegment(previous + 1);
+        if (m_segments[previous].live == 0) {
+            m_segments.erase(previous);
+            ::unlink(segmentPath(previous).c_str());
+        }
+    }
+}
+
+std::size_t wss::FileUndeliveredStore::take(user_id_t recipient,
+                                            std::size_t limit,
+                                            std::vector<MessagePayloadPtr> &out) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    uint64_t consumed = 0;
+    std::size_t taken = 0;
+    std::string record;
+    std::string decompressed;
+    m_queues.take(recipient, limit, now(), [&](UndeliveredQueues<Location>::Entry &&entry, bool live) {
+      consumed = entry.seq;
+      if (entry.expired) {
+          // released by expiry index
+          return;
+      }
+      const Location &location = entry.item;
+      if (live) {
+          const auto seg = m_segments.find(location.segment);
+          record.resize(location.length);
+          if (seg != m_segments.end() && readAll(seg->second.file->fd, &record[0], location.length, location.offset)
+              && checksum(record.data() + RECORD_HEADER, location.length - RECORD_HEADER)
+                  == *reinterpret_cast<const uint32_t *>(record.data() + 4)) {
+              uint32_t lengthField, count;
+              std::memcpy(&lengthField, record.data(), 4);
+              std::memcpy(&count, record.data() + RECORD_HEADER + 16, 4);
+              const std::size_t offset = RECORD_HEADER + RECORD_META + static_cast<std::size_t>(count) * 8;
+              const char *envelope = record.data() + offset;
+              std::size_t envelopeLength = location.length - offset;
+              if (lengthField & SegmentCodec::COMPRESSED) {
+                  if (!m_codec->decompress(envelope, envelopeLength, decompressed)) {
+                      decompressed.clear();
+                      L_ERR_F("Chat::Undelivered", "Unable to decompress message for user %lu from segment %lu",
+                              recipient, location.segment);
+                  }
+                  envelope = decompressed.data();
+                  envelopeLength = decompressed.size();
+              }
+              MessagePayload payload = MessagePayload::fromStoredBinary(envelope, envelopeLength);
+              if (payload.isValid()) {
+                  out.push_back(std::make_shared<const MessagePayload>(std::move(payload)));
+                  taken++;
+              }
+          } else {
+              L_ERR_F("Chat::Undelivered", "Unable to read message for user %lu from segment %lu",
+                      recipient, location.segment);
+          }
+      }
+      release(location);
+    });
+
+    if (consumed != 0) {
+        setConsumed(recipient, consumed);
+        m_dirty = true;
+    }
+    return taken;
+}
+
+const wss::SegmentCodec &wss::FileUndeliveredStore::getCodec() const noexcept {
+    return *m_codec;
+}
+
+bool wss::FileUndeliveredStore::has(user_id_t recipient) const {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_queues.has(recipient);
+}
+std::size_t wss::FileUndeliveredStore::expire() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    const std::size_t expired = m_queues.expire([this](UndeliveredQueues<Location>::Entry &entry) {
+      release(entry.item);
+    });
+    m_metrics.expired += expired;
+    return expired;
+}
+std::size_t wss::FileUndeliveredStore::size() const {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_queues.size();
+}
+
+void wss::FileUndeliveredStore::openIndex() {
+    const std::string path = m_directory + "/index.bin";
+    const int fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw systemError("Unable to open undelivered store index", path);
+    }
+    m_indexFile = std::make_shared<FileHandle>(fd);
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        throw systemError("Unable to stat undelivered store index", path);
+    }
+
+    IndexHeader header;
+    const auto fileSize = static_cast<std::size_t>(st.st_size);
+    if (fileSize >= sizeof(IndexHeader) && readAll(fd, reinterpret_cast<char *>(&header), sizeof(header), 0)
+        && std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0
+        && fileSize == sizeof(IndexHeader) + header.capacity * sizeof(IndexSlot)) {
+        mapIndex(static_cast<std::size_t>(header.capacity));
+        return;
+    }
+
+    if (fileSize > 0) {
+        // without index taken messages would be delivered again
+        L_WARN_F("Chat::Undelivered", "Index %s is invalid, it will be recreated", path.c_str());
+    }
+    const std::size_t size = sizeof(IndexHeader) + INDEX_MIN_CAPACITY * sizeof(IndexSlot);
+    if (::ftruncate(fd, 0) != 0 || ::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        throw systemError("Unable to resize undelivered store index", path);
+    }
+    mapIndex(INDEX_MIN_CAPACITY);
+    std::memcpy(indexHeader().magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    indexHeader().capacity = INDEX_MIN_CAPACITY;
+    indexHeader().count = 0;
+}
+
+void wss::FileUndeliveredStore::mapIndex(std::size_t capacity) {
+    const std::size_t size = sizeof(IndexHeader) + capacity * sizeof(IndexSlot);
+    void *mapped = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_indexFile->fd, 0);
+    if (mapped == MAP_FAILED) {
+        throw systemError("Unable to map undelivered store index", m_directory + "/index.bin");
+    }
+    if (m_indexMap) {
+        ::munmap(m_indexMap, m_indexMapSize);
+    }
+    m_indexMap = mapped;
+    m_indexMapSize = size;
+}
+
+wss::FileUndeliveredStore::IndexHeader &wss::FileUndeliveredStore::indexHeader() const {
+    return *static_cast<IndexHeader *>(m_indexMap);
+}
+wss::FileUndeliveredStore::IndexSlot *wss::FileUndeliveredStore::indexSlots() const {
+    return reinterpret_cast<IndexSlot *>(static_cast<char *>(m_indexMap) + sizeof(IndexHeader));
+}
+
+void wss::FileUndeliveredStore::growIndex() {
+    // recipient position is needed only while some segment can contain its taken records
+    uint64_t minSeq = 0;
+    for (const auto &item: m_segments) {
+        if (item.second.firstSeq != 0) {
+            minSeq = minSeq == 0 ? item.second.firstSeq : std::min(minSeq, item.second.firstSeq);
+        }
+    }
+    std::vector<IndexSlot> kept;
+    const IndexSlot *slots = indexSlots();
+    for (std::size_t i = 0; i < indexHeader().capacity; i++) {
+        if (slots[i].used && minSeq != 0 && slots[i].consumed >= minSeq) {
+            kept.push_back(slots[i]);
+        }
+    }
+
+    std::size_t capacity = INDEX_MIN_CAPACITY;
+    while (capacity < kept.size() * 4) {
+        capacity *= 2;
+    }
+
+    // new index is written aside and atomically replaces old one
+    const std::string path = m_directory + "/index.bin";
+    const std::string tmpPath = path + ".tmp";
+    const int fd = ::open(tmpPath.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw systemError("Unable to create undelivered store index", tmpPath);
+    }
+    auto file = std::make_shared<FileHandle>(fd);
+    const std::size_t size = sizeof(IndexHeader) + capacity * sizeof(IndexSlot);
+    std::vector<char> data(size, 0);
+    auto *header = reinterpret_cast<IndexHeader *>(data.data());
+    auto *newSlots = reinterpret_cast<IndexSlot *>(data.data() + sizeof(IndexHeader));
+    std::memcpy(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header->capacity = capacity;
+    header->count = kept.size();
+    for (const auto &slot: kept) {
+        std::size_t i = mixRecipient(slot.recipient) & (capacity - 1);
+        while (newSlots[i].used) {
+            i = (i + 1) & (capacity - 1);
+        }
+        newSlots[i] = slot;
+    }
+    if (!writeAll(fd, data.data(), data.size()) || ::fdatasync(fd) != 0
+        || ::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        throw systemError("Unable to write undelivered store index", tmpPath);
+    }
+
+    m_indexFile = std::move(file);
+    mapIndex(capacity);
+}
+
+wss::FileUndeliveredStore::IndexSlot *wss::FileUndeliveredStore::findIndexSlot(user_id_t recipient, bool insert) {
+    if (insert && (indexHeader().count + 1) * 2 > indexHeader().capacity) {
+        growIndex();
+    }
+    const std::size_t capacity = static_cast<std::size_t>(indexHeader().capacity);
+    IndexSlot *slots = indexSlots();
+    for (std::size_t i = mixRecipient(recipient) & (capacity - 1);; i = (i + 1) & (capacity - 1)) {
+        if (!slots[i].used) {
+            if (!insert) {
+                return nullptr;
+            }
+            slots[i].recipient = recipient;
+            slots[i].consumed = 0;
+            slots[i].used = 1;
+            indexHeader().count++;
+            return &slots[i];
+        }
+        if (slots[i].recipient == recipient) {
+            return &slots[i];
+        }
+    }
+}
+uint64_t wss::FileUndeliveredStore::getConsumed(user_id_t recipient) {
+    const IndexSlot *slot = findIndexSlot(recipient, false);
+    return slot == nullptr ? 0 : slot->consumed;
+}
+void wss::FileUndeliveredStore::setConsumed(user_id_t recipient, uint64_t seq) {
+    findIndexSlot(recipient, true)->consumed = seq;
+}
+
+void wss::FileUndeliveredStore::sync() {
+    std::unique_lock<std::mutex> lock(m_lock);
+    syncLocked(lock);
+}
+void wss::FileUndeliveredStore::syncLocked(std::unique_lock<std::mutex> &lock) {
+    if (!m_dirty) {
+        return;
+    }
+    m_dirty = false;
+    const auto it = m_segments.find(m_activeSegment);
+    std::shared_ptr<FileHandle> segment = it == m_segments.end() ? nullptr : it->second.file;
+    std::shared_ptr<FileHandle> index = m_indexFile;
+
+    // pushes and takes continue while data is flushed, handles keep descriptors open
+    lock.unlock();
+    if (segment) {
+        ::fdatasync(segment->fd);
+    }
+    // dirty pages of shared mapping are written by file sync
+    ::fdatasync(index->fd);
+    lock.lock();
+}
+
+void wss::FileUndeliveredStore::flushLoop() {
+    wss::affinity::pin(wss::affinity::Group::Background);
+    const auto interval = std::chrono::milliseconds(m_options.syncIntervalMillis);
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (!m_stop) {
+        m_flushCondition.wait_for(lock, interval, [this] { return m_stop; });
+        syncLocked(lock);
+    }
+}
+
+namespace {
+
+std::unique_ptr<wss::UndeliveredStore> writeBehind(std::unique_ptr<wss::UndeliveredStore> store,
+                                                   const wss::undelivered::StoreConfig &config) {
+    if (config.writeBehindBytes == 0) {
+        return store;
+    }
+    wss::WriteBehindUndeliveredStore::Options options;
+    options.maxPendingBytes = config.writeBehindBytes;
+    return std::make_unique<wss::WriteBehindUndeliveredStore>(std::move(store), options);
+}
+
+}
+
+std::unique_ptr<wss::UndeliveredStore> wss::undelivered::registry::create(const std::string &type,
+                                                                       const StoreConfig &config) {
+    using toolboxpp::strings::equalsIgnoreCase;
+    if (equalsIgnoreCase(type, "memory")) {
+        wss::MemoryUndeliveredStore::Options options = config.memory;
+        std::unique_ptr<wss::UndeliveredStore> spill;
+        if (equalsIgnoreCase(config.overflowPolicy, "dropOldest")) {
+            options.policy = wss::MemoryUndeliveredStore::OverflowPolicy::DropOldest;
+        } else if (equalsIgnoreCase(config.overflowPolicy, "spill")) {
+            options.policy = wss::MemoryUndeliveredStore::OverflowPolicy::Spill;
+            spill = std::make_unique<wss::FileUndeliveredStore>(config.spillDirectory, config.file);
+        } else {
+            throw std::runtime_error("Unknown undelivered store overflow policy: " + config.overflowPolicy
+                                         + ". Available: dropOldest, spill");
+        }
+        return std::make_unique<wss::MemoryUndeliveredStore>(options, std::move(spill));
+    } else if (equalsIgnoreCase(type, "file")) {
+        return writeBehind(std::make_unique<wss::FileUndeliveredStore>(config.directory, config.file), config);
+    }
+    #ifdef ENABLE_REDIS_TARGET
+    if (equalsIgnoreCase(type, "redis")) {
+        return writeBehind(std::make_unique<wss::RedisUndeliveredStore>(config.redis), config);
+    }
+    throw std::runtime_error("Unknown undelivered store type: " + type + ". Available: memory, file, redis");
+    #else
+    throw std::runtime_error("Unknown undelivered store type: " + type + ". Available: memory, file");
+    #endif
+}
@@ -0,0 +1,536 @@
+/**
+ * wsserver
+ * UndeliveredStore.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_UNDELIVEREDSTORE_H
+#define WSSERVER_UNDELIVEREDSTORE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Message.h"
+#include "timer_wheel.hpp"
+#include "../base/Metrics.h"
+#include "../base/SegmentCodec.h"
+#include "../wsserver_core.h"
+
+namespace wss {
+
+/// \brief Undelivered store counters
+struct UndeliveredMetrics {
+  /// \brief Memory used by stored bodies (memory store), each body is counted once
+  std::atomic<uint64_t> bytes{0};
+  /// \brief Messages moved to disk because memory limits are reached
+  std::atomic<uint64_t> spilled{0};
+  /// \brief Messages dropped because limits are reached
+  std::atomic<uint64_t> dropped{0};
+  /// \brief Messages dropped by ttl
+  std::atomic<uint64_t> expired{0};
+};
+
+/// \brief Write-behind queue counters, see WriteBehindUndeliveredStore
+struct WriteBehindMetrics {
+  /// \brief Pushes accepted, but not written to store yet
+  std::atomic<uint64_t> pending{0};
+  std::atomic<uint64_t> pendingBytes{0};
+  std::atomic<uint64_t> written{0};
+  /// \brief Pushes, that waited for free queue space
+  std::atomic<uint64_t> stalls{0};
+};
+
+/// \brief Messages waiting for offline recipients. Implementations are thread safe.
+/// Message body is stored once for all its recipients, recipient queue holds only reference to it
+class UndeliveredStore {
+ public:
+    virtual ~UndeliveredStore() = default;
+
+    /// \brief Stores one message for many recipients
+    /// \param recipients
+    /// \param count
+    /// \param payload shared body, recipients of payload itself are not used
+    /// \param expiresAt unix time in milliseconds, 0 - never expires
+    virtual void push(const user_id_t *recipients, std::size_t count,
+                      const MessagePayloadPtr &payload, uint64_t expiresAt) = 0;
+
+    /// \brief Stores message for one recipient
+    /// \param recipient
+    /// \param payload
+    /// \param expiresAt unix time in milliseconds, 0 - never expires
+    void push(user_id_t recipient, const MessagePayloadPtr &payload, uint64_t expiresAt) {
+        push(&recipient, 1, payload, expiresAt);
+    }
+
+    /// \brief Removes oldest not expired messages of recipient, in order they were stored
+    /// \param recipient
+    /// \param limit max messages to take, 0 - all
+    /// \param out taken messages are appended here. Body can be shared with other recipients
+    /// \return number of taken messages
+    virtual std::size_t take(user_id_t recipient, std::size_t limit, std::vector<MessagePayloadPtr> &out) = 0;
+
+    /// \brief Whether recipient has stored messages (expired, but not dropped yet, are counted too)
+    /// \param recipient
+    /// \return
+    virtual bool has(user_id_t recipient) const = 0;
+
+    /// \brief Drops messages, which deadline is passed. Called every second
+    /// \return number of dropped messages
+    virtual std::size_t expire() = 0;
+
+    /// \brief Number of stored messages
+    /// \return
+    virtual std::size_t size() const = 0;
+
+    /// \brief Receives stored message with all its recipients and expiry time (unix ms, 0 - never)
+    using SnapshotHandler = std::function<void(const std::vector<user_id_t> &recipients,
+                                               const MessagePayloadPtr &payload,
+                                               uint64_t expiresAt)>;
+
+    /// \brief Visits stored messages to save them in snapshot (see ChatServer::saveSnapshot()).
+    /// Message with many recipients is visited once
+    /// \param handler
+    /// \return false if store keeps messages itself (on disk or in redis), so they are not a part of snapshot
+    virtual bool snapshot(const SnapshotHandler &handler) const {
+        return false;
+    }
+
+    /// \brief Whether messages are kept outside of node and are seen by all nodes (see ChatServer handoff)
+    /// \return
+    virtual bool isShared() const noexcept {
+        return false;
+    }
+
+    /// \brief Current unix time in milliseconds
+    static uint64_t now() noexcept {
+        using namespace std::chrono;
+        return static_cast<uint64_t>(duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count());
+    }
+
+    /// \brief Store counters, not every store fills all of them. Decorators return counters of wrapped store
+    /// \return
+    virtual const UndeliveredMetrics &getMetrics() const noexcept {
+        return m_metrics;
+    }
+
+    /// \brief Write-behind queue counters
+    /// \return nullptr if pushes are written synchronously
+    virtual const WriteBehindMetrics *getWriteBehindMetrics() const noexcept {
+        return nullptr;
+    }
+
+ protected:
+    UndeliveredMetrics m_metrics;
+};
+
+/// \brief Per-recipient FIFO queues with expiry index (timer wheel with 1 second tick).
+/// Expired entry is found in its queue by binary search of sequence number, without scanning queues.
+/// Not thread safe: used by stores under their locks
+/// \tparam T stored item, movable and default constructible
+template<typename T>
+class UndeliveredQueues {
+ public:
+    struct Entry {
+      /// \brief Increasing number: recipient queue is sorted by it
+      uint64_t seq;
+      /// \brief unix milliseconds, 0 - never expires
+      uint64_t expiresAt;
+      /// \brief Dropped by expiry index, item is released already
+      bool expired;
+      T item;
+    };
+
+    UndeliveredQueues() :
+        m_expiry(std::chrono::seconds(1), 3600) { }
+
+    /// \brief Adds item to the end of recipient queue
+    /// \param recipient
+    /// \param seq must be greater than any seq in recipient queue
+    /// \param item
+    /// \param expiresAt unix milliseconds, 0 - never
+    /// \param now unix milliseconds
+    void push(user_id_t recipient, uint64_t seq, T item, uint64_t expiresAt, uint64_t now) {
+        m_queues[recipient].push_back(Entry{seq, expiresAt, false, std::move(item)});
+        m_size++;
+        if (expiresAt != 0) {
+            const uint64_t left = expiresAt > now ? expiresAt - now : 0;
+            m_expiry.schedule(Expiry{recipient, seq},
+                              std::chrono::steady_clock::now() + std::chrono::milliseconds(left));
+        }
+    }
+
+    /// \brief Removes oldest entries of recipient
+    /// \param recipient
+    /// \param limit max not expired entries, 0 - all
+    /// \param now unix milliseconds
+    /// \param handler void(Entry &&entry, bool live): called for each removed entry, live=false for expired
+    /// \return number of live entries
+    template<typename Handler>
+    std::size_t take(user_id_t recipient, std::size_t limit, uint64_t now, Handler &&handler) {
+        const auto it = m_queues.find(recipient);
+        if (it == m_queues.end()) {
+            return 0;
+        }
+        Queue &queue = it->second;
+        std::size_t taken = 0;
+        while (!queue.empty() && (limit == 0 || taken < limit)) {
+            Entry entry = std::move(queue.front());
+            queue.pop_front();
+            m_size--;
+            // expiry index has 1 second resolution
+            const bool live = !entry.expired && (entry.expiresAt == 0 || entry.expiresAt > now);
+            if (live) {
+                taken++;
+            }
+            handler(std::move(entry), live);
+        }
+        if (queue.empty()) {
+            m_queues.erase(it);
+        }
+        return taken;
+    }
+
+    /// \brief Drops expired entries
+    /// \param handler void(Entry &entry): called before entry item is released
+    /// \return number of dropped entries
+    template<typename Handler>
+    std::size_t expire(Handler &&handler) {
+        std::size_t expired = 0;
+        m_expiry.advance(std::chrono::steady_clock::now(), [this, &expired, &handler](Expiry &&item) {
+          // entry could be taken already
+          const auto it = m_queues.find(item.recipient);
+          if (it == m_queues.end()) {
+              return;
+          }
+          Queue &queue = it->second;
+          const auto pos = std::lower_bound(queue.begin(), queue.end(), item.seq,
+                                            [](const Entry &lhs, uint64_t seq) {
+                                              return lhs.seq < seq;
+                                            });
+          if (pos == queue.end() || pos->seq != item.seq || pos->expired) {
+              return;
+          }
+          handler(*pos);
+          pos->expired = true;
+          pos->item = T();
+          expired++;
+
+          while (!queue.empty() && queue.front().expired) {
+              queue.pop_front();
+              m_size--;
+          }
+          if (queue.empty()) {
+              m_queues.erase(it);
+          }
+        });
+        return expired;
+    }
+
+    /// \brief Removes oldest entry of recipient
+    /// \param recipient
+    /// \param handler void(Entry &&entry): called for removed entry
+    /// \return false if recipient has no entries
+    template<typename Handler>
+    bool dropOldest(user_id_t recipient, Handler &&handler) {
+        const auto it = m_queues.find(recipient);
+        if (it == m_queues.end()) {
+            return false;
+        }
+        Entry entry = std::move(it->second.front());
+        it->second.pop_front();
+        m_size--;
+        if (it->second.empty()) {
+            m_queues.erase(it);
+        }
+        handler(std::move(entry));
+        return true;
+    }
+
+    bool has(user_id_t recipient) const {
+        return m_queues.find(recipient) != m_queues.end();
+    }
+
+    /// \brief Visits not expired entries, in queue order
+    /// \param handler void(user_id_t recipient, const Entry &entry)
+    template<typename Handler>
+    void forEach(Handler &&handler) const {
+        for (const auto &queue: m_queues) {
+            for (const Entry &entry: queue.second) {
+                if (!entry.expired) {
+                    handler(queue.first, entry);
+                }
+            }
+        }
+    }
+
+    /// \brief Number of recipient entries (including expired, but not dropped yet)
+    std::size_t size(user_id_t recipient) const {
+        const auto it = m_queues.find(recipient);
+        return it == m_queues.end() ? 0 : it->second.size();
+    }
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+ private:
+    using Queue = std::deque<Entry>;
+    struct Expiry {
+      user_id_t recipient;
+      uint64_t seq;
+    };
+
+    UserMap<Queue> m_queues;
+    wss::utils::TimerWheel<Expiry> m_expiry;
+    std::size_t m_size = 0;
+};
+
+/// \brief Keeps messages in memory: they are lost on restart.
+/// Queues of all recipients reference one body, it is released when last recipient takes it or it expires.
+/// Recipients are split into shards by id, each shard has own lock, so enqueue for big group doesn't contend
+/// with redelivery of other users.
+/// Memory can be bounded by per-user and total limits. Over limit messages are dropped or moved to spill store.
+/// Once recipient has spilled messages, its new messages go to spill store too, until it is drained, so order is kept
+class MemoryUndeliveredStore : public UndeliveredStore {
+ public:
+    /// \brief Number of shards (power of two)
+    static constexpr std::size_t SHARDS = 16;
+
+    /// \brief What to do when limit is reached
+    enum class OverflowPolicy {
+      /// \brief User over maxPerUser loses its oldest message. New messages are dropped when maxBytes is reached
+      DropOldest,
+      /// \brief Over limit messages go to spill store
+      Spill
+    };
+
+    struct Options {
+      /// \brief Max messages of one user in memory, 0 - unlimited
+      std::size_t maxPerUser = 0;
+      /// \brief Max memory used by bodies, 0 - unlimited
+      std::size_t maxBytes = 0;
+      OverflowPolicy policy = OverflowPolicy::DropOldest;
+    };
+
+    /// \brief Unbounded store
+    MemoryUndeliveredStore();
+
+    /// \brief Bounded store
+    /// \param options
+    /// \param spill store for over limit messages, required for OverflowPolicy::Spill
+    /// \throws std::invalid_argument if policy is Spill and spill store is nullptr
+    MemoryUndeliveredStore(const Options &options, std::unique_ptr<UndeliveredStore> spill);
+
+    using UndeliveredStore::push;
+    void push(const user_id_t *recipients, std::size_t count,
+              const MessagePayloadPtr &payload, uint64_t expiresAt) override;
+    std::size_t take(user_id_t recipient, std::size_t limit, std::vector<MessagePayloadPtr> &out) override;
+    bool has(user_id_t recipient) const override;
+    std::size_t expire() override;
+    std::size_t size() const override;
+
+    /// \brief Visits messages kept in memory. Spilled messages are kept by spill store
+    /// \param handler
+    /// \return true
+    bool snapshot(const SnapshotHandler &handler) const override;
+
+ private:
+    /// \brief Body shared by recipients queues, its size is counted in metrics until last reference is released
+    struct Body {
+      Body(MessagePayloadPtr payload, std::size_t bytes, std::atomic<uint64_t> &counter, uint64_t order) :
+          payload(std::move(payload)), bytes(bytes), counter(counter), order(order) {
+          counter += bytes;
+          wss::metrics::acquire(wss::metrics::Memory::Undelivered, bytes);
+      }
+      ~Body() {
+          counter -= bytes;
+          wss::metrics::release(wss::metrics::Memory::Undelivered, bytes);
+      }
+      const MessagePayloadPtr payload;
+      const std::size_t bytes;
+      std::atomic<uint64_t> &counter;
+      /// \brief Creation order, snapshot keeps recipients queues order by it
+      const uint64_t order;
+    };
+    using BodyPtr = std::shared_ptr<const Body>;
+
+    struct Shard {
+      mutable std::mutex lock;
+      UndeliveredQueues<BodyPtr> queues;
+      /// \brief Assigned under shard lock, so recipient queue stays sorted by it
+      uint64_t seq = 0;
+    };
+    std::array<Shard, SHARDS> m_shards;
+    std::atomic<uint64_t> m_bodies{0};
+    const Options m_options;
+    std::unique_ptr<UndeliveredStore> m_spill;
+
+    /// \brief Adds recipient entry or moves it to spill store, shard must be locked
+    void pushLocked(Shard &shard, user_id_t recipient, const BodyPtr &body, uint64_t expiresAt, uint64_t pushedAt,
+                    bool overBytes);
+
+    Shard &getShard(user_id_t recipient) noexcept {
+        return m_shards[recipient & (SHARDS - 1)];
+    }
+    const Shard &getShard(user_id_t recipient) const noexcept {
+        return m_shards[recipient & (SHARDS - 1)];
+    }
+};
+
+/// \brief Keeps messages in segmented append-only log on disk, survives restart.
+/// Record (host byte order): u32 body length, u32 crc32 of body, body: u64 seq, u64 expiresAt (unix ms),
+/// u32 recipients count, u64 recipients, binary envelope of payload (see MessagePayload::toBinary()).
+/// If length has SegmentCodec::COMPRESSED flag, envelope is zstd frame, decompressed when record is taken.
+/// One record is written for all recipients of message, memory holds only record locations. Consumed position of every recipient (last taken seq) is kept in
+/// memory-mapped index file, so recovery reads segments once, without replaying acknowledgements.
+/// Segment is deleted when all its records are taken or expired by every recipient.
+/// Writes are group-committed: pushes are not waiting for fsync, flusher thread syncs log and index
+/// every syncInterval, so crash loses at most last syncInterval of messages. Messages that were taken less than
+/// syncInterval before crash are redelivered again after restart
+class FileUndeliveredStore : public UndeliveredStore {
+ public:
+    struct Options {
+      /// \brief Segment is closed and new one is started when it grows above this size
+      std::size_t segmentBytes = 64 * 1024 * 1024;
+      /// \brief Group commit interval, 0 - fsync every push
+      uint32_t syncIntervalMillis = 100;
+      /// \brief Compression of envelopes
+      SegmentCodec::Options compression;
+    };
+
+    /// \brief Opens store directory (creates if not exists) and recovers not taken messages
+    /// \param directory
+    /// \param options
+    /// \throws std::runtime_error if directory or files can't be opened
+    FileUndeliveredStore(const std::string &directory, const Options &options);
+    ~FileUndeliveredStore() override;
+
+    using UndeliveredStore::push;
+    void push(const user_id_t *recipients, std::size_t count,
+              const MessagePayloadPtr &payload, uint64_t expiresAt) override;
+    std::size_t take(user_id_t recipient, std::size_t limit, std::vector<MessagePayloadPtr> &out) override;
+    bool has(user_id_t recipient) const override;
+    std::size_t expire() override;
+    std::size_t size() const override;
+
+    /// \brief Writes pending records and index to disk
+    void sync();
+
+    /// \brief Envelopes compression
+    const SegmentCodec &getCodec() const noexcept;
+
+ private:
+    /// \brief Record position in log
+    struct Location {
+      uint64_t segment = 0;
+      uint64_t offset = 0;
+      uint32_t length = 0;
+    };
+    /// \brief File descriptor, closed when last user (writer or flusher) releases it
+    struct FileHandle {
+      explicit FileHandle(int fd) : fd(fd) { }
+      ~FileHandle();
+      const int fd;
+    };
+    struct Segment {
+      std::shared_ptr<FileHandle> file;
+      uint64_t size = 0;
+      /// \brief Not taken and not expired record references
+      std::size_t live = 0;
+      /// \brief Seq of first record, 0 - empty segment
+      uint64_t firstSeq = 0;
+    };
+    /// \brief Index file slot: recipient and its consumed seq
+    struct IndexSlot {
+      uint64_t used;
+      uint64_t recipient;
+      uint64_t consumed;
+    };
+    struct IndexHeader {
+      char magic[8];
+      uint64_t capacity;
+      uint64_t count;
+    };
+
+    const std::string m_directory;
+    const Options m_options;
+
+    mutable std::mutex m_lock;
+    UndeliveredQueues<Location> m_queues;
+    std::map<uint64_t, Segment> m_segments;
+    uint64_t m_activeSegment = 0;
+    uint64_t m_seq = 0;
+    bool m_dirty = false;
+    std::unique_ptr<SegmentCodec> m_codec;
+
+    std::shared_ptr<FileHandle> m_indexFile;
+    void *m_indexMap = nullptr;
+    std::size_t m_indexMapSize = 0;
+
+    std::condition_variable m_flushCondition;
+    bool m_stop = false;
+    std::thread m_flusher;
+
+    std::string segmentPath(uint64_t segment) const;
+    void recover();
+    void recoverSegment(uint64_t segment, bool last);
+    void openSegment(uint64_t segment);
+    void release(const Location &location);
+
+    void openIndex();
+    void mapIndex(std::size_t capacity);
+    /// \brief Rebuilds index with bigger capacity, drops recipients without records in remaining segments
+    void growIndex();
+    IndexHeader &indexHeader() const;
+    IndexSlot *indexSlots() const;
+    IndexSlot *findIndexSlot(user_id_t recipient, bool insert);
+    uint64_t getConsumed(user_id_t recipient);
+    void setConsumed(user_id_t recipient, uint64_t seq);
+
+    void flushLoop();
+    void syncLocked(std::unique_lock<std::mutex> &lock);
+};
+
+namespace undelivered {
+
+/// \brief Options of all store types
+struct StoreConfig {
+  /// \brief File store directory
+  std::string directory;
+  /// \brief Directory of memory store spill (file store), used with "spill" overflow policy
+  std::string spillDirectory;
+  wss::FileUndeliveredStore::Options file;
+  wss::MemoryUndeliveredStore::Options memory;
+  /// \brief Memory store overflow policy name: dropOldest or spill
+  std::string overflowPolicy = "dropOldest";
+  /// \brief Redis store connection config, see RedisUndeliveredStore
+  nlohmann::json redis = nlohmann::json::object();
+  /// \brief File and redis stores: max memory of write-behind queue, 0 - pushes are written by caller thread
+  std::size_t writeBehindBytes = 0;
+};
+
+namespace registry {
+/// \brief Creates store by type name
+/// \param type memory, file or redis (if built with ENABLE_REDIS_TARGET)
+/// \param config file and redis stores are wrapped in WriteBehindUndeliveredStore, if writeBehindBytes is set
+/// \throws std::runtime_error if type or overflow policy is unknown, or store can't be opened
+/// \return
+std::unique_ptr<wss::UndeliveredStore> create(const std::string &type, const StoreConfig &config);
+}
+}
+
+}
+
+#endif //WSSERVER_UNDELIVEREDSTORE_H
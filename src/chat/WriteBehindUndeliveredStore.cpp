@@ -0,0 +1,191 @@
+/**
+ * wsserver
+ * WriteBehindUndeliveredStore.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "WriteBehindUndeliveredStore.h"
+#include <stdexcept>
+#include <toolboxpp.h>
+#include "../base/Affinity.h"
+
+wss::WriteBehindUndeliveredStore::WriteBehindUndeliveredStore(std::unique_ptr<UndeliveredStore> store,
+                                                              const Options &options) :
+    m_store(std::move(store)),
+    m_options(options),
+    m_head(&m_stub),
+    m_tail(&m_stub) {
+    if (!m_store) {
+        throw std::invalid_argument("Write-behind store requires wrapped store");
+    }
+    m_writer = std::thread(&WriteBehindUndeliveredStore::writeLoop, this);
+}
+wss::WriteBehindUndeliveredStore::~WriteBehindUndeliveredStore() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_pushCondition.notify_all();
+    m_writtenCondition.notify_all();
+    if (m_writer.joinable()) {
+        m_writer.join();
+    }
+}
+
+void wss::WriteBehindUndeliveredStore::enqueue(Node *node) noexcept {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node *prev = m_head.exchange(node, std::memory_order_acq_rel);
+    prev->next.store(node, std::memory_order_release);
+}
+
+wss::WriteBehindUndeliveredStore::Node *wss::WriteBehindUndeliveredStore::dequeue() noexcept {
+    Node *tail = m_tail;
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if (tail == &m_stub) {
+        if (next == nullptr) {
+            return nullptr;
+        }
+        m_tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr) {
+        m_tail = next;
+        return tail;
+    }
+    if (tail != m_head.load(std::memory_order_acquire)) {
+        // producer exchanged head, but not linked its node yet
+        return nullptr;
+    }
+    // tail is the last node: stub is put after it, so tail can be returned
+    enqueue(&m_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next != nullptr) {
+        m_tail = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+void wss::WriteBehindUndeliveredStore::push(const user_id_t *recipients,
+                                            std::size_t count,
+                                            const MessagePayloadPtr &payload,
+                                            uint64_t expiresAt) {
+    if (count == 0) {
+        return;
+    }
+    auto *node = new Node();
+    node->recipients.assign(recipients, recipients + count);
+    node->payload = payload;
+    node->expiresAt = expiresAt;
+    // envelope is cached by payload, stores write the same bytes
+    node->bytes = sizeof(Node) + count * sizeof(user_id_t) + payload->toBinary().size();
+
+    if (m_writeBehindMetrics.pendingBytes + node->bytes > m_options.maxPendingBytes) {
+        // backpressure: caller waits for writer, instead of growing queue or losing message
+        m_writeBehindMetrics.stalls++;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_writtenCondition.wait(lock, [this, node] {
+          return m_stop || m_pushed == m_written
+              || m_writeBehindMetrics.pendingBytes + node->bytes <= m_options.maxPendingBytes;
+        });
+    }
+
+    m_writeBehindMetrics.pendingBytes += node->bytes;
+    m_writeBehindMetrics.pending++;
+    // counted before node is linked, so flush() waits for every push that returned before it
+    const uint64_t before = m_pushed.fetch_add(1);
+    enqueue(node);
+    if (before == m_written) {
+        // writer could be idle
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pushCondition.notify_one();
+    }
+}
+
+void wss::WriteBehindUndeliveredStore::writeLoop() {
+    wss::affinity::pin(wss::affinity::Group::Background);
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_pushCondition.wait(lock, [this] {
+              return m_stop || m_pushed != m_written;
+            });
+            if (m_pushed == m_written) {
+                // stopped, everything is written
+                return;
+            }
+        }
+
+        std::size_t written = 0;
+        std::size_t bytes = 0;
+        while (written < m_options.batchSize) {
+            Node *node = dequeue();
+            if (node == nullptr) {
+                if (m_pushed == m_written + written) {
+                    break;
+                }
+                std::this_thread::yield();
+                continue;
+            }
+            try {
+                m_store->push(node->recipients.data(), node->recipients.size(), node->payload, node->expiresAt);
+            } catch (const std::exception &e) {
+                L_ERR_F("Chat::Undelivered", "Unable to write message for %lu user(s): %s",
+                        node->recipients.size(), e.what());
+            }
+            bytes += node->bytes;
+            written++;
+            delete node;
+        }
+
+        m_writeBehindMetrics.pendingBytes -= bytes;
+        m_writeBehindMetrics.pending -= written;
+        m_writeBehindMetrics.written += written;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_written += written;
+        }
+        m_writtenCondition.notify_all();
+    }
+}
+
+void wss::WriteBehindUndeliveredStore::flush() const {
+    const uint64_t pushed = m_pushed;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_writtenCondition.wait(lock, [this, pushed] {
+      return m_written >= pushed;
+    });
+}
+
+std::size_t wss::WriteBehindUndeliveredStore::take(user_id_t recipient,
+                                                   std::size_t limit,
+                                                   std::vector<MessagePayloadPtr> &out) {
+    flush();
+    return m_store->take(recipient, limit, out);
+}
+bool wss::WriteBehindUndeliveredStore::has(user_id_t recipient) const {
+    // queued recipients are not indexed: take() finds out
+    return m_pushed != m_written || m_store->has(recipient);
+}
+std::size_t wss::WriteBehindUndeliveredStore::expire() {
+    return m_store->expire();
+}
+std::size_t wss::WriteBehindUndeliveredStore::size() const {
+    return m_store->size() + static_cast<std::size_t>(m_writeBehindMetrics.pending);
+}
+bool wss::WriteBehindUndeliveredStore::snapshot(const SnapshotHandler &handler) const {
+    flush();
+    return m_store->snapshot(handler);
+}
+bool wss::WriteBehindUndeliveredStore::isShared() const noexcept {
+    return m_store->isShared();
+}
+const wss::UndeliveredMetrics &wss::WriteBehindUndeliveredStore::getMetrics() const noexcept {
+    return m_store->getMetrics();
+}
+const wss::WriteBehindMetrics *wss::WriteBehindUndeliveredStore::getWriteBehindMetrics() const noexcept {
+    return &m_writeBehindMetrics;
+}
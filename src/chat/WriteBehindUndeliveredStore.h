@@ -0,0 +1,101 @@
+/**
+ * wsserver
+ * WriteBehindUndeliveredStore.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_WRITEBEHINDUNDELIVEREDSTORE_H
+#define WSSERVER_WRITEBEHINDUNDELIVEREDSTORE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "UndeliveredStore.h"
+
+namespace wss {
+
+/// \brief Decorator of slow (disk or network) store: push only puts message to lock-free queue (MPSC), dedicated
+/// writer thread moves queued messages to wrapped store in batches. So io thread, that found offline recipient,
+/// never waits for store. Queue memory is bounded: when it's full, push waits for writer (backpressure, counted in
+/// stalls), messages are never lost or reordered.
+/// Reads see queued messages: take() and snapshot() wait until messages pushed before them are written,
+/// has() counts queued messages as stored for anybody. Reads are made by throttle thread, not by io threads
+class WriteBehindUndeliveredStore : public UndeliveredStore {
+ public:
+    struct Options {
+      /// \brief Max memory of queued messages (envelopes and recipients)
+      std::size_t maxPendingBytes = 64 * 1024 * 1024;
+      /// \brief Max messages written by writer at once, before it reports progress
+      std::size_t batchSize = 256;
+    };
+
+    /// \param store wrapped store
+    /// \param options
+    /// \throws std::invalid_argument if store is nullptr
+    WriteBehindUndeliveredStore(std::unique_ptr<UndeliveredStore> store, const Options &options);
+
+    /// \brief Writes all queued messages and stops writer
+    ~WriteBehindUndeliveredStore() override;
+
+    using UndeliveredStore::push;
+    void push(const user_id_t *recipients, std::size_t count,
+              const MessagePayloadPtr &payload, uint64_t expiresAt) override;
+    std::size_t take(user_id_t recipient, std::size_t limit, std::vector<MessagePayloadPtr> &out) override;
+    bool has(user_id_t recipient) const override;
+    std::size_t expire() override;
+    std::size_t size() const override;
+    bool snapshot(const SnapshotHandler &handler) const override;
+    bool isShared() const noexcept override;
+
+    const UndeliveredMetrics &getMetrics() const noexcept override;
+    const WriteBehindMetrics *getWriteBehindMetrics() const noexcept override;
+
+    /// \brief Waits until messages pushed before this call are written to wrapped store
+    void flush() const;
+
+ private:
+    /// \brief Intrusive queue node
+    struct Node {
+      std::atomic<Node *> next{nullptr};
+      std::vector<user_id_t> recipients;
+      MessagePayloadPtr payload;
+      uint64_t expiresAt = 0;
+      std::size_t bytes = 0;
+    };
+
+    const std::unique_ptr<UndeliveredStore> m_store;
+    const Options m_options;
+    WriteBehindMetrics m_writeBehindMetrics;
+
+    // Vyukov intrusive MPSC queue: producers exchange head, writer owns tail
+    std::atomic<Node *> m_head;
+    Node *m_tail;
+    Node m_stub;
+
+    /// \brief Pushed and written messages count, flush() waits for written to reach pushed
+    std::atomic<uint64_t> m_pushed{0};
+    std::atomic<uint64_t> m_written{0};
+
+    mutable std::mutex m_mutex;
+    /// \brief Writer waits for messages
+    std::condition_variable m_pushCondition;
+    /// \brief Producers wait for free space, readers wait for written messages
+    mutable std::condition_variable m_writtenCondition;
+    bool m_stop = false;
+    std::thread m_writer;
+
+    void enqueue(Node *node) noexcept;
+    /// \brief Writer thread only
+    /// \return nullptr if queue is empty or producer has not finished linking node yet
+    Node *dequeue() noexcept;
+    void writeLoop();
+};
+
+}
+
+#endif //WSSERVER_WRITEBEHINDUNDELIVEREDSTORE_H
@@ -0,0 +1,571 @@
+/**
+ * wsserver
+ * Connection.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_CLIENT_CONNECTION_HPP
+#define WSSERVER_CLIENT_CONNECTION_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+#include <openssl/sha.h>
+#include "Frame.hpp"
+
+namespace wss {
+namespace client {
+
+namespace asio = boost::asio;
+using ErrorCode = boost::system::error_code;
+
+/// \brief Upgrade request, used only while connecting
+struct Handshake {
+  /// \brief Host header and TLS server name
+  std::string host;
+  /// \brief Appended to Host header if not empty
+  std::string port;
+  /// \brief Path with query
+  std::string target = "/";
+  std::vector<std::pair<std::string, std::string>> headers;
+  /// \brief Check server certificate name against host (RFC 2818), TLS context must verify peer
+  bool verifyHost = false;
+};
+
+namespace detail {
+
+inline std::string base64(const uint8_t *data, std::size_t length) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve((length + 2) / 3 * 4);
+    for (std::size_t i = 0; i < length; i += 3) {
+        const uint32_t triple = (static_cast<uint32_t>(data[i]) << 16u)
+            | (i + 1 < length ? static_cast<uint32_t>(data[i + 1]) << 8u : 0u)
+            | (i + 2 < length ? static_cast<uint32_t>(data[i + 2]) : 0u);
+        out.push_back(alphabet[(triple >> 18u) & 0x3Fu]);
+        out.push_back(alphabet[(triple >> 12u) & 0x3Fu]);
+        out.push_back(i + 1 < length ? alphabet[(triple >> 6u) & 0x3Fu] : '=');
+        out.push_back(i + 2 < length ? alphabet[triple & 0x3Fu] : '=');
+    }
+    return out;
+}
+
+/// \brief Sec-WebSocket-Accept server must answer for key
+inline std::string acceptOf(const std::string &key) {
+    const std::string source = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    uint8_t digest[SHA_DIGEST_LENGTH];
+    SHA1(reinterpret_cast<const unsigned char *>(source.data()), source.size(), digest);
+    return base64(digest, sizeof(digest));
+}
+
+inline bool equalsIgnoreCase(const char *begin, const char *end, const char *expected) {
+    const std::size_t length = std::strlen(expected);
+    if (static_cast<std::size_t>(end - begin) != length) {
+        return false;
+    }
+    for (std::size_t i = 0; i < length; i++) {
+        if (std::tolower(static_cast<unsigned char>(begin[i]))
+            != std::tolower(static_cast<unsigned char>(expected[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+/// \brief Client websocket connection over plain tcp or TLS, header-only, with the same framing costs as server:
+/// frames are parsed in place from one contiguous read buffer (data frames are passed to handler without copy),
+/// outgoing frames are encoded and masked by FrameWriter straight into batch buffer, written by one async_write
+/// while next batch is collected, so after warm up sending allocates nothing.
+///
+/// Derived class (CRTP) gets events by hooks, called on io service thread; defaults do nothing:
+///     void onSecured(std::chrono::steady_clock::duration tlsHandshake) - TLS handshake done
+///     void onOpen() - upgrade is accepted, frames could be sent
+///     void onMessage(uint8_t opcode, const char *data, std::size_t length) - text or binary message,
+///         data is valid only during call
+///     void onClose(const ErrorCode &ec, bool wasOpen) - called once, for failed connect too
+/// Hooks must be accessible to Connection: public, or Connection<Derived> is friend.
+/// Pings are answered, close frame is answered and connection is closed after that.
+/// Connection must be created by std::make_shared, its methods must be called on its io service thread
+template<typename Derived>
+class Connection : public std::enable_shared_from_this<Derived> {
+ public:
+    /// \brief Bigger messages close connection
+    static constexpr std::size_t MAX_MESSAGE_SIZE = 64 * 1024 * 1024;
+    /// \brief Upgrade response headers limit
+    static constexpr std::size_t MAX_RESPONSE_HEADER = 16 * 1024;
+    /// \brief Write buffer grown over it by burst is released after write
+    static constexpr std::size_t WRITE_BUFFER_KEEP = 64 * 1024;
+
+    /// \param service
+    /// \param tlsContext client context of wss connection, nullptr - plain websocket
+    /// \param readBufferSize bytes read by one read, buffer grows only for bigger frames
+    explicit Connection(asio::io_service &service, asio::ssl::context *tlsContext = nullptr,
+                        std::size_t readBufferSize = 16 * 1024) :
+        socket(service),
+        readBufferSize(readBufferSize) {
+        if (tlsContext != nullptr) {
+            tls.reset(new asio::ssl::stream<asio::ip::tcp::socket>(service, *tlsContext));
+        }
+    }
+
+    Connection(const Connection &other) = delete;
+    Connection &operator=(const Connection &other) = delete;
+
+    /// \brief Connects and sends upgrade request
+    /// \param endpoint
+    /// \param handshake
+    /// \param source local address to bind, nullptr - any
+    void connect(const asio::ip::tcp::endpoint &endpoint, Handshake handshake,
+                 const asio::ip::address *source = nullptr) {
+        if (state != State::Idle) {
+            return;
+        }
+        state = State::Connecting;
+        ErrorCode ec;
+        tcpSocket().open(endpoint.protocol(), ec);
+        if (!ec && source != nullptr) {
+            tcpSocket().bind(asio::ip::tcp::endpoint(*source, 0), ec);
+        }
+        if (ec) {
+            finish(ec);
+            return;
+        }
+
+        auto request = std::make_shared<Handshake>(std::move(handshake));
+        const std::shared_ptr<Derived> self = this->shared_from_this();
+        tcpSocket().async_connect(endpoint, [self, request](const ErrorCode &connectError) {
+          if (connectError) {
+              self->finish(connectError);
+              return;
+          }
+          ErrorCode noDelayError;
+          self->tcpSocket().set_option(asio::ip::tcp::no_delay(true), noDelayError);
+          if (!self->tls) {
+              self->upgrade(*request);
+              return;
+          }
+
+          SSL_set_tlsext_host_name(self->tls->native_handle(), request->host.c_str());
+          if (request->verifyHost) {
+              self->tls->set_verify_callback(asio::ssl::rfc2818_verification(request->host));
+          }
+          const auto handshakeStart = std::chrono::steady_clock::now();
+          const auto role = asio::ssl::stream_base::client;
+          self->tls->async_handshake(role, [self, request, handshakeStart](const ErrorCode &tlsError) {
+            if (tlsError) {
+                self->finish(tlsError);
+                return;
+            }
+            self->derived().onSecured(std::chrono::steady_clock::now() - handshakeStart);
+            self->upgrade(*request);
+          });
+        });
+    }
+
+    /// \brief Queues not fragmented frame. Frames sent before open are written after upgrade
+    /// \param opcode
+    /// \param data
+    /// \param length
+    void send(uint8_t opcode, const char *data, std::size_t length) {
+        if (state == State::Closing || state == State::Closed) {
+            return;
+        }
+        writer.append(pending, static_cast<uint8_t>(0x80u | opcode), data, length);
+        write();
+    }
+
+    void send(uint8_t opcode, const std::string &payload) {
+        send(opcode, payload.data(), payload.size());
+    }
+
+    /// \brief Sends close frame, connection is closed when server answers it
+    /// \param code status code, RFC 6455 7.4
+    void shutdown(uint16_t code = 1000) {
+        if (state != State::Open) {
+            return;
+        }
+        const char payload[2] = {static_cast<char>(code >> 8), static_cast<char>(code & 0xFF)};
+        writer.append(pending, 0x80u | Close, payload, sizeof(payload));
+        state = State::Closing;
+        write();
+    }
+
+    /// \brief Drops connection at once, without close frame and TLS shutdown
+    void close() {
+        finish(ErrorCode());
+    }
+
+    bool isOpen() const noexcept {
+        return state == State::Open;
+    }
+
+    /// \brief Bytes queued and being written: backpressure of sender
+    std::size_t getQueuedBytes() const noexcept {
+        return pending.size() + writing.size();
+    }
+
+    asio::ip::tcp::socket &tcpSocket() noexcept {
+        return tls ? tls->next_layer() : socket;
+    }
+
+ protected:
+    void onSecured(std::chrono::steady_clock::duration) { }
+    void onOpen() { }
+    void onMessage(uint8_t, const char *, std::size_t) { }
+    void onClose(const ErrorCode &, bool) { }
+
+ private:
+    enum class State : uint8_t {
+      Idle,
+      Connecting,
+      Open,
+      /// \brief Close frame is sent or received
+      Closing,
+      Closed
+    };
+
+    /// \brief Unused if tls is set: stream owns its socket
+    asio::ip::tcp::socket socket;
+    std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket>> tls;
+    FrameWriter writer;
+    /// \brief Frames collected while previous batch is written
+    std::string pending;
+    std::string writing;
+    bool writeInFlight = false;
+    std::vector<uint8_t> readBuffer;
+    std::size_t readStart = 0;
+    std::size_t readEnd = 0;
+    const std::size_t readBufferSize;
+    /// \brief Fragmented message being reassembled
+    std::string fragments;
+    uint8_t fragmentsOpcode = 0;
+    /// \brief Expected Sec-WebSocket-Accept, set while connecting
+    std::string accept;
+    State state = State::Idle;
+    bool closeReceived = false;
+
+    Derived &derived() noexcept {
+        return static_cast<Derived &>(*this);
+    }
+
+    template<typename Buffers, typename Handler>
+    void writeAsync(const Buffers &buffers, Handler &&handler) {
+        if (tls) {
+            asio::async_write(*tls, buffers, std::forward<Handler>(handler));
+        } else {
+            asio::async_write(socket, buffers, std::forward<Handler>(handler));
+        }
+    }
+
+    template<typename Handler>
+    void readSomeAsync(Handler &&handler) {
+        auto *data = readBuffer.data() + readEnd;
+        const std::size_t free = readBuffer.size() - readEnd;
+        if (tls) {
+            tls->async_read_some(asio::buffer(data, free), std::forward<Handler>(handler));
+        } else {
+            socket.async_read_some(asio::buffer(data, free), std::forward<Handler>(handler));
+        }
+    }
+
+    void upgrade(const Handshake &handshake) {
+        uint8_t nonce[16];
+        writer.fill(nonce, sizeof(nonce));
+        const std::string key = detail::base64(nonce, sizeof(nonce));
+        accept = detail::acceptOf(key);
+
+        writing = "GET " + handshake.target + " HTTP/1.1\r\n";
+        writing += "Host: " + handshake.host + (handshake.port.empty() ? "" : ":" + handshake.port) + "\r\n";
+        writing += "Upgrade: websocket\r\n"
+                   "Connection: Upgrade\r\n"
+                   "Sec-WebSocket-Version: 13\r\n";
+        writing += "Sec-WebSocket-Key: " + key + "\r\n";
+        for (const auto &header: handshake.headers) {
+            writing += header.first + ": " + header.second + "\r\n";
+        }
+        writing += "\r\n";
+
+        writeInFlight = true;
+        const std::shared_ptr<Derived> self = this->shared_from_this();
+        writeAsync(asio::buffer(writing), [self](const ErrorCode &ec, std::size_t) {
+          self->writeInFlight = false;
+          self->writing.clear();
+          if (ec) {
+              self->finish(ec);
+              return;
+          }
+          self->readBuffer.resize(self->readBufferSize);
+          self->readResponse();
+        });
+    }
+
+    void readResponse() {
+        const std::shared_ptr<Derived> self = this->shared_from_this();
+        readSomeAsync([self](const ErrorCode &ec, std::size_t length) {
+          if (ec) {
+              self->finish(ec);
+              return;
+          }
+          self->readEnd += length;
+          const auto *begin = reinterpret_cast<const char *>(self->readBuffer.data());
+          const char *end = begin + self->readEnd;
+          const char *marker = "\r\n\r\n";
+          const char *found = std::search(begin, end, marker, marker + 4);
+          if (found == end) {
+              if (self->readEnd >= MAX_RESPONSE_HEADER) {
+                  self->finish(asio::error::make_error_code(asio::error::message_size));
+                  return;
+              }
+              if (self->readEnd == self->readBuffer.size()) {
+                  self->readBuffer.resize(self->readBuffer.size() * 2);
+              }
+              self->readResponse();
+              return;
+          }
+          const ErrorCode upgradeError = self->checkResponse(begin, found + 2);
+          if (upgradeError) {
+              self->finish(upgradeError);
+              return;
+          }
+          // frames could come with upgrade response
+          self->readStart = static_cast<std::size_t>(found + 4 - begin);
+          self->onUpgraded();
+        });
+    }
+
+    /// \param begin response
+    /// \param end after last header line
+    /// \return
+    ErrorCode checkResponse(const char *begin, const char *end) {
+        // "HTTP/1.1 101 Switching Protocols"
+        if (end - begin < 12 || std::strncmp(begin + 9, "101", 3) != 0) {
+            return asio::error::make_error_code(asio::error::connection_refused);
+        }
+        bool accepted = false;
+        const char *line = std::find(begin, end, '\n') + 1;
+        while (line < end) {
+            const char *lineEnd = std::find(line, end, '\r');
+            const char *colon = std::find(line, lineEnd, ':');
+            if (colon != lineEnd && detail::equalsIgnoreCase(line, colon, "Sec-WebSocket-Accept")) {
+                const char *value = colon + 1;
+                while (value < lineEnd && *value == ' ') {
+                    value++;
+                }
+                accepted = std::string(value, lineEnd) == accept;
+            }
+            line = lineEnd + 2;
+        }
+        accept.clear();
+        accept.shrink_to_fit();
+        return accepted ? ErrorCode() : boost::system::errc::make_error_code(boost::system::errc::protocol_error);
+    }
+
+    void onUpgraded() {
+        state = State::Open;
+        derived().onOpen();
+        if (state != State::Open) {
+            return;
+        }
+        if (!parseFrames()) {
+            return;
+        }
+        read();
+        write();
+    }
+
+    void read() {
+        const std::shared_ptr<Derived> self = this->shared_from_this();
+        readSomeAsync([self](const ErrorCode &ec, std::size_t length) {
+          if (ec) {
+              self->finish(ec);
+              return;
+          }
+          self->readEnd += length;
+          if (self->parseFrames()) {
+              self->read();
+          }
+        });
+    }
+
+    /// \brief Dispatches complete frames of read buffer and makes room for next read
+    /// \return false if connection is closed
+    bool parseFrames() {
+        FrameView frame;
+        while (state == State::Open || state == State::Closing) {
+            const ParseResult result =
+                parseFrame(readBuffer.data() + readStart, readEnd - readStart, MAX_MESSAGE_SIZE, frame);
+            if (result == ParseResult::Incomplete) {
+                break;
+            }
+            if (result != ParseResult::Complete) {
+                finish(asio::error::make_error_code(result == ParseResult::TooLarge ? asio::error::message_size
+                                                                                    : asio::error::invalid_argument));
+                return false;
+            }
+            readStart += frame.size;
+            dispatch(frame);
+        }
+        if (state == State::Closed) {
+            return false;
+        }
+
+        if (readStart == readEnd) {
+            readStart = readEnd = 0;
+            if (readBuffer.size() > readBufferSize) {
+                // buffer was grown for big frame
+                std::vector<uint8_t>(readBufferSize).swap(readBuffer);
+            }
+        }
+        const std::size_t needed = std::max(frame.size, readBufferSize / 4);
+        if (readBuffer.size() - readStart < needed || readEnd == readBuffer.size()) {
+            std::memmove(readBuffer.data(), readBuffer.data() + readStart, readEnd - readStart);
+            readEnd -= readStart;
+            readStart = 0;
+            if (readBuffer.size() < needed) {
+                readBuffer.resize(needed);
+            }
+        }
+        return true;
+    }
+
+    void dispatch(const FrameView &frame) {
+        switch (frame.opcode()) {
+            case Text:
+            case Binary:
+                if (frame.isFinal()) {
+                    derived().onMessage(frame.opcode(), frame.payload, frame.length);
+                } else {
+                    fragmentsOpcode = frame.opcode();
+                    fragments.assign(frame.payload, frame.length);
+                }
+                return;
+            case Continuation:
+                if (fragments.size() + frame.length > MAX_MESSAGE_SIZE) {
+                    finish(asio::error::make_error_code(asio::error::message_size));
+                    return;
+                }
+                fragments.append(frame.payload, frame.length);
+                if (frame.isFinal()) {
+                    std::string message;
+                    message.swap(fragments);
+                    derived().onMessage(fragmentsOpcode, message.data(), message.size());
+                }
+                return;
+            case Ping:
+                if (state == State::Open) {
+                    writer.append(pending, 0x80u | Pong, frame.payload, frame.length);
+                    write();
+                }
+                return;
+            case Pong:
+                return;
+            case Close:
+                if (state == State::Closing) {
+                    // answer to our close frame
+                    finish(ErrorCode());
+                    return;
+                }
+                // status code is sent back, connection is closed after it's written
+                writer.append(pending, 0x80u | Close, frame.payload, std::min<std::size_t>(frame.length, 2));
+                state = State::Closing;
+                closeReceived = true;
+                write();
+                return;
+            default:
+                finish(asio::error::make_error_code(asio::error::invalid_argument));
+                return;
+        }
+    }
+
+    void write() {
+        if (writeInFlight || pending.empty() || (state != State::Open && state != State::Closing)) {
+            return;
+        }
+        writing.swap(pending);
+        writeInFlight = true;
+        const std::shared_ptr<Derived> self = this->shared_from_this();
+        writeAsync(asio::buffer(writing), [self](const ErrorCode &ec, std::size_t) {
+          self->writeInFlight = false;
+          if (self->writing.capacity() > WRITE_BUFFER_KEEP) {
+              // burst is over, idle connection does not keep its buffer
+              std::string().swap(self->writing);
+          } else {
+              self->writing.clear();
+          }
+          if (ec) {
+              self->finish(ec);
+              return;
+          }
+          if (self->closeReceived && self->pending.empty()) {
+              self->finish(ErrorCode());
+              return;
+          }
+          self->write();
+        });
+    }
+
+    void finish(const ErrorCode &ec) {
+        if (state == State::Closed) {
+            return;
+        }
+        const bool wasOpen = state == State::Open || state == State::Closing;
+        state = State::Closed;
+        ErrorCode ignored;
+        tcpSocket().close(ignored);
+        std::string().swap(pending);
+        std::string().swap(fragments);
+        std::vector<uint8_t>().swap(readBuffer);
+        readStart = readEnd = 0;
+        derived().onClose(ec, wasOpen);
+    }
+};
+
+/// \brief Connection with std::function handlers, for code which does not subclass Connection
+class Client : public Connection<Client> {
+ public:
+    using OpenHandler = std::function<void(Client &)>;
+    using MessageHandler = std::function<void(Client &, uint8_t opcode, const char *data, std::size_t length)>;
+    using CloseHandler = std::function<void(Client &, const ErrorCode &ec, bool wasOpen)>;
+
+    explicit Client(asio::io_service &service, asio::ssl::context *tlsContext = nullptr) :
+        Connection<Client>(service, tlsContext) { }
+
+    OpenHandler openHandler;
+    MessageHandler messageHandler;
+    CloseHandler closeHandler;
+
+    void onOpen() {
+        if (openHandler) {
+            openHandler(*this);
+        }
+    }
+
+    void onMessage(uint8_t opcode, const char *data, std::size_t length) {
+        if (messageHandler) {
+            messageHandler(*this, opcode, data, length);
+        }
+    }
+
+    void onClose(const ErrorCode &ec, bool wasOpen) {
+        if (closeHandler) {
+            closeHandler(*this, ec, wasOpen);
+        }
+    }
+};
+
+}
+}
+
+#endif //WSSERVER_CLIENT_CONNECTION_HPP
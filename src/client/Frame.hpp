@@ -0,0 +1,201 @@
+/**
+ * wsserver
+ * Frame.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_CLIENT_FRAME_HPP
+#define WSSERVER_CLIENT_FRAME_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <string>
+#include "../helpers/unmask.hpp"
+
+namespace wss {
+namespace client {
+
+/// \brief Frame opcodes, RFC 6455 5.2
+enum Opcode : uint8_t {
+  Continuation = 0x0,
+  Text = 0x1,
+  Binary = 0x2,
+  Close = 0x8,
+  Ping = 0x9,
+  Pong = 0xA
+};
+
+/// \brief Header length of frame with payload of length bytes: 2, 4 or 10, and 4 more for mask
+inline std::size_t frameHeaderSize(std::size_t length, bool masked) noexcept {
+    const std::size_t header = length < 126 ? 2 : (length <= 0xFFFF ? 4 : 10);
+    return masked ? header + 4 : header;
+}
+
+/// \brief Encodes masked client frames right into caller's buffer: one resize of it and one pass over payload,
+/// which is copied and masked at once by wss::utils::unmask (vectorized, as server unmasking).
+/// Masking keys are xorshift sequence seeded from std::random_device, not cryptographically strong: enough for
+/// non-browser clients, which are not the ones masking protects proxies from
+class FrameWriter {
+ public:
+    FrameWriter() :
+        state(seed()) { }
+
+    explicit FrameWriter(uint64_t seed) :
+        state(seed | 1u) { }
+
+    /// \brief Appends whole frame to out
+    /// \param out batch of frames
+    /// \param finRsvOpcode 0x80 | opcode for not fragmented frame
+    /// \param payload
+    /// \param length
+    void append(std::string &out, uint8_t finRsvOpcode, const char *payload, std::size_t length) {
+        const std::size_t header = frameHeaderSize(length, true);
+        const std::size_t offset = out.size();
+        out.resize(offset + header + length);
+        auto *frame = reinterpret_cast<uint8_t *>(&out[offset]);
+
+        std::size_t position = 0;
+        frame[position++] = finRsvOpcode;
+        if (length < 126) {
+            frame[position++] = static_cast<uint8_t>(0x80u | length);
+        } else if (length <= 0xFFFF) {
+            frame[position++] = 0x80u | 126u;
+            frame[position++] = static_cast<uint8_t>(length >> 8);
+            frame[position++] = static_cast<uint8_t>(length & 0xFF);
+        } else {
+            frame[position++] = 0x80u | 127u;
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                frame[position++] = static_cast<uint8_t>((static_cast<uint64_t>(length) >> shift) & 0xFF);
+            }
+        }
+        const uint32_t key = nextKey();
+        uint8_t mask[4];
+        std::memcpy(mask, &key, sizeof(mask));
+        std::memcpy(frame + position, mask, sizeof(mask));
+        position += sizeof(mask);
+        if (length > 0) {
+            wss::utils::unmask(frame + position, reinterpret_cast<const uint8_t *>(payload), length, mask);
+        }
+    }
+
+    /// \brief Random bytes of the same sequence, e.g. for Sec-WebSocket-Key
+    void fill(uint8_t *out, std::size_t length) noexcept {
+        for (std::size_t i = 0; i < length; i += 4) {
+            const uint32_t value = nextKey();
+            std::memcpy(out + i, &value, std::min<std::size_t>(4, length - i));
+        }
+    }
+
+ private:
+    uint64_t state;
+
+    /// \brief One random_device read per thread, not per connection: opening many connections stays cheap
+    static uint64_t seed() {
+        thread_local std::mt19937_64 seeds((static_cast<uint64_t>(std::random_device()()) << 32u)
+                                               ^ std::random_device()());
+        return seeds() | 1u;
+    }
+
+    uint32_t nextKey() noexcept {
+        state ^= state << 13u;
+        state ^= state >> 7u;
+        state ^= state << 17u;
+        return static_cast<uint32_t>(state >> 16u);
+    }
+};
+
+/// \brief Frame parsed in place by parseFrame(), payload points into parsed buffer
+struct FrameView {
+  uint8_t finRsvOpcode = 0;
+  const char *payload = nullptr;
+  std::size_t length = 0;
+  /// \brief Whole frame: header and payload. If frame is incomplete, bytes needed for it (0 - header is not read)
+  std::size_t size = 0;
+
+  bool isFinal() const noexcept {
+      return (finRsvOpcode & 0x80u) != 0;
+  }
+  uint8_t opcode() const noexcept {
+      return finRsvOpcode & 0x0Fu;
+  }
+  bool isControl() const noexcept {
+      return (finRsvOpcode & 0x08u) != 0;
+  }
+};
+
+enum class ParseResult {
+  Incomplete,
+  Complete,
+  /// \brief Payload is bigger than limit
+  TooLarge,
+  /// \brief Control frame is fragmented or longer than 125 bytes
+  Invalid
+};
+
+/// \brief Parses one frame from the beginning of contiguous buffer, without copying it. Server frames are not
+/// masked, masked ones are accepted too: payload is unmasked in place
+/// \param data
+/// \param available bytes in data
+/// \param maxPayload
+/// \param out frame, or bytes needed for incomplete one in size
+/// \return
+inline ParseResult parseFrame(uint8_t *data, std::size_t available, std::size_t maxPayload, FrameView &out) noexcept {
+    out.size = 0;
+    if (available < 2) {
+        return ParseResult::Incomplete;
+    }
+    const bool masked = (data[1] & 0x80u) != 0;
+    uint64_t length = data[1] & 0x7Fu;
+    std::size_t header = 2;
+    if (length == 126) {
+        if (available < 4) {
+            return ParseResult::Incomplete;
+        }
+        length = (static_cast<uint64_t>(data[2]) << 8) | data[3];
+        header = 4;
+    } else if (length == 127) {
+        if (available < 10) {
+            return ParseResult::Incomplete;
+        }
+        length = 0;
+        for (std::size_t i = 2; i < 10; i++) {
+            length = (length << 8) | data[i];
+        }
+        header = 10;
+    }
+    out.finRsvOpcode = data[0];
+    if (out.isControl() && (!out.isFinal() || length > 125)) {
+        return ParseResult::Invalid;
+    }
+    if (length > maxPayload) {
+        return ParseResult::TooLarge;
+    }
+    const std::size_t maskOffset = header;
+    if (masked) {
+        header += 4;
+    }
+    out.length = static_cast<std::size_t>(length);
+    out.size = header + out.length;
+    if (available < out.size) {
+        return ParseResult::Incomplete;
+    }
+
+    uint8_t *payload = data + header;
+    if (masked && out.length > 0) {
+        uint8_t mask[4];
+        std::memcpy(mask, data + maskOffset, sizeof(mask));
+        wss::utils::unmask(payload, payload, out.length, mask);
+    }
+    out.payload = reinterpret_cast<const char *>(payload);
+    return ParseResult::Complete;
+}
+
+}
+}
+
+#endif //WSSERVER_CLIENT_FRAME_HPP
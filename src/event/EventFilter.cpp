@@ -0,0 +1,219 @@
+/**
+ * wsserver
+ * EventFilter.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "EventFilter.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+/// \brief "a.b.c" -> {a, b, c}
+std::vector<std::string> splitPath(const std::string &path) {
+    std::vector<std::string> out;
+    std::size_t start = 0;
+    while (true) {
+        const std::size_t dot = path.find('.', start);
+        out.push_back(path.substr(start, dot == std::string::npos ? std::string::npos : dot - start));
+        if (out.back().empty()) {
+            throw std::invalid_argument("Empty data field name in path: " + path);
+        }
+        if (dot == std::string::npos) {
+            return out;
+        }
+        start = dot + 1;
+    }
+}
+
+/// \return nullptr if field is missing
+const nlohmann::json *findField(const nlohmann::json &data, const std::vector<std::string> &path) {
+    const nlohmann::json *value = &data;
+    for (const std::string &key: path) {
+        if (!value->is_object()) {
+            return nullptr;
+        }
+        const auto it = value->find(key);
+        if (it == value->end()) {
+            return nullptr;
+        }
+        value = &*it;
+    }
+    return value;
+}
+
+std::vector<wss::user_id_t> toUsers(const nlohmann::json &list, const std::string &name) {
+    if (!list.is_array()) {
+        throw std::invalid_argument("Filter " + name + " must be an array of user ids");
+    }
+    std::vector<wss::user_id_t> out;
+    out.reserve(list.size());
+    for (const auto &item: list) {
+        out.push_back(item.get<wss::user_id_t>());
+    }
+    std::sort(out.begin(), out.end());
+    return out;
+}
+}
+
+wss::event::EventFilter::EventFilter(const nlohmann::json &config) :
+    m_root(compile(config)) {
+}
+
+wss::event::EventFilter::Node wss::event::EventFilter::compile(const nlohmann::json &config) {
+    if (!config.is_object()) {
+        throw std::invalid_argument("Filter must be an object");
+    }
+
+    Node node;
+    node.type = Type::All;
+    for (auto &item: config.items()) {
+        const std::string &key = item.key();
+        const nlohmann::json &value = item.value();
+        if (key == "types") {
+            if (!value.is_array()) {
+                throw std::invalid_argument("Filter types must be an array of type names");
+            }
+            Node types;
+            types.type = Type::Types;
+            types.types = wss::types::compile(value.get<std::vector<std::string>>());
+            node.children.push_back(std::move(types));
+        } else if (key == "senders" || key == "recipients") {
+            Node users;
+            users.type = key == "senders" ? Type::Senders : Type::Recipients;
+            users.users = toUsers(value, key);
+            node.children.push_back(std::move(users));
+        } else if (key == "data") {
+            if (!value.is_object()) {
+                throw std::invalid_argument("Filter data must be an object of field paths and values");
+            }
+            for (auto &field: value.items()) {
+                Node data;
+                data.type = Type::Data;
+                data.field = splitPath(field.key());
+                if (field.value().is_array()) {
+                    data.values.assign(field.value().begin(), field.value().end());
+                } else {
+                    data.values.push_back(field.value());
+                }
+                node.children.push_back(std::move(data));
+            }
+        } else if (key == "any") {
+            if (!value.is_array() || value.empty()) {
+                throw std::invalid_argument("Filter any must be a non-empty array of filters");
+            }
+            Node any;
+            any.type = Type::Any;
+            for (const auto &child: value) {
+                any.children.push_back(compile(child));
+            }
+            node.children.push_back(std::move(any));
+        } else if (key == "not") {
+            Node negation;
+            negation.type = Type::Not;
+            negation.children.push_back(compile(value));
+            node.children.push_back(std::move(negation));
+        } else {
+            throw std::invalid_argument("Unknown filter field: " + key);
+        }
+    }
+
+    // cheap conditions first: data is parsed only if they have matched
+    const auto cost = [](const Node &n) {
+      switch (n.type) {
+          case Type::Types:
+          case Type::Senders:
+          case Type::Recipients: return 0;
+          case Type::Data: return 2;
+          default: return 1;
+      }
+    };
+    std::stable_sort(node.children.begin(), node.children.end(), [&cost](const Node &lhs, const Node &rhs) {
+      return cost(lhs) < cost(rhs);
+    });
+    return node;
+}
+
+bool wss::event::EventFilter::matches(const wss::MessagePayload &payload) const {
+    nlohmann::json data;
+    bool parsed = false;
+    return evaluate(m_root, payload, data, parsed);
+}
+
+bool wss::event::EventFilter::evaluate(const Node &node,
+                                       const wss::MessagePayload &payload,
+                                       nlohmann::json &data,
+                                       bool &parsed) const {
+    switch (node.type) {
+        case Type::All:
+            for (const Node &child: node.children) {
+                if (!evaluate(child, payload, data, parsed)) {
+                    return false;
+                }
+            }
+            return true;
+        case Type::Any:
+            for (const Node &child: node.children) {
+                if (evaluate(child, payload, data, parsed)) {
+                    return true;
+                }
+            }
+            return false;
+        case Type::Not:
+            return !evaluate(node.children[0], payload, data, parsed);
+        case Type::Types:
+            return node.types[payload.getTypeId()];
+        case Type::Senders:
+            return std::binary_search(node.users.begin(), node.users.end(), payload.getSender());
+        case Type::Recipients:
+            for (wss::user_id_t recipient: payload.getRecipients()) {
+                if (std::binary_search(node.users.begin(), node.users.end(), recipient)) {
+                    return true;
+                }
+            }
+            return false;
+        case Type::Data: {
+            if (!parsed) {
+                data = payload.getData();
+                parsed = true;
+            }
+            const nlohmann::json *value = findField(data, node.field);
+            return value != nullptr && std::find(node.values.begin(), node.values.end(), *value) != node.values.end();
+        }
+    }
+    return false;
+}
+
+wss::event::EventProjection::EventProjection(const nlohmann::json &fields) {
+    if (!fields.is_array() || fields.empty()) {
+        throw std::invalid_argument("Projection must be a non-empty array of data field paths");
+    }
+    for (const auto &field: fields) {
+        if (!field.is_string()) {
+            throw std::invalid_argument("Projection must be a non-empty array of data field paths");
+        }
+        m_fields.push_back(splitPath(field.get<std::string>()));
+    }
+}
+
+wss::MessagePayloadPtr wss::event::EventProjection::apply(const wss::MessagePayloadPtr &payload) const {
+    const nlohmann::json data = payload->getData();
+    nlohmann::json projected = nlohmann::json::object();
+    for (const auto &path: m_fields) {
+        const nlohmann::json *value = findField(data, path);
+        if (value == nullptr) {
+            continue;
+        }
+        nlohmann::json *target = &projected;
+        for (std::size_t i = 0; i + 1 < path.size(); i++) {
+            target = &(*target)[path[i]];
+        }
+        (*target)[path.back()] = *value;
+    }
+
+    wss::MessagePayload out = *payload;
+    out.setData(projected);
+    return std::make_shared<const wss::MessagePayload>(std::move(out));
+}
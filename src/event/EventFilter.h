@@ -0,0 +1,87 @@
+/**
+ * wsserver
+ * EventFilter.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_EVENTFILTER_H
+#define WSSERVER_EVENTFILTER_H
+
+#include <string>
+#include <vector>
+#include "json.hpp"
+#include "../chat/Message.h"
+#include "../chat/MessageType.h"
+
+namespace wss {
+namespace event {
+
+/// \brief Target "filter": predicate tree compiled once on config load, evaluated before event is queued for target.
+/// Fields of one object must all match:
+///     "types": ["text", ...] - any of types, one bit test
+///     "senders": [1, 2] - any of senders
+///     "recipients": [5, 6] - any recipient of event is in list
+///     "data": {"kind": "order", "order.status": ["paid", "shipped"]} - data field (dot separated path) equals value,
+///         array - any of values. Data is parsed once per event and only if other conditions matched
+///     "any": [{...}, {...}] - at least one of filters matches
+///     "not": {...} - filter doesn't match
+class EventFilter {
+ public:
+    /// \param config filter object
+    /// \throws std::invalid_argument if filter is not valid
+    explicit EventFilter(const nlohmann::json &config);
+
+    bool matches(const wss::MessagePayload &payload) const;
+
+ private:
+    enum class Type {
+      All,
+      Any,
+      Not,
+      Types,
+      Senders,
+      Recipients,
+      Data
+    };
+
+    struct Node {
+      Type type = Type::All;
+      wss::types::TypeSet types;
+      /// \brief Sorted
+      std::vector<wss::user_id_t> users;
+      /// \brief Data field path
+      std::vector<std::string> field;
+      std::vector<nlohmann::json> values;
+      std::vector<Node> children;
+    };
+
+    Node m_root;
+
+    static Node compile(const nlohmann::json &config);
+    /// \param data parsed by first data condition
+    /// \param parsed
+    bool evaluate(const Node &node, const wss::MessagePayload &payload, nlohmann::json &data, bool &parsed) const;
+};
+
+/// \brief Target "projection": only listed data fields (dot separated paths) are sent to target
+class EventProjection {
+ public:
+    /// \param fields array of paths
+    /// \throws std::invalid_argument if fields are not array of strings
+    explicit EventProjection(const nlohmann::json &fields);
+
+    /// \brief Copy of payload with projected data. Missing fields are skipped
+    /// \param payload
+    /// \return
+    wss::MessagePayloadPtr apply(const wss::MessagePayloadPtr &payload) const;
+
+ private:
+    std::vector<std::vector<std::string>> m_fields;
+};
+
+}
+}
+
+#endif //WSSERVER_EVENTFILTER_H
@@ -8,10 +8,39 @@
 
 #include "EventNotifier.h"
 #include "../base/Settings.hpp"
+#include "../helpers/logging.h"
+#include "../base/Tracing.h"
+#include "../base/Metrics.h"
+#include "../base/Affinity.h"
 
 #ifdef ENABLE_REDIS_TARGET
 #include "RedisTarget.h"
 #endif
+#ifdef ENABLE_KAFKA_TARGET
+#include "KafkaTarget.h"
+#endif
+
+namespace {
+
+/// \brief Records target send span, parented to message root span
+void traceSend(const wss::tracing::SpanContext &span,
+               const wss::event::EventNotifier::SendStatus &status,
+               std::chrono::steady_clock::time_point start,
+               std::chrono::steady_clock::time_point end) {
+    wss::tracing::record("event.send", span, start, end, {
+        {"event.target", status.target->getType()},
+        {"event.try", std::to_string(status.sendTries)},
+        {"error", status.hasSent ? std::string() : status.sendResult}
+    }, !status.hasSent);
+}
+
+/// \brief Accounted bytes of queued event: payload json is shared by all targets, but each queue keeps it alive,
+/// so it is counted by every queued status. Json is cached by payload and is used by targets anyway
+std::size_t queuedBytes(const wss::event::EventNotifier::SendStatus &status) {
+    return sizeof(status) + (status.payload ? status.payload->toJson().size() : 0);
+}
+
+}
 
 wss::event::EventNotifier::EventNotifier(std::shared_ptr<wss::ChatServer> &ws) :
     m_keepGoing(true),
@@ -19,20 +48,67 @@ wss::event::EventNotifier::EventNotifier(std::shared_ptr<wss::ChatServer> &ws) :
     m_ws(ws),
     m_enableRetry(wss::Settings::get().event.enableRetry),
     m_maxParallelWorkers(wss::Settings::get().event.maxParallelWorkers),
-    m_maxRetries(3),
-    m_retryIntervalSeconds(10),
-    m_ioService(),
-    m_threadGroup(),
-    m_work(m_ioService) { }
+    m_maxRetries(wss::Settings::get().event.retryCount) {
+    const auto &settings = wss::Settings::get().event;
+    m_retryPolicy.interval = std::chrono::seconds(settings.retryIntervalSeconds);
+    m_retryPolicy.maxInterval = std::chrono::seconds(settings.retryMaxIntervalSeconds);
+    m_retryPolicy.multiplier = settings.retryBackoffMultiplier;
+    m_retryPolicy.jitter = settings.retryJitter;
+}
 
 wss::event::EventNotifier::~EventNotifier() {
-    m_keepGoing = false;
-    m_readCondition.notify_one();
     onStop();
 }
 
 void wss::event::EventNotifier::setRetryIntervalSeconds(int seconds) {
-    m_retryIntervalSeconds = seconds;
+    RetryPolicy policy = getRetryPolicy();
+    policy.interval = std::chrono::seconds(seconds);
+    setRetryPolicy(policy);
+}
+void wss::event::EventNotifier::setRetryPolicy(const RetryPolicy &policy) {
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    m_retryPolicy = policy;
+    for (auto &lane: m_lanes) {
+        lane->retryPolicy = lane->target->getRetryPolicy(policy);
+    }
+}
+wss::event::RetryPolicy wss::event::EventNotifier::getRetryPolicy() const {
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    return m_retryPolicy;
+}
+
+void wss::event::EventNotifier::setMaxParallelWorkers(uint32_t workers) {
+    workers = std::max(workers, (uint32_t) 1);
+    std::lock_guard<std::mutex> locker(m_workersMutex);
+    m_maxParallelWorkers = workers;
+    if (!m_started || !m_keepGoing) {
+        return;
+    }
+
+    // lanes are not changed after start, only their limits
+    const auto targets = static_cast<uint32_t>(std::max(m_targets.size(), (std::size_t) 1));
+    const uint32_t share = std::max(workers / targets, (uint32_t) 1);
+    for (auto &lane: m_lanes) {
+        if (lane->ownLimit) {
+            continue;
+        }
+        lane->maxInFlight = share;
+        if (lane->target->getLatencyTarget().count() > 0) {
+            // adaptive limit grows to new maximum by itself
+            lane->limit = std::min<uint32_t>(lane->limit, share);
+        } else {
+            lane->limit = share;
+        }
+    }
+    startWorkers();
+    m_metrics.workers = workers;
+    L_INFO_F("EventNotifier", "Workers pool is resized to %u", workers);
+    {
+        // idle extra workers wake up to retire, others look for work of raised limits
+        std::lock_guard<std::mutex> lock(m_readMutex);
+        m_signal++;
+    }
+    m_readCondition.notify_all();
 }
 
 std::shared_ptr<wss::event::Target> wss::event::EventNotifier::createTargetByConfig(const nlohmann::json &json) {
@@ -49,11 +125,18 @@ std::shared_ptr<wss::event::Target> wss::event::EventNotifier::createTargetByCon
 
     if (eq(type, "postback")) {
         out = std::make_shared<wss::event::PostbackTarget>(json);
+    } else if (eq(type, "stream")) {
+        out = std::make_shared<wss::event::StreamTarget>(json);
     } else
         //@TODO shared modules and target map in config, instead of hardcode
         #ifdef ENABLE_REDIS_TARGET
     if (eq(type, "redis")) {
         out = std::make_shared<wss::event::RedisTarget>(json);
+    } else
+        #endif
+        #ifdef ENABLE_KAFKA_TARGET
+    if (eq(type, "kafka")) {
+        out = std::make_shared<wss::event::KafkaTarget>(json);
     } else
         #endif
     {
@@ -95,19 +178,62 @@ void wss::event::EventNotifier::addTarget(std::shared_ptr<wss::event::Target> &&
 }
 
 void wss::event::EventNotifier::subscribe() {
-    for (int i = 0; i < 4; i++) {
-        m_threadGroup.create_thread(
-            boost::bind(&boost::asio::io_service::run, &m_ioService)
-        );
+    const uint32_t workers = std::max(m_maxParallelWorkers.load(), (uint32_t) 1);
+    // by default every target gets equal share of workers
+    const auto targets = static_cast<uint32_t>(std::max(m_targets.size(), (std::size_t) 1));
+    for (const auto &target: m_targets) {
+        createLane(target.second, std::max(workers / targets, (uint32_t) 1));
+    }
+    {
+        std::lock_guard<std::mutex> locker(m_workersMutex);
+        m_maxParallelWorkers = workers;
+        startWorkers();
+        m_started = true;
+    }
+    m_metrics.workers = workers;
+    if (m_outbox) {
+        // workers drain queues meanwhile; recovered events are not limited by queue capacity: all of them are on disk
+        const std::size_t replayed = m_outbox->replay([this](wss::MessagePayload &&payload,
+                                                             EventOutbox::TicketPtr ticket) {
+          addMessage(std::make_shared<const wss::MessagePayload>(std::move(payload)), ticket, false);
+        });
+        if (replayed > 0) {
+            L_INFO_F("EventNotifier", "Replaying %lu event(s) from outbox", replayed);
+        }
     }
 
     m_ws->addMessageListener(std::bind(&EventNotifier::onMessage, this, std::placeholders::_1));
     m_ws->addStopListener(std::bind(&EventNotifier::onStop, this));
     addErrorListener(std::bind(&EventNotifier::onErrorSending, this, std::placeholders::_1));
-    m_ioService.post(boost::bind(&EventNotifier::handleMessageQueue, this));
 }
 void wss::event::EventNotifier::joinThreads() {
-    m_threadGroup.join_all();
+    // pool may grow meanwhile, so workers are taken one by one
+    for (std::size_t i = 0;; i++) {
+        boost::thread *worker;
+        {
+            std::lock_guard<std::mutex> locker(m_workersMutex);
+            if (i >= m_workers.size()) {
+                break;
+            }
+            worker = m_workers[i].get();
+        }
+        worker->join();
+    }
+}
+void wss::event::EventNotifier::startWorkers() {
+    while (m_runningWorkers < m_maxParallelWorkers) {
+        m_runningWorkers++;
+        m_workers.push_back(std::make_unique<boost::thread>(boost::bind(&EventNotifier::workerLoop, this)));
+    }
+}
+bool wss::event::EventNotifier::retireWorker() {
+    uint32_t running = m_runningWorkers;
+    while (running > m_maxParallelWorkers) {
+        if (m_runningWorkers.compare_exchange_weak(running, running - 1)) {
+            return true;
+        }
+    }
+    return false;
 }
 void wss::event::EventNotifier::detachThreads() {
 
@@ -126,118 +252,504 @@ void wss::event::EventNotifier::stopService() {
     onStop();
 }
 void wss::event::EventNotifier::onStop() {
-    m_ioService.stop();
-    m_keepGoing = false;
-    m_threadGroup.interrupt_all();
+    {
+        std::lock_guard<std::mutex> lock(m_readMutex);
+        m_keepGoing = false;
+    }
+    m_readCondition.notify_all();
+    {
+        std::lock_guard<std::mutex> locker(m_workersMutex);
+        for (auto &worker: m_workers) {
+            worker->interrupt();
+        }
+    }
+    if (m_outbox) {
+        // queued events are kept for next start
+        m_outbox->close();
+    }
 }
 
-void wss::event::EventNotifier::handleMessageQueue() {
-    std::unique_lock<std::mutex> lock(m_readMutex);
-    const auto &ready = [this](SendStatus status) {
-      if (!m_enableRetry) return true;
-
-      const long diff = abs(std::time(nullptr) - status.sendTime);
-      return diff >= m_retryIntervalSeconds;
-    };
+wss::event::EventNotifier::Lane::Lane(std::shared_ptr<Target> target,
+                                      uint32_t maxInFlight,
+                                      bool ownLimit,
+                                      const RetryPolicy &retryPolicy) :
+    target(std::move(target)),
+    retryPolicy(retryPolicy),
+    limit(maxInFlight),
+    maxInFlight(maxInFlight),
+    ownLimit(ownLimit) {
+}
 
-    while (m_keepGoing) {
-        // @TODO play around this time, check performance and cpu consumption
+void wss::event::EventNotifier::createLane(const std::shared_ptr<Target> &target, uint32_t maxInFlight) {
+    if (m_laneByTarget.find(target.get()) != m_laneByTarget.end()) {
+        return;
+    }
+    const bool ownLimit = target->getMaxInFlight() > 0;
+    const uint32_t limit = ownLimit ? target->getMaxInFlight() : maxInFlight;
+    m_lanes.push_back(std::make_unique<Lane>(target, limit, ownLimit, target->getRetryPolicy(getRetryPolicy())));
+    m_laneByTarget[target.get()] = m_lanes.back().get();
+    for (const auto &fallback: target->getFallbacks()) {
+        createLane(fallback, maxInFlight);
+    }
+}
 
-        m_readCondition.wait_for(lock, std::chrono::seconds(m_retryIntervalSeconds));
+void wss::event::EventNotifier::workerLoop() {
+    wss::affinity::pin(wss::affinity::Group::Events);
+    SendStatus status;
+    std::vector<SendStatus> batch;
+    while (m_keepGoing && !retireWorker()) {
+        const uint64_t signal = m_signal;
+        Lane *lane = nullptr;
+        std::chrono::steady_clock::time_point wakeup;
+        bool hasWakeup = false;
+        if (!takeFresh(lane, status) && !takeDelayed(lane, status, batch, wakeup, hasWakeup)) {
+            waitForWork(signal, wakeup, hasWakeup);
+            continue;
+        }
 
-        std::vector<SendStatus> bulk;
+        if (batch.empty() && lane->target->getBatchSize() > 1 && !collect(*lane, std::move(status), batch)) {
+            // batch is not complete yet
+            releaseSlot(*lane);
+            continue;
+        }
 
-        try {
-            size_t extract;
-            const size_t approxSize = m_sendQueue.size_approx();
-            if (approxSize > m_maxParallelWorkers) {
-                // maximum connections per cycle
-                extract = m_maxParallelWorkers;
+        bool probe = false;
+        if (!allowSend(*lane, probe)) {
+            if (batch.empty()) {
+                shortCircuit(*lane, std::move(status));
             } else {
-                extract = approxSize;
+                for (auto &item: batch) {
+                    shortCircuit(*lane, std::move(item));
+                }
+                batch.clear();
+            }
+            releaseSlot(*lane);
+            continue;
+        }
+
+        m_metrics.busyWorkers++;
+        const auto started = std::chrono::steady_clock::now();
+        bool success;
+        if (batch.empty()) {
+            const wss::tracing::SpanContext span = status.payload->getTrace().sampled
+                                                   ? wss::tracing::child(status.payload->getTrace())
+                                                   : wss::tracing::SpanContext();
+            {
+                // postback passes span to receiver in traceparent header
+                wss::tracing::ScopedSpan scope(span);
+                status.hasSent = status.target->send(*status.payload, status.sendResult);
             }
+            if (span.sampled) {
+                traceSend(span, status, started, std::chrono::steady_clock::now());
+            }
+            success = status.hasSent;
+            onSendResult(*lane, success, std::chrono::steady_clock::now() - started, probe);
+            complete(std::move(status));
+        } else {
+            success = dispatchBatch(batch);
+            onSendResult(*lane, success, std::chrono::steady_clock::now() - started, probe);
+            batch.clear();
+        }
+        m_metrics.busyWorkers--;
+        releaseSlot(*lane);
+    }
+}
+
+bool wss::event::EventNotifier::reserveSlot(Lane &lane) {
+    if (lane.inFlight.fetch_add(1) >= lane.limit) {
+        lane.inFlight--;
+        return false;
+    }
+    return true;
+}
+void wss::event::EventNotifier::releaseSlot(Lane &lane) {
+    if (lane.inFlight.fetch_sub(1) == lane.limit) {
+        // other workers skipped this target
+        signal();
+    }
+}
 
-            bulk.resize(extract);
-            m_sendQueue.try_dequeue_bulk(bulk.begin(), bulk.size());
-        } catch (const std::exception &e) {
-            L_DEBUG_F("Event::Send", "Can't dequeue bulk: %s", e.what());
+bool wss::event::EventNotifier::takeFresh(Lane *&lane, SendStatus &status) {
+    const std::size_t count = m_lanes.size();
+    const std::size_t start = m_nextLane++;
+    for (std::size_t i = 0; i < count; i++) {
+        Lane &candidate = *m_lanes[(start + i) % count];
+        if (candidate.queued == 0 || !reserveSlot(candidate)) {
             continue;
         }
+        if (candidate.queue.try_dequeue(status)) {
+            candidate.queued--;
+            m_metrics.queued--;
+            wss::metrics::release(wss::metrics::Memory::EventQueue, queuedBytes(status));
+            lane = &candidate;
+            return true;
+        }
+        candidate.inFlight--;
+    }
+    return false;
+}
+
+bool wss::event::EventNotifier::takeDelayed(Lane *&lane,
+                                            SendStatus &status,
+                                            std::vector<SendStatus> &batch,
+                                            std::chrono::steady_clock::time_point &wakeup,
+                                            bool &hasWakeup) {
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    const auto now = std::chrono::steady_clock::now();
+    const auto &setWakeup = [&wakeup, &hasWakeup](std::chrono::steady_clock::time_point time) {
+      if (!hasWakeup || time < wakeup) {
+          wakeup = time;
+          hasWakeup = true;
+      }
+    };
 
-        int i = 0;
-        for (auto it: bulk) {
-            if (!ready(it)) {
-                m_sendQueue.enqueue(std::move(it));
+    for (const auto &item: m_lanes) {
+        Lane &candidate = *item;
+        const bool hasRetry = !candidate.retries.empty();
+        const bool hasBatch = !candidate.batch.items.empty();
+        if (!hasRetry && !hasBatch) {
+            continue;
+        }
+        if (candidate.inFlight >= candidate.limit) {
+            // woken by releaseSlot()
+            continue;
+        }
+        if (hasRetry && candidate.retries.front().due <= now) {
+            if (!reserveSlot(candidate)) {
+                continue;
+            }
+            std::pop_heap(candidate.retries.begin(), candidate.retries.end(), RetryLater());
+            status = std::move(candidate.retries.back().status);
+            candidate.retries.pop_back();
+            m_metrics.delayed--;
+            lane = &candidate;
+            return true;
+        }
+        if (hasBatch && candidate.batch.deadline <= now) {
+            if (!reserveSlot(candidate)) {
                 continue;
             }
+            batch.swap(candidate.batch.items);
+            m_metrics.batching -= batch.size();
+            lane = &candidate;
+            return true;
+        }
+        if (hasRetry) {
+            setWakeup(candidate.retries.front().due);
+        }
+        if (hasBatch) {
+            setWakeup(candidate.batch.deadline);
+        }
+    }
+    return false;
+}
 
-            auto sender = boost::thread([this, s = std::move(it)]() {
-              SendStatus status = s;
-              status.hasSent = status.target->send(status.payload, status.sendResult);
-              if (m_enableRetry && !status.hasSent) {
-                  Logger::get().debug(__FILE__,
-                                      __LINE__,
-                                      "Event::Send",
-                                      fmt::format("Can't send message to target {0}: {1}",
-                                                  status.target->getType(),
-                                                  status.sendResult));
-
-                  m_readCondition.notify_one();
-
-                  // if tries < maxRetries
-                  if (status.sendTries < m_maxRetries) {
-                      status.sendTries++;
-                      status.sendTime = std::time(nullptr);
-                      m_sendQueue.enqueue(status);
-                  } else {
-                      // can't send over maxTries times
-                      // notify listeners
-                      for (auto &listener: m_sendErrorListeners) {
-                          listener(std::move(status));
-                      }
-                  }
-              } else {
-                  Logger::get().debug(__FILE__,
-                                      __LINE__,
-                                      "Event::Send",
-                                      fmt::format("Message has sent to target: {0}", status.target->getType()));
-              }
-            });
-            // we don't need to join this thread back, we just need to send, and if not, re-enqueue payload
-            sender.detach();
-
-            i++;
-        }
-
-        bulk.clear();
-        if (i > 0) {
-            L_DEBUG_F("Event::Send", "Prepared %d messages", i);
-        }
-    }
-}
-void wss::event::EventNotifier::addMessage(wss::MessagePayload payload) {
-    for (auto &target: m_targets) {
-        m_sendQueue.enqueue(SendStatus(target.second, payload, 0L, 1));
+void wss::event::EventNotifier::waitForWork(uint64_t signal,
+                                            std::chrono::steady_clock::time_point wakeup,
+                                            bool hasWakeup) {
+    std::unique_lock<std::mutex> lock(m_readMutex);
+    m_idleWorkers++;
+    // signal() seen no idle workers, but changed counter
+    if (m_keepGoing && m_signal == signal) {
+        if (hasWakeup) {
+            m_readCondition.wait_until(lock, wakeup);
+        } else {
+            m_readCondition.wait(lock);
+        }
+    }
+    m_idleWorkers--;
+}
+
+void wss::event::EventNotifier::signal() {
+    m_signal++;
+    if (m_idleWorkers > 0) {
+        std::lock_guard<std::mutex> lock(m_readMutex);
         m_readCondition.notify_one();
     }
 }
 
-void wss::event::EventNotifier::onMessage(wss::MessagePayload &&payload) {
-    if (payload.isFromBot() && not wss::Settings::get().event.sendBotMessages) {
-        L_DEBUG("Event::Enqueue", "Skipping Bot message (sender=0)");
+bool wss::event::EventNotifier::collect(Lane &lane, SendStatus &&status, std::vector<SendStatus> &batch) {
+    const std::size_t batchSize = lane.target->getBatchSize();
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    Batch &pending = lane.batch;
+    const bool first = pending.items.empty();
+    if (first) {
+        pending.deadline = std::chrono::steady_clock::now() + lane.target->getBatchLinger();
+        pending.items.reserve(batchSize);
+    }
+    pending.items.push_back(std::move(status));
+    m_metrics.batching++;
+
+    if (pending.items.size() >= batchSize) {
+        batch.swap(pending.items);
+        m_metrics.batching -= batch.size();
+        return true;
+    }
+    if (first) {
+        // waiting worker sleeps until previous wakeup time
+        m_signal++;
+        m_readCondition.notify_one();
+    }
+    return false;
+}
+
+bool wss::event::EventNotifier::allowSend(Lane &lane, bool &probe) {
+    probe = false;
+    if (lane.breaker == BreakerState::Closed) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(lane.breakerMutex);
+    if (lane.breaker == BreakerState::Closed) {
+        return true;
+    }
+    if (lane.breaker == BreakerState::HalfOpen || std::chrono::steady_clock::now() < lane.openUntil) {
+        return false;
+    }
+    lane.breaker = BreakerState::HalfOpen;
+    probe = true;
+    L_INFO_F("Event::Breaker", "Circuit of target %s is half-open, sending probe", lane.target->getType().c_str());
+    return true;
+}
+
+void wss::event::EventNotifier::onSendResult(Lane &lane,
+                                             bool success,
+                                             std::chrono::steady_clock::duration latency,
+                                             bool probe) {
+    const Target &target = *lane.target;
+    const auto now = std::chrono::steady_clock::now();
+    bool raised = false;
+    {
+        std::lock_guard<std::mutex> lock(lane.breakerMutex);
+        const uint32_t threshold = target.getBreakerFailures();
+        if (probe) {
+            // only probe decides, results of sends started before breaker was opened are late
+            if (success) {
+                lane.breaker = BreakerState::Closed;
+                lane.failures = 0;
+                L_INFO_F("Event::Breaker", "Circuit of target %s is closed", lane.target->getType().c_str());
+            } else {
+                lane.breaker = BreakerState::Open;
+                lane.openUntil = now + target.getBreakerOpen();
+            }
+        } else if (threshold > 0 && lane.breaker == BreakerState::Closed) {
+            if (success) {
+                lane.failures = 0;
+            } else if (++lane.failures >= threshold) {
+                lane.breaker = BreakerState::Open;
+                lane.openUntil = now + target.getBreakerOpen();
+                lane.breakerOpened++;
+                L_WARN_F("Event::Breaker", "Circuit of target %s is open after %u failed sends",
+                         lane.target->getType().c_str(), lane.failures);
+            }
+        }
+
+        const auto latencyTarget = target.getLatencyTarget();
+        if (latencyTarget.count() > 0) {
+            const uint32_t limit = lane.limit;
+            if (success && latency <= latencyTarget) {
+                // additive increase: +1 after limit fast sends
+                if (++lane.successes >= limit && limit < lane.maxInFlight) {
+                    lane.limit = limit + 1;
+                    lane.successes = 0;
+                    raised = true;
+                }
+            } else if (now - lane.lastDecrease >= latencyTarget) {
+                // multiplicative decrease, once per latency target: sends in flight are slow for the same reason
+                lane.limit = std::max(limit / 2, (uint32_t) 1);
+                lane.successes = 0;
+                lane.lastDecrease = now;
+            }
+        }
+    }
+    if (raised) {
+        signal();
+    }
+}
+
+void wss::event::EventNotifier::shortCircuit(Lane &lane, SendStatus status) {
+    lane.shortCircuited++;
+    m_metrics.shortCircuited++;
+    status.hasSent = false;
+    status.sendResult = "circuit breaker is open";
+    if (!status.fallbackQueue.empty()) {
+        // not a failure of message yet: fallback is another target
+        onErrorSending(std::move(status));
+        return;
+    }
+    if (!m_enableRetry) {
+        m_metrics.failed++;
+        lane.failed++;
+        for (auto &listener: m_sendErrorListeners) {
+            listener(std::move(status));
+        }
+        return;
+    }
+    complete(std::move(status));
+}
+
+bool wss::event::EventNotifier::dispatchBatch(std::vector<SendStatus> &batch) {
+    std::vector<const wss::MessagePayload *> payloads;
+    payloads.reserve(batch.size());
+    for (const auto &status: batch) {
+        payloads.push_back(status.payload.get());
+    }
+
+    // one request for whole batch: it carries span of first sampled event
+    std::vector<wss::tracing::SpanContext> spans(batch.size());
+    const wss::tracing::SpanContext *requestSpan = &spans.front();
+    for (std::size_t i = 0; i < batch.size(); i++) {
+        if (batch[i].payload->getTrace().sampled) {
+            spans[i] = wss::tracing::child(batch[i].payload->getTrace());
+            if (!requestSpan->sampled) {
+                requestSpan = &spans[i];
+            }
+        }
+    }
+
+    std::vector<bool> sent;
+    std::vector<std::string> errors;
+    const auto started = std::chrono::steady_clock::now();
+    {
+        wss::tracing::ScopedSpan scope(*requestSpan);
+        batch.front().target->sendBatch(payloads, sent, errors);
+    }
+    const auto finished = std::chrono::steady_clock::now();
+    m_metrics.batches++;
+
+    bool accepted = false;
+    for (std::size_t i = 0; i < batch.size(); i++) {
+        SendStatus &status = batch[i];
+        status.hasSent = i < sent.size() && sent[i];
+        accepted = accepted || status.hasSent;
+        if (i < errors.size()) {
+            status.sendResult = std::move(errors[i]);
+        }
+        if (spans[i].sampled) {
+            traceSend(spans[i], status, started, finished);
+        }
+        complete(std::move(status));
+    }
+    return accepted;
+}
+
+void wss::event::EventNotifier::complete(SendStatus status) {
+    // lanes are created before workers start, map is not changed after
+    Lane &lane = *m_laneByTarget.at(status.target.get());
+    if (m_enableRetry && !status.hasSent) {
+        WSS_DEBUG("Event::Send", fmt::format("Can't send message to target {0}: {1}",
+                                             status.target->getType(),
+                                             status.sendResult));
+
+        // if tries < maxRetries
+        if (status.sendTries < m_maxRetries) {
+            status.sendTries++;
+            status.sendTime = std::time(nullptr);
+            m_metrics.retried++;
+            lane.retried++;
+            delay(std::move(status));
+        } else {
+            // can't send over maxTries times
+            // notify listeners
+            m_metrics.failed++;
+            lane.failed++;
+            for (auto &listener: m_sendErrorListeners) {
+                listener(std::move(status));
+            }
+        }
+    } else {
+        m_metrics.sent++;
+        lane.sent++;
+        WSS_DEBUG("Event::Send", fmt::format("Message has sent to target: {0}", status.target->getType()));
+    }
+}
+
+void wss::event::EventNotifier::enqueue(SendStatus &&status, bool bounded) {
+    const auto it = m_laneByTarget.find(status.target.get());
+    if (it == m_laneByTarget.end()) {
+        L_WARN_F("Event::Enqueue", "Unknown target %s", status.target->getType().c_str());
+        return;
+    }
+    Lane &lane = *it->second;
+    const std::size_t capacity = lane.target->getQueueCapacity();
+    if (bounded && capacity > 0 && lane.queued >= capacity) {
+        lane.dropped++;
+        m_metrics.dropped++;
+        if (status.ticket) {
+            status.ticket->keep();
+        }
+        WSS_DEBUG_F("Event::Enqueue", "Queue of target %s is full, event dropped", lane.target->getType().c_str());
+        return;
+    }
+    if (bounded && wss::metrics::isOverMemorySoftLimit()) {
+        lane.dropped++;
+        m_metrics.dropped++;
+        if (status.ticket) {
+            status.ticket->keep();
+        }
+        wss::metrics::add(wss::metrics::Counter::MemoryShed);
+        WSS_DEBUG_F("Event::Enqueue", "Memory soft limit is reached, event for %s dropped",
+                    lane.target->getType().c_str());
         return;
     }
 
-    bool isIgnoredType = false;
-    for (const auto &ignoredType: wss::Settings::get().event.ignoreTypes) {
-        if (toolboxpp::strings::equalsIgnoreCase(ignoredType, payload.getType())) {
-            isIgnoredType = true;
-            break;
+    wss::metrics::acquire(wss::metrics::Memory::EventQueue, queuedBytes(status));
+    lane.queued++;
+    m_metrics.queued++;
+    lane.queue.enqueue(std::move(status));
+    signal();
+}
+
+void wss::event::EventNotifier::delay(SendStatus &&status) {
+    Lane &lane = *m_laneByTarget.at(status.target.get());
+    // per thread generator: jitter doesn't need shared state between workers
+    thread_local std::mt19937 random(std::random_device{}());
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    const double random01 = unit(random);
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    const auto due = std::chrono::steady_clock::now() + lane.retryPolicy.getDelay(status.sendTries, random01);
+    const bool earliest = lane.retries.empty() || due < lane.retries.front().due;
+    lane.retries.push_back({due, std::move(status)});
+    std::push_heap(lane.retries.begin(), lane.retries.end(), RetryLater());
+    m_metrics.delayed++;
+    if (earliest) {
+        // waiting worker sleeps until previous earliest retry
+        m_signal++;
+        m_readCondition.notify_one();
+    }
+}
+
+void wss::event::EventNotifier::addMessage(const wss::MessagePayloadPtr &payload) {
+    addMessage(payload, m_outbox ? m_outbox->append(*payload) : nullptr);
+}
+void wss::event::EventNotifier::addMessage(const wss::MessagePayloadPtr &payload,
+                                           const EventOutbox::TicketPtr &ticket,
+                                           bool bounded) {
+    for (auto &target: m_targets) {
+        if (!target.second->accepts(*payload)) {
+            const auto it = m_laneByTarget.find(target.second.get());
+            if (it != m_laneByTarget.end()) {
+                it->second->filtered++;
+            }
+            continue;
         }
+        SendStatus status(target.second, target.second->project(payload), 0L, 1);
+        status.ticket = ticket;
+        enqueue(std::move(status), bounded);
+    }
+}
+
+void wss::event::EventNotifier::onMessage(const wss::MessagePayloadPtr &payload) {
+    // presence transitions are passed only if chat.presence.notifyEvents enabled
+    if (payload->isFromBot() && !payload->typeIs(wss::types::ID_PRESENCE) && not wss::Settings::get().event.sendBotMessages) {
+        WSS_DEBUG("Event::Enqueue", "Skipping Bot message (sender=0)");
+        return;
     }
 
+    const bool isIgnoredType = wss::Settings::get().event.ignoreTypesSet[payload->getTypeId()];
+
     if (!isIgnoredType) {
-        m_ioService.post(boost::bind(&EventNotifier::addMessage, this, payload));
+        // lock-free queue: caller thread enqueues without hop to another thread, payload is shared with chat
+        addMessage(payload);
     }
 }
 
@@ -250,13 +762,69 @@ void wss::event::EventNotifier::onErrorSending(wss::event::EventNotifier::SendSt
     status.target = status.fallbackQueue.front();
     status.fallbackQueue.pop();
     status.sendTries = 0;
-    // and re-re-enqueue this message (and reset tries)
-    m_sendQueue.enqueue(std::move(status));
+    // and re-re-enqueue this message (and reset tries), fallback is another target, so it's sent without delay
+    enqueue(std::move(status));
+}
+
+void wss::event::EventNotifier::setOutbox(std::unique_ptr<EventOutbox> outbox) {
+    m_outbox = std::move(outbox);
+}
+const wss::event::EventOutbox *wss::event::EventNotifier::getOutbox() const noexcept {
+    return m_outbox.get();
 }
 
 void wss::event::EventNotifier::addErrorListener(wss::event::EventNotifier::OnSendError listener) {
     m_sendErrorListeners.push_back(listener);
 }
 
+const wss::event::EventMetrics &wss::event::EventNotifier::getMetrics() const noexcept {
+    return m_metrics;
+}
+
+std::shared_ptr<wss::event::StreamTarget> wss::event::EventNotifier::getStream(const std::string &name) const {
+    for (const auto &target: m_targets) {
+        auto stream = std::dynamic_pointer_cast<StreamTarget>(target.second);
+        if (stream && stream->getName() == name) {
+            return stream;
+        }
+    }
+    return nullptr;
+}
+
+std::vector<wss::event::TargetMetrics> wss::event::EventNotifier::getTargetMetrics() const {
+    std::vector<TargetMetrics> out;
+    std::lock_guard<std::mutex> lock(m_readMutex);
+    out.reserve(m_lanes.size());
+    for (const auto &lane: m_lanes) {
+        TargetMetrics item;
+        item.type = lane->target->getType();
+        item.queued = lane->queued;
+        item.delayed = lane->retries.size();
+        item.dropped = lane->dropped;
+        item.filtered = lane->filtered;
+        item.shortCircuited = lane->shortCircuited;
+        item.sent = lane->sent;
+        item.retried = lane->retried;
+        item.failed = lane->failed;
+        switch (lane->breaker.load()) {
+            case BreakerState::Closed: item.breaker = "closed";
+                break;
+            case BreakerState::Open: item.breaker = "open";
+                break;
+            case BreakerState::HalfOpen: item.breaker = "halfOpen";
+                break;
+        }
+        {
+            std::lock_guard<std::mutex> breakerLock(lane->breakerMutex);
+            item.breakerOpened = lane->breakerOpened;
+        }
+        item.inFlight = lane->inFlight;
+        item.limit = lane->limit;
+        item.maxInFlight = lane->maxInFlight;
+        out.push_back(std::move(item));
+    }
+    return out;
+}
+
 
 
@@ -19,12 +19,15 @@
 #include <deque>
 #include <algorithm>
 #include <boost/thread.hpp>
+#include <chrono>
 #include <cmath>
-#include <boost/asio/io_service.hpp>
+#include <random>
 #include "../chat/ChatServer.h"
 #include "../base/StandaloneService.h"
 #include "Target.hpp"
 #include "PostbackTarget.h"
+#include "StreamTarget.h"
+#include "EventOutbox.h"
 #include "concurrentqueue.h"
 
 namespace wss {
@@ -32,6 +35,51 @@ namespace event {
 
 using toolboxpp::Logger;
 
+/// \brief Event dispatch counters
+struct EventMetrics {
+  /// \brief Fresh events waiting for worker
+  std::atomic<uint64_t> queued{0};
+  /// \brief Failed events waiting for retry time
+  std::atomic<uint64_t> delayed{0};
+  std::atomic<uint64_t> sent{0};
+  /// \brief Sends that failed after all tries
+  std::atomic<uint64_t> failed{0};
+  std::atomic<uint64_t> retried{0};
+  /// \brief Events dropped because target queue was full
+  std::atomic<uint64_t> dropped{0};
+  /// \brief Events not sent because target circuit breaker was open
+  std::atomic<uint64_t> shortCircuited{0};
+  /// \brief Events collected to incomplete batches
+  std::atomic<uint64_t> batching{0};
+  /// \brief Batch requests sent
+  std::atomic<uint64_t> batches{0};
+  std::atomic<uint32_t> workers{0};
+  /// \brief Workers sending event right now
+  std::atomic<uint32_t> busyWorkers{0};
+};
+
+/// \brief Counters of one target queue
+struct TargetMetrics {
+  std::string type;
+  uint64_t queued = 0;
+  uint64_t delayed = 0;
+  uint64_t dropped = 0;
+  /// \brief Events not matched by target filter
+  uint64_t filtered = 0;
+  uint64_t shortCircuited = 0;
+  uint64_t sent = 0;
+  uint64_t retried = 0;
+  uint64_t failed = 0;
+  /// \brief How many times circuit breaker was opened
+  uint64_t breakerOpened = 0;
+  /// \brief closed, open or halfOpen
+  std::string breaker;
+  uint32_t inFlight = 0;
+  /// \brief Current (adaptive) workers limit
+  uint32_t limit = 0;
+  uint32_t maxInFlight = 0;
+};
+
 class EventNotifier : public virtual wss::StandaloneService {
  private:
     /// \brief Creates event target instance from global server config file.
@@ -40,29 +88,31 @@ class EventNotifier : public virtual wss::StandaloneService {
     static std::shared_ptr<Target> createTargetByConfig(const nlohmann::json &json);
     void onStop();
 
-    /// \brief Start the service. Producer: onMessage(), consumer: handleMessageQueue(), but consumer can be a producer at the same time, cause re-enqueues undelivered messages
-    /// \todo calculate performance, cause here we create hardcoded 4 threads,
-    ///     but event emitter (wss::ChatMessageServer) can generate message from the N threads at the same time.
-    ///     Potential bottleneck
+    /// \brief Start the service. Producer: onMessage(), consumers: pool of event.maxParallelWorkers workers
+    /// (workerLoop()), but consumer can be a producer at the same time, cause re-enqueues undelivered messages.
+    /// Every target (and fallback) has own queue and limit of workers sending to it, so slow target doesn't starve others
     void subscribe();
 
  public:
     struct SendStatus {
       std::shared_ptr<wss::event::Target> target;
-      wss::MessagePayload payload;
+      /// \brief Shared by statuses of all targets
+      wss::MessagePayloadPtr payload;
       std::time_t sendTime;
       int sendTries;
       int sendRetryIndex;
       bool hasSent = false;
       std::string sendResult;
       std::queue<std::shared_ptr<wss::event::Target>> fallbackQueue;
+      /// \brief Outbox record, shared by statuses of all targets, nullptr if outbox is disabled
+      EventOutbox::TicketPtr ticket;
 
       SendStatus(std::shared_ptr<wss::event::Target> target,
-                 wss::MessagePayload payload,
+                 wss::MessagePayloadPtr payload,
                  std::time_t sendTime,
                  int tries) :
           target(target),
-          payload(payload),
+          payload(std::move(payload)),
           sendTime(sendTime),
           sendTries(tries) {
           for (const auto &t: target->getFallbacks()) {
@@ -92,54 +142,242 @@ class EventNotifier : public virtual wss::StandaloneService {
     /// \param tries Tries number
     void setMaxTries(int tries);
 
+    /// \brief Default retry policy of targets, can be changed while service is running: delays of next retries
+    /// are taken from new policy, already delayed events keep their due time. Target own retry options stay in force
+    /// \param policy
+    void setRetryPolicy(const RetryPolicy &policy);
+    RetryPolicy getRetryPolicy() const;
+
+    /// \brief Resizes workers pool while service is running: new workers are started at once, extra workers
+    /// exit after their current send. Default workers limit of targets without own maxInFlight is changed too
+    /// \param workers at least 1
+    void setMaxParallelWorkers(uint32_t workers);
+
     /// \brief Adds event target
     /// \param targetConfig
     void addTarget(const nlohmann::json &targetConfig);
     void addTarget(const std::shared_ptr<Target> &target);
     void addTarget(std::shared_ptr<Target> &&target);
 
+    /// \brief Makes events durable: they are written to outbox before enqueue, and events not handled before
+    /// restart are sent again on start. Must be set before service is started
+    /// \param outbox
+    void setOutbox(std::unique_ptr<EventOutbox> outbox);
+
+    /// \brief Outbox counters
+    /// \return nullptr if outbox is disabled
+    const EventOutbox *getOutbox() const noexcept;
+
     /// \brief Error listener. Called when can't send message to target #maxRetries times
     /// \param listener
     void addErrorListener(wss::event::EventNotifier::OnSendError listener);
 
+    /// \brief Queue depth and workers utilization
+    /// \return
+    const EventMetrics &getMetrics() const noexcept;
+
+    /// \brief Queue counters of every target, including fallbacks
+    /// \return empty until service is started
+    std::vector<TargetMetrics> getTargetMetrics() const;
+
+    /// \brief Stream target for pull consumers
+    /// \param name stream name
+    /// \return nullptr if there is no stream target with this name
+    std::shared_ptr<StreamTarget> getStream(const std::string &name) const;
+
     void joinThreads() override;
     void detachThreads() override;
     void runService() override;
     void stopService() override;
 
  private:
-    /// \brief Calling on event
-    /// Send post to io_service with payload
+    /// \brief Calling on event, payload is shared with chat and all targets
     /// \param payload
-    /// \param hasSent is recipient online and recieved websocket frame
-    void onMessage(wss::MessagePayload &&payload);
+    void onMessage(const wss::MessagePayloadPtr &payload);
 
     /// \brief Calling when can't send message to main target
     void onErrorSending(wss::event::EventNotifier::SendStatus &&status);
 
-    /// \brief Calling after event in separate thread (io_service.post)
-    /// Adds message to send queue
+    /// \brief Writes message to outbox (if enabled) and adds it to queues of all targets, payload is shared by them
+    /// \param payload
+    void addMessage(const wss::MessagePayloadPtr &payload);
     /// \param payload
-    void addMessage(wss::MessagePayload payload);
+    /// \param ticket outbox record, or nullptr
+    /// \param bounded see enqueue()
+    void addMessage(const wss::MessagePayloadPtr &payload, const EventOutbox::TicketPtr &ticket, bool bounded = true);
+
+    struct Retry {
+      std::chrono::steady_clock::time_point due;
+      SendStatus status;
+    };
+    /// \brief Heap order: earliest due on top
+    struct RetryLater {
+      bool operator()(const Retry &lhs, const Retry &rhs) const {
+          return lhs.due > rhs.due;
+      }
+    };
+    struct Batch {
+      std::chrono::steady_clock::time_point deadline;
+      std::vector<SendStatus> items;
+    };
+
+    enum class BreakerState : uint8_t {
+      Closed,
+      Open,
+      /// \brief Open time is over, single probe send is in flight
+      HalfOpen
+    };
+
+    /// \brief Queues of one target
+    struct Lane {
+      Lane(std::shared_ptr<Target> target, uint32_t maxInFlight, bool ownLimit, const RetryPolicy &retryPolicy);
+
+      const std::shared_ptr<Target> target;
+      /// \brief Guarded by m_readMutex
+      RetryPolicy retryPolicy;
+      /// \brief Fresh events
+      moodycamel::ConcurrentQueue<SendStatus> queue;
+      std::atomic<uint64_t> queued{0};
+      std::atomic<uint64_t> dropped{0};
+      std::atomic<uint64_t> filtered{0};
+      std::atomic<uint64_t> shortCircuited{0};
+      std::atomic<uint64_t> sent{0};
+      std::atomic<uint64_t> retried{0};
+      std::atomic<uint64_t> failed{0};
+      /// \brief Workers sending to target, or holding its event
+      std::atomic<uint32_t> inFlight{0};
+      /// \brief Workers limit, between 1 and maxInFlight if target has latency target, otherwise maxInFlight
+      std::atomic<uint32_t> limit;
+      std::atomic<uint32_t> maxInFlight;
+      /// \brief maxInFlight is set by target, not share of workers pool
+      const bool ownLimit;
+
+      std::atomic<BreakerState> breaker{BreakerState::Closed};
+      /// \brief Breaker and adaptive limit state below
+      std::mutex breakerMutex;
+      uint32_t failures = 0;
+      uint64_t breakerOpened = 0;
+      std::chrono::steady_clock::time_point openUntil;
+      /// \brief Fast sends since last limit change
+      uint32_t successes = 0;
+      std::chrono::steady_clock::time_point lastDecrease;
+      /// \brief Retry lane, guarded by m_readMutex
+      std::vector<Retry> retries;
+      /// \brief Incomplete batch if target batchSize > 1, guarded by m_readMutex
+      Batch batch;
+    };
+
+    /// \brief Creates queues of target and its fallbacks
+    /// \param target
+    /// \param maxInFlight default workers limit
+    void createLane(const std::shared_ptr<Target> &target, uint32_t maxInFlight);
+
+    /// \brief Puts status to target fresh queue and wakes idle worker
+    /// \param status dropped if target queue is full. Outbox record of dropped status is kept (see Ticket::keep())
+    /// \param bounded false - queue capacity and memory soft limit are not checked (replayed outbox events)
+    void enqueue(SendStatus &&status, bool bounded = true);
+
+    /// \brief Puts failed status to target retry lane, it's sent after retry interval
+    /// \param status
+    void delay(SendStatus &&status);
+
+    /// \brief Pool worker: sends fresh messages first, then retries and batches that are due
+    void workerLoop();
+    /// \brief Starts workers until pool has m_maxParallelWorkers, m_workersMutex must be held
+    void startWorkers();
+    /// \brief Pool is larger than m_maxParallelWorkers: calling worker leaves it
+    /// \return true if worker must exit
+    bool retireWorker();
+
+    /// \brief Takes fresh message of the first target that has free workers slot, targets are scanned round-robin
+    /// \param lane target queues, with reserved slot
+    /// \param status
+    /// \return false if nothing was taken
+    bool takeFresh(Lane *&lane, SendStatus &status);
+
+    /// \brief Takes due retry or batch, which linger time is over
+    /// \param lane target queues, with reserved slot
+    /// \param status due retry
+    /// \param batch due batch
+    /// \param wakeup the earliest retry or batch time of targets with free slots
+    /// \return false if nothing was taken
+    bool takeDelayed(Lane *&lane, SendStatus &status, std::vector<SendStatus> &batch,
+                     std::chrono::steady_clock::time_point &wakeup, bool &hasWakeup);
+
+    /// \brief Waits for new work, or for wakeup time
+    /// \param signal value of m_signal before looking for work
+    void waitForWork(uint64_t signal, std::chrono::steady_clock::time_point wakeup, bool hasWakeup);
+
+    /// \brief Wakes idle worker: new message, free slot, or earlier wakeup time
+    void signal();
+
+    bool reserveSlot(Lane &lane);
+    void releaseSlot(Lane &lane);
+
+    /// \brief Adds message to batch of its target
+    /// \param lane
+    /// \param status
+    /// \param batch complete batch
+    /// \return true if batch reached target batch size and was moved to batch argument
+    bool collect(Lane &lane, SendStatus &&status, std::vector<SendStatus> &batch);
+
+    /// \brief Sends batch of one target by single request, then completes every message
+    /// \param batch
+    /// \return true if at least one message was accepted
+    bool dispatchBatch(std::vector<SendStatus> &batch);
+
+    /// \brief Checks circuit breaker of target before send
+    /// \param lane
+    /// \param probe true if it's the probe send of half-open breaker
+    /// \return false if breaker is open, or probe is in flight
+    bool allowSend(Lane &lane, bool &probe);
+
+    /// \brief Updates circuit breaker and adaptive workers limit by send result
+    /// \param lane
+    /// \param success
+    /// \param latency send duration
+    /// \param probe
+    void onSendResult(Lane &lane, bool success, std::chrono::steady_clock::duration latency, bool probe);
+
+    /// \brief Handles message not sent because breaker is open: it goes to fallback at once, if there is one,
+    /// otherwise it's a failed try
+    /// \param lane
+    /// \param status
+    void shortCircuit(Lane &lane, SendStatus status);
 
-    /// \brief Running in separate thread with sleep timer. Handling queued messages and trying to send them
-    void handleMessageQueue();
+    /// \brief Handles send result: delays message for retry, or notifies error listeners on failure
+    /// \param status taken by value: outbox ticket of handled message is released here
+    void complete(SendStatus status);
 
     std::atomic_bool m_keepGoing;
     std::condition_variable m_readCondition;
-    std::mutex m_readMutex;
+    mutable std::mutex m_readMutex;
+    std::atomic<uint32_t> m_idleWorkers{0};
+    /// \brief Incremented on every new work, workers wait only if it's not changed while they were looking for work
+    std::atomic<uint64_t> m_signal{0};
+    std::atomic<uint32_t> m_nextLane{0};
+    EventMetrics m_metrics;
+    /// \brief Outlives lanes: their statuses hold tickets of outbox
+    std::unique_ptr<EventOutbox> m_outbox;
+    /// \brief Created on start, never changed after
+    std::vector<std::unique_ptr<Lane>> m_lanes;
+    std::unordered_map<const Target *, Lane *> m_laneByTarget;
 
     std::shared_ptr<wss::ChatServer> m_ws;
     const bool m_enableRetry;
-    const uint32_t m_maxParallelWorkers;
-    int m_maxRetries;
-    int m_retryIntervalSeconds;
-    boost::asio::io_service m_ioService;
-    boost::thread_group m_threadGroup;
-    boost::asio::io_service::work m_work;
+    std::atomic<uint32_t> m_maxParallelWorkers;
+    std::atomic<int> m_maxRetries;
+    /// \brief Default retry policy of targets, guarded by m_readMutex
+    RetryPolicy m_retryPolicy;
+    /// \brief Guards pool: workers are added while joinThreads() waits for them (boost::thread_group can't do it)
+    std::mutex m_workersMutex;
+    /// \brief Every worker ever started, retired ones are joined on stop
+    std::vector<std::unique_ptr<boost::thread>> m_workers;
+    /// \brief Workers that haven't retired
+    std::atomic<uint32_t> m_runningWorkers{0};
+    bool m_started = false;
 
     std::unordered_map<std::string, std::shared_ptr<Target>> m_targets, m_targetsUndelivered;
-    moodycamel::ConcurrentQueue<SendStatus> m_sendQueue;
     std::vector<wss::event::EventNotifier::OnSendError> m_sendErrorListeners;
 };
 
@@ -0,0 +1,507 @@
+/**
+ * wsserver
+ * EventOutbox.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "EventOutbox.h"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <fmt/format.h>
+#include <toolboxpp.h>
+#include "../base/Affinity.h"
+
+namespace {
+
+/// \brief u32 body length, u32 crc32
+const std::size_t RECORD_HEADER = 8;
+/// \brief u64 seq, followed by envelope
+const std::size_t RECORD_META = 8;
+/// \brief u64 checkpoint, u32 crc32
+const std::size_t CHECKPOINT_SIZE = 12;
+
+std::runtime_error systemError(const std::string &what, const std::string &path) {
+    return std::runtime_error(fmt::format("{0} {1}: {2}", what, path, std::strerror(errno)));
+}
+
+uint32_t checksum(const char *data, std::size_t length) noexcept {
+    return static_cast<uint32_t>(::crc32(0L, reinterpret_cast<const Bytef *>(data), static_cast<uInt>(length)));
+}
+
+bool writeAll(int fd, const char *data, std::size_t length) {
+    while (length > 0) {
+        const ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        length -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+bool readAll(int fd, char *data, std::size_t length, uint64_t offset) {
+    while (length > 0) {
+        const ssize_t read = ::pread(fd, data, length, static_cast<off_t>(offset));
+        if (read <= 0) {
+            if (read < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += read;
+        offset += static_cast<uint64_t>(read);
+        length -= static_cast<std::size_t>(read);
+    }
+    return true;
+}
+
+}
+
+wss::event::EventOutbox::Ticket::Ticket(EventOutbox &outbox, uint64_t seq) :
+    m_outbox(outbox),
+    m_seq(seq) {
+}
+wss::event::EventOutbox::Ticket::~Ticket() {
+    if (!m_kept.load(std::memory_order_acquire)) {
+        m_outbox.ack(m_seq);
+    }
+}
+void wss::event::EventOutbox::Ticket::keep() const noexcept {
+    m_kept.store(true, std::memory_order_release);
+}
+
+wss::event::EventOutbox::FileHandle::~FileHandle() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+wss::event::EventOutbox::EventOutbox(const std::string &directory, const Options &options) :
+    m_directory(directory),
+    m_options(options) {
+    if (::mkdir(m_directory.c_str(), 0755) != 0 && errno != EEXIST) {
+        throw systemError("Unable to create event outbox directory", m_directory);
+    }
+    // created even if compression is disabled: compressed records written before stay readable
+    m_codec = std::unique_ptr<SegmentCodec>(new SegmentCodec(m_directory, m_options.compression));
+
+    recover();
+    m_flusher = std::thread(&EventOutbox::flushLoop, this);
+}
+wss::event::EventOutbox::~EventOutbox() {
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stop = true;
+    }
+    m_flushCondition.notify_all();
+    if (m_flusher.joinable()) {
+        m_flusher.join();
+    }
+    std::unique_lock<std::mutex> lock(m_lock);
+    syncLocked(lock);
+}
+
+std::string wss::event::EventOutbox::segmentPath(uint64_t segment) const {
+    return fmt::format("{0}/{1:020d}.log", m_directory, segment);
+}
+std::string wss::event::EventOutbox::checkpointPath() const {
+    return m_directory + "/checkpoint";
+}
+
+void wss::event::EventOutbox::recover() {
+    readCheckpoint();
+    m_seq = m_checkpoint;
+    m_syncedCheckpoint = m_checkpoint;
+
+    std::vector<uint64_t> segments;
+    DIR *dir = ::opendir(m_directory.c_str());
+    if (dir == nullptr) {
+        throw systemError("Unable to read event outbox directory", m_directory);
+    }
+    while (const dirent *item = ::readdir(dir)) {
+        const std::string name(item->d_name);
+        if (name.size() == 24 && name.compare(20, 4, ".log") == 0
+            && std::all_of(name.begin(), name.begin() + 20, ::isdigit)) {
+            segments.push_back(std::stoull(name.substr(0, 20)));
+        }
+    }
+    ::closedir(dir);
+    std::sort(segments.begin(), segments.end());
+
+    for (uint64_t segment: segments) {
+        recoverSegment(segment);
+    }
+    for (auto it = m_segments.begin(); it != m_segments.end();) {
+        if (it->second.lastSeq <= m_checkpoint) {
+            ::unlink(segmentPath(it->first).c_str());
+            it = m_segments.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // seqs lost by torn write are not waited for
+    auto recovered = m_recovered.begin();
+    for (uint64_t seq = m_checkpoint + 1; seq <= m_seq; seq++) {
+        const bool found = recovered != m_recovered.end() && recovered->seq == seq;
+        m_acked.push_back(!found);
+        if (found) {
+            ++recovered;
+        }
+    }
+    while (!m_acked.empty() && m_acked.front()) {
+        m_acked.pop_front();
+        m_checkpoint++;
+    }
+
+    openSegment(segments.empty() ? 1 : segments.back() + 1);
+    L_INFO_F("Event::Outbox", "Recovered %lu event(s) from %lu segment(s) in %s",
+             m_recovered.size(), m_segments.size() - 1, m_directory.c_str());
+}
+
+void wss::event::EventOutbox::recoverSegment(uint64_t segment) {
+    const std::string path = segmentPath(segment);
+    const int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        throw systemError("Unable to open event outbox segment", path);
+    }
+    Segment &seg = m_segments[segment];
+    seg.file = std::make_shared<FileHandle>(fd);
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        throw systemError("Unable to stat event outbox segment", path);
+    }
+    const auto fileSize = static_cast<uint64_t>(st.st_size);
+    if (fileSize == 0) {
+        return;
+    }
+
+    void *mapped = ::mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        throw systemError("Unable to map event outbox segment", path);
+    }
+    const char *data = static_cast<const char *>(mapped);
+
+    uint64_t offset = 0;
+    while (offset + RECORD_HEADER <= fileSize) {
+        uint32_t length, crc;
+        std::memcpy(&length, data + offset, 4);
+        std::memcpy(&crc, data + offset + 4, 4);
+        length &= ~SegmentCodec::COMPRESSED;
+        const char *body = data + offset + RECORD_HEADER;
+        if (length < RECORD_META || offset + RECORD_HEADER + length > fileSize || checksum(body, length) != crc) {
+            break;
+        }
+        uint64_t seq;
+        std::memcpy(&seq, body, 8);
+        if (seq <= seg.lastSeq) {
+            // seqs are only growing
+            break;
+        }
+        m_seq = std::max(m_seq, seq);
+        seg.lastSeq = seq;
+        if (seq > m_checkpoint) {
+            m_recovered.push_back({segment, offset, static_cast<uint32_t>(RECORD_HEADER + length), seq});
+        }
+        offset += RECORD_HEADER + length;
+    }
+    ::munmap(mapped, fileSize);
+
+    if (offset != fileSize) {
+        // torn write of crashed process: tail after last valid record is dropped
+        L_WARN_F("Event::Outbox", "Segment %s is truncated from %lu to %lu bytes", path.c_str(), fileSize, offset);
+        if (::ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+            throw systemError("Unable to truncate event outbox segment", path);
+        }
+    }
+    seg.size = offset;
+}
+
+void wss::event::EventOutbox::openSegment(uint64_t segment) {
+    m_segments[segment].file = createSegment(segment);
+    m_activeSegment = segment;
+}
+
+std::shared_ptr<wss::event::EventOutbox::FileHandle> wss::event::EventOutbox::createSegment(uint64_t segment) const {
+    const std::string path = segmentPath(segment);
+    const int fd = ::open(path.c_str(), O_CREAT | O_RDWR | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw systemError("Unable to create event outbox segment", path);
+    }
+    auto file = std::make_shared<FileHandle>(fd);
+
+    // new file entry must survive crash too
+    const int dirFd = ::open(m_directory.c_str(), O_RDONLY | O_CLOEXEC);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+    return file;
+}
+
+void wss::event::EventOutbox::readCheckpoint() {
+    const std::string path = checkpointPath();
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            throw systemError("Unable to open event outbox checkpoint", path);
+        }
+        return;
+    }
+    char data[CHECKPOINT_SIZE];
+    const bool read = readAll(fd, data, CHECKPOINT_SIZE, 0);
+    ::close(fd);
+    uint32_t crc;
+    std::memcpy(&crc, data + 8, 4);
+    if (!read || checksum(data, 8) != crc) {
+        // all events of log are sent again
+        L_WARN_F("Event::Outbox", "Checkpoint %s is corrupted, ignoring it", path.c_str());
+        return;
+    }
+    std::memcpy(&m_checkpoint, data, 8);
+}
+
+void wss::event::EventOutbox::writeCheckpoint(uint64_t checkpoint) {
+    const std::string path = checkpointPath();
+    const std::string tmpPath = path + ".tmp";
+    char data[CHECKPOINT_SIZE];
+    std::memcpy(data, &checkpoint, 8);
+    const uint32_t crc = checksum(data, 8);
+    std::memcpy(data + 8, &crc, 4);
+
+    const int fd = ::open(tmpPath.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw systemError("Unable to create event outbox checkpoint", tmpPath);
+    }
+    const bool written = writeAll(fd, data, CHECKPOINT_SIZE) && ::fdatasync(fd) == 0;
+    ::close(fd);
+    if (!written) {
+        throw systemError("Unable to write event outbox checkpoint", tmpPath);
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        throw systemError("Unable to replace event outbox checkpoint", path);
+    }
+}
+
+wss::event::EventOutbox::TicketPtr wss::event::EventOutbox::append(const wss::MessagePayload &payload) {
+    const std::string &binary = payload.toBinary();
+    std::string compressed;
+    const bool isCompressed = m_codec->compress(binary.data(), binary.size(), compressed);
+    const std::string &envelope = isCompressed ? compressed : binary;
+    const auto length = static_cast<uint32_t>(RECORD_META + envelope.size());
+    const uint32_t lengthField = isCompressed ? (length | SegmentCodec::COMPRESSED) : length;
+    std::string record(RECORD_HEADER + length, '\0');
+    char *body = &record[RECORD_HEADER];
+    std::memcpy(body + RECORD_META, envelope.data(), envelope.size());
+
+    uint64_t seq;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        seq = m_seq + 1;
+        std::memcpy(body, &seq, 8);
+        const uint32_t crc = checksum(body, length);
+        std::memcpy(&record[0], &lengthField, 4);
+        std::memcpy(&record[4], &crc, 4);
+
+        Segment &seg = m_segments[m_activeSegment];
+        if (!writeAll(seg.file->fd, record.data(), record.size())) {
+            L_ERR_F("Event::Outbox", "Unable to write event: %s", std::strerror(errno));
+            // partial record is cut on recovery by crc check, next records must not follow it
+            if (::ftruncate(seg.file->fd, static_cast<off_t>(seg.size)) != 0) {
+                openSegment(m_activeSegment + 1);
+            }
+            return nullptr;
+        }
+        m_seq = seq;
+        m_acked.push_back(false);
+        seg.size += record.size();
+        seg.lastSeq = seq;
+        m_dirty = true;
+
+        if (seg.size >= m_options.segmentBytes && !m_rotate) {
+            // appends continue to full segment until flusher switches them to next one
+            m_rotate = true;
+            m_flushCondition.notify_one();
+        }
+    }
+    m_metrics.appended++;
+    return std::make_shared<const Ticket>(*this, seq);
+}
+
+std::size_t wss::event::EventOutbox::replay(const ReplayHandler &handler) {
+    std::vector<Location> recovered;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        recovered.swap(m_recovered);
+    }
+
+    std::size_t replayed = 0;
+    std::string record;
+    std::string decompressed;
+    for (const auto &location: recovered) {
+        std::shared_ptr<FileHandle> file;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            // segment can't be deleted: its events are not acknowledged yet
+            file = m_segments.at(location.segment).file;
+        }
+        auto ticket = std::make_shared<const Ticket>(*this, location.seq);
+        record.resize(location.length);
+        if (!readAll(file->fd, &record[0], location.length, location.offset)) {
+            L_ERR_F("Event::Outbox", "Unable to read event %lu: %s", location.seq, std::strerror(errno));
+            continue;
+        }
+        const std::size_t envelopeOffset = RECORD_HEADER + RECORD_META;
+        const char *envelope = record.data() + envelopeOffset;
+        std::size_t envelopeLength = record.size() - envelopeOffset;
+        uint32_t lengthField;
+        std::memcpy(&lengthField, record.data(), 4);
+        if (lengthField & SegmentCodec::COMPRESSED) {
+            if (!m_codec->decompress(envelope, envelopeLength, decompressed)) {
+                L_WARN_F("Event::Outbox", "Skipping event %lu: unable to decompress", location.seq);
+                continue;
+            }
+            envelope = decompressed.data();
+            envelopeLength = decompressed.size();
+        }
+        wss::MessagePayload payload = wss::MessagePayload::fromStoredBinary(envelope, envelopeLength);
+        if (!payload.isValid()) {
+            L_WARN_F("Event::Outbox", "Skipping invalid event %lu", location.seq);
+            continue;
+        }
+        m_metrics.replayed++;
+        replayed++;
+        handler(std::move(payload), std::move(ticket));
+    }
+    return replayed;
+}
+
+void wss::event::EventOutbox::ack(uint64_t seq) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_closed || seq <= m_checkpoint || seq - m_checkpoint > m_acked.size()) {
+        return;
+    }
+    m_acked[seq - m_checkpoint - 1] = true;
+    m_metrics.acked++;
+    while (!m_acked.empty() && m_acked.front()) {
+        m_acked.pop_front();
+        m_checkpoint++;
+    }
+}
+
+void wss::event::EventOutbox::close() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_closed = true;
+}
+
+uint64_t wss::event::EventOutbox::getPending() const {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_seq - m_checkpoint;
+}
+const wss::SegmentCodec &wss::event::EventOutbox::getCodec() const noexcept {
+    return *m_codec;
+}
+
+const wss::event::OutboxMetrics &wss::event::EventOutbox::getMetrics() const noexcept {
+    return m_metrics;
+}
+
+void wss::event::EventOutbox::syncLocked(std::unique_lock<std::mutex> &lock) {
+    const bool dirty = m_dirty;
+    const uint64_t checkpoint = m_checkpoint;
+    if (!dirty && checkpoint == m_syncedCheckpoint) {
+        return;
+    }
+    m_dirty = false;
+    const auto it = m_segments.find(m_activeSegment);
+    std::shared_ptr<FileHandle> segment = it == m_segments.end() ? nullptr : it->second.file;
+    const bool moved = checkpoint != m_syncedCheckpoint;
+
+    // appends and acks continue while data is flushed, handle keeps descriptor open
+    lock.unlock();
+    if (dirty && segment) {
+        ::fdatasync(segment->fd);
+        m_metrics.syncs++;
+    }
+    bool written = false;
+    if (moved) {
+        try {
+            writeCheckpoint(checkpoint);
+            written = true;
+        } catch (const std::exception &e) {
+            L_ERR_F("Event::Outbox", "%s", e.what());
+        }
+    }
+    lock.lock();
+
+    if (!written) {
+        return;
+    }
+    m_syncedCheckpoint = checkpoint;
+    for (auto seg = m_segments.begin(); seg != m_segments.end() && seg->first != m_activeSegment;) {
+        if (seg->second.lastSeq > checkpoint) {
+            break;
+        }
+        ::unlink(segmentPath(seg->first).c_str());
+        seg = m_segments.erase(seg);
+    }
+}
+
+void wss::event::EventOutbox::rotateLocked(std::unique_lock<std::mutex> &lock) {
+    if (!m_rotate) {
+        return;
+    }
+    const uint64_t current = m_activeSegment;
+    lock.unlock();
+    std::shared_ptr<FileHandle> file;
+    try {
+        file = createSegment(current + 1);
+    } catch (const std::exception &e) {
+        // appends stay on current segment, next interval tries again
+        L_ERR_F("Event::Outbox", "%s", e.what());
+    }
+    lock.lock();
+    if (!file || m_activeSegment != current) {
+        // next append asks again, or failed write has switched segment meanwhile
+        m_rotate = false;
+        return;
+    }
+    m_rotate = false;
+    std::shared_ptr<FileHandle> previous = m_segments[current].file;
+    m_segments[current + 1].file = std::move(file);
+    m_activeSegment = current + 1;
+
+    // nothing is appended to previous segment anymore, its tail is synced once
+    lock.unlock();
+    ::fdatasync(previous->fd);
+    m_metrics.syncs++;
+    lock.lock();
+}
+
+void wss::event::EventOutbox::flushLoop() {
+    wss::affinity::pin(wss::affinity::Group::Events);
+    const auto interval = std::chrono::milliseconds(std::max(m_options.syncIntervalMillis, (uint32_t) 1));
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (!m_stop) {
+        m_flushCondition.wait_for(lock, interval, [this] { return m_stop || m_rotate; });
+        rotateLocked(lock);
+        syncLocked(lock);
+    }
+}
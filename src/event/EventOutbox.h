@@ -0,0 +1,178 @@
+/**
+ * wsserver
+ * EventOutbox.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_EVENTOUTBOX_H
+#define WSSERVER_EVENTOUTBOX_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../base/SegmentCodec.h"
+#include "../chat/Message.h"
+
+namespace wss {
+namespace event {
+
+struct OutboxMetrics {
+  std::atomic<uint64_t> appended{0};
+  /// \brief Events handled by all targets (sent, or failed after all tries)
+  std::atomic<uint64_t> acked{0};
+  /// \brief Events recovered on start
+  std::atomic<uint64_t> replayed{0};
+  /// \brief Group commits
+  std::atomic<uint64_t> syncs{0};
+};
+
+/// \brief Durable queue of events, that are not handled yet by all targets: with outbox, events waiting in memory
+/// queues (fresh, retry, batch) survive restart or crash, and are sent again (at-least-once).
+/// Segmented append-only log. Record (host byte order): u32 body length, u32 crc32 of body, body: u64 seq,
+/// binary envelope of payload (see MessagePayload::toBinary()), zstd frame of it if length has
+/// SegmentCodec::COMPRESSED flag. Appends only write records (page cache), full segment is synced and replaced
+/// by next one in flusher thread.
+/// Event is acknowledged when last target lets it go (see Ticket). Acknowledgements are kept as checkpoint:
+/// every event with seq up to it is handled. Writes and checkpoint are group-committed: appends are not waiting
+/// for fsync, flusher thread syncs log and writes checkpoint every syncInterval, and deletes segments below it.
+/// Crash loses at most last syncInterval of events, events handled less than syncInterval before crash
+/// (or after older not handled event) are sent again
+class EventOutbox {
+ public:
+    struct Options {
+      /// \brief Segment is closed and new one is started when it grows above this size
+      std::size_t segmentBytes = 64 * 1024 * 1024;
+      /// \brief Group commit interval
+      uint32_t syncIntervalMillis = 100;
+      /// \brief Compression of envelopes
+      SegmentCodec::Options compression;
+    };
+
+    /// \brief Event record, shared by send statuses of all targets. Event is acknowledged when last copy is released
+    class Ticket {
+     public:
+        Ticket(EventOutbox &outbox, uint64_t seq);
+        ~Ticket();
+        Ticket(const Ticket &other) = delete;
+        Ticket &operator=(const Ticket &other) = delete;
+
+        /// \brief Event is dropped without sending (queue is full): it's not acknowledged, so checkpoint stops
+        /// before it and it's sent again on next start
+        void keep() const noexcept;
+
+     private:
+        EventOutbox &m_outbox;
+        const uint64_t m_seq;
+        mutable std::atomic<bool> m_kept{false};
+    };
+    using TicketPtr = std::shared_ptr<const Ticket>;
+    using ReplayHandler = std::function<void(wss::MessagePayload &&payload, TicketPtr ticket)>;
+
+    /// \brief Opens outbox directory (creates if not exists) and recovers not acknowledged events
+    /// \param directory
+    /// \param options
+    /// \throws std::runtime_error if directory or files can't be opened
+    EventOutbox(const std::string &directory, const Options &options);
+    /// \brief Syncs log and checkpoint
+    ~EventOutbox();
+    EventOutbox(const EventOutbox &other) = delete;
+    EventOutbox &operator=(const EventOutbox &other) = delete;
+
+    /// \brief Writes event to log
+    /// \param payload
+    /// \return ticket of event, nullptr if it can't be written (event is sent anyway, but it's not durable)
+    TicketPtr append(const wss::MessagePayload &payload);
+
+    /// \brief Passes every recovered event to handler, once
+    /// \param handler
+    /// \return events count
+    std::size_t replay(const ReplayHandler &handler);
+
+    /// \brief Stops acknowledging: tickets released after this (by stopping notifier) keep their events
+    /// for next start
+    void close();
+
+    /// \brief Not acknowledged events
+    /// \return
+    uint64_t getPending() const;
+    const OutboxMetrics &getMetrics() const noexcept;
+    /// \brief Envelopes compression
+    const SegmentCodec &getCodec() const noexcept;
+
+ private:
+    struct FileHandle {
+      explicit FileHandle(int fd) : fd(fd) { }
+      ~FileHandle();
+      const int fd;
+    };
+    struct Segment {
+      std::shared_ptr<FileHandle> file;
+      uint64_t size = 0;
+      /// \brief Seq of last record, 0 - empty segment
+      uint64_t lastSeq = 0;
+    };
+    /// \brief Recovered record position
+    struct Location {
+      uint64_t segment;
+      uint64_t offset;
+      uint32_t length;
+      uint64_t seq;
+    };
+
+    const std::string m_directory;
+    const Options m_options;
+    OutboxMetrics m_metrics;
+
+    mutable std::mutex m_lock;
+    std::map<uint64_t, Segment> m_segments;
+    uint64_t m_activeSegment = 0;
+    uint64_t m_seq = 0;
+    /// \brief Every event up to this seq is acknowledged
+    uint64_t m_checkpoint = 0;
+    /// \brief Checkpoint written to disk
+    uint64_t m_syncedCheckpoint = 0;
+    /// \brief Ack flags of events after checkpoint
+    std::deque<bool> m_acked;
+    std::vector<Location> m_recovered;
+    bool m_dirty = false;
+    bool m_closed = false;
+    /// \brief Active segment is full: flusher starts next one
+    bool m_rotate = false;
+    std::unique_ptr<SegmentCodec> m_codec;
+
+    std::condition_variable m_flushCondition;
+    bool m_stop = false;
+    std::thread m_flusher;
+
+    std::string segmentPath(uint64_t segment) const;
+    std::string checkpointPath() const;
+    void recover();
+    void recoverSegment(uint64_t segment);
+    void openSegment(uint64_t segment);
+    /// \brief Creates segment file and syncs directory entry of it
+    /// \throws std::runtime_error
+    std::shared_ptr<FileHandle> createSegment(uint64_t segment) const;
+    void readCheckpoint();
+    /// \throws std::runtime_error
+    void writeCheckpoint(uint64_t checkpoint);
+
+    void ack(uint64_t seq);
+    void flushLoop();
+    /// \brief Switches appends to next segment, file is created and previous one is synced without lock
+    void rotateLocked(std::unique_lock<std::mutex> &lock);
+    void syncLocked(std::unique_lock<std::mutex> &lock);
+};
+
+}
+}
+
+#endif //WSSERVER_EVENTOUTBOX_H
@@ -0,0 +1,174 @@
+/**
+ * wsserver
+ * KafkaTarget.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "KafkaTarget.h"
+#include "../base/Affinity.h"
+
+wss::event::KafkaTarget::KafkaTarget(const nlohmann::json &config) :
+    Target(config),
+    m_stop(false) {
+    const std::string brokers = config.value("brokers", "");
+    m_topic = config.value("topic", "");
+    if (brokers.empty()) {
+        appendErrorMessage("Kafka target: brokers required");
+    }
+    if (m_topic.empty()) {
+        appendErrorMessage("Kafka target: topic required");
+    }
+    if (!isValid()) {
+        return;
+    }
+
+    const std::string key = config.value("partitionKey", "sender");
+    if (toolboxpp::strings::equalsIgnoreCase(key, "sender")) {
+        m_partitionKey = Sender;
+    } else if (toolboxpp::strings::equalsIgnoreCase(key, "recipient")) {
+        m_partitionKey = Recipient;
+    } else if (toolboxpp::strings::equalsIgnoreCase(key, "none")) {
+        m_partitionKey = None;
+    } else {
+        appendErrorMessage(fmt::format("Unknown partition key for kafka target: {0}", key));
+        return;
+    }
+    m_deliveryTimeoutMs = config.value("deliveryTimeoutMs", (uint32_t) 30000);
+
+    char error[512];
+    rd_kafka_conf_t *conf = rd_kafka_conf_new();
+    const auto &set = [this, conf, &error](const std::string &name, const std::string &value) {
+      if (rd_kafka_conf_set(conf, name.c_str(), value.c_str(), error, sizeof(error)) != RD_KAFKA_CONF_OK) {
+          appendErrorMessage(fmt::format("Kafka target {0}: {1}", name, error));
+      }
+    };
+    set("bootstrap.servers", brokers);
+    set("linger.ms", std::to_string(config.value("lingerMs", (uint32_t) 5)));
+    set("compression.codec", config.value("compression", "lz4"));
+    set("acks", config.value("acks", "all"));
+    set("message.timeout.ms", std::to_string(m_deliveryTimeoutMs));
+    if (config.find("properties") != config.end()) {
+        for (auto &item: config.at("properties").items()) {
+            set(item.key(), item.value().get<std::string>());
+        }
+    }
+    rd_kafka_conf_set_dr_msg_cb(conf, &KafkaTarget::onDelivery);
+    if (!isValid()) {
+        rd_kafka_conf_destroy(conf);
+        return;
+    }
+
+    // producer owns conf on success
+    m_producer = rd_kafka_new(RD_KAFKA_PRODUCER, conf, error, sizeof(error));
+    if (m_producer == nullptr) {
+        rd_kafka_conf_destroy(conf);
+        appendErrorMessage(fmt::format("Unable to create kafka producer: {0}", error));
+        return;
+    }
+    m_poller = std::thread(&KafkaTarget::pollLoop, this);
+}
+
+wss::event::KafkaTarget::~KafkaTarget() {
+    m_stop = true;
+    if (m_poller.joinable()) {
+        m_poller.join();
+    }
+    if (m_producer != nullptr) {
+        rd_kafka_flush(m_producer, static_cast<int>(m_deliveryTimeoutMs));
+        rd_kafka_destroy(m_producer);
+    }
+}
+
+void wss::event::KafkaTarget::pollLoop() {
+    wss::affinity::pin(wss::affinity::Group::Events);
+    while (!m_stop) {
+        rd_kafka_poll(m_producer, 100);
+    }
+}
+
+void wss::event::KafkaTarget::onDelivery(rd_kafka_t *, const rd_kafka_message_t *message, void *) {
+    const auto *report = static_cast<const Report *>(message->_private);
+    Delivery &delivery = *report->delivery;
+    std::lock_guard<std::mutex> lock(delivery.mutex);
+    if (message->err) {
+        (*delivery.errors)[report->index] = fmt::format("Kafka partition {0}: {1}",
+                                                        message->partition, rd_kafka_err2str(message->err));
+    } else {
+        (*delivery.sent)[report->index] = true;
+    }
+    if (--delivery.pending == 0) {
+        delivery.done.notify_all();
+    }
+}
+
+bool wss::event::KafkaTarget::send(const wss::MessagePayload &payload, std::string &error) {
+    std::vector<bool> sent;
+    std::vector<std::string> errors;
+    sendBatch({&payload}, sent, errors);
+    error = std::move(errors[0]);
+    return sent[0];
+}
+
+void wss::event::KafkaTarget::sendBatch(const std::vector<const wss::MessagePayload *> &payloads,
+                                        std::vector<bool> &sent,
+                                        std::vector<std::string> &errors) {
+    sent.assign(payloads.size(), false);
+    errors.assign(payloads.size(), std::string());
+    if (m_producer == nullptr) {
+        errors.assign(payloads.size(), "Kafka producer is not created");
+        return;
+    }
+
+    // values are not copied by producer: they are kept until delivery reports
+    std::vector<std::string> messages(payloads.size());
+    std::vector<Report> reports(payloads.size());
+    Delivery delivery;
+    delivery.sent = &sent;
+    delivery.errors = &errors;
+
+    for (std::size_t i = 0; i < payloads.size(); i++) {
+        const wss::MessagePayload &payload = *payloads[i];
+        messages[i] = getCodec().encode(payload);
+        reports[i] = {&delivery, i};
+
+        std::string key;
+        if (m_partitionKey == Sender) {
+            key = std::to_string(payload.getSender());
+        } else if (m_partitionKey == Recipient && !payload.getRecipients().empty()) {
+            key = std::to_string(payload.getRecipients()[0]);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(delivery.mutex);
+            delivery.pending++;
+        }
+        rd_kafka_resp_err_t result = RD_KAFKA_RESP_ERR_NO_ERROR;
+        for (int attempt = 0; attempt < 2; attempt++) {
+            result = rd_kafka_producev(m_producer,
+                                       RD_KAFKA_V_TOPIC(m_topic.c_str()),
+                                       RD_KAFKA_V_VALUE(&messages[i][0], messages[i].size()),
+                                       RD_KAFKA_V_KEY(key.empty() ? nullptr : key.data(), key.size()),
+                                       RD_KAFKA_V_OPAQUE(&reports[i]),
+                                       RD_KAFKA_V_END);
+            if (result != RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+                break;
+            }
+            // local queue is full: wait for in-flight requests, then try once more
+            rd_kafka_poll(m_producer, 100);
+        }
+        if (result != RD_KAFKA_RESP_ERR_NO_ERROR) {
+            std::lock_guard<std::mutex> lock(delivery.mutex);
+            delivery.pending--;
+            errors[i] = rd_kafka_err2str(result);
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(delivery.mutex);
+    delivery.done.wait(lock, [&delivery] { return delivery.pending == 0; });
+}
+
+std::string wss::event::KafkaTarget::getType() {
+    return "kafka";
+}
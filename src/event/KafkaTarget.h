@@ -0,0 +1,85 @@
+/**
+ * wsserver
+ * KafkaTarget.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_KAFKATARGET_H
+#define WSSERVER_KAFKATARGET_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <librdkafka/rdkafka.h>
+#include "Target.hpp"
+
+namespace wss {
+namespace event {
+
+/// \brief Produces events to kafka topic. Produce is asynchronous: librdkafka collects messages of all workers to
+/// batches (linger, compression), and sendBatch() only waits for delivery reports of its events,
+/// so every event gets own result (with partition in error), which goes to retry or fallback as usual.
+/// Config:
+///     "brokers": "host1:9092,host2:9092" - required
+///     "topic": "wsserver_events" - required
+///     "partitionKey": "sender" - message key: sender, recipient (first one) or none (librdkafka partitioner)
+///     "lingerMs": 5 - how long producer collects messages before request (linger.ms)
+///     "compression": "lz4" - none, gzip, snappy, lz4 or zstd (compression.codec)
+///     "acks": "all" - broker acknowledgements required for delivery (acks)
+///     "deliveryTimeoutMs": 30000 - delivery report with error comes after this time (message.timeout.ms)
+///     "properties": {} - any other librdkafka producer properties, string values
+class KafkaTarget : public wss::event::Target {
+ public:
+    enum PartitionKey {
+      Sender,
+      Recipient,
+      None
+    };
+
+    explicit KafkaTarget(const nlohmann::json &config);
+    /// \brief Waits for delivery of produced events (not longer than delivery timeout)
+    ~KafkaTarget();
+
+    bool send(const wss::MessagePayload &payload, std::string &error) override;
+
+    /// \brief Produces all events at once and waits for their delivery reports
+    void sendBatch(const std::vector<const wss::MessagePayload *> &payloads,
+                   std::vector<bool> &sent,
+                   std::vector<std::string> &errors) override;
+    std::string getType() override;
+
+ private:
+    /// \brief Results of one sendBatch() call, filled by delivery report callback
+    struct Delivery {
+      std::mutex mutex;
+      std::condition_variable done;
+      std::size_t pending = 0;
+      std::vector<bool> *sent;
+      std::vector<std::string> *errors;
+    };
+    /// \brief Message opaque
+    struct Report {
+      Delivery *delivery;
+      std::size_t index;
+    };
+
+    rd_kafka_t *m_producer = nullptr;
+    std::string m_topic;
+    PartitionKey m_partitionKey = Sender;
+    uint32_t m_deliveryTimeoutMs = 30000;
+    std::atomic_bool m_stop;
+    /// \brief Serves delivery reports
+    std::thread m_poller;
+
+    /// \brief Called by poller thread
+    static void onDelivery(rd_kafka_t *producer, const rd_kafka_message_t *message, void *opaque);
+    void pollLoop();
+};
+
+}
+}
+
+#endif //WSSERVER_KAFKATARGET_H
@@ -7,29 +7,81 @@
  */
 
 #include "PostbackTarget.h"
+#include <cstring>
 #include <type_traits>
+#include "../base/Tracing.h"
 
-bool wss::event::PostbackTarget::send(const wss::MessagePayload &payload, std::string &error) {
-    const std::string out = payload.toJson();
-    if (out.length() < 1000) {
-        //L_DEBUG_F("Event-Send", "Request body: %s", out.c_str());
-    }
-
+wss::web::Response wss::event::PostbackTarget::post(const std::string &body,
+                                                    const std::string &contentType,
+                                                    std::string &error) {
     wss::web::Request request(m_url);
-    request.setBody(out);
+    request.setBody(body);
     request.setMethod(m_httpMethod);
-    request.setHeader({"Content-Type", "application/json"});
+    request.setHeader({"Content-Type", contentType});
+    const wss::tracing::SpanContext &span = wss::tracing::current();
+    if (span.sampled) {
+        request.setHeader({"traceparent", span.toTraceparent()});
+    }
 
     m_auth->performAuth(request);
     wss::web::Response response = getClient().execute(request);
-    bool success = response.isSuccess();
-    std::stringstream ss;
-    ss << response.statusMessage << "\n" << response.data;
-    if (!success) {
+    if (!response.isSuccess()) {
+        std::stringstream ss;
+        ss << response.statusMessage << "\n" << response.data;
         error = ss.str();
     }
+    return response;
+}
+
+bool wss::event::PostbackTarget::send(const wss::MessagePayload &payload, std::string &error) {
+    const std::string out = getCodec().encode(payload);
+    if (out.length() < 1000) {
+        //L_DEBUG_F("Event-Send", "Request body: %s", out.c_str());
+    }
 
-    return success;
+    return post(out, getCodec().getMediaType(), error).isSuccess();
+}
+
+void wss::event::PostbackTarget::sendBatch(const std::vector<const wss::MessagePayload *> &payloads,
+                                           std::vector<bool> &sent,
+                                           std::vector<std::string> &errors) {
+    sent.assign(payloads.size(), false);
+    errors.assign(payloads.size(), std::string());
+    if (payloads.empty()) {
+        return;
+    }
+
+    std::string body;
+    body.reserve(payloads.size() * 256);
+    body += m_ndjson ? "" : "[";
+    for (std::size_t i = 0; i < payloads.size(); i++) {
+        if (i > 0) {
+            body += m_ndjson ? '\n' : ',';
+        }
+        body += getCodec().encode(*payloads[i]);
+    }
+    body += m_ndjson ? "\n" : "]";
+
+    std::string error;
+    const wss::web::Response response = post(body, m_ndjson ? "application/x-ndjson" : "application/json", error);
+    if (!response.isSuccess()) {
+        errors.assign(payloads.size(), error);
+        return;
+    }
+
+    sent.assign(payloads.size(), true);
+    const nlohmann::json results = nlohmann::json::parse(response.data, nullptr, false);
+    if (!results.is_array() || results.size() != payloads.size()) {
+        return;
+    }
+    for (std::size_t i = 0; i < payloads.size(); i++) {
+        const nlohmann::json &item = results[i];
+        sent[i] = (item.is_boolean() && item.get<bool>())
+            || (item.is_object() && item.value("success", false));
+        if (!sent[i]) {
+            errors[i] = item.dump();
+        }
+    }
 }
 
 std::string wss::event::PostbackTarget::getType() {
@@ -53,8 +105,19 @@ wss::event::PostbackTarget::PostbackTarget(const nlohmann::json &config) :
             m_httpMethod = req.methodFromString(config.value(std::string("method"), "POST"));
         }
 
+        const std::string batchFormat = config.value("batchFormat", std::string("array"));
+        if (batchFormat != "array" && batchFormat != "ndjson") {
+            throw std::runtime_error("Unknown batchFormat: " + batchFormat + ". Available: array, ndjson");
+        }
+        m_ndjson = batchFormat == "ndjson";
+        if (getBatchSize() > 1 && std::strcmp(getCodec().getName(), wss::SUBPROTOCOL_JSON_V1) != 0) {
+            throw std::runtime_error("Batch mode requires format " + std::string(wss::SUBPROTOCOL_JSON_V1));
+        }
+
         m_client.enableVerbose(false);
         m_client.setConnectionTimeout(config.value("connectionTimeoutSeconds", 10L));
+        // concurrent sends of lane workers (maxInFlight) become streams of one connection
+        m_client.setHttp2(config.value("http2", false));
     } catch (const std::exception &e) {
         setErrorMessage("Invalid postback target configuration. " + std::string(e.what()));
     }
@@ -26,6 +26,13 @@ class PostbackTarget : public Target {
     explicit PostbackTarget(const json &config);
 
     bool send(const wss::MessagePayload &payload, std::string &error) override;
+
+    /// \brief Posts events as one request: json array or newline delimited json ("batchFormat": "array" or "ndjson").
+    /// Receiver may answer with json array, one item per event: true or {"success": true} if event is accepted,
+    /// anything else is an error of this event. Other successful response accepts all events
+    void sendBatch(const std::vector<const wss::MessagePayload *> &payloads,
+                   std::vector<bool> &sent,
+                   std::vector<std::string> &errors) override;
     std::string getType() override;
 
  protected:
@@ -43,10 +50,18 @@ class PostbackTarget : public Target {
     template<class T>
     void setAuth(T &&auth);
 
+    /// \brief Sends request with auth
+    /// \param body
+    /// \param contentType
+    /// \param error
+    /// \return received response
+    wss::web::Response post(const std::string &body, const std::string &contentType, std::string &error);
+
     wss::web::Request::Method m_httpMethod;
     std::unique_ptr<wss::Auth> m_auth;
     wss::web::HttpClient m_client;
     std::string m_url;
+    bool m_ndjson = false;
 
 };
 
@@ -7,109 +7,333 @@
  */
 
 #include "RedisTarget.h"
+#include <algorithm>
+#include <random>
+#include "../base/Affinity.h"
+#include "../helpers/logging.h"
+
 wss::event::RedisTarget::RedisTarget(const nlohmann::json &config) :
     Target(config),
     modeTargetName("wsserver_events_queue"),
-    mode(Queue) {
+    mode(Queue),
+    m_connected(false),
+    m_stop(false) {
 
     if (config.find("unixSocket") != config.end()) {
-        const std::string sock = config.at("unixSocket").get<std::string>();
-        client.connect(sock,
-                       0,
-                       [this, &config](const std::string &host, size_t, cpp_redis::client::connect_state status) {
-                         if (status == cpp_redis::client::connect_state::failed) {
-                             appendErrorMessage(fmt::format("Can't connect to redis: {0}", host));
-                         } else if (status == cpp_redis::client::connect_state::ok) {
-                             onConnected(config);
-                         }
-                       });
+        m_host = config.at("unixSocket").get<std::string>();
+        m_port = 0;
     } else {
-        const std::string addr = config.value("address", "127.0.0.1");
-        size_t portNum = config.value("port", (size_t) 6379);
-        try {
-            client.connect(addr,
-                           portNum,
-                           [this, &config](const std::string &host,
-                                           size_t port,
-                                           cpp_redis::client::connect_state status) {
-                             if (status == cpp_redis::client::connect_state::failed) {
-                                 appendErrorMessage(fmt::format("Can't connect to redis: {0}:{1}", host, port));
-                             } else if (status == cpp_redis::client::connect_state::ok) {
-                                 onConnected(config);
-                             }
-                           });
-        } catch (const std::exception &err) {
-            appendErrorMessage(err.what());
+        m_host = config.value("address", "127.0.0.1");
+        m_port = config.value("port", (size_t) 6379);
+    }
+    if (config.find("database") != config.end()) {
+        m_database = config.at("database").get<int>();
+    }
+    if (config.find("password") != config.end()) {
+        m_password = config.at("password").get<std::string>();
+    }
+
+    if (config.find("mode") != config.end()) {
+        const nlohmann::json modeObj = config.at("mode");
+        const std::string m = modeObj.value("type", "queue");
+
+        if (toolboxpp::strings::equalsIgnoreCase(m, "queue")) {
+            mode = Queue;
+            modeTargetName = modeObj.value("name", "wsserver_events_queue");
+        } else if (toolboxpp::strings::equalsIgnoreCase(m, "channel")) {
+            mode = Channel;
+            modeTargetName = modeObj.value("name", "wsserver_events_channel");
+        } else {
+            appendErrorMessage(fmt::format("Unknown mode for redis target: {0}", m));
             return;
         }
-
     }
 
-    client.sync_commit();
+    m_connectTimeoutMs = config.value("connectTimeoutMs", (uint32_t) 3000);
+    m_reconnectPolicy.interval = std::chrono::milliseconds(config.value("reconnectIntervalMs", (uint32_t) 100));
+    m_reconnectPolicy.maxInterval =
+        std::chrono::milliseconds(config.value("reconnectMaxIntervalMs", (uint32_t) 30000));
+    m_bufferSize = config.value("bufferSize", (std::size_t) 10000);
+    m_bufferWait = std::chrono::milliseconds(config.value("bufferWaitMs", (uint32_t) 10000));
+
+    m_connector = std::thread(&RedisTarget::connectLoop, this);
 }
 
 bool wss::event::RedisTarget::send(const wss::MessagePayload &msg, std::string &err) {
-    const std::string jsonMsg = msg.toJson();
+    std::vector<bool> sent;
+    std::vector<std::string> errors;
+    sendBatch({&msg}, sent, errors);
+    err = std::move(errors[0]);
+    return sent[0];
+}
 
-    bool success = true;
+void wss::event::RedisTarget::sendBatch(const std::vector<const wss::MessagePayload *> &payloads,
+                                        std::vector<bool> &sent,
+                                        std::vector<std::string> &errors) {
+    sent.assign(payloads.size(), false);
+    errors.assign(payloads.size(), std::string());
+    if (payloads.empty()) {
+        return;
+    }
 
-    const auto result = [&success, &err](const cpp_redis::reply &reply) {
-      if (reply.is_error()) {
-          success = false;
-          err = reply.error();
-      }
-    };
+    std::vector<std::string> messages;
+    messages.reserve(payloads.size());
+    for (const wss::MessagePayload *payload: payloads) {
+        messages.push_back(getCodec().encode(*payload));
+    }
 
-    switch (mode) {
-        case Queue:client.rpush(modeTargetName, {msg.toJson()}, result);
-            break;
-        case Channel:client.publish(modeTargetName, msg.toJson(), result);
-            break;
+    // events without reply (not connected or connection dropped during commit) are buffered
+    std::vector<bool> replied(messages.size(), false);
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (m_ready && m_connected) {
+        switch (mode) {
+            case Queue:
+                // list push is atomic: all events are pushed or none
+                client.rpush(modeTargetName, messages, [&sent, &errors, &replied](const cpp_redis::reply &reply) {
+                  replied.assign(replied.size(), true);
+                  if (reply.is_error()) {
+                      errors.assign(errors.size(), reply.error());
+                  } else {
+                      sent.assign(sent.size(), true);
+                  }
+                });
+                break;
+            case Channel:
+                for (std::size_t i = 0; i < messages.size(); i++) {
+                    client.publish(modeTargetName, messages[i], [&sent, &errors, &replied, i](const cpp_redis::reply &reply) {
+                      replied[i] = true;
+                      if (reply.is_error()) {
+                          errors[i] = reply.error();
+                      } else {
+                          sent[i] = true;
+                      }
+                    });
+                }
+                break;
+        }
+
+        try {
+            client.sync_commit();
+        } catch (const std::exception &e) {
+            WSS_LOG_F(wss::logging::LevelWarning, "Event::Redis", "Unable to send to redis: %s", e.what());
+        }
     }
 
-    client.sync_commit();
+    // buffered event is reported only by flush, so rejected and not flushed in time ones are retried as usual
+    std::vector<std::shared_ptr<Buffered>> buffered(messages.size());
+    for (std::size_t i = 0; i < messages.size(); i++) {
+        if (replied[i]) {
+            continue;
+        }
+        if (m_buffer.size() < m_bufferSize) {
+            buffered[i] = std::make_shared<Buffered>();
+            buffered[i]->message = std::move(messages[i]);
+            m_buffer.push_back(buffered[i]);
+        } else {
+            errors[i] = "Redis is not connected, buffer is full";
+        }
+    }
 
-    return success;
+    const auto flushed = [&buffered] {
+      for (const auto &event: buffered) {
+          if (event && !event->flushed) {
+              return false;
+          }
+      }
+      return true;
+    };
+    m_flushed.wait_for(lock, m_bufferWait, [this, &flushed] { return m_stop || flushed(); });
+
+    for (std::size_t i = 0; i < buffered.size(); i++) {
+        if (!buffered[i]) {
+            continue;
+        }
+        if (buffered[i]->flushed) {
+            sent[i] = buffered[i]->error.empty();
+            errors[i] = std::move(buffered[i]->error);
+        } else {
+            m_buffer.erase(std::find(m_buffer.begin(), m_buffer.end(), buffered[i]));
+            errors[i] = "Redis is not connected, event is not flushed in time";
+        }
+    }
 }
+
 std::string wss::event::RedisTarget::getType() {
     return "redis";
 }
+
 wss::event::RedisTarget::~RedisTarget() {
+    {
+        std::lock_guard<std::mutex> state(m_stateLock);
+        m_stop = true;
+    }
+    m_stateChanged.notify_all();
+    if (m_connector.joinable()) {
+        m_connector.join();
+    }
+
+    m_flushed.notify_all();
+
+    std::lock_guard<std::mutex> lock(m_lock);
     if (client.is_connected()) {
         client.disconnect(true);
     }
+    if (!m_buffer.empty()) {
+        WSS_LOG_F(wss::logging::LevelWarning, "Event::Redis", "%lu buffered events are not sent to redis",
+                  static_cast<unsigned long>(m_buffer.size()));
+    }
 }
-void wss::event::RedisTarget::onConnected(const nlohmann::json &config) {
-    if (config.find("database") != config.end()) {
-        client.select(config.at("database").get<int>(), [this](cpp_redis::reply &reply) {
-          if (reply.is_error()) {
-              appendErrorMessage(std::string(reply.error()));
-          }
+
+void wss::event::RedisTarget::connectLoop() {
+    wss::affinity::pin(wss::affinity::Group::Events);
+    std::mt19937 random(std::random_device{}());
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    int attempt = 0;
+
+    while (!m_stop) {
+        if (m_connected) {
+            std::unique_lock<std::mutex> state(m_stateLock);
+            m_stateChanged.wait(state, [this] { return m_stop || !m_connected; });
+            continue;
+        }
+
+        {
+            // senders don't use client until it's connected and buffered events are flushed
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_ready = false;
+        }
+        std::string error;
+        if (connect(error)) {
+            // senders wait until buffered events are flushed, so order of events is kept
+            std::lock_guard<std::mutex> lock(m_lock);
+            flushBuffer();
+            m_ready = true;
+        }
+        if (m_connected) {
+            if (attempt > 0) {
+                WSS_LOG_F(wss::logging::LevelInfo, "Event::Redis", "Connected to redis %s:%lu after %d attempts",
+                          m_host.c_str(), static_cast<unsigned long>(m_port), attempt);
+            }
+            attempt = 0;
+            continue;
+        }
+
+        attempt++;
+        if (attempt == 1) {
+            WSS_LOG_F(wss::logging::LevelWarning, "Event::Redis", "Can't connect to redis %s:%lu: %s, reconnecting",
+                      m_host.c_str(), static_cast<unsigned long>(m_port), error.c_str());
+        }
+        std::unique_lock<std::mutex> state(m_stateLock);
+        m_stateChanged.wait_for(state, m_reconnectPolicy.getDelay(attempt, unit(random)), [this] {
+          return m_stop.load();
         });
     }
+}
 
-    if (config.find("password") != config.end()) {
-        const std::string pass = config.at("password").get<std::string>();
-        client.auth(pass, [this](const cpp_redis::reply &reply) {
-          if (reply.is_error()) {
-              appendErrorMessage(std::string(reply.error()));
-          }
-        });
+bool wss::event::RedisTarget::connect(std::string &error) {
+    try {
+        client.connect(m_host, m_port, [this](const std::string &, size_t, cpp_redis::client::connect_state status) {
+          onStateChanged(status);
+        }, m_connectTimeoutMs);
+    } catch (const std::exception &e) {
+        error = e.what();
+        return false;
     }
+    if (!client.is_connected()) {
+        error = "connection failed";
+        return false;
+    }
+    // set before setup: drop during setup or flush resets it
+    m_connected = true;
 
-    if (config.find("mode") != config.end()) {
-        const nlohmann::json modeObj = config.at("mode");
-        const std::string m = modeObj.value("type", "queue");
+    std::string setupError;
+    const auto onReply = [&setupError](const cpp_redis::reply &reply) {
+      if (reply.is_error()) {
+          setupError = reply.error();
+      }
+    };
+    if (!m_password.empty()) {
+        client.auth(m_password, onReply);
+    }
+    if (m_database >= 0) {
+        client.select(m_database, onReply);
+    }
+    try {
+        client.sync_commit();
+    } catch (const std::exception &e) {
+        setupError = e.what();
+    }
+    if (!setupError.empty()) {
+        error = std::move(setupError);
+        m_connected = false;
+        client.disconnect(true);
+        return false;
+    }
+    return m_connected;
+}
 
-        if (toolboxpp::strings::equalsIgnoreCase(m, "queue")) {
-            mode = Queue;
-            modeTargetName = modeObj.value("name", "wsserver_events_queue");
-        } else if (toolboxpp::strings::equalsIgnoreCase(m, "channel")) {
-            mode = Channel;
-            modeTargetName = modeObj.value("name", "wsserver_events_channel");
-        } else {
-            appendErrorMessage(fmt::format("Unknown mode for redis target: {0}", m));
-            return;
-        }
+void wss::event::RedisTarget::onStateChanged(cpp_redis::client::connect_state status) {
+    if (status != cpp_redis::client::connect_state::dropped) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> state(m_stateLock);
+        m_connected = false;
+    }
+    m_stateChanged.notify_all();
+    WSS_LOG_F(wss::logging::LevelWarning, "Event::Redis", "Connection to redis %s:%lu is lost, reconnecting",
+              m_host.c_str(), static_cast<unsigned long>(m_port));
+}
+
+void wss::event::RedisTarget::flushBuffer() {
+    if (m_buffer.empty()) {
+        return;
+    }
+
+    std::vector<std::string> messages;
+    messages.reserve(m_buffer.size());
+    for (const auto &event: m_buffer) {
+        messages.push_back(event->message);
+    }
+    const std::vector<std::shared_ptr<Buffered>> events(m_buffer.begin(), m_buffer.end());
+    const auto onReply = [](Buffered &event, const cpp_redis::reply &reply) {
+      event.flushed = true;
+      if (reply.is_error()) {
+          event.error = reply.error();
+      }
+    };
+    switch (mode) {
+        case Queue:
+            client.rpush(modeTargetName, messages, [&events, &onReply](const cpp_redis::reply &reply) {
+              for (const auto &event: events) {
+                  onReply(*event, reply);
+              }
+            });
+            break;
+        case Channel:
+            for (std::size_t i = 0; i < messages.size(); i++) {
+                client.publish(modeTargetName, messages[i], [&events, &onReply, i](const cpp_redis::reply &reply) {
+                  onReply(*events[i], reply);
+                });
+            }
+            break;
+    }
+
+    try {
+        client.sync_commit();
+    } catch (const std::exception &e) {
+        WSS_LOG_F(wss::logging::LevelWarning, "Event::Redis", "Unable to flush buffered events: %s", e.what());
+    }
+
+    // replies come in order of commands, so replied events are first ones; senders get rejected ones back
+    std::size_t replied = 0;
+    std::size_t failed = 0;
+    while (!m_buffer.empty() && m_buffer.front()->flushed) {
+        failed += m_buffer.front()->error.empty() ? 0 : 1;
+        m_buffer.pop_front();
+        replied++;
     }
+    m_flushed.notify_all();
+    WSS_LOG_F(wss::logging::LevelInfo, "Event::Redis", "Flushed %lu buffered events to redis, %lu rejected",
+              static_cast<unsigned long>(replied), static_cast<unsigned long>(failed));
 }
@@ -9,11 +9,33 @@
 #ifndef WSSERVER_REDISTARGET_H
 #define WSSERVER_REDISTARGET_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <cpp_redis/core/client.hpp>
 #include "Target.hpp"
 
 namespace wss {
 namespace event {
+
+/// \brief Pushes events to redis list or publishes them to channel. Connection is opened and restored
+/// by background thread with exponential backoff, so startup doesn't wait for redis.
+/// While disconnected, senders keep events in bounded local buffer and wait until they are flushed
+/// by one pipeline after reconnect: event is reported sent only by redis reply.
+/// Config:
+///     "address": "127.0.0.1", "port": 6379 or "unixSocket": "/path/to/redis.sock"
+///     "database", "password" - selected and sent on every connect
+///     "mode": {"type": "queue" or "channel", "name": list or channel name}
+///     "connectTimeoutMs": 3000
+///     "reconnectIntervalMs": 100 - first reconnect delay, doubled on every failed attempt
+///     "reconnectMaxIntervalMs": 30000
+///     "bufferSize": 10000 - events kept while disconnected, events over it fail (and are retried as usual).
+///         0 - events fail while disconnected
+///     "bufferWaitMs": 10000 - how long sender waits for flush of buffered events, not flushed ones fail
 class RedisTarget : public wss::event::Target {
  public:
     enum Mode {
@@ -21,18 +43,66 @@ class RedisTarget : public wss::event::Target {
       Channel
     };
 
-    RedisTarget(const nlohmann::json &config);
+    explicit RedisTarget(const nlohmann::json &config);
     ~RedisTarget();
 
     bool send(const wss::MessagePayload &payload, std::string &error) override;
+
+    /// \brief Queue mode: single RPUSH of all events, channel mode: pipelined PUBLISH per event.
+    /// Both are sent by one commit, so batch costs one redis round-trip.
+    /// While disconnected, events are buffered and the call waits up to bufferWaitMs for their flush
+    void sendBatch(const std::vector<const wss::MessagePayload *> &payloads,
+                   std::vector<bool> &sent,
+                   std::vector<std::string> &errors) override;
     std::string getType() override;
 
  private:
     cpp_redis::client client;
     std::string modeTargetName;
     Mode mode;
+    std::string m_host;
+    std::size_t m_port = 0;
+    std::string m_password;
+    int m_database = -1;
+    uint32_t m_connectTimeoutMs = 3000;
+    RetryPolicy m_reconnectPolicy;
+    std::size_t m_bufferSize = 10000;
+    std::chrono::milliseconds m_bufferWait;
+
+    /// \brief Encoded event waiting for connection and its flush result, guarded by m_lock
+    struct Buffered {
+      std::string message;
+      bool flushed = false;
+      /// \brief Redis error if event is rejected
+      std::string error;
+    };
+
+    /// \brief Guards client commands, buffer and m_ready
+    std::mutex m_lock;
+    /// \brief Events waiting for connection, in order of send
+    std::deque<std::shared_ptr<Buffered>> m_buffer;
+    /// \brief Wakes senders waiting for flush of their buffered events
+    std::condition_variable m_flushed;
+    /// \brief Connection is set up and buffer is flushed, so senders may use client
+    bool m_ready = false;
+
+    std::atomic_bool m_connected;
+    std::atomic_bool m_stop;
+    /// \brief Wakes connector on drop and stop. Client callbacks lock only this, never m_lock:
+    /// they are called by client io thread while sync_commit() waits for it
+    std::mutex m_stateLock;
+    std::condition_variable m_stateChanged;
+    std::thread m_connector;
 
-    void onConnected(const nlohmann::json &config);
+    void connectLoop();
+    /// \brief Connects, sends auth and select
+    /// \param error
+    /// \return false if connection is not ready
+    bool connect(std::string &error);
+    void onStateChanged(cpp_redis::client::connect_state status);
+    /// \brief Sends buffered events by one commit, removes replied ones (sent or rejected) and wakes their senders.
+    /// Those without reply (connection is dropped again) are kept
+    void flushBuffer();
 };
 }
 }
@@ -0,0 +1,106 @@
+/**
+ * wsserver
+ * StreamTarget.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "StreamTarget.h"
+
+wss::event::StreamTarget::StreamTarget(const nlohmann::json &config) :
+    Target(config),
+    m_name(config.value("name", "events")),
+    m_capacity(config.value("capacity", (std::size_t) 100000)) {
+    if (config.value("format", std::string(wss::SUBPROTOCOL_JSON_V1)) != wss::SUBPROTOCOL_JSON_V1) {
+        appendErrorMessage(fmt::format("Stream target supports only {0} format", wss::SUBPROTOCOL_JSON_V1));
+    }
+    if (m_capacity == 0) {
+        appendErrorMessage("Stream target capacity must be positive");
+    }
+}
+
+bool wss::event::StreamTarget::send(const wss::MessagePayload &payload, std::string &error) {
+    std::vector<bool> sent;
+    std::vector<std::string> errors;
+    sendBatch({&payload}, sent, errors);
+    error = std::move(errors[0]);
+    return sent[0];
+}
+
+void wss::event::StreamTarget::sendBatch(const std::vector<const wss::MessagePayload *> &payloads,
+                                         std::vector<bool> &sent,
+                                         std::vector<std::string> &errors) {
+    sent.assign(payloads.size(), true);
+    errors.assign(payloads.size(), std::string());
+    if (payloads.empty()) {
+        return;
+    }
+
+    std::vector<std::string> encoded;
+    encoded.reserve(payloads.size());
+    for (const wss::MessagePayload *payload: payloads) {
+        encoded.push_back(getCodec().encode(*payload));
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (auto &data: encoded) {
+            m_events.push_back({m_next++, std::move(data)});
+        }
+        while (m_events.size() > m_capacity) {
+            m_events.pop_front();
+        }
+    }
+    notifySubscribers();
+}
+
+std::string wss::event::StreamTarget::getType() {
+    return "stream";
+}
+
+const std::string &wss::event::StreamTarget::getName() const noexcept {
+    return m_name;
+}
+
+uint64_t wss::event::StreamTarget::read(uint64_t from, std::size_t limit, std::vector<Event> &out) const {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_events.empty()) {
+        return m_next;
+    }
+    const uint64_t first = m_events.front().offset;
+    // offsets are contiguous, so position is computed
+    std::size_t index = from > first ? static_cast<std::size_t>(from - first) : 0;
+    for (; index < m_events.size() && (limit == 0 || out.size() < limit); index++) {
+        out.push_back(m_events[index]);
+    }
+    return first;
+}
+
+uint64_t wss::event::StreamTarget::getNextOffset() const {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_next;
+}
+
+uint64_t wss::event::StreamTarget::subscribe(std::function<void()> &&listener) {
+    std::lock_guard<std::mutex> lock(m_subscribersLock);
+    const uint64_t id = ++m_subscriberId;
+    m_subscribers.emplace(id, std::move(listener));
+    return id;
+}
+
+void wss::event::StreamTarget::unsubscribe(uint64_t id) {
+    std::lock_guard<std::mutex> lock(m_subscribersLock);
+    m_subscribers.erase(id);
+}
+
+std::size_t wss::event::StreamTarget::getSubscribers() const {
+    std::lock_guard<std::mutex> lock(m_subscribersLock);
+    return m_subscribers.size();
+}
+
+void wss::event::StreamTarget::notifySubscribers() {
+    std::lock_guard<std::mutex> lock(m_subscribersLock);
+    for (const auto &subscriber: m_subscribers) {
+        subscriber.second();
+    }
+}
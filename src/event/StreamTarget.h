@@ -0,0 +1,82 @@
+/**
+ * wsserver
+ * StreamTarget.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_STREAMTARGET_H
+#define WSSERVER_STREAMTARGET_H
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include "Target.hpp"
+
+namespace wss {
+namespace event {
+
+/// \brief Events kept for pull consumers: bounded in-memory log, every event gets offset (from 1, ascending).
+/// Consumers read it through rest api (GET /events batches or GET /events/stream server-sent events)
+/// from their own offset, at their own pace, so there is no push per event and no retry storm:
+/// send to this target always succeeds, if consumer is slower than capacity of log, oldest events are lost for it
+/// and reported as gap. Config:
+///     "name": "events" - stream name for consumers (?stream=)
+///     "capacity": 100000 - events kept
+/// Only wss.json.v1 format: events go to text responses
+class StreamTarget : public wss::event::Target {
+ public:
+    struct Event {
+      uint64_t offset;
+      std::string data;
+    };
+
+    explicit StreamTarget(const nlohmann::json &config);
+
+    bool send(const wss::MessagePayload &payload, std::string &error) override;
+    /// \brief Appends all events under one lock and wakes subscribers once
+    void sendBatch(const std::vector<const wss::MessagePayload *> &payloads,
+                   std::vector<bool> &sent,
+                   std::vector<std::string> &errors) override;
+    std::string getType() override;
+
+    const std::string &getName() const noexcept;
+
+    /// \brief Copies events from offset
+    /// \param from first wanted offset, older ones than first kept are skipped
+    /// \param limit max events
+    /// \param out
+    /// \return offset of first kept event (> from means events from..first-1 are lost)
+    uint64_t read(uint64_t from, std::size_t limit, std::vector<Event> &out) const;
+
+    /// \brief Offset that next event gets
+    uint64_t getNextOffset() const;
+
+    /// \brief Listener is called (by event notifier worker) after new events are appended. Must not block
+    /// \param listener
+    /// \return subscription id
+    uint64_t subscribe(std::function<void()> &&listener);
+    void unsubscribe(uint64_t id);
+    std::size_t getSubscribers() const;
+
+ private:
+    std::string m_name;
+    std::size_t m_capacity;
+
+    mutable std::mutex m_lock;
+    std::deque<Event> m_events;
+    uint64_t m_next = 1;
+
+    mutable std::mutex m_subscribersLock;
+    std::map<uint64_t, std::function<void()>> m_subscribers;
+    uint64_t m_subscriberId = 0;
+
+    void notifySubscribers();
+};
+
+}
+}
+
+#endif //WSSERVER_STREAMTARGET_H
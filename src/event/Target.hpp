@@ -9,20 +9,64 @@
 #ifndef WSSERVER_EVENTCONFIG_H
 #define WSSERVER_EVENTCONFIG_H
 
+#include <algorithm>
+#include <chrono>
 #include <string>
+#include <vector>
 #include <curl/curl.h>
 #include "../helpers/base64.h"
 #include "../chat/Message.h"
+#include "../chat/PayloadCodec.h"
 #include "../web/HttpClient.h"
 #include "../base/Settings.hpp"
+#include "EventFilter.h"
 //#include "EventNotifier.h"
 
 namespace wss {
 namespace event {
 
+/// \brief Exponential backoff of failed sends: delay of retry N (from 1) is
+/// interval * multiplier^(N - 1), not longer than maxInterval, reduced by random part up to jitter of it,
+/// so events failed at the same time are not retried at once
+struct RetryPolicy {
+  std::chrono::milliseconds interval{10000};
+  std::chrono::milliseconds maxInterval{300000};
+  double multiplier = 2.0;
+  /// \brief 0 - no jitter, 1 - delay is random between 0 and backoff
+  double jitter = 0.2;
+
+  /// \param retry retry number, from 1
+  /// \param random value in [0, 1)
+  /// \return
+  std::chrono::milliseconds getDelay(int retry, double random) const {
+      double delay = static_cast<double>(interval.count());
+      const double limit = static_cast<double>(std::max(maxInterval, interval).count());
+      for (int i = 1; i < retry && delay < limit; i++) {
+          delay *= multiplier;
+      }
+      delay = std::min(delay, limit);
+      delay -= delay * std::min(std::max(jitter, 0.0), 1.0) * random;
+      return std::chrono::milliseconds(static_cast<int64_t>(delay));
+  }
+};
+
 /// \brief Available:
 /// postback: PostbackTarget
 ///     "url": "http://example.com/postback",
+///     "http2": false - negotiate HTTP/2 (https only), sends of all workers are multiplexed on one connection
+/// Common fields:
+///     "batchSize": 1 - max events sent at once by sendBatch(), 1 - events are sent one by one
+///     "batchLingerMs": 50 - how long first event of incomplete batch waits for others
+///     "maxInFlight": 0 - max workers sending to target at once, 0 - equal share of event notifier workers
+///     "queueCapacity": 10000 - max events waiting for target, new events over it are dropped. 0 - unlimited
+///     "breakerFailures": 5 - consecutive failed sends that open circuit breaker, 0 - breaker is disabled
+///     "breakerOpenSeconds": 30 - how long events go to fallback (or retry) without sending, before probe send
+///     "latencyTargetMs": 0 - adaptive workers limit: it grows by one while sends are faster,
+///         and halves on slower or failed send. 0 - limit is always maxInFlight
+///     "retryIntervalSeconds", "retryMaxIntervalSeconds", "retryBackoffMultiplier", "retryJitter" - retry policy
+///         of target, by default event notifier one (event.* settings with same names)
+///     "filter": {} - only matching events are sent to target, see EventFilter
+///     "projection": ["field", "nested.field"] - only these data fields are sent to target
 class Target {
  public:
     /// \brief Accept json config of entire target object
@@ -31,6 +75,33 @@ class Target {
         m_config(config),
         m_validState(true),
         m_errorMessage("") {
+
+        // same names as websocket subprotocols
+        const std::string format = config.value("format", std::string(wss::SUBPROTOCOL_JSON_V1));
+        m_codec = wss::codec::registry::createByName(format);
+        if (!m_codec) {
+            setErrorMessage("Unknown target format: " + format);
+            m_codec = std::make_unique<wss::JsonCodec>();
+        }
+
+        m_batchSize = std::max(config.value("batchSize", (std::size_t) 1), (std::size_t) 1);
+        m_batchLinger = std::chrono::milliseconds(config.value("batchLingerMs", (uint32_t) 50));
+        m_maxInFlight = config.value("maxInFlight", (uint32_t) 0);
+        m_queueCapacity = config.value("queueCapacity", (std::size_t) 10000);
+        m_breakerFailures = config.value("breakerFailures", (uint32_t) 5);
+        m_breakerOpen = std::chrono::seconds(config.value("breakerOpenSeconds", (uint32_t) 30));
+        m_latencyTarget = std::chrono::milliseconds(config.value("latencyTargetMs", (uint32_t) 0));
+
+        try {
+            if (config.find("filter") != config.end()) {
+                m_filter = std::make_unique<EventFilter>(config.at("filter"));
+            }
+            if (config.find("projection") != config.end()) {
+                m_projection = std::make_unique<EventProjection>(config.at("projection"));
+            }
+        } catch (const std::exception &e) {
+            setErrorMessage(e.what());
+        }
     }
 
     /// \brief Send event to entire target
@@ -38,8 +109,95 @@ class Target {
     /// \param error if method returned false, error will contains error message
     /// \return true if sending complete
     virtual bool send(const wss::MessagePayload &payload, std::string &error) = 0;
+
+    /// \brief Send events to entire target at once. By default sends them one by one
+    /// \param payloads events, not more than getBatchSize()
+    /// \param sent per event result, resized to payloads size
+    /// \param errors per event error message, resized to payloads size
+    virtual void sendBatch(const std::vector<const wss::MessagePayload *> &payloads,
+                           std::vector<bool> &sent,
+                           std::vector<std::string> &errors) {
+        sent.assign(payloads.size(), false);
+        errors.assign(payloads.size(), std::string());
+        for (std::size_t i = 0; i < payloads.size(); i++) {
+            sent[i] = send(*payloads[i], errors[i]);
+        }
+    }
+
     virtual std::string getType() = 0;
 
+    /// \brief Whether event passes target filter
+    /// \param payload
+    /// \return true if target has no filter
+    bool accepts(const wss::MessagePayload &payload) const {
+        return !m_filter || m_filter->matches(payload);
+    }
+
+    /// \brief Event as target receives it
+    /// \param payload
+    /// \return the same payload if target has no projection
+    wss::MessagePayloadPtr project(const wss::MessagePayloadPtr &payload) const {
+        return m_projection ? m_projection->apply(payload) : payload;
+    }
+
+    /// \brief Max events passed to sendBatch()
+    /// \return 1 if each event is sent by send()
+    std::size_t getBatchSize() const {
+        return m_batchSize;
+    }
+
+    /// \brief How long incomplete batch is collected
+    /// \return
+    std::chrono::milliseconds getBatchLinger() const {
+        return m_batchLinger;
+    }
+
+    /// \brief Max workers sending to target at once
+    /// \return 0 if not set in config
+    uint32_t getMaxInFlight() const {
+        return m_maxInFlight;
+    }
+
+    /// \brief Max fresh events waiting for target
+    /// \return 0 - unlimited
+    std::size_t getQueueCapacity() const {
+        return m_queueCapacity;
+    }
+
+    /// \brief Consecutive failed sends that open circuit breaker
+    /// \return 0 - breaker is disabled
+    uint32_t getBreakerFailures() const {
+        return m_breakerFailures;
+    }
+
+    /// \brief How long circuit breaker is open before probe send
+    /// \return
+    std::chrono::seconds getBreakerOpen() const {
+        return m_breakerOpen;
+    }
+
+    /// \brief Send latency that adaptive workers limit keeps
+    /// \return 0 - adaptive limit is disabled
+    std::chrono::milliseconds getLatencyTarget() const {
+        return m_latencyTarget;
+    }
+
+    /// \brief Retry policy of target
+    /// \param defaults event notifier policy, used for fields not set in target config
+    /// \return
+    RetryPolicy getRetryPolicy(const RetryPolicy &defaults) const {
+        RetryPolicy policy = defaults;
+        if (m_config.find("retryIntervalSeconds") != m_config.end()) {
+            policy.interval = std::chrono::seconds(m_config.at("retryIntervalSeconds").get<uint32_t>());
+        }
+        if (m_config.find("retryMaxIntervalSeconds") != m_config.end()) {
+            policy.maxInterval = std::chrono::seconds(m_config.at("retryMaxIntervalSeconds").get<uint32_t>());
+        }
+        policy.multiplier = m_config.value("retryBackoffMultiplier", policy.multiplier);
+        policy.jitter = m_config.value("retryJitter", policy.jitter);
+        return policy;
+    }
+
     /// \brief Check target is in valid state
     /// \return valid state of target object
     bool isValid() const {
@@ -61,6 +219,12 @@ class Target {
     }
 
  protected:
+    /// \brief Payload wire format of target ("format" field of target config)
+    /// \return
+    const wss::PayloadCodec &getCodec() const {
+        return *m_codec;
+    }
+
     /// \brief Set error message to read when object is invalid state. Mark object as in invalid state/
     /// \param msg
     void setErrorMessage(const std::string &msg) {
@@ -102,6 +266,16 @@ class Target {
     nlohmann::json m_config;
     bool m_validState;
     std::string m_errorMessage;
+    std::unique_ptr<wss::PayloadCodec> m_codec;
+    std::size_t m_batchSize = 1;
+    std::chrono::milliseconds m_batchLinger;
+    uint32_t m_maxInFlight = 0;
+    std::size_t m_queueCapacity = 10000;
+    uint32_t m_breakerFailures = 5;
+    std::chrono::seconds m_breakerOpen;
+    std::chrono::milliseconds m_latencyTarget;
+    std::unique_ptr<EventFilter> m_filter;
+    std::unique_ptr<EventProjection> m_projection;
     std::vector<std::shared_ptr<wss::event::Target>> fallbackTargets;
 };
 
@@ -8,92 +8,153 @@
  */
 
 #include "base64.h"
-#include <iostream>
+#include <array>
+#include <cstdint>
 
-static const std::string base64_chars =
+// SSSE3 path is compiled for x86-64 without -mssse3, and chosen by cpu at runtime
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define WSS_BASE64_SSSE3 1
+#include <tmmintrin.h>
+#endif
+
+namespace {
+
+const char BASE64_CHARS[] =
     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
     "abcdefghijklmnopqrstuvwxyz"
     "0123456789+/";
 
-static inline bool is_base64(unsigned char c) {
-    return (isalnum(c) || (c == '+') || (c == '/'));
-}
+const uint8_t INVALID = 0xFF;
 
-std::string wss::utils::base64_encode(unsigned char const *bytes_to_encode, unsigned int in_len) {
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-
-    while (in_len--) {
-        char_array_3[i++] = *(bytes_to_encode++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-
-            for (i = 0; (i < 4); i++)
-                ret += base64_chars[char_array_4[i]];
-            i = 0;
-        }
+/// \brief Character to its 6 bits, INVALID for characters out of alphabet
+std::array<uint8_t, 256> makeDecodeTable() {
+    std::array<uint8_t, 256> table;
+    table.fill(INVALID);
+    for (uint8_t i = 0; i < 64; i++) {
+        table[static_cast<uint8_t>(BASE64_CHARS[i])] = i;
     }
+    return table;
+}
 
-    if (i) {
-        for (j = i; j < 3; j++)
-            char_array_3[j] = '\0';
+const std::array<uint8_t, 256> DECODE_TABLE = makeDecodeTable();
+
+#ifdef WSS_BASE64_SSSE3
+/// \brief Encodes 12 bytes of 16 loaded into 16 characters (W. Mula, "Base64 encoding with SIMD instructions")
+__attribute__((target("ssse3"))) inline __m128i encode12(__m128i in) {
+    // every 3 bytes are spread to 4 lanes of 32-bit word, then each 6 bits are moved to own byte
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    const __m128i indices = _mm_or_si128(t1, t3);
+
+    // offset of character from its index: 0..25 -> 'A', 26..51 -> 'a', 52..61 -> '0', 62 -> '+', 63 -> '/'
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+}
+
+/// \brief Encodes 12-byte blocks while 16 bytes can be loaded
+/// \return encoded input bytes
+__attribute__((target("ssse3"))) std::size_t encodeBlocks(const unsigned char *bytes, std::size_t len, char *out) {
+    std::size_t i = 0;
+    for (; i + 16 <= len; i += 12) {
+        const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), encode12(in));
+        out += 16;
+    }
+    return i;
+}
 
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
+const bool HAS_SSSE3 = __builtin_cpu_supports("ssse3");
+#endif
 
-        for (j = 0; (j < i + 1); j++)
-            ret += base64_chars[char_array_4[j]];
+}
 
-        while ((i++ < 3))
-            ret += '=';
+std::string wss::utils::base64_encode(unsigned char const *bytes, std::size_t len) {
+    std::string ret;
+    ret.resize(((len + 2) / 3) * 4);
+    char *out = &ret[0];
+    std::size_t i = 0;
+
+#ifdef WSS_BASE64_SSSE3
+    if (HAS_SSSE3) {
+        i = encodeBlocks(bytes, len, out);
+        out += (i / 3) * 4;
+    }
+#endif
+
+    for (; i + 3 <= len; i += 3) {
+        const uint32_t triple = (uint32_t(bytes[i]) << 16u) | (uint32_t(bytes[i + 1]) << 8u) | bytes[i + 2];
+        out[0] = BASE64_CHARS[(triple >> 18u) & 0x3Fu];
+        out[1] = BASE64_CHARS[(triple >> 12u) & 0x3Fu];
+        out[2] = BASE64_CHARS[(triple >> 6u) & 0x3Fu];
+        out[3] = BASE64_CHARS[triple & 0x3Fu];
+        out += 4;
+    }
 
+    const std::size_t rest = len - i;
+    if (rest > 0) {
+        uint32_t triple = uint32_t(bytes[i]) << 16u;
+        if (rest == 2) {
+            triple |= uint32_t(bytes[i + 1]) << 8u;
+        }
+        out[0] = BASE64_CHARS[(triple >> 18u) & 0x3Fu];
+        out[1] = BASE64_CHARS[(triple >> 12u) & 0x3Fu];
+        out[2] = rest == 2 ? BASE64_CHARS[(triple >> 6u) & 0x3Fu] : '=';
+        out[3] = '=';
     }
 
     return ret;
-
 }
 
 std::string wss::utils::base64_decode(std::string const &encoded_string) {
-    int in_len = encoded_string.size();
-    int i = 0;
-    int j = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
+    const auto *in = reinterpret_cast<const uint8_t *>(encoded_string.data());
+    const std::size_t len = encoded_string.size();
     std::string ret;
-
-    while (in_len-- && (encoded_string[in_] != '=') && is_base64(encoded_string[in_])) {
-        char_array_4[i++] = encoded_string[in_];
-        in_++;
-        if (i == 4) {
-            for (i = 0; i < 4; i++)
-                char_array_4[i] = base64_chars.find(char_array_4[i]);
-
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-            for (i = 0; (i < 3); i++)
-                ret += char_array_3[i];
-            i = 0;
+    ret.resize((len / 4) * 3 + 2);
+    char *out = &ret[0];
+
+    std::size_t i = 0;
+    for (; i + 4 <= len; i += 4) {
+        const uint8_t a = DECODE_TABLE[in[i]], b = DECODE_TABLE[in[i + 1]];
+        const uint8_t c = DECODE_TABLE[in[i + 2]], d = DECODE_TABLE[in[i + 3]];
+        if (((a | b | c | d) & 0xC0u) != 0) {
+            // padding or junk: finished by tail below
+            break;
         }
+        const uint32_t triple = (uint32_t(a) << 18u) | (uint32_t(b) << 12u) | (uint32_t(c) << 6u) | d;
+        out[0] = static_cast<char>(triple >> 16u);
+        out[1] = static_cast<char>(triple >> 8u);
+        out[2] = static_cast<char>(triple);
+        out += 3;
     }
 
-    if (i) {
-        for (j = 0; j < i; j++)
-            char_array_4[j] = base64_chars.find(char_array_4[j]);
-
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-
-        for (j = 0; (j < i - 1); j++) ret += char_array_3[j];
+    // up to 3 valid characters before end, padding or invalid character
+    uint32_t bits = 0;
+    std::size_t count = 0;
+    for (; i < len && count < 3; i++) {
+        const uint8_t value = DECODE_TABLE[in[i]];
+        if (value == INVALID) {
+            break;
+        }
+        bits = (bits << 6u) | value;
+        count++;
+    }
+    if (count == 3) {
+        bits <<= 6u;
+        *out++ = static_cast<char>(bits >> 16u);
+        *out++ = static_cast<char>(bits >> 8u);
+    } else if (count == 2) {
+        bits <<= 12u;
+        *out++ = static_cast<char>(bits >> 16u);
     }
 
+    ret.resize(out - ret.data());
     return ret;
-}
\ No newline at end of file
+}
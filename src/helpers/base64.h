@@ -12,17 +12,24 @@
 #ifndef WSSERVER_BASE64_H
 #define WSSERVER_BASE64_H
 
+#include <cstddef>
 #include <string>
 
 namespace wss {
 namespace utils {
 
-/// \brief Encode string to base 64 string
-/// \param len input string length
+/// \brief Encode bytes to base 64 string (RFC 4648, with padding). Output is allocated once,
+/// 12 bytes per step are encoded by SSSE3 shuffles if cpu has them (x86-64), rest by lookup table
+/// \param bytes input
+/// \param len input length
 /// \return encoded string
-std::string base64_encode(unsigned char const *, unsigned int len);
+std::string base64_encode(unsigned char const *bytes, std::size_t len);
 
-/// \brief Decode base64 string
+inline std::string base64_encode(const std::string &s) {
+    return base64_encode(reinterpret_cast<unsigned char const *>(s.data()), s.size());
+}
+
+/// \brief Decode base64 string. Decoding stops at padding or first character out of alphabet
 /// \param s input string
 /// \return decoded string
 std::string base64_decode(std::string const &s);
@@ -0,0 +1,189 @@
+/**
+ * wsserver
+ * flat_map.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_FLAT_MAP_HPP
+#define WSSERVER_FLAT_MAP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace wss {
+namespace utils {
+
+/// \brief Open-addressing hash map with 64-bit integer keys: one contiguous slots array, linear probing,
+/// backward-shift deletion (no tombstones). Lookup touches one or few neighbour slots instead of chasing list nodes.
+/// Pointers to values are invalidated by insert and erase. Not thread safe.
+/// \tparam V default constructible, movable
+template<typename V>
+class FlatMap {
+ public:
+    using key_type = uint64_t;
+
+    FlatMap() = default;
+
+    /// \param key
+    /// \return nullptr if not found
+    V *find(key_type key) noexcept {
+        if (m_size == 0) {
+            return nullptr;
+        }
+        for (std::size_t i = indexOf(key);; i = next(i)) {
+            if (!m_used[i]) {
+                return nullptr;
+            }
+            if (m_keys[i] == key) {
+                return &m_values[i];
+            }
+        }
+    }
+    const V *find(key_type key) const noexcept {
+        return const_cast<FlatMap *>(this)->find(key);
+    }
+
+    /// \brief Returns value by key, inserts default value if not exists
+    /// \param key
+    /// \return
+    V &operator[](key_type key) {
+        if ((m_size + 1) * 4 > capacity() * 3) {
+            rehash(capacity() == 0 ? 16 : capacity() * 2);
+        }
+        std::size_t i = indexOf(key);
+        for (; m_used[i]; i = next(i)) {
+            if (m_keys[i] == key) {
+                return m_values[i];
+            }
+        }
+        m_used[i] = 1;
+        m_keys[i] = key;
+        m_size++;
+        return m_values[i];
+    }
+
+    /// \param key
+    /// \return false if key not exists
+    bool erase(key_type key) {
+        if (m_size == 0) {
+            return false;
+        }
+        std::size_t i = indexOf(key);
+        for (;; i = next(i)) {
+            if (!m_used[i]) {
+                return false;
+            }
+            if (m_keys[i] == key) {
+                break;
+            }
+        }
+
+        // moving back following items of probe chain, those are not at their home slot
+        std::size_t hole = i;
+        for (std::size_t j = next(i); m_used[j]; j = next(j)) {
+            const std::size_t home = indexOf(m_keys[j]);
+            const bool between = hole <= j ? (hole < home && home <= j) : (hole < home || home <= j);
+            if (!between) {
+                m_keys[hole] = m_keys[j];
+                m_values[hole] = std::move(m_values[j]);
+                hole = j;
+            }
+        }
+        m_used[hole] = 0;
+        m_values[hole] = V();
+        m_size--;
+        return true;
+    }
+
+    /// \brief Calls handler(key, value) for each item
+    template<typename Handler>
+    void forEach(Handler &&handler) {
+        for (std::size_t i = 0; i < capacity(); i++) {
+            if (m_used[i]) {
+                handler(m_keys[i], m_values[i]);
+            }
+        }
+    }
+    template<typename Handler>
+    void forEach(Handler &&handler) const {
+        for (std::size_t i = 0; i < capacity(); i++) {
+            if (m_used[i]) {
+                handler(m_keys[i], m_values[i]);
+            }
+        }
+    }
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    bool empty() const noexcept {
+        return m_size == 0;
+    }
+
+    void clear() {
+        m_keys.clear();
+        m_used.clear();
+        m_values.clear();
+        m_size = 0;
+    }
+
+ private:
+    // keys are stored apart from values, so probing walks dense keys array
+    std::vector<key_type> m_keys;
+    std::vector<uint8_t> m_used;
+    std::vector<V> m_values;
+    std::size_t m_size = 0;
+
+    std::size_t capacity() const noexcept {
+        return m_keys.size();
+    }
+
+    /// \brief splitmix64 finalizer: sequential ids are spread over whole table
+    static uint64_t mix(key_type key) noexcept {
+        key ^= key >> 30;
+        key *= 0xbf58476d1ce4e5b9ULL;
+        key ^= key >> 27;
+        key *= 0x94d049bb133111ebULL;
+        key ^= key >> 31;
+        return key;
+    }
+
+    std::size_t indexOf(key_type key) const noexcept {
+        return static_cast<std::size_t>(mix(key)) & (capacity() - 1);
+    }
+
+    std::size_t next(std::size_t i) const noexcept {
+        return (i + 1) & (capacity() - 1);
+    }
+
+    void rehash(std::size_t newCapacity) {
+        std::vector<key_type> keys(newCapacity);
+        std::vector<uint8_t> used(newCapacity, 0);
+        std::vector<V> values(newCapacity);
+        keys.swap(m_keys);
+        used.swap(m_used);
+        values.swap(m_values);
+        for (std::size_t j = 0; j < keys.size(); j++) {
+            if (!used[j]) {
+                continue;
+            }
+            std::size_t i = indexOf(keys[j]);
+            while (m_used[i]) {
+                i = next(i);
+            }
+            m_used[i] = 1;
+            m_keys[i] = keys[j];
+            m_values[i] = std::move(values[j]);
+        }
+    }
+};
+
+}
+}
+
+#endif //WSSERVER_FLAT_MAP_HPP
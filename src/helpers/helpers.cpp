@@ -6,11 +6,27 @@
  * @link https://github.com/edwardstock
  */
 
+#include <chrono>
+#include <cstdio>
 #include "../base/Settings.hpp"
 #include "helpers.h"
 #include "date/date.h"
 #include "date/tz.h"
 
+namespace {
+
+/// \brief Current second formatted for one timezone: kept per thread, so only fraction is formatted per call
+struct DateTimeCache {
+  int64_t second = -1;
+  std::string timezone;
+  /// \brief %Y-%m-%d %H:%M:%S
+  std::string prefix;
+  /// \brief zone offset: %Oz
+  std::string zone;
+};
+
+}
+
 boost::posix_time::ptime wss::utils::parseDate(const std::string &t, const char *format) {
     pt::time_input_facet *timeFacet(new pt::time_input_facet(format));
     std::locale ioFormat = std::locale(std::locale::classic(), timeFacet);
@@ -41,11 +57,31 @@ std::string wss::utils::formatBoostPTime(const boost::posix_time::ptime &t, cons
 }
 
 std::string wss::utils::getNowISODateTimeFractionalConfigAware() {
-    if (wss::Settings::get().server.timezone.empty()) {
-        return getNowISODateTime("UTC");
+    static const std::string utc = "UTC";
+    const std::string &configured = wss::Settings::get().server.timezone;
+    const std::string &timezone = configured.empty() ? utc : configured;
+
+    const int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    const int64_t second = micros / 1000000;
+
+    // same output as getNowISODateTime(), but tz database and date formatting are used once per second
+    static thread_local DateTimeCache cache;
+    if (cache.second != second || cache.timezone != timezone) {
+        const auto t = date::make_zoned(timezone, date::sys_seconds(std::chrono::seconds(second)));
+        cache.prefix = date::format("%Y-%m-%d %H:%M:%S", t);
+        cache.zone = date::format("%Oz", t);
+        cache.timezone = timezone;
+        cache.second = second;
     }
 
-    return getNowISODateTime(wss::Settings::get().server.timezone);
+    char fraction[8];
+    snprintf(fraction, sizeof(fraction), ".%06d", static_cast<int>(micros % 1000000));
+
+    std::string out;
+    out.reserve(cache.prefix.size() + 7 + cache.zone.size());
+    out.append(cache.prefix).append(fraction).append(cache.zone);
+    return out;
 }
 
 std::string wss::utils::getNowLocalISODateTime() {
@@ -0,0 +1,83 @@
+/**
+ * wsserver
+ * inline_vector.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_INLINE_VECTOR_HPP
+#define WSSERVER_INLINE_VECTOR_HPP
+
+#include <array>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace wss {
+namespace utils {
+
+/// \brief Vector that keeps first N items inline (without heap allocation), others - in regular vector.
+/// Order of items is not preserved by erase. Not thread safe.
+/// \tparam T default constructible, movable
+/// \tparam N inline capacity
+template<typename T, std::size_t N>
+class InlineVector {
+ public:
+    InlineVector() = default;
+
+    void push_back(T item) {
+        if (m_inlineSize < N) {
+            m_inline[m_inlineSize++] = std::move(item);
+            return;
+        }
+        m_overflow.push_back(std::move(item));
+    }
+
+    T &operator[](std::size_t i) noexcept {
+        return i < m_inlineSize ? m_inline[i] : m_overflow[i - m_inlineSize];
+    }
+    const T &operator[](std::size_t i) const noexcept {
+        return i < m_inlineSize ? m_inline[i] : m_overflow[i - m_inlineSize];
+    }
+
+    /// \brief Removes item by index: last item takes its place
+    /// \param i
+    void erase(std::size_t i) {
+        const std::size_t last = size() - 1;
+        if (i != last) {
+            (*this)[i] = std::move((*this)[last]);
+        }
+        if (!m_overflow.empty()) {
+            m_overflow.pop_back();
+        } else {
+            m_inline[--m_inlineSize] = T();
+        }
+    }
+
+    std::size_t size() const noexcept {
+        return m_inlineSize + m_overflow.size();
+    }
+
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    void clear() {
+        for (std::size_t i = 0; i < m_inlineSize; i++) {
+            m_inline[i] = T();
+        }
+        m_inlineSize = 0;
+        m_overflow.clear();
+    }
+
+ private:
+    std::array<T, N> m_inline;
+    std::size_t m_inlineSize = 0;
+    std::vector<T> m_overflow;
+};
+
+}
+}
+
+#endif //WSSERVER_INLINE_VECTOR_HPP
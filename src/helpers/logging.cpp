@@ -0,0 +1,223 @@
+/**
+ * wsserver
+ * logging.cpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#include "logging.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <toolboxpp.h>
+
+std::atomic<int> wss::logging::detail::threshold(wss::logging::LevelDebug);
+
+namespace {
+
+using namespace wss::logging;
+
+struct Record {
+  int level = LevelDebug;
+  const char *file = nullptr;
+  int line = 0;
+  std::string tag;
+  std::string message;
+};
+
+void writeNow(const Record &record) {
+    auto &logger = toolboxpp::Logger::get();
+    switch (record.level) {
+        case LevelDebug:
+            logger.debug(record.file, record.line, record.tag, record.message);
+            break;
+        case LevelInfo:
+            logger.info(record.file, record.line, record.tag, record.message);
+            break;
+        case LevelWarning:
+            logger.warning(record.file, record.line, record.tag, record.message);
+            break;
+        default:
+            logger.error(record.file, record.line, record.tag, record.message);
+            break;
+    }
+}
+
+/// \brief Fixed ring of records and thread that drains it
+class AsyncSink {
+ public:
+    explicit AsyncSink(std::size_t capacity) :
+        m_ring(std::max<std::size_t>(capacity, 1)),
+        m_head(0),
+        m_size(0),
+        m_stop(false),
+        m_thread(&AsyncSink::run, this) {
+    }
+
+    /// \brief Drains ring and joins thread, later records are written by caller
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_stop) {
+                return;
+            }
+            m_stop = true;
+        }
+        m_cv.notify_one();
+        m_thread.join();
+    }
+
+    void push(Record &&record) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_stop) {
+                lock.unlock();
+                writeNow(record);
+                return;
+            }
+            if (m_size == m_ring.size()) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            m_ring[(m_head + m_size) % m_ring.size()] = std::move(record);
+            m_size++;
+        }
+        m_cv.notify_one();
+    }
+
+    uint64_t getDropped() const noexcept {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+ private:
+    std::vector<Record> m_ring;
+    std::size_t m_head;
+    std::size_t m_size;
+    bool m_stop;
+    std::atomic<uint64_t> m_dropped{0};
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::thread m_thread;
+
+    void run() {
+        std::vector<Record> batch;
+        uint64_t reportedDropped = 0;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_cv.wait(lock, [this] { return m_stop || m_size > 0; });
+            if (m_size == 0 && m_stop) {
+                return;
+            }
+
+            // take all queued records at once, write them without lock
+            batch.clear();
+            while (m_size > 0) {
+                batch.push_back(std::move(m_ring[m_head]));
+                m_head = (m_head + 1) % m_ring.size();
+                m_size--;
+            }
+            lock.unlock();
+
+            for (const auto &record: batch) {
+                writeNow(record);
+            }
+            const uint64_t dropped = getDropped();
+            if (dropped != reportedDropped) {
+                toolboxpp::Logger::get().warning(__FILE__, __LINE__, "Logging",
+                                                 "Log ring is full, dropped records: "
+                                                     + std::to_string(dropped - reportedDropped));
+                reportedDropped = dropped;
+            }
+
+            lock.lock();
+        }
+    }
+};
+
+std::mutex sinkMutex;
+/// \brief Never destroyed: other threads could log after exit handlers
+std::atomic<AsyncSink *> sink(nullptr);
+
+}
+
+void wss::logging::setVerbosity(uint16_t verbosity) {
+    toolboxpp::Logger::get().setVerbosity(verbosity);
+    int level = LevelError;
+    if (verbosity >= 2) {
+        level = LevelDebug;
+    } else if (verbosity == 1) {
+        level = LevelInfo;
+    }
+    detail::threshold.store(level, std::memory_order_relaxed);
+}
+
+void wss::logging::startAsync(std::size_t capacity) {
+    std::lock_guard<std::mutex> lock(sinkMutex);
+    if (sink.load() != nullptr) {
+        return;
+    }
+    sink.store(new AsyncSink(capacity));
+    std::atexit(stopAsync);
+}
+
+void wss::logging::stopAsync() {
+    std::lock_guard<std::mutex> lock(sinkMutex);
+    AsyncSink *current = sink.load();
+    if (current != nullptr) {
+        current->stop();
+    }
+}
+
+uint64_t wss::logging::getDropped() noexcept {
+    AsyncSink *current = sink.load();
+    return current == nullptr ? 0 : current->getDropped();
+}
+
+void wss::logging::write(int level, const char *file, int line, const std::string &tag, std::string message) {
+    Record record;
+    record.level = level;
+    record.file = file;
+    record.line = line;
+    record.tag = tag;
+    record.message = std::move(message);
+
+    AsyncSink *current = sink.load(std::memory_order_acquire);
+    if (current != nullptr) {
+        current->push(std::move(record));
+    } else {
+        writeNow(record);
+    }
+}
+
+void wss::logging::writef(int level, const char *file, int line, const std::string &tag, const char *format, ...) {
+    char stackBuffer[512];
+    std::string message;
+
+    va_list args;
+    va_start(args, format);
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    const int length = std::vsnprintf(stackBuffer, sizeof(stackBuffer), format, args);
+    va_end(args);
+
+    if (length < 0) {
+        va_end(argsCopy);
+        return;
+    }
+    if (static_cast<std::size_t>(length) < sizeof(stackBuffer)) {
+        message.assign(stackBuffer, static_cast<std::size_t>(length));
+    } else {
+        message.resize(static_cast<std::size_t>(length) + 1);
+        std::vsnprintf(&message[0], message.size(), format, argsCopy);
+        message.resize(static_cast<std::size_t>(length));
+    }
+    va_end(argsCopy);
+
+    write(level, file, line, tag, std::move(message));
+}
@@ -0,0 +1,79 @@
+/**
+ * wsserver
+ * logging.h
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_LOGGING_H
+#define WSSERVER_LOGGING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// \brief Records below this level are not compiled: 0 - debug, 1 - info, 2 - warning, 3 - error
+#ifndef WSS_MIN_LOG_LEVEL
+#define WSS_MIN_LOG_LEVEL 0
+#endif
+
+namespace wss {
+namespace logging {
+
+enum Level : int {
+  LevelDebug = 0,
+  LevelInfo = 1,
+  LevelWarning = 2,
+  LevelError = 3,
+};
+
+namespace detail {
+extern std::atomic<int> threshold;
+}
+
+/// \brief Runtime level check, one relaxed load
+inline bool enabled(int level) noexcept {
+    return level >= detail::threshold.load(std::memory_order_relaxed);
+}
+
+/// \brief Sets runtime threshold and toolboxpp logger verbosity
+/// \param verbosity 0 (error,critical), 1(0 + info), 2(all)
+void setVerbosity(uint16_t verbosity);
+
+/// \brief Starts background writer: records are put to fixed ring and written to logger from its thread,
+/// so callers never wait for console or file. If ring is full, records are dropped and counted
+/// \param capacity ring size in records
+void startAsync(std::size_t capacity = 8192);
+/// \brief Writes queued records and stops background writer. Called at exit if writer was started
+void stopAsync();
+/// \brief Records dropped by full ring
+uint64_t getDropped() noexcept;
+
+void write(int level, const char *file, int line, const std::string &tag, std::string message);
+void writef(int level, const char *file, int line, const std::string &tag, const char *format, ...)
+__attribute__((format(printf, 5, 6)));
+
+}
+}
+
+/// \brief Arguments are evaluated only if level is enabled, levels below WSS_MIN_LOG_LEVEL are removed by compiler
+#define WSS_LOG(level, tag, message) \
+    do { \
+        if ((level) >= WSS_MIN_LOG_LEVEL && wss::logging::enabled(level)) { \
+            wss::logging::write(level, __FILE__, __LINE__, tag, message); \
+        } \
+    } while (0)
+
+#define WSS_LOG_F(level, tag, ...) \
+    do { \
+        if ((level) >= WSS_MIN_LOG_LEVEL && wss::logging::enabled(level)) { \
+            wss::logging::writef(level, __FILE__, __LINE__, tag, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define WSS_DEBUG(tag, message) WSS_LOG(wss::logging::LevelDebug, tag, message)
+#define WSS_DEBUG_F(tag, ...) WSS_LOG_F(wss::logging::LevelDebug, tag, __VA_ARGS__)
+
+#endif //WSSERVER_LOGGING_H
@@ -0,0 +1,99 @@
+/**
+ * wsserver
+ * presence_bitmap.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_PRESENCE_BITMAP_HPP
+#define WSSERVER_PRESENCE_BITMAP_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace wss {
+namespace utils {
+
+/// \brief Lock-free set of online ids for dense id ranges: one bit per id in 8 KiB pages (65536 ids),
+/// allocated on first set() of page and kept until bitmap is destroyed. Ids from 2^32 are not covered:
+/// owner must look them up by other means. Reads are one or two atomic loads, without locks and allocations.
+/// Writes of one id must be serialized by owner (e.g. under lock of its map shard), writes of different ids
+/// may run concurrently
+class PresenceBitmap {
+ public:
+    static constexpr std::size_t PAGE_BITS = 16;
+    static constexpr std::size_t PAGES = 65536;
+    static constexpr uint64_t LIMIT = uint64_t(PAGES) << PAGE_BITS;
+
+    PresenceBitmap() :
+        m_pages(new std::atomic<Page *>[PAGES]()) { }
+
+    ~PresenceBitmap() {
+        for (std::size_t i = 0; i < PAGES; i++) {
+            delete m_pages[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    PresenceBitmap(const PresenceBitmap &other) = delete;
+    PresenceBitmap &operator=(const PresenceBitmap &other) = delete;
+
+    /// \brief Whether bitmap answers for id
+    static bool covers(uint64_t id) noexcept {
+        return id < LIMIT;
+    }
+
+    /// \param id covered id
+    /// \return
+    bool test(uint64_t id) const noexcept {
+        const Page *page = m_pages[id >> PAGE_BITS].load(std::memory_order_acquire);
+        if (page == nullptr) {
+            return false;
+        }
+        return (page->words[wordOf(id)].load(std::memory_order_acquire) & bitOf(id)) != 0;
+    }
+
+    /// \param id covered id
+    void set(uint64_t id) {
+        std::atomic<Page *> &slot = m_pages[id >> PAGE_BITS];
+        Page *page = slot.load(std::memory_order_acquire);
+        if (page == nullptr) {
+            // writers of other ids of page may race for it, one page wins
+            std::unique_ptr<Page> created(new Page());
+            if (slot.compare_exchange_strong(page, created.get(), std::memory_order_acq_rel)) {
+                page = created.release();
+            }
+        }
+        page->words[wordOf(id)].fetch_or(bitOf(id), std::memory_order_release);
+    }
+
+    /// \param id covered id
+    void reset(uint64_t id) noexcept {
+        Page *page = m_pages[id >> PAGE_BITS].load(std::memory_order_acquire);
+        if (page != nullptr) {
+            page->words[wordOf(id)].fetch_and(~bitOf(id), std::memory_order_release);
+        }
+    }
+
+ private:
+    struct Page {
+      std::array<std::atomic<uint64_t>, (std::size_t(1) << PAGE_BITS) / 64> words{};
+    };
+
+    std::unique_ptr<std::atomic<Page *>[]> m_pages;
+
+    static std::size_t wordOf(uint64_t id) noexcept {
+        return static_cast<std::size_t>(id & ((uint64_t(1) << PAGE_BITS) - 1)) >> 6u;
+    }
+    static uint64_t bitOf(uint64_t id) noexcept {
+        return uint64_t(1) << (id & 63u);
+    }
+};
+
+}
+}
+
+#endif //WSSERVER_PRESENCE_BITMAP_HPP
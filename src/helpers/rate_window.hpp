@@ -0,0 +1,114 @@
+/**
+ * wsserver
+ * rate_window.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_RATE_WINDOW_HPP
+#define WSSERVER_RATE_WINDOW_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+#ifdef __linux__
+#include <time.h>
+#endif
+
+namespace wss {
+namespace utils {
+
+/// \brief Wall clock seconds without syscall: kernel tick cached time (CLOCK_REALTIME_COARSE) on linux,
+/// time(nullptr) on other systems
+class CoarseClock {
+ public:
+    static time_t now() noexcept {
+#ifdef CLOCK_REALTIME_COARSE
+        struct timespec ts;
+        if (clock_gettime(CLOCK_REALTIME_COARSE, &ts) == 0) {
+            return ts.tv_sec;
+        }
+#endif
+        return std::time(nullptr);
+    }
+};
+
+/// \brief Sum of values added during last Buckets * BucketSeconds seconds, in fixed memory.
+/// Each bucket is one atomic word: bucket epoch in high bits and its sum in low bits, so adding is single CAS
+/// and stale bucket is reset by the same CAS that adds to it.
+/// Window slides by whole buckets: sum includes currently filling bucket
+/// \tparam Buckets number of buckets
+/// \tparam BucketSeconds bucket width
+template<std::size_t Buckets, std::size_t BucketSeconds>
+class RateWindow {
+ public:
+    static constexpr std::size_t WINDOW_SECONDS = Buckets * BucketSeconds;
+
+    RateWindow() noexcept {
+        for (auto &bucket: m_buckets) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+    RateWindow(const RateWindow &other) = delete;
+    RateWindow &operator=(const RateWindow &other) = delete;
+
+    /// \param value
+    /// \param now unix time, see CoarseClock::now()
+    void add(uint64_t value, time_t now) noexcept {
+        const uint64_t epoch = epochOf(now);
+        std::atomic<uint64_t> &bucket = m_buckets[epoch % Buckets];
+        uint64_t current = bucket.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            const uint64_t sum = (current >> SUM_BITS) == (epoch & EPOCH_MASK) ? current & SUM_MASK : 0;
+            next = ((epoch & EPOCH_MASK) << SUM_BITS) | ((sum + value) & SUM_MASK);
+        } while (!bucket.compare_exchange_weak(current, next, std::memory_order_relaxed));
+    }
+
+    /// \brief Sum of values added in window
+    /// \param now unix time
+    /// \return
+    uint64_t sum(time_t now) const noexcept {
+        const uint64_t epoch = epochOf(now);
+        uint64_t out = 0;
+        for (std::size_t i = 0; i < Buckets && i <= epoch; i++) {
+            const uint64_t bucketEpoch = epoch - i;
+            const uint64_t value = m_buckets[bucketEpoch % Buckets].load(std::memory_order_relaxed);
+            if ((value >> SUM_BITS) == (bucketEpoch & EPOCH_MASK)) {
+                out += value & SUM_MASK;
+            }
+        }
+        return out;
+    }
+
+    /// \brief Average per second in window
+    /// \param now unix time
+    /// \return
+    double perSecond(time_t now) const noexcept {
+        return static_cast<double>(sum(now)) / WINDOW_SECONDS;
+    }
+
+ private:
+    /// \brief Up to 1T per bucket, epoch wraps after 16M buckets: far longer than window
+    static constexpr unsigned SUM_BITS = 40;
+    static constexpr uint64_t SUM_MASK = (uint64_t(1) << SUM_BITS) - 1;
+    static constexpr uint64_t EPOCH_MASK = (uint64_t(1) << (64 - SUM_BITS)) - 1;
+
+    std::array<std::atomic<uint64_t>, Buckets> m_buckets;
+
+    static uint64_t epochOf(time_t now) noexcept {
+        return now < 0 ? 0 : static_cast<uint64_t>(now) / BucketSeconds;
+    }
+};
+
+template<std::size_t Buckets, std::size_t BucketSeconds>
+constexpr std::size_t RateWindow<Buckets, BucketSeconds>::WINDOW_SECONDS;
+
+}
+}
+
+#endif //WSSERVER_RATE_WINDOW_HPP
@@ -0,0 +1,131 @@
+/**
+ * wsserver
+ * ring_queue.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_RING_QUEUE_HPP
+#define WSSERVER_RING_QUEUE_HPP
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <stdexcept>
+
+namespace wss {
+namespace utils {
+
+/// \brief FIFO queue over ring buffer. Slots are preallocated and reused, so push/pop do not allocate
+/// until queue grows over its capacity (then capacity is doubled, once).
+/// Not thread safe.
+/// \tparam T default constructible and movable type
+template<typename T>
+class RingQueue {
+ public:
+    explicit RingQueue(std::size_t capacity = 16) :
+        m_data(roundCapacity(capacity)),
+        m_head(0),
+        m_size(0) { }
+
+    bool empty() const noexcept {
+        return m_size == 0;
+    }
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    std::size_t capacity() const noexcept {
+        return m_data.size();
+    }
+
+    T &front() {
+        return m_data[m_head];
+    }
+
+    const T &front() const {
+        return m_data[m_head];
+    }
+
+    T &back() {
+        return at(m_size - 1);
+    }
+
+    /// \brief Element by index, counting from front
+    T &at(std::size_t i) {
+        return m_data[(m_head + i) & (m_data.size() - 1)];
+    }
+
+    const T &at(std::size_t i) const {
+        return m_data[(m_head + i) & (m_data.size() - 1)];
+    }
+
+    template<typename... Args>
+    void emplace_back(Args &&... args) {
+        if (m_size == m_data.size()) {
+            grow();
+        }
+        at(m_size) = T(std::forward<Args>(args)...);
+        m_size++;
+    }
+
+    void pop_front() {
+        if (m_size == 0) {
+            throw std::out_of_range("RingQueue is empty");
+        }
+        // releasing resources held by element, slot stays allocated
+        m_data[m_head] = T();
+        m_head = (m_head + 1) & (m_data.size() - 1);
+        m_size--;
+    }
+
+    /// \brief Removes element from the middle of queue, preserving order. O(n)
+    /// \param i index counting from front
+    void erase(std::size_t i) {
+        if (i >= m_size) {
+            throw std::out_of_range("RingQueue index out of range");
+        }
+        for (std::size_t c = i; c + 1 < m_size; c++) {
+            at(c) = std::move(at(c + 1));
+        }
+        at(m_size - 1) = T();
+        m_size--;
+    }
+
+    void clear() {
+        while (m_size > 0) {
+            pop_front();
+        }
+        m_head = 0;
+    }
+
+ private:
+    std::vector<T> m_data;
+    std::size_t m_head;
+    std::size_t m_size;
+
+    static std::size_t roundCapacity(std::size_t capacity) {
+        // power of 2 to use mask instead of modulo
+        std::size_t out = 1;
+        while (out < capacity) {
+            out <<= 1;
+        }
+        return out;
+    }
+
+    void grow() {
+        std::vector<T> data(m_data.size() * 2);
+        for (std::size_t c = 0; c < m_size; c++) {
+            data[c] = std::move(at(c));
+        }
+        m_data = std::move(data);
+        m_head = 0;
+    }
+};
+
+}
+}
+
+#endif //WSSERVER_RING_QUEUE_HPP
@@ -0,0 +1,103 @@
+/**
+ * wsserver
+ * slab_pool.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_SLAB_POOL_HPP
+#define WSSERVER_SLAB_POOL_HPP
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace wss {
+namespace utils {
+
+/// \brief Thread local free list of equal sized blocks.
+/// Blocks released on other thread go to that thread free list, so there are no locks at all.
+/// \tparam BlockSize
+/// \tparam MaxFree max cached blocks per thread, everything over will be returned to system
+template<std::size_t BlockSize, std::size_t MaxFree = 4096>
+class SlabPool {
+ public:
+    static void *allocate() {
+        auto &list = freeList();
+        if (!list.blocks.empty()) {
+            void *block = list.blocks.back();
+            list.blocks.pop_back();
+            return block;
+        }
+        return ::operator new(BlockSize);
+    }
+
+    static void deallocate(void *block) noexcept {
+        auto &list = freeList();
+        if (list.blocks.size() < MaxFree) {
+            try {
+                list.blocks.push_back(block);
+                return;
+            } catch (...) {
+            }
+        }
+        ::operator delete(block);
+    }
+
+ private:
+    struct FreeList {
+      std::vector<void *> blocks;
+      ~FreeList() {
+          for (void *block: blocks) {
+              ::operator delete(block);
+          }
+      }
+    };
+
+    static FreeList &freeList() {
+        static thread_local FreeList list;
+        return list;
+    }
+};
+
+/// \brief Std allocator over SlabPool, suitable for std::allocate_shared
+/// Only single object allocations are pooled.
+template<typename T>
+class PoolAllocator {
+ public:
+    using value_type = T;
+
+    PoolAllocator() noexcept = default;
+    template<typename U>
+    PoolAllocator(const PoolAllocator<U> &) noexcept { }
+
+    T *allocate(std::size_t n) {
+        if (n == 1) {
+            return static_cast<T *>(SlabPool<sizeof(T)>::allocate());
+        }
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        if (n == 1) {
+            SlabPool<sizeof(T)>::deallocate(p);
+            return;
+        }
+        ::operator delete(p);
+    }
+
+    template<typename U>
+    bool operator==(const PoolAllocator<U> &) const noexcept {
+        return true;
+    }
+    template<typename U>
+    bool operator!=(const PoolAllocator<U> &) const noexcept {
+        return false;
+    }
+};
+
+}
+}
+
+#endif //WSSERVER_SLAB_POOL_HPP
@@ -0,0 +1,163 @@
+/**
+ * wsserver
+ * small_vector.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_SMALL_VECTOR_HPP
+#define WSSERVER_SMALL_VECTOR_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace wss {
+namespace utils {
+
+/// \brief Contiguous vector that keeps up to N items inline and moves them to heap only when grown above N.
+/// Unlike InlineVector, items are stored in one array: data() can be passed as pointer and count. Not thread safe.
+/// \tparam T trivially copyable
+/// \tparam N inline capacity
+template<typename T, std::size_t N>
+class SmallVector {
+    static_assert(std::is_trivially_copyable<T>::value, "SmallVector supports only trivially copyable items");
+    static_assert(N > 0, "Inline capacity must be at least 1");
+
+ public:
+    using value_type = T;
+    using iterator = T *;
+    using const_iterator = const T *;
+
+    SmallVector() noexcept = default;
+    SmallVector(std::initializer_list<T> items) {
+        assign(items.begin(), items.end());
+    }
+    explicit SmallVector(const std::vector<T> &items) {
+        assign(items.data(), items.data() + items.size());
+    }
+    SmallVector(const SmallVector &other) {
+        assign(other.begin(), other.end());
+    }
+    SmallVector(SmallVector &&other) noexcept {
+        moveFrom(other);
+    }
+    SmallVector &operator=(const SmallVector &other) {
+        if (this != &other) {
+            assign(other.begin(), other.end());
+        }
+        return *this;
+    }
+    SmallVector &operator=(SmallVector &&other) noexcept {
+        if (this != &other) {
+            m_heap.reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    void assign(const T *first, const T *last) {
+        const auto count = static_cast<std::size_t>(last - first);
+        m_size = 0;
+        reserve(count);
+        if (count > 0) {
+            std::memmove(data(), first, count * sizeof(T));
+        }
+        m_size = count;
+    }
+
+    void push_back(const T &item) {
+        if (m_size == capacity()) {
+            reserve(m_size * 2);
+        }
+        data()[m_size++] = item;
+    }
+
+    void reserve(std::size_t count) {
+        if (count <= capacity()) {
+            return;
+        }
+        std::unique_ptr<T[]> heap(new T[count]);
+        if (m_size > 0) {
+            std::memcpy(heap.get(), data(), m_size * sizeof(T));
+        }
+        m_heap = std::move(heap);
+        m_capacity = count;
+    }
+
+    void clear() noexcept {
+        m_size = 0;
+    }
+
+    T *data() noexcept {
+        return m_heap ? m_heap.get() : m_inline;
+    }
+    const T *data() const noexcept {
+        return m_heap ? m_heap.get() : m_inline;
+    }
+
+    iterator begin() noexcept {
+        return data();
+    }
+    iterator end() noexcept {
+        return data() + m_size;
+    }
+    const_iterator begin() const noexcept {
+        return data();
+    }
+    const_iterator end() const noexcept {
+        return data() + m_size;
+    }
+
+    T &operator[](std::size_t i) noexcept {
+        return data()[i];
+    }
+    const T &operator[](std::size_t i) const noexcept {
+        return data()[i];
+    }
+
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    std::size_t capacity() const noexcept {
+        return m_heap ? m_capacity : N;
+    }
+
+    bool empty() const noexcept {
+        return m_size == 0;
+    }
+
+    bool operator==(const SmallVector &other) const noexcept {
+        return m_size == other.m_size && std::equal(begin(), end(), other.begin());
+    }
+
+ private:
+    T m_inline[N];
+    std::unique_ptr<T[]> m_heap;
+    std::size_t m_capacity = N;
+    std::size_t m_size = 0;
+
+    void moveFrom(SmallVector &other) noexcept {
+        if (other.m_heap) {
+            m_heap = std::move(other.m_heap);
+            m_capacity = other.m_capacity;
+        } else {
+            std::memcpy(m_inline, other.m_inline, other.m_size * sizeof(T));
+            m_capacity = N;
+        }
+        m_size = other.m_size;
+        other.m_size = 0;
+        other.m_capacity = N;
+    }
+};
+
+}
+}
+
+#endif //WSSERVER_SMALL_VECTOR_HPP
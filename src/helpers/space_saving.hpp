@@ -0,0 +1,127 @@
+/**
+ * wsserver
+ * space_saving.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_SPACE_SAVING_HPP
+#define WSSERVER_SPACE_SAVING_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "flat_map.hpp"
+
+namespace wss {
+namespace utils {
+
+/// \brief Space-Saving heavy hitters summary: keeps at most capacity counters, new key replaces the least
+/// counter and inherits its count as overestimation error. Any key with true count greater than total / capacity
+/// is guaranteed to be kept. Not thread safe.
+class SpaceSaving {
+ public:
+    struct Item {
+      uint64_t key = 0;
+      /// \brief Optional key name (message type, for example), set when key is added to summary
+      std::string label;
+      /// \brief Estimated count, true count is in [count - error, count]
+      uint64_t count = 0;
+      uint64_t error = 0;
+    };
+
+    explicit SpaceSaving(std::size_t capacity) :
+        m_capacity(std::max<std::size_t>(capacity, 1)) {
+        m_items.reserve(m_capacity);
+    }
+
+    /// \param key
+    /// \param weight
+    /// \param label used only if key is not in summary yet
+    void add(uint64_t key, uint64_t weight = 1, const std::string &label = std::string()) {
+        m_total += weight;
+        const std::size_t *index = m_index.find(key);
+        if (index != nullptr) {
+            m_items[*index].count += weight;
+            return;
+        }
+
+        std::size_t target;
+        uint64_t error = 0;
+        if (m_items.size() < m_capacity) {
+            target = m_items.size();
+            m_items.emplace_back();
+        } else {
+            // small capacity: linear scan for the least counter is cheaper than keeping order on every add
+            target = 0;
+            for (std::size_t i = 1; i < m_items.size(); i++) {
+                if (m_items[i].count < m_items[target].count) {
+                    target = i;
+                }
+            }
+            error = m_items[target].count;
+            m_index.erase(m_items[target].key);
+        }
+
+        Item &item = m_items[target];
+        item.key = key;
+        item.label = label;
+        item.count = error + weight;
+        item.error = error;
+        m_index[key] = target;
+    }
+
+    /// \brief Adds other summary counters to this one
+    /// \param other
+    void merge(const SpaceSaving &other) {
+        const uint64_t total = m_total;
+        for (const auto &item: other.m_items) {
+            add(item.key, item.count, item.label);
+            m_items[*m_index.find(item.key)].error += item.error;
+        }
+        m_total = total + other.m_total;
+    }
+
+    /// \brief Items with greatest counts
+    /// \param limit
+    /// \return ordered by count descending
+    std::vector<Item> top(std::size_t limit) const {
+        std::vector<Item> out(m_items);
+        const auto byCount = [](const Item &lhs, const Item &rhs) {
+          return lhs.count > rhs.count;
+        };
+        if (limit < out.size()) {
+            std::partial_sort(out.begin(), out.begin() + limit, out.end(), byCount);
+            out.resize(limit);
+        } else {
+            std::sort(out.begin(), out.end(), byCount);
+        }
+        return out;
+    }
+
+    /// \brief Sum of all added weights
+    /// \return
+    uint64_t getTotal() const noexcept {
+        return m_total;
+    }
+
+    void clear() {
+        m_items.clear();
+        m_index.clear();
+        m_total = 0;
+    }
+
+ private:
+    std::size_t m_capacity;
+    std::vector<Item> m_items;
+    FlatMap<std::size_t> m_index;
+    uint64_t m_total = 0;
+};
+
+}
+}
+
+#endif //WSSERVER_SPACE_SAVING_HPP
@@ -0,0 +1,118 @@
+/**
+ * wsserver
+ * timer_wheel.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_TIMER_WHEEL_HPP
+#define WSSERVER_TIMER_WHEEL_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace wss {
+namespace utils {
+
+/// \brief Hashed timer wheel: O(1) schedule, each tick touches only one slot.
+/// Deadlines further than slots * tick are kept in slot with rounds counter.
+/// Items can't be cancelled: owner checks item state when it expires and reschedules it, if needed.
+/// Not thread safe.
+/// \tparam T item type, movable
+template<typename T>
+class TimerWheel {
+ public:
+    using Clock = std::chrono::steady_clock;
+
+    /// \param tick slot resolution
+    /// \param slots number of slots
+    /// \param now wheel start time
+    explicit TimerWheel(Clock::duration tick, std::size_t slots = 512, Clock::time_point now = Clock::now()) :
+        m_tick(tick),
+        m_slots(slots == 0 ? 1 : slots),
+        m_cursor(0),
+        m_current(now),
+        m_size(0) { }
+
+    /// \brief Schedules item to expire not earlier than deadline (rounded up to tick)
+    /// \param item
+    /// \param deadline
+    void schedule(T item, Clock::time_point deadline) {
+        std::size_t ticks = 1;
+        if (deadline > m_current + m_tick) {
+            ticks = static_cast<std::size_t>((deadline - m_current + m_tick - Clock::duration(1)) / m_tick);
+        }
+
+        const std::size_t offset = ticks - 1;
+        m_slots[(m_cursor + offset) % m_slots.size()].push_back(Entry{std::move(item), offset / m_slots.size()});
+        m_size++;
+    }
+
+    /// \brief Processes all ticks passed until now
+    /// \param now
+    /// \param handler called for each expired item: void(T&&). Handler can schedule items to this wheel
+    /// \return number of expired items
+    template<typename Handler>
+    std::size_t advance(Clock::time_point now, Handler &&handler) {
+        std::size_t expired = 0;
+        while (m_current + m_tick <= now) {
+            auto &slot = m_slots[m_cursor];
+            m_expired.clear();
+            for (std::size_t i = 0; i < slot.size();) {
+                if (slot[i].rounds > 0) {
+                    slot[i].rounds--;
+                    i++;
+                    continue;
+                }
+                m_expired.push_back(std::move(slot[i].item));
+                if (i + 1 != slot.size()) {
+                    slot[i] = std::move(slot.back());
+                }
+                slot.pop_back();
+            }
+
+            m_current += m_tick;
+            m_cursor = (m_cursor + 1) % m_slots.size();
+            m_size -= m_expired.size();
+            expired += m_expired.size();
+
+            // handlers may schedule into wheel, so calling them after slot is processed
+            for (auto &item: m_expired) {
+                handler(std::move(item));
+            }
+            m_expired.clear();
+        }
+
+        return expired;
+    }
+
+    /// \brief Number of scheduled items
+    std::size_t size() const noexcept {
+        return m_size;
+    }
+
+    Clock::duration getTick() const noexcept {
+        return m_tick;
+    }
+
+ private:
+    struct Entry {
+      T item;
+      std::size_t rounds;
+    };
+
+    Clock::duration m_tick;
+    std::vector<std::vector<Entry>> m_slots;
+    std::vector<T> m_expired;
+    std::size_t m_cursor;
+    Clock::time_point m_current;
+    std::size_t m_size;
+};
+
+}
+}
+
+#endif //WSSERVER_TIMER_WHEEL_HPP
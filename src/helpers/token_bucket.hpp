@@ -0,0 +1,121 @@
+/**
+ * wsserver
+ * token_bucket.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_TOKEN_BUCKET_HPP
+#define WSSERVER_TOKEN_BUCKET_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace wss {
+namespace utils {
+
+/// \brief Lock-free token bucket (GCRA: keeps only "theoretical arrival time" of next token instead of tokens count),
+/// so concurrent consumers do single CAS. Tokens are refilled with rate per second, up to burst tokens.
+/// configure() is not thread safe: must be called before bucket is used.
+class TokenBucket {
+ public:
+    using Clock = std::chrono::steady_clock;
+
+    TokenBucket() = default;
+    TokenBucket(double rate, double burst) noexcept {
+        configure(rate, burst);
+    }
+    TokenBucket(const TokenBucket &other) = delete;
+    TokenBucket(TokenBucket &&other) = delete;
+
+    /// \param rate tokens per second, 0 - disables bucket
+    /// \param burst max tokens consumed at once, at least one token
+    void configure(double rate, double burst) noexcept {
+        m_tat = 0;
+        if (rate <= 0) {
+            m_cost = 0;
+            m_window = 0;
+            return;
+        }
+        m_cost = std::max<int64_t>(1, static_cast<int64_t>(1e9 / rate));
+        m_window = static_cast<int64_t>(std::max(1.0, burst) * m_cost);
+    }
+
+    /// \return false if bucket has no limits
+    bool isEnabled() const noexcept {
+        return m_cost > 0;
+    }
+
+    /// \brief Consumes tokens if all of them are available
+    /// \param tokens
+    /// \param now nowNanos()
+    /// \return 0 if consumed, otherwise nanoseconds until tokens will be available
+    int64_t tryConsume(std::size_t tokens, int64_t now) noexcept {
+        if (!isEnabled()) {
+            return 0;
+        }
+        const int64_t cost = m_cost * static_cast<int64_t>(tokens);
+        // more tokens than burst are allowed only when bucket is full
+        const int64_t limit = std::max(m_window, cost);
+        int64_t tat = m_tat.load(std::memory_order_relaxed);
+        while (true) {
+            const int64_t next = std::max(tat, now) + cost;
+            const int64_t wait = next - now - limit;
+            if (wait > 0) {
+                return wait;
+            }
+            if (m_tat.compare_exchange_weak(tat, next, std::memory_order_relaxed)) {
+                return 0;
+            }
+        }
+    }
+
+    /// \brief Consumes tokens even if they are not available yet: caller must wait before using them
+    /// \param tokens
+    /// \param now nowNanos()
+    /// \return nanoseconds to wait, 0 - tokens are available now
+    int64_t reserve(std::size_t tokens, int64_t now) noexcept {
+        if (!isEnabled()) {
+            return 0;
+        }
+        const int64_t cost = m_cost * static_cast<int64_t>(tokens);
+        const int64_t limit = std::max(m_window, cost);
+        int64_t tat = m_tat.load(std::memory_order_relaxed);
+        int64_t next;
+        do {
+            next = std::max(tat, now) + cost;
+        } while (!m_tat.compare_exchange_weak(tat, next, std::memory_order_relaxed));
+
+        return std::max<int64_t>(0, next - now - limit);
+    }
+
+    /// \brief Returns consumed or reserved tokens back
+    /// \param tokens
+    void refund(std::size_t tokens) noexcept {
+        if (isEnabled()) {
+            m_tat.fetch_sub(m_cost * static_cast<int64_t>(tokens), std::memory_order_relaxed);
+        }
+    }
+
+    /// \brief Bucket clock
+    /// \return steady clock nanoseconds
+    static int64_t nowNanos() noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+ private:
+    /// \brief Nanoseconds per token
+    int64_t m_cost = 0;
+    /// \brief Burst in nanoseconds
+    int64_t m_window = 0;
+    std::atomic<int64_t> m_tat{0};
+};
+
+}
+}
+
+#endif //WSSERVER_TOKEN_BUCKET_HPP
@@ -0,0 +1,93 @@
+/**
+ * wsserver
+ * unmask.hpp
+ *
+ * @author Eduard Maximovich <edward.vstock@gmail.com>
+ * @link https://github.com/edwardstock
+ */
+
+#ifndef WSSERVER_UNMASK_HPP
+#define WSSERVER_UNMASK_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+namespace wss {
+namespace utils {
+
+/// \brief Applies (or removes, XOR is symmetric) websocket frame mask (RFC 6455 5.3).
+/// Works a vector register at a time (AVX2, SSE2 or NEON, depends on target), then 64-bit words, then tail bytes.
+/// Source and destination may be the same buffer.
+/// \param dst output buffer, at least length bytes
+/// \param src masked input, at least length bytes
+/// \param length number of bytes to process
+/// \param mask 4-byte masking key
+/// \param offset position of src[0] inside the whole frame payload, used to continue masking from the middle of payload
+inline void unmask(uint8_t *dst, const uint8_t *src, std::size_t length, const uint8_t mask[4],
+                   std::size_t offset = 0) noexcept {
+    // rotate key so that key[0] applies to src[0]
+    uint8_t key[8];
+    for (std::size_t i = 0; i < 8; i++) {
+        key[i] = mask[(offset + i) % 4];
+    }
+
+    std::size_t c = 0;
+
+#if defined(__AVX2__)
+    uint8_t wideKey[32];
+    for (std::size_t i = 0; i < 32; i += 8) {
+        std::memcpy(wideKey + i, key, 8);
+    }
+    const __m256i vKey = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(wideKey));
+    for (; c + 32 <= length; c += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + c));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + c), _mm256_xor_si256(v, vKey));
+    }
+#elif defined(__SSE2__)
+    uint8_t wideKey[16];
+    std::memcpy(wideKey, key, 8);
+    std::memcpy(wideKey + 8, key, 8);
+    const __m128i vKey = _mm_loadu_si128(reinterpret_cast<const __m128i *>(wideKey));
+    for (; c + 16 <= length; c += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + c));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + c), _mm_xor_si128(v, vKey));
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    uint8_t wideKey[16];
+    std::memcpy(wideKey, key, 8);
+    std::memcpy(wideKey + 8, key, 8);
+    const uint8x16_t vKey = vld1q_u8(wideKey);
+    for (; c + 16 <= length; c += 16) {
+        vst1q_u8(dst + c, veorq_u8(vld1q_u8(src + c), vKey));
+    }
+#endif
+
+    // 64-bit word fallback (and vector tail). memcpy keeps it free from alignment and aliasing issues
+    uint64_t wordKey;
+    std::memcpy(&wordKey, key, 8);
+    for (; c + 8 <= length; c += 8) {
+        uint64_t word;
+        std::memcpy(&word, src + c, 8);
+        word ^= wordKey;
+        std::memcpy(dst + c, &word, 8);
+    }
+
+    // all blocks above are multiple of 4, so tail starts with key[0]
+    for (; c < length; c++) {
+        dst[c] = src[c] ^ key[c % 4];
+    }
+}
+
+}
+}
+
+#endif //WSSERVER_UNMASK_HPP
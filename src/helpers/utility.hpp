@@ -3,6 +3,7 @@
 
 #include "../base/StatusCode.hpp"
 #include <atomic>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -47,6 +48,37 @@ using CaseInsensitiveMultimap = std::unordered_multimap<std::string,
                                                         CaseInsensitiveHash,
                                                         CaseInsensitiveEqual>;
 
+/// Setting that can be changed while it's read by other threads (runtime reload).
+/// Relaxed atomic: readers take either old or new value, without ordering with other memory.
+/// Unlike std::atomic, it's copyable, so it can be a member of copyable config
+template<typename T>
+class Tunable {
+ public:
+    Tunable() noexcept: m_value() { }
+    Tunable(T value) noexcept: m_value(value) { }
+    Tunable(const Tunable &other) noexcept: m_value(other.load()) { }
+    Tunable &operator=(const Tunable &other) noexcept {
+        store(other.load());
+        return *this;
+    }
+    Tunable &operator=(T value) noexcept {
+        store(value);
+        return *this;
+    }
+    operator T() const noexcept {
+        return load();
+    }
+    T load() const noexcept {
+        return m_value.load(std::memory_order_relaxed);
+    }
+    void store(T value) noexcept {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+
+ private:
+    std::atomic<T> m_value;
+};
+
 /// Percent encoding and decoding
 class Percent {
  public:
@@ -276,6 +308,87 @@ class RequestMessage {
             return false;
         return true;
     }
+
+    /// Single pass parse of request line and header fields right from contiguous buffer, without stream and line copies
+    /// \param data buffer, starting with request line
+    /// \param size buffer size, including final empty line
+    static bool parse(const char *data,
+                      std::size_t size,
+                      std::string &method,
+                      std::string &path,
+                      std::string &query_string,
+                      std::string &version,
+                      CaseInsensitiveMultimap &header) noexcept {
+        header.clear();
+        const char *end = data + size;
+        const char *lineEnd = static_cast<const char *>(std::memchr(data, '\n', size));
+        if (lineEnd == nullptr) {
+            return false;
+        }
+        const char *lineContentEnd = (lineEnd > data && lineEnd[-1] == '\r') ? lineEnd - 1 : lineEnd;
+
+        // METHOD SP path[?query] SP HTTP/version
+        const char *methodEnd = static_cast<const char *>(std::memchr(data, ' ', lineContentEnd - data));
+        if (methodEnd == nullptr || methodEnd == data) {
+            return false;
+        }
+        const char *target = methodEnd + 1;
+        const char *targetEnd = static_cast<const char *>(std::memchr(target, ' ', lineContentEnd - target));
+        if (targetEnd == nullptr) {
+            return false;
+        }
+        const char *protocol = targetEnd + 1;
+        if (lineContentEnd - protocol < 5 || std::memcmp(protocol, "HTTP/", 5) != 0) {
+            return false;
+        }
+
+        try {
+            method.assign(data, methodEnd);
+            const char *queryStart = static_cast<const char *>(std::memchr(target, '?', targetEnd - target));
+            if (queryStart != nullptr) {
+                path.assign(target, queryStart);
+                query_string.assign(queryStart + 1, targetEnd);
+            } else {
+                path.assign(target, targetEnd);
+                query_string.clear();
+            }
+            version.assign(protocol + 5, lineContentEnd);
+
+            // upgrade request usually has near 10 headers, avoiding rehashes
+            header.reserve(16);
+            const char *line = lineEnd + 1;
+            while (line < end) {
+                lineEnd = static_cast<const char *>(std::memchr(line, '\n', end - line));
+                if (lineEnd == nullptr) {
+                    lineEnd = end;
+                }
+                lineContentEnd = (lineEnd > line && lineEnd[-1] == '\r') ? lineEnd - 1 : lineEnd;
+
+                const char *colon = static_cast<const char *>(std::memchr(line, ':', lineContentEnd - line));
+                if (colon == nullptr) {
+                    // empty line - end of headers
+                    break;
+                }
+                const char *value = colon + 1;
+                while (value < lineContentEnd && (*value == ' ' || *value == '\t')) {
+                    value++;
+                }
+                const char *valueEnd = lineContentEnd;
+                while (valueEnd > value && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t')) {
+                    valueEnd--;
+                }
+                header.emplace(std::piecewise_construct,
+                               std::forward_as_tuple(line, colon),
+                               std::forward_as_tuple(value, valueEnd));
+
+                line = lineEnd + 1;
+            }
+        } catch (const std::exception &) {
+            return false;
+        }
+
+        return true;
+    }
 };
 
 class ResponseMessage {
@@ -325,31 +438,40 @@ class ScopeRunner {
     std::atomic<long> count;
 
  public:
+    /// Value guard, taken by every completion handler: no allocation. False if scope should be exited
     class SharedLock {
         friend class ScopeRunner;
-        std::atomic<long> &count;
-        SharedLock(std::atomic<long> &count) noexcept : count(count) { }
+        std::atomic<long> *count;
+        explicit SharedLock(std::atomic<long> *count) noexcept : count(count) { }
+
+     public:
         SharedLock &operator=(const SharedLock &) = delete;
         SharedLock(const SharedLock &) = delete;
+        SharedLock(SharedLock &&other) noexcept : count(other.count) {
+            other.count = nullptr;
+        }
+        SharedLock &operator=(SharedLock &&) = delete;
 
-     public:
         ~SharedLock() noexcept {
-            count.fetch_sub(1);
+            if (count) {
+                count->fetch_sub(1);
+            }
+        }
+
+        explicit operator bool() const noexcept {
+            return count != nullptr;
         }
     };
 
     ScopeRunner() noexcept : count(0) { }
 
-    /// Returns nullptr if scope should be exited, or a shared lock otherwise
-    std::unique_ptr<SharedLock> continueLock() noexcept {
+    /// Returns empty lock if scope should be exited, or a shared lock otherwise
+    SharedLock continueLock() noexcept {
         long expected = count;
         while (expected >= 0 && !count.compare_exchange_weak(expected, expected + 1))
             spin_loop_pause();
 
-        if (expected < 0)
-            return nullptr;
-        else
-            return std::unique_ptr<SharedLock>(new SharedLock(count));
+        return SharedLock(expected < 0 ? nullptr : &count);
     }
 
     /// Blocks until all shared locks are released, then prevents future shared locks
@@ -367,12 +489,84 @@ class ScopeRunner {
 class RegexOrderable : public regexns::regex {
     std::string str;
 
+    /// \brief How match() compares path
+    enum class MatchKind {
+      /// \brief Full string equality with literal (or literal without its optional last char)
+      Exact,
+      /// \brief Path begins with literal
+      Prefix,
+      /// \brief Pattern uses regex syntax
+      Regex
+    };
+    MatchKind kind = MatchKind::Regex;
+    std::string literal;
+    bool optionalLast = false;
+
+    /// \brief Detects patterns without real regex syntax: ^/chat$, ^/chat/?$, ^/api/.*
+    void classify() {
+        std::size_t begin = 0, end = str.size();
+        if (begin < end && str[begin] == '^') {
+            begin++;
+        }
+        if (end > begin && str[end - 1] == '$' && (end - begin < 2 || str[end - 2] != '\\')) {
+            end--;
+        }
+
+        MatchKind out = MatchKind::Exact;
+        if (end - begin >= 2 && str.compare(end - 2, 2, ".*") == 0 && (end - begin < 3 || str[end - 3] != '\\')) {
+            out = MatchKind::Prefix;
+            end -= 2;
+        }
+
+        std::string value;
+        bool optional = false;
+        for (std::size_t c = begin; c < end; c++) {
+            const char chr = str[c];
+            if (chr == '\\' && c + 1 < end && std::strchr(".^$|?*+()[]{}/\\-", str[c + 1]) != nullptr) {
+                value += str[++c];
+            } else if (chr == '?' && c + 1 == end && !value.empty() && out == MatchKind::Exact) {
+                // optional last char: ^/chat/?$
+                optional = true;
+            } else if (std::strchr(".^$|?*+()[]{}\\", chr) != nullptr) {
+                return;
+            } else {
+                value += chr;
+            }
+        }
+
+        kind = out;
+        literal = std::move(value);
+        optionalLast = optional;
+    }
+
  public:
-    RegexOrderable(const char *regex_cstr) : regexns::regex(regex_cstr), str(regex_cstr) { }
-    RegexOrderable(const std::string &regex_str) : regexns::regex(regex_str), str(regex_str) { }
+    RegexOrderable(const char *regex_cstr) : regexns::regex(regex_cstr), str(regex_cstr) {
+        classify();
+    }
+    RegexOrderable(const std::string &regex_str) : regexns::regex(regex_str), str(regex_str) {
+        classify();
+    }
     bool operator<(const RegexOrderable &rhs) const noexcept {
         return str < rhs.str;
     }
+
+    /// \brief Full match of path. Literal patterns are compared as strings, without regex engine
+    /// \param path
+    /// \param match filled only if pattern is real regex
+    /// \return
+    bool match(const std::string &path, regexns::smatch &match) const {
+        switch (kind) {
+            case MatchKind::Exact:
+                if (path == literal) {
+                    return true;
+                }
+                return optionalLast
+                    && path.size() + 1 == literal.size()
+                    && literal.compare(0, path.size(), path) == 0;
+            case MatchKind::Prefix:return path.compare(0, literal.size(), literal) == 0;
+            default:return regexns::regex_match(path, match, *this);
+        }
+    }
 };
 
 } // namespace wss
@@ -7,6 +7,399 @@
  */
 
 #include "ChatRestServer.h"
+#include <array>
+#include <cctype>
+#include <fstream>
+#include "../event/EventNotifier.h"
+#include "../helpers/base64.h"
+#include "../helpers/logging.h"
+#include "../base/Metrics.h"
+#include "../base/TopK.h"
+#include "../base/Tracing.h"
+
+namespace {
+
+using Item = std::pair<const char *, std::size_t>;
+
+/// \brief W3C trace context of caller, empty if request has no one
+std::string getTraceparent(const wss::HttpRequest &request) {
+    const auto it = request->header.find("traceparent");
+    return it == request->header.end() ? std::string() : it->second;
+}
+
+const char *skipSpaces(const char *pos, const char *end) {
+    while (pos != end && std::isspace(static_cast<unsigned char>(*pos))) {
+        pos++;
+    }
+    return pos;
+}
+
+/// \brief Splits top level json array into items, without parsing them. Items are validated later by payload
+/// \param data
+/// \param end
+/// \param items
+/// \param error
+/// \return false if data is not a json array
+bool splitArray(const char *data, const char *end, std::vector<Item> &items, std::string &error) {
+    const char *pos = skipSpaces(data, end);
+    if (pos == end || *pos != '[') {
+        error = "Array of messages expected";
+        return false;
+    }
+    pos = skipSpaces(pos + 1, end);
+    if (pos != end && *pos == ']') {
+        pos++;
+    } else {
+        while (true) {
+            const char *item = pos;
+            std::size_t depth = 0;
+            bool inString = false;
+            while (pos != end) {
+                const char c = *pos;
+                if (inString) {
+                    if (c == '\\' && pos + 1 != end) {
+                        pos++;
+                    } else if (c == '"') {
+                        inString = false;
+                    }
+                } else if (c == '"') {
+                    inString = true;
+                } else if (c == '{' || c == '[') {
+                    depth++;
+                } else if (c == '}' || c == ']') {
+                    if (depth == 0) {
+                        break;
+                    }
+                    depth--;
+                } else if (c == ',' && depth == 0) {
+                    break;
+                }
+                pos++;
+            }
+            if (pos == end || *pos == '}') {
+                error = "Malformed array of messages";
+                return false;
+            }
+
+            const char *itemEnd = pos;
+            while (itemEnd != item && std::isspace(static_cast<unsigned char>(*(itemEnd - 1)))) {
+                itemEnd--;
+            }
+            if (itemEnd == item) {
+                error = fmt::format("Empty item at index {0}", items.size());
+                return false;
+            }
+            items.emplace_back(item, itemEnd - item);
+
+            if (*pos++ == ']') {
+                break;
+            }
+            pos = skipSpaces(pos, end);
+        }
+    }
+
+    if (skipSpaces(pos, end) != end) {
+        error = "Unexpected data after array of messages";
+        return false;
+    }
+    return true;
+}
+
+/// \brief Fields of GET /stats items, bit index in fields mask is index in this list
+const std::array<std::string, 15> STAT_FIELDS = {{
+    "id", "isOnline", "lastConnection", "connectedTimes", "disconnectedTimes", "lastMessageTime",
+    "timeOnline", "timeOffline", "timeInactivity", "sentMessages", "receivedMessages", "bytesTransferred",
+    "messagesRate", "bytesRate", "connectsPerMinute"
+}};
+constexpr uint32_t ALL_STAT_FIELDS = (1u << 15) - 1;
+/// \brief Items serialized into one chunk of response
+constexpr std::size_t STATS_CHUNK_ITEMS = 512;
+/// \brief History messages of one response chunk
+constexpr std::size_t HISTORY_CHUNK_MESSAGES = 256;
+/// \brief Default no incoming frames time of idle connection, GET /connections?idle=
+constexpr long CONNECTIONS_IDLE_SECONDS = 60;
+/// \brief Max wait of POST /send-message?wait= for delivery report
+constexpr unsigned long SEND_WAIT_MAX_MILLIS = 60000;
+
+const char *outcomeName(wss::ChatServer::DeliveryOutcome outcome) {
+    using Outcome = wss::ChatServer::DeliveryOutcome;
+    switch (outcome) {
+        case Outcome::Delivered: return "delivered";
+        case Outcome::Queued: return "queued";
+        case Outcome::Forwarded: return "forwarded";
+        case Outcome::Dropped: return "dropped";
+        default: return "pending";
+    }
+}
+
+void writeStat(std::string &out, const wss::Statistics &stat, uint32_t fields) {
+    out += '{';
+    bool first = true;
+    for (std::size_t i = 0; i < STAT_FIELDS.size(); i++) {
+        if ((fields & (1u << i)) == 0) {
+            continue;
+        }
+        if (!first) {
+            out += ',';
+        }
+        first = false;
+        out += '"';
+        out += STAT_FIELDS[i];
+        out += "\":";
+        switch (i) {
+            case 0: out += std::to_string(stat.getId()); break;
+            case 1: out += stat.isOnline() ? "true" : "false"; break;
+            case 2: out += std::to_string(stat.getConnectionTime()); break;
+            case 3: out += std::to_string(stat.getConnectedTimes()); break;
+            case 4: out += std::to_string(stat.getDisconnectedTimes()); break;
+            case 5: out += std::to_string(stat.getLastMessageTime()); break;
+            case 6: out += std::to_string(stat.getOnlineTime()); break;
+            case 7: out += std::to_string(stat.getOfflineTime()); break;
+            case 8: out += std::to_string(stat.getInactiveTime()); break;
+            case 9: out += std::to_string(stat.getSentMessages()); break;
+            case 10: out += std::to_string(stat.getReceivedMessages()); break;
+            case 11: out += std::to_string(stat.getBytesTransferred()); break;
+            case 12: out += fmt::format("{:.3f}", stat.getMessagesRate()); break;
+            case 13: out += fmt::format("{:.3f}", stat.getBytesRate()); break;
+            default: out += std::to_string(stat.getConnectsPerMinute()); break;
+        }
+    }
+    out += '}';
+}
+
+/// \brief GET /stats response, that is written by chunks: next chunk is serialized after previous is sent
+struct StatsStream {
+  std::vector<wss::StatisticsStorage::StatisticsPtr> items;
+  std::size_t position = 0;
+  uint32_t fields = ALL_STAT_FIELDS;
+  /// \brief Rest of response after data array
+  std::string tail;
+
+  bool write(std::string &chunk) {
+      if (position == 0) {
+          chunk = "{\"success\":true,\"data\":[";
+      }
+      const std::size_t end = std::min(position + STATS_CHUNK_ITEMS, items.size());
+      for (; position < end; position++) {
+          if (position > 0) {
+              chunk += ',';
+          }
+          writeStat(chunk, *items[position], fields);
+      }
+
+      if (position == items.size()) {
+          chunk += tail;
+          return false;
+      }
+      return true;
+  }
+};
+
+/// \brief GET /history response: messages are stored serialized, so they are written as is, by chunks
+struct HistoryStream {
+  std::vector<wss::MessagePayloadPtr> messages;
+  std::size_t position = 0;
+  /// \brief Rest of response after messages array
+  std::string tail;
+
+  bool write(std::string &chunk) {
+      if (position == 0) {
+          chunk = "{\"success\":true,\"data\":{\"messages\":[";
+      }
+      const std::size_t end = std::min(position + HISTORY_CHUNK_MESSAGES, messages.size());
+      for (; position < end; position++) {
+          if (position > 0) {
+              chunk += ',';
+          }
+          chunk += messages[position]->toJson();
+      }
+
+      if (position == messages.size()) {
+          chunk += tail;
+          return false;
+      }
+      return true;
+  }
+};
+
+/// \brief Writes HELP and TYPE lines of Prometheus metric family
+void writeMetricHeader(std::string &out, const char *name, const char *type, const char *help) {
+    out += fmt::format("# HELP {0} {1}\n# TYPE {0} {2}\n", name, help, type);
+}
+
+template<typename T>
+void writeMetric(std::string &out, const char *name, const char *type, const char *help, T value) {
+    writeMetricHeader(out, name, type, help);
+    out += fmt::format("{0} {1}\n", name, value);
+}
+
+void writeHistogram(std::string &out, const char *name, const char *help, const wss::metrics::HistogramSnapshot &value) {
+    writeMetricHeader(out, name, "histogram", help);
+    uint64_t cumulative = 0;
+    for (std::size_t i = 0; i < wss::metrics::BUCKETS; i++) {
+        cumulative += value.buckets[i];
+        out += fmt::format("{0}_bucket{{le=\"{1}\"}} {2}\n", name, wss::metrics::BUCKET_BOUNDS[i], cumulative);
+    }
+    out += fmt::format("{0}_bucket{{le=\"+Inf\"}} {1}\n", name, value.count);
+    out += fmt::format("{0}_sum {1}\n{0}_count {2}\n", name, value.sum, value.count);
+}
+
+/// \brief Escapes backslash, quote and new line in Prometheus label value
+std::string escapeLabel(const std::string &value) {
+    std::string out;
+    out.reserve(value.size());
+    for (char c: value) {
+        if (c == '\\' || c == '"') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+/// \brief Heavy hitters items of one dimension: users are keyed by id, types by name
+nlohmann::json topItems(const std::vector<wss::topk::Item> &items, bool byLabel) {
+    nlohmann::json out = nlohmann::json::array();
+    for (const auto &item: items) {
+        nlohmann::json value;
+        if (byLabel) {
+            value["type"] = item.label;
+        } else {
+            value["id"] = item.key;
+        }
+        value["count"] = item.count;
+        value["error"] = item.error;
+        out.push_back(std::move(value));
+    }
+    return out;
+}
+
+/// \brief Non-empty lines of NDJSON
+void splitLines(const char *data, const char *end, std::vector<Item> &items) {
+    const char *pos = data;
+    while (pos != end) {
+        const char *lineEnd = std::find(pos, end, '\n');
+        const char *item = skipSpaces(pos, lineEnd);
+        const char *itemEnd = lineEnd;
+        while (itemEnd != item && std::isspace(static_cast<unsigned char>(*(itemEnd - 1)))) {
+            itemEnd--;
+        }
+        if (itemEnd != item) {
+            items.emplace_back(item, itemEnd - item);
+        }
+        pos = lineEnd == end ? end : lineEnd + 1;
+    }
+}
+
+const std::size_t ATTACHMENT_CHUNK_BYTES = 64 * 1024;
+/// \brief Events of pull batch and server-sent events consumer credits, by default and max
+const std::size_t EVENTS_LIMIT_DEFAULT = 1000;
+const std::size_t EVENTS_LIMIT_MAX = 10000;
+/// \brief Max events written to server-sent events response at once
+const std::size_t EVENTS_STREAM_BATCH = 256;
+
+/// \brief Server-sent events consumer of stream target. Available events are written by batches, next batch
+/// when previous is flushed to socket, so slow consumer holds only one batch. Consumer gives credits: response is
+/// finished after that many events, consumer reconnects with Last-Event-ID and so controls the pace
+struct EventsSubscription : std::enable_shared_from_this<EventsSubscription> {
+  wss::HttpResponse response;
+  std::shared_ptr<wss::event::StreamTarget> stream;
+  uint64_t id = 0;
+  uint64_t next = 0;
+  std::size_t credits = 0;
+
+  std::mutex lock;
+  bool writing = false;
+  bool finished = false;
+
+  /// \brief Writes next batch. Called on server io service
+  void pump() {
+      std::vector<wss::event::StreamTarget::Event> events;
+      std::string out;
+      {
+          std::lock_guard<std::mutex> locker(lock);
+          if (writing || finished) {
+              return;
+          }
+          const uint64_t first = stream->read(next, std::min(credits, EVENTS_STREAM_BATCH), events);
+          if (events.empty()) {
+              return;
+          }
+          writing = true;
+          if (first > next) {
+              out += fmt::format("event: gap\ndata: {{\"from\":{0},\"to\":{1}}}\n\n", next, first - 1);
+          }
+          next = events.back().offset + 1;
+          credits -= events.size();
+      }
+
+      for (const auto &event: events) {
+          out += "id: ";
+          out += std::to_string(event.offset);
+          out += "\ndata: ";
+          out += event.data;
+          out += "\n\n";
+      }
+      response->write(out.data(), out.size());
+      flush();
+  }
+
+  /// \brief Sends written part, when it's done, writes next batch. Must be called with writing flag set
+  void flush() {
+      auto self = shared_from_this();
+      response->send([self](const wss::server::http::error_code &ec) {
+        bool done;
+        {
+            std::lock_guard<std::mutex> locker(self->lock);
+            self->writing = false;
+            done = ec || self->credits == 0;
+            self->finished = done;
+        }
+        if (done) {
+            // drops last reference held by stream: response is released and connection closed
+            self->stream->unsubscribe(self->id);
+            return;
+        }
+        self->pump();
+      });
+  }
+};
+
+/// \brief Stream target by request param "stream"
+/// \return nullptr if event notifier is disabled or there is no such stream
+std::shared_ptr<wss::event::StreamTarget> findStream(const std::shared_ptr<const wss::event::EventNotifier> &notifier,
+                                                     wss::web::Request &req) {
+    if (!notifier) {
+        return nullptr;
+    }
+    return notifier->getStream(req.hasParam("stream") ? req.getParam("stream") : "events");
+}
+
+/// \brief Writes attachment file to response by chunks, next one is read when previous is flushed to socket
+void streamFile(const wss::HttpResponse &response, const std::shared_ptr<std::ifstream> &file) {
+    std::array<char, ATTACHMENT_CHUNK_BYTES> chunk;
+    file->read(chunk.data(), chunk.size());
+    const std::streamsize read = file->gcount();
+    if (read > 0) {
+        response->write(chunk.data(), read);
+    }
+    if (read < static_cast<std::streamsize>(chunk.size())) {
+        // rest is sent when response is released
+        return;
+    }
+
+    response->send([response, file](const wss::server::http::error_code &ec) {
+      if (!ec) {
+          streamFile(response, file);
+      }
+    });
+}
+
+}
 
 
 wss::ChatRestServer::ChatRestServer(std::shared_ptr<ChatServer> &chatMessageServer,
@@ -35,12 +428,57 @@ wss::ChatRestServer::ChatRestServer(std::shared_ptr<ChatServer> &chatMessageServ
     m_ws(chatMessageServer) {
 }
 
+void wss::ChatRestServer::setEventNotifier(const std::shared_ptr<const wss::event::EventNotifier> &eventNotifier) {
+    m_eventNotifier = eventNotifier;
+}
+void wss::ChatRestServer::setReloadHandler(ReloadHandler handler) {
+    m_reloadHandler = std::move(handler);
+}
+
+bool wss::ChatRestServer::isOverloaded(const wss::HttpRequest &request) const {
+    const wss::OverloadController *overload = m_ws->getOverload();
+    if (overload == nullptr || !overload->isAtLeast(wss::OverloadLevel::RejectApi)) {
+        return false;
+    }
+    // overload must stay observable
+    if (request->path == "/metrics" || request->path == "/status") {
+        return false;
+    }
+    wss::metrics::add(wss::metrics::Counter::OverloadRejectedRequests);
+    return true;
+}
+
 void wss::ChatRestServer::createEndpoints() {
     RestServer::createEndpoints();
     addEndpoint("stats", "GET", ACTION_BIND(ChatRestServer, actionStats));
     addEndpoint("stat", "GET", ACTION_BIND(ChatRestServer, actionStat));
     addEndpoint("check-online", "GET", ACTION_BIND(ChatRestServer, actionCheckOnline));
+    addEndpoint("check-online", "POST", ACTION_BIND(ChatRestServer, actionCheckOnlineMany));
     addEndpoint("send-message", "POST", ACTION_BIND(ChatRestServer, actionSendMessage));
+    addEndpoint("send-messages", "POST", ACTION_BIND(ChatRestServer, actionSendMessages));
+    addEndpoint("broadcast", "POST", ACTION_BIND(ChatRestServer, actionBroadcast));
+    addEndpoint("room", "GET", ACTION_BIND(ChatRestServer, actionRoom));
+    addEndpoint("room-join", "POST", ACTION_BIND(ChatRestServer, actionRoomJoin));
+    addEndpoint("room-leave", "POST", ACTION_BIND(ChatRestServer, actionRoomLeave));
+    addEndpoint("send-queue", "GET", ACTION_BIND(ChatRestServer, actionSendQueue));
+    addEndpoint("tls-sessions", "GET", ACTION_BIND(ChatRestServer, actionTlsSessions));
+    addEndpoint("auth-queue", "GET", ACTION_BIND(ChatRestServer, actionAuthQueue));
+    addEndpoint("throttle", "GET", ACTION_BIND(ChatRestServer, actionThrottle));
+    addEndpoint("undelivered", "GET", ACTION_BIND(ChatRestServer, actionUndelivered));
+    addEndpoint("acks", "GET", ACTION_BIND(ChatRestServer, actionAcks));
+    addEndpoint("history", "GET", ACTION_BIND(ChatRestServer, actionHistory));
+    addEndpoint("attachment", "GET", ACTION_BIND(ChatRestServer, actionAttachment));
+    addEndpoint("connections", "GET", ACTION_BIND(ChatRestServer, actionConnections));
+    addEndpoint("connection", "GET", ACTION_BIND(ChatRestServer, actionConnection));
+    addEndpoint("top", "GET", ACTION_BIND(ChatRestServer, actionTop));
+    addEndpoint("top-reset", "POST", ACTION_BIND(ChatRestServer, actionTopReset));
+    addEndpoint("presence", "GET", ACTION_BIND(ChatRestServer, actionPresence));
+    addEndpoint("events", "GET", ACTION_BIND(ChatRestServer, actionEvents));
+    addEndpoint("events/pull", "GET", ACTION_BIND(ChatRestServer, actionEventsPull));
+    addEndpoint("events/stream", "GET", ACTION_BIND(ChatRestServer, actionEventsStream));
+    addEndpoint("metrics", "GET", ACTION_BIND(ChatRestServer, actionMetrics));
+    addEndpoint("hotpath", "GET", ACTION_BIND(ChatRestServer, actionHotpath));
+    addEndpoint("reload", "POST", ACTION_BIND(ChatRestServer, actionReload));
     addEndpoint("status", "HEAD", ACTION_BIND(ChatRestServer, actionStatus));
 }
 
@@ -64,14 +502,61 @@ void wss::ChatRestServer::actionCheckOnline(wss::HttpResponse response, wss::Htt
 
     json statItem;
 
-    const auto begin = m_ws->getStats().find(id);
-    statItem["isOnline"] = begin != m_ws->getStats().end() && begin->second->isOnline();
+    const auto stat = m_ws->findStat(id);
+    statItem["isOnline"] = stat && stat->isOnline();
     content["data"] = statItem;
     const std::string out = content.dump();
     setResponseStatus(response, HttpStatus::success_ok, out.length());
     setContent(response, out, "application/json");
 }
 
+void wss::ChatRestServer::actionCheckOnlineMany(wss::HttpResponse response, wss::HttpRequest request) {
+    wss::web::Request req(request);
+    const std::string format = req.hasParam("format") ? req.getParam("format") : "ids";
+    if (format != "ids" && format != "bitmap") {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Unknown format, available: ids, bitmap");
+        return;
+    }
+
+    std::vector<wss::user_id_t> ids;
+    try {
+        const char *data = request->content.data();
+        ids = json::parse(data, data + request->content.size()).get<std::vector<wss::user_id_t>>();
+    } catch (const std::exception &e) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Array of user ids expected");
+        return;
+    }
+
+    const std::vector<bool> online = m_ws->checkOnline(ids);
+
+    json data;
+    if (format == "bitmap") {
+        std::vector<unsigned char> bitmap((online.size() + 7) / 8, 0);
+        for (std::size_t i = 0; i < online.size(); i++) {
+            if (online[i]) {
+                bitmap[i / 8] |= static_cast<unsigned char>(1u << (i % 8));
+            }
+        }
+        data["count"] = online.size();
+        data["bitmap"] = wss::utils::base64_encode(bitmap.data(), static_cast<unsigned int>(bitmap.size()));
+    } else {
+        std::vector<wss::user_id_t> onlineIds;
+        for (std::size_t i = 0; i < online.size(); i++) {
+            if (online[i]) {
+                onlineIds.push_back(ids[i]);
+            }
+        }
+        data["online"] = std::move(onlineIds);
+    }
+
+    json content;
+    content["success"] = true;
+    content["data"] = std::move(data);
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
 void wss::ChatRestServer::actionStat(wss::HttpResponse response, wss::HttpRequest request) {
     wss::web::Request req(request);
     if (!req.hasParam("id")) {
@@ -90,7 +575,8 @@ void wss::ChatRestServer::actionStat(wss::HttpResponse response, wss::HttpReques
     json content;
     content["success"] = true;
 
-    if (m_ws->getStats().find(id) == m_ws->getStats().end()) {
+    const auto stat = m_ws->findStat(id);
+    if (!stat) {
         json statItem;
         statItem["id"] = id;
         statItem["isOnline"] = false;
@@ -104,6 +590,9 @@ void wss::ChatRestServer::actionStat(wss::HttpResponse response, wss::HttpReques
         statItem["sentMessages"] = 0;
         statItem["receivedMessages"] = 0;
         statItem["bytesTransferred"] = 0;
+        statItem["messagesRate"] = 0;
+        statItem["bytesRate"] = 0;
+        statItem["connectsPerMinute"] = 0;
 
         content["data"] = statItem;
 
@@ -114,19 +603,21 @@ void wss::ChatRestServer::actionStat(wss::HttpResponse response, wss::HttpReques
     }
 
     json statItem;
-    const auto idStat = m_ws->getStats().find(id);
-    statItem["id"] = idStat->first;
-    statItem["isOnline"] = idStat->second->isOnline();
-    statItem["lastConnection"] = idStat->second->getConnectionTime();
-    statItem["connectedTimes"] = idStat->second->getConnectedTimes();
-    statItem["disconnectedTimes"] = idStat->second->getDisconnectedTimes();
-    statItem["lastMessageTime"] = idStat->second->getLastMessageTime();
-    statItem["timeOnline"] = idStat->second->getOnlineTime();
-    statItem["timeOffline"] = idStat->second->getOfflineTime();
-    statItem["timeInactivity"] = idStat->second->getInactiveTime();
-    statItem["sentMessages"] = idStat->second->getSentMessages();
-    statItem["receivedMessages"] = idStat->second->getReceivedMessages();
-    statItem["bytesTransferred"] = idStat->second->getBytesTransferred();
+    statItem["id"] = stat->getId();
+    statItem["isOnline"] = stat->isOnline();
+    statItem["lastConnection"] = stat->getConnectionTime();
+    statItem["connectedTimes"] = stat->getConnectedTimes();
+    statItem["disconnectedTimes"] = stat->getDisconnectedTimes();
+    statItem["lastMessageTime"] = stat->getLastMessageTime();
+    statItem["timeOnline"] = stat->getOnlineTime();
+    statItem["timeOffline"] = stat->getOfflineTime();
+    statItem["timeInactivity"] = stat->getInactiveTime();
+    statItem["sentMessages"] = stat->getSentMessages();
+    statItem["receivedMessages"] = stat->getReceivedMessages();
+    statItem["bytesTransferred"] = stat->getBytesTransferred();
+    statItem["messagesRate"] = stat->getMessagesRate();
+    statItem["bytesRate"] = stat->getBytesRate();
+    statItem["connectsPerMinute"] = stat->getConnectsPerMinute();
 
     content["data"] = statItem;
 
@@ -136,42 +627,78 @@ void wss::ChatRestServer::actionStat(wss::HttpResponse response, wss::HttpReques
 }
 
 void wss::ChatRestServer::actionStats(wss::HttpResponse response, wss::HttpRequest request) {
-    L_DEBUG_F("Http::Server", "%s %s", request->method.c_str(), request->path.c_str())
-    json content;
-    content["success"] = true;
+    WSS_DEBUG_F("Http::Server", "%s %s", request->method.c_str(), request->path.c_str());
+    wss::web::Request req(request);
 
-    std::vector<json> statItems(m_ws->getStats().size());
-    L_DEBUG_F("Http::Server", "Statistics: available %lu records", m_ws->getStats().size());
-    std::size_t i = 0;
-    for (auto &idStat: m_ws->getStats()) {
-        json statItem;
-        statItem["id"] = idStat.first;
-        statItem["isOnline"] = idStat.second->isOnline();
-        statItem["lastConnection"] = idStat.second->getConnectionTime();
-        statItem["connectedTimes"] = idStat.second->getConnectedTimes();
-        statItem["disconnectedTimes"] = idStat.second->getDisconnectedTimes();
-        statItem["lastMessageTime"] = idStat.second->getLastMessageTime();
-        statItem["timeOnline"] = idStat.second->getOnlineTime();
-        statItem["timeOffline"] = idStat.second->getOfflineTime();
-        statItem["timeInactivity"] = idStat.second->getInactiveTime();
-        statItem["sentMessages"] = idStat.second->getSentMessages();
-        statItem["receivedMessages"] = idStat.second->getReceivedMessages();
-        statItem["bytesTransferred"] = idStat.second->getBytesTransferred();
+    wss::user_id_t after = 0;
+    std::size_t limit = 0;
+    time_t inactive = 0;
+    try {
+        if (req.hasParam("after")) {
+            after = std::stoull(req.getParam("after"));
+        }
+        if (req.hasParam("limit")) {
+            limit = std::stoul(req.getParam("limit"));
+        }
+        if (req.hasParam("inactive")) {
+            inactive = std::stol(req.getParam("inactive"));
+        }
+    } catch (const std::exception &e) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Invalid after, limit or inactive");
+        return;
+    }
 
-        statItems[i] = std::move(statItem);
-        i++;
+    uint32_t fields = ALL_STAT_FIELDS;
+    if (req.hasParam("fields")) {
+        fields = 0;
+        for (const auto &name: toolboxpp::strings::split(req.getParam("fields"), ',')) {
+            const auto it = std::find(STAT_FIELDS.begin(), STAT_FIELDS.end(), name);
+            if (it == STAT_FIELDS.end()) {
+                setError(response, HttpStatus::client_error_bad_request, 400, "Unknown field: " + name);
+                return;
+            }
+            fields |= 1u << (it - STAT_FIELDS.begin());
+        }
     }
 
-    content["data"] = statItems;
+    wss::StatisticsStorage::Filter filter;
+    const std::string online = req.hasParam("online") ? req.getParam("online") : "";
+    if (!online.empty() || inactive > 0) {
+        const bool onlineOnly = online == "1" || online == "true";
+        const bool offlineOnly = online == "0" || online == "false";
+        filter = [onlineOnly, offlineOnly, inactive](const wss::Statistics &stat) {
+          const bool isOnline = stat.isOnline();
+          return !(onlineOnly && !isOnline)
+              && !(offlineOnly && isOnline)
+              && (inactive <= 0 || stat.getInactiveTime() > inactive);
+        };
+    }
 
-    const std::string out = content.dump();
+    // statistics storage snapshot is consistent with concurrent updates
+    auto stream = std::make_shared<StatsStream>();
+    bool more = false;
+    stream->items = m_ws->getStatsPage(after, limit, filter, more);
+    stream->fields = fields;
+    WSS_DEBUG_F("Http::Server", "Statistics: sending %lu records", stream->items.size());
 
-    setResponseStatus(response, HttpStatus::success_ok, out.length());
-    setContent(response, out, "application/json");
+    json page;
+    page["next"] = stream->items.empty() ? json(nullptr) : json(stream->items.back()->getId());
+    page["more"] = more;
+    const wss::StatisticsStorage::Rates rates = m_ws->getRates();
+    page["rates"] = {
+        {"messagesRate", rates.messagesPerSecond},
+        {"bytesRate", rates.bytesPerSecond},
+        {"connectsPerMinute", rates.connectsPerMinute}
+    };
+    // closing data array, then page fields are merged into root object
+    stream->tail = "]," + page.dump().substr(1);
+
+    setChunkedContent(response, HttpStatus::success_ok, [stream](std::string &chunk) {
+      return stream->write(chunk);
+    });
 }
 
 void wss::ChatRestServer::actionSendMessage(wss::HttpResponse response, wss::HttpRequest request) {
-    response->close_connection_after_response = true;
     auto ctype = request->header.find("content-type");
 
     if (ctype == request->header.end() || ctype->second != "application/json") {
@@ -179,7 +706,7 @@ void wss::ChatRestServer::actionSendMessage(wss::HttpResponse response, wss::Htt
         return;
     }
 
-    const MessagePayload payload(request->content.string());
+    MessagePayload payload(request->content.data(), request->content.size());
     if (!payload.isValid()) {
         setError(response, HttpStatus::client_error_bad_request, 400, payload.getError());
         return;
@@ -190,9 +717,1168 @@ void wss::ChatRestServer::actionSendMessage(wss::HttpResponse response, wss::Htt
         return;
     }
 
-    m_ws->send(payload);
+    wss::web::Request req(request);
+    unsigned long wait = 0;
+    if (req.hasParam("wait")) {
+        try {
+            wait = std::stoul(req.getParam("wait"));
+        } catch (const std::exception &e) {
+            setError(response, HttpStatus::client_error_bad_request, 400, "Invalid wait");
+            return;
+        }
+        if (wait == 0 || wait > SEND_WAIT_MAX_MILLIS) {
+            setError(response, HttpStatus::client_error_bad_request, 400,
+                     fmt::format("Wait must be from 1 to {0} ms", SEND_WAIT_MAX_MILLIS));
+            return;
+        }
+    }
+
+    payload.setTrace(wss::tracing::sampleRemote(getTraceparent(request)));
+    if (wait == 0) {
+        m_ws->send(payload);
+        setResponseStatus(response, HttpStatus::success_accepted, 0u);
+        return;
+    }
+
+    // response is completed by last write completion or by timeout, no thread waits for it
+    const std::string id = payload.getId().str();
+    const std::chrono::milliseconds timeout(wait);
+    m_ws->send(payload, timeout, [this, response, id](wss::ChatServer::DeliveryReport &&report) {
+      if (!report.tracked) {
+          post([this, response]() mutable {
+            setResponseStatus(response, HttpStatus::success_accepted, 0u);
+          });
+          return;
+      }
+      bool complete = true;
+      json recipients = json::array();
+      for (const auto &item: report.recipients) {
+          complete = complete && item.second != wss::ChatServer::DeliveryOutcome::Pending;
+          recipients.push_back({{"id", item.first}, {"result", outcomeName(item.second)}});
+      }
+      json content;
+      content["success"] = true;
+      content["data"] = json{{"id", id}, {"complete", complete}, {"recipients", std::move(recipients)}};
+      auto out = std::make_shared<std::string>(content.dump());
+      post([this, response, out]() mutable {
+        setResponseStatus(response, HttpStatus::success_ok, out->length());
+        setContent(response, *out, "application/json");
+      });
+    });
+}
+
+void wss::ChatRestServer::actionBroadcast(wss::HttpResponse response, wss::HttpRequest request) {
+    auto ctype = request->header.find("content-type");
+    if (ctype == request->header.end() || ctype->second != "application/json") {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Content-Type must be application/json");
+        return;
+    }
+
+    wss::web::Request req(request);
+    wss::BroadcastSegment segment;
+    try {
+        if (req.hasParam("connectedWithin")) {
+            segment.connectedWithinSeconds = static_cast<uint32_t>(std::stoul(req.getParam("connectedWithin")));
+        }
+        if (req.hasParam("room")) {
+            segment.room = std::stoul(req.getParam("room"));
+        }
+    } catch (const std::exception &e) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Invalid connectedWithin or room");
+        return;
+    }
+
+    json body;
+    try {
+        body = json::parse(request->content.data(), request->content.data() + request->content.size());
+    } catch (const std::exception &e) {
+        setError(response, HttpStatus::client_error_bad_request, 400, e.what());
+        return;
+    }
+    if (!body.is_object()) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Payload must be an object");
+        return;
+    }
+    // recipients are not part of broadcast, placeholder passes payload validation
+    body["recipients"] = json::array({0});
+    body.erase("room");
+    body.erase("topic");
+
+    MessagePayload payload(body);
+    if (!payload.isValid()) {
+        setError(response, HttpStatus::client_error_bad_request, 400, payload.getError());
+        return;
+    }
+    payload.setRecipients(std::vector<user_id_t>());
+    payload.setTrace(wss::tracing::sampleRemote(getTraceparent(request)));
+    m_ws->broadcast(payload, segment);
     setResponseStatus(response, HttpStatus::success_accepted, 0u);
+}
+
+void wss::ChatRestServer::actionSendMessages(wss::HttpResponse response, wss::HttpRequest request) {
+    auto ctype = request->header.find("content-type");
+    const std::string type = ctype == request->header.end() ? "" : ctype->second.substr(0, ctype->second.find(';'));
+    const bool ndjson = type == "application/x-ndjson";
+    if (!ndjson && type != "application/json") {
+        setError(response,
+                 HttpStatus::client_error_bad_request,
+                 400,
+                 "Content-Type must be application/json or application/x-ndjson");
+        return;
+    }
+
+    // items point to request buffer: payloads are parsed one by one, without building whole request document
+    const char *data = request->content.data();
+    const char *end = data + request->content.size();
+    std::vector<Item> items;
+    if (ndjson) {
+        splitLines(data, end, items);
+    } else {
+        // array is checked entirely before sending, so malformed request sends nothing
+        std::string error;
+        if (!splitArray(data, end, items, error)) {
+            setError(response, HttpStatus::client_error_bad_request, 400, error);
+            return;
+        }
+    }
+    if (items.empty()) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "No messages to send");
+        return;
+    }
+
+    json statuses = json::array();
+    std::size_t accepted = 0;
+    const std::string traceparent = getTraceparent(request);
+    for (const auto &item: items) {
+        MessagePayload payload(item.first, item.second);
+        if (!payload.isValid()) {
+            statuses.push_back({{"success", false}, {"error", payload.getError()}});
+        } else if (payload.isForBot()) {
+            statuses.push_back({{"success", false}, {"error", "Can't send message to bot through the api"}});
+        } else {
+            payload.setTrace(wss::tracing::sampleRemote(traceparent));
+            m_ws->send(payload);
+            statuses.push_back({{"success", true}});
+            accepted++;
+        }
+    }
+
+    json content;
+    content["success"] = true;
+    content["data"] = json{
+        {"accepted", accepted},
+        {"rejected", items.size() - accepted},
+        {"items", std::move(statuses)}
+    };
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_accepted, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionRoom(wss::HttpResponse response, wss::HttpRequest request) {
+    wss::web::Request req(request);
+    if (!req.hasParam("id")) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Id required");
+        return;
+    }
+
+    wss::room_id_t room;
+    try {
+        room = std::stoul(req.getParam("id"));
+    } catch (const std::exception &e) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Invalid id");
+        return;
+    }
+
+    json content;
+    content["success"] = true;
+    content["data"] = json{{"members", *m_ws->getRoomMembers(room)}};
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+bool wss::ChatRestServer::getRoomParams(const wss::HttpRequest &request,
+                                        wss::room_id_t &room,
+                                        wss::user_id_t &user,
+                                        std::string &error) {
+    wss::web::Request req(request);
+    if (!req.hasParam("id") || !req.hasParam("user")) {
+        error = "Room id and user id required";
+        return false;
+    }
 
+    try {
+        room = std::stoul(req.getParam("id"));
+        user = std::stoul(req.getParam("user"));
+    } catch (const std::exception &e) {
+        error = "Invalid room id or user id";
+        return false;
+    }
+
+    if (room == 0 || user == 0) {
+        error = "Room id and user id must be greater than 0";
+        return false;
+    }
+
+    return true;
+}
+
+void wss::ChatRestServer::actionRoomJoin(wss::HttpResponse response, wss::HttpRequest request) {
+    wss::room_id_t room;
+    wss::user_id_t user;
+    std::string error;
+    if (!getRoomParams(request, room, user, error)) {
+        setError(response, HttpStatus::client_error_bad_request, 400, error);
+        return;
+    }
+
+    json content;
+    content["success"] = true;
+    content["data"] = json{{"changed", m_ws->joinRoom(room, user)}};
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionRoomLeave(wss::HttpResponse response, wss::HttpRequest request) {
+    wss::room_id_t room;
+    wss::user_id_t user;
+    std::string error;
+    if (!getRoomParams(request, room, user, error)) {
+        setError(response, HttpStatus::client_error_bad_request, 400, error);
+        return;
+    }
+
+    json content;
+    content["success"] = true;
+    content["data"] = json{{"changed", m_ws->leaveRoom(room, user)}};
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionSendQueue(wss::HttpResponse response, wss::HttpRequest) {
+    const auto &metrics = m_ws->getSendQueueMetrics();
+
+    json content;
+    content["success"] = true;
+
+    json data;
+    data["frames"] = metrics.frames.load();
+    data["bytes"] = metrics.bytes.load();
+    data["dropped"] = metrics.dropped.load();
+    data["slowConsumerCloses"] = metrics.slowConsumerCloses.load();
+    data["coalesced"] = metrics.coalesced.load();
+    content["data"] = data;
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionTlsSessions(wss::HttpResponse response, wss::HttpRequest) {
+    const auto *metrics = m_ws->getTlsSessionMetrics();
+
+    json content;
+    content["success"] = true;
+
+    json data;
+    data["enabled"] = metrics != nullptr;
+    const uint64_t handshakes = metrics ? metrics->handshakes.load() : 0;
+    const uint64_t resumed = metrics ? metrics->resumed.load() : 0;
+    data["handshakes"] = handshakes;
+    data["resumed"] = resumed;
+    data["hitRate"] = handshakes > 0 ? static_cast<double>(resumed) / handshakes : 0.0;
+    data["ticketsRenewed"] = metrics ? metrics->ticketsRenewed.load() : 0;
+    data["ticketsRejected"] = metrics ? metrics->ticketsRejected.load() : 0;
+    content["data"] = data;
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionAuthQueue(wss::HttpResponse response, wss::HttpRequest) {
+    const auto &metrics = m_ws->getAuthMetrics();
+
+    json content;
+    content["success"] = true;
+
+    json data;
+    data["running"] = metrics.running.load();
+    data["total"] = metrics.total.load();
+    data["rejected"] = metrics.rejected.load();
+    content["data"] = data;
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionThrottle(wss::HttpResponse response, wss::HttpRequest) {
+    const auto &metrics = m_ws->getRateLimitMetrics();
+
+    json content;
+    content["success"] = true;
+
+    json data;
+    data["dropped"] = metrics.dropped.load();
+    data["delayed"] = metrics.delayed.load();
+    data["closed"] = metrics.closed.load();
+    content["data"] = data;
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionUndelivered(wss::HttpResponse response, wss::HttpRequest) {
+    const auto &store = m_ws->getUndeliveredStore();
+    const auto &metrics = store.getMetrics();
+
+    json content;
+    content["success"] = true;
+
+    json data;
+    data["messages"] = store.size();
+    data["bytes"] = metrics.bytes.load();
+    data["spilled"] = metrics.spilled.load();
+    data["dropped"] = metrics.dropped.load();
+    data["expired"] = metrics.expired.load();
+    if (const wss::WriteBehindMetrics *writeBehind = store.getWriteBehindMetrics()) {
+        json queue;
+        queue["pending"] = writeBehind->pending.load();
+        queue["pendingBytes"] = writeBehind->pendingBytes.load();
+        queue["written"] = writeBehind->written.load();
+        queue["stalls"] = writeBehind->stalls.load();
+        data["writeBehind"] = queue;
+    }
+    content["data"] = data;
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionEvents(wss::HttpResponse response, wss::HttpRequest) {
+    json content;
+    content["success"] = true;
+
+    json data;
+    data["enabled"] = m_eventNotifier != nullptr;
+    if (m_eventNotifier) {
+        const wss::event::EventMetrics &metrics = m_eventNotifier->getMetrics();
+        const uint32_t workers = metrics.workers;
+        const uint32_t busy = metrics.busyWorkers;
+        data["queued"] = metrics.queued.load();
+        data["delayed"] = metrics.delayed.load();
+        data["batching"] = metrics.batching.load();
+        data["batches"] = metrics.batches.load();
+        data["sent"] = metrics.sent.load();
+        data["failed"] = metrics.failed.load();
+        data["retried"] = metrics.retried.load();
+        data["workers"] = workers;
+        data["busyWorkers"] = busy;
+        data["utilization"] = workers == 0 ? 0.0 : static_cast<double>(busy) / workers;
+        data["dropped"] = metrics.dropped.load();
+        data["shortCircuited"] = metrics.shortCircuited.load();
+        json targets = json::array();
+        for (const auto &item: m_eventNotifier->getTargetMetrics()) {
+            json target;
+            target["type"] = item.type;
+            target["queued"] = item.queued;
+            target["delayed"] = item.delayed;
+            target["dropped"] = item.dropped;
+            target["shortCircuited"] = item.shortCircuited;
+            target["sent"] = item.sent;
+            target["retried"] = item.retried;
+            target["failed"] = item.failed;
+            target["breaker"] = item.breaker;
+            target["breakerOpened"] = item.breakerOpened;
+            target["inFlight"] = item.inFlight;
+            target["limit"] = item.limit;
+            target["maxInFlight"] = item.maxInFlight;
+            targets.push_back(target);
+        }
+        data["targets"] = targets;
+        if (const auto *outbox = m_eventNotifier->getOutbox()) {
+            const wss::event::OutboxMetrics &outboxMetrics = outbox->getMetrics();
+            json outboxData;
+            outboxData["pending"] = outbox->getPending();
+            outboxData["appended"] = outboxMetrics.appended.load();
+            outboxData["acked"] = outboxMetrics.acked.load();
+            outboxData["replayed"] = outboxMetrics.replayed.load();
+            outboxData["syncs"] = outboxMetrics.syncs.load();
+            data["outbox"] = outboxData;
+        }
+    }
+    content["data"] = data;
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionAcks(wss::HttpResponse response, wss::HttpRequest) {
+    const wss::AckMetrics *metrics = m_ws->getAckMetrics();
+
+    json content;
+    content["success"] = true;
+
+    json data;
+    data["enabled"] = metrics != nullptr;
+    if (metrics) {
+        data["inFlight"] = metrics->inFlight.load();
+        data["acked"] = metrics->acked.load();
+        data["deferred"] = metrics->deferred.load();
+        data["requeued"] = metrics->requeued.load();
+    }
+    content["data"] = data;
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionHistory(wss::HttpResponse response, wss::HttpRequest request) {
+    wss::web::Request req(request);
+    if (!req.hasParam("user")) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "User id required");
+        return;
+    }
+
+    wss::user_id_t user;
+    std::size_t limit = m_ws->getHistoryPageSize();
+    try {
+        user = std::stoul(req.getParam("user"));
+        if (req.hasParam("limit")) {
+            limit = std::min(limit, static_cast<std::size_t>(std::stoul(req.getParam("limit"))));
+        }
+    } catch (const std::exception &e) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Invalid user id or limit");
+        return;
+    }
+
+    wss::unid_t since{};
+    const bool hasCursor = req.hasParam("since");
+    if (hasCursor && !wss::unid_t::parse(req.getParam("since"), since)) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Invalid cursor");
+        return;
+    }
+
+    std::vector<wss::MessagePayloadPtr> messages;
+    if (!m_ws->readHistory(user, hasCursor ? &since : nullptr, limit, messages)) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "History is disabled");
+        return;
+    }
+
+    json page;
+    page["next"] = messages.empty() ? (hasCursor ? json(since) : json(nullptr)) : json(messages.back()->getId());
+    page["more"] = limit > 0 && messages.size() == limit;
+    // closing messages array, then page fields are merged into data object
+    auto stream = std::make_shared<HistoryStream>();
+    stream->messages = std::move(messages);
+    stream->tail = "]," + page.dump().substr(1) + "}";
+    setChunkedContent(response, HttpStatus::success_ok, [stream](std::string &chunk) {
+      return stream->write(chunk);
+    });
+}
+
+void wss::ChatRestServer::actionAttachment(wss::HttpResponse response, wss::HttpRequest request) {
+    wss::web::Request req(request);
+    if (!req.hasParam("id")) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Attachment id required");
+        return;
+    }
+    const wss::AttachmentStore *attachments = m_ws->getAttachmentStore();
+    if (!attachments) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Attachments are disabled");
+        return;
+    }
+
+    const std::string path = attachments->find(req.getParam("id"));
+    auto file = std::make_shared<std::ifstream>(path, std::ios::binary | std::ios::ate);
+    if (path.empty() || !file->is_open()) {
+        setError(response, HttpStatus::client_error_not_found, 404, "Attachment not found or expired");
+        return;
+    }
+    const std::streamoff size = file->tellg();
+    file->seekg(0);
+
+    setResponseStatus(response, HttpStatus::success_ok, static_cast<std::size_t>(size));
+    *response << buildResponse({{"Content-Type", "application/json"}}) << "\r\n";
+    streamFile(response, file);
+}
+
+void wss::ChatRestServer::actionEventsPull(wss::HttpResponse response, wss::HttpRequest request) {
+    wss::web::Request req(request);
+    const std::shared_ptr<wss::event::StreamTarget> stream = findStream(m_eventNotifier, req);
+    if (!stream) {
+        setError(response, HttpStatus::client_error_not_found, 404, "Stream not found");
+        return;
+    }
+
+    uint64_t from = 0;
+    std::size_t limit = EVENTS_LIMIT_DEFAULT;
+    try {
+        if (req.hasParam("from")) {
+            from = std::stoull(req.getParam("from"));
+        }
+        if (req.hasParam("limit")) {
+            limit = std::min(static_cast<std::size_t>(std::stoul(req.getParam("limit"))), EVENTS_LIMIT_MAX);
+        }
+    } catch (const std::exception &e) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Invalid from or limit");
+        return;
+    }
+
+    std::vector<wss::event::StreamTarget::Event> events;
+    const uint64_t first = stream->read(from, std::max(limit, (std::size_t) 1), events);
+    const uint64_t next = events.empty() ? std::max(from, first) : events.back().offset + 1;
+
+    // events are json already: they are joined without parsing
+    std::string out = fmt::format(R"({{"success":true,"data":{{"first":{0},"next":{1},"events":[)", first, next);
+    for (std::size_t i = 0; i < events.size(); i++) {
+        if (i > 0) {
+            out += ',';
+        }
+        out += events[i].data;
+    }
+    out += "]}}";
+
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionEventsStream(wss::HttpResponse response, wss::HttpRequest request) {
+    wss::web::Request req(request);
+    const std::shared_ptr<wss::event::StreamTarget> stream = findStream(m_eventNotifier, req);
+    if (!stream) {
+        setError(response, HttpStatus::client_error_not_found, 404, "Stream not found");
+        return;
+    }
+
+    auto subscription = std::make_shared<EventsSubscription>();
+    subscription->response = response;
+    subscription->stream = stream;
+    // by default only new events, reconnected EventSource resumes after last received one
+    subscription->next = stream->getNextOffset();
+    subscription->credits = EVENTS_LIMIT_DEFAULT;
+    try {
+        const auto lastId = request->header.find("Last-Event-ID");
+        if (req.hasParam("from")) {
+            subscription->next = std::stoull(req.getParam("from"));
+        } else if (lastId != request->header.end()) {
+            subscription->next = std::stoull(lastId->second) + 1;
+        }
+        if (req.hasParam("credits")) {
+            subscription->credits = std::min(static_cast<std::size_t>(std::stoul(req.getParam("credits"))),
+                                             EVENTS_LIMIT_MAX);
+        }
+    } catch (const std::exception &e) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Invalid from, Last-Event-ID or credits");
+        return;
+    }
+    // offsets start from 1
+    subscription->next = std::max(subscription->next, (uint64_t) 1);
+    if (subscription->credits == 0) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Credits must be positive");
+        return;
+    }
+
+    // body is not limited by length: connection is closed after it
+    response->close_connection_after_response = true;
+    *response << buildResponse({
+                                   {"HTTP/1.1", wss::server::status_code(HttpStatus::success_ok)},
+                                   {"Server", "WS Rest Server"},
+                                   {"Connection", "close"},
+                                   {"Content-Type", "text/event-stream"},
+                                   {"Cache-Control", "no-cache"}
+                               }) << "\r\n";
+
+    // stream holds subscription until credits are spent or write fails
+    subscription->writing = true;
+    subscription->id = stream->subscribe([this, subscription] {
+      post([subscription] {
+        subscription->pump();
+      });
+    });
+    // headers are sent right away, events that are available already follow them
+    subscription->flush();
+}
+
+void wss::ChatRestServer::actionMetrics(wss::HttpResponse response, wss::HttpRequest) {
+    using wss::metrics::Counter;
+    // per-thread counters are summed only here, rates (accepts per second etc.) are computed by prometheus
+    const wss::metrics::Snapshot snapshot = wss::metrics::collect();
+    std::string out;
+
+    writeMetric(out, "wss_connections", "gauge", "Open websocket connections", m_ws->getConnectionsCount());
+    writeMetric(out, "wss_connections_accepted_total", "counter", "Accepted websocket connections",
+                snapshot.get(Counter::ConnectionsAccepted));
+    writeMetric(out, "wss_connections_closed_total", "counter", "Closed websocket connections",
+                snapshot.get(Counter::ConnectionsClosed));
+    writeMetric(out, "wss_frames_in_total", "counter", "Received websocket messages",
+                snapshot.get(Counter::FramesIn));
+    writeMetric(out, "wss_frames_out_total", "counter", "Sent websocket messages",
+                snapshot.get(Counter::FramesOut));
+    writeMetric(out, "wss_bytes_in_total", "counter", "Received websocket messages bytes",
+                snapshot.get(Counter::BytesIn));
+    writeMetric(out, "wss_bytes_out_total", "counter", "Sent websocket messages bytes",
+                snapshot.get(Counter::BytesOut));
+
+    const auto &sendQueue = m_ws->getSendQueueMetrics();
+    writeMetric(out, "wss_send_queue_frames", "gauge", "Frames waiting in connections send queues",
+                sendQueue.frames.load());
+    writeMetric(out, "wss_send_queue_bytes", "gauge", "Bytes waiting in connections send queues",
+                sendQueue.bytes.load());
+    writeMetric(out, "wss_send_queue_dropped_total", "counter", "Frames dropped by slow consumer policy",
+                sendQueue.dropped.load());
+    writeMetric(out, "wss_send_queue_coalesced_total", "counter",
+                "Frames of coalesced types replaced by newer frame of the same sender",
+                sendQueue.coalesced.load());
+
+    // one sweep over hot connection columns
+    const auto summary = m_ws->getConnectionsSummary(CONNECTIONS_IDLE_SECONDS);
+    writeMetric(out, "wss_connections_authorized", "gauge", "Connections with authorized user",
+                summary.authorized);
+    writeMetric(out, "wss_connections_awaiting_pong", "gauge", "Connections with unanswered keepalive pings",
+                summary.awaitingPong);
+    writeMetric(out, "wss_send_queue_max_frames", "gauge", "Deepest connection send queue, frames",
+                summary.maxQueueFrames);
+    writeMetric(out, "wss_send_queue_max_bytes", "gauge", "Largest connection send queue, bytes",
+                summary.maxQueueBytes);
+
+    if (const wss::AttachmentStore *attachments = m_ws->getAttachmentStore()) {
+        writeMetric(out, "wss_attachments_offloaded_total", "counter",
+                    "Payloads which data was spooled to file and sent by reference",
+                    attachments->getOffloaded());
+        writeMetric(out, "wss_attachments_offloaded_bytes_total", "counter", "Data bytes spooled to attachment files",
+                    attachments->getOffloadedBytes());
+        writeMetric(out, "wss_attachments_expired_total", "counter", "Attachment files removed after ttl",
+                    attachments->getExpired());
+    }
+
+    writeMetricHeader(out, "wss_memory_bytes", "gauge", "Bytes held by subsystems, accounted at enqueue and dequeue");
+    static const std::array<const char *, wss::metrics::MEMORY_GAUGES> memoryNames = {{
+        "send_queues", "read_buffers", "fragment_buffers", "undelivered", "event_queue", "statistics", "connections"
+    }};
+    for (std::size_t i = 0; i < wss::metrics::MEMORY_GAUGES; i++) {
+        out += fmt::format("wss_memory_bytes{{subsystem=\"{0}\"}} {1}\n",
+                           memoryNames[i], wss::metrics::getMemory(static_cast<wss::metrics::Memory>(i)));
+    }
+    writeMetric(out, "wss_memory_soft_limit_bytes", "gauge", "Memory soft limit, 0 - unlimited",
+                wss::metrics::getMemorySoftLimit());
+    writeMetric(out, "wss_memory_shed_total", "counter", "Connections, events and messages shed by memory soft limit",
+                snapshot.get(Counter::MemoryShed));
+    writeMetric(out, "wss_shard_redirects_total", "counter",
+                "Connections redirected to node of shard ring, that user belongs to",
+                snapshot.get(Counter::ShardRedirects));
+    writeMetric(out, "wss_handoff_sent_total", "counter",
+                "User statistics and undelivered messages handed off to other node by drain",
+                snapshot.get(Counter::HandoffSent));
+    writeMetric(out, "wss_handoff_received_total", "counter",
+                "User statistics and undelivered messages received from draining nodes",
+                snapshot.get(Counter::HandoffReceived));
+    writeMetric(out, "wss_statistics_expired_total", "counter",
+                "Statistics of long offline users removed by chat.statistics limits",
+                snapshot.get(Counter::StatisticsExpired));
+    writeMetric(out, "wss_zerocopy_writes_total", "counter", "Socket writes sent with MSG_ZEROCOPY",
+                snapshot.get(Counter::ZeroCopyWrites));
+    writeMetric(out, "wss_zerocopy_copied_total", "counter",
+                "MSG_ZEROCOPY sends, that kernel has copied anyway (loopback or device without scatter-gather)",
+                snapshot.get(Counter::ZeroCopyCopied));
+    writeMetric(out, "wss_proxy_header_rejected_total", "counter",
+                "Connections closed because of missing or invalid PROXY protocol header",
+                snapshot.get(Counter::ProxyHeaderRejected));
+    writeMetric(out, "wss_admission_rejected_connections_total", "counter",
+                "Connections closed after accept: source address is over server.admission.maxConnectionsPerIp",
+                snapshot.get(Counter::AdmissionRejectedConnections));
+    writeMetric(out, "wss_admission_rejected_rate_total", "counter",
+                "Connections closed after accept: source address is over server.admission.connectRatePerIp",
+                snapshot.get(Counter::AdmissionRejectedRate));
+    writeMetric(out, "wss_handshake_rejected_total", "counter",
+                "Connections closed because upgrade request is not a GET or its head is over limit",
+                snapshot.get(Counter::HandshakeRejected));
+
+    // soak runs watch these for growth that never goes back (packaging/soak.sh)
+    const wss::StateSizes sizes = m_ws->getStateSizes();
+    writeMetricHeader(out, "wss_state_entries", "gauge", "Entries of long-living server structures");
+    const std::array<std::pair<const char *, std::size_t>, 6> structures = {{
+        {"connections", sizes.connections},
+        {"users", sizes.users},
+        {"statistics", sizes.statistics},
+        {"rooms", sizes.rooms},
+        {"topic_subscriptions", sizes.topicSubscriptions},
+        {"rate_limited_users", sizes.rateLimitedUsers}
+    }};
+    for (const auto &structure: structures) {
+        out += fmt::format("wss_state_entries{{structure=\"{0}\"}} {1}\n", structure.first, structure.second);
+    }
+
+    const wss::server::websocket::EventLoopMetrics loops = m_ws->getEventLoopMetrics();
+    if (!loops.lagMicros.empty()) {
+        writeMetricHeader(out, "wss_event_loop_lag_last_seconds", "gauge", "Event loop lag measured by last probe");
+        for (std::size_t i = 0; i < loops.lagMicros.size(); i++) {
+            out += fmt::format("wss_event_loop_lag_last_seconds{{loop=\"{0}\"}} {1:.6f}\n",
+                               i, loops.lagMicros[i] / 1000000.0);
+        }
+        writeMetric(out, "wss_executor_backlog_sampled", "gauge", "Connections which executor backlog was sampled",
+                    loops.backlogSampled);
+        writeMetric(out, "wss_executor_backlog_max", "gauge", "Largest executor backlog of sampled connections",
+                    loops.backlogMax);
+        writeMetric(out, "wss_executor_backlog_tasks", "gauge", "Tasks waiting in executors of sampled connections",
+                    loops.backlogTotal);
+        writeHistogram(out, "wss_event_loop_lag_seconds", "Posted no-op waited behind ready event loop handlers",
+                       snapshot.get(wss::metrics::Histogram::EventLoopLag));
+        writeMetric(out, "wss_lag_shed_total", "counter", "Connections rejected because event loop lag was over limit",
+                    snapshot.get(Counter::LagShed));
+    }
+
+    const auto &auth = m_ws->getAuthMetrics();
+    writeMetric(out, "wss_auth_running", "gauge", "Connections waiting for authorization", auth.running.load());
+    writeMetric(out, "wss_auth_rejected_total", "counter", "Connections rejected because auth queue was full",
+                auth.rejected.load());
+    writeHistogram(out, "wss_auth_latency_seconds", "Connection authorization latency",
+                   snapshot.get(wss::metrics::Histogram::AuthLatency));
+
+    // message latency stages: parse -> route -> send queue wait -> socket write
+    writeHistogram(out, "wss_message_parse_seconds", "Message read from socket to payload decoded",
+                   snapshot.get(wss::metrics::Histogram::MessageParse));
+    writeHistogram(out, "wss_message_route_seconds", "Payload routed and queued to recipients connections",
+                   snapshot.get(wss::metrics::Histogram::MessageRoute));
+    writeHistogram(out, "wss_message_queue_wait_seconds", "Frame waited in connection send queue",
+                   snapshot.get(wss::metrics::Histogram::MessageQueueWait));
+    writeHistogram(out, "wss_message_write_seconds", "Socket write of frames",
+                   snapshot.get(wss::metrics::Histogram::MessageWrite));
+    writeHistogram(out, "wss_message_latency_seconds", "Message read from socket to written to recipient socket",
+                   snapshot.get(wss::metrics::Histogram::MessageEndToEnd));
+
+    if (wss::tracing::isEnabled()) {
+        const wss::tracing::Stats traces = wss::tracing::getStats();
+        writeMetricHeader(out, "wss_trace_spans_total", "counter", "Trace spans by export result");
+        out += fmt::format("wss_trace_spans_total{{result=\"recorded\"}} {0}\n", traces.recorded);
+        out += fmt::format("wss_trace_spans_total{{result=\"exported\"}} {0}\n", traces.exported);
+        out += fmt::format("wss_trace_spans_total{{result=\"dropped\"}} {0}\n", traces.dropped);
+        out += fmt::format("wss_trace_spans_total{{result=\"failed\"}} {0}\n", traces.failed);
+    }
+
+    const wss::topk::Snapshot top = wss::topk::collect(10);
+    const auto &writeTop = [&out](const char *name, const char *help, const char *label,
+                                  const std::vector<wss::topk::Item> &items, bool byLabel) {
+      writeMetricHeader(out, name, "gauge", help);
+      for (const auto &item: items) {
+          out += fmt::format("{0}{{{1}=\"{2}\"}} {3}\n",
+                             name, label, byLabel ? escapeLabel(item.label) : std::to_string(item.key), item.count);
+      }
+    };
+    writeTop("wss_top_sender_messages", "Estimated messages of top 10 senders", "user",
+             top.get(wss::topk::Dimension::Senders), false);
+    writeTop("wss_top_recipient_messages", "Estimated delivered messages of top 10 recipients", "user",
+             top.get(wss::topk::Dimension::Recipients), false);
+    writeTop("wss_top_type_messages", "Estimated messages of top 10 message types", "type",
+             top.get(wss::topk::Dimension::Types), true);
+
+    if (m_eventNotifier) {
+        const std::vector<wss::event::TargetMetrics> targets = m_eventNotifier->getTargetMetrics();
+        const auto &writeTargets = [&out, &targets](const char *name, const char *type, const char *help,
+                                                    uint64_t wss::event::TargetMetrics::*field) {
+          writeMetricHeader(out, name, type, help);
+          for (std::size_t i = 0; i < targets.size(); i++) {
+              out += fmt::format("{0}{{target=\"{1}\",index=\"{2}\"}} {3}\n",
+                                 name, targets[i].type, i, targets[i].*field);
+          }
+        };
+        writeTargets("wss_event_queued", "gauge", "Events waiting for worker", &wss::event::TargetMetrics::queued);
+        writeTargets("wss_event_delayed", "gauge", "Events waiting for retry", &wss::event::TargetMetrics::delayed);
+        writeTargets("wss_event_sent_total", "counter", "Sent events", &wss::event::TargetMetrics::sent);
+        writeTargets("wss_event_retried_total", "counter", "Event send retries", &wss::event::TargetMetrics::retried);
+        writeTargets("wss_event_failed_total", "counter", "Events failed after all tries",
+                     &wss::event::TargetMetrics::failed);
+        writeTargets("wss_event_dropped_total", "counter", "Events dropped because target queue was full",
+                     &wss::event::TargetMetrics::dropped);
+        writeTargets("wss_event_filtered_total", "counter", "Events not matched by target filter",
+                     &wss::event::TargetMetrics::filtered);
+    }
+
+    if (const wss::ClusterBus *cluster = m_ws->getCluster()) {
+        const wss::ClusterMetrics &links = cluster->getMetrics();
+        writeMetric(out, "wss_cluster_links_up", "gauge", "Connected links to other nodes", links.linksUp.load());
+        writeMetric(out, "wss_cluster_remote_users", "gauge", "Users connected to other nodes",
+                    cluster->getDirectory().size());
+        writeMetric(out, "wss_cluster_reconnects_total", "counter", "Reconnects of links to other nodes",
+                    links.reconnects.load());
+        writeMetric(out, "wss_cluster_forwarded_total", "counter", "Messages forwarded to other nodes",
+                    links.forwarded.load());
+        writeMetric(out, "wss_cluster_forwarded_recipients_total", "counter", "Recipients of forwarded messages",
+                    links.forwardedRecipients.load());
+        writeMetric(out, "wss_cluster_received_total", "counter", "Messages received from other nodes",
+                    links.received.load());
+        writeMetric(out, "wss_cluster_unroutable_total", "counter",
+                    "Remote recipients not forwarded because link was down or full", links.unroutable.load());
+        writeMetric(out, "wss_cluster_lost_bytes_total", "counter", "Buffered bytes lost with broken links",
+                    links.lostBytes.load());
+        writeMetric(out, "wss_cluster_resyncs_total", "counter", "Syncs of all local users sent to other nodes",
+                    links.resyncs.load());
+        writeMetric(out, "wss_cluster_sent_bytes_total", "counter", "Bytes written to other nodes",
+                    links.bytesOut.load());
+        writeMetric(out, "wss_cluster_received_bytes_total", "counter", "Bytes read from other nodes",
+                    links.bytesIn.load());
+    }
+    if (const wss::ClusterBridge *bridge = m_ws->getClusterBridge()) {
+        const wss::ClusterBridgeMetrics &brokered = bridge->getMetrics();
+        writeMetric(out, "wss_cluster_bridge_subscriptions", "gauge", "Users channels subscribed by this node",
+                    bridge->getSubscriptions());
+        writeMetric(out, "wss_cluster_bridge_forwarded_recipients_total", "counter",
+                    "Recipients of messages published for other nodes", brokered.forwarded.load());
+        writeMetric(out, "wss_cluster_bridge_received_total", "counter", "Messages received from other nodes",
+                    brokered.received.load());
+        writeMetric(out, "wss_cluster_bridge_unroutable_total", "counter",
+                    "Published recipients, that no node has received", brokered.unroutable.load());
+        writeMetric(out, "wss_cluster_bridge_errors_total", "counter", "Failed broker commands and invalid messages",
+                    brokered.errors.load());
+    }
+    if (const wss::OverloadController *overload = m_ws->getOverload()) {
+        writeMetric(out, "wss_overload_level", "gauge",
+                    "Overload level: 0 - normal, 1 - reject connections, 2 - shed bulk messages, 3 - reject api",
+                    static_cast<int>(overload->getLevel()));
+        writeMetricHeader(out, "wss_overload_pressure", "gauge", "Largest load signal relative to its limit");
+        out += fmt::format("wss_overload_pressure {0:.3f}\n", overload->getPressure());
+        writeMetric(out, "wss_overload_transitions_total", "counter", "Overload level changes",
+                    overload->getTransitions());
+        writeMetric(out, "wss_overload_rejected_connections_total", "counter",
+                    "Websocket upgrades answered with 503 by overload controller",
+                    snapshot.get(Counter::OverloadRejectedConnections));
+        writeMetric(out, "wss_overload_shed_messages_total", "counter",
+                    "Messages of bulk priority types dropped by overload controller",
+                    snapshot.get(Counter::OverloadShedMessages));
+        writeMetric(out, "wss_overload_rejected_requests_total", "counter",
+                    "Rest api requests answered with 429 by overload controller",
+                    snapshot.get(Counter::OverloadRejectedRequests));
+    }
+    if (const wss::LocalIngest *ingest = m_ws->getLocalIngest()) {
+        writeMetric(out, "wss_local_ingest_received_total", "counter", "Messages taken from local ingest ring",
+                    ingest->getMetrics().received.load());
+        writeMetric(out, "wss_local_ingest_invalid_total", "counter", "Local ingest messages with invalid envelope",
+                    ingest->getMetrics().invalid.load());
+        writeMetric(out, "wss_local_ingest_rejected_total", "counter", "Producer pushes rejected by full ring",
+                    ingest->getRejected());
+    }
+    if (const wss::DeliveryScheduler *scheduler = m_ws->getScheduler()) {
+        writeMetric(out, "wss_scheduled_messages", "gauge", "Messages waiting for their deliverAt time",
+                    scheduler->size());
+        writeMetric(out, "wss_scheduled_delivered_total", "counter", "Scheduled messages sent when due",
+                    scheduler->getDelivered());
+        writeMetric(out, "wss_scheduled_rejected_total", "counter",
+                    "Scheduled messages dropped because scheduler is full or delay is too long",
+                    scheduler->getRejected());
+    }
+    if (const wss::RecipientCache *cache = m_ws->getRecipientCache()) {
+        writeMetric(out, "wss_recipient_cache_entries", "gauge", "Cached recipient sets", cache->size());
+        writeMetric(out, "wss_recipient_cache_hits_total", "counter", "Group sends served by cached recipient set",
+                    cache->getHits());
+        writeMetric(out, "wss_recipient_cache_misses_total", "counter",
+                    "Group sends that looked up recipients: new set or its connections changed",
+                    cache->getMisses());
+    }
+    if (const wss::IngestServer *ingest = m_ws->getIngestServer()) {
+        const wss::IngestMetrics &metrics = ingest->getMetrics();
+        writeMetric(out, "wss_ingest_connections", "gauge", "Open streaming ingest connections",
+                    metrics.connections.load());
+        writeMetric(out, "wss_ingest_batches_total", "counter", "Batches received by streaming ingest",
+                    metrics.batches.load());
+        writeMetric(out, "wss_ingest_accepted_total", "counter", "Streaming ingest messages sent",
+                    metrics.accepted.load());
+        writeMetric(out, "wss_ingest_rejected_total", "counter", "Streaming ingest messages rejected as invalid",
+                    metrics.rejected.load());
+        writeMetric(out, "wss_ingest_received_bytes_total", "counter", "Bytes of streaming ingest frames",
+                    metrics.bytesIn.load());
+    }
+    if (const wss::Http2Gateway *http2 = m_ws->getHttp2Gateway()) {
+        const wss::Http2Metrics &metrics = http2->getMetrics();
+        writeMetric(out, "wss_http2_connections", "gauge", "Open HTTP/2 connections", metrics.connections.load());
+        writeMetric(out, "wss_http2_streams", "gauge", "Open websocket streams of HTTP/2 connections",
+                    metrics.streams.load());
+        writeMetric(out, "wss_http2_streams_total", "counter", "Websocket streams requested over HTTP/2",
+                    metrics.streamsTotal.load());
+        writeMetric(out, "wss_http2_streams_rejected_total", "counter",
+                    "HTTP/2 streams answered without upgrade: invalid request or rejected by ws listener",
+                    metrics.rejectedStreams.load());
+        writeMetric(out, "wss_http2_received_bytes_total", "counter", "Bytes read from HTTP/2 connections",
+                    metrics.bytesIn.load());
+        writeMetric(out, "wss_http2_sent_bytes_total", "counter", "Bytes written to HTTP/2 connections",
+                    metrics.bytesOut.load());
+    }
+
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, std::move(out), "text/plain; version=0.0.4");
+}
+
+void wss::ChatRestServer::actionConnections(wss::HttpResponse response, wss::HttpRequest request) {
+    wss::web::Request req(request);
+    long idle = CONNECTIONS_IDLE_SECONDS;
+    if (req.hasParam("idle")) {
+        try {
+            idle = std::stol(req.getParam("idle"));
+        } catch (const std::exception &e) {
+            setError(response, HttpStatus::client_error_bad_request, 400, "Invalid idle");
+            return;
+        }
+    }
+
+    json content;
+    content["success"] = true;
+
+    const wss::server::websocket::ConnectionTable::Summary summary = m_ws->getConnectionsSummary(idle);
+    json data;
+    data["connections"] = m_ws->getConnectionsCount();
+    data["authorized"] = summary.authorized;
+    data["awaitingPong"] = summary.awaitingPong;
+    data["idle"] = summary.idle;
+    data["maxQueueFrames"] = summary.maxQueueFrames;
+    data["maxQueueBytes"] = summary.maxQueueBytes;
+    content["data"] = data;
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionConnection(wss::HttpResponse response, wss::HttpRequest request) {
+    wss::web::Request req(request);
+    if (!req.hasParam("user")) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "User id required");
+        return;
+    }
+
+    wss::user_id_t user;
+    try {
+        user = std::stoul(req.getParam("user"));
+    } catch (const std::exception &e) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Invalid user id");
+        return;
+    }
+
+    const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    // connection times are steady clock, so they are given as milliseconds ago
+    const auto &ago = [now](int64_t millis) {
+      return millis == 0 ? json(nullptr) : json(now - millis);
+    };
+
+    json connections = json::array();
+    for (const auto &item: m_ws->getConnectionDiagnostics(user)) {
+        json tls = {{"enabled", item.secure}};
+        if (item.secure) {
+            tls["version"] = item.tlsVersion;
+            tls["cipher"] = item.tlsCipher;
+            tls["resumed"] = item.tlsResumed;
+        }
+        connections.push_back({
+                                  {"id", item.uniqueId},
+                                  {"address", item.remoteAddress},
+                                  {"port", item.remotePort},
+                                  {"sendQueueFrames", item.sendQueueFrames},
+                                  {"sendQueueBytes", item.sendQueueBytes},
+                                  {"executorBacklog", item.executorBacklog},
+                                  {"lastReadMsAgo", ago(item.lastReadMillis)},
+                                  {"lastWriteMsAgo", ago(item.lastWriteMillis)},
+                                  {"rttMicros", item.rttMicros < 0 ? json(nullptr) : json(item.rttMicros)},
+                                  {"unansweredPings", item.unansweredPings},
+                                  {"tls", tls},
+                                  {"fragmentBufferBytes", item.fragmentBufferBytes},
+                                  {"subprotocol", item.subprotocol},
+                                  {"permessageDeflate", item.permessageDeflate}
+                              });
+    }
+
+    json content;
+    content["success"] = true;
+    content["data"] = {
+        {"user", user},
+        {"online", !connections.empty()},
+        {"connections", connections}
+    };
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionTop(wss::HttpResponse response, wss::HttpRequest request) {
+    wss::web::Request req(request);
+    std::size_t limit = 10;
+    try {
+        if (req.hasParam("limit")) {
+            limit = std::stoul(req.getParam("limit"));
+        }
+    } catch (const std::exception &e) {
+        setError(response, HttpStatus::client_error_bad_request, 400, "Invalid limit");
+        return;
+    }
+
+    const wss::topk::Snapshot top = wss::topk::collect(std::min(limit, wss::topk::CAPACITY));
+    json content;
+    content["success"] = true;
+    content["data"] = {
+        {"senders", topItems(top.get(wss::topk::Dimension::Senders), false)},
+        {"recipients", topItems(top.get(wss::topk::Dimension::Recipients), false)},
+        {"types", topItems(top.get(wss::topk::Dimension::Types), true)},
+        {"totals", {
+            {"sent", top.getTotal(wss::topk::Dimension::Senders)},
+            {"delivered", top.getTotal(wss::topk::Dimension::Recipients)}
+        }}
+    };
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionHotpath(wss::HttpResponse response, wss::HttpRequest) {
+    if (!wss::hotpath::ENABLED) {
+        setError(response, HttpStatus::client_error_not_found, 404, "Hot path profiling is not built");
+        return;
+    }
+
+    wss::hotpath::Snapshot current;
+    wss::hotpath::Snapshot last;
+    double windowSeconds;
+    {
+        // one window per call: maximums are reset by collect()
+        std::lock_guard<std::mutex> lock(m_hotpathMutex);
+        current = wss::hotpath::collect();
+        const auto now = std::chrono::steady_clock::now();
+        windowSeconds = std::chrono::duration<double>(now - m_hotpathLastTime).count();
+        last = m_hotpathLast;
+        m_hotpathLast = current;
+        m_hotpathLastTime = now;
+    }
+    const auto micros = [](uint64_t nanos) {
+      return static_cast<double>(nanos) / 1000.0;
+    };
+    const auto perSecond = [windowSeconds](uint64_t count) {
+      return windowSeconds > 0 ? static_cast<double>(count) / windowSeconds : 0.0;
+    };
+
+    json locks = json::array();
+    for (std::size_t i = 0; i < wss::hotpath::LOCK_SITES; i++) {
+        const wss::hotpath::LockStats &total = current.locks[i];
+        const wss::hotpath::LockStats &previous = last.locks[i];
+        const uint64_t acquisitions = total.acquisitions - previous.acquisitions;
+        const uint64_t waitNanos = total.waitNanos - previous.waitNanos;
+        const uint64_t holdNanos = total.holdNanos - previous.holdNanos;
+        locks.push_back({
+                            {"site", wss::hotpath::nameOf(static_cast<wss::hotpath::LockSite>(i))},
+                            {"acquisitions", total.acquisitions},
+                            {"contended", total.contended},
+                            {"waitMicros", micros(total.waitNanos)},
+                            {"holdMicros", micros(total.holdNanos)},
+                            {"window", {
+                                {"acquisitions", acquisitions},
+                                {"perSecond", perSecond(acquisitions)},
+                                {"contended", total.contended - previous.contended},
+                                {"waitMicros", micros(waitNanos)},
+                                {"holdMicros", micros(holdNanos)},
+                                {"avgWaitMicros", acquisitions ? micros(waitNanos / acquisitions) : 0.0},
+                                {"avgHoldMicros", acquisitions ? micros(holdNanos / acquisitions) : 0.0},
+                                {"maxWaitMicros", micros(total.maxWaitNanos)},
+                                {"maxHoldMicros", micros(total.maxHoldNanos)}
+                            }}
+                        });
+    }
+
+    json allocations = json::array();
+    for (std::size_t i = 0; i < wss::hotpath::ALLOC_SITES; i++) {
+        const wss::hotpath::AllocStats &total = current.allocations[i];
+        const wss::hotpath::AllocStats &previous = last.allocations[i];
+        const uint64_t count = total.allocations - previous.allocations;
+        allocations.push_back({
+                                  {"site", wss::hotpath::nameOf(static_cast<wss::hotpath::AllocSite>(i))},
+                                  {"allocations", total.allocations},
+                                  {"frees", total.frees},
+                                  {"live", total.live()},
+                                  {"bytes", total.bytes},
+                                  {"window", {
+                                      {"allocations", count},
+                                      {"perSecond", perSecond(count)},
+                                      {"bytes", total.bytes - previous.bytes}
+                                  }}
+                              });
+    }
+
+    json content;
+    content["success"] = true;
+    content["data"] = {
+        {"windowSeconds", windowSeconds},
+        {"locks", locks},
+        {"allocations", allocations}
+    };
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionReload(wss::HttpResponse response, wss::HttpRequest) {
+    if (!m_reloadHandler) {
+        setError(response, HttpStatus::client_error_not_found, 404, "Reload is not available");
+        return;
+    }
+
+    json content;
+    try {
+        content["data"] = m_reloadHandler();
+    } catch (const std::runtime_error &e) {
+        setError(response, HttpStatus::server_error_internal_server_error, 500, e.what());
+        return;
+    }
+    content["success"] = true;
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
+}
+
+void wss::ChatRestServer::actionTopReset(wss::HttpResponse response, wss::HttpRequest) {
+    wss::topk::reset();
+    setResponseStatus(response, HttpStatus::success_ok, 0u);
+}
+
+void wss::ChatRestServer::actionPresence(wss::HttpResponse response, wss::HttpRequest request) {
+    wss::web::Request req(request);
+    uint64_t since = 0;
+    if (req.hasParam("since")) {
+        try {
+            since = std::stoull(req.getParam("since"));
+        } catch (const std::exception &e) {
+            setError(response, HttpStatus::client_error_bad_request, 400, "Invalid since");
+            return;
+        }
+    }
+
+    std::vector<wss::PresenceFeed::PresenceEvent> events;
+    uint64_t last = 0;
+    const bool complete = m_ws->getPresenceEvents(since, events, last);
+
+    json items = json::array();
+    for (const auto &event: events) {
+        items.push_back({{"user", event.user}, {"online", event.online}, {"seq", event.sequence}});
+    }
+
+    json content;
+    content["success"] = true;
+    // reset: client must reload online users (GET /stats) and continue from "next"
+    content["data"] = json{{"events", items}, {"next", last}, {"reset", !complete}};
+
+    const std::string out = content.dump();
+    setResponseStatus(response, HttpStatus::success_ok, out.length());
+    setContent(response, out, "application/json");
 }
 
 void wss::ChatRestServer::actionStatus(wss::HttpResponse response, wss::HttpRequest) {
@@ -9,19 +9,31 @@
 #ifndef WSSERVER_CHATRESTAPI_H
 #define WSSERVER_CHATRESTAPI_H
 
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include "..//wsserver_core.h"
 #include "RestServer.h"
+#include "../base/Hotpath.h"
 #include "../base/auth/Auth.h"
 #include "json.hpp"
 
 namespace wss {
 
+namespace event {
+class EventNotifier;
+}
+
 using namespace std::placeholders;
 
 class ChatRestServer : public RestServer {
  public:
+    /// \brief Re-reads server config and applies tunable settings
+    /// \throws std::runtime_error if config can't be read, nothing is applied then
+    /// \return report: applied settings and ones that require restart
+    using ReloadHandler = std::function<nlohmann::json()>;
+
     explicit ChatRestServer(
         std::shared_ptr<ChatServer> &chatMessageServer,
         const std::string &crtPath, const std::string &keyPath
@@ -33,7 +45,27 @@ class ChatRestServer : public RestServer {
 
     explicit ChatRestServer(std::shared_ptr<ChatServer> &chatMessageServer);
     ChatRestServer(std::shared_ptr<ChatServer> &chatMessageServer, const std::string &host, unsigned short port);
+
+    /// \brief Event notifier, which counters are available at GET /events
+    /// \param eventNotifier nullptr if event notifier is disabled
+    void setEventNotifier(const std::shared_ptr<const wss::event::EventNotifier> &eventNotifier);
+    /// \brief Enables POST /reload
+    /// \param handler
+    void setReloadHandler(ReloadHandler handler);
  protected:
+    /// \brief Overload controller level RejectApi: all requests except metrics and status
+    /// \param request
+    /// \return
+    bool isOverloaded(const wss::HttpRequest &request) const override;
+
+    /// \brief Reads room id and user id params
+    /// \param request
+    /// \param room
+    /// \param user
+    /// \param error
+    /// \return false if any param is missing or invalid, error contains reason
+    bool getRoomParams(const wss::HttpRequest &request, wss::room_id_t &room, wss::user_id_t &user, std::string &error);
+
     // actions
     /// \brief Statistics list method: GET /stats
     /// \param response Http response
@@ -50,13 +82,154 @@ class ChatRestServer : public RestServer {
     /// \param request Http request
     ACTION_DEFINE(actionCheckOnline);
 
-    /// \brief Send message to recipient: POST /send-message
-    /// content-type must be JSON and data must have a valid structure
+    /// \brief Many users online checking method: POST /check-online?format={ids|bitmap}
+    /// content is JSON array of user ids. Response contains online ids, or with format=bitmap - base64 of bits
+    /// in request ids order (bit i is (byte i / 8) >> (i % 8) & 1)
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionCheckOnlineMany);
+
+    /// \brief Send message to recipient: POST /send-message?wait=
+    /// content-type must be JSON and data must have a valid structure.
+    /// Without wait answers 202 right away. With wait (ms) answers 200 with result of every recipient, once all
+    /// writes are completed or message is queued, or when wait is elapsed (not completed ones are "pending")
     /// \see wss::MessagePayload
     /// \param response Http response
     /// \param request Http request
     ACTION_DEFINE(actionSendMessage);
 
+    /// \brief Send many messages at once: POST /send-messages
+    /// content-type must be JSON (array of payloads) or NDJSON (application/x-ndjson, payload per line).
+    /// Items are parsed and sent one by one, response contains status of each item in request order
+    /// \see wss::MessagePayload
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionSendMessages);
+
+    /// \brief Send message to all connected users of this server: POST /broadcast?connectedWithin={seconds}&room={RoomId}
+    /// content-type must be JSON, recipients of payload are not required and ignored.
+    /// connectedWithin - also users that were online during this time, offline ones get message from undelivered queue.
+    /// room - only room members
+    /// \see wss::ChatServer::broadcast
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionBroadcast);
+
+    /// \brief Room members list: GET /room?id={RoomId}
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionRoom);
+
+    /// \brief Add user to room: POST /room-join?id={RoomId}&user={UserId}
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionRoomJoin);
+
+    /// \brief Remove user from room: POST /room-leave?id={RoomId}&user={UserId}
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionRoomLeave);
+
+    /// \brief Send queues gauges (all connections): GET /send-queue
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionSendQueue);
+
+    /// \brief TLS handshakes and session resumption counters: GET /tls-sessions
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionTlsSessions);
+
+    /// \brief Connection authorization counters: GET /auth-queue
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionAuthQueue);
+
+    /// \brief Inbound rate limiting counters: GET /throttle
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionThrottle);
+
+    /// \brief Undelivered queue size and counters: GET /undelivered
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionUndelivered);
+
+    /// \brief Acknowledgement window counters: GET /acks
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionAcks);
+
+    /// \brief User messages page from history log: GET /history?user=&since=&limit=
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionHistory);
+
+    /// \brief Data of large message, that was sent by reference: GET /attachment?id=
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionAttachment);
+
+    /// \brief Open connections count and state summary (authorized, awaiting pong, idle, deepest send queue):
+    /// GET /connections?idle=seconds
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionConnections);
+
+    /// \brief Live state of user connections (send queue, executor backlog, ping RTT, TLS): GET /connection?user=
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionConnection);
+
+    /// \brief Heavy hitters: top senders, recipients and message types, GET /top?limit=
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionTop);
+
+    /// \brief Drops heavy hitters counters: POST /top-reset
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionTopReset);
+
+    /// \brief Users online/offline transitions after cursor: GET /presence?since=
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionPresence);
+
+    /// \brief Event notifier queue depth and workers utilization: GET /events
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionEvents);
+
+    /// \brief Batch of events of stream target: GET /events/pull?stream=&from=&limit=
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionEventsPull);
+
+    /// \brief Server-sent events of stream target: GET /events/stream?stream=&from=&credits=
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionEventsStream);
+
+    /// \brief Server-wide counters, gauges and latency histograms in Prometheus text format: GET /metrics
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionMetrics);
+
+    /// \brief Wait and hold time of hot mutexes and counts of per-message allocations: GET /hotpath
+    /// Totals since start and the window since previous call (deltas, rates and maximums), so polling it before and
+    /// after a change shows which site limits throughput. 404 if server was built without -DWITH_HOTPATH_PROFILING
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionHotpath);
+
+    /// \brief Reloads config file without restart, the same as SIGHUP: POST /reload
+    /// Tunable settings (workers pools, limits, queue caps, intervals) are applied at once, other changed settings
+    /// are listed as requiring restart
+    /// \param response Http response
+    /// \param request Http request
+    ACTION_DEFINE(actionReload);
+
     /// \brief Check server is online
     /// \param response
     /// \param request
@@ -67,6 +240,12 @@ class ChatRestServer : public RestServer {
 
  private:
     std::shared_ptr<ChatServer> m_ws;
+    std::shared_ptr<const wss::event::EventNotifier> m_eventNotifier;
+    ReloadHandler m_reloadHandler;
+
+    std::mutex m_hotpathMutex;
+    wss::hotpath::Snapshot m_hotpathLast;
+    std::chrono::steady_clock::time_point m_hotpathLastTime = std::chrono::steady_clock::now();
 };
 }
 
@@ -7,6 +7,7 @@
  */
 
 #include "RestServer.h"
+#include <atomic>
 
 wss::RestServer::RestServer(
     const std::string &crtPath, const std::string &keyPath,
@@ -39,6 +40,7 @@ void wss::RestServer::createEndpoints() {
 
 void wss::RestServer::cleanupEndpoints() {
     m_server->resource.clear();
+    m_server->exact_resource.clear();
 }
 
 void wss::RestServer::setAddress(const std::string &address) {
@@ -55,6 +57,19 @@ void wss::RestServer::setPort(uint16_t portNumber) {
     m_server->config.port = portNumber;
 }
 
+void wss::RestServer::setKeepAlive(long idleTimeoutSeconds, std::size_t maxRequests) {
+    m_server->config.timeout_idle = idleTimeoutSeconds;
+    m_server->config.max_requests_per_connection = maxRequests;
+}
+
+void wss::RestServer::setSocketOptions(const wss::SocketOptions &options) {
+    m_server->config.socket = options;
+}
+
+const char *wss::RestServer::getConnectionHeader(const wss::HttpResponse &response) {
+    return response->close_connection_after_response ? "close" : "keep-alive";
+}
+
 void wss::RestServer::setResponseStatus(wss::HttpResponse &response,
                                         HttpStatus status,
                                         std::size_t contentLength) {
@@ -67,6 +82,7 @@ void wss::RestServer::setResponseStatus(wss::HttpResponse &response,
         {
             {"HTTP/1.1",       sCode},
             {"Server",         "WS Rest Server"},
+            {"Connection",     getConnectionHeader(response)},
             {"Content-Length", ss.str()}
         });
 }
@@ -108,6 +124,51 @@ void wss::RestServer::setError(wss::HttpResponse &response,
     setContent(response, out, "application/json");
 }
 
+namespace {
+
+void writeChunks(const wss::HttpResponse &response,
+                 const std::shared_ptr<std::function<bool(std::string &)>> &writer) {
+    std::string chunk;
+    bool more;
+    try {
+        more = (*writer)(chunk);
+    } catch (const std::exception &e) {
+        // status is sent already, unterminated body tells client that response is broken
+        L_ERR_F("Http::Server", "Chunked response failed: %s", e.what());
+        response->close_connection_after_response = true;
+        return;
+    }
+    response->write_chunk(chunk.data(), chunk.size());
+    if (!more) {
+        // rest is sent when response is released
+        response->write_last_chunk();
+        return;
+    }
+
+    response->send([response, writer](const wss::server::http::error_code &ec) {
+      if (!ec) {
+          writeChunks(response, writer);
+      }
+    });
+}
+
+}
+
+void wss::RestServer::setChunkedContent(wss::HttpResponse &response,
+                                        wss::HttpStatus status,
+                                        ChunkWriter &&writer,
+                                        const std::string &contentType) {
+    *response << buildResponse({
+                                   {"HTTP/1.1",          wss::server::status_code(status)},
+                                   {"Server",            "WS Rest Server"},
+                                   {"Connection",        getConnectionHeader(response)},
+                                   {"Content-Type",      contentType},
+                                   {"Transfer-Encoding", "chunked"},
+                               });
+    *response << "\r\n";
+    writeChunks(response, std::make_shared<ChunkWriter>(std::move(writer)));
+}
+
 std::string wss::RestServer::buildResponse(const std::vector<std::pair<std::string, std::string>> &parts) {
     std::stringstream ss;
     for (const auto &part: parts) {
@@ -120,6 +181,9 @@ std::string wss::RestServer::buildResponse(const std::vector<std::pair<std::stri
 
     return ss.str();
 }
+void wss::RestServer::post(std::function<void()> &&handler) {
+    m_server->io_service->post(std::move(handler));
+}
 void wss::RestServer::joinThreads() {
     if (m_workerThread != nullptr && m_workerThread->joinable()) {
         m_workerThread->join();
@@ -140,7 +204,11 @@ void wss::RestServer::runService() {
 
     const char *proto = m_useSSL ? "https" : "http";
     const char *hostname = m_server->config.address.empty() ? "0.0.0.0" : m_server->config.address.c_str();
-    L_INFO_F("HttpServer", "Started at %s://%s:%d", proto, hostname, m_server->config.port);
+    if (wss::unixsocket::isAddress(m_server->config.address)) {
+        L_INFO_F("HttpServer", "Started at %s+%s", proto, hostname);
+    } else {
+        L_INFO_F("HttpServer", "Started at %s://%s:%d", proto, hostname, m_server->config.port);
+    }
 
 }
 void wss::RestServer::stopService() {
@@ -148,6 +216,10 @@ void wss::RestServer::stopService() {
     cleanupEndpoints();
 }
 
+bool wss::RestServer::isOverloaded(const wss::HttpRequest &) const {
+    return false;
+}
+
 void wss::RestServer::setAuth(const nlohmann::json &config) {
     m_auth = wss::auth::registry::createFromConfig(config);
 }
@@ -156,6 +228,32 @@ std::unique_ptr<wss::Auth> &wss::RestServer::getAuth() {
     return m_auth;
 }
 
+void wss::RestServer::authorize(const HttpRequest &request, std::function<void(bool authorized)> &&handler) {
+    // whoever comes second (validateAuthAsync return or its callback) runs handler:
+    // in place if auth completed inside call, otherwise on io service
+    struct State {
+      std::atomic<int> stage{0};
+      bool authorized = false;
+      std::function<void(bool)> handler;
+    };
+    enum { Pending = 0, Returned = 1, Completed = 2 };
+    auto state = std::make_shared<State>();
+    state->handler = std::move(handler);
+    std::shared_ptr<boost::asio::io_service> service = m_server->io_service;
+
+    m_auth->validateAuthAsync(wss::web::Request(request), [state, service](bool authorized) {
+      state->authorized = authorized;
+      if (state->stage.exchange(Completed) == Returned) {
+          service->post([state] {
+            state->handler(state->authorized);
+          });
+      }
+    });
+    if (state->stage.exchange(Returned) == Completed) {
+        state->handler(state->authorized);
+    }
+}
+
 
 
 
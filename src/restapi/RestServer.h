@@ -57,54 +57,100 @@ class RestServer : public virtual StandaloneService {
     void setAddress(const std::string &address);
     void setAddress(std::string &&host);
     void setPort(uint16_t portNumber);
-
+    /// \brief Persistent connections settings
+    /// \param idleTimeoutSeconds how long connection waits for next request
+    /// \param maxRequests connection is closed after this number of requests, 0 - unlimited
+    void setKeepAlive(long idleTimeoutSeconds, std::size_t maxRequests);
+    /// \brief Tcp options of listener and accepted connections
+    /// \param options
+    void setSocketOptions(const wss::SocketOptions &options);
+
+    /// \brief Adds exact path endpoint, it's found by hash lookup regardless of endpoints count
+    /// \param path path without leading slash and query
+    /// \param methodName http method
+    /// \param callback
     template<typename ResponseCallback = std::function<void(HttpResponse, HttpRequest)> >
     RestServer &addEndpoint(const std::string &path, const std::string &methodName, ResponseCallback &&callback) {
-        const std::string endpoint = "^/" + path + "$";
         L_INFO_F("HttpServer", "Endpoint: %s /%s", methodName.c_str(), path.c_str());
+        m_server->exact_resource["/" + path][toolboxpp::strings::toUpper(methodName)] =
+            createHandler(std::forward<ResponseCallback>(callback));
+        return *this;
+    }
 
-        m_server->resource[endpoint][toolboxpp::strings::toUpper(methodName)] =
-            [this, callback](wss::HttpResponse response, wss::HttpRequest request) {
-              const wss::web::Request verifyRequest(request);
-              response->close_connection_after_response = true;
-              if (!m_auth->validateAuth(verifyRequest)) {
-
-                  if (m_auth->getType() == "basic") {
-
-                      json errorOut;
-                      errorOut["success"] = false;
-                      errorOut["status"] = 401;
-                      errorOut["message"] = "Unauthorized";
-                      const std::string out = errorOut.dump();
-
-                      *response << buildResponse({
-                                                     {"HTTP/1.1",         "401 Unauthorized"},
-                                                     {"Server",           "WS Rest Server"},
-                                                     {"Connection",       "keep-alive"},
-                                                     {"Content-Length",   wss::utils::toString(out.length())},
-                                                     {"WWW-Authenticate", "Basic realm=\"Come to the dark side, we have cookies!\""},
-                                                 });
-
-                      *response << "\r\n";
-                      *response << out;
-                  } else {
-                      setError(response, HttpStatus::client_error_unauthorized, 401, "Unauthorized");
-                  }
-
-                  return;
-              }
-              callback(response, request);
-            };
-
+    /// \brief Adds regex endpoint, checked only if there is no exact path endpoint for request.
+    /// Regex endpoints are matched one by one, so use them only if path has variable parts
+    /// \param pattern path regex without leading slash, matched with whole path
+    /// \param methodName http method
+    /// \param callback
+    template<typename ResponseCallback = std::function<void(HttpResponse, HttpRequest)> >
+    RestServer &addRegexEndpoint(const std::string &pattern,
+                                 const std::string &methodName,
+                                 ResponseCallback &&callback) {
+        L_INFO_F("HttpServer", "Endpoint: %s /%s (regex)", methodName.c_str(), pattern.c_str());
+        m_server->resource["^/" + pattern + "$"][toolboxpp::strings::toUpper(methodName)] =
+            createHandler(std::forward<ResponseCallback>(callback));
         return *this;
     }
 
  protected:
     virtual void createEndpoints();
 
+    /// \brief Wraps endpoint callback with authorization
+    template<typename ResponseCallback>
+    std::function<void(HttpResponse, HttpRequest)> createHandler(ResponseCallback &&callback) {
+        return [this, callback](wss::HttpResponse response, wss::HttpRequest request) {
+          // shed before auth: remote auth request is the most expensive part
+          if (isOverloaded(request)) {
+              setError(response, HttpStatus::client_error_too_many_requests, 429,
+                       "Server is overloaded, try again later");
+              return;
+          }
+          authorize(request, [this, callback, response, request](bool authorized) mutable {
+            if (!authorized) {
+                if (m_auth->getType() == "basic") {
+
+                    json errorOut;
+                    errorOut["success"] = false;
+                    errorOut["status"] = 401;
+                    errorOut["message"] = "Unauthorized";
+                    const std::string out = errorOut.dump();
+
+                    *response << buildResponse({
+                                                   {"HTTP/1.1",         "401 Unauthorized"},
+                                                   {"Server",           "WS Rest Server"},
+                                                   {"Connection",       getConnectionHeader(response)},
+                                                   {"Content-Length",   wss::utils::toString(out.length())},
+                                                   {"WWW-Authenticate", "Basic realm=\"Come to the dark side, we have cookies!\""},
+                                               });
+
+                    *response << "\r\n";
+                    *response << out;
+                } else {
+                    setError(response, HttpStatus::client_error_unauthorized, 401, "Unauthorized");
+                }
+
+                return;
+            }
+            callback(response, request);
+          });
+        };
+    }
+
     std::unique_ptr<wss::Auth> &getAuth();
 
+    /// \brief Admission control of requests
+    /// \param request
+    /// \return true - request is answered with 429
+    virtual bool isOverloaded(const HttpRequest &request) const;
+
+    /// \brief Validates request without blocking io thread (remote auth completes later)
+    /// \param request
+    /// \param handler called on server io thread: in place if auth decided right away
+    void authorize(const HttpRequest &request, std::function<void(bool authorized)> &&handler);
+
     void setResponseStatus(HttpResponse &response, HttpStatus status, std::size_t contentLength = 0u);
+    /// \brief "keep-alive" or "close" if connection is closed after this response
+    static const char *getConnectionHeader(const HttpResponse &response);
     void setContent(HttpResponse &response,
                     const std::string &content,
                     const std::string &contentType = "text/html");
@@ -116,6 +162,23 @@ class RestServer : public virtual StandaloneService {
     void setError(HttpResponse &response, HttpStatus status, int code, const std::string &message);
     void setError(HttpResponse &response, HttpStatus status, int code, std::string &&message);
     std::string buildResponse(const std::vector<std::pair<std::string, std::string>> &parts);
+
+    /// \brief Appends next part of body to out
+    /// \return false if it's the last part
+    using ChunkWriter = std::function<bool(std::string &out)>;
+    /// \brief Sends chunked response: next part is serialized only after previous one is written to socket,
+    /// so response of any size takes memory of one part. Writer is called on server io thread
+    /// \param response
+    /// \param status
+    /// \param writer
+    /// \param contentType
+    void setChunkedContent(HttpResponse &response,
+                           HttpStatus status,
+                           ChunkWriter &&writer,
+                           const std::string &contentType = "application/json");
+    /// \brief Runs handler on server io service, for responses completed by other threads
+    /// \param handler
+    void post(std::function<void()> &&handler);
  private:
     std::unique_ptr<Auth> m_auth;
     std::unique_ptr<HttpBase> m_server;
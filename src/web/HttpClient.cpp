@@ -6,10 +6,15 @@
  * @link https://github.com/edwardstock
  */
 
-#include <thread>
+#include <atomic>
 #include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "HttpClient.h"
 #include "../helpers/helpers.h"
+#include "../helpers/logging.h"
+#include "../base/Affinity.h"
 
 // BASE IO
 wss::web::IOContainer::IOContainer() :
@@ -66,9 +71,28 @@ std::string wss::web::IOContainer::getHeader(const std::string &headerName) cons
 
     return std::string();
 }
+const std::string *wss::web::IOContainer::findHeader(const std::string &headerName) const noexcept {
+    const auto lower = [](char c) {
+      return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c;
+    };
+    for (auto &h: headers) {
+        if (h.first.size() != headerName.size()) {
+            continue;
+        }
+        bool equals = true;
+        for (std::size_t i = 0; i < headerName.size() && equals; i++) {
+            equals = lower(h.first[i]) == lower(headerName[i]);
+        }
+        if (equals) {
+            return &h.second;
+        }
+    }
+
+    return nullptr;
+}
 bool wss::web::IOContainer::compareHeaderValue(const std::string &headerName, const std::string &comparable) const {
-    if (!hasHeader(headerName)) return false;
-    return getHeader(headerName) == comparable;
+    const std::string *value = findHeader(headerName);
+    return value != nullptr && *value == comparable;
 }
 void wss::web::IOContainer::addHeader(const std::string &key, const std::string &value) {
     headers.emplace_back(key, value);
@@ -104,6 +128,9 @@ const char *wss::web::IOContainer::getBodyC() const {
     const char *out = body.c_str();
     return out;
 }
+std::size_t wss::web::IOContainer::getBodySize() const {
+    return body.size();
+}
 
 bool wss::web::IOContainer::hasBody() const {
     return !body.empty();
@@ -337,132 +364,376 @@ bool wss::web::Response::isSuccess() const {
 
 // CLIENT
 
-wss::web::HttpClient::HttpClient() {
-    curl_global_init(CURL_GLOBAL_ALL);
+namespace {
+
+/// \brief Idle handles kept by pool, over this count released handles are destroyed
+const std::size_t MAX_IDLE_HANDLES = 64;
+
+/// \brief Process-wide easy handles pool. Handles share DNS, TLS sessions and (curl >= 7.57) connections cache,
+/// reset handle keeps its connections, so next request to the same host skips TCP and TLS setup
+class CurlPool {
+ public:
+    static CurlPool &get() {
+        static CurlPool pool;
+        return pool;
+    }
+
+    CURL *acquire() {
+        CURL *curl = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (!m_idle.empty()) {
+                curl = m_idle.back();
+                m_idle.pop_back();
+            }
+        }
+        if (curl == nullptr) {
+            curl = curl_easy_init();
+        }
+        if (curl != nullptr && m_share != nullptr) {
+            curl_easy_setopt(curl, CURLOPT_SHARE, m_share);
+        }
+        return curl;
+    }
+
+    void release(CURL *curl) {
+        curl_easy_reset(curl);
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (m_idle.size() < MAX_IDLE_HANDLES) {
+                m_idle.push_back(curl);
+                return;
+            }
+        }
+        curl_easy_cleanup(curl);
+    }
+
+ private:
+    std::mutex m_lock;
+    std::vector<CURL *> m_idle;
+    CURLSH *m_share = nullptr;
+    std::mutex m_shareLocks[CURL_LOCK_DATA_LAST];
+
+    CurlPool() {
+        curl_global_init(CURL_GLOBAL_ALL);
+        m_share = curl_share_init();
+        if (m_share == nullptr) {
+            return;
+        }
+        curl_share_setopt(m_share, CURLSHOPT_LOCKFUNC, &CurlPool::lockShare);
+        curl_share_setopt(m_share, CURLSHOPT_UNLOCKFUNC, &CurlPool::unlockShare);
+        curl_share_setopt(m_share, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        #if LIBCURL_VERSION_NUM >= 0x073900
+        curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+        #endif
+    }
+    ~CurlPool() {
+        for (CURL *curl: m_idle) {
+            curl_easy_cleanup(curl);
+        }
+        if (m_share != nullptr) {
+            curl_share_cleanup(m_share);
+        }
+        curl_global_cleanup();
+    }
+
+    static void lockShare(CURL *, curl_lock_data data, curl_lock_access, void *self) {
+        static_cast<CurlPool *>(self)->m_shareLocks[data].lock();
+    }
+    static void unlockShare(CURL *, curl_lock_data data, void *self) {
+        static_cast<CurlPool *>(self)->m_shareLocks[data].unlock();
+    }
+};
+
+struct AsyncTransfer {
+  CURL *curl = nullptr;
+  curl_slist *headers = nullptr;
+  wss::web::Request request;
+  wss::web::Response response;
+  wss::web::HttpClient::ResponseCallback callback;
+};
+
+/// \brief Drives async transfers of all clients with one curl multi handle in one thread
+class CurlMulti {
+ public:
+    static CurlMulti &get() {
+        static CurlMulti multi;
+        return multi;
+    }
+
+    void add(AsyncTransfer *transfer) {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_pending.push_back(transfer);
+        }
+        #if LIBCURL_VERSION_NUM >= 0x074400
+        curl_multi_wakeup(m_multi);
+        #endif
+    }
+
+ private:
+    CURLM *m_multi;
+    std::mutex m_lock;
+    std::vector<AsyncTransfer *> m_pending;
+    std::atomic_bool m_stop{false};
+    std::thread m_thread;
+
+    CurlMulti() {
+        // pool is created first and destroyed after driver
+        CurlPool::get();
+        m_multi = curl_multi_init();
+        #if LIBCURL_VERSION_NUM >= 0x072B00
+        // default since curl 7.62: streams of HTTP/2 connection are used by concurrent transfers
+        curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        #endif
+        m_thread = std::thread(&CurlMulti::run, this);
+    }
+    ~CurlMulti() {
+        m_stop = true;
+        #if LIBCURL_VERSION_NUM >= 0x074400
+        curl_multi_wakeup(m_multi);
+        #endif
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+        curl_multi_cleanup(m_multi);
+    }
+
+    void complete(CURL *curl, CURLcode result) {
+        AsyncTransfer *transfer = nullptr;
+        curl_easy_getinfo(curl, CURLINFO_PRIVATE, &transfer);
+        curl_multi_remove_handle(m_multi, curl);
+        curl_slist_free_all(transfer->headers);
+        CurlPool::get().release(curl);
+
+        wss::web::HttpClient::finish(result, transfer->response);
+        if (transfer->callback) {
+            transfer->callback(std::move(transfer->response));
+        }
+        delete transfer;
+    }
+
+    void run() {
+        wss::affinity::pin(wss::affinity::Group::Auth);
+        while (!m_stop) {
+            std::vector<AsyncTransfer *> pending;
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                pending.swap(m_pending);
+            }
+            for (AsyncTransfer *transfer: pending) {
+                curl_easy_setopt(transfer->curl, CURLOPT_PRIVATE, transfer);
+                curl_multi_add_handle(m_multi, transfer->curl);
+            }
+
+            int running = 0;
+            curl_multi_perform(m_multi, &running);
+            int left = 0;
+            while (CURLMsg *msg = curl_multi_info_read(m_multi, &left)) {
+                if (msg->msg == CURLMSG_DONE) {
+                    complete(msg->easy_handle, msg->data.result);
+                }
+            }
+
+            #if LIBCURL_VERSION_NUM >= 0x074400
+            curl_multi_poll(m_multi, nullptr, 0, 1000, nullptr);
+            #else
+            // no wakeup: new transfers wait at most this timeout
+            curl_multi_wait(m_multi, nullptr, 0, 50, nullptr);
+            #endif
+        }
+    }
+};
+
 }
-wss::web::HttpClient::~HttpClient() {
-    curl_global_cleanup();
+
+wss::web::HttpClient::HttpClient() {
+    CurlPool::get();
 }
+wss::web::HttpClient::~HttpClient() = default;
 void wss::web::HttpClient::enableVerbose(bool enable) {
     m_verbose = enable;
 }
 
-template<typename Callback>
-void wss::web::HttpClient::executeAsync(const wss::web::Request &request, const Callback &cb) {
-    std::async(std::launch::async, [this, request, cb] {
-      auto response = execute(request);
-      if (cb) {
-          cb(response);
-      }
-    });
-}
-wss::web::Response wss::web::HttpClient::execute(const wss::web::Request &request) {
-    CURL *curl;
-    CURLcode res = CURLE_OK;
+bool wss::web::HttpClient::prepare(CURL *curl,
+                                   const wss::web::Request &request,
+                                   wss::web::Response &resp,
+                                   curl_slist *&headers) const {
+    curl_easy_setopt(curl, CURLOPT_URL, request.getUrlWithParams().c_str());
 
-    curl = curl_easy_init();
-    Response resp;
-    if (curl) {
-        curl_easy_setopt(curl, CURLOPT_URL, request.getUrlWithParams().c_str());
-
-        bool isPost = false;
-        switch (request.getMethod()) {
-            case Request::Method::POST:curl_easy_setopt(curl, CURLOPT_POST, 1L);
-                isPost = true;
-                break;
-            case Request::Method::PUT:curl_easy_setopt(curl, CURLOPT_PUT, 1L);
-                isPost = true;
-                break;
-            case Request::Method::DELETE:curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
-                isPost = false;
-                break;
-            case Request::Method::HEAD:curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "HEAD");
-                isPost = false;
-                break;
-            default:break;
+    bool isPost = false;
+    switch (request.getMethod()) {
+        case Request::Method::POST:curl_easy_setopt(curl, CURLOPT_POST, 1L);
+            isPost = true;
+            break;
+        case Request::Method::PUT:curl_easy_setopt(curl, CURLOPT_PUT, 1L);
+            isPost = true;
+            break;
+        case Request::Method::DELETE:curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+            isPost = false;
+            break;
+        case Request::Method::HEAD:curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "HEAD");
+            isPost = false;
+            break;
+        default:break;
+    }
+
+    if (isPost && request.hasBody()) {
+        const char *body = request.getBodyC();
+        if (body == nullptr) {
+            resp.status = -1;
+            resp.statusMessage = "Request body is NULL";
+            return false;
         }
 
-        if (isPost && request.hasBody()) {
-            const char *body = request.getBodyC();
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+        // binary formats may contain zero bytes
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t) request.getBodySize());
+    }
 
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, m_connectionTimeout);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    #if LIBCURL_VERSION_NUM >= 0x072F00
+    if (m_http2) {
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+        // wait for connection, that is being established, to multiplex on it instead of opening new one
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+    }
+    #endif
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &HttpClient::handleResponseData);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &HttpClient::handleResponseHeaders);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &resp);
 
-            if (body == nullptr) {
-                resp.status = -1;
-                resp.statusMessage = "Request body is NULL";
-                return resp;
-            }
+    for (const auto &h: request.getHeadersGlued()) {
+        if (m_verbose) {
+            WSS_DEBUG_F("Http::Request", "Header -> %s", h.c_str());
         }
 
-        curl_easy_setopt(curl, CURLOPT_TIMEOUT, m_connectionTimeout);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &HttpClient::handleResponseData);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp);
-        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, &HttpClient::handleResponseHeaders);
-        curl_easy_setopt(curl, CURLOPT_HEADERDATA, &resp);
-
-        if (request.hasHeaders()) {
-            struct curl_slist *headers = nullptr;
-            for (const auto &h: request.getHeadersGlued()) {
-                if (m_verbose) {
-                    L_DEBUG_F("Http::Request", "Header -> %s", h.c_str());
-                }
+        headers = curl_slist_append(headers, h.c_str());
+    }
+    if (isPost && !request.hasHeader("Expect")) {
+        // don't wait for 100-continue round-trip on big bodies
+        headers = curl_slist_append(headers, "Expect:");
+    }
+    if (headers != nullptr) {
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    }
 
-                headers = curl_slist_append(headers, h.c_str());
-            }
+    if (m_verbose) {
+        curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+    }
+    return true;
+}
 
-            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+void wss::web::HttpClient::finish(CURLcode res, wss::web::Response &resp) {
+    if (res != CURLE_OK) {
+        resp.status = -1;
+        resp.statusMessage = "CURL error: " + std::string(curl_easy_strerror(res));
+        return;
+    }
+
+    std::vector<std::string> headerLines = toolboxpp::strings::split(resp._headersBuffer, "\r\n");
+    for (auto &header: headerLines) {
+        if (header.length() == 0) {
+            continue;
+        }
+        if (toolboxpp::strings::hasRegex("HTTP", header)) {
+            std::vector<std::string>
+                match = toolboxpp::strings::matchRegexp(R"(HTTP\/\d\.\d.(\d+).(.*))", header);
+            resp.status = std::stoi(match[1]);
+            resp.statusMessage = match[2];
+            continue;
         }
 
-        if (m_verbose) {
-            curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+        if (header.empty()) {
+            continue;
+        }
+        std::pair<std::string, std::string> split = toolboxpp::strings::splitPair(header, ':');
+        std::string leftCopy = boost::algorithm::trim_left_copy(split.first);
+        std::string rightCopy = boost::algorithm::trim_left_copy(split.second);
+        split.first = leftCopy;
+        split.second = rightCopy;
+
+        if (leftCopy.empty() || rightCopy.empty()) {
+            continue;
         }
 
-        res = curl_easy_perform(curl);
+        resp.addHeader(std::move(split));
+    }
 
-        if (res != CURLE_OK) {
-            resp.status = -1;
-            resp.statusMessage = "CURL error: " + std::string(curl_easy_strerror(res));
-        } else {
-            std::vector<std::string> headerLines = toolboxpp::strings::split(resp._headersBuffer, "\r\n");
-            for (auto &header: headerLines) {
-                if (header.length() == 0) {
-                    continue;
-                }
-                if (toolboxpp::strings::hasRegex("HTTP", header)) {
-                    std::vector<std::string>
-                        match = toolboxpp::strings::matchRegexp(R"(HTTP\/\d\.\d.(\d+).(.*))", header);
-                    resp.status = std::stoi(match[1]);
-                    resp.statusMessage = match[2];
-                    continue;
-                }
+    resp._headersBuffer.clear();
+}
 
-                if (header.empty()) {
-                    continue;
-                }
-                std::pair<std::string, std::string> split = toolboxpp::strings::splitPair(header, ':');
-                std::string leftCopy = boost::algorithm::trim_left_copy(split.first);
-                std::string rightCopy = boost::algorithm::trim_left_copy(split.second);
-                split.first = leftCopy;
-                split.second = rightCopy;
-
-                if (leftCopy.empty() || rightCopy.empty()) {
-                    continue;
-                }
+void wss::web::HttpClient::executeAsync(const wss::web::Request &request, ResponseCallback cb) {
+    auto *transfer = new AsyncTransfer();
+    transfer->request = request;
+    transfer->callback = std::move(cb);
+    transfer->curl = CurlPool::get().acquire();
+    if (transfer->curl == nullptr) {
+        transfer->response.status = -1;
+        transfer->response.statusMessage = "CURL error: unable to create handle";
+    } else if (prepare(transfer->curl, transfer->request, transfer->response, transfer->headers)) {
+        CurlMulti::get().add(transfer);
+        return;
+    } else {
+        curl_slist_free_all(transfer->headers);
+        CurlPool::get().release(transfer->curl);
+    }
 
-                resp.addHeader(std::move(split));
-            }
+    if (transfer->callback) {
+        transfer->callback(std::move(transfer->response));
+    }
+    delete transfer;
+}
 
-            resp._headersBuffer.clear();
-        }
+#ifdef WSS_ENABLE_COROUTINES
+wss::web::Response wss::web::HttpClient::execute(const wss::web::Request &request, wss::async::Context &context) {
+    return wss::async::await<Response>(context, [this, &request](std::function<void(Response)> done) {
+      executeAsync(request, [done](Response &&response) {
+        done(std::move(response));
+      });
+    });
+}
+#endif
 
-        curl_easy_cleanup(curl);
-    } else {
+wss::web::Response wss::web::HttpClient::execute(const wss::web::Request &request) {
+    if (m_http2) {
+        std::promise<Response> result;
+        std::future<Response> future = result.get_future();
+        executeAsync(request, [&result](Response &&response) {
+          result.set_value(std::move(response));
+        });
+        return future.get();
+    }
+
+    Response resp;
+    CURL *curl = CurlPool::get().acquire();
+    if (curl == nullptr) {
         resp.status = -1;
-        resp.statusMessage = "CURL error: " + std::string(curl_easy_strerror(res));
+        resp.statusMessage = "CURL error: unable to create handle";
+        return resp;
     }
 
+    curl_slist *headers = nullptr;
+    if (prepare(curl, request, resp, headers)) {
+        finish(curl_easy_perform(curl), resp);
+    }
+    curl_slist_free_all(headers);
+    CurlPool::get().release(curl);
+
     return resp;
 }
 void wss::web::HttpClient::setConnectionTimeout(long timeoutSeconds) {
     m_connectionTimeout = timeoutSeconds;
 }
+void wss::web::HttpClient::setHttp2(bool enable) {
+    static std::atomic_bool warned{false};
+    if (enable && (curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP2) == 0 && !warned.exchange(true)) {
+        WSS_LOG_F(wss::logging::LevelWarning, "HttpClient", "libcurl is built without HTTP/2, using HTTP/1.1");
+    }
+    m_http2 = enable;
+}
@@ -9,6 +9,7 @@
 #ifndef WSSERVER_STANDALONE_HTTPCLIENT_H
 #define WSSERVER_STANDALONE_HTTPCLIENT_H
 
+#include <functional>
 #include <string>
 #include <iostream>
 #include <istream>
@@ -19,6 +20,7 @@
 #include "../base/StatusCode.hpp"
 #include "../base/http/HttpServer.h"
 #include "../wsserver_core.h"
+#include "../base/Async.hpp"
 
 namespace wss {
 namespace web {
@@ -86,6 +88,11 @@ class IOContainer {
     /// \return empty string if not found, otherwise copy of origin value
     std::string getHeader(const std::string &headerName) const;
 
+    /// \brief Search for header without copying it value
+    /// \param headerName string. Searching is case insensitive (ascii)
+    /// \return pointer to value of first found header, nullptr if not found. Valid until headers change
+    const std::string *findHeader(const std::string &headerName) const noexcept;
+
     /// \brief Search for header and compare it value with comparable string
     /// \param headerName string. Searching is case insensitive
     /// \param comparable string to compare with
@@ -120,6 +127,10 @@ class IOContainer {
     /// \return Copy of body
     const char *getBodyC() const;
 
+    /// \brief Body length in bytes
+    /// \return
+    std::size_t getBodySize() const;
+
     /// \brief Check for body is not empty
     /// \return true if !body.empty()
     bool hasBody() const;
@@ -252,11 +263,25 @@ class Response : public IOContainer {
     bool isSuccess() const;
 };
 
-/// \brief Simple Http Client based on libcurl
+/// \brief Simple Http Client based on libcurl.
+/// Clients share process-wide pool of curl handles and curl share of DNS, TLS sessions and connections,
+/// so requests to the same host reuse kept-alive connection, even if client is created per request
 class HttpClient {
+ public:
+    typedef std::function<void(wss::web::Response &&response)> ResponseCallback;
+
  private:
     bool m_verbose = false;
     long m_connectionTimeout = 10L;
+    bool m_http2 = false;
+
+    /// \brief Sets request options to pooled handle
+    /// \param curl
+    /// \param request must live until transfer is done, body is not copied
+    /// \param response
+    /// \param headers list to free after transfer
+    /// \return false if request is invalid, response contains error
+    bool prepare(CURL *curl, const Request &request, Response &response, curl_slist *&headers) const;
 
     static size_t handleResponseData(void *buffer, size_t size, size_t nitems, void *userData) {
         ((Response *) userData)->data.append((char *) buffer, size * nitems);
@@ -272,6 +297,11 @@ class HttpClient {
     HttpClient();
     ~HttpClient();
 
+    /// \brief Reads status and headers from received headers buffer, or sets curl error
+    /// \param result transfer result
+    /// \param response
+    static void finish(CURLcode result, Response &response);
+
     /// \brief Set verbosity mode for curl
     /// \param enable
     void enableVerbose(bool enable);
@@ -280,15 +310,32 @@ class HttpClient {
     /// \param timeoutSeconds Long seconds
     void setConnectionTimeout(long timeoutSeconds);
 
+    /// \brief Negotiate HTTP/2 by ALPN on https urls (plain http stays HTTP/1.1). Concurrent requests
+    /// to the same host are multiplexed as streams of one connection: new request waits for existing
+    /// connection instead of opening another one. Blocking execute() is performed by transfers thread then,
+    /// because only transfers of one curl multi handle share connection (so it must not be called from
+    /// executeAsync() callback)
+    /// \param enable
+    void setHttp2(bool enable);
+
     /// \brief Make request using request
     /// \param request wss::web::Request
     /// \return wss::web::Response
     Response execute(const Request &request);
 
-    /// \brief Async request call
+    /// \brief Async request call: request is performed by single thread, that drives all async transfers
+    /// by curl multi interface, so there is no thread per request
     /// \param request
-    template<typename Callback = std::function<wss::web::Response>()>
-    void executeAsync(const Request &request, const Callback &cb = nullptr);
+    /// \param cb called from transfers thread, must not block
+    void executeAsync(const Request &request, ResponseCallback cb = nullptr);
+
+#ifdef WSS_ENABLE_COROUTINES
+    /// \brief Async request for coroutine: suspends it until response, without thread per request
+    /// \param request
+    /// \param context running coroutine
+    /// \return
+    Response execute(const Request &request, wss::async::Context &context);
+#endif
 };
 
 }
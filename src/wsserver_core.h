@@ -20,12 +20,14 @@ namespace wss {
 
 using user_id_t = unsigned long;
 using conn_id_t = unsigned long;
+using room_id_t = unsigned long;
 
 using WsBase = wss::server::websocket::SocketServerBase;
 using WsServer = wss::server::websocket::SocketServer;
 using WssServer = wss::server::websocket::SocketServerSecure;
 
 using WsMessageStream = WsBase::SendStream;
+using WsFramePtr = std::shared_ptr<const WsBase::Frame>;
 using WsConnectionPtr = std::shared_ptr<WsBase::Connection>;
 using WsMessagePtr = std::shared_ptr<WsBase::Message>;
 using json = nlohmann::json;
@@ -37,6 +39,9 @@ using UserMap = std::unordered_map<user_id_t, T>;
 template<typename T>
 using ConnectionMap = std::unordered_map<conn_id_t, T>;
 
+template<typename T>
+using RoomMap = std::unordered_map<room_id_t, T>;
+
 }
 
 #endif //WSSERVER_DEFS_H
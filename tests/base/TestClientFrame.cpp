@@ -0,0 +1,174 @@
+/*!
+ * wsserver
+ * TestClientFrame.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <string>
+#include <thread>
+#include <vector>
+#include <src/client/Connection.hpp>
+
+#include "gtest/gtest.h"
+
+namespace asio = boost::asio;
+using asio::ip::tcp;
+using wss::client::FrameView;
+using wss::client::FrameWriter;
+using wss::client::ParseResult;
+
+TEST(ClientFrameTest, WrittenFramesAreParsedBackBySizeClass) {
+    FrameWriter writer(42);
+    for (std::size_t length: {0, 1, 125, 126, 65535, 65536, 200000}) {
+        std::string payload(length, 'a');
+        for (std::size_t i = 0; i < length; i++) {
+            payload[i] = static_cast<char>('a' + i % 26);
+        }
+        std::string batch("x");
+        writer.append(batch, 0x80u | wss::client::Binary, payload.data(), payload.size());
+        ASSERT_EQ(1 + wss::client::frameHeaderSize(length, true) + length, batch.size());
+
+        auto *data = reinterpret_cast<uint8_t *>(&batch[1]);
+        FrameView frame;
+        // every prefix is incomplete
+        for (std::size_t prefix: {std::size_t(0), std::size_t(1), batch.size() - 2}) {
+            ASSERT_EQ(ParseResult::Incomplete, wss::client::parseFrame(data, prefix, SIZE_MAX, frame));
+        }
+        ASSERT_EQ(ParseResult::Complete, wss::client::parseFrame(data, batch.size() - 1, SIZE_MAX, frame));
+        ASSERT_TRUE(frame.isFinal());
+        ASSERT_EQ(wss::client::Binary, frame.opcode());
+        ASSERT_EQ(batch.size() - 1, frame.size);
+        ASSERT_EQ(payload, std::string(frame.payload, frame.length));
+    }
+}
+
+TEST(ClientFrameTest, LimitsAndBrokenControlFramesAreReported) {
+    FrameWriter writer;
+    const std::string payload(200, 'p');
+    std::string batch;
+    writer.append(batch, 0x80u | wss::client::Text, payload.data(), payload.size());
+    FrameView frame;
+    ASSERT_EQ(ParseResult::TooLarge,
+              wss::client::parseFrame(reinterpret_cast<uint8_t *>(&batch[0]), batch.size(), 199, frame));
+
+    // unmasked server frames: fragmented ping and ping longer than 125 bytes
+    uint8_t fragmentedPing[] = {0x09, 0x00};
+    ASSERT_EQ(ParseResult::Invalid, wss::client::parseFrame(fragmentedPing, sizeof(fragmentedPing), 1024, frame));
+    uint8_t longPing[130] = {0x89, 126, 0, 126};
+    ASSERT_EQ(ParseResult::Invalid, wss::client::parseFrame(longPing, sizeof(longPing), 1024, frame));
+}
+
+namespace {
+
+/// \brief Collects events of connection
+class Recorder : public wss::client::Connection<Recorder> {
+ public:
+    explicit Recorder(asio::io_service &service) :
+        Connection<Recorder>(service, nullptr, 64) { }
+
+    void onOpen() {
+        opened = true;
+        send(wss::client::Text, std::string("hello"));
+    }
+    void onMessage(uint8_t opcode, const char *data, std::size_t length) {
+        messages.emplace_back(opcode, std::string(data, length));
+    }
+    void onClose(const wss::client::ErrorCode &ec, bool wasOpen) {
+        closed = true;
+        closedClean = !ec && wasOpen;
+    }
+
+    bool opened = false;
+    bool closed = false;
+    bool closedClean = false;
+    std::vector<std::pair<uint8_t, std::string>> messages;
+};
+
+/// \brief Reads frames of client until opcode, server side of test
+std::vector<FrameView> readClientFrames(tcp::socket &socket, std::string &buffer, uint8_t until) {
+    std::vector<FrameView> frames;
+    std::size_t offset = 0;
+    while (true) {
+        FrameView frame;
+        auto *data = reinterpret_cast<uint8_t *>(&buffer[0]);
+        if (wss::client::parseFrame(data + offset, buffer.size() - offset, SIZE_MAX, frame)
+            == ParseResult::Complete) {
+            frames.push_back(frame);
+            offset += frame.size;
+            if (frame.opcode() == until) {
+                return frames;
+            }
+            continue;
+        }
+        // frames point into buffer: it's reserved to not move
+        char chunk[4096];
+        const std::size_t read = socket.read_some(asio::buffer(chunk));
+        buffer.append(chunk, read);
+    }
+}
+
+}
+
+TEST(ClientConnectionTest, UpgradesReassemblesFragmentsAnswersPingAndClose) {
+    asio::io_service service;
+    tcp::acceptor acceptor(service, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    const tcp::endpoint endpoint = acceptor.local_endpoint();
+
+    std::string received;
+    received.reserve(1 << 20);
+    std::vector<FrameView> clientFrames;
+    std::thread server([&acceptor, &received, &clientFrames] {
+      asio::io_service serverService;
+      tcp::socket socket(serverService);
+      acceptor.accept(socket);
+      asio::streambuf request;
+      asio::read_until(socket, request, "\r\n\r\n");
+      const std::string headers(asio::buffer_cast<const char *>(request.data()), request.size());
+      const std::string keyHeader = "Sec-WebSocket-Key: ";
+      const std::size_t keyStart = headers.find(keyHeader) + keyHeader.size();
+      const std::string key = headers.substr(keyStart, headers.find("\r\n", keyStart) - keyStart);
+
+      // answer, fragmented message of 3 frames with ping between them, and close: all in one write,
+      // so client parses them from buffer of 64 bytes by growing and compacting it
+      std::string out = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                        "sec-websocket-accept: " + wss::client::detail::acceptOf(key) + "\r\n\r\n";
+      const std::string first(100, 'f');
+      out += std::string("\x01\x64", 2) + first;
+      out += std::string("\x89\x02pi", 4);
+      out += std::string("\x00\x03mid", 5);
+      out += std::string("\x80\x04last", 6);
+      out += std::string("\x81\x05small", 7);
+      out += std::string("\x88\x02\x03\xe8", 4);
+      asio::write(socket, asio::buffer(out));
+
+      received.assign(asio::buffer_cast<const char *>(request.data()) + headers.find("\r\n\r\n") + 4,
+                      asio::buffer_cast<const char *>(request.data()) + request.size());
+      clientFrames = readClientFrames(socket, received, wss::client::Close);
+    });
+
+    auto client = std::make_shared<Recorder>(service);
+    wss::client::Handshake handshake;
+    handshake.host = "localhost";
+    handshake.target = "/chat?id=1";
+    client->connect(endpoint, std::move(handshake));
+    service.run();
+    server.join();
+
+    ASSERT_TRUE(client->opened);
+    ASSERT_TRUE(client->closed);
+    ASSERT_TRUE(client->closedClean);
+    ASSERT_EQ(2u, client->messages.size());
+    ASSERT_EQ(wss::client::Text, client->messages[0].first);
+    ASSERT_EQ(std::string(100, 'f') + "midlast", client->messages[0].second);
+    ASSERT_EQ("small", client->messages[1].second);
+
+    ASSERT_EQ(3u, clientFrames.size());
+    ASSERT_EQ(wss::client::Text, clientFrames[0].opcode());
+    ASSERT_EQ("hello", std::string(clientFrames[0].payload, clientFrames[0].length));
+    ASSERT_EQ(wss::client::Pong, clientFrames[1].opcode());
+    ASSERT_EQ("pi", std::string(clientFrames[1].payload, clientFrames[1].length));
+    ASSERT_EQ(std::string("\x03\xe8", 2), std::string(clientFrames[2].payload, clientFrames[2].length));
+}
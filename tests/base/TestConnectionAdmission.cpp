@@ -0,0 +1,74 @@
+/*!
+ * wsserver
+ * TestConnectionAdmission.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <src/base/ws/ConnectionAdmission.hpp>
+
+#include "gtest/gtest.h"
+
+using wss::server::websocket::ConnectionAdmission;
+
+TEST(ConnectionAdmissionTest, ConcurrentTicketsNeverExceedLimit) {
+    auto admission = std::make_shared<ConnectionAdmission>();
+    ConnectionAdmission::Options options;
+    options.maxConnectionsPerIp = 4;
+    admission->configure(options);
+
+    const std::size_t threadsCount = 8;
+    const auto address = boost::asio::ip::address::from_string("10.0.0.1");
+    std::atomic<std::size_t> open{0};
+    std::atomic<std::size_t> maxOpen{0};
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < threadsCount; t++) {
+        threads.emplace_back([&] {
+          for (std::size_t i = 0; i < 20000; i++) {
+              ConnectionAdmission::Ticket ticket;
+              if (admission->admit(address, ticket) != ConnectionAdmission::Result::Accepted) {
+                  continue;
+              }
+              const std::size_t current = ++open;
+              std::size_t seen = maxOpen;
+              while (current > seen && !maxOpen.compare_exchange_weak(seen, current)) { }
+              --open;
+          }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+
+    ASSERT_LE(maxOpen.load(), options.maxConnectionsPerIp);
+    // released tickets of source without rate limit leave nothing behind
+    ASSERT_EQ(0u, admission->size());
+}
+
+TEST(ConnectionAdmissionTest, Ipv6SourcesAreCountedByPrefix) {
+    auto admission = std::make_shared<ConnectionAdmission>();
+    ConnectionAdmission::Options options;
+    options.maxConnectionsPerIp = 1;
+    admission->configure(options);
+
+    ConnectionAdmission::Ticket first, second, other, local;
+    ASSERT_EQ(ConnectionAdmission::Result::Accepted,
+              admission->admit(boost::asio::ip::address::from_string("2001:db8:1:2::1"), first));
+    ASSERT_EQ(ConnectionAdmission::Result::TooManyConnections,
+              admission->admit(boost::asio::ip::address::from_string("2001:db8:1:2::ffff"), second));
+    ASSERT_EQ(ConnectionAdmission::Result::Accepted,
+              admission->admit(boost::asio::ip::address::from_string("2001:db8:1:3::1"), other));
+    // unix socket connections have no address
+    ASSERT_EQ(ConnectionAdmission::Result::Accepted, admission->admit(boost::asio::ip::address(), local));
+
+    first.release();
+    ASSERT_EQ(ConnectionAdmission::Result::Accepted,
+              admission->admit(boost::asio::ip::address::from_string("2001:db8:1:2::ffff"), second));
+}
@@ -0,0 +1,70 @@
+/*!
+ * wsserver
+ * TestConnectionTable.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <src/base/ws/ConnectionTable.hpp>
+
+#include "gtest/gtest.h"
+
+using wss::server::websocket::ConnectionTable;
+
+TEST(ConnectionTableTest, SweepSeesPublishedSlotsWhileTheyChurn) {
+    ConnectionTable &table = ConnectionTable::global();
+    // table is shared by process: other tests may hold connections
+    const std::size_t before = table.summarize(0, 0).connections;
+
+    std::vector<std::unique_ptr<ConnectionTable::Slot>> kept;
+    for (uint64_t i = 1; i <= 5000; i++) {
+        std::unique_ptr<ConnectionTable::Slot> slot(new ConnectionTable::Slot());
+        slot->userId() = i % 2 == 0 ? i : 0;
+        slot->unansweredPings() = i % 5 == 0 ? 1 : 0;
+        slot->queuedFrames() = i;
+        slot->lastActivity() = 1000;
+        slot->publish(i);
+        kept.push_back(std::move(slot));
+    }
+
+    const std::size_t threadsCount = 4;
+    std::atomic<bool> done{false};
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < threadsCount; t++) {
+        threads.emplace_back([&done, t] {
+          for (uint64_t i = 0; i < 20000; i++) {
+              // freed slots are reused, cells must come back clean
+              ConnectionTable::Slot slot;
+              EXPECT_EQ(0u, slot.userId().load());
+              EXPECT_EQ(0u, slot.queuedFrames().load());
+              slot.userId() = 1;
+              slot.publish((t + 1) * 1000000 + i + 1);
+          }
+          done = true;
+        });
+    }
+    while (!done) {
+        const ConnectionTable::Summary summary = table.summarize(0, 0);
+        EXPECT_GE(summary.connections, before + kept.size());
+        EXPECT_LE(summary.connections, before + kept.size() + threadsCount);
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+
+    const ConnectionTable::Summary summary = table.summarize(61000, 60000);
+    ASSERT_EQ(before + kept.size(), summary.connections);
+    ASSERT_GE(summary.authorized, kept.size() / 2);
+    ASSERT_GE(summary.awaitingPong, kept.size() / 5);
+    ASSERT_GE(summary.idle, kept.size());
+    ASSERT_GE(summary.maxQueueFrames, kept.size());
+
+    kept.clear();
+    ASSERT_EQ(before, table.summarize(0, 0).connections);
+}
@@ -0,0 +1,68 @@
+/*!
+ * wsserver
+ * TestJwtAuth.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <memory>
+#include <string>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <src/base/auth/JwtAuth.h>
+#include <src/web/HttpClient.h>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+/// \brief Unpadded base64url
+std::string base64Url(const std::string &in) {
+    std::string out(4 * ((in.size() + 2) / 3) + 1, '\0');
+    const int length = EVP_EncodeBlock(reinterpret_cast<unsigned char *>(&out[0]),
+                                       reinterpret_cast<const unsigned char *>(in.data()),
+                                       static_cast<int>(in.size()));
+    out.resize(static_cast<std::size_t>(length));
+    while (!out.empty() && out.back() == '=') {
+        out.pop_back();
+    }
+    for (auto &c: out) {
+        c = c == '+' ? '-' : (c == '/' ? '_' : c);
+    }
+    return out;
+}
+
+std::string signHs256(const std::string &secret, const std::string &payload) {
+    const std::string input = base64Url(R"({"alg":"HS256","typ":"JWT"})") + "." + base64Url(payload);
+    unsigned char mac[EVP_MAX_MD_SIZE];
+    unsigned int macLength = 0;
+    HMAC(EVP_sha256(), secret.data(), static_cast<int>(secret.size()),
+         reinterpret_cast<const unsigned char *>(input.data()), input.size(), mac, &macLength);
+    return input + "." + base64Url(std::string(reinterpret_cast<const char *>(mac), macLength));
+}
+
+bool validate(const wss::Auth &auth, const std::string &token) {
+    wss::web::Request request;
+    request.addHeader("Authorization", "Bearer " + token);
+    return auth.validateAuth(request);
+}
+
+}
+
+TEST(JwtAuthTest, OnlyCanonicalBase64IsAccepted) {
+    const wss::JwtAuth auth({{"secret", "secret"}}, nullptr);
+    const std::string token = signHs256("secret", R"({"sub":"1"})");
+    // 32 bytes signature: 43 characters, last one carries 2 unused bits
+    ASSERT_TRUE(validate(auth, token));
+    ASSERT_TRUE(validate(auth, token + "="));
+
+    ASSERT_FALSE(validate(auth, token + "==")); // padding doesn't match length
+    ASSERT_FALSE(validate(auth, token + "=A")); // data after padding
+    const std::string alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    std::string unusedBits = token;
+    unusedBits.back() = alphabet[alphabet.find(unusedBits.back()) ^ 1u];
+    ASSERT_FALSE(validate(auth, unusedBits));
+    ASSERT_FALSE(validate(auth, signHs256("other", R"({"sub":"1"})")));
+}
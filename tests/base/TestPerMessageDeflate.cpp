@@ -0,0 +1,86 @@
+/*!
+ * wsserver
+ * TestPerMessageDeflate.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <cstring>
+#include <string>
+#include <zlib.h>
+#include <src/base/ws/PerMessageDeflate.hpp>
+
+#include "gtest/gtest.h"
+
+using wss::server::websocket::PerMessageDeflate;
+
+namespace {
+
+/// \brief Raw deflate of whole message, as client does
+std::string deflateMessage(const std::string &text, int flush) {
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    std::string out(deflateBound(&stream, text.size()) + 16, '\0');
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(text.data()));
+    stream.avail_in = static_cast<uInt>(text.size());
+    stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+    deflate(&stream, flush);
+    out.resize(out.size() - stream.avail_out);
+    deflateEnd(&stream);
+    if (flush == Z_SYNC_FLUSH) {
+        out.resize(out.size() - 4);
+    }
+    return out;
+}
+
+bool decompress(PerMessageDeflate &deflate, const std::string &data, std::string &out) {
+    out.clear();
+    return deflate.decompress(reinterpret_cast<const uint8_t *>(data.data()), data.size(), true, out, 1024 * 1024);
+}
+
+}
+
+TEST(PerMessageDeflateTest, MessageEndedWithFinalBlockIsInflated) {
+    PerMessageDeflate deflate{PerMessageDeflate::Params(), PerMessageDeflate::Options()};
+    const std::string text = "hello hello hello, final block";
+    std::string out;
+
+    ASSERT_TRUE(decompress(deflate, deflateMessage(text, Z_FINISH), out));
+    ASSERT_EQ(text, out);
+
+    // next message starts new stream
+    ASSERT_TRUE(decompress(deflate, deflateMessage("second", Z_SYNC_FLUSH), out));
+    ASSERT_EQ("second", out);
+    ASSERT_TRUE(decompress(deflate, deflateMessage(text, Z_FINISH), out));
+    ASSERT_EQ(text, out);
+}
+
+TEST(PerMessageDeflateTest, FinalBlockSplitIntoFragments) {
+    PerMessageDeflate deflate{PerMessageDeflate::Params(), PerMessageDeflate::Options()};
+    const std::string text(5000, 'a');
+    const std::string data = deflateMessage(text, Z_FINISH);
+    std::string out;
+
+    ASSERT_TRUE(deflate.decompress(reinterpret_cast<const uint8_t *>(data.data()), data.size(), false, out, 1 << 20));
+    ASSERT_TRUE(deflate.decompress(nullptr, 0, true, out, 1 << 20));
+    ASSERT_EQ(text, out);
+}
+
+TEST(PerMessageDeflateTest, DataAfterFinalBlockIsRejected) {
+    PerMessageDeflate deflate{PerMessageDeflate::Params(), PerMessageDeflate::Options()};
+    std::string out;
+
+    ASSERT_FALSE(decompress(deflate, deflateMessage("hello", Z_FINISH) + "garbage", out));
+
+    const std::string data = deflateMessage("hello", Z_FINISH);
+    ASSERT_TRUE(deflate.decompress(reinterpret_cast<const uint8_t *>(data.data()), data.size(), false, out, 1 << 20));
+    ASSERT_FALSE(deflate.decompress(reinterpret_cast<const uint8_t *>("x"), 1, true, out, 1 << 20));
+
+    // decompressor is usable after rejection
+    ASSERT_TRUE(decompress(deflate, deflateMessage("again", Z_SYNC_FLUSH), out));
+    ASSERT_EQ("again", out);
+}
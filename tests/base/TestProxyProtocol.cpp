@@ -0,0 +1,132 @@
+/*!
+ * wsserver
+ * TestProxyProtocol.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <string>
+#include <src/base/ws/ProxyProtocol.hpp>
+
+#include "gtest/gtest.h"
+
+using boost::asio::ip::address;
+using boost::asio::ip::tcp;
+using wss::server::websocket::ProxyProtocol;
+
+namespace {
+
+/// \brief Parses header as listener does: fixed part first, then body of announced length
+ProxyProtocol::Status parse(const std::string &header, tcp::endpoint &source) {
+    const auto *data = reinterpret_cast<const uint8_t *>(header.data());
+    std::size_t bodyBytes = 0;
+    if (header.size() < ProxyProtocol::HEADER_BYTES || !ProxyProtocol::parseHeader(data, bodyBytes)
+        || header.size() != ProxyProtocol::HEADER_BYTES + bodyBytes) {
+        return ProxyProtocol::Status::Invalid;
+    }
+    return ProxyProtocol::parseBody(data, data + ProxyProtocol::HEADER_BYTES, bodyBytes, source);
+}
+
+}
+
+TEST(ProxyProtocolTest, WrittenHeaderIsParsedBack) {
+    const tcp::endpoint client(address::from_string("203.0.113.7"), 51422);
+    const tcp::endpoint local(address::from_string("127.0.0.1"), 8085);
+    tcp::endpoint source;
+    const std::string v4 = ProxyProtocol::writeHeader(client, local);
+    ASSERT_EQ(ProxyProtocol::HEADER_BYTES + 12, v4.size());
+    ASSERT_EQ(ProxyProtocol::Status::Proxied, parse(v4, source));
+    ASSERT_EQ(client, source);
+
+    // mixed families are sent as IPv6, IPv4 one as IPv4-mapped
+    const tcp::endpoint client6(address::from_string("2001:db8::42"), 40000);
+    const std::string v6 = ProxyProtocol::writeHeader(client6, local);
+    ASSERT_EQ(ProxyProtocol::HEADER_BYTES + 36, v6.size());
+    ASSERT_EQ(ProxyProtocol::Status::Proxied, parse(v6, source));
+    ASSERT_EQ(client6, source);
+
+    const std::string mapped = ProxyProtocol::writeHeader(client, tcp::endpoint(address::from_string("::1"), 8085));
+    ASSERT_EQ(ProxyProtocol::Status::Proxied, parse(mapped, source));
+    ASSERT_EQ(address::from_string("::ffff:203.0.113.7"), source.address());
+    ASSERT_EQ(51422, source.port());
+}
+
+TEST(ProxyProtocolTest, TruncatedHeaderIsInvalid) {
+    const tcp::endpoint client(address::from_string("203.0.113.7"), 51422);
+    const tcp::endpoint local(address::from_string("127.0.0.1"), 8085);
+    tcp::endpoint source;
+    const std::string header = ProxyProtocol::writeHeader(client, local);
+    for (std::size_t size = 0; size < header.size(); size++) {
+        ASSERT_EQ(ProxyProtocol::Status::Invalid, parse(header.substr(0, size), source)) << size;
+    }
+
+    // announced length is shorter than addresses of family
+    std::string shortBody = header;
+    shortBody[15] = 8;
+    shortBody.resize(ProxyProtocol::HEADER_BYTES + 8);
+    ASSERT_EQ(ProxyProtocol::Status::Invalid, parse(shortBody, source));
+
+    std::string tooLong = header;
+    tooLong[14] = static_cast<char>((ProxyProtocol::MAX_BODY_BYTES + 1) >> 8u);
+    tooLong[15] = static_cast<char>((ProxyProtocol::MAX_BODY_BYTES + 1) & 0xFFu);
+    std::size_t bodyBytes = 0;
+    ASSERT_FALSE(ProxyProtocol::parseHeader(reinterpret_cast<const uint8_t *>(tooLong.data()), bodyBytes));
+}
+
+TEST(ProxyProtocolTest, BadSignatureIsInvalid) {
+    const tcp::endpoint client(address::from_string("203.0.113.7"), 51422);
+    const tcp::endpoint local(address::from_string("127.0.0.1"), 8085);
+    tcp::endpoint source;
+    std::string header = ProxyProtocol::writeHeader(client, local);
+    header[7] = 'X';
+    ASSERT_EQ(ProxyProtocol::Status::Invalid, parse(header, source));
+
+    // version 1 (text) header is not accepted
+    const std::string v1 = "PROXY TCP4 203.0.113.7 127.0.0.1 51422 8085\r\n";
+    ASSERT_EQ(ProxyProtocol::Status::Invalid, parse(v1, source));
+
+    // version nibble other than 2
+    header = ProxyProtocol::writeHeader(client, local);
+    header[12] = '\x11';
+    ASSERT_EQ(ProxyProtocol::Status::Invalid, parse(header, source));
+
+    // unknown command
+    header[12] = '\x2F';
+    ASSERT_EQ(ProxyProtocol::Status::Invalid, parse(header, source));
+}
+
+TEST(ProxyProtocolTest, LocalCommandKeepsPeerAddress) {
+    const tcp::endpoint peer(address::from_string("10.0.0.5"), 1234);
+    tcp::endpoint source = peer;
+
+    // health check of balancer: LOCAL command, no addresses
+    std::string local = ProxyProtocol::writeHeader(peer, peer).substr(0, ProxyProtocol::HEADER_BYTES);
+    local[12] = '\x20';
+    local[13] = '\x00';
+    local[14] = 0;
+    local[15] = 0;
+    ASSERT_EQ(ProxyProtocol::Status::Local, parse(local, source));
+    ASSERT_EQ(peer, source);
+
+    // unsupported family (unix socket) keeps peer address too
+    std::string unixFamily = ProxyProtocol::writeHeader(peer, peer);
+    unixFamily[13] = '\x31';
+    ASSERT_EQ(ProxyProtocol::Status::Local, parse(unixFamily, source));
+    ASSERT_EQ(peer, source);
+}
+
+TEST(ProxyProtocolTest, Ipv6SourceWithTlvsIsParsed) {
+    const tcp::endpoint client(address::from_string("2001:db8:1::7"), 443);
+    const tcp::endpoint local(address::from_string("2001:db8::1"), 8085);
+    tcp::endpoint source;
+    std::string header = ProxyProtocol::writeHeader(client, local);
+
+    // PP2_TYPE_NOOP TLV after addresses is skipped
+    header.append("\x04\x00\x02\x00\x00", 5);
+    header[15] = static_cast<char>(36 + 5);
+    ASSERT_EQ(ProxyProtocol::Status::Proxied, parse(header, source));
+    ASSERT_EQ(client, source);
+    ASSERT_TRUE(source.address().is_v6());
+}
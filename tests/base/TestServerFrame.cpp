@@ -0,0 +1,197 @@
+/*!
+ * wsserver
+ * TestServerFrame.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include <zlib.h>
+#include <src/base/ws/WebsocketServer.hpp>
+
+#include "gtest/gtest.h"
+
+namespace asio = boost::asio;
+using asio::ip::tcp;
+using wss::server::websocket::SocketServer;
+
+namespace {
+
+/// \brief Server running on its own thread, connections are adopted from test listener
+class ServerPeer {
+ public:
+    /// \param configure sets endpoint handlers and options before server start
+    /// \param extraHeaders additional upgrade request headers, each ends with \r\n
+    explicit ServerPeer(const std::function<void(SocketServer::Endpoint &)> &configure = nullptr,
+                        const std::string &extraHeaders = "") :
+        m_work(std::make_unique<asio::io_service::work>(*m_service)),
+        m_acceptor(m_clientService, tcp::endpoint(asio::ip::address_v4::loopback(), 0)),
+        socket(m_clientService) {
+        m_server.ioService = m_service;
+        m_server.getConfig().externalAccept = true;
+        SocketServer::Endpoint &endpoint = m_server.getEndpoint()["^/chat/?$"];
+        if (configure) {
+            configure(endpoint);
+        }
+        m_server.start();
+        m_thread = std::thread([this] { m_service->run(); });
+
+        socket.connect(m_acceptor.local_endpoint());
+        tcp::socket accepted(m_clientService);
+        m_acceptor.accept(accepted);
+        m_server.adopt(::dup(accepted.native_handle()));
+
+        const std::string request = std::string("GET /chat HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n"
+                                                "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                                                "Sec-WebSocket-Version: 13\r\n") + extraHeaders + "\r\n";
+        asio::write(socket, asio::buffer(request));
+        const std::size_t headers = asio::read_until(socket, m_input, "\r\n\r\n");
+        response.assign(asio::buffer_cast<const char *>(m_input.data()), headers);
+        m_input.consume(headers);
+    }
+
+    ~ServerPeer() {
+        m_server.stop();
+        m_work.reset();
+        m_service->stop();
+        m_thread.join();
+    }
+
+    /// \brief Sends masked client frame (zero mask)
+    void send(uint8_t finRsvOpcode, const std::string &payload, bool extendedLength = false) {
+        std::string frame(1, static_cast<char>(finRsvOpcode));
+        if (extendedLength) {
+            frame.push_back(static_cast<char>(0x80u | 126u));
+            frame.push_back(static_cast<char>(payload.size() >> 8u));
+            frame.push_back(static_cast<char>(payload.size() & 0xFFu));
+        } else {
+            frame.push_back(static_cast<char>(0x80u | payload.size()));
+        }
+        frame.append(4, '\0');
+        frame.append(payload);
+        asio::write(socket, asio::buffer(frame));
+    }
+
+    /// \brief Reads unmasked server frame of at most 125 bytes
+    /// \return first byte and payload
+    std::pair<uint8_t, std::string> read() {
+        if (m_input.size() < 2) {
+            asio::read(socket, m_input, asio::transfer_at_least(2 - m_input.size()));
+        }
+        const auto *header = asio::buffer_cast<const uint8_t *>(m_input.data());
+        const uint8_t first = header[0];
+        const std::size_t length = header[1] & 127u;
+        m_input.consume(2);
+        if (m_input.size() < length) {
+            asio::read(socket, m_input, asio::transfer_at_least(length - m_input.size()));
+        }
+        std::string payload(asio::buffer_cast<const char *>(m_input.data()), length);
+        m_input.consume(length);
+        return {first, payload};
+    }
+
+ private:
+    std::shared_ptr<asio::io_service> m_service = std::make_shared<asio::io_service>();
+    std::unique_ptr<asio::io_service::work> m_work;
+    SocketServer m_server;
+    std::thread m_thread;
+    asio::io_service m_clientService;
+    tcp::acceptor m_acceptor;
+    asio::streambuf m_input;
+
+ public:
+    tcp::socket socket;
+    std::string response;
+};
+
+int closeStatusOf(const std::pair<uint8_t, std::string> &frame) {
+    if (frame.first != 0x88u || frame.second.size() < 2) {
+        return -1;
+    }
+    return (static_cast<uint8_t>(frame.second[0]) << 8) | static_cast<uint8_t>(frame.second[1]);
+}
+
+}
+
+TEST(ServerFrameTest, PingIsAnsweredWithPong) {
+    ServerPeer peer;
+    ASSERT_EQ(0u, peer.response.find("HTTP/1.1 101"));
+
+    peer.send(0x89u, "ping");
+    const auto pong = peer.read();
+    ASSERT_EQ(0x8Au, pong.first);
+    ASSERT_EQ("ping", pong.second);
+}
+
+TEST(ServerFrameTest, LongControlFrameClosesConnection) {
+    ServerPeer peer;
+    ASSERT_EQ(0u, peer.response.find("HTTP/1.1 101"));
+
+    peer.send(0x89u, std::string(126, 'p'), true);
+    ASSERT_EQ(1002, closeStatusOf(peer.read()));
+}
+
+TEST(ServerFrameTest, FragmentedControlFrameClosesConnection) {
+    ServerPeer peer;
+    ASSERT_EQ(0u, peer.response.find("HTTP/1.1 101"));
+
+    // ping without FIN bit
+    peer.send(0x09u, "ping");
+    ASSERT_EQ(1002, closeStatusOf(peer.read()));
+}
+
+TEST(ServerFrameTest, CompressedFramesAreWrittenInCompressionOrder) {
+    using wss::server::websocket::SendPriority;
+    const std::string text = " lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor";
+    ServerPeer peer([&text](SocketServer::Endpoint &endpoint) {
+      endpoint.deflateOptions.enabled = true;
+      endpoint.deflateOptions.minSize = 0;
+      // frames queued by one strand pass: High lane is written first, though it's queued last
+      endpoint.onMessage = [&text](std::shared_ptr<SocketServer::Connection> connection,
+                                   std::shared_ptr<SocketServer::Message>) {
+        for (int i = 0; i < 3; i++) {
+            connection->send(SocketServer::Frame::create("bulk " + std::to_string(i) + text), nullptr,
+                             SendPriority::Bulk);
+        }
+        connection->send(SocketServer::Frame::create("high" + text), nullptr, SendPriority::High);
+      };
+    }, "Sec-WebSocket-Extensions: permessage-deflate\r\n");
+    ASSERT_EQ(0u, peer.response.find("HTTP/1.1 101"));
+    ASSERT_NE(std::string::npos, peer.response.find("permessage-deflate"));
+
+    peer.send(0x81u, "go");
+
+    // client inflates with context takeover, every frame by history of previous ones
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    ASSERT_EQ(Z_OK, inflateInit2(&stream, -15));
+    std::vector<std::string> messages;
+    for (int i = 0; i < 4; i++) {
+        const auto frame = peer.read();
+        ASSERT_EQ(0xC1u, frame.first);
+        std::string input = frame.second + std::string("\x00\x00\xff\xff", 4);
+        std::string out(1024, '\0');
+        stream.next_in = reinterpret_cast<Bytef *>(&input[0]);
+        stream.avail_in = static_cast<uInt>(input.size());
+        stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+        stream.avail_out = static_cast<uInt>(out.size());
+        ASSERT_EQ(Z_OK, inflate(&stream, Z_SYNC_FLUSH));
+        out.resize(out.size() - stream.avail_out);
+        messages.push_back(out);
+    }
+    inflateEnd(&stream);
+
+    ASSERT_EQ("high" + text, messages[0]);
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ("bulk " + std::to_string(i) + text, messages[i + 1]);
+    }
+}
@@ -0,0 +1,42 @@
+/*!
+ * wsserver
+ * TestUnid.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <src/base/unid.h>
+
+#include "gtest/gtest.h"
+
+TEST(UnidTest, ConcurrentNextIsUnique) {
+    // more ids than counter block, so threads take blocks concurrently many times
+    const std::size_t threadsCount = 8;
+    const std::size_t perThread = 20000;
+    std::vector<std::vector<std::string>> generated(threadsCount);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < threadsCount; t++) {
+        threads.emplace_back([&generated, t, perThread] {
+          wss::unid &generator = wss::unid::generator();
+          generated[t].reserve(perThread);
+          for (std::size_t i = 0; i < perThread; i++) {
+              generated[t].push_back(generator.next().str());
+          }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+
+    std::unordered_set<std::string> unique;
+    for (const auto &ids: generated) {
+        unique.insert(ids.begin(), ids.end());
+    }
+    ASSERT_EQ(threadsCount * perThread, unique.size());
+}
@@ -0,0 +1,65 @@
+/*!
+ * wsserver
+ * TestAckWindow.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <src/chat/AckWindow.h>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+wss::MessagePayloadPtr makeMessage() {
+    return std::make_shared<const wss::MessagePayload>(
+        std::string(R"({"type":"text","sender":1,"recipients":[2],"text":"hi"})"));
+}
+
+}
+
+TEST(AckWindowTest, ConnectionIsTrackedAfterFirstAck) {
+    wss::AckWindow window(2);
+    window.open(10);
+    ASSERT_EQ(wss::AckWindow::TrackResult::Untracked, window.track(10, makeMessage()));
+
+    ASSERT_FALSE(window.ack(10, {}));
+    const wss::MessagePayloadPtr first = makeMessage();
+    ASSERT_EQ(wss::AckWindow::TrackResult::Tracked, window.track(10, first));
+    ASSERT_EQ(wss::AckWindow::TrackResult::Tracked, window.track(10, makeMessage()));
+    ASSERT_EQ(wss::AckWindow::TrackResult::Full, window.track(10, makeMessage()));
+    ASSERT_EQ(0u, window.available(10));
+
+    // half of window is free again: deferred messages are resumed
+    ASSERT_TRUE(window.ack(10, {first->getId()}));
+    ASSERT_EQ(1u, window.available(10));
+}
+
+TEST(AckWindowTest, LateAckOfReleasedConnectionIsIgnored) {
+    wss::AckWindow window(4);
+    window.open(10);
+    ASSERT_FALSE(window.ack(10, {}));
+    const wss::MessagePayloadPtr message = makeMessage();
+    ASSERT_EQ(wss::AckWindow::TrackResult::Tracked, window.track(10, message));
+
+    std::vector<wss::MessagePayloadPtr> unacked;
+    window.release(10, unacked);
+    ASSERT_EQ(1u, unacked.size());
+    ASSERT_EQ(0u, window.getMetrics().inFlight);
+
+    // window is not created again
+    ASSERT_FALSE(window.ack(10, {message->getId()}));
+    ASSERT_EQ(wss::AckWindow::TrackResult::Untracked, window.track(10, makeMessage()));
+    unacked.clear();
+    window.release(10, unacked);
+    ASSERT_TRUE(unacked.empty());
+
+    // connection that was never opened isn't tracked by ack
+    ASSERT_FALSE(window.ack(11, {}));
+    ASSERT_EQ(wss::AckWindow::TrackResult::Untracked, window.track(11, makeMessage()));
+}
@@ -0,0 +1,156 @@
+/*!
+ * wsserver
+ * TestAttachments.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <src/chat/AttachmentStore.h>
+#include <src/chat/ChatServer.h>
+#include <src/restapi/ChatRestServer.h>
+
+#include "gtest/gtest.h"
+
+namespace asio = boost::asio;
+using asio::ip::tcp;
+
+namespace {
+
+/// \brief Reads unmasked server frame
+std::string readFrame(tcp::socket &socket, asio::streambuf &input) {
+    if (input.size() < 2) {
+        asio::read(socket, input, asio::transfer_at_least(2 - input.size()));
+    }
+    const auto *header = asio::buffer_cast<const uint8_t *>(input.data());
+    std::size_t length = header[1] & 127u;
+    std::size_t headerSize = 2;
+    if (length == 126) {
+        headerSize = 4;
+    } else if (length == 127) {
+        headerSize = 10;
+    }
+    if (input.size() < headerSize) {
+        asio::read(socket, input, asio::transfer_at_least(headerSize - input.size()));
+    }
+    header = asio::buffer_cast<const uint8_t *>(input.data());
+    if (headerSize > 2) {
+        length = 0;
+        for (std::size_t i = 2; i < headerSize; i++) {
+            length = (length << 8u) | header[i];
+        }
+    }
+    input.consume(headerSize);
+    if (input.size() < length) {
+        asio::read(socket, input, asio::transfer_at_least(length - input.size()));
+    }
+    std::string payload(asio::buffer_cast<const char *>(input.data()), length);
+    input.consume(length);
+    return payload;
+}
+
+/// \brief Masked (zero mask) text frame
+std::string textFrame(const std::string &payload) {
+    std::string frame(1, static_cast<char>(0x81u));
+    frame.push_back(static_cast<char>(0x80u | 126u));
+    frame.push_back(static_cast<char>(payload.size() >> 8u));
+    frame.push_back(static_cast<char>(payload.size() & 0xFFu));
+    frame.append(4, '\0');
+    frame.append(payload);
+    return frame;
+}
+
+unsigned short freePort() {
+    asio::io_service service;
+    tcp::acceptor acceptor(service, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    return acceptor.local_endpoint().port();
+}
+
+}
+
+TEST(AttachmentsTest, OffloadedMessageIsDeliveredByReferenceAndFetched) {
+    char directory[] = "/tmp/wss-attachments-XXXXXX";
+    ASSERT_NE(nullptr, ::mkdtemp(directory));
+    wss::AttachmentStore::Options options;
+    options.thresholdBytes = 64;
+
+    auto chat = std::make_shared<wss::ChatServer>("127.0.0.1", 0, "^/chat/?$");
+    chat->setAuth(nlohmann::json());
+    chat->setExternalAccept(true);
+    chat->setAttachmentStore(std::make_unique<wss::AttachmentStore>(directory, options));
+    const unsigned short restPort = freePort();
+    wss::ChatRestServer rest(chat, "127.0.0.1", restPort);
+    rest.setAuth(nlohmann::json());
+    chat->runService();
+    rest.runService();
+    for (int i = 0; i < 500 && !chat->isAccepting(); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_TRUE(chat->isAccepting());
+
+    // recipient connection, adopted like one passed by master process
+    asio::io_service service;
+    tcp::acceptor acceptor(service, tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+    tcp::socket socket(service);
+    socket.connect(acceptor.local_endpoint());
+    tcp::socket accepted(service);
+    acceptor.accept(accepted);
+    chat->adoptConnection(::dup(accepted.native_handle()));
+
+    asio::streambuf input;
+    const std::string request = "GET /chat?id=1 HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n"
+                                "Connection: Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+                                "Sec-WebSocket-Version: 13\r\n\r\n";
+    asio::write(socket, asio::buffer(request));
+    const std::size_t headers = asio::read_until(socket, input, "\r\n\r\n");
+    ASSERT_EQ(0u, std::string(asio::buffer_cast<const char *>(input.data()), headers).find("HTTP/1.1 101"));
+    input.consume(headers);
+
+    const std::string data = nlohmann::json{{"blob", std::string(1000, 'b')}}.dump();
+    const std::string message = R"({"type":"text","sender":2,"recipients":[1],"text":"file","data":)" + data + "}";
+    asio::write(socket, asio::buffer(textFrame(message)));
+
+    wss::MessagePayload received(readFrame(socket, input));
+    ASSERT_TRUE(received.isValid());
+    const std::string id = received.getId().str();
+    const nlohmann::json reference = {{"attachment", {{"id", id}, {"size", data.size()}}}};
+    ASSERT_EQ(reference, received.getData());
+    ASSERT_EQ(1u, chat->getAttachmentStore()->getOffloaded());
+
+    // data is available by reference
+    tcp::socket http(service);
+    boost::system::error_code ec;
+    for (int i = 0; i < 500; i++) {
+        http.close();
+        http.connect(tcp::endpoint(asio::ip::address_v4::loopback(), restPort), ec);
+        if (!ec) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    ASSERT_FALSE(ec);
+    asio::write(http, asio::buffer("GET /attachment?id=" + id + " HTTP/1.1\r\nHost: localhost\r\n\r\n"));
+    asio::streambuf response;
+    const std::size_t responseHeaders = asio::read_until(http, response, "\r\n\r\n");
+    const std::string head(asio::buffer_cast<const char *>(response.data()), responseHeaders);
+    response.consume(responseHeaders);
+    ASSERT_EQ(0u, head.find("HTTP/1.1 200"));
+    if (response.size() < data.size()) {
+        asio::read(http, response, asio::transfer_at_least(data.size() - response.size()));
+    }
+    ASSERT_EQ(data, std::string(asio::buffer_cast<const char *>(response.data()), response.size()));
+
+    rest.stopService();
+    chat->stopService();
+    rest.joinThreads();
+    chat->joinThreads();
+    ::unlink((std::string(directory) + "/" + id).c_str());
+    ::rmdir(directory);
+}
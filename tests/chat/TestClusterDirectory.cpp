@@ -0,0 +1,103 @@
+/*!
+ * wsserver
+ * TestClusterDirectory.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <algorithm>
+#include <vector>
+#include <src/chat/ClusterDirectory.h>
+
+#include "gtest/gtest.h"
+
+using wss::ClusterDirectory;
+
+TEST(ClusterDirectoryTest, StaleOfflineDoesNotHideOnline) {
+    ClusterDirectory directory;
+    directory.online(2, 100, 5);
+    // offline sent before reconnect arrives after it
+    directory.offline(2, 100, 4);
+    ASSERT_TRUE(directory.exists(100));
+
+    directory.offline(2, 100, 6);
+    ASSERT_FALSE(directory.exists(100));
+    ASSERT_EQ(0, directory.size());
+}
+
+TEST(ClusterDirectoryTest, LocateGroupsUsersByNode) {
+    ClusterDirectory directory;
+    directory.online(2, 1, 1);
+    directory.online(2, 2, 2);
+    directory.online(3, 2, 1);
+    directory.online(3, 3, 2);
+
+    const std::vector<wss::user_id_t> users = {1, 2, 3, 4};
+    std::vector<ClusterDirectory::Route> routes;
+    std::vector<wss::user_id_t> missing;
+    directory.locate(users.data(), users.size(), routes, missing);
+
+    ASSERT_EQ(2, routes.size());
+    for (auto &route: routes) {
+        std::sort(route.users.begin(), route.users.end());
+        if (route.node == 2) {
+            ASSERT_EQ(std::vector<wss::user_id_t>({1, 2}), route.users);
+        } else {
+            ASSERT_EQ(3, route.node);
+            ASSERT_EQ(std::vector<wss::user_id_t>({2, 3}), route.users);
+        }
+    }
+    ASSERT_EQ(std::vector<wss::user_id_t>({4}), missing);
+}
+
+TEST(ClusterDirectoryTest, DigestFollowsEntries) {
+    ClusterDirectory directory;
+    ClusterDirectory::Digest expected;
+    for (wss::user_id_t user = 1; user <= 10; user++) {
+        directory.online(2, user, user);
+        expected.add(user);
+    }
+    directory.offline(2, 4, 100);
+    expected.remove(4);
+    ASSERT_EQ(expected, directory.getDigest(2));
+    ASSERT_EQ(ClusterDirectory::Digest(), directory.getDigest(3));
+
+    // same count, other users
+    ClusterDirectory::Digest other;
+    for (wss::user_id_t user = 2; user <= 10; user++) {
+        other.add(user);
+    }
+    ASSERT_NE(other, directory.getDigest(2));
+
+    ASSERT_EQ(9, directory.removeNode(2));
+    ASSERT_EQ(ClusterDirectory::Digest(), directory.getDigest(2));
+    ASSERT_EQ(0, directory.size());
+}
+
+TEST(ClusterDirectoryTest, SyncDropsUsersNotRepeated) {
+    ClusterDirectory directory;
+    directory.online(2, 1, 1);
+    directory.online(2, 2, 2);
+    directory.online(3, 2, 1);
+
+    directory.beginSync(2);
+    // entries are kept while sync is in progress
+    ASSERT_TRUE(directory.exists(1));
+    directory.online(2, 2, 3);
+    directory.online(2, 5, 4);
+    ASSERT_EQ(1, directory.endSync(2));
+
+    ASSERT_FALSE(directory.exists(1));
+    ASSERT_TRUE(directory.exists(2));
+    ASSERT_TRUE(directory.exists(5));
+
+    ClusterDirectory::Digest expected;
+    expected.add(2);
+    expected.add(5);
+    ASSERT_EQ(expected, directory.getDigest(2));
+    // other node isn't touched by sync
+    directory.removeNode(2);
+    ASSERT_TRUE(directory.exists(2));
+}
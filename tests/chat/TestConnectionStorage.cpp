@@ -0,0 +1,199 @@
+/*!
+ * wsserver
+ * TestConnectionStorage.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <src/chat/ConnectionStorage.h>
+#include <src/chat/RecipientCache.h>
+#include <src/base/ws/WebsocketServer.hpp>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+wss::WsConnectionPtr createConnection(wss::io_context_service &ioContext) {
+    // not opened socket: storage never writes to connections except on destruction
+    return std::make_shared<wss::WsBase::Connection>(std::make_unique<SocketLayerWrapper>(ioContext));
+}
+
+}
+
+TEST(ConnectionStorageTest, ConcurrentAddRemoveAndLookups) {
+    wss::io_context_service ioContext;
+    wss::ConnectionStorage storage;
+    const std::size_t writersCount = 4;
+    const wss::user_id_t usersPerWriter = 200;
+    std::atomic<bool> writing(true);
+    std::atomic<std::size_t> found(0);
+
+    std::vector<std::thread> readers;
+    for (std::size_t r = 0; r < 4; r++) {
+        readers.emplace_back([&] {
+          std::vector<wss::user_id_t> ids;
+          for (wss::user_id_t id = 1; id <= writersCount * usersPerWriter; id++) {
+              ids.push_back(id);
+          }
+          wss::ConnectionStorage::Recipients recipients;
+          std::vector<bool> exists;
+          while (writing) {
+              for (wss::user_id_t id = 1; id <= writersCount * usersPerWriter; id += 7) {
+                  try {
+                      found += storage.get(id).size();
+                  } catch (const wss::ConnectionNotFound &) {
+                      // removed by writer
+                  }
+                  storage.forEach(id, [&found](size_t, const wss::WsConnectionPtr &connection, wss::conn_id_t,
+                                               wss::user_id_t) {
+                    found += connection ? 1 : 0;
+                  });
+              }
+              storage.resolve(ids.data(), ids.size(), recipients);
+              storage.exists(ids.data(), ids.size(), exists);
+              found += recipients.online.size() + storage.size();
+          }
+        });
+    }
+
+    std::vector<std::thread> writers;
+    for (std::size_t w = 0; w < writersCount; w++) {
+        writers.emplace_back([&, w] {
+          for (int round = 0; round < 20; round++) {
+              std::vector<wss::WsConnectionPtr> connections;
+              for (wss::user_id_t i = 1; i <= usersPerWriter; i++) {
+                  const wss::user_id_t id = w * usersPerWriter + i;
+                  // two devices of the same user
+                  for (int device = 0; device < 2; device++) {
+                      connections.push_back(createConnection(ioContext));
+                      storage.add(id, connections.back());
+                  }
+              }
+              for (std::size_t i = 0; i < connections.size(); i++) {
+                  if (i % 2 == 0) {
+                      storage.remove(connections[i]);
+                  } else {
+                      storage.remove(connections[i]->getId(), connections[i]->getUniqueId());
+                  }
+              }
+          }
+        });
+    }
+    for (auto &writer: writers) {
+        writer.join();
+    }
+    writing = false;
+    for (auto &reader: readers) {
+        reader.join();
+    }
+
+    ASSERT_EQ(0, storage.size());
+    ASSERT_FALSE(storage.exists(1));
+}
+
+TEST(ConnectionStorageTest, RecipientCacheInvalidatedByConnectionChange) {
+    wss::io_context_service ioContext;
+    wss::ConnectionStorage storage;
+    wss::RecipientCache cache{wss::RecipientCache::Options()};
+    std::vector<wss::WsConnectionPtr> connections;
+    std::vector<wss::user_id_t> group;
+    for (wss::user_id_t id = 1; id <= 10; id++) {
+        group.push_back(id);
+        if (id % 2 == 0) {
+            connections.push_back(createConnection(ioContext));
+            storage.add(id, connections.back());
+        }
+    }
+
+    auto first = cache.resolve(storage, group.data(), group.size(), 0);
+    ASSERT_EQ(5u, first->online.size());
+    ASSERT_EQ(5u, first->missing.size());
+
+    // the same set in other order is served from cache
+    std::vector<wss::user_id_t> reversed(group.rbegin(), group.rend());
+    auto second = cache.resolve(storage, reversed.data(), reversed.size(), 0);
+    ASSERT_EQ(first.get(), second.get());
+    ASSERT_EQ(1u, cache.getHits());
+
+    // other excluded sender is other set
+    auto excluded = cache.resolve(storage, group.data(), group.size(), 2);
+    ASSERT_EQ(4u, excluded->online.size());
+
+    connections.push_back(createConnection(ioContext));
+    storage.add(1, connections.back());
+    auto third = cache.resolve(storage, group.data(), group.size(), 0);
+    ASSERT_NE(first.get(), third.get());
+    ASSERT_EQ(6u, third->online.size());
+
+    storage.remove(connections.front());
+    auto fourth = cache.resolve(storage, group.data(), group.size(), 0);
+    ASSERT_EQ(5u, fourth->online.size());
+    ASSERT_EQ(1u, cache.getHits());
+}
+
+TEST(ConnectionStorageTest, ResolveKeepsUserDevicesAdjacent) {
+    wss::io_context_service ioContext;
+    wss::ConnectionStorage storage;
+    std::vector<wss::WsConnectionPtr> connections;
+    std::vector<wss::user_id_t> recipients;
+    for (wss::user_id_t id = 1; id <= 40; id++) {
+        recipients.push_back(id);
+        for (int device = 0; device < 3; device++) {
+            connections.push_back(createConnection(ioContext));
+            storage.add(id, connections.back());
+        }
+    }
+
+    // devices of one user are sent as one group
+    wss::ConnectionStorage::Recipients resolved;
+    storage.resolve(recipients.data(), recipients.size(), resolved);
+    ASSERT_EQ(120u, resolved.online.size());
+    std::size_t groups = 0;
+    for (std::size_t i = 0; i < resolved.online.size(); i++) {
+        if (i == 0 || resolved.online[i].user != resolved.online[i - 1].user) {
+            groups++;
+        }
+    }
+    ASSERT_EQ(40u, groups);
+}
+
+TEST(ConnectionStorageTest, PresenceBitmapAgreesWithShards) {
+    wss::io_context_service ioContext;
+    wss::ConnectionStorage storage;
+    // dense ids are answered by bitmap, large ids by shards
+    const std::vector<wss::user_id_t> users = {1, 65535, 65536, 4294967295UL, 4294967296UL, 1UL << 40};
+    std::vector<wss::WsConnectionPtr> connections;
+    for (wss::user_id_t id: users) {
+        connections.push_back(createConnection(ioContext));
+        storage.add(id, connections.back());
+    }
+
+    std::vector<wss::user_id_t> recipients = users;
+    recipients.push_back(2);
+    recipients.push_back(4294967297UL);
+    std::vector<bool> online;
+    storage.exists(recipients.data(), recipients.size(), online);
+    for (std::size_t i = 0; i < recipients.size(); i++) {
+        ASSERT_EQ(i < users.size(), online[i]) << recipients[i];
+        ASSERT_EQ(i < users.size(), storage.exists(recipients[i])) << recipients[i];
+    }
+    ASSERT_THROW(storage.get(2), wss::ConnectionNotFound);
+
+    storage.remove(connections[1]);
+    storage.remove(4294967296UL);
+    wss::ConnectionStorage::Recipients resolved;
+    storage.resolve(recipients.data(), recipients.size(), resolved, 1);
+    ASSERT_EQ(3u, resolved.online.size());
+    std::sort(resolved.missing.begin(), resolved.missing.end());
+    const std::vector<wss::user_id_t> missing = {2, 65535, 4294967296UL, 4294967297UL};
+    ASSERT_EQ(missing, resolved.missing);
+    ASSERT_FALSE(storage.exists(65535));
+    ASSERT_EQ(0u, storage.size(65535));
+}
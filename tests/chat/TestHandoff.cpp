@@ -0,0 +1,121 @@
+/*!
+ * wsserver
+ * TestHandoff.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include <src/chat/Handoff.h>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+wss::Statistics::State makeState(wss::user_id_t id) {
+    wss::Statistics::State state;
+    state.id = id;
+    state.lastConnectionTime = 1700000000 + id;
+    state.lastDisconnectionTime = 1700000100 + id;
+    state.connectedTimes = 3;
+    state.disconnectedTimes = 2;
+    state.bytesTransferred = 1ULL << 40u;
+    state.sentMessages = 17;
+    state.receivedMessages = 19;
+    state.lastMessageTime = -1;
+    return state;
+}
+
+const auto ignoreState = [](const wss::Statistics::State &) {
+  FAIL() << "unexpected state";
+};
+const auto ignoreMessage = [](std::vector<wss::user_id_t> &&, const wss::MessagePayloadPtr &, uint64_t) {
+  FAIL() << "unexpected message";
+};
+
+}
+
+TEST(HandoffTest, StatisticsAreReadBack) {
+    wss::handoff::Writer writer(wss::handoff::StatisticsKind);
+    writer.add(makeState(1));
+    writer.add(makeState(2));
+    ASSERT_EQ(2, writer.count());
+
+    std::vector<wss::Statistics::State> states;
+    wss::handoff::read(writer.getBody().data(), writer.getBody().size(), [&states](const wss::Statistics::State &s) {
+      states.push_back(s);
+    }, ignoreMessage);
+    ASSERT_EQ(2, states.size());
+    const auto expected = makeState(2);
+    ASSERT_EQ(expected.id, states[1].id);
+    ASSERT_EQ(expected.lastConnectionTime, states[1].lastConnectionTime);
+    ASSERT_EQ(expected.lastDisconnectionTime, states[1].lastDisconnectionTime);
+    ASSERT_EQ(expected.connectedTimes, states[1].connectedTimes);
+    ASSERT_EQ(expected.disconnectedTimes, states[1].disconnectedTimes);
+    ASSERT_EQ(expected.bytesTransferred, states[1].bytesTransferred);
+    ASSERT_EQ(expected.sentMessages, states[1].sentMessages);
+    ASSERT_EQ(expected.receivedMessages, states[1].receivedMessages);
+    ASSERT_EQ(expected.lastMessageTime, states[1].lastMessageTime);
+}
+
+TEST(HandoffTest, MessagesAreReadBackWithExpiry) {
+    const auto payload = std::make_shared<const wss::MessagePayload>(1, std::vector<wss::user_id_t>{2, 3}, "hello");
+    wss::handoff::Writer writer(wss::handoff::MessagesKind);
+    writer.add({2, 3}, payload, 1700000000123ULL);
+    writer.add({4}, payload, 0);
+
+    std::vector<std::vector<wss::user_id_t>> recipients;
+    std::vector<uint64_t> expiry;
+    wss::handoff::read(writer.getBody().data(), writer.getBody().size(), ignoreState,
+                       [&](std::vector<wss::user_id_t> &&users, const wss::MessagePayloadPtr &read, uint64_t at) {
+                         recipients.push_back(std::move(users));
+                         expiry.push_back(at);
+                         ASSERT_EQ(payload->getId(), read->getId());
+                         ASSERT_EQ(1, read->getSender());
+                         ASSERT_EQ("hello", read->getText());
+                       });
+    ASSERT_EQ(std::vector<std::vector<wss::user_id_t>>({{2, 3}, {4}}), recipients);
+    ASSERT_EQ(std::vector<uint64_t>({1700000000123ULL, 0}), expiry);
+}
+
+TEST(HandoffTest, ClearedWriterStartsNewBody) {
+    wss::handoff::Writer writer(wss::handoff::StatisticsKind);
+    writer.add(makeState(1));
+    const std::size_t empty = wss::handoff::Writer(wss::handoff::StatisticsKind).size();
+    writer.clear();
+    ASSERT_EQ(0, writer.count());
+    ASSERT_EQ(empty, writer.size());
+    writer.add(makeState(5));
+
+    std::vector<wss::user_id_t> ids;
+    wss::handoff::read(writer.getBody().data(), writer.getBody().size(), [&ids](const wss::Statistics::State &s) {
+      ids.push_back(s.id);
+    }, ignoreMessage);
+    ASSERT_EQ(std::vector<wss::user_id_t>({5}), ids);
+}
+
+TEST(HandoffTest, BrokenBodyThrows) {
+    wss::handoff::Writer writer(wss::handoff::StatisticsKind);
+    writer.add(makeState(1));
+    const std::string &body = writer.getBody();
+    for (std::size_t size = 0; size < body.size(); size++) {
+        ASSERT_THROW(wss::handoff::read(body.data(), size, [](const wss::Statistics::State &) { }, ignoreMessage),
+                     std::runtime_error) << size;
+    }
+
+    std::string unknown = body;
+    unknown[0] = 42;
+    ASSERT_THROW(wss::handoff::read(unknown.data(), unknown.size(), ignoreState, ignoreMessage), std::runtime_error);
+
+    const auto payload = std::make_shared<const wss::MessagePayload>(1, 2, "hello");
+    wss::handoff::Writer messages(wss::handoff::MessagesKind);
+    messages.add({2}, payload, 0);
+    std::string invalid = messages.getBody();
+    // first byte of envelope
+    invalid[invalid.size() - payload->toBinary().size()] = '\xFF';
+    ASSERT_THROW(wss::handoff::read(invalid.data(), invalid.size(), ignoreState, ignoreMessage), std::runtime_error);
+}
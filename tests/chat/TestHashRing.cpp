@@ -0,0 +1,70 @@
+/*!
+ * wsserver
+ * TestHashRing.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <map>
+#include <stdexcept>
+#include <vector>
+#include <src/chat/HashRing.h>
+
+#include "gtest/gtest.h"
+
+using wss::HashRing;
+
+TEST(HashRingTest, InvalidNodesAreRejected) {
+    ASSERT_THROW(HashRing({}, 16), std::invalid_argument);
+    ASSERT_THROW(HashRing({{1, ""}}, 0), std::invalid_argument);
+    ASSERT_THROW(HashRing({{0, ""}}, 16), std::invalid_argument);
+    ASSERT_THROW(HashRing({{1, ""}, {2, ""}, {1, ""}}, 16), std::invalid_argument);
+}
+
+TEST(HashRingTest, OrderOfNodesDoesNotMatter) {
+    const HashRing ring({{1, "a"}, {2, "b"}, {3, "c"}}, 64);
+    const HashRing reversed({{3, "c"}, {2, "b"}, {1, "a"}}, 64);
+    for (wss::user_id_t user = 1; user <= 10000; user++) {
+        ASSERT_EQ(ring.locate(user).id, reversed.locate(user).id) << user;
+    }
+    ASSERT_TRUE(ring.contains(2));
+    ASSERT_FALSE(ring.contains(4));
+    for (wss::user_id_t user = 1; user <= 100; user++) {
+        const HashRing::Node &node = ring.locate(user);
+        ASSERT_EQ(std::string(1, static_cast<char>('a' + node.id - 1)), node.url);
+    }
+}
+
+TEST(HashRingTest, UsersAreSplitEvenly) {
+    const HashRing ring({{1, ""}, {2, ""}, {3, ""}, {4, ""}}, 160);
+    std::map<wss::node_id_t, std::size_t> counts;
+    const std::size_t users = 100000;
+    for (wss::user_id_t user = 1; user <= users; user++) {
+        counts[ring.locate(user).id]++;
+    }
+    ASSERT_EQ(4, counts.size());
+    for (const auto &count: counts) {
+        // quarter +-25%
+        ASSERT_GT(count.second, users / 4 * 3 / 4) << count.first;
+        ASSERT_LT(count.second, users / 4 * 5 / 4) << count.first;
+    }
+}
+
+TEST(HashRingTest, AddedNodeTakesOnlyItsUsers) {
+    const HashRing before({{1, ""}, {2, ""}, {3, ""}}, 64);
+    const HashRing after({{1, ""}, {2, ""}, {3, ""}, {4, ""}}, 64);
+    std::size_t moved = 0;
+    for (wss::user_id_t user = 1; user <= 10000; user++) {
+        const wss::node_id_t from = before.locate(user).id;
+        const wss::node_id_t to = after.locate(user).id;
+        if (from != to) {
+            // users move only to new node, never between old ones
+            ASSERT_EQ(4, to) << user;
+            moved++;
+        }
+    }
+    ASSERT_GT(moved, 0);
+    ASSERT_LT(moved, 10000 / 2);
+}
@@ -0,0 +1,45 @@
+/*!
+ * wsserver
+ * TestMessagePayload.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <thread>
+#include <vector>
+#include <src/chat/Message.h>
+
+#include "gtest/gtest.h"
+
+TEST(MessagePayloadTest, ConcurrentSerializationIsCachedOnce) {
+    // same payload is serialized by all recipients' io threads when message is fanned out
+    const wss::MessagePayload payload(1, std::vector<wss::user_id_t>{2, 3, 4}, std::string(512, 'x'));
+    const std::size_t threadsCount = 8;
+    std::vector<const std::string *> jsonData(threadsCount), binaryData(threadsCount);
+    std::vector<wss::SerializedCache::Buffer> buffers(threadsCount);
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < threadsCount; t++) {
+        threads.emplace_back([&, t] {
+          for (int i = 0; i < 1000; i++) {
+              jsonData[t] = &payload.toJson();
+              binaryData[t] = &payload.toBinary();
+              buffers[t] = payload.getJsonBuffer();
+          }
+        });
+    }
+    for (auto &thread: threads) {
+        thread.join();
+    }
+
+    ASSERT_FALSE(payload.toJson().empty());
+    ASSERT_FALSE(payload.toBinary().empty());
+    for (std::size_t t = 0; t < threadsCount; t++) {
+        // every thread got the same cached buffer, not its own serialization
+        ASSERT_EQ(jsonData[0], jsonData[t]);
+        ASSERT_EQ(binaryData[0], binaryData[t]);
+        ASSERT_EQ(buffers[0], buffers[t]);
+        ASSERT_EQ(payload.toJson(), *buffers[t]);
+    }
+}
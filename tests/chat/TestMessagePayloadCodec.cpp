@@ -0,0 +1,119 @@
+/*!
+ * wsserver
+ * TestMessagePayloadCodec.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <string>
+#include <vector>
+#include <src/chat/Message.h>
+#include <src/chat/PayloadCodec.h>
+
+#include "gtest/gtest.h"
+
+TEST(MessagePayloadTest, DeliverAtSurvivesJsonAndBinary) {
+    const wss::MessagePayload parsed(
+        std::string(R"({"type":"text","sender":1,"recipients":[2],"text":"hi","ttl":60,"deliverAt":1893456000000})"));
+    ASSERT_TRUE(parsed.isValid());
+    ASSERT_EQ(1893456000000u, parsed.getDeliverAt());
+
+    const wss::MessagePayload restored(parsed.toJson());
+    ASSERT_EQ(1893456000000u, restored.getDeliverAt());
+
+    const std::string &binary = parsed.toBinary();
+    const wss::MessagePayload decoded = wss::MessagePayload::fromBinary(binary.data(), binary.size());
+    ASSERT_TRUE(decoded.isValid());
+    ASSERT_EQ(1893456000000u, decoded.getDeliverAt());
+    ASSERT_EQ(60u, decoded.getTtl());
+
+    const wss::MessagePayload invalid(
+        std::string(R"({"type":"text","sender":1,"recipients":[2],"text":"","deliverAt":"x"})"));
+    ASSERT_FALSE(invalid.isValid());
+}
+
+TEST(MessagePayloadTest, BatchingCodecsJoinDecodableBatches) {
+    // 30 items: past msgpack fixarray and cbor inline count limits
+    std::vector<wss::MessagePayload> payloads;
+    for (int i = 0; i < 30; i++) {
+        payloads.emplace_back(std::string(R"({"type":"text","sender":1,"recipients":[2],"text":"m)")
+                                  + std::to_string(i) + "\"}");
+        ASSERT_TRUE(payloads.back().isValid());
+    }
+
+    for (const char *name: {"wss.json.v1+batch", "wss.binary.v1+batch", "wss.msgpack.v1+batch", "wss.cbor.v1+batch"}) {
+        const auto codec = wss::codec::registry::createByName(name);
+        ASSERT_TRUE(codec != nullptr) << name;
+        ASSERT_TRUE(codec->isBatching());
+        ASSERT_STREQ(name, codec->getName());
+
+        std::vector<std::string> encoded;
+        wss::PayloadCodec::EncodedItems items;
+        for (const auto &payload: payloads) {
+            encoded.push_back(codec->encode(payload));
+        }
+        for (const auto &item: encoded) {
+            items.emplace_back(item.data(), item.size());
+        }
+
+        const std::string batch = codec->encodeBatch(items);
+        ASSERT_EQ(payloads.size(), codec->countBatch(batch.data(), batch.size())) << name;
+        ASSERT_EQ(0u, codec->countBatch(encoded[0].data(), encoded[0].size())) << name;
+        std::vector<wss::MessagePayload> decoded;
+        ASSERT_TRUE(codec->decodeBatch(batch.data(), batch.size(), decoded)) << name;
+        ASSERT_EQ(payloads.size(), decoded.size()) << name;
+        for (std::size_t i = 0; i < decoded.size(); i++) {
+            ASSERT_EQ("m" + std::to_string(i), decoded[i].getText()) << name;
+        }
+    }
+
+    ASSERT_TRUE(wss::codec::registry::createByName("wss.json.v1+batch+batch") == nullptr);
+}
+
+TEST(MessagePayloadTest, BatchIsCountedWithoutDecoding) {
+    const wss::JsonCodec json;
+    const auto count = [&json](const std::string &data) {
+      return json.countBatch(data.data(), data.size());
+    };
+    ASSERT_EQ(0u, count(R"({"type":"text"})"));
+    ASSERT_EQ(0u, count(" [ ] "));
+    ASSERT_EQ(1u, count("[1]"));
+    // separators and brackets inside strings and nested containers are not items
+    ASSERT_EQ(3u, count(R"( [{"text":"a,b]\",c","list":[1,2,{"x":[3]}]}, "[,]", 5] )"));
+    ASSERT_THROW(count(R"([{"text":"a"}, {"text":)"), wss::InvalidPayloadException);
+
+    const wss::CborCodec cbor;
+    // indefinite length array
+    const std::string indefinite("\x9F\xFF", 2);
+    ASSERT_THROW(cbor.countBatch(indefinite.data(), indefinite.size()), wss::InvalidPayloadException);
+    const std::string truncated("\x99\x01", 2);
+    ASSERT_THROW(cbor.countBatch(truncated.data(), truncated.size()), wss::InvalidPayloadException);
+}
+
+TEST(MessagePayloadTest, DataIsKeptAsTextOnEveryParsePath) {
+    const wss::json data = {{"ids", {"a", "b"}}, {"nested", {{"n", 1.5}, {"list", {1, 2, 3}}}}};
+    const wss::json obj = {{"type", "text"}, {"sender", 1}, {"recipients", {2}}, {"text", "hi"}, {"data", data}};
+
+    // DOM path (codecs) and text path give the same data text
+    const wss::MessagePayload fromDom(obj);
+    const wss::MessagePayload fromText(obj.dump());
+    ASSERT_TRUE(fromDom.isValid());
+    ASSERT_TRUE(fromText.isValid());
+    ASSERT_EQ(data.dump(), fromDom.getDataText());
+    ASSERT_EQ(data.dump(), fromText.getDataText());
+    ASSERT_EQ(data, fromDom.getData());
+    ASSERT_EQ(data, wss::json::parse(fromDom.toJson()).at("data"));
+
+    wss::MessagePayload copy = fromDom;
+    ASSERT_EQ(data.dump(), copy.getDataText());
+    copy.setData(nullptr);
+    ASSERT_TRUE(copy.getData().is_null());
+    ASSERT_EQ(0u, copy.getDataSize());
+    ASSERT_EQ(wss::json(nullptr), wss::json::parse(copy.toJson()).at("data"));
+
+    const std::string &binary = fromDom.toBinary();
+    const wss::MessagePayload decoded = wss::MessagePayload::fromBinary(binary.data(), binary.size());
+    ASSERT_EQ(data, decoded.getData());
+}
@@ -0,0 +1,97 @@
+/*!
+ * wsserver
+ * TestStatisticsStorage.cpp
+ *
+ * \date   2026
+ * \author Eduard Maximovich (edward.vstock@gmail.com)
+ * \link   https://github.com/edwardstock
+ */
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <src/chat/StatisticsStorage.h>
+
+#include "gtest/gtest.h"
+
+TEST(StatisticsStorageTest, ConcurrentUpdatesAndSnapshots) {
+    wss::StatisticsStorage storage;
+    const std::size_t writersCount = 8;
+    const wss::user_id_t usersCount = 500;
+    const std::size_t messagesPerWriter = 20000;
+    std::atomic<bool> writing(true);
+
+    std::vector<std::thread> readers;
+    for (std::size_t r = 0; r < 2; r++) {
+        readers.emplace_back([&] {
+          while (writing) {
+              std::size_t sent = 0;
+              for (const auto &stat: storage.snapshot()) {
+                  sent += stat->getSentMessages();
+              }
+              bool more = false;
+              const auto page = storage.page(usersCount / 2, 50, [](const wss::Statistics &stat) {
+                return stat.getSentMessages() > 0;
+              }, more);
+              ASSERT_LE(page.size(), 50u);
+              ASSERT_LE(sent, writersCount * messagesPerWriter);
+          }
+        });
+    }
+
+    std::vector<std::thread> writers;
+    for (std::size_t w = 0; w < writersCount; w++) {
+        writers.emplace_back([&, w] {
+          for (std::size_t i = 0; i < messagesPerWriter; i++) {
+              // users are shared between writers: new user creation races with updates of the same shard
+              storage.get(1 + (i * writersCount + w) % usersCount)->addSendMessage();
+          }
+        });
+    }
+    for (auto &writer: writers) {
+        writer.join();
+    }
+    writing = false;
+    for (auto &reader: readers) {
+        reader.join();
+    }
+
+    std::size_t sent = 0;
+    for (const auto &stat: storage.snapshot()) {
+        sent += stat->getSentMessages();
+    }
+    ASSERT_EQ(usersCount, storage.size());
+    ASSERT_EQ(writersCount * messagesPerWriter, sent);
+}
+
+TEST(StatisticsStorageTest, ExpireOfflineUsers) {
+    wss::StatisticsStorage storage;
+    const time_t now = wss::utils::CoarseClock::now();
+    const auto setIdle = [&](wss::user_id_t id, time_t idleSeconds, std::size_t connections) {
+      wss::Statistics::State state{};
+      state.id = id;
+      state.lastConnectionTime = now - idleSeconds;
+      state.lastDisconnectionTime = now - idleSeconds;
+      state.connectedTimes = connections;
+      state.disconnectedTimes = 1;
+      state.lastMessageTime = now - idleSeconds;
+      storage.get(id)->setState(state);
+    };
+    setIdle(1, 100, 1);
+    setIdle(2, 1000, 1);
+    // online
+    setIdle(3, 5000, 2);
+    setIdle(4, 5000, 1);
+    // held by connection
+    const wss::StatisticsStorage::StatisticsPtr held = storage.find(4);
+
+    ASSERT_EQ(1u, storage.expire(500, 0));
+    ASSERT_EQ(3u, storage.size());
+    ASSERT_EQ(nullptr, storage.find(2));
+
+    // online and held users are over limit, but can't be removed
+    ASSERT_EQ(1u, storage.expire(0, 1));
+    ASSERT_EQ(nullptr, storage.find(1));
+    ASSERT_NE(nullptr, storage.find(3));
+    ASSERT_NE(nullptr, storage.find(4));
+}